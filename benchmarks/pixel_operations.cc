@@ -0,0 +1,367 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmarks of the single color conversion operations and pixel operations.
+// Every benchmark reports the throughput as 'bytes_per_cycle', computed from the pixel data size
+// of the input image and the nominal clock frequency of the CPU.
+// Use --benchmark_filter to select a subset, e.g. --benchmark_filter='Op_YCbCr420.*1920x1080'.
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "libheif/color-conversion/colorconversion.h"
+#include "libheif/pixelimage.h"
+
+#if WITH_UNCOMPRESSED_CODEC
+#include "libheif/uncompressed_image.h"
+#endif
+
+
+struct ImageSize
+{
+  int width;
+  int height;
+};
+
+// A block that stays in the cache (the size of the speed cost calibration) and a full HD frame.
+static const ImageSize kImageSizes[] = {{256, 64},
+                                        {1920, 1080}};
+
+
+static std::string get_state_name(const ColorState& state)
+{
+  std::stringstream sstr;
+  sstr << state.colorspace << "_" << state.chroma << "_" << state.bits_per_pixel;
+  if (state.has_alpha) {
+    sstr << "_alpha";
+  }
+
+  return sstr.str();
+}
+
+
+static std::string get_size_name(const ImageSize& size)
+{
+  return std::to_string(size.width) + "x" + std::to_string(size.height);
+}
+
+
+static void set_throughput_counters(benchmark::State& state, size_t bytes_per_iteration)
+{
+  auto bytes = static_cast<int64_t>(bytes_per_iteration) * static_cast<int64_t>(state.iterations());
+  state.SetBytesProcessed(bytes);
+
+  // A rate is divided by the measured seconds, which gives bytes / (seconds * cycles_per_second).
+  double cycles_per_second = benchmark::CPUInfo::Get().cycles_per_second;
+  state.counters["bytes_per_cycle"] = benchmark::Counter(static_cast<double>(bytes) / cycles_per_second,
+                                                         benchmark::Counter::kIsRate);
+}
+
+
+// --- color conversion operations
+
+static void BM_ColorConversion(benchmark::State& state, const ColorConversionOperation* op,
+                               ColorState input_state, ColorState output_state, ImageSize size)
+{
+  heif_color_conversion_options options{};
+  options.version = 1;
+  options.preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average;
+  options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear;
+  options.only_use_preferred_chroma_algorithm = false;
+
+  auto input = ColorConversionPipeline::create_calibration_image(size.width, size.height, input_state);
+  if (!input) {
+    state.SkipWithError("cannot create input image");
+    return;
+  }
+
+  for (auto _ : state) {
+    auto output = op->convert_colorspace(input, output_state, options);
+    if (!output) {
+      state.SkipWithError("conversion failed");
+      return;
+    }
+
+    benchmark::DoNotOptimize(output);
+  }
+
+  set_throughput_counters(state, input->get_pixel_data_size());
+}
+
+
+// Registers every transition that the pipeline search can take between the calibration states,
+// i.e. all input states of all operations, at every bit depth and chroma of these states.
+static void register_color_conversion_benchmarks()
+{
+  heif_color_conversion_options options{};
+  options.version = 1;
+  options.preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average;
+  options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear;
+  options.only_use_preferred_chroma_algorithm = false;
+
+  std::vector<ColorState> states = ColorConversionPipeline::get_calibration_states();
+
+  for (const auto* op : ColorConversionPipeline::get_operations()) {
+    std::string op_name = get_operation_name(op);
+    std::set<std::tuple<int, int, bool, int, int, int, bool, int>> registered;
+
+    for (const auto& input_state : states) {
+      for (const auto& target_state : states) {
+        for (auto out_state : op->state_after_conversion(input_state, target_state, options)) {
+          ColorState output_state = out_state.color_state;
+          if (output_state == input_state || !ColorConversionPipeline::is_valid_image_state(output_state)) {
+            continue;
+          }
+
+          if (!registered.emplace(input_state.colorspace, input_state.chroma, input_state.has_alpha,
+                                  input_state.bits_per_pixel,
+                                  output_state.colorspace, output_state.chroma, output_state.has_alpha,
+                                  output_state.bits_per_pixel).second) {
+            continue;
+          }
+
+          // Some operations take the output nclx parameters from the target state.
+          output_state.nclx_profile = target_state.nclx_profile;
+
+          for (const auto& size : kImageSizes) {
+            std::string name = "ColorConversion/" + op_name + "/" + get_state_name(input_state) + "_to_" +
+                               get_state_name(output_state) + "/" + get_size_name(size);
+
+            benchmark::RegisterBenchmark(name.c_str(), BM_ColorConversion, op, input_state, output_state, size);
+          }
+        }
+      }
+    }
+  }
+}
+
+
+// --- pixel operations
+
+static std::vector<ColorState> get_pixel_operation_states()
+{
+  std::vector<ColorState> states;
+
+  for (const auto& state : ColorConversionPipeline::get_calibration_states()) {
+    // The float formats are only produced by the color conversion.
+    if (state.bits_per_pixel <= 16 && state.chroma != heif_chroma_interleaved_RGB_HALF &&
+        state.chroma != heif_chroma_interleaved_RGBA_HALF) {
+      states.push_back(state);
+    }
+  }
+
+  return states;
+}
+
+
+static void BM_ScaleNearestNeighbor(benchmark::State& state, ColorState image_state, ImageSize size)
+{
+  auto input = ColorConversionPipeline::create_calibration_image(size.width, size.height, image_state);
+
+  for (auto _ : state) {
+    std::shared_ptr<HeifPixelImage> output;
+    Error err = input->scale_nearest_neighbor(output, size.width / 2, size.height / 2);
+    if (err) {
+      state.SkipWithError(err.message.c_str());
+      return;
+    }
+
+    benchmark::DoNotOptimize(output);
+  }
+
+  set_throughput_counters(state, input->get_pixel_data_size());
+}
+
+
+static void BM_RotateAndMirror(benchmark::State& state, ColorState image_state, ImageSize size,
+                               int angle, bool mirror)
+{
+  auto input = ColorConversionPipeline::create_calibration_image(size.width, size.height, image_state);
+
+  for (auto _ : state) {
+    std::shared_ptr<HeifPixelImage> output;
+    Error err = input->rotate_and_mirror(angle, mirror, output);
+    if (err) {
+      state.SkipWithError(err.message.c_str());
+      return;
+    }
+
+    benchmark::DoNotOptimize(output);
+  }
+
+  set_throughput_counters(state, input->get_pixel_data_size());
+}
+
+
+// crop() shares the pixel memory with the input. This measures the crop together with the copy
+// that is made when the cropped image is written to.
+static void BM_Crop(benchmark::State& state, ColorState image_state, ImageSize size)
+{
+  auto input = ColorConversionPipeline::create_calibration_image(size.width, size.height, image_state);
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    std::shared_ptr<HeifPixelImage> output;
+    Error err = input->crop(size.width / 4, size.width * 3 / 4 - 1, size.height / 4, size.height * 3 / 4 - 1, output);
+    if (err) {
+      state.SkipWithError(err.message.c_str());
+      return;
+    }
+
+    for (heif_channel channel : output->get_channel_set()) {
+      int stride;
+      benchmark::DoNotOptimize(output->get_plane(channel, &stride));
+    }
+
+    bytes = output->get_pixel_data_size();
+  }
+
+  set_throughput_counters(state, bytes);
+}
+
+
+static void BM_Overlay(benchmark::State& state, ColorState image_state, ImageSize size)
+{
+  // overlay() only supports 8-bit planar images. The overlay covers the centered quarter of the canvas.
+  auto canvas = ColorConversionPipeline::create_calibration_image(size.width, size.height, image_state);
+  auto overlay = ColorConversionPipeline::create_calibration_image(size.width / 2, size.height / 2, image_state);
+
+  for (auto _ : state) {
+    Error err = canvas->overlay(overlay, size.width / 4, size.height / 4);
+    if (err) {
+      state.SkipWithError(err.message.c_str());
+      return;
+    }
+
+    benchmark::ClobberMemory();
+  }
+
+  set_throughput_counters(state, overlay->get_pixel_data_size());
+}
+
+
+static void register_pixel_operation_benchmarks()
+{
+  for (const auto& image_state : get_pixel_operation_states()) {
+    for (const auto& size : kImageSizes) {
+      std::string suffix = "/" + get_state_name(image_state) + "/" + get_size_name(size);
+
+      benchmark::RegisterBenchmark(("ScaleNearestNeighbor" + suffix).c_str(), BM_ScaleNearestNeighbor,
+                                   image_state, size);
+
+      for (int angle : {90, 180, 270}) {
+        // 4:2:2 images cannot be rotated by 90 degrees.
+        if (image_state.chroma == heif_chroma_422 && angle != 180) {
+          continue;
+        }
+
+        benchmark::RegisterBenchmark(("Rotate" + std::to_string(angle) + suffix).c_str(), BM_RotateAndMirror,
+                                     image_state, size, angle, false);
+      }
+
+      benchmark::RegisterBenchmark(("Mirror" + suffix).c_str(), BM_RotateAndMirror, image_state, size, 0, true);
+
+      benchmark::RegisterBenchmark(("Crop" + suffix).c_str(), BM_Crop, image_state, size);
+
+      if (image_state.bits_per_pixel == 8 && image_state.chroma != heif_chroma_interleaved_RGB &&
+          image_state.chroma != heif_chroma_interleaved_RGBA &&
+          image_state.chroma != heif_chroma_420_NV12 && image_state.chroma != heif_chroma_420_NV21) {
+        benchmark::RegisterBenchmark(("Overlay" + suffix).c_str(), BM_Overlay, image_state, size);
+      }
+    }
+  }
+}
+
+
+#if WITH_UNCOMPRESSED_CODEC
+
+// --- deinterleaving of 'uncC' pixel-interleaved rows
+
+static void BM_Deinterleave(benchmark::State& state, uint32_t num_components, int bytes_per_sample,
+                            bool little_endian, ImageSize size)
+{
+  auto width = static_cast<uint32_t>(size.width);
+  size_t row_size = width * num_components * bytes_per_sample;
+
+  std::vector<uint8_t> src(row_size * size.height);
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = static_cast<uint8_t>(i * 7);
+  }
+
+  std::vector<std::vector<uint8_t>> planes(num_components, std::vector<uint8_t>(width * bytes_per_sample));
+  std::vector<uint8_t*> dst;
+  for (auto& plane : planes) {
+    dst.push_back(plane.data());
+  }
+
+  for (auto _ : state) {
+    for (int y = 0; y < size.height; y++) {
+      deinterleave_row(src.data() + y * row_size, dst.data(), num_components, width, bytes_per_sample, little_endian);
+    }
+
+    benchmark::ClobberMemory();
+  }
+
+  set_throughput_counters(state, src.size());
+}
+
+
+static void register_deinterleave_benchmarks()
+{
+  for (uint32_t num_components : {1, 3, 4}) {
+    for (int bytes_per_sample : {1, 2}) {
+      for (const auto& size : kImageSizes) {
+        std::string name = "Deinterleave/" + std::to_string(num_components) + "x" + std::to_string(bytes_per_sample * 8) +
+                           "bit/" + get_size_name(size);
+
+        benchmark::RegisterBenchmark(name.c_str(), BM_Deinterleave, num_components, bytes_per_sample, false, size);
+      }
+    }
+  }
+}
+
+#endif
+
+
+int main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+
+  register_color_conversion_benchmarks();
+  register_pixel_operation_benchmarks();
+#if WITH_UNCOMPRESSED_CODEC
+  register_deinterleave_benchmarks();
+#endif
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  return 0;
+}
@@ -2,29 +2,76 @@
 set -e
 DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
 
+# Build variants (can be combined):
+#   USE_WASM_THREADS=1  Decode the tiles of grid images in parallel on worker threads. This needs
+#                       SharedArrayBuffer, i.e. a cross-origin isolated page (COOP/COEP headers),
+#                       and the generated libheif.worker.js next to libheif.js.
+#                       WASM_THREADS sets the number of decoding threads (default: 4).
+#   USE_WASM_SIMD=1     Use WebAssembly SIMD for the color conversion and other pixel operations.
+# Without these, a single-threaded build is made that runs on all browsers.
+
 CORES=$(nproc --all)
 echo "Build using ${CORES} CPU cores"
 
+WASM_THREADS=${WASM_THREADS:-4}
+LEGACY_VM_SUPPORT=1
+VARIANT=""
+COMPILE_FLAGS=""
+LIBDE265_FLAGS=""
+LINK_FLAGS=""
+CONFIGURE_ARGS="-DWITH_GDK_PIXBUF=OFF -DWITH_EXAMPLES=OFF -DBUILD_SHARED_LIBS=ON"
+
+if [ "${USE_WASM_THREADS}" = "1" ]; then
+    echo "Building with ${WASM_THREADS} decoding threads"
+    VARIANT="${VARIANT}-threads"
+    COMPILE_FLAGS="${COMPILE_FLAGS} -pthread -DHEIF_JS_DECODING_THREADS=${WASM_THREADS}"
+    LIBDE265_FLAGS="${LIBDE265_FLAGS} -pthread"
+    LINK_FLAGS="${LINK_FLAGS} -pthread -s PTHREAD_POOL_SIZE=${WASM_THREADS}"
+    CONFIGURE_ARGS="${CONFIGURE_ARGS} -DENABLE_MULTITHREADING_SUPPORT=ON"
+    LEGACY_VM_SUPPORT=0
+else
+    CONFIGURE_ARGS="${CONFIGURE_ARGS} -DENABLE_MULTITHREADING_SUPPORT=OFF"
+fi
+
+if [ "${USE_WASM_SIMD}" = "1" ]; then
+    echo "Building with WebAssembly SIMD"
+    VARIANT="${VARIANT}-simd"
+    # The SSE4.1 kernels of libheif are translated to WebAssembly SIMD by Emscripten.
+    COMPILE_FLAGS="${COMPILE_FLAGS} -msimd128 -msse4.1"
+    LIBDE265_FLAGS="${LIBDE265_FLAGS} -msimd128"
+    LINK_FLAGS="${LINK_FLAGS} -msimd128"
+    LEGACY_VM_SUPPORT=0
+fi
+
 LIBDE265_VERSION=1.0.8
+LIBDE265_DIR="libde265-${LIBDE265_VERSION}${VARIANT}"
 [ -s "libde265-${LIBDE265_VERSION}.tar.gz" ] || curl \
     -L \
     -o libde265-${LIBDE265_VERSION}.tar.gz \
     https://github.com/strukturag/libde265/releases/download/v${LIBDE265_VERSION}/libde265-${LIBDE265_VERSION}.tar.gz
-if [ ! -s "libde265-${LIBDE265_VERSION}/libde265/.libs/libde265.so" ]; then
-    tar xf libde265-${LIBDE265_VERSION}.tar.gz
-    cd libde265-${LIBDE265_VERSION}
+if [ ! -s "${LIBDE265_DIR}/libde265/.libs/libde265.so" ]; then
+    # Each variant needs its own build of libde265, the object files must use the same features.
+    rm -rf "${LIBDE265_DIR}" "libde265-${LIBDE265_VERSION}.tmp"
+    mkdir "libde265-${LIBDE265_VERSION}.tmp"
+    tar xf libde265-${LIBDE265_VERSION}.tar.gz -C "libde265-${LIBDE265_VERSION}.tmp"
+    mv "libde265-${LIBDE265_VERSION}.tmp/libde265-${LIBDE265_VERSION}" "${LIBDE265_DIR}"
+    rmdir "libde265-${LIBDE265_VERSION}.tmp"
+    cd "${LIBDE265_DIR}"
     [ -x configure ] || ./autogen.sh
-    emconfigure ./configure --disable-sse --disable-dec265 --disable-sherlock265
+    CFLAGS="${LIBDE265_FLAGS}" CXXFLAGS="${LIBDE265_FLAGS}" \
+        emconfigure ./configure --disable-sse --disable-dec265 --disable-sherlock265
     emmake make -j${CORES}
     cd ..
 fi
 
-CONFIGURE_ARGS="-DENABLE_MULTITHREADING_SUPPORT=OFF -DWITH_GDK_PIXBUF=OFF -DWITH_EXAMPLES=OFF -DBUILD_SHARED_LIBS=ON"
-#export PKG_CONFIG_PATH="${DIR}/libde265-${LIBDE265_VERSION}"
+#export PKG_CONFIG_PATH="${DIR}/${LIBDE265_DIR}"
 
+# The flags are always passed, so that switching between the variants updates the CMake cache.
 emcmake cmake $CONFIGURE_ARGS \
-    -DLIBDE265_INCLUDE_DIR="${DIR}/libde265-${LIBDE265_VERSION}" \
-    -DLIBDE265_LIBRARY="-L${DIR}/libde265-${LIBDE265_VERSION}/libde265/.libs"
+    -DCMAKE_C_FLAGS="${COMPILE_FLAGS}" \
+    -DCMAKE_CXX_FLAGS="${COMPILE_FLAGS}" \
+    -DLIBDE265_INCLUDE_DIR="${DIR}/${LIBDE265_DIR}" \
+    -DLIBDE265_LIBRARY="-L${DIR}/${LIBDE265_DIR}/libde265/.libs"
 emmake make -j${CORES}
 
 export TOTAL_MEMORY=16777216
@@ -42,11 +89,12 @@ emcc libheif/libheif.so \
     -s PRECISE_F32=0 \
     -s DISABLE_EXCEPTION_CATCHING=1 \
     -s USE_CLOSURE_COMPILER=0 \
-    -s LEGACY_VM_SUPPORT=1 \
+    -s LEGACY_VM_SUPPORT=${LEGACY_VM_SUPPORT} \
+    ${LINK_FLAGS} \
     --memory-init-file 0 \
     -O3 \
     -std=c++11 \
-    -L${DIR}/libde265-${LIBDE265_VERSION}/libde265/.libs \
+    -L${DIR}/${LIBDE265_DIR}/libde265/.libs \
     -lde265 \
     --pre-js pre.js \
     --post-js post.js \
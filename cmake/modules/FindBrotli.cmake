@@ -0,0 +1,30 @@
+include(LibFindMacros)
+
+libfind_pkg_check_modules(BROTLI_DEC_PKGCONF libbrotlidec)
+libfind_pkg_check_modules(BROTLI_ENC_PKGCONF libbrotlienc)
+
+find_path(BROTLI_INCLUDE_DIR
+    NAMES brotli/decode.h brotli/encode.h
+    HINTS ${BROTLI_DEC_PKGCONF_INCLUDE_DIRS} ${BROTLI_DEC_PKGCONF_INCLUDEDIR}
+)
+
+find_library(BROTLI_DEC_LIBRARY
+    NAMES brotlidec
+    HINTS ${BROTLI_DEC_PKGCONF_LIBRARY_DIRS} ${BROTLI_DEC_PKGCONF_LIBDIR}
+)
+
+find_library(BROTLI_ENC_LIBRARY
+    NAMES brotlienc
+    HINTS ${BROTLI_ENC_PKGCONF_LIBRARY_DIRS} ${BROTLI_ENC_PKGCONF_LIBDIR}
+)
+
+set(BROTLI_PROCESS_LIBS BROTLI_DEC_LIBRARY BROTLI_ENC_LIBRARY)
+set(BROTLI_PROCESS_INCLUDES BROTLI_INCLUDE_DIR)
+libfind_process(BROTLI)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Brotli
+    REQUIRED_VARS
+        BROTLI_INCLUDE_DIR
+        BROTLI_LIBRARIES
+)
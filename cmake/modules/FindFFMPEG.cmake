@@ -0,0 +1,36 @@
+include(LibFindMacros)
+
+libfind_pkg_check_modules(FFMPEG_AVCODEC_PKGCONF libavcodec)
+libfind_pkg_check_modules(FFMPEG_AVUTIL_PKGCONF libavutil)
+
+find_path(FFMPEG_INCLUDE_DIR
+    NAMES libavcodec/avcodec.h libavutil/hwcontext.h
+    HINTS ${FFMPEG_AVCODEC_PKGCONF_INCLUDE_DIRS} ${FFMPEG_AVCODEC_PKGCONF_INCLUDEDIR}
+)
+
+find_library(FFMPEG_AVCODEC_LIBRARY
+    NAMES libavcodec avcodec
+    HINTS ${FFMPEG_AVCODEC_PKGCONF_LIBRARY_DIRS} ${FFMPEG_AVCODEC_PKGCONF_LIBDIR}
+)
+
+find_library(FFMPEG_AVUTIL_LIBRARY
+    NAMES libavutil avutil
+    HINTS ${FFMPEG_AVUTIL_PKGCONF_LIBRARY_DIRS} ${FFMPEG_AVUTIL_PKGCONF_LIBDIR}
+)
+
+if(EXISTS "${FFMPEG_INCLUDE_DIR}/libavutil/hwcontext.h" AND FFMPEG_AVCODEC_LIBRARY AND FFMPEG_AVUTIL_LIBRARY)
+    set(FFMPEG_DECODER_FOUND YES)
+else()
+    set(FFMPEG_DECODER_FOUND NO)
+endif()
+
+set(FFMPEG_PROCESS_LIBS FFMPEG_AVCODEC_LIBRARY FFMPEG_AVUTIL_LIBRARY)
+set(FFMPEG_PROCESS_INCLUDES FFMPEG_INCLUDE_DIR)
+libfind_process(FFMPEG)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(FFMPEG
+    REQUIRED_VARS
+        FFMPEG_INCLUDE_DIR
+        FFMPEG_LIBRARIES
+)
@@ -0,0 +1,29 @@
+include(LibFindMacros)
+libfind_pkg_check_modules(LIBJPEG_PKGCONF libjpeg)
+
+find_path(LIBJPEG_INCLUDE_DIR
+    NAMES jpeglib.h
+    HINTS ${LIBJPEG_PKGCONF_INCLUDE_DIRS} ${LIBJPEG_PKGCONF_INCLUDEDIR}
+)
+
+find_library(LIBJPEG_LIBRARY
+    NAMES libjpeg jpeg
+    HINTS ${LIBJPEG_PKGCONF_LIBRARY_DIRS} ${LIBJPEG_PKGCONF_LIBDIR}
+)
+
+if(LIBJPEG_INCLUDE_DIR AND LIBJPEG_LIBRARY)
+    set(JPEG_DECODER_FOUND YES)
+else()
+    set(JPEG_DECODER_FOUND NO)
+endif()
+
+set(LIBJPEG_PROCESS_LIBS LIBJPEG_LIBRARY)
+set(LIBJPEG_PROCESS_INCLUDES LIBJPEG_INCLUDE_DIR)
+libfind_process(LIBJPEG)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LIBJPEG
+    REQUIRED_VARS
+        LIBJPEG_INCLUDE_DIR
+        LIBJPEG_LIBRARIES
+)
@@ -21,6 +21,465 @@
 #include "benchmark.h"
 #include "libheif/heif.h"
 #include <math.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
+
+
+// The SIMD code computes squared differences and sums with 16-bit multiplications into 32-bit lanes.
+// These do not overflow up to this bit depth. Deeper planes are processed with the scalar code.
+static const int kMaxSIMDBitDepth = 12;
+
+
+struct Plane
+{
+  const uint8_t* data;
+  size_t stride;
+  int width;
+  int height;
+  bool wide; // 16-bit samples (bit depth > 8)
+};
+
+
+static inline int get_sample(const uint8_t* row, int x, bool wide)
+{
+  return wide ? reinterpret_cast<const uint16_t*>(row)[x] : row[x];
+}
+
+
+// Calls f(begin, end, tile) for tiles of the range [0;n) on separate threads.
+// Returns the number of tiles.
+template <typename F>
+static int run_in_tiles(int n, int num_threads, const F& f)
+{
+  int num_tiles = std::max(1, std::min(n, num_threads));
+
+  std::vector<std::thread> threads;
+  for (int tile = 1; tile < num_tiles; tile++) {
+    threads.emplace_back(f, n * tile / num_tiles, n * (tile + 1) / num_tiles, tile);
+  }
+
+  f(0, n / num_tiles, 0);
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  return num_tiles;
+}
+
+
+// --- PSNR
+
+static uint64_t sum_squared_error_row(const uint8_t* a, const uint8_t* b, int width, bool wide, int bit_depth)
+{
+  uint64_t sum = 0;
+  int x = 0;
+
+#if HAVE_SSE2
+  if (bit_depth <= kMaxSIMDBitDepth) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+
+    for (; x + 8 <= width; x += 8) {
+      __m128i va, vb;
+      if (wide) {
+        va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 2 * x));
+        vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 2 * x));
+      }
+      else {
+        va = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + x)), zero);
+        vb = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + x)), zero);
+      }
+
+      __m128i d = _mm_sub_epi16(va, vb);
+      __m128i sq = _mm_madd_epi16(d, d);
+      acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+      acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    sum = lanes[0] + lanes[1];
+  }
+#else
+  (void) bit_depth;
+#endif
+
+  for (; x < width; x++) {
+    int64_t d = get_sample(a, x, wide) - get_sample(b, x, wide);
+    sum += static_cast<uint64_t>(d * d);
+  }
+
+  return sum;
+}
+
+
+static double compute_plane_psnr(const Plane& a, const Plane& b, int bit_depth, int num_threads)
+{
+  std::vector<uint64_t> tile_sums(static_cast<size_t>(num_threads), 0);
+
+  int num_tiles = run_in_tiles(a.height, num_threads, [&](int begin, int end, int tile) {
+    uint64_t sum = 0;
+    for (int y = begin; y < end; y++) {
+      sum += sum_squared_error_row(a.data + y * a.stride, b.data + y * b.stride, a.width, a.wide, bit_depth);
+    }
+
+    tile_sums[tile] = sum;
+  });
+
+  uint64_t sum = 0;
+  for (int i = 0; i < num_tiles; i++) {
+    sum += tile_sums[i];
+  }
+
+  if (sum == 0) {
+    return kMaxPSNR;
+  }
+
+  double max_value = (1 << bit_depth) - 1;
+  double mse = static_cast<double>(sum) / (static_cast<double>(a.width) * a.height);
+  return std::min(kMaxPSNR, 10 * log10(max_value * max_value / mse));
+}
+
+
+// --- SSIM
+//
+// The statistics are computed in windows of 8x8 samples at a distance of 4 samples (as in libvpx).
+// The sums of all 4x4 blocks are computed first, such that every sample is read only once. Each
+// window is then the sum of 2x2 blocks.
+
+struct BlockSums
+{
+  uint64_t a, b, aa, bb, ab;
+};
+
+
+static void compute_block_sums_row(const Plane& a, const Plane& b, int bit_depth, int by, BlockSums* out)
+{
+  int num_blocks = a.width / 4;
+  const uint8_t* row_a = a.data + 4 * by * a.stride;
+  const uint8_t* row_b = b.data + 4 * by * b.stride;
+
+  int bx = 0;
+
+#if HAVE_SSE2
+  if (bit_depth <= kMaxSIMDBitDepth) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    // two blocks at a time
+    for (; bx + 2 <= num_blocks; bx += 2) {
+      __m128i sum_a = zero, sum_b = zero, sum_aa = zero, sum_bb = zero, sum_ab = zero;
+
+      for (int y = 0; y < 4; y++) {
+        const uint8_t* pa = row_a + y * a.stride;
+        const uint8_t* pb = row_b + y * b.stride;
+
+        __m128i va, vb;
+        if (a.wide) {
+          va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + 8 * bx));
+          vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + 8 * bx));
+        }
+        else {
+          va = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pa + 4 * bx)), zero);
+          vb = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pb + 4 * bx)), zero);
+        }
+
+        sum_a = _mm_add_epi32(sum_a, _mm_madd_epi16(va, ones));
+        sum_b = _mm_add_epi32(sum_b, _mm_madd_epi16(vb, ones));
+        sum_aa = _mm_add_epi32(sum_aa, _mm_madd_epi16(va, va));
+        sum_bb = _mm_add_epi32(sum_bb, _mm_madd_epi16(vb, vb));
+        sum_ab = _mm_add_epi32(sum_ab, _mm_madd_epi16(va, vb));
+      }
+
+      // lanes 0 and 1 belong to the first block, lanes 2 and 3 to the second block
+      uint32_t lanes[5][4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[0]), sum_a);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[1]), sum_b);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[2]), sum_aa);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[3]), sum_bb);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[4]), sum_ab);
+
+      for (int i = 0; i < 2; i++) {
+        BlockSums& s = out[bx + i];
+        s.a = lanes[0][2 * i] + lanes[0][2 * i + 1];
+        s.b = lanes[1][2 * i] + lanes[1][2 * i + 1];
+        s.aa = lanes[2][2 * i] + lanes[2][2 * i + 1];
+        s.bb = lanes[3][2 * i] + lanes[3][2 * i + 1];
+        s.ab = lanes[4][2 * i] + lanes[4][2 * i + 1];
+      }
+    }
+  }
+#else
+  (void) bit_depth;
+#endif
+
+  for (; bx < num_blocks; bx++) {
+    BlockSums s{0, 0, 0, 0, 0};
+
+    for (int y = 0; y < 4; y++) {
+      const uint8_t* pa = row_a + y * a.stride;
+      const uint8_t* pb = row_b + y * b.stride;
+
+      for (int x = 4 * bx; x < 4 * bx + 4; x++) {
+        uint64_t sa = static_cast<uint64_t>(get_sample(pa, x, a.wide));
+        uint64_t sb = static_cast<uint64_t>(get_sample(pb, x, b.wide));
+        s.a += sa;
+        s.b += sb;
+        s.aa += sa * sa;
+        s.bb += sb * sb;
+        s.ab += sa * sb;
+      }
+    }
+
+    out[bx] = s;
+  }
+}
+
+
+struct SSIMStatistics
+{
+  double mean_ssim;
+  double mean_contrast_structure;
+};
+
+
+// The planes have to be at least 8x8 samples large.
+static SSIMStatistics compute_ssim_statistics(const Plane& a, const Plane& b, int bit_depth, int num_threads)
+{
+  int blocks_w = a.width / 4;
+  int blocks_h = a.height / 4;
+
+  std::vector<BlockSums> blocks(static_cast<size_t>(blocks_w) * blocks_h);
+
+  run_in_tiles(blocks_h, num_threads, [&](int begin, int end, int) {
+    for (int by = begin; by < end; by++) {
+      compute_block_sums_row(a, b, bit_depth, by, &blocks[static_cast<size_t>(by) * blocks_w]);
+    }
+  });
+
+  const double n = 64;
+  const double max_value = (1 << bit_depth) - 1;
+  const double c1 = (0.01 * max_value * n) * (0.01 * max_value * n);
+  const double c2 = (0.03 * max_value * n) * (0.03 * max_value * n);
+
+  int windows_w = blocks_w - 1;
+  int windows_h = blocks_h - 1;
+
+  std::vector<double> tile_ssim(static_cast<size_t>(num_threads), 0.0);
+  std::vector<double> tile_cs(static_cast<size_t>(num_threads), 0.0);
+
+  int num_tiles = run_in_tiles(windows_h, num_threads, [&](int begin, int end, int tile) {
+    double sum_ssim = 0;
+    double sum_cs = 0;
+
+    for (int wy = begin; wy < end; wy++) {
+      const BlockSums* top = &blocks[static_cast<size_t>(wy) * blocks_w];
+      const BlockSums* bottom = top + blocks_w;
+
+      for (int wx = 0; wx < windows_w; wx++) {
+        auto sum = [&](uint64_t BlockSums::* field) {
+          return static_cast<double>(top[wx].*field + top[wx + 1].*field + bottom[wx].*field + bottom[wx + 1].*field);
+        };
+
+        double s_a = sum(&BlockSums::a);
+        double s_b = sum(&BlockSums::b);
+        double s_aa = sum(&BlockSums::aa);
+        double s_bb = sum(&BlockSums::bb);
+        double s_ab = sum(&BlockSums::ab);
+
+        double luminance = (2 * s_a * s_b + c1) / (s_a * s_a + s_b * s_b + c1);
+        double contrast_structure = (2 * (n * s_ab - s_a * s_b) + c2) /
+                                    (n * s_aa - s_a * s_a + n * s_bb - s_b * s_b + c2);
+
+        sum_ssim += luminance * contrast_structure;
+        sum_cs += contrast_structure;
+      }
+    }
+
+    tile_ssim[tile] = sum_ssim;
+    tile_cs[tile] = sum_cs;
+  });
+
+  double sum_ssim = 0;
+  double sum_cs = 0;
+  for (int i = 0; i < num_tiles; i++) {
+    sum_ssim += tile_ssim[i];
+    sum_cs += tile_cs[i];
+  }
+
+  double num_windows = static_cast<double>(windows_w) * windows_h;
+  return {sum_ssim / num_windows, sum_cs / num_windows};
+}
+
+
+// Halves the size of the plane by averaging 2x2 samples.
+static Plane downsample_plane(const Plane& in, std::vector<uint16_t>& buffer, int num_threads)
+{
+  Plane out{};
+  out.width = in.width / 2;
+  out.height = in.height / 2;
+  out.stride = static_cast<size_t>(out.width) * 2;
+  out.wide = true;
+
+  buffer.resize(static_cast<size_t>(out.width) * out.height);
+
+  run_in_tiles(out.height, num_threads, [&](int begin, int end, int) {
+    for (int y = begin; y < end; y++) {
+      const uint8_t* row0 = in.data + 2 * y * in.stride;
+      const uint8_t* row1 = row0 + in.stride;
+      uint16_t* out_row = &buffer[static_cast<size_t>(y) * out.width];
+
+      for (int x = 0; x < out.width; x++) {
+        int sum = get_sample(row0, 2 * x, in.wide) + get_sample(row0, 2 * x + 1, in.wide) +
+                  get_sample(row1, 2 * x, in.wide) + get_sample(row1, 2 * x + 1, in.wide);
+        out_row[x] = static_cast<uint16_t>((sum + 2) / 4);
+      }
+    }
+  });
+
+  out.data = reinterpret_cast<const uint8_t*>(buffer.data());
+  return out;
+}
+
+
+// MS-SSIM (Wang, Simoncelli, Bovik 2003) with the weights of the paper. Small images use fewer
+// scales, such that the smallest scale is still at least 8x8 samples large.
+static void compute_ssim(const Plane& a, const Plane& b, int bit_depth, int num_threads,
+                         double& ssim, double& ms_ssim)
+{
+  static const double weights[] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+  const int max_scales = 5;
+
+  if (a.width < 8 || a.height < 8) {
+    ssim = 1.0;
+    ms_ssim = 1.0;
+    return;
+  }
+
+  int num_scales = 1;
+  while (num_scales < max_scales &&
+         (a.width >> num_scales) >= 8 && (a.height >> num_scales) >= 8) {
+    num_scales++;
+  }
+
+  double weight_sum = 0;
+  for (int i = 0; i < num_scales; i++) {
+    weight_sum += weights[i];
+  }
+
+  Plane scale_a = a;
+  Plane scale_b = b;
+  std::vector<uint16_t> buffer_a[2], buffer_b[2];
+
+  double log_ms_ssim = 0;
+
+  for (int scale = 0; scale < num_scales; scale++) {
+    SSIMStatistics stats = compute_ssim_statistics(scale_a, scale_b, bit_depth, num_threads);
+
+    if (scale == 0) {
+      ssim = stats.mean_ssim;
+    }
+
+    // The luminance term is only included at the coarsest scale.
+    double value = (scale == num_scales - 1) ? stats.mean_ssim : stats.mean_contrast_structure;
+    log_ms_ssim += weights[scale] / weight_sum * log(std::max(value, 1e-10));
+
+    if (scale + 1 < num_scales) {
+      scale_a = downsample_plane(scale_a, buffer_a[scale % 2], num_threads);
+      scale_b = downsample_plane(scale_b, buffer_b[scale % 2], num_threads);
+    }
+  }
+
+  ms_ssim = exp(log_ms_ssim);
+}
+
+
+heif_error compute_quality_metrics(const heif_image* reference, const heif_image* distorted,
+                                   QualityMetrics& metrics, int num_threads)
+{
+  metrics = QualityMetrics();
+
+  if (num_threads <= 0) {
+    num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  }
+
+  heif_colorspace colorspace = heif_image_get_colorspace(reference);
+  heif_chroma chroma = heif_image_get_chroma_format(reference);
+
+  if (colorspace != heif_image_get_colorspace(distorted) ||
+      chroma != heif_image_get_chroma_format(distorted) ||
+      heif_image_get_primary_width(reference) != heif_image_get_primary_width(distorted) ||
+      heif_image_get_primary_height(reference) != heif_image_get_primary_height(distorted)) {
+    return {heif_error_Usage_error, heif_suberror_Unspecified, "Images have different formats or sizes"};
+  }
+
+  std::vector<heif_channel> channels;
+  heif_channel luma_channel;
+
+  if (colorspace == heif_colorspace_YCbCr &&
+      (chroma == heif_chroma_420 || chroma == heif_chroma_422 || chroma == heif_chroma_444)) {
+    channels = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr};
+    luma_channel = heif_channel_Y;
+  }
+  else if (colorspace == heif_colorspace_RGB && chroma == heif_chroma_444) {
+    channels = {heif_channel_R, heif_channel_G, heif_channel_B};
+    luma_channel = heif_channel_G;
+  }
+  else if (colorspace == heif_colorspace_monochrome) {
+    channels = {heif_channel_Y};
+    luma_channel = heif_channel_Y;
+  }
+  else {
+    return {heif_error_Usage_error, heif_suberror_Unsupported_color_conversion,
+            "Quality metrics can only be computed on planar images"};
+  }
+
+  if (heif_image_has_channel(reference, heif_channel_Alpha) &&
+      heif_image_has_channel(distorted, heif_channel_Alpha)) {
+    channels.push_back(heif_channel_Alpha);
+  }
+
+  for (heif_channel channel : channels) {
+    int bit_depth = heif_image_get_bits_per_pixel_range(reference, channel);
+    if (bit_depth < 1 || bit_depth > 16 || bit_depth != heif_image_get_bits_per_pixel_range(distorted, channel)) {
+      return {heif_error_Usage_error, heif_suberror_Unsupported_bit_depth,
+              "Planes must have equal bit depths of up to 16 bits"};
+    }
+
+    Plane planes[2];
+    const heif_image* images[2] = {reference, distorted};
+    for (int i = 0; i < 2; i++) {
+      int stride;
+      planes[i].data = heif_image_get_plane_readonly(images[i], channel, &stride);
+      planes[i].stride = static_cast<size_t>(stride);
+      planes[i].width = heif_image_get_width(images[i], channel);
+      planes[i].height = heif_image_get_height(images[i], channel);
+      planes[i].wide = (bit_depth > 8);
+    }
+
+    if (!planes[0].data || !planes[1].data) {
+      return {heif_error_Usage_error, heif_suberror_Unspecified, "Images have different planes"};
+    }
+
+    metrics.planes.push_back({channel, compute_plane_psnr(planes[0], planes[1], bit_depth, num_threads)});
+
+    if (channel == luma_channel) {
+      compute_ssim(planes[0], planes[1], bit_depth, num_threads, metrics.ssim, metrics.ms_ssim);
+    }
+  }
+
+  return {heif_error_Ok, heif_suberror_Unspecified, "Success"};
+}
 
 
 double compute_psnr(heif_image* original_image, const std::string& encoded_file)
@@ -33,21 +492,7 @@ double compute_psnr(heif_image* original_image, const std::string& encoded_file)
   struct heif_image_handle* handle = nullptr;
   struct heif_image* image = nullptr;
   heif_error err{};
-
-  int orig_stride = 0;
-  const uint8_t* orig_p = nullptr;
-  int compressed_stride = 0;
-  const uint8_t* compressed_p = nullptr;
-
-  int w = 0, h = 0;
-  double mse = 0.0;
-
-
-  if (heif_image_get_colorspace(original_image) != heif_colorspace_YCbCr &&
-      heif_image_get_colorspace(original_image) != heif_colorspace_monochrome) {
-    fprintf(stderr, "Benchmark can only be computed on YCbCr or monochrome images\n");
-    goto cleanup;
-  }
+  QualityMetrics metrics;
 
 
   ctx = heif_context_alloc();
@@ -73,22 +518,13 @@ double compute_psnr(heif_image* original_image, const std::string& encoded_file)
     goto cleanup;
   }
 
-  w = heif_image_get_width(original_image, heif_channel_Y);
-  h = heif_image_get_height(original_image, heif_channel_Y);
-
-  orig_p = heif_image_get_plane_readonly(original_image, heif_channel_Y, &orig_stride);
-  compressed_p = heif_image_get_plane_readonly(image, heif_channel_Y, &compressed_stride);
-
-  for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w; x++) {
-      int d = orig_p[y * orig_stride + x] - compressed_p[y * compressed_stride + x];
-      mse += d * d;
-    }
+  err = compute_quality_metrics(original_image, image, metrics);
+  if (err.code) {
+    fprintf(stderr, "Benchmark cannot be computed: %s\n", err.message);
+    goto cleanup;
   }
 
-  mse /= w * h;
-
-  psnr = 10 * log10(255.0 * 255.0 / mse);
+  psnr = metrics.planes[0].psnr;
 
   cleanup:
   heif_image_release(image);
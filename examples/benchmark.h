@@ -18,15 +18,42 @@
  * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-
 #ifndef LIBHEIF_BENCHMARK_H
 #define LIBHEIF_BENCHMARK_H
 
 #include <memory>
 #include <string>
+#include <vector>
+
+#include "libheif/heif.h"
+
+
+// PSNR of the planes of identical images.
+static const double kMaxPSNR = 100.0;
+
+struct PlaneQuality
+{
+  heif_channel channel;
+  double psnr;
+};
+
+struct QualityMetrics
+{
+  // PSNR in dB of all planes, in the order Y, Cb, Cr (or R, G, B) and alpha.
+  std::vector<PlaneQuality> planes;
+
+  // SSIM and MS-SSIM of the luma plane (Y, or G of RGB images).
+  double ssim = 0.0;
+  double ms_ssim = 0.0;
+};
 
-struct heif_image;
+// Compares two images with the same size, colorspace, planar chroma format (interleaved formats are
+// not supported) and bit depths (8 to 16 bits). The planes are split into tiles of rows that are
+// processed in parallel on 'num_threads' threads (0: one per core).
+heif_error compute_quality_metrics(const heif_image* reference, const heif_image* distorted,
+                                   QualityMetrics& metrics, int num_threads = 0);
 
+// PSNR of the Y plane of the primary image in 'encoded_file'. Returns 0 if it cannot be computed.
 double compute_psnr(heif_image* original_image, const std::string& encoded_file);
 
 #endif //LIBHEIF_BENCHMARK_H
@@ -215,6 +215,103 @@ bool ReadEXIFFromJPEG(j_decompress_ptr cinfo,
 }
 
 
+// Returns the chroma format of a YCbCr JPEG whose planes can be stored in a heif_image without resampling,
+// or heif_chroma_undefined for other sampling factors (e.g. 4:1:1) and other color spaces.
+static heif_chroma get_raw_jpeg_chroma(const struct jpeg_decompress_struct& cinfo)
+{
+  if (cinfo.jpeg_color_space != JCS_YCbCr || cinfo.num_components != 3) {
+    return heif_chroma_undefined;
+  }
+
+  const jpeg_component_info* comp = cinfo.comp_info;
+  if (comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1 ||
+      comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1) {
+    return heif_chroma_undefined;
+  }
+
+  if (comp[0].h_samp_factor == 2 && comp[0].v_samp_factor == 2) {
+    return heif_chroma_420;
+  }
+  else if (comp[0].h_samp_factor == 2 && comp[0].v_samp_factor == 1) {
+    return heif_chroma_422;
+  }
+  else if (comp[0].h_samp_factor == 1 && comp[0].v_samp_factor == 1) {
+    return heif_chroma_444;
+  }
+  else {
+    return heif_chroma_undefined;
+  }
+}
+
+
+// Reads the Y, Cb, Cr planes in their coded resolution with jpeg_read_raw_data(). This skips the chroma
+// upsampling in libjpeg and the subsequent downsampling to 4:2:0.
+static void read_raw_jpeg_planes(struct jpeg_decompress_struct& cinfo, struct heif_image* image)
+{
+  const heif_channel channels[3] = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr};
+
+  // libjpeg writes complete blocks, i.e. up to 7 samples beyond the plane width and whole iMCU rows
+  // beyond the image height. We decode into buffers of one iMCU row and copy the visible part.
+  std::vector<std::vector<JSAMPLE>> buffers(3);
+  std::vector<std::vector<JSAMPROW>> rows(3);
+  JSAMPARRAY component_rows[3];
+
+  for (int c = 0; c < 3; c++) {
+    const jpeg_component_info& comp = cinfo.comp_info[c];
+    size_t buffer_width = (size_t) comp.width_in_blocks * DCTSIZE + (size_t) comp.h_samp_factor * DCTSIZE;
+    int num_rows = comp.v_samp_factor * DCTSIZE;
+
+    buffers[c].resize(buffer_width * num_rows);
+    rows[c].resize(num_rows);
+    for (int r = 0; r < num_rows; r++) {
+      rows[c][r] = buffers[c].data() + r * buffer_width;
+    }
+
+    component_rows[c] = rows[c].data();
+  }
+
+  int iMCU_row = 0;
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JDIMENSION num_lines = jpeg_read_raw_data(&cinfo, component_rows, cinfo.max_v_samp_factor * DCTSIZE);
+    if (num_lines == 0) {
+      break;
+    }
+
+    for (int c = 0; c < 3; c++) {
+      int stride;
+      uint8_t* plane = heif_image_get_plane(image, channels[c], &stride);
+      int plane_width = heif_image_get_width(image, channels[c]);
+      int plane_height = heif_image_get_height(image, channels[c]);
+
+      int num_rows = cinfo.comp_info[c].v_samp_factor * DCTSIZE;
+      int first_row = iMCU_row * num_rows;
+
+      for (int r = 0; r < num_rows && first_row + r < plane_height; r++) {
+        memcpy(plane + (size_t) (first_row + r) * stride, rows[c][r], plane_width);
+      }
+    }
+
+    iMCU_row++;
+  }
+}
+
+
+// JPEG (JFIF) stores YCbCr with the BT.601 matrix in full range.
+static void set_jpeg_nclx_profile(struct heif_image* image)
+{
+  struct heif_color_profile_nclx* nclx = heif_nclx_color_profile_alloc();
+  if (!nclx) {
+    return;
+  }
+
+  nclx->matrix_coefficients = heif_matrix_coefficients_ITU_R_BT_601_6;
+  nclx->full_range_flag = 1;
+
+  heif_image_set_nclx_color_profile(image, nclx);
+  heif_nclx_color_profile_free(nclx);
+}
+
+
 InputImage loadJPEG(const char* filename)
 {
   InputImage img;
@@ -268,6 +365,8 @@ InputImage loadJPEG(const char* filename)
     img.orientation = (heif_orientation) read_exif_orientation_tag(exifData.data(), (int) exifData.size());
   }
 
+  heif_chroma raw_chroma = get_raw_jpeg_chroma(cinfo);
+
   if (cinfo.jpeg_color_space == JCS_GRAYSCALE) {
     cinfo.out_color_space = JCS_GRAYSCALE;
 
@@ -301,6 +400,32 @@ InputImage loadJPEG(const char* filename)
       memcpy(py + (cinfo.output_scanline - 1) * y_stride, *buffer, cinfo.output_width);
     }
   }
+  else if (raw_chroma != heif_chroma_undefined) {
+    cinfo.out_color_space = JCS_YCbCr;
+    cinfo.raw_data_out = TRUE;
+
+    jpeg_start_decompress(&cinfo);
+
+
+    // create destination image with the subsampling of the JPEG
+
+    struct heif_error err = heif_image_create(cinfo.output_width, cinfo.output_height,
+                                              heif_colorspace_YCbCr,
+                                              raw_chroma,
+                                              &image);
+    (void) err;
+
+    int chroma_width = cinfo.comp_info[1].downsampled_width;
+    int chroma_height = cinfo.comp_info[1].downsampled_height;
+
+    heif_image_add_plane(image, heif_channel_Y, cinfo.output_width, cinfo.output_height, 8);
+    heif_image_add_plane(image, heif_channel_Cb, chroma_width, chroma_height, 8);
+    heif_image_add_plane(image, heif_channel_Cr, chroma_width, chroma_height, 8);
+
+    set_jpeg_nclx_profile(image);
+
+    read_raw_jpeg_planes(cinfo, image);
+  }
   else {
     cinfo.out_color_space = JCS_YCbCr;
 
@@ -323,6 +448,8 @@ InputImage loadJPEG(const char* filename)
     heif_image_add_plane(image, heif_channel_Cb, (cinfo.output_width + 1) / 2, (cinfo.output_height + 1) / 2, 8);
     heif_image_add_plane(image, heif_channel_Cr, (cinfo.output_width + 1) / 2, (cinfo.output_height + 1) / 2, 8);
 
+    set_jpeg_nclx_profile(image);
+
     int y_stride;
     int cb_stride;
     int cr_stride;
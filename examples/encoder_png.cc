@@ -25,8 +25,12 @@
 */
 #include <cerrno>
 #include <png.h>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <cstdlib>
+#include <thread>
 #include <vector>
 
 #include "encoder_png.h"
@@ -34,6 +38,235 @@
 
 PngEncoder::PngEncoder() = default;
 
+
+PngEncoder::PngEncoder(int compression_level, bool fast_filtering, int num_threads)
+    : compression_level_(compression_level),
+      fast_filtering_(fast_filtering),
+      num_threads_(std::max(num_threads, 1))
+{
+  if (compression_level_ < -1 || compression_level_ > 9) {
+    compression_level_ = -1;
+  }
+}
+
+
+// --- PNG row filters (for the parallel compression, libpng filters the rows itself otherwise)
+
+enum
+{
+  kFilterNone = 0, kFilterSub = 1, kFilterUp = 2, kFilterAverage = 3, kFilterPaeth = 4
+};
+
+
+static uint8_t paeth_predictor(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+
+  if (pa <= pb && pa <= pc) {
+    return (uint8_t) a;
+  }
+  else if (pb <= pc) {
+    return (uint8_t) b;
+  }
+  else {
+    return (uint8_t) c;
+  }
+}
+
+
+// 'prev' is nullptr for the first row of the image. 'out' receives the filter type byte and the filtered row.
+static void filter_row(int filter, const uint8_t* row, const uint8_t* prev, size_t row_bytes, int bpp, uint8_t* out)
+{
+  out[0] = (uint8_t) filter;
+  out++;
+
+  for (size_t i = 0; i < row_bytes; i++) {
+    int a = (i >= (size_t) bpp) ? row[i - bpp] : 0;
+    int b = prev ? prev[i] : 0;
+    int c = (prev && i >= (size_t) bpp) ? prev[i - bpp] : 0;
+
+    switch (filter) {
+      case kFilterSub:
+        out[i] = (uint8_t) (row[i] - a);
+        break;
+      case kFilterUp:
+        out[i] = (uint8_t) (row[i] - b);
+        break;
+      case kFilterAverage:
+        out[i] = (uint8_t) (row[i] - ((a + b) >> 1));
+        break;
+      case kFilterPaeth:
+        out[i] = (uint8_t) (row[i] - paeth_predictor(a, b, c));
+        break;
+      default:
+        out[i] = row[i];
+        break;
+    }
+  }
+}
+
+
+// Chooses the filter with the smallest sum of absolute (signed) residuals, which is also the heuristic of libpng.
+static void filter_row_adaptive(const uint8_t* row, const uint8_t* prev, size_t row_bytes, int bpp,
+                                uint8_t* out, std::vector<uint8_t>& scratch)
+{
+  scratch.resize(row_bytes + 1);
+
+  uint64_t best_sum = UINT64_MAX;
+
+  for (int filter = kFilterNone; filter <= kFilterPaeth; filter++) {
+    filter_row(filter, row, prev, row_bytes, bpp, scratch.data());
+
+    uint64_t sum = 0;
+    for (size_t i = 1; i <= row_bytes; i++) {
+      sum += (uint64_t) abs((int8_t) scratch[i]);
+    }
+
+    if (sum < best_sum) {
+      best_sum = sum;
+      memcpy(out, scratch.data(), row_bytes + 1);
+    }
+  }
+}
+
+
+struct CompressedStrip
+{
+  std::vector<uint8_t> data;
+  uLong adler = 0;
+  size_t uncompressed_size = 0;
+  bool success = false;
+};
+
+
+// Filters and compresses the rows [first_row, end_row) into a raw deflate stream. All strips except the last one
+// end with a sync flush, so that the strips can be concatenated into one zlib stream.
+static void compress_strip(uint8_t** row_pointers, int first_row, int end_row, size_t row_bytes, int bpp,
+                           bool fast_filtering, int compression_level, bool last_strip, CompressedStrip& strip)
+{
+  std::vector<uint8_t> filtered((row_bytes + 1) * (end_row - first_row));
+  std::vector<uint8_t> scratch;
+
+  for (int y = first_row; y < end_row; y++) {
+    const uint8_t* prev = (y > 0) ? row_pointers[y - 1] : nullptr;
+    uint8_t* out = &filtered[(row_bytes + 1) * (y - first_row)];
+
+    if (fast_filtering) {
+      filter_row(kFilterSub, row_pointers[y], prev, row_bytes, bpp, out);
+    }
+    else {
+      filter_row_adaptive(row_pointers[y], prev, row_bytes, bpp, out, scratch);
+    }
+  }
+
+  strip.uncompressed_size = filtered.size();
+  strip.adler = adler32(0L, Z_NULL, 0);
+  strip.adler = adler32(strip.adler, filtered.data(), (uInt) filtered.size());
+
+  z_stream strm{};
+  if (deflateInit2(&strm, compression_level, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK) {
+    return;
+  }
+
+  strip.data.resize(deflateBound(&strm, filtered.size()) + 64);
+
+  strm.next_in = filtered.data();
+  strm.avail_in = (uInt) filtered.size();
+  strm.next_out = strip.data.data();
+  strm.avail_out = (uInt) strip.data.size();
+
+  int ret = deflate(&strm, last_strip ? Z_FINISH : Z_SYNC_FLUSH);
+  bool complete = last_strip ? (ret == Z_STREAM_END) : (ret == Z_OK && strm.avail_in == 0 && strm.avail_out > 0);
+
+  strip.data.resize(strm.total_out);
+  deflateEnd(&strm);
+
+  strip.success = complete;
+}
+
+
+bool PngEncoder::WriteParallelIDAT(png_structp png_ptr, uint8_t** row_pointers, int height, size_t row_bytes,
+                                   int bytes_per_pixel) const
+{
+  // Strips of at least 16 rows, with a few strips per thread to balance the load.
+  const int kMinRowsPerStrip = 16;
+  int num_strips = std::max(std::min(height / kMinRowsPerStrip, num_threads_ * 4), 1);
+
+  std::vector<CompressedStrip> strips(num_strips);
+  std::atomic<int> next_strip(0);
+
+  auto compress_strips = [&]() {
+    for (int s = next_strip++; s < num_strips; s = next_strip++) {
+      int first_row = (int) ((int64_t) height * s / num_strips);
+      int end_row = (int) ((int64_t) height * (s + 1) / num_strips);
+      compress_strip(row_pointers, first_row, end_row, row_bytes, bytes_per_pixel, fast_filtering_,
+                     compression_level_, s == num_strips - 1, strips[s]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < std::min(num_threads_, num_strips); i++) {
+    threads.emplace_back(compress_strips);
+  }
+  compress_strips();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+
+  // --- assemble the zlib stream: header, concatenated strips, Adler-32 of the whole uncompressed data
+
+  int level_flags;
+  if (compression_level_ == 0 || compression_level_ == 1) {
+    level_flags = 0;
+  }
+  else if (compression_level_ >= 2 && compression_level_ <= 5) {
+    level_flags = 1;
+  }
+  else if (compression_level_ == 6 || compression_level_ == -1) {
+    level_flags = 2;
+  }
+  else {
+    level_flags = 3;
+  }
+
+  int header = (0x78 << 8) | (level_flags << 6);
+  header += 31 - (header % 31);
+
+  std::vector<uint8_t> zdata;
+  zdata.push_back((uint8_t) (header >> 8));
+  zdata.push_back((uint8_t) (header & 0xFF));
+
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for (const auto& strip : strips) {
+    if (!strip.success) {
+      return false;
+    }
+
+    zdata.insert(zdata.end(), strip.data.begin(), strip.data.end());
+    adler = adler32_combine(adler, strip.adler, (z_off_t) strip.uncompressed_size);
+  }
+
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    zdata.push_back((uint8_t) (adler >> shift));
+  }
+
+
+  // --- write the stream as IDAT chunks
+
+  const size_t kMaxChunkSize = 1024 * 1024;
+  for (size_t offset = 0; offset < zdata.size(); offset += kMaxChunkSize) {
+    size_t size = std::min(kMaxChunkSize, zdata.size() - offset);
+    png_write_chunk(png_ptr, (png_const_bytep) "IDAT", zdata.data() + offset, size);
+  }
+
+  return true;
+}
+
 bool PngEncoder::Encode(const struct heif_image_handle* handle,
                         const struct heif_image* image, const std::string& filename)
 {
@@ -67,6 +300,14 @@ bool PngEncoder::Encode(const struct heif_image_handle* handle,
 
   png_init_io(png_ptr, fp);
 
+  if (compression_level_ >= 0) {
+    png_set_compression_level(png_ptr, compression_level_);
+  }
+
+  if (fast_filtering_) {
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+  }
+
   bool withAlpha = (heif_image_get_chroma_format(image) == heif_chroma_interleaved_RGBA ||
                     heif_image_get_chroma_format(image) == heif_chroma_interleaved_RRGGBBAA_BE);
 
@@ -184,9 +425,27 @@ bool PngEncoder::Encode(const struct heif_image_handle* handle,
   }
 
 
-  png_write_image(png_ptr, row_pointers);
+  if (num_threads_ > 1) {
+    int bytes_per_pixel = (withAlpha ? 4 : 3) * bitDepth / 8;
+    size_t row_bytes = (size_t) width * bytes_per_pixel;
 
-  png_write_end(png_ptr, nullptr);
+    if (!WriteParallelIDAT(png_ptr, row_pointers, height, row_bytes, bytes_per_pixel)) {
+      png_destroy_write_struct(&png_ptr, &info_ptr);
+      delete[] row_pointers;
+      fclose(fp);
+      fprintf(stderr, "Error while compressing image\n");
+      return false;
+    }
+
+    // libpng did not see the IDAT chunks, so that png_write_end() would fail. There is nothing to write after
+    // the image data, as all metadata is written before it.
+    png_write_chunk(png_ptr, (png_const_bytep) "IEND", nullptr, 0);
+  }
+  else {
+    png_write_image(png_ptr, row_pointers);
+
+    png_write_end(png_ptr, nullptr);
+  }
   png_destroy_write_struct(&png_ptr, &info_ptr);
   delete[] row_pointers;
   fclose(fp);
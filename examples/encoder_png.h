@@ -28,6 +28,8 @@
 
 #include <string>
 
+#include <png.h>
+
 #include "encoder.h"
 
 class PngEncoder : public Encoder
@@ -35,6 +37,11 @@ class PngEncoder : public Encoder
 public:
   PngEncoder();
 
+  // 'compression_level' is the zlib level 0-9, or -1 for the zlib default.
+  // With 'fast_filtering', every row uses the 'Sub' filter instead of choosing the best filter for each row.
+  // With 'num_threads' > 1, horizontal strips of the image are compressed in parallel into one IDAT stream.
+  PngEncoder(int compression_level, bool fast_filtering, int num_threads);
+
   heif_colorspace colorspace(bool has_alpha) const override
   {
     return heif_colorspace_RGB;
@@ -60,6 +67,12 @@ public:
               const struct heif_image* image, const std::string& filename) override;
 
 private:
+  bool WriteParallelIDAT(png_structp png_ptr, uint8_t** row_pointers, int height, size_t row_bytes,
+                         int bytes_per_pixel) const;
+
+  int compression_level_ = -1;
+  bool fast_filtering_ = false;
+  int num_threads_ = 1;
 };
 
 #endif  // EXAMPLE_ENCODER_PNG_H
@@ -0,0 +1,796 @@
+/*
+  libheif example application "heif-bench".
+
+  MIT License
+
+  Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <libheif/heif.h>
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#if defined(_MSC_VER)
+#include "getopt.h"
+#endif
+
+
+static void show_help(const char* argv0)
+{
+  std::cerr << " heif-bench  libheif version: " << heif_get_version() << "\n"
+            << "-----------------------------------------\n"
+               "Usage: heif-bench [options] <input-image> ...\n"
+               "\n"
+               "Measures the decoding (and optionally encoding) speed of the primary images of the input files\n"
+               "for all combinations of the given decoders, thread counts and output formats.\n"
+               "The files are read into memory first. The results are written as JSON.\n"
+               "The quality of the encoded images (PSNR of all planes, SSIM and MS-SSIM of luma) is measured\n"
+               "against the decoded input image.\n"
+               "\n"
+               "Options:\n"
+               "  -h, --help                 show help\n"
+               "  -n, --iterations N         number of measured runs per configuration (default: 10)\n"
+               "  -w, --warmup N             number of unmeasured runs before the measurement (default: 1)\n"
+               "  -t, --threads LIST         comma separated list of decoding thread counts (default: 1,<number of cores>)\n"
+               "  -c, --chroma LIST          comma separated list of output formats (default: rgb)\n"
+               "                             rgb, rgba, rrggbb, rrggbbaa (little endian), rgb444, 420, 422, 444, mono,\n"
+               "                             nv12, nv21, p010, rgb-half, rgba-half, rgb-float, rgba-float\n"
+               "  -d, --decoder LIST         comma separated list of decoder IDs (default: the default decoder)\n"
+               "  -e, --encoder LIST         also measure encoding with these encoder IDs ('all' for all encoders)\n"
+               "  -p, --preset LIST          comma separated list of encoder presets. Sets the 'preset' parameter,\n"
+               "                             or 'speed' for encoders without presets (default: encoder default)\n"
+               "  -q, --quality Q            encoder quality (default: 50)\n"
+               "  -o, --output FILE          write the JSON results into FILE instead of stdout\n"
+               "      --list-decoders        list all available decoders\n"
+               "      --list-encoders        list all available encoders\n";
+}
+
+
+static int option_list_decoders = 0;
+static int option_list_encoders = 0;
+
+static struct option long_options[] = {
+    {(char* const) "iterations",    required_argument, 0,                     'n'},
+    {(char* const) "warmup",        required_argument, 0,                     'w'},
+    {(char* const) "threads",       required_argument, 0,                     't'},
+    {(char* const) "chroma",        required_argument, 0,                     'c'},
+    {(char* const) "decoder",       required_argument, 0,                     'd'},
+    {(char* const) "encoder",       required_argument, 0,                     'e'},
+    {(char* const) "preset",        required_argument, 0,                     'p'},
+    {(char* const) "quality",       required_argument, 0,                     'q'},
+    {(char* const) "output",        required_argument, 0,                     'o'},
+    {(char* const) "list-decoders", no_argument,       &option_list_decoders, 1},
+    {(char* const) "list-encoders", no_argument,       &option_list_encoders, 1},
+    {(char* const) "help",          no_argument,       0,                     'h'},
+    {0, 0,                                             0,                     0}
+};
+
+
+struct OutputFormat
+{
+  const char* name;
+  heif_colorspace colorspace;
+  heif_chroma chroma;
+};
+
+static const OutputFormat output_formats[] = {
+    {"rgb",        heif_colorspace_RGB,        heif_chroma_interleaved_RGB},
+    {"rgba",       heif_colorspace_RGB,        heif_chroma_interleaved_RGBA},
+    {"rrggbb",     heif_colorspace_RGB,        heif_chroma_interleaved_RRGGBB_LE},
+    {"rrggbbaa",   heif_colorspace_RGB,        heif_chroma_interleaved_RRGGBBAA_LE},
+    {"rgb444",     heif_colorspace_RGB,        heif_chroma_444},
+    {"420",        heif_colorspace_YCbCr,      heif_chroma_420},
+    {"422",        heif_colorspace_YCbCr,      heif_chroma_422},
+    {"444",        heif_colorspace_YCbCr,      heif_chroma_444},
+    {"mono",       heif_colorspace_monochrome, heif_chroma_monochrome},
+    {"nv12",       heif_colorspace_YCbCr,      heif_chroma_420_NV12},
+    {"nv21",       heif_colorspace_YCbCr,      heif_chroma_420_NV21},
+    {"p010",       heif_colorspace_YCbCr,      heif_chroma_420_P010},
+    {"rgb-half",   heif_colorspace_RGB,        heif_chroma_interleaved_RGB_HALF},
+    {"rgba-half",  heif_colorspace_RGB,        heif_chroma_interleaved_RGBA_HALF},
+    {"rgb-float",  heif_colorspace_RGB,        heif_chroma_interleaved_RGB_FLOAT},
+    {"rgba-float", heif_colorspace_RGB,        heif_chroma_interleaved_RGBA_FLOAT},
+};
+
+
+static const OutputFormat* find_output_format(const std::string& name)
+{
+  for (const auto& format : output_formats) {
+    if (name == format.name) {
+      return &format;
+    }
+  }
+
+  return nullptr;
+}
+
+
+static std::vector<std::string> split_list(const char* list)
+{
+  std::vector<std::string> items;
+  std::stringstream sstr(list);
+  std::string item;
+
+  while (std::getline(sstr, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+
+  return items;
+}
+
+
+static std::string json_string(const std::string& s)
+{
+  std::string out = "\"";
+
+  for (char c : s) {
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        }
+        else {
+          out += c;
+        }
+    }
+  }
+
+  return out + "\"";
+}
+
+
+// Peak resident set size of the process in KiB. 0 if not available.
+static long get_peak_rss_kib()
+{
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+  return usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+
+class Timer
+{
+public:
+  Timer() : m_start(std::chrono::steady_clock::now()) {}
+
+  double elapsed_ms() const
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+  }
+
+private:
+  std::chrono::steady_clock::time_point m_start;
+};
+
+
+// Writes the statistics of the measured run times of one configuration.
+static std::string latency_statistics(std::vector<double> times_ms, double megapixels)
+{
+  std::sort(times_ms.begin(), times_ms.end());
+
+  auto percentile = [&times_ms](double p) {
+    // nearest-rank percentile
+    size_t rank = static_cast<size_t>(p / 100.0 * static_cast<double>(times_ms.size()) + 0.999999);
+    rank = std::min(std::max(rank, static_cast<size_t>(1)), times_ms.size());
+    return times_ms[rank - 1];
+  };
+
+  double total_ms = 0;
+  for (double t : times_ms) {
+    total_ms += t;
+  }
+
+  double runs = static_cast<double>(times_ms.size());
+  double mean_ms = total_ms / runs;
+
+  std::stringstream sstr;
+  sstr << "\"mpix_per_s\": " << (total_ms > 0 ? megapixels * runs / (total_ms / 1000.0) : 0.0) << ", "
+       << "\"latency_ms\": {"
+       << "\"min\": " << times_ms.front() << ", "
+       << "\"mean\": " << mean_ms << ", "
+       << "\"p50\": " << percentile(50) << ", "
+       << "\"p90\": " << percentile(90) << ", "
+       << "\"p99\": " << percentile(99) << ", "
+       << "\"max\": " << times_ms.back() << "}";
+
+  return sstr.str();
+}
+
+
+struct InputFile
+{
+  std::string filename;
+  std::vector<uint8_t> data;
+};
+
+
+struct BenchmarkSettings
+{
+  int iterations = 10;
+  int warmup = 1;
+  int quality = 50;
+};
+
+
+static std::string error_json(const std::string& configuration, const heif_error& err)
+{
+  return configuration + ", \"error\": " + json_string(err.message ? err.message : "unknown error");
+}
+
+
+static std::string benchmark_decoding(const InputFile& file, const std::string& decoder_id, int threads,
+                                      const OutputFormat& format, const BenchmarkSettings& settings)
+{
+  std::stringstream config;
+  config << "\"file\": " << json_string(file.filename) << ", "
+         << "\"decoder\": " << json_string(decoder_id.empty() ? "default" : decoder_id) << ", "
+         << "\"threads\": " << threads << ", "
+         << "\"chroma\": " << json_string(format.name);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_context_set_max_decoding_threads(ctx, threads);
+
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data.data(), file.data.size(), nullptr);
+  if (err.code) {
+    heif_context_free(ctx);
+    return error_json(config.str(), err);
+  }
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  if (err.code) {
+    heif_context_free(ctx);
+    return error_json(config.str(), err);
+  }
+
+  heif_decoding_options* options = heif_decoding_options_alloc();
+  options->decoder_id = decoder_id.empty() ? nullptr : decoder_id.c_str();
+
+  std::vector<double> times_ms;
+  int width = 0, height = 0;
+
+  for (int i = 0; i < settings.warmup + settings.iterations; i++) {
+    heif_image* img = nullptr;
+
+    Timer timer;
+    err = heif_decode_image(handle, &img, format.colorspace, format.chroma, options);
+    double time_ms = timer.elapsed_ms();
+
+    if (err.code) {
+      break;
+    }
+
+    width = heif_image_get_primary_width(img);
+    height = heif_image_get_primary_height(img);
+    heif_image_release(img);
+
+    if (i >= settings.warmup) {
+      times_ms.push_back(time_ms);
+    }
+  }
+
+  heif_decoding_options_free(options);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+
+  if (err.code) {
+    return error_json(config.str(), err);
+  }
+
+  config << ", \"width\": " << width << ", \"height\": " << height
+         << ", \"iterations\": " << times_ms.size() << ", "
+         << latency_statistics(times_ms, width * static_cast<double>(height) / 1e6)
+         << ", \"peak_rss_kib\": " << get_peak_rss_kib();
+
+  return config.str();
+}
+
+
+static heif_error set_encoder_preset(heif_encoder* encoder, const std::string& preset)
+{
+  for (const heif_encoder_parameter* const* param = heif_encoder_list_parameters(encoder); *param; param++) {
+    const char* name = heif_encoder_parameter_get_name(*param);
+    if (strcmp(name, "preset") == 0) {
+      return heif_encoder_set_parameter(encoder, "preset", preset.c_str());
+    }
+  }
+
+  return heif_encoder_set_parameter(encoder, "speed", preset.c_str());
+}
+
+
+static const char* get_channel_name(heif_channel channel)
+{
+  switch (channel) {
+    case heif_channel_Y:
+      return "Y";
+    case heif_channel_Cb:
+      return "Cb";
+    case heif_channel_Cr:
+      return "Cr";
+    case heif_channel_R:
+      return "R";
+    case heif_channel_G:
+      return "G";
+    case heif_channel_B:
+      return "B";
+    case heif_channel_Alpha:
+      return "alpha";
+    default:
+      return "unknown";
+  }
+}
+
+
+// Decodes the primary image of the encoded file into the format of 'original' and compares both.
+static std::string quality_metrics_json(const std::vector<uint8_t>& coded_data, const heif_image* original)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_image_handle* handle = nullptr;
+  heif_image* decoded = nullptr;
+  QualityMetrics metrics;
+
+  Timer timer;
+
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, coded_data.data(), coded_data.size(), nullptr);
+  if (!err.code) {
+    err = heif_context_get_primary_image_handle(ctx, &handle);
+  }
+  if (!err.code) {
+    err = heif_decode_image(handle, &decoded, heif_image_get_colorspace(original),
+                            heif_image_get_chroma_format(original), nullptr);
+  }
+
+  if (!err.code) {
+    err = compute_quality_metrics(original, decoded, metrics);
+  }
+
+  if (decoded) {
+    heif_image_release(decoded);
+  }
+
+  if (handle) {
+    heif_image_handle_release(handle);
+  }
+
+  heif_context_free(ctx);
+
+  if (err.code) {
+    return std::string("\"quality_error\": ") + json_string(err.message);
+  }
+
+  std::stringstream sstr;
+  sstr << "\"quality\": {";
+  for (const auto& plane : metrics.planes) {
+    sstr << "\"psnr_" << get_channel_name(plane.channel) << "\": " << plane.psnr << ", ";
+  }
+  sstr << "\"ssim\": " << metrics.ssim << ", "
+       << "\"ms_ssim\": " << metrics.ms_ssim << ", "
+       << "\"time_ms\": " << timer.elapsed_ms() << "}";
+
+  return sstr.str();
+}
+
+
+static std::string benchmark_encoding(const InputFile& file, const heif_image* image,
+                                      const heif_encoder_descriptor* descriptor, const std::string& preset,
+                                      const BenchmarkSettings& settings)
+{
+  std::stringstream config;
+  config << "\"file\": " << json_string(file.filename) << ", "
+         << "\"encoder\": " << json_string(heif_encoder_descriptor_get_id_name(descriptor)) << ", "
+         << "\"preset\": " << json_string(preset.empty() ? "default" : preset) << ", "
+         << "\"quality\": " << settings.quality;
+
+  std::vector<double> times_ms;
+  size_t coded_size = 0;
+  std::string quality;
+  heif_error err{heif_error_Ok, heif_suberror_Unspecified, "Success"};
+
+  for (int i = 0; i < settings.warmup + settings.iterations && !err.code; i++) {
+    heif_context* ctx = heif_context_alloc();
+
+    heif_encoder* encoder = nullptr;
+    err = heif_context_get_encoder(ctx, descriptor, &encoder);
+    if (!err.code) {
+      err = heif_encoder_set_lossy_quality(encoder, settings.quality);
+    }
+    if (!err.code && !preset.empty()) {
+      err = set_encoder_preset(encoder, preset);
+    }
+
+    if (!err.code) {
+      Timer timer;
+      err = heif_context_encode_image(ctx, image, encoder, nullptr, nullptr);
+      double time_ms = timer.elapsed_ms();
+
+      if (i >= settings.warmup) {
+        times_ms.push_back(time_ms);
+      }
+    }
+
+    if (!err.code && i == 0) {
+      struct MemoryWriter
+      {
+        static heif_error write(heif_context*, const void* data, size_t size, void* userdata)
+        {
+          auto* out = static_cast<std::vector<uint8_t>*>(userdata);
+          out->insert(out->end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+          return {heif_error_Ok, heif_suberror_Unspecified, "Success"};
+        }
+      };
+
+      std::vector<uint8_t> coded_data;
+      heif_writer writer{1, MemoryWriter::write};
+      err = heif_context_write(ctx, &writer, &coded_data);
+      coded_size = coded_data.size();
+
+      if (!err.code) {
+        quality = quality_metrics_json(coded_data, image);
+      }
+    }
+
+    if (encoder) {
+      heif_encoder_release(encoder);
+    }
+
+    heif_context_free(ctx);
+  }
+
+  if (err.code) {
+    return error_json(config.str(), err);
+  }
+
+  int width = heif_image_get_primary_width(image);
+  int height = heif_image_get_primary_height(image);
+
+  config << ", \"width\": " << width << ", \"height\": " << height
+         << ", \"iterations\": " << times_ms.size() << ", "
+         << latency_statistics(times_ms, width * static_cast<double>(height) / 1e6)
+         << ", \"file_size\": " << coded_size
+         << ", " << quality
+         << ", \"peak_rss_kib\": " << get_peak_rss_kib();
+
+  return config.str();
+}
+
+
+#define MAX_CODECS 20
+
+static void list_decoders()
+{
+  const heif_decoder_descriptor* decoders[MAX_CODECS];
+  int n = heif_get_decoder_descriptors(heif_compression_undefined, decoders, MAX_CODECS);
+
+  for (int i = 0; i < n; i++) {
+    const char* id = heif_decoder_descriptor_get_id_name(decoders[i]);
+    std::cout << "- " << (id ? id : "---") << " = " << heif_decoder_descriptor_get_name(decoders[i]) << "\n";
+  }
+}
+
+
+static void list_encoders()
+{
+  const heif_encoder_descriptor* encoders[MAX_CODECS];
+  int n = heif_get_encoder_descriptors(heif_compression_undefined, nullptr, encoders, MAX_CODECS);
+
+  for (int i = 0; i < n; i++) {
+    std::cout << "- " << heif_encoder_descriptor_get_id_name(encoders[i]) << " = "
+              << heif_encoder_descriptor_get_name(encoders[i]) << "\n";
+  }
+}
+
+
+static void write_results(std::ostream& ostr, const std::vector<std::string>& results)
+{
+  for (size_t i = 0; i < results.size(); i++) {
+    ostr << "    {" << results[i] << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+}
+
+
+class LibHeifInitializer
+{
+public:
+  LibHeifInitializer() { heif_init(nullptr); }
+
+  ~LibHeifInitializer() { heif_deinit(); }
+};
+
+
+int main(int argc, char** argv)
+{
+  LibHeifInitializer initializer;
+
+  BenchmarkSettings settings;
+  std::vector<int> thread_counts;
+  std::vector<const OutputFormat*> formats;
+  std::vector<std::string> decoder_ids;
+  std::vector<std::string> encoder_ids;
+  std::vector<std::string> presets;
+  const char* output_filename = nullptr;
+
+  while (true) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "hn:w:t:c:d:e:p:q:o:", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case 'n':
+        settings.iterations = atoi(optarg);
+        break;
+      case 'w':
+        settings.warmup = atoi(optarg);
+        break;
+      case 't':
+        for (const auto& item : split_list(optarg)) {
+          thread_counts.push_back(atoi(item.c_str()));
+        }
+        break;
+      case 'c':
+        for (const auto& item : split_list(optarg)) {
+          const OutputFormat* format = find_output_format(item);
+          if (!format) {
+            std::cerr << "Unknown output format: " << item << "\n";
+            return 1;
+          }
+
+          formats.push_back(format);
+        }
+        break;
+      case 'd':
+        decoder_ids = split_list(optarg);
+        break;
+      case 'e':
+        encoder_ids = split_list(optarg);
+        break;
+      case 'p':
+        presets = split_list(optarg);
+        break;
+      case 'q':
+        settings.quality = atoi(optarg);
+        break;
+      case 'o':
+        output_filename = optarg;
+        break;
+      case 'h':
+        show_help(argv[0]);
+        return 0;
+      case '?':
+        show_help(argv[0]);
+        return 1;
+    }
+  }
+
+  if (option_list_decoders) {
+    list_decoders();
+    return 0;
+  }
+
+  if (option_list_encoders) {
+    list_encoders();
+    return 0;
+  }
+
+  if (optind >= argc || settings.iterations < 1 || settings.warmup < 0) {
+    show_help(argv[0]);
+    return 1;
+  }
+
+  if (thread_counts.empty()) {
+    thread_counts = {1, std::max(static_cast<int>(std::thread::hardware_concurrency()), 1)};
+    if (thread_counts[1] == 1) {
+      thread_counts.pop_back();
+    }
+  }
+
+  if (formats.empty()) {
+    formats.push_back(find_output_format("rgb"));
+  }
+
+  if (decoder_ids.empty()) {
+    decoder_ids.emplace_back(); // default decoder
+  }
+
+  if (presets.empty()) {
+    presets.emplace_back(); // encoder default
+  }
+
+  std::vector<const heif_encoder_descriptor*> encoders;
+  if (!encoder_ids.empty()) {
+    const heif_encoder_descriptor* all_encoders[MAX_CODECS];
+    int n = heif_get_encoder_descriptors(heif_compression_undefined, nullptr, all_encoders, MAX_CODECS);
+
+    for (const auto& id : encoder_ids) {
+      bool found = false;
+      for (int i = 0; i < n; i++) {
+        if (id == "all" || id == heif_encoder_descriptor_get_id_name(all_encoders[i])) {
+          encoders.push_back(all_encoders[i]);
+          found = true;
+        }
+      }
+
+      if (!found) {
+        std::cerr << "Unknown encoder: " << id << "\n";
+        return 1;
+      }
+    }
+  }
+
+
+  // --- read the input files
+
+  std::vector<InputFile> files;
+  for (int i = optind; i < argc; i++) {
+    std::ifstream istr(argv[i], std::ios::binary);
+    if (!istr) {
+      std::cerr << "Cannot open file " << argv[i] << "\n";
+      return 1;
+    }
+
+    InputFile file;
+    file.filename = argv[i];
+    file.data.assign(std::istreambuf_iterator<char>(istr), std::istreambuf_iterator<char>());
+    files.push_back(std::move(file));
+  }
+
+
+  // --- run the benchmarks
+
+  std::vector<std::string> decode_results;
+  std::vector<std::string> encode_results;
+
+  for (const auto& file : files) {
+    for (const auto& decoder_id : decoder_ids) {
+      for (int threads : thread_counts) {
+        for (const OutputFormat* format : formats) {
+          std::cerr << "decoding " << file.filename << " (" << (decoder_id.empty() ? "default" : decoder_id)
+                    << ", " << threads << " threads, " << format->name << ")\n";
+
+          decode_results.push_back(benchmark_decoding(file, decoder_id, threads, *format, settings));
+        }
+      }
+    }
+
+    if (encoders.empty()) {
+      continue;
+    }
+
+    // The image is encoded in its decoded colorspace and chroma, such that the encoder does not
+    // have to convert it.
+    heif_context* ctx = heif_context_alloc();
+    heif_image* image = nullptr;
+    heif_image_handle* handle = nullptr;
+
+    heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data.data(), file.data.size(), nullptr);
+    if (!err.code) {
+      err = heif_context_get_primary_image_handle(ctx, &handle);
+    }
+    if (!err.code) {
+      err = heif_decode_image(handle, &image, heif_colorspace_undefined, heif_chroma_undefined, nullptr);
+    }
+
+    for (const heif_encoder_descriptor* encoder : encoders) {
+      for (const auto& preset : presets) {
+        std::cerr << "encoding " << file.filename << " (" << heif_encoder_descriptor_get_id_name(encoder)
+                  << ", preset " << (preset.empty() ? "default" : preset) << ")\n";
+
+        if (err.code) {
+          std::stringstream config;
+          config << "\"file\": " << json_string(file.filename) << ", "
+                 << "\"encoder\": " << json_string(heif_encoder_descriptor_get_id_name(encoder));
+          encode_results.push_back(error_json(config.str(), err));
+        }
+        else {
+          encode_results.push_back(benchmark_encoding(file, image, encoder, preset, settings));
+        }
+      }
+    }
+
+    if (image) {
+      heif_image_release(image);
+    }
+
+    if (handle) {
+      heif_image_handle_release(handle);
+    }
+
+    heif_context_free(ctx);
+  }
+
+
+  // --- write the results
+
+  std::ofstream ofstr;
+  if (output_filename) {
+    ofstr.open(output_filename);
+    if (!ofstr) {
+      std::cerr << "Cannot write file " << output_filename << "\n";
+      return 1;
+    }
+  }
+
+  std::ostream& ostr = output_filename ? ofstr : std::cout;
+
+  ostr << "{\n"
+       << "  \"libheif_version\": " << json_string(heif_get_version()) << ",\n"
+       << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+       << "  \"iterations\": " << settings.iterations << ",\n"
+       << "  \"warmup\": " << settings.warmup << ",\n"
+       << "  \"decode\": [\n";
+  write_results(ostr, decode_results);
+  ostr << "  ],\n"
+       << "  \"encode\": [\n";
+  write_results(ostr, encode_results);
+  ostr << "  ],\n"
+       << "  \"peak_rss_kib\": " << get_peak_rss_kib() << "\n"
+       << "}\n";
+
+  return 0;
+}
@@ -43,6 +43,18 @@
 #include <algorithm>
 #include <vector>
 #include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <sys/stat.h>
+
+#if !defined(_MSC_VER)
+#include <dirent.h>
+#endif
 
 #include <libheif/heif.h>
 
@@ -72,9 +84,14 @@ static void show_help(const char* argv0)
   std::cerr << " heif-convert  libheif version: " << heif_get_version() << "\n"
             << "-------------------------------------------\n"
                "Usage: heif-convert [options]  <input-image> <output-image>\n"
+               "       heif-convert [options] --batch [--output-dir DIR] [--format FORMAT] <input>...\n"
                "\n"
                "The program determines the output file format from the output filename suffix.\n"
-               "These suffices are recognized: jpg, jpeg, png, y4m."
+               "These suffices are recognized: jpg, jpeg, png, y4m.\n"
+               "\n"
+               "In batch mode, each input can be a file, a directory (all HEIF/AVIF files in it),\n"
+               "or '-' to read one filename per line from stdin. All files are converted in one process,\n"
+               "reading the next files while the previous ones are decoded and written.\n"
                "\n"
                "Options:\n"
                "  -h, --help                     show help\n"
@@ -87,7 +104,14 @@ static void show_help(const char* argv0)
                "      --no-colons                replace ':' characters in auxiliary image filenames with '_'\n"
                "      --list-decoders            list all available decoders (built-in and plugins)\n"
                "      --quiet                    do not output status messages to console\n"
-               "  -C, --chroma-upsampling ALGO   Force chroma upsampling algorithm (nn = nearest-neighbor / bilinear)\n";
+               "  -C, --chroma-upsampling ALGO   Force chroma upsampling algorithm (nn = nearest-neighbor / bilinear)\n"
+               "  -b, --batch                    convert all given inputs, print per-file timings and a throughput summary\n"
+               "  -o, --output-dir DIR           batch mode: write the output files to DIR (default: next to the input)\n"
+               "  -f, --format FORMAT            batch mode: output format jpg, png or y4m (default: jpg)\n"
+               "  -j, --jobs N                   batch mode: number of parallel conversions (default: number of cores)\n"
+               "      --png-compression-level L  zlib compression level 0-9 for PNG output (default: zlib default, 6)\n"
+               "      --png-fast                 use a fixed PNG row filter instead of choosing the best one for each row\n"
+               "      --png-threads N            compress strips of PNG output with N threads (default: 1)\n";
 }
 
 
@@ -114,6 +138,13 @@ int option_with_xmp = 0;
 int option_with_exif = 0;
 int option_skip_exif_offset = 0;
 int option_list_decoders = 0;
+int option_batch = 0;
+int option_png_fast = 0;
+int png_compression_level = -1;
+int png_threads = 1;
+
+const int OPTION_PNG_COMPRESSION_LEVEL = 1000;
+const int OPTION_PNG_THREADS = 1001;
 
 std::string chroma_upsampling;
 
@@ -130,6 +161,14 @@ static struct option long_options[] = {
     {(char* const) "list-decoders",    no_argument,       &option_list_decoders,    1},
     {(char* const) "help",             no_argument,       0,                        'h'},
     {(char* const) "chroma-upsampling", required_argument, 0,                     'C'},
+    {(char* const) "batch",            no_argument,       0,                        'b'},
+    {(char* const) "output-dir",       required_argument, 0,                        'o'},
+    {(char* const) "format",           required_argument, 0,                        'f'},
+    {(char* const) "jobs",             required_argument, 0,                        'j'},
+    {(char* const) "png-compression-level", required_argument, 0,                   OPTION_PNG_COMPRESSION_LEVEL},
+    {(char* const) "png-fast",         no_argument,       &option_png_fast,         1},
+    {(char* const) "png-threads",      required_argument, 0,                        OPTION_PNG_THREADS},
+    {0, 0,                                                0,                        0}
 };
 
 
@@ -173,164 +212,115 @@ public:
   ~LibHeifInitializer() { heif_deinit(); }
 };
 
-
-int main(int argc, char** argv)
+class Timer
 {
-  // This takes care of initializing libheif and also deinitializing it at the end to free all resources.
-  LibHeifInitializer initializer;
-
-  int quality = -1;  // Use default quality.
-  bool strict_decoding = false;
-  const char* decoder_id = nullptr;
-
-  UNUSED(quality);  // The quality will only be used by encoders that support it.
-  //while ((opt = getopt(argc, argv, "q:s")) != -1) {
-  while (true) {
-    int option_index = 0;
-    int c = getopt_long(argc, argv, "hq:sd:C:", long_options, &option_index);
-    if (c == -1) {
-      break;
-    }
+public:
+  Timer() : m_start(std::chrono::steady_clock::now()) {}
 
-    switch (c) {
-      case 'q':
-        quality = atoi(optarg);
-        break;
-      case 'd':
-        decoder_id = optarg;
-        break;
-      case 's':
-        strict_decoding = true;
-        break;
-      case '?':
-        std::cerr << "\n";
-        // fallthrough
-      case 'h':
-        show_help(argv[0]);
-        return 0;
-      case 'C':
-        chroma_upsampling = optarg;
-        if (chroma_upsampling != "nn" &&
-            chroma_upsampling != "nearest-neighbor" &&
-            chroma_upsampling != "bilinear") {
-          fprintf(stderr, "Undefined chroma upsampling algorithm.\n");
-          exit(5);
-        }
-        if (chroma_upsampling == "nn") { // abbreviation
-          chroma_upsampling = "nearest-neighbor";
-        }
-        break;
-    }
+  double get_milliseconds() const
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
   }
 
-  if (option_list_decoders) {
-    list_all_decoders();
-    return 0;
-  }
+private:
+  std::chrono::steady_clock::time_point m_start;
+};
 
-  if (optind + 2 > argc) {
-    // Need input and output filenames as additional arguments.
-    show_help(argv[0]);
-    return 5;
-  }
 
-  std::string input_filename(argv[optind++]);
-  std::string output_filename(argv[optind++]);
-  std::string output_filename_stem;
-  std::string output_filename_suffix;
+struct DecodingSettings
+{
+  bool strict_decoding = false;
+  const char* decoder_id = nullptr;
+};
 
-  std::unique_ptr<Encoder> encoder;
 
-  size_t dot_pos = output_filename.rfind('.');
-  if (dot_pos != std::string::npos) {
-    output_filename_stem = output_filename.substr(0,dot_pos);
-    std::string suffix_lowercase = output_filename.substr(dot_pos + 1);
+// Accumulated times of one input file, including all its images and auxiliary images.
+struct ConversionTimes
+{
+  double decode_ms = 0;
+  double encode_ms = 0;  // includes writing the output file
+  int num_images = 0;
+};
 
-    std::transform(suffix_lowercase.begin(), suffix_lowercase.end(),
-                   suffix_lowercase.begin(), ::tolower);
 
-    output_filename_suffix = suffix_lowercase;
+static std::unique_ptr<Encoder> create_encoder(const std::string& suffix_lowercase, int quality)
+{
+  std::unique_ptr<Encoder> encoder;
 
-    if (suffix_lowercase == "jpg" || suffix_lowercase == "jpeg") {
+  if (suffix_lowercase == "jpg" || suffix_lowercase == "jpeg") {
 #if HAVE_LIBJPEG
-      static const int kDefaultJpegQuality = 90;
-      if (quality == -1) {
-        quality = kDefaultJpegQuality;
-      }
-      encoder.reset(new JpegEncoder(quality));
+    static const int kDefaultJpegQuality = 90;
+    if (quality == -1) {
+      quality = kDefaultJpegQuality;
+    }
+    encoder.reset(new JpegEncoder(quality));
 #else
-      fprintf(stderr, "JPEG support has not been compiled in.\n");
-      return 1;
+    fprintf(stderr, "JPEG support has not been compiled in.\n");
 #endif  // HAVE_LIBJPEG
-    }
+  }
 
-    if (suffix_lowercase == "png") {
+  if (suffix_lowercase == "png") {
 #if HAVE_LIBPNG
-      encoder.reset(new PngEncoder());
+    encoder.reset(new PngEncoder(png_compression_level, option_png_fast, png_threads));
 #else
-      fprintf(stderr, "PNG support has not been compiled in.\n");
-      return 1;
+    fprintf(stderr, "PNG support has not been compiled in.\n");
 #endif  // HAVE_LIBPNG
-    }
-
-    if (suffix_lowercase == "y4m") {
-      encoder.reset(new Y4MEncoder());
-    }
-  }
-  else {
-    output_filename_stem = output_filename;
-    output_filename_suffix = "jpg";
   }
 
-  if (!encoder) {
-    fprintf(stderr, "Unknown file type in %s\n", output_filename.c_str());
-    return 1;
+  if (suffix_lowercase == "y4m") {
+    encoder.reset(new Y4MEncoder());
   }
 
+  return encoder;
+}
 
-  // --- check whether input is a supported HEIF file
 
-  // TODO: when we are reading from named pipes, we probably should not consume any bytes
-  // just for file-type checking.
-  // TODO: check, whether reading from named pipes works at all.
+static std::string to_lowercase(std::string s)
+{
+  std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+  return s;
+}
 
-  std::ifstream istr(input_filename.c_str(), std::ios_base::binary);
-  uint8_t magic[12];
-  istr.read((char*) magic, 12);
 
-  if (heif_check_jpeg_filetype(magic, 12)) {
+// Returns true if the data starts with a supported HEIF/AVIF file type. Otherwise, an error is printed.
+static bool check_input_filetype(const uint8_t* magic, size_t size, const std::string& input_filename)
+{
+  if (size < 12) {
+    fprintf(stderr, "Input file '%s' is too small to be an HEIF/AVIF file\n", input_filename.c_str());
+    return false;
+  }
+
+  if (heif_check_jpeg_filetype(magic, (int) size) == 1) {
     fprintf(stderr, "Input file '%s' is a JPEG image\n", input_filename.c_str());
-    return 1;
+    return false;
   }
 
-  enum heif_filetype_result filetype_check = heif_check_filetype(magic, 12);
+  enum heif_filetype_result filetype_check = heif_check_filetype(magic, (int) size);
   if (filetype_check == heif_filetype_no) {
-    fprintf(stderr, "Input file is not an HEIF/AVIF file\n");
-    return 1;
+    fprintf(stderr, "Input file '%s' is not an HEIF/AVIF file\n", input_filename.c_str());
+    return false;
   }
 
   if (filetype_check == heif_filetype_yes_unsupported) {
-    fprintf(stderr, "Input file is an unsupported HEIF/AVIF file type\n");
-    return 1;
+    fprintf(stderr, "Input file '%s' is an unsupported HEIF/AVIF file type\n", input_filename.c_str());
+    return false;
   }
 
+  return true;
+}
 
 
-  // --- read the HEIF file
-
-  struct heif_context* ctx = heif_context_alloc();
-  if (!ctx) {
-    fprintf(stderr, "Could not create context object\n");
-    return 1;
-  }
-
-  ContextReleaser cr(ctx);
+// Decodes all top level images of the context and writes them (and optionally their auxiliary images
+// and metadata) to files named after 'output_filename'. Status messages are written to 'log'.
+static int convert_images(struct heif_context* ctx, Encoder* encoder,
+                          const std::string& output_filename,
+                          const std::string& output_filename_stem,
+                          const std::string& output_filename_suffix,
+                          const DecodingSettings& settings,
+                          std::ostream& log,
+                          ConversionTimes* times)
+{
   struct heif_error err;
-  err = heif_context_read_from_file(ctx, input_filename.c_str(), nullptr);
-  if (err.code != 0) {
-    std::cerr << "Could not read HEIF/AVIF file: " << err.message << "\n";
-    return 1;
-  }
 
   int num_images = heif_context_get_number_of_top_level_images(ctx);
   if (num_images == 0) {
@@ -339,7 +329,7 @@ int main(int argc, char** argv)
   }
 
   if (!option_quiet) {
-    std::cout << "File contains " << num_images << " image" << (num_images>1 ? "s" : "") << "\n";
+    log << "File contains " << num_images << " image" << (num_images>1 ? "s" : "") << "\n";
   }
 
   std::vector<heif_item_id> image_IDs(num_images);
@@ -379,8 +369,8 @@ int main(int argc, char** argv)
     struct heif_decoding_options* decode_options = heif_decoding_options_alloc();
     encoder->UpdateDecodingOptions(handle, decode_options);
 
-    decode_options->strict_decoding = strict_decoding;
-    decode_options->decoder_id = decoder_id;
+    decode_options->strict_decoding = settings.strict_decoding;
+    decode_options->decoder_id = settings.decoder_id;
 
     if (chroma_upsampling=="nearest-neighbor") {
       decode_options->color_conversion_options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_nearest_neighbor;
@@ -399,6 +389,7 @@ int main(int argc, char** argv)
       return 1;
     }
 
+    Timer decode_timer;
     struct heif_image* image;
     err = heif_decode_image(handle,
                             &image,
@@ -413,6 +404,11 @@ int main(int argc, char** argv)
       return 1;
     }
 
+    if (times) {
+      times->decode_ms += decode_timer.get_milliseconds();
+      times->num_images++;
+    }
+
     // show decoding warnings
 
     for (int i = 0;; i++) {
@@ -425,13 +421,18 @@ int main(int argc, char** argv)
     }
 
     if (image) {
+      Timer encode_timer;
       bool written = encoder->Encode(handle, image, filename);
+      if (times) {
+        times->encode_ms += encode_timer.get_milliseconds();
+      }
+
       if (!written) {
         fprintf(stderr, "could not write image\n");
       }
       else {
         if (!option_quiet) {
-          std::cout << "Written to " << filename << "\n";
+          log << "Written to " << filename << "\n";
         }
       }
       heif_image_release(image);
@@ -455,6 +456,7 @@ int main(int argc, char** argv)
 
           int depth_bit_depth = heif_image_handle_get_luma_bits_per_pixel(depth_handle);
 
+          decode_timer = Timer();
           struct heif_image* depth_image;
           err = heif_decode_image(depth_handle,
                                   &depth_image,
@@ -468,18 +470,27 @@ int main(int argc, char** argv)
             return 1;
           }
 
+          if (times) {
+            times->decode_ms += decode_timer.get_milliseconds();
+          }
+
           std::ostringstream s;
           s << numbered_output_filename_stem;
           s << "-depth.";
           s << output_filename_suffix;
 
+          encode_timer = Timer();
           written = encoder->Encode(depth_handle, depth_image, s.str());
+          if (times) {
+            times->encode_ms += encode_timer.get_milliseconds();
+          }
+
           if (!written) {
             fprintf(stderr, "could not write depth image\n");
           }
           else {
             if (!option_quiet) {
-              std::cout << "Depth image written to " << s.str() << "\n";
+              log << "Depth image written to " << s.str() << "\n";
             }
           }
 
@@ -512,6 +523,7 @@ int main(int argc, char** argv)
 
             int aux_bit_depth = heif_image_handle_get_luma_bits_per_pixel(aux_handle);
 
+            decode_timer = Timer();
             struct heif_image* aux_image;
             err = heif_decode_image(aux_handle,
                                     &aux_image,
@@ -525,6 +537,10 @@ int main(int argc, char** argv)
               return 1;
             }
 
+            if (times) {
+              times->decode_ms += decode_timer.get_milliseconds();
+            }
+
             const char* auxTypeC = nullptr;
             err = heif_image_handle_get_auxiliary_type(aux_handle, &auxTypeC);
             if (err.code) {
@@ -549,13 +565,18 @@ int main(int argc, char** argv)
               std::replace(auxFilename.begin(), auxFilename.end(), ':', '_');
             }
 
+            encode_timer = Timer();
             written = encoder->Encode(aux_handle, aux_image, auxFilename);
+            if (times) {
+              times->encode_ms += encode_timer.get_milliseconds();
+            }
+
             if (!written) {
               fprintf(stderr, "could not write auxiliary image\n");
             }
             else {
               if (!option_quiet) {
-                std::cout << "Auxiliary image written to " << auxFilename << "\n";
+                log << "Auxiliary image written to " << auxFilename << "\n";
               }
             }
 
@@ -565,7 +586,6 @@ int main(int argc, char** argv)
         }
       }
 
-
       // --- write metadata
 
       if (option_with_xmp || option_with_exif) {
@@ -645,5 +665,495 @@ int main(int argc, char** argv)
     image_index++;
   }
 
+
   return 0;
 }
+
+
+// --- batch mode
+
+struct BatchSettings
+{
+  std::string output_directory;  // empty: write next to the input file
+  std::string output_suffix = "jpg";
+  int quality = -1;
+  int num_jobs = 0;  // 0: number of cores
+};
+
+
+struct BatchInput
+{
+  std::string filename;
+  std::vector<uint8_t> data;
+  double read_ms = 0;
+};
+
+
+// Bounded FIFO between the reading thread and the conversion workers.
+// It limits the number of input files that are held in memory at the same time.
+class BatchQueue
+{
+public:
+  explicit BatchQueue(size_t capacity) : m_capacity(capacity) {}
+
+  void push(std::unique_ptr<BatchInput> input)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_full.wait(lock, [this]() { return m_queue.size() < m_capacity; });
+    m_queue.push_back(std::move(input));
+    m_not_empty.notify_one();
+  }
+
+  // Signals that no more inputs will be pushed.
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_not_empty.notify_all();
+  }
+
+  // Returns nullptr when the queue is closed and all inputs have been taken.
+  std::unique_ptr<BatchInput> pop()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_empty.wait(lock, [this]() { return !m_queue.empty() || m_closed; });
+    if (m_queue.empty()) {
+      return nullptr;
+    }
+
+    std::unique_ptr<BatchInput> input = std::move(m_queue.front());
+    m_queue.pop_front();
+    m_not_full.notify_one();
+    return input;
+  }
+
+private:
+  size_t m_capacity;
+  bool m_closed = false;
+  std::deque<std::unique_ptr<BatchInput>> m_queue;
+  std::mutex m_mutex;
+  std::condition_variable m_not_full;
+  std::condition_variable m_not_empty;
+};
+
+
+struct BatchStatistics
+{
+  std::mutex mutex;  // also serializes the per-file output lines
+
+  int num_files = 0;
+  int num_failed = 0;
+  int num_images = 0;
+  uint64_t input_bytes = 0;
+  double read_ms = 0;
+  double decode_ms = 0;
+  double encode_ms = 0;
+};
+
+
+static bool is_heif_filename(const std::string& filename)
+{
+  size_t dot_pos = filename.rfind('.');
+  if (dot_pos == std::string::npos) {
+    return false;
+  }
+
+  std::string suffix = to_lowercase(filename.substr(dot_pos + 1));
+  return (suffix == "heic" || suffix == "heif" || suffix == "hif" || suffix == "avif");
+}
+
+
+static bool is_directory(const std::string& path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+
+// Lists the HEIF/AVIF files in a directory (not recursively) in alphabetical order.
+static std::vector<std::string> list_directory(const std::string& path)
+{
+  std::vector<std::string> filenames;
+
+#if defined(_MSC_VER)
+  fprintf(stderr, "Directory input is not supported on this platform: %s\n", path.c_str());
+#else
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    fprintf(stderr, "Cannot open directory '%s'\n", path.c_str());
+    return filenames;
+  }
+
+  while (struct dirent* entry = readdir(dir)) {
+    std::string filename = path + "/" + entry->d_name;
+    if (is_heif_filename(filename) && !is_directory(filename)) {
+      filenames.push_back(filename);
+    }
+  }
+
+  closedir(dir);
+
+  std::sort(filenames.begin(), filenames.end());
+#endif
+
+  return filenames;
+}
+
+
+static std::string get_batch_output_filename(const std::string& input_filename, const BatchSettings& batch)
+{
+  size_t slash_pos = input_filename.find_last_of("/\\");
+  size_t name_start = (slash_pos == std::string::npos) ? 0 : slash_pos + 1;
+
+  size_t dot_pos = input_filename.rfind('.');
+  if (dot_pos == std::string::npos || dot_pos < name_start) {
+    dot_pos = input_filename.size();
+  }
+
+  std::string stem;
+  if (batch.output_directory.empty()) {
+    stem = input_filename.substr(0, dot_pos);
+  }
+  else {
+    stem = batch.output_directory + "/" + input_filename.substr(name_start, dot_pos - name_start);
+  }
+
+  return stem + "." + batch.output_suffix;
+}
+
+
+static void read_batch_input(const std::string& filename, BatchQueue& queue)
+{
+  std::unique_ptr<BatchInput> input(new BatchInput);
+  input->filename = filename;
+
+  Timer timer;
+  std::ifstream istr(filename.c_str(), std::ios_base::binary);
+  if (istr) {
+    istr.seekg(0, std::ios_base::end);
+    std::streamoff size = istr.tellg();
+    istr.seekg(0, std::ios_base::beg);
+
+    if (size > 0) {
+      input->data.resize((size_t) size);
+      istr.read((char*) input->data.data(), size);
+      if (!istr) {
+        input->data.clear();
+      }
+    }
+  }
+  input->read_ms = timer.get_milliseconds();
+
+  // An empty input is reported as a failed conversion by the worker.
+  queue.push(std::move(input));
+}
+
+
+// Reads all input files in the order given on the command line. Arguments can be files, directories,
+// or '-' to read one filename per line from stdin.
+static void run_batch_reader(const std::vector<std::string>& arguments, BatchQueue& queue)
+{
+  for (const auto& argument : arguments) {
+    if (argument == "-") {
+      std::string line;
+      while (std::getline(std::cin, line)) {
+        if (!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+
+        if (!line.empty()) {
+          read_batch_input(line, queue);
+        }
+      }
+    }
+    else if (is_directory(argument)) {
+      for (const auto& filename : list_directory(argument)) {
+        read_batch_input(filename, queue);
+      }
+    }
+    else {
+      read_batch_input(argument, queue);
+    }
+  }
+
+  queue.close();
+}
+
+
+static void run_batch_worker(BatchQueue& queue, const BatchSettings& batch,
+                             const DecodingSettings& settings, BatchStatistics& stats)
+{
+  std::unique_ptr<Encoder> encoder = create_encoder(batch.output_suffix, batch.quality);
+  assert(encoder);
+
+  while (std::unique_ptr<BatchInput> input = queue.pop()) {
+    ConversionTimes times;
+    bool success = false;
+
+    if (input->data.empty()) {
+      fprintf(stderr, "Cannot read input file '%s'\n", input->filename.c_str());
+    }
+    else if (check_input_filetype(input->data.data(), input->data.size(), input->filename)) {
+      struct heif_context* ctx = heif_context_alloc();
+      ContextReleaser cr(ctx);
+
+      struct heif_error err = heif_context_read_from_memory_without_copy(ctx, input->data.data(), input->data.size(),
+                                                                         nullptr);
+      if (err.code != 0) {
+        std::cerr << "Could not read HEIF/AVIF file '" << input->filename << "': " << err.message << "\n";
+      }
+      else {
+        std::string output_filename = get_batch_output_filename(input->filename, batch);
+        std::string output_filename_stem = output_filename.substr(0, output_filename.rfind('.'));
+
+        // The status messages of concurrent workers would be interleaved. We print one summary line per file instead.
+        std::ostringstream log;
+        success = (convert_images(ctx, encoder.get(), output_filename, output_filename_stem, batch.output_suffix,
+                                  settings, log, &times) == 0);
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(stats.mutex);
+
+    stats.num_files++;
+    stats.num_images += times.num_images;
+    stats.input_bytes += input->data.size();
+    stats.read_ms += input->read_ms;
+    stats.decode_ms += times.decode_ms;
+    stats.encode_ms += times.encode_ms;
+
+    if (!success) {
+      stats.num_failed++;
+      std::cerr << input->filename << ": conversion failed\n";
+    }
+    else if (!option_quiet) {
+      std::cout << std::fixed << std::setprecision(1)
+                << input->filename << ": " << times.num_images << " image" << (times.num_images != 1 ? "s" : "")
+                << ", " << (double) input->data.size() / (1024 * 1024) << " MB"
+                << ", read " << input->read_ms << " ms"
+                << ", decode " << times.decode_ms << " ms"
+                << ", encode " << times.encode_ms << " ms\n";
+    }
+  }
+}
+
+
+static int run_batch(const std::vector<std::string>& arguments, const BatchSettings& batch,
+                     const DecodingSettings& settings)
+{
+  if (!batch.output_directory.empty() && !is_directory(batch.output_directory)) {
+    fprintf(stderr, "Output directory '%s' does not exist\n", batch.output_directory.c_str());
+    return 1;
+  }
+
+  // The reader stays at most two files per worker ahead of the conversion.
+  BatchQueue queue(2 * (size_t) batch.num_jobs);
+  BatchStatistics stats;
+
+  Timer timer;
+
+  std::thread reader(run_batch_reader, std::cref(arguments), std::ref(queue));
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < batch.num_jobs; i++) {
+    workers.emplace_back(run_batch_worker, std::ref(queue), std::cref(batch), std::cref(settings), std::ref(stats));
+  }
+
+  reader.join();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  double seconds = timer.get_milliseconds() / 1000.0;
+  double megabytes = (double) stats.input_bytes / (1024 * 1024);
+
+  std::cout << std::fixed << std::setprecision(2)
+            << "Converted " << (stats.num_files - stats.num_failed) << " of " << stats.num_files << " files ("
+            << stats.num_images << " images, " << megabytes << " MB) in " << seconds << " s with "
+            << batch.num_jobs << " job" << (batch.num_jobs != 1 ? "s" : "") << "\n";
+
+  if (seconds > 0) {
+    std::cout << "Throughput: " << stats.num_files / seconds << " files/s, "
+              << stats.num_images / seconds << " images/s, "
+              << megabytes / seconds << " MB/s\n";
+  }
+
+  std::cout << "Accumulated times: read " << stats.read_ms / 1000.0 << " s, decode "
+            << stats.decode_ms / 1000.0 << " s, encode " << stats.encode_ms / 1000.0 << " s\n";
+
+  return stats.num_failed ? 1 : 0;
+}
+
+
+int main(int argc, char** argv)
+{
+  // This takes care of initializing libheif and also deinitializing it at the end to free all resources.
+  LibHeifInitializer initializer;
+
+  int quality = -1;  // Use default quality.
+  DecodingSettings settings;
+  BatchSettings batch;
+
+  UNUSED(quality);  // The quality will only be used by encoders that support it.
+  //while ((opt = getopt(argc, argv, "q:s")) != -1) {
+  while (true) {
+    int option_index = 0;
+    int c = getopt_long(argc, argv, "hq:sd:C:bo:f:j:", long_options, &option_index);
+    if (c == -1) {
+      break;
+    }
+
+    switch (c) {
+      case 'q':
+        quality = atoi(optarg);
+        break;
+      case 'd':
+        settings.decoder_id = optarg;
+        break;
+      case 's':
+        settings.strict_decoding = true;
+        break;
+      case '?':
+        std::cerr << "\n";
+        // fallthrough
+      case 'h':
+        show_help(argv[0]);
+        return 0;
+      case 'C':
+        chroma_upsampling = optarg;
+        if (chroma_upsampling != "nn" &&
+            chroma_upsampling != "nearest-neighbor" &&
+            chroma_upsampling != "bilinear") {
+          fprintf(stderr, "Undefined chroma upsampling algorithm.\n");
+          exit(5);
+        }
+        if (chroma_upsampling == "nn") { // abbreviation
+          chroma_upsampling = "nearest-neighbor";
+        }
+        break;
+      case 'b':
+        option_batch = 1;
+        break;
+      case 'o':
+        batch.output_directory = optarg;
+        break;
+      case 'f':
+        batch.output_suffix = to_lowercase(optarg);
+        break;
+      case 'j':
+        batch.num_jobs = atoi(optarg);
+        if (batch.num_jobs < 1) {
+          fprintf(stderr, "Invalid number of jobs.\n");
+          exit(5);
+        }
+        break;
+      case OPTION_PNG_COMPRESSION_LEVEL:
+        png_compression_level = atoi(optarg);
+        if (png_compression_level < 0 || png_compression_level > 9) {
+          fprintf(stderr, "Invalid PNG compression level. Must be between 0 and 9.\n");
+          exit(5);
+        }
+        break;
+      case OPTION_PNG_THREADS:
+        png_threads = atoi(optarg);
+        if (png_threads < 1) {
+          fprintf(stderr, "Invalid number of PNG threads.\n");
+          exit(5);
+        }
+        break;
+    }
+  }
+
+  if (option_list_decoders) {
+    list_all_decoders();
+    return 0;
+  }
+
+  if (option_batch) {
+    if (optind >= argc) {
+      show_help(argv[0]);
+      return 5;
+    }
+
+    std::unique_ptr<Encoder> encoder = create_encoder(batch.output_suffix, quality);
+    if (!encoder) {
+      fprintf(stderr, "Unknown output format '%s'\n", batch.output_suffix.c_str());
+      return 1;
+    }
+
+    if (batch.num_jobs == 0) {
+      batch.num_jobs = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+
+    batch.quality = quality;
+
+    std::vector<std::string> arguments(argv + optind, argv + argc);
+    return run_batch(arguments, batch, settings);
+  }
+
+  if (optind + 2 > argc) {
+    // Need input and output filenames as additional arguments.
+    show_help(argv[0]);
+    return 5;
+  }
+
+  std::string input_filename(argv[optind++]);
+  std::string output_filename(argv[optind++]);
+  std::string output_filename_stem;
+  std::string output_filename_suffix;
+
+  std::unique_ptr<Encoder> encoder;
+
+  size_t dot_pos = output_filename.rfind('.');
+  if (dot_pos != std::string::npos) {
+    output_filename_stem = output_filename.substr(0,dot_pos);
+    output_filename_suffix = to_lowercase(output_filename.substr(dot_pos + 1));
+
+    encoder = create_encoder(output_filename_suffix, quality);
+  }
+  else {
+    output_filename_stem = output_filename;
+    output_filename_suffix = "jpg";
+  }
+
+  if (!encoder) {
+    fprintf(stderr, "Unknown file type in %s\n", output_filename.c_str());
+    return 1;
+  }
+
+
+  // --- check whether input is a supported HEIF file
+
+  // TODO: when we are reading from named pipes, we probably should not consume any bytes
+  // just for file-type checking.
+  // TODO: check, whether reading from named pipes works at all.
+
+  std::ifstream istr(input_filename.c_str(), std::ios_base::binary);
+  uint8_t magic[12];
+  istr.read((char*) magic, 12);
+
+  if (!check_input_filetype(magic, (size_t) istr.gcount(), input_filename)) {
+    return 1;
+  }
+
+
+
+  // --- read the HEIF file
+
+  struct heif_context* ctx = heif_context_alloc();
+  if (!ctx) {
+    fprintf(stderr, "Could not create context object\n");
+    return 1;
+  }
+
+  ContextReleaser cr(ctx);
+  struct heif_error err;
+  err = heif_context_read_from_file(ctx, input_filename.c_str(), nullptr);
+  if (err.code != 0) {
+    std::cerr << "Could not read HEIF/AVIF file: " << err.message << "\n";
+    return 1;
+  }
+
+  return convert_images(ctx, encoder.get(), output_filename, output_filename_stem, output_filename_suffix,
+                        settings, std::cout, nullptr);
+}
@@ -36,6 +36,9 @@
 #include <iomanip>
 #include <memory>
 #include <algorithm>
+#include <deque>
+#include <future>
+#include <thread>
 #include <vector>
 #include <string>
 
@@ -122,6 +125,7 @@ static struct option long_options[] = {
     {(char* const) "enable-metadata-compression", no_argument,       &metadata_compression,  1},
     {(char* const) "pitm-description",            required_argument, 0,                     OPTION_PITM_DESCRIPTION},
     {(char* const) "chroma-downsampling", required_argument, 0, 'C'},
+    {(char* const) "jobs",                    required_argument, 0,              'j'},
     {0, 0,                                                       0,               0},
 };
 
@@ -169,6 +173,7 @@ void show_help(const char* argv0)
             << "                                  (sharp-yuv makes edges look sharper when using YUV420 with bilinear chroma upsampling)\n"
             << "  --benchmark               measure encoding time, PSNR, and output file size\n"
             << "  --pitm-description TEXT   (EXPERIMENTAL) set user description for primary image\n"
+            << "  -j, --jobs #              load up to # input images in parallel while the previous image is encoded (default: 1)\n"
 
             << "\n"
             << "Note: to get lossless encoding, you need this set of options:\n"
@@ -400,6 +405,84 @@ heif_compression_format guess_compression_format_from_filename(const std::string
 }
 
 
+static InputImage load_image(const std::string& input_filename, int output_bit_depth)
+{
+  // get file type from file name
+
+  std::string suffix;
+  auto suffix_pos = input_filename.find_last_of('.');
+  if (suffix_pos != std::string::npos) {
+    suffix = input_filename.substr(suffix_pos + 1);
+    std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+  }
+
+  enum
+  {
+    PNG, JPEG, Y4M
+  } filetype = JPEG;
+  if (suffix == "png") {
+    filetype = PNG;
+  }
+  else if (suffix == "y4m") {
+    filetype = Y4M;
+  }
+
+  if (filetype == PNG) {
+    return loadPNG(input_filename.c_str(), output_bit_depth);
+  }
+  else if (filetype == Y4M) {
+    return loadY4M(input_filename.c_str());
+  }
+  else {
+    return loadJPEG(input_filename.c_str());
+  }
+}
+
+
+// When the input images are loaded in parallel, the encoder gets the cores that are not needed for loading,
+// unless its number of threads was set explicitly with '-p threads=#'.
+static void balance_encoder_threads(struct heif_encoder* encoder, int num_jobs,
+                                    const std::vector<std::string>& raw_params, int logging_level)
+{
+  for (const std::string& p : raw_params) {
+    if (p.compare(0, 8, "threads=") == 0) {
+      return;
+    }
+  }
+
+  const struct heif_encoder_parameter* const* params = heif_encoder_list_parameters(encoder);
+  for (int i = 0; params[i]; i++) {
+    if (strcmp(heif_encoder_parameter_get_name(params[i]), "threads") == 0 &&
+        heif_encoder_parameter_get_type(params[i]) == heif_encoder_parameter_type_integer) {
+      int num_cores = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+      // The loading threads are mostly idle, as loading is much faster than encoding. One core is reserved
+      // for each additional loading thread.
+      int encoder_threads = std::max(num_cores - (num_jobs - 1), 1);
+
+      int have_minimum = 0, have_maximum = 0, minimum = 0, maximum = 0;
+      struct heif_error error = heif_encoder_parameter_get_valid_integer_values(params[i], &have_minimum, &have_maximum,
+                                                                                &minimum, &maximum, nullptr, nullptr);
+      if (error.code == 0) {
+        if (have_minimum) {
+          encoder_threads = std::max(encoder_threads, minimum);
+        }
+        if (have_maximum) {
+          encoder_threads = std::min(encoder_threads, maximum);
+        }
+      }
+
+      heif_encoder_set_parameter_integer(encoder, "threads", encoder_threads);
+
+      if (logging_level > 0) {
+        std::cout << "encoding with " << encoder_threads << " threads, loading " << num_jobs << " images in parallel\n";
+      }
+      return;
+    }
+  }
+}
+
+
 class LibHeifInitializer
 {
 public:
@@ -424,13 +507,14 @@ int main(int argc, char** argv)
   bool force_enc_av1f = false;
   bool force_enc_uncompressed = false;
   bool crop_to_even_size = false;
+  int num_jobs = 1;
 
   std::vector<std::string> raw_params;
 
 
   while (true) {
     int option_index = 0;
-    int c = getopt_long(argc, argv, "hq:Lo:vPp:t:b:AEe:C:"
+    int c = getopt_long(argc, argv, "hq:Lo:vPp:t:b:AEe:C:j:"
 #if false && WITH_UNCOMPRESSED_CODEC
         "U"
 #endif
@@ -480,6 +564,13 @@ int main(int argc, char** argv)
       case 'e':
         encoderId = optarg;
         break;
+      case 'j':
+        num_jobs = atoi(optarg);
+        if (num_jobs < 1) {
+          std::cerr << "Invalid number of jobs. Must be at least 1.\n";
+          return 5;
+        }
+        break;
       case OPTION_NCLX_MATRIX_COEFFICIENTS:
         nclx_matrix_coefficients = (uint16_t) strtoul(optarg, nullptr, 0);
         break;
@@ -636,13 +727,31 @@ int main(int argc, char** argv)
     return 0;
   }
 
+  if (num_jobs > 1) {
+    balance_encoder_threads(encoder, num_jobs, raw_params, logging_level);
+  }
+
 
   struct heif_error error;
 
   std::shared_ptr<heif_image> primary_image;
 
-  for (; optind < argc; optind++) {
-    std::string input_filename = argv[optind];
+  std::vector<std::string> input_filenames(argv + optind, argv + argc);
+
+  // Input images that are loaded in the background, in the order of the input files.
+  // The images are still encoded one after the other into the same file, in the order given on the command line.
+  std::deque<std::future<InputImage>> loading_images;
+  size_t next_image_to_load = 0;
+
+  auto start_loading_images = [&]() {
+    while (next_image_to_load < input_filenames.size() && loading_images.size() < (size_t) num_jobs) {
+      loading_images.push_back(std::async(std::launch::async, load_image,
+                                          input_filenames[next_image_to_load], output_bit_depth));
+      next_image_to_load++;
+    }
+  };
+
+  for (const std::string& input_filename : input_filenames) {
 
     if (output_filename.empty()) {
       std::string filename_without_suffix;
@@ -660,35 +769,18 @@ int main(int argc, char** argv)
 
     // ==============================================================================
 
-    // get file type from file name
-
-    std::string suffix;
-    auto suffix_pos = input_filename.find_last_of('.');
-    if (suffix_pos != std::string::npos) {
-      suffix = input_filename.substr(suffix_pos + 1);
-      std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
-    }
+    InputImage input_image;
+    if (num_jobs > 1) {
+      start_loading_images();
 
-    enum
-    {
-      PNG, JPEG, Y4M
-    } filetype = JPEG;
-    if (suffix == "png") {
-      filetype = PNG;
-    }
-    else if (suffix == "y4m") {
-      filetype = Y4M;
-    }
+      input_image = loading_images.front().get();
+      loading_images.pop_front();
 
-    InputImage input_image;
-    if (filetype == PNG) {
-      input_image = loadPNG(input_filename.c_str(), output_bit_depth);
-    }
-    else if (filetype == Y4M) {
-      input_image = loadY4M(input_filename.c_str());
+      // keep loading the next images while this one is encoded
+      start_loading_images();
     }
     else {
-      input_image = loadJPEG(input_filename.c_str());
+      input_image = load_image(input_filename, output_bit_depth);
     }
 
     std::shared_ptr<heif_image> image = input_image.image;
@@ -41,9 +41,15 @@
 
 #include <libheif/heif.h>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <getopt.h>
 #include <assert.h>
 
@@ -67,6 +73,8 @@ static struct option long_options[] = {
     //{"write-raw", required_argument, 0, 'w' },
     //{"output",    required_argument, 0, 'o' },
     {(char* const) "dump-boxes", no_argument, 0, 'd'},
+    {(char* const) "json",       no_argument, 0, 'J'},
+    {(char* const) "jobs",       required_argument, 0, 'j'},
     {(char* const) "help",       no_argument, 0, 'h'},
     {0, 0,                                    0, 0}
 };
@@ -87,15 +95,338 @@ void show_help(const char* argv0)
   fprintf(stderr, " heif-info  libheif version: %s\n", heif_get_version());
   fprintf(stderr, "------------------------------------\n");
   fprintf(stderr, "usage: heif-info [options] image.heic\n");
+  fprintf(stderr, "       heif-info --json [-j N] image.heic ...\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "options:\n");
   //fprintf(stderr,"  -w, --write-raw ID   write raw compressed data of image 'ID'\n");
   //fprintf(stderr,"  -o, --output NAME    output file name for image selected by -w\n");
   fprintf(stderr, "  -d, --dump-boxes     show a low-level dump of all MP4 file boxes\n");
+  fprintf(stderr, "      --json           scan the file structure of all input files without reading the image data\n");
+  fprintf(stderr, "                       and write one JSON object per file (JSON lines)\n");
+  fprintf(stderr, "  -j, --jobs N         number of files scanned in parallel with --json (default: number of cores)\n");
   fprintf(stderr, "  -h, --help           show help\n");
 }
 
 
+// --- JSON scan mode
+
+static std::string json_string(const std::string& s)
+{
+  std::ostringstream out;
+  out << '"';
+
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"':
+        out << "\\\"";
+        break;
+      case '\\':
+        out << "\\\\";
+        break;
+      case '\n':
+        out << "\\n";
+        break;
+      case '\r':
+        out << "\\r";
+        break;
+      case '\t':
+        out << "\\t";
+        break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out << buf;
+        }
+        else {
+          out << c;
+        }
+    }
+  }
+
+  out << '"';
+  return out.str();
+}
+
+
+static std::string fourcc_to_json(uint32_t fourcc)
+{
+  std::string s;
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    s += (char) ((fourcc >> shift) & 0xFF);
+  }
+
+  return json_string(s);
+}
+
+
+static uint64_t get_item_data_size(heif_context* ctx, heif_item_id id, std::ostream* ranges_out)
+{
+  struct heif_file_range* ranges = nullptr;
+  int num_ranges = 0;
+  struct heif_error err = heif_item_get_file_ranges(ctx, id, &ranges, &num_ranges);
+  if (err.code) {
+    return 0;
+  }
+
+  uint64_t size = 0;
+  for (int i = 0; i < num_ranges; i++) {
+    size += ranges[i].size;
+
+    if (ranges_out) {
+      *ranges_out << (i > 0 ? "," : "") << "[" << ranges[i].offset << "," << ranges[i].size << "]";
+    }
+  }
+
+  heif_file_ranges_release(ranges);
+  return size;
+}
+
+
+static void write_json_image(heif_context* ctx, heif_item_id id, std::ostream& out)
+{
+  struct heif_image_handle* handle;
+  struct heif_error err = heif_context_get_image_handle(ctx, id, &handle);
+  if (err.code) {
+    out << "{\"id\":" << id << ",\"error\":" << json_string(err.message) << "}";
+    return;
+  }
+
+  out << "{\"id\":" << id
+      << ",\"codec\":" << fourcc_to_json(heif_item_get_item_type(ctx, id))
+      << ",\"width\":" << heif_image_handle_get_width(handle)
+      << ",\"height\":" << heif_image_handle_get_height(handle)
+      << ",\"bit_depth\":" << heif_image_handle_get_luma_bits_per_pixel(handle)
+      << ",\"primary\":" << (heif_image_handle_is_primary_image(handle) ? "true" : "false")
+      << ",\"alpha\":" << (heif_image_handle_has_alpha_channel(handle) ? "true" : "false");
+
+
+  // --- thumbnails
+
+  int num_thumbnails = heif_image_handle_get_number_of_thumbnails(handle);
+  std::vector<heif_item_id> thumbnail_IDs(num_thumbnails);
+  num_thumbnails = heif_image_handle_get_list_of_thumbnail_IDs(handle, thumbnail_IDs.data(), num_thumbnails);
+
+  out << ",\"thumbnails\":[";
+  for (int i = 0; i < num_thumbnails; i++) {
+    struct heif_image_handle* thumbnail_handle;
+    err = heif_image_handle_get_thumbnail(handle, thumbnail_IDs[i], &thumbnail_handle);
+    if (err.code) {
+      continue;
+    }
+
+    out << (i > 0 ? "," : "")
+        << "{\"id\":" << thumbnail_IDs[i]
+        << ",\"width\":" << heif_image_handle_get_width(thumbnail_handle)
+        << ",\"height\":" << heif_image_handle_get_height(thumbnail_handle) << "}";
+
+    heif_image_handle_release(thumbnail_handle);
+  }
+  out << "]";
+
+
+  // --- auxiliary images (including alpha and depth)
+
+  int num_aux = heif_image_handle_get_number_of_auxiliary_images(handle, 0);
+  std::vector<heif_item_id> aux_IDs(num_aux);
+  num_aux = heif_image_handle_get_list_of_auxiliary_image_IDs(handle, 0, aux_IDs.data(), num_aux);
+
+  out << ",\"aux\":[";
+  for (int i = 0; i < num_aux; i++) {
+    struct heif_image_handle* aux_handle;
+    err = heif_image_handle_get_auxiliary_image_handle(handle, aux_IDs[i], &aux_handle);
+    if (err.code) {
+      continue;
+    }
+
+    const char* aux_type = nullptr;
+    err = heif_image_handle_get_auxiliary_type(aux_handle, &aux_type);
+
+    out << (i > 0 ? "," : "")
+        << "{\"id\":" << aux_IDs[i]
+        << ",\"type\":" << json_string((err.code == 0 && aux_type) ? aux_type : "")
+        << ",\"width\":" << heif_image_handle_get_width(aux_handle)
+        << ",\"height\":" << heif_image_handle_get_height(aux_handle) << "}";
+
+    if (err.code == 0) {
+      heif_image_handle_release_auxiliary_type(aux_handle, &aux_type);
+    }
+    heif_image_handle_release(aux_handle);
+  }
+  out << "]";
+
+
+  // --- metadata (the size is taken from the file structure, the metadata content is not read)
+
+  int num_metadata = heif_image_handle_get_number_of_metadata_blocks(handle, nullptr);
+  std::vector<heif_item_id> metadata_IDs(num_metadata);
+  num_metadata = heif_image_handle_get_list_of_metadata_block_IDs(handle, nullptr, metadata_IDs.data(), num_metadata);
+
+  out << ",\"metadata\":[";
+  for (int i = 0; i < num_metadata; i++) {
+    out << (i > 0 ? "," : "")
+        << "{\"id\":" << metadata_IDs[i]
+        << ",\"type\":" << json_string(heif_image_handle_get_metadata_type(handle, metadata_IDs[i]))
+        << ",\"content_type\":" << json_string(heif_image_handle_get_metadata_content_type(handle, metadata_IDs[i]))
+        << ",\"size\":" << get_item_data_size(ctx, metadata_IDs[i], nullptr) << "}";
+  }
+  out << "]}";
+
+  heif_image_handle_release(handle);
+}
+
+
+// Scans one file in 'metadata_only' mode. No image data (and no metadata content) is read.
+static std::string scan_file_to_json(const std::string& filename)
+{
+  std::ostringstream out;
+  out << "{\"file\":" << json_string(filename);
+
+
+  // --- file type
+
+  std::ifstream istr(filename.c_str(), std::ios_base::binary);
+  if (!istr) {
+    out << ",\"error\":" << json_string("cannot open file") << "}";
+    return out.str();
+  }
+
+  std::vector<uint8_t> header(1024);
+  istr.read((char*) header.data(), (std::streamsize) header.size());
+  int header_size = (int) istr.gcount();
+
+  istr.clear();
+  istr.seekg(0, std::ios_base::end);
+  out << ",\"file_size\":" << (uint64_t) istr.tellg();
+  istr.close();
+
+  out << ",\"mime_type\":" << json_string(heif_get_file_mime_type(header.data(), header_size));
+
+  if (header_size >= 12) {
+    out << ",\"main_brand\":" << fourcc_to_json(heif_read_main_brand(header.data(), header_size));
+
+    heif_brand2* brands = nullptr;
+    int num_brands = 0;
+    struct heif_error err = heif_list_compatible_brands(header.data(), header_size, &brands, &num_brands);
+    if (err.code == 0) {
+      out << ",\"compatible_brands\":[";
+      for (int i = 0; i < num_brands; i++) {
+        out << (i > 0 ? "," : "") << fourcc_to_json(brands[i]);
+      }
+      out << "]";
+
+      heif_free_list_of_compatible_brands(brands);
+    }
+  }
+
+
+  // --- file structure
+
+  std::shared_ptr<heif_context> ctx(heif_context_alloc(),
+                                    [](heif_context* c) { heif_context_free(c); });
+
+  struct heif_reading_options* reading_options = heif_reading_options_alloc();
+  reading_options->metadata_only = true;
+
+  struct heif_error err = heif_context_read_from_file(ctx.get(), filename.c_str(), reading_options);
+  heif_reading_options_free(reading_options);
+
+  if (err.code) {
+    out << ",\"error\":" << json_string(err.message) << "}";
+    return out.str();
+  }
+
+
+  // --- top-level images
+
+  int num_images = heif_context_get_number_of_top_level_images(ctx.get());
+  std::vector<heif_item_id> image_IDs(num_images);
+  num_images = heif_context_get_list_of_top_level_image_IDs(ctx.get(), image_IDs.data(), num_images);
+
+  out << ",\"images\":[";
+  for (int i = 0; i < num_images; i++) {
+    if (i > 0) {
+      out << ",";
+    }
+
+    write_json_image(ctx.get(), image_IDs[i], out);
+  }
+  out << "]";
+
+
+  // --- all items with their byte ranges
+
+  int num_items = heif_context_get_number_of_items(ctx.get());
+  std::vector<heif_item_id> item_IDs(num_items);
+  num_items = heif_context_get_list_of_item_IDs(ctx.get(), item_IDs.data(), num_items);
+
+  out << ",\"items\":[";
+  for (int i = 0; i < num_items; i++) {
+    heif_item_id id = item_IDs[i];
+
+    std::ostringstream ranges;
+    uint64_t size = get_item_data_size(ctx.get(), id, &ranges);
+
+    out << (i > 0 ? "," : "")
+        << "{\"id\":" << id
+        << ",\"type\":" << fourcc_to_json(heif_item_get_item_type(ctx.get(), id))
+        << ",\"hidden\":" << (heif_item_is_item_hidden(ctx.get(), id) ? "true" : "false");
+
+    const char* content_type = heif_item_get_mime_item_content_type(ctx.get(), id);
+    if (content_type && *content_type) {
+      out << ",\"content_type\":" << json_string(content_type);
+    }
+
+    out << ",\"size\":" << size
+        << ",\"ranges\":[" << ranges.str() << "]}";
+  }
+  out << "]}";
+
+  return out.str();
+}
+
+
+// Scans the files with 'num_jobs' threads. The JSON lines are written in the order of the input files.
+static int scan_files_to_json(const std::vector<std::string>& filenames, int num_jobs)
+{
+  std::vector<std::string> results(filenames.size());
+  std::vector<bool> finished(filenames.size(), false);
+  size_t next_output = 0;
+  std::mutex output_mutex;
+
+  std::atomic<size_t> next_file(0);
+
+  auto scan = [&]() {
+    for (size_t i = next_file++; i < filenames.size(); i = next_file++) {
+      std::string json = scan_file_to_json(filenames[i]);
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      results[i] = std::move(json);
+      finished[i] = true;
+
+      while (next_output < filenames.size() && finished[next_output]) {
+        std::cout << results[next_output] << "\n";
+        results[next_output].clear();
+        next_output++;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < std::min(num_jobs, (int) filenames.size()); i++) {
+    threads.emplace_back(scan);
+  }
+  scan();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::cout.flush();
+  return 0;
+}
+
+
 class LibHeifInitializer
 {
 public:
@@ -111,6 +442,8 @@ int main(int argc, char** argv)
   LibHeifInitializer initializer;
 
   bool dump_boxes = false;
+  bool json_scan = false;
+  int num_jobs = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
 
   bool write_raw_image = false;
   heif_item_id raw_image_id;
@@ -118,7 +451,7 @@ int main(int argc, char** argv)
 
   while (true) {
     int option_index = 0;
-    int c = getopt_long(argc, argv, "dh", long_options, &option_index);
+    int c = getopt_long(argc, argv, "dhj:", long_options, &option_index);
     if (c == -1)
       break;
 
@@ -126,6 +459,16 @@ int main(int argc, char** argv)
       case 'd':
         dump_boxes = true;
         break;
+      case 'J':
+        json_scan = true;
+        break;
+      case 'j':
+        num_jobs = atoi(optarg);
+        if (num_jobs < 1) {
+          fprintf(stderr, "Invalid number of jobs.\n");
+          return 5;
+        }
+        break;
       case 'h':
         show_help(argv[0]);
         return 0;
@@ -139,6 +482,11 @@ int main(int argc, char** argv)
     }
   }
 
+  if (json_scan && optind < argc) {
+    std::vector<std::string> filenames(argv + optind, argv + argc);
+    return scan_files_to_json(filenames, num_jobs);
+  }
+
   if (optind != argc - 1) {
     show_help(argv[0]);
     return 0;
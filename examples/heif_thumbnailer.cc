@@ -85,7 +85,7 @@ int main(int argc, char** argv)
     }
   }
 
-  if (optind + 2 > argc) {
+  if (optind + 2 > argc || size <= 0) {
     // Need input and output filenames as additional arguments.
     return usage(argv[0]);
   }
@@ -118,29 +118,15 @@ int main(int argc, char** argv)
   }
 
 
-  // --- if image has a thumbnail, use that instead
+  // --- decode the image
+  //     libheif decodes the smallest stored thumbnail that still covers the requested size
+  //     and scales it down to fit into it. Without a suitable thumbnail, it decodes the primary image
+  //     at a reduced size (e.g. grid tiles are scaled down while they are decoded).
+  //     When the thumbnail has to be rendered from the primary image (-p), this is only possible when there
+  //     are no stored thumbnails that libheif could choose instead.
 
-  if (!thumbnail_from_primary_image_only) {
-    heif_item_id thumbnail_ID;
-    int nThumbnails = heif_image_handle_get_list_of_thumbnail_IDs(image_handle, &thumbnail_ID, 1);
-    if (nThumbnails > 0) {
-      struct heif_image_handle* thumbnail_handle;
-      err = heif_image_handle_get_thumbnail(image_handle, thumbnail_ID, &thumbnail_handle);
-      if (err.code) {
-        std::cerr << "Could not read HEIF image : " << err.message << "\n";
-        return 1;
-      }
-
-      // replace image handle with thumbnail handle
-
-      heif_image_handle_release(image_handle);
-      image_handle = thumbnail_handle;
-    }
-  }
-
-
-
-  // --- decode the image (or its thumbnail)
+  bool decode_at_target_size = (!thumbnail_from_primary_image_only ||
+                                heif_image_handle_get_number_of_thumbnails(image_handle) == 0);
 
   std::unique_ptr<Encoder> encoder(new PngEncoder());
 
@@ -148,6 +134,12 @@ int main(int argc, char** argv)
   encoder->UpdateDecodingOptions(image_handle, decode_options);
   decode_options->convert_hdr_to_8bit = true;
 
+  if (decode_at_target_size) {
+    decode_options->target_bbox_width = size;
+    decode_options->target_bbox_height = size;
+    decode_options->target_scaling_filter = heif_scaling_filter_box;
+  }
+
   int bit_depth = 8;
 
   struct heif_image* image = NULL;
@@ -156,6 +148,7 @@ int main(int argc, char** argv)
                           encoder->colorspace(false),
                           encoder->chroma(false, bit_depth),
                           decode_options);
+  heif_decoding_options_free(decode_options);
   if (err.code) {
     std::cerr << "Could not decode HEIF image : " << err.message << "\n";
     return 1;
@@ -168,7 +161,7 @@ int main(int argc, char** argv)
   int input_width = heif_image_handle_get_width(image_handle);
   int input_height = heif_image_handle_get_height(image_handle);
 
-  if (input_width > size || input_height > size) {
+  if (!decode_at_target_size && (input_width > size || input_height > size)) {
     int thumbnail_width;
     int thumbnail_height;
 
@@ -185,12 +178,16 @@ int main(int argc, char** argv)
     }
 
 
-    // --- output thumbnail smaller than HEIF thumbnail -> scale down
+    // --- output thumbnail smaller than primary image -> scale down
+
+    struct heif_scaling_options* scaling_options = heif_scaling_options_alloc();
+    scaling_options->filter = heif_scaling_filter_box;
 
     struct heif_image* scaled_image = NULL;
     err = heif_image_scale_image(image, &scaled_image,
                                  thumbnail_width, thumbnail_height,
-                                 NULL);
+                                 scaling_options);
+    heif_scaling_options_free(scaling_options);
     if (err.code) {
       std::cerr << "Could not scale image : " << err.message << "\n";
       return 1;
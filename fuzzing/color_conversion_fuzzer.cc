@@ -39,6 +39,13 @@ static bool is_valid_chroma(uint8_t chroma)
     case heif_chroma_interleaved_RRGGBBAA_BE:
     case heif_chroma_interleaved_RRGGBB_LE:
     case heif_chroma_interleaved_RRGGBBAA_LE:
+    case heif_chroma_420_NV12:
+    case heif_chroma_420_NV21:
+    case heif_chroma_420_P010:
+    case heif_chroma_interleaved_RGB_HALF:
+    case heif_chroma_interleaved_RGBA_HALF:
+    case heif_chroma_interleaved_RGB_FLOAT:
+    case heif_chroma_interleaved_RGBA_FLOAT:
       return true;
     default:
       return false;
@@ -22,6 +22,7 @@
 
 #include <gdk-pixbuf/gdk-pixbuf-io.h>
 #include <libheif/heif.h>
+#include <string.h>
 
 
 G_MODULE_EXPORT void fill_vtable(GdkPixbufModule* module);
@@ -29,16 +30,109 @@ G_MODULE_EXPORT void fill_vtable(GdkPixbufModule* module);
 G_MODULE_EXPORT void fill_info(GdkPixbufFormat* info);
 
 
+// The file is parsed as soon as its 'meta' box has been loaded. The image is then decoded in a
+// background thread while the rest of the file is still loading. The reader of this thread waits
+// until the data that libheif requests has arrived, such that the grid tiles are decoded as soon
+// as their data is complete.
 typedef struct
 {
   GdkPixbufModuleUpdatedFunc update_func;
   GdkPixbufModulePreparedFunc prepare_func;
   GdkPixbufModuleSizeFunc size_func;
   gpointer user_data;
+
+  // 'data', 'complete' and the reader position are shared with the decoding thread
+  GMutex mutex;
+  GCond data_added;
   GByteArray* data;
+  gboolean complete;
+  int64_t position;
+
+  struct heif_context* hc;
+  struct heif_image_handle* hdl;
+  gboolean parsing_failed;
+  int requested_width;
+  int requested_height;
+
+  GThread* decoding_thread;
+  struct heif_image* img;
+  struct heif_error decoding_error;
+  gchar* decoding_error_message;
 } HeifPixbufCtx;
 
 
+static int64_t reader_get_position(void* userdata)
+{
+  HeifPixbufCtx* hpc = (HeifPixbufCtx*) userdata;
+  return hpc->position;
+}
+
+
+static int reader_read(void* data, size_t size, void* userdata)
+{
+  HeifPixbufCtx* hpc = (HeifPixbufCtx*) userdata;
+  int result = 1;
+
+  g_mutex_lock(&hpc->mutex);
+  if (hpc->position >= 0 && (uint64_t) hpc->position + size <= hpc->data->len) {
+    memcpy(data, hpc->data->data + hpc->position, size);
+    hpc->position += size;
+    result = 0;
+  }
+  g_mutex_unlock(&hpc->mutex);
+
+  return result;
+}
+
+
+static int reader_seek(int64_t position, void* userdata)
+{
+  HeifPixbufCtx* hpc = (HeifPixbufCtx*) userdata;
+  hpc->position = position;
+  return 0;
+}
+
+
+static enum heif_reader_grow_status reader_wait_for_file_size(int64_t target_size, void* userdata)
+{
+  HeifPixbufCtx* hpc = (HeifPixbufCtx*) userdata;
+  enum heif_reader_grow_status status;
+
+  g_mutex_lock(&hpc->mutex);
+
+  // Wait for more data only while decoding in the background (the tiles may also be decoded by
+  // threads of libheif). load_increment() cannot add data while it is parsing the file itself.
+  if (hpc->decoding_thread) {
+    while (!hpc->complete && (uint64_t) target_size > hpc->data->len) {
+      g_cond_wait(&hpc->data_added, &hpc->mutex);
+    }
+  }
+
+  if ((uint64_t) target_size <= hpc->data->len) {
+    status = heif_reader_grow_status_size_reached;
+  }
+  else if (hpc->complete) {
+    status = heif_reader_grow_status_size_beyond_eof;
+  }
+  else {
+    status = heif_reader_grow_status_timeout;
+  }
+
+  g_mutex_unlock(&hpc->mutex);
+
+  return status;
+}
+
+
+static const struct heif_reader heif_pixbuf_reader = {
+    1,
+    reader_get_position,
+    reader_read,
+    reader_seek,
+    reader_wait_for_file_size
+};
+
+
 static gpointer begin_load(GdkPixbufModuleSizeFunc size_func,
                            GdkPixbufModulePreparedFunc prepare_func,
                            GdkPixbufModuleUpdatedFunc update_func,
@@ -46,8 +140,17 @@ static gpointer begin_load(GdkPixbufModuleSizeFunc size_func,
                            GError** error)
 {
   HeifPixbufCtx* hpc;
+  struct heif_error err;
+
+  err = heif_init(NULL);
+  if (err.code != heif_error_Ok) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED, "%s", err.message);
+    return NULL;
+  }
 
   hpc = g_new0(HeifPixbufCtx, 1);
+  g_mutex_init(&hpc->mutex);
+  g_cond_init(&hpc->data_added);
   hpc->data = g_byte_array_new();
   hpc->size_func = size_func;
   hpc->prepare_func = prepare_func;
@@ -63,15 +166,155 @@ static void release_heif_image(guchar* pixels, gpointer data)
 }
 
 
+// Returns whether the data contains the complete 'meta' box.
+static gboolean have_meta_box(const guint8* data, guint len)
+{
+  uint64_t pos = 0;
+
+  while (pos + 8 <= len) {
+    uint64_t size = ((uint64_t) data[pos] << 24) | ((uint64_t) data[pos + 1] << 16) |
+                    ((uint64_t) data[pos + 2] << 8) | data[pos + 3];
+    uint64_t header_size = 8;
+
+    if (size == 1) {
+      if (pos + 16 > len) {
+        return FALSE;
+      }
+
+      size = 0;
+      for (int i = 0; i < 8; i++) {
+        size = (size << 8) | data[pos + 8 + i];
+      }
+      header_size = 16;
+    }
+
+    if (size < header_size) {
+      // Box extends to the end of the file (size = 0) or is invalid.
+      return FALSE;
+    }
+
+    if (memcmp(data + pos + 4, "meta", 4) == 0) {
+      return pos + size <= len;
+    }
+
+    pos += size;
+  }
+
+  return FALSE;
+}
+
+
+// Reads the file structure from the data loaded so far and asks for the size in which the image
+// should be loaded.
+static gboolean parse_file(HeifPixbufCtx* hpc, GError** error)
+{
+  struct heif_error err;
+  struct heif_reading_options* options;
+
+  hpc->hc = heif_context_alloc();
+  if (!hpc->hc) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY, "cannot allocate heif_context");
+    return FALSE;
+  }
+
+  // Only read the 'ftyp' and 'meta' boxes, the image data is read while decoding.
+  options = heif_reading_options_alloc();
+  options->metadata_only = 1;
+
+  hpc->position = 0;
+  err = heif_context_read_from_reader(hpc->hc, &heif_pixbuf_reader, hpc, options);
+  heif_reading_options_free(options);
+
+  if (err.code == heif_error_Ok) {
+    err = heif_context_get_primary_image_handle(hpc->hc, &hpc->hdl);
+  }
+
+  if (err.code != heif_error_Ok) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "%s", err.message);
+    return FALSE;
+  }
+
+  hpc->requested_width = heif_image_handle_get_width(hpc->hdl);
+  hpc->requested_height = heif_image_handle_get_height(hpc->hdl);
+
+  if (hpc->size_func) {
+    (*hpc->size_func)(&hpc->requested_width, &hpc->requested_height, hpc->user_data);
+  }
+
+  // The size function sets a size of 0 when only the image size was requested.
+  if (hpc->requested_width == 0 || hpc->requested_height == 0) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED, "image has zero width or height");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+static gpointer decode_image(gpointer context)
+{
+  HeifPixbufCtx* hpc = (HeifPixbufCtx*) context;
+  struct heif_decoding_options* options;
+  int has_alpha = heif_image_handle_has_alpha_channel(hpc->hdl);
+
+  // Decode a thumbnail or a downscaled image if a smaller size has been requested.
+  options = heif_decoding_options_alloc();
+  if (hpc->requested_width > 0 && hpc->requested_height > 0) {
+    options->target_bbox_width = hpc->requested_width;
+    options->target_bbox_height = hpc->requested_height;
+  }
+
+  hpc->decoding_error = heif_decode_image(hpc->hdl, &hpc->img, heif_colorspace_RGB,
+                                          has_alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB,
+                                          options);
+  heif_decoding_options_free(options);
+
+  if (hpc->decoding_error.code != heif_error_Ok) {
+    hpc->img = NULL;
+
+    // The message may not be valid anymore when the context is freed.
+    hpc->decoding_error_message = g_strdup(hpc->decoding_error.message);
+  }
+
+  return NULL;
+}
+
+
+static void start_decoding(HeifPixbufCtx* hpc)
+{
+  // Hold the lock such that the reader sees 'decoding_thread' when the thread starts reading.
+  g_mutex_lock(&hpc->mutex);
+  hpc->decoding_thread = g_thread_new("heif-pixbuf-decoder", decode_image, hpc);
+  g_mutex_unlock(&hpc->mutex);
+}
+
+
+static void free_context(HeifPixbufCtx* hpc)
+{
+  if (hpc->hdl) {
+    heif_image_handle_release(hpc->hdl);
+  }
+
+  if (hpc->hc) {
+    heif_context_free(hpc->hc);
+  }
+
+  g_free(hpc->decoding_error_message);
+  g_byte_array_free(hpc->data, TRUE);
+  g_cond_clear(&hpc->data_added);
+  g_mutex_clear(&hpc->mutex);
+  g_free(hpc);
+
+  heif_deinit();
+}
+
+
 static gboolean stop_load(gpointer context, GError** error)
 {
   HeifPixbufCtx* hpc;
   struct heif_error err;
-  struct heif_context* hc = NULL;
-  struct heif_image_handle* hdl = NULL;
   struct heif_image* img = NULL;
   int width, height, stride;
-  int requested_width, requested_height;
   const uint8_t* data;
   GdkPixbuf* pixbuf;
   gboolean result;
@@ -79,56 +322,65 @@ static gboolean stop_load(gpointer context, GError** error)
   result = FALSE;
   hpc = (HeifPixbufCtx*) context;
 
-  err = heif_init(NULL);
-  if (err.code != heif_error_Ok) {
-    g_warning("%s", err.message);
-    goto cleanup;
-  }
+  g_mutex_lock(&hpc->mutex);
+  hpc->complete = TRUE;
+  g_cond_signal(&hpc->data_added);
+  g_mutex_unlock(&hpc->mutex);
 
-  hc = heif_context_alloc();
-  if (!hc) {
-    g_warning("cannot allocate heif_context");
-    goto cleanup;
+  if (hpc->decoding_thread) {
+    g_thread_join(hpc->decoding_thread);
+    hpc->decoding_thread = NULL;
   }
-
-  err = heif_context_read_from_memory_without_copy(hc, hpc->data->data, hpc->data->len, NULL);
-  if (err.code != heif_error_Ok) {
-    g_warning("%s", err.message);
+  else if (hpc->hdl && (hpc->requested_width == 0 || hpc->requested_height == 0)) {
+    // Loading was already stopped by the size function in load_increment().
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED, "image has zero width or height");
     goto cleanup;
   }
+  else {
+    // The 'meta' box was not complete before all data had been loaded, or parsing failed.
+    // Parse again with all data and decode on this thread.
+    if (hpc->hc) {
+      if (hpc->hdl) {
+        heif_image_handle_release(hpc->hdl);
+        hpc->hdl = NULL;
+      }
+      heif_context_free(hpc->hc);
+      hpc->hc = NULL;
+    }
 
-  err = heif_context_get_primary_image_handle(hc, &hdl);
-  if (err.code != heif_error_Ok) {
-    g_warning("%s", err.message);
-    goto cleanup;
+    if (!parse_file(hpc, error)) {
+      goto cleanup;
+    }
+
+    decode_image(hpc);
   }
 
-  int has_alpha = heif_image_handle_has_alpha_channel(hdl);
+  img = hpc->img;
+  hpc->img = NULL;
 
-  err = heif_decode_image(hdl, &img, heif_colorspace_RGB,
-                          has_alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB,
-                          NULL);
-  if (err.code != heif_error_Ok) {
-    g_warning("%s", err.message);
+  if (!img) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "%s",
+                hpc->decoding_error_message ? hpc->decoding_error_message : "cannot decode image");
     goto cleanup;
   }
 
+  int has_alpha = heif_image_has_channel(img, heif_channel_Alpha) ||
+                  heif_image_get_chroma_format(img) == heif_chroma_interleaved_RGBA;
+
   width = heif_image_get_width(img, heif_channel_interleaved);
   height = heif_image_get_height(img, heif_channel_interleaved);
-  requested_width = width;
-  requested_height = height;
-
-  if (hpc->size_func) {
-    (*hpc->size_func)(&requested_width, &requested_height, hpc->user_data);
-  }
 
-  if (requested_width > 0 && requested_height > 0 && (width != requested_width || height != requested_height)) {
+  // The decoded image keeps its aspect ratio and is not scaled up. Scale it to the exact requested size.
+  if (hpc->requested_width > 0 && hpc->requested_height > 0 &&
+      (width != hpc->requested_width || height != hpc->requested_height)) {
     struct heif_image* resized;
-    heif_image_scale_image(img, &resized, requested_width, requested_height, NULL);
-    heif_image_release(img);
-    width = requested_width;
-    height = requested_height;
-    img = resized;
+    err = heif_image_scale_image(img, &resized, hpc->requested_width, hpc->requested_height, NULL);
+    if (err.code == heif_error_Ok) {
+      heif_image_release(img);
+      width = hpc->requested_width;
+      height = hpc->requested_height;
+      img = resized;
+    }
   }
 
   data = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
@@ -136,21 +388,21 @@ static gboolean stop_load(gpointer context, GError** error)
   pixbuf = gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB, has_alpha, 8, width, height, stride, release_heif_image,
                                     img);
 
-  size_t profile_size = heif_image_handle_get_raw_color_profile_size(hdl);
+  size_t profile_size = heif_image_handle_get_raw_color_profile_size(hpc->hdl);
   if(profile_size) {
     guchar *profile_data = (guchar *)g_malloc0(profile_size);
-    err = heif_image_handle_get_raw_color_profile(hdl, profile_data);
+    err = heif_image_handle_get_raw_color_profile(hpc->hdl, profile_data);
     if (err.code == heif_error_Ok) {
       gchar *profile_base64 = g_base64_encode(profile_data, profile_size);
       gdk_pixbuf_set_option(pixbuf, "icc-profile", profile_base64);
       g_free(profile_base64);
-      g_free(profile_data);
     }
     else {
       g_warning("%s", err.message);
     }
+    g_free(profile_data);
   }
-  
+
   if (hpc->prepare_func) {
     (*hpc->prepare_func)(pixbuf, NULL, hpc->user_data);
   }
@@ -159,31 +411,13 @@ static gboolean stop_load(gpointer context, GError** error)
     (*hpc->update_func)(pixbuf, 0, 0, gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf), hpc->user_data);
   }
 
+  // The pixbuf owns the image now.
   g_clear_object(&pixbuf);
 
   result = TRUE;
 
   cleanup:
-  if (img) {
-    // Do not free the image here when we pass it to gdk-pixbuf, as its memory will still be used by gdk-pixbuf.
-
-    if (!result) {
-      heif_image_release(img);
-    }
-  }
-
-  if (hdl) {
-    heif_image_handle_release(hdl);
-  }
-
-  if (hc) {
-    heif_context_free(hc);
-  }
-
-  g_byte_array_free(hpc->data, TRUE);
-  g_free(hpc);
-
-  heif_deinit();
+  free_context(hpc);
 
   return result;
 }
@@ -191,8 +425,33 @@ static gboolean stop_load(gpointer context, GError** error)
 
 static gboolean load_increment(gpointer context, const guchar* buf, guint size, GError** error)
 {
-  HeifPixbufCtx* ctx = (HeifPixbufCtx*) context;
-  g_byte_array_append(ctx->data, buf, size);
+  HeifPixbufCtx* hpc = (HeifPixbufCtx*) context;
+
+  g_mutex_lock(&hpc->mutex);
+  g_byte_array_append(hpc->data, buf, size);
+  g_cond_signal(&hpc->data_added);
+  g_mutex_unlock(&hpc->mutex);
+
+  // Parse the file and start decoding as soon as the 'meta' box is complete.
+  // The data is only appended by this thread, so it can be read here without the lock.
+  if (!hpc->hc && !hpc->parsing_failed && have_meta_box(hpc->data->data, hpc->data->len)) {
+    GError* parse_error = NULL;
+
+    if (parse_file(hpc, &parse_error)) {
+      start_decoding(hpc);
+    }
+    else if (hpc->hdl) {
+      // Loading was stopped by the size function.
+      g_propagate_error(error, parse_error);
+      return FALSE;
+    }
+    else {
+      // Try again with the complete file in stop_load().
+      hpc->parsing_failed = TRUE;
+      g_clear_error(&parse_error);
+    }
+  }
+
   return TRUE;
 }
 
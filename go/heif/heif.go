@@ -299,6 +299,8 @@ const (
 
 	SuberrorInvalidRegionData = C.heif_suberror_Invalid_region_data
 
+	SuberrorDecompressionInvalidData = C.heif_suberror_Decompression_invalid_data
+
 	SuberrorWrongTileImagePixelDepth = C.heif_suberror_Wrong_tile_image_pixel_depth
 
 	SuberrorUnknownNCLXColorPrimaries = C.heif_suberror_Unknown_NCLX_color_primaries
@@ -324,6 +326,8 @@ const (
 
 	SuberrorUnsupportedHeaderCompressionMethod = C.heif_suberror_Unsupported_header_compression_method
 
+	SuberrorUnsupportedGenericCompressionMethod = C.heif_suberror_Unsupported_generic_compression_method
+
 	// --- Encoder_plugin_error ---
 
 	SuberrorUnsupportedBitDepth = C.heif_suberror_Unsupported_bit_depth
@@ -375,6 +379,9 @@ func convertItemIDs(ids []C.heif_item_id, count int) []int {
 
 type Context struct {
 	context *C.struct_heif_context
+
+	// Releases the input memory of ReadFromMemoryWithoutCopy after the context has been freed.
+	releaseData func()
 }
 
 func NewContext() (*Context, error) {
@@ -392,6 +399,11 @@ func NewContext() (*Context, error) {
 func freeHeifContext(c *Context) {
 	C.heif_context_free(c.context)
 	c.context = nil
+
+	if c.releaseData != nil {
+		c.releaseData()
+		c.releaseData = nil
+	}
 }
 
 func (c *Context) ReadFromFile(filename string) error {
@@ -403,6 +415,18 @@ func (c *Context) ReadFromFile(filename string) error {
 	return convertHeifError(err)
 }
 
+// Adds a function that is called after the context has been freed.
+func (c *Context) addReleaseData(release func()) {
+	if previous := c.releaseData; previous != nil {
+		c.releaseData = func() {
+			previous()
+			release()
+		}
+	} else {
+		c.releaseData = release
+	}
+}
+
 func (c *Context) ReadFromMemory(data []byte) error {
 	// TODO: Use reader API internally.
 	err := C.heif_context_read_from_memory(c.context, unsafe.Pointer(&data[0]), C.size_t(len(data)), nil)
@@ -519,6 +543,10 @@ func (c *Context) GetPrimaryImageID() (int, error) {
 
 type ImageHandle struct {
 	handle *C.struct_heif_image_handle
+
+	// The image handle references the input data of the context, which must not be released
+	// before the handle (see ReadFromMemoryWithoutCopy).
+	context *Context
 }
 
 func freeHeifImageHandle(c *ImageHandle) {
@@ -527,7 +555,7 @@ func freeHeifImageHandle(c *ImageHandle) {
 }
 
 func (c *Context) GetPrimaryImageHandle() (*ImageHandle, error) {
-	var handle ImageHandle
+	handle := ImageHandle{context: c}
 	err := C.heif_context_get_primary_image_handle(c.context, &handle.handle)
 	runtime.KeepAlive(c)
 	if err := convertHeifError(err); err != nil {
@@ -538,7 +566,7 @@ func (c *Context) GetPrimaryImageHandle() (*ImageHandle, error) {
 }
 
 func (c *Context) GetImageHandle(id int) (*ImageHandle, error) {
-	var handle ImageHandle
+	handle := ImageHandle{context: c}
 	err := C.heif_context_get_image_handle(c.context, C.heif_item_id(id), &handle.handle)
 	runtime.KeepAlive(c)
 	if err := convertHeifError(err); err != nil {
@@ -598,7 +626,7 @@ func (h *ImageHandle) GetListOfDepthImageIDs() []int {
 }
 
 func (h *ImageHandle) GetDepthImageHandle(depth_image_id int) (*ImageHandle, error) {
-	var handle ImageHandle
+	handle := ImageHandle{context: h.context}
 	err := C.heif_image_handle_get_depth_image_handle(h.handle, C.heif_item_id(depth_image_id), &handle.handle)
 	runtime.KeepAlive(h)
 	if err := convertHeifError(err); err != nil {
@@ -629,7 +657,7 @@ func (h *ImageHandle) GetListOfThumbnailIDs() []int {
 }
 
 func (h *ImageHandle) GetThumbnail(thumbnail_id int) (*ImageHandle, error) {
-	var handle ImageHandle
+	handle := ImageHandle{context: h.context}
 	err := C.heif_image_handle_get_thumbnail(h.handle, C.heif_item_id(thumbnail_id), &handle.handle)
 	runtime.KeepAlive(h)
 	runtime.SetFinalizer(&handle, freeHeifImageHandle)
@@ -663,6 +691,9 @@ func freeHeifDecodingOptions(options *DecodingOptions) {
 
 type Image struct {
 	image *C.struct_heif_image
+
+	// Releases the caller-provided plane memory of DecodeImageInto after the image has been released.
+	releasePlanes func()
 }
 
 func NewImage(width, height int, colorspace Colorspace, chroma Chroma) (*Image, error) {
@@ -678,6 +709,11 @@ func NewImage(width, height int, colorspace Colorspace, chroma Chroma) (*Image,
 func freeHeifImage(image *Image) {
 	C.heif_image_release(image.image)
 	image.image = nil
+
+	if image.releasePlanes != nil {
+		image.releasePlanes()
+		image.releasePlanes = nil
+	}
 }
 
 func (h *ImageHandle) DecodeImage(colorspace Colorspace, chroma Chroma, options *DecodingOptions) (*Image, error) {
@@ -698,6 +734,13 @@ func (h *ImageHandle) DecodeImage(colorspace Colorspace, chroma Chroma, options
 	return &image, nil
 }
 
+// Release frees the image now instead of when it is garbage collected. Planes and Go images
+// obtained without copy become invalid and img must not be used anymore.
+func (img *Image) Release() {
+	runtime.SetFinalizer(img, nil)
+	freeHeifImage(img)
+}
+
 func (img *Image) GetColorspace() Colorspace {
 	cs := Colorspace(C.heif_image_get_colorspace(img.image))
 	runtime.KeepAlive(img)
@@ -734,7 +777,21 @@ func (img *Image) GetBitsPerPixelRange(channel Channel) int {
 	return i
 }
 
+// GetImage returns a copy of the image data as Go image.
 func (img *Image) GetImage() (image.Image, error) {
+	return img.getImage(img.GetPlane)
+}
+
+// GetImageWithoutCopy returns a Go image that directly uses the pixel memory of img if its format
+// has a Go equivalent (8 bit YCbCr 4:2:0, 4:2:2 and 4:4:4, 8 bit interleaved RGBA and 16 bit
+// interleaved RRGGBBAA). Other formats are converted like with GetImage.
+// The returned image is only valid as long as img is: keep a reference to img (e.g. with
+// runtime.KeepAlive) until the returned image is not used anymore.
+func (img *Image) GetImageWithoutCopy() (image.Image, error) {
+	return img.getImage(img.GetPlaneWithoutCopy)
+}
+
+func (img *Image) getImage(getPlane func(Channel) (*ImageAccess, error)) (image.Image, error) {
 	var i image.Image
 	cf := img.GetChromaFormat()
 	switch cs := img.GetColorspace(); cs {
@@ -750,15 +807,15 @@ func (img *Image) GetImage() (image.Image, error) {
 		default:
 			return nil, fmt.Errorf("Unsupported YCbCr chroma format: %v", cf)
 		}
-		y, err := img.GetPlane(ChannelY)
+		y, err := getPlane(ChannelY)
 		if err != nil {
 			return nil, err
 		}
-		cb, err := img.GetPlane(ChannelCb)
+		cb, err := getPlane(ChannelCb)
 		if err != nil {
 			return nil, err
 		}
-		cr, err := img.GetPlane(ChannelCr)
+		cr, err := getPlane(ChannelCr)
 		if err != nil {
 			return nil, err
 		}
@@ -783,15 +840,15 @@ func (img *Image) GetImage() (image.Image, error) {
 	case ColorspaceRGB:
 		switch cf {
 		case Chroma444:
-			r, err := img.GetPlane(ChannelR)
+			r, err := getPlane(ChannelR)
 			if err != nil {
 				return nil, err
 			}
-			g, err := img.GetPlane(ChannelG)
+			g, err := getPlane(ChannelG)
 			if err != nil {
 				return nil, err
 			}
-			b, err := img.GetPlane(ChannelB)
+			b, err := getPlane(ChannelB)
 			if err != nil {
 				return nil, err
 			}
@@ -910,7 +967,7 @@ func (img *Image) GetImage() (image.Image, error) {
 				}
 			}
 		case ChromaInterleavedRGB:
-			rgb, err := img.GetPlane(ChannelInterleaved)
+			rgb, err := getPlane(ChannelInterleaved)
 			if err != nil {
 				return nil, err
 			}
@@ -946,7 +1003,7 @@ func (img *Image) GetImage() (image.Image, error) {
 				},
 			}
 		case ChromaInterleavedRGBA:
-			rgba, err := img.GetPlane(ChannelInterleaved)
+			rgba, err := getPlane(ChannelInterleaved)
 			if err != nil {
 				return nil, err
 			}
@@ -965,7 +1022,7 @@ func (img *Image) GetImage() (image.Image, error) {
 				},
 			}
 		case ChromaInterleavedRRGGBB_BE:
-			rgb, err := img.GetPlane(ChannelInterleaved)
+			rgb, err := getPlane(ChannelInterleaved)
 			if err != nil {
 				return nil, err
 			}
@@ -1029,7 +1086,7 @@ func (img *Image) GetImage() (image.Image, error) {
 				},
 			}
 		case ChromaInterleavedRRGGBBAA_BE:
-			rgba, err := img.GetPlane(ChannelInterleaved)
+			rgba, err := getPlane(ChannelInterleaved)
 			if err != nil {
 				return nil, err
 			}
@@ -1091,6 +1148,13 @@ func (img *Image) GetImage() (image.Image, error) {
 	return i, nil
 }
 
+// PlaneBuffer is caller-provided memory for one plane of a decoded image (see DecodeImageInto).
+type PlaneBuffer struct {
+	Channel Channel
+	Data    []byte
+	Stride  int
+}
+
 type ImageAccess struct {
 	Plane    []byte
 	planePtr unsafe.Pointer
@@ -1116,7 +1180,24 @@ func (i *ImageAccess) setData(data []byte, stride int) {
 	i.Plane = C.GoBytes(i.planePtr, C.int(i.height*i.Stride))
 }
 
+// GetPlane returns a copy of the data of a plane in ImageAccess.Plane.
 func (img *Image) GetPlane(channel Channel) (*ImageAccess, error) {
+	return img.getPlane(channel, true)
+}
+
+// GetPlaneWithoutCopy returns the plane with an ImageAccess.Plane that directly uses the memory of img.
+// Writing to the slice changes the image. The slice is only valid as long as img is: keep a
+// reference to img or to the returned ImageAccess while the slice is used.
+func (img *Image) GetPlaneWithoutCopy(channel Channel) (*ImageAccess, error) {
+	return img.getPlane(channel, false)
+}
+
+// Creates a slice that references C memory. The maximum size is that of the array type.
+func cMemoryToSlice(ptr unsafe.Pointer, size int) []byte {
+	return (*[1 << 30]byte)(ptr)[:size:size]
+}
+
+func (img *Image) getPlane(channel Channel, copyData bool) (*ImageAccess, error) {
 	height := C.heif_image_get_height(img.image, uint32(channel))
 	runtime.KeepAlive(img)
 	if height == -1 {
@@ -1132,8 +1213,15 @@ func (img *Image) GetPlane(channel Channel) (*ImageAccess, error) {
 
 	ptr := unsafe.Pointer(plane)
 	size := stride * height
+	var data []byte
+	if copyData {
+		data = C.GoBytes(ptr, size)
+	} else {
+		data = cMemoryToSlice(ptr, int(size))
+	}
+
 	access := &ImageAccess{
-		Plane:    C.GoBytes(ptr, size),
+		Plane:    data,
 		planePtr: ptr,
 		Stride:   int(stride),
 		height:   int(height),
@@ -1404,7 +1492,7 @@ func decodePrimaryImageFromReader(r io.Reader) (*ImageHandle, error) {
 		return nil, err
 	}
 
-	if err := ctx.ReadFromMemory(data); err != nil {
+	if err := ctx.ReadFromMemoryWithoutCopy(data); err != nil {
 		return nil, err
 	}
 
@@ -0,0 +1,166 @@
+/*
+ * GO interface to libheif
+ * Copyright (c) 2018 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of heif, an example application using libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//go:build go1.21
+// +build go1.21
+
+package heif
+
+/*
+#include <stdlib.h>
+#include <libheif/heif.h>
+
+struct go_heif_plane_buffer
+{
+  int channel;
+  uint8_t* data;
+  size_t size;
+  int stride;
+};
+
+struct go_heif_plane_buffers
+{
+  const struct go_heif_plane_buffer* buffers;
+  int count;
+};
+
+static uint8_t* go_heif_get_output_plane_buffer(enum heif_channel channel, int width, int height,
+                                                int bit_depth, int bytes_per_pixel, int* out_stride,
+                                                void* user_data)
+{
+  const struct go_heif_plane_buffers* planes = (const struct go_heif_plane_buffers*) user_data;
+
+  for (int i = 0; i < planes->count; i++) {
+    const struct go_heif_plane_buffer* plane = &planes->buffers[i];
+    if (plane->channel != (int) channel) {
+      continue;
+    }
+
+    if (plane->stride < width * bytes_per_pixel ||
+        plane->size < (size_t) plane->stride * (size_t) height) {
+      return NULL;
+    }
+
+    *out_stride = plane->stride;
+    return plane->data;
+  }
+
+  return NULL;
+}
+
+static struct heif_error go_heif_decode_image_into(const struct heif_image_handle* handle,
+                                                   struct heif_image** out_img,
+                                                   enum heif_colorspace colorspace,
+                                                   enum heif_chroma chroma,
+                                                   const struct heif_decoding_options* options,
+                                                   struct go_heif_plane_buffers* planes)
+{
+  // Use a copy of the options, they may be shared between goroutines.
+  struct heif_decoding_options* decode_options = heif_decoding_options_alloc();
+  if (options) {
+    *decode_options = *options;
+  }
+
+  decode_options->get_output_plane_buffer = go_heif_get_output_plane_buffer;
+  decode_options->output_buffer_user_data = planes;
+
+  struct heif_error err = heif_decode_image(handle, out_img, colorspace, chroma, decode_options);
+  heif_decoding_options_free(decode_options);
+  return err;
+}
+*/
+import "C"
+
+import (
+	"fmt"
+	"runtime"
+	"unsafe"
+)
+
+// ReadFromMemoryWithoutCopy reads the file directly from data. data is pinned until the context
+// and all image handles obtained from it have been garbage collected, and must not be modified
+// during that time.
+func (c *Context) ReadFromMemoryWithoutCopy(data []byte) error {
+	if len(data) == 0 {
+		return fmt.Errorf("No input data")
+	}
+
+	pinner := &runtime.Pinner{}
+	pinner.Pin(&data[0])
+
+	err := C.heif_context_read_from_memory_without_copy(c.context, unsafe.Pointer(&data[0]), C.size_t(len(data)), nil)
+	runtime.KeepAlive(c)
+
+	// Also after an error, the context may still reference the data.
+	c.addReleaseData(pinner.Unpin)
+	return convertHeifError(err)
+}
+
+// DecodeImageInto decodes the image into the caller-provided planes instead of memory allocated
+// by libheif. There has to be a PlaneBuffer for each plane of the requested colorspace and chroma
+// with a Stride of at least the plane width times its bytes per pixel and Stride*height bytes of Data.
+// The planes are pinned and used by the returned image until it is released (see Image.Release)
+// or garbage collected. Only reuse them for the next image after this.
+func (h *ImageHandle) DecodeImageInto(colorspace Colorspace, chroma Chroma, options *DecodingOptions, planes []PlaneBuffer) (*Image, error) {
+	if len(planes) == 0 {
+		return nil, fmt.Errorf("No output planes")
+	}
+
+	bufferMemory := C.malloc(C.size_t(len(planes)) * C.size_t(unsafe.Sizeof(C.struct_go_heif_plane_buffer{})))
+	defer C.free(bufferMemory)
+	buffers := (*[1 << 16]C.struct_go_heif_plane_buffer)(bufferMemory)[:len(planes):len(planes)]
+
+	pinner := &runtime.Pinner{}
+	for i, plane := range planes {
+		if len(plane.Data) == 0 {
+			pinner.Unpin()
+			return nil, fmt.Errorf("No memory for channel %v", plane.Channel)
+		}
+
+		pinner.Pin(&plane.Data[0])
+		buffers[i].channel = C.int(plane.Channel)
+		buffers[i].data = (*C.uint8_t)(unsafe.Pointer(&plane.Data[0]))
+		buffers[i].size = C.size_t(len(plane.Data))
+		buffers[i].stride = C.int(plane.Stride)
+	}
+
+	cPlanes := C.struct_go_heif_plane_buffers{
+		buffers: &buffers[0],
+		count:   C.int(len(planes)),
+	}
+
+	var opt *C.struct_heif_decoding_options
+	if options != nil {
+		opt = options.options
+	}
+
+	var image Image
+	err := C.go_heif_decode_image_into(h.handle, &image.image, uint32(colorspace), uint32(chroma), opt, &cPlanes)
+	runtime.KeepAlive(h)
+	runtime.KeepAlive(options)
+	if err := convertHeifError(err); err != nil {
+		pinner.Unpin()
+		return nil, err
+	}
+
+	image.releasePlanes = pinner.Unpin
+	runtime.SetFinalizer(&image, freeHeifImage)
+	return &image, nil
+}
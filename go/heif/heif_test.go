@@ -87,6 +87,14 @@ func CheckHeifImage(t *testing.T, handle *ImageHandle, thumbnail bool) {
 				t.Errorf("Could not get image with %v /%v: %s", test.colorspace, test.chroma, err)
 				continue
 			}
+
+			copied, _ := img.GetImage()
+			if direct, err := img.GetImageWithoutCopy(); err != nil {
+				t.Errorf("Could not get image without copy with %v /%v: %s", test.colorspace, test.chroma, err)
+			} else if direct.Bounds() != copied.Bounds() || direct.At(0, 0) != copied.At(0, 0) {
+				t.Errorf("Image without copy differs from copied image with %v / %v", test.colorspace, test.chroma)
+			}
+			img.Release()
 		}
 	}
 }
@@ -144,6 +152,78 @@ func TestReadFromMemory(t *testing.T) {
 	CheckHeifFile(t, ctx)
 }
 
+func TestReadFromMemoryWithoutCopy(t *testing.T) {
+	ctx, err := NewContext()
+	if err != nil {
+		t.Fatalf("Can't create context: %s", err)
+	}
+
+	filename := path.Join("..", "..", "examples", "example.heic")
+	data, err := ioutil.ReadFile(filename)
+	if err != nil {
+		t.Fatalf("Can't read file %s: %s", filename, err)
+	}
+	if err := ctx.ReadFromMemoryWithoutCopy(data); err != nil {
+		t.Fatalf("Can't read from memory: %s", err)
+	}
+	data = nil
+
+	CheckHeifFile(t, ctx)
+}
+
+func TestDecodeImageInto(t *testing.T) {
+	ctx, err := NewContext()
+	if err != nil {
+		t.Fatalf("Can't create context: %s", err)
+	}
+
+	filename := path.Join("..", "..", "examples", "example.heic")
+	if err := ctx.ReadFromFile(filename); err != nil {
+		t.Fatalf("Can't read from %s: %s", filename, err)
+	}
+
+	handle, err := ctx.GetPrimaryImageHandle()
+	if err != nil {
+		t.Fatalf("Could not get primary image handle: %s", err)
+	}
+
+	width := handle.GetWidth()
+	height := handle.GetHeight()
+	dst := image.NewRGBA(image.Rect(0, 0, width, height))
+	planes := []PlaneBuffer{
+		PlaneBuffer{ChannelInterleaved, dst.Pix, dst.Stride},
+	}
+
+	img, err := handle.DecodeImageInto(ColorspaceRGB, ChromaInterleavedRGBA, nil, planes)
+	if err != nil {
+		t.Fatalf("Could not decode image into buffer: %s", err)
+	}
+
+	img.Release()
+
+	reference, err := handle.DecodeImage(ColorspaceRGB, ChromaInterleavedRGBA, nil)
+	if err != nil {
+		t.Fatalf("Could not decode image: %s", err)
+	}
+	expected, err := reference.GetImage()
+	if err != nil {
+		t.Fatalf("Could not get image: %s", err)
+	}
+
+	for _, p := range []image.Point{{0, 0}, {width / 2, height / 2}, {width - 1, height - 1}} {
+		if dst.At(p.X, p.Y) != expected.At(p.X, p.Y) {
+			t.Errorf("Pixel %v differs: %v != %v", p, dst.At(p.X, p.Y), expected.At(p.X, p.Y))
+		}
+	}
+
+	small := []PlaneBuffer{
+		PlaneBuffer{ChannelInterleaved, make([]byte, width*4), width * 4},
+	}
+	if _, err := handle.DecodeImageInto(ColorspaceRGB, ChromaInterleavedRGBA, nil, small); err == nil {
+		t.Error("Expected an error for a too small output buffer")
+	}
+}
+
 func TestReadImage(t *testing.T) {
 	filename := path.Join("..", "..", "examples", "example.heic")
 	fp, err := os.Open(filename)
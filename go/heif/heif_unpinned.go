@@ -0,0 +1,85 @@
+/*
+ * GO interface to libheif
+ * Copyright (c) 2018 struktur AG, Dirk Farin <farin@struktur.de>
+ *
+ * This file is part of heif, an example application using libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//go:build !go1.21
+// +build !go1.21
+
+package heif
+
+// #include <stdlib.h>
+// #include <libheif/heif.h>
+import "C"
+
+import (
+	"fmt"
+	"runtime"
+)
+
+// Go versions before 1.21 cannot pin memory that is used by libheif after a call has returned.
+// The functions in this file provide the same API with one copy of the data.
+
+// ReadFromMemoryWithoutCopy reads the file from data. With this Go version, data is copied once
+// into C memory that is used by the context without copying it again.
+func (c *Context) ReadFromMemoryWithoutCopy(data []byte) error {
+	if len(data) == 0 {
+		return fmt.Errorf("No input data")
+	}
+
+	cData := C.CBytes(data)
+
+	err := C.heif_context_read_from_memory_without_copy(c.context, cData, C.size_t(len(data)), nil)
+	runtime.KeepAlive(c)
+
+	c.addReleaseData(func() {
+		C.free(cData)
+	})
+	return convertHeifError(err)
+}
+
+// DecodeImageInto decodes the image and writes its planes into the caller-provided planes.
+// There has to be a PlaneBuffer for each plane of the requested colorspace and chroma with a
+// Stride of at least the plane width times its bytes per pixel and Stride*height bytes of Data.
+// With this Go version, the image is decoded into memory of libheif and copied into the planes.
+// The returned image does not use the planes.
+func (h *ImageHandle) DecodeImageInto(colorspace Colorspace, chroma Chroma, options *DecodingOptions, planes []PlaneBuffer) (*Image, error) {
+	img, err := h.DecodeImage(colorspace, chroma, options)
+	if err != nil {
+		return nil, err
+	}
+
+	for _, plane := range planes {
+		access, err := img.GetPlaneWithoutCopy(plane.Channel)
+		if err != nil {
+			return nil, err
+		}
+
+		rowSize := (img.GetWidth(plane.Channel)*img.GetBitsPerPixel(plane.Channel) + 7) / 8
+		if plane.Stride < rowSize || len(plane.Data) < plane.Stride*access.height {
+			return nil, fmt.Errorf("Output plane for channel %v is too small", plane.Channel)
+		}
+
+		for y := 0; y < access.height; y++ {
+			copy(plane.Data[y*plane.Stride:y*plane.Stride+rowSize], access.Plane[y*access.Stride:])
+		}
+	}
+
+	runtime.KeepAlive(img)
+	return img, nil
+}
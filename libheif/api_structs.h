@@ -23,7 +23,11 @@
 
 #include "pixelimage.h"
 #include "context.h"
+#include "encoding_time_budget.h"
+#include "sequence_decoder.h"
+#include "color-conversion/colorconversion.h"
 
+#include <atomic>
 #include <memory>
 
 struct heif_image_handle
@@ -41,12 +45,41 @@ struct heif_image
 };
 
 
+struct heif_decoding_request
+{
+  // shared with the decoding task, which may outlive the request
+  std::shared_ptr<std::atomic<bool>> canceled;
+};
+
+
 struct heif_context
 {
   std::shared_ptr<HeifContext> context;
 };
 
 
+struct heif_engine
+{
+  std::shared_ptr<HeifEngine> engine;
+};
+
+
+struct heif_sequence_decoder
+{
+  std::shared_ptr<HeifContext> context;
+  std::unique_ptr<SequenceDecoder> decoder;
+};
+
+
+struct heif_color_conversion_pipeline
+{
+  ColorConversionInfo info;
+
+  // the strings returned in heif_color_conversion_step::operation_name
+  std::vector<std::string> operation_names;
+};
+
+
 struct heif_encoder
 {
   heif_encoder(const struct heif_encoder_plugin* plugin);
@@ -57,9 +90,16 @@ struct heif_encoder
 
   void release();
 
+  // Set the parameters of this (allocated) encoder to the current values of 'src'.
+  // 'src' has to use the same plugin.
+  struct heif_error copy_parameters_from(const heif_encoder& src);
+
 
   const struct heif_encoder_plugin* plugin;
   void* encoder = nullptr;
+
+  // see heif_encoder_set_target_encoding_time(), shared with the copies of this encoder
+  std::shared_ptr<EncodingTimeBudget> time_budget;
 };
 
 
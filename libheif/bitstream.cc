@@ -19,6 +19,7 @@
  */
 
 #include "bitstream.h"
+#include "statistics.h"
 
 #include <utility>
 #include <cstring>
@@ -53,6 +54,13 @@ bool StreamReader_istream::read(void* data, size_t size)
   }
 
   m_istr->read((char*) data, size);
+
+  // the file may have been truncated after its length was determined
+  if (static_cast<size_t>(m_istr->gcount()) != size) {
+    return false;
+  }
+
+  statistics::add(statistics::bytes_read, size);
   return true;
 }
 
@@ -107,6 +115,7 @@ bool StreamReader_memory::read(void* data, size_t size)
 
   memcpy(data, &m_data[m_position], size);
   m_position += size;
+  statistics::add(statistics::bytes_read, size);
 
   return true;
 }
@@ -120,6 +129,82 @@ bool StreamReader_memory::seek(int64_t position)
   return true;
 }
 
+const uint8_t* StreamReader_memory::get_memory_view(int64_t position, size_t size) const
+{
+  if (position < 0 || position > m_length ||
+      size > static_cast<uint64_t>(m_length - position)) {
+    return nullptr;
+  }
+
+  return m_data + position;
+}
+
+bool StreamReader_memory::read_at(int64_t position, void* data, size_t size)
+{
+  const uint8_t* src = get_memory_view(position, size);
+  if (!src) {
+    return false;
+  }
+
+  memcpy(data, src, size);
+  statistics::add(statistics::bytes_read, size);
+  return true;
+}
+
+
+StreamReader_section::StreamReader_section(std::vector<uint8_t>&& data, int64_t file_position)
+    : m_data(std::move(data)), m_file_position(file_position)
+{
+}
+
+StreamReader::grow_status StreamReader_section::wait_for_file_size(int64_t target_size)
+{
+  return (target_size - m_file_position > (int64_t) m_data.size()) ? size_beyond_eof : size_reached;
+}
+
+bool StreamReader_section::read(void* data, size_t size)
+{
+  if (!read_at(get_position(), data, size)) {
+    return false;
+  }
+
+  m_position += size;
+  return true;
+}
+
+bool StreamReader_section::seek(int64_t position)
+{
+  int64_t section_position = position - m_file_position;
+  if (section_position < 0 || section_position > (int64_t) m_data.size()) {
+    return false;
+  }
+
+  m_position = section_position;
+  return true;
+}
+
+const uint8_t* StreamReader_section::get_memory_view(int64_t position, size_t size) const
+{
+  int64_t section_position = position - m_file_position;
+  if (section_position < 0 || section_position > (int64_t) m_data.size() ||
+      size > static_cast<uint64_t>((int64_t) m_data.size() - section_position)) {
+    return nullptr;
+  }
+
+  return m_data.data() + section_position;
+}
+
+bool StreamReader_section::read_at(int64_t position, void* data, size_t size)
+{
+  const uint8_t* src = get_memory_view(position, size);
+  if (!src) {
+    return false;
+  }
+
+  memcpy(data, src, size);
+  return true;
+}
+
 
 StreamReader_CApi::StreamReader_CApi(const heif_reader* func_table, void* userdata)
     : m_func_table(func_table), m_userdata(userdata)
@@ -142,6 +227,48 @@ StreamReader::grow_status StreamReader_CApi::wait_for_file_size(int64_t target_s
   }
 }
 
+bool StreamReader_CApi::read(void* data, size_t size)
+{
+  if (m_func_table->read(data, size, m_userdata)) {
+    return false;
+  }
+
+  statistics::add(statistics::bytes_read, size);
+  return true;
+}
+
+
+static void range_completed_callback(int range_index, int success, void* completion_userdata)
+{
+  auto on_completed = static_cast<const StreamReader::range_completion_callback*>(completion_userdata);
+  (*on_completed)(static_cast<size_t>(range_index), success != 0);
+}
+
+
+bool StreamReader_CApi::request_ranges(const std::vector<FileRange>& ranges,
+                                       const range_completion_callback* on_completed)
+{
+  if (m_func_table->reader_api_version < 2 ||
+      m_func_table->request_ranges == nullptr ||
+      ranges.empty() ||
+      ranges.size() > (size_t) std::numeric_limits<int>::max()) {
+    return false;
+  }
+
+  std::vector<heif_file_range> c_ranges(ranges.size());
+  for (size_t i = 0; i < ranges.size(); i++) {
+    c_ranges[i].offset = ranges[i].offset;
+    c_ranges[i].size = ranges[i].size;
+  }
+
+  m_func_table->request_ranges(c_ranges.data(), static_cast<int>(c_ranges.size()),
+                               range_completed_callback,
+                               const_cast<range_completion_callback*>(on_completed),
+                               m_userdata);
+
+  return true;
+}
+
 
 BitstreamRange::BitstreamRange(std::shared_ptr<StreamReader> istr,
                                uint64_t length,
@@ -150,6 +277,7 @@ BitstreamRange::BitstreamRange(std::shared_ptr<StreamReader> istr,
 {
   if (parent) {
     m_nesting_level = parent->m_nesting_level + 1;
+    m_memory_arena = parent->m_memory_arena;
   }
 }
 
@@ -580,14 +708,23 @@ void StreamWriter::write(const std::string& str)
 
 void StreamWriter::write(const std::vector<uint8_t>& vec)
 {
-  size_t required_size = m_position + vec.size();
+  write(vec.data(), vec.size());
+}
+
+
+void StreamWriter::write(const uint8_t* data, size_t size)
+{
+  size_t required_size = m_position + size;
 
   if (required_size > m_data.size()) {
     m_data.resize(required_size);
   }
 
-  memcpy(m_data.data() + m_position, vec.data(), vec.size());
-  m_position += vec.size();
+  if (size > 0) {
+    memcpy(m_data.data() + m_position, data, size);
+  }
+
+  m_position += size;
 }
 
 
@@ -607,7 +744,7 @@ void StreamWriter::write(const StreamWriter& writer)
 }
 
 
-void StreamWriter::skip(int n)
+void StreamWriter::skip(size_t n)
 {
   assert(m_position == m_data.size());
   m_data.resize(m_data.size() + n);
@@ -615,10 +752,8 @@ void StreamWriter::skip(int n)
 }
 
 
-void StreamWriter::insert(int nBytes)
+void StreamWriter::insert(size_t nBytes)
 {
-  assert(nBytes >= 0);
-
   if (nBytes == 0) {
     return;
   }
@@ -35,8 +35,20 @@
 #include <istream>
 #include <string>
 
+#include <functional>
+
 #include "error.h"
 
+class MemoryArena;
+
+
+// A range of bytes in the input file.
+struct FileRange
+{
+  uint64_t offset;
+  uint64_t size;
+};
+
 
 class StreamReader
 {
@@ -64,6 +76,40 @@ public:
   {
     return seek(get_position() + position_offset);
   }
+
+  // Read 'size' bytes at 'position'. Implementations that return true for has_concurrent_read_at()
+  // do not use the read position and can be called from several threads at the same time.
+  // The default implementation seeks and reads, so calls have to be serialized by the caller.
+  virtual bool read_at(int64_t position, void* data, size_t size)
+  {
+    return seek(position) && read(data, size);
+  }
+
+  virtual bool has_concurrent_read_at() const { return false; }
+
+  // If the stream data is held in memory, return a pointer to 'size' bytes at 'position'
+  // that stays valid for the lifetime of the StreamReader. This does not change the read position.
+  // Returns nullptr if the stream cannot provide direct access and the data has to be read().
+  virtual const uint8_t* get_memory_view(int64_t position, size_t size) const
+  {
+    (void) position;
+    (void) size;
+    return nullptr;
+  }
+
+  // Callback for request_ranges() with the index of the completed range.
+  typedef std::function<void(size_t range_index, bool success)> range_completion_callback;
+
+  // Ask the reader to fetch the given ranges asynchronously. 'on_completed' is called exactly once
+  // for each range (possibly from another thread) and has to stay valid until then.
+  // Returns false if the reader does not support range requests. 'on_completed' is not called in this case.
+  virtual bool request_ranges(const std::vector<FileRange>& ranges,
+                              const range_completion_callback* on_completed)
+  {
+    (void) ranges;
+    (void) on_completed;
+    return false;
+  }
 };
 
 
@@ -101,6 +147,12 @@ public:
 
   bool seek(int64_t position) override;
 
+  const uint8_t* get_memory_view(int64_t position, size_t size) const override;
+
+  bool read_at(int64_t position, void* data, size_t size) override;
+
+  bool has_concurrent_read_at() const override { return true; }
+
 private:
   const uint8_t* m_data;
   int64_t m_length;
@@ -111,6 +163,34 @@ private:
 };
 
 
+// A StreamReader on a copy of a section of the input file. Positions refer to the input file,
+// so that boxes parsed from the section can store file positions (e.g. 'idat').
+class StreamReader_section : public StreamReader
+{
+public:
+  StreamReader_section(std::vector<uint8_t>&& data, int64_t file_position);
+
+  int64_t get_position() const override { return m_file_position + m_position; }
+
+  grow_status wait_for_file_size(int64_t target_size) override;
+
+  bool read(void* data, size_t size) override;
+
+  bool seek(int64_t position) override;
+
+  const uint8_t* get_memory_view(int64_t position, size_t size) const override;
+
+  bool read_at(int64_t position, void* data, size_t size) override;
+
+  bool has_concurrent_read_at() const override { return true; }
+
+private:
+  std::vector<uint8_t> m_data;
+  int64_t m_file_position;
+  int64_t m_position = 0;
+};
+
+
 class StreamReader_CApi : public StreamReader
 {
 public:
@@ -120,10 +200,13 @@ public:
 
   StreamReader::grow_status wait_for_file_size(int64_t target_size) override;
 
-  bool read(void* data, size_t size) override { return !m_func_table->read(data, size, m_userdata); }
+  bool read(void* data, size_t size) override;
 
   bool seek(int64_t position) override { return !m_func_table->seek(position, m_userdata); }
 
+  bool request_ranges(const std::vector<FileRange>& ranges,
+                      const range_completion_callback* on_completed) override;
+
 private:
   const heif_reader* m_func_table;
   void* m_userdata;
@@ -220,11 +303,18 @@ public:
 
   int64_t get_remaining_bytes() const { return m_remaining; }
 
+  // Boxes parsed from this range (and its sub-ranges) are allocated in this arena.
+  void set_memory_arena(std::shared_ptr<MemoryArena> arena) { m_memory_arena = std::move(arena); }
+
+  const std::shared_ptr<MemoryArena>& get_memory_arena() const { return m_memory_arena; }
+
 private:
   std::shared_ptr<StreamReader> m_istr;
   BitstreamRange* m_parent_range = nullptr;
   int m_nesting_level = 0;
 
+  std::shared_ptr<MemoryArena> m_memory_arena;
+
   int64_t m_remaining;
   bool m_error = false;
 
@@ -281,6 +371,9 @@ private:
 class StreamWriter
 {
 public:
+  // Receives consecutive parts of the output when the data is not collected in a StreamWriter.
+  typedef std::function<Error(const uint8_t* data, size_t size)> output_sink;
+
   void write8(uint8_t);
 
   void write16(uint16_t);
@@ -295,11 +388,13 @@ public:
 
   void write(const std::vector<uint8_t>&);
 
+  void write(const uint8_t* data, size_t size);
+
   void write(const StreamWriter&);
 
-  void skip(int n);
+  void skip(size_t n);
 
-  void insert(int nBytes);
+  void insert(size_t nBytes);
 
   size_t data_size() const { return m_data.size(); }
 
@@ -309,7 +404,7 @@ public:
 
   void set_position_to_end() { m_position = m_data.size(); }
 
-  const std::vector<uint8_t> get_data() const { return m_data; }
+  const std::vector<uint8_t>& get_data() const { return m_data; }
 
 private:
   std::vector<uint8_t> m_data;
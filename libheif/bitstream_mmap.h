@@ -0,0 +1,52 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_BITSTREAM_MMAP_H
+#define LIBHEIF_BITSTREAM_MMAP_H
+
+#include "bitstream.h"
+
+#include <memory>
+
+
+// A StreamReader that maps a complete file into memory. Reading boxes and extracting
+// compressed image data then works directly on the mapped pages (see StreamReader::get_memory_view()),
+// and the pages are shared through the page cache with all other processes reading the same file.
+// The implementation is platform specific (bitstream_mmap_unix.cc / bitstream_mmap_windows.cc).
+class StreamReader_mmap : public StreamReader_memory
+{
+public:
+  ~StreamReader_mmap() override;
+
+  // Returns nullptr if the file cannot be mapped (e.g. it is no regular file or it is empty).
+  // The caller should fall back to reading the file with a StreamReader_istream in this case.
+  static std::shared_ptr<StreamReader_mmap> open(const char* filename);
+
+private:
+  StreamReader_mmap(const uint8_t* data, int64_t size, void* mapping_handle);
+
+  const uint8_t* m_mapped_data;
+  int64_t m_mapped_size;
+
+  // platform specific handle of the mapping (unused on Unix)
+  void* m_mapping_handle;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bitstream_mmap.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+
+
+StreamReader_mmap::StreamReader_mmap(const uint8_t* data, int64_t size, void* mapping_handle)
+    : StreamReader_memory(data, size, false),
+      m_mapped_data(data),
+      m_mapped_size(size),
+      m_mapping_handle(mapping_handle)
+{
+}
+
+
+StreamReader_mmap::~StreamReader_mmap()
+{
+  munmap(const_cast<uint8_t*>(m_mapped_data), static_cast<size_t>(m_mapped_size));
+}
+
+
+std::shared_ptr<StreamReader_mmap> StreamReader_mmap::open(const char* filename)
+{
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      !S_ISREG(st.st_mode) ||
+      st.st_size <= 0 ||
+      static_cast<uint64_t>(st.st_size) > SIZE_MAX) {
+    close(fd);
+    return nullptr;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // the mapping stays valid after closing the file descriptor
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  return std::shared_ptr<StreamReader_mmap>(new StreamReader_mmap((const uint8_t*) data,
+                                                                  static_cast<int64_t>(size),
+                                                                  nullptr));
+}
@@ -0,0 +1,80 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bitstream_mmap.h"
+#include "file.h"
+
+#include <windows.h>
+
+
+StreamReader_mmap::StreamReader_mmap(const uint8_t* data, int64_t size, void* mapping_handle)
+    : StreamReader_memory(data, size, false),
+      m_mapped_data(data),
+      m_mapped_size(size),
+      m_mapping_handle(mapping_handle)
+{
+}
+
+
+StreamReader_mmap::~StreamReader_mmap()
+{
+  UnmapViewOfFile(m_mapped_data);
+  CloseHandle((HANDLE) m_mapping_handle);
+}
+
+
+std::shared_ptr<StreamReader_mmap> StreamReader_mmap::open(const char* filename)
+{
+  std::wstring wfilename = HeifFile::convert_utf8_path_to_utf16(filename);
+
+  HANDLE file = CreateFileW(wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+
+  LARGE_INTEGER size;
+  if (GetFileType(file) != FILE_TYPE_DISK ||
+      !GetFileSizeEx(file, &size) ||
+      size.QuadPart <= 0 ||
+      static_cast<uint64_t>(size.QuadPart) > SIZE_MAX) {
+    CloseHandle(file);
+    return nullptr;
+  }
+
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+  // the mapping keeps a reference to the file
+  CloseHandle(file);
+
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+
+  void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (data == nullptr) {
+    CloseHandle(mapping);
+    return nullptr;
+  }
+
+  return std::shared_ptr<StreamReader_mmap>(new StreamReader_mmap((const uint8_t*) data,
+                                                                  static_cast<int64_t>(size.QuadPart),
+                                                                  mapping));
+}
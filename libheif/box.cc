@@ -27,6 +27,8 @@
 #include "box.h"
 #include "security_limits.h"
 #include "nclx.h"
+#include "memory_arena.h"
+#include "track.h"
 
 #include <iomanip>
 #include <utility>
@@ -413,153 +415,239 @@ Error Box::read(BitstreamRange& range, std::shared_ptr<Box>* result)
     return range.get_error();
   }
 
+  return read(range, hdr, result);
+}
+
+
+Error Box::read(BitstreamRange& range, const BoxHeader& hdr, std::shared_ptr<Box>* result)
+{
   std::shared_ptr<Box> box;
+  const auto& arena = range.get_memory_arena();
 
   switch (hdr.get_short_type()) {
     case fourcc("ftyp"):
-      box = std::make_shared<Box_ftyp>();
+      box = make_shared_in_arena<Box_ftyp>(arena);
       break;
 
     case fourcc("meta"):
-      box = std::make_shared<Box_meta>();
+      box = make_shared_in_arena<Box_meta>(arena);
       break;
 
     case fourcc("hdlr"):
-      box = std::make_shared<Box_hdlr>();
+      box = make_shared_in_arena<Box_hdlr>(arena);
       break;
 
     case fourcc("pitm"):
-      box = std::make_shared<Box_pitm>();
+      box = make_shared_in_arena<Box_pitm>(arena);
       break;
 
     case fourcc("iloc"):
-      box = std::make_shared<Box_iloc>();
+      box = make_shared_in_arena<Box_iloc>(arena);
       break;
 
     case fourcc("iinf"):
-      box = std::make_shared<Box_iinf>();
+      box = make_shared_in_arena<Box_iinf>(arena);
       break;
 
     case fourcc("infe"):
-      box = std::make_shared<Box_infe>();
+      box = make_shared_in_arena<Box_infe>(arena);
       break;
 
     case fourcc("iprp"):
-      box = std::make_shared<Box_iprp>();
+      box = make_shared_in_arena<Box_iprp>(arena);
       break;
 
     case fourcc("ipco"):
-      box = std::make_shared<Box_ipco>();
+      box = make_shared_in_arena<Box_ipco>(arena);
       break;
 
     case fourcc("ipma"):
-      box = std::make_shared<Box_ipma>();
+      box = make_shared_in_arena<Box_ipma>(arena);
       break;
 
     case fourcc("ispe"):
-      box = std::make_shared<Box_ispe>();
+      box = make_shared_in_arena<Box_ispe>(arena);
       break;
 
     case fourcc("auxC"):
-      box = std::make_shared<Box_auxC>();
+      box = make_shared_in_arena<Box_auxC>(arena);
       break;
 
     case fourcc("irot"):
-      box = std::make_shared<Box_irot>();
+      box = make_shared_in_arena<Box_irot>(arena);
       break;
 
     case fourcc("imir"):
-      box = std::make_shared<Box_imir>();
+      box = make_shared_in_arena<Box_imir>(arena);
       break;
 
     case fourcc("clap"):
-      box = std::make_shared<Box_clap>();
+      box = make_shared_in_arena<Box_clap>(arena);
       break;
 
     case fourcc("iref"):
-      box = std::make_shared<Box_iref>();
+      box = make_shared_in_arena<Box_iref>(arena);
       break;
 
     case fourcc("hvcC"):
-      box = std::make_shared<Box_hvcC>();
+      box = make_shared_in_arena<Box_hvcC>(arena);
       break;
 
     case fourcc("av1C"):
-      box = std::make_shared<Box_av1C>();
+      box = make_shared_in_arena<Box_av1C>(arena);
+      break;
+
+    case fourcc("jpgC"):
+      box = make_shared_in_arena<Box_jpgC>(arena);
       break;
 
     case fourcc("vvcC"):
-      box = std::make_shared<Box_vvcC>();
+      box = make_shared_in_arena<Box_vvcC>(arena);
       break;
 
     case fourcc("idat"):
-      box = std::make_shared<Box_idat>();
+      box = make_shared_in_arena<Box_idat>(arena);
       break;
 
     case fourcc("grpl"):
-      box = std::make_shared<Box_grpl>();
+      box = make_shared_in_arena<Box_grpl>(arena);
       break;
 
     case fourcc("dinf"):
-      box = std::make_shared<Box_dinf>();
+      box = make_shared_in_arena<Box_dinf>(arena);
       break;
 
     case fourcc("dref"):
-      box = std::make_shared<Box_dref>();
+      box = make_shared_in_arena<Box_dref>(arena);
       break;
 
     case fourcc("url "):
-      box = std::make_shared<Box_url>();
+      box = make_shared_in_arena<Box_url>(arena);
       break;
 
     case fourcc("colr"):
-      box = std::make_shared<Box_colr>();
+      box = make_shared_in_arena<Box_colr>(arena);
       break;
 
     case fourcc("pixi"):
-      box = std::make_shared<Box_pixi>();
+      box = make_shared_in_arena<Box_pixi>(arena);
       break;
 
     case fourcc("pasp"):
-      box = std::make_shared<Box_pasp>();
+      box = make_shared_in_arena<Box_pasp>(arena);
       break;
 
     case fourcc("lsel"):
-      box = std::make_shared<Box_lsel>();
+      box = make_shared_in_arena<Box_lsel>(arena);
       break;
 
     case fourcc("a1op"):
-      box = std::make_shared<Box_a1op>();
+      box = make_shared_in_arena<Box_a1op>(arena);
       break;
 
     case fourcc("a1lx"):
-      box = std::make_shared<Box_a1lx>();
+      box = make_shared_in_arena<Box_a1lx>(arena);
       break;
 
     case fourcc("clli"):
-      box = std::make_shared<Box_clli>();
+      box = make_shared_in_arena<Box_clli>(arena);
       break;
 
     case fourcc("mdcv"):
-      box = std::make_shared<Box_mdcv>();
+      box = make_shared_in_arena<Box_mdcv>(arena);
       break;
 
     case fourcc("udes"):
-      box = std::make_shared<Box_udes>();
+      box = make_shared_in_arena<Box_udes>(arena);
+      break;
+
+    case fourcc("moov"):
+      box = make_shared_in_arena<Box_moov>(arena);
+      break;
+
+    case fourcc("mvhd"):
+      box = make_shared_in_arena<Box_mvhd>(arena);
+      break;
+
+    case fourcc("trak"):
+      box = make_shared_in_arena<Box_trak>(arena);
+      break;
+
+    case fourcc("tkhd"):
+      box = make_shared_in_arena<Box_tkhd>(arena);
+      break;
+
+    case fourcc("mdia"):
+      box = make_shared_in_arena<Box_mdia>(arena);
+      break;
+
+    case fourcc("mdhd"):
+      box = make_shared_in_arena<Box_mdhd>(arena);
+      break;
+
+    case fourcc("minf"):
+      box = make_shared_in_arena<Box_minf>(arena);
+      break;
+
+    case fourcc("stbl"):
+      box = make_shared_in_arena<Box_stbl>(arena);
+      break;
+
+    case fourcc("stsd"):
+      box = make_shared_in_arena<Box_stsd>(arena);
+      break;
+
+    case fourcc("hvc1"):
+    case fourcc("hev1"):
+    case fourcc("av01"):
+      box = make_shared_in_arena<Box_VisualSampleEntry>(arena);
+      break;
+
+    case fourcc("stts"):
+      box = make_shared_in_arena<Box_stts>(arena);
+      break;
+
+    case fourcc("ctts"):
+      box = make_shared_in_arena<Box_ctts>(arena);
+      break;
+
+    case fourcc("stsc"):
+      box = make_shared_in_arena<Box_stsc>(arena);
+      break;
+
+    case fourcc("stsz"):
+      box = make_shared_in_arena<Box_stsz>(arena);
+      break;
+
+    case fourcc("stco"):
+    case fourcc("co64"):
+      box = make_shared_in_arena<Box_stco>(arena);
+      break;
+
+    case fourcc("stss"):
+      box = make_shared_in_arena<Box_stss>(arena);
       break;
 
 #if WITH_UNCOMPRESSED_CODEC
     case fourcc("cmpd"):
-      box = std::make_shared<Box_cmpd>();
+      box = make_shared_in_arena<Box_cmpd>(arena);
       break;
 
     case fourcc("uncC"):
-      box = std::make_shared<Box_uncC>();
+      box = make_shared_in_arena<Box_uncC>(arena);
+      break;
+
+    case fourcc("cmpC"):
+      box = make_shared_in_arena<Box_cmpC>(arena);
+      break;
+
+    case fourcc("icef"):
+      box = make_shared_in_arena<Box_icef>(arena);
       break;
 #endif
 
     default:
-      box = std::make_shared<Box>();
+      box = make_shared_in_arena<Box>(arena);
       break;
   }
 
@@ -616,7 +704,7 @@ Error Box::read(BitstreamRange& range, std::shared_ptr<Box>* result)
                           box_size_without_header,
                           &range);
 
-  err = box->parse(boxrange);
+  Error err = box->parse(boxrange);
   if (err == Error::Ok) {
     *result = std::move(box);
   }
@@ -674,6 +762,17 @@ std::shared_ptr<Box> Box::get_child_box(uint32_t short_type) const
 }
 
 
+void Box::remove_child_box(const std::shared_ptr<const Box>& box)
+{
+  for (size_t i = 0; i < m_children.size(); i++) {
+    if (m_children[i] == box) {
+      m_children.erase(m_children.begin() + i);
+      return;
+    }
+  }
+}
+
+
 std::vector<std::shared_ptr<Box>> Box::get_child_boxes(uint32_t short_type) const
 {
   std::vector<std::shared_ptr<Box>> result;
@@ -766,7 +865,10 @@ void Box::derive_box_version_recursive()
   derive_box_version();
 
   for (auto& child : m_children) {
-    child->derive_box_version_recursive();
+    // ipco properties that have not been parsed are written unchanged
+    if (child) {
+      child->derive_box_version_recursive();
+    }
   }
 }
 
@@ -1095,6 +1197,7 @@ Error Box_iloc::parse(BitstreamRange& range)
     }
 
     if (!range.error()) {
+      m_item_index.emplace(item.item_ID, m_items.size());
       m_items.push_back(item);
     }
   }
@@ -1132,6 +1235,99 @@ std::string Box_iloc::dump(Indent& indent) const
 }
 
 
+// Appends 'length' bytes of the item data, starting at 'offset' in the file (construction method 0)
+// or in the idat box (construction method 1).
+static Error read_item_data(const Box_iloc::Item& item,
+                            uint64_t offset, uint64_t length,
+                            const std::shared_ptr<StreamReader>& istr,
+                            const std::shared_ptr<Box_idat>& idat,
+                            std::vector<uint8_t>* dest)
+{
+  if (item.construction_method == 0) {
+
+    // --- security check that we do not allocate too much memory
+
+    size_t old_size = dest->size();
+    if (MAX_MEMORY_BLOCK_SIZE - old_size < length) {
+      std::stringstream sstr;
+      sstr << "iloc box contained " << length << " bytes, total memory size would be "
+           << (old_size + length) << " bytes, exceeding the security limit of "
+           << MAX_MEMORY_BLOCK_SIZE << " bytes";
+
+      return Error(heif_error_Memory_allocation_error,
+                   heif_suberror_Security_limit_exceeded,
+                   sstr.str());
+    }
+
+
+    // --- make sure that all data is available
+
+    if (offset > MAX_FILE_POS ||
+        item.base_offset > MAX_FILE_POS ||
+        length > MAX_FILE_POS) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Security_limit_exceeded,
+                   "iloc data pointers out of allowed range");
+    }
+
+    StreamReader::grow_status status = istr->wait_for_file_size(offset + item.base_offset + length);
+    if (status == StreamReader::size_beyond_eof) {
+      // Out-of-bounds
+      // TODO: I think we should not clear this. Maybe we want to try reading again later and
+      // hence should not lose the data already read.
+      dest->clear();
+
+      std::stringstream sstr;
+      sstr << "Extent in iloc box references data outside of file bounds "
+           << "(points to file position " << offset + item.base_offset << ")\n";
+
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_End_of_data,
+                   sstr.str());
+    }
+    else if (status == StreamReader::timeout) {
+      // TODO: maybe we should introduce some 'Recoverable error' instead of 'Invalid input'
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_End_of_data);
+    }
+
+    // --- read data
+
+    dest->resize(static_cast<size_t>(old_size + length));
+    bool success = istr->read_at(static_cast<int64_t>(offset + item.base_offset),
+                                 dest->data() + old_size, static_cast<size_t>(length));
+    if (!success) {
+      // the file has been truncated after it was opened
+      dest->resize(static_cast<size_t>(old_size));
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_End_of_data,
+                   "Item data could not be read from the file");
+    }
+  }
+  else if (item.construction_method == 1) {
+    if (!idat) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_idat_box,
+                   "idat box referenced in iref box is not present in file");
+    }
+
+    idat->read_data(istr,
+                    offset + item.base_offset,
+                    length,
+                    *dest);
+  }
+  else {
+    std::stringstream sstr;
+    sstr << "Item construction method " << item.construction_method << " not implemented";
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_No_idat_box,
+                 sstr.str());
+  }
+
+  return Error::Ok;
+}
+
+
 Error Box_iloc::read_data(const Item& item,
                           const std::shared_ptr<StreamReader>& istr,
                           const std::shared_ptr<Box_idat>& idat,
@@ -1140,67 +1336,61 @@ Error Box_iloc::read_data(const Item& item,
   //istr.clear();
 
   for (const auto& extent : item.extents) {
-    if (item.construction_method == 0) {
-
-      // --- security check that we do not allocate too much memory
-
-      size_t old_size = dest->size();
-      if (MAX_MEMORY_BLOCK_SIZE - old_size < extent.length) {
-        std::stringstream sstr;
-        sstr << "iloc box contained " << extent.length << " bytes, total memory size would be "
-             << (old_size + extent.length) << " bytes, exceeding the security limit of "
-             << MAX_MEMORY_BLOCK_SIZE << " bytes";
-
-        return Error(heif_error_Memory_allocation_error,
-                     heif_suberror_Security_limit_exceeded,
-                     sstr.str());
-      }
+    Error err = read_item_data(item, extent.offset, extent.length, istr, idat, dest);
+    if (err) {
+      return err;
+    }
+  }
 
+  return Error::Ok;
+}
 
-      // --- make sure that all data is available
 
-      if (extent.offset > MAX_FILE_POS ||
-          item.base_offset > MAX_FILE_POS ||
-          extent.length > MAX_FILE_POS) {
-        return Error(heif_error_Invalid_input,
-                     heif_suberror_Security_limit_exceeded,
-                     "iloc data pointers out of allowed range");
-      }
+Error Box_iloc::read_data_range(const Item& item,
+                                const std::shared_ptr<StreamReader>& istr,
+                                const std::shared_ptr<Box_idat>& idat,
+                                uint64_t offset, uint64_t size,
+                                std::vector<uint8_t>* dest) const
+{
+  for (const auto& extent : item.extents) {
+    if (size == 0) {
+      break;
+    }
 
-      StreamReader::grow_status status = istr->wait_for_file_size(extent.offset + item.base_offset + extent.length);
-      if (status == StreamReader::size_beyond_eof) {
-        // Out-of-bounds
-        // TODO: I think we should not clear this. Maybe we want to try reading again later and
-        // hence should not lose the data already read.
-        dest->clear();
+    // skip extents before the range
+    if (offset >= extent.length) {
+      offset -= extent.length;
+      continue;
+    }
 
-        std::stringstream sstr;
-        sstr << "Extent in iloc box references data outside of file bounds "
-             << "(points to file position " << extent.offset + item.base_offset << ")\n";
+    uint64_t length = std::min(size, extent.length - offset);
 
-        return Error(heif_error_Invalid_input,
-                     heif_suberror_End_of_data,
-                     sstr.str());
-      }
-      else if (status == StreamReader::timeout) {
-        // TODO: maybe we should introduce some 'Recoverable error' instead of 'Invalid input'
-        return Error(heif_error_Invalid_input,
-                     heif_suberror_End_of_data);
-      }
+    Error err = read_item_data(item, extent.offset + offset, length, istr, idat, dest);
+    if (err) {
+      return err;
+    }
 
-      // --- move file pointer to start of data
+    offset = 0;
+    size -= length;
+  }
 
-      bool success = istr->seek(extent.offset + item.base_offset);
-      assert(success);
-      (void) success;
+  if (size > 0) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_End_of_data,
+                 "Requested data range exceeds the item data");
+  }
 
+  return Error::Ok;
+}
 
-      // --- read data
 
-      dest->resize(static_cast<size_t>(old_size + extent.length));
-      success = istr->read((char*) dest->data() + old_size, static_cast<size_t>(extent.length));
-      assert(success);
-      (void) success;
+Error Box_iloc::get_file_ranges(const Item& item,
+                                const std::shared_ptr<Box_idat>& idat,
+                                std::vector<FileRange>& ranges) const
+{
+  for (const auto& extent : item.extents) {
+    if (item.construction_method == 0) {
+      ranges.push_back(FileRange{extent.offset + item.base_offset, extent.length});
     }
     else if (item.construction_method == 1) {
       if (!idat) {
@@ -1209,10 +1399,7 @@ Error Box_iloc::read_data(const Item& item,
                      "idat box referenced in iref box is not present in file");
       }
 
-      idat->read_data(istr,
-                      extent.offset + item.base_offset,
-                      extent.length,
-                      *dest);
+      ranges.push_back(FileRange{idat->get_data_start_pos() + extent.offset + item.base_offset, extent.length});
     }
     else {
       std::stringstream sstr;
@@ -1227,49 +1414,325 @@ Error Box_iloc::read_data(const Item& item,
 }
 
 
-Error Box_iloc::append_data(heif_item_id item_ID,
-                            const std::vector<uint8_t>& data,
-                            uint8_t construction_method)
+bool Box_iloc::get_data_view(const Item& item,
+                             const std::shared_ptr<StreamReader>& istr,
+                             const uint8_t** data,
+                             size_t* size) const
+{
+  if (item.construction_method != 0 ||
+      item.extents.size() != 1) {
+    return false;
+  }
+
+  const Extent& extent = item.extents[0];
+
+  if (extent.offset > MAX_FILE_POS ||
+      item.base_offset > MAX_FILE_POS ||
+      extent.length > MAX_FILE_POS) {
+    return false;
+  }
+
+  const uint8_t* ptr = istr->get_memory_view(static_cast<int64_t>(extent.offset + item.base_offset),
+                                             static_cast<size_t>(extent.length));
+  if (!ptr) {
+    return false;
+  }
+
+  *data = ptr;
+  *size = static_cast<size_t>(extent.length);
+
+  return true;
+}
+
+
+const Box_iloc::Item* Box_iloc::get_item(heif_item_id item_ID) const
+{
+  auto iter = m_item_index.find(item_ID);
+  if (iter == m_item_index.end()) {
+    return nullptr;
+  }
+
+  return &m_items[iter->second];
+}
+
+
+size_t Box_iloc::get_or_add_item(heif_item_id item_ID, uint8_t construction_method)
 {
   // check whether this item ID already exists
 
-  size_t idx;
-  for (idx = 0; idx < m_items.size(); idx++) {
-    if (m_items[idx].item_ID == item_ID) {
-      break;
-    }
+  auto index_iter = m_item_index.find(item_ID);
+  if (index_iter != m_item_index.end()) {
+    return index_iter->second;
   }
 
   // item does not exist -> add a new one to the end
 
-  if (idx == m_items.size()) {
-    Item item;
-    item.item_ID = item_ID;
-    item.construction_method = construction_method;
+  Item item;
+  item.item_ID = item_ID;
+  item.construction_method = construction_method;
+
+  size_t idx = m_items.size();
+  m_item_index.emplace(item_ID, idx);
+  m_items.push_back(item);
+
+  return idx;
+}
+
 
-    m_items.push_back(item);
+Error Box_iloc::append_streaming_data(size_t item_index, const uint8_t* data, size_t size)
+{
+  if (!m_streaming_pending_data.empty() && m_streaming_pending_item != item_index) {
+    Error err = flush_streaming_output();
+    if (err) {
+      return err;
+    }
+  }
+
+  m_streaming_pending_item = item_index;
+  m_streaming_pending_data.insert(m_streaming_pending_data.end(), data, data + size);
+
+  return Error::Ok;
+}
+
+
+Error Box_iloc::append_data(heif_item_id item_ID,
+                            const std::vector<uint8_t>& data,
+                            uint8_t construction_method)
+{
+  if (m_streaming_sink && construction_method == 0) {
+    size_t idx = get_or_add_item(item_ID, construction_method);
+    return append_streaming_data(idx, data.data(), data.size());
   }
 
+  return append_data(item_ID, std::vector<uint8_t>(data), construction_method);
+}
+
+
+Error Box_iloc::append_data(heif_item_id item_ID,
+                            std::vector<uint8_t>&& data,
+                            uint8_t construction_method)
+{
+  size_t idx = get_or_add_item(item_ID, construction_method);
+
   if (m_items[idx].construction_method != construction_method) {
     // TODO: return error: construction methods do not match
   }
 
+  if (m_streaming_sink && construction_method == 0) {
+    return append_streaming_data(idx, data.data(), data.size());
+  }
+
+  size_t size = data.size();
+
   Extent extent;
-  extent.data = data;
+  extent.data = std::move(data);
 
   if (construction_method == 1) {
     extent.offset = m_idat_offset;
-    extent.length = data.size();
+    extent.length = size;
+
+    m_idat_offset += size;
+  }
+
+  m_items[idx].extents.push_back(std::move(extent));
+
+  return Error::Ok;
+}
+
+
+Error Box_iloc::append_data_reference(heif_item_id item_ID,
+                                      const uint8_t* data, size_t size,
+                                      std::shared_ptr<const void> owner)
+{
+  size_t idx = get_or_add_item(item_ID, 0);
+
+  if (m_items[idx].construction_method != 0) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "Referenced item data can only be stored in the 'mdat' box");
+  }
+
+  if (m_streaming_sink) {
+    Error err = flush_streaming_output();
+    if (err) {
+      return err;
+    }
 
-    m_idat_offset += (int) data.size();
+    return write_streaming_mdat(m_items[idx], {{data, size}});
   }
 
+  Extent extent;
+  extent.data_ref = data;
+  extent.data_ref_size = size;
+  extent.data_owner = std::move(owner);
+
   m_items[idx].extents.push_back(std::move(extent));
 
   return Error::Ok;
 }
 
 
+void Box_iloc::remove_item(heif_item_id item_ID)
+{
+  if (m_streaming_sink) {
+    // the pending data refers to an index into m_items
+    flush_streaming_output();
+  }
+
+  for (size_t i = m_items.size(); i-- > 0;) {
+    if (m_items[i].item_ID == item_ID) {
+      m_items.erase(m_items.begin() + i);
+    }
+  }
+
+  m_item_index.clear();
+  for (size_t i = 0; i < m_items.size(); i++) {
+    m_item_index.emplace(m_items[i].item_ID, i);
+  }
+}
+
+
+Error Box_iloc::place_new_data(uint64_t file_position, uint64_t* out_size)
+{
+  uint64_t position = file_position;
+
+  for (auto& item : m_items) {
+    bool has_data = false;
+    for (const auto& extent : item.extents) {
+      has_data |= (extent.get_data_size() > 0);
+    }
+
+    if (!has_data) {
+      continue;
+    }
+
+    if (item.construction_method != 0) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Unspecified,
+                   "Data in the 'idat' box cannot be changed in place");
+    }
+
+    // Same order as in write_mdat_data(). Like the items read from the file, the data is
+    // referenced with absolute offsets.
+
+    item.base_offset = 0;
+
+    for (auto& extent : item.extents) {
+      extent.offset = position;
+      extent.length = extent.get_data_size();
+
+      position += extent.get_data_size();
+    }
+  }
+
+  m_keep_item_offsets = true;
+  *out_size = position - file_position;
+
+  return Error::Ok;
+}
+
+
+void Box_iloc::release_placed_data()
+{
+  for (auto& item : m_items) {
+    for (auto& extent : item.extents) {
+      extent.data = std::vector<uint8_t>();
+      extent.data_ref = nullptr;
+      extent.data_ref_size = 0;
+      extent.data_owner.reset();
+    }
+  }
+}
+
+
+Error Box_iloc::start_streaming_output(const StreamWriter::output_sink& sink, uint64_t file_position)
+{
+  m_streaming_sink = sink;
+  m_streaming_position = file_position;
+
+  // --- write the data that has already been appended
+
+  for (auto& item : m_items) {
+    if (item.construction_method == 0 && !item.extents.empty()) {
+      std::vector<Extent> extents;
+      std::swap(extents, item.extents);
+
+      std::vector<std::pair<const uint8_t*, size_t>> parts;
+      for (const auto& extent : extents) {
+        parts.emplace_back(extent.get_data(), extent.get_data_size());
+      }
+
+      Error err = write_streaming_mdat(item, parts);
+      if (err) {
+        return err;
+      }
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error Box_iloc::flush_streaming_output()
+{
+  if (!m_streaming_pending_data.empty()) {
+    write_streaming_mdat(m_items[m_streaming_pending_item],
+                         {{m_streaming_pending_data.data(), m_streaming_pending_data.size()}});
+    m_streaming_pending_data.clear();
+  }
+
+  return m_streaming_error;
+}
+
+
+Error Box_iloc::write_streaming_mdat(Item& item, const std::vector<std::pair<const uint8_t*, size_t>>& parts)
+{
+  if (m_streaming_error) {
+    return m_streaming_error;
+  }
+
+  uint64_t data_size = 0;
+  for (const auto& part : parts) {
+    data_size += part.second;
+  }
+
+  StreamWriter header;
+  if (data_size + 8 <= 0xFFFFFFFF) {
+    header.write32((uint32_t) (data_size + 8));
+    header.write32(fourcc("mdat"));
+  }
+  else {
+    header.write32(1);
+    header.write32(fourcc("mdat"));
+    header.write64(data_size + 16);
+  }
+
+  m_streaming_error = m_streaming_sink(header.get_data().data(), header.data_size());
+
+  for (const auto& part : parts) {
+    if (!m_streaming_error && part.second > 0) {
+      m_streaming_error = m_streaming_sink(part.first, part.second);
+    }
+  }
+
+  if (m_streaming_error) {
+    return m_streaming_error;
+  }
+
+  // The data is referenced with absolute file offsets.
+  Extent extent;
+  extent.offset = m_streaming_position + header.data_size();
+  extent.length = data_size;
+
+  item.base_offset = 0;
+  item.extents.push_back(extent);
+
+  m_streaming_position += header.data_size() + data_size;
+
+  return Error::Ok;
+}
+
+
 void Box_iloc::derive_box_version()
 {
   int min_version = m_user_defined_min_version;
@@ -1338,9 +1801,61 @@ void Box_iloc::derive_box_version()
 
   m_offset_size = 4;
   m_length_size = 4;
-  m_base_offset_size = 4; // TODO: or could be 8 if we write >4GB files
+  m_base_offset_size = 4;
   m_index_size = 0;
 
+  // --- use 64 bit fields for files larger than 4 GB
+
+  uint64_t sum_mdat_size = 0;
+  bool base_offsets_used = false;
+
+  for (const auto& item : m_items) {
+    // Data that is written into the 'mdat' after the iloc box is placed relative to the item base offset.
+    bool placed_after_iloc = (item.construction_method == 0 && !m_streaming_sink && !m_keep_item_offsets);
+
+    if (!placed_after_iloc && item.base_offset > 0xFFFFFFFF) {
+      m_base_offset_size = 8;
+    }
+
+    base_offsets_used |= (placed_after_iloc || item.base_offset != 0);
+
+    uint64_t item_size = 0;
+
+    for (const auto& extent : item.extents) {
+      // only in files that have been read
+      if (extent.index != 0) {
+        min_version = std::max(min_version, 1);
+        m_index_size = std::max(m_index_size, (uint8_t) (extent.index > 0xFFFFFFFF ? 8 : 4));
+      }
+
+      uint64_t offset = placed_after_iloc ? item_size : extent.offset;
+      uint64_t length = placed_after_iloc ? extent.get_data_size() : extent.length;
+
+      if (offset > 0xFFFFFFFF) {
+        m_offset_size = 8;
+      }
+
+      if (length > 0xFFFFFFFF) {
+        m_length_size = 8;
+      }
+
+      item_size += length;
+    }
+
+    if (placed_after_iloc) {
+      sum_mdat_size += item_size;
+    }
+  }
+
+  // The base offsets are only known after the 'meta' box has been written. The boxes before the
+  // 'mdat' are limited in size, see write_mdat_header_after_iloc().
+  if (sum_mdat_size > 0xFFFFFFFF - (uint64_t) MAX_MEMORY_BLOCK_SIZE) {
+    m_base_offset_size = 8;
+  }
+  else if (!base_offsets_used) {
+    m_base_offset_size = 0;
+  }
+
   set_version((uint8_t) min_version);
 }
 
@@ -1379,7 +1894,7 @@ Error Box_iloc::write(StreamWriter& writer) const
 
   m_iloc_box_start = writer.get_position();
 
-  int nSkip = 0;
+  size_t nSkip = 0;
 
   nSkip += 2;
   nSkip += (get_version() < 2) ? 2 : 4; // item_count
@@ -1407,39 +1922,59 @@ Error Box_iloc::write(StreamWriter& writer) const
 }
 
 
-Error Box_iloc::write_mdat_after_iloc(StreamWriter& writer)
+Error Box_iloc::write_mdat_header_after_iloc(StreamWriter& writer)
 {
+  if (m_streaming_sink) {
+    // The item data has already been written and its offsets are known.
+    patch_iloc_header(writer);
+    return Error::Ok;
+  }
+
   // --- compute sum of all mdat data
 
-  size_t sum_mdat_size = 0;
+  uint64_t sum_mdat_size = 0;
 
   for (const auto& item : m_items) {
     if (item.construction_method == 0) {
       for (const auto& extent : item.extents) {
-        sum_mdat_size += extent.data.size();
+        sum_mdat_size += extent.get_data_size();
       }
     }
   }
 
-  if (sum_mdat_size > 0xFFFFFFFF) {
-    // TODO: box size > 4 GB
+
+  // --- write mdat box header
+
+  if (sum_mdat_size + 8 <= 0xFFFFFFFF) {
+    writer.write32((uint32_t) (sum_mdat_size + 8));
+    writer.write32(fourcc("mdat"));
+  }
+  else {
+    writer.write32(1);
+    writer.write32(fourcc("mdat"));
+    writer.write64(sum_mdat_size + 16);
   }
 
 
-  // --- write mdat box
+  // --- compute the positions of the item data in the mdat box
+
+  uint64_t position = writer.get_position();
 
-  writer.write32((uint32_t) (sum_mdat_size + 8));
-  writer.write32(fourcc("mdat"));
+  if (m_base_offset_size == 4 && position + sum_mdat_size > 0xFFFFFFFF) {
+    return Error(heif_error_Encoding_error,
+                 heif_suberror_Unspecified,
+                 "The boxes before the 'mdat' box are too large");
+  }
 
   for (auto& item : m_items) {
     if (item.construction_method == 0) {
-      item.base_offset = writer.get_position();
+      item.base_offset = position;
 
       for (auto& extent : item.extents) {
-        extent.offset = writer.get_position() - item.base_offset;
-        extent.length = extent.data.size();
+        extent.offset = position - item.base_offset;
+        extent.length = extent.get_data_size();
 
-        writer.write(extent.data);
+        position += extent.get_data_size();
       }
     }
   }
@@ -1453,6 +1988,29 @@ Error Box_iloc::write_mdat_after_iloc(StreamWriter& writer)
 }
 
 
+Error Box_iloc::write_mdat_data(const StreamWriter::output_sink& sink) const
+{
+  // Same order as in write_mdat_header_after_iloc().
+
+  for (const auto& item : m_items) {
+    if (item.construction_method == 0) {
+      for (const auto& extent : item.extents) {
+        if (extent.get_data_size() == 0) {
+          continue;
+        }
+
+        Error err = sink(extent.get_data(), extent.get_data_size());
+        if (err) {
+          return err;
+        }
+      }
+    }
+  }
+
+  return Error::Ok;
+}
+
+
 void Box_iloc::patch_iloc_header(StreamWriter& writer) const
 {
   size_t old_pos = writer.get_position();
@@ -1481,7 +2039,9 @@ void Box_iloc::patch_iloc_header(StreamWriter& writer) const
     }
 
     writer.write16(item.data_reference_index);
-    writer.write(m_base_offset_size, item.base_offset);
+    if (m_base_offset_size > 0) {
+      writer.write(m_base_offset_size, item.base_offset);
+    }
     writer.write16((uint16_t) item.extents.size());
 
     for (const auto& extent : item.extents) {
@@ -1723,7 +2283,180 @@ Error Box_ipco::parse(BitstreamRange& range)
 {
   //parse_full_box_header(range);
 
-  return read_children(range);
+  // Keep a copy of the box content and only read the headers of the properties. Many of them
+  // (e.g. ICC profiles, codec configurations of all tiles) are not needed when opening a file.
+
+  int64_t size = range.get_remaining_bytes();
+  m_property_data.resize((size_t) size);
+  if (size > 0 && !range.read(m_property_data.data(), size)) {
+    return range.get_error();
+  }
+
+  auto reader = std::make_shared<StreamReader_memory>(m_property_data.data(), size, false);
+  BitstreamRange data_range(reader, size);
+
+  while (!data_range.eof() && !data_range.error()) {
+    UnparsedProperty property;
+    property.offset = (size_t) reader->get_position();
+
+    BoxHeader hdr;
+    Error err = hdr.parse_header(data_range);
+    if (err) {
+      return err;
+    }
+
+    if (data_range.error()) {
+      return data_range.get_error();
+    }
+
+    if (hdr.get_box_size() < hdr.get_header_size() ||
+        hdr.get_box_size() - hdr.get_header_size() > (uint64_t) data_range.get_remaining_bytes()) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    if (m_children.size() >= MAX_CHILDREN_PER_BOX) {
+      std::stringstream sstr;
+      sstr << "Maximum number of child boxes " << MAX_CHILDREN_PER_BOX << " exceeded.";
+
+      // Sanity check.
+      return Error(heif_error_Memory_allocation_error,
+                   heif_suberror_Security_limit_exceeded,
+                   sstr.str());
+    }
+
+    property.box_type = hdr.get_short_type();
+    property.size = (size_t) hdr.get_box_size();
+
+    m_children.push_back(nullptr);
+    m_unparsed_properties.push_back(property);
+
+    BitstreamRange box_range(reader, (int64_t) (hdr.get_box_size() - hdr.get_header_size()), &data_range);
+    box_range.skip_to_end_of_box();
+  }
+
+  return data_range.get_error();
+}
+
+
+Error Box_ipco::parse_property(size_t index, std::shared_ptr<Box>* out_box) const
+{
+  const UnparsedProperty& property = m_unparsed_properties[index];
+
+  auto reader = std::make_shared<StreamReader_memory>(m_property_data.data() + property.offset,
+                                                      (int64_t) property.size, false);
+  BitstreamRange range(reader, (int64_t) property.size);
+
+  return Box::read(range, out_box);
+}
+
+
+std::shared_ptr<Box> Box_ipco::get_property(size_t index, Error* out_error)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  if (index >= m_children.size()) {
+    return nullptr;
+  }
+
+  if (!m_children[index] && index < m_unparsed_properties.size()) {
+    auto error_iter = m_property_errors.find(index);
+    if (error_iter != m_property_errors.end()) {
+      if (out_error) {
+        *out_error = error_iter->second;
+      }
+      return nullptr;
+    }
+
+    Error err = parse_property(index, &m_children[index]);
+    if (err) {
+      m_property_errors[index] = err;
+      if (out_error) {
+        *out_error = err;
+      }
+      return nullptr;
+    }
+  }
+
+  return m_children[index];
+}
+
+
+uint32_t Box_ipco::get_property_box_type(size_t index) const
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  if (index < m_children.size() && m_children[index]) {
+    return m_children[index]->get_short_type();
+  }
+
+  if (index < m_unparsed_properties.size()) {
+    return m_unparsed_properties[index].box_type;
+  }
+
+  return 0;
+}
+
+
+Error Box_ipco::get_property_data(size_t index, std::vector<uint8_t>* out_data)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  if (index >= m_children.size()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Ipma_box_references_nonexisting_property);
+  }
+
+  if (index < m_unparsed_properties.size() && m_unparsed_properties[index].size > 0) {
+    const UnparsedProperty& property = m_unparsed_properties[index];
+    out_data->assign(m_property_data.begin() + property.offset,
+                     m_property_data.begin() + property.offset + property.size);
+    return Error::Ok;
+  }
+
+  // property that was added when writing
+
+  StreamWriter writer;
+  m_children[index]->derive_box_version_recursive();
+  Error err = m_children[index]->write(writer);
+  if (err) {
+    return err;
+  }
+
+  *out_data = writer.get_data();
+  return Error::Ok;
+}
+
+
+size_t Box_ipco::append_property_data(const std::vector<uint8_t>& data)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  // properties without an entry have been added when writing
+  m_unparsed_properties.resize(m_children.size());
+
+  UnparsedProperty property;
+  if (data.size() >= 8) {
+    property.box_type = ((uint32_t) data[4] << 24) | ((uint32_t) data[5] << 16) |
+                        ((uint32_t) data[6] << 8) | ((uint32_t) data[7]);
+  }
+  property.offset = m_property_data.size();
+  property.size = data.size();
+
+  m_property_data.insert(m_property_data.end(), data.begin(), data.end());
+
+  m_children.push_back(nullptr);
+  m_unparsed_properties.push_back(property);
+
+  return m_children.size() - 1;
 }
 
 
@@ -1732,11 +2465,60 @@ std::string Box_ipco::dump(Indent& indent) const
   std::ostringstream sstr;
   sstr << Box::dump(indent);
 
-  sstr << dump_children(indent);
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  // like dump_children(), but properties that have not been parsed yet are parsed temporarily
+
+  indent++;
+  for (size_t i = 0; i < m_children.size(); i++) {
+    if (i > 0) {
+      sstr << indent << "\n";
+    }
+
+    std::shared_ptr<Box> property = m_children[i];
+    if (!property && parse_property(i, &property)) {
+      sstr << indent << "invalid property box\n";
+      continue;
+    }
+
+    sstr << property->dump(indent);
+  }
+  indent--;
 
   return sstr.str();
 }
 
+
+Error Box_ipco::write(StreamWriter& writer) const
+{
+  size_t box_start = reserve_box_header_space(writer);
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  for (size_t i = 0; i < m_children.size(); i++) {
+    if (i < m_unparsed_properties.size() && m_unparsed_properties[i].size > 0) {
+      // Copy properties read from the file unchanged, even if they have been parsed. Not all
+      // property types can be written again.
+      const UnparsedProperty& property = m_unparsed_properties[i];
+      writer.write(m_property_data.data() + property.offset, property.size);
+    }
+    else {
+      Error err = m_children[i]->write(writer);
+      if (err) {
+        return err;
+      }
+    }
+  }
+
+  prepend_header(writer, box_start);
+
+  return Error::Ok;
+}
+
 Error color_profile_nclx::parse(BitstreamRange& range)
 {
   StreamReader::grow_status status;
@@ -2093,6 +2875,40 @@ Error Box_lsel::write(StreamWriter& writer) const
 }
 
 
+Error Box_jpgC::parse(BitstreamRange& range)
+{
+  const int64_t data_size = range.get_remaining_bytes();
+  m_data.resize(data_size);
+
+  range.read(m_data.data(), data_size);
+
+  return range.get_error();
+}
+
+
+std::string Box_jpgC::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+
+  sstr << indent << "prefix size: " << m_data.size() << " bytes\n";
+
+  return sstr.str();
+}
+
+
+Error Box_jpgC::write(StreamWriter& writer) const
+{
+  size_t box_start = reserve_box_header_space(writer);
+
+  writer.write(m_data);
+
+  prepend_header(writer, box_start);
+
+  return Error::Ok;
+}
+
+
 Error Box_a1op::parse(BitstreamRange& range)
 {
   op_index = range.read8();
@@ -2269,7 +3085,16 @@ Error Box_mdcv::write(StreamWriter& writer) const
 
 Error Box_ipco::get_properties_for_item_ID(uint32_t itemID,
                                            const std::shared_ptr<class Box_ipma>& ipma,
-                                           std::vector<std::shared_ptr<Box>>& out_properties) const
+                                           std::vector<std::shared_ptr<Box>>& out_properties)
+{
+  return get_properties_for_item_ID(itemID, ipma, {}, out_properties);
+}
+
+
+Error Box_ipco::get_properties_for_item_ID(uint32_t itemID,
+                                           const std::shared_ptr<class Box_ipma>& ipma,
+                                           const std::vector<uint32_t>& property_box_types,
+                                           std::vector<std::shared_ptr<Box>>& out_properties)
 {
   const std::vector<Box_ipma::PropertyAssociation>* property_assoc = ipma->get_properties_for_item_ID(itemID);
   if (property_assoc == nullptr) {
@@ -2281,9 +3106,8 @@ Error Box_ipco::get_properties_for_item_ID(uint32_t itemID,
                  sstr.str());
   }
 
-  const auto& allProperties = get_all_child_boxes();
   for (const Box_ipma::PropertyAssociation& assoc : *property_assoc) {
-    if (assoc.property_index > allProperties.size()) {
+    if (assoc.property_index > m_children.size()) {
       std::stringstream sstr;
       sstr << "Nonexisting property (index=" << assoc.property_index << ") for item "
            << " ID=" << itemID << " referenced in ipma box";
@@ -2294,7 +3118,21 @@ Error Box_ipco::get_properties_for_item_ID(uint32_t itemID,
     }
 
     if (assoc.property_index > 0) {
-      out_properties.push_back(allProperties[assoc.property_index - 1]);
+      size_t index = assoc.property_index - 1;
+
+      if (!property_box_types.empty() &&
+          std::find(property_box_types.begin(), property_box_types.end(),
+                    get_property_box_type(index)) == property_box_types.end()) {
+        continue;
+      }
+
+      Error err;
+      std::shared_ptr<Box> property = get_property(index, &err);
+      if (!property) {
+        return err;
+      }
+
+      out_properties.push_back(property);
     }
   }
 
@@ -2304,23 +3142,22 @@ Error Box_ipco::get_properties_for_item_ID(uint32_t itemID,
 
 std::shared_ptr<Box> Box_ipco::get_property_for_item_ID(heif_item_id itemID,
                                                         const std::shared_ptr<class Box_ipma>& ipma,
-                                                        uint32_t box_type) const
+                                                        uint32_t box_type)
 {
   const std::vector<Box_ipma::PropertyAssociation>* property_assoc = ipma->get_properties_for_item_ID(itemID);
   if (property_assoc == nullptr) {
     return nullptr;
   }
 
-  const auto& allProperties = get_all_child_boxes();
   for (const Box_ipma::PropertyAssociation& assoc : *property_assoc) {
-    if (assoc.property_index > allProperties.size() ||
+    if (assoc.property_index > m_children.size() ||
         assoc.property_index == 0) {
       return nullptr;
     }
 
-    const auto& property = allProperties[assoc.property_index - 1];
-    if (property->get_short_type() == box_type) {
-      return property;
+    size_t index = assoc.property_index - 1;
+    if (get_property_box_type(index) == box_type) {
+      return get_property(index);
     }
   }
 
@@ -2328,12 +3165,37 @@ std::shared_ptr<Box> Box_ipco::get_property_for_item_ID(heif_item_id itemID,
 }
 
 
+bool Box_ipco::has_property_for_item_ID(heif_item_id itemID,
+                                        const std::shared_ptr<class Box_ipma>& ipma,
+                                        uint32_t box_type) const
+{
+  const std::vector<Box_ipma::PropertyAssociation>* property_assoc = ipma->get_properties_for_item_ID(itemID);
+  if (property_assoc == nullptr) {
+    return false;
+  }
+
+  for (const Box_ipma::PropertyAssociation& assoc : *property_assoc) {
+    if (assoc.property_index > 0 &&
+        assoc.property_index <= m_children.size() &&
+        get_property_box_type(assoc.property_index - 1) == box_type) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
 bool Box_ipco::is_property_essential_for_item(heif_item_id itemId,
                                               const std::shared_ptr<const class Box>& property,
                                               const std::shared_ptr<class Box_ipma>& ipma) const
 {
   // find property index
 
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
   for (int i=0;i<(int)m_children.size();i++) {
     if (m_children[i] == property) {
       return ipma->is_property_essential_for_item(itemId, i);
@@ -2414,33 +3276,53 @@ Error Box_ipma::parse(BitstreamRange& range)
       entry.associations.push_back(association);
     }
 
-    m_entries.push_back(entry);
+    add_entry(entry);
   }
 
   return range.get_error();
 }
 
 
-const std::vector<Box_ipma::PropertyAssociation>* Box_ipma::get_properties_for_item_ID(uint32_t itemID) const
+void Box_ipma::remove_entries_for_item_ID(heif_item_id itemID)
 {
-  for (const auto& entry : m_entries) {
-    if (entry.item_ID == itemID) {
-      return &entry.associations;
+  for (size_t i = m_entries.size(); i-- > 0;) {
+    if (m_entries[i].item_ID == itemID) {
+      m_entries.erase(m_entries.begin() + i);
     }
   }
 
-  return nullptr;
+  m_entry_index.clear();
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    m_entry_index.emplace(m_entries[i].item_ID, i);
+  }
+}
+
+
+void Box_ipma::add_entry(const Entry& entry)
+{
+  m_entry_index.emplace(entry.item_ID, m_entries.size());
+  m_entries.push_back(entry);
+}
+
+
+const std::vector<Box_ipma::PropertyAssociation>* Box_ipma::get_properties_for_item_ID(uint32_t itemID) const
+{
+  auto iter = m_entry_index.find(itemID);
+  if (iter == m_entry_index.end()) {
+    return nullptr;
+  }
+
+  return &m_entries[iter->second].associations;
 }
 
 
 bool Box_ipma::is_property_essential_for_item(heif_item_id itemId, int propertyIndex) const
 {
-  for (const auto& entry : m_entries) {
-    if (entry.item_ID == itemId) {
-      for (const auto& assoc : entry.associations) {
-        if (assoc.property_index == propertyIndex) {
-          return assoc.essential;
-        }
+  const std::vector<PropertyAssociation>* associations = get_properties_for_item_ID(itemId);
+  if (associations) {
+    for (const auto& assoc : *associations) {
+      if (assoc.property_index == propertyIndex) {
+        return assoc.essential;
       }
     }
   }
@@ -2453,22 +3335,15 @@ bool Box_ipma::is_property_essential_for_item(heif_item_id itemId, int propertyI
 void Box_ipma::add_property_for_item_ID(heif_item_id itemID,
                                         PropertyAssociation assoc)
 {
-  size_t idx;
-  for (idx = 0; idx < m_entries.size(); idx++) {
-    if (m_entries[idx].item_ID == itemID) {
-      break;
-    }
-  }
-
   // if itemID does not exist, add a new entry
-  if (idx == m_entries.size()) {
+  if (m_entry_index.find(itemID) == m_entry_index.end()) {
     Entry entry;
     entry.item_ID = itemID;
-    m_entries.push_back(entry);
+    add_entry(entry);
   }
 
   // add the property association
-  m_entries[idx].associations.push_back(assoc);
+  m_entries[m_entry_index[itemID]].associations.push_back(assoc);
 }
 
 
@@ -2557,9 +3432,9 @@ Error Box_ipma::write(StreamWriter& writer) const
 
 void Box_ipma::insert_entries_from_other_ipma_box(const Box_ipma& b)
 {
-  m_entries.insert(m_entries.end(),
-                   b.m_entries.begin(),
-                   b.m_entries.end());
+  for (const Entry& entry : b.m_entries) {
+    add_entry(entry);
+  }
 }
 
 
@@ -2865,7 +3740,7 @@ Error Box_iref::parse(BitstreamRange& range)
       }
     }
 
-    m_references.push_back(ref);
+    add_reference(ref);
   }
 
   return range.get_error();
@@ -2943,13 +3818,7 @@ std::string Box_iref::dump(Indent& indent) const
 
 bool Box_iref::has_references(uint32_t itemID) const
 {
-  for (const Reference& ref : m_references) {
-    if (ref.from_item_ID == itemID) {
-      return true;
-    }
-  }
-
-  return false;
+  return m_references_from.find(itemID) != m_references_from.end();
 }
 
 
@@ -2957,9 +3826,10 @@ std::vector<Box_iref::Reference> Box_iref::get_references_from(heif_item_id item
 {
   std::vector<Reference> references;
 
-  for (const Reference& ref : m_references) {
-    if (ref.from_item_ID == itemID) {
-      references.push_back(ref);
+  auto iter = m_references_from.find(itemID);
+  if (iter != m_references_from.end()) {
+    for (size_t idx : iter->second) {
+      references.push_back(m_references[idx]);
     }
   }
 
@@ -2969,10 +3839,12 @@ std::vector<Box_iref::Reference> Box_iref::get_references_from(heif_item_id item
 
 std::vector<uint32_t> Box_iref::get_references(uint32_t itemID, uint32_t ref_type) const
 {
-  for (const Reference& ref : m_references) {
-    if (ref.from_item_ID == itemID &&
-        ref.header.get_short_type() == ref_type) {
-      return ref.to_item_ID;
+  auto iter = m_references_from.find(itemID);
+  if (iter != m_references_from.end()) {
+    for (size_t idx : iter->second) {
+      if (m_references[idx].header.get_short_type() == ref_type) {
+        return m_references[idx].to_item_ID;
+      }
     }
   }
 
@@ -2980,6 +3852,13 @@ std::vector<uint32_t> Box_iref::get_references(uint32_t itemID, uint32_t ref_typ
 }
 
 
+void Box_iref::add_reference(const Reference& ref)
+{
+  m_references_from[ref.from_item_ID].push_back(m_references.size());
+  m_references.push_back(ref);
+}
+
+
 void Box_iref::add_reference(heif_item_id from_id, uint32_t type, const std::vector<heif_item_id>& to_ids)
 {
   Reference ref;
@@ -2987,7 +3866,27 @@ void Box_iref::add_reference(heif_item_id from_id, uint32_t type, const std::vec
   ref.from_item_ID = from_id;
   ref.to_item_ID = to_ids;
 
-  m_references.push_back(ref);
+  add_reference(ref);
+}
+
+
+void Box_iref::remove_references(heif_item_id itemID)
+{
+  std::vector<Reference> references;
+  std::swap(references, m_references);
+  m_references_from.clear();
+
+  for (auto& ref : references) {
+    if (ref.from_item_ID == itemID) {
+      continue;
+    }
+
+    ref.to_item_ID.erase(std::remove(ref.to_item_ID.begin(), ref.to_item_ID.end(), itemID),
+                         ref.to_item_ID.end());
+    if (!ref.to_item_ID.empty()) {
+      add_reference(ref);
+    }
+  }
 }
 
 
@@ -3156,13 +4055,25 @@ std::string Box_hvcC::dump(Indent& indent) const
 
 bool Box_hvcC::get_headers(std::vector<uint8_t>* dest) const
 {
+  size_t total_size = dest->size();
+  for (const auto& array : m_nal_array) {
+    for (const auto& unit : array.m_nal_units) {
+      total_size += 4 + unit.size();
+    }
+  }
+
+  dest->reserve(total_size);
+
   for (const auto& array : m_nal_array) {
     for (const auto& unit : array.m_nal_units) {
 
-      dest->push_back((unit.size() >> 24) & 0xFF);
-      dest->push_back((unit.size() >> 16) & 0xFF);
-      dest->push_back((unit.size() >> 8) & 0xFF);
-      dest->push_back((unit.size() >> 0) & 0xFF);
+      const uint8_t size_prefix[4] = {
+          static_cast<uint8_t>((unit.size() >> 24) & 0xFF),
+          static_cast<uint8_t>((unit.size() >> 16) & 0xFF),
+          static_cast<uint8_t>((unit.size() >> 8) & 0xFF),
+          static_cast<uint8_t>((unit.size() >> 0) & 0xFF)
+      };
+      dest->insert(dest->end(), size_prefix, size_prefix + 4);
 
       /*
       dest->push_back(0);
@@ -3559,19 +4470,19 @@ Error Box_idat::read_data(const std::shared_ptr<StreamReader>& istr,
                  heif_suberror_End_of_data);
   }
 
-  bool success;
-  success = istr->seek(m_data_start_pos + (std::streampos) start);
-  assert(success);
-  (void) success;
-
   if (length > 0) {
     // reserve space for the data in the output array
     out_data.resize(static_cast<size_t>(curr_size + length));
     uint8_t* data = &out_data[curr_size];
 
-    success = istr->read((char*) data, static_cast<size_t>(length));
-    assert(success);
-    (void) success;
+    bool success = istr->read_at(static_cast<int64_t>(get_data_start_pos() + start),
+                                 data, static_cast<size_t>(length));
+    if (!success) {
+      out_data.resize(static_cast<size_t>(curr_size));
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_End_of_data,
+                   "Data could not be read from the file");
+    }
   }
 
   return Error::Ok;
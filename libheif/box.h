@@ -37,12 +37,17 @@
 #include <istream>
 #include <bitset>
 #include <utility>
+#include <unordered_map>
 
 #include "error.h"
 #include "heif.h"
 #include "logging.h"
 #include "bitstream.h"
 
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
 #if !defined(__EMSCRIPTEN__) && !defined(_MSC_VER)
 // std::array<bool> is not supported on some older compilers.
 #define HAS_BOOL_ARRAY 1
@@ -159,6 +164,9 @@ public:
 
   static Error read(BitstreamRange& range, std::shared_ptr<Box>* box);
 
+  // Read the box content when the header 'hdr' has already been read from 'range'.
+  static Error read(BitstreamRange& range, const BoxHeader& hdr, std::shared_ptr<Box>* box);
+
   virtual Error write(StreamWriter& writer) const;
 
   // check, which box version is required and set this in the (full) box header
@@ -191,6 +199,8 @@ public:
     return (int) m_children.size() - 1;
   }
 
+  void remove_child_box(const std::shared_ptr<const Box>& box);
+
 protected:
   virtual Error parse(BitstreamRange& range);
 
@@ -266,6 +276,8 @@ public:
 
   void set_major_brand(uint32_t major_brand) { m_major_brand = major_brand; }
 
+  uint32_t get_major_brand() const { return m_major_brand; }
+
   void set_minor_version(uint32_t minor_version) { m_minor_version = minor_version; }
 
   void clear_compatible_brands() { m_compatible_brands.clear(); }
@@ -371,6 +383,16 @@ public:
     uint64_t length = 0;
 
     std::vector<uint8_t> data; // only used when writing data
+
+    // Only used when writing data: memory that is written instead of 'data' without copying it.
+    // 'data_owner' keeps the memory alive until the file has been written.
+    const uint8_t* data_ref = nullptr;
+    size_t data_ref_size = 0;
+    std::shared_ptr<const void> data_owner;
+
+    const uint8_t* get_data() const { return data_ref ? data_ref : data.data(); }
+
+    size_t get_data_size() const { return data_ref ? data_ref_size : data.size(); }
   };
 
   struct Item
@@ -385,11 +407,34 @@ public:
 
   const std::vector<Item>& get_items() const { return m_items; }
 
+  // Returns nullptr if there is no item with this ID.
+  const Item* get_item(heif_item_id item_ID) const;
+
   Error read_data(const Item& item,
                   const std::shared_ptr<StreamReader>& istr,
                   const std::shared_ptr<class Box_idat>&,
                   std::vector<uint8_t>* dest) const;
 
+  // Like read_data(), but only appends 'size' bytes, starting at byte 'offset' of the item data.
+  Error read_data_range(const Item& item,
+                        const std::shared_ptr<StreamReader>& istr,
+                        const std::shared_ptr<class Box_idat>&,
+                        uint64_t offset, uint64_t size,
+                        std::vector<uint8_t>* dest) const;
+
+  // Get direct access to the item data without copying it. This is only possible if the item
+  // consists of a single extent in the file (construction method 0) and the stream can provide
+  // a view into its memory. Returns false if the data has to be read with read_data() instead.
+  bool get_data_view(const Item& item,
+                     const std::shared_ptr<StreamReader>& istr,
+                     const uint8_t** data,
+                     size_t* size) const;
+
+  // Append the ranges of the input file that read_data() reads for this item.
+  Error get_file_ranges(const Item& item,
+                        const std::shared_ptr<class Box_idat>&,
+                        std::vector<FileRange>& ranges) const;
+
   void set_min_version(uint8_t min_version) { m_user_defined_min_version = min_version; }
 
   // append bitstream data that will be written later (after iloc box)
@@ -397,21 +442,56 @@ public:
                     const std::vector<uint8_t>& data,
                     uint8_t construction_method = 0);
 
-  // append bitstream data that already has been written (before iloc box)
-  // Error write_mdat_before_iloc(heif_image_id item_ID,
-  //                              std::vector<uint8_t>& data)
+  // Takes over the data buffer instead of copying it.
+  Error append_data(heif_item_id item_ID,
+                    std::vector<uint8_t>&& data,
+                    uint8_t construction_method = 0);
+
+  // Like append_data() with construction method 0, but the data is not copied. 'owner' has to keep
+  // the memory valid until the file has been written.
+  Error append_data_reference(heif_item_id item_ID,
+                              const uint8_t* data, size_t size,
+                              std::shared_ptr<const void> owner);
+
+  void remove_item(heif_item_id item_ID);
+
+  // For updating a file in place: the data appended with construction method 0 is placed into an
+  // 'mdat' box at 'file_position' (the position of its content) instead of after the iloc box.
+  // All other items keep their offsets. The size of the placed data is returned in 'out_size',
+  // the data has to be written with write_mdat_data().
+  Error place_new_data(uint64_t file_position, uint64_t* out_size);
 
-  // reserve data entry that will be written later
-  // Error reserve_mdat_item(heif_image_id item_ID,
-  //                         uint8_t construction_method,
-  //                         uint32_t* slot_ID);
-  // void patch_mdat_slot(uint32_t slot_ID, size_t start, size_t length);
+  // After the placed data has been written, it is released and read from the file like the data
+  // of the other items.
+  void release_placed_data();
+
+  // Write the data appended with construction method 0 to 'sink' as it arrives instead of keeping
+  // it until write(). Each item is written into an 'mdat' box of its own, consecutive appends for
+  // the same item are collected into one extent. 'file_position' is the position in the output
+  // file at which the sink continues. Data that has already been appended is written immediately.
+  Error start_streaming_output(const StreamWriter::output_sink& sink, uint64_t file_position);
+
+  bool is_streaming_output() const { return m_streaming_sink != nullptr; }
+
+  // Write the collected data of the last item. Returns the first error of the sink.
+  Error flush_streaming_output();
+
+  Error append_streaming_data(size_t item_index, const uint8_t* data, size_t size);
 
   void derive_box_version() override;
 
   Error write(StreamWriter& writer) const override;
 
-  Error write_mdat_after_iloc(StreamWriter& writer);
+  // Write the header of the 'mdat' box that follows the iloc box at the current writer position
+  // and fill in the item offsets in the iloc box. The 'mdat' content has to be written directly
+  // afterwards with write_mdat_data().
+  Error write_mdat_header_after_iloc(StreamWriter& writer);
+
+  Error write_mdat_data(const StreamWriter::output_sink& sink) const;
+
+  // Fill in the item offsets of the iloc box that has been written by write() into 'writer'.
+  // This is only called directly when the offsets are already known (see place_new_data()).
+  void patch_iloc_header(StreamWriter& writer) const;
 
 protected:
   Error parse(BitstreamRange& range) override;
@@ -419,6 +499,9 @@ protected:
 private:
   std::vector<Item> m_items;
 
+  // item_ID -> index into m_items (of the first item with this ID)
+  std::unordered_map<heif_item_id, size_t> m_item_index;
+
   mutable size_t m_iloc_box_start = 0;
   uint8_t m_user_defined_min_version = 0;
   uint8_t m_offset_size = 0;
@@ -426,9 +509,21 @@ private:
   uint8_t m_base_offset_size = 0;
   uint8_t m_index_size = 0;
 
-  void patch_iloc_header(StreamWriter& writer) const;
+  // set by place_new_data(), all items are written with their current offsets
+  bool m_keep_item_offsets = false;
+
+  uint64_t m_idat_offset = 0; // only for writing: offset of next data array
 
-  int m_idat_offset = 0; // only for writing: offset of next data array
+  StreamWriter::output_sink m_streaming_sink;
+  uint64_t m_streaming_position = 0;
+  size_t m_streaming_pending_item = 0;
+  std::vector<uint8_t> m_streaming_pending_data;
+  Error m_streaming_error;
+
+  // Returns the index into m_items, a new item is added if there is none with this ID yet.
+  size_t get_or_add_item(heif_item_id item_ID, uint8_t construction_method);
+
+  Error write_streaming_mdat(Item& item, const std::vector<std::pair<const uint8_t*, size_t>>& parts);
 };
 
 
@@ -454,6 +549,8 @@ public:
 
   void set_item_type(const std::string& type) { m_item_type = type; }
 
+  const std::string& get_item_name() const { return m_item_name; }
+
   void set_item_name(const std::string& name) { m_item_name = name; }
 
   const std::string& get_content_type() const { return m_content_type; }
@@ -531,22 +628,79 @@ public:
     set_short_type(fourcc("ipco"));
   }
 
+  // Only the box headers of the properties are read when parsing the file. Each property is parsed
+  // when it is requested for the first time. get_all_child_boxes() contains nullptr for the
+  // properties that have not been parsed yet.
+
+  // 'index' is zero-based (ipma property index - 1). Returns nullptr if there is no such property
+  // or if it could not be parsed. In that case, the error is returned in 'out_error'.
+  std::shared_ptr<Box> get_property(size_t index, Error* out_error = nullptr);
+
   Error get_properties_for_item_ID(heif_item_id itemID,
                                    const std::shared_ptr<class Box_ipma>&,
-                                   std::vector<std::shared_ptr<Box>>& out_properties) const;
+                                   std::vector<std::shared_ptr<Box>>& out_properties);
+
+  // Only the properties of the given types are parsed and returned (in the order of the ipma entry).
+  Error get_properties_for_item_ID(heif_item_id itemID,
+                                   const std::shared_ptr<class Box_ipma>&,
+                                   const std::vector<uint32_t>& property_box_types,
+                                   std::vector<std::shared_ptr<Box>>& out_properties);
 
   std::shared_ptr<Box> get_property_for_item_ID(heif_item_id itemID,
                                                 const std::shared_ptr<class Box_ipma>&,
-                                                uint32_t property_box_type) const;
+                                                uint32_t property_box_type);
+
+  // Does not parse the property.
+  bool has_property_for_item_ID(heif_item_id itemID,
+                                const std::shared_ptr<class Box_ipma>&,
+                                uint32_t property_box_type) const;
+
+  // Box type of the property at the zero-based 'index' without parsing it. Returns 0 if there is no such property.
+  uint32_t get_property_box_type(size_t index) const;
 
   bool is_property_essential_for_item(heif_item_id itemId,
                                       const std::shared_ptr<const class Box>& property,
                                       const std::shared_ptr<class Box_ipma>&) const;
 
+  // Get the complete property box (including its header) as it will be written.
+  // Properties read from the file are returned unchanged without parsing them.
+  Error get_property_data(size_t index, std::vector<uint8_t>* out_data);
+
+  // Add a property box (including its header) without parsing it. It is parsed on first access.
+  // Returns the zero-based index of the new property.
+  size_t append_property_data(const std::vector<uint8_t>& data);
+
   std::string dump(Indent&) const override;
 
+  Error write(StreamWriter& writer) const override;
+
 protected:
   Error parse(BitstreamRange& range) override;
+
+private:
+  // Location of a property box (including its header) in m_property_data.
+  struct UnparsedProperty
+  {
+    uint32_t box_type = 0;
+    size_t offset = 0;
+    size_t size = 0;
+  };
+
+  // The content of the ipco box as read from the file.
+  std::vector<uint8_t> m_property_data;
+
+  // Same indices as m_children. Properties added when writing a file have no entry or an empty
+  // entry if there are unparsed properties behind them (see append_property_data()).
+  std::vector<UnparsedProperty> m_unparsed_properties;
+
+  // Errors of properties that could not be parsed, so that we do not try again.
+  std::unordered_map<size_t, Error> m_property_errors;
+
+  Error parse_property(size_t index, std::shared_ptr<Box>* out_box) const;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  mutable std::mutex m_mutex;
+#endif
 };
 
 
@@ -604,6 +758,8 @@ public:
   void add_property_for_item_ID(heif_item_id itemID,
                                 PropertyAssociation assoc);
 
+  void remove_entries_for_item_ID(heif_item_id itemID);
+
   void derive_box_version() override;
 
   Error write(StreamWriter& writer) const override;
@@ -620,6 +776,11 @@ protected:
   };
 
   std::vector<Entry> m_entries;
+
+  // item_ID -> index into m_entries (of the first entry with this ID)
+  std::unordered_map<heif_item_id, size_t> m_entry_index;
+
+  void add_entry(const Entry& entry);
 };
 
 
@@ -761,6 +922,9 @@ public:
 
   void add_reference(heif_item_id from_id, uint32_t type, const std::vector<heif_item_id>& to_ids);
 
+  // Remove all references from and to this item. References without a target are removed, too.
+  void remove_references(heif_item_id itemID);
+
 protected:
   Error parse(BitstreamRange& range) override;
 
@@ -770,6 +934,11 @@ protected:
 
 private:
   std::vector<Reference> m_references;
+
+  // from_item_ID -> indices into m_references, in file order
+  std::unordered_map<heif_item_id, std::vector<size_t>> m_references_from;
+
+  void add_reference(const Reference& ref);
 };
 
 
@@ -815,6 +984,9 @@ public:
 
   const configuration& get_configuration() const { return m_configuration; }
 
+  // number of bytes of the NAL unit sizes in the coded data
+  uint8_t get_length_size() const { return m_length_size; }
+
   void append_nal_data(const std::vector<uint8_t>& nal);
 
   void append_nal_data(const uint8_t* data, size_t size);
@@ -897,6 +1069,35 @@ private:
 };
 
 
+// JPEG configuration of 'jpeg' items (ISO/IEC 23008-12, Annex H). Holds the marker segments
+// (e.g. the quantization and Huffman tables) that are shared by all images using this property.
+// They are prepended to the item data when decoding.
+class Box_jpgC : public Box
+{
+public:
+  Box_jpgC()
+  {
+    set_short_type(fourcc("jpgC"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  bool get_headers(std::vector<uint8_t>* dest) const
+  {
+    dest->insert(dest->end(), m_data.begin(), m_data.end());
+    return true;
+  }
+
+  Error write(StreamWriter& writer) const override;
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  std::vector<uint8_t> m_data;
+};
+
+
 class Box_vvcC : public Box
 {
 public:
@@ -975,6 +1176,9 @@ public:
                   uint64_t start, uint64_t length,
                   std::vector<uint8_t>& out_data) const;
 
+  // File position of the idat content.
+  uint64_t get_data_start_pos() const { return static_cast<uint64_t>(static_cast<std::streamoff>(m_data_start_pos)); }
+
   int append_data(const std::vector<uint8_t>& data)
   {
     auto pos = m_data_for_writing.size();
@@ -0,0 +1,103 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cancellation.h"
+
+#include <string>
+
+
+Cancellation::Cancellation(heif_decoding_options& options)
+    : m_operation("Decoding")
+{
+  if (options.version >= 14) {
+    init(options.cancel_decoding, options.cancel_user_data, options.timeout_ms);
+
+    options.cancel_decoding = is_active() ? installed_callback : nullptr;
+    options.cancel_user_data = this;
+    options.timeout_ms = 0;
+  }
+}
+
+
+Cancellation::Cancellation(heif_encoding_options& options)
+    : m_operation("Encoding")
+{
+  if (options.version >= 9) {
+    init(options.cancel_encoding, options.cancel_user_data, options.timeout_ms);
+
+    options.cancel_encoding = is_active() ? installed_callback : nullptr;
+    options.cancel_user_data = this;
+    options.timeout_ms = 0;
+  }
+}
+
+
+void Cancellation::init(int (* callback)(void*), void* userdata, uint32_t timeout_ms)
+{
+  m_callback = callback;
+  m_userdata = userdata;
+
+  if (timeout_ms > 0) {
+    m_has_deadline = true;
+    m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  }
+}
+
+
+Error Cancellation::check() const
+{
+  if (m_has_deadline && std::chrono::steady_clock::now() >= m_deadline) {
+    return Error(heif_error_Canceled, heif_suberror_Timeout,
+                 std::string(m_operation) + " took longer than the timeout");
+  }
+
+  if (m_callback && m_callback(m_userdata)) {
+    return Error(heif_error_Canceled, heif_suberror_Canceled_by_application,
+                 std::string(m_operation) + " was canceled by the application");
+  }
+
+  return Error::Ok;
+}
+
+
+int Cancellation::installed_callback(void* cancellation)
+{
+  return static_cast<const Cancellation*>(cancellation)->check() ? 1 : 0;
+}
+
+
+const Cancellation* Cancellation::get(const heif_decoding_options& options)
+{
+  if (options.version >= 14 && options.cancel_decoding == installed_callback) {
+    return static_cast<const Cancellation*>(options.cancel_user_data);
+  }
+
+  return nullptr;
+}
+
+
+const Cancellation* Cancellation::get(const heif_encoding_options& options)
+{
+  if (options.version >= 9 && options.cancel_encoding == installed_callback) {
+    return static_cast<const Cancellation*>(options.cancel_user_data);
+  }
+
+  return nullptr;
+}
@@ -0,0 +1,88 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_CANCELLATION_H
+#define LIBHEIF_CANCELLATION_H
+
+#include "heif.h"
+#include "error.h"
+
+#include <chrono>
+#include <cstdint>
+
+
+// Combines the cancel callback and the timeout of the decoding or encoding options.
+//
+// The API functions create a Cancellation for their copy of the options and install it as the cancel
+// callback of that copy. The timeout thus starts when the API function is called and the library code
+// only has to check the options with check_canceled(). The options must not be used after the
+// Cancellation has been destroyed.
+class Cancellation
+{
+public:
+  explicit Cancellation(heif_decoding_options& options);
+
+  explicit Cancellation(heif_encoding_options& options);
+
+  Cancellation(const Cancellation&) = delete;
+
+  Cancellation& operator=(const Cancellation&) = delete;
+
+  // Returns heif_error_Canceled if the application canceled the operation or the timeout has passed.
+  Error check() const;
+
+  // The Cancellation installed into the options, or nullptr if the operation cannot be canceled.
+  static const Cancellation* get(const heif_decoding_options& options);
+
+  static const Cancellation* get(const heif_encoding_options& options);
+
+private:
+  int (* m_callback)(void* userdata) = nullptr;
+  void* m_userdata = nullptr;
+
+  bool m_has_deadline = false;
+  std::chrono::steady_clock::time_point m_deadline;
+
+  const char* m_operation;
+
+  void init(int (* callback)(void*), void* userdata, uint32_t timeout_ms);
+
+  bool is_active() const { return m_callback || m_has_deadline; }
+
+  static int installed_callback(void* cancellation);
+};
+
+
+inline Error check_canceled(const Cancellation* cancellation)
+{
+  return cancellation ? cancellation->check() : Error::Ok;
+}
+
+inline Error check_canceled(const heif_decoding_options& options)
+{
+  return check_canceled(Cancellation::get(options));
+}
+
+inline Error check_canceled(const heif_encoding_options& options)
+{
+  return check_canceled(Cancellation::get(options));
+}
+
+#endif
@@ -19,6 +19,7 @@
  */
 
 #include "alpha.h"
+#include <cstring>
 
 
 std::vector<ColorStateWithCost>
@@ -61,6 +62,7 @@ Op_drop_alpha_plane::convert_colorspace(const std::shared_ptr<const HeifPixelIma
   int height = input->get_height();
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(width, height,
                  input->get_colorspace(),
@@ -79,3 +81,298 @@ Op_drop_alpha_plane::convert_colorspace(const std::shared_ptr<const HeifPixelIma
 
   return outimg;
 }
+
+
+void add_alpha_premultiplication_states(std::vector<ColorStateWithCost>& states,
+                                        const ColorState& input_state,
+                                        const ColorState& target_state)
+{
+  bool change = (input_state.has_alpha && target_state.has_alpha &&
+                 input_state.premultiplied_alpha != target_state.premultiplied_alpha);
+
+  size_t num_states = states.size();
+  for (size_t i = 0; i < num_states; i++) {
+    ColorStateWithCost& state = states[i];
+    state.color_state.premultiplied_alpha = input_state.premultiplied_alpha && state.color_state.has_alpha;
+
+    if (change && state.color_state.has_alpha) {
+      ColorStateWithCost changed = state;
+      changed.color_state.premultiplied_alpha = !input_state.premultiplied_alpha;
+      changed.speed_costs += SpeedCosts_Trivial;
+      states.push_back(changed);
+    }
+  }
+}
+
+
+AlphaPremultiplicationChange get_alpha_premultiplication_change(const HeifPixelImage& input,
+                                                                const ColorState& target_state)
+{
+  if (!input.has_channel(heif_channel_Alpha) || !target_state.has_alpha) {
+    return AlphaPremultiplicationChange::none;
+  }
+
+  if (input.is_premultiplied_alpha() == target_state.premultiplied_alpha) {
+    return AlphaPremultiplicationChange::none;
+  }
+
+  return (target_state.premultiplied_alpha ?
+          AlphaPremultiplicationChange::premultiply :
+          AlphaPremultiplicationChange::unpremultiply);
+}
+
+
+void premultiply_alpha_RGBA_row(uint8_t* row, int width)
+{
+  for (int x = 0; x < width; x++) {
+    uint8_t* p = row + 4 * x;
+    uint32_t a = p[3];
+
+    if (a == 0xFF) {
+      continue;
+    }
+
+    // exact rounding of c*a/255 without division
+    for (int c = 0; c < 3; c++) {
+      uint32_t t = p[c] * a + 128;
+      p[c] = static_cast<uint8_t>((t + (t >> 8)) >> 8);
+    }
+  }
+}
+
+
+void unpremultiply_alpha_RGBA_row(uint8_t* row, int width)
+{
+  for (int x = 0; x < width; x++) {
+    uint8_t* p = row + 4 * x;
+    uint16_t a = p[3];
+
+    if (a == 0xFF) {
+      continue;
+    }
+
+    for (int c = 0; c < 3; c++) {
+      p[c] = static_cast<uint8_t>(unpremultiply_alpha_value(p[c], a, 0xFF, 0xFF));
+    }
+  }
+}
+
+
+std::vector<ColorStateWithCost>
+Op_premultiply_alpha::state_after_conversion(const ColorState& input_state,
+                                             const ColorState& target_state,
+                                             const heif_color_conversion_options& options) const
+{
+  if (input_state.colorspace != heif_colorspace_RGB ||
+      !input_state.has_alpha ||
+      !target_state.has_alpha ||
+      input_state.premultiplied_alpha == target_state.premultiplied_alpha) {
+    return {};
+  }
+
+  switch (input_state.chroma) {
+    case heif_chroma_interleaved_RGBA:
+      if (input_state.bits_per_pixel != 8) {
+        return {};
+      }
+      break;
+    case heif_chroma_interleaved_RRGGBBAA_LE:
+    case heif_chroma_interleaved_RRGGBBAA_BE:
+    case heif_chroma_444:
+      if (input_state.bits_per_pixel > 16) {
+        return {};
+      }
+      break;
+    default:
+      return {};
+  }
+
+  std::vector<ColorStateWithCost> states;
+
+  ColorState output_state = input_state;
+  output_state.premultiplied_alpha = !input_state.premultiplied_alpha;
+
+  states.push_back({output_state, SpeedCosts_Unoptimized});
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_premultiply_alpha::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                         const ColorState& target_state,
+                                         const heif_color_conversion_options& options) const
+{
+  int width = input->get_width();
+  int height = input->get_height();
+
+  auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
+
+  outimg->create(width, height,
+                 input->get_colorspace(),
+                 input->get_chroma_format());
+
+  for (heif_channel channel : input->get_channel_set()) {
+    if (!outimg->add_plane(channel, input->get_width(channel), input->get_height(channel),
+                           input->get_bits_per_pixel(channel))) {
+      return nullptr;
+    }
+  }
+
+  if (!convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+template<class Pixel>
+static void premultiply_planar_rows(const std::shared_ptr<const HeifPixelImage>& input,
+                                    const std::shared_ptr<HeifPixelImage>& output,
+                                    bool premultiply)
+{
+  int width = input->get_width();
+  int height = input->get_height();
+
+  uint32_t alpha_max = (1U << input->get_bits_per_pixel(heif_channel_Alpha)) - 1;
+
+  size_t in_a_stride = 0;
+  const auto* in_a = reinterpret_cast<const Pixel*>(input->get_plane(heif_channel_Alpha, &in_a_stride));
+
+  for (heif_channel channel : {heif_channel_R, heif_channel_G, heif_channel_B}) {
+    uint32_t value_max = (1U << input->get_bits_per_pixel(channel)) - 1;
+
+    size_t in_stride = 0, out_stride = 0;
+    const auto* in_p = reinterpret_cast<const Pixel*>(input->get_plane(channel, &in_stride));
+    auto* out_p = reinterpret_cast<Pixel*>(output->get_plane(channel, &out_stride));
+
+    for (int y = 0; y < height; y++) {
+      const Pixel* in_line = in_p + y * (in_stride / sizeof(Pixel));
+      const Pixel* a_line = in_a + y * (in_a_stride / sizeof(Pixel));
+      Pixel* out_line = out_p + y * (out_stride / sizeof(Pixel));
+
+      for (int x = 0; x < width; x++) {
+        out_line[x] = static_cast<Pixel>(premultiply ?
+                                         premultiply_alpha_value(in_line[x], a_line[x], alpha_max) :
+                                         unpremultiply_alpha_value(in_line[x], a_line[x], alpha_max, value_max));
+      }
+    }
+  }
+
+  size_t out_a_stride = 0;
+  uint8_t* out_a = output->get_plane(heif_channel_Alpha, &out_a_stride);
+
+  for (int y = 0; y < height; y++) {
+    memcpy(out_a + y * static_cast<size_t>(out_a_stride),
+           reinterpret_cast<const uint8_t*>(in_a) + y * static_cast<size_t>(in_a_stride),
+           width * sizeof(Pixel));
+  }
+}
+
+
+bool Op_premultiply_alpha::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                   const std::shared_ptr<HeifPixelImage>& output,
+                                                   const ColorState& target_state,
+                                                   const heif_color_conversion_options& options) const
+{
+  int width = input->get_width();
+  int height = input->get_height();
+  heif_chroma chroma = input->get_chroma_format();
+
+  if (output->get_width() != width ||
+      output->get_height() != height ||
+      output->get_colorspace() != heif_colorspace_RGB ||
+      output->get_chroma_format() != chroma) {
+    return false;
+  }
+
+  for (heif_channel channel : input->get_channel_set()) {
+    if (!output->has_channel(channel) ||
+        output->get_bits_per_pixel(channel) != input->get_bits_per_pixel(channel)) {
+      return false;
+    }
+  }
+
+  bool premultiply = target_state.premultiplied_alpha;
+
+  if (chroma == heif_chroma_444) {
+    if (!input->has_channel(heif_channel_Alpha)) {
+      return false;
+    }
+
+    if (input->get_bits_per_pixel(heif_channel_Alpha) <= 8) {
+      for (heif_channel channel : {heif_channel_R, heif_channel_G, heif_channel_B}) {
+        if (input->get_bits_per_pixel(channel) > 8) {
+          return false;
+        }
+      }
+
+      premultiply_planar_rows<uint8_t>(input, output, premultiply);
+    }
+    else {
+      for (heif_channel channel : {heif_channel_R, heif_channel_G, heif_channel_B}) {
+        if (input->get_bits_per_pixel(channel) <= 8) {
+          return false;
+        }
+      }
+
+      premultiply_planar_rows<uint16_t>(input, output, premultiply);
+    }
+
+    return true;
+  }
+
+  size_t in_stride = 0, out_stride = 0;
+  const uint8_t* in_p = input->get_plane(heif_channel_interleaved, &in_stride);
+  uint8_t* out_p = output->get_plane(heif_channel_interleaved, &out_stride);
+
+  if (chroma == heif_chroma_interleaved_RGBA) {
+    for (int y = 0; y < height; y++) {
+      uint8_t* out_line = out_p + y * static_cast<size_t>(out_stride);
+      memcpy(out_line, in_p + y * static_cast<size_t>(in_stride), width * 4);
+
+      if (premultiply) {
+        premultiply_alpha_RGBA_row(out_line, width);
+      }
+      else {
+        unpremultiply_alpha_RGBA_row(out_line, width);
+      }
+    }
+
+    return true;
+  }
+
+  if (chroma != heif_chroma_interleaved_RRGGBBAA_LE &&
+      chroma != heif_chroma_interleaved_RRGGBBAA_BE) {
+    return false;
+  }
+
+  int le = (chroma == heif_chroma_interleaved_RRGGBBAA_LE) ? 1 : 0;
+  uint32_t maxval = (1U << input->get_bits_per_pixel(heif_channel_interleaved)) - 1;
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t* in_line = in_p + y * static_cast<size_t>(in_stride);
+    uint8_t* out_line = out_p + y * static_cast<size_t>(out_stride);
+
+    for (int x = 0; x < width; x++) {
+      const uint8_t* in = in_line + 8 * x;
+      uint8_t* out = out_line + 8 * x;
+
+      auto a = static_cast<uint16_t>((in[6 + le] << 8) | in[7 - le]);
+
+      for (int c = 0; c < 3; c++) {
+        auto v = static_cast<uint16_t>((in[2 * c + le] << 8) | in[2 * c + 1 - le]);
+        v = premultiply ? premultiply_alpha_value(v, a, maxval) : unpremultiply_alpha_value(v, a, maxval, maxval);
+        out[2 * c + le] = static_cast<uint8_t>(v >> 8);
+        out[2 * c + 1 - le] = static_cast<uint8_t>(v & 0xFF);
+      }
+
+      out[6] = in[6];
+      out[7] = in[7];
+    }
+  }
+
+  return true;
+}
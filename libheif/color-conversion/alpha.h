@@ -22,6 +22,7 @@
 #define LIBHEIF_COLORCONVERSION_ALPHA_H
 
 #include "colorconversion.h"
+#include <cstdint>
 #include <vector>
 #include <memory>
 
@@ -40,4 +41,72 @@ public:
                      const heif_color_conversion_options& options) const override;
 };
 
+
+// Premultiplies or unpremultiplies the color components of RGB images with alpha (interleaved RGBA,
+// RRGGBBAA or planar RGB). The conversions from YCbCr do this in the same pass. This operation
+// is used for all other formats.
+class Op_premultiply_alpha : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+
+  bool handles_alpha_premultiplication() const override { return true; }
+};
+
+
+// For the operations that premultiply or unpremultiply in the same pass as their conversion:
+// The output 'states' keep the alpha premultiplication of the input. If the target state has
+// a different premultiplication, the states with the changed premultiplication are added.
+void add_alpha_premultiplication_states(std::vector<ColorStateWithCost>& states,
+                                        const ColorState& input_state,
+                                        const ColorState& target_state);
+
+enum class AlphaPremultiplicationChange
+{
+  none,
+  premultiply,
+  unpremultiply
+};
+
+// The change of the premultiplication when converting 'input' into an image with 'target_state'.
+AlphaPremultiplicationChange get_alpha_premultiplication_change(const HeifPixelImage& input,
+                                                                const ColorState& target_state);
+
+
+// --- premultiplication of single values, with rounding. 'alpha_max' is the value of alpha = 1.0.
+
+inline uint16_t premultiply_alpha_value(uint16_t value, uint16_t alpha, uint32_t alpha_max)
+{
+  return static_cast<uint16_t>((uint32_t(value) * alpha + alpha_max / 2) / alpha_max);
+}
+
+// Colors of fully transparent pixels cannot be restored and are set to 0.
+inline uint16_t unpremultiply_alpha_value(uint16_t value, uint16_t alpha, uint32_t alpha_max, uint32_t value_max)
+{
+  if (alpha == 0) {
+    return 0;
+  }
+
+  uint32_t v = (uint32_t(value) * alpha_max + alpha / 2u) / alpha;
+  return static_cast<uint16_t>(v > value_max ? value_max : v);
+}
+
+// Rows of 8-bit interleaved RGBA pixels, modified in place.
+void premultiply_alpha_RGBA_row(uint8_t* row, int width);
+
+void unpremultiply_alpha_RGBA_row(uint8_t* row, int width);
+
 #endif //LIBHEIF_COLORCONVERSION_ALPHA_H
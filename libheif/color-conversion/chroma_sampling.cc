@@ -19,6 +19,8 @@
  */
 
 #include "chroma_sampling.h"
+#include "chroma_sampling_simd.h"
+#include "libheif/common_utils.h"
 #include <cstring>
 
 
@@ -54,7 +56,9 @@ Op_YCbCr444_to_YCbCr420_average<Pixel>::state_after_conversion(const ColorState&
     }
   }
 
-  if (target_state.chroma != heif_chroma_420) {
+  // the semi-planar formats are reached from planar 4:2:0
+  if (target_state.chroma != heif_chroma_420 &&
+      !is_semi_planar_chroma(target_state.chroma)) {
     return {};
   }
 
@@ -123,6 +127,7 @@ Op_YCbCr444_to_YCbCr420_average<Pixel>::convert_colorspace(const std::shared_ptr
   int height = input->get_height();
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(width, height, heif_colorspace_YCbCr, heif_chroma_420);
 
@@ -142,10 +147,10 @@ Op_YCbCr444_to_YCbCr420_average<Pixel>::convert_colorspace(const std::shared_ptr
   }
 
   const Pixel* in_y, * in_cb, * in_cr, * in_a;
-  int in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
+  size_t in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
 
   Pixel* out_y, * out_cb, * out_cr, * out_a;
-  int out_y_stride = 0, out_cb_stride = 0, out_cr_stride = 0, out_a_stride = 0;
+  size_t out_y_stride = 0, out_cb_stride = 0, out_cr_stride = 0, out_a_stride = 0;
 
   in_y = (const Pixel*) input->get_plane(heif_channel_Y, &in_y_stride);
   in_cb = (const Pixel*) input->get_plane(heif_channel_Cb, &in_cb_stride);
@@ -240,6 +245,20 @@ template class Op_YCbCr444_to_YCbCr420_average<uint16_t>;
 
 
 
+static inline void upsample_chroma_row(const uint8_t* near_row, const uint8_t* far_row, uint8_t* out,
+                                       int width, int /* bit_depth */)
+{
+  upsample_chroma_row_bilinear(near_row, far_row, out, width);
+}
+
+
+static inline void upsample_chroma_row(const uint16_t* near_row, const uint16_t* far_row, uint16_t* out,
+                                       int width, int bit_depth)
+{
+  upsample_chroma_row_bilinear(near_row, far_row, out, width, bit_depth);
+}
+
+
 template<class Pixel>
 std::vector<ColorStateWithCost>
 Op_YCbCr420_bilinear_to_YCbCr444<Pixel>::state_after_conversion(const ColorState& input_state,
@@ -337,6 +356,7 @@ Op_YCbCr420_bilinear_to_YCbCr444<Pixel>::convert_colorspace(const std::shared_pt
   int height = input->get_height();
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(width, height, heif_colorspace_YCbCr, heif_chroma_444);
 
@@ -353,10 +373,10 @@ Op_YCbCr420_bilinear_to_YCbCr444<Pixel>::convert_colorspace(const std::shared_pt
   }
 
   const Pixel* in_y, * in_cb, * in_cr, * in_a;
-  int in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
+  size_t in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
 
   Pixel* out_y, * out_cb, * out_cr, * out_a;
-  int out_y_stride = 0, out_cb_stride = 0, out_cr_stride = 0, out_a_stride = 0;
+  size_t out_y_stride = 0, out_cb_stride = 0, out_cr_stride = 0, out_a_stride = 0;
 
   in_y = (const Pixel*) input->get_plane(heif_channel_Y, &in_y_stride);
   in_cb = (const Pixel*) input->get_plane(heif_channel_Cb, &in_cb_stride);
@@ -386,119 +406,23 @@ Op_YCbCr420_bilinear_to_YCbCr444<Pixel>::convert_colorspace(const std::shared_pt
     out_a_stride /= 2;
   }
 
-  /*
-   *  We assume that chroma pixels are located in the center of 2x2 luma pixels.
-   *  The image border 'b' is handled separately.
-   *  The right and bottom border are not processed when the size is odd.
-   *  Then, each 2x2 square between 4 chroma samples is computed in one iteration.
-   *
-   *  Upsampling weights are 3/4, 1/4. For example:
-   *    A = 3/4*3/4 * C1 + 3/4*1/4 * C2 + 1/4*3/4 * C3 + 1/4*1/4 * C4
-   *
-   *    +---+---+---+---+
-   *    | b | b | b | b |
-   *    +---C1--+---C2--+
-   *    | b | A |   | b |
-   *    +---+---+---+---+
-   *    | b |   |   | b |
-   *    +---C3--+---C4--+
-   *    | b | b | b | b |
-   *    +---+---+---+---+
-   */
-
-  // --- fill borders
-
-  // top left corner
-  out_cb[0] = in_cb[0];
-  out_cr[0] = in_cr[0];
-
-  // top border
-  for (int cx = 0; cx < (width - 1) / 2; cx++) {
-    out_cb[0 * out_cb_stride + 2 * cx + 1] = (Pixel) ((3 * in_cb[cx / 2] + 1 * in_cb[cx / 2 + 1] + 2) / 4);
-    out_cb[0 * out_cb_stride + 2 * cx + 2] = (Pixel) ((1 * in_cb[cx / 2] + 3 * in_cb[cx / 2 + 1] + 2) / 4);
-    out_cr[0 * out_cr_stride + 2 * cx + 1] = (Pixel) ((3 * in_cr[cx / 2] + 1 * in_cr[cx / 2 + 1] + 2) / 4);
-    out_cr[0 * out_cr_stride + 2 * cx + 2] = (Pixel) ((1 * in_cr[cx / 2] + 3 * in_cr[cx / 2 + 1] + 2) / 4);
-  }
-
-  // top right corner
-  if (width % 2 == 0) {
-    out_cb[width - 1] = in_cb[width / 2 - 1];
-    out_cr[width - 1] = in_cr[width / 2 - 1];
-  }
-
-  // left border
-  for (int cy = 0; cy < (height - 1) / 2; cy++) {
-    out_cb[(2 * cy + 1) * out_cb_stride + 0] = (Pixel) ((3 * in_cb[cy / 2 * in_cb_stride] + 1 * in_cb[(cy / 2 + 1) * in_cb_stride] + 2) / 4);
-    out_cb[(2 * cy + 2) * out_cb_stride + 0] = (Pixel) ((1 * in_cb[cy / 2 * in_cb_stride] + 3 * in_cb[(cy / 2 + 1) * in_cb_stride] + 2) / 4);
-    out_cr[(2 * cy + 1) * out_cr_stride + 0] = (Pixel) ((3 * in_cr[cy / 2 * in_cr_stride] + 1 * in_cr[(cy / 2 + 1) * in_cr_stride] + 2) / 4);
-    out_cr[(2 * cy + 2) * out_cr_stride + 0] = (Pixel) ((1 * in_cr[cy / 2 * in_cr_stride] + 3 * in_cr[(cy / 2 + 1) * in_cr_stride] + 2) / 4);
-  }
-
-  // bottom left corner
-  if (height % 2 == 0) {
-    out_cb[(height - 1) * out_cb_stride] = in_cb[(height / 2 - 1) * in_cb_stride];
-    out_cr[(height - 1) * out_cr_stride] = in_cr[(height / 2 - 1) * in_cr_stride];
-  }
-
-  // right border
-  if (width % 2 == 0) {
-    for (int cy = 0; cy < (height - 1) / 2; cy++) {
-      out_cb[(2 * cy + 1) * out_cb_stride + width - 1] = (Pixel) ((3 * in_cb[cy / 2 * in_cb_stride + width / 2 - 1] + 1 * in_cb[(cy / 2 + 1) * in_cb_stride + width / 2 - 1] + 2) / 4);
-      out_cb[(2 * cy + 2) * out_cb_stride + width - 1] = (Pixel) ((1 * in_cb[cy / 2 * in_cb_stride + width / 2 - 1] + 3 * in_cb[(cy / 2 + 1) * in_cb_stride + width / 2 - 1] + 2) / 4);
-      out_cr[(2 * cy + 1) * out_cr_stride + width - 1] = (Pixel) ((3 * in_cr[cy / 2 * in_cr_stride + width / 2 - 1] + 1 * in_cr[(cy / 2 + 1) * in_cr_stride + width / 2 - 1] + 2) / 4);
-      out_cr[(2 * cy + 2) * out_cr_stride + width - 1] = (Pixel) ((1 * in_cr[cy / 2 * in_cr_stride + width / 2 - 1] + 3 * in_cr[(cy / 2 + 1) * in_cr_stride + width / 2 - 1] + 2) / 4);
-    }
-  }
-
-  // bottom border
-  if (height % 2 == 0) {
-    for (int cx = 0; cx < (width - 1) / 2; cx++) {
-      out_cb[(height - 1) * out_cb_stride + 2 * cx + 1] = (Pixel) ((3 * in_cb[(height / 2 - 1) * in_cb_stride + cx / 2] + 1 * in_cb[(height / 2 - 1) * in_cb_stride + cx / 2 + 1] + 2) / 4);
-      out_cb[(height - 1) * out_cb_stride + 2 * cx + 2] = (Pixel) ((1 * in_cb[(height / 2 - 1) * in_cb_stride + cx / 2] + 3 * in_cb[(height / 2 - 1) * in_cb_stride + cx / 2 + 1] + 2) / 4);
-      out_cr[(height - 1) * out_cr_stride + 2 * cx + 1] = (Pixel) ((3 * in_cr[(height / 2 - 1) * in_cr_stride + cx / 2] + 1 * in_cr[(height / 2 - 1) * in_cr_stride + cx / 2 + 1] + 2) / 4);
-      out_cr[(height - 1) * out_cr_stride + 2 * cx + 2] = (Pixel) ((1 * in_cr[(height / 2 - 1) * in_cr_stride + cx / 2] + 3 * in_cr[(height / 2 - 1) * in_cr_stride + cx / 2 + 1] + 2) / 4);
-    }
-  }
+  // --- bilinear filtering
 
-  // bottom right corner
-  if (width % 2 == 0 && height % 2 == 0) {
-    out_cb[(height - 1) * out_cb_stride + width - 1] = in_cb[(height / 2 - 1) * in_cb_stride + width / 2 - 1];
-    out_cr[(height - 1) * out_cr_stride + width - 1] = in_cr[(height / 2 - 1) * in_cr_stride + width / 2 - 1];
-  }
+  int chroma_height = (height + 1) / 2;
 
+  for (int y = 0; y < height; y++) {
+    int near_row, far_row;
+    get_bilinear_chroma_rows(y, chroma_height, &near_row, &far_row);
 
-  // --- bilinear filtering of inner part
-
-  int x, y;
-  for (y = 1; y < height - 1; y += 2) {
-    for (x = 1; x < width - 1; x += 2) {
-      int cx = x / 2;
-      int cy = y / 2;
-
-      Pixel cb00 = in_cb[cy * in_cb_stride + cx];
-      Pixel cr00 = in_cr[cy * in_cr_stride + cx];
-      Pixel cb01 = in_cb[cy * in_cb_stride + cx + 1];
-      Pixel cr01 = in_cr[cy * in_cr_stride + cx + 1];
-      Pixel cb10 = in_cb[(cy + 1) * in_cb_stride + cx];
-      Pixel cr10 = in_cr[(cy + 1) * in_cr_stride + cx];
-      Pixel cb11 = in_cb[(cy + 1) * in_cb_stride + cx + 1];
-      Pixel cr11 = in_cr[(cy + 1) * in_cr_stride + cx + 1];
-
-      out_cb[(y + 0) * out_cb_stride + x + 0] = (Pixel) ((cb00 * 3 * 3 + cb01 * 1 * 3 + cb10 * 3 * 1 + cb11 * 1 * 1 + 8) / 16);
-      out_cb[(y + 0) * out_cb_stride + x + 1] = (Pixel) ((cb00 * 1 * 3 + cb01 * 3 * 3 + cb10 * 1 * 1 + cb11 * 3 * 1 + 8) / 16);
-      out_cb[(y + 1) * out_cb_stride + x + 0] = (Pixel) ((cb00 * 3 * 1 + cb01 * 1 * 1 + cb10 * 3 * 3 + cb11 * 1 * 3 + 8) / 16);
-      out_cb[(y + 1) * out_cb_stride + x + 1] = (Pixel) ((cb00 * 1 * 1 + cb01 * 3 * 1 + cb10 * 1 * 3 + cb11 * 3 * 3 + 8) / 16);
-
-      out_cr[(y + 0) * out_cr_stride + x + 0] = (Pixel) ((cr00 * 3 * 3 + cr01 * 1 * 3 + cr10 * 3 * 1 + cr11 * 1 * 1 + 8) / 16);
-      out_cr[(y + 0) * out_cr_stride + x + 1] = (Pixel) ((cr00 * 1 * 3 + cr01 * 3 * 3 + cr10 * 1 * 1 + cr11 * 3 * 1 + 8) / 16);
-      out_cr[(y + 1) * out_cr_stride + x + 0] = (Pixel) ((cr00 * 3 * 1 + cr01 * 1 * 1 + cr10 * 3 * 3 + cr11 * 1 * 3 + 8) / 16);
-      out_cr[(y + 1) * out_cr_stride + x + 1] = (Pixel) ((cr00 * 1 * 1 + cr01 * 3 * 1 + cr10 * 1 * 3 + cr11 * 3 * 3 + 8) / 16);
-    }
+    upsample_chroma_row(in_cb + near_row * in_cb_stride, in_cb + far_row * in_cb_stride,
+                        out_cb + y * out_cb_stride, width, bpp_cb);
+    upsample_chroma_row(in_cr + near_row * in_cr_stride, in_cr + far_row * in_cr_stride,
+                        out_cr + y * out_cr_stride, width, bpp_cr);
   }
 
   // TODO: check whether we can use HeifPixelImage::transfer_plane_from_image_as() instead of copying Y and Alpha
 
-  for (y = 0; y < height; y++) {
+  for (int y = 0; y < height; y++) {
     int copyWidth = (hdr ? width * 2 : width);
 
     memcpy(&out_y[y * out_y_stride], &in_y[y * in_y_stride], copyWidth);
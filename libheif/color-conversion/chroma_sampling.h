@@ -59,6 +59,9 @@ public:
   convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
                      const ColorState& target_state,
                      const heif_color_conversion_options& options) const override;
+
+  // the interpolation uses the chroma rows above and below
+  int get_row_band_overlap() const override { return 2; }
 };
 
 #endif //LIBHEIF_CHROMA_SAMPLING_H
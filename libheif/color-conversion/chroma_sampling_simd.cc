@@ -0,0 +1,328 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chroma_sampling_simd.h"
+#include "libheif/cpu_features.h"
+
+#if HEIF_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+static Bilinear_chroma_upsampling_kernels s_kernels;
+
+
+void get_bilinear_chroma_rows(int y, int chroma_height, int* near_row, int* far_row)
+{
+  int near = y / 2;
+  int far = (y % 2 == 1) ? near + 1 : near - 1;
+
+  if (far < 0 || far >= chroma_height) {
+    far = near;
+  }
+
+  *near_row = near;
+  *far_row = far;
+}
+
+
+template<class Pixel>
+static void upsample_chroma_row_bilinear_scalar(const Pixel* near_row, const Pixel* far_row,
+                                                Pixel* out, int width, int first_pair)
+{
+  int chroma_width = (width + 1) / 2;
+  int num_pairs = (width - 1) / 2;
+
+  // left border
+  out[0] = (Pixel) ((3 * near_row[0] + far_row[0] + 2) >> 2);
+
+  for (int cx = first_pair; cx < num_pairs; cx++) {
+    int32_t v0 = 3 * near_row[cx] + far_row[cx];
+    int32_t v1 = 3 * near_row[cx + 1] + far_row[cx + 1];
+
+    out[2 * cx + 1] = (Pixel) ((3 * v0 + v1 + 8) >> 4);
+    out[2 * cx + 2] = (Pixel) ((v0 + 3 * v1 + 8) >> 4);
+  }
+
+  // right border
+  if (width % 2 == 0) {
+    out[width - 1] = (Pixel) ((3 * near_row[chroma_width - 1] + far_row[chroma_width - 1] + 2) >> 2);
+  }
+}
+
+
+void upsample_chroma_row_bilinear(const uint8_t* near_row, const uint8_t* far_row,
+                                  uint8_t* out, int width)
+{
+  int first_pair = 0;
+
+  if (s_kernels.upsample_8bit && width > 1) {
+    first_pair = s_kernels.upsample_8bit(near_row, far_row, out, (width - 1) / 2);
+  }
+
+  upsample_chroma_row_bilinear_scalar(near_row, far_row, out, width, first_pair);
+}
+
+
+void upsample_chroma_row_bilinear(const uint16_t* near_row, const uint16_t* far_row,
+                                  uint16_t* out, int width, int bit_depth)
+{
+  int first_pair = 0;
+
+  if (s_kernels.upsample_16bit && bit_depth <= 12 && width > 1) {
+    first_pair = s_kernels.upsample_16bit(near_row, far_row, out, (width - 1) / 2);
+  }
+
+  upsample_chroma_row_bilinear_scalar(near_row, far_row, out, width, first_pair);
+}
+
+
+#if HEIF_HAVE_X86_SIMD
+
+// --- SSE4.1
+
+// Vertical interpolation: 3*near + far
+HEIF_TARGET_SSE41
+static inline __m128i vertical_sum_sse41(__m128i near, __m128i far)
+{
+  return _mm_add_epi16(_mm_add_epi16(near, _mm_add_epi16(near, near)), far);
+}
+
+
+// Horizontal interpolation of the vertically interpolated values at cx and cx+1.
+HEIF_TARGET_SSE41
+static inline void horizontal_interpolation_sse41(__m128i v0, __m128i v1, __m128i* a, __m128i* b)
+{
+  const __m128i rounding = _mm_set1_epi16(8);
+
+  *a = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v0, _mm_add_epi16(v0, v0)), _mm_add_epi16(v1, rounding)), 4);
+  *b = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v1, _mm_add_epi16(v1, v1)), _mm_add_epi16(v0, rounding)), 4);
+}
+
+
+HEIF_TARGET_SSE41
+static int upsample_chroma_row_8bit_sse41(const uint8_t* near_row, const uint8_t* far_row,
+                                          uint8_t* out, int num_pairs)
+{
+  int cx = 0;
+  for (; cx + 8 <= num_pairs; cx += 8) {
+    __m128i v0 = vertical_sum_sse41(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*) (near_row + cx))),
+                                    _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*) (far_row + cx))));
+    __m128i v1 = vertical_sum_sse41(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*) (near_row + cx + 1))),
+                                    _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*) (far_row + cx + 1))));
+
+    __m128i a, b;
+    horizontal_interpolation_sse41(v0, v1, &a, &b);
+
+    // a and b are < 256: the 16-bit words (a | b<<8) are the interleaved output bytes
+    _mm_storeu_si128((__m128i*) (out + 2 * cx + 1), _mm_or_si128(a, _mm_slli_epi16(b, 8)));
+  }
+
+  return cx;
+}
+
+
+HEIF_TARGET_SSE41
+static int upsample_chroma_row_16bit_sse41(const uint16_t* near_row, const uint16_t* far_row,
+                                           uint16_t* out, int num_pairs)
+{
+  int cx = 0;
+  for (; cx + 8 <= num_pairs; cx += 8) {
+    __m128i v0 = vertical_sum_sse41(_mm_loadu_si128((const __m128i*) (near_row + cx)),
+                                    _mm_loadu_si128((const __m128i*) (far_row + cx)));
+    __m128i v1 = vertical_sum_sse41(_mm_loadu_si128((const __m128i*) (near_row + cx + 1)),
+                                    _mm_loadu_si128((const __m128i*) (far_row + cx + 1)));
+
+    __m128i a, b;
+    horizontal_interpolation_sse41(v0, v1, &a, &b);
+
+    _mm_storeu_si128((__m128i*) (out + 2 * cx + 1), _mm_unpacklo_epi16(a, b));
+    _mm_storeu_si128((__m128i*) (out + 2 * cx + 9), _mm_unpackhi_epi16(a, b));
+  }
+
+  return cx;
+}
+
+#endif
+
+
+#if HEIF_HAVE_X86_AVX
+
+// --- AVX2
+
+HEIF_TARGET_AVX2
+static inline __m256i vertical_sum_avx2(__m256i near, __m256i far)
+{
+  return _mm256_add_epi16(_mm256_add_epi16(near, _mm256_add_epi16(near, near)), far);
+}
+
+
+HEIF_TARGET_AVX2
+static inline void horizontal_interpolation_avx2(__m256i v0, __m256i v1, __m256i* a, __m256i* b)
+{
+  const __m256i rounding = _mm256_set1_epi16(8);
+
+  *a = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(v0, _mm256_add_epi16(v0, v0)), _mm256_add_epi16(v1, rounding)), 4);
+  *b = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(v1, _mm256_add_epi16(v1, v1)), _mm256_add_epi16(v0, rounding)), 4);
+}
+
+
+HEIF_TARGET_AVX2
+static int upsample_chroma_row_8bit_avx2(const uint8_t* near_row, const uint8_t* far_row,
+                                         uint8_t* out, int num_pairs)
+{
+  int cx = 0;
+  for (; cx + 16 <= num_pairs; cx += 16) {
+    __m256i v0 = vertical_sum_avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (near_row + cx))),
+                                   _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (far_row + cx))));
+    __m256i v1 = vertical_sum_avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (near_row + cx + 1))),
+                                   _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (far_row + cx + 1))));
+
+    __m256i a, b;
+    horizontal_interpolation_avx2(v0, v1, &a, &b);
+
+    _mm256_storeu_si256((__m256i*) (out + 2 * cx + 1), _mm256_or_si256(a, _mm256_slli_epi16(b, 8)));
+  }
+
+  return cx;
+}
+
+
+HEIF_TARGET_AVX2
+static int upsample_chroma_row_16bit_avx2(const uint16_t* near_row, const uint16_t* far_row,
+                                          uint16_t* out, int num_pairs)
+{
+  int cx = 0;
+  for (; cx + 16 <= num_pairs; cx += 16) {
+    __m256i v0 = vertical_sum_avx2(_mm256_loadu_si256((const __m256i*) (near_row + cx)),
+                                   _mm256_loadu_si256((const __m256i*) (far_row + cx)));
+    __m256i v1 = vertical_sum_avx2(_mm256_loadu_si256((const __m256i*) (near_row + cx + 1)),
+                                   _mm256_loadu_si256((const __m256i*) (far_row + cx + 1)));
+
+    __m256i a, b;
+    horizontal_interpolation_avx2(v0, v1, &a, &b);
+
+    // unpack works within the 128-bit lanes
+    __m256i lo = _mm256_unpacklo_epi16(a, b);
+    __m256i hi = _mm256_unpackhi_epi16(a, b);
+
+    _mm256_storeu_si256((__m256i*) (out + 2 * cx + 1), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*) (out + 2 * cx + 17), _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+
+  return cx;
+}
+
+#endif
+
+
+#if HEIF_HAVE_NEON
+
+static inline uint16x8_t vertical_sum_neon(uint16x8_t near, uint16x8_t far)
+{
+  return vmlaq_n_u16(far, near, 3);
+}
+
+
+static inline uint16x8x2_t horizontal_interpolation_neon(uint16x8_t v0, uint16x8_t v1)
+{
+  uint16x8x2_t ab;
+  ab.val[0] = vrshrq_n_u16(vmlaq_n_u16(v1, v0, 3), 4);
+  ab.val[1] = vrshrq_n_u16(vmlaq_n_u16(v0, v1, 3), 4);
+  return ab;
+}
+
+
+static int upsample_chroma_row_8bit_neon(const uint8_t* near_row, const uint8_t* far_row,
+                                         uint8_t* out, int num_pairs)
+{
+  int cx = 0;
+  for (; cx + 8 <= num_pairs; cx += 8) {
+    uint16x8_t v0 = vertical_sum_neon(vmovl_u8(vld1_u8(near_row + cx)), vmovl_u8(vld1_u8(far_row + cx)));
+    uint16x8_t v1 = vertical_sum_neon(vmovl_u8(vld1_u8(near_row + cx + 1)), vmovl_u8(vld1_u8(far_row + cx + 1)));
+
+    uint16x8x2_t ab = horizontal_interpolation_neon(v0, v1);
+
+    uint8x8x2_t out_ab;
+    out_ab.val[0] = vmovn_u16(ab.val[0]);
+    out_ab.val[1] = vmovn_u16(ab.val[1]);
+    vst2_u8(out + 2 * cx + 1, out_ab);
+  }
+
+  return cx;
+}
+
+
+static int upsample_chroma_row_16bit_neon(const uint16_t* near_row, const uint16_t* far_row,
+                                          uint16_t* out, int num_pairs)
+{
+  int cx = 0;
+  for (; cx + 8 <= num_pairs; cx += 8) {
+    uint16x8_t v0 = vertical_sum_neon(vld1q_u16(near_row + cx), vld1q_u16(far_row + cx));
+    uint16x8_t v1 = vertical_sum_neon(vld1q_u16(near_row + cx + 1), vld1q_u16(far_row + cx + 1));
+
+    vst2q_u16(out + 2 * cx + 1, horizontal_interpolation_neon(v0, v1));
+  }
+
+  return cx;
+}
+
+#endif
+
+
+void select_bilinear_chroma_upsampling_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  s_kernels = Bilinear_chroma_upsampling_kernels();
+
+#if HEIF_HAVE_X86_SIMD
+  if (cpu.sse41) {
+    s_kernels.upsample_8bit = upsample_chroma_row_8bit_sse41;
+    s_kernels.upsample_16bit = upsample_chroma_row_16bit_sse41;
+  }
+#endif
+
+#if HEIF_HAVE_X86_AVX
+  if (cpu.avx2) {
+    s_kernels.upsample_8bit = upsample_chroma_row_8bit_avx2;
+    s_kernels.upsample_16bit = upsample_chroma_row_16bit_avx2;
+  }
+#endif
+
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    s_kernels.upsample_8bit = upsample_chroma_row_8bit_neon;
+    s_kernels.upsample_16bit = upsample_chroma_row_16bit_neon;
+  }
+#endif
+
+  (void) cpu;
+}
+
+
+const Bilinear_chroma_upsampling_kernels& get_bilinear_chroma_upsampling_kernels()
+{
+  return s_kernels;
+}
@@ -0,0 +1,66 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_COLORCONVERSION_CHROMA_SAMPLING_SIMD_H
+#define LIBHEIF_COLORCONVERSION_CHROMA_SAMPLING_SIMD_H
+
+#include <cstdint>
+
+
+// --- bilinear 4:2:0 chroma upsampling
+//
+// These are the building blocks for all operations that do bilinear chroma upsampling.
+// Chroma samples are located in the center of 2x2 luma pixels. Each output row is interpolated
+// from the nearest chroma row (weight 3/4) and the second nearest one (weight 1/4).
+// At the image borders, the missing chroma samples are replaced by the border sample.
+
+// Chroma rows that contribute to luma row 'y'.
+void get_bilinear_chroma_rows(int y, int chroma_height, int* near_row, int* far_row);
+
+// Computes 'width' upsampled chroma samples from the two chroma rows.
+void upsample_chroma_row_bilinear(const uint8_t* near_row, const uint8_t* far_row,
+                                  uint8_t* out, int width);
+
+void upsample_chroma_row_bilinear(const uint16_t* near_row, const uint16_t* far_row,
+                                  uint16_t* out, int width, int bit_depth);
+
+
+// The SIMD kernels compute the output samples 2*cx+1 and 2*cx+2 for chroma positions cx = 0..num_pairs-1.
+// They return the number of chroma positions that were processed. The remaining positions have to be
+// computed by the caller.
+typedef int (* bilinear_chroma_row_kernel_8bit)(const uint8_t* near_row, const uint8_t* far_row,
+                                               uint8_t* out, int num_pairs);
+
+// Only for bit depths up to 12 bits (the intermediate values have to fit into 16 bits).
+typedef int (* bilinear_chroma_row_kernel_16bit)(const uint16_t* near_row, const uint16_t* far_row,
+                                                uint16_t* out, int num_pairs);
+
+struct Bilinear_chroma_upsampling_kernels
+{
+  bilinear_chroma_row_kernel_8bit upsample_8bit = nullptr;
+  bilinear_chroma_row_kernel_16bit upsample_16bit = nullptr;
+};
+
+// Row kernels for the bilinear chroma upsampling. See cpu_features.h for the dispatch rules.
+const Bilinear_chroma_upsampling_kernels& get_bilinear_chroma_upsampling_kernels();
+
+void select_bilinear_chroma_upsampling_kernels();
+
+#endif
@@ -22,8 +22,13 @@
 #include "colorconversion.h"
 #include "libheif/common_utils.h"
 #include "libheif/nclx.h"
+#include "libheif/thread_pool.h"
+#include "libheif/plane_allocator.h"
+#include "libheif/statistics.h"
 #include <typeinfo>
+#include <cstdlib>
 #include <algorithm>
+#include <list>
 #include <cstring>
 #include <cassert>
 #include <iostream>
@@ -31,14 +36,32 @@
 #include <cmath>
 #include <limits>
 #include <string>
+#include <array>
+#include <chrono>
+#include <map>
+#include <sstream>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
 #include "rgb2yuv.h"
 #include "rgb2yuv_sharp.h"
 #include "yuv2rgb.h"
+#include "yuv2rgb_simd.h"
+#include "rgb2yuv_simd.h"
 #include "rgb2rgb.h"
 #include "monochrome.h"
 #include "alpha.h"
 #include "hdr_sdr.h"
 #include "chroma_sampling.h"
+#include "chroma_sampling_simd.h"
+#include "semi_planar.h"
+#include "rgb_float.h"
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
 
 
 #define DEBUG_ME 0
@@ -102,6 +125,27 @@ std::ostream& operator<<(std::ostream& ostr, heif_chroma c)
     case heif_chroma_interleaved_RRGGBBAA_LE:
       ostr << "RRGGBBBAA_LE";
       break;
+    case heif_chroma_420_NV12:
+      ostr << "NV12";
+      break;
+    case heif_chroma_420_NV21:
+      ostr << "NV21";
+      break;
+    case heif_chroma_420_P010:
+      ostr << "P010";
+      break;
+    case heif_chroma_interleaved_RGB_HALF:
+      ostr << "RGB_HALF";
+      break;
+    case heif_chroma_interleaved_RGBA_HALF:
+      ostr << "RGBA_HALF";
+      break;
+    case heif_chroma_interleaved_RGB_FLOAT:
+      ostr << "RGB_FLOAT";
+      break;
+    case heif_chroma_interleaved_RGBA_FLOAT:
+      ostr << "RGBA_FLOAT";
+      break;
     case heif_chroma_undefined:
       ostr << "undefined";
       break;
@@ -143,7 +187,8 @@ bool ColorState::operator==(const ColorState& b) const
   return (colorspace == b.colorspace &&
           chroma == b.chroma &&
           has_alpha == b.has_alpha &&
-          bits_per_pixel == b.bits_per_pixel);
+          bits_per_pixel == b.bits_per_pixel &&
+          (!has_alpha || premultiplied_alpha == b.premultiplied_alpha));
 }
 
 
@@ -166,313 +211,1545 @@ struct Node
 std::ostream& operator<<(std::ostream& ostr, const ColorState& state) {
   return ostr << "colorspace=" << state.colorspace << " chroma=" << state.chroma
               << " bpp(R)=" << state.bits_per_pixel
-              << " alpha=" << (state.has_alpha ? "yes" : "no")
+              << " alpha=" << (state.has_alpha ? (state.premultiplied_alpha ? "premultiplied" : "yes") : "no")
               << " nclx=" << (state.nclx_profile ? "yes" : "no");
 }
 
-std::vector<ColorConversionOperation*> ColorConversionPipeline::m_operation_pool;
+// All operations exist once and are shared by all pipelines. The operations do not have any state.
+// They are created, and the SIMD kernels for this CPU are selected, when a color conversion is needed
+// for the first time. Applications that only read metadata never initialize the color conversion.
+struct ColorConversionOperations
+{
+  ColorConversionOperations()
+  {
+    select_YCbCr_to_RGB_kernels();
+    select_RGB_to_YCbCr420_kernels();
+    select_bilinear_chroma_upsampling_kernels();
+    select_semi_planar_kernels();
+    select_mono_to_RGB_kernels();
+    select_RGB_float_kernels();
+
+    // The list order is the order in which the pipeline search tries the operations.
+    pool = {
+        &rgb_to_rgb24_32,
+        &rgb24_32_to_rgb,
+        &ycbcr_to_rgb_16bit,
+        &ycbcr_to_rgb_8bit,
+        &ycbcr420_to_rgb24,
+        &ycbcr420_to_rgb32,
+        &ycbcr420_to_rrggbbaa,
+        &ycbcr422_444_to_rgb24,
+        &ycbcr422_444_to_rgb32,
+        &ycbcr422_444_to_rrggbbaa,
+        &ycbcr420_bilinear_to_interleaved_hdr,
+        &ycbcr_hdr_to_rgb24_32_fast,
+        &rgb_hdr_to_rrggbbaa_be,
+        &rgb_to_rrggbbaa_be,
+        &mono_to_interleaved_rgb,
+        &mono_to_ycbcr420,
+        &rrggbbaa_swap_endianness,
+        &rrggbbaa_be_to_rgb_hdr,
+        &rgb24_32_to_ycbcr,
+        &rgb_to_ycbcr_8bit,
+        &rgb_to_ycbcr_16bit,
+        &rrggbbxx_hdr_to_ycbcr420,
+        &rgb24_32_to_ycbcr444_gbr,
+        &drop_alpha_plane,
+        &to_hdr_planes,
+        &to_sdr_planes,
+        &ycbcr420_bilinear_to_ycbcr444_8bit,
+        &ycbcr420_bilinear_to_ycbcr444_16bit,
+        &ycbcr444_to_ycbcr420_average_8bit,
+        &ycbcr444_to_ycbcr420_average_16bit,
+        &any_rgb_to_ycbcr_420_sharp,
+        &ycbcr420_to_semi_planar,
+        &semi_planar_to_ycbcr420,
+        &to_rgb_float,
+        &rgb_float_to_rgb,
+        &premultiply_alpha
+    };
+  }
+
+  Op_RGB_to_RGB24_32 rgb_to_rgb24_32;
+  Op_RGB24_32_to_RGB rgb24_32_to_rgb;
+  Op_YCbCr_to_RGB<uint16_t> ycbcr_to_rgb_16bit;
+  Op_YCbCr_to_RGB<uint8_t> ycbcr_to_rgb_8bit;
+  Op_YCbCr420_to_RGB24 ycbcr420_to_rgb24;
+  Op_YCbCr420_to_RGB32 ycbcr420_to_rgb32;
+  Op_YCbCr420_to_RRGGBBaa ycbcr420_to_rrggbbaa;
+  Op_YCbCr422_444_to_RGB24 ycbcr422_444_to_rgb24;
+  Op_YCbCr422_444_to_RGB32 ycbcr422_444_to_rgb32;
+  Op_YCbCr422_444_to_RRGGBBaa ycbcr422_444_to_rrggbbaa;
+  Op_YCbCr420_bilinear_to_interleaved_HDR ycbcr420_bilinear_to_interleaved_hdr;
+  Op_YCbCr_HDR_to_RGB24_32_fast ycbcr_hdr_to_rgb24_32_fast;
+  Op_RGB_HDR_to_RRGGBBaa_BE rgb_hdr_to_rrggbbaa_be;
+  Op_RGB_to_RRGGBBaa_BE rgb_to_rrggbbaa_be;
+  Op_mono_to_interleaved_RGB mono_to_interleaved_rgb;
+  Op_mono_to_YCbCr420 mono_to_ycbcr420;
+  Op_RRGGBBaa_swap_endianness rrggbbaa_swap_endianness;
+  Op_RRGGBBaa_BE_to_RGB_HDR rrggbbaa_be_to_rgb_hdr;
+  Op_RGB24_32_to_YCbCr rgb24_32_to_ycbcr;
+  Op_RGB_to_YCbCr<uint8_t> rgb_to_ycbcr_8bit;
+  Op_RGB_to_YCbCr<uint16_t> rgb_to_ycbcr_16bit;
+  Op_RRGGBBxx_HDR_to_YCbCr420 rrggbbxx_hdr_to_ycbcr420;
+  Op_RGB24_32_to_YCbCr444_GBR rgb24_32_to_ycbcr444_gbr;
+  Op_drop_alpha_plane drop_alpha_plane;
+  Op_to_hdr_planes to_hdr_planes;
+  Op_to_sdr_planes to_sdr_planes;
+  Op_YCbCr420_bilinear_to_YCbCr444<uint8_t> ycbcr420_bilinear_to_ycbcr444_8bit;
+  Op_YCbCr420_bilinear_to_YCbCr444<uint16_t> ycbcr420_bilinear_to_ycbcr444_16bit;
+  Op_YCbCr444_to_YCbCr420_average<uint8_t> ycbcr444_to_ycbcr420_average_8bit;
+  Op_YCbCr444_to_YCbCr420_average<uint16_t> ycbcr444_to_ycbcr420_average_16bit;
+  Op_Any_RGB_to_YCbCr_420_Sharp any_rgb_to_ycbcr_420_sharp;
+  Op_YCbCr420_to_semi_planar ycbcr420_to_semi_planar;
+  Op_semi_planar_to_YCbCr420 semi_planar_to_ycbcr420;
+  Op_to_RGB_float to_rgb_float;
+  Op_RGB_float_to_RGB rgb_float_to_rgb;
+  Op_premultiply_alpha premultiply_alpha;
+
+  // not part of 'pool', see find_tone_mapping_pipeline()
+  Op_HDR_to_SDR_tone_mapping tone_mapping;
+
+  std::vector<const ColorConversionOperation*> pool;
+};
+
+
+static const ColorConversionOperations& get_color_conversion_operations()
+{
+  // thread-safe initialization on first use
+  static const ColorConversionOperations operations;
+  return operations;
+}
+
+
+const std::vector<const ColorConversionOperation*>& ColorConversionPipeline::get_operations()
+{
+  return get_color_conversion_operations().pool;
+}
 
 
 void ColorConversionPipeline::init_ops()
 {
-  if (!m_operation_pool.empty()) {
-    return;
+  get_color_conversion_operations();
+}
+
+
+void ColorConversionPipeline::release_ops()
+{
+  // The operations are static and released at program exit, but cached pipelines can be freed now.
+  clear_pipeline_cache();
+}
+
+
+// With heif_color_conversion_accuracy_fast, nearest-neighbor chroma sampling replaces the preferred
+// algorithms, unless the application insists on them.
+static heif_color_conversion_options get_effective_options(const heif_color_conversion_options& options)
+{
+  heif_color_conversion_options effective_options = options;
+
+  if (options.conversion_accuracy == heif_color_conversion_accuracy_fast &&
+      !options.only_use_preferred_chroma_algorithm) {
+    effective_options.preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_nearest_neighbor;
+    effective_options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_nearest_neighbor;
   }
 
-  std::vector<ColorConversionOperation*>& ops = m_operation_pool;
-  ops.push_back(new Op_RGB_to_RGB24_32());
-  ops.push_back(new Op_RGB24_32_to_RGB());
-  ops.push_back(new Op_YCbCr_to_RGB<uint16_t>());
-  ops.push_back(new Op_YCbCr_to_RGB<uint8_t>());
-  ops.push_back(new Op_YCbCr420_to_RGB24());
-  ops.push_back(new Op_YCbCr420_to_RGB32());
-  ops.push_back(new Op_YCbCr420_to_RRGGBBaa());
-  ops.push_back(new Op_RGB_HDR_to_RRGGBBaa_BE());
-  ops.push_back(new Op_RGB_to_RRGGBBaa_BE());
-  ops.push_back(new Op_mono_to_YCbCr420());
-  ops.push_back(new Op_mono_to_RGB24_32());
-  ops.push_back(new Op_RRGGBBaa_swap_endianness());
-  ops.push_back(new Op_RRGGBBaa_BE_to_RGB_HDR());
-  ops.push_back(new Op_RGB24_32_to_YCbCr());
-  ops.push_back(new Op_RGB_to_YCbCr<uint8_t>());
-  ops.push_back(new Op_RGB_to_YCbCr<uint16_t>());
-  ops.push_back(new Op_RRGGBBxx_HDR_to_YCbCr420());
-  ops.push_back(new Op_RGB24_32_to_YCbCr444_GBR());
-  ops.push_back(new Op_drop_alpha_plane());
-  ops.push_back(new Op_to_hdr_planes());
-  ops.push_back(new Op_to_sdr_planes());
-  ops.push_back(new Op_YCbCr420_bilinear_to_YCbCr444<uint8_t>());
-  ops.push_back(new Op_YCbCr420_bilinear_to_YCbCr444<uint16_t>());
-  ops.push_back(new Op_YCbCr444_to_YCbCr420_average<uint8_t>());
-  ops.push_back(new Op_YCbCr444_to_YCbCr420_average<uint16_t>());
-  ops.push_back(new Op_Any_RGB_to_YCbCr_420_Sharp());
+  return effective_options;
 }
 
 
-void ColorConversionPipeline::release_ops()
+// --- cache of constructed pipelines
+
+// The pipeline search depends on the nclx parameters (e.g. some operations only support some
+// matrix coefficients). Profiles are compared by content because each image has its own profile object.
+static bool nclx_profiles_equal(const std::shared_ptr<const color_profile_nclx>& a,
+                                const std::shared_ptr<const color_profile_nclx>& b)
 {
-  for (auto& op : m_operation_pool) {
-    delete op;
+  if (!a || !b) {
+    return a == b;
   }
 
-  m_operation_pool.clear();
+  return (a->get_colour_primaries() == b->get_colour_primaries() &&
+          a->get_transfer_characteristics() == b->get_transfer_characteristics() &&
+          a->get_matrix_coefficients() == b->get_matrix_coefficients() &&
+          a->get_full_range_flag() == b->get_full_range_flag());
 }
 
 
-bool ColorConversionPipeline::construct_pipeline(const ColorState& input_state,
-                                                 const ColorState& target_state,
-                                                 const heif_color_conversion_options& options)
+struct CachedPipeline
 {
-  m_conversion_steps.clear();
+  ColorState input_state;
+  ColorState target_state;
+  heif_color_conversion_options options;
 
-  m_options = options;
+  std::vector<ColorConversionPipeline::ConversionStep> steps;
+  bool success;
 
-  if (input_state == target_state) {
-    return true;
+  bool matches(const ColorState& input, const ColorState& target, const heif_color_conversion_options& opts) const
+  {
+    return (input_state == input &&
+            target_state == target &&
+            nclx_profiles_equal(input_state.nclx_profile, input.nclx_profile) &&
+            nclx_profiles_equal(target_state.nclx_profile, target.nclx_profile) &&
+            options.preferred_chroma_downsampling_algorithm == opts.preferred_chroma_downsampling_algorithm &&
+            options.preferred_chroma_upsampling_algorithm == opts.preferred_chroma_upsampling_algorithm &&
+            options.only_use_preferred_chroma_algorithm == opts.only_use_preferred_chroma_algorithm &&
+            options.conversion_accuracy == opts.conversion_accuracy);
   }
+};
 
-#if DEBUG_ME
-  std::cerr << "--- construct_pipeline\n";
-  std::cerr << "from: " << input_state << "\nto: " << target_state << "\n";
-#endif
 
-  init_ops(); // to be sure these are initialized even without heif_init()
+// Most applications only use a few different conversions. The most recently used pipeline is at the front.
+static const size_t kMaxCachedPipelines = 64;
 
-  std::vector<ColorConversionOperation*>& ops = m_operation_pool;
+static std::list<CachedPipeline> s_pipeline_cache;
 
-  // --- Dijkstra search for the minimum-cost conversion pipeline
+#if ENABLE_MULTITHREADING_SUPPORT
+static std::mutex s_pipeline_cache_mutex;
+#endif
 
-  std::vector<Node> processed_states;
-  std::vector<Node> border_states;
-  border_states.push_back({-1, nullptr, {input_state, 0}});
 
-  while (!border_states.empty()) {
-    int minIdx = -1;
-    int minCost = std::numeric_limits<int>::max();
-    for (int i = 0; i < (int)border_states.size(); i++) {
-      int cost = border_states[i].color_state.speed_costs;
-      if (cost < minCost) {
-        minIdx = i;
-        minCost = cost;
-      }
+bool ColorConversionPipeline::lookup_cached_pipeline(const ColorState& input_state,
+                                                     const ColorState& target_state,
+                                                     const heif_color_conversion_options& options,
+                                                     std::vector<ConversionStep>& out_steps,
+                                                     bool& out_success)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(s_pipeline_cache_mutex);
+#endif
+
+  for (auto iter = s_pipeline_cache.begin(); iter != s_pipeline_cache.end(); ++iter) {
+    if (iter->matches(input_state, target_state, options)) {
+      statistics::add(statistics::conversion_pipeline_cache_hits);
+      s_pipeline_cache.splice(s_pipeline_cache.begin(), s_pipeline_cache, iter);
+
+      out_steps = s_pipeline_cache.front().steps;
+      out_success = s_pipeline_cache.front().success;
+      return true;
     }
+  }
 
-    assert(minIdx >= 0);
+  statistics::add(statistics::conversion_pipeline_cache_misses);
+  return false;
+}
 
 
-    // move minimum-cost border_state into processed_states
+void ColorConversionPipeline::store_pipeline_in_cache(const ColorState& input_state,
+                                                      const ColorState& target_state,
+                                                      const heif_color_conversion_options& options,
+                                                      const std::vector<ConversionStep>& steps,
+                                                      bool success)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(s_pipeline_cache_mutex);
+#endif
 
-    processed_states.push_back(border_states[minIdx]);
+  s_pipeline_cache.push_front({input_state, target_state, options, steps, success});
 
-    border_states[minIdx] = border_states.back();
-    border_states.pop_back();
+  if (s_pipeline_cache.size() > kMaxCachedPipelines) {
+    s_pipeline_cache.pop_back();
+  }
+}
 
-#if DEBUG_PIPELINE_CREATION
-    std::cerr << "- expand node: " << processed_states.back().color_state.color_state
-        << " with cost " << processed_states.back().color_state.speed_costs << " \n";
+
+void ColorConversionPipeline::clear_pipeline_cache()
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(s_pipeline_cache_mutex);
 #endif
 
-    if (processed_states.back().color_state.color_state == target_state) {
-      // end-state found, backtrack path to find conversion pipeline
+  s_pipeline_cache.clear();
+}
 
-      size_t idx = processed_states.size() - 1;
-      int len = 0;
-      while (idx > 0) {
-        idx = processed_states[idx].prev_processed_idx;
-        len++;
-      }
 
-      m_conversion_steps.resize(len);
+// --- calibrated speed costs
 
-      idx = processed_states.size() - 1;
-      int step = 0;
-      while (idx > 0) {
-        m_conversion_steps[len - 1 - step].operation = processed_states[idx].op;
-        m_conversion_steps[len - 1 - step].output_state = processed_states[idx].color_state.color_state;
+// The fixed SpeedCosts do not reflect whether an operation has a SIMD kernel on this CPU.
+// The calibration measures each transition (operation, input state, output state) and stores
+// the measured cost together with the fixed cost that the operation reported at that time.
+// The pipeline search adds the difference to the reported cost. Costs that operations add
+// depending on the options (e.g. for a non-preferred chroma algorithm) are thus preserved.
 
-        //printf("cost: %f\n",processed_states[idx].color_state.costs.total(options.criterion));
-        idx = processed_states[idx].prev_processed_idx;
-        step++;
-      }
+namespace {
 
-      assert(m_conversion_steps.back().output_state == target_state);
+struct SpeedCostKey
+{
+  // Operations are identified by their type name so that a stored profile can be matched
+  // against the operations of the running library.
+  std::string op_name;
 
-#if DEBUG_ME
-      std::cerr << debug_dump_pipeline();
-#endif
+  // colorspace, chroma, alpha, bit depth of the input and output states
+  std::array<int, 8> states;
 
-      return true;
-    }
+  bool operator<(const SpeedCostKey& b) const
+  {
+    return op_name < b.op_name || (op_name == b.op_name && states < b.states);
+  }
+};
 
+struct CalibratedCost
+{
+  int measured;
+  int fixed;
+};
 
-    // expand the node with minimum cost
+}
 
-    for (const auto& op_ptr : ops) {
 
-#if DEBUG_PIPELINE_CREATION
-      auto& op = *op_ptr;
-      std::cerr << "-- apply op: " << typeid(op).name() << "\n";
-#endif
+static SpeedCostKey make_speed_cost_key(const ColorConversionOperation* op, const ColorState& in, const ColorState& out)
+{
+  return {typeid(*op).name(),
+          {{in.colorspace, in.chroma, in.has_alpha, in.bits_per_pixel,
+            out.colorspace, out.chroma, out.has_alpha, out.bits_per_pixel}}};
+}
 
-      auto out_states = op_ptr->state_after_conversion(processed_states.back().color_state.color_state,
-                                                       target_state,
-                                                       options);
-      for (const auto& out_state : out_states) {
-        int new_op_costs = out_state.speed_costs + processed_states.back().color_state.speed_costs;
-#if DEBUG_PIPELINE_CREATION
-        std::cerr << "--- " << out_state.color_state << " with cost " << new_op_costs << "\n";
-#endif
 
-        bool state_exists = false;
-        for (const auto& s : processed_states) {
-          if (s.color_state.color_state == out_state.color_state) {
-            state_exists = true;
-            break;
-          }
-        }
+static std::map<SpeedCostKey, CalibratedCost> s_calibrated_costs;
 
-        if (!state_exists) {
-          for (auto& s : border_states) {
-            if (s.color_state.color_state == out_state.color_state) {
-              state_exists = true;
+#if ENABLE_MULTITHREADING_SUPPORT
+static std::mutex s_calibrated_costs_mutex;
+#endif
 
-              // if we reached the same border node with a lower cost, replace the border node
 
-              if (s.color_state.speed_costs > new_op_costs) {
-                s = {(int) (processed_states.size() - 1),
-                     op_ptr,
-                     out_state};
+// s_calibrated_costs_mutex has to be held by the caller.
+static int get_calibrated_speed_costs(const ColorConversionOperation* op, const ColorState& in,
+                                      const ColorStateWithCost& out)
+{
+  if (s_calibrated_costs.empty()) {
+    return out.speed_costs;
+  }
 
-                s.color_state.speed_costs = new_op_costs;
-              }
-              break;
-            }
-          }
-        }
+  auto iter = s_calibrated_costs.find(make_speed_cost_key(op, in, out.color_state));
+  if (iter == s_calibrated_costs.end()) {
+    return out.speed_costs;
+  }
 
+  return std::max(1, out.speed_costs + iter->second.measured - iter->second.fixed);
+}
 
-        // enter the new output state into the list of border states
 
-        if (!state_exists) {
-          ColorStateWithCost s = out_state;
-          s.speed_costs = s.speed_costs + processed_states.back().color_state.speed_costs;
+// The input and target states of the calibration. These cover the formats of decoded images
+// and of the usual output formats, and thus most of the intermediate states of the pipelines.
+std::vector<ColorState> ColorConversionPipeline::get_calibration_states()
+{
+  std::vector<ColorState> states;
 
-          border_states.push_back({(int) (processed_states.size() - 1), op_ptr, s});
-        }
+  for (int bpp : {8, 10}) {
+    for (bool alpha : {false, true}) {
+      for (heif_chroma chroma : {heif_chroma_420, heif_chroma_422, heif_chroma_444}) {
+        states.emplace_back(heif_colorspace_YCbCr, chroma, alpha, bpp);
       }
+
+      states.emplace_back(heif_colorspace_RGB, heif_chroma_444, alpha, bpp);
+      states.emplace_back(heif_colorspace_monochrome, heif_chroma_monochrome, alpha, bpp);
     }
   }
 
-  return false;
+  states.emplace_back(heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8);
+  states.emplace_back(heif_colorspace_RGB, heif_chroma_interleaved_RGBA, true, 8);
+
+  for (heif_chroma chroma : {heif_chroma_interleaved_RRGGBB_BE, heif_chroma_interleaved_RRGGBB_LE,
+                             heif_chroma_interleaved_RRGGBBAA_BE, heif_chroma_interleaved_RRGGBBAA_LE}) {
+    states.emplace_back(heif_colorspace_RGB, chroma, is_chroma_with_alpha(chroma), 10);
+  }
+
+  states.emplace_back(heif_colorspace_YCbCr, heif_chroma_420_NV12, false, 8);
+  states.emplace_back(heif_colorspace_YCbCr, heif_chroma_420_NV21, false, 8);
+  states.emplace_back(heif_colorspace_YCbCr, heif_chroma_420_P010, false, 10);
+
+  states.emplace_back(heif_colorspace_RGB, heif_chroma_interleaved_RGB_HALF, false, 16);
+  states.emplace_back(heif_colorspace_RGB, heif_chroma_interleaved_RGBA_HALF, true, 16);
+  states.emplace_back(heif_colorspace_RGB, heif_chroma_interleaved_RGB_FLOAT, false, 32);
+  states.emplace_back(heif_colorspace_RGB, heif_chroma_interleaved_RGBA_FLOAT, true, 32);
+
+  auto nclx = std::make_shared<color_profile_nclx>();
+  for (auto& state : states) {
+    state.nclx_profile = nclx;
+  }
+
+  return states;
 }
 
 
-std::string ColorConversionPipeline::debug_dump_pipeline() const
+// Some operations also report states that no image can have (e.g. YCbCr with interleaved chroma or
+// RRGGBB with 8 bits) when the target state is one of these. The search never reaches them, because
+// they are no valid targets, but they cannot be converted either.
+bool ColorConversionPipeline::is_valid_image_state(const ColorState& state)
 {
-  std::ostringstream ostr;
-  ostr << "final pipeline has " << m_conversion_steps.size() << " steps:\n";
-  for (const auto& step : m_conversion_steps) {
-    auto& op = *step.operation;
-    ostr << "> " << typeid(op).name() << "\n";
+  switch (state.chroma) {
+    case heif_chroma_420:
+    case heif_chroma_422:
+      return state.colorspace == heif_colorspace_YCbCr;
+    case heif_chroma_444:
+      return state.colorspace == heif_colorspace_YCbCr || state.colorspace == heif_colorspace_RGB;
+    case heif_chroma_monochrome:
+      return state.colorspace == heif_colorspace_monochrome;
+    case heif_chroma_interleaved_RGB:
+    case heif_chroma_interleaved_RGBA:
+      return state.colorspace == heif_colorspace_RGB && state.bits_per_pixel == 8;
+    case heif_chroma_interleaved_RRGGBB_BE:
+    case heif_chroma_interleaved_RRGGBB_LE:
+    case heif_chroma_interleaved_RRGGBBAA_BE:
+    case heif_chroma_interleaved_RRGGBBAA_LE:
+      return state.colorspace == heif_colorspace_RGB && state.bits_per_pixel > 8;
+    case heif_chroma_420_NV12:
+    case heif_chroma_420_NV21:
+      return state.colorspace == heif_colorspace_YCbCr && state.bits_per_pixel == 8 && !state.has_alpha;
+    case heif_chroma_420_P010:
+      return state.colorspace == heif_colorspace_YCbCr && state.bits_per_pixel > 8 && !state.has_alpha;
+    case heif_chroma_interleaved_RGB_HALF:
+    case heif_chroma_interleaved_RGBA_HALF:
+      return state.colorspace == heif_colorspace_RGB && state.bits_per_pixel == 16;
+    case heif_chroma_interleaved_RGB_FLOAT:
+    case heif_chroma_interleaved_RGBA_FLOAT:
+      return state.colorspace == heif_colorspace_RGB && state.bits_per_pixel == 32;
+    default:
+      return false;
   }
-  return ostr.str();
 }
 
 
-std::shared_ptr<HeifPixelImage> ColorConversionPipeline::convert_image(const std::shared_ptr<HeifPixelImage>& input)
+std::shared_ptr<HeifPixelImage> ColorConversionPipeline::create_calibration_image(int width, int height, const ColorState& state)
 {
-  std::shared_ptr<HeifPixelImage> in = input;
-  std::shared_ptr<HeifPixelImage> out = in;
+  auto img = std::make_shared<HeifPixelImage>();
+  img->create(width, height, state.colorspace, state.chroma);
 
-  for (const auto& step : m_conversion_steps) {
+  for (const auto& layout : get_image_plane_layout(width, height, state)) {
+    if (!img->add_plane(layout.channel, layout.width, layout.height, layout.bit_depth)) {
+      return nullptr;
+    }
 
-#if DEBUG_ME
-    std::cerr << "input spec: ";
-    print_spec(std::cerr, in);
-#endif
+    size_t stride;
+    uint8_t* p = img->get_plane(layout.channel, &stride);
 
-    out = step.operation->convert_colorspace(in, step.output_state, m_options);
-    if (!out) {
-      return nullptr; // TODO: we should return a proper error
-    }
+    int bytes_per_row = layout.width * (img->get_storage_bits_per_pixel(layout.channel) / 8);
+    bool big_endian = (state.chroma == heif_chroma_interleaved_RRGGBB_BE ||
+                       state.chroma == heif_chroma_interleaved_RRGGBBAA_BE);
+    uint16_t max_value = (uint16_t) ((1 << std::min(layout.bit_depth, 16)) - 1);
 
-    // --- pass the color profiles to the new image
+    for (int y = 0; y < layout.height; y++) {
+      uint8_t* row = p + y * stride;
 
-    out->set_color_profile_nclx(step.output_state.nclx_profile);
-    out->set_color_profile_icc(in->get_color_profile_icc());
+      if (is_float_chroma(state.chroma)) {
+        bool half = (layout.bit_depth == 16);
+        for (int x = 0; x < bytes_per_row / (half ? 2 : 4); x++) {
+          float v = static_cast<float>((x * 29 + y * 11) & 0xFF) / 255.0f;
 
-    out->set_premultiplied_alpha(in->is_premultiplied_alpha());
+          if (half) {
+            ((uint16_t*) row)[x] = float_to_half(v);
+          }
+          else {
+            ((float*) row)[x] = v;
+          }
+        }
+      }
+      else if (layout.bit_depth <= 8) {
+        for (int x = 0; x < bytes_per_row; x++) {
+          row[x] = (uint8_t) ((x * 7 + y * 3) & 0xFF);
+        }
+      }
+      else {
+        for (int x = 0; x < bytes_per_row / 2; x++) {
+          uint16_t v = (uint16_t) ((x * 29 + y * 11) & max_value);
 
-    // pass through HDR information
-    if (in->has_clli()) {
-      out->set_clli(in->get_clli());
+          if (num_interleaved_pixels_per_plane(state.chroma, layout.channel) == 1 ||
+              state.chroma == heif_chroma_420_P010) {
+            ((uint16_t*) row)[x] = v;
+          }
+          else {
+            row[2 * x + (big_endian ? 0 : 1)] = (uint8_t) (v >> 8);
+            row[2 * x + (big_endian ? 1 : 0)] = (uint8_t) (v & 0xFF);
+          }
+        }
+      }
     }
+  }
 
-    if (in->has_mdcv()) {
-      out->set_mdcv(in->get_mdcv());
-    }
+  img->set_color_profile_nclx(state.nclx_profile);
+
+  return img;
+}
 
-    if (in->has_nonsquare_pixel_ratio()) {
-      uint32_t h, v;
-      in->get_pixel_ratio(&h, &v);
-      out->set_pixel_ratio(h, v);
-    }
 
-    const auto& warnings = in->get_warnings();
-    for (const auto& warning : warnings) {
-      out->add_warning(warning);
+void ColorConversionPipeline::calibrate_speed_costs()
+{
+  // Large enough to measure the row loops, but small enough to stay in the cache.
+  const int block_width = 256;
+  const int block_height = 64;
+  const int repetitions = 3;
+
+  heif_color_conversion_options options{};
+  options.version = 1;
+  options.preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average;
+  options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear;
+  options.only_use_preferred_chroma_algorithm = false;
+  options.conversion_accuracy = heif_color_conversion_accuracy_precise;
+
+  // some operations are only offered for the fast conversion
+  heif_color_conversion_options fast_options = options;
+  fast_options.conversion_accuracy = heif_color_conversion_accuracy_fast;
+  fast_options = get_effective_options(fast_options);
+
+  std::vector<ColorState> states = get_calibration_states();
+
+  struct Measurement
+  {
+    SpeedCostKey key;
+    int fixed;
+    double seconds;
+  };
+
+  std::vector<Measurement> measurements;
+  std::set<SpeedCostKey> measured_keys;
+
+  for (const auto& input_state : states) {
+    auto input = create_calibration_image(block_width, block_height, input_state);
+    if (!input) {
+      continue;
     }
 
-    in = out;
-  }
+    for (const auto* op_options : {&options, &fast_options}) {
+      for (const auto* op : get_operations()) {
+        for (const auto& target_state : states) {
+          for (auto out_state : op->state_after_conversion(input_state, target_state, *op_options)) {
+            // The pipeline search never applies these (e.g. a bit depth change to the same bit depth).
+            if (out_state.color_state == input_state || !is_valid_image_state(out_state.color_state)) {
+              continue;
+            }
 
-  return out;
-}
+            SpeedCostKey key = make_speed_cost_key(op, input_state, out_state.color_state);
+            if (!measured_keys.insert(key).second) {
+              continue;
+            }
 
+            // Some operations take the output nclx parameters from the target state.
+            out_state.color_state.nclx_profile = target_state.nclx_profile;
 
-std::shared_ptr<HeifPixelImage> convert_colorspace(const std::shared_ptr<HeifPixelImage>& input,
-                                                   heif_colorspace target_colorspace,
-                                                   heif_chroma target_chroma,
-                                                   const std::shared_ptr<const color_profile_nclx>& target_profile,
-                                                   int output_bpp,
-                                                   const heif_color_conversion_options& options)
-{
-  // --- check that input image is valid
+            double best = std::numeric_limits<double>::max();
+            for (int i = 0; i < repetitions; i++) {
+              auto start = std::chrono::steady_clock::now();
+              auto output = op->convert_colorspace(input, out_state.color_state, *op_options);
+              auto end = std::chrono::steady_clock::now();
 
-  int width = input->get_width();
-  int height = input->get_height();
+              if (!output) {
+                best = 0;
+                break;
+              }
 
-  // alpha image should have full image resolution
+              best = std::min(best, std::chrono::duration<double>(end - start).count());
+            }
 
-  if (input->has_channel(heif_channel_Alpha)) {
-    if (input->get_width(heif_channel_Alpha) != width ||
-        input->get_height(heif_channel_Alpha) != height) {
-      return nullptr;
+            if (best > 0) {
+              measurements.push_back({key, out_state.speed_costs, best});
+            }
+          }
+        }
+      }
     }
   }
 
-  // check for valid target YCbCr chroma formats
+  if (measurements.empty()) {
+    return;
+  }
 
-  if (target_colorspace == heif_colorspace_YCbCr) {
-    if (target_chroma != heif_chroma_420 &&
-        target_chroma != heif_chroma_422 &&
-        target_chroma != heif_chroma_444) {
-      return nullptr;
-    }
+  // Scale the measured times such that they are on average (geometric mean) equal to the fixed costs.
+  // The costs of transitions that were not measured are then still comparable.
+  double log_scale = 0;
+  for (const auto& m : measurements) {
+    log_scale += std::log((double) m.fixed) - std::log(m.seconds);
   }
+  log_scale /= (double) measurements.size();
 
-  // --- prepare conversion
+  std::map<SpeedCostKey, CalibratedCost> costs;
+  for (const auto& m : measurements) {
+    int measured = (int) std::lround(m.seconds * std::exp(log_scale));
+    costs[m.key] = {std::max(1, measured), m.fixed};
+  }
+
+  {
+#if ENABLE_MULTITHREADING_SUPPORT
+    std::lock_guard<std::mutex> lock(s_calibrated_costs_mutex);
+#endif
+    s_calibrated_costs = std::move(costs);
+  }
+
+  clear_pipeline_cache();
+}
+
+
+static const char* const kSpeedCostProfileHeader = "libheif-color-conversion-costs-1";
+
+
+std::string ColorConversionPipeline::get_speed_cost_profile()
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(s_calibrated_costs_mutex);
+#endif
+
+  if (s_calibrated_costs.empty()) {
+    return {};
+  }
+
+  std::stringstream sstr;
+  sstr << kSpeedCostProfileHeader << "\n";
+
+  for (const auto& entry : s_calibrated_costs) {
+    for (int v : entry.first.states) {
+      sstr << v << " ";
+    }
+
+    // The type name is last because it may contain spaces.
+    sstr << entry.second.measured << " " << entry.second.fixed << " " << entry.first.op_name << "\n";
+  }
+
+  return sstr.str();
+}
+
+
+Error ColorConversionPipeline::load_speed_cost_profile(const std::string& profile)
+{
+  std::set<std::string> op_names;
+  for (const auto* op : get_operations()) {
+    op_names.insert(typeid(*op).name());
+  }
+
+  std::stringstream sstr(profile);
+  std::string line;
+
+  if (!std::getline(sstr, line) || line != kSpeedCostProfileHeader) {
+    return {heif_error_Usage_error,
+            heif_suberror_Unspecified,
+            "Unsupported color conversion cost profile"};
+  }
+
+  std::map<SpeedCostKey, CalibratedCost> costs;
+
+  while (std::getline(sstr, line)) {
+    if (line.empty()) {
+      continue;
+    }
+
+    std::stringstream line_stream(line);
+    SpeedCostKey key;
+    CalibratedCost cost;
+
+    for (int& v : key.states) {
+      line_stream >> v;
+    }
+    line_stream >> cost.measured >> cost.fixed;
+    std::getline(line_stream >> std::ws, key.op_name);
+
+    if (line_stream.fail() || cost.measured < 1 || cost.fixed < 1) {
+      return {heif_error_Usage_error,
+              heif_suberror_Unspecified,
+              "Invalid entry in color conversion cost profile"};
+    }
+
+    if (op_names.find(key.op_name) != op_names.end()) {
+      costs[key] = cost;
+    }
+  }
+
+  {
+#if ENABLE_MULTITHREADING_SUPPORT
+    std::lock_guard<std::mutex> lock(s_calibrated_costs_mutex);
+#endif
+    s_calibrated_costs = std::move(costs);
+  }
+
+  clear_pipeline_cache();
+
+  return Error::Ok;
+}
+
+
+void ColorConversionPipeline::reset_speed_costs()
+{
+  {
+#if ENABLE_MULTITHREADING_SUPPORT
+    std::lock_guard<std::mutex> lock(s_calibrated_costs_mutex);
+#endif
+    s_calibrated_costs.clear();
+  }
+
+  clear_pipeline_cache();
+}
+
+
+bool ColorConversionPipeline::construct_pipeline(const ColorState& input_state,
+                                                 const ColorState& target_state,
+                                                 const heif_color_conversion_options& requested_options)
+{
+  const heif_color_conversion_options options = get_effective_options(requested_options);
+
+  m_conversion_steps.clear();
+  m_step_statistics.clear();
+
+  m_input_state = input_state;
+  m_options = options;
+
+  if (input_state == target_state) {
+    return true;
+  }
+
+#if DEBUG_ME
+  std::cerr << "--- construct_pipeline\n";
+  std::cerr << "from: " << input_state << "\nto: " << target_state << "\n";
+#endif
+
+  bool success;
+  if (lookup_cached_pipeline(input_state, target_state, options, m_conversion_steps, success)) {
+    return success;
+  }
+
+  success = false;
+  if (Op_HDR_to_SDR_tone_mapping::requires_tone_mapping(input_state, target_state)) {
+    success = find_tone_mapping_pipeline(input_state, target_state, options);
+  }
+
+  // Without tone mapping (e.g. if there is no conversion to planar RGB), the bit depth is only reduced.
+  if (!success) {
+    success = find_pipeline(input_state, target_state, options);
+  }
+
+  store_pipeline_in_cache(input_state, target_state, options, m_conversion_steps, success);
+
+  return success;
+}
+
+
+bool ColorConversionPipeline::find_pipeline(const ColorState& input_state,
+                                            const ColorState& target_state,
+                                            const heif_color_conversion_options& options)
+{
+  const std::vector<const ColorConversionOperation*>& ops = get_operations();
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(s_calibrated_costs_mutex);
+#endif
+
+  // --- Dijkstra search for the minimum-cost conversion pipeline
+
+  std::vector<Node> processed_states;
+  std::vector<Node> border_states;
+  border_states.push_back({-1, nullptr, {input_state, 0}});
+
+  while (!border_states.empty()) {
+    int minIdx = -1;
+    int minCost = std::numeric_limits<int>::max();
+    for (int i = 0; i < (int)border_states.size(); i++) {
+      int cost = border_states[i].color_state.speed_costs;
+      if (cost < minCost) {
+        minIdx = i;
+        minCost = cost;
+      }
+    }
+
+    assert(minIdx >= 0);
+
+
+    // move minimum-cost border_state into processed_states
+
+    processed_states.push_back(border_states[minIdx]);
+
+    border_states[minIdx] = border_states.back();
+    border_states.pop_back();
+
+#if DEBUG_PIPELINE_CREATION
+    std::cerr << "- expand node: " << processed_states.back().color_state.color_state
+        << " with cost " << processed_states.back().color_state.speed_costs << " \n";
+#endif
+
+    if (processed_states.back().color_state.color_state == target_state) {
+      // end-state found, backtrack path to find conversion pipeline
+
+      size_t idx = processed_states.size() - 1;
+      int len = 0;
+      while (idx > 0) {
+        idx = processed_states[idx].prev_processed_idx;
+        len++;
+      }
+
+      m_conversion_steps.resize(len);
+
+      idx = processed_states.size() - 1;
+      int step = 0;
+      while (idx > 0) {
+        const Node& prev = processed_states[processed_states[idx].prev_processed_idx];
+
+        m_conversion_steps[len - 1 - step].operation = processed_states[idx].op;
+        m_conversion_steps[len - 1 - step].output_state = processed_states[idx].color_state.color_state;
+        m_conversion_steps[len - 1 - step].speed_costs = (processed_states[idx].color_state.speed_costs -
+                                                          prev.color_state.speed_costs);
+
+        //printf("cost: %f\n",processed_states[idx].color_state.costs.total(options.criterion));
+        idx = processed_states[idx].prev_processed_idx;
+        step++;
+      }
+
+      assert(m_conversion_steps.back().output_state == target_state);
+
+#if DEBUG_ME
+      std::cerr << debug_dump_pipeline();
+#endif
+
+      return true;
+    }
+
+
+    // expand the node with minimum cost
+
+    for (const auto& op_ptr : ops) {
+
+#if DEBUG_PIPELINE_CREATION
+      auto& op = *op_ptr;
+      std::cerr << "-- apply op: " << typeid(op).name() << "\n";
+#endif
+
+      auto out_states = op_ptr->state_after_conversion(processed_states.back().color_state.color_state,
+                                                       target_state,
+                                                       options);
+      for (auto out_state : out_states) {
+        if (!op_ptr->handles_alpha_premultiplication()) {
+          out_state.color_state.premultiplied_alpha = processed_states.back().color_state.color_state.premultiplied_alpha;
+        }
+
+        out_state.color_state.premultiplied_alpha &= out_state.color_state.has_alpha;
+
+        out_state.speed_costs = get_calibrated_speed_costs(op_ptr, processed_states.back().color_state.color_state, out_state);
+
+        int new_op_costs = out_state.speed_costs + processed_states.back().color_state.speed_costs;
+#if DEBUG_PIPELINE_CREATION
+        std::cerr << "--- " << out_state.color_state << " with cost " << new_op_costs << "\n";
+#endif
+
+        bool state_exists = false;
+        for (const auto& s : processed_states) {
+          if (s.color_state.color_state == out_state.color_state) {
+            state_exists = true;
+            break;
+          }
+        }
+
+        if (!state_exists) {
+          for (auto& s : border_states) {
+            if (s.color_state.color_state == out_state.color_state) {
+              state_exists = true;
+
+              // if we reached the same border node with a lower cost, replace the border node
+
+              if (s.color_state.speed_costs > new_op_costs) {
+                s = {(int) (processed_states.size() - 1),
+                     op_ptr,
+                     out_state};
+
+                s.color_state.speed_costs = new_op_costs;
+              }
+              break;
+            }
+          }
+        }
+
+
+        // enter the new output state into the list of border states
+
+        if (!state_exists) {
+          ColorStateWithCost s = out_state;
+          s.speed_costs = s.speed_costs + processed_states.back().color_state.speed_costs;
+
+          border_states.push_back({(int) (processed_states.size() - 1), op_ptr, s});
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+
+bool ColorConversionPipeline::find_tone_mapping_pipeline(const ColorState& input_state,
+                                                         const ColorState& target_state,
+                                                         const heif_color_conversion_options& options)
+{
+  ColorState hdr_rgb(heif_colorspace_RGB, heif_chroma_444, input_state.has_alpha, input_state.bits_per_pixel);
+  hdr_rgb.premultiplied_alpha = input_state.premultiplied_alpha;
+  hdr_rgb.nclx_profile = input_state.nclx_profile;
+
+  ColorState sdr_rgb(heif_colorspace_RGB, heif_chroma_444, input_state.has_alpha, 8);
+  sdr_rgb.premultiplied_alpha = input_state.premultiplied_alpha;
+  sdr_rgb.nclx_profile = target_state.nclx_profile;
+
+  std::vector<ConversionStep> steps;
+
+  if (!(input_state == hdr_rgb)) {
+    if (!find_pipeline(input_state, hdr_rgb, options)) {
+      return false;
+    }
+
+    steps = m_conversion_steps;
+
+    // The tone mapping takes the input transfer characteristics from the image.
+    steps.back().output_state.nclx_profile = input_state.nclx_profile;
+  }
+
+  steps.push_back({&get_color_conversion_operations().tone_mapping, sdr_rgb, SpeedCosts_OptimizedSoftware});
+
+  if (!(sdr_rgb == target_state)) {
+    if (!find_pipeline(sdr_rgb, target_state, options)) {
+      m_conversion_steps.clear();
+      return false;
+    }
+
+    steps.insert(steps.end(), m_conversion_steps.begin(), m_conversion_steps.end());
+    steps.back().output_state.nclx_profile = target_state.nclx_profile;
+  }
+
+  m_conversion_steps = steps;
+  return true;
+}
+
+
+std::string get_operation_name(const ColorConversionOperation* op)
+{
+  const char* name = typeid(*op).name();
+
+#if defined(__GNUG__)
+  int status = 0;
+  char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+  if (status == 0 && demangled) {
+    std::string result = demangled;
+    free(demangled);
+    return result;
+  }
+#endif
+
+  return name;
+}
+
+
+ColorConversionInfo ColorConversionPipeline::get_info() const
+{
+  ColorConversionInfo info;
+  info.input_state = m_input_state;
+
+  for (size_t i = 0; i < m_conversion_steps.size(); i++) {
+    const ConversionStep& step = m_conversion_steps[i];
+    bool measured = (i < m_step_statistics.size());
+
+    info.steps.push_back({step.operation, step.output_state, step.speed_costs,
+                          measured,
+                          measured ? m_step_statistics[i].time_us : 0,
+                          measured ? m_step_statistics[i].memory_bytes : 0});
+  }
+
+  return info;
+}
+
+
+std::string ColorConversionPipeline::debug_dump_pipeline() const
+{
+  std::ostringstream ostr;
+  ostr << "final pipeline has " << m_conversion_steps.size() << " steps:\n";
+  for (const auto& step : m_conversion_steps) {
+    auto& op = *step.operation;
+    ostr << "> " << typeid(op).name() << "\n";
+  }
+  return ostr.str();
+}
+
+
+// Pass the color profiles and other image properties to the converted image.
+static void pass_image_properties(const HeifPixelImage& in, HeifPixelImage& out, const ColorState& output_state)
+{
+  out.set_color_profile_nclx(output_state.nclx_profile);
+  out.set_color_profile_icc(in.get_color_profile_icc());
+
+  out.set_premultiplied_alpha(output_state.has_alpha && output_state.premultiplied_alpha);
+
+  // pass through HDR information
+  if (in.has_clli()) {
+    out.set_clli(in.get_clli());
+  }
+
+  if (in.has_mdcv()) {
+    out.set_mdcv(in.get_mdcv());
+  }
+
+  if (in.has_nonsquare_pixel_ratio()) {
+    uint32_t h, v;
+    in.get_pixel_ratio(&h, &v);
+    out.set_pixel_ratio(h, v);
+  }
+
+  const auto& warnings = in.get_warnings();
+  for (const auto& warning : warnings) {
+    out.add_warning(warning);
+  }
+}
+
+
+static uint64_t get_elapsed_us(std::chrono::steady_clock::time_point start)
+{
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+
+// Process-wide count of the pixels that each operation converted (see heif_get_color_conversion_statistics()).
+static void count_converted_pixels(const std::vector<ColorConversionPipeline::ConversionStep>& steps,
+                                   const HeifPixelImage& input)
+{
+  const auto& ops = ColorConversionPipeline::get_operations();
+  uint64_t num_pixels = static_cast<uint64_t>(input.get_width()) * static_cast<uint64_t>(input.get_height());
+
+  for (const auto& step : steps) {
+    auto op_index = std::find(ops.begin(), ops.end(), step.operation) - ops.begin();
+    statistics::add_color_conversion(static_cast<int>(op_index), num_pixels);
+  }
+
+  statistics::add(statistics::pixels_converted, num_pixels);
+}
+
+
+std::shared_ptr<HeifPixelImage> ColorConversionPipeline::convert_image(const std::shared_ptr<HeifPixelImage>& input,
+                                                                       const std::shared_ptr<HeifPixelImage>& output)
+{
+  std::shared_ptr<HeifPixelImage> in = input;
+  std::shared_ptr<HeifPixelImage> out = in;
+
+  m_step_statistics.clear();
+
+  if (m_conversion_steps.empty() && output) {
+    if (!input->copy_planes_to(*output)) {
+      return nullptr;
+    }
+
+    output->copy_image_properties_from(*input);
+    return output;
+  }
+
+  std::vector<StepStatistics> statistics(m_conversion_steps.size(), StepStatistics{0, 0});
+
+  if (can_convert_in_strips()) {
+    std::shared_ptr<HeifPixelImage> strip_output = convert_image_in_strips(input, output, statistics);
+    if (strip_output) {
+      m_step_statistics = std::move(statistics);
+      count_converted_pixels(m_conversion_steps, *input);
+      return strip_output;
+    }
+
+    // do not convert the image again when the strips stopped because of the cancellation
+    if (check_canceled(m_cancellation)) {
+      return nullptr;
+    }
+
+    statistics.assign(m_conversion_steps.size(), StepStatistics{0, 0});
+  }
+
+  for (size_t i = 0; i < m_conversion_steps.size(); i++) {
+    const auto& step = m_conversion_steps[i];
+    bool last_step = (i == m_conversion_steps.size() - 1);
+
+    if (check_canceled(m_cancellation)) {
+      return nullptr;
+    }
+
+#if DEBUG_ME
+    std::cerr << "input spec: ";
+    print_spec(std::cerr, in);
+#endif
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::shared_ptr<HeifPixelImage> band_output;
+
+    int num_bands = get_number_of_row_bands(step, in);
+    if (num_bands > 1) {
+      band_output = convert_step_in_row_bands(step, in, last_step ? output : nullptr, num_bands, statistics[i]);
+    }
+
+    if (band_output) {
+      out = band_output;
+    }
+    else if (last_step && output) {
+      // Write the final result directly into the output planes if the operation supports this.
+      // Otherwise, convert into a temporary image and copy it.
+      if (step.operation->convert_colorspace_into(in, output, step.output_state, m_options)) {
+        out = output;
+      }
+      else {
+        out = step.operation->convert_colorspace(in, step.output_state, m_options);
+        if (!out || !out->copy_planes_to(*output)) {
+          return nullptr;
+        }
+
+        out = output;
+      }
+    }
+    else {
+      out = step.operation->convert_colorspace(in, step.output_state, m_options);
+      if (!out) {
+        return nullptr; // TODO: we should return a proper error
+      }
+    }
+
+    // The time of the row bands is summed up over the bands.
+    if (!band_output) {
+      statistics[i].time_us = get_elapsed_us(start);
+    }
+
+    statistics[i].memory_bytes = out->get_allocated_memory_size();
+
+    pass_image_properties(*in, *out, step.output_state);
 
+    in = out;
+  }
+
+  m_step_statistics = std::move(statistics);
+  count_converted_pixels(m_conversion_steps, *input);
+
+  return out;
+}
+
+
+// Do not split the image into bands that are so small that the threading overhead dominates.
+static const int kMinRowsPerBand = 16;
+static const int kMinPixelsPerBand = 64 * 1024;
+
+
+int ColorConversionPipeline::get_number_of_row_bands(const ConversionStep& step,
+                                                      const std::shared_ptr<HeifPixelImage>& input) const
+{
+  if (!m_thread_pool || !step.operation->supports_row_bands()) {
+    return 1;
+  }
+
+  int num_threads = m_thread_pool->get_num_threads();
+  if (m_max_threads > 0) {
+    num_threads = std::min(num_threads, m_max_threads);
+  }
+
+  int height = input->get_height();
+  int64_t num_pixels = input->get_width() * static_cast<int64_t>(height);
+
+  int max_bands = static_cast<int>(std::min(static_cast<int64_t>(height / kMinRowsPerBand),
+                                            num_pixels / kMinPixelsPerBand));
+
+  return std::min(num_threads, max_bands);
+}
+
+
+std::shared_ptr<HeifPixelImage>
+ColorConversionPipeline::convert_step_in_row_bands(const ConversionStep& step,
+                                                   const std::shared_ptr<HeifPixelImage>& input,
+                                                   std::shared_ptr<HeifPixelImage> output,
+                                                   int num_bands,
+                                                   StepStatistics& statistics) const
+{
+  int width = input->get_width();
+  int height = input->get_height();
+
+  if (!output) {
+    output = std::make_shared<HeifPixelImage>();
+    output->set_plane_allocator(input->get_plane_allocator());
+    output->create(width, height, step.output_state.colorspace, step.output_state.chroma);
+
+    for (const auto& plane : get_image_plane_layout(width, height, step.output_state)) {
+      if (!output->add_plane(plane.channel, plane.width, plane.height, plane.bit_depth)) {
+        return nullptr;
+      }
+    }
+  }
+
+  // Bands start at even rows so that they do not split 4:2:0 chroma samples.
+  int band_height = ((height + num_bands - 1) / num_bands + 1) & ~1;
+
+  // Additional input rows above and below each band. Only the inner rows of the band are kept.
+  int overlap = (step.operation->get_row_band_overlap() + 1) & ~1;
+
+  std::vector<std::shared_ptr<HeifPixelImage>> input_bands;
+  std::vector<std::shared_ptr<HeifPixelImage>> output_bands;
+  std::vector<int> band_top_overlaps;
+
+  for (int y0 = 0; y0 < height; y0 += band_height) {
+    int h = std::min(band_height, height - y0);
+
+    int in_y0 = std::max(0, y0 - overlap);
+    int in_y1 = std::min(height, y0 + h + overlap);
+
+    auto in_band = input->create_view(0, in_y0, width, in_y1 - in_y0);
+    auto out_band = output->create_view(0, y0, width, h);
+    if (!in_band || !out_band) {
+      return nullptr;
+    }
+
+    // the operations take the color profile from the input image
+    in_band->copy_image_properties_from(*input);
+
+    input_bands.push_back(in_band);
+    output_bands.push_back(out_band);
+    band_top_overlaps.push_back(y0 - in_y0);
+  }
+
+  const ColorConversionOperation* op = step.operation;
+  const ColorState& output_state = step.output_state;
+  const heif_color_conversion_options& options = m_options;
+  const Cancellation* cancellation = m_cancellation;
+
+  // Each band writes its own entry.
+  std::vector<uint64_t> band_times_us(input_bands.size(), 0);
+
+  TaskGroup band_tasks(m_thread_pool);
+
+  for (size_t i = 0; i < input_bands.size(); i++) {
+    std::shared_ptr<HeifPixelImage> in_band = input_bands[i];
+    std::shared_ptr<HeifPixelImage> out_band = output_bands[i];
+    int top_overlap = band_top_overlaps[i];
+    uint64_t* time_us = &band_times_us[i];
+
+    band_tasks.run([op, in_band, out_band, top_overlap, overlap, time_us, &output_state, &options, cancellation]() -> Error {
+      Error err = check_canceled(cancellation);
+      if (err) {
+        return err;
+      }
+
+      auto start = std::chrono::steady_clock::now();
+
+      if (overlap == 0 &&
+          op->convert_colorspace_into(in_band, out_band, output_state, options)) {
+        *time_us = get_elapsed_us(start);
+        return Error::Ok;
+      }
+
+      std::shared_ptr<HeifPixelImage> converted = op->convert_colorspace(in_band, output_state, options);
+      std::shared_ptr<HeifPixelImage> inner_rows = converted;
+      if (converted && overlap > 0) {
+        inner_rows = converted->create_view(0, top_overlap, out_band->get_width(), out_band->get_height());
+      }
+
+      if (!inner_rows || !inner_rows->copy_planes_to(*out_band)) {
+        return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+      }
+
+      *time_us = get_elapsed_us(start);
+      return Error::Ok;
+    });
+  }
+
+  Error err = band_tasks.wait();
+  if (err) {
+    return nullptr;
+  }
+
+  for (uint64_t t : band_times_us) {
+    statistics.time_us += t;
+  }
+
+  return output;
+}
+
+
+// Strips are sized such that the intermediate images of all steps stay in the CPU caches.
+static const int kPixelsPerStrip = 64 * 1024;
+
+// Up to this amount of strip memory is kept for reuse by the following strips.
+static const size_t kMaxCachedStripBytes = 32 * 1024 * 1024;
+
+
+bool ColorConversionPipeline::can_convert_in_strips() const
+{
+  // With a single step, there are no intermediate images.
+  if (m_conversion_steps.size() < 2) {
+    return false;
+  }
+
+  for (const auto& step : m_conversion_steps) {
+    if (!step.operation->supports_row_bands() ||
+        step.operation->get_row_band_overlap() > 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+ColorConversionPipeline::convert_image_in_strips(const std::shared_ptr<HeifPixelImage>& input,
+                                                 std::shared_ptr<HeifPixelImage> output,
+                                                 std::vector<StepStatistics>& statistics) const
+{
+  int width = input->get_width();
+  int height = input->get_height();
+
+  const ColorState& output_state = m_conversion_steps.back().output_state;
+
+  if (!output) {
+    output = std::make_shared<HeifPixelImage>();
+    output->set_plane_allocator(input->get_plane_allocator());
+    output->create(width, height, output_state.colorspace, output_state.chroma);
+
+    for (const auto& plane : get_image_plane_layout(width, height, output_state)) {
+      if (!output->add_plane(plane.channel, plane.width, plane.height, plane.bit_depth)) {
+        return nullptr;
+      }
+    }
+  }
+
+  // Even number of rows so that strips do not split 4:2:0 chroma samples.
+  int strip_height = std::max(2, (kPixelsPerStrip / std::max(width, 1) + 1) & ~1);
+
+  // The intermediate images of all strips are taken from this pool. Since each strip releases its
+  // intermediate images before the next strip is converted, only a few strips of memory are in use.
+  std::shared_ptr<PlaneAllocator> strip_memory = std::make_shared<PlaneMemoryPool>(kMaxCachedStripBytes);
+
+  // The strips count in the memory budget of the image, if it has one.
+  if (auto budgeted = std::dynamic_pointer_cast<BudgetedPlaneAllocator>(input->get_plane_allocator())) {
+    strip_memory = std::make_shared<BudgetedPlaneAllocator>(budgeted->get_budget(), strip_memory);
+  }
+
+  std::vector<std::shared_ptr<HeifPixelImage>> input_strips;
+  std::vector<std::shared_ptr<HeifPixelImage>> output_strips;
+
+  for (int y0 = 0; y0 < height; y0 += strip_height) {
+    int h = std::min(strip_height, height - y0);
+
+    auto in_strip = input->create_view(0, y0, width, h);
+    auto out_strip = output->create_view(0, y0, width, h);
+    if (!in_strip || !out_strip) {
+      return nullptr;
+    }
+
+    in_strip->copy_image_properties_from(*input);
+    in_strip->set_plane_allocator(strip_memory);
+
+    input_strips.push_back(in_strip);
+    output_strips.push_back(out_strip);
+  }
+
+  const std::vector<ConversionStep>& steps = m_conversion_steps;
+  const heif_color_conversion_options& options = m_options;
+  const Cancellation* cancellation = m_cancellation;
+
+  // The statistics of each task. The memory is the largest strip of each step.
+  typedef std::vector<StepStatistics> TaskStatistics;
+
+  auto convert_strip = [&steps, &options](const std::shared_ptr<HeifPixelImage>& in_strip,
+                                          const std::shared_ptr<HeifPixelImage>& out_strip,
+                                          TaskStatistics& task_statistics) -> Error {
+    std::shared_ptr<HeifPixelImage> in = in_strip;
+
+    for (size_t s = 0; s < steps.size(); s++) {
+      const ConversionStep& step = steps[s];
+      bool last_step = (s == steps.size() - 1);
+
+      auto start = std::chrono::steady_clock::now();
+
+      if (last_step && step.operation->convert_colorspace_into(in, out_strip, step.output_state, options)) {
+        task_statistics[s].time_us += get_elapsed_us(start);
+        break;
+      }
+
+      std::shared_ptr<HeifPixelImage> out = step.operation->convert_colorspace(in, step.output_state, options);
+      if (!out) {
+        return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+      }
+
+      task_statistics[s].memory_bytes = std::max(task_statistics[s].memory_bytes, out->get_allocated_memory_size());
+
+      if (last_step) {
+        if (!out->copy_planes_to(*out_strip)) {
+          return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+        }
+      }
+      else {
+        pass_image_properties(*in, *out, step.output_state);
+        in = out;
+      }
+
+      task_statistics[s].time_us += get_elapsed_us(start);
+    }
+
+    return Error::Ok;
+  };
+
+  // Each task converts a contiguous range of strips.
+  size_t num_strips = input_strips.size();
+  size_t num_tasks = 1;
+  if (m_thread_pool) {
+    int num_threads = m_thread_pool->get_num_threads();
+    if (m_max_threads > 0) {
+      num_threads = std::min(num_threads, m_max_threads);
+    }
+
+    num_tasks = std::max(std::min(num_strips, static_cast<size_t>(num_threads)), static_cast<size_t>(1));
+  }
+
+  std::vector<TaskStatistics> task_statistics(num_tasks, TaskStatistics(steps.size(), StepStatistics{0, 0}));
+
+  TaskGroup strip_tasks(num_tasks > 1 ? m_thread_pool : nullptr);
+
+  for (size_t t = 0; t < num_tasks; t++) {
+    size_t first = t * num_strips / num_tasks;
+    size_t end = (t + 1) * num_strips / num_tasks;
+    TaskStatistics* task_stats = &task_statistics[t];
+
+    strip_tasks.run([first, end, task_stats, &input_strips, &output_strips, &convert_strip, cancellation]() -> Error {
+      for (size_t i = first; i < end; i++) {
+        Error err = check_canceled(cancellation);
+        if (err) {
+          return err;
+        }
+
+        err = convert_strip(input_strips[i], output_strips[i], *task_stats);
+        if (err) {
+          return err;
+        }
+      }
+
+      return Error::Ok;
+    });
+  }
+
+  Error err = strip_tasks.wait();
+  if (err) {
+    return nullptr;
+  }
+
+  // The tasks run at the same time, thus their strip memory adds up.
+  for (const auto& task_stats : task_statistics) {
+    for (size_t s = 0; s < steps.size(); s++) {
+      statistics[s].time_us += task_stats[s].time_us;
+      statistics[s].memory_bytes += task_stats[s].memory_bytes;
+    }
+  }
+
+  // The last step writes into the output image.
+  statistics.back().memory_bytes = output->get_allocated_memory_size();
+
+  pass_image_properties(*input, *output, output_state);
+
+  return output;
+}
+
+
+std::vector<ImagePlaneLayout> get_image_plane_layout(int width, int height, const ColorState& state)
+{
+  std::vector<ImagePlaneLayout> planes;
+
+  if (is_semi_planar_chroma(state.chroma)) {
+    int chroma_width, chroma_height;
+    get_subsampled_size(width, height, heif_channel_interleaved, state.chroma, &chroma_width, &chroma_height);
+
+    planes.push_back({heif_channel_Y, width, height, state.bits_per_pixel});
+    planes.push_back({heif_channel_interleaved, chroma_width, chroma_height, state.bits_per_pixel});
+    return planes;
+  }
+
+  if (num_interleaved_pixels_per_plane(state.chroma) > 1) {
+    planes.push_back({heif_channel_interleaved, width, height, state.bits_per_pixel});
+    return planes;
+  }
+
+  std::vector<heif_channel> channels;
+  if (state.colorspace == heif_colorspace_RGB) {
+    channels = {heif_channel_R, heif_channel_G, heif_channel_B};
+  }
+  else if (state.colorspace == heif_colorspace_monochrome) {
+    channels = {heif_channel_Y};
+  }
+  else {
+    channels = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr};
+  }
+
+  if (state.has_alpha) {
+    channels.push_back(heif_channel_Alpha);
+  }
+
+  for (heif_channel channel : channels) {
+    int plane_width, plane_height;
+    get_subsampled_size(width, height, channel, state.chroma, &plane_width, &plane_height);
+    planes.push_back({channel, plane_width, plane_height, state.bits_per_pixel});
+  }
+
+  return planes;
+}
+
+
+size_t get_image_memory_size(int width, int height, const ColorState& state)
+{
+  size_t size = 0;
+  for (const auto& plane : get_image_plane_layout(width, height, state)) {
+    size_t bytes_per_pixel = num_interleaved_pixels_per_plane(state.chroma, plane.channel) * ((plane.bit_depth + 7) / 8);
+    size += static_cast<size_t>(plane.width) * plane.height * bytes_per_pixel;
+  }
+
+  return size;
+}
+
+
+size_t estimate_conversion_memory(int width, int height,
+                                  const ColorState& input_state,
+                                  const ColorState& target_state,
+                                  const heif_color_conversion_options& options)
+{
+  if (input_state == target_state) {
+    return 0;
+  }
+
+  ColorConversionPipeline pipeline;
+  if (!pipeline.construct_pipeline(input_state, target_state, options)) {
+    return get_image_memory_size(width, height, target_state);
+  }
+
+  size_t peak = 0;
+  size_t previous = 0;
+  for (const auto& step : pipeline.get_info().steps) {
+    size_t size = get_image_memory_size(width, height, step.output_state);
+    peak = std::max(peak, previous + size);
+    previous = size;
+  }
+
+  return peak;
+}
+
+
+static ColorState get_input_color_state(const std::shared_ptr<const HeifPixelImage>& input)
+{
   ColorState input_state;
   input_state.colorspace = input->get_colorspace();
   input_state.chroma = input->get_chroma_format();
   input_state.has_alpha = input->has_channel(heif_channel_Alpha) || is_chroma_with_alpha(input->get_chroma_format());
+  input_state.premultiplied_alpha = input_state.has_alpha && input->is_premultiplied_alpha();
   input_state.nclx_profile = input->get_color_profile_nclx();
 
   std::set<enum heif_channel> channels = input->get_channel_set();
   assert(!channels.empty());
   input_state.bits_per_pixel = input->get_bits_per_pixel(*(channels.begin()));
 
+  return input_state;
+}
+
+
+ColorState get_output_color_state(const std::shared_ptr<const HeifPixelImage>& input,
+                                  heif_colorspace target_colorspace,
+                                  heif_chroma target_chroma,
+                                  const std::shared_ptr<const color_profile_nclx>& target_profile,
+                                  int output_bpp,
+                                  heif_alpha_premultiplication alpha_premultiplication)
+{
+  return get_output_color_state(get_input_color_state(input), target_colorspace, target_chroma,
+                                target_profile, output_bpp, alpha_premultiplication);
+}
+
+
+ColorState get_output_color_state(const ColorState& input_state,
+                                  heif_colorspace target_colorspace,
+                                  heif_chroma target_chroma,
+                                  const std::shared_ptr<const color_profile_nclx>& target_profile,
+                                  int output_bpp,
+                                  heif_alpha_premultiplication alpha_premultiplication)
+{
   ColorState output_state = input_state;
   output_state.colorspace = target_colorspace;
   output_state.chroma = target_chroma;
@@ -483,12 +1760,21 @@ std::shared_ptr<HeifPixelImage> convert_colorspace(const std::shared_ptr<HeifPix
   // For planar formats, we include an alpha plane when included in the input.
 
   if (num_interleaved_pixels_per_plane(target_chroma) > 1) {
+    // also drops the alpha channel for the semi-planar YCbCr formats
     output_state.has_alpha = is_chroma_with_alpha(target_chroma);
   }
   else {
     output_state.has_alpha = input_state.has_alpha;
   }
 
+  // Images without alpha are never premultiplied, also if alpha is added for the output format.
+
+  if (alpha_premultiplication != heif_alpha_premultiplication_unchanged) {
+    output_state.premultiplied_alpha = (alpha_premultiplication == heif_alpha_premultiplication_premultiplied);
+  }
+
+  output_state.premultiplied_alpha &= (output_state.has_alpha && input_state.has_alpha);
+
   if (output_bpp) {
     output_state.bits_per_pixel = output_bpp;
   }
@@ -512,11 +1798,128 @@ std::shared_ptr<HeifPixelImage> convert_colorspace(const std::shared_ptr<HeifPix
     output_state.bits_per_pixel = 10;
   }
 
+  // The same holds for the semi-planar formats: NV12/NV21 are 8-bit, P010 is >8-bit.
+
+  if (target_chroma == heif_chroma_420_NV12 ||
+      target_chroma == heif_chroma_420_NV21) {
+    output_state.bits_per_pixel = 8;
+  }
+
+  if (target_chroma == heif_chroma_420_P010 &&
+      output_state.bits_per_pixel <= 8) {
+    output_state.bits_per_pixel = 10;
+  }
+
+  // The bit depth of the float formats is the size of the samples.
+
+  if (target_chroma == heif_chroma_interleaved_RGB_HALF ||
+      target_chroma == heif_chroma_interleaved_RGBA_HALF) {
+    output_state.bits_per_pixel = 16;
+  }
+
+  if (target_chroma == heif_chroma_interleaved_RGB_FLOAT ||
+      target_chroma == heif_chroma_interleaved_RGBA_FLOAT) {
+    output_state.bits_per_pixel = 32;
+  }
+
+  return output_state;
+}
+
+
+std::shared_ptr<HeifPixelImage> convert_colorspace(const std::shared_ptr<HeifPixelImage>& input,
+                                                   heif_colorspace target_colorspace,
+                                                   heif_chroma target_chroma,
+                                                   const std::shared_ptr<const color_profile_nclx>& target_profile,
+                                                   int output_bpp,
+                                                   const heif_color_conversion_options& options,
+                                                   const std::shared_ptr<HeifPixelImage>& output,
+                                                   ThreadPool* thread_pool,
+                                                   int max_threads,
+                                                   heif_alpha_premultiplication alpha_premultiplication,
+                                                   const Cancellation* cancellation)
+{
+  // --- check that input image is valid
+
+  int width = input->get_width();
+  int height = input->get_height();
+
+  // alpha image should have full image resolution
+
+  if (input->has_channel(heif_channel_Alpha)) {
+    if (input->get_width(heif_channel_Alpha) != width ||
+        input->get_height(heif_channel_Alpha) != height) {
+      return nullptr;
+    }
+  }
+
+  // check for valid target YCbCr chroma formats
+
+  if (target_colorspace == heif_colorspace_YCbCr) {
+    if (target_chroma != heif_chroma_420 &&
+        target_chroma != heif_chroma_422 &&
+        target_chroma != heif_chroma_444 &&
+        !is_semi_planar_chroma(target_chroma)) {
+      return nullptr;
+    }
+  }
+
+  // --- prepare conversion
+
+  ColorState input_state = get_input_color_state(input);
+  ColorState output_state = get_output_color_state(input, target_colorspace, target_chroma, target_profile, output_bpp,
+                                                   alpha_premultiplication);
+
   ColorConversionPipeline pipeline;
   bool success = pipeline.construct_pipeline(input_state, output_state, options);
   if (!success) {
     return nullptr;
   }
 
-  return pipeline.convert_image(input);
+  pipeline.set_thread_pool(thread_pool, max_threads);
+  pipeline.set_cancellation(cancellation);
+
+  std::shared_ptr<HeifPixelImage> result = pipeline.convert_image(input, output);
+
+  // Record the steps, following the steps that produced the input image.
+  if (result && result != input) {
+    auto info = std::make_shared<ColorConversionInfo>(pipeline.get_info());
+
+    if (const auto& previous = input->get_color_conversion_info()) {
+      info->input_state = previous->input_state;
+      info->steps.insert(info->steps.begin(), previous->steps.begin(), previous->steps.end());
+    }
+
+    result->set_color_conversion_info(info);
+  }
+
+  return result;
+}
+
+
+bool convert_colorspace_into(const std::shared_ptr<HeifPixelImage>& input,
+                             const std::shared_ptr<HeifPixelImage>& output,
+                             const heif_color_conversion_options& options)
+{
+  if (input->get_width() != output->get_width() ||
+      input->get_height() != output->get_height()) {
+    return false;
+  }
+
+  std::set<enum heif_channel> channels = output->get_channel_set();
+  if (channels.empty()) {
+    return false;
+  }
+
+  int output_bpp = output->get_bits_per_pixel(*(channels.begin()));
+
+  // same conversion as convert_colorspace(), but with the output format taken from 'output'
+
+  std::shared_ptr<HeifPixelImage> result = convert_colorspace(input,
+                                                              output->get_colorspace(),
+                                                              output->get_chroma_format(),
+                                                              output->get_color_profile_nclx(),
+                                                              output_bpp,
+                                                              options,
+                                                              output);
+  return result != nullptr;
 }
@@ -22,6 +22,7 @@
 #define LIBHEIF_COLORCONVERSION_H
 
 #include "libheif/pixelimage.h"
+#include "libheif/cancellation.h"
 #include <memory>
 #include <string>
 #include <vector>
@@ -32,6 +33,10 @@ struct ColorState
   heif_chroma chroma = heif_chroma_undefined;
   bool has_alpha = false;
   int bits_per_pixel = 8;
+
+  // Whether the color components are multiplied by alpha. Only relevant if 'has_alpha' is set.
+  bool premultiplied_alpha = false;
+
   std::shared_ptr<const color_profile_nclx> nclx_profile;
 
   ColorState() = default;
@@ -42,6 +47,10 @@ struct ColorState
   bool operator==(const ColorState&) const;
 };
 
+std::ostream& operator<<(std::ostream& ostr, heif_colorspace c);
+
+std::ostream& operator<<(std::ostream& ostr, heif_chroma c);
+
 std::ostream& operator<<(std::ostream& ostr, const ColorState& state);
 
 // These are some integer constants for typical color conversion Op speed costs.
@@ -82,43 +91,257 @@ public:
   convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
                      const ColorState& target_state,
                      const heif_color_conversion_options& options) const = 0;
+
+  // Write the conversion result into the already existing planes of 'output' (e.g. a view into
+  // a larger image) instead of allocating a new image.
+  // Returns false if the operation does not support this or if 'output' does not match.
+  virtual bool
+  convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                          const std::shared_ptr<HeifPixelImage>& output,
+                          const ColorState& target_state,
+                          const heif_color_conversion_options& options) const
+  {
+    return false;
+  }
+
+  // True if the output rows of a band of (an even number of) input rows only depend on that band.
+  // The pipeline may then split the image into row bands that are converted in parallel.
+  // Operations that filter across rows (e.g. bilinear chroma upsampling) have to return false.
+  virtual bool supports_row_bands() const { return true; }
+
+  // Number of additional input rows (even) above and below each band that an operation needs to
+  // compute the output rows of the band. Operations with a global filter (sharp YUV) can use
+  // this to be converted in bands that overlap, of which only the inner rows are kept.
+  virtual int get_row_band_overlap() const { return 0; }
+
+  // True if the operation sets ColorState::premultiplied_alpha of the states that it returns
+  // from state_after_conversion(), i.e. if it can premultiply or unpremultiply the color components.
+  // The output of all other operations keeps the alpha premultiplication of the input.
+  virtual bool handles_alpha_premultiplication() const { return false; }
+};
+
+
+class ThreadPool;
+
+
+// Readable name of the operation class (e.g. "Op_YCbCr420_to_RGB24").
+std::string get_operation_name(const ColorConversionOperation* op);
+
+
+// The steps of a color conversion with their estimated costs and, after a conversion,
+// the measured time and memory of each step.
+struct ColorConversionInfo
+{
+  struct Step
+  {
+    const ColorConversionOperation* operation;
+    ColorState output_state;
+    int speed_costs;
+
+    bool measured;
+    // Summed over all threads that converted parts of the image in parallel.
+    uint64_t time_us;
+    // Memory allocated for the output of the step. When the steps are applied to strips of the
+    // image, this is the memory of the strips that are converted at the same time.
+    size_t memory_bytes;
+  };
+
+  ColorState input_state;
+  std::vector<Step> steps;
 };
 
 
 class ColorConversionPipeline
 {
 public:
+  // The operations are created on first use. init_ops() only has to be called to do this in advance.
   static void init_ops();
   static void release_ops();
 
+  // Constructed pipelines are cached, keyed on the input and target states and the options.
+  // The cache has to be cleared whenever the operations or their costs change.
+  static void clear_pipeline_cache();
+
+  // Measures the speed of the operations on a standard image block on this machine and uses the
+  // measured costs instead of the fixed SpeedCosts in the pipeline search.
+  static void calibrate_speed_costs();
+
+  // The calibration as text, so that it can be stored and loaded at the next start instead of
+  // measuring again. Returns an empty string if the operations have not been calibrated.
+  static std::string get_speed_cost_profile();
+
+  // Entries of operations that do not exist in this build are ignored.
+  static Error load_speed_cost_profile(const std::string& profile);
+
+  // Go back to the fixed SpeedCosts.
+  static void reset_speed_costs();
+
+  // Convert row bands in parallel on 'pool', using at most 'max_threads' bands (0: as many as
+  // the pool has threads).
+  void set_thread_pool(ThreadPool* pool, int max_threads)
+  {
+    m_thread_pool = pool;
+    m_max_threads = max_threads;
+  }
+
+  // When the operation is canceled, convert_image() stops after the current step, strip or row band
+  // and returns nullptr.
+  void set_cancellation(const Cancellation* cancellation) { m_cancellation = cancellation; }
+
   bool construct_pipeline(const ColorState& input_state,
                           const ColorState& target_state,
                           const heif_color_conversion_options& options);
 
+  // If 'output' is given, the result is written into its planes and 'output' is returned.
   std::shared_ptr<HeifPixelImage>
-  convert_image(const std::shared_ptr<HeifPixelImage>& input);
+  convert_image(const std::shared_ptr<HeifPixelImage>& input,
+                const std::shared_ptr<HeifPixelImage>& output = nullptr);
 
   std::string debug_dump_pipeline() const;
 
-private:
-  static std::vector<ColorConversionOperation*> m_operation_pool;
+  // The constructed steps, including the measurements of the last convert_image() call.
+  ColorConversionInfo get_info() const;
 
   struct ConversionStep {
     const ColorConversionOperation* operation;
     ColorState output_state;
+    int speed_costs;
   };
 
+  // all operations (except for the tone mapping), in the order in which they are tried
+  static const std::vector<const ColorConversionOperation*>& get_operations();
+
+  // The states of the images on which the operations are measured (by calibrate_speed_costs()
+  // and the benchmarks). They all carry the same default nclx profile.
+  static std::vector<ColorState> get_calibration_states();
+
+  // Whether an image can have this state. Some operations also report impossible states for
+  // impossible target states.
+  static bool is_valid_image_state(const ColorState& state);
+
+  // An image with the layout of 'state' filled with a smooth pattern that is valid for its bit depth.
+  // Returns nullptr if the planes cannot be allocated.
+  static std::shared_ptr<HeifPixelImage> create_calibration_image(int width, int height, const ColorState& state);
+
+private:
+  // Dijkstra search for the minimum-cost sequence of operations.
+  bool find_pipeline(const ColorState& input_state,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options);
+
+  // HDR to SDR conversions are split into a conversion to planar RGB at the input bit depth,
+  // the tone mapping, and a conversion from 8-bit planar RGB to the target format.
+  bool find_tone_mapping_pipeline(const ColorState& input_state,
+                                  const ColorState& target_state,
+                                  const heif_color_conversion_options& options);
+
+  static bool lookup_cached_pipeline(const ColorState& input_state,
+                                     const ColorState& target_state,
+                                     const heif_color_conversion_options& options,
+                                     std::vector<ConversionStep>& out_steps,
+                                     bool& out_success);
+
+  static void store_pipeline_in_cache(const ColorState& input_state,
+                                      const ColorState& target_state,
+                                      const heif_color_conversion_options& options,
+                                      const std::vector<ConversionStep>& steps,
+                                      bool success);
+
   std::vector<ConversionStep> m_conversion_steps;
 
+  ColorState m_input_state;
+
+  struct StepStatistics
+  {
+    uint64_t time_us;
+    size_t memory_bytes;
+  };
+
+  // Measured by convert_image(). Empty before the first conversion.
+  std::vector<StepStatistics> m_step_statistics;
+
   heif_color_conversion_options m_options;
+
+  ThreadPool* m_thread_pool = nullptr;
+  int m_max_threads = 0;
+
+  const Cancellation* m_cancellation = nullptr;
+
+  // Multi-step conversions push strips of a few rows through all steps instead of creating
+  // full-size intermediate images. This is possible when all steps support row bands without overlap.
+  bool can_convert_in_strips() const;
+
+  // If 'output' is nullptr, a new image is allocated. Returns nullptr if the conversion failed.
+  std::shared_ptr<HeifPixelImage> convert_image_in_strips(const std::shared_ptr<HeifPixelImage>& input,
+                                                          std::shared_ptr<HeifPixelImage> output,
+                                                          std::vector<StepStatistics>& statistics) const;
+
+  int get_number_of_row_bands(const ConversionStep& step, const std::shared_ptr<HeifPixelImage>& input) const;
+
+  // Converts 'input' in row bands in parallel. If 'output' is nullptr, a new image is allocated.
+  // Returns nullptr if the step cannot be converted in bands.
+  std::shared_ptr<HeifPixelImage> convert_step_in_row_bands(const ConversionStep& step,
+                                                            const std::shared_ptr<HeifPixelImage>& input,
+                                                            std::shared_ptr<HeifPixelImage> output,
+                                                            int num_bands,
+                                                            StepStatistics& statistics) const;
 };
 
 
+struct ImagePlaneLayout
+{
+  heif_channel channel;
+  int width, height;
+  int bit_depth;
+};
+
+// The planes of an image with 'state' as created by the color conversion operations.
+std::vector<ImagePlaneLayout> get_image_plane_layout(int width, int height, const ColorState& state);
+
+// Memory of the planes of an image with 'state', without the alignment of the rows.
+size_t get_image_memory_size(int width, int height, const ColorState& state);
+
+// Estimated peak memory that the conversion of an image from 'input_state' to 'target_state' allocates:
+// the output of a step together with the output of the previous step. The input image is not included.
+// Returns 0 if no conversion is needed.
+size_t estimate_conversion_memory(int width, int height,
+                                  const ColorState& input_state,
+                                  const ColorState& target_state,
+                                  const heif_color_conversion_options& options);
+
+
+// The format of the image that convert_colorspace() produces for these parameters.
+ColorState get_output_color_state(const std::shared_ptr<const HeifPixelImage>& input,
+                                  heif_colorspace colorspace,
+                                  heif_chroma chroma,
+                                  const std::shared_ptr<const color_profile_nclx>& target_profile,
+                                  int output_bpp,
+                                  heif_alpha_premultiplication alpha_premultiplication = heif_alpha_premultiplication_unchanged);
+
+ColorState get_output_color_state(const ColorState& input_state,
+                                  heif_colorspace colorspace,
+                                  heif_chroma chroma,
+                                  const std::shared_ptr<const color_profile_nclx>& target_profile,
+                                  int output_bpp,
+                                  heif_alpha_premultiplication alpha_premultiplication = heif_alpha_premultiplication_unchanged);
+
+// If 'output' is given, the converted image is written into its planes (see convert_colorspace_into()).
 std::shared_ptr<HeifPixelImage> convert_colorspace(const std::shared_ptr<HeifPixelImage>& input,
                                                    heif_colorspace colorspace,
                                                    heif_chroma chroma,
                                                    const std::shared_ptr<const color_profile_nclx>& target_profile,
                                                    int output_bpp,
-                                                   const heif_color_conversion_options& options);
+                                                   const heif_color_conversion_options& options,
+                                                   const std::shared_ptr<HeifPixelImage>& output = nullptr,
+                                                   ThreadPool* thread_pool = nullptr,
+                                                   int max_threads = 0,
+                                                   heif_alpha_premultiplication alpha_premultiplication = heif_alpha_premultiplication_unchanged,
+                                                   const Cancellation* cancellation = nullptr);
+
+// Convert 'input' into the existing planes of 'output', which defines the target colorspace,
+// chroma and bit depth. Both images must have the same size.
+bool convert_colorspace_into(const std::shared_ptr<HeifPixelImage>& input,
+                             const std::shared_ptr<HeifPixelImage>& output,
+                             const heif_color_conversion_options& options);
 
 #endif
@@ -19,6 +19,14 @@
  */
 
 #include "hdr_sdr.h"
+#include "libheif/nclx.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
 
 
 std::vector<ColorStateWithCost>
@@ -55,6 +63,7 @@ Op_to_hdr_planes::convert_colorspace(const std::shared_ptr<const HeifPixelImage>
                                      const heif_color_conversion_options& options) const
 {
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(input->get_width(),
                  input->get_height(),
@@ -82,11 +91,11 @@ Op_to_hdr_planes::convert_colorspace(const std::shared_ptr<const HeifPixelImage>
       int shift2 = 8 - shift1;
 
       const uint8_t* p_in;
-      int stride_in;
+      size_t stride_in;
       p_in = input->get_plane(channel, &stride_in);
 
       uint16_t* p_out;
-      int stride_out;
+      size_t stride_out;
       p_out = (uint16_t*) outimg->get_plane(channel, &stride_out);
       stride_out /= 2;
 
@@ -141,6 +150,7 @@ Op_to_sdr_planes::convert_colorspace(const std::shared_ptr<const HeifPixelImage>
 {
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(input->get_width(),
                  input->get_height(),
@@ -167,12 +177,12 @@ Op_to_sdr_planes::convert_colorspace(const std::shared_ptr<const HeifPixelImage>
         int shift = input_bits - 8;
 
         const uint16_t* p_in;
-        int stride_in;
+        size_t stride_in;
         p_in = (uint16_t*) input->get_plane(channel, &stride_in);
         stride_in /= 2;
 
         uint8_t* p_out;
-        int stride_out;
+        size_t stride_out;
         p_out = outimg->get_plane(channel, &stride_out);
 
         for (int y = 0; y < height; y++)
@@ -190,3 +200,274 @@ Op_to_sdr_planes::convert_colorspace(const std::shared_ptr<const HeifPixelImage>
   return outimg;
 }
 
+
+
+// --- tone mapping
+
+bool Op_HDR_to_SDR_tone_mapping::is_hdr_transfer(uint16_t transfer_characteristics)
+{
+  return (transfer_characteristics == heif_transfer_characteristic_ITU_R_BT_2100_0_PQ ||
+          transfer_characteristics == heif_transfer_characteristic_ITU_R_BT_2100_0_HLG);
+}
+
+
+bool Op_HDR_to_SDR_tone_mapping::requires_tone_mapping(const ColorState& input_state, const ColorState& target_state)
+{
+  if (!input_state.nclx_profile || !target_state.nclx_profile) {
+    return false;
+  }
+
+  uint16_t target_transfer = target_state.nclx_profile->get_transfer_characteristics();
+
+  return (input_state.bits_per_pixel > 8 &&
+          target_state.bits_per_pixel == 8 &&
+          (input_state.colorspace == heif_colorspace_RGB || input_state.colorspace == heif_colorspace_YCbCr) &&
+          is_hdr_transfer(input_state.nclx_profile->get_transfer_characteristics()) &&
+          !is_hdr_transfer(target_transfer) &&
+          target_transfer != heif_transfer_characteristic_unspecified);
+}
+
+
+std::vector<ColorStateWithCost>
+Op_HDR_to_SDR_tone_mapping::state_after_conversion(const ColorState& input_state,
+                                                   const ColorState& target_state,
+                                                   const heif_color_conversion_options& options) const
+{
+  if (input_state.colorspace != heif_colorspace_RGB ||
+      input_state.chroma != heif_chroma_444 ||
+      !requires_tone_mapping(input_state, target_state)) {
+    return {};
+  }
+
+  std::vector<ColorStateWithCost> states;
+
+  ColorState output_state = input_state;
+  output_state.bits_per_pixel = 8;
+  output_state.nclx_profile = target_state.nclx_profile;
+
+  states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+
+  return states;
+}
+
+
+// Luminance of the SDR reference white (ITU-R BT.2408) and the assumed peak luminance of the HDR content.
+static const double kReferenceWhiteNits = 203.0;
+static const double kHDRPeakNits = 1000.0;
+
+
+// PQ (SMPTE ST 2084) EOTF. Returns the luminance in cd/m^2.
+static double pq_to_nits(double e)
+{
+  const double m1 = 2610.0 / 16384;
+  const double m2 = 2523.0 / 4096 * 128;
+  const double c1 = 3424.0 / 4096;
+  const double c2 = 2413.0 / 4096 * 32;
+  const double c3 = 2392.0 / 4096 * 32;
+
+  double p = pow(e, 1 / m2);
+  return 10000.0 * pow(std::max(p - c1, 0.0) / (c2 - c3 * p), 1 / m1);
+}
+
+
+// HLG inverse OETF followed by the OOTF (system gamma 1.2) of a display with kHDRPeakNits.
+static double hlg_to_nits(double e)
+{
+  const double a = 0.17883277;
+  const double b = 1 - 4 * a;
+  const double c = 0.5 - a * log(4 * a);
+
+  double scene = (e <= 0.5) ? e * e / 3 : (exp((e - c) / a) + b) / 12;
+  return kHDRPeakNits * pow(scene, 1.2);
+}
+
+
+// Maps the luminance relative to the SDR reference white into [0;1].
+// Values up to the knee are kept. Above it, the range up to the HDR peak is compressed into the
+// remaining headroom with an extended Reinhard curve.
+static double tone_map(double v)
+{
+  const double knee = 0.75;
+  const double peak = kHDRPeakNits / kReferenceWhiteNits;
+
+  if (v <= knee) {
+    return v;
+  }
+
+  double t = (v - knee) / (1 - knee);
+  double t_peak = (peak - knee) / (1 - knee);
+  double mapped = knee + (1 - knee) * t * (1 + t / (t_peak * t_peak)) / (1 + t);
+
+  return std::min(mapped, 1.0);
+}
+
+
+static double sdr_oetf(double v, uint16_t transfer_characteristics)
+{
+  switch (transfer_characteristics) {
+    case heif_transfer_characteristic_IEC_61966_2_1:
+      return (v <= 0.0031308) ? 12.92 * v : 1.055 * pow(v, 1 / 2.4) - 0.055;
+    case heif_transfer_characteristic_ITU_R_BT_470_6_System_M:
+      return pow(v, 1 / 2.2);
+    case heif_transfer_characteristic_ITU_R_BT_470_6_System_B_G:
+      return pow(v, 1 / 2.8);
+    case heif_transfer_characteristic_linear:
+      return v;
+    default:
+      // BT.709 and the transfer functions that are identical to it (BT.601, BT.2020)
+      return (v < 0.018) ? 4.5 * v : 1.099 * pow(v, 0.45) - 0.099;
+  }
+}
+
+
+double transfer_to_linear_light(double e, uint16_t transfer_characteristics)
+{
+  e = std::min(std::max(e, 0.0), 1.0);
+
+  switch (transfer_characteristics) {
+    case heif_transfer_characteristic_ITU_R_BT_2100_0_PQ:
+      return pq_to_nits(e) / kReferenceWhiteNits;
+    case heif_transfer_characteristic_ITU_R_BT_2100_0_HLG:
+      return hlg_to_nits(e) / kReferenceWhiteNits;
+    case heif_transfer_characteristic_unspecified:
+    case heif_transfer_characteristic_IEC_61966_2_1:
+      return (e <= 0.04045) ? e / 12.92 : pow((e + 0.055) / 1.055, 2.4);
+    case heif_transfer_characteristic_ITU_R_BT_470_6_System_M:
+      return pow(e, 2.2);
+    case heif_transfer_characteristic_ITU_R_BT_470_6_System_B_G:
+      return pow(e, 2.8);
+    case heif_transfer_characteristic_linear:
+      return e;
+    default:
+      return (e < 0.081) ? e / 4.5 : pow((e + 0.099) / 1.099, 1 / 0.45);
+  }
+}
+
+
+static std::vector<uint8_t> compute_tone_mapping_lut(uint16_t input_transfer, uint16_t output_transfer, int bit_depth)
+{
+  int max_input = (1 << bit_depth) - 1;
+  std::vector<uint8_t> lut(max_input + 1);
+
+  for (int i = 0; i <= max_input; i++) {
+    double e = i / static_cast<double>(max_input);
+    double nits = (input_transfer == heif_transfer_characteristic_ITU_R_BT_2100_0_PQ) ? pq_to_nits(e) : hlg_to_nits(e);
+    double sdr = sdr_oetf(tone_map(nits / kReferenceWhiteNits), output_transfer);
+
+    lut[i] = static_cast<uint8_t>(std::min(std::max(sdr * 255.0 + 0.5, 0.0), 255.0));
+  }
+
+  return lut;
+}
+
+
+static std::shared_ptr<const std::vector<uint8_t>> get_tone_mapping_lut(uint16_t input_transfer,
+                                                                        uint16_t output_transfer,
+                                                                        int bit_depth)
+{
+  static std::map<uint32_t, std::shared_ptr<const std::vector<uint8_t>>> s_luts;
+#if ENABLE_MULTITHREADING_SUPPORT
+  static std::mutex s_luts_mutex;
+  std::lock_guard<std::mutex> lock(s_luts_mutex);
+#endif
+
+  uint32_t key = ((uint32_t) input_transfer << 16) | ((uint32_t) (output_transfer & 0xFF) << 8) | (uint32_t) bit_depth;
+
+  auto iter = s_luts.find(key);
+  if (iter != s_luts.end()) {
+    return iter->second;
+  }
+
+  auto lut = std::make_shared<const std::vector<uint8_t>>(compute_tone_mapping_lut(input_transfer, output_transfer,
+                                                                                   bit_depth));
+  s_luts[key] = lut;
+  return lut;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_HDR_to_SDR_tone_mapping::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                               const ColorState& target_state,
+                                               const heif_color_conversion_options& options) const
+{
+  auto input_profile = input->get_color_profile_nclx();
+  if (!input_profile || !target_state.nclx_profile ||
+      input->get_colorspace() != heif_colorspace_RGB ||
+      input->get_chroma_format() != heif_chroma_444) {
+    return nullptr;
+  }
+
+  int bit_depth = input->get_bits_per_pixel(heif_channel_R);
+  if (bit_depth <= 8 || bit_depth > 16 ||
+      input->get_bits_per_pixel(heif_channel_G) != bit_depth ||
+      input->get_bits_per_pixel(heif_channel_B) != bit_depth) {
+    return nullptr;
+  }
+
+  std::shared_ptr<const std::vector<uint8_t>> lut = get_tone_mapping_lut(input_profile->get_transfer_characteristics(),
+                                                                         target_state.nclx_profile->get_transfer_characteristics(),
+                                                                         bit_depth);
+
+  int width = input->get_width();
+  int height = input->get_height();
+
+  auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
+  outimg->create(width, height, heif_colorspace_RGB, heif_chroma_444);
+
+  uint16_t max_value = static_cast<uint16_t>((1 << bit_depth) - 1);
+  const uint8_t* table = lut->data();
+
+  for (heif_channel channel : {heif_channel_R, heif_channel_G, heif_channel_B}) {
+    if (!outimg->add_plane(channel, width, height, 8)) {
+      return nullptr;
+    }
+
+    size_t stride_in;
+    const uint16_t* p_in = (const uint16_t*) input->get_plane(channel, &stride_in);
+    stride_in /= 2;
+
+    size_t stride_out;
+    uint8_t* p_out = outimg->get_plane(channel, &stride_out);
+
+    for (int y = 0; y < height; y++) {
+      const uint16_t* in_row = p_in + y * stride_in;
+      uint8_t* out_row = p_out + y * stride_out;
+
+      for (int x = 0; x < width; x++) {
+        out_row[x] = table[std::min(in_row[x], max_value)];
+      }
+    }
+  }
+
+  // alpha is not tone mapped, only reduced to 8 bits
+
+  if (input->has_channel(heif_channel_Alpha)) {
+    int alpha_bits = input->get_bits_per_pixel(heif_channel_Alpha);
+
+    if (alpha_bits > 8) {
+      if (!outimg->add_plane(heif_channel_Alpha, width, height, 8)) {
+        return nullptr;
+      }
+
+      int shift = alpha_bits - 8;
+
+      size_t stride_in;
+      const uint16_t* p_in = (const uint16_t*) input->get_plane(heif_channel_Alpha, &stride_in);
+      stride_in /= 2;
+
+      size_t stride_out;
+      uint8_t* p_out = outimg->get_plane(heif_channel_Alpha, &stride_out);
+
+      for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+          p_out[y * stride_out + x] = (uint8_t) (p_in[y * stride_in + x] >> shift);
+        }
+    }
+    else {
+      outimg->copy_new_plane_from(input, heif_channel_Alpha, heif_channel_Alpha);
+    }
+  }
+
+  return outimg;
+}
@@ -55,4 +55,38 @@ public:
                      const heif_color_conversion_options& options) const override;
 };
 
+
+// HDR (PQ or HLG) to SDR tone mapping of planar RGB, combined with the reduction to 8 bits.
+// The transfer characteristics are taken from the nclx profiles of the input image and the target state.
+// Each channel is mapped through a lookup table with one entry for each input value. The tables are
+// computed once for each combination of transfer characteristics and bit depth.
+//
+// This operation is not part of the regular pipeline search, because the search cannot distinguish
+// tone-mapped from only bit-shifted states. ColorConversionPipeline inserts it explicitly when
+// requires_tone_mapping() is true.
+class Op_HDR_to_SDR_tone_mapping : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  static bool is_hdr_transfer(uint16_t transfer_characteristics);
+
+  // True if the input is HDR (PQ or HLG) and the target is an 8-bit image with an SDR transfer function.
+  static bool requires_tone_mapping(const ColorState& input_state, const ColorState& target_state);
+};
+
+
+// Inverse of the transfer function: maps a non-linear sample value in [0;1] to linear light.
+// 1.0 is the SDR reference white. For PQ and HLG, the reference white is 203 cd/m^2 and
+// highlights exceed 1.0. Unknown transfer characteristics are handled like BT.709.
+double transfer_to_linear_light(double e, uint16_t transfer_characteristics);
+
 #endif //LIBHEIF_COLORCONVERSION_HDR_SDR_H
@@ -18,8 +18,17 @@
  * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <cstring>
 #include "monochrome.h"
+#include "libheif/cpu_features.h"
+#include <cstring>
+
+#if HEIF_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
 
 
 std::vector<ColorStateWithCost>
@@ -55,6 +64,7 @@ Op_mono_to_YCbCr420::convert_colorspace(const std::shared_ptr<const HeifPixelIma
                                         const heif_color_conversion_options& options) const
 {
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   int width = input->get_width();
   int height = input->get_height();
@@ -84,10 +94,10 @@ Op_mono_to_YCbCr420::convert_colorspace(const std::shared_ptr<const HeifPixelIma
 
   if (input_bpp == 8) {
     uint8_t* out_cb, * out_cr, * out_y;
-    int out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0;
+    size_t out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0;
 
     const uint8_t* in_y;
-    int in_y_stride = 0;
+    size_t in_y_stride = 0;
 
     in_y = input->get_plane(heif_channel_Y, &in_y_stride);
 
@@ -106,10 +116,10 @@ Op_mono_to_YCbCr420::convert_colorspace(const std::shared_ptr<const HeifPixelIma
   }
   else {
     uint16_t* out_cb, * out_cr, * out_y;
-    int out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0;
+    size_t out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0;
 
     const uint16_t* in_y;
-    int in_y_stride = 0;
+    size_t in_y_stride = 0;
 
     in_y = (const uint16_t*) input->get_plane(heif_channel_Y, &in_y_stride);
 
@@ -138,8 +148,8 @@ Op_mono_to_YCbCr420::convert_colorspace(const std::shared_ptr<const HeifPixelIma
   if (has_alpha) {
     const uint8_t* in_a;
     uint8_t* out_a;
-    int in_a_stride = 0;
-    int out_a_stride = 0;
+    size_t in_a_stride = 0;
+    size_t out_a_stride = 0;
 
     in_a = input->get_plane(heif_channel_Alpha, &in_a_stride);
     out_a = outimg->get_plane(heif_channel_Alpha, &out_a_stride);
@@ -155,119 +165,637 @@ Op_mono_to_YCbCr420::convert_colorspace(const std::shared_ptr<const HeifPixelIma
 }
 
 
+static Mono_to_RGB_kernels s_kernels;
+
+
+void expand_luma_range_row(const uint8_t* in, uint8_t* out, int width)
+{
+  int x = 0;
+
+  if (s_kernels.expand_range_8bit) {
+    x = s_kernels.expand_range_8bit(in, out, width);
+  }
+
+  for (; x < width; x++) {
+    int e = in[x] - 16;
+    e = (e < 0 ? 0 : (e > 219 ? 219 : e));
+
+    int v = (e * 299 + 128) >> 8;
+    out[x] = (uint8_t) (v > 255 ? 255 : v);
+  }
+}
+
+
+void expand_luma_range_row(const uint16_t* in, uint16_t* out, int width, int bit_depth)
+{
+  int x = 0;
+
+  if (s_kernels.expand_range_16bit) {
+    x = s_kernels.expand_range_16bit(in, out, width, bit_depth);
+  }
+
+  const int32_t offset = 16 << (bit_depth - 8);
+  const int32_t range = 219 << (bit_depth - 8);
+  const int32_t max_value = (1 << bit_depth) - 1;
+
+  for (; x < width; x++) {
+    int32_t e = in[x] - offset;
+    e = (e < 0 ? 0 : (e > range ? range : e));
+
+    int32_t v = (e * 299 + 128) >> 8;
+    out[x] = (uint16_t) (v > max_value ? max_value : v);
+  }
+}
+
+
+void mono_to_rgb24_row(const uint8_t* luma, uint8_t* out, int width)
+{
+  int x = 0;
+
+  if (s_kernels.to_rgb24) {
+    x = s_kernels.to_rgb24(luma, nullptr, out, width);
+  }
+
+  for (; x < width; x++) {
+    uint8_t v = luma[x];
+    out[3 * x + 0] = v;
+    out[3 * x + 1] = v;
+    out[3 * x + 2] = v;
+  }
+}
+
+
+void mono_to_rgba_row(const uint8_t* luma, const uint8_t* alpha, uint8_t* out, int width)
+{
+  int x = 0;
+
+  if (s_kernels.to_rgba) {
+    x = s_kernels.to_rgba(luma, alpha, out, width);
+  }
+
+  for (; x < width; x++) {
+    uint8_t v = luma[x];
+    out[4 * x + 0] = v;
+    out[4 * x + 1] = v;
+    out[4 * x + 2] = v;
+    out[4 * x + 3] = (alpha ? alpha[x] : 0xFF);
+  }
+}
+
+
+static inline void write_sample16(uint8_t* out, uint16_t v, bool big_endian)
+{
+  out[big_endian ? 0 : 1] = (uint8_t) (v >> 8);
+  out[big_endian ? 1 : 0] = (uint8_t) (v & 0xFF);
+}
+
+
+void mono_to_rrggbb_row(const uint16_t* luma, uint8_t* out, int width, bool big_endian)
+{
+  int x = 0;
+
+  if (s_kernels.to_rrggbb) {
+    x = s_kernels.to_rrggbb(luma, nullptr, out, width, 0, big_endian);
+  }
+
+  for (; x < width; x++) {
+    uint16_t v = luma[x];
+    write_sample16(out + 6 * x + 0, v, big_endian);
+    write_sample16(out + 6 * x + 2, v, big_endian);
+    write_sample16(out + 6 * x + 4, v, big_endian);
+  }
+}
+
+
+void mono_to_rrggbbaa_row(const uint16_t* luma, const uint16_t* alpha, uint8_t* out, int width,
+                          uint16_t alpha_max, bool big_endian)
+{
+  int x = 0;
+
+  if (s_kernels.to_rrggbbaa) {
+    x = s_kernels.to_rrggbbaa(luma, alpha, out, width, alpha_max, big_endian);
+  }
+
+  for (; x < width; x++) {
+    uint16_t v = luma[x];
+    write_sample16(out + 8 * x + 0, v, big_endian);
+    write_sample16(out + 8 * x + 2, v, big_endian);
+    write_sample16(out + 8 * x + 4, v, big_endian);
+    write_sample16(out + 8 * x + 6, alpha ? alpha[x] : alpha_max, big_endian);
+  }
+}
+
+
+static bool is_interleaved_RGB_chroma(heif_chroma chroma, int bpp)
+{
+  if (bpp == 8) {
+    return (chroma == heif_chroma_interleaved_RGB ||
+            chroma == heif_chroma_interleaved_RGBA);
+  }
+  else {
+    return (chroma == heif_chroma_interleaved_RRGGBB_BE ||
+            chroma == heif_chroma_interleaved_RRGGBB_LE ||
+            chroma == heif_chroma_interleaved_RRGGBBAA_BE ||
+            chroma == heif_chroma_interleaved_RRGGBBAA_LE);
+  }
+}
+
+
 std::vector<ColorStateWithCost>
-Op_mono_to_RGB24_32::state_after_conversion(const ColorState& input_state,
-                                            const ColorState& target_state,
-                                            const heif_color_conversion_options& options) const
+Op_mono_to_interleaved_RGB::state_after_conversion(const ColorState& input_state,
+                                                   const ColorState& target_state,
+                                                   const heif_color_conversion_options& options) const
 {
-  // Note: no input alpha channel required. It will be filled up with 0xFF.
+  // Note: no input alpha channel required. It will be filled up with the maximum value.
 
   if (input_state.colorspace != heif_colorspace_monochrome ||
       input_state.chroma != heif_chroma_monochrome ||
-      input_state.bits_per_pixel != 8) {
+      input_state.bits_per_pixel < 8 ||
+      input_state.bits_per_pixel > 16) {
     return {};
   }
 
   std::vector<ColorStateWithCost> states;
 
   ColorState output_state;
+  output_state.colorspace = heif_colorspace_RGB;
+  output_state.bits_per_pixel = input_state.bits_per_pixel;
+
+  if (input_state.bits_per_pixel == 8) {
 
-  // --- convert to RGB24
+    // --- convert to RGB24
 
-  if (input_state.has_alpha == false) {
-    output_state.colorspace = heif_colorspace_RGB;
-    output_state.chroma = heif_chroma_interleaved_RGB;
-    output_state.has_alpha = false;
-    output_state.bits_per_pixel = 8;
+    if (input_state.has_alpha == false) {
+      output_state.chroma = heif_chroma_interleaved_RGB;
+      output_state.has_alpha = false;
 
-    states.push_back({output_state, SpeedCosts_Unoptimized});
+      states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+    }
+
+    // --- convert to RGB32
+
+    output_state.chroma = heif_chroma_interleaved_RGBA;
+    output_state.has_alpha = true;
+
+    states.push_back({output_state, SpeedCosts_OptimizedSoftware});
   }
+  else {
+    bool little_endian = (target_state.chroma == heif_chroma_interleaved_RRGGBB_LE ||
+                          target_state.chroma == heif_chroma_interleaved_RRGGBBAA_LE);
 
+    // --- convert to RRGGBB
 
-  // --- convert to RGB32
+    if (input_state.has_alpha == false) {
+      output_state.chroma = (little_endian ? heif_chroma_interleaved_RRGGBB_LE : heif_chroma_interleaved_RRGGBB_BE);
+      output_state.has_alpha = false;
 
-  output_state.colorspace = heif_colorspace_RGB;
-  output_state.chroma = heif_chroma_interleaved_RGBA;
-  output_state.has_alpha = true;
-  output_state.bits_per_pixel = 8;
+      states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+    }
 
-  states.push_back({output_state, SpeedCosts_Unoptimized});
+    // --- convert to RRGGBBAA
+
+    output_state.chroma = (little_endian ? heif_chroma_interleaved_RRGGBBAA_LE : heif_chroma_interleaved_RRGGBBAA_BE);
+    output_state.has_alpha = true;
+
+    states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+  }
 
   return states;
 }
 
 
 std::shared_ptr<HeifPixelImage>
-Op_mono_to_RGB24_32::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
-                                        const ColorState& target_state,
-                                        const heif_color_conversion_options& options) const
+Op_mono_to_interleaved_RGB::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                               const ColorState& target_state,
+                                               const heif_color_conversion_options& options) const
 {
   int width = input->get_width();
   int height = input->get_height();
+  int bpp = input->get_bits_per_pixel(heif_channel_Y);
 
-  if (input->get_bits_per_pixel(heif_channel_Y) != 8) {
+  if (!is_interleaved_RGB_chroma(target_state.chroma, bpp)) {
     return nullptr;
   }
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
+  outimg->create(width, height, heif_colorspace_RGB, target_state.chroma);
 
-  bool has_alpha = input->has_channel(heif_channel_Alpha);
+  if (!outimg->add_plane(heif_channel_interleaved, width, height, bpp)) {
+    return nullptr;
+  }
 
-  if (target_state.has_alpha) {
-    outimg->create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_32bit);
+  if (!convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
   }
-  else {
-    outimg->create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_24bit);
+
+  return outimg;
+}
+
+
+bool
+Op_mono_to_interleaved_RGB::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                    const std::shared_ptr<HeifPixelImage>& outimg,
+                                                    const ColorState& target_state,
+                                                    const heif_color_conversion_options& options) const
+{
+  heif_chroma chroma = outimg->get_chroma_format();
+
+  if (input->get_colorspace() != heif_colorspace_monochrome ||
+      !input->has_channel(heif_channel_Y) ||
+      !outimg->has_channel(heif_channel_interleaved)) {
+    return false;
   }
 
-  if (!outimg->add_plane(heif_channel_interleaved, width, height, 8)) {
-    return nullptr;
+  int width = input->get_width(heif_channel_Y);
+  int height = input->get_height(heif_channel_Y);
+  int bpp = input->get_bits_per_pixel(heif_channel_Y);
+
+  if (bpp < 8 || bpp > 16 ||
+      chroma != target_state.chroma ||
+      !is_interleaved_RGB_chroma(chroma, bpp) ||
+      outimg->get_bits_per_pixel(heif_channel_interleaved) != bpp ||
+      outimg->get_width(heif_channel_interleaved) != width ||
+      outimg->get_height(heif_channel_interleaved) != height) {
+    return false;
   }
 
-  const uint8_t* in_y, * in_a = nullptr;
-  int in_y_stride = 0, in_a_stride;
+  bool output_has_alpha = is_chroma_with_alpha(chroma);
+  bool input_has_alpha = output_has_alpha && input->has_channel(heif_channel_Alpha);
 
-  uint8_t* out_p;
-  int out_p_stride = 0;
+  if (input_has_alpha &&
+      (input->get_bits_per_pixel(heif_channel_Alpha) != bpp ||
+       input->get_width(heif_channel_Alpha) != width ||
+       input->get_height(heif_channel_Alpha) != height)) {
+    return false;
+  }
 
-  in_y = input->get_plane(heif_channel_Y, &in_y_stride);
-  if (has_alpha) {
-    in_a = input->get_plane(heif_channel_Alpha, &in_a_stride);
+  // Matrix coefficients do not matter for gray pixels, only the range has to be expanded.
+  auto nclx = input->get_color_profile_nclx();
+  bool limited_range = (nclx && !nclx->get_full_range_flag());
+
+  size_t in_y_stride = 0, in_a_stride = 0, out_p_stride = 0;
+  const uint8_t* in_y = input->get_plane(heif_channel_Y, &in_y_stride);
+  const uint8_t* in_a = (input_has_alpha ? input->get_plane(heif_channel_Alpha, &in_a_stride) : nullptr);
+  uint8_t* out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+
+  if (!in_y || !out_p) {
+    return false;
   }
 
-  out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+  if (bpp == 8) {
+    std::vector<uint8_t> expanded(limited_range ? width : 0);
+
+    for (int y = 0; y < height; y++) {
+      const uint8_t* luma = in_y + y * in_y_stride;
+      uint8_t* out = out_p + y * out_p_stride;
 
-  int x, y;
-  for (y = 0; y < height; y++) {
-    if (target_state.has_alpha == false) {
-      for (x = 0; x < width; x++) {
-        uint8_t v = in_y[x + y * in_y_stride];
-        out_p[y * out_p_stride + 3 * x + 0] = v;
-        out_p[y * out_p_stride + 3 * x + 1] = v;
-        out_p[y * out_p_stride + 3 * x + 2] = v;
+      if (limited_range) {
+        expand_luma_range_row(luma, expanded.data(), width);
+        luma = expanded.data();
       }
-    }
-    else if (has_alpha) {
-      for (x = 0; x < width; x++) {
-        uint8_t v = in_y[x + y * in_y_stride];
-        out_p[y * out_p_stride + 4 * x + 0] = v;
-        out_p[y * out_p_stride + 4 * x + 1] = v;
-        out_p[y * out_p_stride + 4 * x + 2] = v;
-        out_p[y * out_p_stride + 4 * x + 3] = in_a[x + y * in_a_stride];
+
+      if (output_has_alpha) {
+        mono_to_rgba_row(luma, in_a ? in_a + y * in_a_stride : nullptr, out, width);
+      }
+      else {
+        mono_to_rgb24_row(luma, out, width);
       }
     }
-    else {
-      for (x = 0; x < width; x++) {
-        uint8_t v = in_y[x + y * in_y_stride];
-        out_p[y * out_p_stride + 4 * x + 0] = v;
-        out_p[y * out_p_stride + 4 * x + 1] = v;
-        out_p[y * out_p_stride + 4 * x + 2] = v;
-        out_p[y * out_p_stride + 4 * x + 3] = 0xFF;
+  }
+  else {
+    bool big_endian = (chroma == heif_chroma_interleaved_RRGGBB_BE ||
+                       chroma == heif_chroma_interleaved_RRGGBBAA_BE);
+    auto alpha_max = static_cast<uint16_t>((1 << bpp) - 1);
+
+    std::vector<uint16_t> expanded(limited_range ? width : 0);
+
+    for (int y = 0; y < height; y++) {
+      auto* luma = reinterpret_cast<const uint16_t*>(in_y + y * in_y_stride);
+      uint8_t* out = out_p + y * out_p_stride;
+
+      if (limited_range) {
+        expand_luma_range_row(luma, expanded.data(), width, bpp);
+        luma = expanded.data();
+      }
+
+      if (output_has_alpha) {
+        auto* alpha = (in_a ? reinterpret_cast<const uint16_t*>(in_a + y * in_a_stride) : nullptr);
+        mono_to_rrggbbaa_row(luma, alpha, out, width, alpha_max, big_endian);
+      }
+      else {
+        mono_to_rrggbb_row(luma, out, width, big_endian);
       }
     }
   }
 
-  return outimg;
+  return true;
+}
+
+
+// --- SIMD kernels
+
+#if HEIF_HAVE_X86_SIMD
+
+HEIF_TARGET_SSE41
+static int expand_luma_range_row_8bit_sse41(const uint8_t* in, uint8_t* out, int width)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i offset = _mm_set1_epi8(16);
+  const __m128i range = _mm_set1_epi8((char) 219);
+  const __m128i scale = _mm_set1_epi16(299);
+  const __m128i round = _mm_set1_epi16(128);
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i e = _mm_min_epu8(_mm_subs_epu8(_mm_loadu_si128((const __m128i*) (in + x)), offset), range);
+
+    // 219 * 299 + 128 exceeds 16 bits, but saturates to a result of 255 as in the scalar code
+    __m128i lo = _mm_srli_epi16(_mm_adds_epu16(_mm_mullo_epi16(_mm_unpacklo_epi8(e, zero), scale), round), 8);
+    __m128i hi = _mm_srli_epi16(_mm_adds_epu16(_mm_mullo_epi16(_mm_unpackhi_epi8(e, zero), scale), round), 8);
+
+    _mm_storeu_si128((__m128i*) (out + x), _mm_packus_epi16(lo, hi));
+  }
+
+  return x;
+}
+
+
+HEIF_TARGET_SSE41
+static int expand_luma_range_row_16bit_sse41(const uint16_t* in, uint16_t* out, int width, int bit_depth)
+{
+  const __m128i offset = _mm_set1_epi16((short) (16 << (bit_depth - 8)));
+  const __m128i range = _mm_set1_epi16((short) (219 << (bit_depth - 8)));
+  const __m128i max_value = _mm_set1_epi16((short) ((1 << bit_depth) - 1));
+  const __m128i scale = _mm_set1_epi16(299);
+  const __m128i round = _mm_set1_epi32(128);
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i e = _mm_min_epu16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*) (in + x)), offset), range);
+
+    __m128i prod_lo = _mm_mullo_epi16(e, scale);
+    __m128i prod_hi = _mm_mulhi_epu16(e, scale);
+
+    __m128i p0 = _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(prod_lo, prod_hi), round), 8);
+    __m128i p1 = _mm_srli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(prod_lo, prod_hi), round), 8);
+
+    _mm_storeu_si128((__m128i*) (out + x), _mm_min_epu16(_mm_packus_epi32(p0, p1), max_value));
+  }
+
+  return x;
+}
+
+
+HEIF_TARGET_SSE41
+static int mono_to_rgb24_row_sse41(const uint8_t* luma, const uint8_t*, uint8_t* out, int width)
+{
+  const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+  const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+  const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (luma + x));
+
+    _mm_storeu_si128((__m128i*) (out + 3 * x), _mm_shuffle_epi8(v, m0));
+    _mm_storeu_si128((__m128i*) (out + 3 * x + 16), _mm_shuffle_epi8(v, m1));
+    _mm_storeu_si128((__m128i*) (out + 3 * x + 32), _mm_shuffle_epi8(v, m2));
+  }
+
+  return x;
 }
 
 
+HEIF_TARGET_SSE41
+static int mono_to_rgba_row_sse41(const uint8_t* luma, const uint8_t* alpha, uint8_t* out, int width)
+{
+  const __m128i opaque = _mm_set1_epi8((char) 0xFF);
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (luma + x));
+    __m128i a = (alpha ? _mm_loadu_si128((const __m128i*) (alpha + x)) : opaque);
+
+    __m128i vv = _mm_unpacklo_epi8(v, v);
+    __m128i va = _mm_unpacklo_epi8(v, a);
+    _mm_storeu_si128((__m128i*) (out + 4 * x), _mm_unpacklo_epi16(vv, va));
+    _mm_storeu_si128((__m128i*) (out + 4 * x + 16), _mm_unpackhi_epi16(vv, va));
+
+    vv = _mm_unpackhi_epi8(v, v);
+    va = _mm_unpackhi_epi8(v, a);
+    _mm_storeu_si128((__m128i*) (out + 4 * x + 32), _mm_unpacklo_epi16(vv, va));
+    _mm_storeu_si128((__m128i*) (out + 4 * x + 48), _mm_unpackhi_epi16(vv, va));
+  }
+
+  return x;
+}
+
+
+HEIF_TARGET_SSE41
+static int mono_to_rrggbb_row_sse41(const uint16_t* luma, const uint16_t*, uint8_t* out, int width,
+                                    uint16_t, bool big_endian)
+{
+  const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  const __m128i m0 = _mm_setr_epi8(0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 4, 5, 4, 5);
+  const __m128i m1 = _mm_setr_epi8(4, 5, 6, 7, 6, 7, 6, 7, 8, 9, 8, 9, 8, 9, 10, 11);
+  const __m128i m2 = _mm_setr_epi8(10, 11, 10, 11, 12, 13, 12, 13, 12, 13, 14, 15, 14, 15, 14, 15);
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (luma + x));
+    if (big_endian) {
+      v = _mm_shuffle_epi8(v, swap);
+    }
+
+    _mm_storeu_si128((__m128i*) (out + 6 * x), _mm_shuffle_epi8(v, m0));
+    _mm_storeu_si128((__m128i*) (out + 6 * x + 16), _mm_shuffle_epi8(v, m1));
+    _mm_storeu_si128((__m128i*) (out + 6 * x + 32), _mm_shuffle_epi8(v, m2));
+  }
+
+  return x;
+}
+
+
+HEIF_TARGET_SSE41
+static int mono_to_rrggbbaa_row_sse41(const uint16_t* luma, const uint16_t* alpha, uint8_t* out, int width,
+                                      uint16_t alpha_max, bool big_endian)
+{
+  const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  const __m128i opaque = _mm_set1_epi16((short) alpha_max);
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (luma + x));
+    __m128i a = (alpha ? _mm_loadu_si128((const __m128i*) (alpha + x)) : opaque);
+    if (big_endian) {
+      v = _mm_shuffle_epi8(v, swap);
+      a = _mm_shuffle_epi8(a, swap);
+    }
+
+    __m128i vv = _mm_unpacklo_epi16(v, v);
+    __m128i va = _mm_unpacklo_epi16(v, a);
+    _mm_storeu_si128((__m128i*) (out + 8 * x), _mm_unpacklo_epi32(vv, va));
+    _mm_storeu_si128((__m128i*) (out + 8 * x + 16), _mm_unpackhi_epi32(vv, va));
+
+    vv = _mm_unpackhi_epi16(v, v);
+    va = _mm_unpackhi_epi16(v, a);
+    _mm_storeu_si128((__m128i*) (out + 8 * x + 32), _mm_unpacklo_epi32(vv, va));
+    _mm_storeu_si128((__m128i*) (out + 8 * x + 48), _mm_unpackhi_epi32(vv, va));
+  }
+
+  return x;
+}
+
+#endif
+
+
+#if HEIF_HAVE_NEON
+
+static int expand_luma_range_row_8bit_neon(const uint8_t* in, uint8_t* out, int width)
+{
+  const uint8x16_t offset = vdupq_n_u8(16);
+  const uint8x16_t range = vdupq_n_u8(219);
+  const uint16x8_t round = vdupq_n_u16(128);
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t e = vminq_u8(vqsubq_u8(vld1q_u8(in + x), offset), range);
+
+    uint16x8_t lo = vshrq_n_u16(vqaddq_u16(vmulq_n_u16(vmovl_u8(vget_low_u8(e)), 299), round), 8);
+    uint16x8_t hi = vshrq_n_u16(vqaddq_u16(vmulq_n_u16(vmovl_u8(vget_high_u8(e)), 299), round), 8);
+
+    vst1q_u8(out + x, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+  }
+
+  return x;
+}
+
+
+static int expand_luma_range_row_16bit_neon(const uint16_t* in, uint16_t* out, int width, int bit_depth)
+{
+  const uint16x8_t offset = vdupq_n_u16((uint16_t) (16 << (bit_depth - 8)));
+  const uint16x8_t range = vdupq_n_u16((uint16_t) (219 << (bit_depth - 8)));
+  const uint16x8_t max_value = vdupq_n_u16((uint16_t) ((1 << bit_depth) - 1));
+  const uint32x4_t round = vdupq_n_u32(128);
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    uint16x8_t e = vminq_u16(vqsubq_u16(vld1q_u16(in + x), offset), range);
+
+    uint32x4_t p0 = vshrq_n_u32(vaddq_u32(vmull_n_u16(vget_low_u16(e), 299), round), 8);
+    uint32x4_t p1 = vshrq_n_u32(vaddq_u32(vmull_n_u16(vget_high_u16(e), 299), round), 8);
+
+    vst1q_u16(out + x, vminq_u16(vcombine_u16(vqmovn_u32(p0), vqmovn_u32(p1)), max_value));
+  }
+
+  return x;
+}
+
+
+static int mono_to_rgb24_row_neon(const uint8_t* luma, const uint8_t*, uint8_t* out, int width)
+{
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x3_t v;
+    v.val[0] = v.val[1] = v.val[2] = vld1q_u8(luma + x);
+    vst3q_u8(out + 3 * x, v);
+  }
+
+  return x;
+}
+
+
+static int mono_to_rgba_row_neon(const uint8_t* luma, const uint8_t* alpha, uint8_t* out, int width)
+{
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x4_t v;
+    v.val[0] = v.val[1] = v.val[2] = vld1q_u8(luma + x);
+    v.val[3] = (alpha ? vld1q_u8(alpha + x) : vdupq_n_u8(0xFF));
+    vst4q_u8(out + 4 * x, v);
+  }
+
+  return x;
+}
+
+
+static inline uint16x8_t load_samples16_neon(const uint16_t* p, bool big_endian)
+{
+  uint16x8_t v = vld1q_u16(p);
+  return big_endian ? vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v))) : v;
+}
+
+
+static int mono_to_rrggbb_row_neon(const uint16_t* luma, const uint16_t*, uint8_t* out, int width,
+                                   uint16_t, bool big_endian)
+{
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    uint16x8x3_t v;
+    v.val[0] = v.val[1] = v.val[2] = load_samples16_neon(luma + x, big_endian);
+    vst3q_u16(reinterpret_cast<uint16_t*>(out + 6 * x), v);
+  }
+
+  return x;
+}
+
+
+static int mono_to_rrggbbaa_row_neon(const uint16_t* luma, const uint16_t* alpha, uint8_t* out, int width,
+                                     uint16_t alpha_max, bool big_endian)
+{
+  uint16x8_t opaque = vdupq_n_u16(alpha_max);
+  if (big_endian) {
+    opaque = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(opaque)));
+  }
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    uint16x8x4_t v;
+    v.val[0] = v.val[1] = v.val[2] = load_samples16_neon(luma + x, big_endian);
+    v.val[3] = (alpha ? load_samples16_neon(alpha + x, big_endian) : opaque);
+    vst4q_u16(reinterpret_cast<uint16_t*>(out + 8 * x), v);
+  }
+
+  return x;
+}
+
+#endif
+
+
+void select_mono_to_RGB_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  s_kernels = Mono_to_RGB_kernels();
+
+#if HEIF_HAVE_X86_SIMD
+  if (cpu.sse41) {
+    s_kernels.expand_range_8bit = expand_luma_range_row_8bit_sse41;
+    s_kernels.expand_range_16bit = expand_luma_range_row_16bit_sse41;
+    s_kernels.to_rgb24 = mono_to_rgb24_row_sse41;
+    s_kernels.to_rgba = mono_to_rgba_row_sse41;
+    s_kernels.to_rrggbb = mono_to_rrggbb_row_sse41;
+    s_kernels.to_rrggbbaa = mono_to_rrggbbaa_row_sse41;
+  }
+#endif
+
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    s_kernels.expand_range_8bit = expand_luma_range_row_8bit_neon;
+    s_kernels.expand_range_16bit = expand_luma_range_row_16bit_neon;
+    s_kernels.to_rgb24 = mono_to_rgb24_row_neon;
+    s_kernels.to_rgba = mono_to_rgba_row_neon;
+    s_kernels.to_rrggbb = mono_to_rrggbb_row_neon;
+    s_kernels.to_rrggbbaa = mono_to_rrggbbaa_row_neon;
+  }
+#endif
+
+  (void) cpu;
+}
+
+
+const Mono_to_RGB_kernels& get_mono_to_RGB_kernels()
+{
+  return s_kernels;
+}
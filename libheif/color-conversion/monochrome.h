@@ -22,6 +22,7 @@
 #define LIBHEIF_COLORCONVERSION_MONOCHROME_H
 
 #include "colorconversion.h"
+#include <cstdint>
 #include <vector>
 #include <memory>
 
@@ -41,7 +42,10 @@ public:
 };
 
 
-class Op_mono_to_RGB24_32 : public ColorConversionOperation
+// Monochrome directly to interleaved RGB24 / RGBA (8 bit) or RRGGBB(AA)_BE/LE (>8 bit), without
+// creating gray chroma planes first. Limited-range luma is expanded to full range and the alpha
+// plane is merged into the output (or filled with the maximum value when the input has no alpha).
+class Op_mono_to_interleaved_RGB : public ColorConversionOperation
 {
 public:
   std::vector<ColorStateWithCost>
@@ -53,6 +57,61 @@ public:
   convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
                      const ColorState& target_state,
                      const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+};
+
+
+// --- row kernels
+
+// Limited to full range: out = min(max, (min(max(in - offset, 0), range) * 299 + 128) >> 8),
+// with offset = 16 and range = 219 scaled to the bit depth. This is the same luma scale (1.1689)
+// as in the YCbCr to RGB conversion.
+void expand_luma_range_row(const uint8_t* in, uint8_t* out, int width);
+
+void expand_luma_range_row(const uint16_t* in, uint16_t* out, int width, int bit_depth);
+
+// 'alpha' may be nullptr, the alpha output is then 0xFF.
+void mono_to_rgb24_row(const uint8_t* luma, uint8_t* out, int width);
+
+void mono_to_rgba_row(const uint8_t* luma, const uint8_t* alpha, uint8_t* out, int width);
+
+// 16 bit samples in big or little endian byte order. If 'alpha' is nullptr, the alpha output is 'alpha_max'.
+void mono_to_rrggbb_row(const uint16_t* luma, uint8_t* out, int width, bool big_endian);
+
+void mono_to_rrggbbaa_row(const uint16_t* luma, const uint16_t* alpha, uint8_t* out, int width,
+                          uint16_t alpha_max, bool big_endian);
+
+
+// The SIMD kernels process a prefix of the row and return the number of pixels processed.
+// The remaining pixels are converted by the scalar code.
+typedef int (* expand_luma_range_kernel_8bit)(const uint8_t* in, uint8_t* out, int width);
+
+typedef int (* expand_luma_range_kernel_16bit)(const uint16_t* in, uint16_t* out, int width, int bit_depth);
+
+typedef int (* mono_to_rgb_kernel_8bit)(const uint8_t* luma, const uint8_t* alpha, uint8_t* out, int width);
+
+typedef int (* mono_to_rgb_kernel_16bit)(const uint16_t* luma, const uint16_t* alpha, uint8_t* out, int width,
+                                         uint16_t alpha_max, bool big_endian);
+
+struct Mono_to_RGB_kernels
+{
+  expand_luma_range_kernel_8bit expand_range_8bit = nullptr;
+  expand_luma_range_kernel_16bit expand_range_16bit = nullptr;
+
+  // The RGB24 and RRGGBB kernels ignore 'alpha'.
+  mono_to_rgb_kernel_8bit to_rgb24 = nullptr;
+  mono_to_rgb_kernel_8bit to_rgba = nullptr;
+  mono_to_rgb_kernel_16bit to_rrggbb = nullptr;
+  mono_to_rgb_kernel_16bit to_rrggbbaa = nullptr;
 };
 
+// Kernels that replicate a gray plane into interleaved RGB(A). See cpu_features.h for the dispatch rules.
+const Mono_to_RGB_kernels& get_mono_to_RGB_kernels();
+
+void select_mono_to_RGB_kernels();
+
 #endif //LIBHEIF_COLORCONVERSION_MONOCHROME_H
@@ -82,6 +82,7 @@ Op_RGB_to_RGB24_32::convert_colorspace(const std::shared_ptr<const HeifPixelImag
   }
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   int width = input->get_width();
   int height = input->get_height();
@@ -94,10 +95,10 @@ Op_RGB_to_RGB24_32::convert_colorspace(const std::shared_ptr<const HeifPixelImag
   }
 
   const uint8_t* in_r, * in_g, * in_b, * in_a = nullptr;
-  int in_r_stride = 0, in_g_stride = 0, in_b_stride = 0, in_a_stride = 0;
+  size_t in_r_stride = 0, in_g_stride = 0, in_b_stride = 0, in_a_stride = 0;
 
   uint8_t* out_p;
-  int out_p_stride = 0;
+  size_t out_p_stride = 0;
 
   in_r = input->get_plane(heif_channel_R, &in_r_stride);
   in_g = input->get_plane(heif_channel_G, &in_g_stride);
@@ -213,6 +214,7 @@ Op_RGB_HDR_to_RRGGBBaa_BE::convert_colorspace(const std::shared_ptr<const HeifPi
   if (bpp <= 0) return nullptr;
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   int width = input->get_width();
   int height = input->get_height();
@@ -224,10 +226,10 @@ Op_RGB_HDR_to_RRGGBBaa_BE::convert_colorspace(const std::shared_ptr<const HeifPi
   }
 
   const uint16_t* in_r, * in_g, * in_b, * in_a = nullptr;
-  int in_r_stride = 0, in_g_stride = 0, in_b_stride = 0, in_a_stride = 0;
+  size_t in_r_stride = 0, in_g_stride = 0, in_b_stride = 0, in_a_stride = 0;
 
   uint8_t* out_p;
-  int out_p_stride = 0;
+  size_t out_p_stride = 0;
 
   in_r = (uint16_t*) input->get_plane(heif_channel_R, &in_r_stride);
   in_g = (uint16_t*) input->get_plane(heif_channel_G, &in_g_stride);
@@ -334,6 +336,7 @@ Op_RGB_to_RRGGBBaa_BE::convert_colorspace(const std::shared_ptr<const HeifPixelI
   }
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   int width = input->get_width();
   int height = input->get_height();
@@ -346,10 +349,10 @@ Op_RGB_to_RRGGBBaa_BE::convert_colorspace(const std::shared_ptr<const HeifPixelI
   }
 
   const uint8_t* in_r, * in_g, * in_b, * in_a = nullptr;
-  int in_r_stride = 0, in_g_stride = 0, in_b_stride = 0, in_a_stride = 0;
+  size_t in_r_stride = 0, in_g_stride = 0, in_b_stride = 0, in_a_stride = 0;
 
   uint8_t* out_p;
-  int out_p_stride = 0;
+  size_t out_p_stride = 0;
 
   in_r = input->get_plane(heif_channel_R, &in_r_stride);
   in_g = input->get_plane(heif_channel_G, &in_g_stride);
@@ -440,6 +443,7 @@ Op_RRGGBBaa_BE_to_RGB_HDR::convert_colorspace(const std::shared_ptr<const HeifPi
   bool want_alpha = target_state.has_alpha;
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   int width = input->get_width();
   int height = input->get_height();
@@ -460,11 +464,11 @@ Op_RRGGBBaa_BE_to_RGB_HDR::convert_colorspace(const std::shared_ptr<const HeifPi
   }
 
   const uint8_t* in_p;
-  int in_p_stride = 0;
+  size_t in_p_stride = 0;
   int in_pix_size = has_alpha ? 8 : 6;
 
   uint16_t* out_r, * out_g, * out_b, * out_a = nullptr;
-  int out_r_stride = 0, out_g_stride = 0, out_b_stride = 0, out_a_stride = 0;
+  size_t out_r_stride = 0, out_g_stride = 0, out_b_stride = 0, out_a_stride = 0;
 
   in_p = input->get_plane(heif_channel_interleaved, &in_p_stride);
 
@@ -551,6 +555,7 @@ Op_RGB24_32_to_RGB::convert_colorspace(const std::shared_ptr<const HeifPixelImag
   bool want_alpha = target_state.has_alpha;
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   int width = input->get_width();
   int height = input->get_height();
@@ -570,11 +575,11 @@ Op_RGB24_32_to_RGB::convert_colorspace(const std::shared_ptr<const HeifPixelImag
   }
 
   const uint8_t* in_p;
-  int in_p_stride = 0;
+  size_t in_p_stride = 0;
   int in_pix_size = has_alpha ? 4 : 3;
 
   uint8_t* out_r, * out_g, * out_b, * out_a = nullptr;
-  int out_r_stride = 0, out_g_stride = 0, out_b_stride = 0, out_a_stride = 0;
+  size_t out_r_stride = 0, out_g_stride = 0, out_b_stride = 0, out_a_stride = 0;
 
   in_p = input->get_plane(heif_channel_interleaved, &in_p_stride);
 
@@ -674,6 +679,7 @@ Op_RRGGBBaa_swap_endianness::convert_colorspace(const std::shared_ptr<const Heif
                                                 const heif_color_conversion_options& options) const
 {
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   int width = input->get_width();
   int height = input->get_height();
@@ -701,19 +707,18 @@ Op_RRGGBBaa_swap_endianness::convert_colorspace(const std::shared_ptr<const Heif
   }
 
   const uint8_t* in_p = nullptr;
-  int in_p_stride = 0;
+  size_t in_p_stride = 0;
 
   uint8_t* out_p;
-  int out_p_stride = 0;
+  size_t out_p_stride = 0;
 
   in_p = input->get_plane(heif_channel_interleaved, &in_p_stride);
   out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
 
-  int n_bytes = std::min(in_p_stride, out_p_stride);
+  size_t n_bytes = std::min(in_p_stride, out_p_stride);
 
-  int x, y;
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < n_bytes; x += 2) {
+  for (int y = 0; y < height; y++) {
+    for (size_t x = 0; x < n_bytes; x += 2) {
       out_p[y * out_p_stride + x + 0] = in_p[y * in_p_stride + x + 1];
       out_p[y * out_p_stride + x + 1] = in_p[y * in_p_stride + x + 0];
     }
@@ -23,10 +23,30 @@
 #include <memory>
 #include <vector>
 #include "rgb2yuv.h"
+#include "rgb2yuv_simd.h"
 #include "libheif/nclx.h"
 #include "libheif/common_utils.h"
 
 
+template<class Pixel>
+static void get_planar_kernels(typename RGB_planar_kernel_types<Pixel>::row_to_Y* to_Y,
+                               typename RGB_planar_kernel_types<Pixel>::rows_to_CbCr420* to_CbCr)
+{
+  get_RGB_to_YCbCr420_kernels().get_planar(to_Y, to_CbCr);
+}
+
+
+template<class Pixel>
+static bool planar_kernels_available(heif_chroma chroma)
+{
+  typename RGB_planar_kernel_types<Pixel>::row_to_Y to_Y;
+  typename RGB_planar_kernel_types<Pixel>::rows_to_CbCr420 to_CbCr;
+  get_planar_kernels<Pixel>(&to_Y, &to_CbCr);
+
+  return to_Y && to_CbCr && chroma == heif_chroma_420;
+}
+
+
 template<class Pixel>
 std::vector<ColorStateWithCost>
 Op_RGB_to_YCbCr<Pixel>::state_after_conversion(const ColorState& input_state,
@@ -44,6 +64,12 @@ Op_RGB_to_YCbCr<Pixel>::state_after_conversion(const ColorState& input_state,
     return {};
   }
 
+  // Do not let the pipeline search take a lossy detour through YCbCr when converting between RGB formats.
+  // It would otherwise do so when the fused YCbCr to interleaved RGB operations are cheaper than the RGB steps.
+  if (target_state.colorspace == heif_colorspace_RGB) {
+    return {};
+  }
+
   std::vector<ColorStateWithCost> states;
 
   ColorState output_state;
@@ -57,11 +83,12 @@ Op_RGB_to_YCbCr<Pixel>::state_after_conversion(const ColorState& input_state,
        !options.only_use_preferred_chroma_algorithm)) {
 
     output_state.colorspace = heif_colorspace_YCbCr;
-    output_state.chroma = target_state.chroma;
+    // the semi-planar formats are reached from planar 4:2:0
+    output_state.chroma = (is_semi_planar_chroma(target_state.chroma) ? heif_chroma_420 : target_state.chroma);
     output_state.has_alpha = input_state.has_alpha;  // we simply keep the old alpha plane
     output_state.bits_per_pixel = input_state.bits_per_pixel;
 
-    states.push_back({output_state, SpeedCosts_Unoptimized});
+    states.push_back({output_state, planar_kernels_available<Pixel>(output_state.chroma) ? SpeedCosts_OptimizedSoftware : SpeedCosts_Unoptimized});
   }
   else {
     // --- convert to YCbCr 4:4:4
@@ -105,6 +132,7 @@ Op_RGB_to_YCbCr<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
   }
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(width, height, heif_colorspace_YCbCr, chroma);
 
@@ -124,10 +152,10 @@ Op_RGB_to_YCbCr<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
   }
 
   const Pixel* in_r, * in_g, * in_b, * in_a;
-  int in_r_stride = 0, in_g_stride = 0, in_b_stride = 0, in_a_stride = 0;
+  size_t in_r_stride = 0, in_g_stride = 0, in_b_stride = 0, in_a_stride = 0;
 
   Pixel* out_y, * out_cb, * out_cr, * out_a;
-  int out_y_stride = 0, out_cb_stride = 0, out_cr_stride = 0, out_a_stride = 0;
+  size_t out_y_stride = 0, out_cb_stride = 0, out_cr_stride = 0, out_a_stride = 0;
 
   in_r = (const Pixel*) input->get_plane(heif_channel_R, &in_r_stride);
   in_g = (const Pixel*) input->get_plane(heif_channel_G, &in_g_stride);
@@ -166,14 +194,34 @@ Op_RGB_to_YCbCr<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
   if (target_state.nclx_profile) {
     full_range_flag = target_state.nclx_profile->get_full_range_flag();
     matrix_coeffs = target_state.nclx_profile->get_matrix_coefficients();
-    coeffs = get_RGB_to_YCbCr_coefficients(target_state.nclx_profile->get_matrix_coefficients(),
-                                           target_state.nclx_profile->get_colour_primaries());
+    coeffs = get_color_conversion_coefficients(target_state.nclx_profile->get_matrix_coefficients(),
+                                               target_state.nclx_profile->get_colour_primaries(),
+                                               full_range_flag, bpp).rgb_to_ycbcr;
+  }
+
+  typename RGB_planar_kernel_types<Pixel>::row_to_Y simd_to_Y = nullptr;
+  typename RGB_planar_kernel_types<Pixel>::rows_to_CbCr420 simd_to_CbCr = nullptr;
+  if (matrix_coeffs != 0) {
+    get_planar_kernels<Pixel>(&simd_to_Y, &simd_to_CbCr);
   }
 
+  RGB_to_YCbCr_kernel_params simd_params;
+  simd_params.coeffs = coeffs;
+  simd_params.full_range = full_range_flag;
+  simd_params.max_value = fullRange;
+  simd_params.half_range = halfRange;
+  simd_params.limited_range_offset = limited_range_offset;
+
   int x, y;
 
   for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
+    x = 0;
+    if (simd_to_Y) {
+      x = simd_to_Y(in_r + y * in_r_stride, in_g + y * in_g_stride, in_b + y * in_b_stride,
+                    out_y + y * out_y_stride, width, simd_params);
+    }
+
+    for (; x < width; x++) {
       if (matrix_coeffs == 0) {
         if (full_range_flag) {
           out_y[y * out_y_stride + x] = in_g[y * in_g_stride + x];
@@ -201,7 +249,15 @@ Op_RGB_to_YCbCr<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
   }
 
   for (y = 0; y < height; y += subV) {
-    for (x = 0; x < width; x += subH) {
+    x = 0;
+    if (simd_to_CbCr && subH == 2 && subV == 2 && y + 1 < height) {
+      x = 2 * simd_to_CbCr(in_r + y * in_r_stride, in_g + y * in_g_stride, in_b + y * in_b_stride,
+                           in_r + (y + 1) * in_r_stride, in_g + (y + 1) * in_g_stride, in_b + (y + 1) * in_b_stride,
+                           out_cb + (y / 2) * out_cb_stride, out_cr + (y / 2) * out_cr_stride,
+                           width / 2, simd_params);
+    }
+
+    for (; x < width; x += subH) {
       if (matrix_coeffs == 0) {
         if (full_range_flag) {
           out_cb[(y / subV) * out_cb_stride + (x / subH)] = in_b[y * in_b_stride + x];
@@ -304,7 +360,8 @@ Op_RRGGBBxx_HDR_to_YCbCr420::state_after_conversion(const ColorState& input_stat
     }
   }
 
-  if (target_state.chroma != heif_chroma_420) {
+  if (target_state.chroma != heif_chroma_420 &&
+      !is_semi_planar_chroma(target_state.chroma)) {
     return {};
   }
 
@@ -340,6 +397,7 @@ Op_RRGGBBxx_HDR_to_YCbCr420::convert_colorspace(const std::shared_ptr<const Heif
                     input->get_chroma_format() == heif_chroma_interleaved_RRGGBBAA_LE);
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(width, height, heif_colorspace_YCbCr, heif_chroma_420);
 
@@ -361,10 +419,10 @@ Op_RRGGBBxx_HDR_to_YCbCr420::convert_colorspace(const std::shared_ptr<const Heif
   }
 
   const uint8_t* in_p;
-  int in_p_stride = 0;
+  size_t in_p_stride = 0;
 
   uint16_t* out_y, * out_cb, * out_cr, * out_a = nullptr;
-  int out_y_stride = 0, out_cb_stride = 0, out_cr_stride = 0, out_a_stride = 0;
+  size_t out_y_stride = 0, out_cb_stride = 0, out_cr_stride = 0, out_a_stride = 0;
 
   in_p = input->get_plane(heif_channel_interleaved, &in_p_stride);
   out_y = (uint16_t*) outimg->get_plane(heif_channel_Y, &out_y_stride);
@@ -395,8 +453,9 @@ Op_RRGGBBxx_HDR_to_YCbCr420::convert_colorspace(const std::shared_ptr<const Heif
   bool full_range_flag = true;
   if (colorProfile) {
     full_range_flag = target_state.nclx_profile->get_full_range_flag();
-    coeffs = get_RGB_to_YCbCr_coefficients(colorProfile->get_matrix_coefficients(),
-                                           colorProfile->get_colour_primaries());
+    coeffs = get_color_conversion_coefficients(colorProfile->get_matrix_coefficients(),
+                                               colorProfile->get_colour_primaries(),
+                                               full_range_flag, bpp).rgb_to_ycbcr;
   }
 
   for (int y = 0; y < height; y++) {
@@ -432,7 +491,7 @@ Op_RRGGBBxx_HDR_to_YCbCr420::convert_colorspace(const std::shared_ptr<const Heif
       float b = static_cast<float>((in[4 + le] << 8) | in[5 - le]);
 
       int dx = (x + 1 < width) ? bytesPerPixel : 0;
-      int dy = (y + 1 < height) ? in_p_stride : 0;
+      size_t dy = (y + 1 < height) ? in_p_stride : 0;
 
       r += static_cast<float>((in[0 + le + dx] << 8) | in[1 - le + dx]);
       g += static_cast<float>((in[2 + le + dx] << 8) | in[3 - le + dx]);
@@ -491,7 +550,8 @@ Op_RGB24_32_to_YCbCr::state_after_conversion(const ColorState& input_state,
 
   if (target_state.chroma != heif_chroma_420 &&
       target_state.chroma != heif_chroma_422 &&
-      target_state.chroma != heif_chroma_444) {
+      target_state.chroma != heif_chroma_444 &&
+      !is_semi_planar_chroma(target_state.chroma)) {
     return {};
   }
 
@@ -506,11 +566,14 @@ Op_RGB24_32_to_YCbCr::state_after_conversion(const ColorState& input_state,
   ColorState output_state;
 
   output_state.colorspace = heif_colorspace_YCbCr;
-  output_state.chroma = target_state.chroma;
+  output_state.chroma = (is_semi_planar_chroma(target_state.chroma) ? heif_chroma_420 : target_state.chroma);
   output_state.has_alpha = target_state.has_alpha;
   output_state.bits_per_pixel = 8;
 
-  states.push_back({output_state, SpeedCosts_Unoptimized});
+  const RGB_to_YCbCr420_kernels& kernels = get_RGB_to_YCbCr420_kernels();
+  bool have_simd = (kernels.interleaved_to_Y && kernels.interleaved_to_CbCr420 && output_state.chroma == heif_chroma_420);
+
+  states.push_back({output_state, have_simd ? SpeedCosts_OptimizedSoftware : SpeedCosts_Unoptimized});
 
   return states;
 }
@@ -544,6 +607,7 @@ Op_RGB24_32_to_YCbCr::convert_colorspace(const std::shared_ptr<const HeifPixelIm
   int height = input->get_height();
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   auto chroma = target_state.chroma;
   uint8_t chromaSubH = chroma_h_subsampling(chroma);
@@ -570,10 +634,10 @@ Op_RGB24_32_to_YCbCr::convert_colorspace(const std::shared_ptr<const HeifPixelIm
   }
 
   uint8_t* out_cb, * out_cr, * out_y, * out_a;
-  int out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0, out_a_stride = 0;
+  size_t out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0, out_a_stride = 0;
 
   const uint8_t* in_p;
-  int in_stride = 0;
+  size_t in_stride = 0;
 
   in_p = input->get_plane(heif_channel_interleaved, &in_stride);
 
@@ -593,17 +657,30 @@ Op_RGB24_32_to_YCbCr::convert_colorspace(const std::shared_ptr<const HeifPixelIm
   bool full_range_flag = true;
   if (target_state.nclx_profile) {
     full_range_flag = target_state.nclx_profile->get_full_range_flag();
-    coeffs = get_RGB_to_YCbCr_coefficients(target_state.nclx_profile->get_matrix_coefficients(),
-                                           target_state.nclx_profile->get_colour_primaries());
+    coeffs = get_color_conversion_coefficients(target_state.nclx_profile->get_matrix_coefficients(),
+                                               target_state.nclx_profile->get_colour_primaries(),
+                                               full_range_flag, 8).rgb_to_ycbcr;
   }
 
 
   int bytes_per_pixel = (has_alpha ? 4 : 3);
 
+  const RGB_to_YCbCr420_kernels& kernels = get_RGB_to_YCbCr420_kernels();
+
+  RGB_to_YCbCr_kernel_params simd_params;
+  simd_params.coeffs = coeffs;
+  simd_params.full_range = full_range_flag;
+
   for (int y = 0; y < height; y++) {
     const uint8_t* p = &in_p[y * in_stride];
 
-    for (int x = 0; x < width; x++) {
+    int x = 0;
+    if (kernels.interleaved_to_Y) {
+      x = kernels.interleaved_to_Y(p, bytes_per_pixel, out_y + y * out_y_stride, width, simd_params);
+      p += x * bytes_per_pixel;
+    }
+
+    for (; x < width; x++) {
       uint8_t r = p[0];
       uint8_t g = p[1];
       uint8_t b = p[2];
@@ -645,7 +722,15 @@ Op_RGB24_32_to_YCbCr::convert_colorspace(const std::shared_ptr<const HeifPixelIm
     for (int y = 0; y < (height & ~1); y += 2) {
       const uint8_t* p = &in_p[y * in_stride];
 
-      for (int x = 0; x < (width & ~1); x += 2) {
+      int x = 0;
+      if (kernels.interleaved_to_CbCr420) {
+        x = 2 * kernels.interleaved_to_CbCr420(p, p + in_stride, bytes_per_pixel,
+                                               out_cb + (y / 2) * out_cb_stride, out_cr + (y / 2) * out_cr_stride,
+                                               width / 2, simd_params);
+        p += x * bytes_per_pixel;
+      }
+
+      for (; x < (width & ~1); x += 2) {
         uint8_t r = uint8_t((p[0] + p[bytes_per_pixel + 0] + p[in_stride + 0] + p[bytes_per_pixel + in_stride + 0]) / 4);
         uint8_t g = uint8_t((p[1] + p[bytes_per_pixel + 1] + p[in_stride + 1] + p[bytes_per_pixel + in_stride + 1]) / 4);
         uint8_t b = uint8_t((p[2] + p[bytes_per_pixel + 2] + p[in_stride + 2] + p[bytes_per_pixel + in_stride + 2]) / 4);
@@ -820,6 +905,7 @@ Op_RGB24_32_to_YCbCr444_GBR::convert_colorspace(const std::shared_ptr<const Heif
   int height = input->get_height();
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(width, height, heif_colorspace_YCbCr, heif_chroma_444);
 
@@ -839,10 +925,10 @@ Op_RGB24_32_to_YCbCr444_GBR::convert_colorspace(const std::shared_ptr<const Heif
   }
 
   uint8_t* out_cb, * out_cr, * out_y, * out_a;
-  int out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0, out_a_stride = 0;
+  size_t out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0, out_a_stride = 0;
 
   const uint8_t* in_p;
-  int in_stride = 0;
+  size_t in_stride = 0;
 
   in_p = input->get_plane(heif_channel_interleaved, &in_stride);
 
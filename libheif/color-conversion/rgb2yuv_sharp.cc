@@ -62,8 +62,10 @@ Op_Any_RGB_to_YCbCr_420_Sharp::state_after_conversion(
 
   // Note: no input alpha channel required. It will be filled up with 0xFF.
 
+  // the fast conversion skips sharp YUV, unless it was requested with 'only_use_preferred_chroma_algorithm'
   if (options.preferred_chroma_downsampling_algorithm != heif_chroma_downsampling_sharp_yuv &&
-      options.only_use_preferred_chroma_algorithm) {
+      (options.only_use_preferred_chroma_algorithm ||
+       options.conversion_accuracy == heif_color_conversion_accuracy_fast)) {
     return {};
   }
 
@@ -95,7 +97,8 @@ Op_Any_RGB_to_YCbCr_420_Sharp::state_after_conversion(
     return {};
   }
 
-  if (target_state.chroma != heif_chroma_420) {
+  if (target_state.chroma != heif_chroma_420 &&
+      !is_semi_planar_chroma(target_state.chroma)) {
     return {};
   }
 
@@ -132,6 +135,7 @@ Op_Any_RGB_to_YCbCr_420_Sharp::convert_colorspace(
   int height = input->get_height();
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   heif_chroma input_chroma = input->get_chroma_format();
   heif_chroma output_chroma = target_state.chroma;
@@ -174,12 +178,12 @@ Op_Any_RGB_to_YCbCr_420_Sharp::convert_colorspace(
       : 2;
 
   const uint8_t* in_r, * in_g, * in_b, * in_a = nullptr;
-  int in_stride = 0;
-  int in_a_stride = 0;
+  size_t in_stride = 0;
+  size_t in_a_stride = 0;
   bool planar_input = input_chroma == heif_chroma_444;
   int input_bits = 0;
   if (planar_input) {
-    int in_r_stride = 0, in_g_stride = 0, in_b_stride = 0;
+    size_t in_r_stride = 0, in_g_stride = 0, in_b_stride = 0;
     in_r = input->get_plane(heif_channel_R, &in_r_stride);
     in_g = input->get_plane(heif_channel_G, &in_g_stride);
     in_b = input->get_plane(heif_channel_B, &in_b_stride);
@@ -210,7 +214,7 @@ Op_Any_RGB_to_YCbCr_420_Sharp::convert_colorspace(
     }
   }
 
-  int out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0;
+  size_t out_cb_stride = 0, out_cr_stride = 0, out_y_stride = 0;
   uint8_t* out_y = outimg->get_plane(heif_channel_Y, &out_y_stride);
   uint8_t* out_cb = outimg->get_plane(heif_channel_Cb, &out_cb_stride);
   uint8_t* out_cr = outimg->get_plane(heif_channel_Cr, &out_cr_stride);
@@ -219,9 +223,9 @@ Op_Any_RGB_to_YCbCr_420_Sharp::convert_colorspace(
   Kr_Kb kr_kb = Kr_Kb::defaults();
   if (target_state.nclx_profile) {
     full_range_flag = target_state.nclx_profile->get_full_range_flag();
-    kr_kb =
-        get_Kr_Kb(target_state.nclx_profile->get_matrix_coefficients(),
-                  target_state.nclx_profile->get_colour_primaries());
+    kr_kb = get_color_conversion_coefficients(target_state.nclx_profile->get_matrix_coefficients(),
+                                              target_state.nclx_profile->get_colour_primaries(),
+                                              full_range_flag, output_bits).kr_kb;
   }
 
   SharpYuvColorSpace color_space = {
@@ -247,7 +251,7 @@ Op_Any_RGB_to_YCbCr_420_Sharp::convert_colorspace(
               (planar_input && !PlatformIsBigEndian()))
              ? 1
              : 0;
-    int out_a_stride;
+    size_t out_a_stride;
 
     uint8_t* out_a = outimg->get_plane(heif_channel_Alpha, &out_a_stride);
     uint16_t alpha_max = static_cast<uint16_t>((1 << input_bits) - 1);
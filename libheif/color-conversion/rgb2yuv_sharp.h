@@ -38,6 +38,10 @@ public:
   convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
                      const ColorState& target_state,
                      const heif_color_conversion_options& options) const override;
+
+  // Sharp YUV filters across rows, but the influence of distant rows is negligible.
+  // Bands are converted with enough context rows above and below.
+  int get_row_band_overlap() const override { return 32; }
 };
 
 
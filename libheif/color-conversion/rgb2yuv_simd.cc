@@ -0,0 +1,561 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rgb2yuv_simd.h"
+#include "libheif/cpu_features.h"
+
+#if HEIF_HAVE_X86_AVX
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+static RGB_to_YCbCr420_kernels s_kernels;
+
+
+#if HEIF_HAVE_X86_AVX
+
+// --- AVX2
+//
+// All kernels work on 8 pixels (or 8 chroma samples) as 32-bit lanes.
+// Note: the "avx2" target does not include FMA, hence the multiplications and additions are
+// not fused and round exactly like the scalar code.
+
+// c[0]*r + c[1]*g + c[2]*b, evaluated in the same order as the scalar code
+HEIF_TARGET_AVX2
+static inline __m256 dot_avx2(__m256 r, __m256 g, __m256 b, const float* c)
+{
+  __m256 v = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(c[0])),
+                           _mm256_mul_ps(g, _mm256_set1_ps(c[1])));
+  return _mm256_add_ps(v, _mm256_mul_ps(b, _mm256_set1_ps(c[2])));
+}
+
+
+// (long)(v + 0.5f) as in clip_f_u8() / clip_f_u16()
+HEIF_TARGET_AVX2
+static inline __m256i round_avx2(__m256 v)
+{
+  return _mm256_cvttps_epi32(_mm256_add_ps(v, _mm256_set1_ps(0.5f)));
+}
+
+
+HEIF_TARGET_AVX2
+static inline __m256i clamp_avx2(__m256i v, int32_t maxi)
+{
+  return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()), _mm256_set1_epi32(maxi));
+}
+
+
+// Stores 8 values, saturated to [0;255].
+HEIF_TARGET_AVX2
+static inline void store_avx2(uint8_t* out, __m256i v)
+{
+  __m128i v16 = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  _mm_storel_epi64((__m128i*) out, _mm_packus_epi16(v16, v16));
+}
+
+
+// Stores 8 values, saturated to [0;65535].
+HEIF_TARGET_AVX2
+static inline void store_avx2(uint16_t* out, __m256i v)
+{
+  __m128i v16 = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  _mm_storeu_si128((__m128i*) out, v16);
+}
+
+
+HEIF_TARGET_AVX2
+static inline __m256i load_avx2(const uint8_t* in)
+{
+  return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) in));
+}
+
+
+HEIF_TARGET_AVX2
+static inline __m256i load_avx2(const uint16_t* in)
+{
+  return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) in));
+}
+
+
+// Sums of horizontally adjacent values of a (pixels 0-7) and b (pixels 8-15).
+HEIF_TARGET_AVX2
+static inline __m256i add_pairs_avx2(__m256i a, __m256i b)
+{
+  // hadd works within the 128-bit lanes: a01 a23 b01 b23 | a45 a67 b45 b67
+  return _mm256_permute4x64_epi64(_mm256_hadd_epi32(a, b), 0xD8);
+}
+
+
+// Shuffle masks that extract the R, G, B bytes of four interleaved pixels into 32-bit lanes.
+struct InterleavedMasks_avx2
+{
+  __m256i channel[3];
+};
+
+
+HEIF_TARGET_AVX2
+static inline InterleavedMasks_avx2 get_interleaved_masks_avx2(int bytes_per_pixel)
+{
+  InterleavedMasks_avx2 masks;
+
+  for (int c = 0; c < 3; c++) {
+    int8_t m[32];
+    for (int i = 0; i < 32; i++) {
+      m[i] = (i % 4 == 0) ? (int8_t) (c + bytes_per_pixel * ((i % 16) / 4)) : (int8_t) -1;
+    }
+
+    masks.channel[c] = _mm256_loadu_si256((const __m256i*) m);
+  }
+
+  return masks;
+}
+
+
+// Loads 8 interleaved pixels. For RGB24, this reads 4 bytes beyond the last pixel.
+HEIF_TARGET_AVX2
+static inline void load_interleaved_avx2(const uint8_t* in, int bytes_per_pixel,
+                                         const InterleavedMasks_avx2& masks,
+                                         __m256i* r, __m256i* g, __m256i* b)
+{
+  __m128i lo = _mm_loadu_si128((const __m128i*) in);
+  __m128i hi = _mm_loadu_si128((const __m128i*) (in + 4 * bytes_per_pixel));
+  __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+  *r = _mm256_shuffle_epi8(v, masks.channel[0]);
+  *g = _mm256_shuffle_epi8(v, masks.channel[1]);
+  *b = _mm256_shuffle_epi8(v, masks.channel[2]);
+}
+
+
+HEIF_TARGET_AVX2
+static int RGB24_32_row_to_Y_avx2(const uint8_t* in, int bytes_per_pixel,
+                                  uint8_t* out_y, int width,
+                                  const RGB_to_YCbCr_kernel_params& params)
+{
+  const InterleavedMasks_avx2 masks = get_interleaved_masks_avx2(bytes_per_pixel);
+
+  // keep the over-read of load_interleaved_avx2() within the row
+  const int reserve = (bytes_per_pixel == 3) ? 2 : 0;
+
+  int x = 0;
+  for (; x + 8 + reserve <= width; x += 8) {
+    __m256i r, g, b;
+    load_interleaved_avx2(in + x * bytes_per_pixel, bytes_per_pixel, masks, &r, &g, &b);
+
+    __m256 yv = dot_avx2(_mm256_cvtepi32_ps(r), _mm256_cvtepi32_ps(g), _mm256_cvtepi32_ps(b), params.coeffs.c[0]);
+
+    __m256i y;
+    if (params.full_range) {
+      y = round_avx2(yv);
+    }
+    else {
+      y = clamp_avx2(round_avx2(_mm256_mul_ps(yv, _mm256_set1_ps(0.85547f))), 219);
+      y = _mm256_add_epi32(y, _mm256_set1_epi32(16));
+    }
+
+    store_avx2(out_y + x, y);
+  }
+
+  return x;
+}
+
+
+HEIF_TARGET_AVX2
+static int RGB24_32_rows_to_CbCr420_avx2(const uint8_t* in0, const uint8_t* in1, int bytes_per_pixel,
+                                         uint8_t* out_cb, uint8_t* out_cr, int num_chroma,
+                                         const RGB_to_YCbCr_kernel_params& params)
+{
+  const InterleavedMasks_avx2 masks = get_interleaved_masks_avx2(bytes_per_pixel);
+  const int reserve = (bytes_per_pixel == 3) ? 2 : 0;
+
+  const __m256 half_range = _mm256_set1_ps(128.0f);
+  const __m256 limited_scale = _mm256_set1_ps(0.875f);
+
+  int x = 0;
+  for (; 2 * (x + 8) + reserve <= 2 * num_chroma; x += 8) {
+    const uint8_t* p0 = in0 + 2 * x * bytes_per_pixel;
+    const uint8_t* p1 = in1 + 2 * x * bytes_per_pixel;
+
+    __m256i r[4], g[4], b[4];
+    load_interleaved_avx2(p0, bytes_per_pixel, masks, &r[0], &g[0], &b[0]);
+    load_interleaved_avx2(p0 + 8 * bytes_per_pixel, bytes_per_pixel, masks, &r[1], &g[1], &b[1]);
+    load_interleaved_avx2(p1, bytes_per_pixel, masks, &r[2], &g[2], &b[2]);
+    load_interleaved_avx2(p1 + 8 * bytes_per_pixel, bytes_per_pixel, masks, &r[3], &g[3], &b[3]);
+
+    // integer average of the 2x2 block, as in the scalar code
+    __m256i rs = _mm256_srli_epi32(add_pairs_avx2(_mm256_add_epi32(r[0], r[2]), _mm256_add_epi32(r[1], r[3])), 2);
+    __m256i gs = _mm256_srli_epi32(add_pairs_avx2(_mm256_add_epi32(g[0], g[2]), _mm256_add_epi32(g[1], g[3])), 2);
+    __m256i bs = _mm256_srli_epi32(add_pairs_avx2(_mm256_add_epi32(b[0], b[2]), _mm256_add_epi32(b[1], b[3])), 2);
+
+    __m256 rf = _mm256_cvtepi32_ps(rs);
+    __m256 gf = _mm256_cvtepi32_ps(gs);
+    __m256 bf = _mm256_cvtepi32_ps(bs);
+
+    __m256 cb = dot_avx2(rf, gf, bf, params.coeffs.c[1]);
+    __m256 cr = dot_avx2(rf, gf, bf, params.coeffs.c[2]);
+
+    if (!params.full_range) {
+      cb = _mm256_mul_ps(cb, limited_scale);
+      cr = _mm256_mul_ps(cr, limited_scale);
+    }
+
+    store_avx2(out_cb + x, round_avx2(_mm256_add_ps(cb, half_range)));
+    store_avx2(out_cr + x, round_avx2(_mm256_add_ps(cr, half_range)));
+  }
+
+  return x;
+}
+
+
+template<class Pixel>
+HEIF_TARGET_AVX2
+static int RGB_planar_row_to_Y_avx2(const Pixel* in_r, const Pixel* in_g, const Pixel* in_b,
+                                    Pixel* out_y, int width,
+                                    const RGB_to_YCbCr_kernel_params& params)
+{
+  // x/256 and x*(1/256) are identical for floats
+  const __m256 limited_scale = _mm256_set1_ps(219.0f);
+  const __m256 div256 = _mm256_set1_ps(1.0f / 256);
+  const __m256 limited_offset = _mm256_set1_ps(params.limited_range_offset);
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256 r = _mm256_cvtepi32_ps(load_avx2(in_r + x));
+    __m256 g = _mm256_cvtepi32_ps(load_avx2(in_g + x));
+    __m256 b = _mm256_cvtepi32_ps(load_avx2(in_b + x));
+
+    __m256 v = dot_avx2(r, g, b, params.coeffs.c[0]);
+    if (!params.full_range) {
+      v = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(v, limited_scale), div256), limited_offset);
+    }
+
+    store_avx2(out_y + x, clamp_avx2(round_avx2(v), params.max_value));
+  }
+
+  return x;
+}
+
+
+template<class Pixel>
+HEIF_TARGET_AVX2
+static int RGB_planar_rows_to_CbCr420_avx2(const Pixel* r0, const Pixel* g0, const Pixel* b0,
+                                           const Pixel* r1, const Pixel* g1, const Pixel* b1,
+                                           Pixel* out_cb, Pixel* out_cr, int num_chroma,
+                                           const RGB_to_YCbCr_kernel_params& params)
+{
+  const __m256 quarter = _mm256_set1_ps(0.25f);
+  const __m256 limited_scale = _mm256_set1_ps(224.0f);
+  const __m256 div256 = _mm256_set1_ps(1.0f / 256);
+  const __m256 half_range = _mm256_set1_ps(params.half_range);
+
+  int x = 0;
+  for (; x + 8 <= num_chroma; x += 8) {
+    int px = 2 * x;
+
+    // The scalar code sums the four pixels in float, which is exact for integers of this size.
+    __m256i rs = add_pairs_avx2(_mm256_add_epi32(load_avx2(r0 + px), load_avx2(r1 + px)),
+                                _mm256_add_epi32(load_avx2(r0 + px + 8), load_avx2(r1 + px + 8)));
+    __m256i gs = add_pairs_avx2(_mm256_add_epi32(load_avx2(g0 + px), load_avx2(g1 + px)),
+                                _mm256_add_epi32(load_avx2(g0 + px + 8), load_avx2(g1 + px + 8)));
+    __m256i bs = add_pairs_avx2(_mm256_add_epi32(load_avx2(b0 + px), load_avx2(b1 + px)),
+                                _mm256_add_epi32(load_avx2(b0 + px + 8), load_avx2(b1 + px + 8)));
+
+    __m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(rs), quarter);
+    __m256 g = _mm256_mul_ps(_mm256_cvtepi32_ps(gs), quarter);
+    __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(bs), quarter);
+
+    __m256 cb = dot_avx2(r, g, b, params.coeffs.c[1]);
+    __m256 cr = dot_avx2(r, g, b, params.coeffs.c[2]);
+
+    if (!params.full_range) {
+      cb = _mm256_mul_ps(_mm256_mul_ps(cb, limited_scale), div256);
+      cr = _mm256_mul_ps(_mm256_mul_ps(cr, limited_scale), div256);
+    }
+
+    store_avx2(out_cb + x, clamp_avx2(round_avx2(_mm256_add_ps(cb, half_range)), params.max_value));
+    store_avx2(out_cr + x, clamp_avx2(round_avx2(_mm256_add_ps(cr, half_range)), params.max_value));
+  }
+
+  return x;
+}
+
+#endif
+
+
+#if HEIF_HAVE_NEON
+
+// --- NEON
+//
+// As for AVX2, the kernels work on 8 pixels, stored in two float32x4 vectors.
+
+struct f32x8_neon
+{
+  float32x4_t lo, hi;
+};
+
+
+static inline f32x8_neon to_float_neon(uint16x8_t v)
+{
+  return {vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))),
+          vcvtq_f32_u32(vmovl_u16(vget_high_u16(v)))};
+}
+
+
+static inline f32x8_neon to_float_neon(uint32x4_t lo, uint32x4_t hi)
+{
+  return {vcvtq_f32_u32(lo), vcvtq_f32_u32(hi)};
+}
+
+
+static inline f32x8_neon dot_neon(const f32x8_neon& r, const f32x8_neon& g, const f32x8_neon& b, const float* c)
+{
+  return {vaddq_f32(vaddq_f32(vmulq_n_f32(r.lo, c[0]), vmulq_n_f32(g.lo, c[1])), vmulq_n_f32(b.lo, c[2])),
+          vaddq_f32(vaddq_f32(vmulq_n_f32(r.hi, c[0]), vmulq_n_f32(g.hi, c[1])), vmulq_n_f32(b.hi, c[2]))};
+}
+
+
+static inline f32x8_neon mul_neon(const f32x8_neon& v, float f)
+{
+  return {vmulq_n_f32(v.lo, f), vmulq_n_f32(v.hi, f)};
+}
+
+
+static inline f32x8_neon add_neon(const f32x8_neon& v, float f)
+{
+  float32x4_t vf = vdupq_n_f32(f);
+  return {vaddq_f32(v.lo, vf), vaddq_f32(v.hi, vf)};
+}
+
+
+// (long)(v + 0.5f) as in clip_f_u8() / clip_f_u16(), saturated to [0;65535].
+static inline uint16x8_t round_neon(const f32x8_neon& v)
+{
+  float32x4_t half = vdupq_n_f32(0.5f);
+  return vcombine_u16(vqmovun_s32(vcvtq_s32_f32(vaddq_f32(v.lo, half))),
+                      vqmovun_s32(vcvtq_s32_f32(vaddq_f32(v.hi, half))));
+}
+
+
+static inline void store_neon(uint8_t* out, uint16x8_t v, int32_t maxi)
+{
+  vst1_u8(out, vqmovn_u16(vminq_u16(v, vdupq_n_u16((uint16_t) maxi))));
+}
+
+
+static inline void store_neon(uint16_t* out, uint16x8_t v, int32_t maxi)
+{
+  vst1q_u16(out, vminq_u16(v, vdupq_n_u16((uint16_t) maxi)));
+}
+
+
+static inline f32x8_neon load_neon(const uint8_t* in)
+{
+  return to_float_neon(vmovl_u8(vld1_u8(in)));
+}
+
+
+static inline f32x8_neon load_neon(const uint16_t* in)
+{
+  return to_float_neon(vld1q_u16(in));
+}
+
+
+// sums of two rows of 16 pixels, each horizontally adjacent pair added
+static inline f32x8_neon load_pair_sums_neon(const uint8_t* in0, const uint8_t* in1)
+{
+  return to_float_neon(vaddq_u16(vpaddlq_u8(vld1q_u8(in0)), vpaddlq_u8(vld1q_u8(in1))));
+}
+
+
+static inline f32x8_neon load_pair_sums_neon(const uint16_t* in0, const uint16_t* in1)
+{
+  return to_float_neon(vaddq_u32(vpaddlq_u16(vld1q_u16(in0)), vpaddlq_u16(vld1q_u16(in1))),
+                       vaddq_u32(vpaddlq_u16(vld1q_u16(in0 + 8)), vpaddlq_u16(vld1q_u16(in1 + 8))));
+}
+
+
+static int RGB24_32_row_to_Y_neon(const uint8_t* in, int bytes_per_pixel,
+                                  uint8_t* out_y, int width,
+                                  const RGB_to_YCbCr_kernel_params& params)
+{
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    uint8x8_t r, g, b;
+    if (bytes_per_pixel == 3) {
+      uint8x8x3_t rgb = vld3_u8(in + 3 * x);
+      r = rgb.val[0];
+      g = rgb.val[1];
+      b = rgb.val[2];
+    }
+    else {
+      uint8x8x4_t rgba = vld4_u8(in + 4 * x);
+      r = rgba.val[0];
+      g = rgba.val[1];
+      b = rgba.val[2];
+    }
+
+    f32x8_neon yv = dot_neon(to_float_neon(vmovl_u8(r)), to_float_neon(vmovl_u8(g)), to_float_neon(vmovl_u8(b)),
+                             params.coeffs.c[0]);
+
+    if (params.full_range) {
+      store_neon(out_y + x, round_neon(yv), 255);
+    }
+    else {
+      uint16x8_t y = vminq_u16(round_neon(mul_neon(yv, 0.85547f)), vdupq_n_u16(219));
+      vst1_u8(out_y + x, vqmovn_u16(vaddq_u16(y, vdupq_n_u16(16))));
+    }
+  }
+
+  return x;
+}
+
+
+static int RGB24_32_rows_to_CbCr420_neon(const uint8_t* in0, const uint8_t* in1, int bytes_per_pixel,
+                                         uint8_t* out_cb, uint8_t* out_cr, int num_chroma,
+                                         const RGB_to_YCbCr_kernel_params& params)
+{
+  int x = 0;
+  for (; x + 8 <= num_chroma; x += 8) {
+    uint8x16_t r0, g0, b0, r1, g1, b1;
+    if (bytes_per_pixel == 3) {
+      uint8x16x3_t p0 = vld3q_u8(in0 + 6 * x);
+      uint8x16x3_t p1 = vld3q_u8(in1 + 6 * x);
+      r0 = p0.val[0], g0 = p0.val[1], b0 = p0.val[2];
+      r1 = p1.val[0], g1 = p1.val[1], b1 = p1.val[2];
+    }
+    else {
+      uint8x16x4_t p0 = vld4q_u8(in0 + 8 * x);
+      uint8x16x4_t p1 = vld4q_u8(in1 + 8 * x);
+      r0 = p0.val[0], g0 = p0.val[1], b0 = p0.val[2];
+      r1 = p1.val[0], g1 = p1.val[1], b1 = p1.val[2];
+    }
+
+    // integer average of the 2x2 block, as in the scalar code
+    f32x8_neon r = to_float_neon(vshrq_n_u16(vaddq_u16(vpaddlq_u8(r0), vpaddlq_u8(r1)), 2));
+    f32x8_neon g = to_float_neon(vshrq_n_u16(vaddq_u16(vpaddlq_u8(g0), vpaddlq_u8(g1)), 2));
+    f32x8_neon b = to_float_neon(vshrq_n_u16(vaddq_u16(vpaddlq_u8(b0), vpaddlq_u8(b1)), 2));
+
+    f32x8_neon cb = dot_neon(r, g, b, params.coeffs.c[1]);
+    f32x8_neon cr = dot_neon(r, g, b, params.coeffs.c[2]);
+
+    if (!params.full_range) {
+      cb = mul_neon(cb, 0.875f);
+      cr = mul_neon(cr, 0.875f);
+    }
+
+    store_neon(out_cb + x, round_neon(add_neon(cb, 128.0f)), 255);
+    store_neon(out_cr + x, round_neon(add_neon(cr, 128.0f)), 255);
+  }
+
+  return x;
+}
+
+
+template<class Pixel>
+static int RGB_planar_row_to_Y_neon(const Pixel* in_r, const Pixel* in_g, const Pixel* in_b,
+                                    Pixel* out_y, int width,
+                                    const RGB_to_YCbCr_kernel_params& params)
+{
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    f32x8_neon v = dot_neon(load_neon(in_r + x), load_neon(in_g + x), load_neon(in_b + x), params.coeffs.c[0]);
+    if (!params.full_range) {
+      v = add_neon(mul_neon(mul_neon(v, 219.0f), 1.0f / 256), params.limited_range_offset);
+    }
+
+    store_neon(out_y + x, round_neon(v), params.max_value);
+  }
+
+  return x;
+}
+
+
+template<class Pixel>
+static int RGB_planar_rows_to_CbCr420_neon(const Pixel* r0, const Pixel* g0, const Pixel* b0,
+                                           const Pixel* r1, const Pixel* g1, const Pixel* b1,
+                                           Pixel* out_cb, Pixel* out_cr, int num_chroma,
+                                           const RGB_to_YCbCr_kernel_params& params)
+{
+  int x = 0;
+  for (; x + 8 <= num_chroma; x += 8) {
+    int px = 2 * x;
+
+    f32x8_neon r = mul_neon(load_pair_sums_neon(r0 + px, r1 + px), 0.25f);
+    f32x8_neon g = mul_neon(load_pair_sums_neon(g0 + px, g1 + px), 0.25f);
+    f32x8_neon b = mul_neon(load_pair_sums_neon(b0 + px, b1 + px), 0.25f);
+
+    f32x8_neon cb = dot_neon(r, g, b, params.coeffs.c[1]);
+    f32x8_neon cr = dot_neon(r, g, b, params.coeffs.c[2]);
+
+    if (!params.full_range) {
+      cb = mul_neon(mul_neon(cb, 224.0f), 1.0f / 256);
+      cr = mul_neon(mul_neon(cr, 224.0f), 1.0f / 256);
+    }
+
+    store_neon(out_cb + x, round_neon(add_neon(cb, params.half_range)), params.max_value);
+    store_neon(out_cr + x, round_neon(add_neon(cr, params.half_range)), params.max_value);
+  }
+
+  return x;
+}
+
+#endif
+
+
+void select_RGB_to_YCbCr420_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  s_kernels = RGB_to_YCbCr420_kernels();
+
+#if HEIF_HAVE_X86_AVX
+  if (cpu.avx2) {
+    s_kernels.interleaved_to_Y = RGB24_32_row_to_Y_avx2;
+    s_kernels.interleaved_to_CbCr420 = RGB24_32_rows_to_CbCr420_avx2;
+    s_kernels.planar8_to_Y = RGB_planar_row_to_Y_avx2<uint8_t>;
+    s_kernels.planar8_to_CbCr420 = RGB_planar_rows_to_CbCr420_avx2<uint8_t>;
+    s_kernels.planar16_to_Y = RGB_planar_row_to_Y_avx2<uint16_t>;
+    s_kernels.planar16_to_CbCr420 = RGB_planar_rows_to_CbCr420_avx2<uint16_t>;
+  }
+#endif
+
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    s_kernels.interleaved_to_Y = RGB24_32_row_to_Y_neon;
+    s_kernels.interleaved_to_CbCr420 = RGB24_32_rows_to_CbCr420_neon;
+    s_kernels.planar8_to_Y = RGB_planar_row_to_Y_neon<uint8_t>;
+    s_kernels.planar8_to_CbCr420 = RGB_planar_rows_to_CbCr420_neon<uint8_t>;
+    s_kernels.planar16_to_Y = RGB_planar_row_to_Y_neon<uint16_t>;
+    s_kernels.planar16_to_CbCr420 = RGB_planar_rows_to_CbCr420_neon<uint16_t>;
+  }
+#endif
+
+  (void) cpu;
+}
+
+
+const RGB_to_YCbCr420_kernels& get_RGB_to_YCbCr420_kernels()
+{
+  return s_kernels;
+}
@@ -0,0 +1,106 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_COLORCONVERSION_RGB2YUV_SIMD_H
+#define LIBHEIF_COLORCONVERSION_RGB2YUV_SIMD_H
+
+#include <cstdint>
+#include "libheif/nclx.h"
+
+
+// The kernels compute the same float expressions (in the same order) as the scalar loops
+// in rgb2yuv.cc, so that the output does not depend on whether a SIMD kernel is used.
+//
+// All kernels return the number of output samples that were converted. The remaining samples
+// at the end of the row have to be converted by the caller.
+
+struct RGB_to_YCbCr_kernel_params
+{
+  RGB_to_YCbCr_coefficients coeffs;
+  bool full_range = true;
+
+  // only used by the planar kernels
+  int32_t max_value = 255;
+  float half_range = 128.0f;
+  float limited_range_offset = 16.0f;
+};
+
+
+// --- interleaved 8-bit RGB / RGBA input (Op_RGB24_32_to_YCbCr)
+
+typedef int (* RGB24_32_row_to_Y_kernel)(const uint8_t* in, int bytes_per_pixel,
+                                         uint8_t* out_y, int width,
+                                         const RGB_to_YCbCr_kernel_params& params);
+
+// Averages the 2x2 pixel blocks of the two input rows. 'num_chroma' is the number of complete blocks.
+typedef int (* RGB24_32_rows_to_CbCr420_kernel)(const uint8_t* in0, const uint8_t* in1, int bytes_per_pixel,
+                                                uint8_t* out_cb, uint8_t* out_cr, int num_chroma,
+                                                const RGB_to_YCbCr_kernel_params& params);
+
+
+// --- planar RGB 4:4:4 input (Op_RGB_to_YCbCr<Pixel>)
+
+template<class Pixel>
+struct RGB_planar_kernel_types
+{
+  typedef int (* row_to_Y)(const Pixel* r, const Pixel* g, const Pixel* b,
+                           Pixel* out_y, int width,
+                           const RGB_to_YCbCr_kernel_params& params);
+
+  typedef int (* rows_to_CbCr420)(const Pixel* r0, const Pixel* g0, const Pixel* b0,
+                                  const Pixel* r1, const Pixel* g1, const Pixel* b1,
+                                  Pixel* out_cb, Pixel* out_cr, int num_chroma,
+                                  const RGB_to_YCbCr_kernel_params& params);
+};
+
+
+struct RGB_to_YCbCr420_kernels
+{
+  RGB24_32_row_to_Y_kernel interleaved_to_Y = nullptr;
+  RGB24_32_rows_to_CbCr420_kernel interleaved_to_CbCr420 = nullptr;
+
+  RGB_planar_kernel_types<uint8_t>::row_to_Y planar8_to_Y = nullptr;
+  RGB_planar_kernel_types<uint8_t>::rows_to_CbCr420 planar8_to_CbCr420 = nullptr;
+
+  RGB_planar_kernel_types<uint16_t>::row_to_Y planar16_to_Y = nullptr;
+  RGB_planar_kernel_types<uint16_t>::rows_to_CbCr420 planar16_to_CbCr420 = nullptr;
+
+  // Typed access for the Op_RGB_to_YCbCr<Pixel> template.
+  void get_planar(RGB_planar_kernel_types<uint8_t>::row_to_Y* to_Y,
+                  RGB_planar_kernel_types<uint8_t>::rows_to_CbCr420* to_CbCr) const
+  {
+    *to_Y = planar8_to_Y;
+    *to_CbCr = planar8_to_CbCr420;
+  }
+
+  void get_planar(RGB_planar_kernel_types<uint16_t>::row_to_Y* to_Y,
+                  RGB_planar_kernel_types<uint16_t>::rows_to_CbCr420* to_CbCr) const
+  {
+    *to_Y = planar16_to_Y;
+    *to_CbCr = planar16_to_CbCr420;
+  }
+};
+
+// Row kernels for the RGB to YCbCr 4:2:0 conversions. See cpu_features.h for the dispatch rules.
+const RGB_to_YCbCr420_kernels& get_RGB_to_YCbCr420_kernels();
+
+void select_RGB_to_YCbCr420_kernels();
+
+#endif
@@ -0,0 +1,873 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rgb_float.h"
+#include "hdr_sdr.h"
+#include "alpha.h"
+#include "libheif/common_utils.h"
+#include "libheif/cpu_features.h"
+#include "libheif/nclx.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
+#if HEIF_HAVE_X86_AVX
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+static RGB_float_kernels s_kernels;
+
+
+uint16_t float_to_half(float f)
+{
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t exponent = (x >> 23) & 0xFF;
+  uint32_t mantissa = x & 0x7FFFFF;
+
+  if (exponent == 0xFF) {
+    // infinity or (quiet) NaN
+    return (uint16_t) (sign | 0x7C00 | (mantissa ? 0x200 : 0));
+  }
+
+  int e = (int) exponent - 127 + 15;
+
+  if (e >= 31) {
+    return (uint16_t) (sign | 0x7C00);
+  }
+
+  if (e <= 0) {
+    // subnormal half
+    if (e < -10) {
+      return (uint16_t) sign;
+    }
+
+    mantissa |= 0x800000;
+    int shift = 14 - e;
+
+    uint32_t h = mantissa >> shift;
+    uint32_t remainder = mantissa & ((1U << shift) - 1);
+    uint32_t halfway = 1U << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (h & 1))) {
+      h++; // may carry into the smallest normal number, which is still correct
+    }
+
+    return (uint16_t) (sign | h);
+  }
+
+  uint32_t h = sign | ((uint32_t) e << 10) | (mantissa >> 13);
+  uint32_t remainder = mantissa & 0x1FFF;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (h & 1))) {
+    h++; // may carry into the exponent and round up to infinity
+  }
+
+  return (uint16_t) h;
+}
+
+
+float half_to_float(uint16_t h)
+{
+  uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1F;
+  uint32_t mantissa = h & 0x3FF;
+
+  uint32_t x;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      x = sign;
+    }
+    else {
+      // normalize the subnormal half
+      int e = -14;
+      while (!(mantissa & 0x400)) {
+        mantissa <<= 1;
+        e--;
+      }
+      mantissa &= 0x3FF;
+      x = sign | ((uint32_t) (e + 127) << 23) | (mantissa << 13);
+    }
+  }
+  else if (exponent == 31) {
+    x = sign | 0x7F800000 | (mantissa << 13);
+  }
+  else {
+    x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+
+void float_to_half_row(const float* in, uint16_t* out, int n)
+{
+  int x = 0;
+
+  if (s_kernels.float_to_half) {
+    x = s_kernels.float_to_half(in, out, n);
+  }
+
+  for (; x < n; x++) {
+    out[x] = float_to_half(in[x]);
+  }
+}
+
+
+void half_to_float_row(const uint16_t* in, float* out, int n)
+{
+  int x = 0;
+
+  if (s_kernels.half_to_float) {
+    x = s_kernels.half_to_float(in, out, n);
+  }
+
+  for (; x < n; x++) {
+    out[x] = half_to_float(in[x]);
+  }
+}
+
+
+static int get_float_chroma_bit_depth(heif_chroma chroma)
+{
+  switch (chroma) {
+    case heif_chroma_interleaved_RGB_HALF:
+    case heif_chroma_interleaved_RGBA_HALF:
+      return 16;
+    case heif_chroma_interleaved_RGB_FLOAT:
+    case heif_chroma_interleaved_RGBA_FLOAT:
+      return 32;
+    default:
+      return 0;
+  }
+}
+
+
+static bool is_linear_transfer(const std::shared_ptr<const color_profile_nclx>& profile)
+{
+  return profile && profile->get_transfer_characteristics() == heif_transfer_characteristic_linear;
+}
+
+
+// --- linearization
+
+// The inverse transfer function is sampled at kLinearLUTSize + 1 equidistant points in [0;1]
+// and linearly interpolated in between.
+static const int kLinearLUTSize = 4096;
+
+
+static std::shared_ptr<const std::vector<float>> get_linear_light_lut(uint16_t transfer_characteristics)
+{
+  static std::map<uint16_t, std::shared_ptr<const std::vector<float>>> s_luts;
+#if ENABLE_MULTITHREADING_SUPPORT
+  static std::mutex s_luts_mutex;
+  std::lock_guard<std::mutex> lock(s_luts_mutex);
+#endif
+
+  auto iter = s_luts.find(transfer_characteristics);
+  if (iter != s_luts.end()) {
+    return iter->second;
+  }
+
+  // one extra entry, such that the interpolation at 1.0 does not need a special case
+  std::vector<float> lut(kLinearLUTSize + 2);
+  for (int i = 0; i <= kLinearLUTSize; i++) {
+    lut[i] = static_cast<float>(transfer_to_linear_light(i / static_cast<double>(kLinearLUTSize),
+                                                         transfer_characteristics));
+  }
+  lut[kLinearLUTSize + 1] = lut[kLinearLUTSize];
+
+  auto shared_lut = std::make_shared<const std::vector<float>>(std::move(lut));
+  s_luts[transfer_characteristics] = shared_lut;
+  return shared_lut;
+}
+
+
+// Clips the row to [0;1] and optionally maps it through the linearization table.
+static void clip_and_linearize_row(float* row, int width, const float* lut)
+{
+  for (int x = 0; x < width; x++) {
+    row[x] = std::min(std::max(row[x], 0.0f), 1.0f);
+  }
+
+  if (lut) {
+    for (int x = 0; x < width; x++) {
+      float pos = row[x] * kLinearLUTSize;
+      int idx = static_cast<int>(pos);
+      float frac = pos - static_cast<float>(idx);
+      row[x] = lut[idx] + frac * (lut[idx + 1] - lut[idx]);
+    }
+  }
+}
+
+
+// --- conversion of one row to planar float RGB
+
+namespace {
+  struct FloatConversionParameters
+  {
+    int matrix_coeffs = 2;
+    YCbCr_to_RGB_coefficients coeffs;
+
+    // sample value -> [0;1], including the limited range expansion
+    float luma_offset = 0;
+    float luma_scale = 1;
+    float chroma_offset = 0;
+    float chroma_scale = 1;
+  };
+
+
+  template<class Pixel>
+  void YCbCr_row_to_float(const Pixel* in_y, const Pixel* in_cb, const Pixel* in_cr, int shiftH,
+                          const FloatConversionParameters& p,
+                          float* r, float* g, float* b, int width)
+  {
+    if (p.matrix_coeffs == 0) {
+      // GBR: all planes are scaled like luma
+      for (int x = 0; x < width; x++) {
+        int cx = x >> shiftH;
+        r[x] = (in_cr[cx] - p.luma_offset) * p.luma_scale;
+        g[x] = (in_y[x] - p.luma_offset) * p.luma_scale;
+        b[x] = (in_cb[cx] - p.luma_offset) * p.luma_scale;
+      }
+    }
+    else if (p.matrix_coeffs == 8) {
+      // YCgCo
+      for (int x = 0; x < width; x++) {
+        int cx = x >> shiftH;
+        float yv = (in_y[x] - p.luma_offset) * p.luma_scale;
+        float cg = (in_cb[cx] - p.chroma_offset) * p.chroma_scale;
+        float co = (in_cr[cx] - p.chroma_offset) * p.chroma_scale;
+        r[x] = yv - cg + co;
+        g[x] = yv + cg;
+        b[x] = yv - cg - co;
+      }
+    }
+    else {
+      const float r_cr = p.coeffs.r_cr;
+      const float g_cb = p.coeffs.g_cb;
+      const float g_cr = p.coeffs.g_cr;
+      const float b_cb = p.coeffs.b_cb;
+
+      for (int x = 0; x < width; x++) {
+        int cx = x >> shiftH;
+        float yv = (in_y[x] - p.luma_offset) * p.luma_scale;
+        float cb = (in_cb[cx] - p.chroma_offset) * p.chroma_scale;
+        float cr = (in_cr[cx] - p.chroma_offset) * p.chroma_scale;
+        r[x] = yv + r_cr * cr;
+        g[x] = yv + g_cb * cb + g_cr * cr;
+        b[x] = yv + b_cb * cb;
+      }
+    }
+  }
+
+
+  template<class Pixel>
+  void scale_row_to_float(const Pixel* in, float offset, float scale, float* out, int width)
+  {
+    for (int x = 0; x < width; x++) {
+      out[x] = (in[x] - offset) * scale;
+    }
+  }
+
+
+  template<class Pixel>
+  bool convert_to_RGB_float(const std::shared_ptr<const HeifPixelImage>& input,
+                            const std::shared_ptr<HeifPixelImage>& outimg,
+                            const float* lut,
+                            bool unpremultiply, bool premultiply)
+  {
+    heif_colorspace colorspace = input->get_colorspace();
+    heif_chroma chroma = input->get_chroma_format();
+    heif_chroma out_chroma = outimg->get_chroma_format();
+
+    int width = input->get_width();
+    int height = input->get_height();
+
+    int bpp = (colorspace == heif_colorspace_RGB ?
+               input->get_bits_per_pixel(heif_channel_R) : input->get_bits_per_pixel(heif_channel_Y));
+    float max_value = static_cast<float>((1 << bpp) - 1);
+
+    // --- conversion parameters
+
+    FloatConversionParameters params;
+    params.coeffs = YCbCr_to_RGB_coefficients::defaults();
+    bool full_range = true;
+
+    auto profile = input->get_color_profile_nclx();
+    if (profile) {
+      params.matrix_coeffs = profile->get_matrix_coefficients();
+      full_range = profile->get_full_range_flag();
+      params.coeffs = get_color_conversion_coefficients(profile->get_matrix_coefficients(),
+                                                        profile->get_colour_primaries(),
+                                                        full_range, bpp).ycbcr_to_rgb;
+    }
+
+    if (colorspace == heif_colorspace_RGB) {
+      full_range = true;
+    }
+
+    // Same limited range expansion as in Op_YCbCr_to_RGB.
+    params.luma_offset = full_range ? 0.0f : static_cast<float>(16 << (bpp - 8));
+    params.luma_scale = (full_range ? 1.0f : 1.1689f) / max_value;
+    params.chroma_offset = static_cast<float>(1 << (bpp - 1));
+    params.chroma_scale = (full_range ? 1.0f : 1.1429f) / max_value;
+
+    int shiftH = 0;
+    int shiftV = 0;
+    if (colorspace == heif_colorspace_YCbCr) {
+      shiftH = chroma_h_subsampling(chroma) - 1;
+      shiftV = chroma_v_subsampling(chroma) - 1;
+    }
+
+    // --- planes
+
+    const Pixel* in_p[3] = {nullptr, nullptr, nullptr};
+    size_t in_stride[3] = {0, 0, 0};
+
+    if (colorspace == heif_colorspace_RGB) {
+      in_p[0] = (const Pixel*) input->get_plane(heif_channel_R, &in_stride[0]);
+      in_p[1] = (const Pixel*) input->get_plane(heif_channel_G, &in_stride[1]);
+      in_p[2] = (const Pixel*) input->get_plane(heif_channel_B, &in_stride[2]);
+    }
+    else if (colorspace == heif_colorspace_YCbCr) {
+      in_p[0] = (const Pixel*) input->get_plane(heif_channel_Y, &in_stride[0]);
+      in_p[1] = (const Pixel*) input->get_plane(heif_channel_Cb, &in_stride[1]);
+      in_p[2] = (const Pixel*) input->get_plane(heif_channel_Cr, &in_stride[2]);
+    }
+    else {
+      in_p[0] = (const Pixel*) input->get_plane(heif_channel_Y, &in_stride[0]);
+    }
+
+    for (size_t& stride : in_stride) {
+      stride /= static_cast<int>(sizeof(Pixel));
+    }
+
+    bool input_alpha = input->has_channel(heif_channel_Alpha);
+    bool output_alpha = is_chroma_with_alpha(out_chroma);
+
+    const uint8_t* in_a = nullptr;
+    size_t in_a_stride = 0;
+    int bpp_a = 0;
+    float alpha_scale = 1.0f;
+    if (input_alpha) {
+      in_a = input->get_plane(heif_channel_Alpha, &in_a_stride);
+      bpp_a = input->get_bits_per_pixel(heif_channel_Alpha);
+      alpha_scale = 1.0f / static_cast<float>((1 << bpp_a) - 1);
+    }
+
+    size_t out_stride = 0;
+    uint8_t* out_p = outimg->get_plane(heif_channel_interleaved, &out_stride);
+    if (!out_p) {
+      return false;
+    }
+
+    bool half = (get_float_chroma_bit_depth(out_chroma) == 16);
+    int num_components = output_alpha ? 4 : 3;
+
+    std::vector<float> rgba(4 * (size_t) width);
+    float* r = rgba.data();
+    float* g = r + width;
+    float* b = g + width;
+    float* a = b + width;
+
+    std::vector<float> interleaved;
+    if (half) {
+      interleaved.resize(num_components * (size_t) width);
+    }
+
+    for (int y = 0; y < height; y++) {
+      if (colorspace == heif_colorspace_YCbCr) {
+        int cy = y >> shiftV;
+        YCbCr_row_to_float(in_p[0] + y * (size_t) in_stride[0],
+                           in_p[1] + cy * (size_t) in_stride[1],
+                           in_p[2] + cy * (size_t) in_stride[2],
+                           shiftH, params, r, g, b, width);
+      }
+      else if (colorspace == heif_colorspace_RGB) {
+        scale_row_to_float(in_p[0] + y * (size_t) in_stride[0], 0.0f, 1.0f / max_value, r, width);
+        scale_row_to_float(in_p[1] + y * (size_t) in_stride[1], 0.0f, 1.0f / max_value, g, width);
+        scale_row_to_float(in_p[2] + y * (size_t) in_stride[2], 0.0f, 1.0f / max_value, b, width);
+      }
+      else {
+        scale_row_to_float(in_p[0] + y * (size_t) in_stride[0], params.luma_offset, params.luma_scale, r, width);
+      }
+
+      if (output_alpha) {
+        if (in_a == nullptr) {
+          std::fill(a, a + width, 1.0f);
+        }
+        else if (bpp_a <= 8) {
+          scale_row_to_float(in_a + y * (size_t) in_a_stride, 0.0f, alpha_scale, a, width);
+        }
+        else {
+          scale_row_to_float((const uint16_t*) (in_a + y * (size_t) in_a_stride), 0.0f, alpha_scale, a, width);
+        }
+      }
+
+      // monochrome images are converted in 'r' and copied to 'g' and 'b' afterwards
+      float* components[3] = {r, g, b};
+      int num_color_components = (colorspace == heif_colorspace_monochrome ? 1 : 3);
+
+      // The transfer function has to be applied to the colors that are not multiplied by alpha.
+      if (unpremultiply) {
+        for (int i = 0; i < num_color_components; i++) {
+          float* c = components[i];
+          for (int x = 0; x < width; x++) {
+            c[x] = (a[x] > 0.0f ? c[x] / a[x] : 0.0f);
+          }
+        }
+      }
+
+      for (int i = 0; i < num_color_components; i++) {
+        clip_and_linearize_row(components[i], width, lut);
+      }
+
+      if (premultiply) {
+        for (int i = 0; i < num_color_components; i++) {
+          float* c = components[i];
+          for (int x = 0; x < width; x++) {
+            c[x] *= a[x];
+          }
+        }
+      }
+
+      if (colorspace == heif_colorspace_monochrome) {
+        memcpy(g, r, width * sizeof(float));
+        memcpy(b, r, width * sizeof(float));
+      }
+
+      // --- interleave
+
+      uint8_t* out_row = out_p + y * (size_t) out_stride;
+      float* dst = half ? interleaved.data() : reinterpret_cast<float*>(out_row);
+
+      if (output_alpha) {
+        for (int x = 0; x < width; x++) {
+          dst[4 * x + 0] = r[x];
+          dst[4 * x + 1] = g[x];
+          dst[4 * x + 2] = b[x];
+          dst[4 * x + 3] = a[x];
+        }
+      }
+      else {
+        for (int x = 0; x < width; x++) {
+          dst[3 * x + 0] = r[x];
+          dst[3 * x + 1] = g[x];
+          dst[3 * x + 2] = b[x];
+        }
+      }
+
+      if (half) {
+        float_to_half_row(dst, reinterpret_cast<uint16_t*>(out_row), num_components * width);
+      }
+    }
+
+    return true;
+  }
+}
+
+
+// Returns the bit depth of the integer input, or 0 if the input cannot be converted.
+static int get_integer_input_bit_depth(const std::shared_ptr<const HeifPixelImage>& image)
+{
+  std::vector<heif_channel> channels;
+
+  switch (image->get_colorspace()) {
+    case heif_colorspace_YCbCr:
+      if (image->get_chroma_format() != heif_chroma_420 &&
+          image->get_chroma_format() != heif_chroma_422 &&
+          image->get_chroma_format() != heif_chroma_444) {
+        return 0;
+      }
+      channels = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr};
+      break;
+    case heif_colorspace_RGB:
+      if (image->get_chroma_format() != heif_chroma_444) {
+        return 0;
+      }
+      channels = {heif_channel_R, heif_channel_G, heif_channel_B};
+      break;
+    case heif_colorspace_monochrome:
+      channels = {heif_channel_Y};
+      break;
+    default:
+      return 0;
+  }
+
+  int bpp = image->get_bits_per_pixel(channels[0]);
+  for (heif_channel channel : channels) {
+    if (!image->has_channel(channel) ||
+        image->get_bits_per_pixel(channel) != bpp) {
+      return 0;
+    }
+  }
+
+  if (bpp < 8 || bpp > 16) {
+    return 0;
+  }
+
+  if (image->has_channel(heif_channel_Alpha)) {
+    int bpp_a = image->get_bits_per_pixel(heif_channel_Alpha);
+    if (bpp_a < 1 || bpp_a > 16) {
+      return 0;
+    }
+  }
+
+  return bpp;
+}
+
+
+std::vector<ColorStateWithCost>
+Op_to_RGB_float::state_after_conversion(const ColorState& input_state,
+                                        const ColorState& target_state,
+                                        const heif_color_conversion_options& options) const
+{
+  if (!is_float_chroma(target_state.chroma) ||
+      target_state.bits_per_pixel != get_float_chroma_bit_depth(target_state.chroma)) {
+    return {};
+  }
+
+  if (input_state.bits_per_pixel < 8 || input_state.bits_per_pixel > 16) {
+    return {};
+  }
+
+  switch (input_state.colorspace) {
+    case heif_colorspace_YCbCr:
+      if (input_state.chroma != heif_chroma_420 &&
+          input_state.chroma != heif_chroma_422 &&
+          input_state.chroma != heif_chroma_444) {
+        return {};
+      }
+
+      // this Op only implements the nearest-neighbor algorithm
+      if (input_state.chroma != heif_chroma_444 &&
+          options.preferred_chroma_upsampling_algorithm != heif_chroma_upsampling_nearest_neighbor &&
+          options.only_use_preferred_chroma_algorithm) {
+        return {};
+      }
+      break;
+    case heif_colorspace_RGB:
+      if (input_state.chroma != heif_chroma_444) {
+        return {};
+      }
+      break;
+    case heif_colorspace_monochrome:
+      break;
+    default:
+      return {};
+  }
+
+  ColorState output_state;
+  output_state.colorspace = heif_colorspace_RGB;
+  output_state.chroma = target_state.chroma;
+  output_state.has_alpha = is_chroma_with_alpha(target_state.chroma);
+  output_state.bits_per_pixel = target_state.bits_per_pixel;
+  output_state.nclx_profile = (target_state.nclx_profile ? target_state.nclx_profile : input_state.nclx_profile);
+
+  // Never drop the alpha channel. A missing alpha channel is filled with 1.0.
+  if (input_state.has_alpha && !output_state.has_alpha) {
+    return {};
+  }
+
+  std::vector<ColorStateWithCost> states;
+  states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+
+  add_alpha_premultiplication_states(states, input_state, target_state);
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_to_RGB_float::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                    const ColorState& target_state,
+                                    const heif_color_conversion_options& options) const
+{
+  int width = input->get_width();
+  int height = input->get_height();
+
+  auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
+  outimg->create(width, height, heif_colorspace_RGB, target_state.chroma);
+
+  if (!outimg->add_plane(heif_channel_interleaved, width, height, get_float_chroma_bit_depth(target_state.chroma))) {
+    return nullptr;
+  }
+
+  if (!convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+bool
+Op_to_RGB_float::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                         const std::shared_ptr<HeifPixelImage>& outimg,
+                                         const ColorState& target_state,
+                                         const heif_color_conversion_options& options) const
+{
+  heif_chroma out_chroma = outimg->get_chroma_format();
+
+  int bpp = get_integer_input_bit_depth(input);
+  if (bpp == 0 ||
+      out_chroma != target_state.chroma ||
+      outimg->get_colorspace() != heif_colorspace_RGB ||
+      outimg->get_width() != input->get_width() ||
+      outimg->get_height() != input->get_height() ||
+      !outimg->has_channel(heif_channel_interleaved) ||
+      outimg->get_bits_per_pixel(heif_channel_interleaved) != get_float_chroma_bit_depth(out_chroma) ||
+      (input->has_channel(heif_channel_Alpha) && !is_chroma_with_alpha(out_chroma))) {
+    return false;
+  }
+
+  std::shared_ptr<const std::vector<float>> lut;
+  auto input_profile = input->get_color_profile_nclx();
+  if (is_linear_transfer(target_state.nclx_profile) && !is_linear_transfer(input_profile)) {
+    // images without nclx profile are assumed to be sRGB
+    uint16_t transfer = (input_profile ? input_profile->get_transfer_characteristics() :
+                         (uint16_t) heif_transfer_characteristic_IEC_61966_2_1);
+    lut = get_linear_light_lut(transfer);
+  }
+
+  // Premultiplied input is unpremultiplied before the transfer function is changed and premultiplied again.
+  bool input_premultiplied = input->has_channel(heif_channel_Alpha) && input->is_premultiplied_alpha();
+  bool output_premultiplied = is_chroma_with_alpha(out_chroma) && target_state.premultiplied_alpha;
+  bool unpremultiply = input_premultiplied && (!output_premultiplied || lut);
+  bool premultiply = output_premultiplied && (!input_premultiplied || lut);
+
+  if (bpp == 8) {
+    return convert_to_RGB_float<uint8_t>(input, outimg, lut ? lut->data() : nullptr, unpremultiply, premultiply);
+  }
+  else {
+    return convert_to_RGB_float<uint16_t>(input, outimg, lut ? lut->data() : nullptr, unpremultiply, premultiply);
+  }
+}
+
+
+std::vector<ColorStateWithCost>
+Op_RGB_float_to_RGB::state_after_conversion(const ColorState& input_state,
+                                            const ColorState& target_state,
+                                            const heif_color_conversion_options& options) const
+{
+  if (input_state.colorspace != heif_colorspace_RGB ||
+      !is_float_chroma(input_state.chroma) ||
+      is_float_chroma(target_state.chroma) ||
+      target_state.bits_per_pixel < 8 ||
+      target_state.bits_per_pixel > 16) {
+    return {};
+  }
+
+  ColorState output_state = input_state;
+  output_state.chroma = heif_chroma_444;
+  output_state.bits_per_pixel = target_state.bits_per_pixel;
+
+  std::vector<ColorStateWithCost> states;
+  states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_RGB_float_to_RGB::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                        const ColorState& target_state,
+                                        const heif_color_conversion_options& options) const
+{
+  heif_chroma in_chroma = input->get_chroma_format();
+  int in_bpp = get_float_chroma_bit_depth(in_chroma);
+  int out_bpp = target_state.bits_per_pixel;
+
+  if (in_bpp == 0 ||
+      input->get_colorspace() != heif_colorspace_RGB ||
+      input->get_bits_per_pixel(heif_channel_interleaved) != in_bpp ||
+      out_bpp < 8 || out_bpp > 16) {
+    return nullptr;
+  }
+
+  int width = input->get_width();
+  int height = input->get_height();
+  bool has_alpha = is_chroma_with_alpha(in_chroma);
+  int num_components = has_alpha ? 4 : 3;
+
+  auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
+  outimg->create(width, height, heif_colorspace_RGB, heif_chroma_444);
+
+  std::vector<heif_channel> channels = {heif_channel_R, heif_channel_G, heif_channel_B};
+  if (has_alpha) {
+    channels.push_back(heif_channel_Alpha);
+  }
+
+  uint8_t* out_p[4] = {nullptr, nullptr, nullptr, nullptr};
+  size_t out_stride[4] = {0, 0, 0, 0};
+
+  for (int c = 0; c < num_components; c++) {
+    if (!outimg->add_plane(channels[c], width, height, out_bpp)) {
+      return nullptr;
+    }
+
+    out_p[c] = outimg->get_plane(channels[c], &out_stride[c]);
+  }
+
+  size_t in_stride = 0;
+  const uint8_t* in_p = input->get_plane(heif_channel_interleaved, &in_stride);
+
+  std::vector<float> row(num_components * (size_t) width);
+  float max_value = static_cast<float>((1 << out_bpp) - 1);
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t* in_row = in_p + y * (size_t) in_stride;
+    const float* samples;
+
+    if (in_bpp == 16) {
+      half_to_float_row(reinterpret_cast<const uint16_t*>(in_row), row.data(), num_components * width);
+      samples = row.data();
+    }
+    else {
+      samples = reinterpret_cast<const float*>(in_row);
+    }
+
+    for (int c = 0; c < num_components; c++) {
+      uint8_t* out_row = out_p[c] + y * (size_t) out_stride[c];
+
+      for (int x = 0; x < width; x++) {
+        float v = samples[num_components * x + c];
+
+        // also maps NaN to 0
+        int value = (v > 0.0f) ? static_cast<int>(std::min(v, 1.0f) * max_value + 0.5f) : 0;
+
+        if (out_bpp == 8) {
+          out_row[x] = static_cast<uint8_t>(value);
+        }
+        else {
+          reinterpret_cast<uint16_t*>(out_row)[x] = static_cast<uint16_t>(value);
+        }
+      }
+    }
+  }
+
+  return outimg;
+}
+
+
+// --- SIMD kernels
+
+#if HEIF_HAVE_X86_AVX
+
+HEIF_TARGET_F16C
+static int float_to_half_row_f16c(const float* in, uint16_t* out, int n)
+{
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + x), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i*) (out + x), h);
+  }
+
+  return x;
+}
+
+
+HEIF_TARGET_F16C
+static int half_to_float_row_f16c(const uint16_t* in, float* out, int n)
+{
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    __m256 f = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (in + x)));
+    _mm256_storeu_ps(out + x, f);
+  }
+
+  return x;
+}
+
+#endif
+
+
+// The half float conversion instructions are part of the base instruction set on AArch64.
+#if HEIF_HAVE_NEON && defined(__aarch64__)
+
+static int float_to_half_row_neon(const float* in, uint16_t* out, int n)
+{
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    float16x4_t lo = vcvt_f16_f32(vld1q_f32(in + x));
+    float16x4_t hi = vcvt_f16_f32(vld1q_f32(in + x + 4));
+    vst1q_u16(out + x, vreinterpretq_u16_f16(vcombine_f16(lo, hi)));
+  }
+
+  return x;
+}
+
+
+static int half_to_float_row_neon(const uint16_t* in, float* out, int n)
+{
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(in + x));
+    vst1q_f32(out + x, vcvt_f32_f16(vget_low_f16(h)));
+    vst1q_f32(out + x + 4, vcvt_f32_f16(vget_high_f16(h)));
+  }
+
+  return x;
+}
+
+#endif
+
+
+void select_RGB_float_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  s_kernels = RGB_float_kernels();
+
+#if HEIF_HAVE_X86_AVX
+  if (cpu.f16c) {
+    s_kernels.float_to_half = float_to_half_row_f16c;
+    s_kernels.half_to_float = half_to_float_row_f16c;
+  }
+#endif
+
+#if HEIF_HAVE_NEON && defined(__aarch64__)
+  if (cpu.neon) {
+    s_kernels.float_to_half = float_to_half_row_neon;
+    s_kernels.half_to_float = half_to_float_row_neon;
+  }
+#endif
+
+  (void) cpu;
+}
+
+
+const RGB_float_kernels& get_RGB_float_kernels()
+{
+  return s_kernels;
+}
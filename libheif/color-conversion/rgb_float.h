@@ -0,0 +1,102 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_COLORCONVERSION_RGB_FLOAT_H
+#define LIBHEIF_COLORCONVERSION_RGB_FLOAT_H
+
+#include "colorconversion.h"
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+
+// Planar YCbCr (4:2:0, 4:2:2, 4:4:4), monochrome or planar RGB with integer samples to interleaved
+// RGB(A) with half or float samples. The YCbCr to RGB matrix is computed in float, such that the
+// result is not quantized to the input bit depth. Chroma is upsampled with nearest neighbor.
+// When the transfer characteristics of the target state are linear, the inverse transfer function
+// of the input is applied in the same pass.
+class Op_to_RGB_float : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+
+  bool handles_alpha_premultiplication() const override { return true; }
+};
+
+
+// Interleaved half or float RGB(A) back to planar RGB with integer samples, e.g. for encoding
+// images in these formats. Samples outside of [0;1] are clipped. The transfer function is not changed.
+class Op_RGB_float_to_RGB : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+};
+
+
+// --- IEEE half float conversion (round to nearest even, with subnormals, infinity and NaN)
+
+uint16_t float_to_half(float f);
+
+float half_to_float(uint16_t h);
+
+void float_to_half_row(const float* in, uint16_t* out, int n);
+
+void half_to_float_row(const uint16_t* in, float* out, int n);
+
+
+// The SIMD kernels process a prefix of the row and return the number of samples processed.
+// The remaining samples are converted by the scalar code.
+typedef int (* float_to_half_kernel)(const float* in, uint16_t* out, int n);
+
+typedef int (* half_to_float_kernel)(const uint16_t* in, float* out, int n);
+
+struct RGB_float_kernels
+{
+  float_to_half_kernel float_to_half = nullptr;
+  half_to_float_kernel half_to_float = nullptr;
+};
+
+// Half float conversion kernels (F16C on x86, NEON on AArch64). See cpu_features.h for the dispatch rules.
+const RGB_float_kernels& get_RGB_float_kernels();
+
+void select_RGB_float_kernels();
+
+#endif //LIBHEIF_COLORCONVERSION_RGB_FLOAT_H
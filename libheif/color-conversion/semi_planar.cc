@@ -0,0 +1,500 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "semi_planar.h"
+#include "libheif/common_utils.h"
+#include "libheif/cpu_features.h"
+#include <cstring>
+
+#if HEIF_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+static Semi_planar_kernels s_kernels;
+
+
+void interleave_chroma_row(const uint8_t* first, const uint8_t* second, uint8_t* out, int width)
+{
+  int x = 0;
+
+  if (s_kernels.interleave_8bit) {
+    x = s_kernels.interleave_8bit(first, second, out, width);
+  }
+
+  for (; x < width; x++) {
+    out[2 * x] = first[x];
+    out[2 * x + 1] = second[x];
+  }
+}
+
+
+void interleave_chroma_row(const uint16_t* first, const uint16_t* second, uint16_t* out, int width, int shift)
+{
+  int x = 0;
+
+  if (s_kernels.interleave_16bit) {
+    x = s_kernels.interleave_16bit(first, second, out, width, shift);
+  }
+
+  for (; x < width; x++) {
+    out[2 * x] = (uint16_t) (first[x] << shift);
+    out[2 * x + 1] = (uint16_t) (second[x] << shift);
+  }
+}
+
+
+// Returns the bit depth of the planar 4:2:0 input, or 0 if the input cannot be converted.
+static int get_planar_420_bit_depth(const std::shared_ptr<const HeifPixelImage>& image)
+{
+  if (image->get_colorspace() != heif_colorspace_YCbCr ||
+      image->get_chroma_format() != heif_chroma_420 ||
+      !image->has_channel(heif_channel_Y) ||
+      !image->has_channel(heif_channel_Cb) ||
+      !image->has_channel(heif_channel_Cr)) {
+    return 0;
+  }
+
+  int bpp = image->get_bits_per_pixel(heif_channel_Y);
+  if (image->get_bits_per_pixel(heif_channel_Cb) != bpp ||
+      image->get_bits_per_pixel(heif_channel_Cr) != bpp) {
+    return 0;
+  }
+
+  return bpp;
+}
+
+
+// Returns the bit depth of the semi-planar image, or 0 if the bit depth does not fit the chroma format.
+static int get_semi_planar_bit_depth(const std::shared_ptr<const HeifPixelImage>& image)
+{
+  heif_chroma chroma = image->get_chroma_format();
+
+  if (image->get_colorspace() != heif_colorspace_YCbCr ||
+      !is_semi_planar_chroma(chroma) ||
+      !image->has_channel(heif_channel_Y) ||
+      !image->has_channel(heif_channel_interleaved)) {
+    return 0;
+  }
+
+  int bpp = image->get_bits_per_pixel(heif_channel_Y);
+  if (image->get_bits_per_pixel(heif_channel_interleaved) != bpp) {
+    return 0;
+  }
+
+  if (chroma == heif_chroma_420_P010 ? (bpp <= 8 || bpp > 16) : bpp != 8) {
+    return 0;
+  }
+
+  return bpp;
+}
+
+
+static bool have_same_plane_sizes(const std::shared_ptr<const HeifPixelImage>& planar,
+                                  const std::shared_ptr<const HeifPixelImage>& semi_planar)
+{
+  return (planar->get_width() == semi_planar->get_width() &&
+          planar->get_height() == semi_planar->get_height() &&
+          planar->get_width(heif_channel_Y) == semi_planar->get_width(heif_channel_Y) &&
+          planar->get_height(heif_channel_Y) == semi_planar->get_height(heif_channel_Y) &&
+          planar->get_width(heif_channel_Cb) == semi_planar->get_width(heif_channel_interleaved) &&
+          planar->get_height(heif_channel_Cb) == semi_planar->get_height(heif_channel_interleaved) &&
+          planar->get_width(heif_channel_Cr) == semi_planar->get_width(heif_channel_interleaved) &&
+          planar->get_height(heif_channel_Cr) == semi_planar->get_height(heif_channel_interleaved));
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr420_to_semi_planar::state_after_conversion(const ColorState& input_state,
+                                                   const ColorState& target_state,
+                                                   const heif_color_conversion_options& options) const
+{
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      input_state.chroma != heif_chroma_420 ||
+      input_state.has_alpha ||
+      !is_semi_planar_chroma(target_state.chroma)) {
+    return {};
+  }
+
+  if (target_state.chroma == heif_chroma_420_P010) {
+    if (input_state.bits_per_pixel <= 8 || input_state.bits_per_pixel > 16) {
+      return {};
+    }
+  }
+  else if (input_state.bits_per_pixel != 8) {
+    return {};
+  }
+
+  std::vector<ColorStateWithCost> states;
+
+  ColorState output_state = input_state;
+  output_state.chroma = target_state.chroma;
+
+  states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_YCbCr420_to_semi_planar::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                               const ColorState& target_state,
+                                               const heif_color_conversion_options& options) const
+{
+  int width = input->get_width();
+  int height = input->get_height();
+
+  auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
+  outimg->create(width, height, heif_colorspace_YCbCr, target_state.chroma);
+
+  int bpp = get_planar_420_bit_depth(input);
+
+  ColorState output_state(heif_colorspace_YCbCr, target_state.chroma, false, bpp);
+  for (const auto& plane : get_image_plane_layout(width, height, output_state)) {
+    if (!outimg->add_plane(plane.channel, plane.width, plane.height, plane.bit_depth)) {
+      return nullptr;
+    }
+  }
+
+  if (!convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+bool
+Op_YCbCr420_to_semi_planar::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                    const std::shared_ptr<HeifPixelImage>& outimg,
+                                                    const ColorState& target_state,
+                                                    const heif_color_conversion_options& options) const
+{
+  heif_chroma chroma = outimg->get_chroma_format();
+
+  int bpp = get_planar_420_bit_depth(input);
+  if (bpp == 0 ||
+      chroma != target_state.chroma ||
+      get_semi_planar_bit_depth(outimg) != bpp ||
+      !have_same_plane_sizes(input, outimg) ||
+      outimg->has_channel(heif_channel_Alpha)) {
+    return false;
+  }
+
+  int width = input->get_width(heif_channel_Y);
+  int height = input->get_height(heif_channel_Y);
+  int chroma_width = input->get_width(heif_channel_Cb);
+  int chroma_height = input->get_height(heif_channel_Cb);
+
+  // NV21 stores the chroma pairs as Cr,Cb
+  heif_channel first = (chroma == heif_chroma_420_NV21 ? heif_channel_Cr : heif_channel_Cb);
+  heif_channel second = (chroma == heif_chroma_420_NV21 ? heif_channel_Cb : heif_channel_Cr);
+
+  size_t in_y_stride = 0, in_first_stride = 0, in_second_stride = 0;
+  size_t out_y_stride = 0, out_uv_stride = 0;
+
+  const uint8_t* in_y = input->get_plane(heif_channel_Y, &in_y_stride);
+  const uint8_t* in_first = input->get_plane(first, &in_first_stride);
+  const uint8_t* in_second = input->get_plane(second, &in_second_stride);
+  uint8_t* out_y = outimg->get_plane(heif_channel_Y, &out_y_stride);
+  uint8_t* out_uv = outimg->get_plane(heif_channel_interleaved, &out_uv_stride);
+
+  if (!out_y || !out_uv) {
+    return false;
+  }
+
+  if (bpp == 8) {
+    for (int y = 0; y < height; y++) {
+      memcpy(out_y + y * static_cast<size_t>(out_y_stride), in_y + y * static_cast<size_t>(in_y_stride), width);
+    }
+
+    for (int y = 0; y < chroma_height; y++) {
+      interleave_chroma_row(in_first + y * static_cast<size_t>(in_first_stride),
+                            in_second + y * static_cast<size_t>(in_second_stride),
+                            out_uv + y * static_cast<size_t>(out_uv_stride),
+                            chroma_width);
+    }
+  }
+  else {
+    // P010 stores the significant bits in the MSBs
+    int shift = 16 - bpp;
+
+    for (int y = 0; y < height; y++) {
+      auto* in_row = reinterpret_cast<const uint16_t*>(in_y + y * static_cast<size_t>(in_y_stride));
+      auto* out_row = reinterpret_cast<uint16_t*>(out_y + y * static_cast<size_t>(out_y_stride));
+
+      for (int x = 0; x < width; x++) {
+        out_row[x] = (uint16_t) (in_row[x] << shift);
+      }
+    }
+
+    for (int y = 0; y < chroma_height; y++) {
+      interleave_chroma_row(reinterpret_cast<const uint16_t*>(in_first + y * static_cast<size_t>(in_first_stride)),
+                            reinterpret_cast<const uint16_t*>(in_second + y * static_cast<size_t>(in_second_stride)),
+                            reinterpret_cast<uint16_t*>(out_uv + y * static_cast<size_t>(out_uv_stride)),
+                            chroma_width, shift);
+    }
+  }
+
+  return true;
+}
+
+
+std::vector<ColorStateWithCost>
+Op_semi_planar_to_YCbCr420::state_after_conversion(const ColorState& input_state,
+                                                   const ColorState& target_state,
+                                                   const heif_color_conversion_options& options) const
+{
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      !is_semi_planar_chroma(input_state.chroma)) {
+    return {};
+  }
+
+  std::vector<ColorStateWithCost> states;
+
+  ColorState output_state = input_state;
+  output_state.chroma = heif_chroma_420;
+  output_state.has_alpha = false;
+
+  states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_semi_planar_to_YCbCr420::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                               const ColorState& target_state,
+                                               const heif_color_conversion_options& options) const
+{
+  int width = input->get_width();
+  int height = input->get_height();
+
+  auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
+  outimg->create(width, height, heif_colorspace_YCbCr, heif_chroma_420);
+
+  int bpp = get_semi_planar_bit_depth(input);
+
+  ColorState output_state(heif_colorspace_YCbCr, heif_chroma_420, false, bpp);
+  for (const auto& plane : get_image_plane_layout(width, height, output_state)) {
+    if (!outimg->add_plane(plane.channel, plane.width, plane.height, plane.bit_depth)) {
+      return nullptr;
+    }
+  }
+
+  if (!convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+bool
+Op_semi_planar_to_YCbCr420::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                    const std::shared_ptr<HeifPixelImage>& outimg,
+                                                    const ColorState& target_state,
+                                                    const heif_color_conversion_options& options) const
+{
+  heif_chroma chroma = input->get_chroma_format();
+
+  int bpp = get_semi_planar_bit_depth(input);
+  if (bpp == 0 ||
+      get_planar_420_bit_depth(outimg) != bpp ||
+      !have_same_plane_sizes(outimg, input) ||
+      outimg->has_channel(heif_channel_Alpha)) {
+    return false;
+  }
+
+  int width = input->get_width(heif_channel_Y);
+  int height = input->get_height(heif_channel_Y);
+  int chroma_width = input->get_width(heif_channel_interleaved);
+  int chroma_height = input->get_height(heif_channel_interleaved);
+
+  heif_channel first = (chroma == heif_chroma_420_NV21 ? heif_channel_Cr : heif_channel_Cb);
+  heif_channel second = (chroma == heif_chroma_420_NV21 ? heif_channel_Cb : heif_channel_Cr);
+
+  size_t in_y_stride = 0, in_uv_stride = 0;
+  size_t out_y_stride = 0, out_first_stride = 0, out_second_stride = 0;
+
+  const uint8_t* in_y = input->get_plane(heif_channel_Y, &in_y_stride);
+  const uint8_t* in_uv = input->get_plane(heif_channel_interleaved, &in_uv_stride);
+  uint8_t* out_y = outimg->get_plane(heif_channel_Y, &out_y_stride);
+  uint8_t* out_first = outimg->get_plane(first, &out_first_stride);
+  uint8_t* out_second = outimg->get_plane(second, &out_second_stride);
+
+  if (!out_y || !out_first || !out_second) {
+    return false;
+  }
+
+  if (bpp == 8) {
+    for (int y = 0; y < height; y++) {
+      memcpy(out_y + y * static_cast<size_t>(out_y_stride), in_y + y * static_cast<size_t>(in_y_stride), width);
+    }
+
+    for (int y = 0; y < chroma_height; y++) {
+      const uint8_t* in_row = in_uv + y * static_cast<size_t>(in_uv_stride);
+      uint8_t* first_row = out_first + y * static_cast<size_t>(out_first_stride);
+      uint8_t* second_row = out_second + y * static_cast<size_t>(out_second_stride);
+
+      for (int x = 0; x < chroma_width; x++) {
+        first_row[x] = in_row[2 * x];
+        second_row[x] = in_row[2 * x + 1];
+      }
+    }
+  }
+  else {
+    int shift = 16 - bpp;
+
+    for (int y = 0; y < height; y++) {
+      auto* in_row = reinterpret_cast<const uint16_t*>(in_y + y * static_cast<size_t>(in_y_stride));
+      auto* out_row = reinterpret_cast<uint16_t*>(out_y + y * static_cast<size_t>(out_y_stride));
+
+      for (int x = 0; x < width; x++) {
+        out_row[x] = (uint16_t) (in_row[x] >> shift);
+      }
+    }
+
+    for (int y = 0; y < chroma_height; y++) {
+      auto* in_row = reinterpret_cast<const uint16_t*>(in_uv + y * static_cast<size_t>(in_uv_stride));
+      auto* first_row = reinterpret_cast<uint16_t*>(out_first + y * static_cast<size_t>(out_first_stride));
+      auto* second_row = reinterpret_cast<uint16_t*>(out_second + y * static_cast<size_t>(out_second_stride));
+
+      for (int x = 0; x < chroma_width; x++) {
+        first_row[x] = (uint16_t) (in_row[2 * x] >> shift);
+        second_row[x] = (uint16_t) (in_row[2 * x + 1] >> shift);
+      }
+    }
+  }
+
+  return true;
+}
+
+
+// --- SIMD kernels
+
+#if HEIF_HAVE_X86_SIMD
+
+HEIF_TARGET_SSE41
+static int interleave_chroma_row_8bit_sse41(const uint8_t* first, const uint8_t* second, uint8_t* out, int width)
+{
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*) (first + x));
+    __m128i b = _mm_loadu_si128((const __m128i*) (second + x));
+
+    _mm_storeu_si128((__m128i*) (out + 2 * x), _mm_unpacklo_epi8(a, b));
+    _mm_storeu_si128((__m128i*) (out + 2 * x + 16), _mm_unpackhi_epi8(a, b));
+  }
+
+  return x;
+}
+
+
+HEIF_TARGET_SSE41
+static int interleave_chroma_row_16bit_sse41(const uint16_t* first, const uint16_t* second, uint16_t* out,
+                                             int width, int shift)
+{
+  const __m128i shift_v = _mm_cvtsi32_si128(shift);
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i a = _mm_sll_epi16(_mm_loadu_si128((const __m128i*) (first + x)), shift_v);
+    __m128i b = _mm_sll_epi16(_mm_loadu_si128((const __m128i*) (second + x)), shift_v);
+
+    _mm_storeu_si128((__m128i*) (out + 2 * x), _mm_unpacklo_epi16(a, b));
+    _mm_storeu_si128((__m128i*) (out + 2 * x + 8), _mm_unpackhi_epi16(a, b));
+  }
+
+  return x;
+}
+
+#endif
+
+
+#if HEIF_HAVE_NEON
+
+static int interleave_chroma_row_8bit_neon(const uint8_t* first, const uint8_t* second, uint8_t* out, int width)
+{
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x2_t v;
+    v.val[0] = vld1q_u8(first + x);
+    v.val[1] = vld1q_u8(second + x);
+    vst2q_u8(out + 2 * x, v);
+  }
+
+  return x;
+}
+
+
+static int interleave_chroma_row_16bit_neon(const uint16_t* first, const uint16_t* second, uint16_t* out,
+                                            int width, int shift)
+{
+  const int16x8_t shift_v = vdupq_n_s16((int16_t) shift);
+
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    uint16x8x2_t v;
+    v.val[0] = vshlq_u16(vld1q_u16(first + x), shift_v);
+    v.val[1] = vshlq_u16(vld1q_u16(second + x), shift_v);
+    vst2q_u16(out + 2 * x, v);
+  }
+
+  return x;
+}
+
+#endif
+
+
+void select_semi_planar_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  s_kernels = Semi_planar_kernels();
+
+#if HEIF_HAVE_X86_SIMD
+  if (cpu.sse41) {
+    s_kernels.interleave_8bit = interleave_chroma_row_8bit_sse41;
+    s_kernels.interleave_16bit = interleave_chroma_row_16bit_sse41;
+  }
+#endif
+
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    s_kernels.interleave_8bit = interleave_chroma_row_8bit_neon;
+    s_kernels.interleave_16bit = interleave_chroma_row_16bit_neon;
+  }
+#endif
+
+  (void) cpu;
+}
+
+
+const Semi_planar_kernels& get_semi_planar_kernels()
+{
+  return s_kernels;
+}
@@ -0,0 +1,103 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_COLORCONVERSION_SEMI_PLANAR_H
+#define LIBHEIF_COLORCONVERSION_SEMI_PLANAR_H
+
+#include "colorconversion.h"
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+
+// Planar YCbCr 4:2:0 to NV12 / NV21 (8 bit) or P010 (>8 bit).
+// The Y plane is copied (P010: shifted into the MSBs) and the Cb/Cr planes are interleaved.
+// No resampling takes place, such that decoder output can be written directly into the
+// buffers of a video or GPU pipeline.
+class Op_YCbCr420_to_semi_planar : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+};
+
+
+// NV12 / NV21 / P010 back to planar YCbCr 4:2:0, e.g. for encoding images in these formats.
+class Op_semi_planar_to_YCbCr420 : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+};
+
+
+// --- row kernels
+
+// out[2*x] = first[x], out[2*x+1] = second[x]
+void interleave_chroma_row(const uint8_t* first, const uint8_t* second, uint8_t* out, int width);
+
+// As above, with all samples shifted left by 'shift' bits.
+void interleave_chroma_row(const uint16_t* first, const uint16_t* second, uint16_t* out, int width, int shift);
+
+
+// The SIMD kernels process a prefix of the row and return the number of chroma samples processed.
+// The remaining samples are interleaved by the scalar code.
+typedef int (* interleave_chroma_kernel_8bit)(const uint8_t* first, const uint8_t* second,
+                                              uint8_t* out, int width);
+
+typedef int (* interleave_chroma_kernel_16bit)(const uint16_t* first, const uint16_t* second,
+                                               uint16_t* out, int width, int shift);
+
+struct Semi_planar_kernels
+{
+  interleave_chroma_kernel_8bit interleave_8bit = nullptr;
+  interleave_chroma_kernel_16bit interleave_16bit = nullptr;
+};
+
+// Kernels that build the interleaved chroma plane of NV12/P010 images. See cpu_features.h for the dispatch rules.
+const Semi_planar_kernels& get_semi_planar_kernels();
+
+void select_semi_planar_kernels();
+
+#endif //LIBHEIF_COLORCONVERSION_SEMI_PLANAR_H
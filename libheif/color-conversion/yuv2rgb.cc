@@ -18,13 +18,192 @@
  * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include "yuv2rgb.h"
+#include "yuv2rgb_simd.h"
+#include "chroma_sampling_simd.h"
+#include "alpha.h"
 #include "libheif/nclx.h"
 #include "libheif/common_utils.h"
 
 
+namespace {
+  // --- Fixed-point kernels for the common matrix / range / bit depth combinations.
+  //
+  // All parameters that the generic loop in Op_YCbCr_to_RGB<Pixel>::convert_colorspace_into()
+  // checks per pixel are template parameters here, so that the inner loop is branch-free and
+  // the coefficients become compile-time constants (16 fractional bits).
+  // The limited-range scaling factors are the same as in the float code.
+
+  struct YCbCr_to_RGB_planes
+  {
+    const void* y;
+    const void* cb;
+    const void* cr;
+    void* r;
+    void* g;
+    void* b;
+
+    // strides are in pixels (not bytes)
+    size_t y_stride, cb_stride, cr_stride;
+    size_t r_stride, g_stride, b_stride;
+
+    int width, height;
+  };
+
+  typedef void (* YCbCr_to_RGB_fixed_point_kernel)(const YCbCr_to_RGB_planes& planes);
+
+
+  // Kr/Kb for the matrices that have a specialized kernel: 1 = BT.709, 6 = BT.601, 9 = BT.2020 NCL
+
+  constexpr double matrix_Kr(int matrix) { return matrix == 1 ? 0.2126 : (matrix == 9 ? 0.2627 : 0.299); }
+
+  constexpr double matrix_Kb(int matrix) { return matrix == 1 ? 0.0722 : (matrix == 9 ? 0.0593 : 0.114); }
+
+  constexpr int32_t to_fixed16(double v) { return static_cast<int32_t>(v * 65536.0 + (v < 0 ? -0.5 : 0.5)); }
+
+
+  template<class Pixel, int Matrix, int BitDepth, bool FullRange, int ShiftH, int ShiftV>
+  void YCbCr_to_RGB_fixed_point(const YCbCr_to_RGB_planes& p)
+  {
+    constexpr double Kr = matrix_Kr(Matrix);
+    constexpr double Kb = matrix_Kb(Matrix);
+    constexpr double y_scale = FullRange ? 1.0 : 1.1689;
+    constexpr double c_scale = FullRange ? 1.0 : 1.1429;
+
+    constexpr int32_t c_y = to_fixed16(y_scale);
+    constexpr int32_t c_r_cr = to_fixed16(2 * (1 - Kr) * c_scale);
+    constexpr int32_t c_g_cb = to_fixed16(2 * Kb * (1 - Kb) / (Kb + Kr - 1) * c_scale);
+    constexpr int32_t c_g_cr = to_fixed16(2 * Kr * (1 - Kr) / (Kb + Kr - 1) * c_scale);
+    constexpr int32_t c_b_cb = to_fixed16(2 * (1 - Kb) * c_scale);
+
+    constexpr int32_t y_offset = FullRange ? 0 : (16 << (BitDepth - 8));
+    constexpr int32_t half_range = 1 << (BitDepth - 1);
+    constexpr int32_t max_value = (1 << BitDepth) - 1;
+
+    for (int y = 0; y < p.height; y++) {
+      const Pixel* in_y = static_cast<const Pixel*>(p.y) + y * p.y_stride;
+      const Pixel* in_cb = static_cast<const Pixel*>(p.cb) + (y >> ShiftV) * p.cb_stride;
+      const Pixel* in_cr = static_cast<const Pixel*>(p.cr) + (y >> ShiftV) * p.cr_stride;
+      Pixel* out_r = static_cast<Pixel*>(p.r) + y * p.r_stride;
+      Pixel* out_g = static_cast<Pixel*>(p.g) + y * p.g_stride;
+      Pixel* out_b = static_cast<Pixel*>(p.b) + y * p.b_stride;
+
+      for (int x = 0; x < p.width; x++) {
+        int32_t yv = c_y * (in_y[x] - y_offset) + (1 << 15);
+        int32_t cb = in_cb[x >> ShiftH] - half_range;
+        int32_t cr = in_cr[x >> ShiftH] - half_range;
+
+        int32_t r = (yv + c_r_cr * cr) >> 16;
+        int32_t g = (yv + c_g_cb * cb + c_g_cr * cr) >> 16;
+        int32_t b = (yv + c_b_cb * cb) >> 16;
+
+        out_r[x] = static_cast<Pixel>(r < 0 ? 0 : (r > max_value ? max_value : r));
+        out_g[x] = static_cast<Pixel>(g < 0 ? 0 : (g > max_value ? max_value : g));
+        out_b[x] = static_cast<Pixel>(b < 0 ? 0 : (b > max_value ? max_value : b));
+      }
+    }
+  }
+
+
+  template<class Pixel, int Matrix, int BitDepth, bool FullRange>
+  YCbCr_to_RGB_fixed_point_kernel select_fixed_point_kernel_for_chroma(int shiftH, int shiftV)
+  {
+    if (shiftH == 0 && shiftV == 0) {
+      return &YCbCr_to_RGB_fixed_point<Pixel, Matrix, BitDepth, FullRange, 0, 0>;
+    }
+    else if (shiftH == 1 && shiftV == 0) {
+      return &YCbCr_to_RGB_fixed_point<Pixel, Matrix, BitDepth, FullRange, 1, 0>;
+    }
+    else if (shiftH == 1 && shiftV == 1) {
+      return &YCbCr_to_RGB_fixed_point<Pixel, Matrix, BitDepth, FullRange, 1, 1>;
+    }
+    else {
+      return nullptr;
+    }
+  }
+
+
+  template<class Pixel, int BitDepth>
+  YCbCr_to_RGB_fixed_point_kernel select_fixed_point_kernel_for_matrix(int matrix, bool full_range,
+                                                                       int shiftH, int shiftV)
+  {
+    switch (matrix) {
+      case 1:
+        return full_range ?
+               select_fixed_point_kernel_for_chroma<Pixel, 1, BitDepth, true>(shiftH, shiftV) :
+               select_fixed_point_kernel_for_chroma<Pixel, 1, BitDepth, false>(shiftH, shiftV);
+      case 6:
+        return full_range ?
+               select_fixed_point_kernel_for_chroma<Pixel, 6, BitDepth, true>(shiftH, shiftV) :
+               select_fixed_point_kernel_for_chroma<Pixel, 6, BitDepth, false>(shiftH, shiftV);
+      case 9:
+        return full_range ?
+               select_fixed_point_kernel_for_chroma<Pixel, 9, BitDepth, true>(shiftH, shiftV) :
+               select_fixed_point_kernel_for_chroma<Pixel, 9, BitDepth, false>(shiftH, shiftV);
+      default:
+        return nullptr;
+    }
+  }
+
+
+  YCbCr_to_RGB_fixed_point_kernel select_fixed_point_kernel(uint8_t*, int bpp, int matrix, bool full_range,
+                                                            int shiftH, int shiftV)
+  {
+    if (bpp == 8) {
+      return select_fixed_point_kernel_for_matrix<uint8_t, 8>(matrix, full_range, shiftH, shiftV);
+    }
+    else {
+      return nullptr;
+    }
+  }
+
+
+  YCbCr_to_RGB_fixed_point_kernel select_fixed_point_kernel(uint16_t*, int bpp, int matrix, bool full_range,
+                                                            int shiftH, int shiftV)
+  {
+    if (bpp == 10) {
+      return select_fixed_point_kernel_for_matrix<uint16_t, 10>(matrix, full_range, shiftH, shiftV);
+    }
+    else if (bpp == 12) {
+      return select_fixed_point_kernel_for_matrix<uint16_t, 12>(matrix, full_range, shiftH, shiftV);
+    }
+    else {
+      return nullptr;
+    }
+  }
+
+
+  // Returns nullptr when there is no specialized kernel and the generic loop has to be used.
+  template<class Pixel>
+  YCbCr_to_RGB_fixed_point_kernel get_fixed_point_kernel(int matrix_coeffs, bool full_range, int bpp,
+                                                         int shiftH, int shiftV)
+  {
+    int matrix;
+    switch (matrix_coeffs) {
+      case 1:
+        matrix = 1;
+        break;
+      case 2: // unspecified, we use the BT.601 defaults
+      case 5:
+      case 6:
+        matrix = 6;
+        break;
+      case 9:
+      case 10:
+        matrix = 9;
+        break;
+      default:
+        return nullptr;
+    }
+
+    return select_fixed_point_kernel(static_cast<Pixel*>(nullptr), bpp, matrix, full_range, shiftH, shiftV);
+  }
+}
+
+
 template<class Pixel>
 std::vector<ColorStateWithCost>
 Op_YCbCr_to_RGB<Pixel>::state_after_conversion(const ColorState& input_state,
@@ -78,8 +257,6 @@ Op_YCbCr_to_RGB<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
 {
   bool hdr = !std::is_same<Pixel, uint8_t>::value;
 
-  heif_chroma chroma = input->get_chroma_format();
-
   int bpp_y = input->get_bits_per_pixel(heif_channel_Y);
   int bpp_cb = input->get_bits_per_pixel(heif_channel_Cb);
   int bpp_cr = input->get_bits_per_pixel(heif_channel_Cr);
@@ -114,12 +291,11 @@ Op_YCbCr_to_RGB<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
   }
 
 
-  auto colorProfile = input->get_color_profile_nclx();
-
   int width = input->get_width();
   int height = input->get_height();
 
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
 
   outimg->create(width, height, heif_colorspace_RGB, heif_chroma_444);
 
@@ -135,11 +311,70 @@ Op_YCbCr_to_RGB<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
     }
   }
 
+  if (!convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+template<class Pixel>
+bool
+Op_YCbCr_to_RGB<Pixel>::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                const std::shared_ptr<HeifPixelImage>& outimg,
+                                                const ColorState& target_state,
+                                                const heif_color_conversion_options& options) const
+{
+  bool hdr = !std::is_same<Pixel, uint8_t>::value;
+
+  heif_chroma chroma = input->get_chroma_format();
+
+  int bpp_y = input->get_bits_per_pixel(heif_channel_Y);
+  int bpp_cb = input->get_bits_per_pixel(heif_channel_Cb);
+  int bpp_cr = input->get_bits_per_pixel(heif_channel_Cr);
+
+  bool has_alpha = input->has_channel(heif_channel_Alpha);
+
+  if ((bpp_y == 8) == hdr ||
+      bpp_y != bpp_cb ||
+      bpp_y != bpp_cr) {
+    return false;
+  }
+
+  int width = input->get_width();
+  int height = input->get_height();
+
+  // --- check that the output planes match the input
+
+  if (outimg->get_colorspace() != heif_colorspace_RGB ||
+      outimg->get_chroma_format() != heif_chroma_444 ||
+      outimg->get_width() != width ||
+      outimg->get_height() != height ||
+      outimg->has_channel(heif_channel_Alpha) != has_alpha) {
+    return false;
+  }
+
+  for (heif_channel channel : {heif_channel_R, heif_channel_G, heif_channel_B}) {
+    if (!outimg->has_channel(channel) ||
+        outimg->get_bits_per_pixel(channel) != bpp_y) {
+      return false;
+    }
+  }
+
+  if (has_alpha &&
+      outimg->get_bits_per_pixel(heif_channel_Alpha) != input->get_bits_per_pixel(heif_channel_Alpha)) {
+    return false;
+  }
+
+
+  auto colorProfile = input->get_color_profile_nclx();
+
   const Pixel* in_y, * in_cb, * in_cr, * in_a;
-  int in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
+  size_t in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
 
   Pixel* out_r, * out_g, * out_b, * out_a;
-  int out_r_stride = 0, out_g_stride = 0, out_b_stride = 0, out_a_stride = 0;
+  size_t out_r_stride = 0, out_g_stride = 0, out_b_stride = 0, out_a_stride = 0;
 
   in_y = (const Pixel*) input->get_plane(heif_channel_Y, &in_y_stride);
   in_cb = (const Pixel*) input->get_plane(heif_channel_Cb, &in_cb_stride);
@@ -183,8 +418,29 @@ Op_YCbCr_to_RGB<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
   if (colorProfile) {
     matrix_coeffs = colorProfile->get_matrix_coefficients();
     full_range_flag = colorProfile->get_full_range_flag();
-    coeffs = get_YCbCr_to_RGB_coefficients(colorProfile->get_matrix_coefficients(),
-                                           colorProfile->get_colour_primaries());
+    coeffs = get_color_conversion_coefficients(colorProfile->get_matrix_coefficients(),
+                                               colorProfile->get_colour_primaries(),
+                                               full_range_flag, bpp_y).ycbcr_to_rgb;
+  }
+
+
+  YCbCr_to_RGB_fixed_point_kernel kernel = get_fixed_point_kernel<Pixel>(matrix_coeffs, full_range_flag, bpp_y,
+                                                                          shiftH, shiftV);
+  if (kernel) {
+    YCbCr_to_RGB_planes planes{in_y, in_cb, in_cr, out_r, out_g, out_b,
+                               in_y_stride, in_cb_stride, in_cr_stride,
+                               out_r_stride, out_g_stride, out_b_stride,
+                               width, height};
+    kernel(planes);
+
+    if (has_alpha) {
+      int copyWidth = (hdr ? width * 2 : width);
+      for (int y = 0; y < height; y++) {
+        memcpy(&out_a[y * out_a_stride], &in_a[y * in_a_stride], copyWidth);
+      }
+    }
+
+    return true;
   }
 
 
@@ -242,273 +498,810 @@ Op_YCbCr_to_RGB<Pixel>::convert_colorspace(const std::shared_ptr<const HeifPixel
     }
   }
 
-  return outimg;
+  return true;
 }
 
 template class Op_YCbCr_to_RGB<uint8_t>;
 template class Op_YCbCr_to_RGB<uint16_t>;
 
 
-std::vector<ColorStateWithCost>
-Op_YCbCr420_to_RGB24::state_after_conversion(const ColorState& input_state,
-                                             const ColorState& target_state,
-                                             const heif_color_conversion_options& options) const
-{
-  // this Op only implements the nearest-neighbor algorithm
+namespace {
+  // The RGB offsets that each chroma sample of a row adds to the luma values.
+  // With vertically subsampled chroma, they are computed once per chroma row and used for both luma rows.
+  struct ChromaOffsets
+  {
+    explicit ChromaOffsets(int chroma_width) : r(chroma_width), g(chroma_width), b(chroma_width) {}
 
-  if (input_state.chroma != heif_chroma_444) {
-    if (options.preferred_chroma_upsampling_algorithm != heif_chroma_upsampling_nearest_neighbor &&
-        options.only_use_preferred_chroma_algorithm) {
-      return {};
+    void compute(const uint8_t* cb_line, const uint8_t* cr_line, int r_cr, int g_cb, int g_cr, int b_cb)
+    {
+      for (size_t cx = 0; cx < r.size(); cx++) {
+        int cb = cb_line[cx] - 128;
+        int cr = cr_line[cx] - 128;
+
+        r[cx] = static_cast<int16_t>((r_cr * cr + 128) >> 8);
+        g[cx] = static_cast<int16_t>((g_cb * cb + g_cr * cr + 128) >> 8);
+        b[cx] = static_cast<int16_t>((b_cb * cb + 128) >> 8);
+      }
+    }
+
+    std::vector<int16_t> r, g, b;
+  };
+
+
+  // Common input checks of the ops that convert with nearest-neighbor chroma upsampling.
+  bool accepts_nearest_neighbor_input(const ColorState& input_state,
+                                      const heif_color_conversion_options& options,
+                                      bool full_range_only)
+  {
+    if (input_state.chroma != heif_chroma_444) {
+      if (options.preferred_chroma_upsampling_algorithm != heif_chroma_upsampling_nearest_neighbor &&
+          options.only_use_preferred_chroma_algorithm) {
+        return false;
+      }
+    }
+
+    if (input_state.nclx_profile) {
+      int matrix = input_state.nclx_profile->get_matrix_coefficients();
+      if (matrix == 0 || matrix == 8 || matrix == 11 || matrix == 14) {
+        return false;
+      }
+      if (full_range_only && !input_state.nclx_profile->get_full_range_flag()) {
+        return false;
+      }
     }
+
+    return true;
   }
 
-  if (input_state.colorspace != heif_colorspace_YCbCr ||
-      input_state.chroma != heif_chroma_420 ||
-      input_state.bits_per_pixel != 8 ||
-      input_state.has_alpha == true) {
-    return {};
+
+  bool has_8bit_YCbCr_planes(const HeifPixelImage& input)
+  {
+    return (input.get_bits_per_pixel(heif_channel_Y) == 8 &&
+            input.get_bits_per_pixel(heif_channel_Cb) == 8 &&
+            input.get_bits_per_pixel(heif_channel_Cr) == 8);
   }
 
-  if (input_state.nclx_profile) {
-    int matrix = input_state.nclx_profile->get_matrix_coefficients();
-    if (matrix == 0 || matrix == 8 || matrix == 11 || matrix == 14) {
-      return {};
+
+  // Returns the row itself if it has 8 bits. Rows with more bits are rounded to 8 bits into the buffer.
+  const uint8_t* get_8bit_row(const uint8_t* row, int bpp, std::vector<uint8_t>& buffer)
+  {
+    if (bpp == 8) {
+      return row;
     }
-    if (!input_state.nclx_profile->get_full_range_flag()) {
-      return {};
+
+    const auto* in = reinterpret_cast<const uint16_t*>(row);
+    const int shift = bpp - 8;
+    const int rounding = 1 << (shift - 1);
+
+    for (size_t x = 0; x < buffer.size(); x++) {
+      buffer[x] = static_cast<uint8_t>(std::min((in[x] + rounding) >> shift, 255));
     }
+
+    return buffer.data();
   }
 
-  std::vector<ColorStateWithCost> states;
 
-  ColorState output_state;
+  // Nearest-neighbor chroma upsampling, YCbCr to RGB conversion and interleaving of full-range
+  // 4:2:0, 4:2:2 and 4:4:4 images in a single pass. The output is RGB (3 bytes per pixel) or RGBA (4 bytes).
+  // HDR input is rounded to 8 bits row by row (only used with heif_color_conversion_accuracy_fast).
+  void convert_YCbCr_to_interleaved_8bit(const HeifPixelImage& input, HeifPixelImage& outimg,
+                                         int bytes_per_pixel, AlphaPremultiplicationChange alpha_change)
+  {
+    int width = input.get_width();
+    int height = input.get_height();
 
-  // --- convert to RGB
+    heif_chroma chroma = input.get_chroma_format();
+    const int shiftH = (chroma == heif_chroma_444 ? 0 : 1);
+    const int shiftV = (chroma == heif_chroma_420 ? 1 : 0);
 
-  output_state.colorspace = heif_colorspace_RGB;
-  output_state.chroma = heif_chroma_interleaved_RGB;
-  output_state.has_alpha = false;
-  output_state.bits_per_pixel = 8;
+    auto colorProfile = input.get_color_profile_nclx();
+    const ColorConversionCoefficients& coeffs = colorProfile ?
+                                                get_color_conversion_coefficients(colorProfile->get_matrix_coefficients(),
+                                                                                  colorProfile->get_colour_primaries(),
+                                                                                  colorProfile->get_full_range_flag(), 8) :
+                                                get_color_conversion_coefficients(2, 2, true, 8);
 
-  states.push_back({output_state, SpeedCosts_Unoptimized});
+    const bool with_alpha = (bytes_per_pixel == 4 && input.has_channel(heif_channel_Alpha));
 
-  return states;
-}
+    const uint8_t* in_y, * in_cb, * in_cr, * in_a = nullptr;
+    size_t in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
 
+    uint8_t* out_p;
+    size_t out_p_stride = 0;
 
-std::shared_ptr<HeifPixelImage>
-Op_YCbCr420_to_RGB24::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
-                                         const ColorState& target_state,
-                                         const heif_color_conversion_options& options) const
-{
-  if (input->get_bits_per_pixel(heif_channel_Y) != 8 ||
-      input->get_bits_per_pixel(heif_channel_Cb) != 8 ||
-      input->get_bits_per_pixel(heif_channel_Cr) != 8) {
-    return nullptr;
-  }
+    in_y = input.get_plane(heif_channel_Y, &in_y_stride);
+    in_cb = input.get_plane(heif_channel_Cb, &in_cb_stride);
+    in_cr = input.get_plane(heif_channel_Cr, &in_cr_stride);
+    if (with_alpha) {
+      in_a = input.get_plane(heif_channel_Alpha, &in_a_stride);
+    }
 
-  auto outimg = std::make_shared<HeifPixelImage>();
+    out_p = outimg.get_plane(heif_channel_interleaved, &out_p_stride);
 
-  int width = input->get_width();
-  int height = input->get_height();
+    const YCbCr_to_RGB_kernels& kernels = get_YCbCr_to_RGB_kernels();
+    YCbCr_row_to_RGB_kernel kernel;
+    if (bytes_per_pixel == 3) {
+      kernel = (shiftH ? kernels.to_RGB24 : kernels.to_RGB24_444);
+    }
+    else {
+      kernel = (shiftH ? kernels.to_RGB32 : kernels.to_RGB32_444);
+    }
 
-  outimg->create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_24bit);
+    const int chroma_width = (width + shiftH) >> shiftH;
+    ChromaOffsets offsets(chroma_width);
 
-  if (!outimg->add_plane(heif_channel_interleaved, width, height, 8)) {
-    return nullptr;
-  }
+    const int bpp = input.get_bits_per_pixel(heif_channel_Y);
+    const int bpp_a = with_alpha ? input.get_bits_per_pixel(heif_channel_Alpha) : 8;
 
-  auto colorProfile = input->get_color_profile_nclx();
-  YCbCr_to_RGB_coefficients coeffs = YCbCr_to_RGB_coefficients::defaults();
-  if (colorProfile) {
-    coeffs = get_YCbCr_to_RGB_coefficients(colorProfile->get_matrix_coefficients(),
-                                           colorProfile->get_colour_primaries());
-  }
+    std::vector<uint8_t> y_row(bpp != 8 ? width : 0);
+    std::vector<uint8_t> cb_row(bpp != 8 ? chroma_width : 0);
+    std::vector<uint8_t> cr_row(bpp != 8 ? chroma_width : 0);
+    std::vector<uint8_t> a_row(bpp_a != 8 ? width : 0);
 
-  int r_cr = static_cast<int>(std::lround(256 * coeffs.r_cr));
-  int g_cr = static_cast<int>(std::lround(256 * coeffs.g_cr));
-  int g_cb = static_cast<int>(std::lround(256 * coeffs.g_cb));
-  int b_cb = static_cast<int>(std::lround(256 * coeffs.b_cb));
+    for (int y = 0; y < height; y++) {
+      if ((y & shiftV) == 0) {
+        offsets.compute(get_8bit_row(in_cb + (y >> shiftV) * in_cb_stride, bpp, cb_row),
+                        get_8bit_row(in_cr + (y >> shiftV) * in_cr_stride, bpp, cr_row),
+                        coeffs.r_cr, coeffs.g_cb, coeffs.g_cr, coeffs.b_cb);
+      }
 
-  const uint8_t* in_y, * in_cb, * in_cr;
-  int in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0;
+      const uint8_t* y_line = get_8bit_row(in_y + y * in_y_stride, bpp, y_row);
+      const uint8_t* a_line = with_alpha ? get_8bit_row(in_a + y * in_a_stride, bpp_a, a_row) : nullptr;
+      uint8_t* out_line = out_p + y * out_p_stride;
 
-  uint8_t* out_p;
-  int out_p_stride = 0;
+      int x = 0;
+      if (kernel) {
+        x = kernel(y_line, offsets.r.data(), offsets.g.data(), offsets.b.data(), a_line, out_line, width);
+      }
 
-  in_y = input->get_plane(heif_channel_Y, &in_y_stride);
-  in_cb = input->get_plane(heif_channel_Cb, &in_cb_stride);
-  in_cr = input->get_plane(heif_channel_Cr, &in_cr_stride);
-  out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+      for (; x < width; x++) {
+        int yv = y_line[x];
+        uint8_t* out = out_line + bytes_per_pixel * x;
 
-  int x, y;
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      int yv = (in_y[y * in_y_stride + x]);
-      int cb = (in_cb[y / 2 * in_cb_stride + x / 2] - 128);
-      int cr = (in_cr[y / 2 * in_cr_stride + x / 2] - 128);
+        out[0] = clip_int_u8(yv + offsets.r[x >> shiftH]);
+        out[1] = clip_int_u8(yv + offsets.g[x >> shiftH]);
+        out[2] = clip_int_u8(yv + offsets.b[x >> shiftH]);
+        if (bytes_per_pixel == 4) {
+          out[3] = a_line ? a_line[x] : 0xFF;
+        }
+      }
 
-      out_p[y * out_p_stride + 3 * x + 0] = clip_int_u8(yv + ((r_cr * cr + 128) >> 8));
-      out_p[y * out_p_stride + 3 * x + 1] = clip_int_u8(yv + ((g_cb * cb + g_cr * cr + 128) >> 8));
-      out_p[y * out_p_stride + 3 * x + 2] = clip_int_u8(yv + ((b_cb * cb + 128) >> 8));
+      // while the row is still in the cache
+      if (alpha_change == AlphaPremultiplicationChange::premultiply) {
+        premultiply_alpha_RGBA_row(out_line, width);
+      }
+      else if (alpha_change == AlphaPremultiplicationChange::unpremultiply) {
+        unpremultiply_alpha_RGBA_row(out_line, width);
+      }
     }
   }
 
-  return outimg;
-}
 
+  std::shared_ptr<HeifPixelImage> create_interleaved_8bit_image(const HeifPixelImage& input, heif_chroma chroma)
+  {
+    auto outimg = std::make_shared<HeifPixelImage>();
+    outimg->set_plane_allocator(input.get_plane_allocator());
 
-std::vector<ColorStateWithCost>
-Op_YCbCr420_to_RGB32::state_after_conversion(const ColorState& input_state,
-                                             const ColorState& target_state,
-                                             const heif_color_conversion_options& options) const
-{
-  // this Op only implements the nearest-neighbor algorithm
+    int width = input.get_width();
+    int height = input.get_height();
 
-  if (input_state.chroma != heif_chroma_444) {
-    if (options.preferred_chroma_upsampling_algorithm != heif_chroma_upsampling_nearest_neighbor &&
-        options.only_use_preferred_chroma_algorithm) {
-      return {};
+    outimg->create(width, height, heif_colorspace_RGB, chroma);
+
+    if (!outimg->add_plane(heif_channel_interleaved, width, height, 8)) {
+      return nullptr;
     }
+
+    return outimg;
   }
 
-  // Note: no input alpha channel required. It will be filled up with 0xFF.
 
-  if (input_state.colorspace != heif_colorspace_YCbCr ||
-      input_state.chroma != heif_chroma_420 ||
-      input_state.bits_per_pixel != 8) {
-    return {};
+  bool is_matching_interleaved_8bit_image(const HeifPixelImage& input, const HeifPixelImage& outimg, heif_chroma chroma)
+  {
+    return (outimg.get_chroma_format() == chroma &&
+            outimg.get_width() == input.get_width() &&
+            outimg.get_height() == input.get_height() &&
+            outimg.has_channel(heif_channel_interleaved) &&
+            outimg.get_bits_per_pixel(heif_channel_interleaved) == 8);
   }
 
-  if (input_state.nclx_profile) {
-    int matrix = input_state.nclx_profile->get_matrix_coefficients();
-    if (matrix == 0 || matrix == 8 || matrix == 11 || matrix == 14) {
-      return {};
-    }
-    if (!input_state.nclx_profile->get_full_range_flag()) {
-      return {};
-    }
+
+  ColorStateWithCost RGB24_output_state(YCbCr_row_to_RGB_kernel kernel)
+  {
+    ColorState output_state;
+    output_state.colorspace = heif_colorspace_RGB;
+    output_state.chroma = heif_chroma_interleaved_RGB;
+    output_state.has_alpha = false;
+    output_state.bits_per_pixel = 8;
+
+    return {output_state, kernel ? SpeedCosts_OptimizedSoftware : SpeedCosts_Unoptimized};
   }
 
-  std::vector<ColorStateWithCost> states;
 
-  ColorState output_state;
+  ColorStateWithCost RGB32_output_state(YCbCr_row_to_RGB_kernel kernel)
+  {
+    // Note: no input alpha channel required. It will be filled up with 0xFF.
 
-  // --- convert to RGB
+    ColorState output_state;
+    output_state.colorspace = heif_colorspace_RGB;
+    output_state.chroma = heif_chroma_interleaved_RGBA;
+    output_state.has_alpha = true;
+    output_state.bits_per_pixel = 8;
 
-  output_state.colorspace = heif_colorspace_RGB;
-  output_state.chroma = heif_chroma_interleaved_RGBA;
-  output_state.has_alpha = true;
-  output_state.bits_per_pixel = 8;
+    return {output_state, kernel ? SpeedCosts_OptimizedSoftware : SpeedCosts_Unoptimized};
+  }
 
-  states.push_back({output_state, SpeedCosts_Unoptimized});
 
-  return states;
-}
+  // The fused conversion is only fast if there is a fixed-point kernel for the matrix and bit depth.
+  std::vector<ColorStateWithCost> RRGGBBaa_output_states(const ColorState& input_state)
+  {
+    int matrix_coeffs = 2;
+    bool full_range = true;
+    if (input_state.nclx_profile) {
+      matrix_coeffs = input_state.nclx_profile->get_matrix_coefficients();
+      full_range = input_state.nclx_profile->get_full_range_flag();
+    }
 
+    int shiftH = (input_state.chroma == heif_chroma_444 ? 0 : 1);
+    int costs = (get_fixed_point_kernel<uint16_t>(matrix_coeffs, full_range, input_state.bits_per_pixel, shiftH, 0) ?
+                 SpeedCosts_OptimizedSoftware : SpeedCosts_Unoptimized);
 
-std::shared_ptr<HeifPixelImage>
-Op_YCbCr420_to_RGB32::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
-                                         const ColorState& target_state,
-                                         const heif_color_conversion_options& options) const
-{
-  if (input->get_bits_per_pixel(heif_channel_Y) != 8 ||
-      input->get_bits_per_pixel(heif_channel_Cb) != 8 ||
-      input->get_bits_per_pixel(heif_channel_Cr) != 8) {
-    return nullptr;
-  }
+    std::vector<ColorStateWithCost> states;
 
-  auto outimg = std::make_shared<HeifPixelImage>();
+    ColorState output_state;
+    output_state.colorspace = heif_colorspace_RGB;
+    output_state.chroma = (input_state.has_alpha ?
+                           heif_chroma_interleaved_RRGGBBAA_LE : heif_chroma_interleaved_RRGGBB_LE);
+    output_state.has_alpha = input_state.has_alpha;
+    output_state.bits_per_pixel = input_state.bits_per_pixel;
 
-  int width = input->get_width();
-  int height = input->get_height();
+    states.push_back({output_state, costs});
 
-  outimg->create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_32bit);
+    output_state.chroma = (input_state.has_alpha ?
+                           heif_chroma_interleaved_RRGGBBAA_BE : heif_chroma_interleaved_RRGGBB_BE);
 
-  if (!outimg->add_plane(heif_channel_interleaved, width, height, 8)) {
-    return nullptr;
+    states.push_back({output_state, costs});
+
+    return states;
   }
 
 
-  // --- get conversion coefficients
+  // Nearest-neighbor chroma upsampling, YCbCr to RGB conversion and interleaving of HDR
+  // 4:2:0, 4:2:2 and 4:4:4 images in a single pass over the image.
+  std::shared_ptr<HeifPixelImage> convert_YCbCr_HDR_to_RRGGBBaa(const std::shared_ptr<const HeifPixelImage>& input,
+                                                                const ColorState& target_state)
+  {
+    int width = input->get_width();
+    int height = input->get_height();
 
-  auto colorProfile = input->get_color_profile_nclx();
-  YCbCr_to_RGB_coefficients coeffs = YCbCr_to_RGB_coefficients::defaults();
-  if (colorProfile) {
-    coeffs = get_YCbCr_to_RGB_coefficients(colorProfile->get_matrix_coefficients(),
-                                           colorProfile->get_colour_primaries());
-  }
+    heif_chroma chroma = input->get_chroma_format();
+    const int shiftH = (chroma == heif_chroma_444 ? 0 : 1);
+    const int shiftV = (chroma == heif_chroma_420 ? 1 : 0);
 
-  int r_cr = static_cast<int>(std::lround(256 * coeffs.r_cr));
-  int g_cr = static_cast<int>(std::lround(256 * coeffs.g_cr));
-  int g_cb = static_cast<int>(std::lround(256 * coeffs.g_cb));
-  int b_cb = static_cast<int>(std::lround(256 * coeffs.b_cb));
+    int bpp = input->get_bits_per_pixel(heif_channel_Y);
+    bool has_alpha = input->has_channel(heif_channel_Alpha);
 
+    int le = (target_state.chroma == heif_chroma_interleaved_RRGGBB_LE ||
+              target_state.chroma == heif_chroma_interleaved_RRGGBBAA_LE) ? 1 : 0;
 
-  const bool with_alpha = input->has_channel(heif_channel_Alpha);
+    auto outimg = std::make_shared<HeifPixelImage>();
+    outimg->set_plane_allocator(input->get_plane_allocator());
+    outimg->create(width, height, heif_colorspace_RGB, target_state.chroma);
 
-  const uint8_t* in_y, * in_cb, * in_cr, * in_a = nullptr;
-  int in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
+    int bytesPerPixel = has_alpha ? 8 : 6;
 
-  uint8_t* out_p;
-  int out_p_stride = 0;
+    if (!outimg->add_plane(heif_channel_interleaved, width, height, bpp)) {
+      return nullptr;
+    }
 
-  in_y = input->get_plane(heif_channel_Y, &in_y_stride);
-  in_cb = input->get_plane(heif_channel_Cb, &in_cb_stride);
-  in_cr = input->get_plane(heif_channel_Cr, &in_cr_stride);
-  if (with_alpha) {
-    in_a = input->get_plane(heif_channel_Alpha, &in_a_stride);
-  }
+    uint8_t* out_p;
+    size_t out_p_stride = 0;
 
-  out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+    const uint16_t* in_y, * in_cb, * in_cr, * in_a = nullptr;
+    size_t in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
 
-  int x, y;
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
+    out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
+    in_y = (uint16_t*) input->get_plane(heif_channel_Y, &in_y_stride);
+    in_cb = (uint16_t*) input->get_plane(heif_channel_Cb, &in_cb_stride);
+    in_cr = (uint16_t*) input->get_plane(heif_channel_Cr, &in_cr_stride);
+
+    if (has_alpha) {
+      in_a = (uint16_t*) input->get_plane(heif_channel_Alpha, &in_a_stride);
+    }
+
+    int maxval = (1 << bpp) - 1;
+
+    int matrix_coeffs = 2;
+    bool full_range_flag = true;
+    YCbCr_to_RGB_coefficients coeffs = YCbCr_to_RGB_coefficients::defaults();
+
+    auto colorProfile = input->get_color_profile_nclx();
+    if (colorProfile) {
+      matrix_coeffs = colorProfile->get_matrix_coefficients();
+      full_range_flag = colorProfile->get_full_range_flag();
+      coeffs = get_color_conversion_coefficients(colorProfile->get_matrix_coefficients(),
+                                                 colorProfile->get_colour_primaries(),
+                                                 full_range_flag, bpp).ycbcr_to_rgb;
+    }
+
+    float limited_range_offset = static_cast<float>(16 << (bpp - 8));
 
-      int yv = (in_y[y * in_y_stride + x]);
-      int cb = (in_cb[y / 2 * in_cb_stride + x / 2] - 128);
-      int cr = (in_cr[y / 2 * in_cr_stride + x / 2] - 128);
+    AlphaPremultiplicationChange alpha_change = get_alpha_premultiplication_change(*input, target_state);
 
-      out_p[y * out_p_stride + 4 * x + 0] = clip_int_u8(yv + ((r_cr * cr + 128) >> 8));
-      out_p[y * out_p_stride + 4 * x + 1] = clip_int_u8(yv + ((g_cb * cb + g_cr * cr + 128) >> 8));
-      out_p[y * out_p_stride + 4 * x + 2] = clip_int_u8(yv + ((b_cb * cb + 128) >> 8));
+    // Each row is converted to planar RGB into a row buffer and then interleaved, while it is still in the cache.
+    // The fixed-point kernel is called for single rows, hence without vertical subsampling.
+    YCbCr_to_RGB_fixed_point_kernel kernel = get_fixed_point_kernel<uint16_t>(matrix_coeffs, full_range_flag, bpp,
+                                                                              shiftH, 0);
 
+    std::vector<uint16_t> rgb_row(3 * static_cast<size_t>(width));
+    uint16_t* row_r = rgb_row.data();
+    uint16_t* row_g = row_r + width;
+    uint16_t* row_b = row_g + width;
 
-      if (with_alpha) {
-        out_p[y * out_p_stride + 4 * x + 3] = in_a[y * in_a_stride + x];
+    for (int y = 0; y < height; y++) {
+      const uint16_t* y_line = in_y + y * in_y_stride / 2;
+      const uint16_t* cb_line = in_cb + (y >> shiftV) * in_cb_stride / 2;
+      const uint16_t* cr_line = in_cr + (y >> shiftV) * in_cr_stride / 2;
+
+      if (kernel) {
+        YCbCr_to_RGB_planes planes{y_line, cb_line, cr_line, row_r, row_g, row_b,
+                                   0, 0, 0, 0, 0, 0,
+                                   width, 1};
+        kernel(planes);
       }
       else {
-        out_p[y * out_p_stride + 4 * x + 3] = 0xFF;
+        for (int x = 0; x < width; x++) {
+          float y_ = y_line[x];
+          float cb = static_cast<float>(cb_line[x >> shiftH] - (1 << (bpp - 1)));
+          float cr = static_cast<float>(cr_line[x >> shiftH] - (1 << (bpp - 1)));
+
+          if (!full_range_flag) {
+            y_ = (y_ - limited_range_offset) * 1.1689f;
+            cb = cb * 1.1429f;
+            cr = cr * 1.1429f;
+          }
+
+          row_r[x] = static_cast<uint16_t>(clip_f_u16(y_ + coeffs.r_cr * cr, maxval));
+          row_g[x] = static_cast<uint16_t>(clip_f_u16(y_ + coeffs.g_cb * cb + coeffs.g_cr * cr, maxval));
+          row_b[x] = static_cast<uint16_t>(clip_f_u16(y_ + coeffs.b_cb * cb, maxval));
+        }
       }
-    }
-  }
 
-  return outimg;
-}
+      const uint16_t* a_line = has_alpha ? in_a + y * in_a_stride / 2 : nullptr;
+      uint8_t* out_line = out_p + y * out_p_stride;
+
+      for (int x = 0; x < width; x++) {
+        int r = row_r[x];
+        int g = row_g[x];
+        int b = row_b[x];
+
+        if (alpha_change != AlphaPremultiplicationChange::none) {
+          uint16_t a = a_line[x];
+          if (alpha_change == AlphaPremultiplicationChange::premultiply) {
+            r = premultiply_alpha_value((uint16_t) r, a, maxval);
+            g = premultiply_alpha_value((uint16_t) g, a, maxval);
+            b = premultiply_alpha_value((uint16_t) b, a, maxval);
+          }
+          else {
+            r = unpremultiply_alpha_value((uint16_t) r, a, maxval, maxval);
+            g = unpremultiply_alpha_value((uint16_t) g, a, maxval, maxval);
+            b = unpremultiply_alpha_value((uint16_t) b, a, maxval, maxval);
+          }
+        }
 
+        uint8_t* out = out_line + bytesPerPixel * x;
 
-std::vector<ColorStateWithCost>
-Op_YCbCr420_to_RRGGBBaa::state_after_conversion(const ColorState& input_state,
-                                                const ColorState& target_state,
-                                                const heif_color_conversion_options& options) const
+        out[0 + le] = (uint8_t) (r >> 8);
+        out[2 + le] = (uint8_t) (g >> 8);
+        out[4 + le] = (uint8_t) (b >> 8);
+
+        out[1 - le] = (uint8_t) (r & 0xff);
+        out[3 - le] = (uint8_t) (g & 0xff);
+        out[5 - le] = (uint8_t) (b & 0xff);
+
+        if (has_alpha) {
+          out[6 + le] = (uint8_t) (a_line[x] >> 8);
+          out[7 - le] = (uint8_t) (a_line[x] & 0xff);
+        }
+      }
+    }
+
+    return outimg;
+  }
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr420_to_RGB24::state_after_conversion(const ColorState& input_state,
+                                             const ColorState& target_state,
+                                             const heif_color_conversion_options& options) const
 {
   // this Op only implements the nearest-neighbor algorithm
 
-  if (input_state.chroma != heif_chroma_444) {
-    if (options.preferred_chroma_upsampling_algorithm != heif_chroma_upsampling_nearest_neighbor &&
-        options.only_use_preferred_chroma_algorithm) {
-      return {};
-    }
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      input_state.chroma != heif_chroma_420 ||
+      input_state.bits_per_pixel != 8 ||
+      input_state.has_alpha == true) {
+    return {};
+  }
+
+  if (!accepts_nearest_neighbor_input(input_state, options, true)) {
+    return {};
+  }
+
+  return {RGB24_output_state(get_YCbCr_to_RGB_kernels().to_RGB24)};
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_YCbCr420_to_RGB24::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                         const ColorState& target_state,
+                                         const heif_color_conversion_options& options) const
+{
+  auto outimg = create_interleaved_8bit_image(*input, heif_chroma_interleaved_24bit);
+  if (!outimg || !convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+bool
+Op_YCbCr420_to_RGB24::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                              const std::shared_ptr<HeifPixelImage>& outimg,
+                                              const ColorState& target_state,
+                                              const heif_color_conversion_options& options) const
+{
+  if (!has_8bit_YCbCr_planes(*input) ||
+      !is_matching_interleaved_8bit_image(*input, *outimg, heif_chroma_interleaved_RGB)) {
+    return false;
   }
 
+  convert_YCbCr_to_interleaved_8bit(*input, *outimg, 3, AlphaPremultiplicationChange::none);
+
+  return true;
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr420_to_RGB32::state_after_conversion(const ColorState& input_state,
+                                             const ColorState& target_state,
+                                             const heif_color_conversion_options& options) const
+{
+  // this Op only implements the nearest-neighbor algorithm
+
   if (input_state.colorspace != heif_colorspace_YCbCr ||
       input_state.chroma != heif_chroma_420 ||
+      input_state.bits_per_pixel != 8) {
+    return {};
+  }
+
+  if (!accepts_nearest_neighbor_input(input_state, options, true)) {
+    return {};
+  }
+
+  std::vector<ColorStateWithCost> states;
+  states.push_back(RGB32_output_state(get_YCbCr_to_RGB_kernels().to_RGB32));
+
+  add_alpha_premultiplication_states(states, input_state, target_state);
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_YCbCr420_to_RGB32::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                         const ColorState& target_state,
+                                         const heif_color_conversion_options& options) const
+{
+  auto outimg = create_interleaved_8bit_image(*input, heif_chroma_interleaved_32bit);
+  if (!outimg || !convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+bool
+Op_YCbCr420_to_RGB32::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                              const std::shared_ptr<HeifPixelImage>& outimg,
+                                              const ColorState& target_state,
+                                              const heif_color_conversion_options& options) const
+{
+  if (!has_8bit_YCbCr_planes(*input) ||
+      !is_matching_interleaved_8bit_image(*input, *outimg, heif_chroma_interleaved_RGBA)) {
+    return false;
+  }
+
+  convert_YCbCr_to_interleaved_8bit(*input, *outimg, 4, get_alpha_premultiplication_change(*input, target_state));
+
+  return true;
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr420_to_RRGGBBaa::state_after_conversion(const ColorState& input_state,
+                                                const ColorState& target_state,
+                                                const heif_color_conversion_options& options) const
+{
+  // this Op only implements the nearest-neighbor algorithm
+
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      input_state.chroma != heif_chroma_420 ||
+      input_state.bits_per_pixel == 8) {
+    return {};
+  }
+
+  if (!accepts_nearest_neighbor_input(input_state, options, false)) {
+    return {};
+  }
+
+  std::vector<ColorStateWithCost> states = RRGGBBaa_output_states(input_state);
+
+  add_alpha_premultiplication_states(states, input_state, target_state);
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_YCbCr420_to_RRGGBBaa::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                            const ColorState& target_state,
+                                            const heif_color_conversion_options& options) const
+{
+  return convert_YCbCr_HDR_to_RRGGBBaa(input, target_state);
+}
+
+
+static bool is_422_or_444(heif_chroma chroma)
+{
+  return chroma == heif_chroma_422 || chroma == heif_chroma_444;
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr422_444_to_RGB24::state_after_conversion(const ColorState& input_state,
+                                                 const ColorState& target_state,
+                                                 const heif_color_conversion_options& options) const
+{
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      !is_422_or_444(input_state.chroma) ||
+      input_state.bits_per_pixel != 8 ||
+      input_state.has_alpha == true) {
+    return {};
+  }
+
+  if (!accepts_nearest_neighbor_input(input_state, options, true)) {
+    return {};
+  }
+
+  const YCbCr_to_RGB_kernels& kernels = get_YCbCr_to_RGB_kernels();
+  return {RGB24_output_state(input_state.chroma == heif_chroma_444 ? kernels.to_RGB24_444 : kernels.to_RGB24)};
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_YCbCr422_444_to_RGB24::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                             const ColorState& target_state,
+                                             const heif_color_conversion_options& options) const
+{
+  auto outimg = create_interleaved_8bit_image(*input, heif_chroma_interleaved_24bit);
+  if (!outimg || !convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+bool
+Op_YCbCr422_444_to_RGB24::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                  const std::shared_ptr<HeifPixelImage>& outimg,
+                                                  const ColorState& target_state,
+                                                  const heif_color_conversion_options& options) const
+{
+  if (!is_422_or_444(input->get_chroma_format()) ||
+      !has_8bit_YCbCr_planes(*input) ||
+      !is_matching_interleaved_8bit_image(*input, *outimg, heif_chroma_interleaved_RGB)) {
+    return false;
+  }
+
+  convert_YCbCr_to_interleaved_8bit(*input, *outimg, 3, AlphaPremultiplicationChange::none);
+
+  return true;
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr422_444_to_RGB32::state_after_conversion(const ColorState& input_state,
+                                                 const ColorState& target_state,
+                                                 const heif_color_conversion_options& options) const
+{
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      !is_422_or_444(input_state.chroma) ||
+      input_state.bits_per_pixel != 8) {
+    return {};
+  }
+
+  if (!accepts_nearest_neighbor_input(input_state, options, true)) {
+    return {};
+  }
+
+  const YCbCr_to_RGB_kernels& kernels = get_YCbCr_to_RGB_kernels();
+
+  std::vector<ColorStateWithCost> states;
+  states.push_back(RGB32_output_state(input_state.chroma == heif_chroma_444 ? kernels.to_RGB32_444 : kernels.to_RGB32));
+
+  add_alpha_premultiplication_states(states, input_state, target_state);
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_YCbCr422_444_to_RGB32::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                             const ColorState& target_state,
+                                             const heif_color_conversion_options& options) const
+{
+  auto outimg = create_interleaved_8bit_image(*input, heif_chroma_interleaved_32bit);
+  if (!outimg || !convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+bool
+Op_YCbCr422_444_to_RGB32::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                  const std::shared_ptr<HeifPixelImage>& outimg,
+                                                  const ColorState& target_state,
+                                                  const heif_color_conversion_options& options) const
+{
+  if (!is_422_or_444(input->get_chroma_format()) ||
+      !has_8bit_YCbCr_planes(*input) ||
+      !is_matching_interleaved_8bit_image(*input, *outimg, heif_chroma_interleaved_RGBA)) {
+    return false;
+  }
+
+  convert_YCbCr_to_interleaved_8bit(*input, *outimg, 4, get_alpha_premultiplication_change(*input, target_state));
+
+  return true;
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr422_444_to_RRGGBBaa::state_after_conversion(const ColorState& input_state,
+                                                    const ColorState& target_state,
+                                                    const heif_color_conversion_options& options) const
+{
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      !is_422_or_444(input_state.chroma) ||
       input_state.bits_per_pixel == 8) {
     return {};
   }
 
+  if (!accepts_nearest_neighbor_input(input_state, options, false)) {
+    return {};
+  }
+
+  std::vector<ColorStateWithCost> states = RRGGBBaa_output_states(input_state);
+
+  add_alpha_premultiplication_states(states, input_state, target_state);
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_YCbCr422_444_to_RRGGBBaa::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                                const ColorState& target_state,
+                                                const heif_color_conversion_options& options) const
+{
+  return convert_YCbCr_HDR_to_RRGGBBaa(input, target_state);
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr_HDR_to_RGB24_32_fast::state_after_conversion(const ColorState& input_state,
+                                                      const ColorState& target_state,
+                                                      const heif_color_conversion_options& options) const
+{
+  if (options.conversion_accuracy != heif_color_conversion_accuracy_fast) {
+    return {};
+  }
+
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      (input_state.chroma != heif_chroma_420 && !is_422_or_444(input_state.chroma)) ||
+      input_state.bits_per_pixel <= 8 ||
+      input_state.bits_per_pixel > 16) {
+    return {};
+  }
+
+  if (!accepts_nearest_neighbor_input(input_state, options, true)) {
+    return {};
+  }
+
+  const YCbCr_to_RGB_kernels& kernels = get_YCbCr_to_RGB_kernels();
+  const bool is_444 = (input_state.chroma == heif_chroma_444);
+
+  std::vector<ColorStateWithCost> states;
+
+  if (!input_state.has_alpha) {
+    states.push_back(RGB24_output_state(is_444 ? kernels.to_RGB24_444 : kernels.to_RGB24));
+  }
+
+  states.push_back(RGB32_output_state(is_444 ? kernels.to_RGB32_444 : kernels.to_RGB32));
+
+  add_alpha_premultiplication_states(states, input_state, target_state);
+
+  return states;
+}
+
+
+std::shared_ptr<HeifPixelImage>
+Op_YCbCr_HDR_to_RGB24_32_fast::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                                  const ColorState& target_state,
+                                                  const heif_color_conversion_options& options) const
+{
+  auto outimg = create_interleaved_8bit_image(*input, target_state.chroma);
+  if (!outimg || !convert_colorspace_into(input, outimg, target_state, options)) {
+    return nullptr;
+  }
+
+  return outimg;
+}
+
+
+bool
+Op_YCbCr_HDR_to_RGB24_32_fast::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                       const std::shared_ptr<HeifPixelImage>& outimg,
+                                                       const ColorState& target_state,
+                                                       const heif_color_conversion_options& options) const
+{
+  int bpp = input->get_bits_per_pixel(heif_channel_Y);
+  if (bpp <= 8 || bpp > 16 ||
+      input->get_bits_per_pixel(heif_channel_Cb) != bpp ||
+      input->get_bits_per_pixel(heif_channel_Cr) != bpp) {
+    return false;
+  }
+
+  if (input->has_channel(heif_channel_Alpha) &&
+      input->get_bits_per_pixel(heif_channel_Alpha) < 8) {
+    return false;
+  }
+
+  if (is_matching_interleaved_8bit_image(*input, *outimg, heif_chroma_interleaved_RGB)) {
+    convert_YCbCr_to_interleaved_8bit(*input, *outimg, 3, AlphaPremultiplicationChange::none);
+  }
+  else if (is_matching_interleaved_8bit_image(*input, *outimg, heif_chroma_interleaved_RGBA)) {
+    convert_YCbCr_to_interleaved_8bit(*input, *outimg, 4, get_alpha_premultiplication_change(*input, target_state));
+  }
+  else {
+    return false;
+  }
+
+  return true;
+}
+
+
+std::vector<ColorStateWithCost>
+Op_YCbCr420_bilinear_to_interleaved_HDR::state_after_conversion(const ColorState& input_state,
+                                                                const ColorState& target_state,
+                                                                const heif_color_conversion_options& options) const
+{
+  if (options.preferred_chroma_upsampling_algorithm != heif_chroma_upsampling_bilinear) {
+    return {};
+  }
+
+  if (input_state.colorspace != heif_colorspace_YCbCr ||
+      input_state.chroma != heif_chroma_420 ||
+      input_state.bits_per_pixel <= 8 ||
+      input_state.bits_per_pixel > 16) {
+    return {};
+  }
+
   if (input_state.nclx_profile) {
     int matrix = input_state.nclx_profile->get_matrix_coefficients();
     if (matrix == 0 || matrix == 8 || matrix == 11 || matrix == 14) {
@@ -519,75 +1312,126 @@ Op_YCbCr420_to_RRGGBBaa::state_after_conversion(const ColorState& input_state,
   std::vector<ColorStateWithCost> states;
 
   ColorState output_state;
+  output_state.colorspace = heif_colorspace_RGB;
 
-  // --- convert to YCbCr
+  // --- interleaved HDR output with the input bit depth
 
-  output_state.colorspace = heif_colorspace_RGB;
-  output_state.chroma = (input_state.has_alpha ?
-                         heif_chroma_interleaved_RRGGBBAA_LE : heif_chroma_interleaved_RRGGBB_LE);
-  output_state.has_alpha = input_state.has_alpha;
   output_state.bits_per_pixel = input_state.bits_per_pixel;
 
-  states.push_back({output_state, SpeedCosts_Unoptimized});
+  for (heif_chroma chroma : {heif_chroma_interleaved_RRGGBB_LE, heif_chroma_interleaved_RRGGBB_BE,
+                             heif_chroma_interleaved_RRGGBBAA_LE, heif_chroma_interleaved_RRGGBBAA_BE}) {
+    output_state.chroma = chroma;
+    output_state.has_alpha = is_chroma_with_alpha(chroma);
+
+    // Never drop the alpha channel. A missing alpha channel is filled with the maximum value.
+    if (input_state.has_alpha && !output_state.has_alpha) {
+      continue;
+    }
 
+    states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+  }
 
-  output_state.colorspace = heif_colorspace_RGB;
-  output_state.chroma = (input_state.has_alpha ?
-                         heif_chroma_interleaved_RRGGBBAA_BE : heif_chroma_interleaved_RRGGBB_BE);
-  output_state.has_alpha = input_state.has_alpha;
-  output_state.bits_per_pixel = input_state.bits_per_pixel;
+  // --- interleaved 8-bit output
 
-  states.push_back({output_state, SpeedCosts_Unoptimized});
+  output_state.bits_per_pixel = 8;
+
+  for (heif_chroma chroma : {heif_chroma_interleaved_RGB, heif_chroma_interleaved_RGBA}) {
+    output_state.chroma = chroma;
+    output_state.has_alpha = is_chroma_with_alpha(chroma);
+
+    if (input_state.has_alpha && !output_state.has_alpha) {
+      continue;
+    }
+
+    states.push_back({output_state, SpeedCosts_OptimizedSoftware});
+  }
+
+  add_alpha_premultiplication_states(states, input_state, target_state);
 
   return states;
 }
 
 
 std::shared_ptr<HeifPixelImage>
-Op_YCbCr420_to_RRGGBBaa::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
-                                            const ColorState& target_state,
-                                            const heif_color_conversion_options& options) const
+Op_YCbCr420_bilinear_to_interleaved_HDR::convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                                                            const ColorState& target_state,
+                                                            const heif_color_conversion_options& options) const
 {
   int width = input->get_width();
   int height = input->get_height();
 
-  int bpp = input->get_bits_per_pixel(heif_channel_Y);
-  bool has_alpha = input->has_channel(heif_channel_Alpha);
-
-  int le = (target_state.chroma == heif_chroma_interleaved_RRGGBB_LE ||
-            target_state.chroma == heif_chroma_interleaved_RRGGBBAA_LE) ? 1 : 0;
-
   auto outimg = std::make_shared<HeifPixelImage>();
+  outimg->set_plane_allocator(input->get_plane_allocator());
   outimg->create(width, height, heif_colorspace_RGB, target_state.chroma);
 
-  int bytesPerPixel = has_alpha ? 8 : 6;
+  if (!outimg->add_plane(heif_channel_interleaved, width, height, target_state.bits_per_pixel)) {
+    return nullptr;
+  }
 
-  if (!outimg->add_plane(heif_channel_interleaved, width, height, bpp)) {
+  if (!convert_colorspace_into(input, outimg, target_state, options)) {
     return nullptr;
   }
 
-  if (has_alpha) {
-    if (!outimg->add_plane(heif_channel_Alpha, width, height, bpp)) {
-      return nullptr;
-    }
+  return outimg;
+}
+
+
+bool
+Op_YCbCr420_bilinear_to_interleaved_HDR::convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                                                                 const std::shared_ptr<HeifPixelImage>& outimg,
+                                                                 const ColorState& target_state,
+                                                                 const heif_color_conversion_options& options) const
+{
+  int width = input->get_width();
+  int height = input->get_height();
+
+  int bpp = input->get_bits_per_pixel(heif_channel_Y);
+  bool has_input_alpha = input->has_channel(heif_channel_Alpha);
+
+  if (bpp <= 8 || bpp > 16 ||
+      input->get_chroma_format() != heif_chroma_420 ||
+      input->get_bits_per_pixel(heif_channel_Cb) != bpp ||
+      input->get_bits_per_pixel(heif_channel_Cr) != bpp ||
+      (has_input_alpha && input->get_bits_per_pixel(heif_channel_Alpha) != bpp)) {
+    return false;
   }
 
-  uint8_t* out_p;
-  int out_p_stride = 0;
+  heif_chroma out_chroma = outimg->get_chroma_format();
+  bool output_8bit = (out_chroma == heif_chroma_interleaved_RGB ||
+                      out_chroma == heif_chroma_interleaved_RGBA);
+  int out_bpp = output_8bit ? 8 : bpp;
+
+  if (out_chroma != target_state.chroma ||
+      outimg->get_width() != width ||
+      outimg->get_height() != height ||
+      !outimg->has_channel(heif_channel_interleaved) ||
+      outimg->get_bits_per_pixel(heif_channel_interleaved) != out_bpp) {
+    return false;
+  }
 
-  const uint16_t* in_y, * in_cb, * in_cr, * in_a = nullptr;
-  int in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
+  bool out_alpha = is_chroma_with_alpha(out_chroma);
+  bool le = (out_chroma == heif_chroma_interleaved_RRGGBB_LE ||
+             out_chroma == heif_chroma_interleaved_RRGGBBAA_LE);
+  int pixel_size = (out_alpha ? 4 : 3) * (output_8bit ? 1 : 2);
+  int shift_to_8bit = bpp - 8;
 
-  out_p = outimg->get_plane(heif_channel_interleaved, &out_p_stride);
-  in_y = (uint16_t*) input->get_plane(heif_channel_Y, &in_y_stride);
-  in_cb = (uint16_t*) input->get_plane(heif_channel_Cb, &in_cb_stride);
-  in_cr = (uint16_t*) input->get_plane(heif_channel_Cr, &in_cr_stride);
+  const uint16_t* in_y, * in_cb, * in_cr, * in_a = nullptr;
+  size_t in_y_stride = 0, in_cb_stride = 0, in_cr_stride = 0, in_a_stride = 0;
 
-  if (has_alpha) {
-    in_a = (uint16_t*) input->get_plane(heif_channel_Alpha, &in_a_stride);
+  in_y = (const uint16_t*) input->get_plane(heif_channel_Y, &in_y_stride);
+  in_cb = (const uint16_t*) input->get_plane(heif_channel_Cb, &in_cb_stride);
+  in_cr = (const uint16_t*) input->get_plane(heif_channel_Cr, &in_cr_stride);
+  if (has_input_alpha) {
+    in_a = (const uint16_t*) input->get_plane(heif_channel_Alpha, &in_a_stride);
   }
 
-  int maxval = (1 << bpp) - 1;
+  in_y_stride /= 2;
+  in_cb_stride /= 2;
+  in_cr_stride /= 2;
+  in_a_stride /= 2;
+
+  size_t out_stride = 0;
+  uint8_t* out_p = outimg->get_plane(heif_channel_interleaved, &out_stride);
 
   bool full_range_flag = true;
   YCbCr_to_RGB_coefficients coeffs = YCbCr_to_RGB_coefficients::defaults();
@@ -595,45 +1439,94 @@ Op_YCbCr420_to_RRGGBBaa::convert_colorspace(const std::shared_ptr<const HeifPixe
   auto colorProfile = input->get_color_profile_nclx();
   if (colorProfile) {
     full_range_flag = colorProfile->get_full_range_flag();
-    coeffs = get_YCbCr_to_RGB_coefficients(colorProfile->get_matrix_coefficients(),
-                                           colorProfile->get_colour_primaries());
+    coeffs = get_color_conversion_coefficients(colorProfile->get_matrix_coefficients(),
+                                               colorProfile->get_colour_primaries(),
+                                               full_range_flag, bpp).ycbcr_to_rgb;
   }
 
-  float limited_range_offset = static_cast<float>(16 << (bpp - 8));
+  const int halfRange = 1 << (bpp - 1);
+  const int32_t fullRange = (1 << bpp) - 1;
+  const float limited_range_offset = static_cast<float>(16 << (bpp - 8));
+
+  int chroma_height = (height + 1) / 2;
+
+  AlphaPremultiplicationChange alpha_change = get_alpha_premultiplication_change(*input, target_state);
+
+  // bilinearly upsampled chroma of the current row
+  std::vector<uint16_t> cb_line(width), cr_line(width);
 
   for (int y = 0; y < height; y++) {
+    int near_row, far_row;
+    get_bilinear_chroma_rows(y, chroma_height, &near_row, &far_row);
+
+    upsample_chroma_row_bilinear(in_cb + near_row * in_cb_stride, in_cb + far_row * in_cb_stride,
+                                 cb_line.data(), width, bpp);
+    upsample_chroma_row_bilinear(in_cr + near_row * in_cr_stride, in_cr + far_row * in_cr_stride,
+                                 cr_line.data(), width, bpp);
+
+    const uint16_t* y_line = in_y + y * in_y_stride;
+    const uint16_t* a_line = has_input_alpha ? in_a + y * in_a_stride : nullptr;
+    uint8_t* out_line = out_p + y * static_cast<size_t>(out_stride);
+
     for (int x = 0; x < width; x++) {
+      int cb_value = cb_line[x];
+      int cr_value = cr_line[x];
+
+      // --- YCbCr to RGB
 
-      float y_ = in_y[y * in_y_stride / 2 + x];
-      float cb = static_cast<float>(in_cb[y / 2 * in_cb_stride / 2 + x / 2] - (1 << (bpp - 1)));
-      float cr = static_cast<float>(in_cr[y / 2 * in_cr_stride / 2 + x / 2] - (1 << (bpp - 1)));
+      float yv = static_cast<float>(y_line[x]);
+      float cb = static_cast<float>(cb_value - halfRange);
+      float cr = static_cast<float>(cr_value - halfRange);
 
       if (!full_range_flag) {
-        y_ = (y_ - limited_range_offset) * 1.1689f;
+        yv = (yv - limited_range_offset) * 1.1689f;
         cb = cb * 1.1429f;
         cr = cr * 1.1429f;
       }
 
-      int r = clip_f_u16(y_ + coeffs.r_cr * cr, maxval);
-      int g = clip_f_u16(y_ + coeffs.g_cb * cb + coeffs.g_cr * cr, maxval);
-      int b = clip_f_u16(y_ + coeffs.b_cb * cb, maxval);
+      uint16_t r = clip_f_u16(yv + coeffs.r_cr * cr, fullRange);
+      uint16_t g = clip_f_u16(yv + coeffs.g_cb * cb + coeffs.g_cr * cr, fullRange);
+      uint16_t b = clip_f_u16(yv + coeffs.b_cb * cb, fullRange);
+      uint16_t a = static_cast<uint16_t>(a_line ? a_line[x] : fullRange);
 
-      out_p[y * out_p_stride + bytesPerPixel * x + 0 + le] = (uint8_t) (r >> 8);
-      out_p[y * out_p_stride + bytesPerPixel * x + 2 + le] = (uint8_t) (g >> 8);
-      out_p[y * out_p_stride + bytesPerPixel * x + 4 + le] = (uint8_t) (b >> 8);
+      // at the input bit depth, before the reduction to 8 bit
+      if (alpha_change == AlphaPremultiplicationChange::premultiply) {
+        r = premultiply_alpha_value(r, a, fullRange);
+        g = premultiply_alpha_value(g, a, fullRange);
+        b = premultiply_alpha_value(b, a, fullRange);
+      }
+      else if (alpha_change == AlphaPremultiplicationChange::unpremultiply) {
+        r = unpremultiply_alpha_value(r, a, fullRange, fullRange);
+        g = unpremultiply_alpha_value(g, a, fullRange, fullRange);
+        b = unpremultiply_alpha_value(b, a, fullRange, fullRange);
+      }
+
+      // --- write interleaved output
 
-      out_p[y * out_p_stride + bytesPerPixel * x + 1 - le] = (uint8_t) (r & 0xff);
-      out_p[y * out_p_stride + bytesPerPixel * x + 3 - le] = (uint8_t) (g & 0xff);
-      out_p[y * out_p_stride + bytesPerPixel * x + 5 - le] = (uint8_t) (b & 0xff);
+      uint8_t* p = out_line + x * pixel_size;
 
-      if (has_alpha) {
-        out_p[y * out_p_stride + 8 * x + 6 + le] = (uint8_t) (in_a[y * in_a_stride / 2 + x] >> 8);
-        out_p[y * out_p_stride + 8 * x + 7 - le] = (uint8_t) (in_a[y * in_a_stride / 2 + x] & 0xff);
+      if (output_8bit) {
+        p[0] = (uint8_t) (r >> shift_to_8bit);
+        p[1] = (uint8_t) (g >> shift_to_8bit);
+        p[2] = (uint8_t) (b >> shift_to_8bit);
+        if (out_alpha) {
+          p[3] = (uint8_t) (a >> shift_to_8bit);
+        }
+      }
+      else {
+        p[0 + le] = (uint8_t) (r >> 8);
+        p[1 - le] = (uint8_t) (r & 0xff);
+        p[2 + le] = (uint8_t) (g >> 8);
+        p[3 - le] = (uint8_t) (g & 0xff);
+        p[4 + le] = (uint8_t) (b >> 8);
+        p[5 - le] = (uint8_t) (b & 0xff);
+        if (out_alpha) {
+          p[6 + le] = (uint8_t) (a >> 8);
+          p[7 - le] = (uint8_t) (a & 0xff);
+        }
       }
     }
   }
 
-
-  return outimg;
+  return true;
 }
-
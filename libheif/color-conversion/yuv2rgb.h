@@ -40,6 +40,11 @@ public:
   convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
                      const ColorState& target_state,
                      const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
 };
 
 
@@ -55,6 +60,11 @@ public:
   convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
                      const ColorState& target_state,
                      const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
 };
 
 
@@ -70,6 +80,13 @@ public:
   convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
                      const ColorState& target_state,
                      const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+
+  bool handles_alpha_premultiplication() const override { return true; }
 };
 
 
@@ -85,6 +102,120 @@ public:
   convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
                      const ColorState& target_state,
                      const heif_color_conversion_options& options) const override;
+
+  bool handles_alpha_premultiplication() const override { return true; }
+};
+
+// Nearest-neighbor chroma upsampling (for 4:2:2), YCbCr to RGB conversion and interleaving of 8-bit
+// 4:2:2 and 4:4:4 images in a single pass, without an intermediate planar RGB image.
+class Op_YCbCr422_444_to_RGB24 : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+};
+
+
+class Op_YCbCr422_444_to_RGB32 : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+
+  bool handles_alpha_premultiplication() const override { return true; }
+};
+
+
+class Op_YCbCr422_444_to_RRGGBBaa : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool handles_alpha_premultiplication() const override { return true; }
+};
+
+
+// Only used with heif_color_conversion_accuracy_fast: nearest-neighbor chroma upsampling and conversion
+// of HDR 4:2:0, 4:2:2 and 4:4:4 images directly to 8-bit RGB(A). The samples are rounded to 8 bits
+// first and then converted with the 8-bit fixed-point math.
+class Op_YCbCr_HDR_to_RGB24_32_fast : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+
+  bool handles_alpha_premultiplication() const override { return true; }
+};
+
+
+// Bilinear chroma upsampling, YCbCr to RGB conversion and interleaving of HDR 4:2:0 images in
+// a single pass. The output is either RRGGBB(AA) with the input bit depth or RGB(A) reduced to 8 bit.
+class Op_YCbCr420_bilinear_to_interleaved_HDR : public ColorConversionOperation
+{
+public:
+  std::vector<ColorStateWithCost>
+  state_after_conversion(const ColorState& input_state,
+                         const ColorState& target_state,
+                         const heif_color_conversion_options& options) const override;
+
+  std::shared_ptr<HeifPixelImage>
+  convert_colorspace(const std::shared_ptr<const HeifPixelImage>& input,
+                     const ColorState& target_state,
+                     const heif_color_conversion_options& options) const override;
+
+  bool convert_colorspace_into(const std::shared_ptr<const HeifPixelImage>& input,
+                               const std::shared_ptr<HeifPixelImage>& output,
+                               const ColorState& target_state,
+                               const heif_color_conversion_options& options) const override;
+
+  // the interpolation uses the chroma rows above and below
+  int get_row_band_overlap() const override { return 2; }
+
+  bool handles_alpha_premultiplication() const override { return true; }
 };
 
 #endif //LIBHEIF_COLORCONVERSION_YUV2RGB_H
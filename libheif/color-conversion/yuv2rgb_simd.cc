@@ -0,0 +1,373 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "yuv2rgb_simd.h"
+#include "libheif/cpu_features.h"
+
+#if HEIF_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+static YCbCr_to_RGB_kernels s_kernels;
+
+
+#if HEIF_HAVE_X86_SIMD
+
+// --- SSE4.1
+
+// y + d for 16 pixels, saturated to [0;255]. With ShiftH=1, each of the 8 offsets in 'd' applies to two pixels.
+template<int ShiftH>
+HEIF_TARGET_SSE41
+static inline __m128i add_chroma_offset_sse41(__m128i y_lo, __m128i y_hi, const int16_t* d)
+{
+  __m128i d_lo, d_hi;
+  if (ShiftH) {
+    __m128i offsets = _mm_loadu_si128((const __m128i*) d);
+    d_lo = _mm_unpacklo_epi16(offsets, offsets);
+    d_hi = _mm_unpackhi_epi16(offsets, offsets);
+  }
+  else {
+    d_lo = _mm_loadu_si128((const __m128i*) d);
+    d_hi = _mm_loadu_si128((const __m128i*) (d + 8));
+  }
+
+  return _mm_packus_epi16(_mm_add_epi16(y_lo, d_lo), _mm_add_epi16(y_hi, d_hi));
+}
+
+
+// Interleave 16 pixels into four RGBA vectors.
+HEIF_TARGET_SSE41
+static inline void interleave_RGBA_sse41(__m128i r, __m128i g, __m128i b, __m128i a, __m128i out[4])
+{
+  __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+  __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+  __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+  __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+
+  out[0] = _mm_unpacklo_epi16(rg_lo, ba_lo);
+  out[1] = _mm_unpackhi_epi16(rg_lo, ba_lo);
+  out[2] = _mm_unpacklo_epi16(rg_hi, ba_hi);
+  out[3] = _mm_unpackhi_epi16(rg_hi, ba_hi);
+}
+
+
+HEIF_TARGET_SSE41
+static inline void store_RGB24_sse41(__m128i r, __m128i g, __m128i b, uint8_t* out)
+{
+  __m128i rgba[4];
+  interleave_RGBA_sse41(r, g, b, _mm_setzero_si128(), rgba);
+
+  // remove the alpha bytes: 4 pixels -> 12 bytes at the start of the vector
+  const __m128i drop_alpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  __m128i p0 = _mm_shuffle_epi8(rgba[0], drop_alpha);
+  __m128i p1 = _mm_shuffle_epi8(rgba[1], drop_alpha);
+  __m128i p2 = _mm_shuffle_epi8(rgba[2], drop_alpha);
+  __m128i p3 = _mm_shuffle_epi8(rgba[3], drop_alpha);
+
+  _mm_storeu_si128((__m128i*) (out + 0), _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+  _mm_storeu_si128((__m128i*) (out + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+  _mm_storeu_si128((__m128i*) (out + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+}
+
+
+HEIF_TARGET_SSE41
+static inline void store_RGB32_sse41(__m128i r, __m128i g, __m128i b, __m128i a, uint8_t* out)
+{
+  __m128i rgba[4];
+  interleave_RGBA_sse41(r, g, b, a, rgba);
+
+  for (int i = 0; i < 4; i++) {
+    _mm_storeu_si128((__m128i*) (out + 16 * i), rgba[i]);
+  }
+}
+
+
+template<int ShiftH>
+HEIF_TARGET_SSE41
+static int YCbCr_row_to_RGB24_sse41(const uint8_t* in_y,
+                                    const int16_t* dr, const int16_t* dg, const int16_t* db,
+                                    const uint8_t*, uint8_t* out, int width)
+{
+  const __m128i zero = _mm_setzero_si128();
+
+  int x;
+  for (x = 0; x + 16 <= width; x += 16) {
+    __m128i y = _mm_loadu_si128((const __m128i*) (in_y + x));
+    __m128i y_lo = _mm_unpacklo_epi8(y, zero);
+    __m128i y_hi = _mm_unpackhi_epi8(y, zero);
+
+    __m128i r = add_chroma_offset_sse41<ShiftH>(y_lo, y_hi, dr + (x >> ShiftH));
+    __m128i g = add_chroma_offset_sse41<ShiftH>(y_lo, y_hi, dg + (x >> ShiftH));
+    __m128i b = add_chroma_offset_sse41<ShiftH>(y_lo, y_hi, db + (x >> ShiftH));
+
+    store_RGB24_sse41(r, g, b, out + 3 * x);
+  }
+
+  return x;
+}
+
+
+template<int ShiftH>
+HEIF_TARGET_SSE41
+static int YCbCr_row_to_RGB32_sse41(const uint8_t* in_y,
+                                    const int16_t* dr, const int16_t* dg, const int16_t* db,
+                                    const uint8_t* in_a, uint8_t* out, int width)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set1_epi8((char) 0xFF);
+
+  int x;
+  for (x = 0; x + 16 <= width; x += 16) {
+    __m128i y = _mm_loadu_si128((const __m128i*) (in_y + x));
+    __m128i y_lo = _mm_unpacklo_epi8(y, zero);
+    __m128i y_hi = _mm_unpackhi_epi8(y, zero);
+
+    __m128i r = add_chroma_offset_sse41<ShiftH>(y_lo, y_hi, dr + (x >> ShiftH));
+    __m128i g = add_chroma_offset_sse41<ShiftH>(y_lo, y_hi, dg + (x >> ShiftH));
+    __m128i b = add_chroma_offset_sse41<ShiftH>(y_lo, y_hi, db + (x >> ShiftH));
+    __m128i a = in_a ? _mm_loadu_si128((const __m128i*) (in_a + x)) : opaque;
+
+    store_RGB32_sse41(r, g, b, a, out + 4 * x);
+  }
+
+  return x;
+}
+
+#endif
+
+
+#if HEIF_HAVE_X86_AVX
+
+// --- AVX2
+
+// Same as add_chroma_offset_sse41(), but for 32 pixels. The result is in pixel order.
+template<int ShiftH>
+HEIF_TARGET_AVX2
+static inline __m256i add_chroma_offset_avx2(__m256i y0, __m256i y1, const int16_t* d)
+{
+  __m256i d0, d1;
+  if (ShiftH) {
+    __m128i offsets0 = _mm_loadu_si128((const __m128i*) d);
+    __m128i offsets1 = _mm_loadu_si128((const __m128i*) (d + 8));
+
+    d0 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(offsets0, offsets0)),
+                                 _mm_unpackhi_epi16(offsets0, offsets0), 1);
+    d1 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(offsets1, offsets1)),
+                                 _mm_unpackhi_epi16(offsets1, offsets1), 1);
+  }
+  else {
+    d0 = _mm256_loadu_si256((const __m256i*) d);
+    d1 = _mm256_loadu_si256((const __m256i*) (d + 16));
+  }
+
+  // packus works within 128-bit lanes, restore the pixel order afterwards
+  __m256i packed = _mm256_packus_epi16(_mm256_add_epi16(y0, d0), _mm256_add_epi16(y1, d1));
+  return _mm256_permute4x64_epi64(packed, 0xD8);
+}
+
+
+HEIF_TARGET_AVX2
+static inline void load_luma_avx2(const uint8_t* in_y, __m256i* y0, __m256i* y1)
+{
+  *y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) in_y));
+  *y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (in_y + 16)));
+}
+
+
+template<int ShiftH>
+HEIF_TARGET_AVX2
+static int YCbCr_row_to_RGB24_avx2(const uint8_t* in_y,
+                                   const int16_t* dr, const int16_t* dg, const int16_t* db,
+                                   const uint8_t*, uint8_t* out, int width)
+{
+  int x;
+  for (x = 0; x + 32 <= width; x += 32) {
+    __m256i y0, y1;
+    load_luma_avx2(in_y + x, &y0, &y1);
+
+    __m256i r = add_chroma_offset_avx2<ShiftH>(y0, y1, dr + (x >> ShiftH));
+    __m256i g = add_chroma_offset_avx2<ShiftH>(y0, y1, dg + (x >> ShiftH));
+    __m256i b = add_chroma_offset_avx2<ShiftH>(y0, y1, db + (x >> ShiftH));
+
+    store_RGB24_sse41(_mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b),
+                      out + 3 * x);
+    store_RGB24_sse41(_mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1),
+                      out + 3 * x + 48);
+  }
+
+  // process a remaining block of 16 pixels
+  int c = x >> ShiftH;
+  return x + YCbCr_row_to_RGB24_sse41<ShiftH>(in_y + x, dr + c, dg + c, db + c, nullptr,
+                                              out + 3 * x, width - x);
+}
+
+
+template<int ShiftH>
+HEIF_TARGET_AVX2
+static int YCbCr_row_to_RGB32_avx2(const uint8_t* in_y,
+                                   const int16_t* dr, const int16_t* dg, const int16_t* db,
+                                   const uint8_t* in_a, uint8_t* out, int width)
+{
+  const __m256i opaque = _mm256_set1_epi8((char) 0xFF);
+
+  int x;
+  for (x = 0; x + 32 <= width; x += 32) {
+    __m256i y0, y1;
+    load_luma_avx2(in_y + x, &y0, &y1);
+
+    __m256i r = add_chroma_offset_avx2<ShiftH>(y0, y1, dr + (x >> ShiftH));
+    __m256i g = add_chroma_offset_avx2<ShiftH>(y0, y1, dg + (x >> ShiftH));
+    __m256i b = add_chroma_offset_avx2<ShiftH>(y0, y1, db + (x >> ShiftH));
+    __m256i a = in_a ? _mm256_loadu_si256((const __m256i*) (in_a + x)) : opaque;
+
+    store_RGB32_sse41(_mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b),
+                      _mm256_castsi256_si128(a), out + 4 * x);
+    store_RGB32_sse41(_mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1),
+                      _mm256_extracti128_si256(a, 1), out + 4 * x + 64);
+  }
+
+  int c = x >> ShiftH;
+  return x + YCbCr_row_to_RGB32_sse41<ShiftH>(in_y + x, dr + c, dg + c, db + c,
+                                              in_a ? in_a + x : nullptr,
+                                              out + 4 * x, width - x);
+}
+
+#endif
+
+
+#if HEIF_HAVE_NEON
+
+template<int ShiftH>
+static inline uint8x16_t add_chroma_offset_neon(int16x8_t y_lo, int16x8_t y_hi, const int16_t* d)
+{
+  int16x8_t d_lo, d_hi;
+  if (ShiftH) {
+    int16x8_t offsets = vld1q_s16(d);
+    int16x8x2_t doubled = vzipq_s16(offsets, offsets);
+    d_lo = doubled.val[0];
+    d_hi = doubled.val[1];
+  }
+  else {
+    d_lo = vld1q_s16(d);
+    d_hi = vld1q_s16(d + 8);
+  }
+
+  return vcombine_u8(vqmovun_s16(vaddq_s16(y_lo, d_lo)),
+                     vqmovun_s16(vaddq_s16(y_hi, d_hi)));
+}
+
+
+template<int ShiftH>
+static int YCbCr_row_to_RGB24_neon(const uint8_t* in_y,
+                                   const int16_t* dr, const int16_t* dg, const int16_t* db,
+                                   const uint8_t*, uint8_t* out, int width)
+{
+  int x;
+  for (x = 0; x + 16 <= width; x += 16) {
+    uint8x16_t y = vld1q_u8(in_y + x);
+    int16x8_t y_lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y)));
+    int16x8_t y_hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y)));
+
+    uint8x16x3_t rgb;
+    rgb.val[0] = add_chroma_offset_neon<ShiftH>(y_lo, y_hi, dr + (x >> ShiftH));
+    rgb.val[1] = add_chroma_offset_neon<ShiftH>(y_lo, y_hi, dg + (x >> ShiftH));
+    rgb.val[2] = add_chroma_offset_neon<ShiftH>(y_lo, y_hi, db + (x >> ShiftH));
+
+    vst3q_u8(out + 3 * x, rgb);
+  }
+
+  return x;
+}
+
+
+template<int ShiftH>
+static int YCbCr_row_to_RGB32_neon(const uint8_t* in_y,
+                                   const int16_t* dr, const int16_t* dg, const int16_t* db,
+                                   const uint8_t* in_a, uint8_t* out, int width)
+{
+  const uint8x16_t opaque = vdupq_n_u8(0xFF);
+
+  int x;
+  for (x = 0; x + 16 <= width; x += 16) {
+    uint8x16_t y = vld1q_u8(in_y + x);
+    int16x8_t y_lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y)));
+    int16x8_t y_hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y)));
+
+    uint8x16x4_t rgba;
+    rgba.val[0] = add_chroma_offset_neon<ShiftH>(y_lo, y_hi, dr + (x >> ShiftH));
+    rgba.val[1] = add_chroma_offset_neon<ShiftH>(y_lo, y_hi, dg + (x >> ShiftH));
+    rgba.val[2] = add_chroma_offset_neon<ShiftH>(y_lo, y_hi, db + (x >> ShiftH));
+    rgba.val[3] = in_a ? vld1q_u8(in_a + x) : opaque;
+
+    vst4q_u8(out + 4 * x, rgba);
+  }
+
+  return x;
+}
+
+#endif
+
+
+void select_YCbCr_to_RGB_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  s_kernels = YCbCr_to_RGB_kernels();
+
+#if HEIF_HAVE_X86_SIMD
+  if (cpu.sse41) {
+    s_kernels.to_RGB24 = YCbCr_row_to_RGB24_sse41<1>;
+    s_kernels.to_RGB32 = YCbCr_row_to_RGB32_sse41<1>;
+    s_kernels.to_RGB24_444 = YCbCr_row_to_RGB24_sse41<0>;
+    s_kernels.to_RGB32_444 = YCbCr_row_to_RGB32_sse41<0>;
+  }
+#endif
+
+#if HEIF_HAVE_X86_AVX
+  if (cpu.avx2) {
+    s_kernels.to_RGB24 = YCbCr_row_to_RGB24_avx2<1>;
+    s_kernels.to_RGB32 = YCbCr_row_to_RGB32_avx2<1>;
+    s_kernels.to_RGB24_444 = YCbCr_row_to_RGB24_avx2<0>;
+    s_kernels.to_RGB32_444 = YCbCr_row_to_RGB32_avx2<0>;
+  }
+#endif
+
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    s_kernels.to_RGB24 = YCbCr_row_to_RGB24_neon<1>;
+    s_kernels.to_RGB32 = YCbCr_row_to_RGB32_neon<1>;
+    s_kernels.to_RGB24_444 = YCbCr_row_to_RGB24_neon<0>;
+    s_kernels.to_RGB32_444 = YCbCr_row_to_RGB32_neon<0>;
+  }
+#endif
+
+  (void) cpu;
+}
+
+
+const YCbCr_to_RGB_kernels& get_YCbCr_to_RGB_kernels()
+{
+  return s_kernels;
+}
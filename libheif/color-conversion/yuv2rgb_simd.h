@@ -0,0 +1,55 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023, Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_COLORCONVERSION_YUV2RGB_SIMD_H
+#define LIBHEIF_COLORCONVERSION_YUV2RGB_SIMD_H
+
+#include <cstdint>
+
+
+// Converts one row of 8-bit luma to interleaved RGB (RGBA).
+// 'dr', 'dg', 'db' are the RGB offsets that the chroma samples add to the luma values. For horizontally
+// subsampled chroma (4:2:0, 4:2:2), the offset at x/2 applies to the pixel at x. For 4:4:4, there is one
+// offset per pixel.
+// When 'alpha' is nullptr, RGBA output is filled with 0xFF.
+// Returns the number of pixels that were converted. The remaining pixels at the end of the row
+// have to be converted by the caller.
+typedef int (* YCbCr_row_to_RGB_kernel)(const uint8_t* y,
+                                        const int16_t* dr, const int16_t* dg, const int16_t* db,
+                                        const uint8_t* alpha,
+                                        uint8_t* out, int width);
+
+struct YCbCr_to_RGB_kernels
+{
+  // 4:2:0 and 4:2:2
+  YCbCr_row_to_RGB_kernel to_RGB24 = nullptr;
+  YCbCr_row_to_RGB_kernel to_RGB32 = nullptr;
+
+  // 4:4:4
+  YCbCr_row_to_RGB_kernel to_RGB24_444 = nullptr;
+  YCbCr_row_to_RGB_kernel to_RGB32_444 = nullptr;
+};
+
+// Row kernels for the YCbCr to interleaved RGB(A) conversions. See cpu_features.h for the dispatch rules.
+const YCbCr_to_RGB_kernels& get_YCbCr_to_RGB_kernels();
+
+void select_YCbCr_to_RGB_kernels();
+
+#endif
@@ -31,6 +31,9 @@ uint8_t chroma_h_subsampling(heif_chroma c)
 
     case heif_chroma_420:
     case heif_chroma_422:
+    case heif_chroma_420_NV12:
+    case heif_chroma_420_NV21:
+    case heif_chroma_420_P010:
       return 2;
 
     case heif_chroma_interleaved_RGB:
@@ -51,6 +54,9 @@ uint8_t chroma_v_subsampling(heif_chroma c)
       return 1;
 
     case heif_chroma_420:
+    case heif_chroma_420_NV12:
+    case heif_chroma_420_NV21:
+    case heif_chroma_420_P010:
       return 2;
 
     case heif_chroma_interleaved_RGB:
@@ -62,13 +68,31 @@ uint8_t chroma_v_subsampling(heif_chroma c)
 }
 
 
+bool is_semi_planar_chroma(heif_chroma c)
+{
+  return (c == heif_chroma_420_NV12 ||
+          c == heif_chroma_420_NV21 ||
+          c == heif_chroma_420_P010);
+}
+
+
+bool is_float_chroma(heif_chroma c)
+{
+  return (c == heif_chroma_interleaved_RGB_HALF ||
+          c == heif_chroma_interleaved_RGBA_HALF ||
+          c == heif_chroma_interleaved_RGB_FLOAT ||
+          c == heif_chroma_interleaved_RGBA_FLOAT);
+}
+
+
 void get_subsampled_size(int width, int height,
                                heif_channel channel,
                                heif_chroma chroma,
                                int* subsampled_width, int* subsampled_height)
 {
   if (channel == heif_channel_Cb ||
-      channel == heif_channel_Cr) {
+      channel == heif_channel_Cr ||
+      (channel == heif_channel_interleaved && is_semi_planar_chroma(chroma))) {
     uint8_t chromaSubH = chroma_h_subsampling(chroma);
     uint8_t chromaSubV = chroma_v_subsampling(chroma);
 
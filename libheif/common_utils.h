@@ -37,6 +37,12 @@ uint8_t chroma_h_subsampling(heif_chroma c);
 
 uint8_t chroma_v_subsampling(heif_chroma c);
 
+// NV12, NV21 and P010: a luma plane and one interleaved Cb/Cr plane.
+bool is_semi_planar_chroma(heif_chroma c);
+
+// The interleaved RGB(A) formats with half or float samples.
+bool is_float_chroma(heif_chroma c);
+
 void get_subsampled_size(int width, int height,
                          heif_channel channel,
                          heif_chroma chroma,
@@ -29,13 +29,17 @@
 #include <cassert>
 #include <cstring>
 #include <algorithm>
+#include <array>
 #include <iostream>
 #include <limits>
 #include <cmath>
 #include <deque>
+#include <functional>
+#include <chrono>
 
-#if ENABLE_PARALLEL_TILE_DECODING
-#include <future>
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <condition_variable>
+#include <mutex>
 #endif
 
 #include "context.h"
@@ -43,11 +47,19 @@
 #include "pixelimage.h"
 #include "api_structs.h"
 #include "security_limits.h"
+#include "jpeg.h"
 #include "hevc.h"
 #include "avif.h"
 #include "plugin_registry.h"
 #include "libheif/color-conversion/colorconversion.h"
+#include "common_utils.h"
 #include "metadata_compression.h"
+#include "thread_pool.h"
+#include "cancellation.h"
+#include "memory_arena.h"
+#include "plane_allocator_mmap.h"
+#include "track.h"
+#include "statistics.h"
 
 #if WITH_UNCOMPRESSED_CODEC
 #include "uncompressed_image.h"
@@ -76,6 +88,8 @@ void heif_encoder::release()
 struct heif_error heif_encoder::alloc()
 {
   if (encoder == nullptr) {
+    initialize_encoder_plugin(plugin);
+
     struct heif_error error = plugin->new_encoder(&encoder);
     // TODO: error handling
     return error;
@@ -86,6 +100,74 @@ struct heif_error heif_encoder::alloc()
 }
 
 
+struct heif_error heif_encoder::copy_parameters_from(const heif_encoder& src)
+{
+  assert(src.plugin == plugin);
+
+  time_budget = src.time_budget;
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+
+  // Parameters whose value cannot be read back are left at their defaults.
+
+  int value;
+  if (plugin->get_parameter_quality(src.encoder, &value).code == heif_error_Ok) {
+    err = plugin->set_parameter_quality(encoder, value);
+    if (err.code) {
+      return err;
+    }
+  }
+
+  if (plugin->get_parameter_lossless(src.encoder, &value).code == heif_error_Ok) {
+    err = plugin->set_parameter_lossless(encoder, value);
+    if (err.code) {
+      return err;
+    }
+  }
+
+  if (plugin->get_parameter_logging_level(src.encoder, &value).code == heif_error_Ok) {
+    err = plugin->set_parameter_logging_level(encoder, value);
+    if (err.code) {
+      return err;
+    }
+  }
+
+  for (const struct heif_encoder_parameter* const* param = plugin->list_parameters(src.encoder);
+       param && *param; param++) {
+    const char* name = (*param)->name;
+
+    switch ((*param)->type) {
+      case heif_encoder_parameter_type_integer:
+        if (plugin->get_parameter_integer(src.encoder, name, &value).code == heif_error_Ok) {
+          err = plugin->set_parameter_integer(encoder, name, value);
+        }
+        break;
+
+      case heif_encoder_parameter_type_boolean:
+        if (plugin->get_parameter_boolean(src.encoder, name, &value).code == heif_error_Ok) {
+          err = plugin->set_parameter_boolean(encoder, name, value);
+        }
+        break;
+
+      case heif_encoder_parameter_type_string: {
+        char string_value[256];
+        if (plugin->get_parameter_string(src.encoder, name, string_value, sizeof(string_value)).code == heif_error_Ok) {
+          string_value[sizeof(string_value) - 1] = 0;
+          err = plugin->set_parameter_string(encoder, name, string_value);
+        }
+        break;
+      }
+    }
+
+    if (err.code) {
+      return err;
+    }
+  }
+
+  return err;
+}
+
+
 static int32_t readvec_signed(const std::vector<uint8_t>& data, int& ptr, int len)
 {
   const uint32_t high_bit = 0x80 << ((len - 1) * 8);
@@ -400,6 +482,11 @@ HeifContext::HeifContext()
   m_maximum_image_width_limit = MAX_IMAGE_WIDTH;
   m_maximum_image_height_limit = MAX_IMAGE_HEIGHT;
 
+  m_decoding_work_base = DEFAULT_DECODING_WORK_BASE;
+  m_decoding_work_per_input_byte = DEFAULT_DECODING_WORK_PER_INPUT_BYTE;
+
+  m_decoder_pool = std::make_shared<DecoderInstancePool>();
+
   reset_to_empty_heif();
 }
 
@@ -412,9 +499,240 @@ HeifContext::~HeifContext()
   }
 }
 
+void HeifContext::set_max_decoding_threads(int max_threads)
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(m_thread_pool_mutex);
+#endif
+
+  if (max_threads != m_max_decoding_threads) {
+    m_max_decoding_threads = max_threads;
+
+    // the pool will be recreated with the new number of threads on next use
+    m_thread_pool.reset();
+  }
+}
+
+
+void HeifContext::attach_to_engine(std::shared_ptr<HeifEngine> engine)
+{
+  set_thread_pool(engine->get_thread_pool());
+
+  m_plane_memory_pool = engine->get_plane_memory_pool();
+  update_plane_allocators();
+
+  m_decoder_pool = engine->get_decoder_pool();
+
+  m_engine = std::move(engine);
+}
+
+
+void HeifContext::set_plane_memory_pool_size(size_t max_cached_bytes)
+{
+  // Images that were decoded before keep a reference to the old pool and return their memory there.
+  if (max_cached_bytes == 0) {
+    m_plane_memory_pool.reset();
+  }
+  else {
+    m_plane_memory_pool = std::make_shared<PlaneMemoryPool>(max_cached_bytes);
+  }
+
+  update_plane_allocators();
+}
+
+
+void HeifContext::set_memory_budget(size_t max_bytes)
+{
+  // Images that were decoded before keep counting in the old budget.
+  if (max_bytes == 0) {
+    m_memory_budget.reset();
+  }
+  else {
+    m_memory_budget = std::make_shared<MemoryBudget>(max_bytes);
+  }
+
+  update_plane_allocators();
+}
+
+
+void HeifContext::set_decoded_image_cache_size(size_t max_bytes)
+{
+  if (max_bytes == 0) {
+    m_decoded_image_cache.reset();
+  }
+  else {
+    m_decoded_image_cache = std::make_shared<DecodedImageCache>(max_bytes);
+  }
+}
+
+
+void HeifContext::update_plane_allocators()
+{
+  if (m_memory_budget) {
+    m_budgeted_allocator = std::make_shared<BudgetedPlaneAllocator>(m_memory_budget, m_plane_memory_pool);
+    m_budgeted_heap_allocator = std::make_shared<BudgetedPlaneAllocator>(m_memory_budget, nullptr);
+  }
+  else {
+    m_budgeted_allocator.reset();
+    m_budgeted_heap_allocator.reset();
+  }
+}
+
+
+std::shared_ptr<PlaneAllocator> HeifContext::get_plane_allocator() const
+{
+  if (m_budgeted_allocator) {
+    return m_budgeted_allocator;
+  }
+
+  return m_plane_memory_pool;
+}
+
+
+static Error memory_budget_error(size_t required, const MemoryBudget& budget)
+{
+  std::stringstream sstr;
+  sstr << "Decoding needs " << required << " bytes of image memory, but only "
+       << budget.get_max_bytes() - budget.get_used_bytes() << " of the memory budget of "
+       << budget.get_max_bytes() << " bytes are available";
+
+  return Error(heif_error_Memory_allocation_error,
+               heif_suberror_Memory_budget_exceeded,
+               sstr.str());
+}
+
+
+Error HeifContext::adopt_decoded_image(const std::shared_ptr<HeifPixelImage>& img) const
+{
+  if (m_budgeted_heap_allocator) {
+    size_t size = img->get_allocated_memory_size();
+    if (!img->adopt_heap_planes(m_budgeted_heap_allocator)) {
+      return memory_budget_error(size, *m_memory_budget);
+    }
+  }
+
+  img->set_plane_allocator(get_plane_allocator());
+
+  return Error::Ok;
+}
+
+
+void HeifContext::set_thread_pool(std::shared_ptr<ThreadPool> pool)
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(m_thread_pool_mutex);
+#endif
+
+  m_thread_pool = std::move(pool);
+  m_max_decoding_threads = m_thread_pool ? m_thread_pool->get_num_threads() : 0;
+}
+
+
+std::shared_ptr<ThreadPool> HeifContext::get_thread_pool() const
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(m_thread_pool_mutex);
+
+  if (!m_thread_pool && m_max_decoding_threads > 0) {
+    m_thread_pool = std::make_shared<ThreadPool>(m_max_decoding_threads);
+  }
+
+  return m_thread_pool;
+#else
+  return nullptr;
+#endif
+}
+
+
+heif_decoding_options HeifContext::get_concurrent_decoding_options(const heif_decoding_options& options,
+                                                                   size_t num_images) const
+{
+  heif_decoding_options image_options = options;
+
+  if (image_options.decoder_threads == 0) {
+    std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+
+    // the calling thread also decodes images while it waits for the pool
+    size_t num_concurrent = thread_pool ? std::min(num_images, size_t(thread_pool->get_num_threads() + 1)) : 1;
+    num_concurrent = std::max(num_concurrent, size_t(1));
+
+    image_options.decoder_threads = std::max(get_max_decoding_threads() / static_cast<int>(num_concurrent), 1);
+  }
+
+  return image_options;
+}
+
+
+Error HeifContext::acquire_decoder(const struct heif_decoder_plugin* plugin, void** decoder) const
+{
+  return m_decoder_pool->acquire(plugin, decoder);
+}
+
+
+void HeifContext::release_decoder(const struct heif_decoder_plugin* plugin, void* decoder, bool reusable) const
+{
+  m_decoder_pool->release(plugin, decoder, reusable);
+}
+
+
+Error HeifContext::acquire_encoder(const struct heif_encoder& prototype,
+                                   std::unique_ptr<struct heif_encoder>& out_encoder) const
+{
+  out_encoder.reset();
+
+  {
+#if ENABLE_PARALLEL_TILE_DECODING
+    std::lock_guard<std::mutex> lock(m_idle_encoders_mutex);
+#endif
+
+    for (auto iter = m_idle_encoders.begin(); iter != m_idle_encoders.end(); ++iter) {
+      if ((*iter)->plugin == prototype.plugin) {
+        out_encoder = std::move(*iter);
+        m_idle_encoders.erase(iter);
+        break;
+      }
+    }
+  }
+
+  if (!out_encoder) {
+    out_encoder.reset(new heif_encoder(prototype.plugin));
+
+    struct heif_error err = out_encoder->alloc();
+    if (err.code != heif_error_Ok) {
+      return Error(err.code, err.subcode, err.message);
+    }
+  }
+
+  // The parameters of the prototype may have changed since the instance was used last.
+  struct heif_error err = out_encoder->copy_parameters_from(prototype);
+  if (err.code != heif_error_Ok) {
+    return Error(err.code, err.subcode, err.message);
+  }
+
+  return Error::Ok;
+}
+
+
+void HeifContext::release_encoder(std::unique_ptr<struct heif_encoder> encoder) const
+{
+  if (!encoder) {
+    return;
+  }
+
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(m_idle_encoders_mutex);
+#endif
+  m_idle_encoders.push_back(std::move(encoder));
+}
+
+
 Error HeifContext::read(const std::shared_ptr<StreamReader>& reader)
 {
   m_heif_file = std::make_shared<HeifFile>();
+  m_heif_file->set_read_metadata_only(m_read_metadata_only);
+  m_heif_file->set_file_index(m_file_index.data(), m_file_index.size());
+  m_memory_arena = std::make_shared<MemoryArena>();
+  m_heif_file->set_memory_arena(m_memory_arena);
   Error err = m_heif_file->read(reader);
   if (err) {
     return err;
@@ -426,6 +744,11 @@ Error HeifContext::read(const std::shared_ptr<StreamReader>& reader)
 Error HeifContext::read_from_file(const char* input_filename)
 {
   m_heif_file = std::make_shared<HeifFile>();
+  m_heif_file->set_read_metadata_only(m_read_metadata_only);
+  m_heif_file->set_file_index(m_file_index.data(), m_file_index.size());
+  m_heif_file->set_use_memory_mapping(m_use_memory_mapping);
+  m_memory_arena = std::make_shared<MemoryArena>();
+  m_heif_file->set_memory_arena(m_memory_arena);
   Error err = m_heif_file->read_from_file(input_filename);
   if (err) {
     return err;
@@ -437,6 +760,10 @@ Error HeifContext::read_from_file(const char* input_filename)
 Error HeifContext::read_from_memory(const void* data, size_t size, bool copy)
 {
   m_heif_file = std::make_shared<HeifFile>();
+  m_heif_file->set_read_metadata_only(m_read_metadata_only);
+  m_heif_file->set_file_index(m_file_index.data(), m_file_index.size());
+  m_memory_arena = std::make_shared<MemoryArena>();
+  m_heif_file->set_memory_arena(m_memory_arena);
   Error err = m_heif_file->read_from_memory(data, size, copy);
   if (err) {
     return err;
@@ -445,6 +772,11 @@ Error HeifContext::read_from_memory(const void* data, size_t size, bool copy)
   return interpret_heif_file();
 }
 
+Error HeifContext::write_file_index(StreamWriter& writer) const
+{
+  return m_heif_file->write_file_index(writer);
+}
+
 void HeifContext::reset_to_empty_heif()
 {
   m_heif_file = std::make_shared<HeifFile>();
@@ -465,7 +797,16 @@ std::shared_ptr<RegionItem> HeifContext::add_region_item(uint32_t reference_widt
   return regionItem;
 }
 
-void HeifContext::write(StreamWriter& writer)
+Error HeifContext::write(StreamWriter& writer)
+{
+  return write([&writer](const uint8_t* data, size_t size) {
+    writer.write(data, size);
+    return Error::Ok;
+  });
+}
+
+
+Error HeifContext::write(const StreamWriter::output_sink& sink)
 {
   // --- serialize regions
 
@@ -481,15 +822,43 @@ void HeifContext::write(StreamWriter& writer)
     Error err = region->encode(data_array);
     // TODO: err
 
-    m_heif_file->append_iloc_data(region->item_id, data_array);
+    m_heif_file->append_iloc_data(region->item_id, std::move(data_array));
   }
 
 
   // --- write to file
 
-  m_heif_file->write(writer);
+  TraceScope write_trace(m_tracer, heif_trace_stage_write);
+  uint64_t written_bytes = 0;
+
+  Error err = m_heif_file->write([&sink, &written_bytes](const uint8_t* data, size_t size) {
+    written_bytes += size;
+    return sink(data, size);
+  });
+
+  write_trace.set_data_bytes(written_bytes);
+
+  return err;
+}
+
+Error HeifContext::write_in_place(std::iostream& stream)
+{
+  return m_heif_file->write_in_place(stream);
+}
+
+
+Error HeifContext::start_streaming_output(heif_compression_format format, const StreamWriter::output_sink& sink)
+{
+  Error err = m_heif_file->start_streaming_output(format, sink);
+  if (err) {
+    return err;
+  }
+
+  m_streaming_sink = sink;
+  return Error::Ok;
 }
 
+
 std::string HeifContext::debug_dump_boxes() const
 {
   return m_heif_file->debug_dump_boxes();
@@ -503,6 +872,7 @@ static bool item_type_is_image(const std::string& item_type)
           item_type == "iden" ||
           item_type == "iovl" ||
           item_type == "av01" ||
+          item_type == "jpeg" ||
           item_type == "unci" ||
           item_type == "vvc1");
 }
@@ -541,7 +911,7 @@ Error HeifContext::interpret_heif_file()
     }
 
     if (item_type_is_image(infe_box->get_item_type())) {
-      auto image = std::make_shared<Image>(this, id);
+      auto image = make_shared_in_arena<Image>(m_memory_arena, this, id);
       m_all_images.insert(std::make_pair(id, image));
 
       if (!infe_box->is_hidden_item()) {
@@ -571,7 +941,10 @@ Error HeifContext::interpret_heif_file()
 
     std::vector<std::shared_ptr<Box>> properties;
 
-    Error err = m_heif_file->get_properties(pair.first, properties);
+    // Only parse the properties needed here. The others are parsed when they are used.
+    Error err = m_heif_file->get_properties(pair.first,
+                                            {fourcc("ispe"), fourcc("clap"), fourcc("irot"), fourcc("colr")},
+                                            properties);
     if (err) {
       return err;
     }
@@ -682,7 +1055,7 @@ Error HeifContext::interpret_heif_file()
           //     check whether it is an alpha channel and attach to the main image if yes
 
           std::vector<std::shared_ptr<Box>> properties;
-          Error err = m_heif_file->get_properties(image->get_id(), properties);
+          Error err = m_heif_file->get_properties(image->get_id(), {fourcc("auxC")}, properties);
           if (err) {
             return err;
           }
@@ -804,8 +1177,13 @@ Error HeifContext::interpret_heif_file()
 
 
   // --- check that HEVC images have an hvcC property
+  //     (deferred to decoding when only the metadata is read)
 
   for (auto& pair : m_all_images) {
+    if (m_read_metadata_only) {
+      break;
+    }
+
     auto& image = pair.second;
 
     std::shared_ptr<Box_infe> infe = m_heif_file->get_infe_box(image->get_id());
@@ -814,7 +1192,8 @@ Error HeifContext::interpret_heif_file()
       auto ipma = m_heif_file->get_ipma_box();
       auto ipco = m_heif_file->get_ipco_box();
 
-      if (!ipco->get_property_for_item_ID(image->get_id(), ipma, fourcc("hvcC"))) {
+      // The hvcC is only parsed when the image is decoded.
+      if (!ipco->has_property_for_item_ID(image->get_id(), ipma, fourcc("hvcC"))) {
         return Error(heif_error_Invalid_input,
                      heif_suberror_No_hvcC_box,
                      "No hvcC property in hvc1 type image");
@@ -881,9 +1260,21 @@ Error HeifContext::interpret_heif_file()
     metadata->item_type = item_type;
     metadata->content_type = content_type;
 
-    Error err = m_heif_file->get_compressed_image_data(id, &(metadata->m_data));
-    if (err) {
-      return err;
+    // Metadata in memory inputs is not copied. The view stays valid for the lifetime of the HeifFile.
+    const uint8_t* data_view = nullptr;
+    size_t data_view_size = 0;
+
+    if (m_heif_file->get_item_data_view(id, &data_view, &data_view_size)) {
+      metadata->set_data_view(data_view, data_view_size);
+    }
+    else if (m_read_metadata_only) {
+      metadata->set_deferred_data(m_heif_file);
+    }
+    else {
+      Error err = m_heif_file->get_compressed_image_data(id, &(metadata->m_data));
+      if (err) {
+        return err;
+      }
     }
 
     //std::cerr.write((const char*)data.data(), data.size());
@@ -965,6 +1356,75 @@ Error HeifContext::interpret_heif_file()
     }
   }
 
+
+  // --- image sequence tracks
+
+  if (auto moov = m_heif_file->get_moov_box()) {
+    for (const auto& box : moov->get_child_boxes(fourcc("trak"))) {
+      std::shared_ptr<Track> track;
+      Error err = Track::create(std::dynamic_pointer_cast<Box_trak>(box), track);
+      if (err) {
+        // Other tracks (e.g. audio or metadata) and tracks that cannot be decoded are skipped.
+        continue;
+      }
+
+      m_tracks.push_back(std::move(track));
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+std::shared_ptr<Track> HeifContext::get_track(uint32_t track_id) const
+{
+  for (const auto& track : m_tracks) {
+    if (track->get_id() == track_id) {
+      return track;
+    }
+  }
+
+  return nullptr;
+}
+
+
+Error ImageMetadata::load_deferred_data()
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  if (!m_deferred_file) {
+    return Error::Ok;
+  }
+
+  Error err = m_deferred_file->get_compressed_image_data(item_id, &m_data);
+  if (err) {
+    m_data.clear();
+    return err;
+  }
+
+  m_deferred_file.reset();
+  return Error::Ok;
+}
+
+
+Error ImageMetadata::get_data(const uint8_t** out_data, size_t* out_size)
+{
+  Error err = load_deferred_data();
+  if (err) {
+    return err;
+  }
+
+  if (m_view) {
+    *out_data = m_view;
+    *out_size = m_view_size;
+  }
+  else {
+    *out_data = m_data.data();
+    *out_size = m_data.size();
+  }
+
   return Error::Ok;
 }
 
@@ -989,8 +1449,42 @@ bool HeifContext::is_image(heif_item_id ID) const
 }
 
 
-bool HeifContext::has_alpha(heif_item_id ID) const {
-
+int HeifContext::get_number_of_layers(heif_item_id ID) const
+{
+  auto a1lx = m_heif_file->get_property<Box_a1lx>(ID);
+  if (!a1lx) {
+    return 1;
+  }
+
+  // The sizes of all layers but the last one are stored. Unused entries are zero.
+  int num_layers = 1;
+  while (num_layers < 4 && a1lx->layer_size[num_layers - 1] != 0) {
+    num_layers++;
+  }
+
+  return num_layers;
+}
+
+
+uint64_t HeifContext::get_layer_prefix_size(heif_item_id ID, int layer) const
+{
+  if (layer + 1 >= get_number_of_layers(ID)) {
+    return 0;
+  }
+
+  auto a1lx = m_heif_file->get_property<Box_a1lx>(ID);
+
+  uint64_t size = 0;
+  for (int i = 0; i <= layer; i++) {
+    size += a1lx->layer_size[i];
+  }
+
+  return size;
+}
+
+
+bool HeifContext::has_alpha(heif_item_id ID) const {
+
   assert(is_image(ID));
   auto img = m_all_images.find(ID)->second;
 
@@ -1145,36 +1639,50 @@ int HeifContext::Image::get_chroma_bits_per_pixel() const
 }
 
 
-Error HeifContext::decode_image_user(heif_item_id ID,
-                                     std::shared_ptr<HeifPixelImage>& img,
-                                     heif_colorspace out_colorspace,
-                                     heif_chroma out_chroma,
-                                     const struct heif_decoding_options& options) const
+// Writes the samples of 'alpha_channel' into the alpha component of the interleaved RGBA or
+// RRGGBBAA image 'img'. The samples are scaled to the bit depth of 'img'.
+static Error copy_alpha_into_interleaved_image(const HeifPixelImage& alpha, heif_channel alpha_channel,
+                                               HeifPixelImage& img)
 {
-  Error err = decode_image_planar(ID, img, out_colorspace, options, false);
-  if (err) {
-    return err;
+  const int width = img.get_width();
+  const int height = img.get_height();
+
+  if (alpha.get_width(alpha_channel) != width ||
+      alpha.get_height(alpha_channel) != height) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_image_size,
+                 "Alpha image has a different size than the color image");
   }
 
-  // --- convert to output chroma format
+  const int in_bpp = alpha.get_bits_per_pixel(alpha_channel);
+  const int out_bpp = img.get_bits_per_pixel(heif_channel_interleaved);
+  const uint32_t in_max = (1U << in_bpp) - 1;
+  const uint32_t out_max = (1U << out_bpp) - 1;
 
-  heif_colorspace target_colorspace = (out_colorspace == heif_colorspace_undefined ?
-                                       img->get_colorspace() :
-                                       out_colorspace);
+  heif_chroma chroma = img.get_chroma_format();
+  const bool le = (chroma == heif_chroma_interleaved_RRGGBBAA_LE);
 
-  heif_chroma target_chroma = (out_chroma == heif_chroma_undefined ?
-                               img->get_chroma_format() : out_chroma);
+  size_t in_stride = 0, out_stride = 0;
+  const uint8_t* in_p = alpha.get_plane(alpha_channel, &in_stride);
+  uint8_t* out_p = img.get_plane(heif_channel_interleaved, &out_stride);
 
-  bool different_chroma = (target_chroma != img->get_chroma_format());
-  bool different_colorspace = (target_colorspace != img->get_colorspace());
+  for (int y = 0; y < height; y++) {
+    const uint8_t* in_row = in_p + y * static_cast<size_t>(in_stride);
+    uint8_t* out_row = out_p + y * static_cast<size_t>(out_stride);
 
-  int bpp = options.convert_hdr_to_8bit ? 8 : 0;
-  // TODO: check BPP changed
-  if (different_chroma || different_colorspace) {
+    for (int x = 0; x < width; x++) {
+      uint32_t a = (in_bpp <= 8 ? in_row[x] : reinterpret_cast<const uint16_t*>(in_row)[x]);
+      if (in_bpp != out_bpp) {
+        a = (a * out_max + in_max / 2) / in_max;
+      }
 
-    img = convert_colorspace(img, target_colorspace, target_chroma, nullptr, bpp, options.color_conversion_options);
-    if (!img) {
-      return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+      if (chroma == heif_chroma_interleaved_RGBA) {
+        out_row[4 * x + 3] = static_cast<uint8_t>(a);
+      }
+      else {
+        out_row[8 * x + 6 + le] = static_cast<uint8_t>(a >> 8);
+        out_row[8 * x + 7 - le] = static_cast<uint8_t>(a & 0xFF);
+      }
     }
   }
 
@@ -1182,672 +1690,997 @@ Error HeifContext::decode_image_user(heif_item_id ID,
 }
 
 
-Error HeifContext::decode_image_planar(heif_item_id ID,
-                                       std::shared_ptr<HeifPixelImage>& img,
-                                       heif_colorspace out_colorspace,
-                                       const struct heif_decoding_options& options, bool alphaImage) const
+static Error attach_alpha_plane(const std::shared_ptr<HeifPixelImage>& img,
+                                const std::shared_ptr<HeifPixelImage>& alpha,
+                                bool premultiplied_alpha)
 {
-  std::string image_type = m_heif_file->get_item_type(ID);
-
-  std::shared_ptr<Image> imginfo;
-  if (m_all_images.find(ID) != m_all_images.end()) {
-    imginfo = m_all_images.find(ID)->second;
+  // TODO: check that sizes are the same and that we have an Y channel
+  // BUT: is there any indication in the standard that the alpha channel should have the same size?
+
+  heif_channel channel;
+  switch (alpha->get_colorspace()) {
+    case heif_colorspace_YCbCr:
+    case heif_colorspace_monochrome:
+      channel = heif_channel_Y;
+      break;
+    case heif_colorspace_RGB:
+      channel = heif_channel_R;
+      break;
+    case heif_colorspace_undefined:
+    default:
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Unsupported_color_conversion);
   }
 
-  assert(imginfo);
+  if (img->has_channel(heif_channel_interleaved)) {
+    // Interleaved RGB images (e.g. grid images decoded directly into the output format) get the
+    // alpha samples in their alpha component. Without alpha component, alpha is not needed.
+    if (is_chroma_with_alpha(img->get_chroma_format())) {
+      Error err = copy_alpha_into_interleaved_image(*alpha, channel, *img);
+      if (err) {
+        return err;
+      }
+    }
+  }
+  else {
+    img->transfer_plane_from_image_as(alpha, channel, heif_channel_Alpha);
+  }
 
-  Error error;
+  if (premultiplied_alpha && img->has_alpha()) {
+    img->set_premultiplied_alpha(true);
+  }
 
+  return Error::Ok;
+}
 
-  // --- decode image, depending on its type
 
-  if (image_type == "hvc1" ||
-      image_type == "av01") {
+// Scales the image down to 'width' x 'height' if it has a different size.
+static Error scale_image_to(std::shared_ptr<HeifPixelImage>& img, int width, int height,
+                            enum heif_scaling_filter filter, ThreadPool* thread_pool = nullptr)
+{
+  if (img->get_width() == width && img->get_height() == height) {
+    return Error::Ok;
+  }
 
-    heif_compression_format compression = heif_compression_undefined;
-    if (image_type == "hvc1") {
-      compression = heif_compression_HEVC;
-    }
-    else if (image_type == "av01") {
-      compression = heif_compression_AV1;
-    }
+  std::shared_ptr<HeifPixelImage> scaled_img;
+  Error err = img->scale(scaled_img, width, height, filter, thread_pool);
+  if (err) {
+    return err;
+  }
 
-    const struct heif_decoder_plugin* decoder_plugin = get_decoder(compression, options.decoder_id);
-    if (!decoder_plugin) {
-      return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_codec);
-    }
+  scaled_img->copy_image_properties_from(*img);
+  img = scaled_img;
 
-    std::vector<uint8_t> data;
-    error = m_heif_file->get_compressed_image_data(ID, &data);
-    if (error) {
-      return error;
-    }
+  return Error::Ok;
+}
 
-    void* decoder;
-    struct heif_error err = decoder_plugin->new_decoder(&decoder);
-    if (err.code != heif_error_Ok) {
-      return Error(err.code, err.subcode, err.message);
-    }
 
-    if (decoder_plugin->plugin_api_version >= 2) {
-      if (decoder_plugin->set_strict_decoding) {
-        decoder_plugin->set_strict_decoding(decoder, options.strict_decoding);
-      }
-    }
+// Crops the image to the area (left,top)-(right,bottom) (inclusive). The cropped image shares the
+// pixel memory with the input image, such that no pixels are copied unless the image is written to.
+static Error crop_image(std::shared_ptr<HeifPixelImage>& img, int left, int right, int top, int bottom)
+{
+  if (left == 0 && top == 0 && right == img->get_width() - 1 && bottom == img->get_height() - 1) {
+    return Error::Ok;
+  }
 
-    err = decoder_plugin->push_data(decoder, data.data(), data.size());
-    if (err.code != heif_error_Ok) {
-      decoder_plugin->free_decoder(decoder);
-      return Error(err.code, err.subcode, err.message);
-    }
+  std::shared_ptr<HeifPixelImage> cropped_img;
+  Error error = img->crop(left, right, top, bottom, cropped_img);
+  if (error) {
+    return error;
+  }
 
-    //std::shared_ptr<HeifPixelImage>* decoded_img;
+  cropped_img->copy_image_properties_from(*img);
 
-    heif_image* decoded_img = nullptr;
+  img = cropped_img;
 
-    err = decoder_plugin->decode_image(decoder, &decoded_img);
-    if (err.code != heif_error_Ok) {
-      decoder_plugin->free_decoder(decoder);
-      return Error(err.code, err.subcode, err.message);
-    }
+  return Error::Ok;
+}
 
-    if (!decoded_img) {
-      // TODO(farindk): The plugin should return an error in this case.
-      decoder_plugin->free_decoder(decoder);
-      return Error(heif_error_Decoder_plugin_error, heif_suberror_Unspecified);
-    }
 
-    img = std::move(decoded_img->image);
-    heif_image_release(decoded_img);
+// Create an image in the output format whose planes are stored in memory provided by the application.
+static Error create_image_in_user_buffers(const std::shared_ptr<HeifPixelImage>& img,
+                                          const ColorState& output_state,
+                                          bool same_format,
+                                          const struct heif_decoding_options& options,
+                                          std::shared_ptr<HeifPixelImage>& out_img)
+{
+  int width = img->get_width();
+  int height = img->get_height();
 
-    decoder_plugin->free_decoder(decoder);
+  std::vector<ImagePlaneLayout> planes;
 
+  if (same_format) {
+    // no conversion: the output has exactly the planes of the decoded image
+    for (heif_channel channel : img->get_channel_set()) {
+      planes.push_back({channel, img->get_width(channel), img->get_height(channel), img->get_bits_per_pixel(channel)});
+    }
+  }
+  else {
+    planes = get_image_plane_layout(width, height, output_state);
+  }
 
+  out_img = std::make_shared<HeifPixelImage>();
+  out_img->create(width, height, output_state.colorspace, output_state.chroma);
 
-    // --- convert to output chroma format
+  for (const auto& plane : planes) {
+    int bytes_per_pixel = num_interleaved_pixels_per_plane(output_state.chroma, plane.channel) * ((plane.bit_depth + 7) / 8);
+    int stride = 0;
 
-    // If there is an NCLX profile in the HEIF/AVIF metadata, use this for the color conversion.
-    // Otherwise, use the profile that is stored in the image stream itself and then set the
-    // (non-NCLX) profile later.
-    auto nclx = imginfo->get_color_profile_nclx();
-    if (nclx) {
-      img->set_color_profile_nclx(nclx);
+    uint8_t* mem = options.get_output_plane_buffer(plane.channel, plane.width, plane.height,
+                                                   plane.bit_depth, bytes_per_pixel, &stride,
+                                                   options.output_buffer_user_data);
+    if (mem == nullptr) {
+      return Error(heif_error_Memory_allocation_error,
+                   heif_suberror_Unspecified,
+                   "Application did not provide an output buffer");
     }
 
-    auto icc = imginfo->get_color_profile_icc();
-    if (icc) {
-      img->set_color_profile_icc(icc);
+    if (stride < plane.width * bytes_per_pixel ||
+        !out_img->add_external_plane(plane.channel, plane.width, plane.height, plane.bit_depth,
+                                     mem, static_cast<size_t>(stride))) {
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Invalid_parameter_value,
+                   "Stride of application output buffer is too small");
     }
+  }
 
-    if (alphaImage) {
-      // no color conversion required
-    }
-    else {
-      heif_colorspace target_colorspace = (out_colorspace == heif_colorspace_undefined ?
-                                           img->get_colorspace() :
-                                           out_colorspace);
+  return Error::Ok;
+}
 
-      if (!alphaImage && target_colorspace == heif_colorspace_YCbCr) {
-        target_colorspace = heif_colorspace_RGB;
-      }
 
-      heif_chroma target_chroma = (target_colorspace == heif_colorspace_monochrome ?
-                                   heif_chroma_monochrome : heif_chroma_444);
+static Error convert_to_output_format(std::shared_ptr<HeifPixelImage>& img,
+                                      heif_colorspace out_colorspace,
+                                      heif_chroma out_chroma,
+                                      const struct heif_decoding_options& options,
+                                      ThreadPool* thread_pool)
+{
+  if (options.color_conversion_threads == 1) {
+    thread_pool = nullptr;
+  }
 
-      bool different_chroma = (target_chroma != img->get_chroma_format());
-      bool different_colorspace = (target_colorspace != img->get_colorspace());
+  int max_threads = options.color_conversion_threads;
 
-      if (different_chroma || different_colorspace) {
-        img = convert_colorspace(img, target_colorspace, target_chroma, nullptr, 0, options.color_conversion_options);
-        if (!img) {
-          return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
-        }
-      }
-    }
+  heif_colorspace target_colorspace = (out_colorspace == heif_colorspace_undefined ?
+                                       img->get_colorspace() :
+                                       out_colorspace);
+
+  heif_chroma target_chroma = (out_chroma == heif_chroma_undefined ?
+                               img->get_chroma_format() : out_chroma);
+
+  bool different_chroma = (target_chroma != img->get_chroma_format());
+  bool different_colorspace = (target_colorspace != img->get_colorspace());
+
+  int bpp = options.convert_hdr_to_8bit ? 8 : 0;
+
+  // Tone map PQ and HLG images to sRGB. The pipeline inserts the tone mapping because the target
+  // profile has a different transfer function.
+  std::shared_ptr<const color_profile_nclx> target_profile;
+  auto input_profile = img->get_color_profile_nclx();
+  if (bpp == 8 && options.tone_map_hdr_to_sdr && input_profile &&
+      (input_profile->get_transfer_characteristics() == heif_transfer_characteristic_ITU_R_BT_2100_0_PQ ||
+       input_profile->get_transfer_characteristics() == heif_transfer_characteristic_ITU_R_BT_2100_0_HLG)) {
+    auto sdr_profile = std::make_shared<color_profile_nclx>(*input_profile);
+    sdr_profile->set_transfer_characteristics(heif_transfer_characteristic_IEC_61966_2_1);
+    target_profile = sdr_profile;
   }
-  else if (image_type == "grid") {
-    std::vector<uint8_t> data;
-    error = m_heif_file->get_compressed_image_data(ID, &data);
-    if (error) {
-      return error;
-    }
 
-    error = decode_full_grid_image(ID, img, data, options);
-    if (error) {
-      return error;
-    }
+  // Linear light output for the float formats. The conversion to float applies the inverse
+  // transfer function because the target profile has linear transfer characteristics.
+  if (options.linear_light_output && is_float_chroma(target_chroma) &&
+      target_colorspace == heif_colorspace_RGB) {
+    auto linear_profile = (input_profile ? std::make_shared<color_profile_nclx>(*input_profile) :
+                           std::make_shared<color_profile_nclx>());
+    linear_profile->set_transfer_characteristics(heif_transfer_characteristic_linear);
+    target_profile = linear_profile;
   }
-  else if (image_type == "iden") {
-    error = decode_derived_image(ID, img, options);
-    if (error) {
-      return error;
-    }
+
+  // Premultiplication or unpremultiplication of RGB output, done by the conversion from YCbCr.
+  heif_alpha_premultiplication alpha_premultiplication = heif_alpha_premultiplication_unchanged;
+  bool different_alpha = false;
+  if (target_colorspace == heif_colorspace_RGB && img->has_alpha()) {
+    alpha_premultiplication = options.output_alpha_premultiplication;
+    different_alpha = (alpha_premultiplication != heif_alpha_premultiplication_unchanged &&
+                       (alpha_premultiplication == heif_alpha_premultiplication_premultiplied) != img->is_premultiplied_alpha());
   }
-  else if (image_type == "iovl") {
-    std::vector<uint8_t> data;
-    error = m_heif_file->get_compressed_image_data(ID, &data);
-    if (error) {
-      return error;
+
+  if (options.get_output_plane_buffer) {
+    // Let the final conversion step write directly into the application buffers.
+    // When no conversion is needed, the decoded image is copied into them.
+
+    bool same_format = !(different_chroma || different_colorspace || different_alpha || target_profile);
+
+    ColorState output_state = get_output_color_state(img, target_colorspace, target_chroma, target_profile, bpp,
+                                                     alpha_premultiplication);
+
+    std::shared_ptr<HeifPixelImage> out_img;
+    Error err = create_image_in_user_buffers(img, output_state, same_format, options, out_img);
+    if (err) {
+      return err;
     }
 
-    error = decode_overlay_image(ID, img, data, options);
-    if (error) {
-      return error;
+    std::shared_ptr<HeifPixelImage> result;
+    if (same_format) {
+      if (img->copy_planes_to(*out_img)) {
+        out_img->copy_image_properties_from(*img);
+        result = out_img;
+      }
     }
-#if WITH_UNCOMPRESSED_CODEC
-  } else if (image_type == "unci") {
-    std::vector<uint8_t> data;
-    error = m_heif_file->get_compressed_image_data(ID, &data);
-    if (error) {
-      return error;
+    else {
+      result = convert_colorspace(img, target_colorspace, target_chroma, target_profile, bpp, options.color_conversion_options, out_img,
+                                  thread_pool, max_threads, alpha_premultiplication, Cancellation::get(options));
     }
-    error = UncompressedImageCodec::decode_uncompressed_image(m_heif_file,
-                                                              ID,
-                                                              img,
-                                                              m_maximum_image_width_limit,
-                                                              m_maximum_image_height_limit,
-                                                              data);
-    if (error) {
-      return error;
+
+    if (!result) {
+      Error err = check_canceled(options);
+      return err ? err : Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
     }
-#endif
+
+    img = result;
+    return Error::Ok;
   }
-  else {
-    // Should not reach this, was already rejected by "get_image_data".
-    return Error(heif_error_Unsupported_feature,
-                 heif_suberror_Unsupported_image_type);
+
+  // TODO: check BPP changed
+  if (different_chroma || different_colorspace || different_alpha || target_profile) {
+
+    img = convert_colorspace(img, target_colorspace, target_chroma, target_profile, bpp, options.color_conversion_options, nullptr,
+                             thread_pool, max_threads, alpha_premultiplication, Cancellation::get(options));
+    if (!img) {
+      Error err = check_canceled(options);
+      return err ? err : Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+    }
   }
 
+  return Error::Ok;
+}
 
 
-  // --- apply image transformations
+// Whether the canvas of a grid image can be created in the interleaved RGB format 'chroma' that
+// the application requested, such that no conversion of the whole canvas is needed afterwards.
+static bool is_interleaved_canvas_chroma(heif_chroma chroma, int bpp, const heif_decoding_options& options)
+{
+  switch (chroma) {
+    case heif_chroma_interleaved_RGB:
+    case heif_chroma_interleaved_RGBA:
+      return bpp == 8;
+    case heif_chroma_interleaved_RRGGBB_BE:
+    case heif_chroma_interleaved_RRGGBBAA_BE:
+    case heif_chroma_interleaved_RRGGBB_LE:
+    case heif_chroma_interleaved_RRGGBBAA_LE:
+      return bpp > 8 && !options.convert_hdr_to_8bit;
+    default:
+      return false;
+  }
+}
 
-  if (options.ignore_transformations == false) {
-    std::vector<std::shared_ptr<Box>> properties;
-    auto ipco_box = m_heif_file->get_ipco_box();
-    auto ipma_box = m_heif_file->get_ipma_box();
-    error = ipco_box->get_properties_for_item_ID(ID, ipma_box, properties);
 
-    for (const auto& property : properties) {
-      if (property->get_short_type() == fourcc("irot")) {
-        auto rot = std::dynamic_pointer_cast<Box_irot>(property);
-        std::shared_ptr<HeifPixelImage> rotated_img;
-        error = img->rotate_ccw(rot->get_rotation(), rotated_img);
-        if (error) {
-          return error;
-        }
+// The format in which the decoder delivers an image. Only the HEVC and AV1 configurations define
+// the chroma format. YCbCr 4:4:4 is assumed for the other codecs.
+static ColorState get_coded_color_state(const HeifFile& file, heif_item_id coded_id, int bpp, bool has_alpha)
+{
+  heif_chroma chroma = heif_chroma_444;
 
-        img = rotated_img;
-      }
+  std::string coded_type = file.get_item_type(coded_id);
+  if (coded_type == "hvc1" || coded_type == "av01") {
+    chroma = file.get_image_chroma_from_configuration(coded_id);
+  }
 
+  heif_colorspace colorspace = (chroma == heif_chroma_monochrome ? heif_colorspace_monochrome : heif_colorspace_YCbCr);
 
-      if (property->get_short_type() == fourcc("imir")) {
-        auto mirror = std::dynamic_pointer_cast<Box_imir>(property);
-        error = img->mirror_inplace(mirror->get_mirror_direction());
-        if (error) {
-          return error;
-        }
-      }
+  return ColorState(colorspace, chroma, has_alpha, bpp);
+}
 
 
-      if (property->get_short_type() == fourcc("clap")) {
-        auto clap = std::dynamic_pointer_cast<Box_clap>(property);
-        std::shared_ptr<HeifPixelImage> clap_img;
+size_t HeifContext::estimate_tile_memory(heif_item_id tile_id, const ColorState& canvas_state,
+                                         const heif_decoding_options& options) const
+{
+  auto iter = m_all_images.find(tile_id);
+  if (iter == m_all_images.end()) {
+    return 0;
+  }
 
-        int img_width = img->get_width();
-        int img_height = img->get_height();
-        assert(img_width >= 0);
-        assert(img_height >= 0);
+  const std::shared_ptr<Image>& tile = iter->second;
+  ColorState tile_state = get_coded_color_state(*m_heif_file, tile_id, canvas_state.bits_per_pixel, false);
 
-        int left = clap->left_rounded(img_width);
-        int right = clap->right_rounded(img_width);
-        int top = clap->top_rounded(img_height);
-        int bottom = clap->bottom_rounded(img_height);
+  // the decoded tile and its conversion to the canvas format
+  return get_image_memory_size(tile->get_width(), tile->get_height(), tile_state) +
+         estimate_conversion_memory(tile->get_width(), tile->get_height(), tile_state, canvas_state,
+                                    options.color_conversion_options);
+}
 
-        if (left < 0) { left = 0; }
-        if (top < 0) { top = 0; }
 
-        if (right >= img_width) { right = img_width - 1; }
-        if (bottom >= img_height) { bottom = img_height - 1; }
+int HeifContext::get_max_concurrent_tiles(size_t tile_bytes, size_t num_tiles, size_t reserved_bytes) const
+{
+  // The worker threads and the thread that waits for the tiles decode tiles at the same time.
+  size_t max_tiles = (m_max_decoding_threads > 0 ? static_cast<size_t>(m_max_decoding_threads) + 1 : 1);
+  max_tiles = std::min(max_tiles, std::max(num_tiles, size_t{1}));
 
-        if (left > right ||
-            top > bottom) {
-          return Error(heif_error_Invalid_input,
-                       heif_suberror_Invalid_clean_aperture);
-        }
+  if (m_memory_budget && tile_bytes > 0) {
+    size_t used = m_memory_budget->get_used_bytes() + reserved_bytes;
+    size_t available = (used < m_memory_budget->get_max_bytes() ? m_memory_budget->get_max_bytes() - used : 0);
+    max_tiles = std::min(max_tiles, std::max(available / tile_bytes, size_t{1}));
+  }
 
-        std::shared_ptr<HeifPixelImage> cropped_img;
-        error = img->crop(left, right, top, bottom, cropped_img);
-        if (error) {
-          return error;
-        }
+  return static_cast<int>(max_tiles);
+}
 
-        img = cropped_img;
-      }
-    }
-  }
 
+Error HeifContext::estimate_decoding_memory(heif_item_id ID, heif_chroma out_chroma,
+                                            const struct heif_decoding_options& options,
+                                            const ImageRegion* region,
+                                            DecodingMemoryEstimate& estimate) const
+{
+  estimate = DecodingMemoryEstimate();
 
-  // --- add alpha channel, if available
+  auto iter = m_all_images.find(ID);
+  if (iter == m_all_images.end()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
 
-  // TODO: this if statement is probably wrong. When we have a tiled image with alpha
-  // channel, then the alpha images should be associated with their respective tiles.
-  // However, the tile images are not part of the m_all_images list.
-  // Fix this, when we have a test image available.
-  if (m_all_images.find(ID) != m_all_images.end()) {
-    const auto imginfo = m_all_images.find(ID)->second;
+  const std::shared_ptr<Image>& image = iter->second;
 
-    std::shared_ptr<Image> alpha_image = imginfo->get_alpha_channel();
-    if (alpha_image) {
-      std::shared_ptr<HeifPixelImage> alpha;
-      Error err = decode_image_planar(alpha_image->get_id(), alpha,
-                                      heif_colorspace_undefined, options, true);
-      if (err) {
-        return err;
-      }
+  int width = region ? region->width : image->get_width();
+  int height = region ? region->height : image->get_height();
 
-      // TODO: check that sizes are the same and that we have an Y channel
-      // BUT: is there any indication in the standard that the alpha channel should have the same size?
+  heif_item_id coded_id;
+  Error err = get_id_of_non_virtual_child_image(ID, coded_id);
+  if (err) {
+    return err;
+  }
 
-      heif_channel channel;
-      switch (alpha->get_colorspace()) {
-        case heif_colorspace_YCbCr:
-        case heif_colorspace_monochrome:
-          channel = heif_channel_Y;
-          break;
-        case heif_colorspace_RGB:
-          channel = heif_channel_R;
-          break;
-        case heif_colorspace_undefined:
-        default:
-          return Error(heif_error_Invalid_input,
-                       heif_suberror_Unsupported_color_conversion);
-      }
+  bool is_grid = (m_heif_file->get_item_type(ID) == "grid");
+  bool has_alpha = (image->get_alpha_channel() != nullptr);
+  int bpp = std::max(image->get_luma_bits_per_pixel(), 8);
 
-      img->transfer_plane_from_image_as(alpha, channel, heif_channel_Alpha);
+  ColorState decoded_state = get_coded_color_state(*m_heif_file, coded_id, bpp, has_alpha);
 
-      if (imginfo->is_premultiplied_alpha()) {
-        img->set_premultiplied_alpha(true);
-      }
+  if (is_grid) {
+    // Grids are assembled in a planar RGB canvas, or directly in the interleaved output format.
+    if (!has_alpha && is_interleaved_canvas_chroma(out_chroma, bpp, options)) {
+      decoded_state = ColorState(heif_colorspace_RGB, out_chroma, false, bpp);
+    }
+    else {
+      decoded_state = ColorState(heif_colorspace_RGB, heif_chroma_444, has_alpha, bpp);
     }
   }
 
+  estimate.image_bytes = get_image_memory_size(width, height, decoded_state);
 
-  // --- attach metadata to image
+  // The decoded image is alive while it is transformed or converted into the output format.
+  if (out_chroma != heif_chroma_undefined) {
+    heif_colorspace out_colorspace = decoded_state.colorspace;
+    if (out_chroma == heif_chroma_monochrome) {
+      out_colorspace = heif_colorspace_monochrome;
+    }
+    else if (num_interleaved_pixels_per_plane(out_chroma) > 1 && !is_semi_planar_chroma(out_chroma)) {
+      out_colorspace = heif_colorspace_RGB;
+    }
 
-  {
-    auto ipco_box = m_heif_file->get_ipco_box();
-    auto ipma_box = m_heif_file->get_ipma_box();
+    ColorState output_state = get_output_color_state(decoded_state, out_colorspace, out_chroma, nullptr, 0);
+    estimate.output_bytes = estimate_conversion_memory(width, height, decoded_state, output_state,
+                                                       options.color_conversion_options);
+  }
 
-    // CLLI
+  if (!options.ignore_transformations) {
+    estimate.output_bytes = std::max(estimate.output_bytes, estimate.image_bytes);
+  }
 
-    auto clli_box = ipco_box->get_property_for_item_ID(ID, ipma_box, fourcc("clli"));
-    auto clli = std::dynamic_pointer_cast<Box_clli>(clli_box);
+  // A canvas in files is not counted, and neither are the images converted from it.
+  if (is_grid && options.version >= 17 && options.canvas_file_directory != nullptr) {
+    estimate.image_bytes = 0;
+    estimate.output_bytes = 0;
+  }
 
-    if (clli) {
-      img->set_clli(clli->clli);
+  // The tiles are decoded in parallel into the canvas and are released before the output conversion.
+  // Only as many tiles are decoded at the same time as fit into the memory budget.
+  size_t tiles_bytes = 0;
+  if (is_grid) {
+    GridLayout layout;
+    err = get_grid_layout(ID, layout);
+    if (err) {
+      return err;
     }
 
-    // MDCV
+    ColorState canvas_state = decoded_state;
+    canvas_state.has_alpha = false;
 
-    auto mdcv_box = ipco_box->get_property_for_item_ID(ID, ipma_box, fourcc("mdcv"));
-    auto mdcv = std::dynamic_pointer_cast<Box_mdcv>(mdcv_box);
+    size_t num_tiles = size_t{layout.rows} * layout.columns;
+    estimate.tile_bytes = estimate_tile_memory(coded_id, canvas_state, options);
+    estimate.max_concurrent_tiles = get_max_concurrent_tiles(estimate.tile_bytes, num_tiles, estimate.image_bytes);
+    tiles_bytes = estimate.max_concurrent_tiles * estimate.tile_bytes;
+  }
 
-    if (mdcv) {
-      img->set_mdcv(mdcv->mdcv);
-    }
+  estimate.peak_bytes = estimate.image_bytes + std::max(tiles_bytes, estimate.output_bytes);
 
-    // PASP
+  return Error::Ok;
+}
 
-    auto pasp_box = ipco_box->get_property_for_item_ID(ID, ipma_box, fourcc("pasp"));
-    auto pasp = std::dynamic_pointer_cast<Box_pasp>(pasp_box);
 
-    if (pasp) {
-      img->set_pixel_ratio(pasp->hSpacing, pasp->vSpacing);
-    }
+Error HeifContext::check_memory_budget(heif_item_id ID, heif_chroma out_chroma,
+                                       const struct heif_decoding_options& options,
+                                       const ImageRegion* region) const
+{
+  if (!m_memory_budget) {
+    return Error::Ok;
+  }
+
+  DecodingMemoryEstimate estimate;
+  if (estimate_decoding_memory(ID, out_chroma, options, region, estimate)) {
+    // Decoding will report the problem.
+    return Error::Ok;
+  }
+
+  if (!m_memory_budget->fits(estimate.peak_bytes)) {
+    return memory_budget_error(estimate.peak_bytes, *m_memory_budget);
   }
 
   return Error::Ok;
 }
 
 
-// This function only works with RGB images.
-Error HeifContext::decode_full_grid_image(heif_item_id ID,
-                                          std::shared_ptr<HeifPixelImage>& img,
-                                          const std::vector<uint8_t>& grid_data,
-                                          const heif_decoding_options& options) const
+static DecodedImageCache::Key get_decoded_image_cache_key(heif_item_id ID,
+                                                         heif_colorspace out_colorspace,
+                                                         heif_chroma out_chroma,
+                                                         const heif_decoding_options& options,
+                                                         const HeifContext::ImageRegion* region)
 {
-  ImageGrid grid;
-  Error err = grid.parse(grid_data);
-  if (err) {
-    return err;
-  }
+  DecodedImageCache::Key key;
+  key.id = ID;
+  key.colorspace = out_colorspace;
+  key.chroma = out_chroma;
+
+  if (region) {
+    key.has_region = true;
+    key.region_x = region->x;
+    key.region_y = region->y;
+    key.region_width = region->width;
+    key.region_height = region->height;
+  }
+
+  key.ignore_transformations = options.ignore_transformations;
+  key.convert_hdr_to_8bit = options.convert_hdr_to_8bit;
+  key.strict_decoding = options.strict_decoding;
+  key.decoder_id = (options.decoder_id ? options.decoder_id : "");
+  key.downsampling = options.color_conversion_options.preferred_chroma_downsampling_algorithm;
+  key.upsampling = options.color_conversion_options.preferred_chroma_upsampling_algorithm;
+  key.only_use_preferred_chroma_algorithm = options.color_conversion_options.only_use_preferred_chroma_algorithm;
+  key.conversion_accuracy = options.color_conversion_options.conversion_accuracy;
+  key.tone_map_hdr_to_sdr = options.tone_map_hdr_to_sdr;
+  key.target_bbox_width = options.target_bbox_width;
+  key.target_bbox_height = options.target_bbox_height;
+  key.target_scaling_filter = options.target_scaling_filter;
+  key.linear_light_output = options.linear_light_output;
+  key.output_alpha_premultiplication = options.output_alpha_premultiplication;
+
+  return key;
+}
 
-  //std::cout << grid.dump();
 
+Error HeifContext::decode_image_user(heif_item_id ID,
+                                     std::shared_ptr<HeifPixelImage>& img,
+                                     heif_colorspace out_colorspace,
+                                     heif_chroma out_chroma,
+                                     const struct heif_decoding_options& options,
+                                     const ImageRegion* region) const
+{
+  ScopedTaskPriority priority(get_decoding_priority(ID, options));
 
-  auto iref_box = m_heif_file->get_iref_box();
+  // --- return the image from the cache if it has been decoded before with the same parameters.
+  //     Images that are written into application buffers are not cached.
 
-  if (!iref_box) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_No_iref_box,
-                 "No iref box available, but needed for grid image");
+  std::shared_ptr<DecodedImageCache> cache = m_decoded_image_cache;
+  if (options.get_output_plane_buffer) {
+    cache.reset();
   }
 
-  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+  DecodedImageCache::Key cache_key;
+  if (cache) {
+    cache_key = get_decoded_image_cache_key(ID, out_colorspace, out_chroma, options, region);
+    img = cache->get(cache_key);
+    if (img) {
+      return Error::Ok;
+    }
+  }
 
-  if ((int) image_references.size() != grid.get_rows() * grid.get_columns()) {
-    std::stringstream sstr;
-    sstr << "Tiled image with " << grid.get_rows() << "x" << grid.get_columns() << "="
-         << (grid.get_rows() * grid.get_columns()) << " tiles, but only "
-         << image_references.size() << " tile images in file";
+  // Cached images count in the memory budget. Drop them if the decoded image does not fit otherwise.
+  Error err = check_memory_budget(ID, out_chroma, options, region);
+  while (err && err.sub_error_code == heif_suberror_Memory_budget_exceeded && cache && cache->evict_one()) {
+    err = check_memory_budget(ID, out_chroma, options, region);
+  }
 
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_Missing_grid_images,
-                 sstr.str());
+  if (err) {
+    return err;
+  }
+
+  if (!region && (options.target_bbox_width > 0 || options.target_bbox_height > 0)) {
+    err = decode_image_at_target_size(ID, img, out_colorspace, out_chroma, options);
+  }
+  else {
+    err = decode_image_planar(ID, img, out_colorspace, options, false, region, out_chroma);
   }
 
+  if (err) {
+    return err;
+  }
 
-  // --- check that all image IDs are valid images
+  // --- convert to output chroma format
 
-  for (heif_item_id tile_id : image_references) {
-    if (!is_image(tile_id)) {
-      std::stringstream sstr;
-      sstr << "Tile image ID=" << tile_id << " is not a proper image.";
+  TraceScope conversion_trace(m_tracer, heif_trace_stage_color_conversion, ID);
+  conversion_trace.set_input_image(img.get());
+  const HeifPixelImage* decoded_img = img.get();
 
-      return Error(heif_error_Invalid_input,
-                   heif_suberror_Missing_grid_images,
-                   sstr.str());
-    }
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+  err = convert_to_output_format(img, out_colorspace, out_chroma, options, thread_pool.get());
+  if (err) {
+    return err;
   }
 
+  if (img.get() != decoded_img) {
+    conversion_trace.set_output_image(img.get());
+  }
+  else {
+    conversion_trace.cancel();
+  }
 
-  auto ipma = m_heif_file->get_ipma_box();
-  auto ipco = m_heif_file->get_ipco_box();
-  auto pixi_box = ipco->get_property_for_item_ID(ID, ipma, fourcc("pixi"));
-  auto pixi = std::dynamic_pointer_cast<Box_pixi>(pixi_box);
+  statistics::add(statistics::images_decoded);
 
-  const uint32_t w = grid.get_width();
-  const uint32_t h = grid.get_height();
+  if (cache) {
+    cache->put(cache_key, img);
+  }
 
+  return Error::Ok;
+}
 
-  // --- determine output image chroma size and make sure all tiles have same chroma
 
-  assert(!image_references.empty());
+Error HeifContext::decode_alpha_image_user(heif_item_id ID,
+                                           std::shared_ptr<HeifPixelImage>& img,
+                                           const struct heif_decoding_options& options) const
+{
+  // The alpha image is what the application waits for, hence it gets the priority of the color image.
+  ScopedTaskPriority priority(get_decoding_priority(ID, options));
 
-  heif_chroma tile_chroma = heif_chroma_444;
-  /* TODO: in the future, we might support RGB and mono as intermediate formats
-  heif_chroma tile_chroma = m_heif_file->get_image_chroma_from_configuration(some_tile_id);
-  if (tile_chroma != heif_chroma_monochrome) {
-    tile_chroma = heif_chroma_RGB;
+  auto iter = m_all_images.find(ID);
+  if (iter == m_all_images.end()) {
+    return Error(heif_error_Usage_error, heif_suberror_Nonexisting_item_referenced);
   }
-  */
 
-  // --- generate image of full output size
+  std::shared_ptr<Image> alpha_image = iter->second->get_alpha_channel();
+  if (!alpha_image) {
+    return Error(heif_error_Usage_error, heif_suberror_Nonexisting_image_channel_referenced,
+                 "Image has no alpha channel");
+  }
 
-  if (w >= m_maximum_image_width_limit || h >= m_maximum_image_height_limit) {
-    std::stringstream sstr;
-    sstr << "Image size " << w << "x" << h << " exceeds the maximum image size "
-         << m_maximum_image_width_limit << "x" << m_maximum_image_height_limit << "\n";
+  std::shared_ptr<HeifPixelImage> alpha;
+  Error err = decode_image_planar(alpha_image->get_id(), alpha, heif_colorspace_undefined, options, true);
+  if (err) {
+    return err;
+  }
 
-    return Error(heif_error_Memory_allocation_error,
-                 heif_suberror_Security_limit_exceeded,
-                 sstr.str());
+  heif_channel channel;
+  switch (alpha->get_colorspace()) {
+    case heif_colorspace_YCbCr:
+    case heif_colorspace_monochrome:
+      channel = heif_channel_Y;
+      break;
+    case heif_colorspace_RGB:
+      channel = heif_channel_R;
+      break;
+    default:
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Unsupported_color_conversion);
+  }
+
+  if (alpha->get_colorspace() == heif_colorspace_monochrome) {
+    img = alpha;
+    return Error::Ok;
   }
 
+  // drop the (constant) chroma planes that the alpha image was coded with
 
   img = std::make_shared<HeifPixelImage>();
-  img->create(w, h,
-              heif_colorspace_RGB,
-              heif_chroma_444);
+  img->create(alpha->get_width(channel), alpha->get_height(channel),
+              heif_colorspace_monochrome, heif_chroma_monochrome);
+  img->transfer_plane_from_image_as(alpha, channel, heif_channel_Y);
 
-  int bpp = 0;
+  return Error::Ok;
+}
 
-  if (pixi) {
-    if (pixi->get_num_channels() < 1) {
-      return Error(heif_error_Invalid_input,
-                   heif_suberror_Invalid_pixi_box,
-                   "No pixi information for luma channel.");
-    }
 
-    bpp = pixi->get_bits_per_channel(0);
+Error HeifContext::decode_images_user(const std::vector<heif_item_id>& IDs,
+                                      heif_colorspace out_colorspace,
+                                      heif_chroma out_chroma,
+                                      const struct heif_decoding_options& options,
+                                      const std::function<void(size_t idx, const Error& err,
+                                                               const std::shared_ptr<HeifPixelImage>& img)>& image_decoded) const
+{
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
 
-    if (tile_chroma != heif_chroma_monochrome) {
+  // Each image is decoded by one task, which submits its tiles and alpha image to the same pool.
+  // Limit the number of images in flight to the number of threads, such that not all images
+  // are held in memory at the same time.
+  TaskGroup image_tasks(thread_pool.get());
+  if (thread_pool) {
+    image_tasks.set_max_concurrent_tasks(thread_pool->get_num_threads());
+  }
 
-      // there are broken files that save only a one-channel pixi for an RGB image (issue #283)
-      if (pixi->get_num_channels() == 3) {
+  if (options.version >= 18 && options.priority != heif_decoding_priority_automatic) {
+    image_tasks.set_priority(get_decoding_priority(0, options));
+  }
 
-        int bpp_c1 = pixi->get_bits_per_channel(1);
-        int bpp_c2 = pixi->get_bits_per_channel(2);
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::mutex callback_mutex;
+#endif
+  Error first_error = Error::Ok;
+
+  for (size_t i = 0; i < IDs.size(); i++) {
+    image_tasks.run([&, i]() {
+      std::shared_ptr<HeifPixelImage> img;
+      Error err = check_canceled(options);
+      if (!err) {
+        err = decode_image_user(IDs[i], img, out_colorspace, out_chroma, options);
+      }
 
-        if (bpp_c1 != bpp || bpp_c2 != bpp) {
-          // TODO: is this really an error? Does the pixi depths refer to RGB or YCbCr?
-          return Error(heif_error_Invalid_input,
-                       heif_suberror_Invalid_pixi_box,
-                       "Different number of bits per pixel in each channel.");
-        }
+#if ENABLE_MULTITHREADING_SUPPORT
+      std::lock_guard<std::mutex> lock(callback_mutex);
+#endif
+      if (err && !first_error) {
+        first_error = err;
       }
-    }
+
+      image_decoded(i, err, img);
+
+      // Failed images are reported through the callback. They do not stop the other images.
+      return Error::Ok;
+    });
   }
-  else {
-    // When there is no pixi-box, get the pixel-depth from one of the tile images
 
-    heif_item_id tileID = image_references[0];
+  image_tasks.wait();
 
-    auto iter = m_all_images.find(tileID);
-    if (iter == m_all_images.end()) {
-      return Error(heif_error_Invalid_input,
-                   heif_suberror_Missing_grid_images,
-                   "Nonexistent grid image referenced");
-    }
+  return first_error;
+}
 
-    const std::shared_ptr<Image> tileImg = iter->second;
-    bpp = tileImg->get_luma_bits_per_pixel();
-  }
 
-  if (bpp < 8 || bpp > 16) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_Invalid_pixi_box,
-                 "Invalid bits per pixel in pixi box.");
-  }
+void HeifContext::decode_image_async(heif_item_id ID,
+                                     heif_colorspace out_colorspace,
+                                     heif_chroma out_chroma,
+                                     const struct heif_decoding_options& options,
+                                     std::function<void(const Error& err,
+                                                        const std::shared_ptr<HeifPixelImage>& img)> image_decoded) const
+{
+  // The options are copied, such that the caller does not have to keep them alive.
+  auto task = [this, ID, out_colorspace, out_chroma, options, image_decoded]() {
+    std::shared_ptr<HeifPixelImage> img;
+    Error err = check_canceled(options);
+    if (!err) {
+      err = decode_image_user(ID, img, out_colorspace, out_chroma, options);
+    }
 
-  if (tile_chroma == heif_chroma_monochrome) {
-    img->add_plane(heif_channel_Y, w, h, bpp);
+    image_decoded(err, img);
+  };
+
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+  if (thread_pool) {
+    thread_pool->run_detached(get_decoding_priority(ID, options), std::move(task));
   }
   else {
-    img->add_plane(heif_channel_R, w, h, bpp);
-    img->add_plane(heif_channel_G, w, h, bpp);
-    img->add_plane(heif_channel_B, w, h, bpp);
+    task();
   }
+}
 
-  int y0 = 0;
-  int reference_idx = 0;
 
-#if ENABLE_PARALLEL_TILE_DECODING
-  // remember which tile to put where into the image
-  struct tile_data {
-    heif_item_id tileID;
-    int x_origin,y_origin;
-  };
+// Height of the bands in which images that are not grids are delivered by decode_image_in_bands().
+static const int kDecodingBandHeight = 64;
 
-  std::deque<tile_data> tiles;
-  if (m_max_decoding_threads > 0)
-    tiles.resize(grid.get_rows() * grid.get_columns() );
 
-  std::deque<std::future<Error> > errs;
-#endif
+Error HeifContext::decode_image_in_bands(heif_item_id ID,
+                                         heif_colorspace out_colorspace,
+                                         heif_chroma out_chroma,
+                                         const struct heif_decoding_options& options,
+                                         const std::function<Error(const std::shared_ptr<HeifPixelImage>& band, int y)>& band_decoded) const
+{
+  ScopedTaskPriority priority(get_decoding_priority(ID, options));
 
-  for (int y = 0; y < grid.get_rows(); y++) {
-    int x0 = 0;
-    int tile_height = 0;
+  auto iter = m_all_images.find(ID);
+  if (iter == m_all_images.end()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
 
-    for (int x = 0; x < grid.get_columns(); x++) {
+  const std::shared_ptr<Image>& image = iter->second;
+  const Cancellation* cancellation = Cancellation::get(options);
 
-      heif_item_id tileID = image_references[reference_idx];
+  // --- images without tiles are decoded at once
 
-      auto iter = m_all_images.find(tileID);
-      if (iter == m_all_images.end()) {
-        return Error(heif_error_Invalid_input,
-                     heif_suberror_Missing_grid_images,
-                     "Nonexistent grid image referenced");
-      }
+  if (m_heif_file->get_item_type(ID) != "grid") {
+    std::shared_ptr<HeifPixelImage> img;
+    Error err = decode_image_user(ID, img, out_colorspace, out_chroma, options);
+    if (err) {
+      return err;
+    }
 
-      const std::shared_ptr<Image> tileImg = iter->second;
-      int src_width = tileImg->get_width();
-      int src_height = tileImg->get_height();
+    for (int y = 0; y < img->get_height(); y += kDecodingBandHeight) {
+      int band_height = std::min(kDecodingBandHeight, img->get_height() - y);
 
-#if ENABLE_PARALLEL_TILE_DECODING
-      if ( m_max_decoding_threads > 0)
-         tiles[x+y*grid.get_columns()] = tile_data { tileID, x0,y0 };
-      else
-#else
-      if (1)
-#endif
-      {
-        Error err = decode_and_paste_tile_image(tileID, img, x0, y0, options);
-        if (err) {
-          return err;
-        }
+      std::shared_ptr<HeifPixelImage> band = img->create_view(0, y, img->get_width(), band_height);
+      if (!band) {
+        return Error(heif_error_Memory_allocation_error, heif_suberror_Unspecified);
       }
 
-      x0 += src_width;
-      tile_height = src_height; // TODO: check that all tiles have the same height
+      err = band_decoded(band, y);
+      if (err) {
+        return err;
+      }
+    }
 
-      reference_idx++;
-    }
+    return Error::Ok;
+  }
 
-    y0 += tile_height;
+  // --- grid images are decoded band by band
+
+  GridLayout layout;
+  Error err = get_grid_layout(ID, layout);
+  if (err) {
+    return err;
   }
 
-#if ENABLE_PARALLEL_TILE_DECODING
-  if (m_max_decoding_threads > 0) {
-    // Process all tiles in a set of background threads.
-    // Do not start more than the maximum number of threads.
+  int width = options.ignore_transformations ? image->get_ispe_width() : image->get_width();
+  int height = options.ignore_transformations ? image->get_ispe_height() : image->get_height();
 
-    while (tiles.empty()==false) {
+  // The range of tile columns and rows that is needed for an output row. With a rotation by 90 degrees,
+  // a band covers a tile column of the coded image instead of a tile row.
+  typedef std::array<uint32_t, 4> TileSpan;
 
-      // If maximum number of threads running, wait until first thread finishes
+  auto get_tile_span = [&](int y, TileSpan& span) -> Error {
+    ImageRegion coded_region{};
+    Error span_err = get_coded_image_region(ID, ImageRegion{0, y, width, 1}, options.ignore_transformations != 0,
+                                            coded_region);
+    if (span_err) {
+      return span_err;
+    }
 
-      if (errs.size() >= (size_t)m_max_decoding_threads) {
-        Error e = errs.front().get();
-        if (e) {
-          return e;
-        }
+    span = {static_cast<uint32_t>(coded_region.x) / layout.tile_width,
+            static_cast<uint32_t>(coded_region.x + coded_region.width - 1) / layout.tile_width,
+            static_cast<uint32_t>(coded_region.y) / layout.tile_height,
+            static_cast<uint32_t>(coded_region.y + coded_region.height - 1) / layout.tile_height};
+    return Error::Ok;
+  };
+
+  int band_y = 0;
+  TileSpan band_span{};
+  err = get_tile_span(band_y, band_span);
+  if (err) {
+    return err;
+  }
 
-        errs.pop_front();
+  for (int y = 1; y <= height; y++) {
+    TileSpan row_span{};
+    if (y < height) {
+      err = get_tile_span(y, row_span);
+      if (err) {
+        return err;
       }
 
+      if (row_span == band_span) {
+        continue;
+      }
+    }
 
-      // Start a new decoding thread
+    if (cancellation) {
+      err = cancellation->check();
+      if (err) {
+        return err;
+      }
+    }
 
-      tile_data data = tiles.front();
-      tiles.pop_front();
+    // The bands are not cached, because they are only needed once.
+    ImageRegion region{0, band_y, width, y - band_y};
 
-      errs.push_back( std::async(std::launch::async,
-                                 &HeifContext::decode_and_paste_tile_image, this,
-                                 data.tileID, img, data.x_origin,data.y_origin, options) );
+    err = check_memory_budget(ID, out_chroma, options, &region);
+    if (err) {
+      return err;
     }
 
-    // check for decoding errors in remaining tiles
+    std::shared_ptr<HeifPixelImage> band;
+    err = decode_image_planar(ID, band, out_colorspace, options, false, &region, out_chroma);
+    if (err) {
+      return err;
+    }
 
-    while (errs.empty() == false) {
-      Error e = errs.front().get();
-      if (e) {
-        return e;
-      }
+    std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+    err = convert_to_output_format(band, out_colorspace, out_chroma, options, thread_pool.get());
+    if (err) {
+      return err;
+    }
 
-      errs.pop_front();
+    err = band_decoded(band, band_y);
+    if (err) {
+      return err;
     }
+
+    band_y = y;
+    band_span = row_span;
   }
-#endif
 
   return Error::Ok;
 }
 
 
-Error HeifContext::decode_and_paste_tile_image(heif_item_id tileID,
-                                               const std::shared_ptr<HeifPixelImage>& img,
-                                               int x0, int y0,
-                                               const heif_decoding_options& options) const
+Error HeifContext::get_grid_layout(heif_item_id ID, GridLayout& layout) const
 {
-  std::shared_ptr<HeifPixelImage> tile_img;
+  if (m_heif_file->get_item_type(ID) != "grid") {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unsupported_image_type,
+                 "Image is no grid image");
+  }
 
-  Error err = decode_image_planar(tileID, tile_img, img->get_colorspace(), options, false);
-  if (err != Error::Ok) {
+  std::vector<uint8_t> grid_data;
+  Error err = m_heif_file->get_compressed_image_data(ID, &grid_data);
+  if (err) {
     return err;
   }
 
-  const int w = img->get_width();
-  const int h = img->get_height();
+  ImageGrid grid;
+  err = grid.parse(grid_data);
+  if (err) {
+    return err;
+  }
 
+  auto iref_box = m_heif_file->get_iref_box();
+  if (!iref_box) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_iref_box,
+                 "No iref box available, but needed for grid image");
+  }
 
-  // --- copy tile into output image
+  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+  if ((int) image_references.size() != grid.get_rows() * grid.get_columns()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Missing_grid_images);
+  }
 
-  int src_width = tile_img->get_width();
-  int src_height = tile_img->get_height();
-  assert(src_width >= 0);
-  assert(src_height >= 0);
+  // all tiles have the same size, take it from the first one
+  auto iter = m_all_images.find(image_references[0]);
+  if (iter == m_all_images.end()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Missing_grid_images,
+                 "Nonexistent grid image referenced");
+  }
 
-  heif_chroma chroma = img->get_chroma_format();
+  layout.columns = grid.get_columns();
+  layout.rows = grid.get_rows();
+  layout.tile_width = iter->second->get_width();
+  layout.tile_height = iter->second->get_height();
+  layout.image_width = grid.get_width();
+  layout.image_height = grid.get_height();
 
-  if (chroma != tile_img->get_chroma_format()) {
+  if (layout.tile_width == 0 || layout.tile_height == 0) {
     return Error(heif_error_Invalid_input,
-                 heif_suberror_Wrong_tile_image_chroma_format,
-                 "Image tile has different chroma format than combined image");
+                 heif_suberror_Invalid_grid_data,
+                 "Grid tiles have no size");
   }
 
-  // --- add alpha plane if we discovered a tile with alpha
+  return Error::Ok;
+}
 
-  if (tile_img->has_alpha() && !img->has_alpha()) {
-#if ENABLE_PARALLEL_TILE_DECODING
-    // The mutex should probably be a member of heif_context, but since this is so infrequently locked, it probably doesn't matter.
-    static std::mutex m;
-    std::lock_guard<std::mutex> lock(m);
-    if (!img->has_channel(heif_channel_Alpha))	// check again, after locking
-#endif
-    {
-      int alpha_bpp = tile_img->get_bits_per_pixel(heif_channel_Alpha);
 
-      assert(alpha_bpp <= 16);
+Error HeifContext::get_file_ranges_for_decoding(heif_item_id ID,
+                                                const struct heif_decoding_options& options,
+                                                const ImageRegion* region,
+                                                std::vector<FileRange>& ranges) const
+{
+  std::vector<FileRange> item_ranges;
+  Error err = append_file_ranges_for_decoding(ID, options, region, item_ranges);
+  if (err) {
+    return err;
+  }
 
-      uint16_t alpha_default_value = static_cast<uint16_t>((1UL << alpha_bpp) - 1UL);
+  std::sort(item_ranges.begin(), item_ranges.end(),
+            [](const FileRange& a, const FileRange& b) { return a.offset < b.offset; });
 
-      img->fill_new_plane(heif_channel_Alpha, alpha_default_value, w, h, alpha_bpp);
+  ranges.clear();
+  for (const auto& range : item_ranges) {
+    if (range.size == 0) {
+      continue;
+    }
+
+    if (!ranges.empty() && range.offset <= ranges.back().offset + ranges.back().size) {
+      uint64_t end = std::max(ranges.back().offset + ranges.back().size, range.offset + range.size);
+      ranges.back().size = end - ranges.back().offset;
+    }
+    else {
+      ranges.push_back(range);
     }
   }
 
-  std::set<enum heif_channel> channels = tile_img->get_channel_set();
+  return Error::Ok;
+}
+
+
+Error HeifContext::append_file_ranges_for_decoding(heif_item_id ID,
+                                                   const struct heif_decoding_options& options,
+                                                   const ImageRegion* region,
+                                                   std::vector<FileRange>& ranges) const
+{
+  if (!is_image(ID)) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
+
+  // --- the item's own data (coded image, grid or overlay description)
 
-  for (heif_channel channel : channels) {
+  Error err = m_heif_file->append_item_file_ranges(ID, ranges);
+  if (err) {
+    return err;
+  }
 
-    int tile_stride;
-    uint8_t* tile_data = tile_img->get_plane(channel, &tile_stride);
 
-    int out_stride;
-    uint8_t* out_data = img->get_plane(channel, &out_stride);
+  // --- the images it is derived from
 
-    if (w <= x0 || h <= y0) {
-      return Error(heif_error_Invalid_input,
-                   heif_suberror_Invalid_grid_data);
-    }
+  std::string image_type = m_heif_file->get_item_type(ID);
 
-    if (img->get_bits_per_pixel(channel) != tile_img->get_bits_per_pixel(channel)) {
+  if (image_type == "grid" || image_type == "iden" || image_type == "iovl") {
+    auto iref_box = m_heif_file->get_iref_box();
+    if (!iref_box) {
       return Error(heif_error_Invalid_input,
-                   heif_suberror_Wrong_tile_image_pixel_depth);
+                   heif_suberror_No_iref_box,
+                   "No iref box available, but needed for derived image");
     }
 
-    int copy_width = std::min(src_width, w - x0);
-    int copy_height = std::min(src_height, h - y0);
+    std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
 
-    copy_width *= tile_img->get_storage_bits_per_pixel(heif_channel_R) / 8;
+    if (image_type == "grid") {
+      GridLayout layout;
+      err = get_grid_layout(ID, layout);
+      if (err) {
+        return err;
+      }
 
-    int xs = x0, ys = y0;
-    xs *= tile_img->get_storage_bits_per_pixel(heif_channel_R) / 8;
+      // area of the grid that is decoded, in coded image coordinates
+      ImageRegion coded_region{0, 0, static_cast<int>(layout.image_width), static_cast<int>(layout.image_height)};
+      if (region) {
+        err = get_coded_image_region(ID, *region, options.ignore_transformations, coded_region);
+        if (err) {
+          return err;
+        }
+      }
 
-    for (int py = 0; py < copy_height; py++) {
-      memcpy(out_data + xs + (ys + py) * out_stride,
-             tile_data + py * tile_stride,
-             copy_width);
+      for (uint32_t row = 0; row < layout.rows; row++) {
+        for (uint32_t column = 0; column < layout.columns; column++) {
+          int64_t x0 = int64_t{column} * layout.tile_width;
+          int64_t y0 = int64_t{row} * layout.tile_height;
+
+          if (x0 < coded_region.x + coded_region.width && x0 + layout.tile_width > coded_region.x &&
+              y0 < coded_region.y + coded_region.height && y0 + layout.tile_height > coded_region.y) {
+            err = append_file_ranges_for_decoding(image_references[row * layout.columns + column],
+                                                  options, nullptr, ranges);
+            if (err) {
+              return err;
+            }
+          }
+        }
+      }
+    }
+    else {
+      for (heif_item_id ref : image_references) {
+        err = append_file_ranges_for_decoding(ref, options, nullptr, ranges);
+        if (err) {
+          return err;
+        }
+      }
+    }
+  }
+
+
+  // --- alpha channel (decoded with the same region)
+
+  auto iter = m_all_images.find(ID);
+  if (iter != m_all_images.end()) {
+    std::shared_ptr<Image> alpha_image = iter->second->get_alpha_channel();
+    if (alpha_image) {
+      err = append_file_ranges_for_decoding(alpha_image->get_id(), options, region, ranges);
+      if (err) {
+        return err;
+      }
     }
   }
 
@@ -1855,306 +2688,4108 @@ Error HeifContext::decode_and_paste_tile_image(heif_item_id tileID,
 }
 
 
-Error HeifContext::decode_derived_image(heif_item_id ID,
-                                        std::shared_ptr<HeifPixelImage>& img,
-                                        const heif_decoding_options& options) const
+Error HeifContext::decode_grid_tile(heif_item_id ID, uint32_t column, uint32_t row,
+                                    std::shared_ptr<HeifPixelImage>& img,
+                                    heif_colorspace out_colorspace,
+                                    heif_chroma out_chroma,
+                                    const struct heif_decoding_options& options) const
 {
-  // find the ID of the image this image is derived from
+  ScopedTaskPriority priority(get_decoding_priority(ID, options));
+
+  GridLayout layout;
+  Error err = get_grid_layout(ID, layout);
+  if (err) {
+    return err;
+  }
+
+  if (column >= layout.columns || row >= layout.rows) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 "Grid tile index out of range");
+  }
+
+
+  // --- the area of the grid covered by this tile (cropped at the image border)
+
+  uint64_t x0 = uint64_t{column} * layout.tile_width;
+  uint64_t y0 = uint64_t{row} * layout.tile_height;
+
+  if (x0 >= layout.image_width || y0 >= layout.image_height) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_grid_data,
+                 "Grid tile lies outside of the image");
+  }
+
+  ImageRegion tile_region;
+  tile_region.x = static_cast<int>(x0);
+  tile_region.y = static_cast<int>(y0);
+  tile_region.width = static_cast<int>(std::min(uint64_t{layout.tile_width}, layout.image_width - x0));
+  tile_region.height = static_cast<int>(std::min(uint64_t{layout.tile_height}, layout.image_height - y0));
+
+
+  // --- decode the tile
+
+  std::vector<uint8_t> grid_data;
+  err = m_heif_file->get_compressed_image_data(ID, &grid_data);
+  if (err) {
+    return err;
+  }
+
+  err = decode_full_grid_image(ID, img, grid_data, options, &tile_region);
+  if (err) {
+    return err;
+  }
+
+
+  // --- add the respective area of the alpha channel
+
+  auto imginfo_iter = m_all_images.find(ID);
+  if (imginfo_iter != m_all_images.end()) {
+    const auto& imginfo = imginfo_iter->second;
+
+    std::shared_ptr<Image> alpha_image = imginfo->get_alpha_channel();
+    if (alpha_image) {
+      // The tile region is given in coordinates of the untransformed image.
+      heif_decoding_options alpha_options = options;
+      alpha_options.ignore_transformations = true;
+
+      std::shared_ptr<HeifPixelImage> alpha;
+      err = decode_image_planar(alpha_image->get_id(), alpha,
+                                heif_colorspace_undefined, alpha_options, true, &tile_region);
+      if (err) {
+        return err;
+      }
+
+      err = attach_alpha_plane(img, alpha, imginfo->is_premultiplied_alpha());
+      if (err) {
+        return err;
+      }
+    }
+  }
+
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+  return convert_to_output_format(img, out_colorspace, out_chroma, options, thread_pool.get());
+}
+
+
+Error HeifContext::decode_image_planar(heif_item_id ID,
+                                       std::shared_ptr<HeifPixelImage>& img,
+                                       heif_colorspace out_colorspace,
+                                       const struct heif_decoding_options& options, bool alphaImage,
+                                       const ImageRegion* region,
+                                       heif_chroma preferred_chroma,
+                                       const ImageSize* scaled_size) const
+{
+  // also checked before the tiles, alpha images and overlay images, which are decoded with this function
+  Error cancel_err = check_canceled(options);
+  if (cancel_err) {
+    return cancel_err;
+  }
+
+  std::string image_type = m_heif_file->get_item_type(ID);
+
+  std::shared_ptr<Image> imginfo;
+  if (m_all_images.find(ID) != m_all_images.end()) {
+    imginfo = m_all_images.find(ID)->second;
+  }
+
+  assert(imginfo);
+
+  Error error;
+
+
+  // --- when decoding only a region, find the corresponding area in the coded image
+
+  ImageRegion coded_region{};
+  if (region) {
+    error = get_coded_image_region(ID, *region, options.ignore_transformations, coded_region);
+    if (error) {
+      return error;
+    }
+  }
+
+  // set when the decoder already restricted its output to 'coded_region'
+  bool decoded_region_only = false;
+
+
+  // --- start decoding the alpha image, it is decoded concurrently with the color image
+
+  // TODO: this is probably wrong. When we have a tiled image with alpha
+  // channel, then the alpha images should be associated with their respective tiles.
+  // However, the tile images are not part of the m_all_images list.
+  // Fix this, when we have a test image available.
+  std::shared_ptr<Image> alpha_image = imginfo->get_alpha_channel();
+  std::shared_ptr<HeifPixelImage> alpha;
+
+  heif_decoding_options color_options = options;
+  heif_decoding_options alpha_options = options;
+
+  // the progress is reported for the color image only
+  alpha_options.start_progress = nullptr;
+  alpha_options.on_progress = nullptr;
+  alpha_options.end_progress = nullptr;
+  alpha_options.on_tile_decoded = nullptr;
+
+  if (alpha_image) {
+    // Split the decoder threads between both images. Grid tiles are already decoded
+    // concurrently and get their own share of the threads.
+    heif_decoding_options concurrent_options = get_concurrent_decoding_options(options, 2);
+
+    if (image_type != "grid") {
+      color_options.decoder_threads = concurrent_options.decoder_threads;
+    }
+
+    if (m_heif_file->get_item_type(alpha_image->get_id()) != "grid") {
+      alpha_options.decoder_threads = concurrent_options.decoder_threads;
+    }
+  }
+
+  TaskGroup alpha_task(get_thread_pool().get());
+
+  // The alpha image is less urgent than the color image. The alpha image of a thumbnail keeps its priority.
+  if (alpha_task.get_priority() == TaskPriority::Visible) {
+    alpha_task.set_priority(TaskPriority::Alpha);
+  }
+
+  if (alpha_image) {
+    alpha_task.run([this, &alpha_image, &alpha, &alpha_options, region, scaled_size]() {
+      return decode_image_planar(alpha_image->get_id(), alpha,
+                                 heif_colorspace_undefined, alpha_options, true, region,
+                                 heif_chroma_undefined, scaled_size);
+    });
+  }
+
+
+  // --- decode image, depending on its type
+
+  if (image_type == "hvc1" ||
+      image_type == "av01" ||
+      image_type == "jpeg") {
+
+    heif_compression_format compression = heif_compression_undefined;
+    if (image_type == "hvc1") {
+      compression = heif_compression_HEVC;
+    }
+    else if (image_type == "av01") {
+      compression = heif_compression_AV1;
+    }
+    else if (image_type == "jpeg") {
+      compression = heif_compression_JPEG;
+    }
+
+    error = decode_coded_image(ID, compression, img, color_options);
+    if (error) {
+      return error;
+    }
+
+    // scale before the color conversion, such that only the reduced image is converted
+    if (scaled_size) {
+      error = scale_image_to(img, scaled_size->width, scaled_size->height, options.target_scaling_filter);
+      if (error) {
+        return error;
+      }
+    }
+
+    if (alphaImage) {
+      // no color conversion required
+    }
+    else {
+      heif_colorspace target_colorspace = (out_colorspace == heif_colorspace_undefined ?
+                                           img->get_colorspace() :
+                                           out_colorspace);
+
+      if (!alphaImage && target_colorspace == heif_colorspace_YCbCr) {
+        target_colorspace = heif_colorspace_RGB;
+      }
+
+      heif_chroma target_chroma = (target_colorspace == heif_colorspace_monochrome ?
+                                   heif_chroma_monochrome : heif_chroma_444);
+
+      bool different_chroma = (target_chroma != img->get_chroma_format());
+      bool different_colorspace = (target_colorspace != img->get_colorspace());
+
+      if (different_chroma || different_colorspace) {
+        TraceScope conversion_trace(m_tracer, heif_trace_stage_color_conversion, ID);
+        conversion_trace.set_input_image(img.get());
+
+        img = convert_colorspace(img, target_colorspace, target_chroma, nullptr, 0, options.color_conversion_options);
+        if (!img) {
+          return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+        }
+
+        conversion_trace.set_output_image(img.get());
+      }
+    }
+  }
+  else if (image_type == "grid") {
+    std::vector<uint8_t> data;
+    error = m_heif_file->get_compressed_image_data(ID, &data);
+    if (error) {
+      return error;
+    }
+
+    if (scaled_size) {
+      error = decode_scaled_grid_image(ID, img, data, options, *scaled_size);
+    }
+    else {
+      heif_chroma canvas_chroma = (out_colorspace == heif_colorspace_RGB ||
+                                   out_colorspace == heif_colorspace_undefined) ? preferred_chroma : heif_chroma_undefined;
+
+      error = decode_full_grid_image(ID, img, data, options, region ? &coded_region : nullptr, canvas_chroma);
+    }
+
+    if (error) {
+      return error;
+    }
+
+    decoded_region_only = (region != nullptr);
+  }
+  else if (image_type == "iden") {
+    error = decode_derived_image(ID, img, options);
+    if (error) {
+      return error;
+    }
+  }
+  else if (image_type == "iovl") {
+    std::vector<uint8_t> data;
+    error = m_heif_file->get_compressed_image_data(ID, &data);
+    if (error) {
+      return error;
+    }
+
+    error = decode_overlay_image(ID, img, data, options);
+    if (error) {
+      return error;
+    }
+#if WITH_UNCOMPRESSED_CODEC
+  } else if (image_type == "unci") {
+    // An interleaved image cannot get an alpha plane attached or be rotated and mirrored.
+    bool has_rotation_or_mirroring = false;
+    if (!options.ignore_transformations) {
+      auto ipco_box = m_heif_file->get_ipco_box();
+      auto ipma_box = m_heif_file->get_ipma_box();
+      has_rotation_or_mirroring = (ipco_box->get_property_for_item_ID(ID, ipma_box, fourcc("irot")) ||
+                                   ipco_box->get_property_for_item_ID(ID, ipma_box, fourcc("imir")));
+    }
+
+    if (alpha_image || has_rotation_or_mirroring) {
+      preferred_chroma = heif_chroma_undefined;
+    }
+
+    TraceScope decode_trace(m_tracer, heif_trace_stage_decode, ID);
+
+    error = UncompressedImageCodec::decode_uncompressed_image(m_heif_file,
+                                                              ID,
+                                                              img,
+                                                              m_maximum_image_width_limit,
+                                                              m_maximum_image_height_limit,
+                                                              preferred_chroma,
+                                                              region ? &coded_region : nullptr,
+                                                              options.decoder_threads == 1 ? nullptr : get_thread_pool().get());
+    if (error) {
+      return error;
+    }
+
+    decoded_region_only = (region != nullptr);
+
+    error = adopt_decoded_image(img);
+    if (error) {
+      return error;
+    }
+
+    decode_trace.set_output_image(img.get());
+#endif
+  }
+  else {
+    // Should not reach this, was already rejected by "get_image_data".
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_image_type);
+  }
+
+
+  // --- crop, scale and transform the image (traced as a single stage)
+
+  TraceScope transform_trace(m_tracer, heif_trace_stage_transformations, ID);
+  transform_trace.set_input_image(img.get());
+  const HeifPixelImage* untransformed_img = img.get();
+
+
+  // --- if only a region was requested, but the full image was decoded, crop it now
+
+  if (region && !decoded_region_only) {
+    error = crop_image(img, coded_region.x, coded_region.x + coded_region.width - 1,
+                       coded_region.y, coded_region.y + coded_region.height - 1);
+    if (error) {
+      return error;
+    }
+  }
+
+
+  // --- scale down images that were not decoded at the requested size
+
+  if (scaled_size) {
+    error = scale_image_to(img, scaled_size->width, scaled_size->height, options.target_scaling_filter);
+    if (error) {
+      return error;
+    }
+  }
+
+
+  // --- apply image transformations
+  //     All transformations are combined into a crop of the decoded image, which is done without
+  //     copying the pixels if possible, followed by a rotation and mirroring in a single pass.
+
+  if (options.ignore_transformations == false) {
+    std::vector<std::shared_ptr<Box>> properties;
+    auto ipco_box = m_heif_file->get_ipco_box();
+    auto ipma_box = m_heif_file->get_ipma_box();
+    error = ipco_box->get_properties_for_item_ID(ID, ipma_box, properties);
+
+    // The transformed image is the area (crop_x0,crop_y0)-(crop_x1,crop_y1) of 'img', rotated
+    // counter-clockwise by 'rotation' and then mirrored horizontally if 'mirror' is set.
+    int crop_x0 = 0;
+    int crop_y0 = 0;
+    int crop_x1 = img->get_width() - 1;
+    int crop_y1 = img->get_height() - 1;
+    int rotation = 0;
+    bool mirror = false;
+
+    for (const auto& property : properties) {
+      if (property->get_short_type() == fourcc("irot")) {
+        auto rot = std::dynamic_pointer_cast<Box_irot>(property);
+
+        // a rotation after mirroring turns into the opposite direction
+        rotation = (mirror ? rotation + 360 - rot->get_rotation() : rotation + rot->get_rotation()) % 360;
+      }
+
+
+      if (property->get_short_type() == fourcc("imir")) {
+        auto mirror_box = std::dynamic_pointer_cast<Box_imir>(property);
+
+        // a vertical mirroring is a horizontal mirroring of the image rotated by 180 degrees
+        mirror = !mirror;
+        if (mirror_box->get_mirror_direction() == heif_transform_mirror_direction_vertical) {
+          rotation = (rotation + 180) % 360;
+        }
+      }
+
+
+      // When decoding a region, the clean aperture has already been included in 'coded_region'.
+      if (property->get_short_type() == fourcc("clap") && !region) {
+        auto clap = std::dynamic_pointer_cast<Box_clap>(property);
+
+        const int crop_width = crop_x1 - crop_x0 + 1;
+        const int crop_height = crop_y1 - crop_y0 + 1;
+        const bool swap_axes = (rotation == 90 || rotation == 270);
+
+        int img_width = (swap_axes ? crop_height : crop_width);
+        int img_height = (swap_axes ? crop_width : crop_height);
+        assert(img_width >= 0);
+        assert(img_height >= 0);
+
+        int left = clap->left_rounded(img_width);
+        int right = clap->right_rounded(img_width);
+        int top = clap->top_rounded(img_height);
+        int bottom = clap->bottom_rounded(img_height);
+
+        if (left < 0) { left = 0; }
+        if (top < 0) { top = 0; }
+
+        if (right >= img_width) { right = img_width - 1; }
+        if (bottom >= img_height) { bottom = img_height - 1; }
+
+        if (left > right ||
+            top > bottom) {
+          return Error(heif_error_Invalid_input,
+                       heif_suberror_Invalid_clean_aperture);
+        }
+
+        // map a position in the transformed image into 'img' (see HeifPixelImage::rotate_and_mirror())
+        auto map_to_decoded_image = [&](int x, int y, int& out_x, int& out_y) {
+          if (mirror) {
+            x = img_width - 1 - x;
+          }
+
+          out_x = x;
+          out_y = y;
+          if (rotation == 90) {
+            out_x = crop_width - 1 - y;
+            out_y = x;
+          }
+          else if (rotation == 180) {
+            out_x = crop_width - 1 - x;
+            out_y = crop_height - 1 - y;
+          }
+          else if (rotation == 270) {
+            out_x = y;
+            out_y = crop_height - 1 - x;
+          }
+
+          out_x += crop_x0;
+          out_y += crop_y0;
+        };
+
+        int x0, y0, x1, y1;
+        map_to_decoded_image(left, top, x0, y0);
+        map_to_decoded_image(right, bottom, x1, y1);
+
+        crop_x0 = std::min(x0, x1);
+        crop_y0 = std::min(y0, y1);
+        crop_x1 = std::max(x0, x1);
+        crop_y1 = std::max(y0, y1);
+      }
+    }
+
+    error = crop_image(img, crop_x0, crop_x1, crop_y0, crop_y1);
+    if (error) {
+      return error;
+    }
+
+    if (rotation != 0 || mirror) {
+      std::shared_ptr<HeifPixelImage> transformed_img;
+      error = img->rotate_and_mirror(rotation, mirror, transformed_img, get_thread_pool().get());
+      if (error) {
+        return error;
+      }
+
+      img = transformed_img;
+    }
+  }
+
+  if (img.get() != untransformed_img) {
+    transform_trace.set_output_image(img.get());
+    transform_trace.end();
+  }
+  else {
+    transform_trace.cancel();
+  }
+
+
+  // --- add alpha channel, if available
+
+  if (alpha_image) {
+    Error err = alpha_task.wait();
+    if (err) {
+      return err;
+    }
+
+    err = attach_alpha_plane(img, alpha, imginfo->is_premultiplied_alpha());
+    if (err) {
+      return err;
+    }
+  }
+
+
+  // --- attach metadata to image
+
+  {
+    auto ipco_box = m_heif_file->get_ipco_box();
+    auto ipma_box = m_heif_file->get_ipma_box();
+
+    // CLLI
+
+    auto clli_box = ipco_box->get_property_for_item_ID(ID, ipma_box, fourcc("clli"));
+    auto clli = std::dynamic_pointer_cast<Box_clli>(clli_box);
+
+    if (clli) {
+      img->set_clli(clli->clli);
+    }
+
+    // MDCV
+
+    auto mdcv_box = ipco_box->get_property_for_item_ID(ID, ipma_box, fourcc("mdcv"));
+    auto mdcv = std::dynamic_pointer_cast<Box_mdcv>(mdcv_box);
+
+    if (mdcv) {
+      img->set_mdcv(mdcv->mdcv);
+    }
+
+    // PASP
+
+    auto pasp_box = ipco_box->get_property_for_item_ID(ID, ipma_box, fourcc("pasp"));
+    auto pasp = std::dynamic_pointer_cast<Box_pasp>(pasp_box);
+
+    if (pasp) {
+      img->set_pixel_ratio(pasp->hSpacing, pasp->vSpacing);
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::convert_sequence_frame(std::shared_ptr<HeifPixelImage>& img, const Track& track,
+                                          heif_colorspace out_colorspace, heif_chroma out_chroma,
+                                          const heif_decoding_options& options) const
+{
+  Error err = adopt_decoded_image(img);
+  if (err) {
+    return err;
+  }
+
+  // Like for images, a color profile of the track overrides the profile in the bitstream.
+  for (const auto& box : track.get_sample_entry()->get_child_boxes(fourcc("colr"))) {
+    auto colr = std::dynamic_pointer_cast<Box_colr>(box);
+    if (!colr) {
+      continue;
+    }
+
+    auto profile = colr->get_color_profile();
+    if (auto nclx = std::dynamic_pointer_cast<const color_profile_nclx>(profile)) {
+      img->set_color_profile_nclx(nclx);
+    }
+    else if (auto icc = std::dynamic_pointer_cast<const color_profile_raw>(profile)) {
+      img->set_color_profile_icc(icc);
+    }
+  }
+
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+  return convert_to_output_format(img, out_colorspace, out_chroma, options, thread_pool.get());
+}
+
+
+Error HeifContext::set_decoder_options(const struct heif_decoder_plugin* decoder_plugin, void* decoder,
+                                       const heif_decoding_options& options) const
+{
+  if (decoder_plugin->plugin_api_version >= 2) {
+    if (decoder_plugin->set_strict_decoding) {
+      decoder_plugin->set_strict_decoding(decoder, options.strict_decoding);
+    }
+  }
+
+  if (decoder_plugin->plugin_api_version >= 5 && decoder_plugin->set_parameter_integer) {
+    // Images that are decoded concurrently get their share of the threads through
+    // get_concurrent_decoding_options(). A single image may use all decoding threads.
+    int num_threads = (options.decoder_threads > 0 ? options.decoder_threads : std::max(get_max_decoding_threads(), 1));
+
+    struct heif_error err = decoder_plugin->set_parameter_integer(decoder, heif_decoder_parameter_name_threads, num_threads);
+    if (err.code != heif_error_Ok && err.subcode != heif_suberror_Unsupported_parameter) {
+      return Error(err.code, err.subcode, err.message);
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::decode_coded_image(heif_item_id ID, heif_compression_format compression,
+                                      std::shared_ptr<HeifPixelImage>& img,
+                                      const heif_decoding_options& options,
+                                      const std::shared_ptr<HeifPixelImage>& target_area) const
+{
+  const struct heif_decoder_plugin* decoder_plugin = get_decoder(compression, options.decoder_id);
+  if (!decoder_plugin) {
+    return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_codec);
+  }
+
+  Error error = decode_coded_image_with_plugin(decoder_plugin, ID, img, options, target_area);
+
+  // A plugin (e.g. a hardware decoder) may reject images that it cannot decode, like unsupported profiles.
+  // Unless a specific decoder was requested, the image is then decoded with the next plugin.
+  while (error.sub_error_code == heif_suberror_Unsupported_codec && options.decoder_id == nullptr) {
+    decoder_plugin = get_fallback_decoder(compression, decoder_plugin);
+    if (!decoder_plugin) {
+      break;
+    }
+
+    error = decode_coded_image_with_plugin(decoder_plugin, ID, img, options, target_area);
+  }
+
+  return error;
+}
+
+
+Error HeifContext::decode_coded_image_with_plugin(const struct heif_decoder_plugin* decoder_plugin,
+                                                  heif_item_id ID,
+                                                  std::shared_ptr<HeifPixelImage>& img,
+                                                  const heif_decoding_options& options,
+                                                  const std::shared_ptr<HeifPixelImage>& target_area) const
+{
+  auto imginfo_iter = m_all_images.find(ID);
+  assert(imginfo_iter != m_all_images.end());
+  const std::shared_ptr<Image>& imginfo = imginfo_iter->second;
+
+  Error error;
+
+  // The codec configuration headers and the bitstream are pushed to the decoder separately.
+  // The headers are shared with all other images using the same configuration (e.g. grid tiles)
+  // and, if the file is held in memory, the bitstream is not copied at all.
+  HeifFile::CodedImageData coded;
+  {
+    TraceScope read_trace(m_tracer, heif_trace_stage_read_data, ID);
+
+    uint64_t layer_prefix_size = 0;
+    if (options.version >= 16 && options.max_decoded_layer >= 0) {
+      layer_prefix_size = get_layer_prefix_size(ID, options.max_decoded_layer);
+    }
+
+    if (layer_prefix_size) {
+      error = m_heif_file->get_compressed_image_data_prefix(ID, layer_prefix_size, &coded.buffer);
+      coded.data = coded.buffer.data();
+      coded.size = coded.buffer.size();
+    }
+    else {
+      error = m_heif_file->get_coded_image_data(ID, coded);
+    }
+
+    if (error) {
+      return error;
+    }
+
+    read_trace.set_data_bytes((coded.headers ? coded.headers->size() : 0) + coded.size);
+  }
+
+  TraceScope decode_trace(m_tracer, heif_trace_stage_decode, ID);
+  decode_trace.set_data_bytes((coded.headers ? coded.headers->size() : 0) + coded.size);
+
+  void* decoder;
+  error = acquire_decoder(decoder_plugin, &decoder);
+  if (error) {
+    return error;
+  }
+
+  error = set_decoder_options(decoder_plugin, decoder, options);
+  if (error) {
+    release_decoder(decoder_plugin, decoder, false);
+    return error;
+  }
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+
+  if (coded.headers && !coded.headers->empty()) {
+    err = decoder_plugin->push_data(decoder, coded.headers->data(), coded.headers->size());
+  }
+
+  if (err.code == heif_error_Ok && coded.size > 0) {
+    err = decoder_plugin->push_data(decoder, coded.data, coded.size);
+  }
+
+  if (err.code != heif_error_Ok) {
+    release_decoder(decoder_plugin, decoder, false);
+    return Error(err.code, err.subcode, err.message);
+  }
+
+  // --- let the decoder write directly into the target image, if possible
+
+  if (target_area &&
+      decoder_plugin->plugin_api_version >= 6 &&
+      decoder_plugin->decode_image_into) {
+    heif_color_profile_nclx* input_nclx = nullptr;
+    if (auto item_nclx = imginfo->get_color_profile_nclx()) {
+      Error nclx_error = item_nclx->get_nclx_color_profile(&input_nclx);
+      if (nclx_error) {
+        release_decoder(decoder_plugin, decoder, false);
+        return nclx_error;
+      }
+    }
+
+    heif_image target_image;
+    target_image.image = target_area;
+
+    err = decoder_plugin->decode_image_into(decoder, &target_image, input_nclx);
+    color_profile_nclx::free_nclx_color_profile(input_nclx);
+
+    if (err.code == heif_error_Ok) {
+      release_decoder(decoder_plugin, decoder, true);
+      img = target_area;
+      return Error::Ok;
+    }
+    else if (err.subcode != heif_suberror_Unsupported_color_conversion) {
+      release_decoder(decoder_plugin, decoder, false);
+      return Error(err.code, err.subcode, err.message);
+    }
+
+    // The decoder cannot output this format. Decode the image normally and let libheif convert it.
+  }
+
+  //std::shared_ptr<HeifPixelImage>* decoded_img;
+
+  heif_image* decoded_img = nullptr;
+
+  err = decoder_plugin->decode_image(decoder, &decoded_img);
+  if (err.code != heif_error_Ok) {
+    release_decoder(decoder_plugin, decoder, false);
+    return Error(err.code, err.subcode, err.message);
+  }
+
+  if (!decoded_img) {
+    // TODO(farindk): The plugin should return an error in this case.
+    release_decoder(decoder_plugin, decoder, false);
+    return Error(heif_error_Decoder_plugin_error, heif_suberror_Unspecified);
+  }
+
+  img = std::move(decoded_img->image);
+  heif_image_release(decoded_img);
+
+  Error adopt_err = adopt_decoded_image(img);
+  if (adopt_err) {
+    release_decoder(decoder_plugin, decoder, false);
+    return adopt_err;
+  }
+
+  decode_trace.set_output_image(img.get());
+
+  release_decoder(decoder_plugin, decoder, true);
+
+
+
+  // If there is an NCLX profile in the HEIF/AVIF metadata, use this for the color conversion.
+  // Otherwise, use the profile that is stored in the image stream itself and then set the
+  // (non-NCLX) profile later.
+  auto nclx = imginfo->get_color_profile_nclx();
+  if (nclx) {
+    img->set_color_profile_nclx(nclx);
+  }
+
+  auto icc = imginfo->get_color_profile_icc();
+  if (icc) {
+    img->set_color_profile_icc(icc);
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::get_coded_image_region(heif_item_id ID,
+                                          const ImageRegion& region,
+                                          bool ignore_transformations,
+                                          ImageRegion& coded_region) const
+{
+  auto ispe = m_heif_file->get_property<Box_ispe>(ID);
+  if (!ispe) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_image_size,
+                 "Image has no ispe property, cannot decode a region of it");
+  }
+
+  int width = static_cast<int>(ispe->get_width());
+  int height = static_cast<int>(ispe->get_height());
+
+
+  // --- collect the transformations and the input image size of each of them
+
+  struct Transformation
+  {
+    std::shared_ptr<Box> box;
+    int input_width, input_height;
+  };
+
+  std::vector<Transformation> transformations;
+
+  if (!ignore_transformations) {
+    std::vector<std::shared_ptr<Box>> properties;
+    Error err = m_heif_file->get_properties(ID, {fourcc("irot"), fourcc("imir"), fourcc("clap")}, properties);
+    if (err) {
+      return err;
+    }
+
+    for (const auto& property : properties) {
+      uint32_t type = property->get_short_type();
+
+      if (type == fourcc("irot")) {
+        transformations.push_back({property, width, height});
+
+        int rotation = std::dynamic_pointer_cast<Box_irot>(property)->get_rotation();
+        if (rotation == 90 || rotation == 270) {
+          std::swap(width, height);
+        }
+      }
+      else if (type == fourcc("imir")) {
+        transformations.push_back({property, width, height});
+      }
+      else if (type == fourcc("clap")) {
+        transformations.push_back({property, width, height});
+
+        // same computation as in decode_image_planar()
+        auto clap = std::dynamic_pointer_cast<Box_clap>(property);
+        int left = std::max(clap->left_rounded(width), 0);
+        int right = std::min(clap->right_rounded(width), width - 1);
+        int top = std::max(clap->top_rounded(height), 0);
+        int bottom = std::min(clap->bottom_rounded(height), height - 1);
+
+        if (left > right ||
+            top > bottom) {
+          return Error(heif_error_Invalid_input,
+                       heif_suberror_Invalid_clean_aperture);
+        }
+
+        width = right - left + 1;
+        height = bottom - top + 1;
+      }
+    }
+  }
+
+
+  // --- check that the region lies within the output image
+
+  if (region.x < 0 || region.y < 0 ||
+      region.width <= 0 || region.height <= 0 ||
+      region.x >= width || region.y >= height ||
+      region.width > width - region.x ||
+      region.height > height - region.y) {
+    std::stringstream sstr;
+    sstr << "Region " << region.width << "x" << region.height << " at (" << region.x << ";" << region.y
+         << ") exceeds the image size " << width << "x" << height;
+
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 sstr.str());
+  }
+
+
+  // --- map the region back through all transformations, starting with the last one
+
+  int x0 = region.x;
+  int y0 = region.y;
+  int x1 = region.x + region.width - 1;
+  int y1 = region.y + region.height - 1;
+
+  for (auto iter = transformations.rbegin(); iter != transformations.rend(); ++iter) {
+    const int w = iter->input_width;
+    const int h = iter->input_height;
+    uint32_t type = iter->box->get_short_type();
+
+    if (type == fourcc("irot")) {
+      int rotation = std::dynamic_pointer_cast<Box_irot>(iter->box)->get_rotation();
+
+      // see HeifPixelImage::rotate_and_mirror() for the pixel mapping
+      int nx0 = x0, ny0 = y0, nx1 = x1, ny1 = y1;
+      if (rotation == 90) {
+        nx0 = w - 1 - y1;
+        nx1 = w - 1 - y0;
+        ny0 = x0;
+        ny1 = x1;
+      }
+      else if (rotation == 180) {
+        nx0 = w - 1 - x1;
+        nx1 = w - 1 - x0;
+        ny0 = h - 1 - y1;
+        ny1 = h - 1 - y0;
+      }
+      else if (rotation == 270) {
+        nx0 = y0;
+        nx1 = y1;
+        ny0 = h - 1 - x1;
+        ny1 = h - 1 - x0;
+      }
+
+      x0 = nx0;
+      y0 = ny0;
+      x1 = nx1;
+      y1 = ny1;
+    }
+    else if (type == fourcc("imir")) {
+      auto mirror = std::dynamic_pointer_cast<Box_imir>(iter->box);
+      if (mirror->get_mirror_direction() == heif_transform_mirror_direction_horizontal) {
+        int nx0 = w - 1 - x1;
+        x1 = w - 1 - x0;
+        x0 = nx0;
+      }
+      else {
+        int ny0 = h - 1 - y1;
+        y1 = h - 1 - y0;
+        y0 = ny0;
+      }
+    }
+    else if (type == fourcc("clap")) {
+      auto clap = std::dynamic_pointer_cast<Box_clap>(iter->box);
+      int left = std::max(clap->left_rounded(w), 0);
+      int top = std::max(clap->top_rounded(h), 0);
+
+      x0 += left;
+      x1 += left;
+      y0 += top;
+      y1 += top;
+    }
+  }
+
+  coded_region.x = x0;
+  coded_region.y = y0;
+  coded_region.width = x1 - x0 + 1;
+  coded_region.height = y1 - y0 + 1;
+
+  return Error::Ok;
+}
+
+
+static uint64_t saturating_add(uint64_t a, uint64_t b)
+{
+  return (a > std::numeric_limits<uint64_t>::max() - b) ? std::numeric_limits<uint64_t>::max() : a + b;
+}
+
+
+Error HeifContext::get_decoding_work(heif_item_id ID, int depth,
+                                     std::map<heif_item_id, uint64_t>& work_of_items,
+                                     std::set<heif_item_id>& input_items, uint64_t& input_bytes,
+                                     uint64_t& out_work) const
+{
+  auto work_iter = work_of_items.find(ID);
+  if (work_iter != work_of_items.end()) {
+    out_work = work_iter->second;
+    return Error::Ok;
+  }
+
+  if (depth > MAX_IMAGE_DERIVATION_DEPTH) {
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 "Too many nested derived images");
+  }
+
+  // --- coded data of this image (derived images without data, e.g. 'iden', count nothing)
+
+  if (input_items.insert(ID).second) {
+    std::vector<FileRange> ranges;
+    if (m_heif_file->append_item_file_ranges(ID, ranges) == Error::Ok) {
+      for (const FileRange& range : ranges) {
+        input_bytes = saturating_add(input_bytes, range.size);
+      }
+    }
+  }
+
+  // --- pixels decoded or composed for this image
+
+  auto get_area = [this](heif_item_id id) -> uint64_t {
+    auto image_iter = m_all_images.find(id);
+    if (image_iter == m_all_images.end()) {
+      return 0; // decoding will report the error
+    }
+
+    const std::shared_ptr<Image>& image = image_iter->second;
+    if (image->get_ispe_width() > 0 && image->get_ispe_height() > 0) {
+      return static_cast<uint64_t>(image->get_ispe_width()) * static_cast<uint64_t>(image->get_ispe_height());
+    }
+
+    return static_cast<uint64_t>(std::max(image->get_width(), 0)) * static_cast<uint64_t>(std::max(image->get_height(), 0));
+  };
+
+  uint64_t work = get_area(ID);
+
+  std::vector<heif_item_id> references;
+  if (auto iref_box = m_heif_file->get_iref_box()) {
+    references = iref_box->get_references(ID, fourcc("dimg"));
+  }
+
+  if (references.empty()) {
+    work = saturating_add(work, DECODING_WORK_PER_TILE);
+  }
+  else {
+    // Grid tiles are decoded for each reference. Overlay layers that show the same image share one
+    // decoded image and only have to be composed again.
+    bool share_references = (m_heif_file->get_item_type(ID) == "iovl");
+    std::set<heif_item_id> decoded_references;
+
+    for (heif_item_id reference : references) {
+      if (share_references && !decoded_references.insert(reference).second) {
+        work = saturating_add(work, get_area(reference));
+        continue;
+      }
+
+      uint64_t reference_work = 0;
+      Error err = get_decoding_work(reference, depth + 1, work_of_items, input_items, input_bytes, reference_work);
+      if (err) {
+        return err;
+      }
+
+      work = saturating_add(work, reference_work);
+    }
+  }
+
+  work_of_items[ID] = work;
+  out_work = work;
+  return Error::Ok;
+}
+
+
+Error HeifContext::check_decoding_work(heif_item_id ID) const
+{
+  if (m_decoding_work_base == 0) {
+    return Error::Ok;
+  }
+
+  std::map<heif_item_id, uint64_t> work_of_items;
+  std::set<heif_item_id> input_items;
+  uint64_t input_bytes = 0;
+  uint64_t work = 0;
+
+  Error err = get_decoding_work(ID, 0, work_of_items, input_items, input_bytes, work);
+  if (err) {
+    return err;
+  }
+
+  uint64_t limit = m_decoding_work_base;
+  if (m_decoding_work_per_input_byte > 0) {
+    if (input_bytes > std::numeric_limits<uint64_t>::max() / m_decoding_work_per_input_byte) {
+      limit = std::numeric_limits<uint64_t>::max();
+    }
+    else {
+      limit = saturating_add(limit, input_bytes * m_decoding_work_per_input_byte);
+    }
+  }
+
+  if (work > limit) {
+    std::stringstream sstr;
+    sstr << "Decoding image " << ID << " needs a work of " << work << " pixels, which exceeds the limit of "
+         << limit << " for " << input_bytes << " bytes of coded data";
+
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Decoding_work_limit_exceeded,
+                 sstr.str());
+  }
+
+  return Error::Ok;
+}
+
+
+// Bit depth of the color channels of a grid canvas in planar or interleaved RGB.
+static int get_canvas_bit_depth(const HeifPixelImage& img)
+{
+  return img.get_bits_per_pixel(img.has_channel(heif_channel_interleaved) ? heif_channel_interleaved : heif_channel_R);
+}
+
+
+// This function only works with RGB images.
+Error HeifContext::decode_full_grid_image(heif_item_id ID,
+                                          std::shared_ptr<HeifPixelImage>& img,
+                                          const std::vector<uint8_t>& grid_data,
+                                          const heif_decoding_options& options,
+                                          const ImageRegion* region,
+                                          heif_chroma preferred_chroma) const
+{
+  ImageGrid grid;
+  Error err = grid.parse(grid_data);
+  if (err) {
+    return err;
+  }
+
+  //std::cout << grid.dump();
+
+
+  auto iref_box = m_heif_file->get_iref_box();
+
+  if (!iref_box) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_iref_box,
+                 "No iref box available, but needed for grid image");
+  }
+
+  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+
+  if ((int) image_references.size() != grid.get_rows() * grid.get_columns()) {
+    std::stringstream sstr;
+    sstr << "Tiled image with " << grid.get_rows() << "x" << grid.get_columns() << "="
+         << (grid.get_rows() * grid.get_columns()) << " tiles, but only "
+         << image_references.size() << " tile images in file";
+
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Missing_grid_images,
+                 sstr.str());
+  }
+
+
+  // --- check that all image IDs are valid images
+
+  for (heif_item_id tile_id : image_references) {
+    if (!is_image(tile_id)) {
+      std::stringstream sstr;
+      sstr << "Tile image ID=" << tile_id << " is not a proper image.";
+
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Missing_grid_images,
+                   sstr.str());
+    }
+  }
+
+  err = check_decoding_work(ID);
+  if (err) {
+    return err;
+  }
+
+
+  const uint32_t w = grid.get_width();
+  const uint32_t h = grid.get_height();
+
+  // area of the grid covered by the output image
+  ImageRegion out_region{0, 0, static_cast<int>(w), static_cast<int>(h)};
+  if (region) {
+    if (region->x < 0 || region->y < 0 ||
+        region->width <= 0 || region->height <= 0 ||
+        static_cast<uint32_t>(region->x) + static_cast<uint32_t>(region->width) > w ||
+        static_cast<uint32_t>(region->y) + static_cast<uint32_t>(region->height) > h) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_grid_data,
+                   "Grid size does not match the image size");
+    }
+
+    out_region = *region;
+  }
+
+
+  // --- determine output image chroma size and make sure all tiles have same chroma
+
+  assert(!image_references.empty());
+
+  heif_chroma tile_chroma = heif_chroma_444;
+  /* TODO: in the future, we might support RGB and mono as intermediate formats
+  heif_chroma tile_chroma = m_heif_file->get_image_chroma_from_configuration(some_tile_id);
+  if (tile_chroma != heif_chroma_monochrome) {
+    tile_chroma = heif_chroma_RGB;
+  }
+  */
+
+  // --- generate image of full output size
+
+  if (w > m_maximum_image_width_limit || h > m_maximum_image_height_limit) {
+    std::stringstream sstr;
+    sstr << "Image size " << w << "x" << h << " exceeds the maximum image size "
+         << m_maximum_image_width_limit << "x" << m_maximum_image_height_limit << "\n";
+
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 sstr.str());
+  }
+
+
+  int bpp = 0;
+  err = get_grid_bit_depth(ID, image_references[0], bpp);
+  if (err) {
+    return err;
+  }
+
+  // When the application wants an interleaved RGB format at the bit depth of the grid, the canvas
+  // is created in this format. The tiles are converted directly into it, which saves converting
+  // the whole canvas afterwards.
+  if (is_interleaved_canvas_chroma(preferred_chroma, bpp, options)) {
+    tile_chroma = preferred_chroma;
+  }
+
+  bool file_backed_canvas = (options.version >= 17 && options.canvas_file_directory != nullptr);
+
+  img = std::make_shared<HeifPixelImage>();
+  if (file_backed_canvas) {
+    // The images converted from the canvas inherit the allocator. Hence, they are also stored in files.
+    img->set_plane_allocator(std::make_shared<MappedFilePlaneAllocator>(options.canvas_file_directory));
+  }
+  else {
+    img->set_plane_allocator(get_plane_allocator());
+  }
+
+  img->create(out_region.width, out_region.height,
+              heif_colorspace_RGB,
+              tile_chroma);
+
+  bool canvas_allocated;
+  if (tile_chroma == heif_chroma_monochrome) {
+    canvas_allocated = img->add_plane(heif_channel_Y, out_region.width, out_region.height, bpp);
+  }
+  else if (tile_chroma != heif_chroma_444) {
+    canvas_allocated = img->add_plane(heif_channel_interleaved, out_region.width, out_region.height, bpp);
+  }
+  else {
+    canvas_allocated = (img->add_plane(heif_channel_R, out_region.width, out_region.height, bpp) &&
+                        img->add_plane(heif_channel_G, out_region.width, out_region.height, bpp) &&
+                        img->add_plane(heif_channel_B, out_region.width, out_region.height, bpp));
+  }
+
+  if (!canvas_allocated && file_backed_canvas) {
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Unspecified,
+                 std::string("Cannot create the grid image canvas in directory ") + options.canvas_file_directory);
+  }
+
+  int y0 = 0;
+  int reference_idx = 0;
+
+  std::vector<GridTile> tiles;
+
+  for (int y = 0; y < grid.get_rows(); y++) {
+    int x0 = 0;
+    int tile_height = 0;
+
+    for (int x = 0; x < grid.get_columns(); x++) {
+
+      heif_item_id tileID = image_references[reference_idx];
+
+      auto iter = m_all_images.find(tileID);
+      if (iter == m_all_images.end()) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_Missing_grid_images,
+                     "Nonexistent grid image referenced");
+      }
+
+      const std::shared_ptr<Image> tileImg = iter->second;
+      int src_width = tileImg->get_width();
+      int src_height = tileImg->get_height();
+
+      // only decode tiles that intersect the output area
+      if (x0 < out_region.x + out_region.width && x0 + src_width > out_region.x &&
+          y0 < out_region.y + out_region.height && y0 + src_height > out_region.y) {
+        tiles.push_back(GridTile{tileID, x0 - out_region.x, y0 - out_region.y});
+      }
+
+      x0 += src_width;
+      tile_height = src_height; // TODO: check that all tiles have the same height
+
+      reference_idx++;
+    }
+
+    y0 += tile_height;
+  }
+
+
+  // --- decode each distinct tile only once
+  // Generated images (screenshots, collages) often reference the same tile several times, or tiles
+  // with identical data. Such a tile is decoded at one position that lies completely inside of the
+  // output image and copied from there to the other positions.
+
+  std::vector<GridTile> copied_tiles;
+  std::map<std::pair<int, int>, std::vector<GridTile>> tile_copies; // keyed by the position of the decoded tile
+
+  if (tiles.size() > 1) {
+    auto inside_output = [&](const GridTile& tile) {
+      const std::shared_ptr<Image>& tile_info = m_all_images.find(tile.id)->second;
+      return (tile.paste_x >= 0 && tile.paste_y >= 0 &&
+              tile.paste_x + static_cast<int64_t>(tile_info->get_width()) <= out_region.width &&
+              tile.paste_y + static_cast<int64_t>(tile_info->get_height()) <= out_region.height);
+    };
+
+    // the first tile with each distinct content that can be copied
+    std::vector<size_t> source_tiles;
+    std::map<heif_item_id, size_t> source_of_id;
+    std::vector<size_t> tile_source(tiles.size(), SIZE_MAX);
+
+    auto find_source = [&](size_t tile_idx) -> size_t {
+      auto known_id = source_of_id.find(tiles[tile_idx].id);
+      if (known_id != source_of_id.end()) {
+        return known_id->second;
+      }
+
+      for (size_t candidate : source_tiles) {
+        if (have_identical_tile_data(tiles[candidate].id, tiles[tile_idx].id)) {
+          source_of_id[tiles[tile_idx].id] = candidate;
+          return candidate;
+        }
+      }
+
+      return SIZE_MAX;
+    };
+
+    for (size_t i = 0; i < tiles.size(); i++) {
+      if (inside_output(tiles[i])) {
+        tile_source[i] = find_source(i);
+        if (tile_source[i] == SIZE_MAX) {
+          source_tiles.push_back(i);
+          source_of_id[tiles[i].id] = i;
+          tile_source[i] = i;
+        }
+      }
+    }
+
+    // tiles that extend over the border of the output image can only be copied to, not from
+    for (size_t i = 0; i < tiles.size(); i++) {
+      if (tile_source[i] == SIZE_MAX) {
+        tile_source[i] = find_source(i);
+      }
+    }
+
+    std::vector<GridTile> decoded_tiles;
+    for (size_t i = 0; i < tiles.size(); i++) {
+      if (tile_source[i] == SIZE_MAX || tile_source[i] == i) {
+        decoded_tiles.push_back(tiles[i]);
+      }
+      else {
+        const GridTile& source = tiles[tile_source[i]];
+        tile_copies[{source.paste_x, source.paste_y}].push_back(tiles[i]);
+        copied_tiles.push_back(tiles[i]);
+      }
+    }
+
+    if (!copied_tiles.empty()) {
+      tiles = std::move(decoded_tiles);
+    }
+  }
+
+
+  // --- report the progress in the order in which the tiles finish
+  // The tiles finish on different threads. The callbacks are called one at a time.
+
+  int num_finished_tiles = 0;
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::mutex progress_mutex;
+#endif
+
+  auto on_tile_decoded = (options.version >= 15 ? options.on_tile_decoded : nullptr);
+
+  std::function<void(const GridTile&)> tile_finished = [&](const GridTile& tile) {
+    if (!options.on_progress && !on_tile_decoded) {
+      return;
+    }
+
+    // the area of the tile inside the output image
+    const std::shared_ptr<Image>& tile_info = m_all_images.find(tile.id)->second;
+    int x0 = std::max(tile.paste_x, 0);
+    int y0 = std::max(tile.paste_y, 0);
+    int x1 = std::min(tile.paste_x + static_cast<int>(tile_info->get_width()), img->get_width());
+    int y1 = std::min(tile.paste_y + static_cast<int>(tile_info->get_height()), img->get_height());
+
+#if ENABLE_PARALLEL_TILE_DECODING
+    std::lock_guard<std::mutex> lock(progress_mutex);
+#endif
+
+    num_finished_tiles++;
+
+    if (on_tile_decoded && x1 > x0 && y1 > y0) {
+      heif_image tile_view;
+      tile_view.image = img->create_view(x0, y0, x1 - x0, y1 - y0);
+      if (tile_view.image) {
+        on_tile_decoded(&tile_view, x0, y0, options.progress_user_data);
+      }
+    }
+
+    if (options.on_progress) {
+      options.on_progress(heif_progress_step_total, num_finished_tiles, options.progress_user_data);
+    }
+  };
+
+  std::function<void(const GridTile&)> decoded_tile_finished = tile_finished;
+
+  if (!tile_copies.empty()) {
+    decoded_tile_finished = [&](const GridTile& tile) {
+      tile_finished(tile);
+
+      auto copies = tile_copies.find({tile.paste_x, tile.paste_y});
+      if (copies != tile_copies.end()) {
+        for (const GridTile& copy : copies->second) {
+          copy_decoded_tile(img, tile, copy);
+          tile_finished(copy);
+        }
+      }
+    };
+  }
+
+  if (options.start_progress) {
+    options.start_progress(heif_progress_step_total, static_cast<int>(tiles.size() + copied_tiles.size()),
+                           options.progress_user_data);
+  }
+
+  err = decode_grid_tiles(tiles, img, options, decoded_tile_finished);
+
+  if (options.end_progress) {
+    options.end_progress(heif_progress_step_total, options.progress_user_data);
+  }
+
+  return err;
+}
+
+
+bool HeifContext::have_identical_tile_data(heif_item_id id1, heif_item_id id2) const
+{
+  if (id1 == id2) {
+    return true;
+  }
+
+  auto image1 = m_all_images.find(id1);
+  auto image2 = m_all_images.find(id2);
+  if (image1 == m_all_images.end() || image2 == m_all_images.end() ||
+      image1->second->get_alpha_channel() || image2->second->get_alpha_channel()) {
+    return false;
+  }
+
+  if (m_heif_file->get_item_type(id1) != m_heif_file->get_item_type(id2)) {
+    return false;
+  }
+
+  // --- same data
+
+  const Box_iloc::Item* item1 = m_heif_file->get_iloc_item(id1);
+  const Box_iloc::Item* item2 = m_heif_file->get_iloc_item(id2);
+  if (!item1 || !item2 ||
+      item1->construction_method == 2 || // the data depends on the references of the item
+      item1->construction_method != item2->construction_method ||
+      item1->data_reference_index != item2->data_reference_index ||
+      item1->base_offset != item2->base_offset ||
+      item1->extents.size() != item2->extents.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < item1->extents.size(); i++) {
+    if (item1->extents[i].offset != item2->extents[i].offset ||
+        item1->extents[i].length != item2->extents[i].length) {
+      return false;
+    }
+  }
+
+  // --- same properties
+
+  auto ipma = m_heif_file->get_ipma_box();
+  if (!ipma) {
+    return false;
+  }
+
+  const auto* properties1 = ipma->get_properties_for_item_ID(id1);
+  const auto* properties2 = ipma->get_properties_for_item_ID(id2);
+  if (!properties1 || !properties2 || properties1->size() != properties2->size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < properties1->size(); i++) {
+    if ((*properties1)[i].property_index != (*properties2)[i].property_index ||
+        (*properties1)[i].essential != (*properties2)[i].essential) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void HeifContext::copy_decoded_tile(const std::shared_ptr<HeifPixelImage>& img,
+                                    const GridTile& source, const GridTile& copy) const
+{
+  const std::shared_ptr<Image>& tile_info = m_all_images.find(copy.id)->second;
+
+  // the part of the copy inside of the output image
+  int x0 = std::max(copy.paste_x, 0);
+  int y0 = std::max(copy.paste_y, 0);
+  int x1 = std::min(copy.paste_x + static_cast<int>(tile_info->get_width()), img->get_width());
+  int y1 = std::min(copy.paste_y + static_cast<int>(tile_info->get_height()), img->get_height());
+  if (x1 <= x0 || y1 <= y0) {
+    return;
+  }
+
+  int src_x = source.paste_x + (x0 - copy.paste_x);
+  int src_y = source.paste_y + (y0 - copy.paste_y);
+
+  struct Plane
+  {
+    uint8_t* data;
+    size_t stride;
+    int bytes_per_pixel;
+  };
+
+  std::vector<Plane> planes;
+
+  {
+#if ENABLE_PARALLEL_TILE_DECODING
+    // Other tiles are pasted at the same time. Only the lookup of the planes needs the lock.
+    std::lock_guard<std::mutex> lock(m_canvas_mutex);
+#endif
+
+    for (heif_channel channel : img->get_channel_set()) {
+      Plane plane{};
+      plane.data = img->get_plane(channel, &plane.stride);
+      plane.bytes_per_pixel = img->get_storage_bits_per_pixel(channel) / 8;
+      planes.push_back(plane);
+    }
+  }
+
+  // all planes of the grid canvas have the full image size
+  for (const Plane& plane : planes) {
+    size_t row_bytes = static_cast<size_t>(x1 - x0) * plane.bytes_per_pixel;
+
+    for (int y = 0; y < y1 - y0; y++) {
+      memcpy(plane.data + (y0 + y) * plane.stride + static_cast<size_t>(x0) * plane.bytes_per_pixel,
+             plane.data + (src_y + y) * plane.stride + static_cast<size_t>(src_x) * plane.bytes_per_pixel,
+             row_bytes);
+    }
+  }
+}
+
+
+TaskPriority HeifContext::get_decoding_priority(heif_item_id ID, const struct heif_decoding_options& options) const
+{
+  if (options.version >= 18 &&
+      options.priority > heif_decoding_priority_automatic &&
+      options.priority <= heif_decoding_priority_prefetch) {
+    return static_cast<TaskPriority>(options.priority);
+  }
+
+  auto iter = m_all_images.find(ID);
+  if (iter != m_all_images.end()) {
+    const std::shared_ptr<Image>& image = iter->second;
+
+    if (image->is_thumbnail()) {
+      return TaskPriority::Interactive;
+    }
+    else if (image->is_alpha_channel()) {
+      return TaskPriority::Alpha;
+    }
+    else if (image->is_depth_channel() || image->is_aux_image()) {
+      return TaskPriority::Auxiliary;
+    }
+  }
+
+  return TaskPriority::Visible;
+}
+
+
+Error HeifContext::decode_grid_tiles(std::vector<GridTile>& tiles,
+                                     const std::shared_ptr<HeifPixelImage>& img,
+                                     const heif_decoding_options& options,
+                                     const std::function<void(const GridTile&)>& tile_finished) const
+{
+  // Tiles are decoded on the context's thread pool. Without a pool, they are decoded in this thread.
+  TaskGroup tile_tasks(get_thread_pool().get());
+
+  // The canvas has already been allocated. Decode only as many tiles at the same time as fit
+  // into the rest of the memory budget.
+  if (m_memory_budget && !tiles.empty()) {
+    ColorState canvas_state(img->get_colorspace(), img->get_chroma_format(), false, get_canvas_bit_depth(*img));
+    size_t tile_bytes = estimate_tile_memory(tiles[0].id, canvas_state, options);
+    tile_tasks.set_max_concurrent_tasks(get_max_concurrent_tiles(tile_bytes, tiles.size(), 0));
+  }
+
+  heif_decoding_options tile_options = get_concurrent_decoding_options(options, tiles.size());
+
+  // The decoder plugin may decode the tiles with a single decoder, which uses all decoding threads.
+  // The remaining tiles are decoded separately below.
+  Error err = decode_tile_sequence(tiles, img, options, tile_tasks, tile_finished);
+  if (err) {
+    // report the error of a tile that has already been decoded, if there is one
+    Error tile_err = tile_tasks.wait();
+    return tile_err ? tile_err : err;
+  }
+
+  // Stored as std::function since it is referenced by the tile tasks.
+  std::function<Error(size_t)> decode_tile = [this, &tiles, img, &tile_options, &tile_finished](size_t tile_idx) {
+    Error tile_err = check_canceled(tile_options);
+    if (tile_err) {
+      return tile_err;
+    }
+
+    const GridTile& tile = tiles[tile_idx];
+    tile_err = decode_and_paste_tile_image(tile.id, img, tile.paste_x, tile.paste_y, tile_options);
+    if (!tile_err) {
+      statistics::add(statistics::tiles_decoded);
+      tile_finished(tile);
+    }
+
+    return tile_err;
+  };
+
+  auto start_tile = [&tile_tasks, &decode_tile](size_t tile_idx) {
+    tile_tasks.run([&decode_tile, tile_idx]() {
+      return decode_tile(tile_idx);
+    });
+  };
+
+  std::vector<heif_item_id> tile_ids;
+  for (const auto& tile : tiles) {
+    tile_ids.push_back(tile.id);
+  }
+
+  if (!start_tiles_when_data_is_available(tile_ids, options, start_tile) &&
+      !start_tiles_with_prefetching(tile_ids, options, tile_tasks, decode_tile)) {
+    for (size_t i = 0; i < tiles.size(); i++) {
+      start_tile(i);
+    }
+  }
+
+  // Returns the first error of any tile (in completion order).
+  err = tile_tasks.wait();
+
+#if ENABLE_PARALLEL_TILE_DECODING
+  // remove data of tiles that were skipped because of an error
+  m_heif_file->remove_prefetched_data(tile_ids);
+#endif
+
+  if (err) {
+    return err;
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::get_grid_bit_depth(heif_item_id ID, heif_item_id first_tile_id, int& bpp) const
+{
+  auto ipma = m_heif_file->get_ipma_box();
+  auto ipco = m_heif_file->get_ipco_box();
+  auto pixi_box = ipco->get_property_for_item_ID(ID, ipma, fourcc("pixi"));
+  auto pixi = std::dynamic_pointer_cast<Box_pixi>(pixi_box);
+
+  if (pixi) {
+    if (pixi->get_num_channels() < 1) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_pixi_box,
+                   "No pixi information for luma channel.");
+    }
+
+    bpp = pixi->get_bits_per_channel(0);
+
+    // there are broken files that save only a one-channel pixi for an RGB image (issue #283)
+    if (pixi->get_num_channels() == 3) {
+
+      int bpp_c1 = pixi->get_bits_per_channel(1);
+      int bpp_c2 = pixi->get_bits_per_channel(2);
+
+      if (bpp_c1 != bpp || bpp_c2 != bpp) {
+        // TODO: is this really an error? Does the pixi depths refer to RGB or YCbCr?
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_Invalid_pixi_box,
+                     "Different number of bits per pixel in each channel.");
+      }
+    }
+  }
+  else {
+    // When there is no pixi-box, get the pixel-depth from one of the tile images
+
+    auto iter = m_all_images.find(first_tile_id);
+    if (iter == m_all_images.end()) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Missing_grid_images,
+                   "Nonexistent grid image referenced");
+    }
+
+    const std::shared_ptr<Image> tileImg = iter->second;
+    bpp = tileImg->get_luma_bits_per_pixel();
+  }
+
+  if (bpp < 8 || bpp > 16) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_pixi_box,
+                 "Invalid bits per pixel in pixi box.");
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::decode_scaled_grid_image(heif_item_id ID,
+                                            std::shared_ptr<HeifPixelImage>& img,
+                                            const std::vector<uint8_t>& grid_data,
+                                            const heif_decoding_options& options,
+                                            const ImageSize& size) const
+{
+  ImageGrid grid;
+  Error err = grid.parse(grid_data);
+  if (err) {
+    return err;
+  }
+
+  auto iref_box = m_heif_file->get_iref_box();
+  if (!iref_box) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_iref_box,
+                 "No iref box available, but needed for grid image");
+  }
+
+  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+  if ((int) image_references.size() != grid.get_rows() * grid.get_columns()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Missing_grid_images);
+  }
+
+  for (heif_item_id tile_id : image_references) {
+    if (!is_image(tile_id)) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Missing_grid_images,
+                   "Nonexistent grid image referenced");
+    }
+  }
+
+  err = check_decoding_work(ID);
+  if (err) {
+    return err;
+  }
+
+  const int64_t w = grid.get_width();
+  const int64_t h = grid.get_height();
+
+  if (w == 0 || h == 0 || size.width <= 0 || size.height <= 0) {
+    return Error(heif_error_Invalid_input, heif_suberror_Invalid_image_size);
+  }
+
+  // When the tiles become very small, the rounding of the tile borders visibly distorts the image.
+  // The full grid is then decoded and scaled down as a whole.
+  const int min_scaled_tile_size = 8;
+
+  const std::shared_ptr<Image>& first_tile = m_all_images.find(image_references[0])->second;
+  if (first_tile->get_width() * int64_t{size.width} < min_scaled_tile_size * w ||
+      first_tile->get_height() * int64_t{size.height} < min_scaled_tile_size * h) {
+    err = decode_full_grid_image(ID, img, grid_data, options);
+    if (err) {
+      return err;
+    }
+
+    return scale_image_to(img, size.width, size.height, options.target_scaling_filter);
+  }
+
+  int bpp = 0;
+  err = get_grid_bit_depth(ID, image_references[0], bpp);
+  if (err) {
+    return err;
+  }
+
+  img = std::make_shared<HeifPixelImage>();
+  img->set_plane_allocator(get_plane_allocator());
+  img->create(size.width, size.height, heif_colorspace_RGB, heif_chroma_444);
+  img->add_plane(heif_channel_R, size.width, size.height, bpp);
+  img->add_plane(heif_channel_G, size.width, size.height, bpp);
+  img->add_plane(heif_channel_B, size.width, size.height, bpp);
+
+
+  // --- map the tile areas into the output image
+  // The tile borders are rounded to the nearest output pixel. Adjacent tiles thus cover the output
+  // image without gaps. Tiles that are scaled to less than one pixel are skipped.
+  // Only the part of the border tiles that lies inside the grid image is scaled.
+
+  struct ScaledTile
+  {
+    heif_item_id id;
+    int visible_width, visible_height;
+    int x0, y0;
+    int width, height;
+  };
+
+  std::vector<ScaledTile> tiles;
+
+  int64_t y0 = 0;
+  int reference_idx = 0;
+
+  for (int y = 0; y < grid.get_rows(); y++) {
+    int64_t x0 = 0;
+    int tile_height = 0;
+
+    for (int x = 0; x < grid.get_columns(); x++) {
+      heif_item_id tileID = image_references[reference_idx++];
+      const std::shared_ptr<Image>& tileImg = m_all_images.find(tileID)->second;
+
+      int src_width = tileImg->get_width();
+      int src_height = tileImg->get_height();
+
+      int64_t visible_width = std::min(int64_t{src_width}, w - x0);
+      int64_t visible_height = std::min(int64_t{src_height}, h - y0);
+
+      if (visible_width > 0 && visible_height > 0) {
+        int out_x0 = static_cast<int>((x0 * size.width + w / 2) / w);
+        int out_x1 = static_cast<int>(((x0 + visible_width) * size.width + w / 2) / w);
+        int out_y0 = static_cast<int>((y0 * size.height + h / 2) / h);
+        int out_y1 = static_cast<int>(((y0 + visible_height) * size.height + h / 2) / h);
+
+        if (out_x1 > out_x0 && out_y1 > out_y0) {
+          tiles.push_back(ScaledTile{tileID, static_cast<int>(visible_width), static_cast<int>(visible_height),
+                                     out_x0, out_y0, out_x1 - out_x0, out_y1 - out_y0});
+        }
+      }
+
+      x0 += src_width;
+      tile_height = src_height;
+    }
+
+    y0 += tile_height;
+  }
+
+
+  // --- decode, scale and paste the tiles concurrently
+
+  TaskGroup tile_tasks(get_thread_pool().get());
+
+  heif_decoding_options tile_options = get_concurrent_decoding_options(options, tiles.size());
+
+  for (const ScaledTile& tile : tiles) {
+    tile_tasks.run([this, &tile, img, &tile_options]() {
+      std::shared_ptr<HeifPixelImage> tile_img;
+      Error tile_err = decode_image_planar(tile.id, tile_img, heif_colorspace_undefined, tile_options,
+                                           true /* no color conversion */);
+      if (tile_err) {
+        return tile_err;
+      }
+
+      {
+        TraceScope transform_trace(m_tracer, heif_trace_stage_transformations, tile.id);
+        transform_trace.set_input_image(tile_img.get());
+
+        if (tile_img->get_width() > tile.visible_width || tile_img->get_height() > tile.visible_height) {
+          std::shared_ptr<HeifPixelImage> visible_img;
+          tile_err = tile_img->crop(0, tile.visible_width - 1, 0, tile.visible_height - 1, visible_img);
+          if (tile_err) {
+            return tile_err;
+          }
+
+          tile_img = visible_img;
+        }
+
+        tile_err = scale_image_to(tile_img, tile.width, tile.height, tile_options.target_scaling_filter);
+        if (tile_err) {
+          return tile_err;
+        }
+
+        transform_trace.set_output_image(tile_img.get());
+      }
+
+      return paste_tile_image(tile.id, tile_img, false, img, tile.x0, tile.y0, tile_options);
+    });
+  }
+
+  return tile_tasks.wait();
+}
+
+
+// Largest size with the aspect ratio of 'width' x 'height' that fits into the bounding box.
+// Images that already fit are not scaled up. A bounding box size of 0 does not limit that direction.
+static void fit_into_bounding_box(int width, int height, int bbox_width, int bbox_height,
+                                  int& out_width, int& out_height)
+{
+  out_width = width;
+  out_height = height;
+
+  double scale = 1.0;
+  if (bbox_width > 0 && width > bbox_width) {
+    scale = std::min(scale, bbox_width / (double) width);
+  }
+  if (bbox_height > 0 && height > bbox_height) {
+    scale = std::min(scale, bbox_height / (double) height);
+  }
+
+  if (scale < 1.0) {
+    out_width = std::max(1, static_cast<int>(width * scale + 0.5));
+    out_height = std::max(1, static_cast<int>(height * scale + 0.5));
+
+    if (bbox_width > 0) {
+      out_width = std::min(out_width, bbox_width);
+    }
+    if (bbox_height > 0) {
+      out_height = std::min(out_height, bbox_height);
+    }
+  }
+}
+
+
+Error HeifContext::decode_image_at_target_size(heif_item_id ID,
+                                               std::shared_ptr<HeifPixelImage>& img,
+                                               heif_colorspace out_colorspace,
+                                               heif_chroma out_chroma,
+                                               const struct heif_decoding_options& options) const
+{
+  auto image_iter = m_all_images.find(ID);
+  if (image_iter == m_all_images.end()) {
+    return Error(heif_error_Usage_error, heif_suberror_Nonexisting_item_referenced);
+  }
+
+  const int bbox_width = options.target_bbox_width;
+  const int bbox_height = options.target_bbox_height;
+
+  // size of an image as it is output by decode_image_planar()
+  auto get_decoded_size = [&options](const std::shared_ptr<Image>& image, int& width, int& height) {
+    if (options.ignore_transformations) {
+      width = image->get_ispe_width();
+      height = image->get_ispe_height();
+    }
+    else {
+      width = image->get_width();
+      height = image->get_height();
+    }
+  };
+
+
+  // --- choose the smallest thumbnail that still covers the target size
+
+  std::shared_ptr<Image> source = image_iter->second;
+
+  int width, height;
+  get_decoded_size(source, width, height);
+
+  // The output size is derived from the image itself, not from the thumbnail, such that it does not
+  // depend on the rounding of the thumbnail size.
+  int target_width, target_height;
+  fit_into_bounding_box(width, height, bbox_width, bbox_height, target_width, target_height);
+
+  for (const auto& thumbnail : image_iter->second->get_thumbnails()) {
+    int thumb_width, thumb_height;
+    get_decoded_size(thumbnail, thumb_width, thumb_height);
+
+    if (thumb_width >= target_width && thumb_height >= target_height &&
+        (int64_t) thumb_width * thumb_height < (int64_t) width * height) {
+      source = thumbnail;
+      width = thumb_width;
+      height = thumb_height;
+    }
+  }
+
+
+  // --- Images without clean aperture are scaled down right after decoding, before the color conversion.
+  //     Grid images are decoded directly at the reduced size.
+
+  ImageSize scaled_size{};
+  const ImageSize* scaled_size_ptr = nullptr;
+
+  if (target_width > 0 && target_height > 0 &&
+      (target_width != width || target_height != height) &&
+      (options.ignore_transformations || !m_heif_file->get_property<Box_clap>(source->get_id()))) {
+    int coded_width = source->get_ispe_width();
+    int coded_height = source->get_ispe_height();
+
+    if (coded_width > 0 && coded_height > 0) {
+      // Without a clean aperture, the image can only be rotated by multiples of 90 degrees.
+      bool rotated = (coded_width != width);
+
+      scaled_size.width = (rotated ? target_height : target_width);
+      scaled_size.height = (rotated ? target_width : target_height);
+      scaled_size_ptr = &scaled_size;
+    }
+  }
+
+  Error err = decode_image_planar(source->get_id(), img, out_colorspace, options, false, nullptr, out_chroma,
+                                  scaled_size_ptr);
+  if (err) {
+    return err;
+  }
+
+
+  // --- scale down to the target size before the final conversion (e.g. for images with a clean aperture)
+
+  if (target_width <= 0 || target_height <= 0 ||
+      target_width > img->get_width() || target_height > img->get_height()) {
+    // the image size was not known in advance
+    fit_into_bounding_box(img->get_width(), img->get_height(), bbox_width, bbox_height, target_width, target_height);
+  }
+
+  TraceScope scaling_trace(m_tracer, heif_trace_stage_transformations, source->get_id());
+  scaling_trace.set_input_image(img.get());
+  const HeifPixelImage* unscaled_img = img.get();
+
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+
+  err = scale_image_to(img, target_width, target_height, options.target_scaling_filter,
+                       options.color_conversion_threads == 1 ? nullptr : thread_pool.get());
+  if (err) {
+    return err;
+  }
+
+  if (img.get() != unscaled_img) {
+    scaling_trace.set_output_image(img.get());
+  }
+  else {
+    scaling_trace.cancel();
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::decode_tile_sequence(std::vector<GridTile>& tiles,
+                                        const std::shared_ptr<HeifPixelImage>& img,
+                                        const heif_decoding_options& options,
+                                        TaskGroup& tile_tasks,
+                                        const std::function<void(const GridTile&)>& tile_finished) const
+{
+  if (tiles.size() < 2) {
+    return Error::Ok;
+  }
+
+  std::string tile_type = m_heif_file->get_item_type(tiles[0].id);
+  heif_compression_format compression = (tile_type == "hvc1" ? heif_compression_HEVC :
+                                         tile_type == "av01" ? heif_compression_AV1 :
+                                         tile_type == "jpeg" ? heif_compression_JPEG :
+                                         heif_compression_undefined);
+  if (compression == heif_compression_undefined) {
+    return Error::Ok;
+  }
+
+  const struct heif_decoder_plugin* decoder_plugin = get_decoder(compression, options.decoder_id);
+  if (!decoder_plugin ||
+      decoder_plugin->plugin_api_version < 7 ||
+      !decoder_plugin->decode_image_sequence) {
+    return Error::Ok;
+  }
+
+
+  // --- collect the tiles with the same headers whose data can be passed to the decoder without copying
+
+  std::shared_ptr<const std::vector<uint8_t>> headers;
+  std::vector<GridTile> sequence_tiles;
+  std::vector<GridTile> other_tiles;
+  std::vector<const void*> image_data;
+  std::vector<size_t> image_sizes;
+
+  for (const GridTile& tile : tiles) {
+    HeifFile::CodedImageData coded;
+
+    // Tiles that need a transformation or alpha are decoded separately.
+    // Tiles sharing a configuration property also share the header vector, hence the pointer comparison
+    // is usually sufficient.
+    if (m_heif_file->get_item_type(tile.id) != tile_type ||
+        !can_convert_tile_into_canvas(tile.id, img, tile.paste_x, tile.paste_y, options) ||
+        m_heif_file->get_coded_image_data(tile.id, coded) ||
+        !coded.is_view() ||
+        !coded.headers ||
+        (headers && coded.headers != headers && *coded.headers != *headers)) {
+      other_tiles.push_back(tile);
+      continue;
+    }
+
+    if (!headers) {
+      headers = coded.headers;
+    }
+
+    sequence_tiles.push_back(tile);
+    image_data.push_back(coded.data);
+    image_sizes.push_back(coded.size);
+  }
+
+  if (sequence_tiles.size() < 2) {
+    return Error::Ok;
+  }
+
+
+  // --- decode the tiles and paste them into the output image while the decoder continues
+
+  void* decoder;
+  Error err = acquire_decoder(decoder_plugin, &decoder);
+  if (err) {
+    return err;
+  }
+
+  err = set_decoder_options(decoder_plugin, decoder, options);
+  if (err) {
+    release_decoder(decoder_plugin, decoder, false);
+    return err;
+  }
+
+  struct SequenceDecoding
+  {
+    const HeifContext* context;
+    const std::vector<GridTile>* tiles;
+    std::vector<bool> decoded;
+    std::shared_ptr<HeifPixelImage> img;
+    heif_decoding_options options;
+    TaskGroup* tile_tasks;
+    const std::function<void(const GridTile&)>* tile_finished;
+  } sequence{this, &sequence_tiles, std::vector<bool>(sequence_tiles.size(), false), img, options, &tile_tasks,
+             &tile_finished};
+
+  auto image_decoded = [](void* user_data, int image_index, struct heif_image* decoded_img) -> heif_error {
+    auto* sequence = static_cast<SequenceDecoding*>(user_data);
+
+    std::shared_ptr<HeifPixelImage> tile_img = std::move(decoded_img->image);
+    heif_image_release(decoded_img);
+
+    if (image_index < 0 || static_cast<size_t>(image_index) >= sequence->tiles->size() ||
+        sequence->decoded[image_index] || !tile_img) {
+      return {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, "Invalid image index in decoded image sequence"};
+    }
+
+    if (sequence->tile_tasks->has_failed()) {
+      return {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, "Decoding of the image sequence was cancelled"};
+    }
+
+    // the plugin returns this error from decode_image_sequence()
+    Error cancel_err = check_canceled(sequence->options);
+    if (cancel_err) {
+      return {cancel_err.error_code, cancel_err.sub_error_code, "Decoding was canceled"};
+    }
+
+    sequence->decoded[image_index] = true;
+
+    const HeifContext* context = sequence->context;
+    const GridTile tile = (*sequence->tiles)[image_index];
+
+    Error adopt_err = context->adopt_decoded_image(tile_img);
+    if (adopt_err) {
+      return {adopt_err.error_code, adopt_err.sub_error_code, "Decoding exceeds the memory budget"};
+    }
+
+    const std::shared_ptr<Image>& tile_info = context->m_all_images.find(tile.id)->second;
+    if (auto nclx = tile_info->get_color_profile_nclx()) {
+      tile_img->set_color_profile_nclx(nclx);
+    }
+
+    std::shared_ptr<HeifPixelImage> out_img = sequence->img;
+    const heif_decoding_options& options = sequence->options;
+    const std::function<void(const GridTile&)>* tile_finished = sequence->tile_finished;
+
+    sequence->tile_tasks->run([context, tile_img, out_img, tile, options, tile_finished]() {
+      Error err = context->paste_tile_image(tile.id, tile_img, false, out_img, tile.paste_x, tile.paste_y, options);
+      if (!err) {
+        (*tile_finished)(tile);
+      }
+
+      return err;
+    });
+
+    return {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+  };
+
+  // The tiles of the sequence are traced as a single decoding stage. Their pasting is traced per tile.
+  TraceScope decode_trace(m_tracer, heif_trace_stage_decode);
+  if (decode_trace.is_enabled()) {
+    uint64_t data_bytes = headers->size();
+    for (size_t size : image_sizes) {
+      data_bytes += size;
+    }
+
+    decode_trace.set_data_bytes(data_bytes);
+  }
+
+  struct heif_error decode_err = decoder_plugin->decode_image_sequence(decoder,
+                                                                       headers->data(), headers->size(),
+                                                                       image_data.data(), image_sizes.data(),
+                                                                       static_cast<int>(image_data.size()),
+                                                                       image_decoded, &sequence);
+  if (decode_err.code != heif_error_Ok &&
+      decode_err.subcode != heif_suberror_Unsupported_codec) {
+    release_decoder(decoder_plugin, decoder, false);
+    return Error(decode_err.code, decode_err.subcode, decode_err.message);
+  }
+
+  // If the decoder plugin cannot decode these images, e.g. because of an unsupported profile,
+  // the remaining tiles are decoded separately, which can fall back to another plugin.
+  release_decoder(decoder_plugin, decoder, decode_err.code == heif_error_Ok);
+
+  // Tiles that the decoder did not return are decoded separately.
+  for (size_t i = 0; i < sequence_tiles.size(); i++) {
+    if (!sequence.decoded[i]) {
+      other_tiles.push_back(sequence_tiles[i]);
+    }
+  }
+
+  tiles = std::move(other_tiles);
+
+  return Error::Ok;
+}
+
+
+bool HeifContext::start_tiles_when_data_is_available(const std::vector<heif_item_id>& tile_ids,
+                                                     const heif_decoding_options& options,
+                                                     const std::function<void(size_t tile_idx)>& start_tile) const
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  if (tile_ids.size() < 2) {
+    return false;
+  }
+
+
+  // --- collect the file ranges of all tiles
+
+  std::vector<FileRange> ranges;
+  std::vector<size_t> range_tile; // tile index of each range
+  std::vector<size_t> pending_ranges(tile_ids.size());
+
+  for (size_t i = 0; i < tile_ids.size(); i++) {
+    size_t first_range = ranges.size();
+
+    Error err = append_file_ranges_for_decoding(tile_ids[i], options, nullptr, ranges);
+    if (err) {
+      // decode as usual, the error is reported by the tile decoding
+      return false;
+    }
+
+    pending_ranges[i] = ranges.size() - first_range;
+    range_tile.resize(ranges.size(), i);
+  }
+
+
+  // --- request the ranges and start each tile as soon as all its ranges are available
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<size_t> ready_tiles;
+  size_t completed_ranges = 0;
+
+  for (size_t i = 0; i < tile_ids.size(); i++) {
+    if (pending_ranges[i] == 0) {
+      ready_tiles.push_back(i);
+    }
+  }
+
+  // Failed ranges are not handled separately. Reading the data of the tile will fail then.
+  StreamReader::range_completion_callback on_completed = [&](size_t range_idx, bool) {
+    std::lock_guard<std::mutex> lock(mutex);
+    completed_ranges++;
+
+    size_t tile_idx = range_tile[range_idx];
+    if (--pending_ranges[tile_idx] == 0) {
+      ready_tiles.push_back(tile_idx);
+    }
+
+    cond.notify_one();
+  };
+
+  if (!m_heif_file->request_file_ranges(ranges, &on_completed)) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+
+  for (size_t started = 0; started < tile_ids.size(); started++) {
+    cond.wait(lock, [&]() { return !ready_tiles.empty(); });
+
+    size_t tile_idx = ready_tiles.front();
+    ready_tiles.pop_front();
+
+    lock.unlock();
+    start_tile(tile_idx);
+    lock.lock();
+  }
+
+  // 'on_completed' must stay alive until the reader has completed all ranges
+  cond.wait(lock, [&]() { return completed_ranges == ranges.size(); });
+
+  return true;
+#else
+  (void) tile_ids;
+  (void) options;
+  (void) start_tile;
+  return false;
+#endif
+}
+
+
+bool HeifContext::start_tiles_with_prefetching(const std::vector<heif_item_id>& tile_ids,
+                                               const heif_decoding_options& options,
+                                               TaskGroup& tile_tasks,
+                                               const std::function<Error(size_t tile_idx)>& decode_tile) const
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  if (options.tile_prefetch_count <= 0 ||
+      tile_ids.size() < 2 ||
+      !get_thread_pool() ||
+      m_heif_file->has_concurrent_reads()) {
+    return false;
+  }
+
+  const size_t max_prefetched = static_cast<size_t>(options.tile_prefetch_count);
+
+  // The state is shared with the tile tasks, which may still run after this function returned.
+  struct PrefetchState
+  {
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t finished_tiles = 0;
+  };
+
+  auto state = std::make_shared<PrefetchState>();
+
+  for (size_t i = 0; i < tile_ids.size(); i++) {
+
+    // --- wait until less than 'max_prefetched' tiles are read ahead
+
+    auto can_prefetch = [&]() {
+      return i - state->finished_tiles < max_prefetched || tile_tasks.has_failed();
+    };
+
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (can_prefetch()) {
+          break;
+        }
+      }
+
+      // Help decoding instead of waiting. This also prevents a deadlock when the pool has no free worker.
+      if (!tile_tasks.run_queued_task()) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cond.wait(lock, can_prefetch);
+        break;
+      }
+    }
+
+    if (tile_tasks.has_failed()) {
+      // the remaining tiles would be skipped anyway
+      break;
+    }
+
+
+    // --- read the tile data and hand the tile to the decoding threads
+
+    // A read error is reported again when the tile is decoded.
+    {
+      TraceScope read_trace(m_tracer, heif_trace_stage_read_data, tile_ids[i]);
+
+      // Data in memory is passed to the decoder directly and the shared codec headers are not stored
+      // with each tile.
+      HeifFile::CodedImageData coded;
+      if (m_heif_file->get_coded_image_data(tile_ids[i], coded) == Error::Ok && !coded.is_view()) {
+        read_trace.set_data_bytes(coded.buffer.size());
+        m_heif_file->add_prefetched_data(tile_ids[i], std::move(coded.buffer));
+      }
+    }
+
+    tile_tasks.run([state, &decode_tile, i]() {
+      Error err = decode_tile(i);
+
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->finished_tiles++;
+      state->cond.notify_one();
+
+      return err;
+    });
+  }
+
+  return true;
+#else
+  (void) tile_ids;
+  (void) options;
+  (void) tile_tasks;
+  (void) decode_tile;
+  return false;
+#endif
+}
+
+
+bool HeifContext::can_convert_tile_into_canvas(heif_item_id tileID,
+                                               const std::shared_ptr<HeifPixelImage>& img,
+                                               int x0, int y0,
+                                               const heif_decoding_options& options) const
+{
+  auto iter = m_all_images.find(tileID);
+  if (iter == m_all_images.end()) {
+    return false;
+  }
+
+  const std::shared_ptr<Image>& tile = iter->second;
+
+  // The tile has to lie completely within the output image.
+  if (x0 < 0 || y0 < 0 ||
+      tile->get_width() > img->get_width() - x0 ||
+      tile->get_height() > img->get_height() - y0) {
+    return false;
+  }
+
+  // Alpha channels and transformations of the tile are only handled by decode_image_planar().
+  if (tile->get_alpha_channel()) {
+    return false;
+  }
+
+  int canvas_bit_depth;
+  {
+#if ENABLE_PARALLEL_TILE_DECODING
+    std::lock_guard<std::mutex> lock(m_canvas_mutex);
+#endif
+    canvas_bit_depth = get_canvas_bit_depth(*img);
+  }
+
+  if (tile->get_luma_bits_per_pixel() != canvas_bit_depth) {
+    return false;
+  }
+
+  if (!options.ignore_transformations) {
+    std::vector<std::shared_ptr<Box>> properties;
+    if (m_heif_file->get_properties(tileID, {fourcc("irot"), fourcc("imir"), fourcc("clap")}, properties)) {
+      return false;
+    }
+
+    for (const auto& property : properties) {
+      uint32_t type = property->get_short_type();
+      if (type == fourcc("irot") ||
+          type == fourcc("imir") ||
+          type == fourcc("clap")) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+Error HeifContext::decode_and_paste_tile_image(heif_item_id tileID,
+                                               const std::shared_ptr<HeifPixelImage>& img,
+                                               int x0, int y0,
+                                               const heif_decoding_options& options) const
+{
+  std::shared_ptr<HeifPixelImage> tile_img;
+  Error err;
+
+  if (can_convert_tile_into_canvas(tileID, img, x0, y0, options)) {
+    // --- Fastest path: the decoder plugin writes the tile directly into its area of the output image.
+
+    std::string tile_type = m_heif_file->get_item_type(tileID);
+    heif_compression_format compression = (tile_type == "hvc1" ? heif_compression_HEVC :
+                                           tile_type == "av01" ? heif_compression_AV1 :
+                                           tile_type == "jpeg" ? heif_compression_JPEG :
+                                           heif_compression_undefined);
+
+    const struct heif_decoder_plugin* decoder_plugin = nullptr;
+    if (compression != heif_compression_undefined) {
+      decoder_plugin = get_decoder(compression, options.decoder_id);
+    }
+
+    if (decoder_plugin &&
+        decoder_plugin->plugin_api_version >= 6 &&
+        decoder_plugin->decode_image_into) {
+      const std::shared_ptr<Image>& tile = m_all_images.find(tileID)->second;
+
+      std::shared_ptr<HeifPixelImage> tile_area;
+      {
+#if ENABLE_PARALLEL_TILE_DECODING
+        std::lock_guard<std::mutex> lock(m_canvas_mutex);
+#endif
+        tile_area = img->create_view(x0, y0, tile->get_width(), tile->get_height());
+      }
+
+      if (tile_area) {
+        err = decode_coded_image(tileID, compression, tile_img, options, tile_area);
+        if (err != Error::Ok) {
+          return err;
+        }
+
+        if (tile_img == tile_area) {
+          return Error::Ok;
+        }
+      }
+    }
+
+    // --- Fast path: decode the tile without color conversion and convert it directly
+    //     into its area of the output image.
+
+    if (!tile_img) {
+      err = decode_image_planar(tileID, tile_img, heif_colorspace_undefined, options,
+                                true /* no color conversion */);
+      if (err != Error::Ok) {
+        return err;
+      }
+    }
+
+    return paste_tile_image(tileID, tile_img, false, img, x0, y0, options);
+  }
+  else {
+    err = decode_image_planar(tileID, tile_img, img->get_colorspace(), options, false);
+    if (err != Error::Ok) {
+      return err;
+    }
+
+    return paste_tile_image(tileID, tile_img, true, img, x0, y0, options);
+  }
+}
+
+
+Error HeifContext::paste_tile_image(heif_item_id tileID,
+                                    std::shared_ptr<HeifPixelImage> tile_img, bool converted,
+                                    const std::shared_ptr<HeifPixelImage>& img,
+                                    int x0, int y0,
+                                    const heif_decoding_options& options) const
+{
+  TraceScope paste_trace(m_tracer, heif_trace_stage_paste_tile, tileID);
+  paste_trace.set_input_image(tile_img.get());
+
+  const int w = img->get_width();
+  const int h = img->get_height();
+
+  if (!converted) {
+    // The alpha channel of a tile can only be converted into interleaved output images. Planar output
+    // images get an alpha plane below.
+    std::shared_ptr<HeifPixelImage> tile_area;
+
+    if (tile_img->get_width() <= w - x0 &&
+        tile_img->get_height() <= h - y0) {
+#if ENABLE_PARALLEL_TILE_DECODING
+      std::lock_guard<std::mutex> lock(m_canvas_mutex);
+#endif
+
+      if (!tile_img->has_alpha() || img->has_channel(heif_channel_interleaved)) {
+        tile_area = img->create_view(x0, y0, tile_img->get_width(), tile_img->get_height());
+      }
+    }
+
+    if (tile_area && convert_colorspace_into(tile_img, tile_area, options.color_conversion_options)) {
+      return Error::Ok;
+    }
+  }
+
+  // The tile cannot be converted into the output image. Convert it separately and copy it below.
+  // Tiles that have been converted to planar RGB are converted again for interleaved output images.
+  if (!converted ||
+      tile_img->get_colorspace() != img->get_colorspace() ||
+      tile_img->get_chroma_format() != img->get_chroma_format()) {
+    tile_img = convert_colorspace(tile_img, img->get_colorspace(), img->get_chroma_format(), nullptr, 0, options.color_conversion_options);
+    if (!tile_img) {
+      return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+    }
+  }
+
+
+  // --- copy tile into output image
+
+  int src_width = tile_img->get_width();
+  int src_height = tile_img->get_height();
+  assert(src_width >= 0);
+  assert(src_height >= 0);
+
+  heif_chroma chroma = img->get_chroma_format();
+
+  if (chroma != tile_img->get_chroma_format()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Wrong_tile_image_chroma_format,
+                 "Image tile has different chroma format than combined image");
+  }
+
+  // --- add alpha plane if we discovered a tile with alpha
+
+  struct OutputPlane
+  {
+    heif_channel channel;
+    uint8_t* data;
+    size_t stride;
+    int bits_per_pixel;
+  };
+
+  std::vector<OutputPlane> out_planes;
+
+  {
+#if ENABLE_PARALLEL_TILE_DECODING
+    // Other tiles are pasted into the same image at the same time. The planes of the output image
+    // are only added and looked up under the lock, the pixels are copied outside of it.
+    std::lock_guard<std::mutex> lock(m_canvas_mutex);
+#endif
+
+    if (tile_img->has_alpha() && !img->has_alpha()) {
+      int alpha_bpp = tile_img->get_bits_per_pixel(heif_channel_Alpha);
+
+      assert(alpha_bpp <= 16);
+
+      uint16_t alpha_default_value = static_cast<uint16_t>((1UL << alpha_bpp) - 1UL);
+
+      img->fill_new_plane(heif_channel_Alpha, alpha_default_value, w, h, alpha_bpp);
+    }
+
+    for (heif_channel channel : tile_img->get_channel_set()) {
+      OutputPlane plane{};
+      plane.channel = channel;
+      plane.data = img->get_plane(channel, &plane.stride);
+      plane.bits_per_pixel = img->get_bits_per_pixel(channel);
+      out_planes.push_back(plane);
+    }
+  }
+
+  for (const OutputPlane& out_plane : out_planes) {
+    heif_channel channel = out_plane.channel;
+
+    size_t tile_stride;
+    uint8_t* tile_data = tile_img->get_plane(channel, &tile_stride);
+
+    size_t out_stride = out_plane.stride;
+    uint8_t* out_data = out_plane.data;
+
+    if (w <= x0 || h <= y0) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_grid_data);
+    }
+
+    if (out_plane.bits_per_pixel != tile_img->get_bits_per_pixel(channel)) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Wrong_tile_image_pixel_depth);
+    }
+
+    // skip the part of the tile that lies left/above of the output image
+    int src_x = std::max(-x0, 0);
+    int src_y = std::max(-y0, 0);
+    int xs = x0 + src_x, ys = y0 + src_y;
+
+    if (src_x >= src_width || src_y >= src_height) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_grid_data);
+    }
+
+    int copy_width = std::min(src_width - src_x, w - xs);
+    int copy_height = std::min(src_height - src_y, h - ys);
+
+    int bytes_per_pixel = tile_img->get_storage_bits_per_pixel(channel) / 8;
+    copy_width *= bytes_per_pixel;
+    xs *= bytes_per_pixel;
+    src_x *= bytes_per_pixel;
+
+    for (int py = 0; py < copy_height; py++) {
+      memcpy(out_data + xs + (ys + py) * out_stride,
+             tile_data + src_x + (src_y + py) * tile_stride,
+             copy_width);
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::decode_derived_image(heif_item_id ID,
+                                        std::shared_ptr<HeifPixelImage>& img,
+                                        const heif_decoding_options& options) const
+{
+  // find the ID of the image this image is derived from
+
+  auto iref_box = m_heif_file->get_iref_box();
+
+  if (!iref_box) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_iref_box,
+                 "No iref box available, but needed for iden image");
+  }
+
+  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+
+  if ((int) image_references.size() != 1) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Missing_grid_images,
+                 "'iden' image with more than one reference image");
+  }
+
+
+  heif_item_id reference_image_id = image_references[0];
+
+
+  Error error = decode_image_planar(reference_image_id, img,
+                                    heif_colorspace_RGB, options, false); // TODO: always RGB ?
+  return error;
+}
+
+
+// The area of an overlay layer on the canvas.
+struct OverlayLayer
+{
+  // visible area, clipped to the canvas (x1,y1 exclusive)
+  int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+  bool opaque = false;
+
+  // Whether the layer may be skipped when it is covered. False if its area is unknown.
+  bool skippable = false;
+
+  bool decoded = false;
+
+  void set_area(int32_t dx, int32_t dy, int width, int height, uint32_t canvas_width, uint32_t canvas_height,
+                bool is_opaque)
+  {
+    x0 = (int) std::max<int64_t>(dx, 0);
+    y0 = (int) std::max<int64_t>(dy, 0);
+    x1 = (int) std::max<int64_t>(std::min<int64_t>((int64_t) dx + width, canvas_width), x0);
+    y1 = (int) std::max<int64_t>(std::min<int64_t>((int64_t) dy + height, canvas_height), y0);
+    opaque = is_opaque;
+    skippable = true;
+  }
+
+  bool is_empty() const { return x0 == x1 || y0 == y1; }
+
+  bool covers(const OverlayLayer& other) const
+  {
+    return opaque && !is_empty() &&
+           x0 <= other.x0 && y0 <= other.y0 && x1 >= other.x1 && y1 >= other.y1;
+  }
+};
+
+
+// A layer is covered if it is outside of the canvas or if an opaque layer above it contains its area.
+// With 'use_predictions' unset, only decoded layers are trusted to cover other layers.
+static bool is_overlay_layer_covered(const std::vector<OverlayLayer>& layers, size_t idx, bool use_predictions)
+{
+  const OverlayLayer& layer = layers[idx];
+  if (!layer.skippable) {
+    return false;
+  }
+
+  if (layer.is_empty()) {
+    return true;
+  }
+
+  for (size_t i = idx + 1; i < layers.size(); i++) {
+    if ((use_predictions || layers[i].decoded) && layers[i].covers(layer)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+Error HeifContext::decode_overlay_image(heif_item_id ID,
+                                        std::shared_ptr<HeifPixelImage>& img,
+                                        const std::vector<uint8_t>& overlay_data,
+                                        const heif_decoding_options& options) const
+{
+  // find the IDs this image is composed of
+
+  auto iref_box = m_heif_file->get_iref_box();
+
+  if (!iref_box) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_iref_box,
+                 "No iref box available, but needed for iovl image");
+  }
+
+  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+
+  /* TODO: probably, it is valid that an iovl image has no references ?
+
+  if (image_references.empty()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Missing_grid_images,
+                 "'iovl' image with more than one reference image");
+  }
+  */
+
+
+  ImageOverlay overlay;
+  Error err = overlay.parse(image_references.size(), overlay_data);
+  if (err) {
+    return err;
+  }
+
+  if (image_references.size() != overlay.get_num_offsets()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_overlay_data,
+                 "Number of image offsets does not match the number of image references");
+  }
+
+  err = check_decoding_work(ID);
+  if (err) {
+    return err;
+  }
+
+  uint32_t w = overlay.get_canvas_width();
+  uint32_t h = overlay.get_canvas_height();
+
+  if (w > m_maximum_image_width_limit || h > m_maximum_image_height_limit) {
+    std::stringstream sstr;
+    sstr << "Image size " << w << "x" << h << " exceeds the maximum image size "
+         << m_maximum_image_width_limit << "x" << m_maximum_image_height_limit << "\n";
+
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 sstr.str());
+  }
+
+  // TODO: seems we always have to compose this in RGB since the background color is an RGB value
+  img = std::make_shared<HeifPixelImage>();
+  img->set_plane_allocator(get_plane_allocator());
+  img->create(w, h,
+              heif_colorspace_RGB,
+              heif_chroma_444);
+  img->add_plane(heif_channel_R, w, h, 8); // TODO: other bit depths
+  img->add_plane(heif_channel_G, w, h, 8); // TODO: other bit depths
+  img->add_plane(heif_channel_B, w, h, 8); // TODO: other bit depths
+
+  // --- predict the canvas area of each layer from the image headers. Layers that are completely
+  //     covered by an opaque layer above them do not have to be decoded.
+
+  std::vector<OverlayLayer> layers(image_references.size());
+
+  for (size_t i = 0; i < image_references.size(); i++) {
+    int32_t dx, dy;
+    overlay.get_offset(i, &dx, &dy);
+
+    auto image_iter = m_all_images.find(image_references[i]);
+    if (image_iter == m_all_images.end()) {
+      continue; // not skippable, decoding will report the error
+    }
+
+    const std::shared_ptr<Image>& layer_image = image_iter->second;
+    int layer_width = options.ignore_transformations ? layer_image->get_ispe_width() : layer_image->get_width();
+    int layer_height = options.ignore_transformations ? layer_image->get_ispe_height() : layer_image->get_height();
+
+    // Only codecs that store alpha in an auxiliary image are known to be opaque before decoding.
+    std::string layer_type = m_heif_file->get_item_type(image_references[i]);
+    bool opaque = (layer_type == "hvc1" || layer_type == "av01" || layer_type == "jpeg") && !has_alpha(image_references[i]);
+
+    layers[i].set_area(dx, dy, layer_width, layer_height, w, h, opaque);
+  }
+
+
+  // --- decode the visible layers in parallel. They are composed in their specified order below.
+  //     If a layer turns out to be different from its prediction, the layers below it are checked again
+  //     with the decoded layers only.
+
+  std::vector<std::shared_ptr<HeifPixelImage>> overlay_images(image_references.size());
+
+  heif_decoding_options overlay_options = get_concurrent_decoding_options(options, image_references.size());
+
+  for (bool use_predictions = true;; use_predictions = false) {
+    std::vector<size_t> layers_to_decode;
+
+    for (size_t i = 0; i < image_references.size(); i++) {
+      if (!overlay_images[i] && !is_overlay_layer_covered(layers, i, use_predictions)) {
+        layers_to_decode.push_back(i);
+      }
+    }
+
+    if (layers_to_decode.empty()) {
+      break;
+    }
+
+    // Layers that show the same image share one decoded image.
+    std::map<heif_item_id, size_t> decoded_layer_of_item;
+    for (size_t i = 0; i < overlay_images.size(); i++) {
+      if (overlay_images[i]) {
+        decoded_layer_of_item.emplace(image_references[i], i);
+      }
+    }
+
+    std::vector<size_t> shared_layers;
+
+    TaskGroup overlay_tasks(get_thread_pool().get());
+
+    for (size_t i : layers_to_decode) {
+      if (!decoded_layer_of_item.emplace(image_references[i], i).second) {
+        shared_layers.push_back(i);
+        continue;
+      }
+
+      overlay_tasks.run([this, i, w, h, &image_references, &overlay, &overlay_images, &layers, &overlay_options]() {
+        std::shared_ptr<HeifPixelImage> overlay_img;
+        Error err = decode_image_planar(image_references[i], overlay_img,
+                                        heif_colorspace_RGB, overlay_options, false); // TODO: always RGB? Probably yes, because of RGB background color.
+        if (err != Error::Ok) {
+          return err;
+        }
+
+        // the canvas and the blending are 8 bit
+        overlay_img = convert_colorspace(overlay_img, heif_colorspace_RGB, heif_chroma_444, nullptr, 8, overlay_options.color_conversion_options);
+        if (!overlay_img) {
+          return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+        }
+
+        int32_t dx, dy;
+        overlay.get_offset(i, &dx, &dy);
+        layers[i].set_area(dx, dy, overlay_img->get_width(), overlay_img->get_height(), w, h, !overlay_img->has_alpha());
+        layers[i].decoded = true;
+
+        overlay_images[i] = std::move(overlay_img);
+        return Error::Ok;
+      });
+    }
+
+    err = overlay_tasks.wait();
+    if (err) {
+      return err;
+    }
+
+    for (size_t i : shared_layers) {
+      const std::shared_ptr<HeifPixelImage>& overlay_img = overlay_images[decoded_layer_of_item[image_references[i]]];
+
+      int32_t dx, dy;
+      overlay.get_offset(i, &dx, &dy);
+      layers[i].set_area(dx, dy, overlay_img->get_width(), overlay_img->get_height(), w, h, !overlay_img->has_alpha());
+      layers[i].decoded = true;
+
+      overlay_images[i] = overlay_img;
+    }
+  }
+
+
+  // --- the background is only visible if no opaque layer covers the whole canvas
+
+  OverlayLayer canvas;
+  canvas.set_area(0, 0, w, h, w, h, false);
+
+  bool background_visible = true;
+  for (const OverlayLayer& layer : layers) {
+    if (layer.decoded && layer.covers(canvas)) {
+      background_visible = false;
+    }
+  }
+
+  if (background_visible) {
+    uint16_t bkg_color[4];
+    overlay.get_background_color(bkg_color);
+
+    err = img->fill_RGB_16bit(bkg_color[0], bkg_color[1], bkg_color[2], bkg_color[3]);
+    if (err) {
+      return err;
+    }
+  }
+
+
+  for (size_t i = 0; i < image_references.size(); i++) {
+    std::shared_ptr<HeifPixelImage>& overlay_img = overlay_images[i];
+    if (!overlay_img || is_overlay_layer_covered(layers, i, false)) {
+      continue;
+    }
+
+    int32_t dx, dy;
+    overlay.get_offset(i, &dx, &dy);
+
+    err = img->overlay(overlay_img, dx, dy);
+    if (err) {
+      if (err.error_code == heif_error_Invalid_input &&
+          err.sub_error_code == heif_suberror_Overlay_image_outside_of_canvas) {
+        // NOP, ignore this error
+
+        err = Error::Ok;
+      }
+      else {
+        return err;
+      }
+    }
+  }
+
+  return err;
+}
+
+
+static std::shared_ptr<HeifPixelImage>
+create_alpha_image_from_image_alpha_channel(const std::shared_ptr<HeifPixelImage>& image)
+{
+  // --- generate alpha image
+
+  std::shared_ptr<HeifPixelImage> alpha_image = std::make_shared<HeifPixelImage>();
+  alpha_image->create(image->get_width(), image->get_height(),
+                      heif_colorspace_monochrome, heif_chroma_monochrome);
+  alpha_image->copy_new_plane_from(image, heif_channel_Alpha, heif_channel_Y);
+
+
+  // --- set nclx profile with full-range flag
+
+  auto nclx = std::make_shared<color_profile_nclx>();
+  nclx->set_undefined();
+  nclx->set_full_range_flag(true); // this is the default, but just to be sure in case the defaults change
+  alpha_image->set_color_profile_nclx(nclx);
+
+  return alpha_image;
+}
+
+
+void HeifContext::Image::set_preencoded_hevc_image(const std::vector<uint8_t>& data)
+{
+  m_heif_context->m_heif_file->add_hvcC_property(m_id);
+
+
+  // --- parse the h265 stream and set hvcC headers and compressed image data
+
+  int state = 0;
+
+  bool first = true;
+  bool eof = false;
+
+  int prev_start_code_start = -1; // init to an invalid value, will always be overwritten before use
+  int start_code_start;
+  int ptr = 0;
+
+  for (;;) {
+    bool dump_nal = false;
+
+    uint8_t c = data[ptr++];
+
+    if (state == 3) {
+      state = 0;
+    }
+
+    if (c == 0 && state <= 1) {
+      state++;
+    }
+    else if (c == 0) {
+      // NOP
+    }
+    else if (c == 1 && state == 2) {
+      start_code_start = ptr - 3;
+      dump_nal = true;
+      state = 3;
+    }
+    else {
+      state = 0;
+    }
+
+    if (ptr == (int) data.size()) {
+      start_code_start = (int) data.size();
+      dump_nal = true;
+      eof = true;
+    }
+
+    if (dump_nal) {
+      if (first) {
+        first = false;
+      }
+      else {
+        size_t length = start_code_start - (prev_start_code_start + 3);
+
+        assert(prev_start_code_start >= 0);
+        const uint8_t* nal_data = data.data() + prev_start_code_start + 3;
+
+        int nal_type = (nal_data[0] >> 1);
+
+        switch (nal_type) {
+          case 0x20:
+          case 0x21:
+          case 0x22:
+            m_heif_context->m_heif_file->append_hvcC_nal_data(m_id, nal_data, length);
+            break;
+
+          default:
+            m_heif_context->m_heif_file->append_iloc_data_with_4byte_size(m_id, nal_data, length);
+            break;
+        }
+      }
+
+      prev_start_code_start = start_code_start;
+    }
+
+    if (eof) {
+      break;
+    }
+  }
+}
+
+
+static bool encoder_supports_monochrome(const struct heif_encoder* encoder)
+{
+  return (encoder->plugin->plugin_api_version >= 6 &&
+          encoder->plugin->supports_monochrome &&
+          encoder->plugin->supports_monochrome(encoder->encoder));
+}
+
+
+static Error convert_to_encoder_colorspace(const Tracer& tracer,
+                                           const std::shared_ptr<HeifPixelImage>& image,
+                                           struct heif_encoder* encoder,
+                                           const struct heif_encoding_options& options,
+                                           std::shared_ptr<HeifPixelImage>& out_image)
+{
+  heif_colorspace colorspace = image->get_colorspace();
+  heif_chroma chroma = image->get_chroma_format();
+  auto nclx_profile = image->get_color_profile_nclx();
+  if (!nclx_profile) {
+    nclx_profile = std::make_shared<color_profile_nclx>();
+  }
+
+  if (colorspace == heif_colorspace_monochrome && encoder_supports_monochrome(encoder)) {
+    // Code the luma plane only. Converting to YCbCr would add constant chroma planes that the encoder has to code as well.
+  }
+  else if (encoder->plugin->plugin_api_version >= 2) {
+    encoder->plugin->query_input_colorspace2(encoder->encoder, &colorspace, &chroma);
+  }
+  else {
+    encoder->plugin->query_input_colorspace(&colorspace, &chroma);
+  }
+
+  if (colorspace != image->get_colorspace() ||
+      chroma != image->get_chroma_format()) {
+    // @TODO: use color profile when converting
+    int output_bpp = 0; // same as input
+
+    HeifPixelImage::ConversionKey key{};
+    key.colorspace = colorspace;
+    key.chroma = chroma;
+    key.output_bpp = output_bpp;
+    key.colour_primaries = nclx_profile->get_colour_primaries();
+    key.transfer_characteristics = nclx_profile->get_transfer_characteristics();
+    key.matrix_coefficients = nclx_profile->get_matrix_coefficients();
+    key.full_range_flag = nclx_profile->get_full_range_flag();
+    key.downsampling_algorithm = options.color_conversion_options.preferred_chroma_downsampling_algorithm;
+    key.upsampling_algorithm = options.color_conversion_options.preferred_chroma_upsampling_algorithm;
+    key.only_use_preferred_chroma_algorithm = options.color_conversion_options.only_use_preferred_chroma_algorithm;
+    key.conversion_accuracy = options.color_conversion_options.conversion_accuracy;
+
+    // The same image may be coded repeatedly, e.g. with several encoders or quality settings.
+    out_image = image->get_cached_conversion(key);
+    if (out_image) {
+      return Error::Ok;
+    }
+
+    TraceScope conversion_trace(tracer, heif_trace_stage_color_conversion);
+    conversion_trace.set_input_image(image.get());
+
+    out_image = convert_colorspace(image, colorspace, chroma, nclx_profile,
+                                   output_bpp, options.color_conversion_options, nullptr,
+                                   nullptr, 0, heif_alpha_premultiplication_unchanged, Cancellation::get(options));
+    if (!out_image) {
+      Error err = check_canceled(options);
+      return err ? err : Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+    }
+
+    conversion_trace.set_output_image(out_image.get());
+
+    image->set_cached_conversion(key, out_image);
+  }
+  else {
+    out_image = image;
+  }
+
+  return Error::Ok;
+}
+
+
+// 'out_num_layers' is the number of layers of progressive images. Each packet is one layer then.
+static Error run_encoder_plugin(const Tracer& tracer,
+                                const std::shared_ptr<HeifPixelImage>& src_image,
+                                struct heif_encoder* encoder,
+                                const struct heif_encoding_options& options,
+                                enum heif_image_input_class input_class,
+                                std::vector<std::vector<uint8_t>>& out_data,
+                                int& out_num_layers)
+{
+  // The plugin cannot be interrupted while it encodes an image.
+  Error cancel_err = check_canceled(options);
+  if (cancel_err) {
+    return cancel_err;
+  }
+
+  TraceScope encode_trace(tracer, heif_trace_stage_encode);
+
+  heif_image c_api_image;
+  c_api_image.image = src_image;
+
+  size_t speed_level = 0;
+  if (encoder->time_budget) {
+    Error error = encoder->time_budget->apply(*encoder, speed_level);
+    if (error) {
+      return error;
+    }
+  }
+
+  auto start_time = std::chrono::steady_clock::now();
+
+  struct heif_error err = encoder->plugin->encode_image(encoder->encoder, &c_api_image, input_class);
+  if (err.code) {
+    return Error(err.code,
+                 err.subcode,
+                 err.message);
+  }
+
+  for (;;) {
+    uint8_t* data;
+    int size;
+
+    encoder->plugin->get_compressed_data(encoder->encoder, &data, &size, nullptr);
+
+    if (data == nullptr) {
+      break;
+    }
+
+    out_data.emplace_back(data, data + size);
+  }
+
+  out_num_layers = 1;
+  if (encoder->plugin->plugin_api_version >= 5 && encoder->plugin->get_number_of_layers) {
+    out_num_layers = encoder->plugin->get_number_of_layers(encoder->encoder);
+  }
+
+  if (encode_trace.is_enabled()) {
+    uint64_t data_bytes = 0;
+    for (const auto& chunk : out_data) {
+      data_bytes += chunk.size();
+    }
+
+    encode_trace.set_data_bytes(data_bytes);
+  }
+
+  if (encoder->time_budget) {
+    std::chrono::duration<double, std::milli> encoding_time = std::chrono::steady_clock::now() - start_time;
+    double megapixels = src_image->get_width() * static_cast<double>(src_image->get_height()) / 1e6;
+
+    encoder->time_budget->report_encoding_time(speed_level, megapixels, encoding_time.count());
+  }
+
+  // release resources of this image that the encoder would otherwise keep until the next image
+  if (encoder->plugin->plugin_api_version >= 4 && encoder->plugin->reset_image) {
+    encoder->plugin->reset_image(encoder->encoder);
+  }
+
+  return Error::Ok;
+}
+
+
+// Returns false if the image already fits into the bounding box.
+static bool get_thumbnail_size(int orig_width, int orig_height, int bbox_size,
+                               int& thumb_width, int& thumb_height)
+{
+  if (orig_width <= bbox_size && orig_height <= bbox_size) {
+    return false;
+  }
+  else if (orig_width > orig_height) {
+    thumb_height = orig_height * bbox_size / orig_width;
+    thumb_width = bbox_size;
+  }
+  else {
+    thumb_width = orig_width * bbox_size / orig_height;
+    thumb_height = bbox_size;
+  }
+
+
+  // round size to even width and height
+
+  thumb_width &= ~1;
+  thumb_height &= ~1;
+
+  return true;
+}
+
+
+// Returns nullptr if the image already fits into the bounding box.
+static Error create_thumbnail_image(const std::shared_ptr<HeifPixelImage>& image, int bbox_size,
+                                    ThreadPool* thread_pool,
+                                    std::shared_ptr<HeifPixelImage>& out_thumbnail_image)
+{
+  int thumb_width, thumb_height;
+
+  if (!get_thumbnail_size(image->get_width(), image->get_height(), bbox_size, thumb_width, thumb_height)) {
+    // original image is smaller than thumbnail size -> do not encode any thumbnail
+
+    out_thumbnail_image.reset();
+    return Error::Ok;
+  }
+
+  return image->scale(out_thumbnail_image, thumb_width, thumb_height, heif_scaling_filter_box, thread_pool);
+}
+
+
+// Create the thumbnails of all pyramid levels, largest first. Each level is scaled down from the
+// previous level with a box filter. Levels into which the image already fits are skipped.
+static Error create_thumbnail_pyramid(const std::shared_ptr<HeifPixelImage>& image,
+                                      const struct heif_encoding_options& options,
+                                      ThreadPool* thread_pool,
+                                      std::vector<std::shared_ptr<HeifPixelImage>>& out_levels)
+{
+  out_levels.clear();
+
+  if (options.version < 8 || options.thumbnail_pyramid_bbox_sizes == nullptr) {
+    return Error::Ok;
+  }
+
+  std::vector<int> bbox_sizes(options.thumbnail_pyramid_bbox_sizes,
+                              options.thumbnail_pyramid_bbox_sizes + std::max(options.num_thumbnail_pyramid_levels, 0));
+  std::sort(bbox_sizes.begin(), bbox_sizes.end(), std::greater<int>());
+  bbox_sizes.erase(std::unique(bbox_sizes.begin(), bbox_sizes.end()), bbox_sizes.end());
+
+  std::shared_ptr<HeifPixelImage> previous_level = image;
+
+  for (int bbox_size : bbox_sizes) {
+    int thumb_width, thumb_height;
+
+    if (!get_thumbnail_size(image->get_width(), image->get_height(), bbox_size, thumb_width, thumb_height) ||
+        thumb_width == 0 || thumb_height == 0) {
+      continue;
+    }
+
+    std::shared_ptr<HeifPixelImage> level;
+    Error err = previous_level->scale(level, thumb_width, thumb_height, heif_scaling_filter_box, thread_pool);
+    if (err) {
+      return err;
+    }
+
+    out_levels.push_back(level);
+    previous_level = level;
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::get_coded_image(const std::shared_ptr<HeifPixelImage>& image,
+                                   struct heif_encoder* encoder,
+                                   const struct heif_encoding_options& options,
+                                   enum heif_image_input_class input_class,
+                                   CodedImage& out_coded_image)
+{
+  auto precoded_iter = m_precoded_images.find(input_class);
+  if (precoded_iter != m_precoded_images.end() && !precoded_iter->second.empty()) {
+    out_coded_image = std::move(precoded_iter->second.front());
+    precoded_iter->second.pop_front();
+    return Error::Ok;
+  }
+
+  Error err = convert_to_encoder_colorspace(m_tracer, image, encoder, options, out_coded_image.src_image);
+  if (err) {
+    return err;
+  }
+
+  return run_encoder_plugin(m_tracer, out_coded_image.src_image, encoder, options, input_class,
+                            out_coded_image.data, out_coded_image.num_layers);
+}
+
+
+// Collect the images in the order in which they are encoded one after another
+// and convert them to the colorspace of the encoder.
+static Error prepare_precoding_jobs(const Tracer& tracer,
+                                    const std::shared_ptr<HeifPixelImage>& image,
+                                    struct heif_encoder* encoder,
+                                    const struct heif_encoding_options& options,
+                                    ThreadPool* thread_pool,
+                                    std::vector<std::pair<heif_image_input_class, std::shared_ptr<HeifPixelImage>>>& out_jobs)
+{
+  std::vector<std::shared_ptr<HeifPixelImage>> color_images{image};
+
+  if (options.version >= 7 && options.thumbnail_bbox_size > 0) {
+    std::shared_ptr<HeifPixelImage> thumbnail_image;
+    Error err = create_thumbnail_image(image, options.thumbnail_bbox_size, thread_pool, thumbnail_image);
+    if (err) {
+      return err;
+    }
+
+    if (thumbnail_image) {
+      color_images.push_back(thumbnail_image);
+    }
+  }
+
+  std::vector<std::shared_ptr<HeifPixelImage>> pyramid_levels;
+  Error err = create_thumbnail_pyramid(image, options, thread_pool, pyramid_levels);
+  if (err) {
+    return err;
+  }
+
+  color_images.insert(color_images.end(), pyramid_levels.begin(), pyramid_levels.end());
+
+  for (const auto& color_image : color_images) {
+    std::shared_ptr<HeifPixelImage> src_image;
+    err = convert_to_encoder_colorspace(tracer, color_image, encoder, options, src_image);
+    if (err) {
+      return err;
+    }
+
+    out_jobs.emplace_back(heif_image_input_class_normal, src_image);
+
+    if (options.save_alpha_channel && src_image->has_channel(heif_channel_Alpha)) {
+      std::shared_ptr<HeifPixelImage> alpha_image;
+      err = convert_to_encoder_colorspace(tracer, create_alpha_image_from_image_alpha_channel(src_image),
+                                          encoder, options, alpha_image);
+      if (err) {
+        return err;
+      }
+
+      out_jobs.emplace_back(heif_image_input_class_alpha, alpha_image);
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::precode_images_concurrently(const std::vector<std::shared_ptr<HeifPixelImage>>& images,
+                                               struct heif_encoder* encoder,
+                                               const std::vector<heif_encoding_options>& options)
+{
+  assert(images.size() == options.size());
+
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+
+
+  // --- convert the input images in parallel
+
+  std::vector<std::vector<std::pair<heif_image_input_class, std::shared_ptr<HeifPixelImage>>>> image_jobs(images.size());
+
+  TaskGroup conversion_tasks(thread_pool.get());
+
+  for (size_t i = 0; i < images.size(); i++) {
+    conversion_tasks.run([&, i]() {
+      return prepare_precoding_jobs(m_tracer, images[i], encoder, options[i], thread_pool.get(), image_jobs[i]);
+    });
+  }
+
+  Error err = conversion_tasks.wait();
+  if (err) {
+    return err;
+  }
+
+  struct Job
+  {
+    const heif_encoding_options* options;
+    heif_image_input_class input_class;
+    CodedImage coded_image;
+  };
+
+  std::vector<Job> jobs;
+
+  for (size_t i = 0; i < image_jobs.size(); i++) {
+    for (auto& job : image_jobs[i]) {
+      jobs.emplace_back();
+      jobs.back().options = &options[i];
+      jobs.back().input_class = job.first;
+      jobs.back().coded_image.src_image = std::move(job.second);
+    }
+  }
+
+
+  // --- code all images in parallel with one encoder instance per thread
+
+  size_t num_encoders = std::min(jobs.size(), size_t(thread_pool ? thread_pool->get_num_threads() + 1 : 1));
+
+  std::vector<std::unique_ptr<heif_encoder>> additional_encoders(num_encoders > 0 ? num_encoders - 1 : 0);
+  std::vector<struct heif_encoder*> idle_encoders{encoder};
+
+  for (auto& job_encoder : additional_encoders) {
+    err = acquire_encoder(*encoder, job_encoder);
+    if (err) {
+      return err;
+    }
+
+    idle_encoders.push_back(job_encoder.get());
+  }
+
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::mutex idle_encoders_mutex;
+#endif
+
+  TaskGroup coding_tasks(thread_pool.get());
+
+  for (auto& job_ref : jobs) {
+    Job* job = &job_ref;
+
+    coding_tasks.run([&, job]() {
+      struct heif_encoder* job_encoder;
+
+      {
+#if ENABLE_PARALLEL_TILE_DECODING
+        std::lock_guard<std::mutex> lock(idle_encoders_mutex);
+#endif
+        assert(!idle_encoders.empty());
+        job_encoder = idle_encoders.back();
+        idle_encoders.pop_back();
+      }
+
+      Error job_err = run_encoder_plugin(m_tracer, job->coded_image.src_image, job_encoder, *job->options, job->input_class,
+                                         job->coded_image.data, job->coded_image.num_layers);
+
+      {
+#if ENABLE_PARALLEL_TILE_DECODING
+        std::lock_guard<std::mutex> lock(idle_encoders_mutex);
+#endif
+        idle_encoders.push_back(job_encoder);
+      }
+
+      return job_err;
+    });
+  }
+
+  err = coding_tasks.wait();
+
+  for (auto& job_encoder : additional_encoders) {
+    release_encoder(std::move(job_encoder));
+  }
+
+  if (err) {
+    return err;
+  }
+
+  for (auto& job : jobs) {
+    m_precoded_images[job.input_class].push_back(std::move(job.coded_image));
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::encode_image(const std::shared_ptr<HeifPixelImage>& pixel_image,
+                                struct heif_encoder* encoder,
+                                const struct heif_encoding_options& options,
+                                enum heif_image_input_class input_class,
+                                std::shared_ptr<Image>& out_image)
+{
+  Error error = check_canceled(options);
+  if (error) {
+    return error;
+  }
+
+  // TODO: the hdlr box is not the right place for comments
+  // m_heif_file->set_hdlr_library_info(encoder->plugin->get_plugin_name());
+
+  heif_compression_format format = encoder->plugin->compression_format;
+
+  // Not when called for the thumbnail, which has been coded together with the image.
+  bool precode = (options.version >= 7 &&
+                  (options.encode_auxiliary_images_concurrently ||
+                   (options.version >= 8 && options.num_thumbnail_pyramid_levels > 0)) &&
+                  m_precoded_images.empty() &&
+                  (format == heif_compression_HEVC || format == heif_compression_AV1));
+
+  if (precode) {
+    error = precode_images_concurrently({pixel_image}, encoder, {options});
+    if (error) {
+      m_precoded_images.clear();
+      return error;
+    }
+  }
+
+  switch (encoder->plugin->compression_format) {
+    case heif_compression_HEVC: {
+      error = encode_image_as_hevc(pixel_image,
+                                   encoder,
+                                   options,
+                                   heif_image_input_class_normal,
+                                   out_image);
+    }
+      break;
+
+    case heif_compression_AV1: {
+      error = encode_image_as_av1(pixel_image,
+                                  encoder,
+                                  options,
+                                  heif_image_input_class_normal,
+                                  out_image);
+    }
+      break;
+
+    case heif_compression_uncompressed: {
+      error = encode_image_as_uncompressed(pixel_image,
+                                  encoder,
+                                  options,
+                                  heif_image_input_class_normal,
+                                  out_image);
+    }
+      break;
+
+    default:
+      return Error(heif_error_Encoder_plugin_error, heif_suberror_Unsupported_codec);
+  }
+
+  m_heif_file->set_brand(encoder->plugin->compression_format,
+                         out_image->is_miaf_compatible());
+
+  if (!error) {
+    error = encode_thumbnails(pixel_image, encoder, options, out_image);
+  }
+
+  if (precode) {
+    m_precoded_images.clear();
+  }
+
+  return error;
+}
+
+
+Error HeifContext::encode_image_with_target_size(const std::shared_ptr<HeifPixelImage>& pixel_image,
+                                                 struct heif_encoder* encoder,
+                                                 const struct heif_encoding_options& options,
+                                                 size_t target_size,
+                                                 int& out_quality,
+                                                 std::shared_ptr<Image>& out_image)
+{
+  heif_compression_format format = encoder->plugin->compression_format;
+  if (format != heif_compression_HEVC && format != heif_compression_AV1) {
+    return Error(heif_error_Encoder_plugin_error, heif_suberror_Unsupported_codec);
+  }
+
+  std::shared_ptr<HeifPixelImage> src_image;
+  Error err = convert_to_encoder_colorspace(m_tracer, pixel_image, encoder, options, src_image);
+  if (err) {
+    return err;
+  }
+
+
+  // --- one encoder instance per candidate quality that is coded in parallel
+
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
+  size_t num_encoders = thread_pool ? thread_pool->get_num_threads() + 1 : 1;
+
+  std::vector<std::unique_ptr<heif_encoder>> additional_encoders(num_encoders - 1);
+  std::vector<struct heif_encoder*> encoders{encoder};
+
+  for (auto& candidate_encoder : additional_encoders) {
+    err = acquire_encoder(*encoder, candidate_encoder);
+    if (err) {
+      break;
+    }
+
+    encoders.push_back(candidate_encoder.get());
+  }
+
+
+  // --- narrow down the quality range [fitting_quality, oversized_quality]
+  //     The quality range is split at the candidates of each round. The sizes are assumed to grow with the quality.
+
+  int fitting_quality = -1;   // highest quality known to fit into target_size, -1 if none is known yet
+  int oversized_quality = 101; // lowest quality known to exceed target_size
+  CodedImage best_coded_image;
+
+  while (!err && oversized_quality - fitting_quality > 1) {
+    std::vector<int> candidate_qualities;
+    int range = oversized_quality - fitting_quality;
+
+    for (size_t i = 0; i < encoders.size(); i++) {
+      int quality = fitting_quality + static_cast<int>(range * (i + 1) / (encoders.size() + 1));
+      quality = std::max(quality, fitting_quality + 1);
+
+      if (candidate_qualities.empty() || quality > candidate_qualities.back()) {
+        candidate_qualities.push_back(quality);
+      }
+    }
+
+    std::vector<CodedImage> candidates(candidate_qualities.size());
+
+    TaskGroup coding_tasks(thread_pool.get());
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+      coding_tasks.run([&, i]() {
+        struct heif_error quality_err = encoders[i]->plugin->set_parameter_quality(encoders[i]->encoder,
+                                                                                   candidate_qualities[i]);
+        if (quality_err.code) {
+          return Error(quality_err.code, quality_err.subcode, quality_err.message);
+        }
+
+        candidates[i].src_image = src_image;
+        return run_encoder_plugin(m_tracer, src_image, encoders[i], options, heif_image_input_class_normal,
+                                  candidates[i].data, candidates[i].num_layers);
+      });
+    }
+
+    err = coding_tasks.wait();
+    if (err) {
+      break;
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+      size_t coded_size = 0;
+      for (const auto& chunk : candidates[i].data) {
+        coded_size += chunk.size();
+      }
+
+      if (coded_size <= target_size) {
+        fitting_quality = candidate_qualities[i];
+        best_coded_image = std::move(candidates[i]);
+      }
+      else {
+        oversized_quality = candidate_qualities[i];
+        break;
+      }
+    }
+  }
+
+  for (auto& candidate_encoder : additional_encoders) {
+    release_encoder(std::move(candidate_encoder));
+  }
+
+  if (err) {
+    return err;
+  }
+
+  if (fitting_quality < 0) {
+    return Error(heif_error_Encoding_error, heif_suberror_Unspecified,
+                 "Image cannot be coded within the target size");
+  }
+
+
+  // --- add the winning image. Its alpha channel and thumbnails are coded with the same quality.
+
+  struct heif_error quality_err = encoder->plugin->set_parameter_quality(encoder->encoder, fitting_quality);
+  if (quality_err.code) {
+    return Error(quality_err.code, quality_err.subcode, quality_err.message);
+  }
+
+  m_precoded_images[heif_image_input_class_normal].push_back(std::move(best_coded_image));
+
+  err = encode_image(pixel_image, encoder, options, heif_image_input_class_normal, out_image);
+
+  m_precoded_images.clear();
+
+  if (err) {
+    return err;
+  }
+
+  out_quality = fitting_quality;
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::encode_images(const std::vector<std::shared_ptr<HeifPixelImage>>& images,
+                                 struct heif_encoder* encoder,
+                                 const std::vector<heif_encoding_options>& options,
+                                 std::vector<std::shared_ptr<Image>>& out_images)
+{
+  assert(images.size() == options.size());
+
+  out_images.clear();
+
+  heif_compression_format format = encoder->plugin->compression_format;
+
+  // Other formats are not coded through get_coded_image() and are encoded one after another.
+  if (format == heif_compression_HEVC || format == heif_compression_AV1) {
+    Error err = precode_images_concurrently(images, encoder, options);
+    if (err) {
+      m_precoded_images.clear();
+      return err;
+    }
+  }
+
+  Error err;
+
+  for (size_t i = 0; i < images.size(); i++) {
+    std::shared_ptr<Image> image;
+    err = encode_image(images[i], encoder, options[i], heif_image_input_class_normal, image);
+    if (err) {
+      break;
+    }
+
+    out_images.push_back(image);
+  }
+
+  m_precoded_images.clear();
+
+  return err;
+}
+
+
+Error HeifContext::encode_grid(const std::shared_ptr<HeifPixelImage>& image,
+                               uint32_t tile_width, uint32_t tile_height,
+                               struct heif_encoder* encoder,
+                               const struct heif_encoding_options& options,
+                               std::shared_ptr<Image>& out_image)
+{
+  auto get_tile_row_source = [&image](uint32_t, std::shared_ptr<HeifPixelImage>& source, uint32_t& source_top) {
+    source = image;
+    source_top = 0;
+    return Error::Ok;
+  };
+
+  Error err = encode_grid_tiles(image->get_width(), image->get_height(), tile_width, tile_height,
+                                encoder, options, get_tile_row_source, false, out_image);
+  if (err) {
+    return err;
+  }
+
+  return encode_thumbnails(image, encoder, options, out_image);
+}
+
+
+Error HeifContext::encode_grid_from_bands(uint32_t image_width, uint32_t image_height,
+                                          uint32_t tile_width, uint32_t tile_height,
+                                          struct heif_encoder* encoder,
+                                          const struct heif_encoding_options& options,
+                                          const std::function<Error(uint32_t y, uint32_t height,
+                                                                    std::shared_ptr<HeifPixelImage>& band)>& get_band,
+                                          std::shared_ptr<Image>& out_image)
+{
+  if (image_width == 0 || image_height == 0) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 "Grid image size must not be zero");
+  }
+
+  std::shared_ptr<HeifPixelImage> first_band;
+
+  auto get_tile_row_source = [&](uint32_t row, std::shared_ptr<HeifPixelImage>& source, uint32_t& source_top) {
+    source_top = row * tile_height;
+    uint32_t height = std::min(tile_height, image_height - source_top);
+
+    Error err = get_band(source_top, height, source);
+    if (err) {
+      return err;
+    }
+
+    if (!source ||
+        static_cast<uint32_t>(source->get_width()) != image_width ||
+        static_cast<uint32_t>(source->get_height()) != height) {
+      std::stringstream sstr;
+      sstr << "Band at row " << source_top << " must have the size " << image_width << "x" << height;
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Invalid_parameter_value,
+                   sstr.str());
+    }
+
+    // all tiles get the properties of the first tile
+    if (!first_band) {
+      first_band = source;
+    }
+    else if (source->get_colorspace() != first_band->get_colorspace() ||
+             source->get_chroma_format() != first_band->get_chroma_format() ||
+             source->has_alpha() != first_band->has_alpha()) {
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Invalid_parameter_value,
+                   "All bands must have the same colorspace, chroma format and alpha channel");
+    }
+
+    return Error::Ok;
+  };
+
+  return encode_grid_tiles(image_width, image_height, tile_width, tile_height,
+                           encoder, options, get_tile_row_source, true, out_image);
+}
 
-  auto iref_box = m_heif_file->get_iref_box();
 
-  if (!iref_box) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_No_iref_box,
-                 "No iref box available, but needed for iden image");
+Error HeifContext::encode_grid_tiles(uint32_t image_width, uint32_t image_height,
+                                     uint32_t tile_width, uint32_t tile_height,
+                                     struct heif_encoder* encoder,
+                                     const struct heif_encoding_options& options,
+                                     const std::function<Error(uint32_t row, std::shared_ptr<HeifPixelImage>& source,
+                                                               uint32_t& source_top)>& get_tile_row_source,
+                                     bool one_tile_row_at_a_time,
+                                     std::shared_ptr<Image>& out_image)
+{
+  if (tile_width == 0 || tile_height == 0) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 "Grid tile size must not be zero");
   }
 
-  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+  uint32_t columns = (image_width + tile_width - 1) / tile_width;
+  uint32_t rows = (image_height + tile_height - 1) / tile_height;
 
-  if ((int) image_references.size() != 1) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_Missing_grid_images,
-                 "'iden' image with more than one reference image");
+  if (columns > 256 || rows > 256) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 "A grid image can have at most 256x256 tiles");
   }
 
+  size_t num_tiles = columns * rows;
 
-  heif_item_id reference_image_id = image_references[0];
 
+  // --- create one encoder instance for each thread that can encode a tile
 
-  Error error = decode_image_planar(reference_image_id, img,
-                                    heif_colorspace_RGB, options, false); // TODO: always RGB ?
-  return error;
-}
+  std::shared_ptr<ThreadPool> thread_pool = get_thread_pool();
 
+  size_t num_encoders = std::min(num_tiles, size_t(thread_pool ? thread_pool->get_num_threads() + 1 : 1));
 
-Error HeifContext::decode_overlay_image(heif_item_id ID,
-                                        std::shared_ptr<HeifPixelImage>& img,
-                                        const std::vector<uint8_t>& overlay_data,
-                                        const heif_decoding_options& options) const
-{
-  // find the IDs this image is composed of
+  // The additional instances are taken from the context's encoder pool and returned afterwards.
+  std::vector<std::unique_ptr<heif_encoder>> additional_encoders(num_encoders - 1);
+  std::vector<struct heif_encoder*> idle_encoders{encoder};
 
-  auto iref_box = m_heif_file->get_iref_box();
+  for (auto& tile_encoder : additional_encoders) {
+    Error err = acquire_encoder(*encoder, tile_encoder);
+    if (err) {
+      return err;
+    }
 
-  if (!iref_box) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_No_iref_box,
-                 "No iref box available, but needed for iovl image");
+    idle_encoders.push_back(tile_encoder.get());
   }
 
-  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::mutex idle_encoders_mutex;
+#endif
 
-  /* TODO: probably, it is valid that an iovl image has no references ?
 
-  if (image_references.empty()) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_Missing_grid_images,
-                 "'iovl' image with more than one reference image");
-  }
-  */
+  // --- encode each tile into a separate context
 
+  struct EncodedTile
+  {
+    std::shared_ptr<HeifContext> context;
+    std::shared_ptr<Image> image;
+    std::shared_ptr<Image> alpha_image;
+  };
 
-  ImageOverlay overlay;
-  Error err = overlay.parse(image_references.size(), overlay_data);
-  if (err) {
-    return err;
-  }
+  std::vector<EncodedTile> tiles(num_tiles);
 
-  if (image_references.size() != overlay.get_num_offsets()) {
-    return Error(heif_error_Invalid_input,
-                 heif_suberror_Invalid_overlay_data,
-                 "Number of image offsets does not match the number of image references");
-  }
+  // The orientation and the thumbnail are stored at the grid image.
+  heif_encoding_options tile_options = options;
+  tile_options.image_orientation = heif_orientation_normal;
+  tile_options.thumbnail_bbox_size = 0;
+  tile_options.num_thumbnail_pyramid_levels = 0;
+  tile_options.encode_auxiliary_images_concurrently = false; // the tiles are already encoded in parallel
 
-  uint32_t w = overlay.get_canvas_width();
-  uint32_t h = overlay.get_canvas_height();
+  auto encode_tile = [&](uint32_t column, uint32_t row, const std::shared_ptr<HeifPixelImage>& image,
+                         uint32_t image_top, struct heif_encoder* tile_encoder) -> Error {
+    Error cancel_err = check_canceled(tile_options);
+    if (cancel_err) {
+      return cancel_err;
+    }
 
-  if (w >= m_maximum_image_width_limit || h >= m_maximum_image_height_limit) {
-    std::stringstream sstr;
-    sstr << "Image size " << w << "x" << h << " exceeds the maximum image size "
-         << m_maximum_image_width_limit << "x" << m_maximum_image_height_limit << "\n";
+    uint32_t left = column * tile_width;
+    uint32_t top = row * tile_height;
+    uint32_t right = std::min(left + tile_width, image_width) - 1;
+    uint32_t bottom = std::min(top + tile_height, image_height) - 1;
 
-    return Error(heif_error_Memory_allocation_error,
-                 heif_suberror_Security_limit_exceeded,
-                 sstr.str());
-  }
+    std::shared_ptr<HeifPixelImage> tile_img;
+    Error err = image->crop(left, right, top - image_top, bottom - image_top, tile_img);
+    if (err) {
+      return err;
+    }
 
-  // TODO: seems we always have to compose this in RGB since the background color is an RGB value
-  img = std::make_shared<HeifPixelImage>();
-  img->create(w, h,
-              heif_colorspace_RGB,
-              heif_chroma_444);
-  img->add_plane(heif_channel_R, w, h, 8); // TODO: other bit depths
-  img->add_plane(heif_channel_G, w, h, 8); // TODO: other bit depths
-  img->add_plane(heif_channel_B, w, h, 8); // TODO: other bit depths
+    // all tiles must have the same size, the border tiles are padded
+    if (!tile_img->extend_to_size_with_padding(tile_width, tile_height)) {
+      return Error(heif_error_Memory_allocation_error,
+                   heif_suberror_Unspecified);
+    }
 
-  uint16_t bkg_color[4];
-  overlay.get_background_color(bkg_color);
+    uint32_t h_spacing, v_spacing;
+    image->get_pixel_ratio(&h_spacing, &v_spacing);
+    tile_img->set_pixel_ratio(h_spacing, v_spacing);
+    tile_img->set_premultiplied_alpha(image->is_premultiplied_alpha());
 
-  err = img->fill_RGB_16bit(bkg_color[0], bkg_color[1], bkg_color[2], bkg_color[3]);
-  if (err) {
-    return err;
-  }
+    if (image->has_clli()) {
+      tile_img->set_clli(image->get_clli());
+    }
+
+    if (image->has_mdcv()) {
+      tile_img->set_mdcv(image->get_mdcv());
+    }
 
+    EncodedTile& tile = tiles[row * columns + column];
+    tile.context = std::make_shared<HeifContext>();
+    tile.context->m_tracer = m_tracer;
 
-  for (size_t i = 0; i < image_references.size(); i++) {
-    std::shared_ptr<HeifPixelImage> overlay_img;
-    err = decode_image_planar(image_references[i], overlay_img,
-                              heif_colorspace_RGB, options, false); // TODO: always RGB? Probably yes, because of RGB background color.
-    if (err != Error::Ok) {
+    err = tile.context->encode_image(tile_img, tile_encoder, tile_options, heif_image_input_class_normal, tile.image);
+    if (err) {
       return err;
     }
 
-    overlay_img = convert_colorspace(overlay_img, heif_colorspace_RGB, heif_chroma_444, nullptr, 0, options.color_conversion_options);
-    if (!overlay_img) {
-      return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
+    auto tile_iref = tile.context->m_heif_file->get_iref_box();
+    for (const auto& tile_context_image : tile.context->m_all_images) {
+      std::vector<heif_item_id> aux_of;
+      if (tile_iref) {
+        aux_of = tile_iref->get_references(tile_context_image.first, fourcc("auxl"));
+      }
+
+      if (!aux_of.empty() && aux_of[0] == tile.image->get_id()) {
+        tile.alpha_image = tile_context_image.second;
+      }
     }
 
-    int32_t dx, dy;
-    overlay.get_offset(i, &dx, &dy);
+    return Error::Ok;
+  };
 
-    err = img->overlay(overlay_img, dx, dy);
+  // --- copy the encoded tiles into this file in grid order
+
+  HeifFile::CopyMap copy_map;
+  std::vector<heif_item_id> tile_ids;
+  std::vector<heif_item_id> alpha_tile_ids;
+  bool miaf_compatible = true;
+
+  auto copy_tile = [&](EncodedTile& tile) -> Error {
+    // the item IDs and property indices refer to the file of the tile
+    copy_map.items.clear();
+    copy_map.properties.clear();
+
+    heif_item_id tile_id;
+    Error err = m_heif_file->copy_item_from(*tile.context->m_heif_file, tile.image->get_id(), copy_map, &tile_id);
     if (err) {
-      if (err.error_code == heif_error_Invalid_input &&
-          err.sub_error_code == heif_suberror_Overlay_image_outside_of_canvas) {
-        // NOP, ignore this error
+      return err;
+    }
 
-        err = Error::Ok;
-      }
-      else {
+    m_heif_file->get_infe_box(tile_id)->set_hidden_item(true);
+    tile_ids.push_back(tile_id);
+
+    if (tile.alpha_image) {
+      heif_item_id alpha_tile_id;
+      err = m_heif_file->copy_item_from(*tile.context->m_heif_file, tile.alpha_image->get_id(), copy_map, &alpha_tile_id);
+      if (err) {
         return err;
       }
-    }
-  }
-
-  return err;
-}
 
+      m_heif_file->get_infe_box(alpha_tile_id)->set_hidden_item(true);
+      alpha_tile_ids.push_back(alpha_tile_id);
+    }
 
-static std::shared_ptr<HeifPixelImage>
-create_alpha_image_from_image_alpha_channel(const std::shared_ptr<HeifPixelImage>& image)
-{
-  // --- generate alpha image
+    if (!tile.image->is_miaf_compatible()) {
+      miaf_compatible = false;
+    }
 
-  std::shared_ptr<HeifPixelImage> alpha_image = std::make_shared<HeifPixelImage>();
-  alpha_image->create(image->get_width(), image->get_height(),
-                      heif_colorspace_monochrome, heif_chroma_monochrome);
-  alpha_image->copy_new_plane_from(image, heif_channel_Alpha, heif_channel_Y);
+    // the coded data is in this file now
+    tile = EncodedTile();
 
+    return Error::Ok;
+  };
 
-  // --- set nclx profile with full-range flag
 
-  auto nclx = std::make_shared<color_profile_nclx>();
-  nclx->set_undefined();
-  nclx->set_full_range_flag(true); // this is the default, but just to be sure in case the defaults change
-  alpha_image->set_color_profile_nclx(nclx);
+  // --- encode the tiles, either all at once or one tile row after the other
 
-  return alpha_image;
-}
+  bool premultiplied_alpha = false;
 
+  uint32_t rows_per_batch = (one_tile_row_at_a_time ? 1 : rows);
+  Error err;
 
-void HeifContext::Image::set_preencoded_hevc_image(const std::vector<uint8_t>& data)
-{
-  m_heif_context->m_heif_file->add_hvcC_property(m_id);
+  for (uint32_t first_row = 0; first_row < rows && !err; first_row += rows_per_batch) {
+    uint32_t end_row = std::min(first_row + rows_per_batch, rows);
 
+    // Tiles are encoded on the context's thread pool. Without a pool, they are encoded in this thread.
+    TaskGroup tile_tasks(thread_pool.get());
 
-  // --- parse the h265 stream and set hvcC headers and compressed image data
+    for (uint32_t row = first_row; row < end_row; row++) {
+      std::shared_ptr<HeifPixelImage> source;
+      uint32_t source_top = 0;
+      err = get_tile_row_source(row, source, source_top);
+      if (err) {
+        break;
+      }
 
-  int state = 0;
+      if (row == 0) {
+        premultiplied_alpha = source->is_premultiplied_alpha();
+      }
 
-  bool first = true;
-  bool eof = false;
+      for (uint32_t column = 0; column < columns; column++) {
+        tile_tasks.run([&, column, row, source, source_top]() {
+          struct heif_encoder* tile_encoder;
 
-  int prev_start_code_start = -1; // init to an invalid value, will always be overwritten before use
-  int start_code_start;
-  int ptr = 0;
+          {
+#if ENABLE_PARALLEL_TILE_DECODING
+            std::lock_guard<std::mutex> lock(idle_encoders_mutex);
+#endif
+            // there are as many encoders as tiles can be encoded concurrently
+            assert(!idle_encoders.empty());
+            tile_encoder = idle_encoders.back();
+            idle_encoders.pop_back();
+          }
 
-  for (;;) {
-    bool dump_nal = false;
+          Error tile_err = encode_tile(column, row, source, source_top, tile_encoder);
 
-    uint8_t c = data[ptr++];
+          {
+#if ENABLE_PARALLEL_TILE_DECODING
+            std::lock_guard<std::mutex> lock(idle_encoders_mutex);
+#endif
+            idle_encoders.push_back(tile_encoder);
+          }
 
-    if (state == 3) {
-      state = 0;
+          return tile_err;
+        });
+      }
     }
 
-    if (c == 0 && state <= 1) {
-      state++;
-    }
-    else if (c == 0) {
-      // NOP
-    }
-    else if (c == 1 && state == 2) {
-      start_code_start = ptr - 3;
-      dump_nal = true;
-      state = 3;
-    }
-    else {
-      state = 0;
+    Error tasks_err = tile_tasks.wait();
+    if (!err) {
+      err = tasks_err;
     }
 
-    if (ptr == (int) data.size()) {
-      start_code_start = (int) data.size();
-      dump_nal = true;
-      eof = true;
+    for (size_t i = size_t{first_row} * columns; i < size_t{end_row} * columns && !err; i++) {
+      err = copy_tile(tiles[i]);
     }
+  }
 
-    if (dump_nal) {
-      if (first) {
-        first = false;
-      }
-      else {
-        std::vector<uint8_t> nal_data;
-        size_t length = start_code_start - (prev_start_code_start + 3);
+  for (auto& tile_encoder : additional_encoders) {
+    release_encoder(std::move(tile_encoder));
+  }
 
-        nal_data.resize(length);
+  if (err) {
+    return err;
+  }
 
-        assert(prev_start_code_start >= 0);
-        memcpy(nal_data.data(), data.data() + prev_start_code_start + 3, length);
+  if (!alpha_tile_ids.empty() && alpha_tile_ids.size() != tile_ids.size()) {
+    return Error(heif_error_Encoder_plugin_error,
+                 heif_suberror_Unspecified,
+                 "Alpha channel was not encoded for all grid tiles");
+  }
 
-        int nal_type = (nal_data[0] >> 1);
 
-        switch (nal_type) {
-          case 0x20:
-          case 0x21:
-          case 0x22:
-            m_heif_context->m_heif_file->append_hvcC_nal_data(m_id, nal_data);
-            /*hvcC->append_nal_data(nal_data);*/
-            break;
+  // --- create the grid image
 
-          default: {
-            std::vector<uint8_t> nal_data_with_size;
-            nal_data_with_size.resize(nal_data.size() + 4);
+  ImageGrid grid;
+  grid.set_num_tiles(static_cast<uint16_t>(columns), static_cast<uint16_t>(rows));
+  grid.set_output_size(image_width, image_height);
+  std::vector<uint8_t> grid_data = grid.write();
 
-            memcpy(nal_data_with_size.data() + 4, nal_data.data(), nal_data.size());
-            nal_data_with_size[0] = ((nal_data.size() >> 24) & 0xFF);
-            nal_data_with_size[1] = ((nal_data.size() >> 16) & 0xFF);
-            nal_data_with_size[2] = ((nal_data.size() >> 8) & 0xFF);
-            nal_data_with_size[3] = ((nal_data.size() >> 0) & 0xFF);
+  auto add_grid_item = [&](const std::vector<heif_item_id>& tiles_of_grid,
+                           const std::vector<uint32_t>& tile_properties) {
+    heif_item_id grid_id = m_heif_file->add_new_image("grid");
+    m_heif_file->append_iloc_data(grid_id, grid_data, 1);
+    m_heif_file->add_iref_reference(grid_id, fourcc("dimg"), tiles_of_grid);
 
-            m_heif_context->m_heif_file->append_iloc_data(m_id, nal_data_with_size);
-          }
-            break;
-        }
-      }
+    // Note: 'ispe' must be before the transformation properties
+    m_heif_file->add_ispe_property(grid_id, image_width, image_height);
 
-      prev_start_code_start = start_code_start;
-    }
+    // all tiles have the same properties
+    m_heif_file->share_properties(tiles_of_grid[0], grid_id, tile_properties);
 
-    if (eof) {
-      break;
-    }
+    auto grid_image = std::make_shared<Image>(this, grid_id);
+    grid_image->set_size(image_width, image_height);
+
+    m_top_level_images.push_back(grid_image);
+    m_all_images[grid_id] = grid_image;
+
+    return grid_image;
+  };
+
+  out_image = add_grid_item(tile_ids, {fourcc("colr"), fourcc("pixi"), fourcc("pasp"),
+                                       fourcc("clli"), fourcc("mdcv")});
+
+  m_heif_file->add_orientation_properties(out_image->get_id(), options.image_orientation);
+
+  if (!miaf_compatible) {
+    out_image->mark_not_miaf_compatible();
   }
-}
 
 
-Error HeifContext::encode_image(const std::shared_ptr<HeifPixelImage>& pixel_image,
-                                struct heif_encoder* encoder,
-                                const struct heif_encoding_options& options,
-                                enum heif_image_input_class input_class,
-                                std::shared_ptr<Image>& out_image)
-{
-  Error error;
+  // --- the alpha tiles are combined into a grid image, too
 
-  // TODO: the hdlr box is not the right place for comments
-  // m_heif_file->set_hdlr_library_info(encoder->plugin->get_plugin_name());
+  if (!alpha_tile_ids.empty()) {
+    std::shared_ptr<Image> alpha_image = add_grid_item(alpha_tile_ids, {fourcc("auxC"), fourcc("pixi")});
+    m_heif_file->add_orientation_properties(alpha_image->get_id(), options.image_orientation);
 
-  switch (encoder->plugin->compression_format) {
-    case heif_compression_HEVC: {
-      error = encode_image_as_hevc(pixel_image,
-                                   encoder,
-                                   options,
-                                   heif_image_input_class_normal,
-                                   out_image);
-    }
-      break;
+    m_heif_file->add_iref_reference(alpha_image->get_id(), fourcc("auxl"), {out_image->get_id()});
 
-    case heif_compression_AV1: {
-      error = encode_image_as_av1(pixel_image,
-                                  encoder,
-                                  options,
-                                  heif_image_input_class_normal,
-                                  out_image);
-    }
-      break;
+    alpha_image->set_is_alpha_channel_of(out_image->get_id(), true);
+    out_image->set_alpha_channel(alpha_image);
 
-    case heif_compression_uncompressed: {
-      error = encode_image_as_uncompressed(pixel_image,
-                                  encoder,
-                                  options,
-                                  heif_image_input_class_normal,
-                                  out_image);
+    if (premultiplied_alpha) {
+      m_heif_file->add_iref_reference(out_image->get_id(), fourcc("prem"), {alpha_image->get_id()});
+      out_image->set_is_premultiplied_alpha(true);
     }
-      break;
-
-    default:
-      return Error(heif_error_Encoder_plugin_error, heif_suberror_Unsupported_codec);
   }
 
   m_heif_file->set_brand(encoder->plugin->compression_format,
                          out_image->is_miaf_compatible());
 
-  return error;
+  return Error::Ok;
 }
 
 /*
@@ -2176,7 +6811,18 @@ void HeifContext::write_image_metadata(std::shared_ptr<HeifPixelImage> src_image
 
   if (src_image->get_chroma_format() == heif_chroma_monochrome) {
     m_heif_file->add_pixi_property(image_id,
-                                   src_image->get_bits_per_pixel(heif_channel_Y), 0, 0);
+                                   src_image->get_bits_per_pixel(heif_channel_Y), 0, 0);
+  }
+  else if (src_image->get_colorspace() == heif_colorspace_RGB &&
+           src_image->has_channel(heif_channel_interleaved)) {
+    uint8_t bpp = src_image->get_bits_per_pixel(heif_channel_interleaved);
+    m_heif_file->add_pixi_property(image_id, bpp, bpp, bpp);
+  }
+  else if (src_image->get_colorspace() == heif_colorspace_RGB) {
+    m_heif_file->add_pixi_property(image_id,
+                                   src_image->get_bits_per_pixel(heif_channel_R),
+                                   src_image->get_bits_per_pixel(heif_channel_G),
+                                   src_image->get_bits_per_pixel(heif_channel_B));
   }
   else {
     m_heif_file->add_pixi_property(image_id,
@@ -2228,37 +6874,18 @@ Error HeifContext::encode_image_as_hevc(const std::shared_ptr<HeifPixelImage>& i
   heif_item_id image_id = m_heif_file->add_new_image("hvc1");
   out_image = std::make_shared<Image>(this, image_id);
 
-
-  // --- check whether we have to convert the image color space
-
-  heif_colorspace colorspace = image->get_colorspace();
-  heif_chroma chroma = image->get_chroma_format();
   auto nclx_profile = image->get_color_profile_nclx();
   if (!nclx_profile) {
     nclx_profile = std::make_shared<color_profile_nclx>();
   }
 
-  if (encoder->plugin->plugin_api_version >= 2) {
-    encoder->plugin->query_input_colorspace2(encoder->encoder, &colorspace, &chroma);
-  }
-  else {
-    encoder->plugin->query_input_colorspace(&colorspace, &chroma);
+  CodedImage coded_image;
+  Error coding_error = get_coded_image(image, encoder, options, input_class, coded_image);
+  if (coding_error) {
+    return coding_error;
   }
 
-  std::shared_ptr<HeifPixelImage> src_image;
-  if (colorspace != image->get_colorspace() ||
-      chroma != image->get_chroma_format()) {
-    // @TODO: use color profile when converting
-    int output_bpp = 0; // same as input
-    src_image = convert_colorspace(image, colorspace, chroma, nclx_profile,
-                                   output_bpp, options.color_conversion_options);
-    if (!src_image) {
-      return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
-    }
-  }
-  else {
-    src_image = image;
-  }
+  std::shared_ptr<HeifPixelImage> src_image = coded_image.src_image;
 
 
   out_image->set_size(src_image->get_width(heif_channel_Y),
@@ -2268,28 +6895,21 @@ Error HeifContext::encode_image_as_hevc(const std::shared_ptr<HeifPixelImage>& i
   m_heif_file->add_hvcC_property(image_id);
 
 
-  heif_image c_api_image;
-  c_api_image.image = src_image;
-
-  struct heif_error err = encoder->plugin->encode_image(encoder->encoder, &c_api_image, input_class);
-  if (err.code) {
-    return Error(err.code,
-                 err.subcode,
-                 err.message);
-  }
-
   int encoded_width = 0;
   int encoded_height = 0;
 
-  for (;;) {
-    uint8_t* data;
-    int size;
+  // All NALs except the parameter sets are stored as one extent, each prefixed with its 4-byte size.
+  size_t image_data_size = 0;
+  for (const auto& packet : coded_image.data) {
+    image_data_size += packet.size() + 4;
+  }
 
-    encoder->plugin->get_compressed_data(encoder->encoder, &data, &size, NULL);
+  std::vector<uint8_t> image_data;
+  image_data.reserve(image_data_size);
 
-    if (data == NULL) {
-      break;
-    }
+  for (const auto& packet : coded_image.data) {
+    const uint8_t* data = packet.data();
+    int size = static_cast<int>(packet.size());
 
 
     const uint8_t NAL_SPS = 33;
@@ -2310,10 +6930,18 @@ Error HeifContext::encode_image_as_hevc(const std::shared_ptr<HeifPixelImage>& i
         break;
 
       default:
-        m_heif_file->append_iloc_data_with_4byte_size(image_id, data, size);
+        image_data.push_back(static_cast<uint8_t>((size >> 24) & 0xFF));
+        image_data.push_back(static_cast<uint8_t>((size >> 16) & 0xFF));
+        image_data.push_back(static_cast<uint8_t>((size >> 8) & 0xFF));
+        image_data.push_back(static_cast<uint8_t>((size >> 0) & 0xFF));
+        image_data.insert(image_data.end(), data, data + size);
     }
   }
 
+  coded_image.data.clear();
+
+  m_heif_file->append_iloc_data(image_id, std::move(image_data));
+
   if (!encoded_width || !encoded_height) {
     return Error(heif_error_Encoder_plugin_error,
                  heif_suberror_Invalid_image_size);
@@ -2392,7 +7020,6 @@ Error HeifContext::encode_image_as_hevc(const std::shared_ptr<HeifPixelImage>& i
   if (options.save_alpha_channel && src_image->has_channel(heif_channel_Alpha)) {
 
     // --- generate alpha image
-    // TODO: can we directly code a monochrome image instead of the dummy color channels?
 
     std::shared_ptr<HeifPixelImage> alpha_image;
     alpha_image = create_alpha_image_from_image_alpha_channel(src_image);
@@ -2437,37 +7064,19 @@ Error HeifContext::encode_image_as_av1(const std::shared_ptr<HeifPixelImage>& im
   m_top_level_images.push_back(out_image);
   m_all_images[image_id] = out_image;
 
-  // --- check whether we have to convert the image color space
-
-  heif_colorspace colorspace = image->get_colorspace();
-  heif_chroma chroma = image->get_chroma_format();
   auto color_profile = image->get_color_profile_nclx();
   if (!color_profile) {
     color_profile = std::make_shared<color_profile_nclx>();
   }
   auto nclx_profile = std::dynamic_pointer_cast<const color_profile_nclx>(color_profile);
 
-  if (encoder->plugin->plugin_api_version >= 2) {
-    encoder->plugin->query_input_colorspace2(encoder->encoder, &colorspace, &chroma);
-  }
-  else {
-    encoder->plugin->query_input_colorspace(&colorspace, &chroma);
+  CodedImage coded_image;
+  Error coding_error = get_coded_image(image, encoder, options, input_class, coded_image);
+  if (coding_error) {
+    return coding_error;
   }
 
-  std::shared_ptr<HeifPixelImage> src_image;
-  if (colorspace != image->get_colorspace() ||
-      chroma != image->get_chroma_format()) {
-    // @TODO: use color profile when converting
-    int output_bpp = 0; // same as input
-    src_image = convert_colorspace(image, colorspace, chroma, nclx_profile,
-                                   output_bpp, options.color_conversion_options);
-    if (!src_image) {
-      return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion);
-    }
-  }
-  else {
-    src_image = image;
-  }
+  std::shared_ptr<HeifPixelImage> src_image = coded_image.src_image;
 
 
   // --- choose which color profile to put into 'colr' box
@@ -2491,7 +7100,6 @@ Error HeifContext::encode_image_as_av1(const std::shared_ptr<HeifPixelImage>& im
   if (options.save_alpha_channel && src_image->has_channel(heif_channel_Alpha)) {
 
     // --- generate alpha image
-    // TODO: can we directly code a monochrome image instead of the dummy color channels?
 
     std::shared_ptr<HeifPixelImage> alpha_image;
     alpha_image = create_alpha_image_from_image_alpha_channel(src_image);
@@ -2523,34 +7131,30 @@ Error HeifContext::encode_image_as_av1(const std::shared_ptr<HeifPixelImage>& im
   // TODO: maybe we can remove this later.
   fill_av1C_configuration(&config, src_image);
 
-  heif_image c_api_image;
-  c_api_image.image = src_image;
+  // --- progressive images: store the layer sizes such that decoders can read only the first layers
 
-  struct heif_error err = encoder->plugin->encode_image(encoder->encoder, &c_api_image, input_class);
-  if (err.code) {
-    return Error(err.code,
-                 err.subcode,
-                 err.message);
-  }
+  if (coded_image.num_layers > 1) {
+    if (coded_image.num_layers > 4 ||
+        coded_image.data.size() != static_cast<size_t>(coded_image.num_layers)) {
+      return Error(heif_error_Encoder_plugin_error,
+                   heif_suberror_Unspecified,
+                   "Encoder plugin returned an invalid number of layers");
+    }
 
-  for (;;) {
-    uint8_t* data;
-    int size;
+    // the size of the last layer is not stored
+    std::vector<uint32_t> layer_sizes;
+    for (int i = 0; i < coded_image.num_layers - 1; i++) {
+      layer_sizes.push_back(static_cast<uint32_t>(coded_image.data[i].size()));
+    }
 
-    encoder->plugin->get_compressed_data(encoder->encoder, &data, &size, nullptr);
+    m_heif_file->add_a1lx_property(image_id, layer_sizes);
+  }
 
-    bool found_config = fill_av1C_configuration_from_stream(&config, data, size);
+  for (auto& packet : coded_image.data) {
+    bool found_config = fill_av1C_configuration_from_stream(&config, packet.data(), static_cast<int>(packet.size()));
     (void) found_config;
 
-    if (data == nullptr) {
-      break;
-    }
-
-    std::vector<uint8_t> vec;
-    vec.resize(size);
-    memcpy(vec.data(), data, size);
-
-    m_heif_file->append_iloc_data(image_id, vec);
+    m_heif_file->append_iloc_data(image_id, std::move(packet));
   }
 
   m_heif_file->add_av1C_property(image_id);
@@ -2595,28 +7199,118 @@ Error HeifContext::encode_image_as_av1(const std::shared_ptr<HeifPixelImage>& im
 }
 
 
-Error HeifContext::encode_image_as_uncompressed(const std::shared_ptr<HeifPixelImage>& src_image,
+Error HeifContext::add_jpeg_image(const uint8_t* data, size_t size, std::shared_ptr<Image>& out_image)
+{
+  JpegHeaderInfo info;
+  Error err = parse_jpeg_headers(data, size, info);
+  if (err) {
+    return err;
+  }
+
+  if (info.width > m_maximum_image_width_limit || info.height > m_maximum_image_height_limit) {
+    std::stringstream sstr;
+    sstr << "Image size " << info.width << "x" << info.height << " exceeds the maximum image size "
+         << m_maximum_image_width_limit << "x" << m_maximum_image_height_limit << "\n";
+
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 sstr.str());
+  }
+
+  heif_item_id image_id = m_heif_file->add_new_image("jpeg");
+  out_image = std::make_shared<Image>(this, image_id);
+  out_image->set_size(static_cast<int>(info.width), static_cast<int>(info.height));
+
+  // The complete JPEG file is the item data, hence no 'jpgC' property is needed.
+  m_heif_file->append_iloc_data(image_id, std::vector<uint8_t>(data, data + size));
+
+  // Note: 'ispe' must be before the transformation properties
+  m_heif_file->add_ispe_property(image_id, info.width, info.height);
+
+  // HEIF readers do not apply the Exif orientation of the JPEG data.
+  m_heif_file->add_orientation_properties(image_id, info.orientation);
+
+  // The YCbCr conversion of JFIF files is reported by the decoder. Only the ICC profile has to be stored.
+  if (!info.icc_profile.empty()) {
+    auto icc = std::make_shared<color_profile_raw>(fourcc("prof"), info.icc_profile);
+    m_heif_file->set_color_profile(image_id, icc);
+    out_image->set_color_profile(icc);
+  }
+
+  // MIAF does not include JPEG as a coding format.
+  out_image->mark_not_miaf_compatible();
+
+  m_heif_file->set_brand(heif_compression_JPEG, false);
+
+  m_top_level_images.push_back(out_image);
+  m_all_images[image_id] = out_image;
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::encode_image_as_uncompressed(const std::shared_ptr<HeifPixelImage>& image,
                                                 struct heif_encoder* encoder,
                                                 const struct heif_encoding_options& options,
                                                 enum heif_image_input_class input_class,
-                                                std::shared_ptr<Image> out_image)
+                                                std::shared_ptr<Image>& out_image)
 {
 #if WITH_UNCOMPRESSED_CODEC
   heif_item_id image_id = m_heif_file->add_new_image("unci");
   out_image = std::make_shared<Image>(this, image_id);
-
-  Error err = UncompressedImageCodec::encode_uncompressed_image(m_heif_file,
-                                                                src_image,
-                                                                encoder->encoder,
-                                                                options,
-                                                                out_image);
-
   m_top_level_images.push_back(out_image);
   m_all_images[image_id] = out_image;
-#endif
-  //write_image_metadata(src_image, image_id);
+
+  std::shared_ptr<HeifPixelImage> src_image;
+  Error err = convert_to_encoder_colorspace(m_tracer, image, encoder, options, src_image);
+  if (err) {
+    return err;
+  }
+
+  // Alpha is stored as a component of the image, not as an auxiliary image.
+  {
+    TraceScope encode_trace(m_tracer, heif_trace_stage_encode, image_id);
+
+    err = UncompressedImageCodec::encode_uncompressed_image(m_heif_file,
+                                                            image_id,
+                                                            src_image,
+                                                            encoder->encoder,
+                                                            options,
+                                                            get_thread_pool().get());
+    if (err) {
+      return err;
+    }
+  }
+
+  m_heif_file->add_orientation_properties(image_id, options.image_orientation);
+
+  // 'unci' is not a MIAF coding format
+  out_image->mark_not_miaf_compatible();
+
+
+  // --- choose which color profile to put into 'colr' box
+
+  if (input_class == heif_image_input_class_normal || input_class == heif_image_input_class_thumbnail) {
+    auto icc_profile = src_image->get_color_profile_icc();
+    if (icc_profile) {
+      m_heif_file->set_color_profile(image_id, icc_profile);
+    }
+
+    auto nclx_profile = src_image->get_color_profile_nclx();
+    if (nclx_profile &&
+        (!icc_profile || (options.version >= 3 &&
+                          options.save_two_colr_boxes_when_ICC_and_nclx_available))) {
+      m_heif_file->set_color_profile(image_id, nclx_profile);
+    }
+  }
+
+  write_image_metadata(src_image, image_id);
 
   return Error::Ok;
+#else
+  return Error(heif_error_Unsupported_feature,
+               heif_suberror_Unsupported_codec);
+#endif
 }
 
 
@@ -2663,6 +7357,125 @@ Error HeifContext::assign_thumbnail(const std::shared_ptr<Image>& master_image,
 }
 
 
+// Compression format of a coded image or, for derived images, of its first coded input image.
+static heif_compression_format get_item_compression_format(const std::shared_ptr<HeifFile>& file, heif_item_id ID)
+{
+  for (int depth = 0; depth < 8; depth++) {
+    std::string item_type = file->get_item_type(ID);
+    if (item_type == "hvc1") {
+      return heif_compression_HEVC;
+    }
+    else if (item_type == "av01") {
+      return heif_compression_AV1;
+    }
+    else if (item_type == "jpeg") {
+      return heif_compression_JPEG;
+    }
+
+    auto iref = file->get_iref_box();
+    if (!iref) {
+      break;
+    }
+
+    std::vector<heif_item_id> inputs = iref->get_references(ID, fourcc("dimg"));
+    if (inputs.empty()) {
+      break;
+    }
+
+    ID = inputs[0];
+  }
+
+  return heif_compression_undefined;
+}
+
+
+Error HeifContext::copy_image_from(const HeifContext& src, heif_item_id ID, std::shared_ptr<Image>& out_image)
+{
+  auto src_iter = src.m_all_images.find(ID);
+  if (src_iter == src.m_all_images.end()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
+
+  HeifFile::CopyMap copy_map;
+
+  // The thumbnails and aux images are copied after the image they belong to.
+  struct PendingImage
+  {
+    std::shared_ptr<Image> src_image;
+    std::shared_ptr<Image> master_image; // the copy of the image it belongs to
+  };
+
+  std::vector<PendingImage> pending{{src_iter->second, nullptr}};
+
+  for (size_t i = 0; i < pending.size(); i++) {
+    std::shared_ptr<Image> src_image = pending[i].src_image;
+    std::shared_ptr<Image> master_image = pending[i].master_image;
+
+    heif_item_id image_id;
+    Error err = m_heif_file->copy_item_from(*src.m_heif_file, src_image->get_id(), copy_map, &image_id);
+    if (err) {
+      return err;
+    }
+
+    auto image = std::make_shared<Image>(this, image_id);
+    image->set_size(src_image->get_width(), src_image->get_height());
+
+    if (!master_image) {
+      out_image = image;
+    }
+    else if (src_image->is_thumbnail()) {
+      image->set_is_thumbnail_of(master_image->get_id());
+      master_image->add_thumbnail(image);
+
+      m_heif_file->add_iref_reference(image_id, fourcc("thmb"), {master_image->get_id()});
+    }
+    else {
+      image->set_is_aux_image_of(master_image->get_id(), src_image->get_aux_type());
+      master_image->add_aux_image(image);
+
+      m_heif_file->add_iref_reference(image_id, fourcc("auxl"), {master_image->get_id()});
+
+      if (src_image->is_alpha_channel()) {
+        image->set_is_alpha_channel_of(master_image->get_id(), true);
+        master_image->set_alpha_channel(image);
+
+        if (master_image->is_premultiplied_alpha()) {
+          m_heif_file->add_iref_reference(master_image->get_id(), fourcc("prem"), {image_id});
+        }
+      }
+      else if (src_image->is_depth_channel()) {
+        image->set_is_depth_channel_of(master_image->get_id());
+        master_image->set_depth_channel(image);
+      }
+    }
+
+    image->set_is_premultiplied_alpha(src_image->is_premultiplied_alpha());
+
+    for (const auto& thumbnail : src_image->get_thumbnails()) {
+      pending.push_back({thumbnail, image});
+    }
+
+    for (const auto& aux_image : src_image->get_aux_images()) {
+      pending.push_back({aux_image, image});
+    }
+  }
+
+  if (m_heif_file->get_major_brand() == 0) {
+    heif_compression_format format = get_item_compression_format(src.m_heif_file, ID);
+    if (format != heif_compression_undefined) {
+      bool miaf_compatible = src.m_heif_file->has_compatible_brand(fourcc("miaf"));
+      m_heif_file->set_brand(format, miaf_compatible);
+    }
+    else {
+      m_heif_file->set_brands_from(*src.m_heif_file);
+    }
+  }
+
+  return Error::Ok;
+}
+
+
 Error HeifContext::encode_thumbnail(const std::shared_ptr<HeifPixelImage>& image,
                                     struct heif_encoder* encoder,
                                     const struct heif_encoding_options& options,
@@ -2671,48 +7484,76 @@ Error HeifContext::encode_thumbnail(const std::shared_ptr<HeifPixelImage>& image
 {
   Error error;
 
-  int orig_width = image->get_width();
-  int orig_height = image->get_height();
-
-  int thumb_width, thumb_height;
-
-  if (orig_width <= bbox_size && orig_height <= bbox_size) {
-    // original image is smaller than thumbnail size -> do not encode any thumbnail
+  std::shared_ptr<HeifPixelImage> thumbnail_image;
+  error = create_thumbnail_image(image, bbox_size, get_thread_pool().get(), thumbnail_image);
+  if (error) {
+    return error;
+  }
 
+  if (!thumbnail_image) {
     out_thumbnail_handle.reset();
     return Error::Ok;
   }
-  else if (orig_width > orig_height) {
-    thumb_height = orig_height * bbox_size / orig_width;
-    thumb_width = bbox_size;
-  }
-  else {
-    thumb_width = orig_width * bbox_size / orig_height;
-    thumb_height = bbox_size;
-  }
 
+  return encode_thumbnail_image(thumbnail_image, encoder, options, out_thumbnail_handle);
+}
 
-  // round size to even width and height
 
-  thumb_width &= ~1;
-  thumb_height &= ~1;
+Error HeifContext::encode_thumbnail_image(const std::shared_ptr<HeifPixelImage>& thumbnail_image,
+                                          struct heif_encoder* encoder,
+                                          const struct heif_encoding_options& options,
+                                          std::shared_ptr<Image>& out_thumbnail_handle)
+{
+  // the thumbnail does not get another thumbnail
+  heif_encoding_options thumbnail_options = options;
+  thumbnail_options.thumbnail_bbox_size = 0;
+  thumbnail_options.num_thumbnail_pyramid_levels = 0;
+
+  return encode_image(thumbnail_image,
+                      encoder, thumbnail_options,
+                      heif_image_input_class_thumbnail,
+                      out_thumbnail_handle);
+}
 
 
-  std::shared_ptr<HeifPixelImage> thumbnail_image;
-  error = image->scale_nearest_neighbor(thumbnail_image, thumb_width, thumb_height);
-  if (error) {
-    return error;
+Error HeifContext::encode_thumbnails(const std::shared_ptr<HeifPixelImage>& image,
+                                     struct heif_encoder* encoder,
+                                     const struct heif_encoding_options& options,
+                                     const std::shared_ptr<Image>& master_image)
+{
+  // Same order as in precode_images_concurrently(): the thumbnail, then the pyramid levels.
+
+  if (options.version >= 7 && options.thumbnail_bbox_size > 0) {
+    std::shared_ptr<Image> thumbnail_image;
+    Error error = encode_thumbnail(image, encoder, options, options.thumbnail_bbox_size, thumbnail_image);
+    if (!error && thumbnail_image) {
+      error = assign_thumbnail(master_image, thumbnail_image);
+    }
+
+    if (error) {
+      return error;
+    }
   }
 
-  error = encode_image(thumbnail_image,
-                       encoder, options,
-                       heif_image_input_class_thumbnail,
-                       out_thumbnail_handle);
+  std::vector<std::shared_ptr<HeifPixelImage>> pyramid_levels;
+  Error error = create_thumbnail_pyramid(image, options, get_thread_pool().get(), pyramid_levels);
   if (error) {
     return error;
   }
 
-  return error;
+  for (const auto& level : pyramid_levels) {
+    std::shared_ptr<Image> thumbnail_image;
+    error = encode_thumbnail_image(level, encoder, options, thumbnail_image);
+    if (!error) {
+      error = assign_thumbnail(master_image, thumbnail_image);
+    }
+
+    if (error) {
+      return error;
+    }
+  }
+
+  return Error::Ok;
 }
 
 
@@ -2808,7 +7649,32 @@ Error HeifContext::add_generic_metadata(const std::shared_ptr<Image>& master_ima
 
   // copy the data into the file, store the pointer to it in an iloc box entry
 
-  m_heif_file->append_iloc_data(metadata_id, data_array);
+  m_heif_file->append_iloc_data(metadata_id, std::move(data_array));
+
+  return Error::Ok;
+}
+
+
+Error HeifContext::remove_metadata(const std::shared_ptr<Image>& master_image, heif_item_id metadata_id)
+{
+  bool found = false;
+  for (const auto& metadata : master_image->get_metadata()) {
+    found |= (metadata->item_id == metadata_id);
+  }
+
+  if (!found) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
+
+  m_heif_file->remove_item(metadata_id);
+
+  master_image->remove_metadata(metadata_id);
+
+  // the metadata may be assigned to several images
+  for (auto& image : m_all_images) {
+    image.second->remove_metadata(metadata_id);
+  }
 
   return Error::Ok;
 }
@@ -21,6 +21,10 @@
 #ifndef LIBHEIF_CONTEXT_H
 #define LIBHEIF_CONTEXT_H
 
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <istream>
 #include <map>
 #include <memory>
 #include <set>
@@ -28,6 +32,10 @@
 #include <vector>
 #include <utility>
 
+#if ENABLE_PARALLEL_TILE_DECODING
+#include <mutex>
+#endif
+
 #include "error.h"
 
 #include "heif.h"
@@ -37,6 +45,10 @@
 #include "box.h" // only for color_profile, TODO: maybe move the color_profiles to its own header
 
 #include "region.h"
+#include "plane_allocator.h"
+#include "decoded_image_cache.h"
+#include "engine.h"
+#include "tracing.h"
 
 class HeifContext;
 
@@ -46,6 +58,16 @@ class HeifPixelImage;
 
 class StreamWriter;
 
+class ThreadPool;
+
+class TaskGroup;
+
+enum class TaskPriority;
+
+class Track;
+
+struct ColorState;
+
 
 class ImageMetadata
 {
@@ -54,6 +76,31 @@ public:
   std::string item_type;  // e.g. "Exif"
   std::string content_type;
   std::vector<uint8_t> m_data;
+
+  // When only the metadata was read from the file, the content is read on first access.
+  void set_deferred_data(const std::shared_ptr<HeifFile>& file) { m_deferred_file = file; }
+
+  // Use the data in the input of the file instead of m_data (see HeifFile::get_item_data_view()).
+  void set_data_view(const uint8_t* data, size_t size)
+  {
+    m_view = data;
+    m_view_size = size;
+  }
+
+  Error load_deferred_data();
+
+  // The content, from m_data or from the data view. Loads deferred data.
+  Error get_data(const uint8_t** out_data, size_t* out_size);
+
+private:
+  std::shared_ptr<HeifFile> m_deferred_file;
+
+  const uint8_t* m_view = nullptr;
+  size_t m_view_size = 0;
+
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::mutex m_mutex;
+#endif
 };
 
 
@@ -67,7 +114,48 @@ public:
 
   ~HeifContext();
 
-  void set_max_decoding_threads(int max_threads) { m_max_decoding_threads = max_threads; }
+  void set_max_decoding_threads(int max_threads);
+
+  int get_max_decoding_threads() const { return m_max_decoding_threads; }
+
+  // Use a thread pool that is shared with other contexts instead of the context-owned pool.
+  void set_thread_pool(std::shared_ptr<ThreadPool> pool);
+
+  // Returns the pool that is used for decoding tiles and derived images in parallel.
+  // It is created on first use. Returns nullptr if decoding should run in the calling thread.
+  std::shared_ptr<ThreadPool> get_thread_pool() const;
+
+  // Use the thread pool, the image memory pool and the decoder instances of 'engine' instead of
+  // the resources of this context. Must be called before any image is decoded.
+  void attach_to_engine(std::shared_ptr<HeifEngine> engine);
+
+  const std::shared_ptr<HeifEngine>& get_engine() const { return m_engine; }
+
+  // Reuse the memory of released image planes for later decoded images.
+  // A size of 0 disables the pool. Must not be called while images are decoded.
+  void set_plane_memory_pool_size(size_t max_cached_bytes);
+
+  std::shared_ptr<PlaneMemoryPool> get_plane_memory_pool() const { return m_plane_memory_pool; }
+
+  // Limit the plane memory of all images of this context to 'max_bytes' (0: no limit).
+  // Must not be called while images are decoded.
+  void set_memory_budget(size_t max_bytes);
+
+  // nullptr when there is no memory budget
+  std::shared_ptr<MemoryBudget> get_memory_budget() const { return m_memory_budget; }
+
+  // The allocator for the planes of decoded images: the memory pool, counted in the memory budget.
+  std::shared_ptr<PlaneAllocator> get_plane_allocator() const;
+
+  // Keep up to 'max_bytes' of decoded images for repeated decode_image_user() calls with the same
+  // parameters (0: no cache). Must not be called while images are decoded.
+  void set_decoded_image_cache_size(size_t max_bytes);
+
+  // nullptr when there is no cache
+  std::shared_ptr<DecodedImageCache> get_decoded_image_cache() const { return m_decoded_image_cache; }
+
+  // Report the duration of the decoding and encoding stages to 'callback' (nullptr: no tracing).
+  void set_trace_callback(heif_trace_callback callback, void* userdata) { m_tracer.set_callback(callback, userdata); }
 
   void set_maximum_image_size_limit(int maximum_size)
   {
@@ -75,12 +163,50 @@ public:
     m_maximum_image_height_limit = maximum_size;
   }
 
+  // 'base_work' = 0 disables the limit, see heif_context_set_decoding_work_limit().
+  void set_decoding_work_limit(uint64_t base_work, uint32_t work_per_input_byte)
+  {
+    m_decoding_work_base = base_work;
+    m_decoding_work_per_input_byte = work_per_input_byte;
+  }
+
+  // Only read the 'ftyp' and 'meta' boxes and defer the checks that are only needed for decoding.
+  // Has to be set before reading the file.
+  void set_read_metadata_only(bool flag) { m_read_metadata_only = flag; }
+
+  // Open the file with a file index written by write_file_index() instead of parsing it.
+  // Has to be set before reading the file. An empty index parses the file as usual.
+  void set_file_index(const uint8_t* data, size_t size) { m_file_index.assign(data, data + size); }
+
+  // Whether read_from_file() maps regular files into memory. Has to be set before reading the file.
+  void set_use_memory_mapping(bool flag) { m_use_memory_mapping = flag; }
+
+  Error write_file_index(StreamWriter& writer) const;
+
   Error read(const std::shared_ptr<StreamReader>& reader);
 
   Error read_from_file(const char* input_filename);
 
   Error read_from_memory(const void* data, size_t size, bool copy);
 
+  // The visual tracks of image sequences and videos in the 'moov' box.
+  // Tracks that are no visual tracks or that have an invalid sample table are not listed.
+  const std::vector<std::shared_ptr<Track>>& get_tracks() const { return m_tracks; }
+
+  // nullptr if there is no such track
+  std::shared_ptr<Track> get_track(uint32_t track_id) const;
+
+  // Prepare a frame that a decoder plugin output for a track: count its planes in the memory budget,
+  // set the color profile of the track and convert it to the output colorspace.
+  Error convert_sequence_frame(std::shared_ptr<HeifPixelImage>& img, const Track& track,
+                               heif_colorspace out_colorspace, heif_chroma out_chroma,
+                               const heif_decoding_options& options) const;
+
+  // Sets the strict decoding flag and the decoder parameters of a decoder instance for decoding
+  // an image with 'options'.
+  Error set_decoder_options(const struct heif_decoder_plugin* decoder_plugin, void* decoder,
+                            const heif_decoding_options& options) const;
+
   class Image : public ErrorBuffer
   {
   public:
@@ -246,6 +372,15 @@ public:
 
     const std::vector<std::shared_ptr<ImageMetadata>>& get_metadata() const { return m_metadata; }
 
+    void remove_metadata(heif_item_id id)
+    {
+      m_metadata.erase(std::remove_if(m_metadata.begin(), m_metadata.end(),
+                                      [id](const std::shared_ptr<ImageMetadata>& metadata) {
+                                        return metadata->item_id == id;
+                                      }),
+                       m_metadata.end());
+    }
+
 
     // --- miaf
 
@@ -321,6 +456,8 @@ public:
 
   std::shared_ptr<HeifFile> get_heif_file() { return m_heif_file; }
 
+  std::shared_ptr<const HeifFile> get_heif_file() const { return m_heif_file; }
+
   std::vector<std::shared_ptr<Image>> get_top_level_images() { return m_top_level_images; }
 
   std::shared_ptr<Image> get_top_level_image(heif_item_id id)
@@ -345,15 +482,125 @@ public:
 
   bool has_alpha(heif_item_id ID) const;
 
+  // Number of layers of a progressive AV1 image (from its 'a1lx' property), 1 for all other images.
+  int get_number_of_layers(heif_item_id ID) const;
+
+  // Number of bytes at the start of the coded data that contain the layers 0 to 'layer'.
+  // Returns 0 if all of the data is needed.
+  uint64_t get_layer_prefix_size(heif_item_id ID, int layer) const;
+
+  // A rectangular area of an image in pixel coordinates.
+  struct ImageRegion
+  {
+    int x, y;
+    int width, height;
+  };
+
+  // When 'region' is given, only this area of the (transformed) image is decoded.
+  // For grid images, only the tiles intersecting this area are decoded.
   Error decode_image_user(heif_item_id ID, std::shared_ptr<HeifPixelImage>& img,
                           heif_colorspace out_colorspace,
                           heif_chroma out_chroma,
-                          const struct heif_decoding_options& options) const;
+                          const struct heif_decoding_options& options,
+                          const ImageRegion* region = nullptr) const;
+
+  // Decode only the alpha image of image 'ID' (including grid alpha images) without decoding the
+  // color image. The alpha samples are returned as the Y plane of a monochrome image.
+  Error decode_alpha_image_user(heif_item_id ID, std::shared_ptr<HeifPixelImage>& img,
+                                const struct heif_decoding_options& options) const;
+
+  // Decode several images on the thread pool of the context. 'image_decoded' is called for each image
+  // (with its index in 'IDs') as soon as it is finished. The calls are serialized, but not ordered.
+  // A failing image does not stop the others. Returns the first error that occurred.
+  Error decode_images_user(const std::vector<heif_item_id>& IDs,
+                           heif_colorspace out_colorspace,
+                           heif_chroma out_chroma,
+                           const struct heif_decoding_options& options,
+                           const std::function<void(size_t idx, const Error& err,
+                                                    const std::shared_ptr<HeifPixelImage>& img)>& image_decoded) const;
+
+  // Decode the image on the thread pool of the context and pass the result to 'image_decoded' from there.
+  // Without thread pool, the image is decoded before this function returns.
+  // 'options' are copied, but the context and the data that the options point to (e.g. the user data of
+  // the callbacks) have to stay valid until 'image_decoded' has returned.
+  void decode_image_async(heif_item_id ID,
+                          heif_colorspace out_colorspace,
+                          heif_chroma out_chroma,
+                          const struct heif_decoding_options& options,
+                          std::function<void(const Error& err, const std::shared_ptr<HeifPixelImage>& img)> image_decoded) const;
+
+  // Decode the image in horizontal bands from top to bottom. 'band_decoded' is called for each band with
+  // the row of the output image at which it starts. Grid images are decoded one band at a time, where
+  // a band covers the output rows that need the same tiles. Other images are decoded completely and
+  // delivered in bands of a fixed height. Decoding stops when 'band_decoded' returns an error.
+  Error decode_image_in_bands(heif_item_id ID,
+                              heif_colorspace out_colorspace,
+                              heif_chroma out_chroma,
+                              const struct heif_decoding_options& options,
+                              const std::function<Error(const std::shared_ptr<HeifPixelImage>& band, int y)>& band_decoded) const;
+
+  struct ImageSize
+  {
+    int width, height;
+  };
 
+  // 'preferred_chroma' is the chroma that will finally be delivered to the application.
+  // Decoders that can output this format directly may return the image in it instead of planar.
+  // When 'scaled_size' is given, the coded image is scaled down to this size before the transformations
+  // are applied. Grid images are then decoded directly at this size. This cannot be combined with 'region'
+  // and the image must not have a clean aperture.
   Error decode_image_planar(heif_item_id ID, std::shared_ptr<HeifPixelImage>& img,
                             heif_colorspace out_colorspace,
                             const struct heif_decoding_options& options,
-                            bool alphaImage) const;
+                            bool alphaImage,
+                            const ImageRegion* region = nullptr,
+                            heif_chroma preferred_chroma = heif_chroma_undefined,
+                            const ImageSize* scaled_size = nullptr) const;
+
+  struct GridLayout
+  {
+    uint32_t columns, rows;
+    uint32_t tile_width, tile_height;
+    uint32_t image_width, image_height; // size of the untransformed grid image
+  };
+
+  Error get_grid_layout(heif_item_id ID, GridLayout& layout) const;
+
+  struct DecodingMemoryEstimate
+  {
+    size_t peak_bytes = 0;
+    size_t image_bytes = 0; // the decoded image or grid canvas
+    size_t output_bytes = 0; // the transformed or converted image, alive together with the decoded image
+    size_t tile_bytes = 0; // one grid tile that is decoded and converted
+    int max_concurrent_tiles = 0; // grid tiles that are decoded at the same time
+  };
+
+  // Estimate the peak plane memory of decode_image_user(). For grid images, the number of tiles that
+  // are decoded in parallel is reduced such that they fit into the memory budget.
+  Error estimate_decoding_memory(heif_item_id ID, heif_chroma out_chroma,
+                                 const struct heif_decoding_options& options,
+                                 const ImageRegion* region,
+                                 DecodingMemoryEstimate& estimate) const;
+
+  // Fail if the estimated peak memory of decode_image_user() does not fit into the memory budget.
+  Error check_memory_budget(heif_item_id ID, heif_chroma out_chroma,
+                            const struct heif_decoding_options& options,
+                            const ImageRegion* region) const;
+
+  // Get the ranges of the input file that decode_image_user() reads for this image and region.
+  // The ranges are sorted and overlapping or adjacent ranges are merged.
+  Error get_file_ranges_for_decoding(heif_item_id ID,
+                                     const struct heif_decoding_options& options,
+                                     const ImageRegion* region,
+                                     std::vector<FileRange>& ranges) const;
+
+  // Decode a single tile of a grid image. The tile is cropped at the image border.
+  // The transformations of the grid image are not applied.
+  Error decode_grid_tile(heif_item_id ID, uint32_t column, uint32_t row,
+                         std::shared_ptr<HeifPixelImage>& img,
+                         heif_colorspace out_colorspace,
+                         heif_chroma out_chroma,
+                         const struct heif_decoding_options& options) const;
 
   std::string debug_dump_boxes() const;
 
@@ -371,6 +618,48 @@ public:
                      enum heif_image_input_class input_class,
                      std::shared_ptr<Image>& out_image);
 
+  // Split 'image' into tiles of the given size and encode them as a 'grid' image. The border tiles
+  // are padded to the full tile size. The tiles are encoded in parallel on the thread pool, each
+  // thread with its own encoder instance that has the same parameters as 'encoder'.
+  Error encode_grid(const std::shared_ptr<HeifPixelImage>& image,
+                    uint32_t tile_width, uint32_t tile_height,
+                    struct heif_encoder* encoder,
+                    const struct heif_encoding_options& options,
+                    std::shared_ptr<Image>& out_image);
+
+  // Encode a grid image whose pixels are requested from 'get_band' in bands of one tile row, from top to bottom.
+  // 'get_band' returns the image rows [y, y+height) as an image of the full width. The tiles of a band are
+  // encoded in parallel and are added to the file before the next band is requested. No thumbnail is created.
+  Error encode_grid_from_bands(uint32_t image_width, uint32_t image_height,
+                               uint32_t tile_width, uint32_t tile_height,
+                               struct heif_encoder* encoder,
+                               const struct heif_encoding_options& options,
+                               const std::function<Error(uint32_t y, uint32_t height,
+                                                         std::shared_ptr<HeifPixelImage>& band)>& get_band,
+                               std::shared_ptr<Image>& out_image);
+
+  // Encode several images with the same encoder. The images are coded in parallel on the thread pool,
+  // but are added to the file in the same order and with the same item IDs as if encode_image() was
+  // called for each of them. On error, 'out_images' contains the images that have been added so far.
+  // Code the image with the highest lossy quality at which its coded data fits into 'target_size' bytes.
+  // The candidate qualities are coded in parallel and only the winning image is added to the file.
+  Error encode_image_with_target_size(const std::shared_ptr<HeifPixelImage>& pixel_image,
+                                      struct heif_encoder* encoder,
+                                      const struct heif_encoding_options& options,
+                                      size_t target_size,
+                                      int& out_quality,
+                                      std::shared_ptr<Image>& out_image);
+
+  Error encode_images(const std::vector<std::shared_ptr<HeifPixelImage>>& images,
+                      struct heif_encoder* encoder,
+                      const std::vector<heif_encoding_options>& options,
+                      std::vector<std::shared_ptr<Image>>& out_images);
+
+  Error encode_thumbnail_image(const std::shared_ptr<HeifPixelImage>& thumbnail_image,
+                               struct heif_encoder* encoder,
+                               const struct heif_encoding_options& options,
+                               std::shared_ptr<Image>& out_thumbnail_handle);
+
   Error encode_image_as_hevc(const std::shared_ptr<HeifPixelImage>& image,
                              struct heif_encoder* encoder,
                              const struct heif_encoding_options& options,
@@ -383,11 +672,14 @@ public:
                             enum heif_image_input_class input_class,
                             std::shared_ptr<Image>& out_image);
 
-  Error encode_image_as_uncompressed(const std::shared_ptr<HeifPixelImage>& src_image,
+  Error encode_image_as_uncompressed(const std::shared_ptr<HeifPixelImage>& image,
                                      struct heif_encoder* encoder,
                                      const struct heif_encoding_options& options,
                                      enum heif_image_input_class input_class,
-                                     std::shared_ptr<Image> out_image);
+                                     std::shared_ptr<Image>& out_image);
+
+  // Store the JPEG file 'data' as a 'jpeg' image item without decoding it.
+  Error add_jpeg_image(const uint8_t* data, size_t size, std::shared_ptr<Image>& out_image);
 
   // write PIXI, CLLI, MDVC
   void write_image_metadata(std::shared_ptr<HeifPixelImage> src_image, int image_id);
@@ -401,12 +693,23 @@ public:
   Error assign_thumbnail(const std::shared_ptr<Image>& master_image,
                          const std::shared_ptr<Image>& thumbnail_image);
 
+  // Copy an image of 'src' into this context without decoding it, together with its thumbnails
+  // and auxiliary images. See heif_context_copy_image().
+  Error copy_image_from(const HeifContext& src, heif_item_id ID, std::shared_ptr<Image>& out_image);
+
   Error encode_thumbnail(const std::shared_ptr<HeifPixelImage>& image,
                          struct heif_encoder* encoder,
                          const struct heif_encoding_options& options,
                          int bbox_size,
                          std::shared_ptr<Image>& out_image_handle);
 
+  // Encode the thumbnails requested in 'options' (thumbnail_bbox_size and the thumbnail pyramid)
+  // and assign them to 'master_image'.
+  Error encode_thumbnails(const std::shared_ptr<HeifPixelImage>& image,
+                          struct heif_encoder* encoder,
+                          const struct heif_encoding_options& options,
+                          const std::shared_ptr<Image>& master_image);
+
   Error add_exif_metadata(const std::shared_ptr<Image>& master_image, const void* data, int size);
 
   Error add_XMP_metadata(const std::shared_ptr<Image>& master_image, const void* data, int size, heif_metadata_compression compression);
@@ -415,6 +718,9 @@ public:
                              const char* item_type, const char* content_type,
                              heif_metadata_compression compression);
 
+  // Remove a metadata item of the image from the file.
+  Error remove_metadata(const std::shared_ptr<Image>& master_image, heif_item_id metadata_id);
+
   heif_property_id add_property(heif_item_id targetItem, std::shared_ptr<Box> property);
 
   // --- region items
@@ -436,7 +742,21 @@ public:
     return nullptr;
   }
 
-  void write(StreamWriter& writer);
+  Error write(StreamWriter& writer);
+
+  // Write the file in consecutive parts to the sink. The compressed image data is not copied.
+  Error write(const StreamWriter::output_sink& sink);
+
+  // Update the file that has been read in place, see HeifFile::write_in_place().
+  Error write_in_place(std::iostream& stream);
+
+  // Write the compressed data of the images to the sink while they are encoded.
+  // finish_streaming_output() writes the remaining boxes to the same sink.
+  Error start_streaming_output(heif_compression_format format, const StreamWriter::output_sink& sink);
+
+  Error finish_streaming_output() { return write(m_streaming_sink); }
+
+  bool is_streaming_output() const { return m_streaming_sink != nullptr; }
 
 private:
   std::map<heif_item_id, std::shared_ptr<Image>> m_all_images;
@@ -449,27 +769,272 @@ private:
 
   std::shared_ptr<HeifFile> m_heif_file;
 
+  std::vector<std::shared_ptr<Track>> m_tracks;
+
   int m_max_decoding_threads = 4;
 
+  mutable std::shared_ptr<ThreadPool> m_thread_pool;
+
+  // nullptr when no memory pool is used
+  std::shared_ptr<PlaneMemoryPool> m_plane_memory_pool;
+
+  // nullptr when there is no memory budget
+  std::shared_ptr<MemoryBudget> m_memory_budget;
+  std::shared_ptr<BudgetedPlaneAllocator> m_budgeted_allocator; // allocates from m_plane_memory_pool
+  std::shared_ptr<BudgetedPlaneAllocator> m_budgeted_heap_allocator; // adopts the planes of the decoders
+
+  // nullptr when decoded images are not cached
+  std::shared_ptr<DecodedImageCache> m_decoded_image_cache;
+
+  // Set the allocator of a decoded image and count the planes that the decoder allocated in the budget.
+  Error adopt_decoded_image(const std::shared_ptr<HeifPixelImage>& img) const;
+
+  void update_plane_allocators();
+
+  Tracer m_tracer;
+#if ENABLE_PARALLEL_TILE_DECODING
+  mutable std::mutex m_thread_pool_mutex;
+
+  // Guards adding and looking up the planes of grid images while their tiles are pasted in parallel.
+  mutable std::mutex m_canvas_mutex;
+#endif
+
+  // Idle decoder instances of this context, or of the engine that it is attached to.
+  std::shared_ptr<DecoderInstancePool> m_decoder_pool;
+
+  // nullptr when the context is not attached to an engine
+  std::shared_ptr<HeifEngine> m_engine;
+
+  // Options for decoding 'num_images' images concurrently on the thread pool. When the number
+  // of decoder threads is chosen automatically, the decoding threads are divided among the images.
+  heif_decoding_options get_concurrent_decoding_options(const heif_decoding_options& options,
+                                                        size_t num_images) const;
+
+  Error acquire_decoder(const struct heif_decoder_plugin* plugin, void** decoder) const;
+
+  // Return the decoder to the pool of idle decoders or free it if it cannot be reused.
+  void release_decoder(const struct heif_decoder_plugin* plugin, void* decoder, bool reusable) const;
+
+  // Encoder instances that libheif created internally for encoding several images in parallel.
+  // They are kept after use and reused for later images with the same plugin.
+  mutable std::vector<std::unique_ptr<struct heif_encoder>> m_idle_encoders;
+#if ENABLE_PARALLEL_TILE_DECODING
+  mutable std::mutex m_idle_encoders_mutex;
+#endif
+
+  // Get an encoder instance for the plugin of 'prototype' and set it to the same parameters.
+  Error acquire_encoder(const struct heif_encoder& prototype, std::unique_ptr<struct heif_encoder>& out_encoder) const;
+
+  // Return the encoder to the pool of idle encoders.
+  void release_encoder(std::unique_ptr<struct heif_encoder> encoder) const;
+
+  // The input image converted to the colorspace of the encoder and the compressed data packets
+  // that the encoder plugin returned for it.
+  struct CodedImage
+  {
+    std::shared_ptr<HeifPixelImage> src_image;
+    std::vector<std::vector<uint8_t>> data;
+
+    // For progressive (layered) images, each packet in 'data' is one layer.
+    int num_layers = 1;
+  };
+
+  // Images that have been coded in advance (see heif_encoding_options::encode_auxiliary_images_concurrently).
+  // For each input class, they are in the order in which the encode_image_as_*() functions request them.
+  std::map<heif_image_input_class, std::deque<CodedImage>> m_precoded_images;
+
+  // Code the images, their alpha channels and their thumbnails in parallel and put them into
+  // m_precoded_images in the order in which encode_image() takes them out again.
+  Error precode_images_concurrently(const std::vector<std::shared_ptr<HeifPixelImage>>& images,
+                                    struct heif_encoder* encoder,
+                                    const std::vector<heif_encoding_options>& options);
+
+  // Take the next image of this input class from m_precoded_images or, if there is none, run the encoder.
+  Error get_coded_image(const std::shared_ptr<HeifPixelImage>& image,
+                        struct heif_encoder* encoder,
+                        const struct heif_encoding_options& options,
+                        enum heif_image_input_class input_class,
+                        CodedImage& out_coded_image);
+
   uint32_t m_maximum_image_width_limit;
   uint32_t m_maximum_image_height_limit;
 
+  uint64_t m_decoding_work_base;
+  uint32_t m_decoding_work_per_input_byte;
+
+  bool m_read_metadata_only = false;
+
+  bool m_use_memory_mapping = true;
+
+  std::vector<uint8_t> m_file_index;
+
+  // The boxes and images of the file that has been read are allocated in this arena.
+  std::shared_ptr<MemoryArena> m_memory_arena;
+
+  StreamWriter::output_sink m_streaming_sink;
+
   std::vector<std::shared_ptr<RegionItem>> m_region_items;
 
   Error interpret_heif_file();
 
   void remove_top_level_image(const std::shared_ptr<Image>& image);
 
+  // Map an area of the output image back through the image's transformations (irot, imir, clap)
+  // into the coordinates of the coded image.
+  Error get_coded_image_region(heif_item_id ID,
+                               const ImageRegion& region,
+                               bool ignore_transformations,
+                               ImageRegion& coded_region) const;
+
+  Error append_file_ranges_for_decoding(heif_item_id ID,
+                                        const struct heif_decoding_options& options,
+                                        const ImageRegion* region,
+                                        std::vector<FileRange>& ranges) const;
+
+  // Encode the tiles of a grid image. 'get_tile_row_source' returns an image that contains the tile row
+  // 'row' and the image row at which it starts. With 'one_tile_row_at_a_time', the tiles of a row are
+  // encoded and added to the file before the source of the next row is requested.
+  Error encode_grid_tiles(uint32_t image_width, uint32_t image_height,
+                          uint32_t tile_width, uint32_t tile_height,
+                          struct heif_encoder* encoder,
+                          const struct heif_encoding_options& options,
+                          const std::function<Error(uint32_t row, std::shared_ptr<HeifPixelImage>& source,
+                                                    uint32_t& source_top)>& get_tile_row_source,
+                          bool one_tile_row_at_a_time,
+                          std::shared_ptr<Image>& out_image);
+
+  // Fail with heif_suberror_Decoding_work_limit_exceeded if decoding the grid or overlay image 'ID'
+  // needs too much work compared to the size of its coded data.
+  Error check_decoding_work(heif_item_id ID) const;
+
+  // Work of decoding the image 'ID' (see heif_context_set_decoding_work_limit()). The work of each image
+  // is computed once and stored in 'work_of_items'. The coded data of the images that have not been
+  // counted yet in 'input_items' is added to 'input_bytes'.
+  Error get_decoding_work(heif_item_id ID, int depth,
+                          std::map<heif_item_id, uint64_t>& work_of_items,
+                          std::set<heif_item_id>& input_items, uint64_t& input_bytes,
+                          uint64_t& out_work) const;
+
+  // If 'region' is given, the output image only covers this area (in coded image coordinates).
+  // The output image is planar RGB, or 'preferred_chroma' if this is an interleaved RGB format
+  // with the bit depth of the grid.
   Error decode_full_grid_image(heif_item_id ID,
                                std::shared_ptr<HeifPixelImage>& img,
                                const std::vector<uint8_t>& grid_data,
-                               const heif_decoding_options& options) const;
+                               const heif_decoding_options& options,
+                               const ImageRegion* region = nullptr,
+                               heif_chroma preferred_chroma = heif_chroma_undefined) const;
+
+  // Decodes the grid image at 'size'. Each tile is scaled down to its area of the output image right after
+  // it has been decoded, such that the grid image is never held at full size.
+  Error decode_scaled_grid_image(heif_item_id ID,
+                                 std::shared_ptr<HeifPixelImage>& img,
+                                 const std::vector<uint8_t>& grid_data,
+                                 const heif_decoding_options& options,
+                                 const ImageSize& size) const;
+
+  // Bit depth of the output image of a grid, taken from its pixi box or from the first tile.
+  Error get_grid_bit_depth(heif_item_id ID, heif_item_id first_tile_id, int& bpp) const;
+
+  // Implements 'target_bbox_width' and 'target_bbox_height' of the decoding options.
+  Error decode_image_at_target_size(heif_item_id ID, std::shared_ptr<HeifPixelImage>& img,
+                                    heif_colorspace out_colorspace,
+                                    heif_chroma out_chroma,
+                                    const struct heif_decoding_options& options) const;
+
+  // If the reader supports asynchronous range requests, requests the data of all tiles and calls
+  // 'start_tile' for each tile as soon as its data is available. Returns after all tiles were started.
+  // Returns false (without starting any tile) if the reader does not support this.
+  bool start_tiles_when_data_is_available(const std::vector<heif_item_id>& tile_ids,
+                                          const heif_decoding_options& options,
+                                          const std::function<void(size_t tile_idx)>& start_tile) const;
+
+  // Reads the compressed data of up to 'options.tile_prefetch_count' tiles ahead into the HeifFile
+  // while the decoding threads decode the previous tiles. Returns after all tiles were started.
+  // Returns false (without starting any tile) if prefetching is not used for this input.
+  bool start_tiles_with_prefetching(const std::vector<heif_item_id>& tile_ids,
+                                    const heif_decoding_options& options,
+                                    TaskGroup& tile_tasks,
+                                    const std::function<Error(size_t tile_idx)>& decode_tile) const;
+
+  // Whether a tile can be color converted directly into its area of the output grid image.
+  bool can_convert_tile_into_canvas(heif_item_id tileID,
+                                    const std::shared_ptr<HeifPixelImage>& out_image,
+                                    int x0, int y0,
+                                    const heif_decoding_options& options) const;
+
+  // Decodes an HEVC or AV1 coded image with its decoder plugin. The color profiles of the item are
+  // attached, but no color conversion is done. If 'target_area' is given and the plugin can decode
+  // directly into this image, 'img' is set to 'target_area'.
+  // When the plugin rejects the image as unsupported, the plugin with the next lower priority is used.
+  Error decode_coded_image(heif_item_id ID, heif_compression_format compression,
+                           std::shared_ptr<HeifPixelImage>& img,
+                           const heif_decoding_options& options,
+                           const std::shared_ptr<HeifPixelImage>& target_area = nullptr) const;
+
+  Error decode_coded_image_with_plugin(const struct heif_decoder_plugin* decoder_plugin,
+                                       heif_item_id ID,
+                                       std::shared_ptr<HeifPixelImage>& img,
+                                       const heif_decoding_options& options,
+                                       const std::shared_ptr<HeifPixelImage>& target_area) const;
 
   Error decode_and_paste_tile_image(heif_item_id tileID,
                                     const std::shared_ptr<HeifPixelImage>& out_image,
-                                    int x0, int y0,
+                                    int x0, int y0, // may be negative if the tile starts left/above of the output image
                                     const heif_decoding_options& options) const;
 
+  // Copies a decoded tile into the output grid image. If the tile is not 'converted' to the
+  // colorspace of the output image yet, it is color converted directly into its area.
+  Error paste_tile_image(heif_item_id tileID,
+                         std::shared_ptr<HeifPixelImage> tile_img, bool converted,
+                         const std::shared_ptr<HeifPixelImage>& out_image,
+                         int x0, int y0,
+                         const heif_decoding_options& options) const;
+
+  struct GridTile
+  {
+    heif_item_id id;
+    int paste_x, paste_y;
+  };
+
+  // Whether two tile items decode to the same image: they are the same item or items of the same type
+  // with the same data extents and properties (and without alpha images).
+  bool have_identical_tile_data(heif_item_id id1, heif_item_id id2) const;
+
+  // Copies the area of the decoded tile 'source' (which has to lie completely inside of 'out_image')
+  // to the position of 'copy', which may extend over the borders of 'out_image'.
+  void copy_decoded_tile(const std::shared_ptr<HeifPixelImage>& out_image,
+                         const GridTile& source, const GridTile& copy) const;
+
+  // Memory of a decoded grid tile, including its conversion to the format of the canvas.
+  size_t estimate_tile_memory(heif_item_id tile_id, const ColorState& canvas_state,
+                              const heif_decoding_options& options) const;
+
+  // Number of tiles that can be decoded at the same time with the decoding threads, such that
+  // 'tile_bytes' per tile fit into the memory budget besides 'reserved_bytes'. At least 1.
+  int get_max_concurrent_tiles(size_t tile_bytes, size_t num_tiles, size_t reserved_bytes) const;
+
+  // The priority of the decoding tasks of an image (see heif_decoding_priority).
+  TaskPriority get_decoding_priority(heif_item_id ID, const struct heif_decoding_options& options) const;
+
+  // Decodes the tiles into 'out_image' in parallel. 'tile_finished' is called for each tile that
+  // has been pasted, from the thread that decoded it.
+  // With a memory budget, only as many tiles are decoded at the same time as fit into the budget.
+  Error decode_grid_tiles(std::vector<GridTile>& tiles,
+                          const std::shared_ptr<HeifPixelImage>& out_image,
+                          const heif_decoding_options& options,
+                          const std::function<void(const GridTile&)>& tile_finished) const;
+
+  // Decodes the tiles that share the same codec headers with a single decoder instance through
+  // the decode_image_sequence() function of the decoder plugin. The decoded tiles are pasted into
+  // 'out_image' on 'tile_tasks'. The tiles that are not decoded this way remain in 'tiles'.
+  // 'tile_finished' is called for each tile after it has been pasted.
+  Error decode_tile_sequence(std::vector<GridTile>& tiles,
+                             const std::shared_ptr<HeifPixelImage>& out_image,
+                             const heif_decoding_options& options,
+                             TaskGroup& tile_tasks,
+                             const std::function<void(const GridTile&)>& tile_finished) const;
+
   Error decode_derived_image(heif_item_id ID,
                              std::shared_ptr<HeifPixelImage>& img,
                              const heif_decoding_options& options) const;
@@ -0,0 +1,90 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cpu_features.h"
+
+#include <cstdlib>
+
+#if HEIF_HAVE_X86_SIMD && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#elif HEIF_HAVE_X86_SIMD && HEIF_ARCH_X86
+#include <cpuid.h>
+#endif
+
+
+static CPUFeatures detect_cpu_features()
+{
+  CPUFeatures features;
+
+  if (getenv("LIBHEIF_DISABLE_SIMD")) {
+    return features;
+  }
+
+#if HEIF_HAVE_WASM_SIMD
+  // WebAssembly modules that use SIMD cannot be loaded without SIMD support.
+  features.sse41 = true;
+#elif HEIF_HAVE_X86_SIMD
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+
+  if (max_leaf >= 1) {
+    __cpuid(info, 1);
+    features.sse41 = (info[2] & (1 << 19)) != 0;
+
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool os_saves_ymm = osxsave && ((_xgetbv(0) & 6) == 6);
+
+    features.f16c = avx && os_saves_ymm && (info[2] & (1 << 29)) != 0;
+
+    if (max_leaf >= 7 && avx && os_saves_ymm) {
+      __cpuidex(info, 7, 0);
+      features.avx2 = (info[1] & (1 << 5)) != 0;
+    }
+  }
+#else
+  __builtin_cpu_init();
+  features.sse41 = __builtin_cpu_supports("sse4.1");
+  features.avx2 = __builtin_cpu_supports("avx2");
+
+  // F16C uses the VEX encoding, which requires that the OS saves the AVX registers.
+  unsigned int eax, ebx, ecx, edx;
+  if (__builtin_cpu_supports("avx") && __get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    features.f16c = (ecx & bit_F16C) != 0;
+  }
+#endif
+#endif
+
+#if HEIF_HAVE_NEON
+  features.neon = true;
+#endif
+
+  return features;
+}
+
+
+const CPUFeatures& get_cpu_features()
+{
+  static const CPUFeatures features = detect_cpu_features();
+  return features;
+}
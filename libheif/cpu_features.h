@@ -0,0 +1,89 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_CPU_FEATURES_H
+#define LIBHEIF_CPU_FEATURES_H
+
+// Runtime detection of the SIMD instruction sets that optimized kernels may use.
+//
+// Each module with SIMD kernels exposes a get_..._kernels() function that returns a struct of
+// function pointers. An entry is nullptr when no kernel for it is available on this CPU, and the
+// caller then uses its scalar code. The kernels are selected once: the color conversion kernels
+// when the color conversion operations are created on first use (ColorConversionOperations),
+// the others on the first call of their getter.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define HEIF_ARCH_X86 1
+#else
+#define HEIF_ARCH_X86 0
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define HEIF_HAVE_NEON 1
+#else
+#define HEIF_HAVE_NEON 0
+#endif
+
+// Emscripten translates the SSE intrinsics to WebAssembly SIMD when compiling with -msimd128 -msse4.1.
+#if defined(__EMSCRIPTEN__) && defined(__wasm_simd128__) && defined(__SSE4_1__)
+#define HEIF_HAVE_WASM_SIMD 1
+#else
+#define HEIF_HAVE_WASM_SIMD 0
+#endif
+
+// x86 kernels are compiled with per-function target attributes so that the rest of the
+// library does not require these instruction sets. MSVC does not need this.
+// HEIF_HAVE_X86_SIMD enables the SSE4.1 kernels, HEIF_HAVE_X86_AVX the AVX2 and F16C kernels.
+#if HEIF_ARCH_X86 && (defined(__GNUC__) || defined(__clang__))
+#define HEIF_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define HEIF_TARGET_AVX2 __attribute__((target("avx2")))
+#define HEIF_TARGET_F16C __attribute__((target("avx,f16c")))
+#define HEIF_HAVE_X86_SIMD 1
+#define HEIF_HAVE_X86_AVX 1
+#elif HEIF_ARCH_X86 && defined(_MSC_VER)
+#define HEIF_TARGET_SSE41
+#define HEIF_TARGET_AVX2
+#define HEIF_TARGET_F16C
+#define HEIF_HAVE_X86_SIMD 1
+#define HEIF_HAVE_X86_AVX 1
+#elif HEIF_HAVE_WASM_SIMD
+// The whole module is compiled for SIMD, there is no runtime dispatch. 256 bit kernels are not used.
+#define HEIF_TARGET_SSE41
+#define HEIF_HAVE_X86_SIMD 1
+#define HEIF_HAVE_X86_AVX 0
+#else
+#define HEIF_HAVE_X86_SIMD 0
+#define HEIF_HAVE_X86_AVX 0
+#endif
+
+
+struct CPUFeatures
+{
+  bool sse41 = false;
+  bool avx2 = false;
+  bool f16c = false; // half float conversion (requires AVX)
+  bool neon = false;
+};
+
+// The result is computed once and cached.
+// Setting the environment variable LIBHEIF_DISABLE_SIMD disables all SIMD kernels.
+const CPUFeatures& get_cpu_features();
+
+#endif
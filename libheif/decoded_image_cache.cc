@@ -0,0 +1,156 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decoded_image_cache.h"
+#include "pixelimage.h"
+#include "statistics.h"
+
+#include <tuple>
+
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#define LOCK_CACHE std::lock_guard<std::mutex> lock(m_mutex)
+#else
+#define LOCK_CACHE
+#endif
+
+
+bool DecodedImageCache::Key::operator<(const Key& other) const
+{
+  return std::tie(id, colorspace, chroma,
+                  has_region, region_x, region_y, region_width, region_height,
+                  ignore_transformations, convert_hdr_to_8bit, strict_decoding, decoder_id,
+                  downsampling, upsampling, only_use_preferred_chroma_algorithm, conversion_accuracy,
+                  tone_map_hdr_to_sdr,
+                  target_bbox_width, target_bbox_height, target_scaling_filter,
+                  linear_light_output, output_alpha_premultiplication) <
+         std::tie(other.id, other.colorspace, other.chroma,
+                  other.has_region, other.region_x, other.region_y, other.region_width, other.region_height,
+                  other.ignore_transformations, other.convert_hdr_to_8bit, other.strict_decoding, other.decoder_id,
+                  other.downsampling, other.upsampling, other.only_use_preferred_chroma_algorithm, other.conversion_accuracy,
+                  other.tone_map_hdr_to_sdr,
+                  other.target_bbox_width, other.target_bbox_height, other.target_scaling_filter,
+                  other.linear_light_output, other.output_alpha_premultiplication);
+}
+
+
+std::shared_ptr<HeifPixelImage> DecodedImageCache::get(const Key& key)
+{
+  std::shared_ptr<HeifPixelImage> image;
+
+  {
+    LOCK_CACHE;
+
+    auto iter = m_index.find(key);
+    if (iter == m_index.end()) {
+      m_stats.num_misses++;
+      statistics::add(statistics::decoded_image_cache_misses);
+      return nullptr;
+    }
+
+    m_stats.num_hits++;
+    statistics::add(statistics::decoded_image_cache_hits);
+
+    // move to the front of the LRU list
+    m_entries.splice(m_entries.begin(), m_entries, iter->second);
+
+    image = iter->second->image;
+  }
+
+  // The cached image is not modified, so it can be shared outside of the lock.
+  return image->create_shared_copy();
+}
+
+
+void DecodedImageCache::put(const Key& key, const std::shared_ptr<HeifPixelImage>& image)
+{
+  size_t size = image->get_pixel_data_size();
+  if (size > m_max_bytes) {
+    return;
+  }
+
+  std::shared_ptr<HeifPixelImage> cached_image = image->create_shared_copy();
+  if (!cached_image) {
+    return;
+  }
+
+  LOCK_CACHE;
+
+  auto iter = m_index.find(key);
+  if (iter != m_index.end()) {
+    // decoded concurrently by another thread
+    m_entries.splice(m_entries.begin(), m_entries, iter->second);
+    return;
+  }
+
+  while (m_stats.cached_bytes + size > m_max_bytes) {
+    evict_lru();
+  }
+
+  m_entries.push_front(Entry{key, std::move(cached_image), size});
+  m_index[key] = m_entries.begin();
+
+  m_stats.num_images++;
+  m_stats.cached_bytes += size;
+}
+
+
+void DecodedImageCache::evict_lru()
+{
+  const Entry& entry = m_entries.back();
+
+  m_stats.num_images--;
+  m_stats.cached_bytes -= entry.size;
+
+  m_index.erase(entry.key);
+  m_entries.pop_back();
+}
+
+
+bool DecodedImageCache::evict_one()
+{
+  LOCK_CACHE;
+
+  if (m_entries.empty()) {
+    return false;
+  }
+
+  evict_lru();
+  return true;
+}
+
+
+void DecodedImageCache::clear()
+{
+  LOCK_CACHE;
+
+  m_entries.clear();
+  m_index.clear();
+  m_stats.num_images = 0;
+  m_stats.cached_bytes = 0;
+}
+
+
+DecodedImageCache::Statistics DecodedImageCache::get_statistics() const
+{
+  LOCK_CACHE;
+
+  return m_stats;
+}
@@ -0,0 +1,119 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_DECODED_IMAGE_CACHE_H
+#define LIBHEIF_DECODED_IMAGE_CACHE_H
+
+#include "heif.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
+class HeifPixelImage;
+
+
+// Keeps decoded images for repeated decodes of the same image with the same parameters.
+// When the cached images exceed the size of the cache, the least recently used ones are dropped.
+// The cache hands out copies that share the pixel memory with the cached image copy-on-write.
+// The cache is thread-safe.
+class DecodedImageCache
+{
+public:
+  // Everything that changes the decoded pixels.
+  struct Key
+  {
+    heif_item_id id = 0;
+    heif_colorspace colorspace = heif_colorspace_undefined;
+    heif_chroma chroma = heif_chroma_undefined;
+
+    bool has_region = false;
+    int region_x = 0, region_y = 0, region_width = 0, region_height = 0;
+
+    bool ignore_transformations = false;
+    bool convert_hdr_to_8bit = false;
+    bool strict_decoding = false;
+    std::string decoder_id;
+    heif_chroma_downsampling_algorithm downsampling = heif_chroma_downsampling_average;
+    heif_chroma_upsampling_algorithm upsampling = heif_chroma_upsampling_bilinear;
+    bool only_use_preferred_chroma_algorithm = false;
+    uint8_t conversion_accuracy = heif_color_conversion_accuracy_precise;
+    bool tone_map_hdr_to_sdr = false;
+    int target_bbox_width = 0, target_bbox_height = 0;
+    heif_scaling_filter target_scaling_filter = heif_scaling_filter_bilinear;
+    bool linear_light_output = false;
+    heif_alpha_premultiplication output_alpha_premultiplication = heif_alpha_premultiplication_unchanged;
+
+    bool operator<(const Key& other) const;
+  };
+
+  explicit DecodedImageCache(size_t max_bytes) : m_max_bytes(max_bytes) {}
+
+  // Returns nullptr if the image is not in the cache.
+  std::shared_ptr<HeifPixelImage> get(const Key& key);
+
+  // Images that are larger than the cache are not stored.
+  void put(const Key& key, const std::shared_ptr<HeifPixelImage>& image);
+
+  // Drop the least recently used image. Returns false if the cache is empty.
+  bool evict_one();
+
+  void clear();
+
+  struct Statistics
+  {
+    uint64_t num_hits = 0;
+    uint64_t num_misses = 0;
+    size_t num_images = 0;
+    size_t cached_bytes = 0;
+  };
+
+  Statistics get_statistics() const;
+
+private:
+  struct Entry
+  {
+    Key key;
+    std::shared_ptr<HeifPixelImage> image;
+    size_t size;
+  };
+
+  void evict_lru();
+
+  size_t m_max_bytes;
+
+  std::list<Entry> m_entries; // most recently used first
+  std::map<Key, std::list<Entry>::iterator> m_index;
+
+  Statistics m_stats;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  mutable std::mutex m_mutex;
+#endif
+};
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "encoding_time_budget.h"
+#include "api_structs.h"
+
+#include <cstring>
+
+
+// Only go to a slower setting when the measured time is clearly below the target.
+// Otherwise, the speed would alternate between two levels from image to image.
+static const double kSlowerThreshold = 0.7;
+
+// weight of a new measurement in the smoothed time of a level
+static const double kSmoothingWeight = 0.5;
+
+
+Error EncodingTimeBudget::create(const heif_encoder& encoder, double target_ms_per_megapixel,
+                                 std::shared_ptr<EncodingTimeBudget>& out_budget)
+{
+  std::shared_ptr<EncodingTimeBudget> budget = std::make_shared<EncodingTimeBudget>();
+  budget->m_target_ms_per_megapixel = target_ms_per_megapixel;
+
+  // --- find the speed parameter of the plugin
+
+  const struct heif_encoder_parameter* const* params = encoder.plugin->list_parameters(encoder.encoder);
+
+  for (; params && *params; params++) {
+    const struct heif_encoder_parameter* param = *params;
+
+    // 'speed': larger values are faster (aom, rav1e, SVT-AV1)
+    if (param->type == heif_encoder_parameter_type_integer &&
+        strcmp(param->name, "speed") == 0 &&
+        param->integer.have_minimum_maximum) {
+      for (int v = param->integer.minimum; v <= param->integer.maximum; v++) {
+        budget->m_integer_levels.push_back(v);
+      }
+
+      int current;
+      struct heif_error err = encoder.plugin->get_parameter_integer(encoder.encoder, param->name, &current);
+      if (err.code == heif_error_Ok && current >= param->integer.minimum && current <= param->integer.maximum) {
+        budget->m_level = static_cast<size_t>(current - param->integer.minimum);
+      }
+
+      budget->m_parameter_name = param->name;
+      break;
+    }
+
+    // 'preset': the valid values are listed from fastest to slowest (x265)
+    if (param->type == heif_encoder_parameter_type_string &&
+        strcmp(param->name, "preset") == 0 &&
+        param->string.valid_values) {
+      for (const char* const* v = param->string.valid_values; *v; v++) {
+        budget->m_string_levels.insert(budget->m_string_levels.begin(), *v);
+      }
+
+      char current[64];
+      struct heif_error err = encoder.plugin->get_parameter_string(encoder.encoder, param->name, current, sizeof(current));
+      if (err.code == heif_error_Ok) {
+        for (size_t i = 0; i < budget->m_string_levels.size(); i++) {
+          if (budget->m_string_levels[i] == current) {
+            budget->m_level = i;
+          }
+        }
+      }
+
+      budget->m_parameter_name = param->name;
+      break;
+    }
+  }
+
+  if (budget->num_levels() == 0) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unsupported_parameter,
+                 "Encoder has no speed parameter that could be adapted to the encoding time");
+  }
+
+  budget->m_measured_ms_per_megapixel.resize(budget->num_levels(), 0.0);
+
+  out_budget = std::move(budget);
+  return Error::Ok;
+}
+
+
+Error EncodingTimeBudget::apply(heif_encoder& encoder, size_t& out_level) const
+{
+  size_t level;
+  {
+#if ENABLE_MULTITHREADING_SUPPORT
+    std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+    level = m_level;
+  }
+
+  out_level = level;
+
+  struct heif_error err;
+  if (!m_integer_levels.empty()) {
+    err = encoder.plugin->set_parameter_integer(encoder.encoder, m_parameter_name.c_str(), m_integer_levels[level]);
+  }
+  else {
+    err = encoder.plugin->set_parameter_string(encoder.encoder, m_parameter_name.c_str(), m_string_levels[level].c_str());
+  }
+
+  if (err.code != heif_error_Ok) {
+    return Error(err.code, err.subcode, err.message);
+  }
+
+  return Error::Ok;
+}
+
+
+void EncodingTimeBudget::report_encoding_time(size_t level, double megapixels, double milliseconds)
+{
+  if (megapixels <= 0 || level >= num_levels()) {
+    return;
+  }
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  double ms_per_megapixel = milliseconds / megapixels;
+
+  double& measured = m_measured_ms_per_megapixel[level];
+  if (measured == 0) {
+    measured = ms_per_megapixel;
+  }
+  else {
+    measured = kSmoothingWeight * ms_per_megapixel + (1 - kSmoothingWeight) * measured;
+  }
+
+  // Another image encoded in parallel may already have changed the level.
+  if (level != m_level) {
+    return;
+  }
+
+  if (measured > m_target_ms_per_megapixel) {
+    if (m_level + 1 < num_levels()) {
+      m_level++;
+    }
+  }
+  else if (measured < kSlowerThreshold * m_target_ms_per_megapixel && m_level > 0) {
+    // do not go back to a level that was already measured to be too slow
+    double slower_measured = m_measured_ms_per_megapixel[m_level - 1];
+    if (slower_measured == 0 || slower_measured <= m_target_ms_per_megapixel) {
+      m_level--;
+    }
+  }
+}
@@ -0,0 +1,76 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_ENCODING_TIME_BUDGET_H
+#define LIBHEIF_ENCODING_TIME_BUDGET_H
+
+#include "error.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
+struct heif_encoder;
+
+
+// Adapts the speed setting of an encoder plugin ('speed' or 'preset') over successive encodes
+// such that an image is encoded in about the target time per megapixel.
+// The budget is shared by an encoder and the copies that libheif creates of it for parallel encoding.
+class EncodingTimeBudget
+{
+public:
+  // Returns an error if the plugin has no speed setting that can be controlled.
+  static Error create(const heif_encoder& encoder, double target_ms_per_megapixel,
+                      std::shared_ptr<EncodingTimeBudget>& out_budget);
+
+  // Set the speed of 'encoder' for the next image. Returns the speed level in 'out_level'.
+  Error apply(heif_encoder& encoder, size_t& out_level) const;
+
+  // Report how long the encoding of an image with the speed 'level' took. Chooses the speed for the next images.
+  void report_encoding_time(size_t level, double megapixels, double milliseconds);
+
+  double get_target_ms_per_megapixel() const { return m_target_ms_per_megapixel; }
+
+private:
+  double m_target_ms_per_megapixel = 0;
+
+  std::string m_parameter_name;
+
+  // The speed levels, slowest (best quality) first. Only one of the two lists is used.
+  std::vector<int> m_integer_levels;
+  std::vector<std::string> m_string_levels;
+
+  size_t num_levels() const { return m_integer_levels.empty() ? m_string_levels.size() : m_integer_levels.size(); }
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  mutable std::mutex m_mutex;
+#endif
+
+  size_t m_level = 0;
+
+  // smoothed encoding time per megapixel for each level, 0 if not measured yet
+  std::vector<double> m_measured_ms_per_megapixel;
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "engine.h"
+#include "heif_plugin.h"
+#include "plane_allocator.h"
+#include "thread_pool.h"
+#include "statistics.h"
+
+
+DecoderInstancePool::~DecoderInstancePool()
+{
+  free_idle_decoders();
+}
+
+
+Error DecoderInstancePool::acquire(const struct heif_decoder_plugin* plugin, void** decoder)
+{
+  {
+#if ENABLE_MULTITHREADING_SUPPORT
+    std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+    for (auto iter = m_idle_decoders.begin(); iter != m_idle_decoders.end(); ++iter) {
+      if (iter->plugin == plugin) {
+        *decoder = iter->decoder;
+        m_idle_decoders.erase(iter);
+        return Error::Ok;
+      }
+    }
+  }
+
+  struct heif_error err = plugin->new_decoder(decoder);
+  if (err.code != heif_error_Ok) {
+    return Error(err.code, err.subcode, err.message);
+  }
+
+  statistics::add(statistics::decoder_instances_created);
+
+  return Error::Ok;
+}
+
+
+void DecoderInstancePool::release(const struct heif_decoder_plugin* plugin, void* decoder, bool reusable)
+{
+  if (reusable && plugin->plugin_api_version >= 4 && plugin->reset_image) {
+    plugin->reset_image(decoder);
+
+#if ENABLE_MULTITHREADING_SUPPORT
+    std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+    m_idle_decoders.push_back(DecoderInstance{plugin, decoder});
+  }
+  else {
+    plugin->free_decoder(decoder);
+  }
+}
+
+
+void DecoderInstancePool::free_idle_decoders()
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  for (auto& instance : m_idle_decoders) {
+    instance.plugin->free_decoder(instance.decoder);
+  }
+
+  m_idle_decoders.clear();
+}
+
+
+HeifEngine::HeifEngine(int num_threads, size_t max_cached_bytes, const struct heif_executor* executor)
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  if (executor) {
+    m_thread_pool = std::make_shared<ThreadPool>(*executor);
+  }
+  else if (num_threads > 0) {
+    m_thread_pool = std::make_shared<ThreadPool>(num_threads);
+  }
+#else
+  (void) num_threads;
+  (void) executor;
+#endif
+
+  if (max_cached_bytes > 0) {
+    m_plane_memory_pool = std::make_shared<PlaneMemoryPool>(max_cached_bytes);
+  }
+
+  m_decoder_pool = std::make_shared<DecoderInstancePool>();
+}
@@ -0,0 +1,102 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_ENGINE_H
+#define LIBHEIF_ENGINE_H
+
+#include "error.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
+struct heif_decoder_plugin;
+struct heif_executor;
+class ThreadPool;
+class PlaneMemoryPool;
+
+
+// Idle decoder instances that can be reused for the next image (plugins with reset_image() only).
+// There is at most one instance per concurrently running decoding thread.
+// The pool is thread-safe.
+class DecoderInstancePool
+{
+public:
+  DecoderInstancePool() = default;
+
+  ~DecoderInstancePool();
+
+  DecoderInstancePool(const DecoderInstancePool&) = delete;
+
+  DecoderInstancePool& operator=(const DecoderInstancePool&) = delete;
+
+  // Take an idle decoder of 'plugin' or create a new one.
+  Error acquire(const struct heif_decoder_plugin* plugin, void** decoder);
+
+  // Return the decoder to the pool of idle decoders or free it if it cannot be reused.
+  void release(const struct heif_decoder_plugin* plugin, void* decoder, bool reusable);
+
+  void free_idle_decoders();
+
+private:
+  struct DecoderInstance
+  {
+    const struct heif_decoder_plugin* plugin;
+    void* decoder;
+  };
+
+  std::vector<DecoderInstance> m_idle_decoders;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::mutex m_mutex;
+#endif
+};
+
+
+// The resources that are expensive to set up for each context: the decoding threads, the pool of
+// image memory and the decoder instances. Contexts that are attached to an engine use these
+// instead of their own, so that many short-lived contexts, also on different threads, share them.
+// (The cache of color conversion pipelines is shared by all contexts anyway.)
+class HeifEngine
+{
+public:
+  // 'num_threads' = 0: decode in the calling thread. 'max_cached_bytes' = 0: no memory pool.
+  // With an 'executor', the work is run on it instead of on 'num_threads' own threads.
+  HeifEngine(int num_threads, size_t max_cached_bytes, const struct heif_executor* executor = nullptr);
+
+  // nullptr when decoding runs in the calling thread
+  const std::shared_ptr<ThreadPool>& get_thread_pool() const { return m_thread_pool; }
+
+  // nullptr when no memory pool is used
+  const std::shared_ptr<PlaneMemoryPool>& get_plane_memory_pool() const { return m_plane_memory_pool; }
+
+  const std::shared_ptr<DecoderInstancePool>& get_decoder_pool() const { return m_decoder_pool; }
+
+private:
+  std::shared_ptr<ThreadPool> m_thread_pool;
+  std::shared_ptr<PlaneMemoryPool> m_plane_memory_pool;
+  std::shared_ptr<DecoderInstancePool> m_decoder_pool;
+};
+
+#endif
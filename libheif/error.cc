@@ -70,6 +70,8 @@ const char* Error::get_error_string(heif_error_code err)
       return "Color profile does not exist";
     case heif_error_Plugin_loading_error:
       return "Error while loading plugin";
+    case heif_error_Canceled:
+      return "Canceled";
   }
 
   assert(false);
@@ -158,12 +160,18 @@ const char* Error::get_error_string(heif_suberror_code err)
       return "Unknown NCLX matrix coefficients";
     case heif_suberror_Invalid_region_data:
       return "Invalid region item data";
+    case heif_suberror_Decompression_invalid_data:
+      return "Compressed data is invalid";
 
 
       // --- Memory_allocation_error ---
 
     case heif_suberror_Security_limit_exceeded:
       return "Security limit exceeded";
+    case heif_suberror_Memory_budget_exceeded:
+      return "Memory budget exceeded";
+    case heif_suberror_Decoding_work_limit_exceeded:
+      return "Decoding work limit exceeded";
 
       // --- Usage_error ---
 
@@ -200,6 +208,8 @@ const char* Error::get_error_string(heif_suberror_code err)
       return "Unsupported item construction method";
     case heif_suberror_Unsupported_header_compression_method:
       return "Unsupported header compression method";
+    case heif_suberror_Unsupported_generic_compression_method:
+      return "Unsupported generic compression method";
 
       // --- Encoder_plugin_error --
 
@@ -227,6 +237,13 @@ const char* Error::get_error_string(heif_suberror_code err)
       return "Trying to remove a plugin that is not loaded";
     case heif_suberror_Cannot_read_plugin_directory:
       return "Error while scanning the directory for plugins";
+
+      // --- Canceled ---
+
+    case heif_suberror_Canceled_by_application:
+      return "Canceled by the application";
+    case heif_suberror_Timeout:
+      return "Timeout";
   }
 
   assert(false);
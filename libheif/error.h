@@ -25,6 +25,7 @@
 #include "config.h"
 #endif
 
+#include <atomic>
 #include <cinttypes>
 #include <cstddef>
 
@@ -34,7 +35,9 @@
 #include <limits>
 #include <istream>
 #include <ostream>
+#include <set>
 #include <sstream>
+#include <mutex>
 
 
 #include "heif.h"
@@ -43,11 +46,20 @@
 static constexpr char kSuccess[] = "Success";
 
 
+// Keeps the message of the last error of an object, which is returned in heif_error.message.
+// Errors may be reported from several threads at the same time (e.g. when images of the same
+// context are decoded in parallel). Therefore, each distinct message is kept until the object
+// is destroyed, so that a returned message stays valid while other threads report other errors.
 class ErrorBuffer
 {
 public:
   ErrorBuffer() = default;
 
+  // The error state is not copied.
+  ErrorBuffer(const ErrorBuffer&) {}
+
+  ErrorBuffer& operator=(const ErrorBuffer&) { return *this; }
+
   void set_success()
   {
     m_error_message = c_success;
@@ -55,8 +67,9 @@ public:
 
   void set_error(const std::string& err)
   {
-    m_buffer = err;
-    m_error_message = m_buffer.c_str();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_error_message = m_messages.insert(err).first->c_str();
   }
 
   const char* get_error() const
@@ -66,8 +79,12 @@ public:
 
 private:
   constexpr static const char* c_success = "Success";
-  std::string m_buffer;
-  const char* m_error_message = c_success;
+  std::set<std::string> m_messages;
+  std::atomic<const char*> m_error_message{c_success};
+
+  // Not conditional on ENABLE_MULTITHREADING_SUPPORT, because the class layout has to be the same
+  // in code that is compiled outside of libheif (e.g. the unit tests).
+  std::mutex m_mutex;
 };
 
 
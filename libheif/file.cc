@@ -19,6 +19,8 @@
  */
 
 #include "file.h"
+#include "track.h"
+#include "bitstream_mmap.h"
 #include "libheif/box.h"
 
 #include <cstdint>
@@ -29,6 +31,7 @@
 #include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <chrono>
 
 #if defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)
 
@@ -40,6 +43,8 @@
 #endif
 
 #include "metadata_compression.h"
+#include "security_limits.h"
+#include "statistics.h"
 
 #if WITH_UNCOMPRESSED_CODEC
 #include "uncompressed_image.h"
@@ -67,6 +72,15 @@ std::vector<heif_item_id> HeifFile::get_item_IDs() const
 
 Error HeifFile::read_from_file(const char* input_filename)
 {
+  // Regular files are mapped into memory. This also allows passing the compressed image data
+  // to the decoders without copying it.
+  if (m_use_memory_mapping) {
+    auto mmap_stream = StreamReader_mmap::open(input_filename);
+    if (mmap_stream) {
+      return read(mmap_stream);
+    }
+  }
+
 #if defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)
   auto input_stream_istr = std::unique_ptr<std::istream>(new std::ifstream(convert_utf8_path_to_utf16(input_filename).c_str(), std::ios_base::binary));
 #else
@@ -97,6 +111,11 @@ Error HeifFile::read(const std::shared_ptr<StreamReader>& reader)
 
   uint64_t maxSize = std::numeric_limits<int64_t>::max();
   BitstreamRange range(m_input_stream, maxSize);
+  range.set_memory_arena(m_memory_arena);
+
+  if (!m_file_index.empty()) {
+    return read_boxes_from_file_index();
+  }
 
   Error error = parse_heif_file(range);
   return error;
@@ -164,6 +183,19 @@ void HeifFile::set_brand(heif_compression_format format, bool miaf_compatible)
       m_ftyp_box->add_compatible_brand(fourcc("vvic"));
       break;
 
+    case heif_compression_JPEG:
+      m_ftyp_box->set_major_brand(fourcc("jpeg"));
+      m_ftyp_box->set_minor_version(0);
+      m_ftyp_box->add_compatible_brand(fourcc("jpeg"));
+      m_ftyp_box->add_compatible_brand(fourcc("mif1"));
+      break;
+
+    case heif_compression_uncompressed:
+      m_ftyp_box->set_major_brand(fourcc("mif1"));
+      m_ftyp_box->set_minor_version(0);
+      m_ftyp_box->add_compatible_brand(fourcc("mif1"));
+      break;
+
     default:
       break;
   }
@@ -174,14 +206,435 @@ void HeifFile::set_brand(heif_compression_format format, bool miaf_compatible)
 }
 
 
-void HeifFile::write(StreamWriter& writer)
+void HeifFile::set_brands_from(const HeifFile& src)
+{
+  if (!src.m_ftyp_box) {
+    return;
+  }
+
+  m_ftyp_box->set_major_brand(src.m_ftyp_box->get_major_brand());
+  m_ftyp_box->set_minor_version(0);
+
+  for (uint32_t brand : src.m_ftyp_box->list_brands()) {
+    m_ftyp_box->add_compatible_brand(brand);
+  }
+}
+
+
+Error HeifFile::write(StreamWriter& writer)
+{
+  return write([&writer](const uint8_t* data, size_t size) {
+    writer.write(data, size);
+    return Error::Ok;
+  });
+}
+
+
+Error HeifFile::write(const StreamWriter::output_sink& sink)
 {
+  // The boxes are serialized into a small buffer. The 'mdat' content is passed to the sink
+  // directly from the iloc extents without copying it.
+
+  bool streaming = m_iloc_box->is_streaming_output();
+  if (streaming) {
+    Error err = m_iloc_box->flush_streaming_output();
+    if (err) {
+      return err;
+    }
+  }
+
+  StreamWriter header;
+
   for (auto& box : m_top_level_boxes) {
+    if (streaming && box == m_ftyp_box) {
+      continue; // already written by start_streaming_output()
+    }
+
     box->derive_box_version_recursive();
-    box->write(writer);
+    box->write(header);
+  }
+
+  Error err = m_iloc_box->write_mdat_header_after_iloc(header);
+  if (err) {
+    return err;
+  }
+
+  const auto& header_data = header.get_data();
+  err = sink(header_data.data(), header_data.size());
+  if (err) {
+    return err;
+  }
+
+  return m_iloc_box->write_mdat_data(sink);
+}
+
+
+Error HeifFile::start_streaming_output(heif_compression_format format, const StreamWriter::output_sink& sink)
+{
+  if (!m_ftyp_box || !m_iloc_box || m_input_stream) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "Streaming output is only possible for newly created files");
+  }
+
+  if (m_iloc_box->is_streaming_output()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "Streaming output has already been started");
+  }
+
+  if (m_ftyp_box->get_major_brand() == 0) {
+    set_brand(format, false);
+  }
+
+  StreamWriter ftyp;
+  m_ftyp_box->derive_box_version_recursive();
+  m_ftyp_box->write(ftyp);
+
+  Error err = sink(ftyp.get_data().data(), ftyp.data_size());
+  if (err) {
+    return err;
+  }
+
+  return m_iloc_box->start_streaming_output(sink, ftyp.data_size());
+}
+
+
+// --- updating files in place
+
+// Size of the 'free' box that is written after a 'meta' box that had to be moved to the end of the file.
+static const uint64_t meta_box_padding_size = 4096;
+
+
+static bool read_at(std::iostream& stream, uint64_t position, uint8_t* data, size_t size)
+{
+  stream.clear();
+  stream.seekg(static_cast<std::streamoff>(position));
+  stream.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size));
+  return !stream.fail();
+}
+
+
+static uint64_t read_be(const uint8_t* data, int nBytes)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < nBytes; i++) {
+    value = (value << 8) | data[i];
+  }
+
+  return value;
+}
+
+
+struct BoxLocation
+{
+  uint32_t type;
+  uint64_t start;
+  uint64_t size;
+  uint64_t header_size;
+};
+
+
+// The box headers in [start, end) of the stream or of 'data' (if not null, 'start' and 'end' are indices then).
+static Error scan_box_headers(std::iostream& stream, const uint8_t* data, uint64_t start, uint64_t end,
+                              std::vector<BoxLocation>& boxes)
+{
+  uint64_t position = start;
+
+  while (position < end) {
+    uint8_t header[16];
+    size_t header_bytes = static_cast<size_t>(std::min(end - position, (uint64_t) 16));
+
+    if (header_bytes < 8) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    if (data) {
+      memcpy(header, data + position, header_bytes);
+    }
+    else if (!read_at(stream, position, header, header_bytes)) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_End_of_data);
+    }
+
+    BoxLocation box;
+    box.type = static_cast<uint32_t>(read_be(header + 4, 4));
+    box.start = position;
+    box.size = read_be(header, 4);
+    box.header_size = 8;
+
+    if (box.size == 1 && header_bytes == 16) {
+      box.size = read_be(header + 8, 8);
+      box.header_size = 16;
+    }
+    else if (box.size == 0) {
+      // The box extends to the end. Data appended to the file would be part of it.
+      box.size = end - position;
+      if (!data) {
+        return Error(heif_error_Unsupported_feature,
+                     heif_suberror_Unspecified,
+                     "Files with a box that extends to the end of the file cannot be updated in place");
+      }
+    }
+
+    if (box.size < box.header_size || box.size > end - position) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Invalid_box_size);
+    }
+
+    boxes.push_back(box);
+    position += box.size;
+  }
+
+  return Error::Ok;
+}
+
+
+static void write_free_box_header(StreamWriter& writer, uint64_t size)
+{
+  if (size <= 0xFFFFFFFF) {
+    writer.write32(static_cast<uint32_t>(size));
+    writer.write32(fourcc("free"));
+  }
+  else {
+    writer.write32(1);
+    writer.write32(fourcc("free"));
+    writer.write64(size);
+  }
+}
+
+
+Error HeifFile::write_in_place(std::iostream& stream)
+{
+  if (!m_input_stream || !m_meta_box || !m_iloc_box || m_iloc_box->is_streaming_output()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "Only files that have been read can be updated in place");
+  }
+
+  const Error file_modified(heif_error_Usage_error,
+                            heif_suberror_Unspecified,
+                            "The file has been modified since it was read");
+
+  // --- find the 'meta' box and the space behind it
+
+  stream.clear();
+  stream.seekg(0, std::ios::end);
+  if (stream.fail()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "Cannot seek in the file");
+  }
+
+  uint64_t file_size = static_cast<uint64_t>(stream.tellg());
+
+  std::vector<BoxLocation> top_level_boxes;
+  Error err = scan_box_headers(stream, nullptr, 0, file_size, top_level_boxes);
+  if (err) {
+    return err;
+  }
+
+  size_t meta_idx = top_level_boxes.size();
+  for (size_t i = 0; i < top_level_boxes.size(); i++) {
+    if (top_level_boxes[i].type == fourcc("meta")) {
+      meta_idx = i;
+      break;
+    }
+  }
+
+  if (meta_idx == top_level_boxes.size()) {
+    return file_modified;
+  }
+
+  const BoxLocation& meta = top_level_boxes[meta_idx];
+
+  bool meta_range_known = false;
+  for (const auto& range : m_index_box_ranges) {
+    meta_range_known |= (range.offset == meta.start && range.size == meta.size);
+  }
+
+  if (!meta_range_known || meta.size > MAX_MEMORY_BLOCK_SIZE || meta.size < meta.header_size + 4) {
+    return file_modified;
+  }
+
+  uint64_t available_space = meta.size;
+  if (meta_idx + 1 < top_level_boxes.size() &&
+      (top_level_boxes[meta_idx + 1].type == fourcc("free") ||
+       top_level_boxes[meta_idx + 1].type == fourcc("skip"))) {
+    available_space += top_level_boxes[meta_idx + 1].size;
+  }
+
+
+  // --- read the old 'meta' box. Its child boxes that did not change are copied unchanged.
+
+  std::vector<uint8_t> old_meta(static_cast<size_t>(meta.size));
+  if (!read_at(stream, meta.start, old_meta.data(), old_meta.size())) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_End_of_data);
+  }
+
+  size_t meta_content_start = static_cast<size_t>(meta.header_size + 4); // FullBox
+  std::vector<BoxLocation> old_children;
+  err = scan_box_headers(stream, old_meta.data(), meta_content_start, meta.size, old_children);
+  if (err) {
+    return err;
+  }
+
+  const auto& children = m_meta_box->get_all_child_boxes();
+  if (old_children.size() > children.size()) {
+    return file_modified;
+  }
+
+
+  // --- place the new item data at the end of the file
+
+  uint64_t new_data_size;
+  err = m_iloc_box->place_new_data(file_size + 8, &new_data_size);
+  if (err) {
+    return err;
+  }
+
+  uint64_t mdat_header_size = 8;
+  if (new_data_size + 8 > 0xFFFFFFFF) {
+    mdat_header_size = 16;
+    m_iloc_box->place_new_data(file_size + mdat_header_size, &new_data_size);
+  }
+
+  uint64_t mdat_size = (new_data_size > 0 ? mdat_header_size + new_data_size : 0);
+
+
+  // --- write the new 'meta' box into memory
+
+  StreamWriter meta_writer;
+  meta_writer.write32(0); // size, filled in below
+  meta_writer.write32(fourcc("meta"));
+  meta_writer.write(old_meta.data() + meta.header_size, 4); // version and flags
+
+  for (size_t i = 0; i < children.size(); i++) {
+    uint32_t type = children[i]->get_short_type();
+
+    if (i < old_children.size()) {
+      if (old_children[i].type != type) {
+        return file_modified;
+      }
+
+      if (type != fourcc("pitm") &&
+          type != fourcc("iloc") &&
+          type != fourcc("iinf") &&
+          type != fourcc("iref") &&
+          type != fourcc("iprp")) {
+        meta_writer.write(old_meta.data() + old_children[i].start, static_cast<size_t>(old_children[i].size));
+        continue;
+      }
+    }
+
+    children[i]->derive_box_version_recursive();
+    err = children[i]->write(meta_writer);
+    if (err) {
+      return err;
+    }
+  }
+
+  m_iloc_box->patch_iloc_header(meta_writer);
+
+  uint64_t new_meta_size = meta_writer.data_size();
+  if (new_meta_size > 0xFFFFFFFF) {
+    return Error(heif_error_Encoding_error,
+                 heif_suberror_Unspecified,
+                 "The 'meta' box is too large");
+  }
+
+  meta_writer.set_position(0);
+  meta_writer.write32(static_cast<uint32_t>(new_meta_size));
+  meta_writer.set_position(meta_writer.data_size());
+
+  bool meta_fits = (new_meta_size == available_space || new_meta_size + 8 <= available_space);
+
+
+  // --- write the changes
+
+  stream.clear();
+
+  if (mdat_size > 0) {
+    StreamWriter mdat_header;
+    if (mdat_header_size == 8) {
+      mdat_header.write32(static_cast<uint32_t>(mdat_size));
+      mdat_header.write32(fourcc("mdat"));
+    }
+    else {
+      mdat_header.write32(1);
+      mdat_header.write32(fourcc("mdat"));
+      mdat_header.write64(mdat_size);
+    }
+
+    stream.seekp(static_cast<std::streamoff>(file_size));
+    stream.write(reinterpret_cast<const char*>(mdat_header.get_data().data()), mdat_header.data_size());
+
+    err = m_iloc_box->write_mdat_data([&stream](const uint8_t* data, size_t size) {
+      stream.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+      return Error::Ok;
+    });
+    if (err) {
+      return err;
+    }
+  }
+
+  uint64_t new_meta_position;
+
+  if (meta_fits) {
+    new_meta_position = meta.start;
+
+    if (new_meta_size < available_space) {
+      // Only the header of the 'free' box is written, its content is the old 'meta' box data.
+      write_free_box_header(meta_writer, available_space - new_meta_size);
+    }
+
+    stream.seekp(static_cast<std::streamoff>(meta.start));
+    stream.write(reinterpret_cast<const char*>(meta_writer.get_data().data()), meta_writer.data_size());
+  }
+  else {
+    new_meta_position = file_size + mdat_size;
+
+    write_free_box_header(meta_writer, meta_box_padding_size);
+    meta_writer.write(std::vector<uint8_t>(static_cast<size_t>(meta_box_padding_size - 8), 0));
+
+    stream.seekp(static_cast<std::streamoff>(new_meta_position));
+    stream.write(reinterpret_cast<const char*>(meta_writer.get_data().data()), meta_writer.data_size());
+    stream.flush();
+
+    // The old 'meta' box is turned into a 'free' box after the new one has been written.
+
+    StreamWriter free_header;
+    write_free_box_header(free_header, available_space);
+
+    stream.seekp(static_cast<std::streamoff>(meta.start));
+    stream.write(reinterpret_cast<const char*>(free_header.get_data().data()), free_header.data_size());
+  }
+
+  stream.flush();
+  if (stream.fail()) {
+    return Error(heif_error_Encoding_error,
+                 heif_suberror_Cannot_write_output_data);
+  }
+
+
+  // --- the file now matches the boxes in memory
+
+  m_iloc_box->release_placed_data();
+
+  for (auto& range : m_index_box_ranges) {
+    if (range.offset == meta.start && range.size == meta.size) {
+      range.offset = new_meta_position;
+      range.size = new_meta_size;
+    }
   }
 
-  m_iloc_box->write_mdat_after_iloc(writer);
+  if (m_file_size != 0) {
+    m_file_size = std::max(file_size, new_meta_position + meta_writer.data_size());
+  }
+
+  return Error::Ok;
 }
 
 
@@ -214,8 +667,42 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
   // --- read all top-level boxes
 
   for (;;) {
+    if (m_read_metadata_only) {
+      if (m_ftyp_box && m_meta_box) {
+        break;
+      }
+
+      // Do not read (or wait for) the content of other boxes. Only their header is read and the
+      // box is skipped.
+
+      if (m_ftyp_box) {
+        Error error = skip_top_level_box(range);
+        if (error) {
+          return error;
+        }
+
+        if (m_meta_box || range.error() || range.eof()) {
+          break;
+        }
+
+        continue;
+      }
+    }
+
     std::shared_ptr<Box> box;
-    Error error = Box::read(range, &box);
+
+    int64_t box_start = range.get_istream()->get_position();
+
+    BoxHeader hdr;
+    Error error = hdr.parse_header(range);
+    if (error == Error::Ok && !range.error()) {
+      if (hdr.get_short_type() == fourcc("meta")) {
+        error = read_meta_box(range, hdr, &box);
+      }
+      else {
+        error = Box::read(range, hdr, &box);
+      }
+    }
 
     // When an EOF error is returned, this is not really a fatal exception,
     // but simply the indication that we reached the end of the file.
@@ -225,6 +712,11 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
 
     m_top_level_boxes.push_back(box);
 
+    auto box_end = static_cast<uint64_t>(range.get_istream()->get_position());
+    if (!m_read_metadata_only) {
+      m_file_size = std::max(m_file_size, box_end);
+    }
+
 
     // extract relevant boxes (ftyp, meta)
 
@@ -235,8 +727,23 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
     if (box->get_short_type() == fourcc("ftyp")) {
       m_ftyp_box = std::dynamic_pointer_cast<Box_ftyp>(box);
     }
+
+    if (box->get_short_type() == fourcc("moov")) {
+      m_moov_box = std::dynamic_pointer_cast<Box_moov>(box);
+    }
+
+    if (box->get_short_type() == fourcc("meta") ||
+        box->get_short_type() == fourcc("ftyp")) {
+      m_index_box_ranges.push_back(FileRange{static_cast<uint64_t>(box_start), box_end - static_cast<uint64_t>(box_start)});
+    }
   }
 
+  return extract_heif_boxes();
+}
+
+
+Error HeifFile::extract_heif_boxes()
+{
 
 
   // --- check whether this is a HEIF file and its structural format
@@ -249,7 +756,9 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
   if (!m_ftyp_box->has_compatible_brand(fourcc("heic")) &&
       !m_ftyp_box->has_compatible_brand(fourcc("heix")) &&
       !m_ftyp_box->has_compatible_brand(fourcc("mif1")) &&
-      !m_ftyp_box->has_compatible_brand(fourcc("avif"))) {
+      !m_ftyp_box->has_compatible_brand(fourcc("avif")) &&
+      !m_ftyp_box->has_compatible_brand(fourcc("msf1")) &&
+      !m_ftyp_box->has_compatible_brand(fourcc("avis"))) {
     std::stringstream sstr;
     sstr << "File does not include any supported brands.\n";
 
@@ -349,33 +858,299 @@ Error HeifFile::parse_heif_file(BitstreamRange& range)
 }
 
 
-Error HeifFile::check_for_ref_cycle(heif_item_id ID,
-                                    std::shared_ptr<Box_iref>& iref_box) const
+Error HeifFile::read_meta_box(BitstreamRange& range, const BoxHeader& hdr, std::shared_ptr<Box>* box)
 {
-  std::unordered_set<heif_item_id> parent_items;
-  return check_for_ref_cycle_recursion(ID, iref_box, parent_items);
-}
+  auto istr = range.get_istream();
 
-
-Error HeifFile::check_for_ref_cycle_recursion(heif_item_id ID,
-                                    std::shared_ptr<Box_iref>& iref_box,
-                                    std::unordered_set<heif_item_id>& parent_items) const {
-  if (parent_items.find(ID) != parent_items.end()) {
+  if (hdr.get_box_size() < hdr.get_header_size() ||
+      hdr.get_box_size() - hdr.get_header_size() > (uint64_t) range.get_remaining_bytes()) {
     return Error(heif_error_Invalid_input,
-                 heif_suberror_Item_reference_cycle,
-                 "Image reference cycle");
+                 heif_suberror_Invalid_box_size);
   }
-  parent_items.insert(ID);
 
-  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
-  for (heif_item_id reference_idx : image_references) {
-    Error error = check_for_ref_cycle_recursion(reference_idx, iref_box, parent_items);
-    if (error) {
-      return error;
-    }
+  int64_t content_size = static_cast<int64_t>(hdr.get_box_size() - hdr.get_header_size());
+  int64_t content_start = istr->get_position();
+
+  // Memory streams can be parsed directly. Very large boxes are also parsed from the stream
+  // instead of buffering them.
+  if (istr->get_memory_view(content_start, static_cast<size_t>(content_size)) != nullptr ||
+      content_size > MAX_MEMORY_BLOCK_SIZE) {
+    return Box::read(range, hdr, box);
   }
 
-  parent_items.erase(ID);
+
+  // --- read the complete box content with a single read and parse it from memory
+
+  auto status = range.wait_for_available_bytes(content_size);
+  if (status != StreamReader::size_reached) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_End_of_data);
+  }
+
+  std::vector<uint8_t> content(static_cast<size_t>(content_size));
+  if (content_size > 0 && !range.read(content.data(), content_size)) {
+    return range.get_error();
+  }
+
+  auto section = std::make_shared<StreamReader_section>(std::move(content), content_start);
+  BitstreamRange section_range(section, content_size);
+  section_range.set_memory_arena(range.get_memory_arena());
+
+  return Box::read(section_range, hdr, box);
+}
+
+
+Error HeifFile::skip_top_level_box(BitstreamRange& range)
+{
+  int64_t box_start = range.get_istream()->get_position();
+
+  BoxHeader hdr;
+  Error err = hdr.parse_header(range);
+  if (err || range.error() || range.eof()) {
+    // end of file
+    return Error::Ok;
+  }
+
+  if (hdr.get_short_type() == fourcc("meta")) {
+    std::shared_ptr<Box> box;
+    err = read_meta_box(range, hdr, &box);
+    if (err) {
+      return err;
+    }
+
+    m_top_level_boxes.push_back(box);
+    m_meta_box = std::dynamic_pointer_cast<Box_meta>(box);
+    m_index_box_ranges.push_back(FileRange{static_cast<uint64_t>(box_start),
+                                           static_cast<uint64_t>(range.get_istream()->get_position() - box_start)});
+    return Error::Ok;
+  }
+
+  if (hdr.get_box_size() == 0) {
+    // box extends to the end of the file
+    range.skip_to_end_of_file();
+    return Error::Ok;
+  }
+
+  if (hdr.get_box_size() < hdr.get_header_size() ||
+      hdr.get_box_size() - hdr.get_header_size() > (uint64_t) range.get_remaining_bytes()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_box_size);
+  }
+
+  BitstreamRange boxrange(range.get_istream(),
+                          hdr.get_box_size() - hdr.get_header_size(),
+                          &range);
+  boxrange.skip_to_end_of_box();
+
+  return Error::Ok;
+}
+
+
+// --- file index
+//
+// The index stores the raw 'ftyp' and 'meta' boxes together with their file positions:
+//
+//   u32 'hidx', u8 version (1), u64 file size, u32 number of boxes,
+//   { u64 file position, u64 box size, box data }*,
+//   u64 FNV-1a checksum of all preceding bytes
+
+static const uint8_t file_index_version = 1;
+
+static uint64_t file_index_checksum(const uint8_t* data, size_t size)
+{
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3;
+  }
+
+  return hash;
+}
+
+
+static uint64_t read64(BitstreamRange& range)
+{
+  uint64_t high = range.read32();
+  uint64_t low = range.read32();
+  return (high << 32) | low;
+}
+
+
+Error HeifFile::write_file_index(StreamWriter& writer) const
+{
+  if (!m_input_stream || m_file_size == 0 || m_index_box_ranges.size() != 2) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "A file index can only be written for files that have been read completely");
+  }
+
+  StreamWriter index;
+  index.write32(fourcc("hidx"));
+  index.write8(file_index_version);
+  index.write64(m_file_size);
+  index.write32(static_cast<uint32_t>(m_index_box_ranges.size()));
+
+  for (const auto& box_range : m_index_box_ranges) {
+    if (box_range.size > MAX_MEMORY_BLOCK_SIZE) {
+      return Error(heif_error_Memory_allocation_error,
+                   heif_suberror_Security_limit_exceeded);
+    }
+
+    std::vector<uint8_t> data(static_cast<size_t>(box_range.size));
+
+    {
+#if ENABLE_PARALLEL_TILE_DECODING
+      auto guard = lock_input_stream();
+#endif
+
+      if (m_input_stream->wait_for_file_size(static_cast<int64_t>(box_range.offset + box_range.size)) != StreamReader::size_reached ||
+          !m_input_stream->read_at(static_cast<int64_t>(box_range.offset), data.data(), data.size())) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_End_of_data);
+      }
+    }
+
+    index.write64(box_range.offset);
+    index.write64(box_range.size);
+    index.write(data);
+  }
+
+  auto index_data = index.get_data();
+  index.write64(file_index_checksum(index_data.data(), index_data.size()));
+
+  writer.write(index);
+
+  return Error::Ok;
+}
+
+
+Error HeifFile::read_boxes_from_file_index()
+{
+  Error index_mismatch(heif_error_Usage_error,
+                       heif_suberror_Invalid_parameter_value,
+                       "File index does not match the input file");
+
+  const size_t checksum_size = 8;
+  if (m_file_index.size() < checksum_size) {
+    return index_mismatch;
+  }
+
+  size_t content_size = m_file_index.size() - checksum_size;
+
+  uint64_t checksum = 0;
+  for (size_t i = 0; i < checksum_size; i++) {
+    checksum = (checksum << 8) | m_file_index[content_size + i];
+  }
+
+  if (checksum != file_index_checksum(m_file_index.data(), content_size)) {
+    return index_mismatch;
+  }
+
+  auto index_stream = std::make_shared<StreamReader_memory>(m_file_index.data(), content_size, false);
+  BitstreamRange content(index_stream, content_size);
+
+  if (content.read32() != fourcc("hidx") ||
+      content.read8() != file_index_version) {
+    return index_mismatch;
+  }
+
+  uint64_t file_size = read64(content);
+  uint32_t num_boxes = content.read32();
+
+
+  // --- the input has to have exactly the size of the indexed file
+
+  if (content.error() ||
+      file_size == 0 ||
+      file_size >= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) ||
+      m_input_stream->wait_for_file_size(static_cast<int64_t>(file_size)) != StreamReader::size_reached ||
+      m_input_stream->wait_for_file_size(static_cast<int64_t>(file_size + 1)) != StreamReader::size_beyond_eof) {
+    return index_mismatch;
+  }
+
+
+  // --- parse the stored boxes from memory, keeping their original file positions
+
+  for (uint32_t i = 0; i < num_boxes; i++) {
+    FileRange box_range;
+    box_range.offset = read64(content);
+    box_range.size = read64(content);
+
+    if (content.error() ||
+        box_range.size > static_cast<uint64_t>(content.get_remaining_bytes()) ||
+        box_range.offset > file_size ||
+        box_range.size > file_size - box_range.offset) {
+      return index_mismatch;
+    }
+
+    std::vector<uint8_t> data(static_cast<size_t>(box_range.size));
+    if (!content.read(data.data(), static_cast<int64_t>(data.size()))) {
+      return index_mismatch;
+    }
+
+    auto section = std::make_shared<StreamReader_section>(std::move(data), static_cast<int64_t>(box_range.offset));
+    BitstreamRange box_stream(section, box_range.size);
+    box_stream.set_memory_arena(m_memory_arena);
+
+    BoxHeader hdr;
+    Error err = hdr.parse_header(box_stream);
+    if (err) {
+      return err;
+    }
+
+    std::shared_ptr<Box> box;
+    err = Box::read(box_stream, hdr, &box);
+    if (err) {
+      return err;
+    }
+
+    if (box->get_short_type() == fourcc("meta")) {
+      m_meta_box = std::dynamic_pointer_cast<Box_meta>(box);
+    }
+    else if (box->get_short_type() == fourcc("ftyp")) {
+      m_ftyp_box = std::dynamic_pointer_cast<Box_ftyp>(box);
+    }
+    else {
+      return index_mismatch;
+    }
+
+    m_top_level_boxes.push_back(box);
+    m_index_box_ranges.push_back(box_range);
+  }
+
+  m_file_size = file_size;
+
+  return extract_heif_boxes();
+}
+
+
+Error HeifFile::check_for_ref_cycle(heif_item_id ID,
+                                    std::shared_ptr<Box_iref>& iref_box) const
+{
+  std::unordered_set<heif_item_id> parent_items;
+  return check_for_ref_cycle_recursion(ID, iref_box, parent_items);
+}
+
+
+Error HeifFile::check_for_ref_cycle_recursion(heif_item_id ID,
+                                    std::shared_ptr<Box_iref>& iref_box,
+                                    std::unordered_set<heif_item_id>& parent_items) const {
+  if (parent_items.find(ID) != parent_items.end()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Item_reference_cycle,
+                 "Image reference cycle");
+  }
+  parent_items.insert(ID);
+
+  std::vector<heif_item_id> image_references = iref_box->get_references(ID, fourcc("dimg"));
+  for (heif_item_id reference_idx : image_references) {
+    Error error = check_for_ref_cycle_recursion(reference_idx, iref_box, parent_items);
+    if (error) {
+      return error;
+    }
+  }
+
+  parent_items.erase(ID);
   return Error::Ok;
 }
 
@@ -438,6 +1213,23 @@ Error HeifFile::get_properties(heif_item_id imageID,
 }
 
 
+Error HeifFile::get_properties(heif_item_id imageID,
+                               const std::vector<uint32_t>& property_box_types,
+                               std::vector<std::shared_ptr<Box>>& properties) const
+{
+  if (!m_ipco_box) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_ipco_box);
+  }
+  else if (!m_ipma_box) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_ipma_box);
+  }
+
+  return m_ipco_box->get_properties_for_item_ID(imageID, m_ipma_box, property_box_types, properties);
+}
+
+
 heif_chroma HeifFile::get_image_chroma_from_configuration(heif_item_id imageID) const
 {
   // HEVC
@@ -528,6 +1320,12 @@ int HeifFile::get_luma_bits_per_pixel_from_configuration(heif_item_id imageID) c
     }
   }
 
+  // JPEG (12 bit JPEGs are not supported by the decoders)
+
+  if (image_type == "jpeg") {
+    return 8;
+  }
+
 #if WITH_UNCOMPRESSED_CODEC
   // Uncompressed
 
@@ -535,80 +1333,453 @@ int HeifFile::get_luma_bits_per_pixel_from_configuration(heif_item_id imageID) c
     int bpp = UncompressedImageCodec::get_luma_bits_per_pixel_from_configuration_unci(*this, imageID);
     return bpp;
   }
-#endif
+#endif
+
+  return -1;
+}
+
+
+int HeifFile::get_chroma_bits_per_pixel_from_configuration(heif_item_id imageID) const
+{
+  std::string image_type = get_item_type(imageID);
+
+  // HEVC
+
+  if (image_type == "hvc1") {
+    auto box = m_ipco_box->get_property_for_item_ID(imageID, m_ipma_box, fourcc("hvcC"));
+    std::shared_ptr<Box_hvcC> hvcC_box = std::dynamic_pointer_cast<Box_hvcC>(box);
+    if (hvcC_box) {
+      return hvcC_box->get_configuration().bit_depth_chroma;
+    }
+  }
+
+  // AV1
+
+  if (image_type == "av01") {
+    auto box = m_ipco_box->get_property_for_item_ID(imageID, m_ipma_box, fourcc("av1C"));
+    std::shared_ptr<Box_av1C> av1C_box = std::dynamic_pointer_cast<Box_av1C>(box);
+    if (av1C_box) {
+      Box_av1C::configuration config = av1C_box->get_configuration();
+      if (!config.high_bitdepth) {
+        return 8;
+      }
+      else if (config.twelve_bit) {
+        return 12;
+      }
+      else {
+        return 10;
+      }
+    }
+  }
+
+  // JPEG
+
+  if (image_type == "jpeg") {
+    return 8;
+  }
+
+  return -1;
+}
+
+
+const Box_iloc::Item* HeifFile::get_iloc_item(heif_item_id ID) const
+{
+  if (!m_iloc_box) {
+    return nullptr;
+  }
+
+  return m_iloc_box->get_item(ID);
+}
+
+
+Error HeifFile::get_codec_headers(heif_item_id ID, const std::string& item_type,
+                                  std::shared_ptr<const std::vector<uint8_t>>* out_headers) const
+{
+  out_headers->reset();
+
+  uint32_t config_type;
+  heif_suberror_code missing_config_error;
+  if (item_type == "hvc1") {
+    config_type = fourcc("hvcC");
+    missing_config_error = heif_suberror_No_hvcC_box;
+  }
+  else if (item_type == "av01") {
+    config_type = fourcc("av1C");
+    missing_config_error = heif_suberror_No_av1C_box;
+  }
+  else if (item_type == "jpeg") {
+    config_type = fourcc("jpgC");
+    missing_config_error = heif_suberror_Unspecified;
+  }
+  else {
+    return Error::Ok;
+  }
+
+  // We are checking for the codec configuration in heif_context::interpret_heif_file(),
+  // except when only the metadata was read.
+  std::shared_ptr<const Box> config_box = m_ipco_box->get_property_for_item_ID(ID, m_ipma_box, config_type);
+  if (!config_box) {
+    if (item_type == "jpeg") {
+      // The 'jpgC' property is optional. Without it, the item data is a complete JPEG file.
+      static const auto no_headers = std::make_shared<const std::vector<uint8_t>>();
+      *out_headers = no_headers;
+      return Error::Ok;
+    }
+
+    return Error(heif_error_Invalid_input,
+                 missing_config_error);
+  }
+
+  {
+#if ENABLE_PARALLEL_TILE_DECODING
+    std::lock_guard<std::mutex> lock(m_codec_headers_mutex);
+#endif
+
+    auto iter = m_codec_headers.find(config_box);
+    if (iter != m_codec_headers.end()) {
+      *out_headers = iter->second;
+      return Error::Ok;
+    }
+  }
+
+  auto headers = std::make_shared<std::vector<uint8_t>>();
+  bool success = false;
+
+  if (auto hvcC_box = std::dynamic_pointer_cast<const Box_hvcC>(config_box)) {
+    success = hvcC_box->get_headers(headers.get());
+  }
+  else if (auto av1C_box = std::dynamic_pointer_cast<const Box_av1C>(config_box)) {
+    success = av1C_box->get_headers(headers.get());
+  }
+  else if (auto jpgC_box = std::dynamic_pointer_cast<const Box_jpgC>(config_box)) {
+    success = jpgC_box->get_headers(headers.get());
+  }
+  else {
+    return Error(heif_error_Invalid_input,
+                 missing_config_error);
+  }
+
+  if (!success) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_item_data);
+  }
+
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(m_codec_headers_mutex);
+#endif
+
+  // When two threads built the headers concurrently, the first one wins.
+  *out_headers = m_codec_headers.emplace(config_box, std::move(headers)).first->second;
+  return Error::Ok;
+}
+
+
+Error HeifFile::append_item_file_ranges(heif_item_id ID, std::vector<FileRange>& ranges) const
+{
+  const Box_iloc::Item* item = get_iloc_item(ID);
+  if (!item) {
+    std::stringstream sstr;
+    sstr << "Item with ID " << ID << " has no compressed data";
+
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_item_data,
+                 sstr.str());
+  }
+
+  return m_iloc_box->get_file_ranges(*item, m_idat_box, ranges);
+}
+
+
+#if ENABLE_PARALLEL_TILE_DECODING
+std::unique_lock<std::mutex> HeifFile::lock_input_stream() const
+{
+  if (m_input_stream && m_input_stream->has_concurrent_read_at()) {
+    return std::unique_lock<std::mutex>();
+  }
+
+  // Only the time of contended locks is measured, such that the common case stays cheap.
+  std::unique_lock<std::mutex> lock(m_read_mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    auto start = std::chrono::steady_clock::now();
+    lock.lock();
+    auto wait_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    statistics::add(statistics::read_lock_wait_ns, static_cast<uint64_t>(wait_time.count()));
+  }
+
+  return lock;
+}
+#endif
+
+
+#if ENABLE_PARALLEL_TILE_DECODING
+void HeifFile::add_prefetched_data(heif_item_id ID, std::vector<uint8_t>&& data) const
+{
+  std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+  m_prefetched_data[ID] = std::move(data);
+}
+
+
+void HeifFile::remove_prefetched_data(const std::vector<heif_item_id>& IDs) const
+{
+  std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+  for (heif_item_id id : IDs) {
+    m_prefetched_data.erase(id);
+  }
+}
+
+
+bool HeifFile::take_prefetched_data(heif_item_id ID, std::vector<uint8_t>* data) const
+{
+  std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+
+  auto iter = m_prefetched_data.find(ID);
+  if (iter == m_prefetched_data.end()) {
+    return false;
+  }
+
+  if (data->empty()) {
+    *data = std::move(iter->second);
+  }
+  else {
+    data->insert(data->end(), iter->second.begin(), iter->second.end());
+  }
+  m_prefetched_data.erase(iter);
+  return true;
+}
+#endif
+
+
+Error HeifFile::get_compressed_image_data(heif_item_id ID, std::vector<uint8_t>* data) const
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  {
+    CodedImageData prefetched;
+    if (take_prefetched_data(ID, &prefetched.buffer)) {
+      // the prefetched data of coded images does not include the codec headers
+      auto infe_box = get_infe(ID);
+      if (infe_box) {
+        Error error = get_codec_headers(ID, infe_box->get_item_type(), &prefetched.headers);
+        if (error) {
+          return error;
+        }
+      }
+
+      if (prefetched.headers) {
+        data->insert(data->end(), prefetched.headers->begin(), prefetched.headers->end());
+      }
+      data->insert(data->end(), prefetched.buffer.begin(), prefetched.buffer.end());
+      return Error::Ok;
+    }
+  }
+
+  auto guard = lock_input_stream();
+#endif
+
+  if (!image_exists(ID)) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
+
+  auto infe_box = get_infe(ID);
+  if (!infe_box) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
+
+
+  std::string item_type = infe_box->get_item_type();
+  std::string content_type = infe_box->get_content_type();
+
+  // --- get coded image data pointers
+
+  const Box_iloc::Item* item = get_iloc_item(ID);
+  if (!item) {
+    std::stringstream sstr;
+    sstr << "Item with ID " << ID << " has no compressed data";
+
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_No_item_data,
+                 sstr.str());
+  }
+
+  Error error = Error(heif_error_Unsupported_feature,
+                      heif_suberror_Unsupported_codec);
+  if (item_type == "hvc1" ||
+      item_type == "av01" ||
+      item_type == "jpeg") {
+    std::shared_ptr<const std::vector<uint8_t>> headers;
+    error = get_codec_headers(ID, item_type, &headers);
+    if (error) {
+      return error;
+    }
+
+    data->insert(data->end(), headers->begin(), headers->end());
+
+    error = m_iloc_box->read_data(*item, m_input_stream, m_idat_box, data);
+  }
+  else if (true ||  // fallback case for all kinds of generic metadata (e.g. 'iptc')
+           item_type == "grid" ||
+           item_type == "iovl" ||
+           item_type == "Exif" ||
+           (item_type == "mime" && content_type == "application/rdf+xml")) {
+
+    bool read_uncompressed = true;
+    if (item_type == "mime") {
+      std::string encoding = infe_box->get_content_encoding();
+      if (encoding == "deflate") {
+#if WITH_DEFLATE_HEADER_COMPRESSION
+        read_uncompressed = false;
+        std::vector<uint8_t> compressed_data;
+        error = m_iloc_box->read_data(*item, m_input_stream, m_idat_box, &compressed_data);
+        if (error) {
+          return error;
+        }
+
+        error = inflate(compressed_data.data(), compressed_data.size(), MAX_MEMORY_BLOCK_SIZE, data);
+#else
+        return Error(heif_error_Unsupported_feature,
+                     heif_suberror_Unsupported_header_compression_method,
+                     encoding);
+#endif
+      }
+    }
+
+    if (read_uncompressed) {
+      error = m_iloc_box->read_data(*item, m_input_stream, m_idat_box, data);
+    }
+  }
+
+  if (error != Error::Ok) {
+    return error;
+  }
+
+  return Error::Ok;
+}
+
+
+Error HeifFile::get_coded_image_data(heif_item_id ID, CodedImageData& out) const
+{
+  out = CodedImageData();
+
+  auto infe_box = get_infe(ID);
+  if (!infe_box) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
+
+  std::string item_type = infe_box->get_item_type();
+  if (item_type != "hvc1" &&
+      item_type != "av01" &&
+      item_type != "jpeg") {
+    // other item types may need a conversion of the data (e.g. decompression)
+    Error error = get_compressed_image_data(ID, &out.buffer);
+    out.data = out.buffer.data();
+    out.size = out.buffer.size();
+    return error;
+  }
+
+  Error error = get_codec_headers(ID, item_type, &out.headers);
+  if (error) {
+    return error;
+  }
+
+  bool prefetched = false;
+#if ENABLE_PARALLEL_TILE_DECODING
+  prefetched = take_prefetched_data(ID, &out.buffer);
+#endif
+
+  if (!prefetched) {
+#if ENABLE_PARALLEL_TILE_DECODING
+    auto guard = lock_input_stream();
+#endif
+    const Box_iloc::Item* item = get_iloc_item(ID);
+    if (!item) {
+      std::stringstream sstr;
+      sstr << "Item with ID " << ID << " has no compressed data";
+
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_item_data,
+                   sstr.str());
+    }
+
+    if (m_iloc_box->get_data_view(*item, m_input_stream, &out.data, &out.size)) {
+      return Error::Ok;
+    }
+
+    error = m_iloc_box->read_data(*item, m_input_stream, m_idat_box, &out.buffer);
+    if (error) {
+      return error;
+    }
+  }
 
-  return -1;
+  out.data = out.buffer.data();
+  out.size = out.buffer.size();
+  return Error::Ok;
 }
 
 
-int HeifFile::get_chroma_bits_per_pixel_from_configuration(heif_item_id imageID) const
+bool HeifFile::get_item_data_view(heif_item_id ID, const uint8_t** out_data, size_t* out_size) const
 {
-  std::string image_type = get_item_type(imageID);
-
-  // HEVC
-
-  if (image_type == "hvc1") {
-    auto box = m_ipco_box->get_property_for_item_ID(imageID, m_ipma_box, fourcc("hvcC"));
-    std::shared_ptr<Box_hvcC> hvcC_box = std::dynamic_pointer_cast<Box_hvcC>(box);
-    if (hvcC_box) {
-      return hvcC_box->get_configuration().bit_depth_chroma;
-    }
+  if (!m_input_stream) {
+    return false;
   }
 
-  // AV1
+#if ENABLE_PARALLEL_TILE_DECODING
+  auto guard = lock_input_stream();
+#endif
 
-  if (image_type == "av01") {
-    auto box = m_ipco_box->get_property_for_item_ID(imageID, m_ipma_box, fourcc("av1C"));
-    std::shared_ptr<Box_av1C> av1C_box = std::dynamic_pointer_cast<Box_av1C>(box);
-    if (av1C_box) {
-      Box_av1C::configuration config = av1C_box->get_configuration();
-      if (!config.high_bitdepth) {
-        return 8;
-      }
-      else if (config.twelve_bit) {
-        return 12;
-      }
-      else {
-        return 10;
-      }
-    }
+  auto infe_box = get_infe(ID);
+  const Box_iloc::Item* item = get_iloc_item(ID);
+  if (!infe_box || !item ||
+      !infe_box->get_content_encoding().empty()) {
+    return false;
   }
 
-  return -1;
+  return m_iloc_box->get_data_view(*item, m_input_stream, out_data, out_size);
 }
 
 
-Error HeifFile::get_compressed_image_data(heif_item_id ID, std::vector<uint8_t>* data) const
+Error HeifFile::get_compressed_image_data_prefix(heif_item_id ID, uint64_t size,
+                                                 std::vector<uint8_t>* data) const
 {
+  {
 #if ENABLE_PARALLEL_TILE_DECODING
-  std::lock_guard<std::mutex> guard(m_read_mutex);
+    auto guard = lock_input_stream();
 #endif
 
-  if (!image_exists(ID)) {
-    return Error(heif_error_Usage_error,
-                 heif_suberror_Nonexisting_item_referenced);
-  }
+    auto infe_box = get_infe(ID);
+    if (!infe_box) {
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Nonexisting_item_referenced);
+    }
 
-  auto infe_box = get_infe(ID);
-  if (!infe_box) {
-    return Error(heif_error_Usage_error,
-                 heif_suberror_Nonexisting_item_referenced);
+    std::string item_type = infe_box->get_item_type();
+    if (item_type != "hvc1" && item_type != "av01") {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Unsupported_codec);
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> headers;
+    Error error = get_codec_headers(ID, item_type, &headers);
+    if (error) {
+      return error;
+    }
+
+    data->insert(data->end(), headers->begin(), headers->end());
   }
 
+  return get_item_data_range(ID, 0, size, data);
+}
 
-  std::string item_type = infe_box->get_item_type();
-  std::string content_type = infe_box->get_content_type();
 
-  // --- get coded image data pointers
+Error HeifFile::get_item_data_range(heif_item_id ID, uint64_t offset, uint64_t size,
+                                   std::vector<uint8_t>* out_data) const
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  auto guard = lock_input_stream();
+#endif
 
-  auto items = m_iloc_box->get_items();
-  const Box_iloc::Item* item = nullptr;
-  for (const auto& i : items) {
-    if (i.item_ID == ID) {
-      item = &i;
-      break;
-    }
-  }
+  const Box_iloc::Item* item = get_iloc_item(ID);
   if (!item) {
     std::stringstream sstr;
     sstr << "Item with ID " << ID << " has no compressed data";
@@ -618,111 +1789,47 @@ Error HeifFile::get_compressed_image_data(heif_item_id ID, std::vector<uint8_t>*
                  sstr.str());
   }
 
-  Error error = Error(heif_error_Unsupported_feature,
-                      heif_suberror_Unsupported_codec);
-  if (item_type == "hvc1") {
-    // --- --- --- HEVC
-
-    // --- get properties for this image
-
-    std::vector<std::shared_ptr<Box>> properties;
-    Error err = m_ipco_box->get_properties_for_item_ID(ID, m_ipma_box, properties);
-    if (err) {
-      return err;
-    }
-
-    // --- get codec configuration
+  return m_iloc_box->read_data_range(*item, m_input_stream, m_idat_box, offset, size, out_data);
+}
 
-    std::shared_ptr<Box_hvcC> hvcC_box;
-    for (auto& prop : properties) {
-      if (prop->get_short_type() == fourcc("hvcC")) {
-        hvcC_box = std::dynamic_pointer_cast<Box_hvcC>(prop);
-        if (hvcC_box) {
-          break;
-        }
-      }
-    }
 
-    if (!hvcC_box) {
-      // Should always have an hvcC box, because we are checking this in
-      // heif_context::interpret_heif_file()
-      assert(false);
-      return Error(heif_error_Invalid_input,
-                   heif_suberror_No_hvcC_box);
-    }
-    else if (!hvcC_box->get_headers(data)) {
-      return Error(heif_error_Invalid_input,
-                   heif_suberror_No_item_data);
-    }
+Error HeifFile::read_file_range(uint64_t offset, uint32_t size,
+                               std::vector<uint8_t>* out_data, const uint8_t** out_view) const
+{
+  *out_view = nullptr;
 
-    error = m_iloc_box->read_data(*item, m_input_stream, m_idat_box, data);
+  if (!m_input_stream) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "File has not been read from an input");
   }
-  else if (item_type == "av01") {
-    // --- --- --- AV1
-
-    // --- get properties for this image
-
-    std::vector<std::shared_ptr<Box>> properties;
-    Error err = m_ipco_box->get_properties_for_item_ID(ID, m_ipma_box, properties);
-    if (err) {
-      return err;
-    }
-
-    // --- get codec configuration
 
-    std::shared_ptr<Box_av1C> av1C_box;
-    for (auto& prop : properties) {
-      if (prop->get_short_type() == fourcc("av1C")) {
-        av1C_box = std::dynamic_pointer_cast<Box_av1C>(prop);
-        if (av1C_box) {
-          break;
-        }
-      }
-    }
-
-    if (!av1C_box) {
-      // Should always have an hvcC box, because we are checking this in
-      // heif_context::interpret_heif_file()
-      return Error(heif_error_Invalid_input,
-                   heif_suberror_No_av1C_box);
-    }
-    else if (!av1C_box->get_headers(data)) {
-      return Error(heif_error_Invalid_input,
-                   heif_suberror_No_item_data);
-    }
+  if (size > MAX_MEMORY_BLOCK_SIZE) {
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 "Sample size exceeds the security limit");
+  }
 
-    error = m_iloc_box->read_data(*item, m_input_stream, m_idat_box, data);
+  if (offset > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) - size) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_End_of_data);
   }
-  else if (true ||  // fallback case for all kinds of generic metadata (e.g. 'iptc')
-           item_type == "grid" ||
-           item_type == "iovl" ||
-           item_type == "Exif" ||
-           (item_type == "mime" && content_type == "application/rdf+xml")) {
 
-    bool read_uncompressed = true;
-    if (item_type == "mime") {
-      std::string encoding = infe_box->get_content_encoding();
-      if (encoding == "deflate") {
-#if WITH_DEFLATE_HEADER_COMPRESSION
-        read_uncompressed = false;
-        std::vector<uint8_t> compressed_data;
-        error = m_iloc_box->read_data(*item, m_input_stream, m_idat_box, &compressed_data);
-        *data = inflate(compressed_data);
-#else
-        return Error(heif_error_Unsupported_feature,
-                     heif_suberror_Unsupported_header_compression_method,
-                     encoding);
+#if ENABLE_PARALLEL_TILE_DECODING
+  auto guard = lock_input_stream();
 #endif
-      }
-    }
 
-    if (read_uncompressed) {
-      error = m_iloc_box->read_data(*item, m_input_stream, m_idat_box, data);
-    }
+  *out_view = m_input_stream->get_memory_view(static_cast<int64_t>(offset), size);
+  if (*out_view) {
+    return Error::Ok;
   }
 
-  if (error != Error::Ok) {
-    return error;
+  out_data->resize(size);
+  if (m_input_stream->wait_for_file_size(static_cast<int64_t>(offset + size)) != StreamReader::size_reached ||
+      !m_input_stream->read_at(static_cast<int64_t>(offset), out_data->data(), size)) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_End_of_data,
+                 "Sample data is beyond the end of the file");
   }
 
   return Error::Ok;
@@ -731,19 +1838,16 @@ Error HeifFile::get_compressed_image_data(heif_item_id ID, std::vector<uint8_t>*
 
 heif_item_id HeifFile::get_unused_item_id() const
 {
+  // Usual case when writing: the IDs are 1...n without gaps.
+  if (m_infe_boxes.empty() ||
+      (m_infe_boxes.begin()->first == 1 && m_infe_boxes.rbegin()->first == m_infe_boxes.size())) {
+    return (heif_item_id) (m_infe_boxes.size() + 1);
+  }
+
   for (heif_item_id id = 1;;
        id++) {
 
-    bool id_exists = false;
-
-    for (const auto& infe : m_infe_boxes) {
-      if (infe.second->get_item_ID() == id) {
-        id_exists = true;
-        break;
-      }
-    }
-
-    if (!id_exists) {
+    if (m_infe_boxes.find(id) == m_infe_boxes.end()) {
       return id;
     }
   }
@@ -786,6 +1890,20 @@ void HeifFile::add_ispe_property(heif_item_id id, uint32_t width, uint32_t heigh
   m_ipma_box->add_property_for_item_ID(id, Box_ipma::PropertyAssociation{false, uint16_t(index + 1)});
 }
 
+void HeifFile::add_a1lx_property(heif_item_id id, const std::vector<uint32_t>& layer_sizes)
+{
+  assert(layer_sizes.size() <= 3);
+
+  auto a1lx = std::make_shared<Box_a1lx>();
+  for (size_t i = 0; i < layer_sizes.size(); i++) {
+    a1lx->layer_size[i] = layer_sizes[i];
+  }
+
+  int index = m_ipco_box->append_child_box(a1lx);
+
+  m_ipma_box->add_property_for_item_ID(id, Box_ipma::PropertyAssociation{false, uint16_t(index + 1)});
+}
+
 void HeifFile::add_clap_property(heif_item_id id, uint32_t clap_width, uint32_t clap_height,
                                  uint32_t image_width, uint32_t image_height)
 {
@@ -979,6 +2097,12 @@ void HeifFile::append_iloc_data(heif_item_id id, const std::vector<uint8_t>& nal
 }
 
 
+void HeifFile::append_iloc_data(heif_item_id id, std::vector<uint8_t>&& nal_packets, uint8_t construction_method)
+{
+  m_iloc_box->append_data(id, std::move(nal_packets), construction_method);
+}
+
+
 void HeifFile::append_iloc_data_with_4byte_size(heif_item_id id, const uint8_t* data, size_t size)
 {
   std::vector<uint8_t> nal;
@@ -991,7 +2115,7 @@ void HeifFile::append_iloc_data_with_4byte_size(heif_item_id id, const uint8_t*
 
   memcpy(nal.data() + 4, data, size);
 
-  append_iloc_data(id, nal);
+  append_iloc_data(id, std::move(nal));
 }
 
 void HeifFile::set_primary_item_id(heif_item_id id)
@@ -999,6 +2123,215 @@ void HeifFile::set_primary_item_id(heif_item_id id)
   m_pitm_box->set_item_ID(id);
 }
 
+
+void HeifFile::remove_item(heif_item_id id)
+{
+  auto infe = get_infe_box(id);
+  if (infe) {
+    m_iinf_box->remove_child_box(infe);
+    m_infe_boxes.erase(id);
+  }
+
+  m_iloc_box->remove_item(id);
+
+  if (m_ipma_box) {
+    m_ipma_box->remove_entries_for_item_ID(id);
+  }
+
+  if (m_iref_box) {
+    m_iref_box->remove_references(id);
+  }
+}
+
+Error HeifFile::copy_item_from(const HeifFile& src, heif_item_id ID, CopyMap& copy_map, heif_item_id* out_ID)
+{
+  auto copied_iter = copy_map.items.find(ID);
+  if (copied_iter != copy_map.items.end()) {
+    *out_ID = copied_iter->second;
+    return Error::Ok;
+  }
+
+  if (m_input_stream) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "Items can only be copied into newly created files");
+  }
+
+  if (src.m_iloc_box->is_streaming_output()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "Items cannot be copied from files that are being written");
+  }
+
+  auto src_infe = src.get_infe(ID);
+  if (!src_infe) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced);
+  }
+
+  auto infe = add_new_infe_box(src_infe->get_item_type().c_str());
+  infe->set_hidden_item(src_infe->is_hidden_item());
+  infe->set_item_name(src_infe->get_item_name());
+  infe->set_content_type(src_infe->get_content_type());
+  infe->set_content_encoding(src_infe->get_content_encoding());
+
+  heif_item_id new_ID = infe->get_item_ID();
+  copy_map.items[ID] = new_ID;
+
+
+  // --- copy the properties
+
+  const std::vector<Box_ipma::PropertyAssociation>* associations = nullptr;
+  if (src.m_ipma_box) {
+    associations = src.m_ipma_box->get_properties_for_item_ID(ID);
+  }
+
+  if (associations) {
+    for (const auto& assoc : *associations) {
+      if (assoc.property_index == 0) {
+        continue; // no property
+      }
+
+      uint16_t new_index;
+
+      auto property_iter = copy_map.properties.find(assoc.property_index);
+      if (property_iter != copy_map.properties.end()) {
+        new_index = property_iter->second;
+      }
+      else {
+        std::vector<uint8_t> property_data;
+        Error err = src.m_ipco_box->get_property_data(assoc.property_index - 1, &property_data);
+        if (err) {
+          return err;
+        }
+
+        auto content_iter = copy_map.property_contents.find(property_data);
+        if (content_iter != copy_map.property_contents.end()) {
+          new_index = content_iter->second;
+        }
+        else {
+          size_t index = m_ipco_box->append_property_data(property_data);
+          if (index + 1 > 0x7FFF) {
+            return Error(heif_error_Encoding_error,
+                         heif_suberror_Unspecified,
+                         "Too many properties");
+          }
+
+          new_index = (uint16_t) (index + 1);
+          copy_map.property_contents[property_data] = new_index;
+        }
+
+        copy_map.properties[assoc.property_index] = new_index;
+      }
+
+      m_ipma_box->add_property_for_item_ID(new_ID, Box_ipma::PropertyAssociation{assoc.essential, new_index});
+    }
+  }
+
+
+  // --- copy the item data
+
+  const Box_iloc::Item* item = src.get_iloc_item(ID);
+  if (item && !src.m_input_stream) {
+    // The data of a file that has not been written yet is still in the 'iloc' box of 'src'.
+    for (const auto& extent : item->extents) {
+      Error err;
+      if (item->construction_method == 0) {
+        err = m_iloc_box->append_data_reference(new_ID, extent.get_data(), extent.get_data_size(), src.m_iloc_box);
+      }
+      else {
+        std::vector<uint8_t> data(extent.get_data(), extent.get_data() + extent.get_data_size());
+        err = m_iloc_box->append_data(new_ID, data, item->construction_method);
+      }
+
+      if (err) {
+        return err;
+      }
+    }
+  }
+  else if (item) {
+    const uint8_t* data_view = nullptr;
+    size_t data_view_size = 0;
+    std::vector<uint8_t> data;
+    Error err;
+
+    {
+#if ENABLE_PARALLEL_TILE_DECODING
+      auto guard = src.lock_input_stream();
+#endif
+
+      if (!src.m_iloc_box->get_data_view(*item, src.m_input_stream, &data_view, &data_view_size)) {
+        err = src.m_iloc_box->read_data(*item, src.m_input_stream, src.m_idat_box, &data);
+      }
+    }
+
+    if (err) {
+      return err;
+    }
+
+    if (data_view) {
+      // The input stream owns the memory.
+      err = m_iloc_box->append_data_reference(new_ID, data_view, data_view_size, src.m_input_stream);
+    }
+    else {
+      err = m_iloc_box->append_data(new_ID, data, item->construction_method == 1 ? 1 : 0);
+    }
+
+    if (err) {
+      return err;
+    }
+  }
+
+
+  // --- copy the input images of derived images
+
+  if (src.m_iref_box) {
+    std::vector<heif_item_id> inputs = src.m_iref_box->get_references(ID, fourcc("dimg"));
+    if (!inputs.empty()) {
+      std::vector<heif_item_id> new_inputs;
+      for (heif_item_id input : inputs) {
+        heif_item_id new_input;
+        Error err = copy_item_from(src, input, copy_map, &new_input);
+        if (err) {
+          return err;
+        }
+
+        new_inputs.push_back(new_input);
+      }
+
+      add_iref_reference(new_ID, fourcc("dimg"), new_inputs);
+    }
+  }
+
+  *out_ID = new_ID;
+
+  return Error::Ok;
+}
+
+
+void HeifFile::share_properties(heif_item_id from, heif_item_id to, const std::vector<uint32_t>& property_box_types)
+{
+  const std::vector<Box_ipma::PropertyAssociation>* associations = m_ipma_box->get_properties_for_item_ID(from);
+  if (!associations) {
+    return;
+  }
+
+  // copy the list, as adding associations may reallocate it
+  std::vector<Box_ipma::PropertyAssociation> from_associations = *associations;
+
+  for (const auto& assoc : from_associations) {
+    if (assoc.property_index == 0) {
+      continue;
+    }
+
+    uint32_t type = m_ipco_box->get_property_box_type(assoc.property_index - 1);
+    if (std::find(property_box_types.begin(), property_box_types.end(), type) != property_box_types.end()) {
+      m_ipma_box->add_property_for_item_ID(to, assoc);
+    }
+  }
+}
+
+
 void HeifFile::add_iref_reference(uint32_t type, heif_item_id from,
                                   const std::vector<heif_item_id>& to)
 {
@@ -32,6 +32,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <istream>
 #include <unordered_set>
 
 #if ENABLE_PARALLEL_TILE_DECODING
@@ -45,6 +46,8 @@ class HeifPixelImage;
 
 class HeifImage;
 
+class Box_moov;
+
 
 class HeifFile
 {
@@ -59,11 +62,58 @@ public:
 
   Error read_from_memory(const void* data, size_t size, bool copy);
 
+  // Only read the 'ftyp' and 'meta' boxes. Top-level boxes after them are not read.
+  void set_read_metadata_only(bool flag) { m_read_metadata_only = flag; }
+
+  bool is_metadata_only() const { return m_read_metadata_only; }
+
+  // When a file index (see write_file_index()) is set, read() takes the 'ftyp' and 'meta' boxes
+  // from the index instead of parsing the input. The index is only checked against the
+  // size of the input.
+  void set_file_index(const uint8_t* data, size_t size) { m_file_index.assign(data, data + size); }
+
+  // Whether read_from_file() maps regular files into memory. A mapped file that is truncated while it
+  // is read raises SIGBUS. Without mapping, the file is read through a std::ifstream.
+  void set_use_memory_mapping(bool flag) { m_use_memory_mapping = flag; }
+
+  // The boxes read from the input are allocated in this arena.
+  void set_memory_arena(std::shared_ptr<MemoryArena> arena) { m_memory_arena = std::move(arena); }
+
+  // Write the 'ftyp' and 'meta' boxes of the input file together with their file positions
+  // into a compact index that can be used to open the same file again without parsing it.
+  // This is only possible if all top-level boxes of the file have been read.
+  Error write_file_index(StreamWriter& writer) const;
+
   void new_empty_file();
 
   void set_brand(heif_compression_format format, bool miaf_compatible);
 
-  void write(StreamWriter& writer);
+  // Take over the brands of a file from which items are copied.
+  void set_brands_from(const HeifFile& src);
+
+  uint32_t get_major_brand() const { return m_ftyp_box ? m_ftyp_box->get_major_brand() : 0; }
+
+  bool has_compatible_brand(uint32_t brand) const { return m_ftyp_box && m_ftyp_box->has_compatible_brand(brand); }
+
+  Error write(StreamWriter& writer);
+
+  // Write the file in consecutive parts to the sink.
+  // After start_streaming_output(), only the remaining boxes are written.
+  Error write(const StreamWriter::output_sink& sink);
+
+  // Update the file that has been read in place. Only the 'meta' box is written again. New item data
+  // is appended to the end of the file in an 'mdat' box of its own, the data of all other items stays
+  // at its position. The 'meta' box is written to its old position if it fits there (together with
+  // a directly following 'free' box), otherwise it is moved to the end of the file and its old
+  // position becomes a 'free' box. A 'free' box is written after a moved 'meta' box to leave room
+  // for later updates.
+  // The data of new items is not readable from this HeifFile afterwards, the file has to be read again.
+  Error write_in_place(std::iostream& stream);
+
+  // Write the 'ftyp' box to the sink now and write the compressed data of the images to it as soon
+  // as it is appended. The 'meta' box is written at the end of the file with write().
+  // 'format' sets the brands if no image has been encoded yet.
+  Error start_streaming_output(heif_compression_format format, const StreamWriter::output_sink& sink);
 
   int get_num_images() const { return static_cast<int>(m_infe_boxes.size()); }
 
@@ -79,6 +129,73 @@ public:
 
   Error get_compressed_image_data(heif_item_id ID, std::vector<uint8_t>* out_data) const;
 
+  // The coded data of an image item in two parts that are passed to the decoder one after the other:
+  // the codec configuration headers, which are prepared once for each 'hvcC' / 'av1C' property and
+  // shared by all items that use it (e.g. the tiles of a grid), and the bitstream. If the input is
+  // held in memory, 'data' points directly into it and is valid as long as this HeifFile exists.
+  // Otherwise, the bitstream is read into 'buffer'.
+  struct CodedImageData
+  {
+    // nullptr for item types without codec headers, their data is returned as a whole
+    std::shared_ptr<const std::vector<uint8_t>> headers;
+
+    std::vector<uint8_t> buffer;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    bool is_view() const { return data != nullptr && buffer.empty(); }
+  };
+
+  Error get_coded_image_data(heif_item_id ID, CodedImageData& out) const;
+
+  // Get a pointer to the item data in the input without copying it. This is possible when the input is held in memory
+  // (or memory-mapped) and the item is stored in one piece without content encoding. The pointer is valid as long
+  // as this HeifFile exists. Returns false if the data has to be read with get_compressed_image_data().
+  bool get_item_data_view(heif_item_id ID, const uint8_t** out_data, size_t* out_size) const;
+
+  // Like get_compressed_image_data(), but only the first 'size' bytes of the bitstream are read,
+  // e.g. the first layers of a progressive image.
+  Error get_compressed_image_data_prefix(heif_item_id ID, uint64_t size, std::vector<uint8_t>* out_data) const;
+
+  // Read only 'size' bytes of the item data, starting at byte 'offset'. The data is returned as it is
+  // stored in the file, without codec headers or decompression. This allows reading parts of large
+  // uncompressed images.
+  Error get_item_data_range(heif_item_id ID, uint64_t offset, uint64_t size,
+                            std::vector<uint8_t>* out_data) const;
+
+  // The 'moov' box with the image sequence tracks, nullptr if the file has none.
+  std::shared_ptr<Box_moov> get_moov_box() const { return m_moov_box; }
+
+  // Read 'size' bytes at the file position 'offset', e.g. a sample of a track. If the input is held
+  // in memory, 'out_view' points directly into the input data and 'out_data' is not filled.
+  // Otherwise, the data is copied into 'out_data' and 'out_view' is set to nullptr.
+  Error read_file_range(uint64_t offset, uint32_t size,
+                        std::vector<uint8_t>* out_data, const uint8_t** out_view) const;
+
+  // Append the ranges of the input file that get_compressed_image_data() reads for this item.
+  // The codec configuration headers are stored in the 'meta' box and are not included.
+  Error append_item_file_ranges(heif_item_id ID, std::vector<FileRange>& ranges) const;
+
+  // Whether items can be read from several threads at the same time.
+  bool has_concurrent_reads() const { return m_input_stream && m_input_stream->has_concurrent_read_at(); }
+
+#if ENABLE_PARALLEL_TILE_DECODING
+  // Store data that was read ahead with get_coded_image_data() (the 'buffer', without the codec
+  // headers). The next call of get_coded_image_data() or get_compressed_image_data() for this item
+  // uses it without reading the input again.
+  void add_prefetched_data(heif_item_id ID, std::vector<uint8_t>&& data) const;
+
+  void remove_prefetched_data(const std::vector<heif_item_id>& IDs) const;
+#endif
+
+  // Ask the reader to fetch the ranges asynchronously (see StreamReader::request_ranges()).
+  // Returns false if the reader does not support this.
+  bool request_file_ranges(const std::vector<FileRange>& ranges,
+                           const StreamReader::range_completion_callback* on_completed) const
+  {
+    return m_input_stream && m_input_stream->request_ranges(ranges, on_completed);
+  }
+
 
   std::shared_ptr<Box_infe> get_infe_box(heif_item_id imageID)
   {
@@ -103,11 +220,16 @@ public:
   Error get_properties(heif_item_id imageID,
                        std::vector<std::shared_ptr<Box>>& properties) const;
 
+  // Only parses and returns the properties of the given box types.
+  Error get_properties(heif_item_id imageID,
+                       const std::vector<uint32_t>& property_box_types,
+                       std::vector<std::shared_ptr<Box>>& properties) const;
+
   template<class BoxType>
   std::shared_ptr<BoxType> get_property(heif_item_id imageID) const
   {
     std::vector<std::shared_ptr<Box>> properties;
-    Error err = get_properties(imageID, properties);
+    Error err = get_properties(imageID, {BoxType().get_short_type()}, properties);
     if (err) {
       return nullptr;
     }
@@ -152,6 +274,9 @@ public:
 
   void add_ispe_property(heif_item_id id, uint32_t width, uint32_t height);
 
+  // 'layer_sizes' are the sizes of all layers except the last one (at most three).
+  void add_a1lx_property(heif_item_id id, const std::vector<uint32_t>& layer_sizes);
+
   void add_clap_property(heif_item_id id, uint32_t clap_width, uint32_t clap_height,
                          uint32_t image_width, uint32_t image_height);
 
@@ -164,10 +289,40 @@ public:
 
   void append_iloc_data(heif_item_id id, const std::vector<uint8_t>& nal_packets, uint8_t construction_method = 0);
 
+  // Moves the data into the 'iloc' box without copying it.
+  void append_iloc_data(heif_item_id id, std::vector<uint8_t>&& nal_packets, uint8_t construction_method = 0);
+
   void append_iloc_data_with_4byte_size(heif_item_id id, const uint8_t* data, size_t size);
 
   void set_primary_item_id(heif_item_id id);
 
+  // Remove the item with its data, properties and references.
+  void remove_item(heif_item_id id);
+
+  // Maps the item IDs and property indices of another file to their copies in this file.
+  struct CopyMap
+  {
+    std::map<heif_item_id, heif_item_id> items;
+    std::map<uint16_t, uint16_t> properties;
+
+    // Indices of the copied properties by their content. When items of several files are copied,
+    // 'items' and 'properties' are cleared for each source file while this is kept, so that
+    // equal properties (e.g. of grid tiles that were encoded separately) are stored only once.
+    std::map<std::vector<uint8_t>, uint16_t> property_contents;
+  };
+
+  // Copy the item 'ID' of 'src' into a new item of this file without decoding it. The item data
+  // and its properties are copied unchanged. For derived images, the input images ('dimg') are
+  // copied, too. Items and properties that are already in 'copy_map' are not copied again but
+  // shared, e.g. the codec configuration of grid tiles.
+  // If the input of 'src' is held in memory, the item data is referenced instead of copied.
+  // 'src' may also be a file that has been created but not written yet.
+  Error copy_item_from(const HeifFile& src, heif_item_id ID, CopyMap& copy_map, heif_item_id* out_ID);
+
+  // Also associate the properties of item 'from' that have one of the given box types with item 'to'.
+  // The property boxes are shared, not duplicated.
+  void share_properties(heif_item_id from, heif_item_id to, const std::vector<uint32_t>& property_box_types);
+
   void add_iref_reference(heif_item_id from, uint32_t type,
                           const std::vector<heif_item_id>& to);
 
@@ -178,6 +333,9 @@ public:
   // TODO: the hdlr box is probably not the right place for this. Into which box should we write comments?
   void set_hdlr_library_info(const std::string& encoder_plugin_version);
 
+  // The location of the item data. Returns nullptr if the item has no 'iloc' entry.
+  const Box_iloc::Item* get_iloc_item(heif_item_id ID) const;
+
 #if defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)
   static std::wstring convert_utf8_path_to_utf16(std::string pathutf8);
 #endif
@@ -185,15 +343,46 @@ public:
 private:
 #if ENABLE_PARALLEL_TILE_DECODING
   mutable std::mutex m_read_mutex;
+
+  // Returns a lock of m_read_mutex, unless the input stream supports concurrent reads.
+  std::unique_lock<std::mutex> lock_input_stream() const;
+
+  mutable std::mutex m_prefetch_mutex;
+  mutable std::map<heif_item_id, std::vector<uint8_t>> m_prefetched_data;
+
+  bool take_prefetched_data(heif_item_id ID, std::vector<uint8_t>* data) const;
+#endif
+
+  Error get_codec_headers(heif_item_id ID, const std::string& item_type,
+                          std::shared_ptr<const std::vector<uint8_t>>* out_headers) const;
+
+  // The headers of each codec configuration property, see get_codec_headers(). Property boxes are
+  // not changed once an image item refers to them, hence the headers never have to be rebuilt.
+  mutable std::map<std::shared_ptr<const Box>, std::shared_ptr<const std::vector<uint8_t>>> m_codec_headers;
+#if ENABLE_PARALLEL_TILE_DECODING
+  mutable std::mutex m_codec_headers_mutex;
 #endif
 
   std::shared_ptr<StreamReader> m_input_stream;
 
+  bool m_read_metadata_only = false;
+
+  bool m_use_memory_mapping = true;
+
+  std::vector<uint8_t> m_file_index;
+
+  std::shared_ptr<MemoryArena> m_memory_arena;
+
+  // File positions of the 'ftyp' and 'meta' boxes and the total file size, used for the file index.
+  std::vector<FileRange> m_index_box_ranges;
+  uint64_t m_file_size = 0;
+
   std::vector<std::shared_ptr<Box> > m_top_level_boxes;
 
   std::shared_ptr<Box_ftyp> m_ftyp_box;
   std::shared_ptr<Box_hdlr> m_hdlr_box;
   std::shared_ptr<Box_meta> m_meta_box;
+  std::shared_ptr<Box_moov> m_moov_box;
 
   std::shared_ptr<Box_ipco> m_ipco_box;
   std::shared_ptr<Box_ipma> m_ipma_box;
@@ -213,6 +402,17 @@ private:
 
   Error parse_heif_file(BitstreamRange& bitstream);
 
+  Error read_boxes_from_file_index();
+
+  // Check the top-level boxes and extract the boxes that are needed to access the items.
+  Error extract_heif_boxes();
+
+  // Reads the content of the 'meta' box with one read and parses it from memory.
+  Error read_meta_box(BitstreamRange& range, const BoxHeader& hdr, std::shared_ptr<Box>* box);
+
+  // Skips a top-level box without reading its content, except for the 'meta' box, which is parsed.
+  Error skip_top_level_box(BitstreamRange& range);
+
   Error check_for_ref_cycle(heif_item_id ID,
                             std::shared_ptr<Box_iref>& iref_box) const;
 
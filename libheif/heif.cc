@@ -30,10 +30,16 @@
 #include "file.h"
 #include "pixelimage.h"
 #include "api_structs.h"
+#include "track.h"
 #include "context.h"
 #include "plugin_registry.h"
+#include "init.h"
 #include "error.h"
 #include "bitstream.h"
+#include "thread_pool.h"
+#include "cancellation.h"
+#include "statistics.h"
+#include "color-conversion/colorconversion.h"
 #include <set>
 #include <limits>
 
@@ -49,6 +55,7 @@
 #include <utility>
 #include <vector>
 #include <cstring>
+#include <mutex>
 
 #if (defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)) && !defined(HAVE_UNISTD_H)
 // for _write
@@ -435,23 +442,75 @@ void heif_context_free(heif_context* ctx)
   delete ctx;
 }
 
+heif_reading_options* heif_reading_options_alloc()
+{
+  auto options = new heif_reading_options;
+
+  options->version = 3;
+  options->metadata_only = false;
+  options->file_index = nullptr;
+  options->file_index_size = 0;
+  options->disable_memory_mapping = false;
+
+  return options;
+}
+
+
+void heif_reading_options_free(heif_reading_options* options)
+{
+  delete options;
+}
+
+
+static void apply_reading_options(HeifContext& ctx, const struct heif_reading_options* options)
+{
+  bool metadata_only = false;
+  const uint8_t* file_index = nullptr;
+  size_t file_index_size = 0;
+
+  if (options && options->version >= 1) {
+    metadata_only = options->metadata_only;
+  }
+
+  if (options && options->version >= 2 && options->file_index) {
+    file_index = options->file_index;
+    file_index_size = options->file_index_size;
+  }
+
+  bool memory_mapping = true;
+  if (options && options->version >= 3) {
+    memory_mapping = !options->disable_memory_mapping;
+  }
+
+  ctx.set_read_metadata_only(metadata_only);
+  ctx.set_file_index(file_index, file_index_size);
+  ctx.set_use_memory_mapping(memory_mapping);
+}
+
+
 heif_error heif_context_read_from_file(heif_context* ctx, const char* filename,
-                                       const struct heif_reading_options*)
+                                       const struct heif_reading_options* options)
 {
+  apply_reading_options(*ctx->context, options);
+
   Error err = ctx->context->read_from_file(filename);
   return err.error_struct(ctx->context.get());
 }
 
 heif_error heif_context_read_from_memory(heif_context* ctx, const void* mem, size_t size,
-                                         const struct heif_reading_options*)
+                                         const struct heif_reading_options* options)
 {
+  apply_reading_options(*ctx->context, options);
+
   Error err = ctx->context->read_from_memory(mem, size, true);
   return err.error_struct(ctx->context.get());
 }
 
 heif_error heif_context_read_from_memory_without_copy(heif_context* ctx, const void* mem, size_t size,
-                                                      const struct heif_reading_options*)
+                                                      const struct heif_reading_options* options)
 {
+  apply_reading_options(*ctx->context, options);
+
   Error err = ctx->context->read_from_memory(mem, size, false);
   return err.error_struct(ctx->context.get());
 }
@@ -459,14 +518,40 @@ heif_error heif_context_read_from_memory_without_copy(heif_context* ctx, const v
 heif_error heif_context_read_from_reader(struct heif_context* ctx,
                                          const struct heif_reader* reader_func_table,
                                          void* userdata,
-                                         const struct heif_reading_options*)
+                                         const struct heif_reading_options* options)
 {
+  apply_reading_options(*ctx->context, options);
+
   auto reader = std::make_shared<StreamReader_CApi>(reader_func_table, userdata);
 
   Error err = ctx->context->read(reader);
   return err.error_struct(ctx->context.get());
 }
 
+
+heif_error heif_context_write_file_index(struct heif_context* ctx,
+                                         struct heif_writer* writer,
+                                         void* userdata)
+{
+  if (!writer) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+  else if (writer->writer_api_version != 1 && writer->writer_api_version != 2) {
+    Error err(heif_error_Usage_error, heif_suberror_Unsupported_writer_version);
+    return err.error_struct(ctx->context.get());
+  }
+
+  StreamWriter swriter;
+  Error err = ctx->context->write_file_index(swriter);
+  if (err) {
+    return err.error_struct(ctx->context.get());
+  }
+
+  const auto& data = swriter.get_data();
+  return writer->write(ctx, data.data(), data.size(), userdata);
+}
+
 // TODO: heif_error heif_context_read_from_file_descriptor(heif_context*, int fd);
 
 void heif_context_debug_dump_boxes_to_file(struct heif_context* ctx, int fd)
@@ -802,6 +887,12 @@ int heif_image_handle_get_ispe_height(const struct heif_image_handle* handle)
 }
 
 
+int heif_image_handle_get_number_of_layers(const struct heif_image_handle* handle)
+{
+  return handle->context->get_number_of_layers(handle->image->get_id());
+}
+
+
 int heif_image_handle_has_alpha_channel(const struct heif_image_handle* handle)
 {
   // TODO: for now, also scan the grid tiles for alpha information (issue #708), but depending about
@@ -924,9 +1015,23 @@ struct heif_error heif_image_handle_get_depth_image_handle(const struct heif_ima
 }
 
 
+// Version 1 of the struct has no 'conversion_accuracy'. That byte is padding and may contain garbage.
+static void copy_color_conversion_options(heif_color_conversion_options& options,
+                                          const heif_color_conversion_options& input_options)
+{
+  options.preferred_chroma_downsampling_algorithm = input_options.preferred_chroma_downsampling_algorithm;
+  options.preferred_chroma_upsampling_algorithm = input_options.preferred_chroma_upsampling_algorithm;
+  options.only_use_preferred_chroma_algorithm = input_options.only_use_preferred_chroma_algorithm;
+
+  if (input_options.version >= 2) {
+    options.conversion_accuracy = input_options.conversion_accuracy;
+  }
+}
+
+
 void fill_default_decoding_options(heif_decoding_options& options)
 {
-  options.version = 5;
+  options.version = 18;
 
   options.ignore_transformations = false;
 
@@ -949,18 +1054,118 @@ void fill_default_decoding_options(heif_decoding_options& options)
 
   // version 5
 
-  options.color_conversion_options.version = 1;
+  options.color_conversion_options.version = 2;
   options.color_conversion_options.preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average;
   options.color_conversion_options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear;
   options.color_conversion_options.only_use_preferred_chroma_algorithm = false;
+  options.color_conversion_options.conversion_accuracy = heif_color_conversion_accuracy_precise;
+
+  // version 6
+
+  options.get_output_plane_buffer = nullptr;
+  options.output_buffer_user_data = nullptr;
+
+  // version 7
+
+  options.color_conversion_threads = 0;
+
+  // version 8
+
+  options.tone_map_hdr_to_sdr = false;
+
+  // version 9
+
+  options.tile_prefetch_count = 8;
+
+  // version 10
+
+  options.decoder_threads = 0;
+
+  // version 11
+
+  options.target_bbox_width = 0;
+  options.target_bbox_height = 0;
+  options.target_scaling_filter = heif_scaling_filter_box;
+
+  // version 12
+
+  options.linear_light_output = false;
+
+  // version 13
+
+  options.output_alpha_premultiplication = heif_alpha_premultiplication_unchanged;
+
+  // version 14
+
+  options.cancel_decoding = nullptr;
+  options.cancel_user_data = nullptr;
+  options.timeout_ms = 0;
+
+  // version 15
+
+  options.on_tile_decoded = nullptr;
+
+  // version 16
+
+  options.max_decoded_layer = -1;
+
+  // version 17
+
+  options.canvas_file_directory = nullptr;
+
+  options.priority = heif_decoding_priority_automatic;
 }
 
 
 static void copy_options(heif_decoding_options& options, const heif_decoding_options& input_options)
 {
   switch (input_options.version) {
+    case 18:
+      options.priority = input_options.priority;
+      // fallthrough
+    case 17:
+      options.canvas_file_directory = input_options.canvas_file_directory;
+      // fallthrough
+    case 16:
+      options.max_decoded_layer = input_options.max_decoded_layer;
+      // fallthrough
+    case 15:
+      options.on_tile_decoded = input_options.on_tile_decoded;
+      // fallthrough
+    case 14:
+      options.cancel_decoding = input_options.cancel_decoding;
+      options.cancel_user_data = input_options.cancel_user_data;
+      options.timeout_ms = input_options.timeout_ms;
+      // fallthrough
+    case 13:
+      options.output_alpha_premultiplication = input_options.output_alpha_premultiplication;
+      // fallthrough
+    case 12:
+      options.linear_light_output = input_options.linear_light_output;
+      // fallthrough
+    case 11:
+      options.target_bbox_width = input_options.target_bbox_width;
+      options.target_bbox_height = input_options.target_bbox_height;
+      options.target_scaling_filter = input_options.target_scaling_filter;
+      // fallthrough
+    case 10:
+      options.decoder_threads = input_options.decoder_threads;
+      // fallthrough
+    case 9:
+      options.tile_prefetch_count = input_options.tile_prefetch_count;
+      // fallthrough
+    case 8:
+      options.tone_map_hdr_to_sdr = input_options.tone_map_hdr_to_sdr;
+      // fallthrough
+    case 7:
+      options.color_conversion_threads = input_options.color_conversion_threads;
+      // fallthrough
+    case 6:
+      options.get_output_plane_buffer = input_options.get_output_plane_buffer;
+      options.output_buffer_user_data = input_options.output_buffer_user_data;
+      // fallthrough
     case 5:
-      options.color_conversion_options = input_options.color_conversion_options;
+      copy_color_conversion_options(options.color_conversion_options, input_options.color_conversion_options);
       // fallthrough
     case 4:
       options.decoder_id = input_options.decoder_id;
@@ -1016,6 +1221,8 @@ struct heif_error heif_decode_image(const struct heif_image_handle* in_handle,
     copy_options(dec_options, *input_options);
   }
 
+  Cancellation cancellation(dec_options);
+
   Error err = in_handle->context->decode_image_user(id, img,
                                                     colorspace,
                                                     chroma,
@@ -1031,465 +1238,1358 @@ struct heif_error heif_decode_image(const struct heif_image_handle* in_handle,
 }
 
 
-struct heif_error heif_image_create(int width, int height,
-                                    heif_colorspace colorspace,
-                                    heif_chroma chroma,
-                                    struct heif_image** image)
+struct heif_error heif_decode_alpha_image(const struct heif_image_handle* in_handle,
+                                          struct heif_image** out_img,
+                                          const struct heif_decoding_options* input_options)
 {
-  if (image == nullptr) {
-    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_image_create: NULL passed as image pointer."};
+  if (out_img == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_decode_alpha_image: NULL passed as image pointer."};
   }
 
-  // auto-correct colorspace_YCbCr + chroma_monochrome to colorspace_monochrome
-  // TODO: this should return an error in a later version (see below)
-  if (chroma == heif_chroma_monochrome && colorspace == heif_colorspace_YCbCr) {
-    colorspace = heif_colorspace_monochrome;
+  std::shared_ptr<HeifPixelImage> img;
 
-    std::cerr << "libheif warning: heif_image_create() used with an illegal colorspace/chroma combination. This will return an error in a future version.\n";
-  }
+  heif_item_id id = in_handle->image->get_id();
 
-  // return error if invalid colorspace + chroma combination is used
-  auto validChroma = get_valid_chroma_values_for_colorspace(colorspace);
-  if (std::find(validChroma.begin(), validChroma.end(), chroma) == validChroma.end()) {
-    *image = nullptr;
-    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Invalid colorspace/chroma combination."};
+  heif_decoding_options dec_options;
+  fill_default_decoding_options(dec_options);
+
+  if (input_options != nullptr) {
+    // overwrite the (possibly lower version) input options over the default options
+    copy_options(dec_options, *input_options);
   }
 
-  struct heif_image* img = new heif_image;
-  img->image = std::make_shared<HeifPixelImage>();
+  Cancellation cancellation(dec_options);
 
-  img->image->create(width, height, colorspace, chroma);
+  Error err = in_handle->context->decode_alpha_image_user(id, img, dec_options);
+  if (err.error_code != heif_error_Ok) {
+    return err.error_struct(in_handle->image.get());
+  }
 
-  *image = img;
+  *out_img = new heif_image();
+  (*out_img)->image = std::move(img);
 
-  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
-  return err;
+  return Error::Ok.error_struct(in_handle->image.get());
 }
 
-int heif_image_get_decoding_warnings(struct heif_image* image,
-                                     int first_warning_idx,
-                                     struct heif_error* out_warnings,
-                                     int max_output_buffer_entries)
+
+struct heif_error heif_decode_image_region(const struct heif_image_handle* in_handle,
+                                           struct heif_image** out_img,
+                                           int x, int y, int width, int height,
+                                           heif_colorspace colorspace,
+                                           heif_chroma chroma,
+                                           const struct heif_decoding_options* input_options)
 {
-  if (max_output_buffer_entries == 0) {
-    return (int) image->image->get_warnings().size();
-  }
-  else {
-    const auto& warnings = image->image->get_warnings();
-    int n;
-    for (n = 0; n + first_warning_idx < (int) warnings.size(); n++) {
-      out_warnings[n] = warnings[n + first_warning_idx].error_struct(image->image.get());
-    }
-    return n;
+  if (out_img == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_decode_image_region: NULL passed as image pointer."};
   }
-}
 
-void heif_image_add_decoding_warning(struct heif_image* image,
-                                     struct heif_error err)
-{
-  image->image->add_warning(Error(err.code, err.subcode));
-}
+  std::shared_ptr<HeifPixelImage> img;
 
+  heif_item_id id = in_handle->image->get_id();
 
-int heif_image_has_content_light_level(const struct heif_image* image)
-{
-  return image->image->has_clli();
-}
+  heif_decoding_options dec_options;
+  fill_default_decoding_options(dec_options);
 
-void heif_image_get_content_light_level(const struct heif_image* image, struct heif_content_light_level* out)
-{
-  if (out) {
-    *out = image->image->get_clli();
+  if (input_options != nullptr) {
+    // overwrite the (possibly lower version) input options over the default options
+    copy_options(dec_options, *input_options);
   }
-}
 
-void heif_image_set_content_light_level(const struct heif_image* image, const struct heif_content_light_level* in)
-{
-  if (in == nullptr) {
-    return;
-  }
+  Cancellation cancellation(dec_options);
 
-  image->image->set_clli(*in);
-}
+  HeifContext::ImageRegion region{x, y, width, height};
 
+  Error err = in_handle->context->decode_image_user(id, img,
+                                                    colorspace,
+                                                    chroma,
+                                                    dec_options,
+                                                    &region);
+  if (err.error_code != heif_error_Ok) {
+    return err.error_struct(in_handle->image.get());
+  }
 
-int heif_image_has_mastering_display_colour_volume(const struct heif_image* image)
-{
-  return image->image->has_mdcv();
-}
+  *out_img = new heif_image();
+  (*out_img)->image = std::move(img);
 
-void heif_image_get_mastering_display_colour_volume(const struct heif_image* image, struct heif_mastering_display_colour_volume* out)
-{
-  *out = image->image->get_mdcv();
+  return Error::Ok.error_struct(in_handle->image.get());
 }
 
-void heif_image_set_mastering_display_colour_volume(const struct heif_image* image, const struct heif_mastering_display_colour_volume* in)
-{
-  if (in == nullptr) {
-    return;
-  }
-
-  image->image->set_mdcv(*in);
-}
 
-float mdcv_coord_decode_x(uint16_t coord)
+struct heif_error heif_decode_images(const struct heif_image_handle* const* handles, int num_handles,
+                                     heif_colorspace colorspace,
+                                     heif_chroma chroma,
+                                     const struct heif_decoding_options* input_options,
+                                     heif_decoded_image_callback callback,
+                                     void* userdata)
 {
-  // check for unspecified value
-  if (coord < 5 || coord > 37000) {
-    return 0.0f;
+  if (num_handles == 0) {
+    return Error::Ok.error_struct(nullptr);
   }
 
-  return (float) (coord * 0.00002);
-}
+  if (handles == nullptr || callback == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_decode_images: NULL passed as handles or callback."};
+  }
 
-float mdcv_coord_decode_y(uint16_t coord)
-{
-  // check for unspecified value
-  if (coord < 5 || coord > 42000) {
-    return 0.0f;
+  if (num_handles < 0) {
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "heif_decode_images: negative number of handles."};
   }
 
-  return (float) (coord * 0.00002);
-}
+  std::shared_ptr<HeifContext> context = handles[0]->context;
 
-struct heif_error heif_mastering_display_colour_volume_decode(const struct heif_mastering_display_colour_volume* in,
-                                                              struct heif_decoded_mastering_display_colour_volume* out)
-{
-  if (in == nullptr || out == nullptr) {
-    return error_null_parameter;
-  }
+  std::vector<heif_item_id> ids;
+  for (int i = 0; i < num_handles; i++) {
+    if (handles[i] == nullptr) {
+      return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_decode_images: NULL passed as image handle."};
+    }
 
-  for (int c = 0; c < 3; c++) {
-    out->display_primaries_x[c] = mdcv_coord_decode_x(in->display_primaries_x[c]);
-    out->display_primaries_y[c] = mdcv_coord_decode_y(in->display_primaries_y[c]);
+    if (handles[i]->context != context) {
+      return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "heif_decode_images: all images must belong to the same context."};
+    }
+
+    ids.push_back(handles[i]->image->get_id());
   }
 
-  out->white_point_x = mdcv_coord_decode_x(in->white_point_x);
-  out->white_point_y = mdcv_coord_decode_y(in->white_point_y);
+  heif_decoding_options dec_options;
+  fill_default_decoding_options(dec_options);
 
-  if (in->max_display_mastering_luminance < 50000 || in->max_display_mastering_luminance > 100000000) {
-    out->max_display_mastering_luminance = 0;
-  }
-  else {
-    out->max_display_mastering_luminance = in->max_display_mastering_luminance * 0.0001;
+  if (input_options != nullptr) {
+    copy_options(dec_options, *input_options);
   }
 
-  if (in->min_display_mastering_luminance < 1 || in->min_display_mastering_luminance > 50000) {
-    out->min_display_mastering_luminance = 0;
-  }
-  else {
-    out->min_display_mastering_luminance = in->min_display_mastering_luminance * 0.0001;
-  }
+  Cancellation cancellation(dec_options);
 
-  return error_Ok;
-}
+  Error err = context->decode_images_user(ids, colorspace, chroma, dec_options,
+                                          [&](size_t idx, const Error& image_err, const std::shared_ptr<HeifPixelImage>& img) {
+                                            const heif_image_handle* handle = handles[idx];
 
+                                            if (image_err) {
+                                              callback((int) idx, nullptr, image_err.error_struct(handle->image.get()), userdata);
+                                              return;
+                                            }
 
-void heif_image_get_pixel_aspect_ratio(const struct heif_image* image, uint32_t* aspect_h, uint32_t* aspect_v)
-{
-  image->image->get_pixel_ratio(aspect_h, aspect_v);
-}
+                                            auto* out_img = new heif_image();
+                                            out_img->image = img;
+                                            callback((int) idx, out_img, Error::Ok.error_struct(handle->image.get()), userdata);
+                                          });
 
-void heif_image_set_pixel_aspect_ratio(struct heif_image* image, uint32_t aspect_h, uint32_t aspect_v)
-{
-  image->image->set_pixel_ratio(aspect_h, aspect_v);
+  return err.error_struct(context.get());
 }
 
 
-void heif_image_release(const struct heif_image* img)
+struct heif_error heif_decode_image_in_bands(const struct heif_image_handle* in_handle,
+                                             heif_colorspace colorspace,
+                                             heif_chroma chroma,
+                                             const struct heif_decoding_options* input_options,
+                                             heif_decoded_band_callback callback,
+                                             void* userdata)
 {
-  delete img;
-}
+  if (in_handle == nullptr || callback == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_decode_image_in_bands: NULL passed as image handle or callback."};
+  }
 
-void heif_image_handle_release(const struct heif_image_handle* handle)
-{
-  delete handle;
-}
+  heif_decoding_options dec_options;
+  fill_default_decoding_options(dec_options);
 
+  if (input_options != nullptr) {
+    copy_options(dec_options, *input_options);
+  }
 
-heif_colorspace heif_image_get_colorspace(const struct heif_image* img)
-{
-  return img->image->get_colorspace();
-}
+  dec_options.target_bbox_width = 0;
+  dec_options.target_bbox_height = 0;
 
-enum heif_chroma heif_image_get_chroma_format(const struct heif_image* img)
-{
-  return img->image->get_chroma_format();
-}
+  Cancellation cancellation(dec_options);
 
+  Error err = in_handle->context->decode_image_in_bands(in_handle->image->get_id(), colorspace, chroma, dec_options,
+                                                        [&](const std::shared_ptr<HeifPixelImage>& band, int y) {
+                                                          heif_image band_img;
+                                                          band_img.image = band;
 
-int heif_image_get_width(const struct heif_image* img, enum heif_channel channel)
-{
-  return img->image->get_width(channel);
-}
+                                                          heif_error band_err = callback(&band_img, y, userdata);
+                                                          if (band_err.code != heif_error_Ok) {
+                                                            return Error(band_err.code, band_err.subcode,
+                                                                         band_err.message ? band_err.message : "");
+                                                          }
 
+                                                          return Error::Ok;
+                                                        });
 
-int heif_image_get_height(const struct heif_image* img, enum heif_channel channel)
-{
-  return img->image->get_height(channel);
+  return err.error_struct(in_handle->image.get());
 }
 
 
-int heif_image_get_primary_width(const struct heif_image* img)
-{
-  if (img->image->get_colorspace() == heif_colorspace_RGB) {
-    if (img->image->get_chroma_format() == heif_chroma_444) {
-      return img->image->get_width(heif_channel_G);
-    }
-    else {
-      return img->image->get_width(heif_channel_interleaved);
+namespace {
+  // The options of a decoding started with heif_decode_image_async(). It is kept alive by the decoding task.
+  struct AsyncDecoding
+  {
+    heif_decoding_options options;
+    std::unique_ptr<Cancellation> cancellation;
+
+    // the cancel callback of the application, which is replaced by is_canceled()
+    int (* cancel_decoding)(void*) = nullptr;
+    void* cancel_user_data = nullptr;
+
+    std::shared_ptr<std::atomic<bool>> canceled = std::make_shared<std::atomic<bool>>(false);
+
+    static int is_canceled(void* decoding_ptr)
+    {
+      auto* decoding = static_cast<const AsyncDecoding*>(decoding_ptr);
+      if (*decoding->canceled) {
+        return 1;
+      }
+
+      return (decoding->cancel_decoding && decoding->cancel_decoding(decoding->cancel_user_data)) ? 1 : 0;
     }
-  }
-  else {
-    return img->image->get_width(heif_channel_Y);
-  }
+  };
 }
 
 
-int heif_image_get_primary_height(const struct heif_image* img)
+struct heif_error heif_decode_image_async(const struct heif_image_handle* in_handle,
+                                          heif_colorspace colorspace,
+                                          heif_chroma chroma,
+                                          const struct heif_decoding_options* input_options,
+                                          heif_decode_completion_callback callback,
+                                          void* userdata,
+                                          struct heif_decoding_request** out_request)
 {
-  if (img->image->get_colorspace() == heif_colorspace_RGB) {
-    if (img->image->get_chroma_format() == heif_chroma_444) {
-      return img->image->get_height(heif_channel_G);
-    }
-    else {
-      return img->image->get_height(heif_channel_interleaved);
-    }
-  }
-  else {
-    return img->image->get_height(heif_channel_Y);
+  if (in_handle == nullptr || callback == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_decode_image_async: NULL passed as image handle or callback."};
   }
-}
 
+  auto decoding = std::make_shared<AsyncDecoding>();
+  fill_default_decoding_options(decoding->options);
 
-heif_error heif_image_crop(struct heif_image* img,
-                           int left, int right, int top, int bottom)
-{
-  std::shared_ptr<HeifPixelImage> out_img;
+  if (input_options != nullptr) {
+    copy_options(decoding->options, *input_options);
+  }
 
-  int w = img->image->get_width();
-  int h = img->image->get_height();
+  decoding->cancel_decoding = decoding->options.cancel_decoding;
+  decoding->cancel_user_data = decoding->options.cancel_user_data;
+  decoding->options.cancel_decoding = AsyncDecoding::is_canceled;
+  decoding->options.cancel_user_data = decoding.get();
 
-  Error err = img->image->crop(left, w - 1 - right, top, h - 1 - bottom, out_img);
-  if (err) {
-    return err.error_struct(img->image.get());
+  // the timeout starts now
+  decoding->cancellation.reset(new Cancellation(decoding->options));
+
+  if (out_request) {
+    *out_request = new heif_decoding_request{decoding->canceled};
   }
 
-  img->image = out_img;
+  // The task refers to the context without owning it. Releasing the last reference from a thread
+  // of the context's pool would have to wait for that thread.
+  HeifContext* context = in_handle->context.get();
+  HeifContext::Image* image = in_handle->image.get();
 
-  return heif_error{heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
+  context->decode_image_async(image->get_id(), colorspace, chroma, decoding->options,
+                              [decoding, image, callback, userdata](const Error& err, const std::shared_ptr<HeifPixelImage>& img) {
+                                if (err) {
+                                  callback(nullptr, err.error_struct(image), userdata);
+                                  return;
+                                }
+
+                                auto* out_img = new heif_image();
+                                out_img->image = img;
+                                callback(out_img, Error::Ok.error_struct(image), userdata);
+                              });
+
+  return Error::Ok.error_struct(in_handle->image.get());
 }
 
 
-int heif_image_get_bits_per_pixel(const struct heif_image* img, enum heif_channel channel)
+void heif_decoding_request_cancel(struct heif_decoding_request* request)
 {
-  return img->image->get_storage_bits_per_pixel(channel);
+  if (request) {
+    *request->canceled = true;
+  }
 }
 
 
-int heif_image_get_bits_per_pixel_range(const struct heif_image* img, enum heif_channel channel)
+void heif_decoding_request_release(struct heif_decoding_request* request)
 {
-  return img->image->get_bits_per_pixel(channel);
+  delete request;
 }
 
 
-int heif_image_has_channel(const struct heif_image* img, enum heif_channel channel)
+int heif_context_number_of_sequence_tracks(const struct heif_context* ctx)
 {
-  return img->image->has_channel(channel);
+  return (int) ctx->context->get_tracks().size();
 }
 
 
-struct heif_error heif_image_add_plane(struct heif_image* image,
-                                       heif_channel channel, int width, int height, int bit_depth)
+int heif_context_get_sequence_track_IDs(const struct heif_context* ctx, uint32_t* track_IDs, int count)
 {
-  if (!image->image->add_plane(channel, width, height, bit_depth)) {
-    struct heif_error err = {heif_error_Memory_allocation_error,
-                             heif_suberror_Unspecified,
-                             "Cannot allocate memory for image plane"};
-    return err;
+  if (track_IDs == nullptr || count <= 0) {
+    return 0;
   }
-  else {
-    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
-    return err;
+
+  const auto& tracks = ctx->context->get_tracks();
+  int n = (int) std::min(count, (int) tracks.size());
+  for (int i = 0; i < n; i++) {
+    track_IDs[i] = tracks[i]->get_id();
   }
+
+  return n;
 }
 
 
-const uint8_t* heif_image_get_plane_readonly(const struct heif_image* image,
-                                             enum heif_channel channel,
-                                             int* out_stride)
+struct heif_error heif_context_get_sequence_track_info(const struct heif_context* ctx, uint32_t track_ID,
+                                                       struct heif_sequence_track_info* out_info)
 {
-  if (!image || !image->image) {
-    *out_stride = 0;
-    return nullptr;
+  if (out_info == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_context_get_sequence_track_info: NULL passed as info."};
   }
 
-  return image->image->get_plane(channel, out_stride);
+  std::shared_ptr<Track> track = ctx->context->get_track(track_ID);
+  if (!track) {
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "heif_context_get_sequence_track_info: no track with this ID."};
+  }
+
+  out_info->width = track->get_width();
+  out_info->height = track->get_height();
+  out_info->timescale = track->get_timescale();
+  out_info->duration = track->get_duration();
+  out_info->number_of_frames = track->get_num_samples();
+  out_info->compression = track->get_compression_format();
+
+  return Error::Ok.error_struct(ctx->context.get());
 }
 
 
-uint8_t* heif_image_get_plane(struct heif_image* image,
-                              enum heif_channel channel,
-                              int* out_stride)
+struct heif_error heif_sequence_decoder_alloc(const struct heif_context* ctx, uint32_t track_ID,
+                                              heif_colorspace colorspace,
+                                              heif_chroma chroma,
+                                              const struct heif_decoding_options* input_options,
+                                              struct heif_sequence_decoder** out_decoder)
 {
-  if (!image || !image->image) {
-    *out_stride = 0;
-    return nullptr;
+  if (out_decoder == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_sequence_decoder_alloc: NULL passed as decoder."};
   }
 
-  return image->image->get_plane(channel, out_stride);
-}
-
+  *out_decoder = nullptr;
 
-void heif_image_set_premultiplied_alpha(struct heif_image* image,
-                                        int is_premultiplied_alpha)
-{
-  if (image == nullptr) {
-    return;
+  std::shared_ptr<Track> track = ctx->context->get_track(track_ID);
+  if (!track) {
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "heif_sequence_decoder_alloc: no track with this ID."};
   }
 
-  image->image->set_premultiplied_alpha(is_premultiplied_alpha);
-}
+  heif_decoding_options dec_options;
+  fill_default_decoding_options(dec_options);
 
+  if (input_options != nullptr) {
+    copy_options(dec_options, *input_options);
+  }
 
-int heif_image_is_premultiplied_alpha(struct heif_image* image)
-{
-  if (image == nullptr) {
-    return 0;
+  // The decoder outlives this call. Callbacks that are only valid during a call are not used.
+  dec_options.cancel_decoding = nullptr;
+  dec_options.on_tile_decoded = nullptr;
+
+  std::unique_ptr<SequenceDecoder> decoder(new SequenceDecoder(ctx->context, track, colorspace, chroma, dec_options));
+  Error err = decoder->init();
+  if (err) {
+    return err.error_struct(ctx->context.get());
   }
 
-  return image->image->is_premultiplied_alpha();
+  *out_decoder = new heif_sequence_decoder();
+  (*out_decoder)->context = ctx->context;
+  (*out_decoder)->decoder = std::move(decoder);
+
+  return Error::Ok.error_struct(ctx->context.get());
 }
 
 
-struct heif_error heif_image_extend_padding_to_size(struct heif_image* image, int min_physical_width, int min_physical_height)
+struct heif_error heif_sequence_decoder_decode_next_frame(struct heif_sequence_decoder* decoder,
+                                                          struct heif_image** out_img,
+                                                          int64_t* out_timestamp)
 {
-  bool mem_alloc_success = image->image->extend_padding_to_size(min_physical_width, min_physical_height);
-  if (!mem_alloc_success) {
-    return heif_error{heif_error_Memory_allocation_error,
-                      heif_suberror_Unspecified,
-                      "Cannot allocate image memory."};
-  }
-  else {
-    return heif_error{heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
+  if (decoder == nullptr || out_img == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_sequence_decoder_decode_next_frame: NULL passed as decoder or image."};
   }
-}
 
+  *out_img = nullptr;
 
-struct heif_error heif_image_scale_image(const struct heif_image* input,
-                                         struct heif_image** output,
-                                         int width, int height,
-                                         const struct heif_scaling_options* options)
-{
-  std::shared_ptr<HeifPixelImage> out_img;
-
-  Error err = input->image->scale_nearest_neighbor(out_img, width, height);
+  std::shared_ptr<HeifPixelImage> img;
+  Error err = decoder->decoder->decode_next_frame(img, out_timestamp);
   if (err) {
-    return err.error_struct(input->image.get());
+    return err.error_struct(decoder->context.get());
   }
 
-  *output = new heif_image;
-  (*output)->image = out_img;
+  if (img) {
+    *out_img = new heif_image();
+    (*out_img)->image = std::move(img);
+  }
 
-  return Error::Ok.error_struct(input->image.get());
+  return Error::Ok.error_struct(decoder->context.get());
 }
 
-struct heif_error heif_image_set_raw_color_profile(struct heif_image* image,
-                                                   const char* color_profile_type_fourcc,
-                                                   const void* profile_data,
-                                                   const size_t profile_size)
-{
-  if (strlen(color_profile_type_fourcc) != 4) {
-    heif_error err = {heif_error_Usage_error,
-                      heif_suberror_Unspecified,
-                      "Invalid color_profile_type (must be 4 characters)"};
-    return err;
-  }
 
-  uint32_t color_profile_type = fourcc(color_profile_type_fourcc);
+void heif_sequence_decoder_free(struct heif_sequence_decoder* decoder)
+{
+  delete decoder;
+}
 
-  std::vector<uint8_t> data;
-  data.insert(data.end(),
-              (const uint8_t*) profile_data,
-              (const uint8_t*) profile_data + profile_size);
 
-  auto color_profile = std::make_shared<color_profile_raw>(color_profile_type, data);
+struct heif_error heif_image_handle_get_file_ranges_for_decoding(const struct heif_image_handle* handle,
+                                                                 int x, int y, int width, int height,
+                                                                 const struct heif_decoding_options* input_options,
+                                                                 struct heif_file_range** out_ranges,
+                                                                 int* out_number_of_ranges)
+{
+  if (out_ranges == nullptr || out_number_of_ranges == nullptr) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Null_pointer_argument);
+    return err.error_struct(handle->image.get());
+  }
 
-  image->image->set_color_profile_icc(color_profile);
+  heif_decoding_options dec_options;
+  fill_default_decoding_options(dec_options);
 
-  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
-  return err;
-}
+  if (input_options != nullptr) {
+    copy_options(dec_options, *input_options);
+  }
 
+  HeifContext::ImageRegion region{x, y, width, height};
+  bool whole_image = (width == 0 && height == 0);
 
-struct heif_error heif_image_set_nclx_color_profile(struct heif_image* image,
-                                                    const struct heif_color_profile_nclx* color_profile)
-{
-  auto nclx = std::make_shared<color_profile_nclx>();
+  std::vector<FileRange> ranges;
+  Error err = handle->context->get_file_ranges_for_decoding(handle->image->get_id(), dec_options,
+                                                            whole_image ? nullptr : &region,
+                                                            ranges);
+  if (err) {
+    return err.error_struct(handle->image.get());
+  }
 
-  nclx->set_colour_primaries(color_profile->color_primaries);
-  nclx->set_transfer_characteristics(color_profile->transfer_characteristics);
-  nclx->set_matrix_coefficients(color_profile->matrix_coefficients);
-  nclx->set_full_range_flag(color_profile->full_range_flag);
+  *out_ranges = new heif_file_range[ranges.size()];
+  for (size_t i = 0; i < ranges.size(); i++) {
+    (*out_ranges)[i].offset = ranges[i].offset;
+    (*out_ranges)[i].size = ranges[i].size;
+  }
 
-  image->image->set_color_profile_nclx(nclx);
+  *out_number_of_ranges = static_cast<int>(ranges.size());
 
-  return error_Ok;
+  return Error::Ok.error_struct(handle->image.get());
 }
 
 
-/*
-void heif_image_remove_color_profile(struct heif_image* image)
+void heif_file_ranges_release(struct heif_file_range* ranges)
 {
-  image->image->set_color_profile(nullptr);
+  delete[] ranges;
 }
-*/
 
 
-int heif_image_handle_get_number_of_metadata_blocks(const struct heif_image_handle* handle,
-                                                    const char* type_filter)
+struct heif_error heif_image_handle_estimate_decoding_memory(const struct heif_image_handle* handle,
+                                                             heif_chroma chroma,
+                                                             const struct heif_decoding_options* input_options,
+                                                             struct heif_decoding_memory_estimate* out_estimate)
 {
-  int cnt = 0;
-  for (const auto& metadata : handle->image->get_metadata()) {
-    if (type_filter == nullptr ||
-        metadata->item_type == type_filter) {
-      cnt++;
-    }
+  if (out_estimate == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "NULL argument"};
   }
 
-  return cnt;
-}
+  heif_decoding_options dec_options;
+  fill_default_decoding_options(dec_options);
 
+  if (input_options != nullptr) {
+    copy_options(dec_options, *input_options);
+  }
 
-int heif_image_handle_get_list_of_metadata_block_IDs(const struct heif_image_handle* handle,
-                                                     const char* type_filter,
-                                                     heif_item_id* ids, int count)
-{
-  int cnt = 0;
-  for (const auto& metadata : handle->image->get_metadata()) {
-    if (type_filter == nullptr ||
-        metadata->item_type == type_filter) {
-      if (cnt < count) {
-        ids[cnt] = metadata->item_id;
-        cnt++;
-      }
-      else {
-        break;
-      }
-    }
+  HeifContext::DecodingMemoryEstimate estimate;
+  Error err = handle->context->estimate_decoding_memory(handle->image->get_id(), chroma, dec_options, nullptr, estimate);
+  if (err) {
+    return err.error_struct(handle->image.get());
   }
 
-  return cnt;
+  out_estimate->peak_bytes = estimate.peak_bytes;
+  out_estimate->image_bytes = estimate.image_bytes;
+  out_estimate->output_bytes = estimate.output_bytes;
+  out_estimate->tile_bytes = estimate.tile_bytes;
+  out_estimate->max_concurrent_tiles = estimate.max_concurrent_tiles;
+
+  return error_Ok;
 }
 
 
-const char* heif_image_handle_get_metadata_type(const struct heif_image_handle* handle,
-                                                heif_item_id metadata_id)
+struct heif_error heif_image_handle_get_grid_layout(const struct heif_image_handle* handle,
+                                                   uint32_t* out_columns,
+                                                   uint32_t* out_rows,
+                                                   uint32_t* out_tile_width,
+                                                   uint32_t* out_tile_height)
 {
-  for (auto& metadata : handle->image->get_metadata()) {
-    if (metadata->item_id == metadata_id) {
-      return metadata->item_type.c_str();
-    }
+  HeifContext::GridLayout layout;
+  Error err = handle->context->get_grid_layout(handle->image->get_id(), layout);
+  if (err) {
+    return err.error_struct(handle->image.get());
+  }
+
+  if (out_columns) {
+    *out_columns = layout.columns;
+  }
+
+  if (out_rows) {
+    *out_rows = layout.rows;
+  }
+
+  if (out_tile_width) {
+    *out_tile_width = layout.tile_width;
+  }
+
+  if (out_tile_height) {
+    *out_tile_height = layout.tile_height;
+  }
+
+  return Error::Ok.error_struct(handle->image.get());
+}
+
+
+struct heif_error heif_decode_grid_tile(const struct heif_image_handle* in_handle,
+                                        struct heif_image** out_img,
+                                        uint32_t column, uint32_t row,
+                                        heif_colorspace colorspace,
+                                        heif_chroma chroma,
+                                        const struct heif_decoding_options* input_options)
+{
+  if (out_img == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_decode_grid_tile: NULL passed as image pointer."};
+  }
+
+  std::shared_ptr<HeifPixelImage> img;
+
+  heif_decoding_options dec_options;
+  fill_default_decoding_options(dec_options);
+
+  if (input_options != nullptr) {
+    // overwrite the (possibly lower version) input options over the default options
+    copy_options(dec_options, *input_options);
+  }
+
+  Cancellation cancellation(dec_options);
+
+  Error err = in_handle->context->decode_grid_tile(in_handle->image->get_id(), column, row, img,
+                                                   colorspace, chroma, dec_options);
+  if (err.error_code != heif_error_Ok) {
+    return err.error_struct(in_handle->image.get());
+  }
+
+  *out_img = new heif_image();
+  (*out_img)->image = std::move(img);
+
+  return Error::Ok.error_struct(in_handle->image.get());
+}
+
+
+struct heif_error heif_image_create(int width, int height,
+                                    heif_colorspace colorspace,
+                                    heif_chroma chroma,
+                                    struct heif_image** image)
+{
+  if (image == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "heif_image_create: NULL passed as image pointer."};
+  }
+
+  // auto-correct colorspace_YCbCr + chroma_monochrome to colorspace_monochrome
+  // TODO: this should return an error in a later version (see below)
+  if (chroma == heif_chroma_monochrome && colorspace == heif_colorspace_YCbCr) {
+    colorspace = heif_colorspace_monochrome;
+
+    std::cerr << "libheif warning: heif_image_create() used with an illegal colorspace/chroma combination. This will return an error in a future version.\n";
+  }
+
+  // return error if invalid colorspace + chroma combination is used
+  auto validChroma = get_valid_chroma_values_for_colorspace(colorspace);
+  if (std::find(validChroma.begin(), validChroma.end(), chroma) == validChroma.end()) {
+    *image = nullptr;
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Invalid colorspace/chroma combination."};
+  }
+
+  struct heif_image* img = new heif_image;
+  img->image = std::make_shared<HeifPixelImage>();
+
+  img->image->create(width, height, colorspace, chroma);
+
+  *image = img;
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
+  return err;
+}
+
+int heif_image_get_decoding_warnings(struct heif_image* image,
+                                     int first_warning_idx,
+                                     struct heif_error* out_warnings,
+                                     int max_output_buffer_entries)
+{
+  if (max_output_buffer_entries == 0) {
+    return (int) image->image->get_warnings().size();
+  }
+  else {
+    const auto& warnings = image->image->get_warnings();
+    int n;
+    for (n = 0; n + first_warning_idx < (int) warnings.size(); n++) {
+      out_warnings[n] = warnings[n + first_warning_idx].error_struct(image->image.get());
+    }
+    return n;
+  }
+}
+
+void heif_image_add_decoding_warning(struct heif_image* image,
+                                     struct heif_error err)
+{
+  image->image->add_warning(Error(err.code, err.subcode));
+}
+
+
+int heif_image_has_content_light_level(const struct heif_image* image)
+{
+  return image->image->has_clli();
+}
+
+void heif_image_get_content_light_level(const struct heif_image* image, struct heif_content_light_level* out)
+{
+  if (out) {
+    *out = image->image->get_clli();
+  }
+}
+
+void heif_image_set_content_light_level(const struct heif_image* image, const struct heif_content_light_level* in)
+{
+  if (in == nullptr) {
+    return;
+  }
+
+  image->image->set_clli(*in);
+}
+
+
+int heif_image_has_mastering_display_colour_volume(const struct heif_image* image)
+{
+  return image->image->has_mdcv();
+}
+
+void heif_image_get_mastering_display_colour_volume(const struct heif_image* image, struct heif_mastering_display_colour_volume* out)
+{
+  *out = image->image->get_mdcv();
+}
+
+void heif_image_set_mastering_display_colour_volume(const struct heif_image* image, const struct heif_mastering_display_colour_volume* in)
+{
+  if (in == nullptr) {
+    return;
+  }
+
+  image->image->set_mdcv(*in);
+}
+
+float mdcv_coord_decode_x(uint16_t coord)
+{
+  // check for unspecified value
+  if (coord < 5 || coord > 37000) {
+    return 0.0f;
+  }
+
+  return (float) (coord * 0.00002);
+}
+
+float mdcv_coord_decode_y(uint16_t coord)
+{
+  // check for unspecified value
+  if (coord < 5 || coord > 42000) {
+    return 0.0f;
+  }
+
+  return (float) (coord * 0.00002);
+}
+
+struct heif_error heif_mastering_display_colour_volume_decode(const struct heif_mastering_display_colour_volume* in,
+                                                              struct heif_decoded_mastering_display_colour_volume* out)
+{
+  if (in == nullptr || out == nullptr) {
+    return error_null_parameter;
+  }
+
+  for (int c = 0; c < 3; c++) {
+    out->display_primaries_x[c] = mdcv_coord_decode_x(in->display_primaries_x[c]);
+    out->display_primaries_y[c] = mdcv_coord_decode_y(in->display_primaries_y[c]);
+  }
+
+  out->white_point_x = mdcv_coord_decode_x(in->white_point_x);
+  out->white_point_y = mdcv_coord_decode_y(in->white_point_y);
+
+  if (in->max_display_mastering_luminance < 50000 || in->max_display_mastering_luminance > 100000000) {
+    out->max_display_mastering_luminance = 0;
+  }
+  else {
+    out->max_display_mastering_luminance = in->max_display_mastering_luminance * 0.0001;
+  }
+
+  if (in->min_display_mastering_luminance < 1 || in->min_display_mastering_luminance > 50000) {
+    out->min_display_mastering_luminance = 0;
+  }
+  else {
+    out->min_display_mastering_luminance = in->min_display_mastering_luminance * 0.0001;
+  }
+
+  return error_Ok;
+}
+
+
+void heif_image_get_pixel_aspect_ratio(const struct heif_image* image, uint32_t* aspect_h, uint32_t* aspect_v)
+{
+  image->image->get_pixel_ratio(aspect_h, aspect_v);
+}
+
+void heif_image_set_pixel_aspect_ratio(struct heif_image* image, uint32_t aspect_h, uint32_t aspect_v)
+{
+  image->image->set_pixel_ratio(aspect_h, aspect_v);
+}
+
+
+void heif_image_release(const struct heif_image* img)
+{
+  delete img;
+}
+
+
+static std::shared_ptr<const color_profile_nclx> nclx_profile_from_struct(const struct heif_color_profile_nclx* profile)
+{
+  if (profile == nullptr) {
+    return nullptr;
+  }
+
+  auto nclx = std::make_shared<color_profile_nclx>();
+  nclx->set_colour_primaries(profile->color_primaries);
+  nclx->set_transfer_characteristics(profile->transfer_characteristics);
+  nclx->set_matrix_coefficients(profile->matrix_coefficients);
+  nclx->set_full_range_flag(profile->full_range_flag);
+  return nclx;
+}
+
+
+static heif_color_conversion_pipeline* create_pipeline_struct(const ColorConversionInfo& info)
+{
+  auto* pipeline = new heif_color_conversion_pipeline;
+  pipeline->info = info;
+
+  for (const auto& step : info.steps) {
+    pipeline->operation_names.push_back(get_operation_name(step.operation));
+  }
+
+  return pipeline;
+}
+
+
+struct heif_error heif_get_color_conversion_pipeline(enum heif_colorspace input_colorspace,
+                                                     enum heif_chroma input_chroma,
+                                                     int input_bits_per_pixel,
+                                                     int input_has_alpha,
+                                                     const struct heif_color_profile_nclx* input_nclx,
+                                                     enum heif_colorspace output_colorspace,
+                                                     enum heif_chroma output_chroma,
+                                                     int output_bits_per_pixel,
+                                                     const struct heif_color_profile_nclx* output_nclx,
+                                                     const struct heif_color_conversion_options* options,
+                                                     struct heif_color_conversion_pipeline** out_pipeline)
+{
+  if (out_pipeline == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "NULL passed as out_pipeline"};
+  }
+
+  *out_pipeline = nullptr;
+
+  if (input_bits_per_pixel < 1 || input_bits_per_pixel > 32 ||
+      output_bits_per_pixel < 0 || output_bits_per_pixel > 32) {
+    return {heif_error_Usage_error, heif_suberror_Unsupported_bit_depth, "Invalid bits per pixel"};
+  }
+
+  heif_color_conversion_options conversion_options{};
+  conversion_options.version = 2;
+  conversion_options.preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average;
+  conversion_options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear;
+  conversion_options.only_use_preferred_chroma_algorithm = false;
+  conversion_options.conversion_accuracy = heif_color_conversion_accuracy_precise;
+
+  if (options) {
+    copy_color_conversion_options(conversion_options, *options);
+  }
+
+  ColorState input_state(input_colorspace, input_chroma, input_has_alpha != 0, input_bits_per_pixel);
+  input_state.nclx_profile = nclx_profile_from_struct(input_nclx);
+
+  ColorState output_state = get_output_color_state(input_state, output_colorspace, output_chroma,
+                                                   nclx_profile_from_struct(output_nclx),
+                                                   output_bits_per_pixel);
+
+  ColorConversionPipeline pipeline;
+  if (!pipeline.construct_pipeline(input_state, output_state, conversion_options)) {
+    return {heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion,
+            "No color conversion for these formats"};
+  }
+
+  *out_pipeline = create_pipeline_struct(pipeline.get_info());
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_image_get_color_conversion_pipeline(const struct heif_image* image,
+                                                           struct heif_color_conversion_pipeline** out_pipeline)
+{
+  if (image == nullptr || out_pipeline == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "NULL passed"};
+  }
+
+  auto info = image->image->get_color_conversion_info();
+  if (info) {
+    *out_pipeline = create_pipeline_struct(*info);
+  }
+  else {
+    // The image was not converted. The pipeline only describes the image format.
+
+    ColorConversionInfo empty_info;
+    empty_info.input_state.colorspace = image->image->get_colorspace();
+    empty_info.input_state.chroma = image->image->get_chroma_format();
+    empty_info.input_state.has_alpha = image->image->has_alpha();
+    empty_info.input_state.nclx_profile = image->image->get_color_profile_nclx();
+
+    std::set<heif_channel> channels = image->image->get_channel_set();
+    if (!channels.empty()) {
+      empty_info.input_state.bits_per_pixel = image->image->get_bits_per_pixel(*channels.begin());
+    }
+
+    *out_pipeline = create_pipeline_struct(empty_info);
+  }
+
+  return error_Ok;
+}
+
+
+void heif_color_conversion_pipeline_release(const struct heif_color_conversion_pipeline* pipeline)
+{
+  delete pipeline;
+}
+
+
+void heif_color_conversion_pipeline_get_input_format(const struct heif_color_conversion_pipeline* pipeline,
+                                                     enum heif_colorspace* out_colorspace,
+                                                     enum heif_chroma* out_chroma,
+                                                     int* out_bits_per_pixel,
+                                                     int* out_has_alpha)
+{
+  const ColorState& state = pipeline->info.input_state;
+
+  if (out_colorspace) {
+    *out_colorspace = state.colorspace;
+  }
+
+  if (out_chroma) {
+    *out_chroma = state.chroma;
+  }
+
+  if (out_bits_per_pixel) {
+    *out_bits_per_pixel = state.bits_per_pixel;
+  }
+
+  if (out_has_alpha) {
+    *out_has_alpha = state.has_alpha;
+  }
+}
+
+
+int heif_color_conversion_pipeline_get_number_of_steps(const struct heif_color_conversion_pipeline* pipeline)
+{
+  return static_cast<int>(pipeline->info.steps.size());
+}
+
+
+struct heif_error heif_color_conversion_pipeline_get_step(const struct heif_color_conversion_pipeline* pipeline,
+                                                          int step_index,
+                                                          struct heif_color_conversion_step* out_step)
+{
+  if (out_step == nullptr) {
+    return {heif_error_Usage_error, heif_suberror_Null_pointer_argument, "NULL passed as out_step"};
+  }
+
+  if (out_step->version < 1) {
+    return {heif_error_Usage_error, heif_suberror_Unsupported_parameter, "Unsupported heif_color_conversion_step version"};
+  }
+
+  if (step_index < 0 || step_index >= static_cast<int>(pipeline->info.steps.size())) {
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Color conversion step index out of range"};
+  }
+
+  const ColorConversionInfo::Step& step = pipeline->info.steps[step_index];
+
+  // version 1
+
+  out_step->operation_name = pipeline->operation_names[step_index].c_str();
+  out_step->colorspace = step.output_state.colorspace;
+  out_step->chroma = step.output_state.chroma;
+  out_step->bits_per_pixel = step.output_state.bits_per_pixel;
+  out_step->has_alpha = step.output_state.has_alpha;
+  out_step->speed_costs = step.speed_costs;
+  out_step->measured = step.measured;
+  out_step->time_us = step.time_us;
+  out_step->memory_bytes = step.memory_bytes;
+
+  return error_Ok;
+}
+
+void heif_image_handle_release(const struct heif_image_handle* handle)
+{
+  delete handle;
+}
+
+
+heif_colorspace heif_image_get_colorspace(const struct heif_image* img)
+{
+  return img->image->get_colorspace();
+}
+
+enum heif_chroma heif_image_get_chroma_format(const struct heif_image* img)
+{
+  return img->image->get_chroma_format();
+}
+
+
+int heif_image_get_width(const struct heif_image* img, enum heif_channel channel)
+{
+  return img->image->get_width(channel);
+}
+
+
+int heif_image_get_height(const struct heif_image* img, enum heif_channel channel)
+{
+  return img->image->get_height(channel);
+}
+
+
+int heif_image_get_primary_width(const struct heif_image* img)
+{
+  if (img->image->get_colorspace() == heif_colorspace_RGB) {
+    if (img->image->get_chroma_format() == heif_chroma_444) {
+      return img->image->get_width(heif_channel_G);
+    }
+    else {
+      return img->image->get_width(heif_channel_interleaved);
+    }
+  }
+  else {
+    return img->image->get_width(heif_channel_Y);
+  }
+}
+
+
+int heif_image_get_primary_height(const struct heif_image* img)
+{
+  if (img->image->get_colorspace() == heif_colorspace_RGB) {
+    if (img->image->get_chroma_format() == heif_chroma_444) {
+      return img->image->get_height(heif_channel_G);
+    }
+    else {
+      return img->image->get_height(heif_channel_interleaved);
+    }
+  }
+  else {
+    return img->image->get_height(heif_channel_Y);
+  }
+}
+
+
+heif_error heif_image_crop(struct heif_image* img,
+                           int left, int right, int top, int bottom)
+{
+  std::shared_ptr<HeifPixelImage> out_img;
+
+  int w = img->image->get_width();
+  int h = img->image->get_height();
+
+  Error err = img->image->crop(left, w - 1 - right, top, h - 1 - bottom, out_img);
+  if (err) {
+    return err.error_struct(img->image.get());
+  }
+
+  img->image = out_img;
+
+  return heif_error{heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
+}
+
+
+int heif_image_get_bits_per_pixel(const struct heif_image* img, enum heif_channel channel)
+{
+  return img->image->get_storage_bits_per_pixel(channel);
+}
+
+
+int heif_image_get_bits_per_pixel_range(const struct heif_image* img, enum heif_channel channel)
+{
+  return img->image->get_bits_per_pixel(channel);
+}
+
+
+int heif_image_has_channel(const struct heif_image* img, enum heif_channel channel)
+{
+  return img->image->has_channel(channel);
+}
+
+
+struct heif_error heif_image_add_plane(struct heif_image* image,
+                                       heif_channel channel, int width, int height, int bit_depth)
+{
+  if (!image->image->add_plane(channel, width, height, bit_depth)) {
+    struct heif_error err = {heif_error_Memory_allocation_error,
+                             heif_suberror_Unspecified,
+                             "Cannot allocate memory for image plane"};
+    return err;
+  }
+  else {
+    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
+    return err;
+  }
+}
+
+
+namespace {
+  // Calls the release function of an external plane when the last reference to the plane memory is gone.
+  struct ExternalPlaneRelease
+  {
+    void (* release_func)(void*) = nullptr;
+    void* release_user_data = nullptr;
+    bool plane_added = false;
+
+    ~ExternalPlaneRelease()
+    {
+      if (plane_added && release_func) {
+        release_func(release_user_data);
+      }
+    }
+  };
+}
+
+
+static struct heif_error add_external_plane(struct heif_image* image,
+                                            enum heif_channel channel,
+                                            int width, int height, int bit_depth,
+                                            uint8_t* data, int stride, bool read_only,
+                                            void (* release_func)(void* release_user_data),
+                                            void* release_user_data)
+{
+  if (!image || !data) {
+    return error_null_parameter;
+  }
+
+  if (width < 0 || height < 0 || stride < 0) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value).error_struct(image->image.get());
+  }
+
+  auto release = std::make_shared<ExternalPlaneRelease>();
+  release->release_func = release_func;
+  release->release_user_data = release_user_data;
+
+  bool added;
+  if (read_only) {
+    added = image->image->add_read_only_external_plane(channel, width, height, bit_depth,
+                                                       data, static_cast<uint32_t>(stride), release);
+  }
+  else {
+    added = image->image->add_external_plane(channel, width, height, bit_depth,
+                                             data, static_cast<uint32_t>(stride), release);
+  }
+
+  if (!added) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 "Invalid plane size, bit depth or stride").error_struct(image->image.get());
+  }
+
+  release->plane_added = true;
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_image_add_external_plane(struct heif_image* image,
+                                                enum heif_channel channel,
+                                                int width, int height, int bit_depth,
+                                                uint8_t* data, int stride,
+                                                void (* release_func)(void* release_user_data),
+                                                void* release_user_data)
+{
+  return add_external_plane(image, channel, width, height, bit_depth, data, stride, false,
+                            release_func, release_user_data);
+}
+
+
+struct heif_error heif_image_add_external_read_only_plane(struct heif_image* image,
+                                                          enum heif_channel channel,
+                                                          int width, int height, int bit_depth,
+                                                          const uint8_t* data, int stride,
+                                                          void (* release_func)(void* release_user_data),
+                                                          void* release_user_data)
+{
+  // HeifPixelImage copies the plane before it is written.
+  return add_external_plane(image, channel, width, height, bit_depth, const_cast<uint8_t*>(data), stride, true,
+                            release_func, release_user_data);
+}
+
+
+// Returns false if the stride does not fit into the 'int' of the old API.
+static bool convert_stride_to_int(size_t stride, int* out_stride)
+{
+  if (stride > static_cast<size_t>(std::numeric_limits<int>::max())) {
+    if (out_stride) {
+      *out_stride = 0;
+    }
+    return false;
+  }
+
+  if (out_stride) {
+    *out_stride = static_cast<int>(stride);
+  }
+  return true;
+}
+
+
+const uint8_t* heif_image_get_plane_readonly(const struct heif_image* image,
+                                             enum heif_channel channel,
+                                             int* out_stride)
+{
+  size_t stride = 0;
+  const uint8_t* plane = heif_image_get_plane_readonly2(image, channel, &stride);
+  if (!convert_stride_to_int(stride, out_stride)) {
+    return nullptr;
+  }
+
+  return plane;
+}
+
+
+uint8_t* heif_image_get_plane(struct heif_image* image,
+                              enum heif_channel channel,
+                              int* out_stride)
+{
+  size_t stride = 0;
+  uint8_t* plane = heif_image_get_plane2(image, channel, &stride);
+  if (!convert_stride_to_int(stride, out_stride)) {
+    return nullptr;
+  }
+
+  return plane;
+}
+
+
+const uint8_t* heif_image_get_plane_readonly2(const struct heif_image* image,
+                                              enum heif_channel channel,
+                                              size_t* out_stride)
+{
+  if (!image || !image->image) {
+    if (out_stride) {
+      *out_stride = 0;
+    }
+    return nullptr;
+  }
+
+  const HeifPixelImage& pixel_image = *image->image;
+  return pixel_image.get_plane(channel, out_stride);
+}
+
+
+uint8_t* heif_image_get_plane2(struct heif_image* image,
+                               enum heif_channel channel,
+                               size_t* out_stride)
+{
+  if (!image || !image->image) {
+    if (out_stride) {
+      *out_stride = 0;
+    }
+    return nullptr;
+  }
+
+  return image->image->get_plane(channel, out_stride);
+}
+
+
+void heif_image_set_premultiplied_alpha(struct heif_image* image,
+                                        int is_premultiplied_alpha)
+{
+  if (image == nullptr) {
+    return;
+  }
+
+  image->image->set_premultiplied_alpha(is_premultiplied_alpha);
+}
+
+
+int heif_image_is_premultiplied_alpha(struct heif_image* image)
+{
+  if (image == nullptr) {
+    return 0;
+  }
+
+  return image->image->is_premultiplied_alpha();
+}
+
+
+struct heif_error heif_image_extend_padding_to_size(struct heif_image* image, int min_physical_width, int min_physical_height)
+{
+  bool mem_alloc_success = image->image->extend_padding_to_size(min_physical_width, min_physical_height);
+  if (!mem_alloc_success) {
+    return heif_error{heif_error_Memory_allocation_error,
+                      heif_suberror_Unspecified,
+                      "Cannot allocate image memory."};
+  }
+  else {
+    return heif_error{heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
+  }
+}
+
+
+static void set_default_options(heif_scaling_options& options)
+{
+  options.version = 1;
+
+  options.filter = heif_scaling_filter_bilinear;
+  options.max_threads = 0;
+}
+
+
+heif_scaling_options* heif_scaling_options_alloc()
+{
+  auto options = new heif_scaling_options;
+
+  set_default_options(*options);
+
+  return options;
+}
+
+
+void heif_scaling_options_free(heif_scaling_options* options)
+{
+  delete options;
+}
+
+
+struct heif_error heif_image_scale_image(const struct heif_image* input,
+                                         struct heif_image** output,
+                                         int width, int height,
+                                         const struct heif_scaling_options* options)
+{
+  std::shared_ptr<HeifPixelImage> out_img;
+  Error err;
+
+  if (options == nullptr) {
+    err = input->image->scale_nearest_neighbor(out_img, width, height);
+  }
+  else if (options->max_threads > 0) {
+    ThreadPool thread_pool(options->max_threads);
+    err = input->image->scale(out_img, width, height, options->filter, &thread_pool);
+  }
+  else {
+    err = input->image->scale(out_img, width, height, options->filter, nullptr);
+  }
+
+  if (err) {
+    return err.error_struct(input->image.get());
+  }
+
+  *output = new heif_image;
+  (*output)->image = out_img;
+
+  return Error::Ok.error_struct(input->image.get());
+}
+
+struct heif_error heif_image_set_raw_color_profile(struct heif_image* image,
+                                                   const char* color_profile_type_fourcc,
+                                                   const void* profile_data,
+                                                   const size_t profile_size)
+{
+  if (strlen(color_profile_type_fourcc) != 4) {
+    heif_error err = {heif_error_Usage_error,
+                      heif_suberror_Unspecified,
+                      "Invalid color_profile_type (must be 4 characters)"};
+    return err;
+  }
+
+  uint32_t color_profile_type = fourcc(color_profile_type_fourcc);
+
+  std::vector<uint8_t> data;
+  data.insert(data.end(),
+              (const uint8_t*) profile_data,
+              (const uint8_t*) profile_data + profile_size);
+
+  auto color_profile = std::make_shared<color_profile_raw>(color_profile_type, data);
+
+  image->image->set_color_profile_icc(color_profile);
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, Error::kSuccess};
+  return err;
+}
+
+
+struct heif_error heif_image_set_nclx_color_profile(struct heif_image* image,
+                                                    const struct heif_color_profile_nclx* color_profile)
+{
+  auto nclx = std::make_shared<color_profile_nclx>();
+
+  nclx->set_colour_primaries(color_profile->color_primaries);
+  nclx->set_transfer_characteristics(color_profile->transfer_characteristics);
+  nclx->set_matrix_coefficients(color_profile->matrix_coefficients);
+  nclx->set_full_range_flag(color_profile->full_range_flag);
+
+  image->image->set_color_profile_nclx(nclx);
+
+  return error_Ok;
+}
+
+
+/*
+void heif_image_remove_color_profile(struct heif_image* image)
+{
+  image->image->set_color_profile(nullptr);
+}
+*/
+
+
+int heif_image_handle_get_number_of_metadata_blocks(const struct heif_image_handle* handle,
+                                                    const char* type_filter)
+{
+  int cnt = 0;
+  for (const auto& metadata : handle->image->get_metadata()) {
+    if (type_filter == nullptr ||
+        metadata->item_type == type_filter) {
+      cnt++;
+    }
+  }
+
+  return cnt;
+}
+
+
+int heif_image_handle_get_list_of_metadata_block_IDs(const struct heif_image_handle* handle,
+                                                     const char* type_filter,
+                                                     heif_item_id* ids, int count)
+{
+  int cnt = 0;
+  for (const auto& metadata : handle->image->get_metadata()) {
+    if (type_filter == nullptr ||
+        metadata->item_type == type_filter) {
+      if (cnt < count) {
+        ids[cnt] = metadata->item_id;
+        cnt++;
+      }
+      else {
+        break;
+      }
+    }
+  }
+
+  return cnt;
+}
+
+
+const char* heif_image_handle_get_metadata_type(const struct heif_image_handle* handle,
+                                                heif_item_id metadata_id)
+{
+  for (auto& metadata : handle->image->get_metadata()) {
+    if (metadata->item_id == metadata_id) {
+      return metadata->item_type.c_str();
+    }
   }
 
   return nullptr;
@@ -1514,7 +2614,14 @@ size_t heif_image_handle_get_metadata_size(const struct heif_image_handle* handl
 {
   for (auto& metadata : handle->image->get_metadata()) {
     if (metadata->item_id == metadata_id) {
-      return metadata->m_data.size();
+      const uint8_t* data;
+      size_t size;
+      Error err = metadata->get_data(&data, &size);
+      if (err) {
+        return 0;
+      }
+
+      return size;
     }
   }
 
@@ -1529,16 +2636,21 @@ struct heif_error heif_image_handle_get_metadata(const struct heif_image_handle*
   for (auto& metadata : handle->image->get_metadata()) {
     if (metadata->item_id == metadata_id) {
 
-      if (!metadata->m_data.empty()) {
+      const uint8_t* data;
+      size_t size;
+      Error err = metadata->get_data(&data, &size);
+      if (err) {
+        return err.error_struct(handle->image.get());
+      }
+
+      if (size > 0) {
         if (out_data == nullptr) {
           Error err(heif_error_Usage_error,
                     heif_suberror_Null_pointer_argument);
           return err.error_struct(handle->image.get());
         }
 
-        memcpy(out_data,
-               metadata->m_data.data(),
-               metadata->m_data.size());
+        memcpy(out_data, data, size);
       }
 
       return Error::Ok.error_struct(handle->image.get());
@@ -1550,6 +2662,49 @@ struct heif_error heif_image_handle_get_metadata(const struct heif_image_handle*
   return err.error_struct(handle->image.get());
 }
 
+
+struct heif_error heif_image_handle_get_metadata_blocks(const struct heif_image_handle* handle,
+                                                        const char* type_filter,
+                                                        struct heif_metadata_block* out_blocks,
+                                                        int max_count,
+                                                        int* out_count)
+{
+  if (out_count == nullptr || (out_blocks == nullptr && max_count > 0)) {
+    Error err(heif_error_Usage_error,
+              heif_suberror_Null_pointer_argument);
+    return err.error_struct(handle->image.get());
+  }
+
+  int cnt = 0;
+  for (const auto& metadata : handle->image->get_metadata()) {
+    if (cnt == max_count) {
+      break;
+    }
+
+    if (type_filter != nullptr &&
+        metadata->item_type != type_filter) {
+      continue;
+    }
+
+    heif_metadata_block& block = out_blocks[cnt];
+    block.id = metadata->item_id;
+    block.type = metadata->item_type.c_str();
+    block.content_type = metadata->content_type.c_str();
+
+    Error err = metadata->get_data(&block.data, &block.size);
+    if (err) {
+      *out_count = cnt;
+      return err.error_struct(handle->image.get());
+    }
+
+    cnt++;
+  }
+
+  *out_count = cnt;
+
+  return Error::Ok.error_struct(handle->image.get());
+}
+
 heif_color_profile_type heif_image_handle_get_color_profile_type(const struct heif_image_handle* handle)
 {
   auto profile_icc = handle->image->get_color_profile_icc();
@@ -1823,6 +2978,99 @@ void heif_nclx_color_profile_free(struct heif_color_profile_nclx* nclx_profile)
 }
 
 
+int heif_context_get_number_of_items(const struct heif_context* ctx)
+{
+  return (int) ctx->context->get_heif_file()->get_item_IDs().size();
+}
+
+
+int heif_context_get_list_of_item_IDs(const struct heif_context* ctx,
+                                      heif_item_id* ID_array,
+                                      int count)
+{
+  if (ID_array == nullptr || count <= 0) {
+    return 0;
+  }
+
+  std::vector<heif_item_id> IDs = ctx->context->get_heif_file()->get_item_IDs();
+
+  int n = (int) std::min(IDs.size(), (size_t) count);
+  for (int i = 0; i < n; i++) {
+    ID_array[i] = IDs[i];
+  }
+
+  return n;
+}
+
+
+uint32_t heif_item_get_item_type(const struct heif_context* ctx, heif_item_id item_id)
+{
+  auto infe = ctx->context->get_heif_file()->get_infe_box(item_id);
+  if (!infe) {
+    return 0;
+  }
+
+  const std::string& type = infe->get_item_type();
+  if (type.size() != 4) {
+    return 0;
+  }
+
+  return heif_fourcc((uint8_t) type[0], (uint8_t) type[1], (uint8_t) type[2], (uint8_t) type[3]);
+}
+
+
+int heif_item_is_item_hidden(const struct heif_context* ctx, heif_item_id item_id)
+{
+  auto infe = ctx->context->get_heif_file()->get_infe_box(item_id);
+  return infe && infe->is_hidden_item();
+}
+
+
+const char* heif_item_get_mime_item_content_type(const struct heif_context* ctx, heif_item_id item_id)
+{
+  auto infe = ctx->context->get_heif_file()->get_infe_box(item_id);
+  if (!infe) {
+    return nullptr;
+  }
+
+  // The string is owned by the infe box, which lives as long as the context.
+  return infe->get_content_type().c_str();
+}
+
+
+struct heif_error heif_item_get_file_ranges(const struct heif_context* ctx, heif_item_id item_id,
+                                            struct heif_file_range** out_ranges,
+                                            int* out_number_of_ranges)
+{
+  if (out_ranges == nullptr || out_number_of_ranges == nullptr) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+
+  auto file = ctx->context->get_heif_file();
+  if (!file->get_infe_box(item_id)) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Nonexisting_item_referenced).error_struct(ctx->context.get());
+  }
+
+  std::vector<FileRange> ranges;
+  Error err = file->append_item_file_ranges(item_id, ranges);
+  if (err && err.sub_error_code != heif_suberror_No_item_data) {
+    return err.error_struct(ctx->context.get());
+  }
+
+  *out_ranges = new heif_file_range[ranges.size()];
+  for (size_t i = 0; i < ranges.size(); i++) {
+    (*out_ranges)[i].offset = ranges[i].offset;
+    (*out_ranges)[i].size = ranges[i].size;
+  }
+
+  *out_number_of_ranges = static_cast<int>(ranges.size());
+
+  return Error::Ok.error_struct(ctx->context.get());
+}
+
+
 int heif_item_get_properties_of_type(const struct heif_context* context,
                                      heif_item_id id,
                                      heif_item_property_type type,
@@ -2115,7 +3363,7 @@ struct heif_error heif_register_decoder_plugin(const heif_decoder_plugin* decode
   if (!decoder_plugin) {
     return error_null_parameter;
   }
-  else if (decoder_plugin->plugin_api_version > 3) {
+  else if (decoder_plugin->plugin_api_version > 8) {
     return error_unsupported_plugin_version;
   }
 
@@ -2128,7 +3376,7 @@ struct heif_error heif_register_encoder_plugin(const heif_encoder_plugin* encode
   if (!encoder_plugin) {
     return error_null_parameter;
   }
-  else if (encoder_plugin->plugin_api_version > 3) {
+  else if (encoder_plugin->plugin_api_version > 6) {
     return error_unsupported_plugin_version;
   }
 
@@ -2158,26 +3406,60 @@ void heif_context_reset(struct heif_context* ctx)
 static struct heif_error heif_file_writer_write(struct heif_context* ctx,
                                                 const void* data, size_t size, void* userdata)
 {
-  const char* filename = static_cast<const char*>(userdata);
-
+  auto* ostr = static_cast<std::ofstream*>(userdata);
+
+  ostr->write(static_cast<const char*>(data), size);
+  if (!ostr->good()) {
+    Error err(heif_error_Encoding_error, heif_suberror_Cannot_write_output_data);
+    return err.error_struct(ctx->context.get());
+  }
+
+  return Error::Ok.error_struct(ctx->context.get());
+}
+
+
+struct heif_error heif_context_write_to_file(struct heif_context* ctx,
+                                             const char* filename)
+{
 #if defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)
   std::ofstream ostr(HeifFile::convert_utf8_path_to_utf16(filename).c_str(), std::ios_base::binary);
 #else
   std::ofstream ostr(filename, std::ios_base::binary);
 #endif
-  ostr.write(static_cast<const char*>(data), size);
-  // TODO: handle write errors
-  return Error::Ok.error_struct(ctx->context.get());
+  if (!ostr.good()) {
+    Error err(heif_error_Encoding_error, heif_suberror_Cannot_write_output_data);
+    return err.error_struct(ctx->context.get());
+  }
+
+  // The file is written in parts as it is serialized.
+  heif_writer writer;
+  writer.writer_api_version = 2;
+  writer.write = heif_file_writer_write;
+  return heif_context_write(ctx, &writer, &ostr);
 }
 
 
-struct heif_error heif_context_write_to_file(struct heif_context* ctx,
-                                             const char* filename)
+struct heif_error heif_context_update_file_in_place(struct heif_context* ctx,
+                                                    const char* filename)
 {
-  heif_writer writer;
-  writer.writer_api_version = 1;
-  writer.write = heif_file_writer_write;
-  return heif_context_write(ctx, &writer, (void*) filename);
+  if (!filename) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+
+  const std::ios_base::openmode mode = std::ios_base::in | std::ios_base::out | std::ios_base::binary;
+#if defined(__MINGW32__) || defined(__MINGW64__) || defined(_MSC_VER)
+  std::fstream stream(HeifFile::convert_utf8_path_to_utf16(filename).c_str(), mode);
+#else
+  std::fstream stream(filename, mode);
+#endif
+  if (!stream.good()) {
+    Error err(heif_error_Encoding_error, heif_suberror_Cannot_write_output_data);
+    return err.error_struct(ctx->context.get());
+  }
+
+  Error err = ctx->context->write_in_place(stream);
+  return err.error_struct(ctx->context.get());
 }
 
 
@@ -2189,16 +3471,91 @@ struct heif_error heif_context_write(struct heif_context* ctx,
     return Error(heif_error_Usage_error,
                  heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
   }
-  else if (writer->writer_api_version != 1) {
+  else if (writer->writer_api_version != 1 && writer->writer_api_version != 2) {
     Error err(heif_error_Usage_error, heif_suberror_Unsupported_writer_version);
     return err.error_struct(ctx->context.get());
   }
 
-  StreamWriter swriter;
-  ctx->context->write(swriter);
+  if (ctx->context->is_streaming_output()) {
+    Error err(heif_error_Usage_error, heif_suberror_Unspecified,
+              "Use heif_context_finish_streaming_write() to complete a streamed file");
+    return err.error_struct(ctx->context.get());
+  }
 
-  const auto& data = swriter.get_data();
-  return writer->write(ctx, data.data(), data.size(), userdata);
+  if (writer->writer_api_version == 1) {
+    StreamWriter swriter;
+    Error err = ctx->context->write(swriter);
+    if (err) {
+      return err.error_struct(ctx->context.get());
+    }
+
+    const auto& data = swriter.get_data();
+    return writer->write(ctx, data.data(), data.size(), userdata);
+  }
+
+
+  // --- version 2: pass the data to the writer as it is serialized
+
+  heif_error writer_error = Error::Ok.error_struct(ctx->context.get());
+
+  Error err = ctx->context->write([&](const uint8_t* data, size_t size) {
+    writer_error = writer->write(ctx, data, size, userdata);
+    if (writer_error.code != heif_error_Ok) {
+      return Error(writer_error.code, writer_error.subcode);
+    }
+
+    return Error::Ok;
+  });
+
+  if (writer_error.code != heif_error_Ok) {
+    return writer_error;
+  }
+
+  return err.error_struct(ctx->context.get());
+}
+
+
+struct heif_error heif_context_start_streaming_write(struct heif_context* ctx,
+                                                     const struct heif_encoder* encoder,
+                                                     const struct heif_writer* writer,
+                                                     void* userdata)
+{
+  if (!encoder || !writer) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+  else if (writer->writer_api_version != 2) {
+    Error err(heif_error_Usage_error, heif_suberror_Unsupported_writer_version,
+              "Streaming output needs a writer with writer_api_version 2");
+    return err.error_struct(ctx->context.get());
+  }
+
+  heif_writer writer_functions = *writer;
+
+  auto sink = [ctx, writer_functions, userdata](const uint8_t* data, size_t size) {
+    heif_error err = writer_functions.write(ctx, data, size, userdata);
+    if (err.code != heif_error_Ok) {
+      return Error(err.code, err.subcode, err.message ? err.message : "");
+    }
+
+    return Error::Ok;
+  };
+
+  Error err = ctx->context->start_streaming_output(encoder->plugin->compression_format, sink);
+  return err.error_struct(ctx->context.get());
+}
+
+
+struct heif_error heif_context_finish_streaming_write(struct heif_context* ctx)
+{
+  if (!ctx->context->is_streaming_output()) {
+    Error err(heif_error_Usage_error, heif_suberror_Unspecified,
+              "heif_context_start_streaming_write() has not been called");
+    return err.error_struct(ctx->context.get());
+  }
+
+  Error err = ctx->context->finish_streaming_output();
+  return err.error_struct(ctx->context.get());
 }
 
 
@@ -2258,12 +3615,14 @@ int heif_get_decoder_descriptors(enum heif_compression_format format_filter,
   std::vector<decoder_with_priority> plugins;
   std::vector<heif_compression_format> formats;
   if (format_filter == heif_compression_undefined) {
-    formats = {heif_compression_HEVC, heif_compression_AV1, heif_compression_VVC};
+    formats = {heif_compression_HEVC, heif_compression_AV1, heif_compression_VVC, heif_compression_JPEG};
   }
   else {
     formats.emplace_back(format_filter);
   }
 
+  load_deferred_plugins();
+
   for (const auto* plugin : s_decoder_plugins) {
     for (auto& format : formats) {
       int priority = plugin->does_support_format(format);
@@ -2452,6 +3811,86 @@ struct heif_error heif_encoder_set_lossless(struct heif_encoder* encoder, int en
 }
 
 
+struct heif_error heif_encoder_set_target_encoding_time(struct heif_encoder* encoder, double milliseconds_per_megapixel)
+{
+  if (!encoder) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(nullptr);
+  }
+
+  if (milliseconds_per_megapixel < 0) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value).error_struct(nullptr);
+  }
+
+  if (milliseconds_per_megapixel == 0) {
+    encoder->time_budget.reset();
+    return Error::Ok.error_struct(nullptr);
+  }
+
+  std::shared_ptr<EncodingTimeBudget> budget;
+  Error err = EncodingTimeBudget::create(*encoder, milliseconds_per_megapixel, budget);
+  if (err) {
+    return err.error_struct(nullptr);
+  }
+
+  encoder->time_budget = std::move(budget);
+  return Error::Ok.error_struct(nullptr);
+}
+
+
+static std::mutex encoder_thread_budget_mutex;
+static int encoder_thread_budget = 0; // 0 = no limit
+static int encoder_threads_in_use = 0;
+static int active_budgeted_encoders = 0;
+
+
+void heif_set_encoder_thread_budget(int max_threads)
+{
+  std::lock_guard<std::mutex> lock(encoder_thread_budget_mutex);
+  encoder_thread_budget = std::max(max_threads, 0);
+}
+
+
+int heif_get_encoder_thread_budget()
+{
+  std::lock_guard<std::mutex> lock(encoder_thread_budget_mutex);
+  return encoder_thread_budget;
+}
+
+
+int heif_encoder_acquire_threads(int requested_threads)
+{
+  std::lock_guard<std::mutex> lock(encoder_thread_budget_mutex);
+
+  int threads = std::max(requested_threads, 1);
+
+  if (encoder_thread_budget > 0) {
+    // Split the budget evenly across all running encoders, but do not take threads that
+    // are still used by earlier encoders. Encoders that start later get a smaller share
+    // until the earlier ones have finished.
+    int fair_share = encoder_thread_budget / (active_budgeted_encoders + 1);
+    int available = encoder_thread_budget - encoder_threads_in_use;
+
+    threads = std::max(1, std::min({threads, fair_share, available}));
+  }
+
+  active_budgeted_encoders++;
+  encoder_threads_in_use += threads;
+
+  return threads;
+}
+
+
+void heif_encoder_release_threads(int threads)
+{
+  std::lock_guard<std::mutex> lock(encoder_thread_budget_mutex);
+
+  active_budgeted_encoders = std::max(active_budgeted_encoders - 1, 0);
+  encoder_threads_in_use = std::max(encoder_threads_in_use - std::max(threads, 1), 0);
+}
+
+
 struct heif_error heif_encoder_set_logging_level(struct heif_encoder* encoder, int level)
 {
   if (!encoder) {
@@ -2835,7 +4274,7 @@ int heif_encoder_has_default(struct heif_encoder* encoder,
 
 static void set_default_options(heif_encoding_options& options)
 {
-  options.version = 6;
+  options.version = 9;
 
   options.save_alpha_channel = true;
   options.macOS_compatibility_workaround = false;
@@ -2844,17 +4283,39 @@ static void set_default_options(heif_encoding_options& options)
   options.macOS_compatibility_workaround_no_nclx_profile = true;
   options.image_orientation = heif_orientation_normal;
 
-  options.color_conversion_options.version = 1;
+  options.color_conversion_options.version = 2;
   options.color_conversion_options.preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average;
   options.color_conversion_options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear;
   options.color_conversion_options.only_use_preferred_chroma_algorithm = false;
+  options.color_conversion_options.conversion_accuracy = heif_color_conversion_accuracy_precise;
+
+  options.thumbnail_bbox_size = 0;
+  options.encode_auxiliary_images_concurrently = false;
+  options.thumbnail_pyramid_bbox_sizes = nullptr;
+  options.num_thumbnail_pyramid_levels = 0;
+  options.cancel_encoding = nullptr;
+  options.cancel_user_data = nullptr;
+  options.timeout_ms = 0;
 }
 
 static void copy_options(heif_encoding_options& options, const heif_encoding_options& input_options)
 {
   switch (input_options.version) {
+    case 9:
+      options.cancel_encoding = input_options.cancel_encoding;
+      options.cancel_user_data = input_options.cancel_user_data;
+      options.timeout_ms = input_options.timeout_ms;
+      // fallthrough
+    case 8:
+      options.thumbnail_pyramid_bbox_sizes = input_options.thumbnail_pyramid_bbox_sizes;
+      options.num_thumbnail_pyramid_levels = input_options.num_thumbnail_pyramid_levels;
+      // fallthrough
+    case 7:
+      options.thumbnail_bbox_size = input_options.thumbnail_bbox_size;
+      options.encode_auxiliary_images_concurrently = input_options.encode_auxiliary_images_concurrently;
+      // fallthrough
     case 6:
-      options.color_conversion_options = input_options.color_conversion_options;
+      copy_color_conversion_options(options.color_conversion_options, input_options.color_conversion_options);
       // fallthrough
     case 5:
       options.image_orientation = input_options.image_orientation;
@@ -2872,63 +4333,326 @@ static void copy_options(heif_encoding_options& options, const heif_encoding_opt
     case 1:
       options.save_alpha_channel = input_options.save_alpha_channel;
   }
-}
+}
+
+
+heif_encoding_options* heif_encoding_options_alloc()
+{
+  auto options = new heif_encoding_options;
+
+  set_default_options(*options);
+
+  return options;
+}
+
+
+void heif_encoding_options_free(heif_encoding_options* options)
+{
+  delete options;
+}
+
+// 'nclx' receives the nclx profile of the input image if the options do not specify one.
+static void get_encoding_options(const struct heif_encoding_options* input_options,
+                                 const struct heif_image* input_image,
+                                 heif_encoding_options& options,
+                                 heif_color_profile_nclx& nclx)
+{
+  set_default_options(options);
+  if (input_options) {
+    copy_options(options, *input_options);
+
+    if (options.output_nclx_profile == nullptr) {
+      auto input_nclx = input_image->image->get_color_profile_nclx();
+      if (input_nclx) {
+        options.output_nclx_profile = &nclx;
+        nclx.version = 1;
+        nclx.color_primaries = (enum heif_color_primaries) input_nclx->get_colour_primaries();
+        nclx.transfer_characteristics = (enum heif_transfer_characteristics) input_nclx->get_transfer_characteristics();
+        nclx.matrix_coefficients = (enum heif_matrix_coefficients) input_nclx->get_matrix_coefficients();
+        nclx.full_range_flag = input_nclx->get_full_range_flag();
+      }
+    }
+  }
+}
+
+
+struct heif_error heif_context_encode_image(struct heif_context* ctx,
+                                            const struct heif_image* input_image,
+                                            struct heif_encoder* encoder,
+                                            const struct heif_encoding_options* input_options,
+                                            struct heif_image_handle** out_image_handle)
+{
+  if (!encoder) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+
+  heif_encoding_options options;
+  heif_color_profile_nclx nclx;
+  get_encoding_options(input_options, input_image, options, nclx);
+
+  Cancellation cancellation(options);
+
+  std::shared_ptr<HeifContext::Image> image;
+  Error error;
+
+
+  error = ctx->context->encode_image(input_image->image,
+                                     encoder,
+                                     options,
+                                     heif_image_input_class_normal,
+                                     image);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+
+  // mark the new image as primary image
+
+  if (ctx->context->is_primary_image_set() == false) {
+    ctx->context->set_primary_image(image);
+  }
+
+  if (out_image_handle) {
+    *out_image_handle = new heif_image_handle;
+    (*out_image_handle)->image = image;
+    (*out_image_handle)->context = ctx->context;
+  }
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_context_encode_image_with_target_size(struct heif_context* ctx,
+                                                             const struct heif_image* input_image,
+                                                             struct heif_encoder* encoder,
+                                                             const struct heif_encoding_options* input_options,
+                                                             size_t target_size,
+                                                             int* out_quality,
+                                                             struct heif_image_handle** out_image_handle)
+{
+  if (!encoder || !input_image) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+
+  heif_encoding_options options;
+  heif_color_profile_nclx nclx;
+  get_encoding_options(input_options, input_image, options, nclx);
+
+  Cancellation cancellation(options);
+
+  std::shared_ptr<HeifContext::Image> image;
+  int quality = 0;
+
+  Error error = ctx->context->encode_image_with_target_size(input_image->image,
+                                                            encoder,
+                                                            options,
+                                                            target_size,
+                                                            quality,
+                                                            image);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+
+  if (ctx->context->is_primary_image_set() == false) {
+    ctx->context->set_primary_image(image);
+  }
+
+  if (out_quality) {
+    *out_quality = quality;
+  }
+
+  if (out_image_handle) {
+    *out_image_handle = new heif_image_handle;
+    (*out_image_handle)->image = image;
+    (*out_image_handle)->context = ctx->context;
+  }
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_context_encode_grid(struct heif_context* ctx,
+                                           const struct heif_image* input_image,
+                                           uint32_t tile_width, uint32_t tile_height,
+                                           struct heif_encoder* encoder,
+                                           const struct heif_encoding_options* input_options,
+                                           struct heif_image_handle** out_image_handle)
+{
+  if (!encoder || !input_image) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+
+  heif_encoding_options options;
+  heif_color_profile_nclx nclx;
+  get_encoding_options(input_options, input_image, options, nclx);
+
+  Cancellation cancellation(options);
+
+  std::shared_ptr<HeifContext::Image> image;
+  Error error = ctx->context->encode_grid(input_image->image,
+                                          tile_width, tile_height,
+                                          encoder,
+                                          options,
+                                          image);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+
+  if (ctx->context->is_primary_image_set() == false) {
+    ctx->context->set_primary_image(image);
+  }
+
+  if (out_image_handle) {
+    *out_image_handle = new heif_image_handle;
+    (*out_image_handle)->image = image;
+    (*out_image_handle)->context = ctx->context;
+  }
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_context_encode_grid_from_bands(struct heif_context* ctx,
+                                                      uint32_t image_width, uint32_t image_height,
+                                                      uint32_t tile_width, uint32_t tile_height,
+                                                      struct heif_encoder* encoder,
+                                                      const struct heif_encoding_options* input_options,
+                                                      heif_encoding_band_callback get_band,
+                                                      void* userdata,
+                                                      struct heif_image_handle** out_image_handle)
+{
+  if (!encoder || !get_band) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
 
+  // There is no input image to take a default output color profile from. Each tile uses the one of its band.
+  heif_encoding_options options;
+  set_default_options(options);
+  if (input_options) {
+    copy_options(options, *input_options);
+  }
 
-heif_encoding_options* heif_encoding_options_alloc()
-{
-  auto options = new heif_encoding_options;
+  Cancellation cancellation(options);
 
-  set_default_options(*options);
+  auto get_band_image = [&](uint32_t y, uint32_t height, std::shared_ptr<HeifPixelImage>& band) {
+    heif_image* band_img = nullptr;
+    heif_error err = get_band(static_cast<int>(y), static_cast<int>(height), &band_img, userdata);
+    if (err.code != heif_error_Ok) {
+      heif_image_release(band_img);
+      return Error(err.code, err.subcode, err.message ? err.message : "");
+    }
 
-  return options;
-}
+    if (!band_img) {
+      return Error(heif_error_Usage_error, heif_suberror_Null_pointer_argument, "No band image returned");
+    }
 
+    band = band_img->image;
+    heif_image_release(band_img);
 
-void heif_encoding_options_free(heif_encoding_options* options)
-{
-  delete options;
+    return Error::Ok;
+  };
+
+  std::shared_ptr<HeifContext::Image> image;
+  Error error = ctx->context->encode_grid_from_bands(image_width, image_height,
+                                                     tile_width, tile_height,
+                                                     encoder,
+                                                     options,
+                                                     get_band_image,
+                                                     image);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+
+  if (ctx->context->is_primary_image_set() == false) {
+    ctx->context->set_primary_image(image);
+  }
+
+  if (out_image_handle) {
+    *out_image_handle = new heif_image_handle;
+    (*out_image_handle)->image = image;
+    (*out_image_handle)->context = ctx->context;
+  }
+
+  return error_Ok;
 }
 
-struct heif_error heif_context_encode_image(struct heif_context* ctx,
-                                            const struct heif_image* input_image,
-                                            struct heif_encoder* encoder,
-                                            const struct heif_encoding_options* input_options,
-                                            struct heif_image_handle** out_image_handle)
+
+struct heif_error heif_context_encode_images(struct heif_context* ctx,
+                                             const struct heif_image* const* input_images, int num_images,
+                                             struct heif_encoder* encoder,
+                                             const struct heif_encoding_options* const* input_options,
+                                             struct heif_image_handle** out_image_handles)
 {
-  if (!encoder) {
+  if (!encoder || (num_images > 0 && !input_images)) {
     return Error(heif_error_Usage_error,
                  heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
   }
 
-  heif_encoding_options options;
-  heif_color_profile_nclx nclx;
-  set_default_options(options);
-  if (input_options) {
-    copy_options(options, *input_options);
+  if (num_images < 0) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value).error_struct(ctx->context.get());
+  }
 
-    if (options.output_nclx_profile == nullptr) {
-      auto input_nclx = input_image->image->get_color_profile_nclx();
-      if (input_nclx) {
-        options.output_nclx_profile = &nclx;
-        nclx.version = 1;
-        nclx.color_primaries = (enum heif_color_primaries) input_nclx->get_colour_primaries();
-        nclx.transfer_characteristics = (enum heif_transfer_characteristics) input_nclx->get_transfer_characteristics();
-        nclx.matrix_coefficients = (enum heif_matrix_coefficients) input_nclx->get_matrix_coefficients();
-        nclx.full_range_flag = input_nclx->get_full_range_flag();
+  std::vector<std::shared_ptr<HeifPixelImage>> images(num_images);
+  std::vector<heif_encoding_options> options(num_images);
+  std::vector<heif_color_profile_nclx> nclx(num_images); // referenced by 'options'
+  std::vector<std::unique_ptr<Cancellation>> cancellations; // installed into 'options'
+
+  for (int i = 0; i < num_images; i++) {
+    if (!input_images[i]) {
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+    }
+
+    images[i] = input_images[i]->image;
+    get_encoding_options(input_options ? input_options[i] : nullptr, input_images[i], options[i], nclx[i]);
+    cancellations.emplace_back(new Cancellation(options[i]));
+  }
+
+  std::vector<std::shared_ptr<HeifContext::Image>> coded_images;
+  Error error = ctx->context->encode_images(images, encoder, options, coded_images);
+
+  // mark the first image as primary image, as the first heif_context_encode_image() call would do
+
+  if (!coded_images.empty() && ctx->context->is_primary_image_set() == false) {
+    ctx->context->set_primary_image(coded_images[0]);
+  }
+
+  if (out_image_handles) {
+    for (int i = 0; i < num_images; i++) {
+      if (i < (int) coded_images.size()) {
+        out_image_handles[i] = new heif_image_handle;
+        out_image_handles[i]->image = coded_images[i];
+        out_image_handles[i]->context = ctx->context;
+      }
+      else {
+        out_image_handles[i] = nullptr;
       }
     }
   }
 
-  std::shared_ptr<HeifContext::Image> image;
-  Error error;
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
 
+  return error_Ok;
+}
 
-  error = ctx->context->encode_image(input_image->image,
-                                     encoder,
-                                     options,
-                                     heif_image_input_class_normal,
-                                     image);
+
+struct heif_error heif_context_add_jpeg_image(struct heif_context* ctx,
+                                              const void* data, size_t size,
+                                              struct heif_image_handle** out_image_handle)
+{
+  if (!data) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+
+  std::shared_ptr<HeifContext::Image> image;
+  Error error = ctx->context->add_jpeg_image(static_cast<const uint8_t*>(data), size, image);
   if (error != Error::Ok) {
     return error.error_struct(ctx->context.get());
   }
@@ -2958,6 +4682,37 @@ struct heif_error heif_context_assign_thumbnail(struct heif_context* ctx,
 }
 
 
+struct heif_error heif_context_copy_image(struct heif_context* ctx,
+                                          const struct heif_image_handle* source_image,
+                                          struct heif_image_handle** out_image_handle)
+{
+  if (!source_image) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Null_pointer_argument).error_struct(ctx->context.get());
+  }
+
+  std::shared_ptr<HeifContext::Image> image;
+  Error error = ctx->context->copy_image_from(*source_image->context,
+                                              source_image->image->get_id(),
+                                              image);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+
+  if (ctx->context->is_primary_image_set() == false) {
+    ctx->context->set_primary_image(image);
+  }
+
+  if (out_image_handle) {
+    *out_image_handle = new heif_image_handle;
+    (*out_image_handle)->image = image;
+    (*out_image_handle)->context = ctx->context;
+  }
+
+  return error_Ok;
+}
+
+
 struct heif_error heif_context_encode_thumbnail(struct heif_context* ctx,
                                                 const struct heif_image* image,
                                                 const struct heif_image_handle* image_handle,
@@ -2975,6 +4730,8 @@ struct heif_error heif_context_encode_thumbnail(struct heif_context* ctx,
     copy_options(options, *input_options);
   }
 
+  Cancellation cancellation(options);
+
   Error error = ctx->context->encode_thumbnail(image->image,
                                                encoder,
                                                options,
@@ -2990,99 +4747,341 @@ struct heif_error heif_context_encode_thumbnail(struct heif_context* ctx,
     return err.error_struct(ctx->context.get());
   }
 
-  error = ctx->context->assign_thumbnail(image_handle->image, thumbnail_image);
-  if (error != Error::Ok) {
-    return error.error_struct(ctx->context.get());
-  }
+  error = ctx->context->assign_thumbnail(image_handle->image, thumbnail_image);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+
+
+  if (out_image_handle) {
+    if (thumbnail_image) {
+      *out_image_handle = new heif_image_handle;
+      (*out_image_handle)->image = thumbnail_image;
+      (*out_image_handle)->context = ctx->context;
+    }
+    else {
+      *out_image_handle = nullptr;
+    }
+  }
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_context_set_primary_image(struct heif_context* ctx,
+                                                 struct heif_image_handle* image_handle)
+{
+  ctx->context->set_primary_image(image_handle->image);
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_context_add_exif_metadata(struct heif_context* ctx,
+                                                 const struct heif_image_handle* image_handle,
+                                                 const void* data, int size)
+{
+  Error error = ctx->context->add_exif_metadata(image_handle->image, data, size);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+  else {
+    return error_Ok;
+  }
+}
+
+
+struct heif_error heif_context_add_XMP_metadata(struct heif_context* ctx,
+                                                const struct heif_image_handle* image_handle,
+                                                const void* data, int size)
+{
+  return heif_context_add_XMP_metadata2(ctx, image_handle, data, size,
+                                        heif_metadata_compression_off);
+}
+
+
+struct heif_error heif_context_add_XMP_metadata2(struct heif_context* ctx,
+                                                 const struct heif_image_handle* image_handle,
+                                                 const void* data, int size,
+                                                 heif_metadata_compression compression)
+{
+  Error error = ctx->context->add_XMP_metadata(image_handle->image, data, size, compression);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+  else {
+    return error_Ok;
+  }
+}
+
+
+struct heif_error heif_context_add_generic_metadata(struct heif_context* ctx,
+                                                    const struct heif_image_handle* image_handle,
+                                                    const void* data, int size,
+                                                    const char* item_type, const char* content_type)
+{
+  Error error = ctx->context->add_generic_metadata(image_handle->image, data, size,
+                                                   item_type, content_type, heif_metadata_compression_off);
+  if (error != Error::Ok) {
+    return error.error_struct(ctx->context.get());
+  }
+  else {
+    return error_Ok;
+  }
+}
+
+
+struct heif_error heif_context_remove_metadata(struct heif_context* ctx,
+                                               const struct heif_image_handle* image_handle,
+                                               heif_item_id metadata_id)
+{
+  Error error = ctx->context->remove_metadata(image_handle->image, metadata_id);
+  return error.error_struct(ctx->context.get());
+}
+
+
+void heif_context_set_maximum_image_size_limit(struct heif_context* ctx, int maximum_width)
+{
+  ctx->context->set_maximum_image_size_limit(maximum_width);
+}
+
+
+void heif_context_set_decoding_work_limit(struct heif_context* ctx, uint64_t base_work, uint32_t work_per_input_byte)
+{
+  ctx->context->set_decoding_work_limit(base_work, work_per_input_byte);
+}
+
+
+void heif_context_set_max_decoding_threads(struct heif_context* ctx, int max_threads)
+{
+  ctx->context->set_max_decoding_threads(max_threads);
+}
+
+
+static bool is_valid_executor(const struct heif_executor* executor)
+{
+  return executor && executor->version >= 1 && executor->submit && executor->concurrency > 0;
+}
+
+
+struct heif_error heif_context_set_executor(struct heif_context* ctx, const struct heif_executor* executor)
+{
+  if (!is_valid_executor(executor)) {
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Invalid executor"};
+  }
+
+#if ENABLE_PARALLEL_TILE_DECODING
+  ctx->context->set_thread_pool(std::make_shared<ThreadPool>(*executor));
+  return error_Ok;
+#else
+  return {heif_error_Unsupported_feature, heif_suberror_Unspecified, "libheif was built without multithreading support"};
+#endif
+}
+
+
+void heif_context_set_image_memory_pool_size(struct heif_context* ctx, size_t max_cached_bytes)
+{
+  ctx->context->set_plane_memory_pool_size(max_cached_bytes);
+}
+
+
+static void get_image_memory_pool_statistics(const std::shared_ptr<PlaneMemoryPool>& pool,
+                                             struct heif_image_memory_pool_statistics* out_stats)
+{
+  *out_stats = {};
+
+  if (pool) {
+    PlaneMemoryPool::Statistics stats = pool->get_statistics();
+    out_stats->num_allocations = stats.num_allocations;
+    out_stats->num_reused = stats.num_reused;
+    out_stats->cached_bytes = stats.cached_bytes;
+  }
+}
+
+
+void heif_context_get_image_memory_pool_statistics(const struct heif_context* ctx,
+                                                   struct heif_image_memory_pool_statistics* out_stats)
+{
+  if (out_stats == nullptr) {
+    return;
+  }
+
+  get_image_memory_pool_statistics(ctx->context->get_plane_memory_pool(), out_stats);
+}
+
+
+void heif_context_set_memory_budget(struct heif_context* ctx, size_t max_bytes)
+{
+  ctx->context->set_memory_budget(max_bytes);
+}
+
+
+size_t heif_context_get_memory_budget_usage(const struct heif_context* ctx)
+{
+  auto budget = ctx->context->get_memory_budget();
+  if (!budget) {
+    return 0;
+  }
+
+  return budget->get_used_bytes();
+}
 
 
-  if (out_image_handle) {
-    if (thumbnail_image) {
-      *out_image_handle = new heif_image_handle;
-      (*out_image_handle)->image = thumbnail_image;
-      (*out_image_handle)->context = ctx->context;
-    }
-    else {
-      *out_image_handle = nullptr;
-    }
+void heif_context_set_decoded_image_cache_size(struct heif_context* ctx, size_t max_bytes)
+{
+  ctx->context->set_decoded_image_cache_size(max_bytes);
+}
+
+
+void heif_context_get_decoded_image_cache_statistics(const struct heif_context* ctx,
+                                                     struct heif_decoded_image_cache_statistics* out_stats)
+{
+  if (out_stats == nullptr) {
+    return;
   }
 
-  return error_Ok;
+  *out_stats = {};
+
+  auto cache = ctx->context->get_decoded_image_cache();
+  if (cache) {
+    DecodedImageCache::Statistics stats = cache->get_statistics();
+    out_stats->num_hits = stats.num_hits;
+    out_stats->num_misses = stats.num_misses;
+    out_stats->num_images = stats.num_images;
+    out_stats->cached_bytes = stats.cached_bytes;
+  }
 }
 
 
-struct heif_error heif_context_set_primary_image(struct heif_context* ctx,
-                                                 struct heif_image_handle* image_handle)
+heif_engine_options* heif_engine_options_alloc()
 {
-  ctx->context->set_primary_image(image_handle->image);
+  auto options = new heif_engine_options;
 
-  return error_Ok;
+  options->version = 2;
+  options->max_decoding_threads = 4;
+  options->image_memory_pool_size = 64 * 1024 * 1024;
+  options->executor = nullptr;
+
+  return options;
 }
 
 
-struct heif_error heif_context_add_exif_metadata(struct heif_context* ctx,
-                                                 const struct heif_image_handle* image_handle,
-                                                 const void* data, int size)
+void heif_engine_options_free(heif_engine_options* options)
 {
-  Error error = ctx->context->add_exif_metadata(image_handle->image, data, size);
-  if (error != Error::Ok) {
-    return error.error_struct(ctx->context.get());
+  delete options;
+}
+
+
+struct heif_engine* heif_engine_alloc(const struct heif_engine_options* options)
+{
+  heif_engine_options* default_options = heif_engine_options_alloc();
+
+  int max_decoding_threads = default_options->max_decoding_threads;
+  size_t image_memory_pool_size = default_options->image_memory_pool_size;
+
+  heif_engine_options_free(default_options);
+
+  const heif_executor* executor = nullptr;
+
+  if (options && options->version >= 1) {
+    max_decoding_threads = options->max_decoding_threads;
+    image_memory_pool_size = options->image_memory_pool_size;
   }
-  else {
-    return error_Ok;
+
+  if (options && options->version >= 2 && is_valid_executor(options->executor)) {
+    executor = options->executor;
   }
+
+  auto engine = new heif_engine;
+  engine->engine = std::make_shared<HeifEngine>(max_decoding_threads, image_memory_pool_size, executor);
+
+  return engine;
 }
 
 
-struct heif_error heif_context_add_XMP_metadata(struct heif_context* ctx,
-                                                const struct heif_image_handle* image_handle,
-                                                const void* data, int size)
+void heif_engine_free(struct heif_engine* engine)
 {
-  return heif_context_add_XMP_metadata2(ctx, image_handle, data, size,
-                                        heif_metadata_compression_off);
+  delete engine;
 }
 
 
-struct heif_error heif_context_add_XMP_metadata2(struct heif_context* ctx,
-                                                 const struct heif_image_handle* image_handle,
-                                                 const void* data, int size,
-                                                 heif_metadata_compression compression)
+void heif_context_attach_to_engine(struct heif_context* ctx, struct heif_engine* engine)
 {
-  Error error = ctx->context->add_XMP_metadata(image_handle->image, data, size, compression);
-  if (error != Error::Ok) {
-    return error.error_struct(ctx->context.get());
-  }
-  else {
-    return error_Ok;
+  if (ctx == nullptr || engine == nullptr) {
+    return;
   }
+
+  ctx->context->attach_to_engine(engine->engine);
 }
 
 
-struct heif_error heif_context_add_generic_metadata(struct heif_context* ctx,
-                                                    const struct heif_image_handle* image_handle,
-                                                    const void* data, int size,
-                                                    const char* item_type, const char* content_type)
+void heif_engine_get_image_memory_pool_statistics(const struct heif_engine* engine,
+                                                  struct heif_image_memory_pool_statistics* out_stats)
 {
-  Error error = ctx->context->add_generic_metadata(image_handle->image, data, size,
-                                                   item_type, content_type, heif_metadata_compression_off);
-  if (error != Error::Ok) {
-    return error.error_struct(ctx->context.get());
+  if (engine == nullptr || out_stats == nullptr) {
+    return;
   }
-  else {
-    return error_Ok;
+
+  get_image_memory_pool_statistics(engine->engine->get_plane_memory_pool(), out_stats);
+}
+
+
+void heif_get_statistics(struct heif_statistics* out_stats)
+{
+  if (out_stats == nullptr) {
+    return;
   }
+
+  out_stats->images_decoded = statistics::get(statistics::images_decoded);
+  out_stats->tiles_decoded = statistics::get(statistics::tiles_decoded);
+  out_stats->bytes_read = statistics::get(statistics::bytes_read);
+  out_stats->pixels_converted = statistics::get(statistics::pixels_converted);
+  out_stats->plane_bytes_allocated = statistics::get(statistics::plane_bytes_allocated);
+  out_stats->plane_bytes_reused = statistics::get(statistics::plane_bytes_reused);
+  out_stats->decoded_image_cache_hits = statistics::get(statistics::decoded_image_cache_hits);
+  out_stats->decoded_image_cache_misses = statistics::get(statistics::decoded_image_cache_misses);
+  out_stats->conversion_pipeline_cache_hits = statistics::get(statistics::conversion_pipeline_cache_hits);
+  out_stats->conversion_pipeline_cache_misses = statistics::get(statistics::conversion_pipeline_cache_misses);
+  out_stats->decoder_instances_created = statistics::get(statistics::decoder_instances_created);
+  out_stats->read_lock_wait_ns = statistics::get(statistics::read_lock_wait_ns);
+  out_stats->plane_allocations = statistics::get(statistics::plane_allocations);
 }
 
 
-void heif_context_set_maximum_image_size_limit(struct heif_context* ctx, int maximum_width)
+void heif_reset_statistics(void)
 {
-  ctx->context->set_maximum_image_size_limit(maximum_width);
+  statistics::reset();
 }
 
 
-void heif_context_set_max_decoding_threads(struct heif_context* ctx, int max_threads)
+int heif_get_color_conversion_statistics(struct heif_color_conversion_statistics* out_stats, int max_entries)
 {
-  ctx->context->set_max_decoding_threads(max_threads);
+  static const std::vector<std::string> names = [] {
+    std::vector<std::string> op_names;
+    for (const ColorConversionOperation* op : ColorConversionPipeline::get_operations()) {
+      op_names.push_back(get_operation_name(op));
+    }
+    return op_names;
+  }();
+
+  int num_operations = std::min((int) names.size(), statistics::kMaxColorConversionOperations);
+
+  if (out_stats != nullptr) {
+    for (int i = 0; i < std::min(max_entries, num_operations); i++) {
+      statistics::ColorConversionCount count = statistics::get_color_conversion(i);
+      out_stats[i].operation_name = names[i].c_str();
+      out_stats[i].num_conversions = count.num_conversions;
+      out_stats[i].num_pixels = count.num_pixels;
+    }
+  }
+
+  return num_operations;
+}
+
+
+void heif_context_set_trace_callback(struct heif_context* ctx, heif_trace_callback callback, void* userdata)
+{
+  ctx->context->set_trace_callback(callback, userdata);
 }
 
 int heif_image_handle_get_number_of_region_items(const struct heif_image_handle* handle)
@@ -3315,6 +5314,308 @@ struct heif_error heif_region_item_add_region_polyline(struct heif_region_item*
 }
 
 
+static const int kMaxRegionsPerItem = 255;
+
+static struct heif_error check_number_of_new_regions(const struct heif_region_item* item, int num)
+{
+  if (num < 0) {
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Negative number of regions"};
+  }
+
+  if (num > kMaxRegionsPerItem - item->region_item->get_number_of_regions()) {
+    return {heif_error_Usage_error, heif_suberror_Too_many_regions, "A region item cannot hold more than 255 regions"};
+  }
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_region_item_add_region_points(struct heif_region_item* item,
+                                                     const int32_t* x_array, const int32_t* y_array,
+                                                     int num_points)
+{
+  heif_error err = check_number_of_new_regions(item, num_points);
+  if (err.code) {
+    return err;
+  }
+
+  for (int i = 0; i < num_points; i++) {
+    auto region = std::make_shared<RegionGeometry_Point>();
+    region->x = x_array[i];
+    region->y = y_array[i];
+    item->region_item->add_region(region);
+  }
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_region_item_add_region_rectangles(struct heif_region_item* item,
+                                                         const int32_t* x_array, const int32_t* y_array,
+                                                         const uint32_t* width_array, const uint32_t* height_array,
+                                                         int num_rectangles)
+{
+  heif_error err = check_number_of_new_regions(item, num_rectangles);
+  if (err.code) {
+    return err;
+  }
+
+  for (int i = 0; i < num_rectangles; i++) {
+    auto region = std::make_shared<RegionGeometry_Rectangle>();
+    region->x = x_array[i];
+    region->y = y_array[i];
+    region->width = width_array[i];
+    region->height = height_array[i];
+    item->region_item->add_region(region);
+  }
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_region_item_add_region_ellipses(struct heif_region_item* item,
+                                                       const int32_t* x_array, const int32_t* y_array,
+                                                       const uint32_t* radius_x_array, const uint32_t* radius_y_array,
+                                                       int num_ellipses)
+{
+  heif_error err = check_number_of_new_regions(item, num_ellipses);
+  if (err.code) {
+    return err;
+  }
+
+  for (int i = 0; i < num_ellipses; i++) {
+    auto region = std::make_shared<RegionGeometry_Ellipse>();
+    region->x = x_array[i];
+    region->y = y_array[i];
+    region->radius_x = radius_x_array[i];
+    region->radius_y = radius_y_array[i];
+    item->region_item->add_region(region);
+  }
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_region_item_add_region_polygons(struct heif_region_item* item,
+                                                       const int32_t* pts_array, const int* num_points_array,
+                                                       int num_polygons)
+{
+  heif_error err = check_number_of_new_regions(item, num_polygons);
+  if (err.code) {
+    return err;
+  }
+
+  for (int i = 0; i < num_polygons; i++) {
+    if (num_points_array[i] < 0) {
+      return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Negative number of polygon points"};
+    }
+  }
+
+  for (int i = 0; i < num_polygons; i++) {
+    auto region = std::make_shared<RegionGeometry_Polygon>();
+    region->points.resize(num_points_array[i]);
+
+    for (int p = 0; p < num_points_array[i]; p++) {
+      region->points[p].x = pts_array[0];
+      region->points[p].y = pts_array[1];
+      pts_array += 2;
+    }
+
+    region->closed = true;
+
+    item->region_item->add_region(region);
+  }
+
+  return error_Ok;
+}
+
+
+int heif_region_item_get_region_types(const struct heif_region_item* item,
+                                      enum heif_region_type* out_types_array, int max_count)
+{
+  const auto& regions = item->region_item->get_region_list();
+  int num = std::min(max_count, (int) regions.size());
+
+  for (int i = 0; i < num; i++) {
+    out_types_array[i] = regions[i]->getRegionType();
+  }
+
+  return num;
+}
+
+
+int heif_region_item_get_number_of_regions_of_type(const struct heif_region_item* item, enum heif_region_type type)
+{
+  int num = 0;
+  for (const auto& region : item->region_item->get_region_list()) {
+    if (region->getRegionType() == type) {
+      num++;
+    }
+  }
+
+  return num;
+}
+
+
+template<class T>
+static std::vector<std::shared_ptr<T>> get_regions_of_class(const struct heif_region_item* item,
+                                                            enum heif_region_type type, int max_count)
+{
+  std::vector<std::shared_ptr<T>> result;
+  for (const auto& region : item->region_item->get_region_list()) {
+    if ((int) result.size() == max_count) {
+      break;
+    }
+
+    if (region->getRegionType() == type) {
+      result.push_back(std::dynamic_pointer_cast<T>(region));
+    }
+  }
+
+  return result;
+}
+
+
+int heif_region_item_get_region_points(const struct heif_region_item* item,
+                                       int32_t* out_x_array, int32_t* out_y_array, int max_count)
+{
+  auto points = get_regions_of_class<RegionGeometry_Point>(item, heif_region_type_point, max_count);
+
+  for (size_t i = 0; i < points.size(); i++) {
+    out_x_array[i] = points[i]->x;
+    out_y_array[i] = points[i]->y;
+  }
+
+  return (int) points.size();
+}
+
+
+int heif_region_item_get_region_rectangles(const struct heif_region_item* item,
+                                           int32_t* out_x_array, int32_t* out_y_array,
+                                           uint32_t* out_width_array, uint32_t* out_height_array,
+                                           int max_count)
+{
+  auto rectangles = get_regions_of_class<RegionGeometry_Rectangle>(item, heif_region_type_rectangle, max_count);
+
+  for (size_t i = 0; i < rectangles.size(); i++) {
+    out_x_array[i] = rectangles[i]->x;
+    out_y_array[i] = rectangles[i]->y;
+    out_width_array[i] = rectangles[i]->width;
+    out_height_array[i] = rectangles[i]->height;
+  }
+
+  return (int) rectangles.size();
+}
+
+
+int heif_region_item_get_region_ellipses(const struct heif_region_item* item,
+                                         int32_t* out_x_array, int32_t* out_y_array,
+                                         uint32_t* out_radius_x_array, uint32_t* out_radius_y_array,
+                                         int max_count)
+{
+  auto ellipses = get_regions_of_class<RegionGeometry_Ellipse>(item, heif_region_type_ellipse, max_count);
+
+  for (size_t i = 0; i < ellipses.size(); i++) {
+    out_x_array[i] = ellipses[i]->x;
+    out_y_array[i] = ellipses[i]->y;
+    out_radius_x_array[i] = ellipses[i]->radius_x;
+    out_radius_y_array[i] = ellipses[i]->radius_y;
+  }
+
+  return (int) ellipses.size();
+}
+
+
+int heif_region_item_get_region_polygon_sizes(const struct heif_region_item* item,
+                                              int* out_num_points_array, int max_count)
+{
+  auto polygons = get_regions_of_class<RegionGeometry_Polygon>(item, heif_region_type_polygon, max_count);
+
+  for (size_t i = 0; i < polygons.size(); i++) {
+    out_num_points_array[i] = (int) polygons[i]->points.size();
+  }
+
+  return (int) polygons.size();
+}
+
+
+int heif_region_item_get_region_polygon_points(const struct heif_region_item* item,
+                                               int32_t* out_pts_array, int max_points)
+{
+  auto polygons = get_regions_of_class<RegionGeometry_Polygon>(item, heif_region_type_polygon, -1);
+
+  int num = 0;
+  for (const auto& polygon : polygons) {
+    if (polygon->points.size() > (size_t) (max_points - num)) {
+      break;
+    }
+
+    for (const auto& point : polygon->points) {
+      out_pts_array[2 * num + 0] = point.x;
+      out_pts_array[2 * num + 1] = point.y;
+      num++;
+    }
+  }
+
+  return num;
+}
+
+
+int heif_region_item_find_regions_at(const struct heif_region_item* item, int32_t x, int32_t y,
+                                     int* out_indices_array, int max_count)
+{
+  std::vector<int> indices = item->region_item->find_regions_at(x, y);
+  int num = std::min(max_count, (int) indices.size());
+
+  std::copy(indices.begin(), indices.begin() + num, out_indices_array);
+
+  return num;
+}
+
+
+int heif_region_item_find_regions_in_rectangle(const struct heif_region_item* item,
+                                               int32_t x, int32_t y, uint32_t width, uint32_t height,
+                                               int* out_indices_array, int max_count)
+{
+  std::vector<int> indices = item->region_item->find_regions_in_rectangle(x, y, width, height);
+  int num = std::min(max_count, (int) indices.size());
+
+  std::copy(indices.begin(), indices.begin() + num, out_indices_array);
+
+  return num;
+}
+
+
+struct heif_error heif_region_rasterize(const struct heif_region* region,
+                                        uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride,
+                                        uint8_t value)
+{
+  if (stride < width) {
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Bitmap stride is smaller than its width"};
+  }
+
+  region->region->rasterize(bitmap, width, height, stride, value);
+
+  return error_Ok;
+}
+
+
+struct heif_error heif_region_item_rasterize(const struct heif_region_item* item,
+                                             uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride,
+                                             uint8_t value)
+{
+  if (stride < width) {
+    return {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Bitmap stride is smaller than its width"};
+  }
+
+  for (const auto& region : item->region_item->get_region_list()) {
+    region->rasterize(bitmap, width, height, stride, value);
+  }
+
+  return error_Ok;
+}
+
+
 void heif_region_release(const struct heif_region* region)
 {
   delete region;
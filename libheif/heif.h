@@ -47,6 +47,7 @@ extern "C" {
 //  1.14           3            5             1             1            1            1
 //  1.15           4            5             1             1            1            1
 //  1.16           5            6             1             1            1            1
+//  1.17           8            6             1             1            1            1
 
 #if defined(_MSC_VER) && !defined(LIBHEIF_STATIC_BUILD)
 #ifdef LIBHEIF_EXPORTS
@@ -129,7 +130,10 @@ enum heif_error_code
   heif_error_Color_profile_does_not_exist = 10,
 
   // Error loading a dynamic plugin
-  heif_error_Plugin_loading_error = 11
+  heif_error_Plugin_loading_error = 11,
+
+  // Decoding or encoding was stopped by the cancel callback or the timeout in the options
+  heif_error_Canceled = 12
 };
 
 
@@ -225,6 +229,9 @@ enum heif_suberror_code
   // Invalid specification of region item
   heif_suberror_Invalid_region_data = 136,
 
+  // Compressed image data could not be decompressed
+  heif_suberror_Decompression_invalid_data = 137,
+
 
   // --- Memory_allocation_error ---
 
@@ -233,6 +240,13 @@ enum heif_suberror_code
   // security limits further.
   heif_suberror_Security_limit_exceeded = 1000,
 
+  // Decoding the image would exceed the memory budget of the context (see heif_context_set_memory_budget()).
+  heif_suberror_Memory_budget_exceeded = 1001,
+
+  // Decoding a grid or overlay image would need too much work compared to the size of its coded data
+  // (see heif_context_set_decoding_work_limit()). This usually indicates a malformed file.
+  heif_suberror_Decoding_work_limit_exceeded = 1002,
+
 
   // --- Usage_error ---
 
@@ -281,6 +295,9 @@ enum heif_suberror_code
 
   heif_suberror_Unsupported_header_compression_method = 3005,
 
+  // Image data was compressed with an unsupported generic compression method ('cmpC' box)
+  heif_suberror_Unsupported_generic_compression_method = 3006,
+
 
   // --- Encoder_plugin_error ---
 
@@ -302,7 +319,13 @@ enum heif_suberror_code
 
   heif_suberror_Plugin_loading_error = 6000,        // a specific plugin file cannot be loaded
   heif_suberror_Plugin_is_not_loaded = 6001,        // trying to remove a plugin that is not loaded
-  heif_suberror_Cannot_read_plugin_directory = 6002 // error while scanning the directory for plugins
+  heif_suberror_Cannot_read_plugin_directory = 6002, // error while scanning the directory for plugins
+
+
+  // --- Canceled ---
+
+  heif_suberror_Canceled_by_application = 7000, // the cancel callback returned a non-zero value
+  heif_suberror_Timeout = 7001                  // the timeout of the options has passed
 };
 
 
@@ -337,11 +360,17 @@ struct heif_init_params
 {
   int version;
 
-  // currently no parameters
+  // --- version 2
+
+  // Do not load the plugins from the plugin directories in heif_init(), but only when a
+  // codec is needed for the first time. This reduces the startup time of applications that
+  // often do not decode or encode anything. Default: false
+  uint8_t lazy_plugin_loading;
 };
 
 
-// You may pass nullptr to get default parameters. Currently, no parameters are supported.
+// You may pass nullptr to get default parameters.
+// Note: registered plugins are always initialized only when they are used for the first time.
 LIBHEIF_API
 struct heif_error heif_init(struct heif_init_params*);
 
@@ -378,6 +407,30 @@ LIBHEIF_API
 struct heif_error heif_unload_plugin(const struct heif_plugin_info* plugin);
 
 
+// --- Color conversion speed calibration
+
+// The color conversion selects the sequence of conversion steps with the lowest estimated cost.
+// By default, fixed estimates are used. This function measures the conversion steps on this
+// machine instead (this takes a fraction of a second) and uses the measured costs afterwards.
+// Setting the environment variable LIBHEIF_CALIBRATE_COLOR_CONVERSION runs the calibration in heif_init().
+LIBHEIF_API
+void heif_calibrate_color_conversion(void);
+
+// Returns the measured costs as a text profile that can be stored and loaded at the next start
+// with heif_load_color_conversion_calibration() to skip the measurement. The profile is only valid
+// for the same machine and libheif build.
+// Returns NULL if there is no calibration. The string has to be released with heif_release_color_conversion_calibration().
+LIBHEIF_API
+char* heif_get_color_conversion_calibration(void);
+
+LIBHEIF_API
+void heif_release_color_conversion_calibration(char* profile);
+
+// Passing NULL goes back to the fixed cost estimates.
+LIBHEIF_API
+struct heif_error heif_load_color_conversion_calibration(const char* profile);
+
+
 // ========================= file type check ======================
 
 enum heif_filetype_result
@@ -441,6 +494,8 @@ typedef uint32_t heif_brand2;
 #define heif_brand2_vvis   heif_fourcc('v','v','i','s') // VVC sequence
 #define heif_brand2_evbi   heif_fourcc('e','v','b','i') // EVC image
 #define heif_brand2_evbs   heif_fourcc('e','v','b','s') // EVC sequence
+#define heif_brand2_jpeg   heif_fourcc('j','p','e','g') // JPEG image
+#define heif_brand2_jpgs   heif_fourcc('j','p','g','s') // JPEG sequence
 
 
 // input data should be at least 12 bytes
@@ -509,7 +564,52 @@ LIBHEIF_API
 void heif_context_free(struct heif_context*);
 
 
-struct heif_reading_options;
+struct heif_reading_options
+{
+  uint8_t version;
+
+  // version 1 options
+
+  // Only read the 'ftyp' and 'meta' boxes. The top-level boxes following them (usually the 'mdat'
+  // box with the compressed image data) are neither read nor skipped through, and checks that are
+  // only needed for decoding are deferred until an image is decoded. The content of metadata
+  // blocks (e.g. Exif) is read when it is requested with heif_image_handle_get_metadata().
+  // This makes opening a file to get the image sizes, the primary image, properties and metadata
+  // cheap. Images can still be decoded afterwards.
+  // Default: false
+  uint8_t metadata_only;
+
+  // version 2 options
+
+  // A file index written by heif_context_write_file_index() for this file. When set, the file
+  // structure is taken from the index and the file is not parsed. The index is only checked for
+  // consistency and against the file size; it is the responsibility of the caller to use it only
+  // for an unchanged file. If the index does not match, reading fails with
+  // heif_suberror_Invalid_parameter_value.
+  // The index data is only accessed while reading the file.
+  // Default: NULL
+  const uint8_t* file_index;
+  size_t file_index_size;
+
+  // version 3 options
+
+  // heif_context_read_from_file() maps regular files into memory, such that the compressed data is
+  // passed to the decoders without copying it. If the file is truncated (or otherwise modified) by
+  // another process while the context is open, accessing the mapped data raises SIGBUS (or an access
+  // violation on Windows) and crashes the process. Set this flag for files that may change while
+  // they are read. The file is then read with regular reads, and a truncated file results in an error.
+  // Default: false
+  uint8_t disable_memory_mapping;
+};
+
+// Allocate reading options and fill with default values.
+// Note: you should always get the reading options through this function since the
+// option structure may grow in size in future versions.
+LIBHEIF_API
+struct heif_reading_options* heif_reading_options_alloc(void);
+
+LIBHEIF_API
+void heif_reading_options_free(struct heif_reading_options*);
 
 enum heif_reader_grow_status
 {
@@ -518,6 +618,13 @@ enum heif_reader_grow_status
   heif_reader_grow_status_size_beyond_eof // size has not been reached and never will. The file has grown to its full size
 };
 
+// A range of bytes in the input file.
+struct heif_file_range
+{
+  uint64_t offset;
+  uint64_t size;
+};
+
 struct heif_reader
 {
   // API version supported by this reader
@@ -544,17 +651,32 @@ struct heif_reader
   // detection whether the target_size is above the (fixed) file length
   // (in this case, return 'size_beyond_eof').
   enum heif_reader_grow_status (* wait_for_file_size)(int64_t target_size, void* userdata);
+
+  // --- version 2 functions ---
+
+  // Optional, may be NULL. libheif announces the ranges of the file that it is going to read next,
+  // e.g. the tiles of a grid image that is decoded. The reader should start fetching them (possibly
+  // in parallel) and return immediately. The 'ranges' array is only valid during this call.
+  //
+  // For each range, 'range_completed' has to be called exactly once when its data can be read
+  // with read() without waiting, or when fetching it failed (success = 0). It may be called from
+  // any thread, also from within request_ranges(). libheif starts decoding each tile as soon as its
+  // data is available and waits until all ranges have been completed before the decoding returns.
+  void (* request_ranges)(const struct heif_file_range* ranges, int num_ranges,
+                          void (* range_completed)(int range_index, int success, void* completion_userdata),
+                          void* completion_userdata,
+                          void* userdata);
 };
 
 
 // Read a HEIF file from a named disk file.
-// The heif_reading_options should currently be set to NULL.
+// The heif_reading_options may be NULL.
 LIBHEIF_API
 struct heif_error heif_context_read_from_file(struct heif_context*, const char* filename,
                                               const struct heif_reading_options*);
 
 // Read a HEIF file stored completely in memory.
-// The heif_reading_options should currently be set to NULL.
+// The heif_reading_options may be NULL.
 // DEPRECATED: use heif_context_read_from_memory_without_copy() instead.
 LIBHEIF_API
 struct heif_error heif_context_read_from_memory(struct heif_context*,
@@ -574,6 +696,17 @@ struct heif_error heif_context_read_from_reader(struct heif_context*,
                                                 void* userdata,
                                                 const struct heif_reading_options*);
 
+struct heif_writer;
+
+// Write a compact index of the file structure of a file that has been read into this context.
+// Passing the index in the heif_reading_options when opening the same file again skips parsing
+// the file. The index contains a copy of the 'ftyp' and 'meta' boxes. It can only be written if
+// the file has been read completely (i.e. not with the 'metadata_only' reading option).
+LIBHEIF_API
+struct heif_error heif_context_write_file_index(struct heif_context*,
+                                                struct heif_writer* writer,
+                                                void* userdata);
+
 // Number of top-level images in the HEIF file. This does not include the thumbnails or the
 // tile images that are composed to an image grid. You can get access to the thumbnails via
 // the main image handle.
@@ -612,17 +745,297 @@ LIBHEIF_API
 void heif_context_debug_dump_boxes_to_file(struct heif_context* ctx, int fd);
 
 
+// Images (including grid and overlay canvases) whose width or height exceed this limit are rejected.
+// The default is 32768. Larger limits are possible for very large images (e.g. image mosaics), but
+// the decoded planes can then exceed 2 GB. Use heif_image_get_plane2() to access them.
 LIBHEIF_API
 void heif_context_set_maximum_image_size_limit(struct heif_context* ctx, int maximum_width);
 
+// Malformed files can need a huge amount of decoding work compared to their size, e.g. a grid that
+// refers to the same tile many times or a chain of derived images. Decoding a grid or overlay image fails
+// with heif_suberror_Decoding_work_limit_exceeded if its work exceeds
+//   'base_work' + 'work_per_input_byte' * (size of the coded data of the image).
+// The work counts the decoded and composed pixels of the image and of all images it is derived from,
+// plus 4096 for each decoded tile. Images that are referenced several times count once in the size of
+// the coded data, but each time in the work.
+// Default: base_work = 2^28, work_per_input_byte = 16384. Setting 'base_work' to 0 disables the limit.
+LIBHEIF_API
+void heif_context_set_decoding_work_limit(struct heif_context* ctx, uint64_t base_work, uint32_t work_per_input_byte);
+
 // If the maximum threads number is set to 0, the image tiles are decoded in the main thread.
 // This is different from setting it to 1, which will generate a single background thread to decode the tiles.
+// The worker threads are created once per context and reused for all decoding calls on this context.
+// Changing the number of threads shuts down the current workers after their work is finished.
 // Note that this setting only affects libheif itself. The codecs itself may still use multi-threaded decoding.
 // You can use it, for example, in cases where you are decoding several images in parallel anyway you thus want
 // to minimize parallelism in each decoder.
 LIBHEIF_API
 void heif_context_set_max_decoding_threads(struct heif_context* ctx, int max_threads);
 
+// An executor of the application (e.g. a TBB arena or a fiber scheduler) on which libheif runs its
+// parallel work instead of on its own threads: grid tiles, alpha and auxiliary images, color conversion
+// bands and parallel encoding. The struct is copied, 'userdata' has to stay valid while it is used.
+struct heif_executor
+{
+  int version; // 1
+
+  void* userdata;
+
+  // Run 'task(task_data)' once, on any thread. Must not wait for the task to finish.
+  // All submitted tasks have to be run, also when no libheif function is active anymore.
+  void (* submit)(void* userdata, void (* task)(void* task_data), void* task_data);
+
+  // Optional. Called when a libheif function has to wait for its submitted tasks. It has to return as soon as
+  // 'is_finished(finished_data)' returns nonzero and may run other tasks or switch to another fiber in the meantime.
+  // When NULL, the waiting thread is blocked.
+  void (* wait)(void* userdata, int (* is_finished)(void* finished_data), void* finished_data);
+
+  // The number of tasks that the executor runs at the same time. libheif submits at most this number of
+  // grid tiles at once and uses it as the number of threads of the decoder plugins (see decoder_threads
+  // in heif_decoding_options). Must be > 0.
+  int concurrency;
+};
+
+// Run the parallel work of this context on 'executor' instead of on threads of libheif.
+// Call heif_context_set_max_decoding_threads() to go back to the threads of libheif.
+// Returns heif_error_Unsupported_feature when libheif was built without multithreading support.
+LIBHEIF_API
+struct heif_error heif_context_set_executor(struct heif_context* ctx, const struct heif_executor* executor);
+
+// Keep the memory of released image planes in a pool and reuse it for images decoded later with
+// this context, including all temporary images of the color conversion.
+// This reduces the number of large memory allocations when many images are decoded.
+// At most 'max_cached_bytes' of unused memory are kept. Setting it to 0 disables the pool (default).
+// Do not call this while images are being decoded with this context.
+LIBHEIF_API
+void heif_context_set_image_memory_pool_size(struct heif_context* ctx, size_t max_cached_bytes);
+
+struct heif_image_memory_pool_statistics
+{
+  uint64_t num_allocations;
+  uint64_t num_reused; // allocations that were served from the pool
+  size_t cached_bytes; // unused memory currently kept in the pool
+};
+
+// All values are zero when no pool is used.
+LIBHEIF_API
+void heif_context_get_image_memory_pool_statistics(const struct heif_context* ctx,
+                                                   struct heif_image_memory_pool_statistics* out_stats);
+
+// Limit the image memory of this context to 'max_bytes'. This covers the planes of the decoded images,
+// the grid tiles, the temporary images of the color conversion and the images that the application
+// did not release yet. Before an image is decoded, its memory use is estimated and decoding fails early
+// with heif_suberror_Memory_budget_exceeded if it does not fit into the remaining budget.
+// Allocations that exceed the budget during decoding fail as well.
+// Memory kept unused in the image memory pool and the internal buffers of the codecs are not counted.
+// Setting it to 0 removes the limit (default). Do not call this while images are being decoded.
+LIBHEIF_API
+void heif_context_set_memory_budget(struct heif_context* ctx, size_t max_bytes);
+
+// The image memory that currently counts in the budget. Returns 0 when there is no budget.
+LIBHEIF_API
+size_t heif_context_get_memory_budget_usage(const struct heif_context* ctx);
+
+// Keep up to 'max_bytes' of decoded images. When the same image is decoded again with the same colorspace,
+// chroma, region and options (apart from the callbacks), heif_decode_image() and heif_decode_image_region()
+// return the cached image without decoding it again. The progress callbacks are not called in this case.
+// The returned image shares its pixel memory with the cache until either of them is modified.
+// The least recently used images are dropped first. Cached images count in the memory budget and are
+// dropped when an image would not fit into the budget otherwise.
+// Images that are written into application buffers (get_output_plane_buffer) are not cached.
+// Setting it to 0 disables the cache (default). Do not call this while images are being decoded.
+LIBHEIF_API
+void heif_context_set_decoded_image_cache_size(struct heif_context* ctx, size_t max_bytes);
+
+struct heif_decoded_image_cache_statistics
+{
+  uint64_t num_hits;
+  uint64_t num_misses;
+  size_t num_images;
+  size_t cached_bytes;
+};
+
+// All values are zero when no cache is used.
+LIBHEIF_API
+void heif_context_get_decoded_image_cache_statistics(const struct heif_context* ctx,
+                                                     struct heif_decoded_image_cache_statistics* out_stats);
+
+
+// --- engine: decoding resources that are shared by several contexts
+
+// An engine owns the decoding threads, a pool of image memory and the idle decoder instances.
+// Contexts that are attached to an engine use these instead of setting up their own. This saves
+// starting threads and allocating decoders and image memory for every file, e.g. in servers that
+// open a new context for each request. Contexts on different threads can use the same engine at
+// the same time.
+struct heif_engine;
+
+struct heif_engine_options
+{
+  uint8_t version;
+
+  // version 1 options
+
+  // Number of decoding threads that are shared by all attached contexts
+  // (see heif_context_set_max_decoding_threads()). 0: decode in the calling thread.
+  // Default: 4
+  int max_decoding_threads;
+
+  // Maximum unused image memory kept for reuse by all attached contexts
+  // (see heif_context_set_image_memory_pool_size()). 0: no memory pool.
+  // Default: 64 MiB
+  size_t image_memory_pool_size;
+
+  // version 2 options
+
+  // When not NULL, the attached contexts run their parallel work on this executor (see heif_context_set_executor())
+  // and 'max_decoding_threads' is ignored.
+  // Default: NULL
+  const struct heif_executor* executor;
+};
+
+LIBHEIF_API
+struct heif_engine_options* heif_engine_options_alloc(void);
+
+LIBHEIF_API
+void heif_engine_options_free(struct heif_engine_options*);
+
+// 'options' may be NULL to use the default options.
+// Has to be freed with heif_engine_free() before heif_deinit() is called.
+LIBHEIF_API
+struct heif_engine* heif_engine_alloc(const struct heif_engine_options* options);
+
+// The resources are released when the engine and all contexts attached to it have been freed.
+LIBHEIF_API
+void heif_engine_free(struct heif_engine*);
+
+// Use the decoding threads, the image memory pool and the decoder instances of 'engine' for this context.
+// Call this right after heif_context_alloc(), before any image is decoded with the context.
+// Calling heif_context_set_max_decoding_threads() or heif_context_set_image_memory_pool_size()
+// afterwards replaces the respective resource of the engine with one that is owned by the context.
+LIBHEIF_API
+void heif_context_attach_to_engine(struct heif_context* ctx, struct heif_engine* engine);
+
+// Statistics of the image memory pool that is shared by the contexts of the engine.
+// All values are zero when the engine has no pool.
+LIBHEIF_API
+void heif_engine_get_image_memory_pool_statistics(const struct heif_engine* engine,
+                                                  struct heif_image_memory_pool_statistics* out_stats);
+
+
+// --- process-wide statistics
+
+// Counters over all contexts of the process since the start or the last heif_reset_statistics().
+// They are always collected. Counting is cheap and does not synchronize threads, hence the values are
+// meant for monitoring (e.g. to scrape them periodically) and may lag behind by a few concurrent updates.
+struct heif_statistics
+{
+  uint64_t images_decoded; // heif_decode_image() and similar calls that were not served from the cache
+  uint64_t tiles_decoded; // grid tiles
+  uint64_t bytes_read; // copied from the input. Data that is accessed directly in memory is not counted.
+  uint64_t pixels_converted; // by color conversion pipelines (pixels of the input image, once per pipeline)
+  uint64_t plane_bytes_allocated; // image plane memory, including the memory reused from a pool
+  uint64_t plane_bytes_reused; // plane memory that was served from an image memory pool
+  uint64_t decoded_image_cache_hits;
+  uint64_t decoded_image_cache_misses;
+  uint64_t conversion_pipeline_cache_hits;
+  uint64_t conversion_pipeline_cache_misses;
+  uint64_t decoder_instances_created;
+  uint64_t read_lock_wait_ns; // time spent waiting for other threads to finish reading from the same input
+  uint64_t plane_allocations; // number of image planes, including those reused from a pool
+};
+
+LIBHEIF_API
+void heif_get_statistics(struct heif_statistics* out_stats);
+
+// Resets all counters, including the color conversion statistics, to zero.
+LIBHEIF_API
+void heif_reset_statistics(void);
+
+struct heif_color_conversion_statistics
+{
+  const char* operation_name; // static string, do not free
+  uint64_t num_conversions;
+  uint64_t num_pixels;
+};
+
+// Fills up to 'max_entries' entries, one for each color conversion operation, and returns the number
+// of operations. Call with max_entries = 0 to get the number of operations.
+LIBHEIF_API
+int heif_get_color_conversion_statistics(struct heif_color_conversion_statistics* out_stats, int max_entries);
+
+
+// --- tracing of the decoding and encoding stages
+
+enum heif_trace_stage
+{
+  // Reading the compressed data of an image item from the input.
+  heif_trace_stage_read_data = 1,
+
+  // Decoding a coded image (or grid tile) with the decoder plugin.
+  heif_trace_stage_decode = 2,
+
+  // Color conversion of a decoded image or tile, including the conversion into the output format,
+  // and of an image into the input format of the encoder.
+  heif_trace_stage_color_conversion = 3,
+
+  // Rotation, mirroring, cropping and scaling of a decoded image.
+  heif_trace_stage_transformations = 4,
+
+  // Copying a decoded tile into the grid image, including its color conversion.
+  heif_trace_stage_paste_tile = 5,
+
+  // Encoding an image with the encoder plugin.
+  heif_trace_stage_encode = 6,
+
+  // Writing the HEIF file.
+  heif_trace_stage_write = 7
+};
+
+struct heif_trace_event
+{
+  // version 1
+  uint8_t version;
+
+  enum heif_trace_stage stage;
+
+  // The image item (e.g. the grid tile) that is processed. 0 if the item ID is not known (yet),
+  // e.g. for the conversion of an image before it is encoded.
+  heif_item_id item_id;
+
+  // Small number that identifies the thread on which the stage ran. It is unique in the process.
+  uint32_t thread_id;
+
+  // Start of the stage in microseconds since the context was created (monotonic clock).
+  uint64_t start_time_us;
+
+  // Elapsed wall-clock time of the stage.
+  uint64_t wall_time_us;
+
+  // CPU time of the thread that ran the stage. This does not include the work that was done on other
+  // threads, e.g. by the codec or by the parallel color conversion. 0 if not supported on the platform.
+  uint64_t cpu_time_us;
+
+  // Size of the data processed: the compressed data for reading and decoding, the coded data for
+  // encoding, the file size for writing and the input image memory for the other stages.
+  uint64_t data_bytes;
+
+  // Memory allocated for the image planes that the stage produced. 0 if the output uses existing memory
+  // (e.g. for tiles that are decoded or converted directly into the grid image).
+  uint64_t allocated_bytes;
+};
+
+// Called at the end of each stage. Stages are nested: a paste_tile stage contains the color_conversion
+// of that tile. The callback is called concurrently from the decoding threads and has to be thread-safe.
+typedef void (* heif_trace_callback)(const struct heif_trace_event* event, void* userdata);
+
+// Set a callback that gets timing information about the stages of decoding and encoding images
+// with this context. Set 'callback' to NULL to disable tracing (default).
+// Without callback, no timing information is measured.
+// Do not call this while images are being decoded or encoded with this context.
+LIBHEIF_API
+void heif_context_set_trace_callback(struct heif_context* ctx, heif_trace_callback callback, void* userdata);
+
 
 // ========================= heif_image_handle =========================
 
@@ -676,6 +1089,12 @@ LIBHEIF_API
 int heif_image_handle_get_ispe_height(const struct heif_image_handle* handle);
 
 
+// Returns the number of layers of a progressive image. The layers can be decoded incrementally
+// (see heif_decoding_options::max_decoded_layer). Returns 1 for images without layers.
+LIBHEIF_API
+int heif_image_handle_get_number_of_layers(const struct heif_image_handle* handle);
+
+
 // ------------------------- depth images -------------------------
 
 LIBHEIF_API
@@ -839,6 +1258,29 @@ struct heif_error heif_image_handle_get_metadata(const struct heif_image_handle*
                                                  heif_item_id metadata_id,
                                                  void* out_data);
 
+struct heif_metadata_block
+{
+  heif_item_id id;
+  const char* type;         // as heif_image_handle_get_metadata_type()
+  const char* content_type; // as heif_image_handle_get_metadata_content_type()
+
+  // The raw metadata, as with heif_image_handle_get_metadata(). It is not copied: for files read from
+  // memory, it points into the input data when the metadata is stored in one piece and uncompressed.
+  // The pointer is valid as long as the context exists.
+  const uint8_t* data;
+  size_t size;
+};
+
+// Get all metadata blocks of the image (or only those of type 'type_filter', may be NULL) with their data in one call.
+// At most 'max_count' blocks are written into 'out_blocks'. The number of blocks is returned in 'out_count'.
+// Use heif_image_handle_get_number_of_metadata_blocks() for the size of the array.
+LIBHEIF_API
+struct heif_error heif_image_handle_get_metadata_blocks(const struct heif_image_handle* handle,
+                                                        const char* type_filter,
+                                                        struct heif_metadata_block* out_blocks,
+                                                        int max_count,
+                                                        int* out_count);
+
 
 // ------------------------- color profiles -------------------------
 
@@ -983,6 +1425,46 @@ struct heif_error heif_image_get_nclx_color_profile(const struct heif_image* ima
                                                     struct heif_color_profile_nclx** out_data);
 
 
+// ------------------------- items -------------------------
+
+// These functions give access to all items of the file, including the images that are not top-level
+// (e.g. grid tiles, thumbnails, alpha and depth images) and the metadata items. They only use the
+// file structure and do not read the item data, also for files opened with the 'metadata_only' reading option.
+
+LIBHEIF_API
+int heif_context_get_number_of_items(const struct heif_context* ctx);
+
+// Fills in the item IDs into the user-supplied array 'ID_array', preallocated with 'count' entries.
+// Function returns the total number of IDs filled into the array.
+LIBHEIF_API
+int heif_context_get_list_of_item_IDs(const struct heif_context* ctx,
+                                      heif_item_id* ID_array,
+                                      int count);
+
+// Returns the item type as a four-character code, e.g. heif_fourcc('h','v','c','1'), 'grid', 'Exif' or 'mime'.
+// Returns 0 if the item does not exist.
+LIBHEIF_API
+uint32_t heif_item_get_item_type(const struct heif_context* ctx, heif_item_id item_id);
+
+LIBHEIF_API
+int heif_item_is_item_hidden(const struct heif_context* ctx, heif_item_id item_id);
+
+// Returns the content type of 'mime' items (e.g. "application/rdf+xml" for XMP), an empty string for
+// other items and NULL if the item does not exist. The string is valid as long as the context.
+LIBHEIF_API
+const char* heif_item_get_mime_item_content_type(const struct heif_context* ctx, heif_item_id item_id);
+
+// Get the ranges of the input file that store the data of the item, as described by the 'iloc' box.
+// For data stored in the 'idat' box, these are the ranges within that box. The ranges are in the order
+// of the item data and are not merged. Items without data (e.g. derived images without 'iloc' entry)
+// have no ranges.
+// The returned array has to be freed with heif_file_ranges_release().
+LIBHEIF_API
+struct heif_error heif_item_get_file_ranges(const struct heif_context* ctx, heif_item_id item_id,
+                                            struct heif_file_range** out_ranges,
+                                            int* out_number_of_ranges);
+
+
 // ------------------------- item properties -------------------------
 
 enum heif_item_property_type
@@ -1118,7 +1600,26 @@ enum heif_chroma
   heif_chroma_interleaved_RRGGBB_BE = 12,   // HDR, big endian.
   heif_chroma_interleaved_RRGGBBAA_BE = 13, // HDR, big endian.
   heif_chroma_interleaved_RRGGBB_LE = 14,   // HDR, little endian.
-  heif_chroma_interleaved_RRGGBBAA_LE = 15  // HDR, little endian.
+  heif_chroma_interleaved_RRGGBBAA_LE = 15, // HDR, little endian.
+
+  // Semi-planar 4:2:0 YCbCr for handing frames to video and GPU pipelines.
+  // The image has a full resolution heif_channel_Y plane and a heif_channel_interleaved
+  // plane at chroma resolution (width+1)/2 x (height+1)/2 that holds Cb/Cr sample pairs.
+  // Images in these formats are converted to planar 4:2:0 for encoding.
+  heif_chroma_420_NV12 = 20, // 8 bit, chroma pairs stored as Cb,Cr.
+  heif_chroma_420_NV21 = 21, // 8 bit, chroma pairs stored as Cr,Cb.
+  heif_chroma_420_P010 = 22, // HDR, layout as NV12 with 16 bit native-endian samples. The significant
+                             // bits (plane bit depth) are stored in the MSBs, the lower bits are zero.
+
+  // Interleaved RGB(A) with floating point samples in native byte order, e.g. for HDR display and
+  // machine learning. The samples are normalized such that the nominal range is [0;1].
+  // The plane bit depth is 16 (IEEE half float) or 32 (IEEE single float).
+  // When decoding with heif_decoding_options::linear_light_output, the samples are linear light.
+  // Otherwise, they keep the transfer function of the image. Alpha is always linear.
+  heif_chroma_interleaved_RGB_HALF = 30,
+  heif_chroma_interleaved_RGBA_HALF = 31,
+  heif_chroma_interleaved_RGB_FLOAT = 32,
+  heif_chroma_interleaved_RGBA_FLOAT = 33
 };
 
 // DEPRECATED ENUM NAMES
@@ -1134,6 +1635,7 @@ enum heif_colorspace
   // * heif_chroma_444
   // * heif_chroma_422
   // * heif_chroma_420
+  // * heif_chroma_420_NV12, heif_chroma_420_NV21, heif_chroma_420_P010
   heif_colorspace_YCbCr = 0,
 
   // heif_colorspace_RGB should be used with one of these heif_chroma values:
@@ -1144,6 +1646,8 @@ enum heif_colorspace
   // * heif_chroma_interleaved_RRGGBBAA_BE
   // * heif_chroma_interleaved_RRGGBB_LE
   // * heif_chroma_interleaved_RRGGBBAA_LE
+  // * heif_chroma_interleaved_RGB_HALF, heif_chroma_interleaved_RGBA_HALF
+  // * heif_chroma_interleaved_RGB_FLOAT, heif_chroma_interleaved_RGBA_FLOAT
   heif_colorspace_RGB = 1,
 
   // heif_colorspace_monochrome should only be used with heif_chroma = heif_chroma_monochrome
@@ -1186,6 +1690,19 @@ enum heif_chroma_upsampling_algorithm
   heif_chroma_upsampling_bilinear = 2
 };
 
+enum heif_color_conversion_accuracy
+{
+  // Full-precision conversion (default).
+  heif_color_conversion_accuracy_precise = 0,
+
+  // Trades accuracy for speed, e.g. for previews and thumbnails:
+  // - nearest-neighbor chroma up- and downsampling (unless 'only_use_preferred_chroma_algorithm' is set),
+  // - no sharp YUV,
+  // - images with more than 8 bits are converted to 8-bit RGB with 8-bit fixed-point math.
+  //   The color values may then differ by a few levels from the precise conversion.
+  heif_color_conversion_accuracy_fast = 1
+};
+
 struct heif_color_conversion_options
 {
   uint8_t version;
@@ -1197,6 +1714,60 @@ struct heif_color_conversion_options
 
   // When set to 'false', libheif may also use a different algorithm if the preferred one is not available.
   uint8_t only_use_preferred_chroma_algorithm;
+
+  // --- version 2 options
+
+  // This field is placed into the padding of the version 1 struct. The size of the struct does not change.
+  uint8_t conversion_accuracy; // enum heif_color_conversion_accuracy
+};
+
+
+enum heif_scaling_filter
+{
+  heif_scaling_filter_nearest_neighbor = 0,
+
+  // Average of all input pixels that are covered by an output pixel. Smooth results when scaling down.
+  heif_scaling_filter_box = 1,
+
+  // Linear interpolation. When scaling down, the filter is widened to cover all input pixels.
+  heif_scaling_filter_bilinear = 2,
+
+  // Lanczos filter with 3 lobes. Sharpest results, but may show slight ringing at hard edges.
+  heif_scaling_filter_lanczos3 = 3
+};
+
+
+enum heif_alpha_premultiplication
+{
+  // Keep the alpha of the image as it is stored in the file (see heif_image_handle_is_premultiplied_alpha()).
+  heif_alpha_premultiplication_unchanged = 0,
+
+  // Color components that are not multiplied by alpha.
+  heif_alpha_premultiplication_straight = 1,
+
+  // Color components that are multiplied by alpha.
+  heif_alpha_premultiplication_premultiplied = 2
+};
+
+
+// When several images are decoded at the same time with one context (or with contexts that share
+// the thread pool of a heif_engine), the tiles of the more urgent images are decoded first.
+// The order is checked whenever a thread has finished a tile, hence a thumbnail that is requested
+// while a large grid image is being decoded does not have to wait until the grid image is complete.
+enum heif_decoding_priority
+{
+  // Derived from the image: thumbnails are 'interactive', alpha images 'alpha', depth and other
+  // auxiliary images 'auxiliary', and all other images 'visible'. The alpha image of an image with
+  // 'visible' priority is decoded with 'alpha' priority, otherwise with the priority of the image.
+  heif_decoding_priority_automatic = 0,
+
+  heif_decoding_priority_interactive = 1,
+  heif_decoding_priority_visible = 2,
+  heif_decoding_priority_alpha = 3,
+  heif_decoding_priority_auxiliary = 4,
+
+  // Images that are decoded in advance and are not shown yet.
+  heif_decoding_priority_prefetch = 5
 };
 
 
@@ -1210,6 +1781,10 @@ struct heif_decoding_options
   // Default: false (do not ignore).
   uint8_t ignore_transformations;
 
+  // The progress of decoding the tiles of a grid image is reported with 'heif_progress_step_total':
+  // start_progress() receives the number of tiles, on_progress() the number of decoded tiles after each
+  // tile, and end_progress() is called when all tiles are decoded or decoding has failed.
+  // The callbacks are called from the decoding threads, but never at the same time.
   void (* start_progress)(enum heif_progress_step step, int max_progress, void* progress_user_data);
 
   void (* on_progress)(enum heif_progress_step step, int progress, void* progress_user_data);
@@ -1239,6 +1814,152 @@ struct heif_decoding_options
   // version 5 options
 
   struct heif_color_conversion_options color_conversion_options;
+
+  // version 6 options
+
+  // If set, the planes of the decoded image are not allocated by libheif, but requested from the
+  // application through this function. The final color conversion then writes directly into the
+  // application's memory, which saves copying the decoded image into the application buffers.
+  // 'width' and 'height' are the plane size in pixels, 'bit_depth' the bit depth of the plane and
+  // 'bytes_per_pixel' the number of bytes of one pixel (e.g. 3 for interleaved RGB, 2 for planar
+  // data with more than 8 bits, 2 or 4 for the interleaved chroma plane of NV12/NV21 or P010).
+  // Return memory for at least 'height' rows of '*out_stride' bytes each and set '*out_stride' to
+  // at least width * bytes_per_pixel. Returning NULL cancels decoding with an error.
+  // libheif never frees this memory. It has to stay valid until the returned heif_image is released.
+  // Default: NULL (libheif allocates the image memory).
+  uint8_t* (* get_output_plane_buffer)(enum heif_channel channel, int width, int height,
+                                       int bit_depth, int bytes_per_pixel, int* out_stride,
+                                       void* output_buffer_user_data);
+
+  void* output_buffer_user_data;
+
+  // version 7 options
+
+  // Maximum number of threads used for the color conversion of the decoded image.
+  // The image is split into bands of rows that are converted in parallel on the decoding threads
+  // of the context (see heif_context_set_max_decoding_threads()).
+  // 0: use all decoding threads of the context, 1: convert on the calling thread only.
+  // Default: 0
+  int color_conversion_threads;
+
+  // version 8 options
+
+  // When set together with 'convert_hdr_to_8bit', images with PQ or HLG transfer characteristics
+  // are tone mapped to sRGB instead of only reducing the bit depth. The tone mapping is done
+  // in the same pass as the bit depth reduction. The nclx profile of the decoded image is changed
+  // to the sRGB transfer characteristics. The colour primaries are not converted.
+  // Default: false
+  uint8_t tone_map_hdr_to_sdr;
+
+  // version 9 options
+
+  // Number of grid tiles whose compressed data is read ahead while the previous tiles are decoded.
+  // This keeps the decoding threads busy when reading the input is slow. It is only used when
+  // decoding with threads (see heif_context_set_max_decoding_threads()) from inputs that cannot
+  // be read from several threads at once (i.e. not for files and memory). At most this number
+  // of tiles is read ahead, which bounds the memory used for the prefetched data.
+  // 0: no read-ahead.
+  // Default: 8
+  int tile_prefetch_count;
+
+  // version 10 options
+
+  // Number of threads that the decoder plugin may use for decoding a single image or tile
+  // (for plugins that support this, e.g. dav1d and aom).
+  // 0: libheif divides the decoding threads of the context (see heif_context_set_max_decoding_threads())
+  //    among the images that it decodes concurrently, e.g. grid tiles, such that the total
+  //    number of threads is not exceeded. A single-tile image gets all threads.
+  // Default: 0
+  int decoder_threads;
+
+  // version 11 options
+
+  // When set, the image is decoded at a reduced size that fits into a bounding box of
+  // 'target_bbox_width' x 'target_bbox_height' pixels while keeping its aspect ratio.
+  // libheif decodes the cheapest source that still covers the bounding box: the smallest thumbnail
+  // that is at least as large as the box, a grid image whose tiles are scaled down while they
+  // are decoded, or the full image. The final downscale is done before the conversion to the
+  // output colorspace, such that only the reduced image is converted.
+  // Images that are already smaller than the bounding box are not scaled up.
+  // This is ignored when decoding an image region.
+  // 0: no limit in this direction. Default: 0 (decode at full size)
+  int target_bbox_width;
+  int target_bbox_height;
+
+  // Filter used for scaling down to the bounding box.
+  // Default: heif_scaling_filter_box
+  enum heif_scaling_filter target_scaling_filter;
+
+  // version 12 options
+
+  // When decoding to one of the half or float interleaved RGB formats, apply the inverse of the
+  // transfer function of the image (e.g. sRGB, BT.709, PQ or HLG), such that the output samples
+  // are linear light. 1.0 is the SDR reference white. PQ and HLG images are scaled such that their
+  // reference white (203 cd/m^2) maps to 1.0 and brighter highlights exceed 1.0.
+  // The nclx profile of the decoded image is changed to linear transfer characteristics.
+  // Images without nclx profile are assumed to be sRGB.
+  // This is ignored for all other output formats.
+  // Default: false
+  uint8_t linear_light_output;
+
+  // version 13 options
+
+  // Premultiply the color components of the decoded image by alpha, or unpremultiply images that
+  // are stored premultiplied. This is done in the same pass as the conversion to the output
+  // colorspace. heif_image_is_premultiplied_alpha() returns the alpha mode of the decoded image.
+  // This is ignored for images without alpha channel and for output colorspaces other than RGB.
+  // Unpremultiplying cannot restore the colors of transparent pixels. They are set to black.
+  // Default: heif_alpha_premultiplication_unchanged
+  enum heif_alpha_premultiplication output_alpha_premultiplication;
+
+  // version 14 options
+
+  // Called repeatedly while decoding, e.g. before each tile of a grid image and between the parts of
+  // the color conversion. When it returns a non-zero value, decoding stops and heif_error_Canceled is
+  // returned. Tiles that are already being decoded are finished first.
+  // The callback may be called from several threads at the same time.
+  int (* cancel_decoding)(void* cancel_user_data); // default: NULL
+  void* cancel_user_data;
+
+  // Decoding is canceled like above when it takes longer than this number of milliseconds,
+  // counted from the call of the decoding function. 0 = no time limit.
+  uint32_t timeout_ms; // default: 0
+
+  // version 15 options
+
+  // Called when a tile of a grid image has been decoded, before the on_progress() call of that tile.
+  // This allows showing the image while the remaining tiles are still being decoded.
+  // 'tile' is the area of the image at position (x,y) that has been decoded. It is in the format in
+  // which the tiles are combined (see heif_image_get_colorspace() and heif_image_get_chroma_format()),
+  // before the conversion into the requested output format and before the transformations of the image.
+  // 'tile' is only valid during the callback. The calls are serialized like the progress callbacks.
+  void (* on_tile_decoded)(const struct heif_image* tile, int x, int y, void* progress_user_data); // default: NULL
+
+  // version 16 options
+
+  // For progressive images, which consist of several layers of increasing quality (see
+  // heif_image_handle_get_number_of_layers()), decode only the layers up to this layer index.
+  // Only the data of these layers is read from the input. Hence, a preview of the image can be
+  // decoded as soon as the beginning of the image data is available.
+  // Values beyond the last layer and images without layers decode the complete image.
+  // -1: decode all layers. Default: -1
+  int max_decoded_layer;
+
+  // version 17 options
+
+  // When set, the canvas into which the tiles of a grid image are decoded is stored in memory-mapped
+  // temporary files in this directory instead of RAM. The operating system can then write out the
+  // parts of the image that have already been decoded, so that images larger than the available RAM
+  // can be decoded. The returned image and its color converted versions are also kept in these files.
+  // The files are deleted when the image is released. This memory is not counted in the memory budget
+  // of the context (see heif_context_set_memory_budget()).
+  // Together with on_tile_decoded(), the tiles can be passed on to the application while only the
+  // tiles being decoded have to be held in RAM.
+  const char* canvas_file_directory; // default: NULL
+
+  // version 18 options
+
+  enum heif_decoding_priority priority; // default: heif_decoding_priority_automatic
 };
 
 
@@ -1258,6 +1979,10 @@ void heif_decoding_options_free(struct heif_decoding_options*);
 // respectively, the original colorspace is taken.
 // Decoding options may be NULL. If you want to supply options, always use
 // heif_decoding_options_alloc() to get the structure.
+//
+// When libheif is built with multithreading support, images of the same heif_context may be
+// decoded concurrently from several threads (also the same image from each thread).
+// The context must not be modified or freed while it is used by other threads.
 LIBHEIF_API
 struct heif_error heif_decode_image(const struct heif_image_handle* in_handle,
                                     struct heif_image** out_img,
@@ -1265,6 +1990,222 @@ struct heif_error heif_decode_image(const struct heif_image_handle* in_handle,
                                     enum heif_chroma chroma,
                                     const struct heif_decoding_options* options);
 
+// Decode only a rectangular area of the image. The area is given in the coordinates of the
+// output image, i.e. after the geometric transformations have been applied (unless
+// 'ignore_transformations' is set in the options). It has to lie completely within the image.
+// For grid images and tiled uncompressed images, only the tiles that intersect the area are decoded.
+// The returned image has the size of the requested area.
+LIBHEIF_API
+struct heif_error heif_decode_image_region(const struct heif_image_handle* in_handle,
+                                           struct heif_image** out_img,
+                                           int x, int y, int width, int height,
+                                           enum heif_colorspace colorspace,
+                                           enum heif_chroma chroma,
+                                           const struct heif_decoding_options* options);
+
+// Decode only the alpha channel of the image, e.g. to get a mask for hit testing. The color image is
+// not decoded. The alpha samples are returned in the heif_channel_Y plane of a monochrome image with
+// the bit depth of the alpha image. The geometric transformations are applied like in heif_decode_image().
+// Fails with heif_suberror_Nonexisting_image_channel_referenced if the image has no alpha channel.
+LIBHEIF_API
+struct heif_error heif_decode_alpha_image(const struct heif_image_handle* in_handle,
+                                          struct heif_image** out_img,
+                                          const struct heif_decoding_options* options);
+
+// Called by heif_decode_images() for each image when it has been decoded. 'index' is the position of
+// the image in the list of handles. On success, 'img' is the decoded image, which has to be released
+// with heif_image_release(). When decoding failed, 'img' is NULL and 'err' describes the error.
+typedef void (* heif_decoded_image_callback)(int index, struct heif_image* img, struct heif_error err,
+                                             void* userdata);
+
+// Decode several images of the same context (e.g. all top-level images of a burst or a scanned document)
+// with the same output format and options. All images, their grid tiles and their alpha images are
+// decoded on the thread pool of the context (see heif_context_set_max_decoding_threads()).
+// The callback is called once for each image as soon as it is finished, which is not necessarily in the
+// order of the handles. The calls of the callback are serialized, but may come from different threads.
+// The same holds for the progress callbacks in the options. A timeout or cancellation callback in the
+// options applies to the whole batch.
+// A failing image does not stop the decoding of the other images. The function returns when all images
+// have been delivered. The returned error is the first error of any image.
+LIBHEIF_API
+struct heif_error heif_decode_images(const struct heif_image_handle* const* handles, int num_handles,
+                                     enum heif_colorspace colorspace,
+                                     enum heif_chroma chroma,
+                                     const struct heif_decoding_options* options,
+                                     heif_decoded_image_callback callback,
+                                     void* userdata);
+
+// Called by heif_decode_image_in_bands() for each band of the image. 'band' contains the rows of the
+// output image starting at row 'y' and has the full image width (see heif_image_get_primary_height()
+// for the number of rows). It is only valid during the callback and must not be released.
+// Returning an error stops decoding. This error is then returned by heif_decode_image_in_bands().
+typedef struct heif_error (* heif_decoded_band_callback)(const struct heif_image* band, int y, void* userdata);
+
+// Decode the image as a sequence of horizontal bands that are passed to the callback in top-to-bottom
+// order, after the transformations and the conversion into the output format. This allows writing large
+// images with scanline-based encoders without holding the complete image in memory.
+// Grid images are decoded one band at a time. A band covers the image rows that need the same tiles
+// (e.g. one row of tiles). The tiles of a band are decoded in parallel. Other images are decoded
+// completely and are then passed on in bands.
+// The target size options (target_bbox_width, target_bbox_height) are ignored.
+LIBHEIF_API
+struct heif_error heif_decode_image_in_bands(const struct heif_image_handle* in_handle,
+                                             enum heif_colorspace colorspace,
+                                             enum heif_chroma chroma,
+                                             const struct heif_decoding_options* options,
+                                             heif_decoded_band_callback callback,
+                                             void* userdata);
+
+// A decoding that has been started with heif_decode_image_async().
+struct heif_decoding_request;
+
+// Called by heif_decode_image_async() when the decoding has finished. On success, 'img' is the decoded image,
+// which has to be released with heif_image_release(). When decoding failed or was canceled, 'img' is NULL and
+// 'err' describes the error. The error message is only valid during the callback.
+typedef void (* heif_decode_completion_callback)(struct heif_image* img, struct heif_error err, void* userdata);
+
+// Start decoding the image like heif_decode_image() and return right away. The image is decoded on the thread
+// pool of the context (the threads of libheif or the executor set with heif_context_set_executor()), and the
+// callback is called exactly once from there, also when decoding fails or is canceled.
+// When the context decodes in the calling thread (see heif_context_set_max_decoding_threads()), the image
+// is decoded and the callback is called before this function returns.
+// The options are copied, but the callbacks and buffers they point to have to stay valid until the callback
+// is called. The context must not be freed before the callback has returned, and not from within the callback.
+// If 'out_request' is not NULL, it returns a request with which the decoding can be canceled. It has to be
+// released with heif_decoding_request_release().
+// When an error is returned, the decoding has not been started and the callback is not called.
+LIBHEIF_API
+struct heif_error heif_decode_image_async(const struct heif_image_handle* in_handle,
+                                          enum heif_colorspace colorspace,
+                                          enum heif_chroma chroma,
+                                          const struct heif_decoding_options* options,
+                                          heif_decode_completion_callback callback,
+                                          void* userdata,
+                                          struct heif_decoding_request** out_request);
+
+// Stop the decoding as soon as possible (between grid tiles and processing steps). The callback is then
+// called with heif_error_Canceled, unless the image has already been decoded.
+LIBHEIF_API
+void heif_decoding_request_cancel(struct heif_decoding_request*);
+
+// Release the request. This does not cancel the decoding. It may be called before the callback has been called.
+LIBHEIF_API
+void heif_decoding_request_release(struct heif_decoding_request*);
+
+// ========================= image sequences =========================
+
+// Image sequences (brand 'msf1') and AVIF sequences (brand 'avis') store their frames in the tracks
+// of a 'moov' box. These functions give access to the visual tracks of such files.
+// Note that the file still needs a 'meta' box with a primary image to be read.
+
+LIBHEIF_API
+int heif_context_number_of_sequence_tracks(const struct heif_context* ctx);
+
+// Fills 'track_IDs' with at most 'count' track IDs. Returns the number of IDs that were written.
+LIBHEIF_API
+int heif_context_get_sequence_track_IDs(const struct heif_context* ctx, uint32_t* track_IDs, int count);
+
+struct heif_sequence_track_info
+{
+  uint32_t width;
+  uint32_t height;
+  uint32_t timescale; // ticks per second of the timestamps and the duration
+  uint64_t duration;
+  uint32_t number_of_frames;
+  enum heif_compression_format compression;
+};
+
+LIBHEIF_API
+struct heif_error heif_context_get_sequence_track_info(const struct heif_context* ctx, uint32_t track_ID,
+                                                       struct heif_sequence_track_info* out_info);
+
+struct heif_sequence_decoder;
+
+// Decodes the frames of a track one after the other with a single decoder instance for the whole track.
+// Reading the next frame, decoding and the color conversion of the previous frame run concurrently
+// on the thread pool of the context. The sample table is not loaded into memory, the frames are
+// looked up while they are decoded.
+// Decoding tracks with frames that depend on each other requires a decoder plugin with API version 8.
+// The decoder keeps the context alive. The options are copied.
+LIBHEIF_API
+struct heif_error heif_sequence_decoder_alloc(const struct heif_context* ctx, uint32_t track_ID,
+                                              enum heif_colorspace colorspace,
+                                              enum heif_chroma chroma,
+                                              const struct heif_decoding_options* options,
+                                              struct heif_sequence_decoder** out_decoder);
+
+// Returns the next frame in presentation order and its presentation time in the timescale of the track.
+// '*out_img' is set to NULL after the last frame. The image has to be released with heif_image_release().
+// 'out_timestamp' may be NULL.
+LIBHEIF_API
+struct heif_error heif_sequence_decoder_decode_next_frame(struct heif_sequence_decoder* decoder,
+                                                          struct heif_image** out_img,
+                                                          int64_t* out_timestamp);
+
+LIBHEIF_API
+void heif_sequence_decoder_free(struct heif_sequence_decoder* decoder);
+
+
+struct heif_decoding_memory_estimate
+{
+  size_t peak_bytes; // the maximum of the image memory while decoding
+  size_t image_bytes; // the decoded image (or the canvas of a grid image)
+  size_t output_bytes; // the image after the transformations and the conversion to the output format
+                       // (image_bytes and output_bytes are 0 for a grid image with canvas_file_directory)
+  size_t tile_bytes; // one tile of a grid image, 0 for other images
+  int max_concurrent_tiles; // grid tiles that are decoded at the same time, 0 for other images
+};
+
+// Estimate the image memory that heif_decode_image() needs for this image with the given output chroma
+// and options (which may be NULL). For grid images, fewer tiles are decoded in parallel when the tiles
+// of all decoding threads would exceed the remaining memory budget of the context (see
+// heif_context_set_memory_budget()). This can be used to decide whether and when an image is decoded.
+LIBHEIF_API
+struct heif_error heif_image_handle_estimate_decoding_memory(const struct heif_image_handle* handle,
+                                                             enum heif_chroma chroma,
+                                                             const struct heif_decoding_options* options,
+                                                             struct heif_decoding_memory_estimate* out_estimate);
+
+// Get the tile layout of a grid image. Returns an error if the image is no grid image.
+// The layout refers to the coded image, before any transformations (rotation, mirroring, cropping)
+// are applied. Tiles in the last column and row may extend beyond the image border.
+// Any of the output pointers may be NULL.
+LIBHEIF_API
+struct heif_error heif_image_handle_get_grid_layout(const struct heif_image_handle* handle,
+                                                   uint32_t* out_columns,
+                                                   uint32_t* out_rows,
+                                                   uint32_t* out_tile_width,
+                                                   uint32_t* out_tile_height);
+
+// Decode a single tile of a grid image, including color conversion to the requested colorspace/chroma.
+// The tile is cropped at the image border. The transformations of the grid image itself are
+// not applied, i.e. the tile is taken from the coded image as described by heif_image_handle_get_grid_layout().
+LIBHEIF_API
+struct heif_error heif_decode_grid_tile(const struct heif_image_handle* in_handle,
+                                        struct heif_image** out_img,
+                                        uint32_t column, uint32_t row,
+                                        enum heif_colorspace colorspace,
+                                        enum heif_chroma chroma,
+                                        const struct heif_decoding_options* options);
+
+// Get the ranges of the input file that are read when decoding the image (including its alpha
+// channel) with heif_decode_image_region(). Pass a zero width and height to get the ranges for
+// decoding the whole image. For grid images, only the tiles intersecting the area are included.
+// The ranges are sorted by offset, and overlapping or adjacent ranges are merged.
+// This is useful for readers that fetch the file from a remote location: after opening the file
+// (e.g. with the 'metadata_only' reading option), all data needed for decoding can be requested at once.
+// Note that the data of grid and overlay descriptions is read to compute the ranges.
+// The returned array has to be freed with heif_file_ranges_release().
+LIBHEIF_API
+struct heif_error heif_image_handle_get_file_ranges_for_decoding(const struct heif_image_handle* handle,
+                                                                 int x, int y, int width, int height,
+                                                                 const struct heif_decoding_options* options,
+                                                                 struct heif_file_range** out_ranges,
+                                                                 int* out_number_of_ranges);
+
+LIBHEIF_API
+void heif_file_ranges_release(struct heif_file_range* ranges);
+
 // Get the colorspace format of the image.
 LIBHEIF_API
 enum heif_colorspace heif_image_get_colorspace(const struct heif_image*);
@@ -1325,15 +2266,52 @@ const uint8_t* heif_image_get_plane_readonly(const struct heif_image*,
                                              enum heif_channel channel,
                                              int* out_stride);
 
+// When an image is encoded, its conversion to the input format of the encoder is kept
+// for further encodes of the same image. This is discarded by heif_image_get_plane().
+// Hence, when the pixels of an image that has already been encoded are modified,
+// the pointer has to be requested again with heif_image_get_plane().
 LIBHEIF_API
 uint8_t* heif_image_get_plane(struct heif_image*,
                               enum heif_channel channel,
                               int* out_stride);
 
+// Like heif_image_get_plane_readonly() and heif_image_get_plane(), but with a 64-bit stride.
+// Use these for very large images (e.g. big grid canvases), where the stride or the offsets into
+// the plane (y * stride) do not fit into an 'int'. Compute the offsets with size_t as well.
+// heif_image_get_plane_readonly() and heif_image_get_plane() return NULL if the stride does not
+// fit into an 'int'.
+LIBHEIF_API
+const uint8_t* heif_image_get_plane_readonly2(const struct heif_image*,
+                                              enum heif_channel channel,
+                                              size_t* out_stride);
+
+LIBHEIF_API
+uint8_t* heif_image_get_plane2(struct heif_image*,
+                               enum heif_channel channel,
+                               size_t* out_stride);
+
+
+struct heif_scaling_options
+{
+  uint8_t version;
+
+  // version 1 options
+
+  enum heif_scaling_filter filter; // default: heif_scaling_filter_bilinear
 
-struct heif_scaling_options;
+  // The image is split into bands of rows that are scaled in parallel on this number of threads.
+  // 0 scales the image on the calling thread only.
+  int max_threads; // default: 0
+};
+
+LIBHEIF_API
+struct heif_scaling_options* heif_scaling_options_alloc(void);
+
+LIBHEIF_API
+void heif_scaling_options_free(struct heif_scaling_options*);
 
-// Currently, heif_scaling_options is not defined yet. Pass a NULL pointer.
+// Scale the image to the given size. All planes are filtered separately, first horizontally, then vertically.
+// When 'options' is NULL, the nearest-neighbor filter is used.
 LIBHEIF_API
 struct heif_error heif_image_scale_image(const struct heif_image* input,
                                          struct heif_image** output,
@@ -1379,6 +2357,92 @@ LIBHEIF_API
 void heif_image_release(const struct heif_image*);
 
 
+// --- Color conversion pipeline introspection
+//
+// A color conversion is carried out as a sequence of steps with the lowest estimated cost (see
+// heif_calibrate_color_conversion()). These functions show which steps are chosen for a conversion
+// and, for decoded images, how long each step took. This helps to select output formats that can be
+// converted cheaply.
+
+struct heif_color_conversion_pipeline;
+
+struct heif_color_conversion_step
+{
+  // Set this to the version of the structure that you are using (currently 1) before calling
+  // heif_color_conversion_pipeline_get_step(). Only the fields of this version are filled.
+  int version;
+
+  // --- version 1
+
+  // Name of the conversion operation. Valid until the pipeline is released.
+  const char* operation_name;
+
+  // The format after this step.
+  enum heif_colorspace colorspace;
+  enum heif_chroma chroma;
+  int bits_per_pixel;
+  int has_alpha;
+
+  // The estimated cost used for selecting the steps. Only comparable between steps.
+  int speed_costs;
+
+  // Whether the following measurements are available (only for the steps of converted images).
+  int measured;
+
+  // Time of this step, summed over all threads that converted parts of the image in parallel.
+  uint64_t time_us;
+
+  // Memory allocated for the output of this step. When several steps are applied to strips of the
+  // image, this is the memory of the strips that were converted at the same time.
+  uint64_t memory_bytes;
+};
+
+// Get the steps for converting images in the input format into the output format.
+// 'output_bits_per_pixel' may be 0 to keep the input bit depth where the output chroma allows it.
+// The nclx profiles and the options may be NULL for the defaults.
+// Returns 'heif_suberror_Unsupported_color_conversion' if there is no conversion.
+// The pipeline has to be released with heif_color_conversion_pipeline_release().
+LIBHEIF_API
+struct heif_error heif_get_color_conversion_pipeline(enum heif_colorspace input_colorspace,
+                                                     enum heif_chroma input_chroma,
+                                                     int input_bits_per_pixel,
+                                                     int input_has_alpha,
+                                                     const struct heif_color_profile_nclx* input_nclx,
+                                                     enum heif_colorspace output_colorspace,
+                                                     enum heif_chroma output_chroma,
+                                                     int output_bits_per_pixel,
+                                                     const struct heif_color_profile_nclx* output_nclx,
+                                                     const struct heif_color_conversion_options* options,
+                                                     struct heif_color_conversion_pipeline** out_pipeline);
+
+// Get the color conversion steps that were applied to produce the image (e.g. while decoding it),
+// together with their measured time and memory. The pipeline has no steps if the image was not converted.
+// The pipeline has to be released with heif_color_conversion_pipeline_release().
+LIBHEIF_API
+struct heif_error heif_image_get_color_conversion_pipeline(const struct heif_image* image,
+                                                           struct heif_color_conversion_pipeline** out_pipeline);
+
+LIBHEIF_API
+void heif_color_conversion_pipeline_release(const struct heif_color_conversion_pipeline* pipeline);
+
+// Any of the output pointers may be NULL.
+LIBHEIF_API
+void heif_color_conversion_pipeline_get_input_format(const struct heif_color_conversion_pipeline* pipeline,
+                                                     enum heif_colorspace* out_colorspace,
+                                                     enum heif_chroma* out_chroma,
+                                                     int* out_bits_per_pixel,
+                                                     int* out_has_alpha);
+
+LIBHEIF_API
+int heif_color_conversion_pipeline_get_number_of_steps(const struct heif_color_conversion_pipeline* pipeline);
+
+// 'out_step->version' has to be set by the caller.
+LIBHEIF_API
+struct heif_error heif_color_conversion_pipeline_get_step(const struct heif_color_conversion_pipeline* pipeline,
+                                                          int step_index,
+                                                          struct heif_color_conversion_step* out_step);
+
+
 // Note: a value of 0 for any of these values indicates that the value is undefined.
 // The unit of these values is Candelas per square meter.
 struct heif_content_light_level
@@ -1454,6 +2518,11 @@ struct heif_writer
   int writer_api_version;
 
   // --- version 1 functions ---
+
+  // With writer_api_version 1, write() is called once with the complete file.
+  // With writer_api_version 2, write() may be called several times with consecutive parts of the
+  // file. The file is then written without collecting it in memory first. The data is only valid
+  // during the call. Returning an error stops writing and the error is returned to the caller.
   struct heif_error (* write)(struct heif_context* ctx, // TODO: why do we need this parameter?
                               const void* data,
                               size_t size,
@@ -1465,6 +2534,30 @@ struct heif_error heif_context_write(struct heif_context*,
                                      struct heif_writer* writer,
                                      void* userdata);
 
+struct heif_encoder;
+
+// Write the file while the images are encoded: the compressed data of each image is passed to the
+// writer as soon as it has been encoded instead of being kept in memory until heif_context_write().
+// This way, the memory needed for encoding large images does not grow with the file size.
+//
+// The 'ftyp' box is written immediately. Its brands are chosen for the format of the 'encoder',
+// unless an image has already been encoded into the context. Each image is stored in an 'mdat'
+// box of its own, and the 'meta' box is written at the end of the file by
+// heif_context_finish_streaming_write(). heif_context_write() cannot be used for this context.
+//
+// The writer has to use writer_api_version 2. It is called until heif_context_finish_streaming_write()
+// returns, the userdata has to stay valid until then.
+// This is only possible for a newly created context, not for a context that was read from a file.
+LIBHEIF_API
+struct heif_error heif_context_start_streaming_write(struct heif_context*,
+                                                     const struct heif_encoder* encoder,
+                                                     const struct heif_writer* writer,
+                                                     void* userdata);
+
+// Write the remaining data and the 'meta' box to the writer passed to heif_context_start_streaming_write().
+LIBHEIF_API
+struct heif_error heif_context_finish_streaming_write(struct heif_context*);
+
 
 // ----- encoder -----
 
@@ -1599,6 +2692,27 @@ struct heif_error heif_encoder_set_lossless(struct heif_encoder*, int enable);
 LIBHEIF_API
 struct heif_error heif_encoder_set_logging_level(struct heif_encoder*, int level);
 
+// Adapt the speed setting of the encoder plugin ('speed' or 'preset') over successive encodes with this
+// encoder, such that encoding takes about the given time per megapixel on this machine. The encoder starts
+// with its current speed setting and chooses faster or slower settings depending on the measured times.
+// Pass 0 to switch this off again. The speed setting is then left at its last value.
+// Returns heif_suberror_Unsupported_parameter if the encoder has no speed setting.
+LIBHEIF_API
+struct heif_error heif_encoder_set_target_encoding_time(struct heif_encoder*, double milliseconds_per_megapixel);
+
+// Limit the number of worker threads that all encoders in this process may use together.
+// Each encoder takes its share of the budget when it starts an image, such that many concurrent
+// encodes do not oversubscribe the CPU cores. The share is at most the budget divided by the number
+// of running encoders, and threads that are still in use by other encoders are not handed out again.
+// Each encoder uses at least one thread and never more than set by its own 'threads' parameter.
+// Pass 0 (the default) to remove the limit.
+// Only encoder plugins that reserve their threads with heif_encoder_acquire_threads() follow the budget.
+LIBHEIF_API
+void heif_set_encoder_thread_budget(int max_threads);
+
+LIBHEIF_API
+int heif_get_encoder_thread_budget(void);
+
 // Get a generic list of encoder parameters.
 // Each encoder may define its own, additional set of parameters.
 // You do not have to free the returned list.
@@ -1766,6 +2880,42 @@ struct heif_encoding_options
   // version 6 options
 
   struct heif_color_conversion_options color_conversion_options;
+
+  // version 7 options
+
+  // If > 0, a thumbnail that fits into a square of this size is encoded together with the image,
+  // like with heif_context_encode_thumbnail().
+  int thumbnail_bbox_size; // default: 0
+
+  // Encode the alpha channel and the thumbnail (with its alpha channel) in parallel to the color image.
+  // Each of them is encoded on the thread pool of the context (see heif_context_set_max_decoding_threads())
+  // with a separate instance of the encoder that has the same parameters. The file is the same
+  // as when the images are encoded one after another.
+  uint8_t encode_auxiliary_images_concurrently; // default: false
+
+  // version 8 options
+
+  // Encode a thumbnail for each of these bounding box sizes, e.g. {1024, 256, 64}, and assign all of
+  // them to the image. The largest level is scaled down from the image, each further level from the
+  // previous level, with a box filter. Levels into which the image already fits are skipped.
+  // All levels are encoded in parallel to the image, as with encode_auxiliary_images_concurrently.
+  // These thumbnails are added in addition to the one requested with thumbnail_bbox_size.
+  // The array is not copied and has to stay valid until the image has been encoded.
+  const int* thumbnail_pyramid_bbox_sizes; // default: NULL
+  int num_thumbnail_pyramid_levels; // default: 0
+
+  // version 9 options
+
+  // Called before each image, grid tile and auxiliary image is passed to the encoder plugin.
+  // When it returns a non-zero value, encoding stops and heif_error_Canceled is returned.
+  // The encoder plugins themselves cannot be interrupted.
+  // The callback may be called from several threads at the same time.
+  int (* cancel_encoding)(void* cancel_user_data); // default: NULL
+  void* cancel_user_data;
+
+  // Encoding is canceled like above when it takes longer than this number of milliseconds,
+  // counted from the call of the encoding function. 0 = no time limit.
+  uint32_t timeout_ms; // default: 0
 };
 
 LIBHEIF_API
@@ -1787,6 +2937,89 @@ struct heif_error heif_context_encode_image(struct heif_context*,
                                             const struct heif_encoding_options* options,
                                             struct heif_image_handle** out_image_handle);
 
+// Compress the input image as a 'grid' image of tiles with the size tile_width x tile_height.
+// The border tiles are padded with the repeated border pixels to the full tile size.
+// This is useful for large images, since each tile is coded as a separate image:
+// the tiles are encoded in parallel, using up to heif_context_set_max_decoding_threads() + 1
+// threads with one encoder instance per thread. The additional encoder instances get the same
+// parameters as 'encoder'. Parameters that the plugin cannot report back are left at their defaults.
+// The grid image (and its alpha grid) get the 'ispe' of the full image and the 'pixi' of the tiles.
+// Otherwise, this works like heif_context_encode_image().
+LIBHEIF_API
+struct heif_error heif_context_encode_grid(struct heif_context*,
+                                           const struct heif_image* image,
+                                           uint32_t tile_width, uint32_t tile_height,
+                                           struct heif_encoder* encoder,
+                                           const struct heif_encoding_options* options,
+                                           struct heif_image_handle** out_image_handle);
+
+// Called by heif_context_encode_grid_from_bands() to get the image rows [y, y+height). The band has to be
+// returned in '*out_band' as an image of the full image width and 'height' rows. It is released by libheif.
+// All bands must have the same colorspace, chroma format and channels.
+// Returning an error stops encoding. This error is then returned by heif_context_encode_grid_from_bands().
+typedef struct heif_error (* heif_encoding_band_callback)(int y, int height, struct heif_image** out_band,
+                                                          void* userdata);
+
+// Compress an image of image_width x image_height pixels as a 'grid' image like heif_context_encode_grid(),
+// but without the complete image in memory. The pixels are requested from the callback in bands of one
+// tile row from top to bottom. The tiles of a band are encoded in parallel and are added to the context
+// before the next band is requested. Hence, only one band is held in memory at a time.
+// The color profile and the image properties (e.g. pixel aspect ratio) are taken from the bands.
+// No thumbnail is created. When encoding fails after the first band, the tiles that have already been
+// added remain in the context as hidden images.
+LIBHEIF_API
+struct heif_error heif_context_encode_grid_from_bands(struct heif_context*,
+                                                      uint32_t image_width, uint32_t image_height,
+                                                      uint32_t tile_width, uint32_t tile_height,
+                                                      struct heif_encoder* encoder,
+                                                      const struct heif_encoding_options* options,
+                                                      heif_encoding_band_callback get_band,
+                                                      void* userdata,
+                                                      struct heif_image_handle** out_image_handle);
+
+// Compress the input image with the highest lossy quality at which the coded image data
+// is at most 'target_size' bytes large. The alpha channel and thumbnails are not counted.
+// The quality is searched by coding several candidate qualities in parallel, using up to
+// heif_context_set_max_decoding_threads() + 1 encoder instances, and narrowing the quality range
+// between them until the best quality is found. Only the image with the winning quality is added
+// to the context. 'encoder' is left at this quality and, if 'out_quality' is not NULL, it is returned there.
+// If the image does not fit into 'target_size' even at quality 0, heif_error_Encoding_error is returned
+// and nothing is added to the context.
+// Only HEVC and AV1 encoders are supported. Otherwise, this works like heif_context_encode_image().
+LIBHEIF_API
+struct heif_error heif_context_encode_image_with_target_size(struct heif_context*,
+                                                             const struct heif_image* image,
+                                                             struct heif_encoder* encoder,
+                                                             const struct heif_encoding_options* options,
+                                                             size_t target_size,
+                                                             int* out_quality,
+                                                             struct heif_image_handle** out_image_handle);
+
+// Compress 'num_images' images with the same encoder, e.g. the images of a burst or the pages of a scan.
+// This gives the same file as calling heif_context_encode_image() for each image in turn
+// (same item IDs, references and primary image), but the images are coded in parallel,
+// using up to heif_context_set_max_decoding_threads() + 1 threads with one encoder instance per thread.
+// 'options' is an array with the options for each image. The array or any of its entries may be NULL.
+// If 'out_image_handles' is not NULL, it has to point to an array of 'num_images' handles, which
+// receives the handles of the coded images. Entries of images that have not been added are set to NULL.
+// When an error is returned, the images before the failing image may already have been added.
+LIBHEIF_API
+struct heif_error heif_context_encode_images(struct heif_context*,
+                                             const struct heif_image* const* images, int num_images,
+                                             struct heif_encoder* encoder,
+                                             const struct heif_encoding_options* const* options,
+                                             struct heif_image_handle** out_image_handles);
+
+// Add the JPEG file 'data' as a 'jpeg' image item. The JPEG data is stored unchanged, without
+// decoding and re-encoding it. The image size, the Exif orientation and an embedded ICC profile
+// are taken from the JPEG headers. Only baseline and progressive 8-bit JPEGs with one or three
+// components are accepted.
+// As with heif_context_encode_image(), the first image added to the context becomes the primary image.
+LIBHEIF_API
+struct heif_error heif_context_add_jpeg_image(struct heif_context*,
+                                              const void* data, size_t size,
+                                              struct heif_image_handle** out_image_handle);
+
 LIBHEIF_API
 struct heif_error heif_context_set_primary_image(struct heif_context*,
                                                  struct heif_image_handle* image_handle);
@@ -1820,6 +3053,21 @@ struct heif_error heif_context_assign_thumbnail(struct heif_context*,
                                                 const struct heif_image_handle* master_image,
                                                 const struct heif_image_handle* thumbnail_image);
 
+// Copy an image of another context into 'ctx' without decoding and re-encoding it.
+// The compressed data and the properties (e.g. the codec configuration, size, color profile and
+// transformations) are copied unchanged. The tiles of grid images, the thumbnails and the auxiliary
+// images (alpha, depth) are copied together with the image. Metadata (Exif, XMP) is not copied.
+//
+// The source context has to be read from a file or memory and 'ctx' has to be a newly created
+// context. If the source was read from memory, the compressed data is referenced instead of copied.
+// With heif_context_read_from_memory_without_copy(), the memory then has to stay valid until 'ctx'
+// has been written.
+// As with heif_context_encode_image(), the first image added to the context becomes the primary image.
+LIBHEIF_API
+struct heif_error heif_context_copy_image(struct heif_context* ctx,
+                                          const struct heif_image_handle* source_image,
+                                          struct heif_image_handle** out_image_handle);
+
 // Add EXIF metadata to an image.
 LIBHEIF_API
 struct heif_error heif_context_add_exif_metadata(struct heif_context*,
@@ -1849,6 +3097,27 @@ struct heif_error heif_context_add_generic_metadata(struct heif_context* ctx,
                                                     const void* data, int size,
                                                     const char* item_type, const char* content_type);
 
+// Remove a metadata block (see heif_image_handle_get_list_of_metadata_block_IDs()) from the file.
+// Together with heif_context_update_file_in_place(), this can be used to replace metadata.
+LIBHEIF_API
+struct heif_error heif_context_remove_metadata(struct heif_context* ctx,
+                                               const struct heif_image_handle* image_handle,
+                                               heif_item_id metadata_id);
+
+// Write the changes made to a context that has been read from 'filename' back into the same file
+// without writing it again completely. This is meant for editing metadata: only the 'meta' box is
+// rewritten and the data of added metadata is appended to the end of the file. The image data stays
+// where it is, so that an update only costs a few kilobytes of I/O.
+//
+// The 'meta' box is written to its old place if there is enough room, otherwise it is moved to the
+// end of the file and padded so that later updates fit in place. The file must not have been
+// changed since it was read. Data that has been added cannot be read from 'ctx' afterwards, read
+// the file again for this.
+// Adding data that is stored in the 'meta' box itself (e.g. grid images) is not supported.
+LIBHEIF_API
+struct heif_error heif_context_update_file_in_place(struct heif_context* ctx,
+                                                    const char* filename);
+
 // --- heif_image allocation
 
 // Create a new image of the specified resolution and colorspace.
@@ -1870,6 +3139,33 @@ struct heif_error heif_image_add_plane(struct heif_image* image,
                                        enum heif_channel channel,
                                        int width, int height, int bit_depth);
 
+// Add a plane that uses existing memory instead of allocating and copying it, e.g. the picture
+// buffer of a decoder. 'stride' is the number of bytes per row. The memory has to be writable,
+// since libheif may modify decoded images in place (e.g. when mirroring them).
+// When the image does not use the memory anymore, 'release_func' (if not NULL) is called with
+// 'release_user_data'. This is done exactly once for each successfully added plane.
+// If an error is returned, 'release_func' is not called and the memory stays with the caller.
+LIBHEIF_API
+struct heif_error heif_image_add_external_plane(struct heif_image* image,
+                                                enum heif_channel channel,
+                                                int width, int height, int bit_depth,
+                                                uint8_t* data, int stride,
+                                                void (* release_func)(void* release_user_data),
+                                                void* release_user_data);
+
+// Like heif_image_add_external_plane(), but libheif never writes into the memory.
+// This can be used to encode images from application buffers: when the encoder accepts the
+// colorspace and chroma of the image, it reads the pixels directly from 'data' without a copy.
+// Functions that modify the plane (e.g. heif_image_get_plane() or heif_image_extend_padding_to_size())
+// work on a copy of the memory.
+LIBHEIF_API
+struct heif_error heif_image_add_external_read_only_plane(struct heif_image* image,
+                                                          enum heif_channel channel,
+                                                          int width, int height, int bit_depth,
+                                                          const uint8_t* data, int stride,
+                                                          void (* release_func)(void* release_user_data),
+                                                          void* release_user_data);
+
 // Signal that the image is premultiplied by the alpha pixel values.
 LIBHEIF_API
 void heif_image_set_premultiplied_alpha(struct heif_image* image,
@@ -2076,6 +3372,104 @@ struct heif_error heif_region_item_add_region_polyline(struct heif_region_item*,
                                                        const int32_t* pts_array, int nPoints,
                                                        struct heif_region** out_region);
 
+// --- adding and querying many regions at once
+
+// These functions work on the regions of one type in the order in which they are stored in the region item.
+// The coordinates are given in separate arrays for each value. They are in the reference coordinate space.
+// A region item can hold at most 255 regions. If the new regions do not fit, none of them is added and
+// heif_suberror_Too_many_regions is returned.
+
+LIBHEIF_API
+struct heif_error heif_region_item_add_region_points(struct heif_region_item*,
+                                                     const int32_t* x_array, const int32_t* y_array,
+                                                     int num_points);
+
+LIBHEIF_API
+struct heif_error heif_region_item_add_region_rectangles(struct heif_region_item*,
+                                                         const int32_t* x_array, const int32_t* y_array,
+                                                         const uint32_t* width_array, const uint32_t* height_array,
+                                                         int num_rectangles);
+
+LIBHEIF_API
+struct heif_error heif_region_item_add_region_ellipses(struct heif_region_item*,
+                                                       const int32_t* x_array, const int32_t* y_array,
+                                                       const uint32_t* radius_x_array, const uint32_t* radius_y_array,
+                                                       int num_ellipses);
+
+// The points of all polygons are stored one after the other in 'pts_array' as x,y pairs.
+// 'num_points_array' gives the number of points of each polygon.
+LIBHEIF_API
+struct heif_error heif_region_item_add_region_polygons(struct heif_region_item*,
+                                                       const int32_t* pts_array, const int* num_points_array,
+                                                       int num_polygons);
+
+// Get the types of all regions of the region item. Returns the number of types written into 'out_types_array'.
+LIBHEIF_API
+int heif_region_item_get_region_types(const struct heif_region_item*,
+                                      enum heif_region_type* out_types_array, int max_count);
+
+LIBHEIF_API
+int heif_region_item_get_number_of_regions_of_type(const struct heif_region_item*, enum heif_region_type type);
+
+// The following functions return the number of regions written into the output arrays.
+
+LIBHEIF_API
+int heif_region_item_get_region_points(const struct heif_region_item*,
+                                       int32_t* out_x_array, int32_t* out_y_array, int max_count);
+
+LIBHEIF_API
+int heif_region_item_get_region_rectangles(const struct heif_region_item*,
+                                           int32_t* out_x_array, int32_t* out_y_array,
+                                           uint32_t* out_width_array, uint32_t* out_height_array,
+                                           int max_count);
+
+LIBHEIF_API
+int heif_region_item_get_region_ellipses(const struct heif_region_item*,
+                                         int32_t* out_x_array, int32_t* out_y_array,
+                                         uint32_t* out_radius_x_array, uint32_t* out_radius_y_array,
+                                         int max_count);
+
+// Get the number of points of each polygon.
+LIBHEIF_API
+int heif_region_item_get_region_polygon_sizes(const struct heif_region_item*,
+                                              int* out_num_points_array, int max_count);
+
+// Get the points of all polygons, one polygon after the other, as x,y pairs. 'out_pts_array' must have
+// space for 2*max_points values. Returns the number of points written. Only complete polygons are written.
+LIBHEIF_API
+int heif_region_item_get_region_polygon_points(const struct heif_region_item*,
+                                               int32_t* out_pts_array, int max_points);
+
+// Get the indices of the regions (in the order of heif_region_item_get_list_of_regions()) that contain
+// the pixel (x,y) of the reference coordinate space. A pixel belongs to a polygon or ellipse if its
+// center lies inside. Polylines do not contain any pixels.
+// Returns the number of indices written into 'out_indices_array'.
+LIBHEIF_API
+int heif_region_item_find_regions_at(const struct heif_region_item*, int32_t x, int32_t y,
+                                     int* out_indices_array, int max_count);
+
+// Get the indices of the regions whose bounding boxes intersect the given rectangle.
+LIBHEIF_API
+int heif_region_item_find_regions_in_rectangle(const struct heif_region_item*,
+                                               int32_t x, int32_t y, uint32_t width, uint32_t height,
+                                               int* out_indices_array, int max_count);
+
+// Set the pixels of the region to 'value' in a bitmap of 8-bit values. The bitmap covers the area of
+// width x height pixels at the origin of the reference coordinate space. 'stride' is the number of bytes
+// per row. Other pixels are not changed. The set pixels are those for which heif_region_item_find_regions_at()
+// would report the region. Polylines are drawn as lines of one pixel width.
+// Mask regions are not supported.
+LIBHEIF_API
+struct heif_error heif_region_rasterize(const struct heif_region* region,
+                                        uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride,
+                                        uint8_t value);
+
+// Rasterize all regions of the region item like heif_region_rasterize().
+LIBHEIF_API
+struct heif_error heif_region_item_rasterize(const struct heif_region_item*,
+                                             uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride,
+                                             uint8_t value);
+
 #ifdef __cplusplus
 }
 #endif
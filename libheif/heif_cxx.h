@@ -340,6 +340,10 @@ namespace heif {
 
     uint8_t* get_plane(enum heif_channel channel, int* out_stride) noexcept;
 
+    const uint8_t* get_plane(enum heif_channel channel, size_t* out_stride) const noexcept;
+
+    uint8_t* get_plane(enum heif_channel channel, size_t* out_stride) noexcept;
+
     // throws Error
     void set_nclx_color_profile(const ColorProfile_nclx&);
 
@@ -360,6 +364,12 @@ namespace heif {
 
     class ScalingOptions
     {
+    public:
+      ScalingOptions() : filter(heif_scaling_filter_nearest_neighbor), max_threads(0) {}
+
+      enum heif_scaling_filter filter;
+
+      int max_threads;
     };
 
     // throws Error
@@ -907,6 +917,16 @@ namespace heif {
     return heif_image_get_plane(m_image.get(), channel, out_stride);
   }
 
+  inline const uint8_t* Image::get_plane(enum heif_channel channel, size_t* out_stride) const noexcept
+  {
+    return heif_image_get_plane_readonly2(m_image.get(), channel, out_stride);
+  }
+
+  inline uint8_t* Image::get_plane(enum heif_channel channel, size_t* out_stride) noexcept
+  {
+    return heif_image_get_plane2(m_image.get(), channel, out_stride);
+  }
+
   inline void Image::set_nclx_color_profile(const ColorProfile_nclx& nclx)
   {
     Error err = Error(heif_image_set_nclx_color_profile(m_image.get(), nclx.mProfile));
@@ -978,11 +998,16 @@ namespace heif {
   }
 
   inline Image Image::scale_image(int width, int height,
-                                  const ScalingOptions&) const
+                                  const ScalingOptions& options) const
   {
+    heif_scaling_options scaling_options;
+    scaling_options.version = 1;
+    scaling_options.filter = options.filter;
+    scaling_options.max_threads = options.max_threads;
+
     heif_image* img;
     Error err = Error(heif_image_scale_image(m_image.get(), &img, width, height,
-                                             nullptr)); // TODO: scaling options not defined yet
+                                             &scaling_options));
     if (err) {
       throw err;
     }
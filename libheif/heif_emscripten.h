@@ -16,9 +16,22 @@ static std::string _heif_get_version()
   return heif_get_version();
 }
 
+#if defined(__EMSCRIPTEN_PTHREADS__)
+// Number of threads used for decoding a grid image. The worker threads have to be started
+// before they are used (see PTHREAD_POOL_SIZE in build-emscripten.sh), because the main
+// browser thread cannot wait for a new worker thread to start.
+#ifndef HEIF_JS_DECODING_THREADS
+#define HEIF_JS_DECODING_THREADS 4
+#endif
+#endif
+
 static struct heif_error _heif_context_read_from_memory(
     struct heif_context* context, const std::string& data)
 {
+#if defined(__EMSCRIPTEN_PTHREADS__)
+  heif_context_set_max_decoding_threads(context, HEIF_JS_DECODING_THREADS);
+#endif
+
   return heif_context_read_from_memory(context, data.data(), data.size(), nullptr);
 }
 
@@ -166,6 +179,71 @@ static emscripten::val heif_js_decode_image(struct heif_image_handle* handle,
   return result;
 }
 
+// Returns the planes of the image as typed array views into the WASM heap, without copying them.
+// A view becomes invalid when the image is released. It also becomes detached when the heap grows
+// (unless it is shared memory), so the views should be requested again for every use of the data.
+static emscripten::val heif_js_image_get_planes(struct heif_image* image)
+{
+  emscripten::val result = emscripten::val::array();
+  if (!image) {
+    return result;
+  }
+
+  const heif_channel channels[] = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr,
+                                   heif_channel_R, heif_channel_G, heif_channel_B,
+                                   heif_channel_Alpha, heif_channel_interleaved};
+
+  int index = 0;
+  for (heif_channel channel : channels) {
+    if (!heif_image_has_channel(image, channel)) {
+      continue;
+    }
+
+    int stride;
+    const uint8_t* data = heif_image_get_plane_readonly(image, channel, &stride);
+    int height = heif_image_get_height(image, channel);
+
+    emscripten::val plane = emscripten::val::object();
+    plane.set("channel", channel);
+    plane.set("width", heif_image_get_width(image, channel));
+    plane.set("height", height);
+    plane.set("bits_per_pixel", heif_image_get_bits_per_pixel_range(image, channel));
+    plane.set("stride", stride);
+    plane.set("data", emscripten::val(emscripten::typed_memory_view((size_t) stride * height, data)));
+    result.set(index++, plane);
+  }
+
+  return result;
+}
+
+// Decodes the image without copying the result. The planes of the returned "image" are available
+// as views into the WASM heap in "planes" (see heif_js_image_get_planes()).
+// The image has to be released with heif_image_release().
+static emscripten::val heif_js_decode_image_view(struct heif_image_handle* handle,
+                                                 enum heif_colorspace colorspace, enum heif_chroma chroma)
+{
+  emscripten::val result = emscripten::val::object();
+  if (!handle) {
+    return result;
+  }
+
+  struct heif_image* image;
+  struct heif_error err = heif_decode_image(handle, &image, colorspace, chroma, nullptr);
+  if (err.code != heif_error_Ok) {
+    return emscripten::val(err);
+  }
+
+  result.set("image", emscripten::val(image, emscripten::allow_raw_pointers()));
+  result.set("is_primary", heif_image_handle_is_primary_image(handle));
+  result.set("thumbnails", heif_image_handle_get_number_of_thumbnails(handle));
+  result.set("width", heif_image_get_primary_width(image));
+  result.set("height", heif_image_get_primary_height(image));
+  result.set("chroma", heif_image_get_chroma_format(image));
+  result.set("colorspace", heif_image_get_colorspace(image));
+  result.set("planes", heif_js_image_get_planes(image));
+  return result;
+}
+
 #define EXPORT_HEIF_FUNCTION(name) \
   emscripten::function(#name, &name, emscripten::allow_raw_pointers())
 
@@ -185,7 +263,12 @@ EMSCRIPTEN_BINDINGS(libheif) {
     &heif_js_context_get_image_handle, emscripten::allow_raw_pointers());
     emscripten::function("heif_js_decode_image",
     &heif_js_decode_image, emscripten::allow_raw_pointers());
+    emscripten::function("heif_js_decode_image_view",
+    &heif_js_decode_image_view, emscripten::allow_raw_pointers());
+    emscripten::function("heif_js_image_get_planes",
+    &heif_js_image_get_planes, emscripten::allow_raw_pointers());
     EXPORT_HEIF_FUNCTION(heif_image_handle_release);
+    EXPORT_HEIF_FUNCTION(heif_image_release);
 
     emscripten::enum_<heif_error_code>("heif_error_code")
     .value("heif_error_Ok", heif_error_Ok)
@@ -253,12 +336,14 @@ EMSCRIPTEN_BINDINGS(libheif) {
     .value("heif_suberror_Item_reference_cycle", heif_suberror_Item_reference_cycle)
     .value("heif_suberror_Invalid_pixi_box", heif_suberror_Invalid_pixi_box)
     .value("heif_suberror_Invalid_region_data", heif_suberror_Invalid_region_data)
+    .value("heif_suberror_Decompression_invalid_data", heif_suberror_Decompression_invalid_data)
     .value("heif_suberror_Unsupported_codec", heif_suberror_Unsupported_codec)
     .value("heif_suberror_Unsupported_image_type", heif_suberror_Unsupported_image_type)
     .value("heif_suberror_Unsupported_data_version", heif_suberror_Unsupported_data_version)
     .value("heif_suberror_Unsupported_color_conversion", heif_suberror_Unsupported_color_conversion)
     .value("heif_suberror_Unsupported_item_construction_method", heif_suberror_Unsupported_item_construction_method)
     .value("heif_suberror_Unsupported_header_compression_method", heif_suberror_Unsupported_header_compression_method)
+    .value("heif_suberror_Unsupported_generic_compression_method", heif_suberror_Unsupported_generic_compression_method)
     .value("heif_suberror_Unsupported_bit_depth", heif_suberror_Unsupported_bit_depth)
     .value("heif_suberror_Wrong_tile_image_pixel_depth", heif_suberror_Wrong_tile_image_pixel_depth)
     .value("heif_suberror_Unknown_NCLX_color_primaries", heif_suberror_Unknown_NCLX_color_primaries)
@@ -42,6 +42,7 @@ extern "C" {
 //  1.8          1         2          2
 //  1.13         2         3          2
 //  1.15         3         3          2
+//  1.17         8         6          2
 
 
 // ====================================================================================================
@@ -62,9 +63,11 @@ struct heif_decoder_plugin
   const char* (* get_plugin_name)();
 
   // Global plugin initialization (may be NULL)
+  // Called before the plugin is used for the first time, not when it is registered.
   void (* init_plugin)();
 
   // Global plugin deinitialization (may be NULL)
+  // Only called when init_plugin() has been called.
   void (* deinit_plugin)();
 
   // Query whether the plugin supports decoding of the given format
@@ -85,6 +88,9 @@ struct heif_decoder_plugin
 
   // --- After pushing the data into the decoder, the decode functions may be called only once.
 
+  // If the plugin cannot decode this particular image (e.g. a hardware decoder that does not support
+  // its profile), it should return heif_suberror_Unsupported_codec. libheif then decodes the image
+  // with the plugin that has the next lower priority.
   struct heif_error (* decode_image)(void* decoder, struct heif_image** out_img);
 
 
@@ -101,17 +107,92 @@ struct heif_decoder_plugin
 
   */
 
-  // Reset decoder, such that we can feed in new data for another image.
-  // void (*reset_image)(void* decoder);
-
   // --- version 3 functions will follow below ... ---
 
   const char* id_name;
 
   // --- version 4 functions will follow below ... ---
+
+  // Reset decoder, such that we can feed in new data for another image.
+  // This allows libheif to decode many images (e.g. the tiles of a grid image) with the same
+  // decoder instance instead of creating a new decoder for each image.
+  // May be NULL, in which case a new decoder is created for each image.
+  void (* reset_image)(void* decoder);
+
+  // --- version 5 functions will follow below ... ---
+
+  // Set a decoder parameter (see heif_decoder_parameter_name_* below).
+  // libheif sets the parameters before pushing the data of each image. A decoder instance may be
+  // reused for further images, hence changed parameters have to take effect for the next image.
+  // Unknown parameters should be rejected with heif_suberror_Unsupported_parameter.
+  // May be NULL if the decoder has no parameters.
+  struct heif_error (* set_parameter_integer)(void* decoder, const char* name, int value);
+
+  // --- version 6 functions will follow below ... ---
+
+  // Decode the pushed data directly into 'out_img' instead of returning a new image in decode_image().
+  // 'out_img' already has the colorspace, chroma, bit depth and planes that libheif wants to get.
+  // Its planes may point into a larger image, e.g. the area of a tile in the grid canvas.
+  // Hence, the decoder must not add, remove or reallocate planes, but only write the pixel data.
+  // 'input_nclx' is the color profile of the coded image stored in the HEIF file, or NULL if there
+  // is none, in which case the profile signalled in the bitstream applies.
+  // If the decoder cannot output the format of 'out_img', it has to return heif_suberror_Unsupported_color_conversion
+  // without consuming the data. libheif will then call decode_image() and convert the image itself.
+  // May be NULL.
+  struct heif_error (* decode_image_into)(void* decoder, struct heif_image* out_img,
+                                          const struct heif_color_profile_nclx* input_nclx);
+
+  // --- version 7 functions will follow below ... ---
+
+  // Decode several independent images that share the same codec headers, e.g. the tiles of a grid image.
+  // 'headers' is the codec configuration (e.g. the HEVC parameter sets) that would otherwise be pushed
+  // in front of each image. 'image_data[i]' with 'image_sizes[i]' bytes is the coded data of image i,
+  // in the same format as for push_data().
+  // The decoder may decode several images at once. It passes each decoded image to 'image_decoded',
+  // together with its index, in any order. The callback takes ownership of the image and is called
+  // from the thread that called decode_image_sequence(). If the callback returns an error, decoding stops
+  // and decode_image_sequence() returns this error.
+  // Afterwards, the decoder is reset with reset_image() before it is used again.
+  // May be NULL.
+  struct heif_error (* decode_image_sequence)(void* decoder,
+                                              const void* headers, size_t headers_size,
+                                              const void* const* image_data, const size_t* image_sizes,
+                                              int num_images,
+                                              struct heif_error (* image_decoded)(void* callback_user_data,
+                                                                                  int image_index,
+                                                                                  struct heif_image* img),
+                                              void* callback_user_data);
+
+  // --- version 8 functions will follow below ... ---
+
+  // Decode a stream of frames that depend on each other, e.g. the samples of an image sequence track.
+  // The codec configuration headers are pushed with push_data() before the first frame.
+  // 'data' is the coded data of the next frame in decoding order, in the same format as for push_data().
+  // It is only valid during the call. 'timestamp' is returned together with the decoded frame.
+  // After the last frame, push_frame() is called with data==NULL to signal the end of the stream,
+  // so that the decoder outputs all frames that it still holds back.
+  // After each push_frame(), libheif calls get_frame() until it returns no frame.
+  // Afterwards, the decoder is reset with reset_image() before it is used again.
+  // May be NULL.
+  struct heif_error (* push_frame)(void* decoder, const void* data, size_t size, int64_t timestamp);
+
+  // Get the next decoded frame in presentation order. '*out_img' is set to NULL when the decoder
+  // needs the next frame first, or when all frames have been output after the end of the stream.
+  // May only be NULL if push_frame() is NULL.
+  struct heif_error (* get_frame)(void* decoder, struct heif_image** out_img, int64_t* out_timestamp);
+
+  // --- version 9 functions will follow below ... ---
 };
 
 
+// Names for standard decoder parameters. These should only be used by the decoder plugins.
+
+// Number of threads that the decoder may use for one image. libheif already takes into account
+// how many images it decodes concurrently. Decoders that cannot change the number of threads
+// may ignore it.
+#define heif_decoder_parameter_name_threads "threads"
+
+
 enum heif_encoded_data_type
 {
   heif_encoded_data_type_HEVC_header = 1,
@@ -160,10 +241,11 @@ struct heif_encoder_plugin
   const char* (* get_plugin_name)();
 
   // Global plugin initialization (may be NULL)
+  // Called before the first encoder is created, not when the plugin is registered.
   void (* init_plugin)();
 
   // Global plugin cleanup (may be NULL).
-  // Free data that was allocated in init_plugin()
+  // Free data that was allocated in init_plugin(). Only called when init_plugin() has been called.
   void (* cleanup_plugin)();
 
   // Create a new decoder context for decoding an image
@@ -230,10 +312,50 @@ struct heif_encoder_plugin
   void (* query_encoded_size)(void* encoder, uint32_t input_width, uint32_t input_height,
                               uint32_t* encoded_width, uint32_t* encoded_height);
 
-  // --- version 4 functions will follow below ... ---
+  // --- version 4 ---
+
+  // Prepare the encoder for encoding another image with the same parameters.
+  // This is called after all compressed data of an image has been retrieved and allows libheif
+  // to keep encoder instances around and reuse them for further images (e.g. grid tiles)
+  // instead of allocating and configuring a new encoder for each image.
+  // Resources that are bound to the previous image should be released here.
+  // May be NULL if the encoder does not hold any per-image state.
+  void (* reset_image)(void* encoder);
+
+  // --- version 5 ---
+
+  // Returns the number of layers of the image that was encoded last, for codecs that support
+  // progressive coding (currently only AV1). When there is more than one layer, get_compressed_data()
+  // returns exactly one packet per layer, starting with the lowest quality layer.
+  // May be NULL if the encoder never codes layered images.
+  int (* get_number_of_layers)(void* encoder);
+
+  // --- version 6 ---
+
+  // Returns non-zero if the encoder can code monochrome (4:0:0) images without chroma planes.
+  // Monochrome images and alpha planes are then passed to encode_image() as they are, with
+  // heif_chroma_monochrome, instead of being converted to the format returned by query_input_colorspace2().
+  // May be NULL if the codec (or the way the plugin drives it) only supports images with chroma.
+  int (* supports_monochrome)(void* encoder);
+
+  // --- version 7 functions will follow below ... ---
 };
 
 
+// --- thread budget for encoder plugins
+
+// Reserve threads from the global encoder thread budget (see heif_set_encoder_thread_budget())
+// before starting the codec's worker threads. Returns the number of threads that the encoder should use,
+// which is between 1 and 'requested_threads'. Without a budget, 'requested_threads' is returned.
+// Each call has to be matched by a call to heif_encoder_release_threads() with the returned number
+// when the encoder has finished the image.
+LIBHEIF_API
+int heif_encoder_acquire_threads(int requested_threads);
+
+LIBHEIF_API
+void heif_encoder_release_threads(int threads);
+
+
 // Names for standard parameters. These should only be used by the encoder plugins.
 #define heif_encoder_parameter_name_quality  "quality"
 #define heif_encoder_parameter_name_lossless "lossless"
@@ -0,0 +1,154 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image_blending.h"
+#include "cpu_features.h"
+
+#if HEIF_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+// The kernels compute v / 255 for v <= 255*255 as (v + 1 + (v >> 8)) >> 8, which is exact
+// in this range and fits into 16 bits.
+
+void blend_row_8bit(const uint8_t* in, const uint8_t* alpha, uint8_t* out, int width)
+{
+  int x = 0;
+
+  const Blending_kernels& kernels = get_blending_kernels();
+  if (kernels.blend_8bit) {
+    x = kernels.blend_8bit(in, alpha, out, width);
+  }
+
+  for (; x < width; x++) {
+    out[x] = (uint8_t) ((in[x] * alpha[x] + out[x] * (255 - alpha[x])) / 255);
+  }
+}
+
+
+// --- SIMD kernels
+
+#if HEIF_HAVE_X86_SIMD
+
+HEIF_TARGET_SSE41
+static inline __m128i blend_8_sse41(__m128i in, __m128i alpha, __m128i out)
+{
+  const __m128i c255 = _mm_set1_epi16(255);
+  const __m128i c1 = _mm_set1_epi16(1);
+
+  __m128i v = _mm_add_epi16(_mm_mullo_epi16(in, alpha),
+                            _mm_mullo_epi16(out, _mm_sub_epi16(c255, alpha)));
+
+  return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, c1), _mm_srli_epi16(v, 8)), 8);
+}
+
+
+HEIF_TARGET_SSE41
+static int blend_row_8bit_sse41(const uint8_t* in, const uint8_t* alpha, uint8_t* out, int width)
+{
+  const __m128i zero = _mm_setzero_si128();
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i in_v = _mm_loadu_si128((const __m128i*) (in + x));
+    __m128i alpha_v = _mm_loadu_si128((const __m128i*) (alpha + x));
+    __m128i out_v = _mm_loadu_si128((const __m128i*) (out + x));
+
+    __m128i lo = blend_8_sse41(_mm_unpacklo_epi8(in_v, zero),
+                               _mm_unpacklo_epi8(alpha_v, zero),
+                               _mm_unpacklo_epi8(out_v, zero));
+    __m128i hi = blend_8_sse41(_mm_unpackhi_epi8(in_v, zero),
+                               _mm_unpackhi_epi8(alpha_v, zero),
+                               _mm_unpackhi_epi8(out_v, zero));
+
+    _mm_storeu_si128((__m128i*) (out + x), _mm_packus_epi16(lo, hi));
+  }
+
+  return x;
+}
+
+#endif
+
+
+#if HEIF_HAVE_NEON
+
+static inline uint8x8_t blend_8_neon(uint8x8_t in, uint8x8_t alpha, uint8x8_t out)
+{
+  uint16x8_t v = vmull_u8(in, alpha);
+  v = vmlal_u8(v, out, vsub_u8(vdup_n_u8(255), alpha));
+
+  return vshrn_n_u16(vaddq_u16(vaddq_u16(v, vdupq_n_u16(1)), vshrq_n_u16(v, 8)), 8);
+}
+
+
+static int blend_row_8bit_neon(const uint8_t* in, const uint8_t* alpha, uint8_t* out, int width)
+{
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t in_v = vld1q_u8(in + x);
+    uint8x16_t alpha_v = vld1q_u8(alpha + x);
+    uint8x16_t out_v = vld1q_u8(out + x);
+
+    uint8x8_t lo = blend_8_neon(vget_low_u8(in_v), vget_low_u8(alpha_v), vget_low_u8(out_v));
+    uint8x8_t hi = blend_8_neon(vget_high_u8(in_v), vget_high_u8(alpha_v), vget_high_u8(out_v));
+
+    vst1q_u8(out + x, vcombine_u8(lo, hi));
+  }
+
+  return x;
+}
+
+#endif
+
+
+static Blending_kernels select_blending_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  Blending_kernels kernels;
+
+#if HEIF_HAVE_X86_SIMD
+  if (cpu.sse41) {
+    kernels.blend_8bit = blend_row_8bit_sse41;
+  }
+#endif
+
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    kernels.blend_8bit = blend_row_8bit_neon;
+  }
+#endif
+
+  (void) cpu;
+
+  return kernels;
+}
+
+
+const Blending_kernels& get_blending_kernels()
+{
+  static const Blending_kernels kernels = select_blending_kernels();
+  return kernels;
+}
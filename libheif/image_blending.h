@@ -0,0 +1,44 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_IMAGE_BLENDING_H
+#define LIBHEIF_IMAGE_BLENDING_H
+
+#include <cstdint>
+
+
+// Blends 'width' 8-bit samples of 'in' over 'out', weighted with the 8-bit samples of 'alpha':
+//   out = (in * alpha + out * (255 - alpha)) / 255   (rounded down)
+void blend_row_8bit(const uint8_t* in, const uint8_t* alpha, uint8_t* out, int width);
+
+
+// Kernels process a prefix of the row and return the number of samples processed.
+// The remaining samples are blended by the scalar code.
+typedef int (* blend_row_8bit_kernel)(const uint8_t* in, const uint8_t* alpha, uint8_t* out, int width);
+
+struct Blending_kernels
+{
+  blend_row_8bit_kernel blend_8bit = nullptr;
+};
+
+// Row kernel for blending a sample row over another one. See cpu_features.h for the dispatch rules.
+const Blending_kernels& get_blending_kernels();
+
+#endif
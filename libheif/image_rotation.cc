@@ -0,0 +1,457 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image_rotation.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if HEIF_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+// The plane is processed in tiles of this size (in output pixels). The input of a tile covers
+// at most 64 cache lines per row/column, which stay in the cache while the tile is written.
+static const int kTileSize = 64;
+
+
+// --- scalar pixel copy
+
+typedef void (* copy_pixels_function)(const uint8_t* in, ptrdiff_t in_step_x, ptrdiff_t in_step_y,
+                                      uint8_t* out, ptrdiff_t out_stride,
+                                      int x_start, int y_start, int x_end, int y_end);
+
+template<int bytes_per_pixel>
+static void copy_pixels(const uint8_t* in, ptrdiff_t in_step_x, ptrdiff_t in_step_y,
+                        uint8_t* out, ptrdiff_t out_stride,
+                        int x_start, int y_start, int x_end, int y_end)
+{
+  for (int y = y_start; y < y_end; y++) {
+    const uint8_t* in_pixel = in + y * in_step_y + x_start * in_step_x;
+    uint8_t* out_pixel = out + y * out_stride + x_start * bytes_per_pixel;
+
+    for (int x = x_start; x < x_end; x++) {
+      memcpy(out_pixel, in_pixel, bytes_per_pixel);
+      out_pixel += bytes_per_pixel;
+      in_pixel += in_step_x;
+    }
+  }
+}
+
+
+static copy_pixels_function get_copy_pixels_function(int bytes_per_pixel)
+{
+  switch (bytes_per_pixel) {
+    case 1:
+      return copy_pixels<1>;
+    case 2:
+      return copy_pixels<2>;
+    case 3:
+      return copy_pixels<3>;
+    case 4:
+      return copy_pixels<4>;
+    case 6:
+      return copy_pixels<6>;
+    case 8:
+      return copy_pixels<8>;
+    case 12:
+      return copy_pixels<12>;
+    case 16:
+      return copy_pixels<16>;
+    default:
+      return nullptr;
+  }
+}
+
+
+// --- transform a band of output rows
+
+struct TransformParameters
+{
+  const uint8_t* in;
+  ptrdiff_t in_step_x;
+  ptrdiff_t in_step_y;
+  uint8_t* out;
+  ptrdiff_t out_stride;
+  int width;
+  int bytes_per_pixel;
+
+  copy_pixels_function copy;
+
+  // Set when the axes are swapped and there is a SIMD kernel for this pixel size.
+  transpose_block_kernel transpose;
+  int block_size;
+};
+
+
+// Transposes the block of output pixels [x, x+block_size) x [y, y+block_size).
+static void transpose_block(const TransformParameters& p, int x, int y)
+{
+  const int bpp = p.bytes_per_pixel;
+  const int n = p.block_size;
+
+  if (p.in_step_y > 0) {
+    // Each input row of the block is an output column.
+    p.transpose(p.in + x * p.in_step_x + y * p.in_step_y, p.in_step_x,
+                p.out + y * p.out_stride + x * bpp, p.out_stride);
+  }
+  else {
+    // The output rows run backwards through the input columns. Transpose the input block
+    // in memory order and write the output rows bottom to top.
+    p.transpose(p.in + x * p.in_step_x + (y + n - 1) * p.in_step_y, p.in_step_x,
+                p.out + (y + n - 1) * p.out_stride + x * bpp, -p.out_stride);
+  }
+}
+
+
+static void transform_band(const TransformParameters& p, int y_start, int y_end)
+{
+  const int bpp = p.bytes_per_pixel;
+
+  if (p.in_step_x == bpp) {
+    for (int y = y_start; y < y_end; y++) {
+      memcpy(p.out + y * p.out_stride, p.in + y * p.in_step_y, static_cast<size_t>(p.width) * bpp);
+    }
+    return;
+  }
+
+  if (!p.transpose && std::abs(p.in_step_y) != bpp) {
+    // Rows are mirrored. Input and output are both read/written sequentially.
+    p.copy(p.in, p.in_step_x, p.in_step_y, p.out, p.out_stride, 0, y_start, p.width, y_end);
+    return;
+  }
+
+  for (int ty = y_start; ty < y_end; ty += kTileSize) {
+    const int ty_end = std::min(ty + kTileSize, y_end);
+
+    for (int tx = 0; tx < p.width; tx += kTileSize) {
+      const int tx_end = std::min(tx + kTileSize, p.width);
+
+      int y = ty;
+
+      if (p.transpose) {
+        const int n = p.block_size;
+
+        for (; y + n <= ty_end; y += n) {
+          int x = tx;
+          for (; x + n <= tx_end; x += n) {
+            transpose_block(p, x, y);
+          }
+
+          p.copy(p.in, p.in_step_x, p.in_step_y, p.out, p.out_stride, x, y, tx_end, y + n);
+        }
+      }
+
+      p.copy(p.in, p.in_step_x, p.in_step_y, p.out, p.out_stride, tx, y, tx_end, ty_end);
+    }
+  }
+}
+
+
+void transform_plane(const uint8_t* in, ptrdiff_t in_step_x, ptrdiff_t in_step_y,
+                     uint8_t* out, ptrdiff_t out_stride,
+                     int width, int height, int bytes_per_pixel,
+                     ThreadPool* thread_pool)
+{
+  TransformParameters p{};
+  p.in = in;
+  p.in_step_x = in_step_x;
+  p.in_step_y = in_step_y;
+  p.out = out;
+  p.out_stride = out_stride;
+  p.width = width;
+  p.bytes_per_pixel = bytes_per_pixel;
+  p.copy = get_copy_pixels_function(bytes_per_pixel);
+  p.transpose = nullptr;
+
+  if (std::abs(in_step_y) == bytes_per_pixel) {
+    const Transpose_kernels& kernels = get_transpose_kernels();
+
+    switch (bytes_per_pixel) {
+      case 1:
+        p.transpose = kernels.transpose_8x8_8bit;
+        p.block_size = 8;
+        break;
+      case 2:
+        p.transpose = kernels.transpose_8x8_16bit;
+        p.block_size = 8;
+        break;
+      case 4:
+        p.transpose = kernels.transpose_4x4_32bit;
+        p.block_size = 4;
+        break;
+      default:
+        break;
+    }
+  }
+
+  int num_bands = 1;
+  if (thread_pool) {
+    num_bands = std::max(1, std::min((thread_pool->get_num_threads() + 1) * 2, height / kTileSize));
+  }
+
+  TaskGroup band_tasks(num_bands > 1 ? thread_pool : nullptr);
+
+  for (int band = 0; band < num_bands; band++) {
+    // Align the bands to the tiles.
+    int y_start = (int) ((int64_t) band * height / num_bands) / kTileSize * kTileSize;
+    int y_end = (band == num_bands - 1 ? height :
+                 (int) ((int64_t) (band + 1) * height / num_bands) / kTileSize * kTileSize);
+
+    band_tasks.run([=, &p]() {
+      transform_band(p, y_start, y_end);
+      return Error::Ok;
+    });
+  }
+
+  band_tasks.wait();
+}
+
+
+// --- SIMD kernels
+
+#if HEIF_HAVE_X86_SIMD
+
+HEIF_TARGET_SSE41
+static void transpose_8x8_8bit_sse41(const uint8_t* in, ptrdiff_t in_stride, uint8_t* out, ptrdiff_t out_stride)
+{
+  __m128i r0 = _mm_loadl_epi64((const __m128i*) (in + 0 * in_stride));
+  __m128i r1 = _mm_loadl_epi64((const __m128i*) (in + 1 * in_stride));
+  __m128i r2 = _mm_loadl_epi64((const __m128i*) (in + 2 * in_stride));
+  __m128i r3 = _mm_loadl_epi64((const __m128i*) (in + 3 * in_stride));
+  __m128i r4 = _mm_loadl_epi64((const __m128i*) (in + 4 * in_stride));
+  __m128i r5 = _mm_loadl_epi64((const __m128i*) (in + 5 * in_stride));
+  __m128i r6 = _mm_loadl_epi64((const __m128i*) (in + 6 * in_stride));
+  __m128i r7 = _mm_loadl_epi64((const __m128i*) (in + 7 * in_stride));
+
+  // pairs of rows
+  __m128i a0 = _mm_unpacklo_epi8(r0, r1);
+  __m128i a1 = _mm_unpacklo_epi8(r2, r3);
+  __m128i a2 = _mm_unpacklo_epi8(r4, r5);
+  __m128i a3 = _mm_unpacklo_epi8(r6, r7);
+
+  // columns 0-3 and 4-7 of rows 0-3 and 4-7
+  __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+  __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+  __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+  __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+  // two complete columns in each register
+  __m128i c0 = _mm_unpacklo_epi32(b0, b2);
+  __m128i c1 = _mm_unpackhi_epi32(b0, b2);
+  __m128i c2 = _mm_unpacklo_epi32(b1, b3);
+  __m128i c3 = _mm_unpackhi_epi32(b1, b3);
+
+  _mm_storel_epi64((__m128i*) (out + 0 * out_stride), c0);
+  _mm_storel_epi64((__m128i*) (out + 1 * out_stride), _mm_srli_si128(c0, 8));
+  _mm_storel_epi64((__m128i*) (out + 2 * out_stride), c1);
+  _mm_storel_epi64((__m128i*) (out + 3 * out_stride), _mm_srli_si128(c1, 8));
+  _mm_storel_epi64((__m128i*) (out + 4 * out_stride), c2);
+  _mm_storel_epi64((__m128i*) (out + 5 * out_stride), _mm_srli_si128(c2, 8));
+  _mm_storel_epi64((__m128i*) (out + 6 * out_stride), c3);
+  _mm_storel_epi64((__m128i*) (out + 7 * out_stride), _mm_srli_si128(c3, 8));
+}
+
+
+HEIF_TARGET_SSE41
+static void transpose_8x8_16bit_sse41(const uint8_t* in, ptrdiff_t in_stride, uint8_t* out, ptrdiff_t out_stride)
+{
+  __m128i r0 = _mm_loadu_si128((const __m128i*) (in + 0 * in_stride));
+  __m128i r1 = _mm_loadu_si128((const __m128i*) (in + 1 * in_stride));
+  __m128i r2 = _mm_loadu_si128((const __m128i*) (in + 2 * in_stride));
+  __m128i r3 = _mm_loadu_si128((const __m128i*) (in + 3 * in_stride));
+  __m128i r4 = _mm_loadu_si128((const __m128i*) (in + 4 * in_stride));
+  __m128i r5 = _mm_loadu_si128((const __m128i*) (in + 5 * in_stride));
+  __m128i r6 = _mm_loadu_si128((const __m128i*) (in + 6 * in_stride));
+  __m128i r7 = _mm_loadu_si128((const __m128i*) (in + 7 * in_stride));
+
+  __m128i a0 = _mm_unpacklo_epi16(r0, r1);
+  __m128i a1 = _mm_unpackhi_epi16(r0, r1);
+  __m128i a2 = _mm_unpacklo_epi16(r2, r3);
+  __m128i a3 = _mm_unpackhi_epi16(r2, r3);
+  __m128i a4 = _mm_unpacklo_epi16(r4, r5);
+  __m128i a5 = _mm_unpackhi_epi16(r4, r5);
+  __m128i a6 = _mm_unpacklo_epi16(r6, r7);
+  __m128i a7 = _mm_unpackhi_epi16(r6, r7);
+
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+  _mm_storeu_si128((__m128i*) (out + 0 * out_stride), _mm_unpacklo_epi64(b0, b4));
+  _mm_storeu_si128((__m128i*) (out + 1 * out_stride), _mm_unpackhi_epi64(b0, b4));
+  _mm_storeu_si128((__m128i*) (out + 2 * out_stride), _mm_unpacklo_epi64(b1, b5));
+  _mm_storeu_si128((__m128i*) (out + 3 * out_stride), _mm_unpackhi_epi64(b1, b5));
+  _mm_storeu_si128((__m128i*) (out + 4 * out_stride), _mm_unpacklo_epi64(b2, b6));
+  _mm_storeu_si128((__m128i*) (out + 5 * out_stride), _mm_unpackhi_epi64(b2, b6));
+  _mm_storeu_si128((__m128i*) (out + 6 * out_stride), _mm_unpacklo_epi64(b3, b7));
+  _mm_storeu_si128((__m128i*) (out + 7 * out_stride), _mm_unpackhi_epi64(b3, b7));
+}
+
+
+// Used for interleaved RGBA and 16-bit two-channel pixels.
+HEIF_TARGET_SSE41
+static void transpose_4x4_32bit_sse41(const uint8_t* in, ptrdiff_t in_stride, uint8_t* out, ptrdiff_t out_stride)
+{
+  __m128i r0 = _mm_loadu_si128((const __m128i*) (in + 0 * in_stride));
+  __m128i r1 = _mm_loadu_si128((const __m128i*) (in + 1 * in_stride));
+  __m128i r2 = _mm_loadu_si128((const __m128i*) (in + 2 * in_stride));
+  __m128i r3 = _mm_loadu_si128((const __m128i*) (in + 3 * in_stride));
+
+  __m128i a0 = _mm_unpacklo_epi32(r0, r1);
+  __m128i a1 = _mm_unpackhi_epi32(r0, r1);
+  __m128i a2 = _mm_unpacklo_epi32(r2, r3);
+  __m128i a3 = _mm_unpackhi_epi32(r2, r3);
+
+  _mm_storeu_si128((__m128i*) (out + 0 * out_stride), _mm_unpacklo_epi64(a0, a2));
+  _mm_storeu_si128((__m128i*) (out + 1 * out_stride), _mm_unpackhi_epi64(a0, a2));
+  _mm_storeu_si128((__m128i*) (out + 2 * out_stride), _mm_unpacklo_epi64(a1, a3));
+  _mm_storeu_si128((__m128i*) (out + 3 * out_stride), _mm_unpackhi_epi64(a1, a3));
+}
+
+#endif
+
+
+#if HEIF_HAVE_NEON
+
+static void transpose_8x8_8bit_neon(const uint8_t* in, ptrdiff_t in_stride, uint8_t* out, ptrdiff_t out_stride)
+{
+  uint8x8x2_t b0 = vtrn_u8(vld1_u8(in + 0 * in_stride), vld1_u8(in + 1 * in_stride));
+  uint8x8x2_t b1 = vtrn_u8(vld1_u8(in + 2 * in_stride), vld1_u8(in + 3 * in_stride));
+  uint8x8x2_t b2 = vtrn_u8(vld1_u8(in + 4 * in_stride), vld1_u8(in + 5 * in_stride));
+  uint8x8x2_t b3 = vtrn_u8(vld1_u8(in + 6 * in_stride), vld1_u8(in + 7 * in_stride));
+
+  uint16x4x2_t c0 = vtrn_u16(vreinterpret_u16_u8(b0.val[0]), vreinterpret_u16_u8(b1.val[0]));
+  uint16x4x2_t c1 = vtrn_u16(vreinterpret_u16_u8(b0.val[1]), vreinterpret_u16_u8(b1.val[1]));
+  uint16x4x2_t c2 = vtrn_u16(vreinterpret_u16_u8(b2.val[0]), vreinterpret_u16_u8(b3.val[0]));
+  uint16x4x2_t c3 = vtrn_u16(vreinterpret_u16_u8(b2.val[1]), vreinterpret_u16_u8(b3.val[1]));
+
+  uint32x2x2_t d0 = vtrn_u32(vreinterpret_u32_u16(c0.val[0]), vreinterpret_u32_u16(c2.val[0]));
+  uint32x2x2_t d1 = vtrn_u32(vreinterpret_u32_u16(c1.val[0]), vreinterpret_u32_u16(c3.val[0]));
+  uint32x2x2_t d2 = vtrn_u32(vreinterpret_u32_u16(c0.val[1]), vreinterpret_u32_u16(c2.val[1]));
+  uint32x2x2_t d3 = vtrn_u32(vreinterpret_u32_u16(c1.val[1]), vreinterpret_u32_u16(c3.val[1]));
+
+  vst1_u8(out + 0 * out_stride, vreinterpret_u8_u32(d0.val[0]));
+  vst1_u8(out + 1 * out_stride, vreinterpret_u8_u32(d1.val[0]));
+  vst1_u8(out + 2 * out_stride, vreinterpret_u8_u32(d2.val[0]));
+  vst1_u8(out + 3 * out_stride, vreinterpret_u8_u32(d3.val[0]));
+  vst1_u8(out + 4 * out_stride, vreinterpret_u8_u32(d0.val[1]));
+  vst1_u8(out + 5 * out_stride, vreinterpret_u8_u32(d1.val[1]));
+  vst1_u8(out + 6 * out_stride, vreinterpret_u8_u32(d2.val[1]));
+  vst1_u8(out + 7 * out_stride, vreinterpret_u8_u32(d3.val[1]));
+}
+
+
+static void transpose_8x8_16bit_neon(const uint8_t* in, ptrdiff_t in_stride, uint8_t* out, ptrdiff_t out_stride)
+{
+  uint16x8x2_t b0 = vtrnq_u16(vld1q_u16((const uint16_t*) (in + 0 * in_stride)),
+                              vld1q_u16((const uint16_t*) (in + 1 * in_stride)));
+  uint16x8x2_t b1 = vtrnq_u16(vld1q_u16((const uint16_t*) (in + 2 * in_stride)),
+                              vld1q_u16((const uint16_t*) (in + 3 * in_stride)));
+  uint16x8x2_t b2 = vtrnq_u16(vld1q_u16((const uint16_t*) (in + 4 * in_stride)),
+                              vld1q_u16((const uint16_t*) (in + 5 * in_stride)));
+  uint16x8x2_t b3 = vtrnq_u16(vld1q_u16((const uint16_t*) (in + 6 * in_stride)),
+                              vld1q_u16((const uint16_t*) (in + 7 * in_stride)));
+
+  // columns (0,4), (2,6), (1,5), (3,7) of rows 0-3 and 4-7
+  uint32x4x2_t c0 = vtrnq_u32(vreinterpretq_u32_u16(b0.val[0]), vreinterpretq_u32_u16(b1.val[0]));
+  uint32x4x2_t c1 = vtrnq_u32(vreinterpretq_u32_u16(b0.val[1]), vreinterpretq_u32_u16(b1.val[1]));
+  uint32x4x2_t c2 = vtrnq_u32(vreinterpretq_u32_u16(b2.val[0]), vreinterpretq_u32_u16(b3.val[0]));
+  uint32x4x2_t c3 = vtrnq_u32(vreinterpretq_u32_u16(b2.val[1]), vreinterpretq_u32_u16(b3.val[1]));
+
+  auto store = [out, out_stride](int row, uint32x4_t top, uint32x4_t bottom, bool high) {
+    uint32x4_t v = high ? vcombine_u32(vget_high_u32(top), vget_high_u32(bottom))
+                        : vcombine_u32(vget_low_u32(top), vget_low_u32(bottom));
+    vst1q_u16((uint16_t*) (out + row * out_stride), vreinterpretq_u16_u32(v));
+  };
+
+  store(0, c0.val[0], c2.val[0], false);
+  store(1, c1.val[0], c3.val[0], false);
+  store(2, c0.val[1], c2.val[1], false);
+  store(3, c1.val[1], c3.val[1], false);
+  store(4, c0.val[0], c2.val[0], true);
+  store(5, c1.val[0], c3.val[0], true);
+  store(6, c0.val[1], c2.val[1], true);
+  store(7, c1.val[1], c3.val[1], true);
+}
+
+
+static void transpose_4x4_32bit_neon(const uint8_t* in, ptrdiff_t in_stride, uint8_t* out, ptrdiff_t out_stride)
+{
+  uint32x4x2_t b0 = vtrnq_u32(vld1q_u32((const uint32_t*) (in + 0 * in_stride)),
+                              vld1q_u32((const uint32_t*) (in + 1 * in_stride)));
+  uint32x4x2_t b1 = vtrnq_u32(vld1q_u32((const uint32_t*) (in + 2 * in_stride)),
+                              vld1q_u32((const uint32_t*) (in + 3 * in_stride)));
+
+  vst1q_u32((uint32_t*) (out + 0 * out_stride), vcombine_u32(vget_low_u32(b0.val[0]), vget_low_u32(b1.val[0])));
+  vst1q_u32((uint32_t*) (out + 1 * out_stride), vcombine_u32(vget_low_u32(b0.val[1]), vget_low_u32(b1.val[1])));
+  vst1q_u32((uint32_t*) (out + 2 * out_stride), vcombine_u32(vget_high_u32(b0.val[0]), vget_high_u32(b1.val[0])));
+  vst1q_u32((uint32_t*) (out + 3 * out_stride), vcombine_u32(vget_high_u32(b0.val[1]), vget_high_u32(b1.val[1])));
+}
+
+#endif
+
+
+static Transpose_kernels select_transpose_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  Transpose_kernels kernels;
+
+#if HEIF_HAVE_X86_SIMD
+  if (cpu.sse41) {
+    kernels.transpose_8x8_8bit = transpose_8x8_8bit_sse41;
+    kernels.transpose_8x8_16bit = transpose_8x8_16bit_sse41;
+    kernels.transpose_4x4_32bit = transpose_4x4_32bit_sse41;
+  }
+#endif
+
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    kernels.transpose_8x8_8bit = transpose_8x8_8bit_neon;
+    kernels.transpose_8x8_16bit = transpose_8x8_16bit_neon;
+    kernels.transpose_4x4_32bit = transpose_4x4_32bit_neon;
+  }
+#endif
+
+  (void) cpu;
+
+  return kernels;
+}
+
+
+const Transpose_kernels& get_transpose_kernels()
+{
+  static const Transpose_kernels kernels = select_transpose_kernels();
+  return kernels;
+}
@@ -0,0 +1,58 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_IMAGE_ROTATION_H
+#define LIBHEIF_IMAGE_ROTATION_H
+
+#include <cstddef>
+#include <cstdint>
+
+class ThreadPool;
+
+
+// --- rotation and mirroring of a single image plane
+//
+// Copies 'width' x 'height' pixels of 'bytes_per_pixel' bytes each into 'out'. The input pixel of
+// the output pixel (x,y) is at in + x * in_step_x + y * in_step_y.
+// For rotations by 90 or 270 degrees, |in_step_y| is the pixel size and the plane is transposed in
+// small blocks, such that both the input and the output are accessed in cache-friendly order.
+// The output rows are split into bands that are processed in parallel on 'thread_pool' (may be NULL).
+
+void transform_plane(const uint8_t* in, ptrdiff_t in_step_x, ptrdiff_t in_step_y,
+                     uint8_t* out, ptrdiff_t out_stride,
+                     int width, int height, int bytes_per_pixel,
+                     ThreadPool* thread_pool);
+
+
+// Kernels that transpose a square block of pixels: out[y * out_stride + x] = in[x * in_stride + y].
+// The strides are in bytes and may be negative.
+typedef void (* transpose_block_kernel)(const uint8_t* in, ptrdiff_t in_stride, uint8_t* out, ptrdiff_t out_stride);
+
+struct Transpose_kernels
+{
+  transpose_block_kernel transpose_8x8_8bit = nullptr;
+  transpose_block_kernel transpose_8x8_16bit = nullptr;
+  transpose_block_kernel transpose_4x4_32bit = nullptr;
+};
+
+// Block transpose kernels for the 90 and 270 degree rotations. See cpu_features.h for the dispatch rules.
+const Transpose_kernels& get_transpose_kernels();
+
+#endif
@@ -0,0 +1,559 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image_scaling.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#if HEIF_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+// --- filter weights
+
+// Do not split the output into bands smaller than this. Each band has to filter the input rows
+// that it shares with its neighbors again.
+static const int kMinBandHeight = 32;
+
+
+static double sinc(double x)
+{
+  if (x == 0.0) {
+    return 1.0;
+  }
+
+  const double pi = 3.14159265358979323846;
+  x *= pi;
+  return std::sin(x) / x;
+}
+
+
+static double filter_radius(enum heif_scaling_filter filter)
+{
+  switch (filter) {
+    case heif_scaling_filter_lanczos3:
+      return 3.0;
+    default:
+      return 1.0;
+  }
+}
+
+
+static double filter_kernel(enum heif_scaling_filter filter, double x)
+{
+  x = std::fabs(x);
+
+  switch (filter) {
+    case heif_scaling_filter_bilinear:
+      return x < 1.0 ? 1.0 - x : 0.0;
+    case heif_scaling_filter_lanczos3:
+      return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    default:
+      assert(false);
+      return 0.0;
+  }
+}
+
+
+// The weights of all output samples along one axis. Every output sample is computed from the same
+// number of consecutive input samples, starting at 'first'. Unused taps have weight 0.
+struct FilterTaps
+{
+  int num_taps = 0;
+  std::vector<int> first;
+  std::vector<float> weights; // 'num_taps' weights for each output sample
+};
+
+
+static FilterTaps compute_filter_taps(int in_size, int out_size, enum heif_scaling_filter filter)
+{
+  const double scale = in_size / (double) out_size;
+
+  // input samples that contribute to each output sample, with the border samples repeated
+  std::vector<int> window_start(out_size);
+  std::vector<std::vector<double>> window_weights(out_size);
+
+  std::vector<std::pair<int, double>> contributions;
+
+  for (int i = 0; i < out_size; i++) {
+    contributions.clear();
+
+    if (filter == heif_scaling_filter_nearest_neighbor) {
+      contributions.emplace_back((int) ((int64_t) i * in_size / out_size), 1.0);
+    }
+    else if (filter == heif_scaling_filter_box) {
+      if (scale <= 1.0) {
+        contributions.emplace_back(std::min(in_size - 1, (int) ((i + 0.5) * scale)), 1.0);
+      }
+      else {
+        // area covered by the output sample
+        double x0 = i * scale;
+        double x1 = (i + 1) * scale;
+
+        for (int j = (int) std::floor(x0); j < x1 && j < in_size; j++) {
+          double w = std::min(j + 1.0, x1) - std::max((double) j, x0);
+          if (w > 0) {
+            contributions.emplace_back(j, w);
+          }
+        }
+      }
+    }
+    else {
+      // When scaling down, the filter is widened to cover all input samples of the output sample.
+      double filter_scale = std::max(scale, 1.0);
+      double support = filter_radius(filter) * filter_scale;
+      double center = (i + 0.5) * scale - 0.5;
+
+      int j0 = (int) std::floor(center - support);
+      int j1 = (int) std::ceil(center + support);
+
+      for (int j = j0; j <= j1; j++) {
+        double w = filter_kernel(filter, (j - center) / filter_scale);
+        if (w != 0.0) {
+          contributions.emplace_back(std::min(std::max(j, 0), in_size - 1), w);
+        }
+      }
+    }
+
+    int min_pos = in_size;
+    int max_pos = 0;
+    double sum = 0.0;
+    for (const auto& c : contributions) {
+      min_pos = std::min(min_pos, c.first);
+      max_pos = std::max(max_pos, c.first);
+      sum += c.second;
+    }
+
+    if (contributions.empty() || sum == 0.0) {
+      // cannot happen with the filters above, but make sure that the output is defined
+      min_pos = max_pos = std::min(in_size - 1, (int) ((int64_t) i * in_size / out_size));
+      contributions.assign(1, {min_pos, 1.0});
+      sum = 1.0;
+    }
+
+    window_start[i] = min_pos;
+    window_weights[i].assign(max_pos - min_pos + 1, 0.0);
+    for (const auto& c : contributions) {
+      window_weights[i][c.first - min_pos] += c.second / sum;
+    }
+  }
+
+
+  // --- convert to the same number of taps for all output samples
+
+  FilterTaps taps;
+
+  for (const auto& w : window_weights) {
+    taps.num_taps = std::max(taps.num_taps, (int) w.size());
+  }
+
+  taps.first.resize(out_size);
+  taps.weights.assign((size_t) out_size * taps.num_taps, 0.0f);
+
+  for (int i = 0; i < out_size; i++) {
+    int first = std::min(window_start[i], in_size - taps.num_taps);
+    int offset = window_start[i] - first;
+
+    taps.first[i] = first;
+    for (size_t k = 0; k < window_weights[i].size(); k++) {
+      taps.weights[(size_t) i * taps.num_taps + offset + k] = (float) window_weights[i][k];
+    }
+  }
+
+  return taps;
+}
+
+
+// --- row conversion
+
+static void load_row(const uint8_t* in, float* out, int num_samples, const ScalingPlaneFormat& format)
+{
+  if (format.bytes_per_sample == 1) {
+    for (int i = 0; i < num_samples; i++) {
+      out[i] = in[i];
+    }
+  }
+  else if (format.byte_order == ScalingPlaneFormat::ByteOrder::native) {
+    const auto* in16 = (const uint16_t*) in;
+    for (int i = 0; i < num_samples; i++) {
+      out[i] = in16[i];
+    }
+  }
+  else if (format.byte_order == ScalingPlaneFormat::ByteOrder::big_endian) {
+    for (int i = 0; i < num_samples; i++) {
+      out[i] = (float) ((in[2 * i] << 8) | in[2 * i + 1]);
+    }
+  }
+  else {
+    for (int i = 0; i < num_samples; i++) {
+      out[i] = (float) ((in[2 * i + 1] << 8) | in[2 * i]);
+    }
+  }
+}
+
+
+static void store_row(const float* in, uint8_t* out, int num_samples, const ScalingPlaneFormat& format)
+{
+  const float max_value = (float) ((1 << format.bit_depth) - 1);
+
+  for (int i = 0; i < num_samples; i++) {
+    // Lanczos overshoots at edges
+    float v = std::min(std::max(in[i], 0.0f), max_value);
+    auto value = (uint16_t) (v + 0.5f);
+
+    if (format.bytes_per_sample == 1) {
+      out[i] = (uint8_t) value;
+    }
+    else if (format.byte_order == ScalingPlaneFormat::ByteOrder::native) {
+      ((uint16_t*) out)[i] = value;
+    }
+    else if (format.byte_order == ScalingPlaneFormat::ByteOrder::big_endian) {
+      out[2 * i] = (uint8_t) (value >> 8);
+      out[2 * i + 1] = (uint8_t) (value & 0xFF);
+    }
+    else {
+      out[2 * i] = (uint8_t) (value & 0xFF);
+      out[2 * i + 1] = (uint8_t) (value >> 8);
+    }
+  }
+}
+
+
+// --- filter passes
+
+template<int NumComponents>
+static void filter_row_horizontal(const float* in, const FilterTaps& taps, float* out, int out_width, int first_x)
+{
+  const int num_taps = taps.num_taps;
+
+  for (int x = first_x; x < out_width; x++) {
+    const float* src = in + taps.first[x] * NumComponents;
+    const float* w = &taps.weights[(size_t) x * num_taps];
+
+    for (int c = 0; c < NumComponents; c++) {
+      float sum = 0.0f;
+      for (int k = 0; k < num_taps; k++) {
+        sum += w[k] * src[k * NumComponents + c];
+      }
+
+      out[x * NumComponents + c] = sum;
+    }
+  }
+}
+
+
+static void filter_row_horizontal(const float* in, const FilterTaps& taps, float* out, int out_width,
+                                  int num_components, const Scaling_kernels& kernels)
+{
+  switch (num_components) {
+    case 1:
+      filter_row_horizontal<1>(in, taps, out, out_width, 0);
+      break;
+    case 2:
+      filter_row_horizontal<2>(in, taps, out, out_width, 0);
+      break;
+    case 3:
+      filter_row_horizontal<3>(in, taps, out, out_width, 0);
+      break;
+    case 4: {
+      int x = 0;
+      if (kernels.horizontal_4) {
+        x = kernels.horizontal_4(in, taps.first.data(), taps.weights.data(), taps.num_taps, out, out_width);
+      }
+
+      filter_row_horizontal<4>(in, taps, out, out_width, x);
+      break;
+    }
+    default:
+      assert(false);
+  }
+}
+
+
+static void filter_row_vertical(const float* const* rows, const float* weights, int num_taps,
+                                float* out, int width, const Scaling_kernels& kernels)
+{
+  int x = 0;
+  if (kernels.vertical) {
+    x = kernels.vertical(rows, weights, num_taps, out, width);
+  }
+
+  for (; x < width; x++) {
+    float sum = 0.0f;
+    for (int k = 0; k < num_taps; k++) {
+      sum += weights[k] * rows[k][x];
+    }
+
+    out[x] = sum;
+  }
+}
+
+
+// Computes the output rows [y_start, y_end).
+// The horizontally filtered input rows are kept in a ring buffer with one row per vertical tap.
+// Since the input windows of successive output rows only move down, each input row of the band
+// is filtered horizontally only once.
+static void scale_band(const uint8_t* in_data, size_t in_stride, int in_width,
+                       uint8_t* out_data, size_t out_stride, int out_width,
+                       int y_start, int y_end,
+                       const FilterTaps& horizontal_taps, const FilterTaps& vertical_taps,
+                       const ScalingPlaneFormat& format, const Scaling_kernels& kernels)
+{
+  const int nc = format.num_components;
+  const int num_taps = vertical_taps.num_taps;
+  const size_t out_row_size = (size_t) out_width * nc;
+
+  std::vector<float> input_row((size_t) in_width * nc);
+  std::vector<float> ring(num_taps * out_row_size);
+  std::vector<int> ring_rows(num_taps, -1);
+  std::vector<const float*> rows(num_taps);
+  std::vector<float> output_row(out_row_size);
+
+  for (int y = y_start; y < y_end; y++) {
+    for (int k = 0; k < num_taps; k++) {
+      int r = vertical_taps.first[y] + k;
+      int slot = r % num_taps;
+      float* slot_data = ring.data() + slot * out_row_size;
+
+      if (ring_rows[slot] != r) {
+        load_row(in_data + (size_t) r * in_stride, input_row.data(), in_width * nc, format);
+        filter_row_horizontal(input_row.data(), horizontal_taps, slot_data, out_width, nc, kernels);
+        ring_rows[slot] = r;
+      }
+
+      rows[k] = slot_data;
+    }
+
+    filter_row_vertical(rows.data(), &vertical_taps.weights[(size_t) y * num_taps], num_taps,
+                        output_row.data(), (int) out_row_size, kernels);
+
+    store_row(output_row.data(), out_data + (size_t) y * out_stride, (int) out_row_size, format);
+  }
+}
+
+
+Error scale_plane(const uint8_t* in_data, size_t in_stride, int in_width, int in_height,
+                  uint8_t* out_data, size_t out_stride, int out_width, int out_height,
+                  const ScalingPlaneFormat& format,
+                  enum heif_scaling_filter filter,
+                  ThreadPool* thread_pool)
+{
+  if (in_width <= 0 || in_height <= 0 || out_width <= 0 || out_height <= 0) {
+    return Error(heif_error_Usage_error, heif_suberror_Invalid_image_size);
+  }
+
+  if (format.num_components < 1 || format.num_components > 4) {
+    return Error(heif_error_Unsupported_feature, heif_suberror_Unspecified,
+                 "Unsupported number of interleaved components for scaling");
+  }
+
+  switch (filter) {
+    case heif_scaling_filter_nearest_neighbor:
+    case heif_scaling_filter_box:
+    case heif_scaling_filter_bilinear:
+    case heif_scaling_filter_lanczos3:
+      break;
+    default:
+      return Error(heif_error_Usage_error, heif_suberror_Invalid_parameter_value, "Unknown scaling filter");
+  }
+
+  const FilterTaps horizontal_taps = compute_filter_taps(in_width, out_width, filter);
+  const FilterTaps vertical_taps = compute_filter_taps(in_height, out_height, filter);
+
+  const Scaling_kernels& kernels = get_scaling_kernels();
+
+  int num_bands = 1;
+  if (thread_pool) {
+    num_bands = std::max(1, std::min((thread_pool->get_num_threads() + 1) * 2, out_height / kMinBandHeight));
+  }
+
+  TaskGroup band_tasks(num_bands > 1 ? thread_pool : nullptr);
+
+  for (int band = 0; band < num_bands; band++) {
+    int y_start = (int) ((int64_t) band * out_height / num_bands);
+    int y_end = (int) ((int64_t) (band + 1) * out_height / num_bands);
+
+    band_tasks.run([=, &horizontal_taps, &vertical_taps, &format, &kernels]() {
+      scale_band(in_data, in_stride, in_width,
+                 out_data, out_stride, out_width,
+                 y_start, y_end,
+                 horizontal_taps, vertical_taps, format, kernels);
+      return Error::Ok;
+    });
+  }
+
+  return band_tasks.wait();
+}
+
+
+// --- SIMD kernels
+
+#if HEIF_HAVE_X86_SIMD
+
+HEIF_TARGET_SSE41
+static int scale_vertical_sse41(const float* const* rows, const float* weights, int num_taps,
+                                float* out, int width)
+{
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128 sum = _mm_setzero_ps();
+    for (int k = 0; k < num_taps; k++) {
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + x)));
+    }
+
+    _mm_storeu_ps(out + x, sum);
+  }
+
+  return x;
+}
+
+
+// One pixel with 4 components fits exactly into a vector.
+HEIF_TARGET_SSE41
+static int scale_horizontal_4_sse41(const float* in, const int* first, const float* weights, int num_taps,
+                                    float* out, int width)
+{
+  for (int x = 0; x < width; x++) {
+    const float* src = in + 4 * first[x];
+    const float* w = weights + (size_t) x * num_taps;
+
+    __m128 sum = _mm_setzero_ps();
+    for (int k = 0; k < num_taps; k++) {
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(src + 4 * k)));
+    }
+
+    _mm_storeu_ps(out + 4 * x, sum);
+  }
+
+  return width;
+}
+
+#endif
+
+
+#if HEIF_HAVE_X86_AVX
+
+HEIF_TARGET_AVX2
+static int scale_vertical_avx2(const float* const* rows, const float* weights, int num_taps,
+                               float* out, int width)
+{
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256 sum = _mm256_setzero_ps();
+    for (int k = 0; k < num_taps; k++) {
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(rows[k] + x)));
+    }
+
+    _mm256_storeu_ps(out + x, sum);
+  }
+
+  return x;
+}
+
+#endif
+
+
+#if HEIF_HAVE_NEON
+
+static int scale_vertical_neon(const float* const* rows, const float* weights, int num_taps,
+                               float* out, int width)
+{
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int k = 0; k < num_taps; k++) {
+      sum = vaddq_f32(sum, vmulq_n_f32(vld1q_f32(rows[k] + x), weights[k]));
+    }
+
+    vst1q_f32(out + x, sum);
+  }
+
+  return x;
+}
+
+
+static int scale_horizontal_4_neon(const float* in, const int* first, const float* weights, int num_taps,
+                                   float* out, int width)
+{
+  for (int x = 0; x < width; x++) {
+    const float* src = in + 4 * first[x];
+    const float* w = weights + (size_t) x * num_taps;
+
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int k = 0; k < num_taps; k++) {
+      sum = vaddq_f32(sum, vmulq_n_f32(vld1q_f32(src + 4 * k), w[k]));
+    }
+
+    vst1q_f32(out + 4 * x, sum);
+  }
+
+  return width;
+}
+
+#endif
+
+
+static Scaling_kernels select_scaling_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  Scaling_kernels kernels;
+
+#if HEIF_HAVE_X86_SIMD
+  if (cpu.sse41) {
+    kernels.vertical = scale_vertical_sse41;
+    kernels.horizontal_4 = scale_horizontal_4_sse41;
+  }
+#endif
+
+#if HEIF_HAVE_X86_AVX
+  if (cpu.avx2) {
+    kernels.vertical = scale_vertical_avx2;
+  }
+#endif
+
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    kernels.vertical = scale_vertical_neon;
+    kernels.horizontal_4 = scale_horizontal_4_neon;
+  }
+#endif
+
+  (void) cpu;
+
+  return kernels;
+}
+
+
+const Scaling_kernels& get_scaling_kernels()
+{
+  static const Scaling_kernels kernels = select_scaling_kernels();
+  return kernels;
+}
@@ -0,0 +1,81 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_IMAGE_SCALING_H
+#define LIBHEIF_IMAGE_SCALING_H
+
+#include "heif.h"
+#include "error.h"
+
+#include <cstdint>
+
+class ThreadPool;
+
+
+// --- separable filtered scaling of a single image plane
+//
+// The plane is first filtered horizontally, then vertically. Both passes work on 32-bit float
+// samples, such that 8-bit and 16-bit planes are handled by the same kernels.
+// At the image borders, the border samples are repeated.
+
+struct ScalingPlaneFormat
+{
+  enum class ByteOrder
+  {
+    native, little_endian, big_endian
+  };
+
+  int num_components = 1; // interleaved components per pixel (1 to 4)
+  int bytes_per_sample = 1; // 1 or 2
+  int bit_depth = 8;
+  ByteOrder byte_order = ByteOrder::native; // only for 16-bit samples
+};
+
+// The output rows are split into bands that are scaled in parallel on 'thread_pool' (may be NULL).
+// heif_scaling_filter_nearest_neighbor picks the same input samples as HeifPixelImage::scale_nearest_neighbor().
+Error scale_plane(const uint8_t* in_data, size_t in_stride, int in_width, int in_height,
+                  uint8_t* out_data, size_t out_stride, int out_width, int out_height,
+                  const ScalingPlaneFormat& format,
+                  enum heif_scaling_filter filter,
+                  ThreadPool* thread_pool);
+
+
+// Kernels for the vertical pass: out[x] = sum_k weights[k] * rows[k][x].
+// They return the number of output samples that were computed. The remaining samples have to be
+// computed by the caller.
+typedef int (* vertical_scaling_kernel)(const float* const* rows, const float* weights, int num_taps,
+                                        float* out, int width);
+
+// Kernels for the horizontal pass of 4-component pixels. For each output pixel x, the 'num_taps'
+// input pixels starting at first[x] are weighted with weights[x * num_taps + k].
+// They return the number of output pixels that were computed.
+typedef int (* horizontal_scaling_kernel_4)(const float* in, const int* first, const float* weights, int num_taps,
+                                            float* out, int width);
+
+struct Scaling_kernels
+{
+  vertical_scaling_kernel vertical = nullptr;
+  horizontal_scaling_kernel_4 horizontal_4 = nullptr;
+};
+
+// Vertical and horizontal filter kernels for the image scaling. See cpu_features.h for the dispatch rules.
+const Scaling_kernels& get_scaling_kernels();
+
+#endif
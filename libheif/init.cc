@@ -24,6 +24,11 @@
 #include "plugin_registry.h"
 #include "common_utils.h"
 #include "libheif/color-conversion/colorconversion.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <atomic>
 
 #if ENABLE_MULTITHREADING_SUPPORT
 #include <mutex>
@@ -65,6 +70,12 @@ std::vector<std::string> list_all_potential_plugins_in_directory(const char* dir
 static int heif_library_initialization_count = 0;
 static bool default_plugins_registered = true; // because they are implicitly registered at startup
 
+#if ENABLE_PLUGIN_LOADING
+// With lazy plugin loading, the plugins in these directories are loaded when a codec is needed for the first time.
+static std::vector<std::string> s_deferred_plugin_directories;
+static std::atomic<bool> s_have_deferred_plugins{false};
+#endif
+
 
 #if ENABLE_MULTITHREADING_SUPPORT
 static std::recursive_mutex& heif_init_mutex()
@@ -74,7 +85,7 @@ static std::recursive_mutex& heif_init_mutex()
 }
 #endif
 
-struct heif_error heif_init(struct heif_init_params*)
+struct heif_error heif_init(struct heif_init_params* params)
 {
 #if ENABLE_MULTITHREADING_SUPPORT
   std::lock_guard<std::recursive_mutex> lock(heif_init_mutex());
@@ -84,7 +95,9 @@ struct heif_error heif_init(struct heif_init_params*)
 
   if (heif_library_initialization_count == 1) {
 
-    ColorConversionPipeline::init_ops();
+    if (getenv("LIBHEIF_CALIBRATE_COLOR_CONVERSION")) {
+      ColorConversionPipeline::calibrate_speed_costs();
+    }
 
     // --- initialize builtin plugins
 
@@ -93,25 +106,30 @@ struct heif_error heif_init(struct heif_init_params*)
     }
 
 #if ENABLE_PLUGIN_LOADING
-    struct heif_error err{};
     std::vector<std::string> plugin_paths = get_plugin_paths();
 
     if (plugin_paths.empty()) {
       // --- load plugins from default directory
 
-      err = heif_load_plugins(LIBHEIF_PLUGIN_DIRECTORY, nullptr, nullptr, 0);
-      if (err.code != 0) {
-        return err;
-      }
+      plugin_paths.emplace_back(LIBHEIF_PLUGIN_DIRECTORY);
+    }
+
+    bool lazy_plugin_loading = (params && params->version >= 2 && params->lazy_plugin_loading);
+
+    if (lazy_plugin_loading) {
+      s_deferred_plugin_directories = plugin_paths;
+      s_have_deferred_plugins.store(true, std::memory_order_release);
     }
     else {
       for (const auto& dir : plugin_paths) {
-        err = heif_load_plugins(dir.c_str(), nullptr, nullptr, 0);
+        struct heif_error err = heif_load_plugins(dir.c_str(), nullptr, nullptr, 0);
         if (err.code != 0) {
           return err;
         }
       }
     }
+#else
+    (void) params;
 #endif
   }
 
@@ -119,22 +137,48 @@ struct heif_error heif_init(struct heif_init_params*)
 }
 
 
+void load_deferred_plugins()
+{
+#if ENABLE_PLUGIN_LOADING
+  if (!s_have_deferred_plugins.load(std::memory_order_acquire)) {
+    return;
+  }
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::recursive_mutex> lock(heif_init_mutex());
+#endif
+
+  // another thread may have loaded the plugins while we were waiting for the lock
+  if (!s_have_deferred_plugins.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  std::vector<std::string> directories;
+  std::swap(directories, s_deferred_plugin_directories);
+
+  for (const auto& dir : directories) {
+    heif_load_plugins(dir.c_str(), nullptr, nullptr, 0);
+  }
+
+  s_have_deferred_plugins.store(false, std::memory_order_release);
+#endif
+}
+
+
 static void heif_unregister_decoder_plugins()
 {
   for (const auto* plugin : s_decoder_plugins) {
-    if (plugin->deinit_plugin) {
-      (*plugin->deinit_plugin)();
-    }
+    deinitialize_decoder_plugin(plugin);
   }
   s_decoder_plugins.clear();
+
+  invalidate_decoder_cache();
 }
 
 static void heif_unregister_encoder_plugins()
 {
   for (const auto& plugin : s_encoder_descriptors) {
-    if (plugin->plugin->cleanup_plugin) {
-      (*plugin->plugin->cleanup_plugin)();
-    }
+    deinitialize_encoder_plugin(plugin->plugin);
   }
   s_encoder_descriptors.clear();
 }
@@ -142,9 +186,7 @@ static void heif_unregister_encoder_plugins()
 #if ENABLE_PLUGIN_LOADING
 void heif_unregister_encoder_plugin(const heif_encoder_plugin* plugin)
 {
-  if (plugin->cleanup_plugin) {
-    (*plugin->cleanup_plugin)();
-  }
+  deinitialize_encoder_plugin(plugin);
 
   for (auto iter = s_encoder_descriptors.begin() ; iter != s_encoder_descriptors.end(); ++iter) {
     if ((*iter)->plugin == plugin) {
@@ -169,6 +211,11 @@ void heif_deinit()
   heif_library_initialization_count--;
 
   if (heif_library_initialization_count == 0) {
+#if ENABLE_PLUGIN_LOADING
+    s_deferred_plugin_directories.clear();
+    s_have_deferred_plugins.store(false, std::memory_order_release);
+#endif
+
     heif_unregister_decoder_plugins();
     heif_unregister_encoder_plugins();
     default_plugins_registered = false;
@@ -180,6 +227,43 @@ void heif_deinit()
 }
 
 
+void heif_calibrate_color_conversion(void)
+{
+  ColorConversionPipeline::calibrate_speed_costs();
+}
+
+
+char* heif_get_color_conversion_calibration(void)
+{
+  std::string profile = ColorConversionPipeline::get_speed_cost_profile();
+  if (profile.empty()) {
+    return nullptr;
+  }
+
+  char* str = new char[profile.size() + 1];
+  strcpy(str, profile.c_str());
+  return str;
+}
+
+
+void heif_release_color_conversion_calibration(char* profile)
+{
+  delete[] profile;
+}
+
+
+struct heif_error heif_load_color_conversion_calibration(const char* profile)
+{
+  if (profile == nullptr) {
+    ColorConversionPipeline::reset_speed_costs();
+    return Error::Ok.error_struct(nullptr);
+  }
+
+  Error err = ColorConversionPipeline::load_speed_cost_profile(profile);
+  return err.error_struct(nullptr);
+}
+
+
 // This could be inside ENABLE_PLUGIN_LOADING, but the "include-what-you-use" checker cannot process this.
 #include <vector>
 #include <string>
@@ -28,8 +28,9 @@ extern heif_error error_dlopen;
 extern heif_error error_plugin_not_loaded;
 extern heif_error error_cannot_read_plugin_directory;
 
-// TODO: later, we might defer the default plugin initialization to when they are actually used for the first time.
-// That would prevent them from being initialized every time at program start, even when the application software uses heif_init() later on.
+// When heif_init() was called with lazy plugin loading, this loads the plugins from the plugin directories.
+// It is called before the registered codecs are queried. Subsequent calls have no effect.
+void load_deferred_plugins();
 
 // Note: the loaded plugin is not released automatically then the class is released, because this would require that
 // we reference-count the handle. We do not really need this since releasing the library explicitly with release() is simple enough.
@@ -0,0 +1,196 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jpeg.h"
+#include "exif.h"
+
+#include <cstring>
+#include <map>
+
+
+static const uint8_t JPEG_SOI = 0xD8;
+static const uint8_t JPEG_EOI = 0xD9;
+static const uint8_t JPEG_SOS = 0xDA;
+static const uint8_t JPEG_TEM = 0x01;
+static const uint8_t JPEG_APP1 = 0xE1;
+static const uint8_t JPEG_APP2 = 0xE2;
+
+
+static bool is_standalone_marker(uint8_t marker)
+{
+  return marker == JPEG_SOI || marker == JPEG_TEM || (marker >= 0xD0 && marker <= 0xD7); // RSTn
+}
+
+
+static bool is_frame_header_marker(uint8_t marker)
+{
+  // 0xC4 (DHT), 0xC8 (JPG) and 0xCC (DAC) are in the range of the SOFn markers, but are no frame headers.
+  return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+
+static bool is_supported_coding_process(uint8_t sof_marker)
+{
+  switch (sof_marker) {
+    case 0xC0: // baseline
+    case 0xC1: // extended sequential
+    case 0xC2: // progressive
+    case 0xC9: // extended sequential, arithmetic coding
+    case 0xCA: // progressive, arithmetic coding
+      return true;
+    default: // lossless and hierarchical
+      return false;
+  }
+}
+
+
+Error parse_jpeg_headers(const uint8_t* data, size_t size, JpegHeaderInfo& out_info)
+{
+  out_info = JpegHeaderInfo();
+
+  if (size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Unspecified,
+                 "Data is no JPEG file");
+  }
+
+  static const char icc_signature[] = "ICC_PROFILE";  // including the terminating zero
+  static const char exif_signature[] = "Exif\0";      // followed by a second zero
+
+  std::map<int, std::vector<uint8_t>> icc_chunks;
+  int num_icc_chunks = 0;
+  bool has_frame_header = false;
+
+  size_t pos = 2;
+  while (pos + 2 <= size) {
+    if (data[pos] != 0xFF) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Unspecified,
+                   "Invalid JPEG marker");
+    }
+
+    uint8_t marker = data[pos + 1];
+    if (marker == 0xFF) {
+      pos++; // fill byte
+      continue;
+    }
+
+    if (is_standalone_marker(marker)) {
+      pos += 2;
+      continue;
+    }
+
+    if (marker == JPEG_SOS || marker == JPEG_EOI) {
+      break;
+    }
+
+    if (pos + 4 > size) {
+      break;
+    }
+
+    size_t segment_size = (static_cast<size_t>(data[pos + 2]) << 8) | data[pos + 3];
+    if (segment_size < 2 || pos + 2 + segment_size > size) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_End_of_data,
+                   "JPEG marker segment exceeds the end of the data");
+    }
+
+    const uint8_t* payload = data + pos + 4;
+    size_t payload_size = segment_size - 2;
+
+    if (is_frame_header_marker(marker) && !has_frame_header) {
+      if (payload_size < 6) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_End_of_data,
+                     "JPEG frame header too short");
+      }
+
+      if (!is_supported_coding_process(marker)) {
+        return Error(heif_error_Unsupported_feature,
+                     heif_suberror_Unsupported_codec,
+                     "Lossless and hierarchical JPEG files are not supported");
+      }
+
+      out_info.bit_depth = payload[0];
+      out_info.height = (static_cast<uint32_t>(payload[1]) << 8) | payload[2];
+      out_info.width = (static_cast<uint32_t>(payload[3]) << 8) | payload[4];
+      out_info.num_components = payload[5];
+      has_frame_header = true;
+    }
+    else if (marker == JPEG_APP1 &&
+             payload_size > sizeof(exif_signature) &&
+             memcmp(payload, exif_signature, sizeof(exif_signature)) == 0) {
+      const uint8_t* exif = payload + sizeof(exif_signature);
+      int orientation = read_exif_orientation_tag(exif, static_cast<int>(payload_size - sizeof(exif_signature)));
+      if (orientation >= 1 && orientation <= 8) {
+        out_info.orientation = static_cast<heif_orientation>(orientation);
+      }
+    }
+    else if (marker == JPEG_APP2 &&
+             payload_size >= sizeof(icc_signature) + 2 &&
+             memcmp(payload, icc_signature, sizeof(icc_signature)) == 0) {
+      // The profile may be split into several segments, each with its 1-based sequence number and the count.
+      int sequence_number = payload[sizeof(icc_signature)];
+      num_icc_chunks = payload[sizeof(icc_signature) + 1];
+      icc_chunks[sequence_number].assign(payload + sizeof(icc_signature) + 2, payload + payload_size);
+    }
+
+    pos += 2 + segment_size;
+  }
+
+  if (!has_frame_header) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Unspecified,
+                 "JPEG file has no frame header");
+  }
+
+  if (out_info.width == 0 || out_info.height == 0) {
+    // A height of 0 would be defined by a DNL marker after the first scan.
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Invalid_image_size,
+                 "JPEG image size is not defined in the frame header");
+  }
+
+  if (out_info.bit_depth != 8) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_bit_depth,
+                 "Only 8-bit JPEG files are supported");
+  }
+
+  if (out_info.num_components != 1 && out_info.num_components != 3) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_color_conversion,
+                 "Only grayscale and YCbCr JPEG files are supported");
+  }
+
+  if (num_icc_chunks > 0 && icc_chunks.size() == static_cast<size_t>(num_icc_chunks)) {
+    for (int i = 1; i <= num_icc_chunks; i++) {
+      auto chunk = icc_chunks.find(i);
+      if (chunk == icc_chunks.end()) {
+        out_info.icc_profile.clear();
+        break;
+      }
+
+      out_info.icc_profile.insert(out_info.icc_profile.end(), chunk->second.begin(), chunk->second.end());
+    }
+  }
+
+  return Error::Ok;
+}
@@ -0,0 +1,52 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_JPEG_H
+#define LIBHEIF_JPEG_H
+
+#include "heif.h"
+#include "error.h"
+
+#include <cstdint>
+#include <vector>
+
+
+// Information from the marker segments of a JPEG file that is stored as a 'jpeg' item
+// without decoding it.
+struct JpegHeaderInfo
+{
+  uint32_t width = 0;
+  uint32_t height = 0;
+  int bit_depth = 0;
+  int num_components = 0;
+
+  // Assembled from the APP2 'ICC_PROFILE' segments. Empty if there is none or a part is missing.
+  std::vector<uint8_t> icc_profile;
+
+  // From the Exif data in the APP1 segment.
+  heif_orientation orientation = heif_orientation_normal;
+};
+
+
+// Parses the marker segments up to the first scan. Only 8-bit grayscale and YCbCr images coded with
+// the sequential or progressive DCT process are accepted, since these can be decoded by the JPEG decoders.
+Error parse_jpeg_headers(const uint8_t* data, size_t size, JpegHeaderInfo& out_info);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memory_arena.h"
+
+
+void* MemoryArena::allocate(size_t size, size_t alignment)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  if (size == 0) {
+    size = 1;
+  }
+
+  // Blocks returned by new[] are aligned for all fundamental types.
+  if (alignment > alignof(std::max_align_t)) {
+    throw std::bad_alloc();
+  }
+
+  size_t padding = (alignment - reinterpret_cast<uintptr_t>(m_current) % alignment) % alignment;
+
+  if (m_current == nullptr || padding + size > m_current_remaining) {
+    // Large allocations get a block of their own so that the remainder of the current block is kept.
+    if (size > block_size / 4) {
+      m_blocks.push_back(std::unique_ptr<uint8_t[]>(new uint8_t[size]));
+      m_allocated_bytes += size;
+      return m_blocks.back().get();
+    }
+
+    m_blocks.push_back(std::unique_ptr<uint8_t[]>(new uint8_t[block_size]));
+    m_current = m_blocks.back().get();
+    m_current_remaining = block_size;
+    m_allocated_bytes += block_size;
+    padding = 0;
+  }
+
+  uint8_t* mem = m_current + padding;
+  m_current += padding + size;
+  m_current_remaining -= padding + size;
+
+  return mem;
+}
@@ -0,0 +1,118 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_MEMORY_ARENA_H
+#define LIBHEIF_MEMORY_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
+
+// Monotonic memory arena. Memory is taken from large blocks and is never released individually.
+// All blocks are freed together when the arena is destroyed.
+// The arena is thread-safe.
+class MemoryArena
+{
+public:
+  MemoryArena() = default;
+
+  MemoryArena(const MemoryArena&) = delete;
+
+  MemoryArena& operator=(const MemoryArena&) = delete;
+
+  // Throws std::bad_alloc if the memory cannot be allocated.
+  void* allocate(size_t size, size_t alignment);
+
+  size_t get_allocated_bytes() const { return m_allocated_bytes; }
+
+private:
+  static const size_t block_size = 64 * 1024;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::mutex m_mutex;
+#endif
+
+  std::vector<std::unique_ptr<uint8_t[]>> m_blocks;
+
+  uint8_t* m_current = nullptr;
+  size_t m_current_remaining = 0;
+
+  size_t m_allocated_bytes = 0;
+};
+
+
+// Standard allocator that takes its memory from a MemoryArena.
+// Objects created with std::allocate_shared() keep the arena alive with the copy of the allocator
+// stored in their control block. Thus, the arena is released when the last object is destroyed.
+template<class T>
+class ArenaAllocator
+{
+public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(std::shared_ptr<MemoryArena> arena) : m_arena(std::move(arena)) {}
+
+  template<class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.get_arena()) {}
+
+  T* allocate(size_t n)
+  {
+    if (n > SIZE_MAX / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+
+    return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, size_t) {}
+
+  const std::shared_ptr<MemoryArena>& get_arena() const { return m_arena; }
+
+private:
+  std::shared_ptr<MemoryArena> m_arena;
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.get_arena() == b.get_arena(); }
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.get_arena() != b.get_arena(); }
+
+
+// Create the object in the arena, or on the heap if no arena is given.
+template<class T, class... Args>
+std::shared_ptr<T> make_shared_in_arena(const std::shared_ptr<MemoryArena>& arena, Args&& ... args)
+{
+  if (arena) {
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+  }
+  else {
+    return std::make_shared<T>(std::forward<Args>(args)...);
+  }
+}
+
+#endif
@@ -22,115 +22,320 @@
 #include "metadata_compression.h"
 
 
-#if WITH_DEFLATE_HEADER_COMPRESSION
+#if HAVE_ZLIB
 #include <zlib.h>
 #include <cstring>
+#include <climits>
+#include <algorithm>
+#endif
+
+#if HAVE_BROTLI
+#include <brotli/encode.h>
+#include <brotli/decode.h>
+#endif
 
-std::vector<uint8_t> deflate(const uint8_t* input, int size)
+
+#if HAVE_ZLIB
+
+Inflater::Inflater(Format format, size_t max_output_size)
+    : m_fixed_output(false),
+      m_max_output_size(max_output_size)
 {
-  std::vector<uint8_t> output;
+  init(format);
+}
 
-  // initialize compressor
 
-  const int outBufferSize = 8192;
-  uint8_t dst[outBufferSize];
+Inflater::Inflater(Format format, uint8_t* dest, size_t dest_size)
+    : m_fixed_output(true),
+      m_dest(dest),
+      m_capacity(dest_size),
+      m_max_output_size(dest_size)
+{
+  init(format);
+}
 
-  z_stream strm;
-  memset(&strm, 0, sizeof(z_stream));
 
-  strm.avail_in = size;
-  strm.next_in = (Bytef*)input;
+Inflater::~Inflater()
+{
+  if (!m_init_error) {
+    inflateEnd(m_stream.get());
+  }
+}
+
 
-  strm.avail_out = outBufferSize;
-  strm.next_out = (Bytef*) dst;
+void Inflater::init(Format format)
+{
+  m_stream = std::unique_ptr<z_stream>(new z_stream);
+  memset(m_stream.get(), 0, sizeof(z_stream));
 
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
+  int window_bits = (format == Format::zlib ? 15 : -15);
 
-  int err = deflateInit(&strm, Z_DEFAULT_COMPRESSION);
-  if (err != Z_OK) {
-    return {}; // TODO: return error
+  if (inflateInit2(m_stream.get(), window_bits) != Z_OK) {
+    m_init_error = Error(heif_error_Memory_allocation_error,
+                         heif_suberror_Unspecified,
+                         "Cannot initialize zlib decompression");
   }
+}
 
-  do {
-    strm.next_out = dst;
-    strm.avail_out = outBufferSize;
 
-    err = deflate(&strm, Z_FINISH);
-    if (err == Z_BUF_ERROR || err == Z_OK) {
-      // this is the usual case when we run out of buffer space
-      // -> do nothing
-    }
-    else if (err == Z_STREAM_ERROR) {
-      return {}; // TODO: return error
+bool Inflater::grow_output()
+{
+  if (m_fixed_output || m_capacity >= m_max_output_size) {
+    return false;
+  }
+
+  const size_t initial_size = 64 * 1024;
+
+  size_t new_capacity = std::min(std::max(2 * m_capacity, initial_size), m_max_output_size);
+
+  m_output.resize(new_capacity);
+  m_dest = m_output.data();
+  m_capacity = new_capacity;
+
+  return true;
+}
+
+
+Error Inflater::push(const uint8_t* data, size_t size)
+{
+  if (m_init_error) {
+    return m_init_error;
+  }
+
+  z_stream* strm = m_stream.get();
+
+  while (!m_finished) {
+    if (strm->avail_in == 0) {
+      if (size == 0) {
+        break;
+      }
+
+      auto n = (uInt) std::min(size, (size_t) UINT_MAX);
+      strm->next_in = (Bytef*) data;
+      strm->avail_in = n;
+      data += n;
+      size -= n;
     }
 
+    // When the output buffer is full and cannot grow, check with a single byte whether there is more data.
+    uint8_t probe;
+    bool output_full = (m_output_size == m_capacity && !grow_output());
 
-    // append decoded data to output
+    uInt avail_out;
+    if (output_full) {
+      strm->next_out = &probe;
+      avail_out = 1;
+    }
+    else {
+      strm->next_out = m_dest + m_output_size;
+      avail_out = (uInt) std::min(m_capacity - m_output_size, (size_t) UINT_MAX);
+    }
+    strm->avail_out = avail_out;
+
+    int ret = inflate(strm, Z_NO_FLUSH);
+
+    if (output_full && strm->avail_out == 0) {
+      if (m_fixed_output) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_Decompression_invalid_data,
+                     "Decompressed data is larger than expected");
+      }
+      else {
+        return Error(heif_error_Memory_allocation_error,
+                     heif_suberror_Security_limit_exceeded,
+                     "Decompressed data exceeds the maximum size");
+      }
+    }
 
-    output.insert(output.end(), dst, dst + outBufferSize - strm.avail_out);
-  } while (err != Z_STREAM_END);
+    if (!output_full) {
+      m_output_size += avail_out - strm->avail_out;
+    }
 
-  deflateEnd(&strm);
+    if (ret == Z_STREAM_END) {
+      m_finished = true;
+    }
+    else if (ret == Z_BUF_ERROR) {
+      // No progress possible. This is only valid while waiting for more input.
+      if (strm->avail_in != 0 && strm->avail_out != 0) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_Decompression_invalid_data);
+      }
+    }
+    else if (ret != Z_OK) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Decompression_invalid_data,
+                   strm->msg ? strm->msg : "Invalid compressed data");
+    }
+  }
 
-  return output;
+  return Error::Ok;
 }
 
 
-std::vector<uint8_t> inflate(const std::vector<uint8_t>& compressed_input)
+Error Inflater::finish()
 {
-  std::vector<uint8_t> output;
+  if (m_init_error) {
+    return m_init_error;
+  }
 
-  // decompress data with zlib
+  if (!m_finished) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Decompression_invalid_data,
+                 "Compressed data is truncated");
+  }
+
+  if (!m_fixed_output) {
+    m_output.resize(m_output_size);
+  }
+
+  return Error::Ok;
+}
 
-  const int outBufferSize = 8192;
-  uint8_t dst[outBufferSize];
 
+// 'window_bits' selects the format: negative for raw deflate, positive for zlib.
+static std::vector<uint8_t> compress_with_zlib(const uint8_t* input, size_t size, int window_bits)
+{
   z_stream strm;
   memset(&strm, 0, sizeof(z_stream));
 
-  strm.avail_in = (int)compressed_input.size();
-  strm.next_in = (Bytef*) compressed_input.data();
+  int err = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+  if (err != Z_OK) {
+    return {};
+  }
 
-  strm.avail_out = outBufferSize;
-  strm.next_out = (Bytef*) dst;
+  std::vector<uint8_t> output(deflateBound(&strm, (uLong) size));
 
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
+  strm.next_in = (Bytef*) input;
+  strm.avail_in = (uInt) size;
+  strm.next_out = output.data();
+  strm.avail_out = (uInt) output.size();
 
-  int err = -1;
+  // The output buffer is large enough to compress everything in one step.
+  err = deflate(&strm, Z_FINISH);
+  deflateEnd(&strm);
 
-  err = inflateInit(&strm);
-  if (err != Z_OK) {
-    // TODO: return error
+  if (err != Z_STREAM_END) {
     return {};
   }
 
-  do {
-    strm.next_out = dst;
-    strm.avail_out = outBufferSize;
+  output.resize(strm.total_out);
+  return output;
+}
 
-    err = inflate(&strm, Z_FINISH);
-    if (err == Z_BUF_ERROR || err == Z_OK) {
-      // this is the usual case when we run out of buffer space
-      // -> do nothing
-    }
-    else if (err == Z_NEED_DICT || err == Z_DATA_ERROR || err == Z_STREAM_ERROR) {
-      // TODO: return error
-      return {};
-    }
 
+// Decompresses into a buffer of 'max_output_size' bytes, which is allocated only once.
+static Error decompress_with_zlib(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output,
+                                  Inflater::Format format)
+{
+  output->resize(max_output_size);
+
+  Inflater inflater(format, output->data(), output->size());
+
+  Error err = inflater.push(input, size);
+  if (!err) {
+    err = inflater.finish();
+  }
+
+  if (err) {
+    output->clear();
+    return err;
+  }
+
+  output->resize(inflater.get_output_size());
+
+  return Error::Ok;
+}
+
+
+std::vector<uint8_t> compress_deflate(const uint8_t* input, size_t size)
+{
+  return compress_with_zlib(input, size, -15);
+}
+
+
+Error decompress_deflate(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output)
+{
+  return decompress_with_zlib(input, size, max_output_size, output, Inflater::Format::deflate);
+}
+
+
+std::vector<uint8_t> compress_zlib(const uint8_t* input, size_t size)
+{
+  return compress_with_zlib(input, size, 15);
+}
+
+
+Error decompress_zlib(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output)
+{
+  return decompress_with_zlib(input, size, max_output_size, output, Inflater::Format::zlib);
+}
+
+#endif
+
+
+#if WITH_DEFLATE_HEADER_COMPRESSION
+
+std::vector<uint8_t> deflate(const uint8_t* input, size_t size)
+{
+  return compress_zlib(input, size);
+}
 
-    // append decoded data to output
 
-    output.insert(output.end(), dst, dst + outBufferSize - strm.avail_out);
-  } while (err != Z_STREAM_END);
+Error inflate(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output)
+{
+  // The decompressed size is unknown. The output grows as needed, up to 'max_output_size'.
+  Inflater inflater(Inflater::Format::zlib, max_output_size);
+
+  Error err = inflater.push(input, size);
+  if (!err) {
+    err = inflater.finish();
+  }
 
+  if (err) {
+    return err;
+  }
 
-  inflateEnd(&strm);
+  *output = std::move(inflater.get_output());
 
+  return Error::Ok;
+}
+
+#endif
+
+
+#if HAVE_BROTLI
+
+std::vector<uint8_t> compress_brotli(const uint8_t* input, size_t size)
+{
+  std::vector<uint8_t> output(BrotliEncoderMaxCompressedSize(size));
+
+  size_t encoded_size = output.size();
+  if (!BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE,
+                             size, input, &encoded_size, output.data())) {
+    return {};
+  }
+
+  output.resize(encoded_size);
   return output;
 }
+
+
+Error decompress_brotli(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output)
+{
+  output->resize(max_output_size);
+
+  size_t decoded_size = output->size();
+  if (BrotliDecoderDecompress(size, input, &decoded_size, output->data()) != BROTLI_DECODER_RESULT_SUCCESS) {
+    output->clear();
+
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Decompression_invalid_data,
+                 "Compressed data is invalid or larger than expected");
+  }
+
+  output->resize(decoded_size);
+
+  return Error::Ok;
+}
+
 #endif
@@ -22,11 +22,100 @@
 
 #include <vector>
 #include <cinttypes>
+#include <cstddef>
+#include <memory>
+
+#include "error.h"
 
 #if WITH_DEFLATE_HEADER_COMPRESSION
-std::vector<uint8_t> deflate(const uint8_t* input, int size);
+std::vector<uint8_t> deflate(const uint8_t* input, size_t size);
+
+// Fails when the decompressed data would be larger than 'max_output_size'.
+Error inflate(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output);
+#endif
+
+
+#if HAVE_ZLIB
+struct z_stream_s;
+
+// Incremental decompression of zlib or raw deflate data. The compressed data can be passed in
+// pieces of any size, e.g. as it is read from the file.
+// The output is either written into a caller-supplied buffer (when the decompressed size is known)
+// or into an internal buffer that grows up to a maximum size.
+class Inflater
+{
+public:
+  enum class Format
+  {
+    zlib, deflate
+  };
+
+  // Output into an internal buffer of at most 'max_output_size' bytes.
+  Inflater(Format format, size_t max_output_size);
+
+  // Output into 'dest'. Decompressed data larger than 'dest_size' is an error.
+  Inflater(Format format, uint8_t* dest, size_t dest_size);
+
+  ~Inflater();
+
+  Inflater(const Inflater&) = delete;
+
+  Inflater& operator=(const Inflater&) = delete;
+
+  // Decompresses the next piece of the compressed data. Data after the end of the stream is ignored.
+  Error push(const uint8_t* data, size_t size);
+
+  // Checks that the stream was complete. Shrinks the internal buffer to the decompressed size.
+  Error finish();
+
+  bool is_finished() const { return m_finished; }
+
+  size_t get_output_size() const { return m_output_size; }
+
+  // Only for output into the internal buffer.
+  std::vector<uint8_t>& get_output() { return m_output; }
+
+private:
+  void init(Format format);
+
+  bool grow_output();
+
+  std::unique_ptr<z_stream_s> m_stream;
+  Error m_init_error;
+  bool m_finished = false;
+
+  bool m_fixed_output;
+  std::vector<uint8_t> m_output;
+  uint8_t* m_dest = nullptr;
+  size_t m_capacity = 0;
+  size_t m_max_output_size;
+  size_t m_output_size = 0;
+};
+#endif
+
+
+// --- generic compression of image data (ISO/IEC 23001-17 Amd 2)
+//
+// The decompression functions fail when the output would be larger than 'max_output_size'.
+// The output is resized to the actual decompressed size.
+
+#if HAVE_ZLIB
+// 'defl' (raw deflate, RFC 1951)
+std::vector<uint8_t> compress_deflate(const uint8_t* input, size_t size);
+
+Error decompress_deflate(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output);
+
+// 'zlib' (RFC 1950)
+std::vector<uint8_t> compress_zlib(const uint8_t* input, size_t size);
+
+Error decompress_zlib(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output);
+#endif
+
+#if HAVE_BROTLI
+// 'brot' (RFC 7932)
+std::vector<uint8_t> compress_brotli(const uint8_t* input, size_t size);
 
-std::vector<uint8_t> inflate(const std::vector<uint8_t>&);
+Error decompress_brotli(const uint8_t* input, size_t size, size_t max_output_size, std::vector<uint8_t>* output);
 #endif
 
 #endif //LIBHEIF_METADATA_COMPRESSION_H
@@ -20,6 +20,9 @@
 
 
 #include "nclx.h"
+#include <cmath>
+#include <map>
+#include <mutex>
 
 
 primaries::primaries(float gx, float gy, float bx, float by, float rx, float ry, float wx, float wy)
@@ -209,3 +212,38 @@ RGB_to_YCbCr_coefficients RGB_to_YCbCr_coefficients::defaults()
   return coeffs;
 }
 
+
+
+const ColorConversionCoefficients& get_color_conversion_coefficients(uint16_t matrix_coefficients_idx,
+                                                                     uint16_t primaries_idx,
+                                                                     bool full_range, int bit_depth)
+{
+  static std::map<uint64_t, ColorConversionCoefficients> s_coefficients;
+#if ENABLE_MULTITHREADING_SUPPORT
+  static std::mutex s_coefficients_mutex;
+  std::lock_guard<std::mutex> lock(s_coefficients_mutex);
+#endif
+
+  uint64_t key = ((uint64_t) matrix_coefficients_idx << 32) | ((uint64_t) primaries_idx << 16) |
+                 ((uint64_t) full_range << 8) | (uint64_t) (bit_depth & 0xFF);
+
+  auto iter = s_coefficients.find(key);
+  if (iter != s_coefficients.end()) {
+    return iter->second;
+  }
+
+  ColorConversionCoefficients c;
+  c.kr_kb = get_Kr_Kb(matrix_coefficients_idx, primaries_idx);
+  c.ycbcr_to_rgb = get_YCbCr_to_RGB_coefficients(matrix_coefficients_idx, primaries_idx);
+  c.rgb_to_ycbcr = get_RGB_to_YCbCr_coefficients(matrix_coefficients_idx, primaries_idx);
+
+  c.r_cr = static_cast<int>(std::lround(256 * c.ycbcr_to_rgb.r_cr));
+  c.g_cb = static_cast<int>(std::lround(256 * c.ycbcr_to_rgb.g_cb));
+  c.g_cr = static_cast<int>(std::lround(256 * c.ycbcr_to_rgb.g_cr));
+  c.b_cb = static_cast<int>(std::lround(256 * c.ycbcr_to_rgb.b_cb));
+
+  c.half_range = 1 << (bit_depth - 1);
+  c.luma_offset = full_range ? 0 : 16 << (bit_depth - 8);
+
+  return s_coefficients[key] = c;
+}
@@ -76,6 +76,29 @@ struct RGB_to_YCbCr_coefficients
 
 RGB_to_YCbCr_coefficients get_RGB_to_YCbCr_coefficients(uint16_t matrix_coefficients_idx, uint16_t primaries_idx);
 
+
+// All conversion parameters that depend on the nclx profile and the bit depth.
+// Use get_color_conversion_coefficients() to get them from the process-wide cache instead of
+// computing them for each conversion.
+struct ColorConversionCoefficients
+{
+  Kr_Kb kr_kb;
+  YCbCr_to_RGB_coefficients ycbcr_to_rgb;
+  RGB_to_YCbCr_coefficients rgb_to_ycbcr;
+
+  // ycbcr_to_rgb in 8.8 fixed point
+  int r_cr = 0, g_cb = 0, g_cr = 0, b_cb = 0;
+
+  int half_range = 0;     // the chroma zero point
+  int luma_offset = 0;    // 16 << (bit_depth-8) for limited range, 0 for full range
+};
+
+// Undefined coefficients are replaced with the Rec. 601 defaults (except for kr_kb, which is returned as is).
+// The returned reference stays valid for the lifetime of the process.
+const ColorConversionCoefficients& get_color_conversion_coefficients(uint16_t matrix_coefficients_idx,
+                                                                     uint16_t primaries_idx,
+                                                                     bool full_range, int bit_depth);
+
 //  uint16_t get_transfer_characteristics() const {return m_transfer_characteristics;}
 // uint16_t get_matrix_coefficients() const {return m_matrix_coefficients;}
 //  bool get_full_range_flag() const {return m_full_range_flag;}
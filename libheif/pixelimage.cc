@@ -21,9 +21,15 @@
 
 #include "pixelimage.h"
 #include "common_utils.h"
+#include "image_scaling.h"
+#include "image_rotation.h"
+#include "image_blending.h"
+#include "statistics.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <tuple>
 #include <utility>
 
 
@@ -48,12 +54,12 @@ heif_chroma chroma_from_subsampling(int h, int v)
 HeifPixelImage::~HeifPixelImage()
 {
   for (auto& iter : m_planes) {
-    delete[] iter.second.allocated_mem;
+    iter.second.free_memory();
   }
 }
 
 
-int num_interleaved_pixels_per_plane(heif_chroma chroma)
+int num_interleaved_pixels_per_plane(heif_chroma chroma, heif_channel channel)
 {
   switch (chroma) {
     case heif_chroma_undefined:
@@ -66,12 +72,21 @@ int num_interleaved_pixels_per_plane(heif_chroma chroma)
     case heif_chroma_interleaved_RGB:
     case heif_chroma_interleaved_RRGGBB_BE:
     case heif_chroma_interleaved_RRGGBB_LE:
+    case heif_chroma_interleaved_RGB_HALF:
+    case heif_chroma_interleaved_RGB_FLOAT:
       return 3;
 
     case heif_chroma_interleaved_RGBA:
     case heif_chroma_interleaved_RRGGBBAA_BE:
     case heif_chroma_interleaved_RRGGBBAA_LE:
+    case heif_chroma_interleaved_RGBA_HALF:
+    case heif_chroma_interleaved_RGBA_FLOAT:
       return 4;
+
+    case heif_chroma_420_NV12:
+    case heif_chroma_420_NV21:
+    case heif_chroma_420_P010:
+      return channel == heif_channel_interleaved ? 2 : 1;
   }
 
   assert(false);
@@ -102,7 +117,8 @@ std::vector<heif_chroma> get_valid_chroma_values_for_colorspace(heif_colorspace
 {
   switch (colorspace) {
     case heif_colorspace_YCbCr:
-      return {heif_chroma_420, heif_chroma_422, heif_chroma_444};
+      return {heif_chroma_420, heif_chroma_422, heif_chroma_444,
+              heif_chroma_420_NV12, heif_chroma_420_NV21, heif_chroma_420_P010};
 
     case heif_colorspace_RGB:
       return {heif_chroma_444,
@@ -111,7 +127,11 @@ std::vector<heif_chroma> get_valid_chroma_values_for_colorspace(heif_colorspace
               heif_chroma_interleaved_RRGGBB_BE,
               heif_chroma_interleaved_RRGGBBAA_BE,
               heif_chroma_interleaved_RRGGBB_LE,
-              heif_chroma_interleaved_RRGGBBAA_LE};
+              heif_chroma_interleaved_RRGGBBAA_LE,
+              heif_chroma_interleaved_RGB_HALF,
+              heif_chroma_interleaved_RGBA_HALF,
+              heif_chroma_interleaved_RGB_FLOAT,
+              heif_chroma_interleaved_RGBA_FLOAT};
 
     case heif_colorspace_monochrome:
       return {heif_chroma_monochrome};
@@ -124,6 +144,8 @@ std::vector<heif_chroma> get_valid_chroma_values_for_colorspace(heif_colorspace
 
 void HeifPixelImage::create(int width, int height, heif_colorspace colorspace, heif_chroma chroma)
 {
+  clear_conversion_cache();
+
   m_width = width;
   m_height = height;
   m_colorspace = colorspace;
@@ -143,8 +165,10 @@ static uint32_t rounded_size(uint32_t s)
 
 bool HeifPixelImage::add_plane(heif_channel channel, int width, int height, int bit_depth)
 {
+  clear_conversion_cache();
+
   ImagePlane plane;
-  if (plane.alloc(width, height, bit_depth, m_chroma)) {
+  if (plane.alloc(width, height, bit_depth, m_chroma, channel, m_plane_allocator)) {
     m_planes.insert(std::make_pair(channel, plane));
     return true;
   }
@@ -154,7 +178,129 @@ bool HeifPixelImage::add_plane(heif_channel channel, int width, int height, int
 }
 
 
-bool HeifPixelImage::ImagePlane::alloc(int width, int height, int bit_depth, heif_chroma chroma)
+bool HeifPixelImage::add_external_plane(heif_channel channel, int width, int height, int bit_depth,
+                                        uint8_t* mem, size_t stride,
+                                        std::shared_ptr<void> memory_owner)
+{
+  clear_conversion_cache();
+
+  assert(width >= 0);
+  assert(height >= 0);
+
+  if (mem == nullptr || bit_depth < 1 || bit_depth > 32) {
+    return false;
+  }
+
+  auto bytes_per_pixel = static_cast<size_t>(num_interleaved_pixels_per_plane(m_chroma, channel) * ((bit_depth + 7) / 8));
+  if (stride < static_cast<size_t>(width) * bytes_per_pixel) {
+    return false;
+  }
+
+  ImagePlane plane;
+  plane.m_bit_depth = static_cast<uint8_t>(bit_depth);
+  plane.m_width = width;
+  plane.m_height = height;
+  plane.m_mem_width = width;
+  plane.m_mem_height = height;
+  plane.stride = stride;
+  plane.mem = mem;
+  plane.allocated_mem = nullptr;
+  plane.external_memory_owner = std::move(memory_owner);
+
+  m_planes.insert(std::make_pair(channel, plane));
+  return true;
+}
+
+
+bool HeifPixelImage::add_read_only_external_plane(heif_channel channel, int width, int height, int bit_depth,
+                                                  const uint8_t* mem, size_t stride,
+                                                  std::shared_ptr<void> memory_owner)
+{
+  if (has_channel(channel)) {
+    return false;
+  }
+
+  // The memory is only accessed through const pointers until make_plane_writable() copies it.
+  if (!add_external_plane(channel, width, height, bit_depth, const_cast<uint8_t*>(mem), stride,
+                          std::move(memory_owner))) {
+    return false;
+  }
+
+  m_planes[channel].read_only = true;
+  return true;
+}
+
+
+std::shared_ptr<HeifPixelImage> HeifPixelImage::create_view(int x0, int y0, int width, int height)
+{
+  clear_conversion_cache();
+
+  if (x0 < 0 || y0 < 0 || width < 0 || height < 0 ||
+      width > m_width - x0 ||
+      height > m_height - y0) {
+    return nullptr;
+  }
+
+  auto view = std::make_shared<HeifPixelImage>();
+  view->create(width, height, m_colorspace, m_chroma);
+
+  for (const auto& plane_pair : m_planes) {
+    heif_channel channel = plane_pair.first;
+    const ImagePlane& plane = plane_pair.second;
+
+    int subH = 1, subV = 1;
+    if (channel == heif_channel_Cb || channel == heif_channel_Cr ||
+        (channel == heif_channel_interleaved && is_semi_planar_chroma(m_chroma))) {
+      subH = chroma_h_subsampling(m_chroma);
+      subV = chroma_v_subsampling(m_chroma);
+    }
+
+    int full_width, full_height;
+    get_subsampled_size(m_width, m_height, channel, m_chroma, &full_width, &full_height);
+
+    if (plane.m_width != full_width ||
+        plane.m_height != full_height) {
+      return nullptr;
+    }
+
+    // A subsampled view has to start at a chroma sample and must not split a chroma sample
+    // except at the right or bottom image border.
+    if (x0 % subH != 0 || y0 % subV != 0 ||
+        (width % subH != 0 && x0 + width != m_width) ||
+        (height % subV != 0 && y0 + height != m_height)) {
+      return nullptr;
+    }
+
+    int view_width, view_height;
+    get_subsampled_size(width, height, channel, m_chroma, &view_width, &view_height);
+
+    int bytes_per_pixel = num_interleaved_pixels_per_plane(m_chroma, channel) * ((plane.m_bit_depth + 7) / 8);
+
+    ImagePlane view_plane;
+    view_plane.m_bit_depth = plane.m_bit_depth;
+    view_plane.m_width = view_width;
+    view_plane.m_height = view_height;
+    view_plane.m_mem_width = view_width;
+    view_plane.m_mem_height = view_height;
+    view_plane.stride = plane.stride;
+    view_plane.mem = plane.mem + (y0 / subV) * static_cast<size_t>(plane.stride) + (x0 / subH) * bytes_per_pixel;
+    view_plane.allocated_mem = nullptr;
+
+    // The planes keep this image alive, also when they are transferred into another image.
+    view_plane.external_memory_owner = shared_from_this();
+    view_plane.read_only = plane.read_only;
+
+    view->m_planes.insert(std::make_pair(plane_pair.first, view_plane));
+  }
+
+  view->m_premultiplied_alpha = m_premultiplied_alpha;
+
+  return view;
+}
+
+
+bool HeifPixelImage::ImagePlane::alloc(int width, int height, int bit_depth, heif_chroma chroma, heif_channel channel,
+                                       const std::shared_ptr<PlaneAllocator>& plane_allocator)
 {
   assert(width >= 0);
   assert(height >= 0);
@@ -185,15 +331,30 @@ bool HeifPixelImage::ImagePlane::alloc(int width, int height, int bit_depth, hei
 
 
   int bytes_per_component = (m_bit_depth + 7) / 8;
-  int bytes_per_pixel = num_interleaved_pixels_per_plane(chroma) * bytes_per_component;
+  int bytes_per_pixel = num_interleaved_pixels_per_plane(chroma, channel) * bytes_per_component;
+
+  stride = static_cast<size_t>(m_mem_width) * bytes_per_pixel;
+  stride = (stride + alignment - 1U) & ~static_cast<size_t>(alignment - 1U);
 
-  stride = m_mem_width * bytes_per_pixel;
-  stride = (stride + alignment - 1U) & ~(alignment - 1U);
+  allocated_size = m_mem_height * stride + alignment - 1;
+  allocator = plane_allocator;
 
   try {
-    allocated_mem = new uint8_t[m_mem_height * stride + alignment - 1];
+    if (allocator) {
+      allocated_mem = allocator->allocate(allocated_size);
+      if (allocated_mem == nullptr) {
+        return false;
+      }
+    }
+    else {
+      allocated_mem = new uint8_t[allocated_size];
+    }
+
     mem = allocated_mem;
 
+    statistics::add(statistics::plane_allocations);
+    statistics::add(statistics::plane_bytes_allocated, allocated_size);
+
     // shift beginning of image data to aligned memory position
 
     auto mem_start_addr = (uint64_t) mem;
@@ -210,11 +371,101 @@ bool HeifPixelImage::ImagePlane::alloc(int width, int height, int bit_depth, hei
 }
 
 
+void HeifPixelImage::ImagePlane::free_memory()
+{
+  if (allocator) {
+    allocator->release(allocated_mem, allocated_size);
+  }
+  else {
+    delete[] allocated_mem;
+  }
+
+  allocated_mem = nullptr;
+  mem = nullptr;
+
+  external_memory_owner.reset();
+}
+
+
+bool HeifPixelImage::share_plane_memory(const ImagePlane& const_plane) const
+{
+  std::lock_guard<std::mutex> lock(m_plane_sharing_mutex);
+
+  // Sharing does not change the pixel data, only who releases the memory.
+  auto& plane = const_cast<ImagePlane&>(const_plane);
+
+  if (plane.allocated_mem) {
+    std::shared_ptr<PlaneAllocator> allocator = plane.allocator;
+    size_t size = plane.allocated_size;
+
+    plane.external_memory_owner = std::shared_ptr<uint8_t>(plane.allocated_mem, [allocator, size](uint8_t* mem) {
+      if (allocator) {
+        allocator->release(mem, size);
+      }
+      else {
+        delete[] mem;
+      }
+    });
+
+    plane.allocated_mem = nullptr;
+    plane.allocator.reset();
+  }
+  else if (!plane.external_memory_owner) {
+    return false;
+  }
+
+  if (!plane.copy_on_write_token) {
+    plane.copy_on_write_token = std::make_shared<bool>(true);
+  }
+
+  return true;
+}
+
+
+bool HeifPixelImage::make_plane_writable(heif_channel channel, ImagePlane& plane)
+{
+  if (!plane.copy_on_write_token && !plane.read_only) {
+    return true;
+  }
+
+  if (plane.read_only || plane.copy_on_write_token.use_count() > 1) {
+    ImagePlane copy;
+    if (!copy.alloc(plane.m_mem_width, plane.m_mem_height, plane.m_bit_depth, m_chroma, channel, m_plane_allocator)) {
+      return false;
+    }
+
+    int bytes_per_line = plane.m_mem_width * num_interleaved_pixels_per_plane(m_chroma, channel) * ((plane.m_bit_depth + 7) / 8);
+
+    for (int y = 0; y < plane.m_mem_height; y++) {
+      memcpy(copy.mem + y * static_cast<size_t>(copy.stride),
+             plane.mem + y * static_cast<size_t>(plane.stride),
+             bytes_per_line);
+    }
+
+    copy.m_width = plane.m_width;
+    copy.m_height = plane.m_height;
+
+    plane.free_memory();
+    plane = copy;
+  }
+
+  plane.copy_on_write_token.reset();
+
+  return true;
+}
+
+
 bool HeifPixelImage::extend_padding_to_size(int width, int height)
 {
+  clear_conversion_cache();
+
   for (auto& planeIter : m_planes) {
     auto* plane = &planeIter.second;
 
+    if (!make_plane_writable(planeIter.first, *plane)) {
+      return false;
+    }
+
     int subsampled_width, subsampled_height;
     get_subsampled_size(width, height, planeIter.first, m_chroma,
                         &subsampled_width, &subsampled_height);
@@ -226,25 +477,28 @@ bool HeifPixelImage::extend_padding_to_size(int width, int height)
         plane->m_mem_height < subsampled_height) {
 
       ImagePlane newPlane;
-      if (!newPlane.alloc(subsampled_width, subsampled_height, plane->m_bit_depth, m_chroma)) {
+      if (!newPlane.alloc(subsampled_width, subsampled_height, plane->m_bit_depth, m_chroma, planeIter.first, m_plane_allocator)) {
         return false;
       }
 
       // copy the visible part of the old plane into the new plane
 
+      int bytes_per_pixel = num_interleaved_pixels_per_plane(m_chroma, planeIter.first) * ((plane->m_bit_depth + 7) / 8);
+
       for (int y = 0; y < plane->m_height; y++) {
         memcpy(&newPlane.mem[y * newPlane.stride],
                &plane->mem[y * plane->stride],
-               plane->m_width);
+               plane->m_width * bytes_per_pixel);
       }
 
+      plane->free_memory();
       planeIter.second = newPlane;
       plane = &planeIter.second;
     }
 
     // extend plane size
 
-    int bytes_per_pixel = (plane->m_bit_depth + 7) / 8;
+    int bytes_per_pixel = num_interleaved_pixels_per_plane(m_chroma, planeIter.first) * ((plane->m_bit_depth + 7) / 8);
 
     for (int y = 0; y < old_height; y++) {
       for (int x = old_width; x < subsampled_width; x++) {
@@ -267,6 +521,24 @@ bool HeifPixelImage::extend_padding_to_size(int width, int height)
 }
 
 
+bool HeifPixelImage::extend_to_size_with_padding(int width, int height)
+{
+  if (!extend_padding_to_size(width, height)) {
+    return false;
+  }
+
+  for (auto& planeIter : m_planes) {
+    get_subsampled_size(width, height, planeIter.first, m_chroma,
+                        &planeIter.second.m_width, &planeIter.second.m_height);
+  }
+
+  m_width = width;
+  m_height = height;
+
+  return true;
+}
+
+
 bool HeifPixelImage::has_channel(heif_channel channel) const
 {
   return (m_planes.find(channel) != m_planes.end());
@@ -276,9 +548,7 @@ bool HeifPixelImage::has_channel(heif_channel channel) const
 bool HeifPixelImage::has_alpha() const
 {
   return has_channel(heif_channel_Alpha) ||
-         get_chroma_format() == heif_chroma_interleaved_RGBA ||
-         get_chroma_format() == heif_chroma_interleaved_RRGGBBAA_BE ||
-         get_chroma_format() == heif_chroma_interleaved_RRGGBBAA_LE;
+         is_chroma_with_alpha(get_chroma_format());
 }
 
 
@@ -316,6 +586,47 @@ std::set<heif_channel> HeifPixelImage::get_channel_set() const
 }
 
 
+size_t HeifPixelImage::get_pixel_data_size() const
+{
+  size_t size = 0;
+  for (const auto& plane : m_planes) {
+    size += plane.second.stride * static_cast<size_t>(plane.second.m_height);
+  }
+
+  return size;
+}
+
+
+bool HeifPixelImage::adopt_heap_planes(const std::shared_ptr<BudgetedPlaneAllocator>& allocator)
+{
+  for (auto& plane : m_planes) {
+    ImagePlane& p = plane.second;
+    if (p.allocated_mem && !p.allocator) {
+      if (!allocator->adopt(p.allocated_size)) {
+        return false;
+      }
+
+      p.allocator = allocator;
+    }
+  }
+
+  return true;
+}
+
+
+size_t HeifPixelImage::get_allocated_memory_size() const
+{
+  size_t size = 0;
+  for (const auto& plane : m_planes) {
+    if (plane.second.allocated_mem) {
+      size += plane.second.allocated_size;
+    }
+  }
+
+  return size;
+}
+
+
 uint8_t HeifPixelImage::get_storage_bits_per_pixel(enum heif_channel channel) const
 {
   if (channel == heif_channel_interleaved) {
@@ -331,6 +642,19 @@ uint8_t HeifPixelImage::get_storage_bits_per_pixel(enum heif_channel channel) co
       case heif_chroma_interleaved_RRGGBBAA_BE:
       case heif_chroma_interleaved_RRGGBBAA_LE:
         return 64;
+      case heif_chroma_420_NV12:
+      case heif_chroma_420_NV21:
+        return 16;
+      case heif_chroma_420_P010:
+        return 32;
+      case heif_chroma_interleaved_RGB_HALF:
+        return 48;
+      case heif_chroma_interleaved_RGBA_HALF:
+        return 64;
+      case heif_chroma_interleaved_RGB_FLOAT:
+        return 96;
+      case heif_chroma_interleaved_RGBA_FLOAT:
+        return 128;
       default:
         return -1; // invalid channel/chroma specification
     }
@@ -354,13 +678,19 @@ uint8_t HeifPixelImage::get_bits_per_pixel(enum heif_channel channel) const
 }
 
 
-uint8_t* HeifPixelImage::get_plane(enum heif_channel channel, int* out_stride)
+uint8_t* HeifPixelImage::get_plane(enum heif_channel channel, size_t* out_stride)
 {
+  clear_conversion_cache();
+
   auto iter = m_planes.find(channel);
   if (iter == m_planes.end()) {
     return nullptr;
   }
 
+  if (!make_plane_writable(channel, iter->second)) {
+    return nullptr;
+  }
+
   if (out_stride) {
     *out_stride = iter->second.stride;
   }
@@ -369,7 +699,7 @@ uint8_t* HeifPixelImage::get_plane(enum heif_channel channel, int* out_stride)
 }
 
 
-const uint8_t* HeifPixelImage::get_plane(enum heif_channel channel, int* out_stride) const
+const uint8_t* HeifPixelImage::get_plane(enum heif_channel channel, size_t* out_stride) const
 {
   auto iter = m_planes.find(channel);
   if (iter == m_planes.end()) {
@@ -384,10 +714,77 @@ const uint8_t* HeifPixelImage::get_plane(enum heif_channel channel, int* out_str
 }
 
 
+bool HeifPixelImage::copy_planes_to(HeifPixelImage& target) const
+{
+  target.clear_conversion_cache();
+
+  if (target.m_width != m_width ||
+      target.m_height != m_height ||
+      target.m_chroma != m_chroma ||
+      target.m_planes.size() != m_planes.size()) {
+    return false;
+  }
+
+  for (const auto& plane_pair : m_planes) {
+    const ImagePlane& plane = plane_pair.second;
+
+    auto target_iter = target.m_planes.find(plane_pair.first);
+    if (target_iter == target.m_planes.end()) {
+      return false;
+    }
+
+    ImagePlane& target_plane = target_iter->second;
+    if (target_plane.m_width != plane.m_width ||
+        target_plane.m_height != plane.m_height ||
+        target_plane.m_bit_depth != plane.m_bit_depth) {
+      return false;
+    }
+
+    if (!target.make_plane_writable(plane_pair.first, target_plane)) {
+      return false;
+    }
+
+    int bytes_per_line = plane.m_width * num_interleaved_pixels_per_plane(m_chroma, plane_pair.first) * ((plane.m_bit_depth + 7) / 8);
+
+    for (int y = 0; y < plane.m_height; y++) {
+      memcpy(target_plane.mem + y * static_cast<size_t>(target_plane.stride),
+             plane.mem + y * static_cast<size_t>(plane.stride),
+             bytes_per_line);
+    }
+  }
+
+  return true;
+}
+
+
+void HeifPixelImage::copy_image_properties_from(const HeifPixelImage& src)
+{
+  clear_conversion_cache();
+
+  m_color_profile_nclx = src.m_color_profile_nclx;
+  m_color_profile_icc = src.m_color_profile_icc;
+  m_premultiplied_alpha = src.m_premultiplied_alpha;
+
+  m_PixelAspectRatio_h = src.m_PixelAspectRatio_h;
+  m_PixelAspectRatio_v = src.m_PixelAspectRatio_v;
+  m_clli = src.m_clli;
+  m_mdcv = src.m_mdcv;
+  m_mdcv_set = src.m_mdcv_set;
+
+  for (const auto& warning : src.m_warnings) {
+    m_warnings.push_back(warning);
+  }
+
+  m_color_conversion_info = src.m_color_conversion_info;
+}
+
+
 void HeifPixelImage::copy_new_plane_from(const std::shared_ptr<const HeifPixelImage>& src_image,
                                          heif_channel src_channel,
                                          heif_channel dst_channel)
 {
+  clear_conversion_cache();
+
   int width = src_image->get_width(src_channel);
   int height = src_image->get_height(src_channel);
 
@@ -396,10 +793,10 @@ void HeifPixelImage::copy_new_plane_from(const std::shared_ptr<const HeifPixelIm
   add_plane(dst_channel, width, height, src_image->get_bits_per_pixel(src_channel));
 
   uint8_t* dst;
-  int dst_stride = 0;
+  size_t dst_stride = 0;
 
   const uint8_t* src;
-  int src_stride = 0;
+  size_t src_stride = 0;
 
   src = src_image->get_plane(src_channel, &src_stride);
   dst = get_plane(dst_channel, &dst_stride);
@@ -413,13 +810,15 @@ void HeifPixelImage::copy_new_plane_from(const std::shared_ptr<const HeifPixelIm
 
 void HeifPixelImage::fill_new_plane(heif_channel dst_channel, uint16_t value, int width, int height, int bpp)
 {
+  clear_conversion_cache();
+
   add_plane(dst_channel, width, height, bpp);
 
-  int num_interleaved = num_interleaved_pixels_per_plane(m_chroma);
+  int num_interleaved = num_interleaved_pixels_per_plane(m_chroma, dst_channel);
 
   if (bpp == 8) {
     uint8_t* dst;
-    int dst_stride = 0;
+    size_t dst_stride = 0;
     dst = get_plane(dst_channel, &dst_stride);
     int width_bytes = width * num_interleaved;
 
@@ -429,7 +828,7 @@ void HeifPixelImage::fill_new_plane(heif_channel dst_channel, uint16_t value, in
   }
   else {
     uint16_t* dst;
-    int dst_stride = 0;
+    size_t dst_stride = 0;
     dst = (uint16_t*) get_plane(dst_channel, &dst_stride);
 
     dst_stride /= 2;
@@ -447,6 +846,9 @@ void HeifPixelImage::transfer_plane_from_image_as(const std::shared_ptr<HeifPixe
                                                   heif_channel src_channel,
                                                   heif_channel dst_channel)
 {
+  clear_conversion_cache();
+  source->clear_conversion_cache();
+
   // TODO: check that dst_channel does not exist yet
 
   ImagePlane plane = source->m_planes[src_channel];
@@ -467,11 +869,18 @@ bool is_chroma_with_alpha(heif_chroma chroma)
     case heif_chroma_interleaved_RGB:
     case heif_chroma_interleaved_RRGGBB_BE:
     case heif_chroma_interleaved_RRGGBB_LE:
+    case heif_chroma_420_NV12:
+    case heif_chroma_420_NV21:
+    case heif_chroma_420_P010:
+    case heif_chroma_interleaved_RGB_HALF:
+    case heif_chroma_interleaved_RGB_FLOAT:
       return false;
 
     case heif_chroma_interleaved_RGBA:
     case heif_chroma_interleaved_RRGGBBAA_BE:
     case heif_chroma_interleaved_RRGGBBAA_LE:
+    case heif_chroma_interleaved_RGBA_HALF:
+    case heif_chroma_interleaved_RGBA_FLOAT:
       return true;
   }
 
@@ -480,146 +889,99 @@ bool is_chroma_with_alpha(heif_chroma chroma)
 }
 
 
-Error HeifPixelImage::rotate_ccw(int angle_degrees,
-                                 std::shared_ptr<HeifPixelImage>& out_img)
+Error HeifPixelImage::rotate_and_mirror(int angle_degrees, bool mirror_horizontally,
+                                        std::shared_ptr<HeifPixelImage>& out_img,
+                                        ThreadPool* thread_pool) const
 {
-  // --- create output image (or simply reuse existing image)
-
-  if (angle_degrees == 0) {
-    out_img = shared_from_this();
-    return Error::Ok;
+  if (angle_degrees != 0 && angle_degrees != 90 && angle_degrees != 180 && angle_degrees != 270) {
+    return Error(heif_error_Usage_error, heif_suberror_Invalid_parameter_value,
+                 "Rotation angle has to be a multiple of 90 degrees");
   }
 
-  int out_width = m_width;
-  int out_height = m_height;
+  const bool swap_axes = (angle_degrees == 90 || angle_degrees == 270);
 
-  if (angle_degrees == 90 || angle_degrees == 270) {
-    std::swap(out_width, out_height);
+  if (swap_axes && m_chroma == heif_chroma_422) {
+    return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion,
+                 "Cannot rotate images with different horizontal and vertical chroma subsampling by 90 degrees");
   }
 
+
+  // --- create output image
+
+  int out_width = (swap_axes ? m_height : m_width);
+  int out_height = (swap_axes ? m_width : m_height);
+
   out_img = std::make_shared<HeifPixelImage>();
   out_img->create(out_width, out_height, m_colorspace, m_chroma);
+  out_img->set_plane_allocator(m_plane_allocator);
 
 
-  // --- rotate all channels
+  // --- transform all channels
 
   for (const auto& plane_pair : m_planes) {
     heif_channel channel = plane_pair.first;
     const ImagePlane& plane = plane_pair.second;
 
-    /*
-    if (plane.bit_depth != 8) {
-      return Error(heif_error_Unsupported_feature,
-                   heif_suberror_Unspecified,
-                   "Can currently only rotate images with 8 bits per pixel");
-    }
-    */
+    const int w = plane.m_width;
+    const int h = plane.m_height;
 
-    int out_plane_width = plane.m_width;
-    int out_plane_height = plane.m_height;
+    int out_plane_width = (swap_axes ? h : w);
+    int out_plane_height = (swap_axes ? w : h);
 
-    if (angle_degrees == 90 || angle_degrees == 270) {
-      std::swap(out_plane_width, out_plane_height);
+    if (!out_img->add_plane(channel, out_plane_width, out_plane_height, plane.m_bit_depth)) {
+      return Error(heif_error_Memory_allocation_error, heif_suberror_Unspecified);
     }
 
-    out_img->add_plane(channel, out_plane_width, out_plane_height, plane.m_bit_depth);
-
-
-    int w = plane.m_width;
-    int h = plane.m_height;
-
-    int in_stride = plane.stride;
-    const uint8_t* in_data = plane.mem;
-
-    int out_stride = 0;
+    size_t out_stride = 0;
     uint8_t* out_data = out_img->get_plane(channel, &out_stride);
 
-    if (plane.m_bit_depth == 8) {
-      if (angle_degrees == 270) {
-        for (int x = 0; x < h; x++)
-          for (int y = 0; y < w; y++) {
-            out_data[y * out_stride + x] = in_data[(h - 1 - x) * in_stride + y];
-          }
-      }
-      else if (angle_degrees == 180) {
-        for (int y = 0; y < h; y++)
-          for (int x = 0; x < w; x++) {
-            out_data[y * out_stride + x] = in_data[(h - 1 - y) * in_stride + (w - 1 - x)];
-          }
-      }
-      else if (angle_degrees == 90) {
-        for (int x = 0; x < h; x++)
-          for (int y = 0; y < w; y++) {
-            out_data[y * out_stride + x] = in_data[x * in_stride + (w - 1 - y)];
-          }
-      }
-    }
-    else { // 16 bit (TODO: unchecked code)
-      if (angle_degrees == 270) {
-        for (int x = 0; x < h; x++)
-          for (int y = 0; y < w; y++) {
-            out_data[y * out_stride + 2 * x] = in_data[(h - 1 - x) * in_stride + 2 * y];
-            out_data[y * out_stride + 2 * x + 1] = in_data[(h - 1 - x) * in_stride + 2 * y + 1];
-          }
-      }
-      else if (angle_degrees == 180) {
-        for (int y = 0; y < h; y++)
-          for (int x = 0; x < w; x++) {
-            out_data[y * out_stride + 2 * x] = in_data[(h - 1 - y) * in_stride + 2 * (w - 1 - x)];
-            out_data[y * out_stride + 2 * x + 1] = in_data[(h - 1 - y) * in_stride + 2 * (w - 1 - x) + 1];
-          }
-      }
-      else if (angle_degrees == 90) {
-        for (int x = 0; x < h; x++)
-          for (int y = 0; y < w; y++) {
-            out_data[y * out_stride + 2 * x] = in_data[x * in_stride + 2 * (w - 1 - y)];
-            out_data[y * out_stride + 2 * x + 1] = in_data[x * in_stride + 2 * (w - 1 - y) + 1];
-          }
-      }
-    }
-  }
-
-  // --- pass the color profiles to the new image
+    const int bytes_per_pixel = num_interleaved_pixels_per_plane(m_chroma, channel) * ((plane.m_bit_depth + 7) / 8);
 
-  out_img->set_color_profile_nclx(get_color_profile_nclx());
-  out_img->set_color_profile_icc(get_color_profile_icc());
+    // Input coordinates of the output pixel (x,y). The output is first rotated, then mirrored.
+    auto input_position = [&](int x, int y) -> ptrdiff_t {
+      if (mirror_horizontally) {
+        x = out_plane_width - 1 - x;
+      }
 
-  return Error::Ok;
-}
+      int in_x = x, in_y = y;
+      switch (angle_degrees) {
+        case 90:
+          in_x = w - 1 - y;
+          in_y = x;
+          break;
+        case 180:
+          in_x = w - 1 - x;
+          in_y = h - 1 - y;
+          break;
+        case 270:
+          in_x = y;
+          in_y = h - 1 - x;
+          break;
+        default:
+          break;
+      }
 
+      return in_y * static_cast<ptrdiff_t>(plane.stride) + in_x * static_cast<ptrdiff_t>(bytes_per_pixel);
+    };
 
-Error HeifPixelImage::mirror_inplace(heif_transform_mirror_direction direction)
-{
-  for (auto& plane_pair : m_planes) {
-    ImagePlane& plane = plane_pair.second;
+    const ptrdiff_t origin = input_position(0, 0);
+    const ptrdiff_t step_x = input_position(1, 0) - origin;
+    const ptrdiff_t step_y = input_position(0, 1) - origin;
+    const uint8_t* in = plane.mem + origin;
 
-    if (plane.m_bit_depth != 8) {
-      return Error(heif_error_Unsupported_feature,
-                   heif_suberror_Unspecified,
-                   "Can currently only mirror images with 8 bits per pixel");
+    if (bytes_per_pixel != 1 && bytes_per_pixel != 2 && bytes_per_pixel != 3 &&
+        bytes_per_pixel != 4 && bytes_per_pixel != 6 && bytes_per_pixel != 8 &&
+        bytes_per_pixel != 12 && bytes_per_pixel != 16) {
+      return Error(heif_error_Unsupported_feature, heif_suberror_Unspecified,
+                   "Unsupported pixel size for rotation");
     }
 
-
-    int w = plane.m_width;
-    int h = plane.m_height;
-
-    int stride = plane.stride;
-    uint8_t* data = plane.mem;
-
-    if (direction == heif_transform_mirror_direction_horizontal) {
-      for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w / 2; x++)
-          std::swap(data[y * stride + x], data[y * stride + w - 1 - x]);
-      }
-    }
-    else {
-      for (int y = 0; y < h / 2; y++) {
-        for (int x = 0; x < w; x++)
-          std::swap(data[y * stride + x], data[(h - 1 - y) * stride + x]);
-      }
-    }
+    transform_plane(in, step_x, step_y, out_data, out_stride,
+                    out_plane_width, out_plane_height, bytes_per_pixel, thread_pool);
   }
 
+  out_img->copy_image_properties_from(*this);
+
   return Error::Ok;
 }
 
@@ -629,6 +991,7 @@ Error HeifPixelImage::crop(int left, int right, int top, int bottom,
 {
   out_img = std::make_shared<HeifPixelImage>();
   out_img->create(right - left + 1, bottom - top + 1, m_colorspace, m_chroma);
+  out_img->set_plane_allocator(m_plane_allocator);
 
 
   // --- crop all channels
@@ -647,35 +1010,49 @@ Error HeifPixelImage::crop(int left, int right, int top, int bottom,
     int w = plane.m_width;
     int h = plane.m_height;
 
-    int plane_left = left * w / m_width;
-    int plane_right = right * w / m_width;
-    int plane_top = top * h / m_height;
-    int plane_bottom = bottom * h / m_height;
+    // 64 bit, the products overflow for very large images
+    int plane_left = static_cast<int>(int64_t{left} * w / m_width);
+    int plane_right = static_cast<int>(int64_t{right} * w / m_width);
+    int plane_top = static_cast<int>(int64_t{top} * h / m_height);
+    int plane_bottom = static_cast<int>(int64_t{bottom} * h / m_height);
+
+    int bytes_per_pixel = num_interleaved_pixels_per_plane(m_chroma, channel) * ((plane.m_bit_depth + 7) / 8);
+
+    if (share_plane_memory(plane)) {
+      ImagePlane cropped_plane;
+      cropped_plane.m_bit_depth = plane.m_bit_depth;
+      cropped_plane.m_width = plane_right - plane_left + 1;
+      cropped_plane.m_height = plane_bottom - plane_top + 1;
+      cropped_plane.m_mem_width = cropped_plane.m_width;
+      cropped_plane.m_mem_height = cropped_plane.m_height;
+      cropped_plane.stride = plane.stride;
+      cropped_plane.mem = plane.mem + plane_top * static_cast<size_t>(plane.stride) + plane_left * bytes_per_pixel;
+      cropped_plane.allocated_mem = nullptr;
+      cropped_plane.external_memory_owner = plane.external_memory_owner;
+      cropped_plane.copy_on_write_token = plane.copy_on_write_token;
+      cropped_plane.read_only = plane.read_only;
+
+      out_img->m_planes.insert(std::make_pair(channel, cropped_plane));
+      continue;
+    }
 
-    out_img->add_plane(channel,
-                       plane_right - plane_left + 1,
-                       plane_bottom - plane_top + 1,
-                       plane.m_bit_depth);
+    if (!out_img->add_plane(channel,
+                            plane_right - plane_left + 1,
+                            plane_bottom - plane_top + 1,
+                            plane.m_bit_depth)) {
+      return Error(heif_error_Memory_allocation_error, heif_suberror_Unspecified);
+    }
 
-    int in_stride = plane.stride;
+    size_t in_stride = plane.stride;
     const uint8_t* in_data = plane.mem;
 
-    int out_stride = 0;
+    size_t out_stride = 0;
     uint8_t* out_data = out_img->get_plane(channel, &out_stride);
 
-    if (plane.m_bit_depth == 8) {
-      for (int y = plane_top; y <= plane_bottom; y++) {
-        memcpy(&out_data[(y - plane_top) * out_stride],
-               &in_data[y * in_stride + plane_left],
-               plane_right - plane_left + 1);
-      }
-    }
-    else {
-      for (int y = plane_top; y <= plane_bottom; y++) {
-        memcpy(&out_data[(y - plane_top) * out_stride],
-               &in_data[y * in_stride + plane_left * 2],
-               (plane_right - plane_left + 1) * 2);
-      }
+    for (int y = plane_top; y <= plane_bottom; y++) {
+      memcpy(&out_data[(y - plane_top) * out_stride],
+             &in_data[y * in_stride + plane_left * bytes_per_pixel],
+             (plane_right - plane_left + 1) * bytes_per_pixel);
     }
   }
 
@@ -688,8 +1065,24 @@ Error HeifPixelImage::crop(int left, int right, int top, int bottom,
 }
 
 
+std::shared_ptr<HeifPixelImage> HeifPixelImage::create_shared_copy() const
+{
+  std::shared_ptr<HeifPixelImage> copy;
+  Error err = crop(0, m_width - 1, 0, m_height - 1, copy);
+  if (err) {
+    return nullptr;
+  }
+
+  copy->copy_image_properties_from(*this);
+
+  return copy;
+}
+
+
 Error HeifPixelImage::fill_RGB_16bit(uint16_t r, uint16_t g, uint16_t b, uint16_t a)
 {
+  clear_conversion_cache();
+
   for (const auto& channel : {heif_channel_R, heif_channel_G, heif_channel_B, heif_channel_Alpha}) {
 
     const auto plane_iter = m_planes.find(channel);
@@ -713,9 +1106,13 @@ Error HeifPixelImage::fill_RGB_16bit(uint16_t r, uint16_t g, uint16_t b, uint16_
                    "Can currently only fill images with 8 bits per pixel");
     }
 
+    if (!make_plane_writable(channel, plane)) {
+      return Error(heif_error_Memory_allocation_error, heif_suberror_Unspecified);
+    }
+
     int h = plane.m_height;
 
-    int stride = plane.stride;
+    size_t stride = plane.stride;
     uint8_t* data = plane.mem;
 
     uint16_t val16;
@@ -750,31 +1147,36 @@ Error HeifPixelImage::fill_RGB_16bit(uint16_t r, uint16_t g, uint16_t b, uint16_
 
 Error HeifPixelImage::overlay(std::shared_ptr<HeifPixelImage>& overlay, int dx, int dy)
 {
-  std::set<enum heif_channel> channels = overlay->get_channel_set();
+  clear_conversion_cache();
 
-  bool has_alpha = overlay->has_channel(heif_channel_Alpha);
+  // only read from the overlay, such that shared planes are not copied
+  const HeifPixelImage& overlay_img = *overlay;
+
+  std::set<enum heif_channel> channels = overlay_img.get_channel_set();
+
+  bool has_alpha = overlay_img.has_channel(heif_channel_Alpha);
   //bool has_alpha_me = has_channel(heif_channel_Alpha);
 
-  int alpha_stride = 0;
-  uint8_t* alpha_p;
-  alpha_p = overlay->get_plane(heif_channel_Alpha, &alpha_stride);
+  size_t alpha_stride = 0;
+  const uint8_t* alpha_p;
+  alpha_p = overlay_img.get_plane(heif_channel_Alpha, &alpha_stride);
 
   for (heif_channel channel : channels) {
     if (!has_channel(channel)) {
       continue;
     }
 
-    int in_stride = 0;
+    size_t in_stride = 0;
     const uint8_t* in_p;
 
-    int out_stride = 0;
+    size_t out_stride = 0;
     uint8_t* out_p;
 
-    in_p = overlay->get_plane(channel, &in_stride);
+    in_p = overlay_img.get_plane(channel, &in_stride);
     out_p = get_plane(channel, &out_stride);
 
-    int in_w = overlay->get_width(channel);
-    int in_h = overlay->get_height(channel);
+    int in_w = overlay_img.get_width(channel);
+    int in_h = overlay_img.get_height(channel);
     assert(in_w >= 0);
     assert(in_h >= 0);
 
@@ -830,19 +1232,14 @@ Error HeifPixelImage::overlay(std::shared_ptr<HeifPixelImage>& overlay, int dx,
     }
 
     for (int y = in_y0; y < in_h; y++) {
+      uint8_t* out_row = out_p + out_x0 + (out_y0 + y - in_y0) * static_cast<size_t>(out_stride);
+      const uint8_t* in_row = in_p + in_x0 + y * static_cast<size_t>(in_stride);
+
       if (!has_alpha) {
-        memcpy(out_p + out_x0 + (out_y0 + y - in_y0) * out_stride,
-               in_p + in_x0 + y * in_stride,
-               in_w - in_x0);
+        memcpy(out_row, in_row, in_w - in_x0);
       }
       else {
-        for (int x = in_x0; x < in_w; x++) {
-          uint8_t* outptr = &out_p[out_x0 + (out_y0 + y - in_y0) * out_stride + x];
-          uint8_t in_val = in_p[in_x0 + y * in_stride + x];
-          uint8_t alpha_val = alpha_p[in_x0 + y * in_stride + x];
-
-          *outptr = (uint8_t) ((in_val * alpha_val + *outptr * (255 - alpha_val)) / 255);
-        }
+        blend_row_8bit(in_row, alpha_p + in_x0 + y * static_cast<size_t>(alpha_stride), out_row, in_w - in_x0);
       }
     }
   }
@@ -851,16 +1248,28 @@ Error HeifPixelImage::overlay(std::shared_ptr<HeifPixelImage>& overlay, int dx,
 }
 
 
-Error HeifPixelImage::scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& out_img,
-                                             int width, int height) const
+Error HeifPixelImage::create_scaled_image(std::shared_ptr<HeifPixelImage>& out_img,
+                                          int width, int height) const
 {
   out_img = std::make_shared<HeifPixelImage>();
   out_img->create(width, height, m_colorspace, m_chroma);
+  out_img->set_plane_allocator(m_plane_allocator);
 
 
   // --- create output image with scaled planes
 
-  if (has_channel(heif_channel_interleaved)) {
+  if (is_semi_planar_chroma(m_chroma)) {
+    if (!has_channel(heif_channel_Y) ||
+        !has_channel(heif_channel_interleaved)) {
+      return Error(heif_error_Invalid_input, heif_suberror_Unspecified, "semi-planar image without Y and chroma planes");
+    }
+
+    int cw, ch;
+    get_subsampled_size(width, height, heif_channel_interleaved, m_chroma, &cw, &ch);
+    out_img->add_plane(heif_channel_Y, width, height, get_bits_per_pixel(heif_channel_Y));
+    out_img->add_plane(heif_channel_interleaved, cw, ch, get_bits_per_pixel(heif_channel_interleaved));
+  }
+  else if (has_channel(heif_channel_interleaved)) {
     out_img->add_plane(heif_channel_interleaved, width, height, get_bits_per_pixel(heif_channel_interleaved));
   }
   else {
@@ -904,6 +1313,18 @@ Error HeifPixelImage::scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& ou
     }
   }
 
+  return Error::Ok;
+}
+
+
+Error HeifPixelImage::scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& out_img,
+                                             int width, int height) const
+{
+  Error err = create_scaled_image(out_img, width, height);
+  if (err) {
+    return err;
+  }
+
 
   // --- scale all channels
 
@@ -920,26 +1341,26 @@ Error HeifPixelImage::scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& ou
     int out_w = out_img->get_width(channel);
     int out_h = out_img->get_height(channel);
 
-    int in_stride = plane.stride;
+    size_t in_stride = plane.stride;
     const uint8_t* in_data = plane.mem;
 
-    int out_stride = 0;
+    size_t out_stride = 0;
     uint8_t* out_data = out_img->get_plane(channel, &out_stride);
 
 
     for (int y = 0; y < out_h; y++) {
-      int iy = y * m_height / height;
+      int iy = static_cast<int>(int64_t{y} * m_height / height);
 
       if (bpp == 1) {
         for (int x = 0; x < out_w; x++) {
-          int ix = x * m_width / width;
+          int ix = static_cast<int>(int64_t{x} * m_width / width);
 
           out_data[y * out_stride + x] = in_data[iy * in_stride + ix];
         }
       }
       else {
         for (int x = 0; x < out_w; x++) {
-          int ix = x * m_width / width;
+          int ix = static_cast<int>(int64_t{x} * m_width / width);
 
           for (int b = 0; b < bpp; b++) {
             out_data[y * out_stride + bpp * x + b] = in_data[iy * in_stride + bpp * ix + b];
@@ -953,11 +1374,71 @@ Error HeifPixelImage::scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& ou
 }
 
 
+Error HeifPixelImage::scale(std::shared_ptr<HeifPixelImage>& out_img, int width, int height,
+                            enum heif_scaling_filter filter, ThreadPool* thread_pool) const
+{
+  if (width <= 0 || height <= 0) {
+    return Error(heif_error_Usage_error, heif_suberror_Invalid_image_size);
+  }
+
+  if (filter == heif_scaling_filter_nearest_neighbor) {
+    return scale_nearest_neighbor(out_img, width, height);
+  }
+
+  if (is_float_chroma(m_chroma)) {
+    return Error(heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion,
+                 "Filtered scaling of images with floating point samples is not supported");
+  }
+
+  Error err = create_scaled_image(out_img, width, height);
+  if (err) {
+    return err;
+  }
+
+  bool big_endian = (m_chroma == heif_chroma_interleaved_RRGGBB_BE ||
+                     m_chroma == heif_chroma_interleaved_RRGGBBAA_BE);
+
+  for (const auto& plane_pair : m_planes) {
+    heif_channel channel = plane_pair.first;
+    const ImagePlane& plane = plane_pair.second;
+
+    if (!out_img->has_channel(channel)) {
+      return Error(heif_error_Invalid_input, heif_suberror_Unspecified, "scaling input has extra color plane");
+    }
+
+    ScalingPlaneFormat format;
+    format.num_components = (channel == heif_channel_interleaved ? num_interleaved_pixels_per_plane(m_chroma) : 1);
+    format.bytes_per_sample = get_storage_bits_per_pixel(channel) / 8 / format.num_components;
+    format.bit_depth = std::min(int(plane.m_bit_depth), 8 * format.bytes_per_sample);
+
+    if (m_chroma == heif_chroma_420_P010) {
+      // the samples are stored in the MSBs
+      format.bit_depth = 16;
+    }
+    else if (channel == heif_channel_interleaved && format.bytes_per_sample == 2) {
+      format.byte_order = (big_endian ? ScalingPlaneFormat::ByteOrder::big_endian : ScalingPlaneFormat::ByteOrder::little_endian);
+    }
+
+    size_t out_stride = 0;
+    uint8_t* out_data = out_img->get_plane(channel, &out_stride);
+
+    err = scale_plane(plane.mem, plane.stride, plane.m_width, plane.m_height,
+                      out_data, out_stride, out_img->get_width(channel), out_img->get_height(channel),
+                      format, filter, thread_pool);
+    if (err) {
+      return err;
+    }
+  }
+
+  return Error::Ok;
+}
+
+
 void HeifPixelImage::debug_dump() const
 {
   auto channels = get_channel_set();
   for (auto c : channels) {
-    int stride = 0;
+    size_t stride = 0;
     const uint8_t* p = get_plane(c, &stride);
 
     for (int y = 0; y < 8; y++) {
@@ -968,3 +1449,53 @@ void HeifPixelImage::debug_dump() const
     }
   }
 }
+
+
+bool HeifPixelImage::ConversionKey::operator<(const ConversionKey& other) const
+{
+  return std::tie(colorspace, chroma, output_bpp,
+                  colour_primaries, transfer_characteristics, matrix_coefficients, full_range_flag,
+                  downsampling_algorithm, upsampling_algorithm, only_use_preferred_chroma_algorithm,
+                  conversion_accuracy) <
+         std::tie(other.colorspace, other.chroma, other.output_bpp,
+                  other.colour_primaries, other.transfer_characteristics, other.matrix_coefficients, other.full_range_flag,
+                  other.downsampling_algorithm, other.upsampling_algorithm, other.only_use_preferred_chroma_algorithm,
+                  other.conversion_accuracy);
+}
+
+
+std::shared_ptr<HeifPixelImage> HeifPixelImage::get_cached_conversion(const ConversionKey& key) const
+{
+  std::lock_guard<std::mutex> lock(m_conversion_cache_mutex);
+
+  auto iter = m_conversion_cache.find(key);
+  if (iter == m_conversion_cache.end()) {
+    return nullptr;
+  }
+
+  return iter->second;
+}
+
+
+// Typically, an image is only coded with one or two encoders.
+// Limit the memory held by the cache when it is coded with many different settings.
+static const size_t cMaxCachedConversions = 4;
+
+void HeifPixelImage::set_cached_conversion(const ConversionKey& key, std::shared_ptr<HeifPixelImage> converted_image)
+{
+  std::lock_guard<std::mutex> lock(m_conversion_cache_mutex);
+
+  if (m_conversion_cache.size() >= cMaxCachedConversions) {
+    m_conversion_cache.clear();
+  }
+
+  m_conversion_cache[key] = std::move(converted_image);
+}
+
+
+void HeifPixelImage::clear_conversion_cache()
+{
+  std::lock_guard<std::mutex> lock(m_conversion_cache_mutex);
+
+  m_conversion_cache.clear();
+}
@@ -25,19 +25,27 @@
 #include "heif.h"
 #include "error.h"
 #include "box.h" // only for color_profile, TODO: maybe move the color_profiles to its own header
+#include "plane_allocator.h"
 
 #include <vector>
 #include <memory>
 #include <map>
+#include <mutex>
 #include <set>
 #include <utility>
 
+class ThreadPool;
+
+struct ColorConversionInfo;
+
 
 heif_chroma chroma_from_subsampling(int h, int v);
 
 bool is_chroma_with_alpha(heif_chroma chroma);
 
-int num_interleaved_pixels_per_plane(heif_chroma chroma);
+// Number of samples per pixel in the plane 'channel'. For semi-planar chroma formats, this is 2 for the
+// interleaved Cb/Cr plane and 1 for the Y plane.
+int num_interleaved_pixels_per_plane(heif_chroma chroma, heif_channel channel = heif_channel_interleaved);
 
 bool is_integer_multiple_of_chroma_size(int width,
                                         int height,
@@ -56,8 +64,40 @@ public:
 
   void create(int width, int height, heif_colorspace colorspace, heif_chroma chroma);
 
+  // Planes added after this call get their memory from 'allocator' (nullptr: plain heap allocation).
+  // Images that are computed from this image (e.g. by color conversion) use the same allocator.
+  void set_plane_allocator(std::shared_ptr<PlaneAllocator> allocator) { m_plane_allocator = std::move(allocator); }
+
+  const std::shared_ptr<PlaneAllocator>& get_plane_allocator() const { return m_plane_allocator; }
+
+  // Hands the planes that were allocated with new[] (e.g. by a decoder plugin) over to 'allocator',
+  // which releases them from now on.
+  // Returns false if the allocator does not accept the memory (e.g. because it exceeds the budget).
+  bool adopt_heap_planes(const std::shared_ptr<BudgetedPlaneAllocator>& allocator);
+
   bool add_plane(heif_channel channel, int width, int height, int bit_depth);
 
+  // Add a plane that uses memory owned by someone else (e.g. an application buffer or a decoded
+  // picture of a codec). The memory is not released by the image. If 'memory_owner' is set, the
+  // plane keeps a reference to it until the plane is freed. Otherwise, the memory must stay valid
+  // as long as the image exists.
+  bool add_external_plane(heif_channel channel, int width, int height, int bit_depth,
+                          uint8_t* mem, size_t stride,
+                          std::shared_ptr<void> memory_owner = nullptr);
+
+  // Like add_external_plane(), but the memory is never written. It is copied when the plane
+  // is modified (through non-const get_plane() or other modifying functions).
+  bool add_read_only_external_plane(heif_channel channel, int width, int height, int bit_depth,
+                                    const uint8_t* mem, size_t stride,
+                                    std::shared_ptr<void> memory_owner = nullptr);
+
+  // Create an image whose planes refer to a rectangular area of this image's planes.
+  // No pixel memory is allocated and writing into the view modifies this image.
+  // Unlike crop(), the view does not copy on write.
+  // For subsampled chroma planes, the area has to be aligned to the chroma samples (it may end
+  // at the right or bottom border with an odd size). Returns nullptr otherwise.
+  std::shared_ptr<HeifPixelImage> create_view(int x0, int y0, int width, int height);
+
   bool has_channel(heif_channel channel) const;
 
   // Has alpha information either as a separate channel or in the interleaved format.
@@ -65,7 +105,11 @@ public:
 
   bool is_premultiplied_alpha() const { return m_premultiplied_alpha; }
 
-  void set_premultiplied_alpha(bool flag) { m_premultiplied_alpha = flag; }
+  void set_premultiplied_alpha(bool flag)
+  {
+    clear_conversion_cache();
+    m_premultiplied_alpha = flag;
+  }
 
   int get_width() const { return m_width; }
 
@@ -81,13 +125,26 @@ public:
 
   std::set<enum heif_channel> get_channel_set() const;
 
+  // Size of the pixel data of all planes (stride x height).
+  size_t get_pixel_data_size() const;
+
+  // Memory that this image allocated for its planes. Views and external planes do not count.
+  size_t get_allocated_memory_size() const;
+
   uint8_t get_storage_bits_per_pixel(enum heif_channel channel) const;
 
   uint8_t get_bits_per_pixel(enum heif_channel channel) const;
 
-  uint8_t* get_plane(enum heif_channel channel, int* out_stride);
+  uint8_t* get_plane(enum heif_channel channel, size_t* out_stride);
+
+  const uint8_t* get_plane(enum heif_channel channel, size_t* out_stride) const;
+
+  // Copy the pixel data of all planes into the existing planes of 'target'.
+  // Returns false if 'target' does not have matching planes.
+  bool copy_planes_to(HeifPixelImage& target) const;
 
-  const uint8_t* get_plane(enum heif_channel channel, int* out_stride) const;
+  // Copy color profiles, HDR information, pixel aspect ratio and warnings, but no pixel data.
+  void copy_image_properties_from(const HeifPixelImage& src);
 
   void copy_new_plane_from(const std::shared_ptr<const HeifPixelImage>& src_image,
                            heif_channel src_channel,
@@ -99,25 +156,48 @@ public:
                                     heif_channel src_channel,
                                     heif_channel dst_channel);
 
-  Error rotate_ccw(int angle_degrees,
-                   std::shared_ptr<HeifPixelImage>& out_img);
-
-  Error mirror_inplace(heif_transform_mirror_direction);
-
+  // Rotates the image counter-clockwise by 'angle_degrees' (0, 90, 180 or 270) and then mirrors it
+  // horizontally if 'mirror_horizontally' is set. Every combination of 'irot' and 'imir' transformations
+  // can be expressed this way. The pixels are copied in a single pass, split into bands that are
+  // processed in parallel on 'thread_pool' (may be NULL).
+  Error rotate_and_mirror(int angle_degrees, bool mirror_horizontally,
+                          std::shared_ptr<HeifPixelImage>& out_img,
+                          ThreadPool* thread_pool = nullptr) const;
+
+  // The cropped image shares the pixel memory with this image. The shared memory is copied
+  // when either image writes to it (through non-const get_plane() or other modifying functions).
+  // Only planes with external memory that has no owner are copied immediately.
   Error crop(int left, int right, int top, int bottom,
              std::shared_ptr<HeifPixelImage>& out_img) const;
 
+  // A copy of the whole image that shares the pixel memory copy-on-write, like crop().
+  // Returns nullptr if a plane had to be copied and the memory cannot be allocated.
+  std::shared_ptr<HeifPixelImage> create_shared_copy() const;
+
   Error fill_RGB_16bit(uint16_t r, uint16_t g, uint16_t b, uint16_t a);
 
   Error overlay(std::shared_ptr<HeifPixelImage>& overlay, int dx, int dy);
 
   Error scale_nearest_neighbor(std::shared_ptr<HeifPixelImage>& output, int width, int height) const;
 
-  void set_color_profile_nclx(const std::shared_ptr<const color_profile_nclx>& profile) { m_color_profile_nclx = profile; }
+  // Scale all planes with a separable filter. The planes are split into bands of rows that are
+  // scaled in parallel on 'thread_pool' (may be NULL).
+  Error scale(std::shared_ptr<HeifPixelImage>& output, int width, int height,
+              enum heif_scaling_filter filter, ThreadPool* thread_pool = nullptr) const;
+
+  void set_color_profile_nclx(const std::shared_ptr<const color_profile_nclx>& profile)
+  {
+    clear_conversion_cache();
+    m_color_profile_nclx = profile;
+  }
 
   const std::shared_ptr<const color_profile_nclx>& get_color_profile_nclx() const { return m_color_profile_nclx; }
 
-  void set_color_profile_icc(const std::shared_ptr<const color_profile_raw>& profile) { m_color_profile_icc = profile; }
+  void set_color_profile_icc(const std::shared_ptr<const color_profile_raw>& profile)
+  {
+    clear_conversion_cache();
+    m_color_profile_icc = profile;
+  }
 
   const std::shared_ptr<const color_profile_raw>& get_color_profile_icc() const { return m_color_profile_icc; }
 
@@ -125,6 +205,10 @@ public:
 
   bool extend_padding_to_size(int width, int height);
 
+  // Like extend_padding_to_size(), but the padded area also becomes part of the visible image.
+  // The border pixels are repeated into the new area.
+  bool extend_to_size_with_padding(int width, int height);
+
   // --- pixel aspect ratio
 
   bool has_nonsquare_pixel_ratio() const { return m_PixelAspectRatio_h != m_PixelAspectRatio_v; }
@@ -137,6 +221,7 @@ public:
 
   void set_pixel_ratio(uint32_t h, uint32_t v)
   {
+    clear_conversion_cache();
     m_PixelAspectRatio_h = h;
     m_PixelAspectRatio_v = v;
   }
@@ -147,7 +232,11 @@ public:
 
   heif_content_light_level get_clli() const { return m_clli; }
 
-  void set_clli(const heif_content_light_level& clli) { m_clli = clli; }
+  void set_clli(const heif_content_light_level& clli)
+  {
+    clear_conversion_cache();
+    m_clli = clli;
+  }
 
   // --- mdcv
 
@@ -157,11 +246,16 @@ public:
 
   void set_mdcv(const heif_mastering_display_colour_volume& mdcv)
   {
+    clear_conversion_cache();
     m_mdcv = mdcv;
     m_mdcv_set = true;
   }
 
-  void unset_mdcv() { m_mdcv_set = false; }
+  void unset_mdcv()
+  {
+    clear_conversion_cache();
+    m_mdcv_set = false;
+  }
 
   // --- warnings
 
@@ -169,10 +263,50 @@ public:
 
   const std::vector<Error>& get_warnings() const { return m_warnings; }
 
+  // --- the color conversions that produced this image (nullptr if it was not converted)
+
+  void set_color_conversion_info(std::shared_ptr<const ColorConversionInfo> info) { m_color_conversion_info = std::move(info); }
+
+  const std::shared_ptr<const ColorConversionInfo>& get_color_conversion_info() const { return m_color_conversion_info; }
+
+  // --- color converted versions of this image
+  //     When the same image is encoded several times, it is converted to the input format of the encoders only once.
+  //     All functions that modify the image (including non-const get_plane()) clear the cache.
+
+  struct ConversionKey
+  {
+    heif_colorspace colorspace;
+    heif_chroma chroma;
+    int output_bpp;
+    uint16_t colour_primaries;
+    uint16_t transfer_characteristics;
+    uint16_t matrix_coefficients;
+    bool full_range_flag;
+    heif_chroma_downsampling_algorithm downsampling_algorithm;
+    heif_chroma_upsampling_algorithm upsampling_algorithm;
+    bool only_use_preferred_chroma_algorithm;
+    uint8_t conversion_accuracy;
+
+    bool operator<(const ConversionKey& other) const;
+  };
+
+  // Returns nullptr if there is no cached conversion for this key.
+  std::shared_ptr<HeifPixelImage> get_cached_conversion(const ConversionKey& key) const;
+
+  void set_cached_conversion(const ConversionKey& key, std::shared_ptr<HeifPixelImage> converted_image);
+
+  void clear_conversion_cache();
+
 private:
+  // Create an image with the same format and empty planes for the given size.
+  Error create_scaled_image(std::shared_ptr<HeifPixelImage>& out_img, int width, int height) const;
+
   struct ImagePlane
   {
-    bool alloc(int width, int height, int bit_depth, heif_chroma chroma);
+    bool alloc(int width, int height, int bit_depth, heif_chroma chroma, heif_channel channel,
+               const std::shared_ptr<PlaneAllocator>& allocator);
+
+    void free_memory();
 
     uint8_t m_bit_depth = 0;
 
@@ -185,10 +319,29 @@ private:
     int m_mem_height = 0;
 
     uint8_t* mem = nullptr; // aligned memory start
-    uint8_t* allocated_mem = nullptr; // unaligned memory we allocated
-    uint32_t stride = 0; // bytes per line
+    uint8_t* allocated_mem = nullptr; // unaligned memory we allocated (nullptr for views)
+    size_t stride = 0; // bytes per line
+
+    std::shared_ptr<PlaneAllocator> allocator; // where 'allocated_mem' came from (nullptr: new[])
+    size_t allocated_size = 0;
+
+    std::shared_ptr<void> external_memory_owner; // keeps external memory ('mem') alive
+
+    // Held by all planes that share their memory copy-on-write (see crop()).
+    // The memory is still shared while use_count() > 1.
+    std::shared_ptr<void> copy_on_write_token;
+
+    // The external memory must not be written. It is always copied on write.
+    bool read_only = false;
   };
 
+  // Moves the plane memory into a reference counted owner, such that other planes can share it.
+  // Returns false if the plane refers to external memory without an owner.
+  bool share_plane_memory(const ImagePlane& plane) const;
+
+  // Copies the plane memory if it is shared copy-on-write with another plane.
+  bool make_plane_writable(heif_channel channel, ImagePlane& plane);
+
   int m_width = 0;
   int m_height = 0;
   heif_colorspace m_colorspace = heif_colorspace_undefined;
@@ -199,6 +352,8 @@ private:
 
   std::map<heif_channel, ImagePlane> m_planes;
 
+  std::shared_ptr<PlaneAllocator> m_plane_allocator;
+
   uint32_t m_PixelAspectRatio_h = 1;
   uint32_t m_PixelAspectRatio_v = 1;
   heif_content_light_level m_clli{};
@@ -206,6 +361,14 @@ private:
   bool m_mdcv_set = false; // replace with std::optional<> when we are on C*+17
 
   std::vector<Error> m_warnings;
+
+  std::shared_ptr<const ColorConversionInfo> m_color_conversion_info;
+
+  std::map<ConversionKey, std::shared_ptr<HeifPixelImage>> m_conversion_cache;
+
+  mutable std::mutex m_conversion_cache_mutex;
+
+  mutable std::mutex m_plane_sharing_mutex;
 };
 
 #endif
@@ -0,0 +1,220 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "plane_allocator.h"
+#include "statistics.h"
+
+#include <new>
+
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#define LOCK_POOL std::lock_guard<std::mutex> lock(m_mutex)
+#else
+#define LOCK_POOL
+#endif
+
+
+PlaneMemoryPool::PlaneMemoryPool(size_t max_cached_bytes)
+{
+  m_stats.max_cached_bytes = max_cached_bytes;
+}
+
+
+PlaneMemoryPool::~PlaneMemoryPool()
+{
+  trim();
+}
+
+
+size_t PlaneMemoryPool::size_class(size_t size)
+{
+  // small blocks are all rounded to the same size
+
+  const size_t min_size = 4096;
+  if (size <= min_size) {
+    return min_size;
+  }
+
+  // Split each power-of-two range into four classes.
+
+  size_t power = min_size;
+  while (power * 2 < size && power * 2 > power) {
+    power *= 2;
+  }
+
+  size_t step = power / 4;
+  return (size + step - 1) / step * step;
+}
+
+
+uint8_t* PlaneMemoryPool::allocate(size_t size)
+{
+  size_t block_size = size_class(size);
+
+  {
+    LOCK_POOL;
+
+    m_stats.num_allocations++;
+
+    auto iter = m_free_blocks.find(block_size);
+    if (iter != m_free_blocks.end() && !iter->second.empty()) {
+      uint8_t* mem = iter->second.back();
+      iter->second.pop_back();
+
+      m_stats.cached_bytes -= block_size;
+      m_stats.num_reused++;
+      statistics::add(statistics::plane_bytes_reused, size);
+      return mem;
+    }
+  }
+
+  return new(std::nothrow) uint8_t[block_size];
+}
+
+
+void PlaneMemoryPool::release(uint8_t* mem, size_t size)
+{
+  if (mem == nullptr) {
+    return;
+  }
+
+  size_t block_size = size_class(size);
+
+  {
+    LOCK_POOL;
+
+    if (m_stats.cached_bytes + block_size <= m_stats.max_cached_bytes) {
+      m_free_blocks[block_size].push_back(mem);
+      m_stats.cached_bytes += block_size;
+      return;
+    }
+  }
+
+  delete[] mem;
+}
+
+
+PlaneMemoryPool::Statistics PlaneMemoryPool::get_statistics() const
+{
+  LOCK_POOL;
+
+  return m_stats;
+}
+
+
+void PlaneMemoryPool::trim()
+{
+  LOCK_POOL;
+
+  for (auto& blocks : m_free_blocks) {
+    for (uint8_t* mem : blocks.second) {
+      delete[] mem;
+    }
+  }
+
+  m_free_blocks.clear();
+  m_stats.cached_bytes = 0;
+}
+
+
+size_t MemoryBudget::get_used_bytes() const
+{
+  LOCK_POOL;
+
+  return m_used_bytes;
+}
+
+
+bool MemoryBudget::fits(size_t size) const
+{
+  LOCK_POOL;
+
+  return size <= m_max_bytes - m_used_bytes;
+}
+
+
+bool MemoryBudget::acquire(size_t size)
+{
+  LOCK_POOL;
+
+  if (size > m_max_bytes - m_used_bytes) {
+    return false;
+  }
+
+  m_used_bytes += size;
+  return true;
+}
+
+
+void MemoryBudget::release(size_t size)
+{
+  LOCK_POOL;
+
+  m_used_bytes -= size;
+}
+
+
+uint8_t* BudgetedPlaneAllocator::allocate(size_t size)
+{
+  if (!m_budget->acquire(size)) {
+    return nullptr;
+  }
+
+  uint8_t* mem;
+  if (m_allocator) {
+    mem = m_allocator->allocate(size);
+  }
+  else {
+    mem = new(std::nothrow) uint8_t[size];
+  }
+
+  if (mem == nullptr) {
+    m_budget->release(size);
+  }
+
+  return mem;
+}
+
+
+void BudgetedPlaneAllocator::release(uint8_t* mem, size_t size)
+{
+  if (mem == nullptr) {
+    return;
+  }
+
+  if (m_allocator) {
+    m_allocator->release(mem, size);
+  }
+  else {
+    delete[] mem;
+  }
+
+  m_budget->release(size);
+}
+
+
+bool BudgetedPlaneAllocator::adopt(size_t size)
+{
+  if (m_allocator) {
+    return false;
+  }
+
+  return m_budget->acquire(size);
+}
@@ -0,0 +1,146 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_PLANE_ALLOCATOR_H
+#define LIBHEIF_PLANE_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
+
+// Provides the pixel memory for HeifPixelImage planes.
+// An allocator is shared by all images that are derived from each other during decoding
+// (decoder output, color conversion intermediates, output image).
+class PlaneAllocator
+{
+public:
+  virtual ~PlaneAllocator() = default;
+
+  // Returns nullptr if the memory cannot be allocated.
+  virtual uint8_t* allocate(size_t size) = 0;
+
+  // 'size' is the same value that was passed to allocate().
+  virtual void release(uint8_t* mem, size_t size) = 0;
+};
+
+
+// Keeps released plane memory for reuse in later allocations of a similar size.
+// Sizes are rounded up to size classes with at most 25% overhead so that images of
+// slightly different sizes share the same blocks.
+// The pool is thread-safe.
+class PlaneMemoryPool : public PlaneAllocator
+{
+public:
+  // Up to 'max_cached_bytes' of released memory are kept for reuse.
+  explicit PlaneMemoryPool(size_t max_cached_bytes);
+
+  ~PlaneMemoryPool() override;
+
+  uint8_t* allocate(size_t size) override;
+
+  void release(uint8_t* mem, size_t size) override;
+
+  struct Statistics
+  {
+    uint64_t num_allocations = 0;
+    uint64_t num_reused = 0; // allocations served from cached memory
+    size_t cached_bytes = 0;
+    size_t max_cached_bytes = 0;
+  };
+
+  Statistics get_statistics() const;
+
+  // Free all cached memory. Memory that is currently in use is not affected.
+  void trim();
+
+private:
+  static size_t size_class(size_t size);
+
+  std::map<size_t, std::vector<uint8_t*>> m_free_blocks; // size class -> blocks
+
+  Statistics m_stats;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  mutable std::mutex m_mutex;
+#endif
+};
+
+
+// Counts the plane memory of a context that is in use and limits it to 'max_bytes'.
+// The budget is thread-safe.
+class MemoryBudget
+{
+public:
+  explicit MemoryBudget(size_t max_bytes) : m_max_bytes(max_bytes) {}
+
+  size_t get_max_bytes() const { return m_max_bytes; }
+
+  size_t get_used_bytes() const;
+
+  // Whether 'size' more bytes can be used at the moment.
+  bool fits(size_t size) const;
+
+  // Counts 'size' bytes as used. Returns false (and counts nothing) if they exceed the budget.
+  bool acquire(size_t size);
+
+  void release(size_t size);
+
+private:
+  size_t m_max_bytes;
+  size_t m_used_bytes = 0;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  mutable std::mutex m_mutex;
+#endif
+};
+
+
+// Allocates the plane memory from 'allocator' (nullptr: new[]) and counts it in 'budget'.
+// Allocations that would exceed the budget fail.
+class BudgetedPlaneAllocator : public PlaneAllocator
+{
+public:
+  BudgetedPlaneAllocator(std::shared_ptr<MemoryBudget> budget, std::shared_ptr<PlaneAllocator> allocator)
+      : m_budget(std::move(budget)), m_allocator(std::move(allocator)) {}
+
+  uint8_t* allocate(size_t size) override;
+
+  void release(uint8_t* mem, size_t size) override;
+
+  // Takes over memory that was allocated with new[] elsewhere (e.g. by a decoder plugin) and counts it.
+  // Only possible without an underlying allocator, because release() has to delete[] the memory.
+  bool adopt(size_t size);
+
+  const std::shared_ptr<MemoryBudget>& get_budget() const { return m_budget; }
+
+private:
+  std::shared_ptr<MemoryBudget> m_budget;
+  std::shared_ptr<PlaneAllocator> m_allocator;
+};
+
+#endif
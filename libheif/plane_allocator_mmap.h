@@ -0,0 +1,63 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_PLANE_ALLOCATOR_MMAP_H
+#define LIBHEIF_PLANE_ALLOCATOR_MMAP_H
+
+#include "plane_allocator.h"
+
+#include <string>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <mutex>
+#endif
+
+#ifdef _WIN32
+#include <map>
+#endif
+
+
+// Allocates each plane in a memory-mapped temporary file in 'directory'. The operating system
+// writes the pages to the file when memory is low and reads them back on access, so that images
+// larger than the available RAM can be assembled. The files are deleted when the planes are released.
+// The implementation is platform specific (plane_allocator_mmap_unix.cc / plane_allocator_mmap_windows.cc).
+class MappedFilePlaneAllocator : public PlaneAllocator
+{
+public:
+  explicit MappedFilePlaneAllocator(std::string directory) : m_directory(std::move(directory)) {}
+
+  uint8_t* allocate(size_t size) override;
+
+  void release(uint8_t* mem, size_t size) override;
+
+private:
+  std::string m_directory;
+
+#ifdef _WIN32
+  // mapped memory -> handle of the file mapping
+  std::map<uint8_t*, void*> m_mappings;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::mutex m_mutex;
+#endif
+#endif
+};
+
+#endif
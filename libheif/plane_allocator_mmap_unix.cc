@@ -0,0 +1,70 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "plane_allocator_mmap.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+
+uint8_t* MappedFilePlaneAllocator::allocate(size_t size)
+{
+  if (size == 0 || static_cast<uint64_t>(size) > static_cast<uint64_t>(std::numeric_limits<off_t>::max())) {
+    return nullptr;
+  }
+
+  std::string name_template = m_directory + "/libheif-canvas-XXXXXX";
+  std::vector<char> filename(name_template.begin(), name_template.end());
+  filename.push_back(0);
+
+  int fd = mkstemp(filename.data());
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  // The file has no name anymore. It is deleted when the mapping is removed.
+  unlink(filename.data());
+
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  // the mapping stays valid after closing the file descriptor
+  close(fd);
+
+  if (mem == MAP_FAILED) {
+    return nullptr;
+  }
+
+  return static_cast<uint8_t*>(mem);
+}
+
+
+void MappedFilePlaneAllocator::release(uint8_t* mem, size_t size)
+{
+  munmap(mem, size);
+}
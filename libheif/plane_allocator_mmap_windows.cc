@@ -0,0 +1,91 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "plane_allocator_mmap.h"
+#include "file.h"
+
+#include <windows.h>
+
+
+uint8_t* MappedFilePlaneAllocator::allocate(size_t size)
+{
+  if (size == 0) {
+    return nullptr;
+  }
+
+  std::wstring wdirectory = HeifFile::convert_utf8_path_to_utf16(m_directory.c_str());
+
+  wchar_t filename[MAX_PATH];
+  if (GetTempFileNameW(wdirectory.c_str(), L"hif", 0, filename) == 0) {
+    return nullptr;
+  }
+
+  HANDLE file = CreateFileW(filename, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    DeleteFileW(filename);
+    return nullptr;
+  }
+
+  uint64_t size64 = size;
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+                                      static_cast<DWORD>(size64 >> 32),
+                                      static_cast<DWORD>(size64 & 0xFFFFFFFF),
+                                      nullptr);
+
+  // The mapping keeps a reference to the file. The file is deleted when the mapping is closed.
+  CloseHandle(file);
+
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+
+  void* mem = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (mem == nullptr) {
+    CloseHandle(mapping);
+    return nullptr;
+  }
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  m_mappings[static_cast<uint8_t*>(mem)] = mapping;
+
+  return static_cast<uint8_t*>(mem);
+}
+
+
+void MappedFilePlaneAllocator::release(uint8_t* mem, size_t size)
+{
+  (void) size;
+
+  UnmapViewOfFile(mem);
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+
+  auto iter = m_mappings.find(mem);
+  if (iter != m_mappings.end()) {
+    CloseHandle((HANDLE) iter->second);
+    m_mappings.erase(iter);
+  }
+}
@@ -25,8 +25,14 @@
 #include <utility>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+
+#if ENABLE_PARALLEL_TILE_DECODING
+#include <mutex>
+#endif
 
 #include "plugin_registry.h"
+#include "init.h"
 
 #if HAVE_LIBDE265
 #include "libheif/plugins/decoder_libde265.h"
@@ -56,6 +62,14 @@
 #include "libheif/plugins/encoder_svt.h"
 #endif
 
+#if HAVE_FFMPEG_DECODER
+#include "libheif/plugins/decoder_ffmpeg.h"
+#endif
+
+#if HAVE_JPEG_DECODER
+#include "libheif/plugins/decoder_jpeg.h"
+#endif
+
 #if WITH_UNCOMPRESSED_CODEC
 #include "libheif/plugins/encoder_uncompressed.h"
 #endif
@@ -66,6 +80,41 @@ std::set<const struct heif_decoder_plugin*> s_decoder_plugins;
 std::multiset<std::unique_ptr<struct heif_encoder_descriptor>,
               encoder_descriptor_priority_order> s_encoder_descriptors;
 
+
+// The decoder plugins that support a compression format, highest priority first.
+// Once created, an entry is not modified anymore. This allows get_decoder() to read it without locking.
+struct decoder_cache_entry
+{
+  struct plugin_with_priority
+  {
+    const struct heif_decoder_plugin* plugin;
+    int priority;
+  };
+
+  std::vector<plugin_with_priority> plugins;
+};
+
+static const int kNumCachedCompressionFormats = 16;
+
+static std::atomic<const decoder_cache_entry*> s_decoder_cache[kNumCachedCompressionFormats];
+
+// owns the entries referenced by s_decoder_cache
+static std::vector<std::unique_ptr<decoder_cache_entry>> s_decoder_cache_entries;
+
+#if ENABLE_PARALLEL_TILE_DECODING
+static std::mutex s_decoder_cache_mutex;
+#endif
+
+
+// Plugins are initialized when they are used for the first time instead of when they are registered.
+// This keeps the startup time low for applications that do not use all codecs.
+static std::set<const struct heif_decoder_plugin*> s_initialized_decoder_plugins;
+static std::set<const struct heif_encoder_plugin*> s_initialized_encoder_plugins;
+
+#if ENABLE_PARALLEL_TILE_DECODING
+static std::mutex s_plugin_initialization_mutex;
+#endif
+
 // Note: we cannot move this to 'heif_init' because we have to make sure that this is initialized
 // AFTER the two global std::set above.
 static class Register_Default_Plugins
@@ -108,6 +157,14 @@ void register_default_plugins()
   register_encoder(get_encoder_plugin_svt());
 #endif
 
+#if HAVE_FFMPEG_DECODER
+  register_decoder(get_decoder_plugin_ffmpeg());
+#endif
+
+#if HAVE_JPEG_DECODER
+  register_decoder(get_decoder_plugin_jpeg());
+#endif
+
 #if WITH_UNCOMPRESSED_CODEC
   register_encoder(get_encoder_plugin_uncompressed());
 #endif
@@ -116,45 +173,154 @@ void register_default_plugins()
 
 void register_decoder(const heif_decoder_plugin* decoder_plugin)
 {
-  if (decoder_plugin->init_plugin) {
+  s_decoder_plugins.insert(decoder_plugin);
+
+  invalidate_decoder_cache();
+}
+
+
+void initialize_decoder_plugin(const heif_decoder_plugin* decoder_plugin)
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(s_plugin_initialization_mutex);
+#endif
+
+  bool first_use = s_initialized_decoder_plugins.insert(decoder_plugin).second;
+  if (first_use && decoder_plugin->init_plugin) {
     (*decoder_plugin->init_plugin)();
   }
+}
 
-  s_decoder_plugins.insert(decoder_plugin);
+
+void deinitialize_decoder_plugin(const heif_decoder_plugin* decoder_plugin)
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(s_plugin_initialization_mutex);
+#endif
+
+  bool was_initialized = (s_initialized_decoder_plugins.erase(decoder_plugin) > 0);
+  if (was_initialized && decoder_plugin->deinit_plugin) {
+    (*decoder_plugin->deinit_plugin)();
+  }
 }
 
 
-const struct heif_decoder_plugin* get_decoder(enum heif_compression_format type, const char* name_id)
+void invalidate_decoder_cache()
 {
-  int highest_priority = 0;
-  const struct heif_decoder_plugin* best_plugin = nullptr;
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(s_decoder_cache_mutex);
+#endif
+
+  for (auto& entry : s_decoder_cache) {
+    entry.store(nullptr, std::memory_order_release);
+  }
+
+  // Note: like changing the set of plugins itself, this must not be done while images are decoded.
+  s_decoder_cache_entries.clear();
+}
+
 
+static void fill_decoder_cache_entry(enum heif_compression_format type, decoder_cache_entry& entry)
+{
   for (const auto* plugin : s_decoder_plugins) {
+    // a plugin may need its initialization to check which formats it supports (e.g. for probing hardware)
+    initialize_decoder_plugin(plugin);
 
     int priority = plugin->does_support_format(type);
+    if (priority > 0) {
+      entry.plugins.push_back({plugin, priority});
+    }
+  }
 
-    if (priority > 0 && name_id && plugin->plugin_api_version >= 3) {
-      if (strcmp(name_id, plugin->id_name) == 0) {
-        return plugin;
+  // stable: for equal priorities, keep the plugin that comes first in s_decoder_plugins
+  std::stable_sort(entry.plugins.begin(), entry.plugins.end(),
+                   [](const decoder_cache_entry::plugin_with_priority& a,
+                      const decoder_cache_entry::plugin_with_priority& b) {
+                     return a.priority > b.priority;
+                   });
+}
+
+
+// Returns the cached list of decoders for 'type'. For formats that cannot be cached,
+// the list is filled into 'uncached_entry'.
+static const decoder_cache_entry* get_decoder_cache_entry(enum heif_compression_format type,
+                                                          decoder_cache_entry& uncached_entry)
+{
+  int idx = static_cast<int>(type);
+  if (idx < 0 || idx >= kNumCachedCompressionFormats) {
+    fill_decoder_cache_entry(type, uncached_entry);
+    return &uncached_entry;
+  }
+
+  const decoder_cache_entry* entry = s_decoder_cache[idx].load(std::memory_order_acquire);
+  if (entry) {
+    return entry;
+  }
+
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(s_decoder_cache_mutex);
+#endif
+
+  // another thread may have filled the entry while we were waiting for the lock
+  entry = s_decoder_cache[idx].load(std::memory_order_acquire);
+  if (entry) {
+    return entry;
+  }
+
+  std::unique_ptr<decoder_cache_entry> new_entry(new decoder_cache_entry);
+  fill_decoder_cache_entry(type, *new_entry);
+
+  entry = new_entry.get();
+  s_decoder_cache_entries.push_back(std::move(new_entry));
+  s_decoder_cache[idx].store(entry, std::memory_order_release);
+
+  return entry;
+}
+
+
+const struct heif_decoder_plugin* get_decoder(enum heif_compression_format type, const char* name_id)
+{
+  load_deferred_plugins();
+
+  decoder_cache_entry uncached_entry;
+  const decoder_cache_entry* entry = get_decoder_cache_entry(type, uncached_entry);
+
+  if (entry->plugins.empty()) {
+    return nullptr;
+  }
+
+  if (name_id) {
+    for (const auto& p : entry->plugins) {
+      if (p.plugin->plugin_api_version >= 3 && strcmp(name_id, p.plugin->id_name) == 0) {
+        return p.plugin;
       }
     }
+  }
 
-    if (priority > highest_priority) {
-      highest_priority = priority;
-      best_plugin = plugin;
+  return entry->plugins[0].plugin;
+}
+
+
+const struct heif_decoder_plugin* get_fallback_decoder(enum heif_compression_format type,
+                                                       const struct heif_decoder_plugin* failed_plugin)
+{
+  int failed_priority = failed_plugin->does_support_format(type);
+
+  decoder_cache_entry uncached_entry;
+  const decoder_cache_entry* entry = get_decoder_cache_entry(type, uncached_entry);
+
+  for (const auto& p : entry->plugins) {
+    if (p.priority < failed_priority) {
+      return p.plugin;
     }
   }
 
-  return best_plugin;
+  return nullptr;
 }
 
 
 void register_encoder(const heif_encoder_plugin* encoder_plugin)
 {
-  if (encoder_plugin->init_plugin) {
-    (*encoder_plugin->init_plugin)();
-  }
-
   auto descriptor = std::unique_ptr<struct heif_encoder_descriptor>(new heif_encoder_descriptor);
   descriptor->plugin = encoder_plugin;
 
@@ -162,6 +328,32 @@ void register_encoder(const heif_encoder_plugin* encoder_plugin)
 }
 
 
+void initialize_encoder_plugin(const heif_encoder_plugin* encoder_plugin)
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(s_plugin_initialization_mutex);
+#endif
+
+  bool first_use = s_initialized_encoder_plugins.insert(encoder_plugin).second;
+  if (first_use && encoder_plugin->init_plugin) {
+    (*encoder_plugin->init_plugin)();
+  }
+}
+
+
+void deinitialize_encoder_plugin(const heif_encoder_plugin* encoder_plugin)
+{
+#if ENABLE_PARALLEL_TILE_DECODING
+  std::lock_guard<std::mutex> lock(s_plugin_initialization_mutex);
+#endif
+
+  bool was_initialized = (s_initialized_encoder_plugins.erase(encoder_plugin) > 0);
+  if (was_initialized && encoder_plugin->cleanup_plugin) {
+    (*encoder_plugin->cleanup_plugin)();
+  }
+}
+
+
 const struct heif_encoder_plugin* get_encoder(enum heif_compression_format type)
 {
   auto filtered_encoder_descriptors = get_filtered_encoder_descriptors(type, nullptr);
@@ -178,6 +370,8 @@ std::vector<const struct heif_encoder_descriptor*>
 get_filtered_encoder_descriptors(enum heif_compression_format format,
                                  const char* name)
 {
+  load_deferred_plugins();
+
   std::vector<const struct heif_encoder_descriptor*> filtered_descriptors;
 
   for (const auto& descr : s_encoder_descriptors) {
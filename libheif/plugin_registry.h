@@ -62,10 +62,29 @@ void register_default_plugins();
 
 void register_decoder(const heif_decoder_plugin* decoder_plugin);
 
+// Must be called whenever s_decoder_plugins is changed other than through register_decoder().
+void invalidate_decoder_cache();
+
 void register_encoder(const heif_encoder_plugin* encoder_plugin);
 
+// Registered plugins are initialized when they are used for the first time.
+// Calling these functions more than once has no effect.
+void initialize_decoder_plugin(const heif_decoder_plugin* decoder_plugin);
+
+void initialize_encoder_plugin(const heif_encoder_plugin* encoder_plugin);
+
+// Deinitialize the plugin if it has been initialized.
+void deinitialize_decoder_plugin(const heif_decoder_plugin* decoder_plugin);
+
+void deinitialize_encoder_plugin(const heif_encoder_plugin* encoder_plugin);
+
 const struct heif_decoder_plugin* get_decoder(enum heif_compression_format type, const char* name_id);
 
+// Returns the decoder with the highest priority below the priority of 'failed_plugin',
+// or nullptr if there is none. Used when 'failed_plugin' cannot decode a specific image.
+const struct heif_decoder_plugin* get_fallback_decoder(enum heif_compression_format type,
+                                                       const struct heif_decoder_plugin* failed_plugin);
+
 const struct heif_encoder_plugin* get_encoder(enum heif_compression_format type);
 
 std::vector<const struct heif_encoder_descriptor*>
@@ -29,6 +29,7 @@
 #include <memory>
 #include <cstring>
 #include <cassert>
+#include <vector>
 
 #include <aom/aom_decoder.h>
 #include <aom/aomdx.h>
@@ -41,7 +42,14 @@ struct aom_decoder
 
   aom_codec_iface_t* iface;
 
+  // The number of threads is set when initializing the codec. The codec is initialized
+  // on first use, since the number of threads may still change.
+  unsigned int num_threads = 0;
+
   bool strict_decoding = false;
+
+  // data pushed since the last decode, it is sent to the codec as one temporal unit
+  std::vector<uint8_t> pending_data;
 };
 
 static const char kSuccess[] = "Success";
@@ -94,17 +102,6 @@ struct heif_error aom_new_decoder(void** dec)
 
   decoder->iface = aom_codec_av1_dx();
 
-  aom_codec_err_t aomerr = aom_codec_dec_init(&decoder->codec, decoder->iface, NULL, 0);
-  if (aomerr) {
-    *dec = NULL;
-
-    delete decoder;
-
-    struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, aom_codec_err_to_string(aomerr)};
-    return err;
-  }
-
-  decoder->codec_initialized = true;
   *dec = decoder;
 
   struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
@@ -129,6 +126,49 @@ void aom_free_decoder(void* decoder_raw)
 }
 
 
+void aom_reset_image(void* decoder_raw)
+{
+  struct aom_decoder* decoder = (aom_decoder*) decoder_raw;
+
+  // Each AV1 image item carries its own sequence header, so we only have to
+  // drop any frames that have not been fetched from the previous image.
+  if (decoder->codec_initialized) {
+    aom_codec_iter_t iter = NULL;
+    while (aom_codec_get_frame(&decoder->codec, &iter) != NULL) {
+    }
+  }
+
+  decoder->pending_data.clear();
+}
+
+
+struct heif_error aom_set_parameter_integer(void* decoder_raw, const char* name, int value)
+{
+  struct aom_decoder* decoder = (aom_decoder*) decoder_raw;
+
+  if (strcmp(name, heif_decoder_parameter_name_threads) == 0) {
+    if (value < 0) {
+      struct heif_error err = {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, kEmptyString};
+      return err;
+    }
+
+    // The codec is initialized again with the new number of threads for the next image.
+    if (decoder->num_threads != (unsigned int) value && decoder->codec_initialized) {
+      aom_codec_destroy(&decoder->codec);
+      decoder->codec_initialized = false;
+    }
+
+    decoder->num_threads = (unsigned int) value;
+
+    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+    return err;
+  }
+
+  struct heif_error err = {heif_error_Usage_error, heif_suberror_Unsupported_parameter, kEmptyString};
+  return err;
+}
+
+
 void aom_set_strict_decoding(void* decoder_raw, int flag)
 {
   struct aom_decoder* decoder = (aom_decoder*) decoder_raw;
@@ -144,13 +184,10 @@ struct heif_error aom_push_data(void* decoder_raw, const void* frame_data, size_
   const char* ver = aom_codec_version_str();
   (void)ver;
 
-  aom_codec_err_t aomerr;
-  aomerr = aom_codec_decode(&decoder->codec, (const uint8_t*) frame_data, frame_size, NULL);
-  if (aomerr) {
-    struct heif_error err = {heif_error_Invalid_input, heif_suberror_Unspecified, aom_codec_err_to_string(aomerr)};
-    return err;
-  }
-
+  // push_data() may be called several times (e.g. for the codec headers and the image data),
+  // but aom_codec_decode() expects a complete temporal unit. Collect the data until decoding.
+  const auto* data = (const uint8_t*) frame_data;
+  decoder->pending_data.insert(decoder->pending_data.end(), data, data + frame_size);
 
   struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
   return err;
@@ -161,6 +198,31 @@ struct heif_error aom_decode_image(void* decoder_raw, struct heif_image** out_im
 {
   struct aom_decoder* decoder = (struct aom_decoder*) decoder_raw;
 
+  aom_codec_err_t aomerr;
+
+  if (!decoder->codec_initialized) {
+    aom_codec_dec_cfg_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.threads = decoder->num_threads;
+
+    aomerr = aom_codec_dec_init(&decoder->codec, decoder->iface, decoder->num_threads ? &cfg : NULL, 0);
+    if (aomerr) {
+      decoder->pending_data.clear();
+
+      struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, aom_codec_err_to_string(aomerr)};
+      return err;
+    }
+
+    decoder->codec_initialized = true;
+  }
+
+  aomerr = aom_codec_decode(&decoder->codec, decoder->pending_data.data(), decoder->pending_data.size(), NULL);
+  decoder->pending_data.clear();
+  if (aomerr) {
+    struct heif_error err = {heif_error_Invalid_input, heif_suberror_Unspecified, aom_codec_err_to_string(aomerr)};
+    return err;
+  }
+
   aom_codec_iter_t iter = NULL;
   aom_image_t* img = NULL;
 
@@ -281,7 +343,7 @@ struct heif_error aom_decode_image(void* decoder_raw, struct heif_image** out_im
 
 static const struct heif_decoder_plugin decoder_aom
     {
-        3,
+        5,
         aom_plugin_name,
         aom_init_plugin,
         aom_deinit_plugin,
@@ -291,7 +353,9 @@ static const struct heif_decoder_plugin decoder_aom
         aom_push_data,
         aom_decode_image,
         aom_set_strict_decoding,
-        "aom"
+        "aom",
+        aom_reset_image,
+        aom_set_parameter_integer
     };
 
 
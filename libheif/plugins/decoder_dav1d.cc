@@ -28,6 +28,8 @@
 #include "config.h"
 #endif
 
+#include <atomic>
+#include <deque>
 #include <memory>
 #include <cstring>
 #include <cassert>
@@ -39,8 +41,11 @@
 struct dav1d_decoder
 {
   Dav1dSettings settings;
-  Dav1dContext* context;
-  Dav1dData data;
+  Dav1dContext* context = nullptr; // opened on first use, since the settings may still change
+
+  // Data that has been pushed but not yet been sent to dav1d, in the order in which it was pushed.
+  // Each push_data() call is one entry, such that earlier data is never copied again.
+  std::deque<Dav1dData> pending_data;
   bool strict_decoding = false;
 };
 
@@ -97,13 +102,11 @@ struct heif_error dav1d_new_decoder(void** dec)
 
   decoder->settings.frame_size_limit = MAX_IMAGE_WIDTH * MAX_IMAGE_HEIGHT;
   decoder->settings.all_layers = 0;
-
-  if (dav1d_open(&decoder->context, &decoder->settings) != 0) {
-    struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kSuccess};
-    return err;
-  }
-
-  memset(&decoder->data, 0, sizeof(Dav1dData));
+#if DAV1D_API_VERSION_MAJOR >= 6
+  // we usually decode single frames, frame threading would only add latency
+  // (see dav1d_open_context())
+  decoder->settings.max_frame_delay = 1;
+#endif
 
   *dec = decoder;
 
@@ -112,6 +115,16 @@ struct heif_error dav1d_new_decoder(void** dec)
 }
 
 
+static void dav1d_clear_pending_data(struct dav1d_decoder* decoder)
+{
+  for (Dav1dData& data : decoder->pending_data) {
+    dav1d_data_unref(&data);
+  }
+
+  decoder->pending_data.clear();
+}
+
+
 void dav1d_free_decoder(void* decoder_raw)
 {
   auto* decoder = (dav1d_decoder*) decoder_raw;
@@ -120,9 +133,8 @@ void dav1d_free_decoder(void* decoder_raw)
     return;
   }
 
-  if (decoder->data.sz) {
-    dav1d_data_unref(&decoder->data);
-  }
+  dav1d_clear_pending_data(decoder);
+
   if (decoder->context) {
     dav1d_close(&decoder->context);
   }
@@ -131,6 +143,51 @@ void dav1d_free_decoder(void* decoder_raw)
 }
 
 
+void dav1d_reset_image(void* decoder_raw)
+{
+  auto* decoder = (dav1d_decoder*) decoder_raw;
+
+  dav1d_clear_pending_data(decoder);
+
+  if (decoder->context) {
+    dav1d_flush(decoder->context);
+  }
+}
+
+
+struct heif_error dav1d_set_parameter_integer(void* decoder_raw, const char* name, int value)
+{
+  auto* decoder = (dav1d_decoder*) decoder_raw;
+
+  if (strcmp(name, heif_decoder_parameter_name_threads) == 0) {
+    if (value < 0) {
+      struct heif_error err = {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, kEmptyString};
+      return err;
+    }
+
+#if DAV1D_API_VERSION_MAJOR >= 6
+    bool changed = (decoder->settings.n_threads != value);
+    decoder->settings.n_threads = value;
+#else
+    bool changed = (decoder->settings.n_tile_threads != value);
+    decoder->settings.n_frame_threads = 1;
+    decoder->settings.n_tile_threads = value;
+#endif
+
+    // The number of threads can only be set when opening the decoder. It is reopened for the next image.
+    if (changed && decoder->context) {
+      dav1d_close(&decoder->context);
+    }
+
+    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+    return err;
+  }
+
+  struct heif_error err = {heif_error_Usage_error, heif_suberror_Unsupported_parameter, kEmptyString};
+  return err;
+}
+
+
 void dav1d_set_strict_decoding(void* decoder_raw, int flag)
 {
   struct dav1d_decoder* decoder = (dav1d_decoder*) decoder_raw;
@@ -142,9 +199,11 @@ struct heif_error dav1d_push_data(void* decoder_raw, const void* frame_data, siz
 {
   auto* decoder = (struct dav1d_decoder*) decoder_raw;
 
-  assert(decoder->data.sz == 0);
-
-  uint8_t* d = dav1d_data_create(&decoder->data, frame_size);
+  // push_data() may be called several times (e.g. for the codec headers and the image data).
+  // The data is only valid during the call, hence it is copied once. It is sent to dav1d as a
+  // separate packet after the data that has been pushed before.
+  Dav1dData data;
+  uint8_t* d = dav1d_data_create(&data, frame_size);
   if (d == nullptr) {
     struct heif_error err = {heif_error_Memory_allocation_error, heif_suberror_Unspecified, kSuccess};
     return err;
@@ -152,50 +211,67 @@ struct heif_error dav1d_push_data(void* decoder_raw, const void* frame_data, siz
 
   memcpy(d, frame_data, frame_size);
 
+  decoder->pending_data.push_back(data);
+
   struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
   return err;
 }
 
 
-struct heif_error dav1d_decode_image(void* decoder_raw, struct heif_image** out_img)
+// A decoded picture whose buffers are used by the planes of a heif_image.
+// It is released when the last of these planes is freed.
+struct dav1d_shared_picture
 {
-  auto* decoder = (struct dav1d_decoder*) decoder_raw;
+  Dav1dPicture picture;
+  std::atomic<int> num_planes;
+};
 
-  struct heif_error err;
 
-  Dav1dPicture frame;
-  memset(&frame, 0, sizeof(Dav1dPicture));
+static void release_plane_picture(void* shared_picture_raw)
+{
+  auto* shared_picture = (struct dav1d_shared_picture*) shared_picture_raw;
 
-  bool flushed = false;
+  if (--shared_picture->num_planes == 0) {
+    dav1d_picture_unref(&shared_picture->picture);
+    delete shared_picture;
+  }
+}
 
-  for (;;) {
 
-    int res = dav1d_send_data(decoder->context, &decoder->data);
-    if ((res < 0) && (res != DAV1D_ERR(EAGAIN))) {
-      err = {heif_error_Decoder_plugin_error,
-             heif_suberror_Unspecified,
-             kEmptyString};
-      return err;
-    }
+// Opens the decoder context if it is not open yet.
+// Frame threading is only enabled for decoding a sequence of images.
+static bool dav1d_open_context(struct dav1d_decoder* decoder, bool frame_threading)
+{
+#if DAV1D_API_VERSION_MAJOR >= 6
+  int max_frame_delay = (frame_threading ? 0 /* auto */ : 1);
+  if (decoder->context && decoder->settings.max_frame_delay != max_frame_delay) {
+    dav1d_close(&decoder->context);
+  }
 
-    res = dav1d_get_picture(decoder->context, &frame);
-    if (!flushed && res == DAV1D_ERR(EAGAIN)) {
-      if (decoder->data.sz == 0) {
-        flushed = true;
-      }
-      continue;
-    }
-    else if (res < 0) {
-      err = {heif_error_Decoder_plugin_error,
-             heif_suberror_Unspecified,
-             kEmptyString};
-      return err;
-    }
-    else {
-      break;
+  decoder->settings.max_frame_delay = max_frame_delay;
+#else
+  (void) frame_threading;
+#endif
+
+  if (!decoder->context) {
+    if (dav1d_open(&decoder->context, &decoder->settings) != 0) {
+      decoder->context = nullptr;
+      return false;
     }
   }
 
+  return true;
+}
+
+
+// Creates a heif_image that uses the buffers of the decoded 'frame'.
+// The image takes over the reference to the picture, which is released on errors.
+static struct heif_error convert_dav1d_picture_to_heif_image(struct dav1d_decoder* decoder,
+                                                             Dav1dPicture& frame,
+                                                             struct heif_image** out_img)
+{
+  struct heif_error err;
+
   heif_chroma chroma;
   heif_colorspace colorspace;
   switch (frame.p.layout) {
@@ -216,6 +292,8 @@ struct heif_error dav1d_decode_image(void* decoder_raw, struct heif_image** out_
       colorspace = heif_colorspace_monochrome;
       break;
     default: {
+      dav1d_picture_unref(&frame);
+
       err = {heif_error_Decoder_plugin_error,
              heif_suberror_Unspecified,
              kEmptyString};
@@ -231,6 +309,7 @@ struct heif_error dav1d_decode_image(void* decoder_raw, struct heif_image** out_
                           &heif_img);
   if (err.code != heif_error_Ok) {
     assert(heif_img == nullptr);
+    dav1d_picture_unref(&frame);
     return err;
   }
 
@@ -255,49 +334,298 @@ struct heif_error dav1d_decode_image(void* decoder_raw, struct heif_image** out_
   };
 
 
-  // --- copy image data
+  // --- hand over the picture buffers to the image without copying them
 
   int num_planes = (chroma == heif_chroma_monochrome ? 1 : 3);
 
+  auto* shared_picture = new dav1d_shared_picture();
+  shared_picture->picture = frame; // takes over our reference to the picture
+  shared_picture->num_planes = num_planes;
+
   for (int c = 0; c < num_planes; c++) {
     int bpp = frame.p.bpc;
 
-    const uint8_t* data = (uint8_t*) frame.data[c];
+    uint8_t* data = (uint8_t*) frame.data[c];
     int stride = (int) frame.stride[c > 0 ? 1 : 0];
 
     int w, h;
     get_subsampled_size(frame.p.w, frame.p.h,
                         channel2plane[c], chroma, &w, &h);
 
-    err = heif_image_add_plane(heif_img, channel2plane[c], w, h, bpp);
+    err = heif_image_add_external_plane(heif_img, channel2plane[c], w, h, bpp, data, stride,
+                                        release_plane_picture, shared_picture);
     if (err.code != heif_error_Ok) {
+      // drop the references of the planes that have not been added
+      for (int i = c; i < num_planes; i++) {
+        release_plane_picture(shared_picture);
+      }
+
       heif_image_release(heif_img);
       return err;
     }
+  }
 
-    int dst_stride;
-    uint8_t* dst_mem = heif_image_get_plane(heif_img, channel2plane[c], &dst_stride);
+  *out_img = heif_img;
+
+
+  err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+  return err;
+}
 
-    int bytes_per_pixel = (bpp + 7) / 8;
 
-    for (int y = 0; y < h; y++) {
-      memcpy(dst_mem + y * dst_stride, data + y * stride, w * bytes_per_pixel);
+// Sends the pending data to dav1d until it does not accept more data before pictures are output.
+// Returns a negative dav1d error code if the data cannot be decoded.
+static int dav1d_send_pending_data(struct dav1d_decoder* decoder)
+{
+  while (!decoder->pending_data.empty()) {
+    Dav1dData& data = decoder->pending_data.front();
+
+    int res = dav1d_send_data(decoder->context, &data);
+    if (res == DAV1D_ERR(EAGAIN)) {
+      return 0;
+    }
+    else if (res < 0) {
+      return res;
+    }
+
+    // dav1d took over the reference to the data
+    if (data.sz == 0) {
+      decoder->pending_data.pop_front();
     }
   }
 
-  dav1d_picture_unref(&frame);
+  return 0;
+}
 
-  *out_img = heif_img;
+
+struct heif_error dav1d_decode_image(void* decoder_raw, struct heif_image** out_img)
+{
+  auto* decoder = (struct dav1d_decoder*) decoder_raw;
+
+  struct heif_error err;
+
+  Dav1dPicture frame;
+  memset(&frame, 0, sizeof(Dav1dPicture));
+
+  bool flushed = false;
+
+  if (!dav1d_open_context(decoder, false)) {
+    err = {heif_error_Decoder_plugin_error,
+           heif_suberror_Unspecified,
+           kEmptyString};
+    return err;
+  }
+
+  for (;;) {
+
+    int res = dav1d_send_pending_data(decoder);
+    if (res < 0) {
+      err = {heif_error_Decoder_plugin_error,
+             heif_suberror_Unspecified,
+             kEmptyString};
+      return err;
+    }
+
+    res = dav1d_get_picture(decoder->context, &frame);
+    if (!flushed && res == DAV1D_ERR(EAGAIN)) {
+      if (decoder->pending_data.empty()) {
+        flushed = true;
+      }
+      continue;
+    }
+    else if (res < 0) {
+      err = {heif_error_Decoder_plugin_error,
+             heif_suberror_Unspecified,
+             kEmptyString};
+      return err;
+    }
+    else {
+      break;
+    }
+  }
+
+  return convert_dav1d_picture_to_heif_image(decoder, frame, out_img);
+}
+
+
+static void dav1d_no_free(const uint8_t*, void*)
+{
+  // the image data is owned by libheif and valid until decode_image_sequence() returns
+}
 
 
+struct heif_error dav1d_decode_image_sequence(void* decoder_raw,
+                                              const void* headers, size_t headers_size,
+                                              const void* const* image_data, const size_t* image_sizes,
+                                              int num_images,
+                                              struct heif_error (* image_decoded)(void* callback_user_data,
+                                                                                  int image_index,
+                                                                                  struct heif_image* img),
+                                              void* callback_user_data)
+{
+  auto* decoder = (struct dav1d_decoder*) decoder_raw;
+
+  struct heif_error err = {heif_error_Decoder_plugin_error,
+                           heif_suberror_Unspecified,
+                           kEmptyString};
+
+  // With frame threading, dav1d decodes several of the (intra-only) images concurrently.
+  if (!dav1d_open_context(decoder, true)) {
+    return err;
+  }
+
+  // The sequence header is sent only once. The images are passed to dav1d without copying them.
+  if (headers_size) {
+    err = dav1d_push_data(decoder, headers, headers_size);
+    if (err.code != heif_error_Ok) {
+      return err;
+    }
+  }
+
+  int next_image = 0;
+  bool flushed = false;
+
+  for (;;) {
+    if (decoder->pending_data.empty() && next_image < num_images) {
+      Dav1dData data;
+      if (dav1d_data_wrap(&data, (const uint8_t*) image_data[next_image], image_sizes[next_image],
+                          dav1d_no_free, nullptr) != 0) {
+        err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+        return err;
+      }
+
+      // The timestamp identifies the image in dav1d's output.
+      data.m.timestamp = next_image;
+      decoder->pending_data.push_back(data);
+      next_image++;
+    }
+
+    int res = dav1d_send_pending_data(decoder);
+    if (res < 0) {
+      err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+      return err;
+    }
+
+    Dav1dPicture frame;
+    memset(&frame, 0, sizeof(Dav1dPicture));
+
+    res = dav1d_get_picture(decoder->context, &frame);
+    if (res == DAV1D_ERR(EAGAIN)) {
+      if (decoder->pending_data.empty() && next_image == num_images) {
+        // Sending data resets dav1d's drain mode. Only the following calls wait for the frames that
+        // are still decoded by the frame threads, until all pictures have been output.
+        if (flushed) {
+          break;
+        }
+
+        flushed = true;
+      }
+
+      continue;
+    }
+    else if (res < 0) {
+      err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+      return err;
+    }
+
+    int64_t image_index = frame.m.timestamp;
+    if (image_index < 0 || image_index >= num_images) {
+      dav1d_picture_unref(&frame);
+      err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, "Decoded picture has no valid image index"};
+      return err;
+    }
+
+    struct heif_image* heif_img = nullptr;
+    err = convert_dav1d_picture_to_heif_image(decoder, frame, &heif_img);
+    if (err.code != heif_error_Ok) {
+      return err;
+    }
+
+    err = image_decoded(callback_user_data, static_cast<int>(image_index), heif_img);
+    if (err.code != heif_error_Ok) {
+      return err;
+    }
+  }
+
   err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
   return err;
 }
 
 
+struct heif_error dav1d_push_frame(void* decoder_raw, const void* data, size_t size, int64_t timestamp)
+{
+  auto* decoder = (struct dav1d_decoder*) decoder_raw;
+
+  // dav1d outputs the remaining frames in dav1d_get_picture() when no more data is sent.
+  if (data == nullptr) {
+    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+    return err;
+  }
+
+  // With frame threading, dav1d decodes the following frames while the previous frames are output.
+  if (!dav1d_open_context(decoder, true)) {
+    struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+    return err;
+  }
+
+  // All data that has been pushed before has been sent by dav1d_get_frame(), except for the codec headers
+  // that are pushed before the first frame.
+  struct heif_error err = dav1d_push_data(decoder, data, size);
+  if (err.code != heif_error_Ok) {
+    return err;
+  }
+
+  decoder->pending_data.back().m.timestamp = timestamp;
+
+  return err;
+}
+
+
+struct heif_error dav1d_get_frame(void* decoder_raw, struct heif_image** out_img, int64_t* out_timestamp)
+{
+  auto* decoder = (struct dav1d_decoder*) decoder_raw;
+
+  *out_img = nullptr;
+
+  if (!decoder->context) {
+    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+    return err;
+  }
+
+  for (;;) {
+    int res = dav1d_send_pending_data(decoder);
+    if (res < 0) {
+      struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+      return err;
+    }
+
+    Dav1dPicture frame;
+    memset(&frame, 0, sizeof(Dav1dPicture));
+
+    res = dav1d_get_picture(decoder->context, &frame);
+    if (res == DAV1D_ERR(EAGAIN)) {
+      if (decoder->pending_data.empty()) {
+        // all data has been sent, the decoder needs the next frame
+        struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+        return err;
+      }
+
+      continue;
+    }
+    else if (res < 0) {
+      struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+      return err;
+    }
+
+    *out_timestamp = frame.m.timestamp;
+    return convert_dav1d_picture_to_heif_image(decoder, frame, out_img);
+  }
+}
+
+
 static const struct heif_decoder_plugin decoder_dav1d
     {
-        3,
+        8,
         dav1d_plugin_name,
         dav1d_init_plugin,
         dav1d_deinit_plugin,
@@ -307,7 +635,13 @@ static const struct heif_decoder_plugin decoder_dav1d
         dav1d_push_data,
         dav1d_decode_image,
         dav1d_set_strict_decoding,
-        "dav1d"
+        "dav1d",
+        dav1d_reset_image,
+        dav1d_set_parameter_integer,
+        nullptr, // decode_image_into
+        dav1d_decode_image_sequence,
+        dav1d_push_frame,
+        dav1d_get_frame
     };
 
 
@@ -0,0 +1,561 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Hardware accelerated HEVC and AV1 decoding through the hwaccel interface of libavcodec
+// (VA-API on Linux, VideoToolbox on macOS/iOS).
+// The plugin only announces the formats that the hardware can decode. Images that the hardware
+// cannot decode (e.g. unsupported profiles) are rejected with heif_suberror_Unsupported_codec,
+// such that libheif decodes them with the software decoder that has the next lower priority.
+
+#include "libheif/heif.h"
+#include "libheif/heif_plugin.h"
+#include "decoder_ffmpeg.h"
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <memory>
+#include <mutex>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+}
+
+
+struct ffmpeg_decoder
+{
+  std::vector<uint8_t> data;
+
+  AVCodecContext* codec_context = nullptr; // opened on first use, since the codec is known only then
+  enum AVCodecID codec_id = AV_CODEC_ID_NONE;
+  enum AVPixelFormat hw_pixel_format = AV_PIX_FMT_NONE;
+  bool hw_format_rejected = false;
+
+  int num_threads = 1;
+  bool strict_decoding = false;
+};
+
+static const char kEmptyString[] = "";
+static const char kSuccess[] = "Success";
+
+// higher than the software decoders, such that these are only used when the hardware cannot decode the format
+static const int FFMPEG_HW_PLUGIN_PRIORITY = 200;
+
+#if defined(__APPLE__)
+static const enum AVHWDeviceType kHWDeviceType = AV_HWDEVICE_TYPE_VIDEOTOOLBOX;
+#else
+static const enum AVHWDeviceType kHWDeviceType = AV_HWDEVICE_TYPE_VAAPI;
+#endif
+
+#define MAX_PLUGIN_NAME_LENGTH 80
+
+static char plugin_name[MAX_PLUGIN_NAME_LENGTH];
+
+
+// The hardware device is opened when the plugin is first asked for a format, because
+// opening it at plugin registration would slow down all applications that do not decode anything.
+static std::mutex s_hw_device_mutex;
+static bool s_hw_device_probed = false;
+static AVBufferRef* s_hw_device = nullptr;
+static enum AVPixelFormat s_hevc_hw_pixel_format = AV_PIX_FMT_NONE;
+static enum AVPixelFormat s_av1_hw_pixel_format = AV_PIX_FMT_NONE;
+
+
+static enum AVPixelFormat get_hw_pixel_format(enum AVCodecID codec_id)
+{
+  const AVCodec* codec = avcodec_find_decoder(codec_id);
+  if (!codec) {
+    return AV_PIX_FMT_NONE;
+  }
+
+  for (int i = 0;; i++) {
+    const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+    if (!config) {
+      return AV_PIX_FMT_NONE;
+    }
+
+    if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) &&
+        config->device_type == kHWDeviceType) {
+      return config->pix_fmt;
+    }
+  }
+}
+
+
+static void open_hw_device()
+{
+  std::lock_guard<std::mutex> lock(s_hw_device_mutex);
+
+  if (s_hw_device_probed) {
+    return;
+  }
+
+  s_hw_device_probed = true;
+
+  if (av_hwdevice_ctx_create(&s_hw_device, kHWDeviceType, nullptr, nullptr, 0) < 0) {
+    s_hw_device = nullptr;
+    return;
+  }
+
+  s_hevc_hw_pixel_format = get_hw_pixel_format(AV_CODEC_ID_HEVC);
+  s_av1_hw_pixel_format = get_hw_pixel_format(AV_CODEC_ID_AV1);
+}
+
+
+static const char* ffmpeg_plugin_name()
+{
+  snprintf(plugin_name, MAX_PLUGIN_NAME_LENGTH, "FFMPEG %s decoder (libavcodec %s)",
+           av_hwdevice_get_type_name(kHWDeviceType),
+           LIBAVCODEC_IDENT + strlen("Lavc"));
+
+  // make sure that the string is null-terminated
+  plugin_name[MAX_PLUGIN_NAME_LENGTH - 1] = 0;
+
+  return plugin_name;
+}
+
+
+static void ffmpeg_init_plugin()
+{
+}
+
+
+static void ffmpeg_deinit_plugin()
+{
+  std::lock_guard<std::mutex> lock(s_hw_device_mutex);
+
+  if (s_hw_device) {
+    av_buffer_unref(&s_hw_device);
+  }
+
+  s_hw_device_probed = false;
+}
+
+
+static int ffmpeg_does_support_format(enum heif_compression_format format)
+{
+  open_hw_device();
+
+  if (!s_hw_device) {
+    return 0;
+  }
+
+  if ((format == heif_compression_HEVC && s_hevc_hw_pixel_format != AV_PIX_FMT_NONE) ||
+      (format == heif_compression_AV1 && s_av1_hw_pixel_format != AV_PIX_FMT_NONE)) {
+    return FFMPEG_HW_PLUGIN_PRIORITY;
+  }
+  else {
+    return 0;
+  }
+}
+
+
+static struct heif_error ffmpeg_new_decoder(void** dec)
+{
+  struct ffmpeg_decoder* decoder = new ffmpeg_decoder();
+
+  *dec = decoder;
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+  return err;
+}
+
+
+static void ffmpeg_free_decoder(void* decoder_raw)
+{
+  struct ffmpeg_decoder* decoder = (struct ffmpeg_decoder*) decoder_raw;
+
+  if (decoder->codec_context) {
+    avcodec_free_context(&decoder->codec_context);
+  }
+
+  delete decoder;
+}
+
+
+static void ffmpeg_reset_image(void* decoder_raw)
+{
+  struct ffmpeg_decoder* decoder = (struct ffmpeg_decoder*) decoder_raw;
+
+  decoder->data.clear();
+
+  // leaves the draining mode after the previous image
+  if (decoder->codec_context) {
+    avcodec_flush_buffers(decoder->codec_context);
+  }
+}
+
+
+static void ffmpeg_set_strict_decoding(void* decoder_raw, int flag)
+{
+  struct ffmpeg_decoder* decoder = (struct ffmpeg_decoder*) decoder_raw;
+
+  decoder->strict_decoding = flag;
+}
+
+
+static struct heif_error ffmpeg_set_parameter_integer(void* decoder_raw, const char* name, int value)
+{
+  struct ffmpeg_decoder* decoder = (struct ffmpeg_decoder*) decoder_raw;
+
+  if (strcmp(name, heif_decoder_parameter_name_threads) == 0) {
+    if (value < 1) {
+      struct heif_error err = {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, kEmptyString};
+      return err;
+    }
+
+    // The number of threads can only be set when opening the codec. It is reopened for the next image.
+    if (value != decoder->num_threads && decoder->codec_context) {
+      avcodec_free_context(&decoder->codec_context);
+    }
+
+    decoder->num_threads = value;
+
+    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+    return err;
+  }
+
+  struct heif_error err = {heif_error_Usage_error, heif_suberror_Unsupported_parameter, kEmptyString};
+  return err;
+}
+
+
+static struct heif_error ffmpeg_push_data(void* decoder_raw, const void* data, size_t size)
+{
+  struct ffmpeg_decoder* decoder = (struct ffmpeg_decoder*) decoder_raw;
+
+  const uint8_t* cdata = (const uint8_t*) data;
+  decoder->data.insert(decoder->data.end(), cdata, cdata + size);
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+  return err;
+}
+
+
+static enum AVPixelFormat ffmpeg_get_format(AVCodecContext* codec_context, const enum AVPixelFormat* formats)
+{
+  struct ffmpeg_decoder* decoder = (struct ffmpeg_decoder*) codec_context->opaque;
+
+  for (const enum AVPixelFormat* format = formats; *format != AV_PIX_FMT_NONE; format++) {
+    if (*format == decoder->hw_pixel_format) {
+      return *format;
+    }
+  }
+
+  // The hardware cannot decode this stream. Do not fall back to the software decoder of
+  // libavcodec, but let libheif use its own software decoder plugin.
+  decoder->hw_format_rejected = true;
+  return AV_PIX_FMT_NONE;
+}
+
+
+static bool open_codec(struct ffmpeg_decoder* decoder, enum AVCodecID codec_id)
+{
+  if (decoder->codec_context && decoder->codec_id == codec_id) {
+    return true;
+  }
+
+  if (decoder->codec_context) {
+    avcodec_free_context(&decoder->codec_context);
+  }
+
+  const AVCodec* codec = avcodec_find_decoder(codec_id);
+  if (!codec) {
+    return false;
+  }
+
+  decoder->codec_context = avcodec_alloc_context3(codec);
+  if (!decoder->codec_context) {
+    return false;
+  }
+
+  decoder->codec_id = codec_id;
+  decoder->hw_pixel_format = (codec_id == AV_CODEC_ID_HEVC ? s_hevc_hw_pixel_format : s_av1_hw_pixel_format);
+
+  decoder->hw_format_rejected = false;
+
+  decoder->codec_context->opaque = decoder;
+  decoder->codec_context->get_format = ffmpeg_get_format;
+  decoder->codec_context->hw_device_ctx = av_buffer_ref(s_hw_device);
+  decoder->codec_context->thread_count = decoder->num_threads;
+
+  if (avcodec_open2(decoder->codec_context, codec, nullptr) < 0) {
+    avcodec_free_context(&decoder->codec_context);
+    return false;
+  }
+
+  return true;
+}
+
+
+// libheif passes HEVC NAL units with a 4-byte size prefix. libavcodec expects them with start codes
+// when there is no 'hvcC' extradata. Both prefixes have the same size, hence they are replaced in place.
+static bool convert_hevc_to_annexb(std::vector<uint8_t>& data)
+{
+  size_t ptr = 0;
+  while (ptr < data.size()) {
+    if (4 > data.size() - ptr) {
+      return false;
+    }
+
+    uint32_t nal_size = (uint32_t) ((data[ptr] << 24) | (data[ptr + 1] << 16) | (data[ptr + 2] << 8) | (data[ptr + 3]));
+
+    data[ptr + 0] = 0;
+    data[ptr + 1] = 0;
+    data[ptr + 2] = 0;
+    data[ptr + 3] = 1;
+    ptr += 4;
+
+    if (nal_size > data.size() - ptr) {
+      return false;
+    }
+
+    ptr += nal_size;
+  }
+
+  return true;
+}
+
+
+// Converts the (transferred) software frame to a heif_image.
+// Handles all planar and semi-planar YUV formats in little endian, e.g. NV12 and P010 from the hardware.
+static struct heif_error convert_frame_to_heif_image(struct ffmpeg_decoder* decoder,
+                                                     const AVFrame* frame,
+                                                     struct heif_image** out_img)
+{
+  struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unsupported_color_conversion, kEmptyString};
+
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat) frame->format);
+  if (!desc ||
+      (desc->flags & (AV_PIX_FMT_FLAG_BE | AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL)) ||
+      (desc->nb_components != 1 && desc->nb_components != 3)) {
+    return err;
+  }
+
+  heif_colorspace colorspace = heif_colorspace_YCbCr;
+  heif_chroma chroma;
+  if (desc->nb_components == 1) {
+    colorspace = heif_colorspace_monochrome;
+    chroma = heif_chroma_monochrome;
+  }
+  else if (desc->log2_chroma_w == 1 && desc->log2_chroma_h == 1) {
+    chroma = heif_chroma_420;
+  }
+  else if (desc->log2_chroma_w == 1 && desc->log2_chroma_h == 0) {
+    chroma = heif_chroma_422;
+  }
+  else if (desc->log2_chroma_w == 0 && desc->log2_chroma_h == 0) {
+    chroma = heif_chroma_444;
+  }
+  else {
+    return err;
+  }
+
+  err = heif_image_create(frame->width, frame->height, colorspace, chroma, out_img);
+  if (err.code != heif_error_Ok) {
+    return err;
+  }
+
+
+  // --- color profile from the bitstream
+
+  struct heif_color_profile_nclx* nclx = heif_nclx_color_profile_alloc();
+  HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_color_primaries(nclx, static_cast<uint16_t>(frame->color_primaries)), { heif_nclx_color_profile_free(nclx);});
+  HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_transfer_characteristics(nclx, static_cast<uint16_t>(frame->color_trc)), { heif_nclx_color_profile_free(nclx);});
+  HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_matrix_coefficients(nclx, static_cast<uint16_t>(frame->colorspace)), { heif_nclx_color_profile_free(nclx);});
+  nclx->full_range_flag = (frame->color_range == AVCOL_RANGE_JPEG);
+  heif_image_set_nclx_color_profile(*out_img, nclx);
+  heif_nclx_color_profile_free(nclx);
+
+
+  // --- copy the components into separate planes
+
+  heif_channel channel2plane[3] = {
+      heif_channel_Y,
+      heif_channel_Cb,
+      heif_channel_Cr
+  };
+
+  for (int c = 0; c < desc->nb_components; c++) {
+    const AVComponentDescriptor& comp = desc->comp[c];
+    int bpp = comp.depth;
+
+    int w = frame->width;
+    int h = frame->height;
+    if (c > 0) {
+      w = -((-w) >> desc->log2_chroma_w);
+      h = -((-h) >> desc->log2_chroma_h);
+    }
+
+    err = heif_image_add_plane(*out_img, channel2plane[c], w, h, bpp);
+    if (err.code != heif_error_Ok) {
+      heif_image_release(*out_img);
+      *out_img = nullptr;
+      return err;
+    }
+
+    int dst_stride;
+    uint8_t* dst = heif_image_get_plane(*out_img, channel2plane[c], &dst_stride);
+
+    const uint8_t* src = frame->data[comp.plane] + comp.offset;
+    int src_stride = frame->linesize[comp.plane];
+    uint16_t mask = (uint16_t) ((1 << bpp) - 1);
+
+    for (int y = 0; y < h; y++) {
+      const uint8_t* src_row = src + y * src_stride;
+
+      if (bpp <= 8) {
+        uint8_t* dst_row = dst + y * dst_stride;
+
+        if (comp.step == 1 && comp.shift == 0) {
+          memcpy(dst_row, src_row, w);
+        }
+        else {
+          for (int x = 0; x < w; x++) {
+            dst_row[x] = (uint8_t) ((src_row[x * comp.step] >> comp.shift) & mask);
+          }
+        }
+      }
+      else {
+        uint16_t* dst_row = (uint16_t*) (dst + y * dst_stride);
+
+        for (int x = 0; x < w; x++) {
+          const uint8_t* p = src_row + x * comp.step;
+          dst_row[x] = (uint16_t) (((p[0] | (p[1] << 8)) >> comp.shift) & mask);
+        }
+      }
+    }
+  }
+
+  err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+  return err;
+}
+
+
+static struct heif_error ffmpeg_decode_image(void* decoder_raw, struct heif_image** out_img)
+{
+  struct ffmpeg_decoder* decoder = (struct ffmpeg_decoder*) decoder_raw;
+
+  struct heif_error err_unsupported = {heif_error_Unsupported_feature, heif_suberror_Unsupported_codec,
+                                       "Image cannot be decoded by the hardware decoder"};
+  struct heif_error err_decoding = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+
+  if (decoder->data.empty()) {
+    return err_decoding;
+  }
+
+  // HEVC data starts with the size of the first NAL unit. The first byte of an AV1 OBU cannot be zero.
+  enum AVCodecID codec_id = (decoder->data[0] == 0 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_AV1);
+
+  if (codec_id == AV_CODEC_ID_HEVC && !convert_hevc_to_annexb(decoder->data)) {
+    return err_decoding;
+  }
+
+  if (!open_codec(decoder, codec_id)) {
+    return err_unsupported;
+  }
+
+  // libavcodec reads beyond the end of the data
+  size_t data_size = decoder->data.size();
+  decoder->data.resize(data_size + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+
+  AVPacket* packet = av_packet_alloc();
+  AVFrame* frame = av_frame_alloc();
+  AVFrame* sw_frame = av_frame_alloc();
+
+  struct heif_error err = err_decoding;
+
+  if (packet && frame && sw_frame) {
+    packet->data = decoder->data.data();
+    packet->size = (int) data_size;
+
+    int ret = avcodec_send_packet(decoder->codec_context, packet);
+    if (ret >= 0) {
+      ret = avcodec_send_packet(decoder->codec_context, nullptr);
+    }
+
+    if (ret >= 0) {
+      ret = avcodec_receive_frame(decoder->codec_context, frame);
+    }
+
+    if (ret < 0) {
+      err = (decoder->hw_format_rejected ? err_unsupported : err_decoding);
+    }
+    else if (frame->format == decoder->hw_pixel_format) {
+      if (av_hwframe_transfer_data(sw_frame, frame, 0) >= 0 &&
+          av_frame_copy_props(sw_frame, frame) >= 0) {
+        err = convert_frame_to_heif_image(decoder, sw_frame, out_img);
+      }
+    }
+    else {
+      err = convert_frame_to_heif_image(decoder, frame, out_img);
+    }
+  }
+
+  av_frame_free(&sw_frame);
+  av_frame_free(&frame);
+  av_packet_free(&packet);
+
+  // The codec cannot be reused after a failed decode.
+  if (err.code != heif_error_Ok) {
+    avcodec_free_context(&decoder->codec_context);
+  }
+
+  return err;
+}
+
+
+static const struct heif_decoder_plugin decoder_ffmpeg
+    {
+        5,
+        ffmpeg_plugin_name,
+        ffmpeg_init_plugin,
+        ffmpeg_deinit_plugin,
+        ffmpeg_does_support_format,
+        ffmpeg_new_decoder,
+        ffmpeg_free_decoder,
+        ffmpeg_push_data,
+        ffmpeg_decode_image,
+        ffmpeg_set_strict_decoding,
+        "ffmpeg",
+        ffmpeg_reset_image,
+        ffmpeg_set_parameter_integer
+    };
+
+
+const struct heif_decoder_plugin* get_decoder_plugin_ffmpeg()
+{
+  return &decoder_ffmpeg;
+}
+
+
+#if PLUGIN_FFMPEG_DECODER
+heif_plugin_info plugin_info {
+  1,
+  heif_plugin_type_decoder,
+  &decoder_ffmpeg
+};
+#endif
@@ -0,0 +1,320 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libheif/heif.h"
+#include "libheif/heif_plugin.h"
+#include "decoder_jpeg.h"
+
+#if defined(HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <jpeglib.h>
+
+struct jpeg_decoder
+{
+  std::vector<uint8_t> data;
+};
+
+static const char kEmptyString[] = "";
+static const char kSuccess[] = "Success";
+
+static const int JPEG_PLUGIN_PRIORITY = 100;
+
+#define MAX_PLUGIN_NAME_LENGTH 80
+
+static char plugin_name[MAX_PLUGIN_NAME_LENGTH];
+
+
+static const char* jpeg_plugin_name()
+{
+#if defined(LIBJPEG_TURBO_VERSION)
+#define LIBJPEG_STRINGIFY2(x) #x
+#define LIBJPEG_STRINGIFY(x) LIBJPEG_STRINGIFY2(x)
+  snprintf(plugin_name, MAX_PLUGIN_NAME_LENGTH, "libjpeg-turbo %s", LIBJPEG_STRINGIFY(LIBJPEG_TURBO_VERSION));
+#else
+  snprintf(plugin_name, MAX_PLUGIN_NAME_LENGTH, "libjpeg %d", JPEG_LIB_VERSION);
+#endif
+
+  // make sure that the string is null-terminated
+  plugin_name[MAX_PLUGIN_NAME_LENGTH - 1] = 0;
+
+  return plugin_name;
+}
+
+
+static void jpeg_init_plugin()
+{
+}
+
+
+static void jpeg_deinit_plugin()
+{
+}
+
+
+static int jpeg_does_support_format(enum heif_compression_format format)
+{
+  if (format == heif_compression_JPEG) {
+    return JPEG_PLUGIN_PRIORITY;
+  }
+  else {
+    return 0;
+  }
+}
+
+
+struct heif_error jpeg_new_decoder(void** dec)
+{
+  auto* decoder = new jpeg_decoder();
+
+  *dec = decoder;
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+  return err;
+}
+
+
+void jpeg_free_decoder(void* decoder_raw)
+{
+  auto* decoder = (jpeg_decoder*) decoder_raw;
+
+  delete decoder;
+}
+
+
+void jpeg_reset_image(void* decoder_raw)
+{
+  auto* decoder = (jpeg_decoder*) decoder_raw;
+
+  decoder->data.clear();
+}
+
+
+void jpeg_set_strict_decoding(void*, int)
+{
+}
+
+
+struct heif_error jpeg_push_data(void* decoder_raw, const void* frame_data, size_t frame_size)
+{
+  auto* decoder = (struct jpeg_decoder*) decoder_raw;
+
+  // push_data() may be called for an optional 'jpgC' prefix and then for the image data.
+  const auto* data = (const uint8_t*) frame_data;
+  decoder->data.insert(decoder->data.end(), data, data + frame_size);
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+  return err;
+}
+
+
+// The default error handler of libjpeg terminates the process. We jump back into jpeg_decode_image() instead.
+struct jpeg_error_handler
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+};
+
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+  auto* handler = (struct jpeg_error_handler*) cinfo->err;
+  longjmp(handler->setjmp_buffer, 1);
+}
+
+
+static void jpeg_output_message(j_common_ptr)
+{
+  // do not print warnings to stderr
+}
+
+
+struct heif_error jpeg_decode_image(void* decoder_raw, struct heif_image** out_img)
+{
+  auto* decoder = (struct jpeg_decoder*) decoder_raw;
+
+  // No objects with destructors may be alive between setjmp() and longjmp().
+  struct heif_image* heif_img = nullptr;
+
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_handler jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = jpeg_error_exit;
+  jerr.pub.output_message = jpeg_output_message;
+
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress(&cinfo);
+    heif_image_release(heif_img);
+
+    struct heif_error err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+    return err;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, decoder->data.data(), (unsigned long) decoder->data.size());
+
+  jpeg_read_header(&cinfo, TRUE);
+
+  // The components are output without color conversion. Chroma is upsampled to 4:4:4.
+  heif_colorspace colorspace;
+  heif_chroma chroma;
+  int num_planes;
+
+  switch (cinfo.jpeg_color_space) {
+    case JCS_GRAYSCALE:
+      cinfo.out_color_space = JCS_GRAYSCALE;
+      colorspace = heif_colorspace_monochrome;
+      chroma = heif_chroma_monochrome;
+      num_planes = 1;
+      break;
+    case JCS_YCbCr:
+      cinfo.out_color_space = JCS_YCbCr;
+      colorspace = heif_colorspace_YCbCr;
+      chroma = heif_chroma_444;
+      num_planes = 3;
+      break;
+    case JCS_RGB:
+      cinfo.out_color_space = JCS_RGB;
+      colorspace = heif_colorspace_RGB;
+      chroma = heif_chroma_444;
+      num_planes = 3;
+      break;
+    default: {
+      jpeg_destroy_decompress(&cinfo);
+
+      struct heif_error err = {heif_error_Unsupported_feature, heif_suberror_Unsupported_color_conversion,
+                               "Unsupported JPEG color space"};
+      return err;
+    }
+  }
+
+  jpeg_start_decompress(&cinfo);
+
+  int width = (int) cinfo.output_width;
+  int height = (int) cinfo.output_height;
+
+  struct heif_error err = heif_image_create(width, height, colorspace, chroma, &heif_img);
+  if (err.code != heif_error_Ok) {
+    jpeg_destroy_decompress(&cinfo);
+    return err;
+  }
+
+  static const heif_channel ycbcr_channels[3] = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr};
+  static const heif_channel rgb_channels[3] = {heif_channel_R, heif_channel_G, heif_channel_B};
+  const heif_channel* channels = (colorspace == heif_colorspace_RGB ? rgb_channels : ycbcr_channels);
+
+  uint8_t* planes[3];
+  int strides[3];
+
+  for (int c = 0; c < num_planes; c++) {
+    err = heif_image_add_plane(heif_img, channels[c], width, height, 8);
+    if (err.code != heif_error_Ok) {
+      jpeg_destroy_decompress(&cinfo);
+      heif_image_release(heif_img);
+      return err;
+    }
+
+    planes[c] = heif_image_get_plane(heif_img, channels[c], &strides[c]);
+  }
+
+  // Decode into a row buffer allocated by libjpeg, which is freed by jpeg_destroy_decompress().
+  JSAMPARRAY row = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE,
+                                              cinfo.output_width * cinfo.output_components, 1);
+
+  while (cinfo.output_scanline < cinfo.output_height) {
+    int y = (int) cinfo.output_scanline;
+    jpeg_read_scanlines(&cinfo, row, 1);
+
+    if (num_planes == 1) {
+      memcpy(planes[0] + y * strides[0], row[0], width);
+    }
+    else {
+      const uint8_t* in = row[0];
+      uint8_t* out0 = planes[0] + y * strides[0];
+      uint8_t* out1 = planes[1] + y * strides[1];
+      uint8_t* out2 = planes[2] + y * strides[2];
+
+      for (int x = 0; x < width; x++) {
+        out0[x] = in[3 * x];
+        out1[x] = in[3 * x + 1];
+        out2[x] = in[3 * x + 2];
+      }
+    }
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+
+
+  // --- JFIF YCbCr uses the BT.601 matrix with full-range values
+
+  if (colorspace == heif_colorspace_YCbCr) {
+    struct heif_color_profile_nclx* nclx = heif_nclx_color_profile_alloc();
+    if (nclx) {
+      nclx->matrix_coefficients = heif_matrix_coefficients_ITU_R_BT_601_6;
+      nclx->full_range_flag = 1;
+      heif_image_set_nclx_color_profile(heif_img, nclx);
+      heif_nclx_color_profile_free(nclx);
+    }
+  }
+
+  *out_img = heif_img;
+
+  err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+  return err;
+}
+
+
+static const struct heif_decoder_plugin decoder_jpeg
+    {
+        4,
+        jpeg_plugin_name,
+        jpeg_init_plugin,
+        jpeg_deinit_plugin,
+        jpeg_does_support_format,
+        jpeg_new_decoder,
+        jpeg_free_decoder,
+        jpeg_push_data,
+        jpeg_decode_image,
+        jpeg_set_strict_decoding,
+        "jpeg",
+        jpeg_reset_image
+    };
+
+
+const struct heif_decoder_plugin* get_decoder_plugin_jpeg()
+{
+  return &decoder_jpeg;
+}
+
+
+#if PLUGIN_JPEG_DECODER
+heif_plugin_info plugin_info {
+  1,
+  heif_plugin_type_decoder,
+  &decoder_jpeg
+};
+#endif
@@ -40,6 +40,11 @@ struct libde265_decoder
 {
   de265_decoder_context* ctx;
   bool strict_decoding = false;
+
+  // The worker threads are started when the first data is pushed,
+  // because libheif sets the number of threads after creating the decoder.
+  int num_threads = 1;
+  bool worker_threads_started = false;
 };
 
 static const char kEmptyString[] = "";
@@ -162,20 +167,37 @@ static struct heif_error convert_libde265_image_to_heif_image(struct libde265_de
 }
 
 
-static struct heif_error libde265_new_decoder(void** dec)
+static de265_decoder_context* libde265_new_context()
 {
-  struct libde265_decoder* decoder = new libde265_decoder();
-  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
-
-  decoder->ctx = de265_new_decoder();
+  de265_decoder_context* ctx = de265_new_decoder();
 #if defined(__EMSCRIPTEN__)
   // Speed up decoding from JavaScript.
-  de265_set_parameter_bool(decoder->ctx, DE265_DECODER_PARAM_DISABLE_DEBLOCKING, 1);
-  de265_set_parameter_bool(decoder->ctx, DE265_DECODER_PARAM_DISABLE_SAO, 1);
-#else
+  de265_set_parameter_bool(ctx, DE265_DECODER_PARAM_DISABLE_DEBLOCKING, 1);
+  de265_set_parameter_bool(ctx, DE265_DECODER_PARAM_DISABLE_SAO, 1);
+#endif
+
+  return ctx;
+}
+
+
+static void libde265_start_worker_threads(struct libde265_decoder* decoder)
+{
+#if !defined(__EMSCRIPTEN__)
   // Worker threads are not supported when running on Emscripten.
-  de265_start_worker_threads(decoder->ctx, 1);
+  if (!decoder->worker_threads_started) {
+    de265_start_worker_threads(decoder->ctx, decoder->num_threads);
+    decoder->worker_threads_started = true;
+  }
 #endif
+}
+
+
+static struct heif_error libde265_new_decoder(void** dec)
+{
+  struct libde265_decoder* decoder = new libde265_decoder();
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+
+  decoder->ctx = libde265_new_context();
 
   *dec = decoder;
   return err;
@@ -192,6 +214,15 @@ static void libde265_free_decoder(void* decoder_raw)
 }
 
 
+static void libde265_reset_image(void* decoder_raw)
+{
+  struct libde265_decoder* decoder = (struct libde265_decoder*) decoder_raw;
+
+  // Drops all decoded pictures and pending input, such that the next image starts from a clean state.
+  de265_reset(decoder->ctx);
+}
+
+
 void libde265_set_strict_decoding(void* decoder_raw, int flag)
 {
   struct libde265_decoder* decoder = (libde265_decoder*) decoder_raw;
@@ -200,12 +231,43 @@ void libde265_set_strict_decoding(void* decoder_raw, int flag)
 }
 
 
+static struct heif_error libde265_set_parameter_integer(void* decoder_raw, const char* name, int value)
+{
+  struct libde265_decoder* decoder = (libde265_decoder*) decoder_raw;
+
+  if (strcmp(name, heif_decoder_parameter_name_threads) == 0) {
+    if (value < 1) {
+      struct heif_error err = {heif_error_Usage_error, heif_suberror_Invalid_parameter_value, kEmptyString};
+      return err;
+    }
+
+    // libde265 cannot change the number of running worker threads.
+    // Start over with a new decoder context that gets the new number of threads on the next image.
+    if (value != decoder->num_threads && decoder->worker_threads_started) {
+      de265_free_decoder(decoder->ctx);
+      decoder->ctx = libde265_new_context();
+      decoder->worker_threads_started = false;
+    }
+
+    decoder->num_threads = value;
+
+    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+    return err;
+  }
+
+  struct heif_error err = {heif_error_Usage_error, heif_suberror_Unsupported_parameter, kEmptyString};
+  return err;
+}
+
+
 #if LIBDE265_NUMERIC_VERSION >= 0x02000000
 
 static struct heif_error libde265_v2_push_data(void* decoder_raw, const void* data, size_t size)
 {
   struct libde265_decoder* decoder = (struct libde265_decoder*)decoder_raw;
 
+  libde265_start_worker_threads(decoder);
+
   const uint8_t* cdata = (const uint8_t*)data;
 
   size_t ptr=0;
@@ -271,9 +333,10 @@ static struct heif_error libde265_v2_decode_image(void* decoder_raw,
 
 #else
 
-static struct heif_error libde265_v1_push_data(void* decoder_raw, const void* data, size_t size)
+static struct heif_error libde265_v1_push_NALs(struct libde265_decoder* decoder, const void* data, size_t size,
+                                               de265_PTS pts)
 {
-  struct libde265_decoder* decoder = (struct libde265_decoder*) decoder_raw;
+  libde265_start_worker_threads(decoder);
 
   const uint8_t* cdata = (const uint8_t*) data;
 
@@ -296,7 +359,7 @@ static struct heif_error libde265_v1_push_data(void* decoder_raw, const void* da
       return err;
     }
 
-    de265_push_NAL(decoder->ctx, cdata + ptr, nal_size, 0, nullptr);
+    de265_push_NAL(decoder->ctx, cdata + ptr, nal_size, pts, nullptr);
     ptr += nal_size;
   }
 
@@ -308,6 +371,38 @@ static struct heif_error libde265_v1_push_data(void* decoder_raw, const void* da
 }
 
 
+static struct heif_error libde265_v1_push_data(void* decoder_raw, const void* data, size_t size)
+{
+  struct libde265_decoder* decoder = (struct libde265_decoder*) decoder_raw;
+
+  return libde265_v1_push_NALs(decoder, data, size, 0);
+}
+
+
+// Converts a decoded picture to a heif_image, including the color profile from the bitstream.
+static struct heif_error libde265_v1_convert_picture(struct libde265_decoder* decoder,
+                                                     const struct de265_image* image,
+                                                     struct heif_image** out_img)
+{
+  struct heif_error err = convert_libde265_image_to_heif_image(decoder, image, out_img);
+  if (err.code != heif_error_Ok) {
+    return err;
+  }
+
+  struct heif_color_profile_nclx* nclx = heif_nclx_color_profile_alloc();
+#if LIBDE265_NUMERIC_VERSION >= 0x01000700
+  HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_color_primaries(nclx, static_cast<uint16_t>(de265_get_image_colour_primaries(image))), { heif_nclx_color_profile_free(nclx);});
+  HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_transfer_characteristics(nclx, static_cast<uint16_t>(de265_get_image_transfer_characteristics(image))), { heif_nclx_color_profile_free(nclx);});
+  HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_matrix_coefficients(nclx, static_cast<uint16_t>(de265_get_image_matrix_coefficients(image))), { heif_nclx_color_profile_free(nclx);});
+  nclx->full_range_flag = (bool)de265_get_image_full_range_flag(image);
+#endif
+  heif_image_set_nclx_color_profile(*out_img, nclx);
+  heif_nclx_color_profile_free(nclx);
+
+  return err;
+}
+
+
 static struct heif_error libde265_v1_decode_image(void* decoder_raw,
                                                   struct heif_image** out_img)
 {
@@ -336,21 +431,11 @@ static struct heif_error libde265_v1_decode_image(void* decoder_raw,
       if (*out_img) {
         heif_image_release(*out_img);
       }
-      err = convert_libde265_image_to_heif_image(decoder, image, out_img);
+      err = libde265_v1_convert_picture(decoder, image, out_img);
       if (err.code != heif_error_Ok) {
         return err;
       }
 
-      struct heif_color_profile_nclx* nclx = heif_nclx_color_profile_alloc();
-#if LIBDE265_NUMERIC_VERSION >= 0x01000700
-      HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_color_primaries(nclx, static_cast<uint16_t>(de265_get_image_colour_primaries(image))), { heif_nclx_color_profile_free(nclx);});
-      HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_transfer_characteristics(nclx, static_cast<uint16_t>(de265_get_image_transfer_characteristics(image))), { heif_nclx_color_profile_free(nclx);});
-      HEIF_WARN_OR_FAIL(decoder->strict_decoding, *out_img, heif_nclx_color_profile_set_matrix_coefficients(nclx, static_cast<uint16_t>(de265_get_image_matrix_coefficients(image))), { heif_nclx_color_profile_free(nclx);});
-      nclx->full_range_flag = (bool)de265_get_image_full_range_flag(image);
-#endif
-      heif_image_set_nclx_color_profile(*out_img, nclx);
-      heif_nclx_color_profile_free(nclx);
-
       de265_release_next_picture(decoder->ctx);
     }
   } while (more);
@@ -359,6 +444,158 @@ static struct heif_error libde265_v1_decode_image(void* decoder_raw,
 }
 
 
+// Passes all pictures in the output queue to 'image_decoded'. The PTS of each picture is the index
+// of the image that it was decoded from.
+static struct heif_error libde265_v1_output_pictures(struct libde265_decoder* decoder, int num_images,
+                                                     struct heif_error (* image_decoded)(void* callback_user_data,
+                                                                                         int image_index,
+                                                                                         struct heif_image* img),
+                                                     void* callback_user_data)
+{
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+
+  for (;;) {
+    const struct de265_image* image = de265_get_next_picture(decoder->ctx);
+    if (!image) {
+      return err;
+    }
+
+    de265_PTS image_index = de265_get_image_PTS(image);
+
+    struct heif_image* heif_img = nullptr;
+    err = libde265_v1_convert_picture(decoder, image, &heif_img);
+    de265_release_next_picture(decoder->ctx);
+    if (err.code != heif_error_Ok) {
+      return err;
+    }
+
+    if (image_index < 0 || image_index >= num_images) {
+      heif_image_release(heif_img);
+      err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, "Decoded picture has no valid image index"};
+      return err;
+    }
+
+    err = image_decoded(callback_user_data, static_cast<int>(image_index), heif_img);
+    if (err.code != heif_error_Ok) {
+      return err;
+    }
+  }
+}
+
+
+static struct heif_error libde265_v1_decode_image_sequence(void* decoder_raw,
+                                                           const void* headers, size_t headers_size,
+                                                           const void* const* image_data, const size_t* image_sizes,
+                                                           int num_images,
+                                                           struct heif_error (* image_decoded)(void* callback_user_data,
+                                                                                               int image_index,
+                                                                                               struct heif_image* img),
+                                                           void* callback_user_data)
+{
+  struct libde265_decoder* decoder = (struct libde265_decoder*) decoder_raw;
+
+  // The parameter sets are pushed and parsed only once for all images.
+  struct heif_error err = libde265_v1_push_data(decoder, headers, headers_size);
+  if (err.code != heif_error_Ok) {
+    return err;
+  }
+
+  for (int i = 0; i <= num_images; i++) {
+    if (i < num_images) {
+      // The PTS identifies the image in libde265's output, which is in display order.
+      err = libde265_v1_push_NALs(decoder, image_data[i], image_sizes[i], i);
+      if (err.code != heif_error_Ok) {
+        return err;
+      }
+
+      de265_push_end_of_frame(decoder->ctx);
+    }
+    else {
+      de265_flush_data(decoder->ctx);
+    }
+
+    // decode until libde265 needs the data of the next image
+    int more;
+    do {
+      more = 0;
+      de265_error decode_err = de265_decode(decoder->ctx, &more);
+      if (decode_err == DE265_ERROR_WAITING_FOR_INPUT_DATA) {
+        break;
+      }
+      else if (decode_err != DE265_OK) {
+        err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+        return err;
+      }
+
+      err = libde265_v1_output_pictures(decoder, num_images, image_decoded, callback_user_data);
+      if (err.code != heif_error_Ok) {
+        return err;
+      }
+    } while (more);
+  }
+
+  // After the flush, the decoder may stop with several pictures still in the output queue.
+  return libde265_v1_output_pictures(decoder, num_images, image_decoded, callback_user_data);
+}
+
+
+static struct heif_error libde265_v1_push_frame(void* decoder_raw, const void* data, size_t size, int64_t timestamp)
+{
+  struct libde265_decoder* decoder = (struct libde265_decoder*) decoder_raw;
+
+  if (data == nullptr) {
+    de265_flush_data(decoder->ctx);
+
+    struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+    return err;
+  }
+
+  struct heif_error err = libde265_v1_push_NALs(decoder, data, size, timestamp);
+  if (err.code != heif_error_Ok) {
+    return err;
+  }
+
+  de265_push_end_of_frame(decoder->ctx);
+
+  return err;
+}
+
+
+static struct heif_error libde265_v1_get_frame(void* decoder_raw, struct heif_image** out_img, int64_t* out_timestamp)
+{
+  struct libde265_decoder* decoder = (struct libde265_decoder*) decoder_raw;
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+
+  *out_img = nullptr;
+
+  // decode until a picture is output or libde265 needs the data of the next frame
+  int more = 1;
+  for (;;) {
+    const struct de265_image* image = de265_get_next_picture(decoder->ctx);
+    if (image) {
+      *out_timestamp = de265_get_image_PTS(image);
+      err = libde265_v1_convert_picture(decoder, image, out_img);
+      de265_release_next_picture(decoder->ctx);
+      return err;
+    }
+
+    if (!more) {
+      return err;
+    }
+
+    more = 0;
+    de265_error decode_err = de265_decode(decoder->ctx, &more);
+    if (decode_err == DE265_ERROR_WAITING_FOR_INPUT_DATA) {
+      more = 0;
+    }
+    else if (decode_err != DE265_OK) {
+      err = {heif_error_Decoder_plugin_error, heif_suberror_Unspecified, kEmptyString};
+      return err;
+    }
+  }
+}
+
+
 #endif
 
 
@@ -381,7 +618,7 @@ static const struct heif_decoder_plugin decoder_libde265
 
 static const struct heif_decoder_plugin decoder_libde265
     {
-        3,
+        8,
         libde265_plugin_name,
         libde265_init_plugin,
         libde265_deinit_plugin,
@@ -391,7 +628,13 @@ static const struct heif_decoder_plugin decoder_libde265
         libde265_v1_push_data,
         libde265_v1_decode_image,
         libde265_set_strict_decoding,
-        "libde265"
+        "libde265",
+        libde265_reset_image,
+        libde265_set_parameter_integer,
+        nullptr, // decode_image_into
+        libde265_v1_decode_image_sequence,
+        libde265_v1_push_frame,
+        libde265_v1_get_frame
     };
 
 #endif
@@ -76,6 +76,12 @@ struct encoder_struct_aom
   bool lossless;
   bool lossless_alpha;
 
+  int tile_rows = 1; // 1,2,4,8,16,32,64
+  int tile_cols = 1; // 1,2,4,8,16,32,64
+  bool auto_tiles = false;
+
+  int progressive_layers = 1; // 1-4
+
 #if defined(HAVE_AOM_CODEC_SET_OPTION)
   std::vector<custom_option> custom_options;
 
@@ -96,8 +102,9 @@ struct encoder_struct_aom
 
   // --- output
 
-  std::vector<uint8_t> compressedData;
-  bool data_read = false;
+  // one packet per layer
+  std::vector<std::vector<uint8_t>> compressedData;
+  size_t packets_read = 0;
 
   // --- error message copies
 
@@ -166,6 +173,12 @@ static const char* kParam_lossless_alpha = "lossless-alpha";
 static const char* kParam_threads = "threads";
 static const char* kParam_realtime = "realtime";
 static const char* kParam_speed = "speed";
+static const char* kParam_tile_rows = "tile-rows";
+static const char* kParam_tile_cols = "tile-cols";
+static const char* kParam_auto_tiles = "auto-tiles";
+static const char* kParam_progressive_layers = "progressive-layers";
+
+static int valid_tile_num_values[] = {1, 2, 4, 8, 16, 32, 64};
 
 static const char* kParam_chroma = "chroma";
 static const char* const kParam_chroma_valid_values[] = {
@@ -201,7 +214,7 @@ static const char* aom_plugin_name()
 }
 
 
-#define MAX_NPARAMETERS 14
+#define MAX_NPARAMETERS 17
 
 static struct heif_encoder_parameter aom_encoder_params[MAX_NPARAMETERS];
 static const struct heif_encoder_parameter* aom_encoder_parameter_ptrs[MAX_NPARAMETERS + 1];
@@ -251,6 +264,51 @@ static void aom_init_parameters()
   p->integer.num_valid_values = 0;
   d[i++] = p++;
 
+  assert(i < MAX_NPARAMETERS);
+  p->version = 2;
+  p->name = kParam_tile_rows;
+  p->type = heif_encoder_parameter_type_integer;
+  p->integer.default_value = 1;
+  p->has_default = true;
+  p->integer.have_minimum_maximum = false;
+  p->integer.valid_values = valid_tile_num_values;
+  p->integer.num_valid_values = 7;
+  d[i++] = p++;
+
+  assert(i < MAX_NPARAMETERS);
+  p->version = 2;
+  p->name = kParam_tile_cols;
+  p->type = heif_encoder_parameter_type_integer;
+  p->integer.default_value = 1;
+  p->has_default = true;
+  p->integer.have_minimum_maximum = false;
+  p->integer.valid_values = valid_tile_num_values;
+  p->integer.num_valid_values = 7;
+  d[i++] = p++;
+
+  // Choose the tiling from the image size and the number of threads. Overrides 'tile-rows' and 'tile-cols'.
+  assert(i < MAX_NPARAMETERS);
+  p->version = 2;
+  p->name = kParam_auto_tiles;
+  p->type = heif_encoder_parameter_type_boolean;
+  p->boolean.default_value = false;
+  p->has_default = true;
+  d[i++] = p++;
+
+  // Code the image in layers of increasing quality that can be decoded incrementally (progressive AVIF).
+  assert(i < MAX_NPARAMETERS);
+  p->version = 2;
+  p->name = kParam_progressive_layers;
+  p->type = heif_encoder_parameter_type_integer;
+  p->integer.default_value = 1;
+  p->has_default = true;
+  p->integer.have_minimum_maximum = true;
+  p->integer.minimum = 1;
+  p->integer.maximum = 4;
+  p->integer.valid_values = NULL;
+  p->integer.num_valid_values = 0;
+  d[i++] = p++;
+
   assert(i < MAX_NPARAMETERS);
   p->version = 2;
   p->name = heif_encoder_parameter_name_quality;
@@ -479,6 +537,18 @@ struct heif_error aom_get_parameter_logging_level(void* encoder_raw, int* loglev
   return heif_error_ok;
 }
 
+static bool is_valid_tile_num(int value)
+{
+  for (int v : valid_tile_num_values) {
+    if (v == value) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
 #define set_value(paramname, paramvar) if (strcmp(name, paramname)==0) { encoder->paramvar = value; return heif_error_ok; }
 #define get_value(paramname, paramvar) if (strcmp(name, paramname)==0) { *value = encoder->paramvar; return heif_error_ok; }
 
@@ -512,6 +582,28 @@ struct heif_error aom_set_parameter_integer(void* encoder_raw, const char* name,
       encoder->alpha_max_q_set = true;
       return heif_error_ok;
   }
+  else if (strcmp(name, kParam_tile_rows) == 0 || strcmp(name, kParam_tile_cols) == 0) {
+    if (!is_valid_tile_num(value)) {
+      return heif_error_invalid_parameter_value;
+    }
+
+    if (strcmp(name, kParam_tile_rows) == 0) {
+      encoder->tile_rows = value;
+    }
+    else {
+      encoder->tile_cols = value;
+    }
+
+    return heif_error_ok;
+  }
+  else if (strcmp(name, kParam_progressive_layers) == 0) {
+    if (value < 1 || value > 4) {
+      return heif_error_invalid_parameter_value;
+    }
+
+    encoder->progressive_layers = value;
+    return heif_error_ok;
+  }
 
   set_value(kParam_min_q, min_q);
   set_value(kParam_max_q, max_q);
@@ -548,6 +640,9 @@ struct heif_error aom_get_parameter_integer(void* encoder_raw, const char* name,
   get_value(kParam_max_q, max_q);
   get_value(kParam_threads, threads);
   get_value(kParam_speed, cpu_used);
+  get_value(kParam_progressive_layers, progressive_layers);
+  get_value(kParam_tile_rows, tile_rows);
+  get_value(kParam_tile_cols, tile_cols);
 
   return heif_error_unsupported_parameter;
 }
@@ -572,6 +667,7 @@ struct heif_error aom_set_parameter_boolean(void* encoder_raw, const char* name,
   }
 
   set_value(kParam_realtime, realtime_mode);
+  set_value(kParam_auto_tiles, auto_tiles);
 
   return heif_error_unsupported_parameter;
 }
@@ -586,6 +682,7 @@ struct heif_error aom_get_parameter_boolean(void* encoder_raw, const char* name,
 
   get_value(kParam_realtime, realtime_mode);
   get_value(kParam_lossless_alpha, lossless_alpha);
+  get_value(kParam_auto_tiles, auto_tiles);
 
   return heif_error_unsupported_parameter;
 }
@@ -706,6 +803,68 @@ static void aom_set_default_parameters(void* encoder)
 }
 
 
+static int int_log2(int pow2_value)
+{
+  int v = 0;
+  while (pow2_value > 1) {
+    pow2_value >>= 1;
+    v++;
+  }
+
+  return v;
+}
+
+
+// Choose the number of tiles such that all threads of a decoder can work in parallel, but
+// without making the tiles so small that the compression efficiency suffers.
+static void compute_auto_tiling(int width, int height, int threads, int* log2_tile_rows, int* log2_tile_cols)
+{
+  const int64_t kMinTileArea = 512 * 512;
+  const int kMaxLog2Tiles = 6; // AV1 allows at most 64 tile rows and columns
+
+  int64_t max_tiles_by_area = std::max(int64_t{width} * height / kMinTileArea, int64_t{1});
+  int64_t max_tiles = std::min(max_tiles_by_area, int64_t{std::max(threads, 1)});
+
+  int log2_tiles = 0;
+  while ((int64_t{2} << log2_tiles) <= max_tiles) {
+    log2_tiles++;
+  }
+
+  // Split the tiles into columns and rows, with more columns for landscape images.
+  int log2_cols = (width >= height) ? (log2_tiles + 1) / 2 : log2_tiles / 2;
+  int log2_rows = log2_tiles - log2_cols;
+
+  *log2_tile_cols = std::min(log2_cols, kMaxLog2Tiles);
+  *log2_tile_rows = std::min(log2_rows, kMaxLog2Tiles);
+}
+
+
+// The layers of a progressive image have increasing quality. The last layer has the target quality,
+// the lower layers are evenly spaced between it and the lowest quality.
+static int get_layer_cq_level(int target_cq_level, int layer, int num_layers)
+{
+  const int kMaxCQLevel = 63;
+  return target_cq_level + (kMaxCQLevel - target_cq_level) * (num_layers - 1 - layer) / num_layers;
+}
+
+
+static void append_compressed_packets(aom_codec_ctx_t* codec, std::vector<uint8_t>& out_data)
+{
+  const aom_codec_cx_pkt_t* pkt = NULL;
+  aom_codec_iter_t iter = NULL; // for extracting the compressed packets
+
+  while ((pkt = aom_codec_get_cx_data(codec, &iter)) != NULL) {
+    if (pkt->kind == AOM_CODEC_CX_FRAME_PKT) {
+      // TODO: split the received data into separate OBUs
+      // This allows libheif to easily extract the sequence header for the av1C header
+
+      const auto* data = (const uint8_t*) pkt->data.frame.buf;
+      out_data.insert(out_data.end(), data, data + pkt->data.frame.sz);
+    }
+  }
+}
+
+
 void aom_query_input_colorspace(heif_colorspace* colorspace, heif_chroma* chroma)
 {
   *colorspace = heif_colorspace_YCbCr;
@@ -864,6 +1023,22 @@ struct heif_error aom_encode_image(void* encoder_raw, const struct heif_image* i
     aomUsage = AOM_USAGE_REALTIME;
   }
 
+  // Lossless images cannot be refined in further layers.
+  int num_layers = encoder->progressive_layers;
+  if (encoder->lossless || (input_class == heif_image_input_class_alpha && encoder->lossless_alpha)) {
+    num_layers = 1;
+  }
+
+#if !defined(AOM_CTRL_AOME_SET_NUMBER_SPATIAL_LAYERS)
+  num_layers = 1;
+#endif
+
+  // The layers after the first one are predicted from the previous layer, which is not possible
+  // in the all-intra mode.
+  if (num_layers > 1 && !encoder->realtime_mode) {
+    aomUsage = AOM_USAGE_GOOD_QUALITY;
+  }
+
   aom_codec_enc_cfg_t cfg;
   aom_codec_err_t res = aom_codec_enc_config_default(iface, &cfg, aomUsage);
   if (res) {
@@ -881,7 +1056,8 @@ struct heif_error aom_encode_image(void* encoder_raw, const struct heif_image* i
   // Set the max number of frames to encode to 1. This makes the libaom encoder
   // set still_picture and reduced_still_picture_header to 1 in the AV1 sequence
   // header OBU.
-  cfg.g_limit = 1;
+  // A progressive image is coded as one frame per layer.
+  cfg.g_limit = num_layers;
 
   // Use the default settings of the new AOM_USAGE_ALL_INTRA (added in
   // https://crbug.com/aomedia/2959).
@@ -892,8 +1068,10 @@ struct heif_error aom_encode_image(void* encoder_raw, const struct heif_image* i
   cfg.g_lag_in_frames = 0;
   // Disable automatic placement of key frames by the encoder.
   cfg.kf_mode = AOM_KF_DISABLED;
-  // Tell libaom that all frames will be key frames.
-  cfg.kf_max_dist = 0;
+  if (num_layers == 1) {
+    // Tell libaom that all frames will be key frames.
+    cfg.kf_max_dist = 0;
+  }
 
   cfg.g_profile = seq_profile;
   cfg.g_bit_depth = (aom_bit_depth_t) bpp_y;
@@ -945,6 +1123,12 @@ struct heif_error aom_encode_image(void* encoder_raw, const struct heif_image* i
   int cq_level = ((100 - quality) * 63 + 50) / 100;
   aom_codec_control(&codec, AOME_SET_CQ_LEVEL, cq_level);
 
+#if defined(AOM_CTRL_AOME_SET_NUMBER_SPATIAL_LAYERS)
+  if (num_layers > 1) {
+    aom_codec_control(&codec, AOME_SET_NUMBER_SPATIAL_LAYERS, num_layers);
+  }
+#endif
+
   if (encoder->threads > 1) {
 #if defined(AOM_CTRL_AV1E_SET_ROW_MT)
     // aom 2.0
@@ -952,7 +1136,21 @@ struct heif_error aom_encode_image(void* encoder_raw, const struct heif_image* i
 #endif
   }
 
-  // TODO: set AV1E_SET_TILE_ROWS and AV1E_SET_TILE_COLUMNS.
+  // --- tiles, which can be decoded in parallel
+
+  int log2_tile_rows;
+  int log2_tile_cols;
+
+  if (encoder->auto_tiles) {
+    compute_auto_tiling(source_width, source_height, encoder->threads, &log2_tile_rows, &log2_tile_cols);
+  }
+  else {
+    log2_tile_rows = int_log2(encoder->tile_rows);
+    log2_tile_cols = int_log2(encoder->tile_cols);
+  }
+
+  aom_codec_control(&codec, AV1E_SET_TILE_ROWS, log2_tile_rows);
+  aom_codec_control(&codec, AV1E_SET_TILE_COLUMNS, log2_tile_cols);
 
 
   struct heif_color_profile_nclx* nclx = nullptr;
@@ -998,54 +1196,51 @@ struct heif_error aom_encode_image(void* encoder_raw, const struct heif_image* i
   }
 #endif
 
-  // --- encode frame
-
-  res = aom_codec_encode(&codec, &input_image,
-                         0, // only encoding a single frame
-                         1,
-                         0); // no flags
-
-  // Note: we are freeing the input image directly after use.
-  // This covers the usual success case and also all error cases that occur below.
-  aom_img_free(&input_image);
-
-  if (res != AOM_CODEC_OK) {
-    err = {
-        heif_error_Encoder_plugin_error,
-        heif_suberror_Encoder_encoding,
-        encoder->set_aom_error(aom_codec_error_detail(&codec))
-    };
-    aom_codec_destroy(&codec);
-    return err;
-  }
+  // --- encode frame (one frame per layer)
 
   encoder->compressedData.clear();
-  const aom_codec_cx_pkt_t* pkt = NULL;
-  aom_codec_iter_t iter = NULL; // for extracting the compressed packets
-
-  while ((pkt = aom_codec_get_cx_data(&codec, &iter)) != NULL) {
+  encoder->packets_read = 0;
 
-    if (pkt->kind == AOM_CODEC_CX_FRAME_PKT) {
-      //std::cerr.write((char*)pkt->data.frame.buf, pkt->data.frame.sz);
-
-      //printf("packet of size: %d\n",(int)pkt->data.frame.sz);
-
-
-      // TODO: split the received data into separate OBUs
-      // This allows libheif to easily extract the sequence header for the av1C header
+  for (int layer = 0; layer < num_layers; layer++) {
+    aom_enc_frame_flags_t flags = 0;
 
-      size_t n = pkt->data.frame.sz;
-      size_t oldSize = encoder->compressedData.size();
-      encoder->compressedData.resize(oldSize + n);
+#if defined(AOM_CTRL_AOME_SET_NUMBER_SPATIAL_LAYERS)
+    if (num_layers > 1) {
+      aom_codec_control(&codec, AOME_SET_SPATIAL_LAYER_ID, layer);
+      aom_codec_control(&codec, AOME_SET_CQ_LEVEL, get_layer_cq_level(cq_level, layer, num_layers));
 
-      memcpy(encoder->compressedData.data() + oldSize,
-             pkt->data.frame.buf,
-             n);
+      if (layer == 0) {
+        flags = AOM_EFLAG_FORCE_KF;
+      }
+      else {
+        // only refine the previous layer
+        flags = (AOM_EFLAG_NO_REF_LAST2 | AOM_EFLAG_NO_REF_LAST3 | AOM_EFLAG_NO_REF_GF |
+                 AOM_EFLAG_NO_REF_ARF | AOM_EFLAG_NO_REF_BWD | AOM_EFLAG_NO_REF_ARF2 |
+                 AOM_EFLAG_NO_UPD_GF | AOM_EFLAG_NO_UPD_ARF);
+      }
+    }
+#endif
 
-      encoder->data_read = false;
+    res = aom_codec_encode(&codec, &input_image, layer, 1, flags);
+    if (res != AOM_CODEC_OK) {
+      err = {
+          heif_error_Encoder_plugin_error,
+          heif_suberror_Encoder_encoding,
+          encoder->set_aom_error(aom_codec_error_detail(&codec))
+      };
+      aom_img_free(&input_image);
+      aom_codec_destroy(&codec);
+      return err;
     }
+
+    encoder->compressedData.emplace_back();
+    append_compressed_packets(&codec, encoder->compressedData.back());
   }
 
+  // Note: we are freeing the input image directly after the last layer has been encoded.
+  // This covers the usual success case and also all error cases that occur below.
+  aom_img_free(&input_image);
+
   int flags = 0;
   res = aom_codec_encode(&codec, NULL, -1, 0, flags);
   if (res != AOM_CODEC_OK) {
@@ -1056,30 +1251,7 @@ struct heif_error aom_encode_image(void* encoder_raw, const struct heif_image* i
     return err;
   }
 
-  iter = NULL;
-
-  while ((pkt = aom_codec_get_cx_data(&codec, &iter)) != NULL) {
-
-    if (pkt->kind == AOM_CODEC_CX_FRAME_PKT) {
-      //std::cerr.write((char*)pkt->data.frame.buf, pkt->data.frame.sz);
-
-      //printf("packet of size: %d\n",(int)pkt->data.frame.sz);
-
-
-      // TODO: split the received data into separate OBUs
-      // This allows libheif to easily extract the sequence header for the av1C header
-
-      size_t n = pkt->data.frame.sz;
-      size_t oldSize = encoder->compressedData.size();
-      encoder->compressedData.resize(oldSize + n);
-
-      memcpy(encoder->compressedData.data() + oldSize,
-             pkt->data.frame.buf,
-             n);
-
-      encoder->data_read = false;
-    }
-  }
+  append_compressed_packets(&codec, encoder->compressedData.back());
 
 
   // --- clean up
@@ -1096,19 +1268,34 @@ struct heif_error aom_encode_image(void* encoder_raw, const struct heif_image* i
 }
 
 
+int aom_get_number_of_layers(void* encoder_raw)
+{
+  struct encoder_struct_aom* encoder = (struct encoder_struct_aom*) encoder_raw;
+
+  return (int) encoder->compressedData.size();
+}
+
+
+int aom_supports_monochrome(void* encoder_raw)
+{
+  // coded with the 'monochrome' flag of the sequence header
+  return 1;
+}
+
+
 struct heif_error aom_get_compressed_data(void* encoder_raw, uint8_t** data, int* size,
                                           enum heif_encoded_data_type* type)
 {
   struct encoder_struct_aom* encoder = (struct encoder_struct_aom*) encoder_raw;
 
-  if (encoder->data_read) {
+  if (encoder->packets_read == encoder->compressedData.size()) {
     *size = 0;
     *data = nullptr;
   }
   else {
-    *size = (int) encoder->compressedData.size();
-    *data = encoder->compressedData.data();
-    encoder->data_read = true;
+    std::vector<uint8_t>& packet = encoder->compressedData[encoder->packets_read++];
+    *size = (int) packet.size();
+    *data = packet.data();
   }
 
   return heif_error_ok;
@@ -1117,7 +1304,7 @@ struct heif_error aom_get_compressed_data(void* encoder_raw, uint8_t** data, int
 
 static const struct heif_encoder_plugin encoder_plugin_aom
     {
-        /* plugin_api_version */ 3,
+        /* plugin_api_version */ 6,
         /* compression_format */ heif_compression_AV1,
         /* id_name */ "aom",
         /* priority */ AOM_PLUGIN_PRIORITY,
@@ -1145,7 +1332,10 @@ static const struct heif_encoder_plugin encoder_plugin_aom
         /* encode_image */ aom_encode_image,
         /* get_compressed_data */ aom_get_compressed_data,
         /* query_input_colorspace (v2) */ aom_query_input_colorspace2,
-        /* query_encoded_size (v3) */ nullptr
+        /* query_encoded_size (v3) */ nullptr,
+        /* reset_image (v4) */ nullptr,
+        /* get_number_of_layers (v5) */ aom_get_number_of_layers,
+        /* supports_monochrome (v6) */ aom_supports_monochrome
     };
 
 const struct heif_encoder_plugin* get_encoder_plugin_aom()
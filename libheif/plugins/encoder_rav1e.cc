@@ -472,8 +472,19 @@ void rav1e_query_input_colorspace2(void* encoder_raw, heif_colorspace* colorspac
 {
   auto* encoder = (struct encoder_struct_rav1e*) encoder_raw;
 
-  *colorspace = heif_colorspace_YCbCr;
-  *chroma = encoder->chroma;
+  if (*colorspace == heif_colorspace_monochrome) {
+    // keep the monochrome colorspace
+  }
+  else {
+    *colorspace = heif_colorspace_YCbCr;
+    *chroma = encoder->chroma;
+  }
+}
+
+
+int rav1e_supports_monochrome(void* encoder_raw)
+{
+  return 1;
 }
 
 
@@ -489,29 +500,26 @@ struct heif_error rav1e_encode_image(void* encoder_raw, const struct heif_image*
   RaChromaSamplePosition chromaPosition;
   RaPixelRange rav1eRange;
 
-  if (input_class == heif_image_input_class_alpha) {
-    chromaSampling = RA_CHROMA_SAMPLING_CS420; // I can't seem to get RA_CHROMA_SAMPLING_CS400 to work right now, unfortunately
-    chromaPosition = RA_CHROMA_SAMPLE_POSITION_UNKNOWN; // TODO: set to CENTER when AV1 and rav1e supports this
-    yShift = 1;
-  }
-  else {
-    switch (chroma) {
-      case heif_chroma_444:
-        chromaSampling = RA_CHROMA_SAMPLING_CS444;
-        chromaPosition = RA_CHROMA_SAMPLE_POSITION_COLOCATED;
-        break;
-      case heif_chroma_422:
-        chromaSampling = RA_CHROMA_SAMPLING_CS422;
-        chromaPosition = RA_CHROMA_SAMPLE_POSITION_COLOCATED;
-        break;
-      case heif_chroma_420:
-        chromaSampling = RA_CHROMA_SAMPLING_CS420;
-        chromaPosition = RA_CHROMA_SAMPLE_POSITION_UNKNOWN; // TODO: set to CENTER when AV1 and rav1e supports this
-        yShift = 1;
-        break;
-      default:
-        return heif_error_codec_library_error;
-    }
+  switch (chroma) {
+    case heif_chroma_monochrome:
+      chromaSampling = RA_CHROMA_SAMPLING_CS400;
+      chromaPosition = RA_CHROMA_SAMPLE_POSITION_UNKNOWN;
+      break;
+    case heif_chroma_444:
+      chromaSampling = RA_CHROMA_SAMPLING_CS444;
+      chromaPosition = RA_CHROMA_SAMPLE_POSITION_COLOCATED;
+      break;
+    case heif_chroma_422:
+      chromaSampling = RA_CHROMA_SAMPLING_CS422;
+      chromaPosition = RA_CHROMA_SAMPLE_POSITION_COLOCATED;
+      break;
+    case heif_chroma_420:
+      chromaSampling = RA_CHROMA_SAMPLING_CS420;
+      chromaPosition = RA_CHROMA_SAMPLE_POSITION_UNKNOWN; // TODO: set to CENTER when AV1 and rav1e supports this
+      yShift = 1;
+      break;
+    default:
+      return heif_error_codec_library_error;
   }
 
   struct heif_color_profile_nclx* nclx = nullptr;
@@ -607,21 +615,20 @@ struct heif_error rav1e_encode_image(void* encoder_raw, const struct heif_image*
   auto rav1eFrame = std::shared_ptr<RaFrame>(rav1eFrameRaw, [](RaFrame* frm) { rav1e_frame_unref(frm); });
 
   int byteWidth = (bitDepth > 8) ? 2 : 1;
-  // if (input_class == heif_image_input_class_alpha) {
-  //} else
-  {
-    int strideY;
-    const uint8_t* Y = heif_image_get_plane_readonly(image, heif_channel_Y, &strideY);
+
+  int strideY;
+  const uint8_t* Y = heif_image_get_plane_readonly(image, heif_channel_Y, &strideY);
+
+  uint32_t height = heif_image_get_height(image, heif_channel_Y);
+  rav1e_frame_fill_plane(rav1eFrame.get(), 0, Y, strideY * height, strideY, byteWidth);
+
+  if (chroma != heif_chroma_monochrome) {
     int strideCb;
     const uint8_t* Cb = heif_image_get_plane_readonly(image, heif_channel_Cb, &strideCb);
     int strideCr;
     const uint8_t* Cr = heif_image_get_plane_readonly(image, heif_channel_Cr, &strideCr);
 
-
-    uint32_t height = heif_image_get_height(image, heif_channel_Y);
-
     uint32_t uvHeight = (height + yShift) >> yShift;
-    rav1e_frame_fill_plane(rav1eFrame.get(), 0, Y, strideY * height, strideY, byteWidth);
     rav1e_frame_fill_plane(rav1eFrame.get(), 1, Cb, strideCb * uvHeight, strideCb, byteWidth);
     rav1e_frame_fill_plane(rav1eFrame.get(), 2, Cr, strideCr * uvHeight, strideCr, byteWidth);
   }
@@ -677,7 +684,7 @@ struct heif_error rav1e_get_compressed_data(void* encoder_raw, uint8_t** data, i
 
 static const struct heif_encoder_plugin encoder_plugin_rav1e
     {
-        /* plugin_api_version */ 3,
+        /* plugin_api_version */ 6,
         /* compression_format */ heif_compression_AV1,
         /* id_name */ "rav1e",
         /* priority */ RAV1E_PLUGIN_PRIORITY,
@@ -705,7 +712,10 @@ static const struct heif_encoder_plugin encoder_plugin_rav1e
         /* encode_image */ rav1e_encode_image,
         /* get_compressed_data */ rav1e_get_compressed_data,
         /* query_input_colorspace (v2) */ rav1e_query_input_colorspace2,
-        /* query_encoded_size (v3) */ nullptr
+        /* query_encoded_size (v3) */ nullptr,
+        /* reset_image (v4) */ nullptr,
+        /* get_number_of_layers (v5) */ nullptr,
+        /* supports_monochrome (v6) */ rav1e_supports_monochrome
     };
 
 const struct heif_encoder_plugin* get_encoder_plugin_rav1e()
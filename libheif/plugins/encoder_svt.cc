@@ -60,6 +60,26 @@ struct encoder_struct_svt
   bool data_read = false;
 };
 
+
+// Reserves the encoder threads from the global encoder thread budget while an image is encoded.
+class ThreadBudgetReservation
+{
+public:
+  explicit ThreadBudgetReservation(int requested_threads)
+      : m_threads(heif_encoder_acquire_threads(requested_threads)) {}
+
+  ~ThreadBudgetReservation() { heif_encoder_release_threads(m_threads); }
+
+  ThreadBudgetReservation(const ThreadBudgetReservation&) = delete;
+
+  ThreadBudgetReservation& operator=(const ThreadBudgetReservation&) = delete;
+
+  int get_threads() const { return m_threads; }
+
+private:
+  int m_threads;
+};
+
 //static const char* kError_out_of_memory = "Out of memory";
 
 static const char* kParam_min_q = "min-q";
@@ -574,6 +594,9 @@ struct heif_error svt_encode_image(void* encoder_raw, const struct heif_image* i
   auto* encoder = (struct encoder_struct_svt*) encoder_raw;
   EbErrorType res = EB_ErrorNone;
 
+  encoder->compressed_data.clear();
+  encoder->data_read = false;
+
   int w = heif_image_get_width(image, heif_channel_Y);
   int h = heif_image_get_height(image, heif_channel_Y);
 
@@ -623,6 +646,10 @@ struct heif_error svt_encode_image(void* encoder_raw, const struct heif_image* i
 
   // --- initialize the encoder
 
+  // SVT-AV1 sizes its thread pool and the per-thread buffers by 'logical_processors'.
+  // Limit it to our share of the global encoder thread budget.
+  ThreadBudgetReservation thread_reservation(encoder->threads);
+
   EbComponentType* svt_encoder = nullptr;
   EbSvtAv1EncConfiguration svt_config;
   memset(&svt_config, 0, sizeof(EbSvtAv1EncConfiguration));
@@ -674,7 +701,7 @@ struct heif_error svt_encode_image(void* encoder_raw, const struct heif_image* i
 
   svt_config.source_width = encoded_width;
   svt_config.source_height = encoded_height;
-  svt_config.logical_processors = encoder->threads;
+  svt_config.logical_processors = thread_reservation.get_threads();
 
   // disable 2-pass
   svt_config.rc_stats_buffer = (SvtAv1FixedBuf) {nullptr, 0};
@@ -855,9 +882,21 @@ struct heif_error svt_get_compressed_data(void* encoder_raw, uint8_t** data, int
 }
 
 
+static void svt_reset_image(void* encoder_raw)
+{
+  auto* encoder = (struct encoder_struct_svt*) encoder_raw;
+
+  // SVT-AV1 cannot take new pictures after the end of stream has been signalled. The encoder
+  // handle is therefore opened and closed within svt_encode_image(). Only the output remains.
+  encoder->compressed_data.clear();
+  encoder->compressed_data.shrink_to_fit();
+  encoder->data_read = false;
+}
+
+
 static const struct heif_encoder_plugin encoder_plugin_svt
     {
-        /* plugin_api_version */ 3,
+        /* plugin_api_version */ 4,
         /* compression_format */ heif_compression_AV1,
         /* id_name */ "svt",
         /* priority */ SVT_PLUGIN_PRIORITY,
@@ -885,7 +924,8 @@ static const struct heif_encoder_plugin encoder_plugin_svt
         /* encode_image */ svt_encode_image,
         /* get_compressed_data */ svt_get_compressed_data,
         /* query_input_colorspace (v2) */ svt_query_input_colorspace2,
-        /* query_encoded_size (v3) */ svt_query_encoded_size
+        /* query_encoded_size (v3) */ svt_query_encoded_size,
+        /* reset_image (v4) */ svt_reset_image
     };
 
 const struct heif_encoder_plugin* get_encoder_plugin_svt()
@@ -37,6 +37,24 @@
 
 
 static const char* kParam_interleave = "interleave";
+static const char* const kParam_interleave_valid_values[] = {
+    "planar", "row", "pixel", nullptr
+};
+
+static const char* kParam_compression = "compression";
+static const char* const kParam_compression_valid_values[] = {
+    "none",
+#if HAVE_ZLIB
+    "deflate", "zlib",
+#endif
+#if HAVE_BROTLI
+    "brotli",
+#endif
+    nullptr
+};
+
+static const char* kParam_tile_columns = "tile-columns";
+static const char* kParam_tile_rows = "tile-rows";
 
 static const int PLUGIN_PRIORITY = 60;
 
@@ -69,6 +87,42 @@ static void uncompressed_init_parameters()
   p->type = heif_encoder_parameter_type_string;
   p->string.default_value = "planar";
   p->has_default = true;
+  p->string.valid_values = kParam_interleave_valid_values;
+  d[i++] = p++;
+
+  assert(i < MAX_NPARAMETERS);
+  p->version = 2;
+  p->name = kParam_compression;
+  p->type = heif_encoder_parameter_type_string;
+  p->string.default_value = "none";
+  p->has_default = true;
+  p->string.valid_values = kParam_compression_valid_values;
+  d[i++] = p++;
+
+  assert(i < MAX_NPARAMETERS);
+  p->version = 2;
+  p->name = kParam_tile_columns;
+  p->type = heif_encoder_parameter_type_integer;
+  p->integer.default_value = 1;
+  p->has_default = true;
+  p->integer.have_minimum_maximum = true;
+  p->integer.minimum = 1;
+  p->integer.maximum = 65536;
+  p->integer.valid_values = NULL;
+  p->integer.num_valid_values = 0;
+  d[i++] = p++;
+
+  assert(i < MAX_NPARAMETERS);
+  p->version = 2;
+  p->name = kParam_tile_rows;
+  p->type = heif_encoder_parameter_type_integer;
+  p->integer.default_value = 0;  // automatic
+  p->has_default = true;
+  p->integer.have_minimum_maximum = true;
+  p->integer.minimum = 0;
+  p->integer.maximum = 65536;
+  p->integer.valid_values = NULL;
+  p->integer.num_valid_values = 0;
   d[i++] = p++;
 
   assert(i < MAX_NPARAMETERS + 1);
@@ -175,14 +229,40 @@ struct heif_error uncompressed_get_parameter_logging_level(void* encoder_raw, in
 
 struct heif_error uncompressed_set_parameter_integer(void* encoder_raw, const char* name, int value)
 {
-  //struct encoder_struct_uncompressed* encoder = (struct encoder_struct_uncompressed*) encoder_raw;
+  struct encoder_struct_uncompressed* encoder = (struct encoder_struct_uncompressed*) encoder_raw;
+
+  if (strcmp(name, kParam_tile_columns) == 0) {
+    if (value < 1 || value > 65536) {
+      return heif_error_invalid_parameter_value;
+    }
+
+    encoder->tile_columns = value;
+    return heif_error_ok;
+  }
+  else if (strcmp(name, kParam_tile_rows) == 0) {
+    if (value < 0 || value > 65536) {
+      return heif_error_invalid_parameter_value;
+    }
+
+    encoder->tile_rows = value;
+    return heif_error_ok;
+  }
 
   return heif_error_unsupported_parameter;
 }
 
 struct heif_error uncompressed_get_parameter_integer(void* encoder_raw, const char* name, int* value)
 {
-  //struct encoder_struct_uncompressed* encoder = (struct encoder_struct_uncompressed*) encoder_raw;
+  struct encoder_struct_uncompressed* encoder = (struct encoder_struct_uncompressed*) encoder_raw;
+
+  if (strcmp(name, kParam_tile_columns) == 0) {
+    *value = encoder->tile_columns;
+    return heif_error_ok;
+  }
+  else if (strcmp(name, kParam_tile_rows) == 0) {
+    *value = encoder->tile_rows;
+    return heif_error_ok;
+  }
 
   return heif_error_unsupported_parameter;
 }
@@ -205,16 +285,97 @@ struct heif_error uncompressed_get_parameter_boolean(void* encoder_raw, const ch
 
 struct heif_error uncompressed_set_parameter_string(void* encoder_raw, const char* name, const char* value)
 {
-  //struct encoder_struct_uncompressed* encoder = (struct encoder_struct_uncompressed*) encoder_raw;
+  struct encoder_struct_uncompressed* encoder = (struct encoder_struct_uncompressed*) encoder_raw;
+
+  if (strcmp(name, kParam_interleave) == 0) {
+    if (strcmp(value, "planar") == 0) {
+      encoder->interleaveFormat = encoder_struct_uncompressed::InterleaveFormat::Planar;
+    }
+    else if (strcmp(value, "row") == 0) {
+      encoder->interleaveFormat = encoder_struct_uncompressed::InterleaveFormat::Row;
+    }
+    else if (strcmp(value, "pixel") == 0) {
+      encoder->interleaveFormat = encoder_struct_uncompressed::InterleaveFormat::Pixel;
+    }
+    else {
+      return heif_error_invalid_parameter_value;
+    }
+
+    return heif_error_ok;
+  }
+  else if (strcmp(name, kParam_compression) == 0) {
+    if (strcmp(value, "none") == 0) {
+      encoder->compression = encoder_struct_uncompressed::Compression::None;
+    }
+#if HAVE_ZLIB
+    else if (strcmp(value, "deflate") == 0) {
+      encoder->compression = encoder_struct_uncompressed::Compression::Deflate;
+    }
+    else if (strcmp(value, "zlib") == 0) {
+      encoder->compression = encoder_struct_uncompressed::Compression::Zlib;
+    }
+#endif
+#if HAVE_BROTLI
+    else if (strcmp(value, "brotli") == 0) {
+      encoder->compression = encoder_struct_uncompressed::Compression::Brotli;
+    }
+#endif
+    else {
+      return heif_error_invalid_parameter_value;
+    }
+
+    return heif_error_ok;
+  }
 
   return heif_error_unsupported_parameter;
 }
 
 
+static void save_strcpy(char* dst, int dst_size, const char* src)
+{
+  strncpy(dst, src, dst_size - 1);
+  dst[dst_size - 1] = 0;
+}
+
+
 struct heif_error uncompressed_get_parameter_string(void* encoder_raw, const char* name,
                                                     char* value, int value_size)
 {
-  //struct encoder_struct_uncompressed* encoder = (struct encoder_struct_uncompressed*) encoder_raw;
+  struct encoder_struct_uncompressed* encoder = (struct encoder_struct_uncompressed*) encoder_raw;
+
+  if (strcmp(name, kParam_interleave) == 0) {
+    switch (encoder->interleaveFormat) {
+      case encoder_struct_uncompressed::InterleaveFormat::Planar:
+        save_strcpy(value, value_size, "planar");
+        break;
+      case encoder_struct_uncompressed::InterleaveFormat::Row:
+        save_strcpy(value, value_size, "row");
+        break;
+      case encoder_struct_uncompressed::InterleaveFormat::Pixel:
+        save_strcpy(value, value_size, "pixel");
+        break;
+    }
+
+    return heif_error_ok;
+  }
+  else if (strcmp(name, kParam_compression) == 0) {
+    switch (encoder->compression) {
+      case encoder_struct_uncompressed::Compression::None:
+        save_strcpy(value, value_size, "none");
+        break;
+      case encoder_struct_uncompressed::Compression::Deflate:
+        save_strcpy(value, value_size, "deflate");
+        break;
+      case encoder_struct_uncompressed::Compression::Zlib:
+        save_strcpy(value, value_size, "zlib");
+        break;
+      case encoder_struct_uncompressed::Compression::Brotli:
+        save_strcpy(value, value_size, "brotli");
+        break;
+    }
+
+    return heif_error_ok;
+  }
 
   return heif_error_unsupported_parameter;
 }
@@ -256,9 +417,12 @@ void uncompressed_query_input_colorspace2(void* encoder_raw, heif_colorspace* co
   if (*colorspace == heif_colorspace_monochrome) {
     // keep the monochrome colorspace
   }
+  else if (*colorspace == heif_colorspace_YCbCr) {
+    // subsampled chroma is not supported yet
+    *chroma = heif_chroma_444;
+  }
   else {
-    //*colorspace = heif_colorspace_YCbCr;
-    //*chroma = encoder->chroma;
+    // RGB is stored as it is, planar or interleaved
   }
 }
 
@@ -37,6 +37,19 @@ struct encoder_struct_uncompressed
 
   InterleaveFormat interleaveFormat = InterleaveFormat::Planar;
 
+  // generic compression of the tiles ('cmpC')
+  enum class Compression
+  {
+    None, Deflate, Zlib, Brotli
+  };
+
+  Compression compression = Compression::None;
+
+  // Number of tiles. With tile_rows == 0, compressed images are split into bands of rows
+  // that are compressed in parallel.
+  int tile_columns = 1;
+  int tile_rows = 0;
+
   // --- output
 
   //bool data_read = false;
@@ -985,9 +985,34 @@ static struct heif_error x265_get_compressed_data(void* encoder_raw, uint8_t** d
 }
 
 
+static void x265_reset_image(void* encoder_raw)
+{
+  struct encoder_struct_x265* encoder = (struct encoder_struct_x265*) encoder_raw;
+
+  // x265 cannot take new pictures after it has been flushed. Release it now instead of
+  // keeping its frame buffers and worker threads alive while the encoder instance is idle.
+  if (encoder->encoder) {
+    const x265_api* api = x265_api_get(encoder->bit_depth);
+    api->encoder_close(encoder->encoder);
+    encoder->encoder = nullptr;
+  }
+
+  encoder->nals = nullptr;
+  encoder->num_nals = 0;
+  encoder->nal_output_counter = 0;
+}
+
+
+static int x265_supports_monochrome(void* encoder_raw)
+{
+  // 4:0:0 is coded with the RExt profiles
+  return 1;
+}
+
+
 static const struct heif_encoder_plugin encoder_plugin_x265
     {
-        /* plugin_api_version */ 2,
+        /* plugin_api_version */ 6,
         /* compression_format */ heif_compression_HEVC,
         /* id_name */ "x265",
         /* priority */ X265_PLUGIN_PRIORITY,
@@ -1014,7 +1039,11 @@ static const struct heif_encoder_plugin encoder_plugin_x265
         /* query_input_colorspace */ x265_query_input_colorspace,
         /* encode_image */ x265_encode_image,
         /* get_compressed_data */ x265_get_compressed_data,
-        /* query_input_colorspace (v2) */ x265_query_input_colorspace2
+        /* query_input_colorspace (v2) */ x265_query_input_colorspace2,
+        /* query_encoded_size (v3) */ nullptr,
+        /* reset_image (v4) */ x265_reset_image,
+        /* get_number_of_layers (v5) */ nullptr,
+        /* supports_monochrome (v6) */ x265_supports_monochrome
     };
 
 const struct heif_encoder_plugin* get_encoder_plugin_x265()
@@ -22,6 +22,9 @@
 #include "error.h"
 #include "file.h"
 #include "box.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <utility>
 
 
@@ -102,11 +105,50 @@ Error RegionItem::parse(const std::vector<uint8_t>& data)
       return error;
     }
 
-    mRegions.push_back(region);
+    add_region(region);
   }
   return Error::Ok;
 }
 
+
+void RegionItem::add_region(const std::shared_ptr<RegionGeometry>& region)
+{
+  mRegions.push_back(region);
+  mBoundingBoxes.push_back(region->get_bounding_box());
+}
+
+
+std::vector<int> RegionItem::find_regions_at(int32_t x, int32_t y) const
+{
+  std::vector<int> indices;
+
+  for (size_t i = 0; i < mRegions.size(); i++) {
+    if (mBoundingBoxes[i].contains(x, y) && mRegions[i]->contains(x, y)) {
+      indices.push_back(static_cast<int>(i));
+    }
+  }
+
+  return indices;
+}
+
+
+std::vector<int> RegionItem::find_regions_in_rectangle(int32_t x, int32_t y, uint32_t width, uint32_t height) const
+{
+  std::vector<int> indices;
+
+  int64_t right = int64_t{x} + width;
+  int64_t bottom = int64_t{y} + height;
+
+  for (size_t i = 0; i < mRegions.size(); i++) {
+    const RegionBoundingBox& box = mBoundingBoxes[i];
+    if (box.left < right && box.right > x && box.top < bottom && box.bottom > y) {
+      indices.push_back(static_cast<int>(i));
+    }
+  }
+
+  return indices;
+}
+
 Error RegionItem::encode(std::vector<uint8_t>& result) const
 {
   StreamWriter writer;
@@ -240,6 +282,38 @@ void RegionGeometry_Point::encode(StreamWriter& writer, int field_size_bytes) co
 }
 
 
+RegionBoundingBox RegionGeometry_Point::get_bounding_box() const
+{
+  return {x, y, int64_t{x} + 1, int64_t{y} + 1};
+}
+
+
+bool RegionGeometry_Point::contains(int32_t px, int32_t py) const
+{
+  return px == x && py == y;
+}
+
+
+void RegionGeometry_Point::rasterize(uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const
+{
+  if (x >= 0 && y >= 0 && static_cast<uint32_t>(x) < width && static_cast<uint32_t>(y) < height) {
+    bitmap[y * stride + x] = value;
+  }
+}
+
+
+// Set the pixels [x0,x1) of a bitmap row, clipped to the bitmap width.
+static void fill_span(uint8_t* row, int64_t x0, int64_t x1, uint32_t width, uint8_t value)
+{
+  x0 = std::max(x0, int64_t{0});
+  x1 = std::min(x1, int64_t{width});
+
+  if (x0 < x1) {
+    memset(row + x0, value, static_cast<size_t>(x1 - x0));
+  }
+}
+
+
 Error RegionGeometry_Rectangle::parse(const std::vector<uint8_t>& data,
                                       int field_size,
                                       unsigned int* dataOffset)
@@ -272,6 +346,29 @@ void RegionGeometry_Rectangle::encode(StreamWriter& writer, int field_size_bytes
   writer.write(field_size_bytes, height);
 }
 
+
+RegionBoundingBox RegionGeometry_Rectangle::get_bounding_box() const
+{
+  return {x, y, int64_t{x} + width, int64_t{y} + height};
+}
+
+
+bool RegionGeometry_Rectangle::contains(int32_t px, int32_t py) const
+{
+  return get_bounding_box().contains(px, py);
+}
+
+
+void RegionGeometry_Rectangle::rasterize(uint8_t* bitmap, uint32_t width_, uint32_t height_, size_t stride, uint8_t value) const
+{
+  int64_t top = std::max(int64_t{y}, int64_t{0});
+  int64_t bottom = std::min(int64_t{y} + height, int64_t{height_});
+
+  for (int64_t row = top; row < bottom; row++) {
+    fill_span(bitmap + row * stride, x, int64_t{x} + width, width_, value);
+  }
+}
+
 Error RegionGeometry_Ellipse::parse(const std::vector<uint8_t>& data,
                                     int field_size,
                                     unsigned int* dataOffset)
@@ -304,6 +401,49 @@ void RegionGeometry_Ellipse::encode(StreamWriter& writer, int field_size_bytes)
 }
 
 
+int64_t RegionGeometry_Ellipse::get_half_width(int64_t dy) const
+{
+  if (dy < -int64_t{radius_y} || dy > int64_t{radius_y}) {
+    return -1;
+  }
+
+  if (radius_y == 0) {
+    return radius_x;
+  }
+
+  double r = static_cast<double>(dy) / radius_y;
+  return static_cast<int64_t>(std::floor(radius_x * std::sqrt(1.0 - r * r)));
+}
+
+
+RegionBoundingBox RegionGeometry_Ellipse::get_bounding_box() const
+{
+  return {int64_t{x} - radius_x, int64_t{y} - radius_y, int64_t{x} + radius_x + 1, int64_t{y} + radius_y + 1};
+}
+
+
+bool RegionGeometry_Ellipse::contains(int32_t px, int32_t py) const
+{
+  int64_t half_width = get_half_width(int64_t{py} - y);
+  int64_t dx = int64_t{px} - x;
+
+  return half_width >= 0 && dx >= -half_width && dx <= half_width;
+}
+
+
+void RegionGeometry_Ellipse::rasterize(uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const
+{
+  RegionBoundingBox box = get_bounding_box();
+  int64_t top = std::max(box.top, int64_t{0});
+  int64_t bottom = std::min(box.bottom, int64_t{height});
+
+  for (int64_t row = top; row < bottom; row++) {
+    int64_t half_width = get_half_width(row - y);
+    fill_span(bitmap + row * stride, x - half_width, x + half_width + 1, width, value);
+  }
+}
+
+
 
 Error RegionGeometry_Polygon::parse(const std::vector<uint8_t>& data,
                                     int field_size,
@@ -365,6 +505,143 @@ void RegionGeometry_Polygon::encode(StreamWriter& writer, int field_size_bytes)
 }
 
 
+RegionBoundingBox RegionGeometry_Polygon::get_bounding_box() const
+{
+  if (points.empty()) {
+    return {0, 0, 0, 0};
+  }
+
+  RegionBoundingBox box{points[0].x, points[0].y, int64_t{points[0].x} + 1, int64_t{points[0].y} + 1};
+
+  for (const auto& p : points) {
+    box.left = std::min(box.left, int64_t{p.x});
+    box.top = std::min(box.top, int64_t{p.y});
+    box.right = std::max(box.right, int64_t{p.x} + 1);
+    box.bottom = std::max(box.bottom, int64_t{p.y} + 1);
+  }
+
+  return box;
+}
+
+
+void RegionGeometry_Polygon::get_crossings(int32_t y, std::vector<double>& crossings) const
+{
+  crossings.clear();
+
+  double center_y = y + 0.5;
+
+  for (size_t i = 0; i < points.size(); i++) {
+    const Point& p0 = points[i];
+    const Point& p1 = points[(i + 1) % points.size()];
+
+    if ((p0.y > center_y) != (p1.y > center_y)) {
+      crossings.push_back(p0.x + (center_y - p0.y) * (double(p1.x) - p0.x) / (double(p1.y) - p0.y));
+    }
+  }
+
+  std::sort(crossings.begin(), crossings.end());
+}
+
+
+bool RegionGeometry_Polygon::contains(int32_t px, int32_t py) const
+{
+  if (!closed) {
+    return false;
+  }
+
+  std::vector<double> crossings;
+  get_crossings(py, crossings);
+
+  // the pixel center is inside if there is an odd number of edges left of it
+  double center_x = px + 0.5;
+  size_t num_left = 0;
+  for (double c : crossings) {
+    if (c <= center_x) {
+      num_left++;
+    }
+  }
+
+  return (num_left % 2) == 1;
+}
+
+
+void RegionGeometry_Polygon::draw_line(const Point& p0, const Point& p1,
+                                       uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride,
+                                       uint8_t value) const
+{
+  int64_t dx = int64_t{p1.x} - p0.x;
+  int64_t dy = int64_t{p1.y} - p0.y;
+
+  // Step along the longer axis. Only the steps within the bitmap are visited.
+  bool steep = (std::abs(dy) > std::abs(dx));
+  int64_t start = steep ? std::min(p0.y, p1.y) : std::min(p0.x, p1.x);
+  int64_t end = steep ? std::max(p0.y, p1.y) : std::max(p0.x, p1.x);
+
+  start = std::max(start, int64_t{0});
+  end = std::min(end, int64_t{steep ? height : width} - 1);
+
+  for (int64_t major = start; major <= end; major++) {
+    int64_t minor;
+    if (steep) {
+      minor = p0.x + std::llround(static_cast<double>(major - p0.y) * static_cast<double>(dx) / static_cast<double>(dy));
+    }
+    else if (dx != 0) {
+      minor = p0.y + std::llround(static_cast<double>(major - p0.x) * static_cast<double>(dy) / static_cast<double>(dx));
+    }
+    else {
+      minor = p0.y;
+    }
+
+    int64_t px = steep ? minor : major;
+    int64_t py = steep ? major : minor;
+
+    if (px >= 0 && py >= 0 && px < int64_t{width} && py < int64_t{height}) {
+      bitmap[py * stride + px] = value;
+    }
+  }
+}
+
+
+void RegionGeometry_Polygon::rasterize(uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const
+{
+  if (points.empty()) {
+    return;
+  }
+
+  if (!closed) {
+    for (size_t i = 0; i + 1 < points.size(); i++) {
+      draw_line(points[i], points[i + 1], bitmap, width, height, stride, value);
+    }
+
+    if (points.size() == 1) {
+      draw_line(points[0], points[0], bitmap, width, height, stride, value);
+    }
+
+    return;
+  }
+
+  // --- fill the spans between pairs of edge crossings in each row
+
+  RegionBoundingBox box = get_bounding_box();
+  int64_t top = std::max(box.top, int64_t{0});
+  int64_t bottom = std::min(box.bottom, int64_t{height});
+
+  std::vector<double> crossings;
+
+  for (int64_t row = top; row < bottom; row++) {
+    get_crossings(static_cast<int32_t>(row), crossings);
+
+    // pixels whose center lies in [c0,c1)
+    for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+      fill_span(bitmap + row * stride,
+                static_cast<int64_t>(std::ceil(crossings[i] - 0.5)),
+                static_cast<int64_t>(std::ceil(crossings[i + 1] - 0.5)),
+                width, value);
+    }
+  }
+}
+
+
 RegionCoordinateTransform RegionCoordinateTransform::create(std::shared_ptr<HeifFile> file,
                                                             heif_item_id item_id,
                                                             int reference_width, int reference_height)
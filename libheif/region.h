@@ -30,6 +30,15 @@
 
 class RegionGeometry;
 
+// Pixel area [left,right) x [top,bottom) that covers a region.
+struct RegionBoundingBox
+{
+  int64_t left, top, right, bottom;
+
+  bool contains(int64_t x, int64_t y) const { return x >= left && x < right && y >= top && y < bottom; }
+};
+
+
 class RegionItem
 {
 public:
@@ -46,10 +55,15 @@ public:
 
   std::vector<std::shared_ptr<RegionGeometry>> get_regions() { return mRegions; }
 
-  void add_region(const std::shared_ptr<RegionGeometry>& region)
-  {
-    mRegions.push_back(region);
-  }
+  const std::vector<std::shared_ptr<RegionGeometry>>& get_region_list() const { return mRegions; }
+
+  void add_region(const std::shared_ptr<RegionGeometry>& region);
+
+  // Indices of the regions that contain the pixel (x,y) (see RegionGeometry::contains()).
+  std::vector<int> find_regions_at(int32_t x, int32_t y) const;
+
+  // Indices of the regions whose bounding box intersects the rectangle.
+  std::vector<int> find_regions_in_rectangle(int32_t x, int32_t y, uint32_t width, uint32_t height) const;
 
   heif_item_id item_id = 0;
   uint32_t reference_width = 0;
@@ -57,6 +71,9 @@ public:
 
 private:
   std::vector<std::shared_ptr<RegionGeometry>> mRegions;
+
+  // The bounding boxes of mRegions, for a quick test which regions can be hit.
+  std::vector<RegionBoundingBox> mBoundingBoxes;
 };
 
 
@@ -73,6 +90,17 @@ public:
 
   virtual void encode(StreamWriter&, int field_size_bytes) const {}
 
+  virtual RegionBoundingBox get_bounding_box() const = 0;
+
+  // Whether the pixel (x,y) of the reference coordinate space belongs to the region.
+  // A pixel belongs to a polygon if its center lies inside. Polylines do not contain any pixels.
+  virtual bool contains(int32_t x, int32_t y) const = 0;
+
+  // Set the pixels of the region to 'value' in a bitmap that covers the area (0,0)-(width,height) of
+  // the reference coordinate space. This sets exactly the pixels for which contains() is true.
+  // Polylines are drawn as lines of one pixel width.
+  virtual void rasterize(uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const = 0;
+
 protected:
   uint32_t parse_unsigned(const std::vector<uint8_t>& data, int field_size, unsigned int* dataOffset);
 
@@ -90,6 +118,12 @@ public:
 
   heif_region_type getRegionType() override { return heif_region_type_point; }
 
+  RegionBoundingBox get_bounding_box() const override;
+
+  bool contains(int32_t x, int32_t y) const override;
+
+  void rasterize(uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const override;
+
   int32_t x, y;
 };
 
@@ -104,6 +138,12 @@ public:
 
   heif_region_type getRegionType() override { return heif_region_type_rectangle; }
 
+  RegionBoundingBox get_bounding_box() const override;
+
+  bool contains(int32_t x, int32_t y) const override;
+
+  void rasterize(uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const override;
+
   int32_t x, y;
   uint32_t width, height;
 };
@@ -119,8 +159,18 @@ public:
 
   heif_region_type getRegionType() override { return heif_region_type_ellipse; }
 
+  RegionBoundingBox get_bounding_box() const override;
+
+  bool contains(int32_t x, int32_t y) const override;
+
+  void rasterize(uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const override;
+
   int32_t x, y;
   uint32_t radius_x, radius_y;
+
+private:
+  // Half width of the ellipse in the row 'dy' rows below its center, or -1 if the row is outside.
+  int64_t get_half_width(int64_t dy) const;
 };
 
 class RegionGeometry_Polygon : public RegionGeometry
@@ -137,6 +187,12 @@ public:
     return closed ? heif_region_type_polygon : heif_region_type_polyline;
   }
 
+  RegionBoundingBox get_bounding_box() const override;
+
+  bool contains(int32_t x, int32_t y) const override;
+
+  void rasterize(uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const override;
+
   struct Point
   {
     int32_t x, y;
@@ -144,6 +200,13 @@ public:
 
   bool closed = true;
   std::vector<Point> points;
+
+private:
+  // The sorted x positions at which the polygon edges cross the pixel centers of row 'y'.
+  void get_crossings(int32_t y, std::vector<double>& crossings) const;
+
+  void draw_line(const Point& p0, const Point& p1,
+                 uint8_t* bitmap, uint32_t width, uint32_t height, size_t stride, uint8_t value) const;
 };
 
 #if 0
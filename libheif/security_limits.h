@@ -46,4 +46,13 @@ static const int64_t MAX_LARGE_BOX_SIZE = 0x0FFFFFFFFFFFFFFF;
 static const int64_t MAX_FILE_POS = 0x007FFFFFFFFFFFFFLL; // maximum file position
 static const int MAX_FRACTION_VALUE = 0x10000;
 
+// Default limit of the work of decoding a grid or overlay image (see heif_context_set_decoding_work_limit()).
+// The work is counted in pixels. Each decoded tile adds the work of a small image for setting up the decoder.
+static const uint64_t DEFAULT_DECODING_WORK_BASE = 1 << 28;
+static const uint32_t DEFAULT_DECODING_WORK_PER_INPUT_BYTE = 16384;
+static const uint64_t DECODING_WORK_PER_TILE = 64 * 64;
+
+// Maximum length of a chain of derived images (e.g. a grid of overlays of grids).
+static const int MAX_IMAGE_DERIVATION_DEPTH = 64;
+
 #endif  // LIBHEIF_SECURITY_LIMITS_H
@@ -0,0 +1,416 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sequence_decoder.h"
+#include "context.h"
+#include "file.h"
+#include "pixelimage.h"
+#include "api_structs.h"
+#include "plugin_registry.h"
+#include "thread_pool.h"
+#include "statistics.h"
+#include "libheif/heif_plugin.h"
+
+#include <utility>
+
+
+static Error plugin_error(const struct heif_error& err)
+{
+  return Error(err.code, err.subcode, err.message);
+}
+
+
+// The decoder plugins expect NAL units with 4-byte size prefixes.
+static Error convert_nal_length_size(const uint8_t* data, size_t size, int length_size,
+                                     std::vector<uint8_t>& out)
+{
+  out.clear();
+  out.reserve(size + size / 4);
+
+  size_t pos = 0;
+  while (pos < size) {
+    if (static_cast<size_t>(length_size) > size - pos) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_End_of_data,
+                   "Truncated NAL unit size in sample");
+    }
+
+    uint32_t nal_size = 0;
+    for (int i = 0; i < length_size; i++) {
+      nal_size = (nal_size << 8) | data[pos++];
+    }
+
+    if (nal_size > size - pos) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_End_of_data,
+                   "NAL unit exceeds the sample size");
+    }
+
+    out.push_back(static_cast<uint8_t>(nal_size >> 24));
+    out.push_back(static_cast<uint8_t>(nal_size >> 16));
+    out.push_back(static_cast<uint8_t>(nal_size >> 8));
+    out.push_back(static_cast<uint8_t>(nal_size));
+    out.insert(out.end(), data + pos, data + pos + nal_size);
+    pos += nal_size;
+  }
+
+  return Error::Ok;
+}
+
+
+SequenceDecoder::SequenceDecoder(std::shared_ptr<const HeifContext> ctx, std::shared_ptr<const Track> track,
+                                 heif_colorspace out_colorspace, heif_chroma out_chroma,
+                                 const heif_decoding_options& options)
+    : m_ctx(std::move(ctx)),
+      m_track(std::move(track)),
+      m_out_colorspace(out_colorspace),
+      m_out_chroma(out_chroma),
+      m_options(options),
+      m_cursor(*m_track)
+{
+}
+
+
+SequenceDecoder::~SequenceDecoder()
+{
+  // the tasks use the sample data and the images of this decoder
+  if (m_read_task) {
+    m_read_task->wait();
+  }
+
+  if (m_conversion) {
+    m_conversion->task->wait();
+  }
+
+  if (m_decoder) {
+    m_decoder_plugin->free_decoder(m_decoder);
+  }
+}
+
+
+Error SequenceDecoder::init()
+{
+  m_decoder_plugin = get_decoder(m_track->get_compression_format(), m_options.decoder_id);
+  if (!m_decoder_plugin) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_codec);
+  }
+
+  m_use_frame_api = (m_decoder_plugin->plugin_api_version >= 8 &&
+                     m_decoder_plugin->push_frame &&
+                     m_decoder_plugin->get_frame);
+
+  if (!m_use_frame_api) {
+    // Without push_frame(), only samples that do not depend on other samples can be decoded.
+    if (!m_track->has_only_sync_samples() ||
+        m_decoder_plugin->plugin_api_version < 4 ||
+        !m_decoder_plugin->reset_image) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Unsupported_codec,
+                   "The decoder plugin cannot decode this image sequence");
+    }
+  }
+
+  Error err = m_track->get_codec_headers(&m_headers);
+  if (err) {
+    return err;
+  }
+
+  struct heif_error plugin_err = m_decoder_plugin->new_decoder(&m_decoder);
+  if (plugin_err.code != heif_error_Ok) {
+    m_decoder = nullptr;
+    return plugin_error(plugin_err);
+  }
+
+  statistics::add(statistics::decoder_instances_created);
+
+  err = m_ctx->set_decoder_options(m_decoder_plugin, m_decoder, m_options);
+  if (err) {
+    return err;
+  }
+
+  // In frame mode, the headers are pushed only once for the whole track.
+  if (m_use_frame_api && !m_headers.empty()) {
+    plugin_err = m_decoder_plugin->push_data(m_decoder, m_headers.data(), m_headers.size());
+    if (plugin_err.code != heif_error_Ok) {
+      return plugin_error(plugin_err);
+    }
+  }
+
+  start_reading_next_sample();
+
+  return Error::Ok;
+}
+
+
+Error SequenceDecoder::read_sample(SampleData& sample) const
+{
+  const uint8_t* view = nullptr;
+  Error err = m_ctx->get_heif_file()->read_file_range(sample.sample.offset, sample.sample.size, &sample.data, &view);
+  if (err) {
+    return err;
+  }
+
+  if (m_track->get_compression_format() == heif_compression_HEVC &&
+      m_track->get_nal_length_size() != 4) {
+    std::vector<uint8_t> converted;
+    err = convert_nal_length_size(view ? view : sample.data.data(), sample.sample.size,
+                                  m_track->get_nal_length_size(), converted);
+    if (err) {
+      return err;
+    }
+
+    sample.data = std::move(converted);
+    view = nullptr;
+  }
+
+  sample.view = view;
+
+  return Error::Ok;
+}
+
+
+void SequenceDecoder::start_reading_next_sample()
+{
+  m_next_sample.reset();
+
+  if (m_cursor.at_end()) {
+    return;
+  }
+
+  m_next_sample.reset(new SampleData());
+  m_next_sample->error = m_cursor.get_sample(m_next_sample->sample);
+  m_cursor.advance();
+
+  if (m_next_sample->error) {
+    return;
+  }
+
+  SampleData* sample = m_next_sample.get();
+
+  std::shared_ptr<ThreadPool> thread_pool = m_ctx->get_thread_pool();
+  m_read_task.reset(new TaskGroup(thread_pool.get()));
+  m_read_task->run([this, sample]() {
+    sample->error = read_sample(*sample);
+    return Error::Ok;
+  });
+}
+
+
+Error SequenceDecoder::push_next_sample()
+{
+  if (m_read_task) {
+    m_read_task->wait();
+    m_read_task.reset();
+  }
+
+  if (!m_next_sample) {
+    m_end_of_stream_pushed = true;
+
+    struct heif_error err = m_decoder_plugin->push_frame(m_decoder, nullptr, 0, 0);
+    if (err.code != heif_error_Ok) {
+      return plugin_error(err);
+    }
+
+    return Error::Ok;
+  }
+
+  std::unique_ptr<SampleData> sample = std::move(m_next_sample);
+  if (sample->error) {
+    return sample->error;
+  }
+
+  // read the following sample while this one is decoded
+  start_reading_next_sample();
+
+  if (sample->get_size() == 0) {
+    return Error::Ok;
+  }
+
+  struct heif_error err = m_decoder_plugin->push_frame(m_decoder, sample->get_data(), sample->get_size(),
+                                                       sample->sample.presentation_time);
+  if (err.code != heif_error_Ok) {
+    return plugin_error(err);
+  }
+
+  return Error::Ok;
+}
+
+
+Error SequenceDecoder::decode_frame(std::shared_ptr<HeifPixelImage>& img, int64_t& timestamp)
+{
+  img.reset();
+
+  if (!m_use_frame_api) {
+    return decode_independent_frame(img, timestamp);
+  }
+
+  for (;;) {
+    heif_image* decoded_img = nullptr;
+    struct heif_error err = m_decoder_plugin->get_frame(m_decoder, &decoded_img, &timestamp);
+    if (err.code != heif_error_Ok) {
+      if (decoded_img) {
+        heif_image_release(decoded_img);
+      }
+
+      return plugin_error(err);
+    }
+
+    if (decoded_img) {
+      img = std::move(decoded_img->image);
+      heif_image_release(decoded_img);
+      return Error::Ok;
+    }
+
+    if (m_end_of_stream_pushed) {
+      return Error::Ok;
+    }
+
+    Error push_err = push_next_sample();
+    if (push_err) {
+      return push_err;
+    }
+  }
+}
+
+
+Error SequenceDecoder::decode_independent_frame(std::shared_ptr<HeifPixelImage>& img, int64_t& timestamp)
+{
+  if (m_read_task) {
+    m_read_task->wait();
+    m_read_task.reset();
+  }
+
+  if (!m_next_sample) {
+    return Error::Ok;
+  }
+
+  std::unique_ptr<SampleData> sample = std::move(m_next_sample);
+  if (sample->error) {
+    return sample->error;
+  }
+
+  start_reading_next_sample();
+
+  struct heif_error err = {heif_error_Ok, heif_suberror_Unspecified, kSuccess};
+
+  if (!m_headers.empty()) {
+    err = m_decoder_plugin->push_data(m_decoder, m_headers.data(), m_headers.size());
+  }
+
+  if (err.code == heif_error_Ok) {
+    err = m_decoder_plugin->push_data(m_decoder, sample->get_data(), sample->get_size());
+  }
+
+  heif_image* decoded_img = nullptr;
+  if (err.code == heif_error_Ok) {
+    err = m_decoder_plugin->decode_image(m_decoder, &decoded_img);
+  }
+
+  m_decoder_plugin->reset_image(m_decoder);
+
+  if (err.code != heif_error_Ok) {
+    if (decoded_img) {
+      heif_image_release(decoded_img);
+    }
+
+    return plugin_error(err);
+  }
+
+  if (!decoded_img) {
+    return Error(heif_error_Decoder_plugin_error, heif_suberror_Unspecified);
+  }
+
+  img = std::move(decoded_img->image);
+  heif_image_release(decoded_img);
+
+  timestamp = sample->sample.presentation_time;
+
+  return Error::Ok;
+}
+
+
+Error SequenceDecoder::start_next_conversion()
+{
+  m_conversion.reset();
+
+  std::shared_ptr<HeifPixelImage> img;
+  int64_t timestamp = 0;
+  Error err = decode_frame(img, timestamp);
+  if (err || !img) {
+    return err;
+  }
+
+  std::unique_ptr<Conversion> conversion(new Conversion());
+  conversion->image = std::move(img);
+  conversion->timestamp = timestamp;
+
+  std::shared_ptr<ThreadPool> thread_pool = m_ctx->get_thread_pool();
+  conversion->task.reset(new TaskGroup(thread_pool.get()));
+
+  Conversion* c = conversion.get();
+  m_conversion = std::move(conversion);
+
+  c->task->run([this, c]() {
+    return m_ctx->convert_sequence_frame(c->image, *m_track, m_out_colorspace, m_out_chroma, m_options);
+  });
+
+  return Error::Ok;
+}
+
+
+Error SequenceDecoder::decode_next_frame(std::shared_ptr<HeifPixelImage>& out_img, int64_t* out_timestamp)
+{
+  out_img.reset();
+
+  if (m_deferred_error) {
+    return m_deferred_error;
+  }
+
+  if (!m_conversion) {
+    Error err = start_next_conversion();
+    if (err) {
+      return err;
+    }
+
+    if (!m_conversion) {
+      // all frames have been returned
+      return Error::Ok;
+    }
+  }
+
+  std::unique_ptr<Conversion> current = std::move(m_conversion);
+
+  // Decode the next frame while the current frame is converted. An error is returned in the next call,
+  // after the current frame.
+  m_deferred_error = start_next_conversion();
+
+  Error err = current->task->wait();
+  if (err) {
+    return err;
+  }
+
+  out_img = std::move(current->image);
+  if (out_timestamp) {
+    *out_timestamp = current->timestamp;
+  }
+
+  return Error::Ok;
+}
@@ -0,0 +1,127 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_SEQUENCE_DECODER_H
+#define LIBHEIF_SEQUENCE_DECODER_H
+
+#include "error.h"
+#include "track.h"
+#include "libheif/heif.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+class HeifContext;
+
+class HeifPixelImage;
+
+class TaskGroup;
+
+struct heif_decoder_plugin;
+
+
+// Decodes the frames of a track one after the other with a single decoder instance that is kept
+// for the whole track.
+// The work on consecutive frames overlaps: the next sample is read while the current one is decoded,
+// and a decoded frame is color converted on the thread pool while the decoder works on the next frame.
+// Hence, decode_next_frame() returns each frame one call after it has been decoded.
+class SequenceDecoder
+{
+public:
+  SequenceDecoder(std::shared_ptr<const HeifContext> ctx, std::shared_ptr<const Track> track,
+                  heif_colorspace out_colorspace, heif_chroma out_chroma,
+                  const heif_decoding_options& options);
+
+  ~SequenceDecoder();
+
+  SequenceDecoder(const SequenceDecoder&) = delete;
+
+  SequenceDecoder& operator=(const SequenceDecoder&) = delete;
+
+  // Creates the decoder instance and pushes the codec headers.
+  Error init();
+
+  // Returns the frames in presentation order. 'out_img' is nullptr after the last frame.
+  // 'out_timestamp' is the presentation time in the timescale of the track.
+  Error decode_next_frame(std::shared_ptr<HeifPixelImage>& out_img, int64_t* out_timestamp);
+
+private:
+  struct SampleData
+  {
+    Track::Sample sample{};
+    std::vector<uint8_t> data;
+    const uint8_t* view = nullptr; // points into the input file, 'data' is empty then
+    Error error;
+
+    const uint8_t* get_data() const { return view ? view : data.data(); }
+
+    size_t get_size() const { return view ? sample.size : data.size(); }
+  };
+
+  struct Conversion
+  {
+    std::shared_ptr<HeifPixelImage> image;
+    int64_t timestamp = 0;
+    std::unique_ptr<TaskGroup> task;
+  };
+
+  // Start reading the next sample in the background. Does nothing after the last sample.
+  void start_reading_next_sample();
+
+  Error read_sample(SampleData& sample) const;
+
+  // Push the next sample into the decoder, or signal the end of the stream after the last sample.
+  Error push_next_sample();
+
+  // Get the next frame from the decoder. 'img' is nullptr after the last frame.
+  Error decode_frame(std::shared_ptr<HeifPixelImage>& img, int64_t& timestamp);
+
+  // Fallback for decoders without push_frame(): each (sync) sample is decoded on its own.
+  Error decode_independent_frame(std::shared_ptr<HeifPixelImage>& img, int64_t& timestamp);
+
+  // Decode the next frame and start its color conversion. m_conversion is nullptr after the last frame.
+  Error start_next_conversion();
+
+  std::shared_ptr<const HeifContext> m_ctx;
+  std::shared_ptr<const Track> m_track;
+  heif_colorspace m_out_colorspace;
+  heif_chroma m_out_chroma;
+  heif_decoding_options m_options;
+
+  const heif_decoder_plugin* m_decoder_plugin = nullptr;
+  void* m_decoder = nullptr;
+  bool m_use_frame_api = false;
+  std::vector<uint8_t> m_headers;
+
+  Track::SampleCursor m_cursor;
+  bool m_end_of_stream_pushed = false;
+
+  std::unique_ptr<SampleData> m_next_sample;
+  std::unique_ptr<TaskGroup> m_read_task;
+
+  std::unique_ptr<Conversion> m_conversion;
+
+  // a decoding error that is returned after the frame that was decoded before
+  Error m_deferred_error;
+};
+
+#endif
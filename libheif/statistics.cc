@@ -0,0 +1,108 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "statistics.h"
+
+#include <atomic>
+
+
+namespace {
+
+  // Threads are distributed round-robin over the shards. Threads that share a shard still count
+  // correctly, they only access the same cache lines.
+  const int kNumShards = 16;
+
+  struct alignas(64) Shard
+  {
+    std::atomic<uint64_t> counters[statistics::num_counters];
+    std::atomic<uint64_t> conversions[statistics::kMaxColorConversionOperations];
+    std::atomic<uint64_t> converted_pixels[statistics::kMaxColorConversionOperations];
+  };
+
+  // zero-initialized, because it has static storage duration
+  Shard s_shards[kNumShards];
+
+  std::atomic<unsigned int> s_next_shard{0};
+
+
+  Shard& get_thread_shard()
+  {
+    thread_local Shard& shard = s_shards[s_next_shard.fetch_add(1, std::memory_order_relaxed) % kNumShards];
+    return shard;
+  }
+}
+
+
+void statistics::add(Counter counter, uint64_t value)
+{
+  get_thread_shard().counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+
+void statistics::add_color_conversion(int op_index, uint64_t num_pixels)
+{
+  if (op_index < 0 || op_index >= kMaxColorConversionOperations) {
+    return;
+  }
+
+  Shard& shard = get_thread_shard();
+  shard.conversions[op_index].fetch_add(1, std::memory_order_relaxed);
+  shard.converted_pixels[op_index].fetch_add(num_pixels, std::memory_order_relaxed);
+}
+
+
+uint64_t statistics::get(Counter counter)
+{
+  uint64_t total = 0;
+  for (const Shard& shard : s_shards) {
+    total += shard.counters[counter].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+
+statistics::ColorConversionCount statistics::get_color_conversion(int op_index)
+{
+  if (op_index < 0 || op_index >= kMaxColorConversionOperations) {
+    return {0, 0};
+  }
+
+  ColorConversionCount count{0, 0};
+  for (const Shard& shard : s_shards) {
+    count.num_conversions += shard.conversions[op_index].load(std::memory_order_relaxed);
+    count.num_pixels += shard.converted_pixels[op_index].load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+
+void statistics::reset()
+{
+  for (Shard& shard : s_shards) {
+    for (auto& counter : shard.counters) {
+      counter.store(0, std::memory_order_relaxed);
+    }
+
+    for (int i = 0; i < kMaxColorConversionOperations; i++) {
+      shard.conversions[i].store(0, std::memory_order_relaxed);
+      shard.converted_pixels[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
@@ -0,0 +1,73 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_STATISTICS_H
+#define LIBHEIF_STATISTICS_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Process-wide counters (see heif_get_statistics()). They are cheap enough to be always on:
+// each thread increments its own shard of relaxed atomics, which are only summed up when read.
+namespace statistics {
+
+  enum Counter
+  {
+    images_decoded,
+    tiles_decoded,
+    bytes_read,
+    pixels_converted,
+    plane_bytes_allocated,
+    plane_bytes_reused,
+    decoded_image_cache_hits,
+    decoded_image_cache_misses,
+    conversion_pipeline_cache_hits,
+    conversion_pipeline_cache_misses,
+    decoder_instances_created,
+    read_lock_wait_ns,
+    plane_allocations,
+
+    num_counters
+  };
+
+  // Operations with a higher index are not counted separately.
+  static const int kMaxColorConversionOperations = 64;
+
+  void add(Counter counter, uint64_t value = 1);
+
+  // Counts one conversion of 'num_pixels' by the color conversion operation with index 'op_index'.
+  void add_color_conversion(int op_index, uint64_t num_pixels);
+
+  uint64_t get(Counter counter);
+
+  struct ColorConversionCount
+  {
+    uint64_t num_conversions;
+    uint64_t num_pixels;
+  };
+
+  ColorConversionCount get_color_conversion(int op_index);
+
+  // Counts that are added concurrently to a reset may be lost or kept.
+  void reset();
+}
+
+#endif
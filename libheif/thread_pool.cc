@@ -0,0 +1,373 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread_pool.h"
+
+#include <utility>
+
+
+#if ENABLE_MULTITHREADING_SUPPORT
+static thread_local TaskPriority s_current_priority = TaskPriority::Visible;
+#else
+static TaskPriority s_current_priority = TaskPriority::Visible;
+#endif
+
+
+ScopedTaskPriority::ScopedTaskPriority(TaskPriority priority)
+    : m_previous_priority(s_current_priority)
+{
+  s_current_priority = priority;
+}
+
+
+ScopedTaskPriority::~ScopedTaskPriority()
+{
+  s_current_priority = m_previous_priority;
+}
+
+
+TaskPriority ScopedTaskPriority::current()
+{
+  return s_current_priority;
+}
+
+
+ThreadPool::ThreadPool(int num_threads)
+    : m_num_threads(num_threads > 0 ? num_threads : 0)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  m_workers.reserve(m_num_threads);
+  for (int i = 0; i < m_num_threads; i++) {
+    m_workers.emplace_back(&ThreadPool::worker_main, this);
+  }
+#else
+  m_num_threads = 0;
+#endif
+}
+
+
+ThreadPool::ThreadPool(const heif_executor& executor)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  m_use_executor = true;
+  m_executor = executor;
+  m_num_threads = executor.concurrency > 0 ? executor.concurrency : 0;
+#else
+  (void) executor;
+#endif
+}
+
+
+ThreadPool::~ThreadPool()
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  if (m_use_executor) {
+    // Jobs whose task has already been run by a waiting thread still refer to the pool.
+    std::unique_lock<std::mutex> lock(m_mutex);
+    wait_until(lock, m_cond_executor_jobs_finished, [this] { return m_num_executor_jobs == 0; });
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_shutdown = true;
+  }
+
+  m_cond_task_available.notify_all();
+
+  for (auto& worker : m_workers) {
+    worker.join();
+  }
+#endif
+}
+
+
+void ThreadPool::submit(TaskGroup* group, TaskPriority priority, std::function<void()> func)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  // the task runs with its priority, such that the groups it creates inherit it
+  auto task = [priority, func]() {
+    ScopedTaskPriority task_priority(priority);
+    func();
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks[static_cast<int>(priority) - 1].push_back(Task{group, std::move(task)});
+
+    if (m_use_executor) {
+      m_num_executor_jobs++;
+    }
+  }
+
+  if (m_use_executor) {
+    m_executor.submit(m_executor.userdata, &ThreadPool::run_executor_job, this);
+  }
+  else {
+    m_cond_task_available.notify_one();
+  }
+#else
+  (void) group;
+  ScopedTaskPriority task_priority(priority);
+  func();
+#endif
+}
+
+
+void ThreadPool::run_detached(TaskPriority priority, std::function<void()> func)
+{
+  if (m_num_threads == 0) {
+    ScopedTaskPriority task_priority(priority);
+    func();
+    return;
+  }
+
+  submit(nullptr, priority, std::move(func));
+}
+
+
+bool ThreadPool::run_queued_task_of_group(TaskGroup* group)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::function<void()> func;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::deque<Task>& tasks = m_tasks[static_cast<int>(group->get_priority()) - 1];
+    for (auto iter = tasks.begin(); iter != tasks.end(); ++iter) {
+      if (iter->group == group) {
+        func = std::move(iter->func);
+        tasks.erase(iter);
+        break;
+      }
+    }
+  }
+
+  if (!func) {
+    return false;
+  }
+
+  func();
+  return true;
+#else
+  (void) group;
+  return false;
+#endif
+}
+
+
+#if ENABLE_MULTITHREADING_SUPPORT
+bool ThreadPool::take_next_task(std::function<void()>& func)
+{
+  for (auto& tasks : m_tasks) {
+    if (!tasks.empty()) {
+      func = std::move(tasks.front().func);
+      tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+void ThreadPool::run_executor_job(void* pool_ptr)
+{
+  auto* pool = static_cast<ThreadPool*>(pool_ptr);
+
+  std::function<void()> func;
+  {
+    std::lock_guard<std::mutex> lock(pool->m_mutex);
+    pool->take_next_task(func);
+  }
+
+  // The queue may be empty when a waiting thread has run the task of this job.
+  if (func) {
+    func();
+  }
+
+  std::lock_guard<std::mutex> lock(pool->m_mutex);
+  pool->m_num_executor_jobs--;
+  if (pool->m_num_executor_jobs == 0) {
+    pool->m_cond_executor_jobs_finished.notify_all();
+  }
+}
+
+
+void ThreadPool::wait_until(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+                            const std::function<bool()>& is_finished)
+{
+  if (m_use_executor && m_executor.wait) {
+    struct WaitState
+    {
+      std::unique_lock<std::mutex>* lock;
+      const std::function<bool()>* is_finished;
+    } state{&lock, &is_finished};
+
+    lock.unlock();
+
+    m_executor.wait(m_executor.userdata, [](void* data) -> int {
+      auto* state = static_cast<WaitState*>(data);
+      std::lock_guard<std::mutex> check_lock(*state->lock->mutex());
+      return (*state->is_finished)() ? 1 : 0;
+    }, &state);
+
+    lock.lock();
+  }
+
+  cond.wait(lock, is_finished);
+}
+
+
+void ThreadPool::worker_main()
+{
+  for (;;) {
+    std::function<void()> func;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond_task_available.wait(lock, [this, &func] { return take_next_task(func) || m_shutdown; });
+
+      if (!func) {
+        // shutdown requested and no more work to do
+        return;
+      }
+    }
+
+    func();
+  }
+}
+#endif
+
+
+TaskGroup::TaskGroup(ThreadPool* pool)
+    : m_pool(pool), m_priority(ScopedTaskPriority::current())
+{
+  if (m_pool && m_pool->get_num_threads() == 0) {
+    m_pool = nullptr;
+  }
+}
+
+
+TaskGroup::~TaskGroup()
+{
+  // Never leave tasks behind that still reference this group.
+  wait();
+}
+
+
+void TaskGroup::execute(const std::function<Error()>& task)
+{
+  if (m_failed) {
+    return;
+  }
+
+  Error err = task();
+  if (err) {
+#if ENABLE_MULTITHREADING_SUPPORT
+    std::lock_guard<std::mutex> lock(m_mutex);
+#endif
+    if (!m_failed) {
+      m_first_error = err;
+      m_failed = true;
+    }
+  }
+}
+
+
+#if ENABLE_MULTITHREADING_SUPPORT
+void TaskGroup::submit(std::function<Error()> task)
+{
+  m_pool->submit(this, m_priority, [this, task]() {
+    execute(task);
+
+    std::function<Error()> next_task;
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_num_pending--;
+      m_num_submitted--;
+
+      if (!m_deferred_tasks.empty()) {
+        next_task = std::move(m_deferred_tasks.front());
+        m_deferred_tasks.pop_front();
+        m_num_submitted++;
+      }
+
+      if (m_num_pending == 0) {
+        m_cond_finished.notify_all();
+      }
+    }
+
+    if (next_task) {
+      submit(std::move(next_task));
+    }
+  });
+}
+#endif
+
+
+void TaskGroup::run(std::function<Error()> task)
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  if (m_pool) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_num_pending++;
+
+      if (m_max_concurrent_tasks > 0 && m_num_submitted >= m_max_concurrent_tasks) {
+        m_deferred_tasks.push_back(std::move(task));
+        return;
+      }
+
+      m_num_submitted++;
+    }
+
+    submit(std::move(task));
+    return;
+  }
+#endif
+
+  execute(task);
+}
+
+
+bool TaskGroup::run_queued_task()
+{
+  return m_pool && m_pool->run_queued_task_of_group(this);
+}
+
+
+Error TaskGroup::wait()
+{
+#if ENABLE_MULTITHREADING_SUPPORT
+  if (m_pool) {
+    // help processing our own queued tasks instead of idly waiting
+    while (m_pool->run_queued_task_of_group(this)) {
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_pool->wait_until(lock, m_cond_finished, [this] { return m_num_pending == 0; });
+  }
+#endif
+
+  return m_first_error;
+}
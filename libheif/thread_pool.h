@@ -0,0 +1,213 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_THREAD_POOL_H
+#define LIBHEIF_THREAD_POOL_H
+
+#include "error.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#if ENABLE_MULTITHREADING_SUPPORT
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+
+class TaskGroup;
+
+
+// Queued tasks with a higher priority (lower value) are started first. A task that is already
+// running is not interrupted, hence more urgent work has to wait at most for one task (e.g. one tile).
+// The values are the same as in heif_decoding_priority.
+enum class TaskPriority
+{
+  Interactive = 1,
+  Visible = 2,
+  Alpha = 3,
+  Auxiliary = 4,
+  Prefetch = 5
+};
+
+
+// Sets the priority of the TaskGroups that are created by the current thread while this object exists.
+// Tasks run with the priority of their group, hence the TaskGroups that are created by a task inherit its priority.
+class ScopedTaskPriority
+{
+public:
+  explicit ScopedTaskPriority(TaskPriority priority);
+
+  ~ScopedTaskPriority();
+
+  ScopedTaskPriority(const ScopedTaskPriority&) = delete;
+
+  ScopedTaskPriority& operator=(const ScopedTaskPriority&) = delete;
+
+  // The priority of the current thread (TaskPriority::Visible if none has been set).
+  static TaskPriority current();
+
+private:
+  TaskPriority m_previous_priority;
+};
+
+
+// A fixed set of worker threads that execute tasks submitted through a TaskGroup.
+// The pool is kept alive for the lifetime of its owner (usually a HeifContext) so that
+// decoding grid tiles, overlay images and auxiliary images does not create a new thread
+// for each work item.
+// Instead of own threads, the pool can use an executor of the application. The tasks are then still
+// queued by priority in the pool and each job that is submitted to the executor runs the next queued task.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(int num_threads);
+
+  explicit ThreadPool(const heif_executor& executor);
+
+  ~ThreadPool();
+
+  int get_num_threads() const { return m_num_threads; }
+
+  // Run 'func' on the pool without waiting for it, e.g. the decoding of a complete image that was started
+  // asynchronously. The task may wait for TaskGroups on the same pool. Without threads, 'func' is run immediately.
+  void run_detached(TaskPriority priority, std::function<void()> func);
+
+private:
+  friend class TaskGroup;
+
+  struct Task
+  {
+    TaskGroup* group;
+    std::function<void()> func;
+  };
+
+  static const int kNumPriorities = 5;
+
+  void submit(TaskGroup* group, TaskPriority priority, std::function<void()> func);
+
+  // Remove one queued task of 'group' from the queue and run it on the calling thread.
+  // Returns false if there is no queued task of this group.
+  bool run_queued_task_of_group(TaskGroup* group);
+
+  int m_num_threads = 0;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  void worker_main();
+
+  // Remove the next task from the queue of the highest priority. Returns false if all queues are empty.
+  bool take_next_task(std::function<void()>& func);
+
+  // Runs the next queued task. Submitted to the executor once for each task.
+  static void run_executor_job(void* pool);
+
+  // Blocks until the condition is true. Uses the wait function of the executor if it has one.
+  void wait_until(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+                  const std::function<bool()>& is_finished);
+
+  bool m_use_executor = false;
+  heif_executor m_executor{};
+  int m_num_executor_jobs = 0; // submitted to the executor and not finished yet
+  std::condition_variable m_cond_executor_jobs_finished;
+
+  std::vector<std::thread> m_workers;
+  std::deque<Task> m_tasks[kNumPriorities]; // one queue for each TaskPriority
+  std::mutex m_mutex;
+  std::condition_variable m_cond_task_available;
+  bool m_shutdown = false;
+#endif
+};
+
+
+// A set of tasks whose completion is checked together.
+// When no ThreadPool is given (or multithreading is not supported), tasks are run
+// immediately on the calling thread.
+// wait() returns as soon as all tasks have finished. Errors are collected in the order
+// in which the tasks complete. After the first error, tasks that have not been started yet
+// are skipped.
+class TaskGroup
+{
+public:
+  explicit TaskGroup(ThreadPool* pool);
+
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup&) = delete;
+
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  void run(std::function<Error()> task);
+
+  // Run at most 'max_tasks' tasks of this group at the same time (0: no limit). Further tasks are
+  // submitted to the pool when a running task has finished. Has to be set before run() is called.
+  void set_max_concurrent_tasks(int max_tasks) { m_max_concurrent_tasks = max_tasks; }
+
+  // The priority of the tasks in the pool queue. Defaults to the priority of the thread that created the group
+  // (see ScopedTaskPriority). Has to be set before run() is called.
+  void set_priority(TaskPriority priority) { m_priority = priority; }
+
+  TaskPriority get_priority() const { return m_priority; }
+
+  // Blocks until all tasks are finished. While waiting, the calling thread also executes
+  // tasks of this group that have not been picked up by a worker yet. This makes it safe to
+  // wait for a group from within a task of another group on the same pool.
+  Error wait();
+
+  // Run one task of this group that has not been picked up by a worker yet on the calling thread.
+  // Returns false if there is no such task.
+  bool run_queued_task();
+
+  // Whether a task has failed. Tasks that are started afterwards are skipped.
+  bool has_failed() const { return m_failed; }
+
+private:
+  friend class ThreadPool;
+
+  void execute(const std::function<Error()>& task);
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  void submit(std::function<Error()> task);
+#endif
+
+  ThreadPool* m_pool;
+
+  int m_max_concurrent_tasks = 0;
+
+  TaskPriority m_priority;
+
+  Error m_first_error;
+
+#if ENABLE_MULTITHREADING_SUPPORT
+  std::mutex m_mutex;
+  std::condition_variable m_cond_finished;
+  int m_num_pending = 0;
+  int m_num_submitted = 0; // tasks in the pool that have not finished yet
+  std::deque<std::function<Error()>> m_deferred_tasks; // waiting for the concurrency limit
+  std::atomic<bool> m_failed{false};
+#else
+  bool m_failed = false;
+#endif
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tracing.h"
+#include "pixelimage.h"
+
+#include <atomic>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+uint64_t get_thread_cpu_time_us()
+{
+#if defined(_WIN32)
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (!GetThreadTimes(GetCurrentThread(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+    return 0;
+  }
+
+  // FILETIME is in units of 100 ns
+  uint64_t kernel = (static_cast<uint64_t>(kernel_time.dwHighDateTime) << 32) | kernel_time.dwLowDateTime;
+  uint64_t user = (static_cast<uint64_t>(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime;
+  return (kernel + user) / 10;
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+#else
+  return 0;
+#endif
+}
+
+
+static uint32_t get_trace_thread_id()
+{
+  static std::atomic<uint32_t> next_id{1};
+  thread_local uint32_t id = next_id++;
+  return id;
+}
+
+
+uint64_t Tracer::now_us() const
+{
+  auto elapsed = std::chrono::steady_clock::now() - m_start;
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+
+void Tracer::emit(const heif_trace_event& event) const
+{
+  if (m_callback) {
+    m_callback(&event, m_userdata);
+  }
+}
+
+
+TraceScope::TraceScope(const Tracer& tracer, heif_trace_stage stage, heif_item_id id)
+    : m_tracer(tracer), m_enabled(tracer.is_enabled())
+{
+  if (!m_enabled) {
+    return;
+  }
+
+  m_event.version = 1;
+  m_event.stage = stage;
+  m_event.item_id = id;
+  m_event.thread_id = get_trace_thread_id();
+  m_event.start_time_us = tracer.now_us();
+  m_cpu_start_us = get_thread_cpu_time_us();
+}
+
+
+TraceScope::~TraceScope()
+{
+  end();
+}
+
+
+void TraceScope::end()
+{
+  if (!m_enabled) {
+    return;
+  }
+
+  m_enabled = false;
+
+  m_event.wall_time_us = m_tracer.now_us() - m_event.start_time_us;
+
+  uint64_t cpu_end_us = get_thread_cpu_time_us();
+  m_event.cpu_time_us = (cpu_end_us > m_cpu_start_us ? cpu_end_us - m_cpu_start_us : 0);
+
+  m_tracer.emit(m_event);
+}
+
+
+void TraceScope::set_input_image(const HeifPixelImage* img)
+{
+  if (m_enabled && img) {
+    m_event.data_bytes = img->get_pixel_data_size();
+  }
+}
+
+
+void TraceScope::set_output_image(const HeifPixelImage* img)
+{
+  if (m_enabled) {
+    m_event.allocated_bytes = (img ? img->get_allocated_memory_size() : 0);
+  }
+}
@@ -0,0 +1,102 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_TRACING_H
+#define LIBHEIF_TRACING_H
+
+#include "heif.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+class HeifPixelImage;
+
+
+// Forwards the trace events of a context to the application callback (see heif_context_set_trace_callback()).
+class Tracer
+{
+public:
+  Tracer() : m_start(std::chrono::steady_clock::now()) {}
+
+  void set_callback(heif_trace_callback callback, void* userdata)
+  {
+    m_callback = callback;
+    m_userdata = userdata;
+  }
+
+  bool is_enabled() const { return m_callback != nullptr; }
+
+  // microseconds since the tracer was created
+  uint64_t now_us() const;
+
+  void emit(const heif_trace_event& event) const;
+
+private:
+  std::chrono::steady_clock::time_point m_start;
+
+  heif_trace_callback m_callback = nullptr;
+  void* m_userdata = nullptr;
+};
+
+
+// Measures a stage from construction to destruction and sends it to the tracer.
+// Does nothing when the tracer has no callback.
+class TraceScope
+{
+public:
+  TraceScope(const Tracer& tracer, heif_trace_stage stage, heif_item_id id = 0);
+
+  ~TraceScope();
+
+  TraceScope(const TraceScope&) = delete;
+
+  TraceScope& operator=(const TraceScope&) = delete;
+
+  bool is_enabled() const { return m_enabled; }
+
+  void set_item_id(heif_item_id id) { m_event.item_id = id; }
+
+  void set_data_bytes(uint64_t bytes) { m_event.data_bytes = bytes; }
+
+  // memory of the image that the stage processes
+  void set_input_image(const HeifPixelImage* img);
+
+  // the new image that the stage created (not for images that are modified in place)
+  void set_output_image(const HeifPixelImage* img);
+
+  // Send the event now instead of at destruction.
+  void end();
+
+  // Do not send an event, e.g. because there was nothing to do.
+  void cancel() { m_enabled = false; }
+
+private:
+  const Tracer& m_tracer;
+  bool m_enabled;
+  heif_trace_event m_event{};
+  uint64_t m_cpu_start_us = 0;
+};
+
+
+// CPU time of the calling thread in microseconds. 0 if not supported.
+uint64_t get_thread_cpu_time_us();
+
+#endif
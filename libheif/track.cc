@@ -0,0 +1,772 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "track.h"
+#include "security_limits.h"
+
+#include <sstream>
+
+
+static uint64_t read64(BitstreamRange& range)
+{
+  uint64_t high = range.read32();
+  uint64_t low = range.read32();
+  return (high << 32) | low;
+}
+
+
+Error Box_moov::parse(BitstreamRange& range)
+{
+  return read_children(range);
+}
+
+
+std::string Box_moov::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << dump_children(indent);
+
+  return sstr.str();
+}
+
+
+Error Box_mvhd::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  if (get_version() == 1) {
+    read64(range); // creation_time
+    read64(range); // modification_time
+    m_timescale = range.read32();
+    m_duration = read64(range);
+  }
+  else {
+    range.read32(); // creation_time
+    range.read32(); // modification_time
+    m_timescale = range.read32();
+    m_duration = range.read32();
+  }
+
+  return range.get_error();
+}
+
+
+std::string Box_mvhd::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "timescale: " << m_timescale << "\n"
+       << indent << "duration: " << m_duration << "\n";
+
+  return sstr.str();
+}
+
+
+Error Box_trak::parse(BitstreamRange& range)
+{
+  return read_children(range);
+}
+
+
+std::string Box_trak::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << dump_children(indent);
+
+  return sstr.str();
+}
+
+
+Error Box_tkhd::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  if (get_version() == 1) {
+    read64(range); // creation_time
+    read64(range); // modification_time
+    m_track_id = range.read32();
+    range.read32(); // reserved
+    m_duration = read64(range);
+  }
+  else {
+    range.read32(); // creation_time
+    range.read32(); // modification_time
+    m_track_id = range.read32();
+    range.read32(); // reserved
+    m_duration = range.read32();
+  }
+
+  range.read32(); // reserved
+  range.read32();
+  range.read16(); // layer
+  range.read16(); // alternate_group
+  range.read16(); // volume
+  range.read16(); // reserved
+
+  for (int i = 0; i < 9; i++) {
+    range.read32(); // matrix
+  }
+
+  m_width = range.read32();
+  m_height = range.read32();
+
+  return range.get_error();
+}
+
+
+std::string Box_tkhd::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "track_ID: " << m_track_id << "\n"
+       << indent << "duration: " << m_duration << "\n"
+       << indent << "width: " << (m_width / 65536.0) << "\n"
+       << indent << "height: " << (m_height / 65536.0) << "\n";
+
+  return sstr.str();
+}
+
+
+Error Box_mdia::parse(BitstreamRange& range)
+{
+  return read_children(range);
+}
+
+
+std::string Box_mdia::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << dump_children(indent);
+
+  return sstr.str();
+}
+
+
+Error Box_mdhd::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  if (get_version() == 1) {
+    read64(range); // creation_time
+    read64(range); // modification_time
+    m_timescale = range.read32();
+    m_duration = read64(range);
+  }
+  else {
+    range.read32(); // creation_time
+    range.read32(); // modification_time
+    m_timescale = range.read32();
+    m_duration = range.read32();
+  }
+
+  range.read16(); // language
+  range.read16(); // pre_defined
+
+  return range.get_error();
+}
+
+
+std::string Box_mdhd::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "timescale: " << m_timescale << "\n"
+       << indent << "duration: " << m_duration << "\n";
+
+  return sstr.str();
+}
+
+
+Error Box_minf::parse(BitstreamRange& range)
+{
+  return read_children(range);
+}
+
+
+std::string Box_minf::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << dump_children(indent);
+
+  return sstr.str();
+}
+
+
+Error Box_stbl::parse(BitstreamRange& range)
+{
+  return read_children(range);
+}
+
+
+std::string Box_stbl::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << dump_children(indent);
+
+  return sstr.str();
+}
+
+
+Error Box_stsd::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  uint32_t entry_count = range.read32();
+  if (entry_count == 0) {
+    return range.get_error();
+  }
+
+  if (entry_count > MAX_CHILDREN_PER_BOX) {
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 "Number of sample entries exceeds the security limit");
+  }
+
+  return read_children(range, (int) entry_count);
+}
+
+
+std::string Box_stsd::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << dump_children(indent);
+
+  return sstr.str();
+}
+
+
+Error Box_VisualSampleEntry::parse(BitstreamRange& range)
+{
+  for (int i = 0; i < 6; i++) {
+    range.read8(); // reserved
+  }
+
+  m_data_reference_index = range.read16();
+
+  range.read16(); // pre_defined
+  range.read16(); // reserved
+  for (int i = 0; i < 3; i++) {
+    range.read32(); // pre_defined
+  }
+
+  m_width = range.read16();
+  m_height = range.read16();
+
+  range.read32(); // horizresolution
+  range.read32(); // vertresolution
+  range.read32(); // reserved
+  range.read16(); // frame_count
+
+  uint8_t name_length = range.read8();
+  char name[31];
+  for (char& c : name) {
+    c = static_cast<char>(range.read8());
+  }
+  m_compressor_name.assign(name, std::min<size_t>(name_length, sizeof(name)));
+
+  m_depth = range.read16();
+  range.read16(); // pre_defined
+
+  if (range.error()) {
+    return range.get_error();
+  }
+
+  return read_children(range);
+}
+
+
+std::string Box_VisualSampleEntry::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "data_reference_index: " << m_data_reference_index << "\n"
+       << indent << "width: " << m_width << "\n"
+       << indent << "height: " << m_height << "\n"
+       << indent << "compressor name: " << m_compressor_name << "\n"
+       << indent << "depth: " << m_depth << "\n";
+  sstr << dump_children(indent);
+
+  return sstr.str();
+}
+
+
+Error PackedTable::read(BitstreamRange& range, uint32_t num_entries, uint32_t entry_size)
+{
+  uint64_t size = static_cast<uint64_t>(num_entries) * entry_size;
+  if (range.error() || size > static_cast<uint64_t>(range.get_remaining_bytes())) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_End_of_data,
+                 "Sample table exceeds the box size");
+  }
+
+  m_num_entries = num_entries;
+  m_entry_size = entry_size;
+
+  if (size == 0) {
+    return Error::Ok;
+  }
+
+  // The table is at the end of the box. If it is not read here, it is skipped together with the rest of the box.
+  std::shared_ptr<StreamReader> istr = range.get_istream();
+  m_data = istr->get_memory_view(istr->get_position(), static_cast<size_t>(size));
+  if (m_data) {
+    m_stream = istr;
+    return Error::Ok;
+  }
+
+  if (size > MAX_MEMORY_BLOCK_SIZE) {
+    return Error(heif_error_Memory_allocation_error,
+                 heif_suberror_Security_limit_exceeded,
+                 "Sample table exceeds the security limit");
+  }
+
+  m_copy.resize(static_cast<size_t>(size));
+  if (!range.read(m_copy.data(), static_cast<int64_t>(size))) {
+    return range.get_error();
+  }
+
+  return Error::Ok;
+}
+
+
+uint32_t PackedTable::get32(uint32_t entry, uint32_t field_offset) const
+{
+  const uint8_t* p = (m_data ? m_data : m_copy.data()) + static_cast<size_t>(entry) * m_entry_size + field_offset;
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+
+uint64_t PackedTable::get64(uint32_t entry, uint32_t field_offset) const
+{
+  return (static_cast<uint64_t>(get32(entry, field_offset)) << 32) | get32(entry, field_offset + 4);
+}
+
+
+Error Box_stts::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  uint32_t entry_count = range.read32();
+  return m_entries.read(range, entry_count, 8);
+}
+
+
+std::string Box_stts::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "entries: " << get_num_entries() << "\n";
+  for (uint32_t i = 0; i < get_num_entries(); i++) {
+    sstr << indent << "[" << i << "] sample_count: " << get_sample_count(i)
+         << ", sample_delta: " << get_sample_delta(i) << "\n";
+  }
+
+  return sstr.str();
+}
+
+
+int64_t Box_ctts::get_sample_offset(uint32_t entry) const
+{
+  uint32_t offset = m_entries.get32(entry, 4);
+
+  if (get_version() == 1) {
+    return static_cast<int32_t>(offset);
+  }
+  else {
+    return offset;
+  }
+}
+
+
+Error Box_ctts::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  uint32_t entry_count = range.read32();
+  return m_entries.read(range, entry_count, 8);
+}
+
+
+std::string Box_ctts::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "entries: " << get_num_entries() << "\n";
+  for (uint32_t i = 0; i < get_num_entries(); i++) {
+    sstr << indent << "[" << i << "] sample_count: " << get_sample_count(i)
+         << ", sample_offset: " << get_sample_offset(i) << "\n";
+  }
+
+  return sstr.str();
+}
+
+
+Error Box_stsc::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  uint32_t entry_count = range.read32();
+  return m_entries.read(range, entry_count, 12);
+}
+
+
+std::string Box_stsc::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "entries: " << get_num_entries() << "\n";
+  for (uint32_t i = 0; i < get_num_entries(); i++) {
+    sstr << indent << "[" << i << "] first_chunk: " << get_first_chunk(i)
+         << ", samples_per_chunk: " << get_samples_per_chunk(i)
+         << ", sample_description_index: " << get_sample_description_index(i) << "\n";
+  }
+
+  return sstr.str();
+}
+
+
+Error Box_stsz::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  m_fixed_sample_size = range.read32();
+  m_sample_count = range.read32();
+
+  if (m_fixed_sample_size == 0) {
+    return m_sizes.read(range, m_sample_count, 4);
+  }
+
+  return range.get_error();
+}
+
+
+std::string Box_stsz::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "sample_size: " << m_fixed_sample_size << "\n"
+       << indent << "sample_count: " << m_sample_count << "\n";
+
+  if (m_fixed_sample_size == 0) {
+    for (uint32_t i = 0; i < m_sample_count; i++) {
+      sstr << indent << "[" << i << "] " << get_sample_size(i) << "\n";
+    }
+  }
+
+  return sstr.str();
+}
+
+
+Error Box_stco::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  uint32_t entry_count = range.read32();
+  return m_offsets.read(range, entry_count, get_short_type() == fourcc("co64") ? 8 : 4);
+}
+
+
+std::string Box_stco::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "chunks: " << get_num_chunks() << "\n";
+  for (uint32_t i = 0; i < get_num_chunks(); i++) {
+    sstr << indent << "[" << i << "] " << get_chunk_offset(i) << "\n";
+  }
+
+  return sstr.str();
+}
+
+
+Error Box_stss::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  uint32_t entry_count = range.read32();
+  return m_sample_numbers.read(range, entry_count, 4);
+}
+
+
+std::string Box_stss::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << Box::dump(indent);
+  sstr << indent << "sync samples:";
+  for (uint32_t i = 0; i < get_num_entries(); i++) {
+    sstr << " " << get_sample_number(i);
+  }
+  sstr << "\n";
+
+  return sstr.str();
+}
+
+
+static Error invalid_track(const char* message)
+{
+  return Error(heif_error_Invalid_input,
+               heif_suberror_Unspecified,
+               message);
+}
+
+
+template<class BoxType>
+static std::shared_ptr<BoxType> get_typed_child(const std::shared_ptr<Box>& box, uint32_t type)
+{
+  return box ? std::dynamic_pointer_cast<BoxType>(box->get_child_box(type)) : nullptr;
+}
+
+
+Error Track::create(const std::shared_ptr<Box_trak>& trak, std::shared_ptr<Track>& out_track)
+{
+  auto track = std::make_shared<Track>();
+
+  auto tkhd = get_typed_child<Box_tkhd>(trak, fourcc("tkhd"));
+  auto mdia = get_typed_child<Box_mdia>(trak, fourcc("mdia"));
+  auto mdhd = get_typed_child<Box_mdhd>(mdia, fourcc("mdhd"));
+  auto hdlr = get_typed_child<Box_hdlr>(mdia, fourcc("hdlr"));
+  auto minf = get_typed_child<Box_minf>(mdia, fourcc("minf"));
+  auto stbl = get_typed_child<Box_stbl>(minf, fourcc("stbl"));
+  auto stsd = get_typed_child<Box_stsd>(stbl, fourcc("stsd"));
+
+  if (!tkhd || !mdhd || !hdlr || !stsd) {
+    return invalid_track("Track misses one of the boxes 'tkhd', 'mdhd', 'hdlr' or 'stsd'");
+  }
+
+  track->m_id = tkhd->get_track_id();
+  track->m_width = tkhd->get_width() >> 16;
+  track->m_height = tkhd->get_height() >> 16;
+  track->m_timescale = mdhd->get_timescale();
+  track->m_duration = mdhd->get_duration();
+  track->m_handler_type = hdlr->get_handler_type();
+
+  if (track->m_handler_type != fourcc("pict") &&
+      track->m_handler_type != fourcc("vide")) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_data_version,
+                 "Track is no image sequence or video track");
+  }
+
+  if (track->m_timescale == 0) {
+    return invalid_track("Track timescale is zero");
+  }
+
+
+  // --- sample description (only a single one is supported)
+
+  if (stsd->get_all_child_boxes().empty()) {
+    return invalid_track("Track has no sample description");
+  }
+
+  track->m_sample_entry = std::dynamic_pointer_cast<Box_VisualSampleEntry>(stsd->get_all_child_boxes()[0]);
+  if (!track->m_sample_entry) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_codec,
+                 "Unsupported sample entry type of track");
+  }
+
+  uint32_t sample_type = track->m_sample_entry->get_short_type();
+  if (sample_type == fourcc("hvc1") || sample_type == fourcc("hev1")) {
+    auto hvcC = get_typed_child<Box_hvcC>(track->m_sample_entry, fourcc("hvcC"));
+    if (!hvcC) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_hvcC_box);
+    }
+
+    track->m_compression = heif_compression_HEVC;
+    track->m_nal_length_size = hvcC->get_length_size();
+  }
+  else if (sample_type == fourcc("av01")) {
+    if (!track->m_sample_entry->get_child_box(fourcc("av1C"))) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_av1C_box);
+    }
+
+    track->m_compression = heif_compression_AV1;
+  }
+
+  if (track->m_width == 0 || track->m_height == 0) {
+    track->m_width = track->m_sample_entry->get_width();
+    track->m_height = track->m_sample_entry->get_height();
+  }
+
+
+  // --- sample table
+
+  track->m_stts = get_typed_child<Box_stts>(stbl, fourcc("stts"));
+  track->m_ctts = get_typed_child<Box_ctts>(stbl, fourcc("ctts"));
+  track->m_stsc = get_typed_child<Box_stsc>(stbl, fourcc("stsc"));
+  track->m_stsz = get_typed_child<Box_stsz>(stbl, fourcc("stsz"));
+  track->m_stss = get_typed_child<Box_stss>(stbl, fourcc("stss"));
+
+  track->m_stco = get_typed_child<Box_stco>(stbl, fourcc("stco"));
+  if (!track->m_stco) {
+    track->m_stco = get_typed_child<Box_stco>(stbl, fourcc("co64"));
+  }
+
+  if (!track->m_stts || !track->m_stsc || !track->m_stsz || !track->m_stco) {
+    return invalid_track("Track misses one of the sample table boxes 'stts', 'stsc', 'stsz' or 'stco'");
+  }
+
+  const Box_stsc& stsc = *track->m_stsc;
+  if (stsc.get_num_entries() == 0 && track->get_num_samples() > 0) {
+    return invalid_track("Empty 'stsc' box");
+  }
+
+  for (uint32_t i = 0; i < stsc.get_num_entries(); i++) {
+    if (stsc.get_samples_per_chunk(i) == 0) {
+      return invalid_track("Chunk without samples in 'stsc' box");
+    }
+
+    if (stsc.get_sample_description_index(i) != 1) {
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Unsupported_data_version,
+                   "Tracks with several sample descriptions are not supported");
+    }
+
+    if ((i == 0 && stsc.get_first_chunk(i) != 1) ||
+        (i > 0 && stsc.get_first_chunk(i) <= stsc.get_first_chunk(i - 1))) {
+      return invalid_track("Chunk numbers in 'stsc' box are not increasing");
+    }
+  }
+
+  out_track = std::move(track);
+  return Error::Ok;
+}
+
+
+Error Track::get_codec_headers(std::vector<uint8_t>* data) const
+{
+  if (m_compression == heif_compression_HEVC) {
+    auto hvcC = get_typed_child<Box_hvcC>(m_sample_entry, fourcc("hvcC"));
+    if (!hvcC || !hvcC->get_headers(data)) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_hvcC_box);
+    }
+  }
+  else if (m_compression == heif_compression_AV1) {
+    auto av1C = get_typed_child<Box_av1C>(m_sample_entry, fourcc("av1C"));
+    if (!av1C || !av1C->get_headers(data)) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_No_av1C_box);
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error Track::SampleCursor::get_sample(Sample& sample) const
+{
+  const Track& track = *m_track;
+
+  if (at_end()) {
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Unspecified,
+                 "No more samples in track");
+  }
+
+  if (m_chunk >= track.m_stco->get_num_chunks()) {
+    return invalid_track("Sample table references a non-existing chunk");
+  }
+
+  if (m_stts_entry >= track.m_stts->get_num_entries()) {
+    return invalid_track("Sample table has no decoding time for all samples");
+  }
+
+  sample.index = m_sample;
+  sample.offset = track.m_stco->get_chunk_offset(m_chunk) + m_offset_in_chunk;
+  sample.size = track.m_stsz->get_sample_size(m_sample);
+  sample.decoding_time = m_decoding_time;
+  sample.duration = track.m_stts->get_sample_delta(m_stts_entry);
+
+  sample.presentation_time = static_cast<int64_t>(m_decoding_time);
+  if (track.m_ctts && m_ctts_entry < track.m_ctts->get_num_entries()) {
+    sample.presentation_time += track.m_ctts->get_sample_offset(m_ctts_entry);
+  }
+
+  sample.is_sync = (!track.m_stss ||
+                    (m_stss_entry < track.m_stss->get_num_entries() &&
+                     track.m_stss->get_sample_number(m_stss_entry) == m_sample + 1));
+
+  return Error::Ok;
+}
+
+
+void Track::SampleCursor::advance()
+{
+  const Track& track = *m_track;
+
+  if (at_end()) {
+    return;
+  }
+
+  // --- position in the chunks
+
+  m_offset_in_chunk += track.m_stsz->get_sample_size(m_sample);
+  m_sample_in_chunk++;
+
+  const Box_stsc& stsc = *track.m_stsc;
+  if (m_sample_in_chunk >= stsc.get_samples_per_chunk(m_stsc_entry)) {
+    m_chunk++;
+    m_sample_in_chunk = 0;
+    m_offset_in_chunk = 0;
+
+    // 'first_chunk' is 1-based
+    if (m_stsc_entry + 1 < stsc.get_num_entries() &&
+        m_chunk + 1 >= stsc.get_first_chunk(m_stsc_entry + 1)) {
+      m_stsc_entry++;
+    }
+  }
+
+  // --- times
+
+  const Box_stts& stts = *track.m_stts;
+  if (m_stts_entry < stts.get_num_entries()) {
+    m_decoding_time += stts.get_sample_delta(m_stts_entry);
+
+    if (++m_stts_sample >= stts.get_sample_count(m_stts_entry)) {
+      m_stts_entry++;
+      m_stts_sample = 0;
+    }
+  }
+
+  if (track.m_ctts && m_ctts_entry < track.m_ctts->get_num_entries()) {
+    if (++m_ctts_sample >= track.m_ctts->get_sample_count(m_ctts_entry)) {
+      m_ctts_entry++;
+      m_ctts_sample = 0;
+    }
+  }
+
+  // --- sync samples
+
+  if (track.m_stss && m_stss_entry < track.m_stss->get_num_entries() &&
+      track.m_stss->get_sample_number(m_stss_entry) <= m_sample + 1) {
+    m_stss_entry++;
+  }
+
+  m_sample++;
+}
@@ -0,0 +1,506 @@
+/*
+ * HEIF codec.
+ * Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+ *
+ * This file is part of libheif.
+ *
+ * libheif is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libheif is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBHEIF_TRACK_H
+#define LIBHEIF_TRACK_H
+
+#include "box.h"
+#include "error.h"
+#include "libheif/heif.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// --- boxes of image sequence tracks (ISO/IEC 14496-12, ISO/IEC 23008-12 section 7)
+
+class Box_moov : public Box
+{
+public:
+  Box_moov()
+  {
+    set_short_type(fourcc("moov"));
+  }
+
+  std::string dump(Indent&) const override;
+
+protected:
+  Error parse(BitstreamRange& range) override;
+};
+
+
+class Box_mvhd : public FullBox
+{
+public:
+  Box_mvhd()
+  {
+    set_short_type(fourcc("mvhd"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  uint32_t get_timescale() const { return m_timescale; }
+
+  uint64_t get_duration() const { return m_duration; }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  uint32_t m_timescale = 0;
+  uint64_t m_duration = 0;
+};
+
+
+class Box_trak : public Box
+{
+public:
+  Box_trak()
+  {
+    set_short_type(fourcc("trak"));
+  }
+
+  std::string dump(Indent&) const override;
+
+protected:
+  Error parse(BitstreamRange& range) override;
+};
+
+
+class Box_tkhd : public FullBox
+{
+public:
+  Box_tkhd()
+  {
+    set_short_type(fourcc("tkhd"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  uint32_t get_track_id() const { return m_track_id; }
+
+  // the presentation size, in 16.16 fixed point
+  uint32_t get_width() const { return m_width; }
+
+  uint32_t get_height() const { return m_height; }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  uint32_t m_track_id = 0;
+  uint64_t m_duration = 0;
+  uint32_t m_width = 0;
+  uint32_t m_height = 0;
+};
+
+
+class Box_mdia : public Box
+{
+public:
+  Box_mdia()
+  {
+    set_short_type(fourcc("mdia"));
+  }
+
+  std::string dump(Indent&) const override;
+
+protected:
+  Error parse(BitstreamRange& range) override;
+};
+
+
+class Box_mdhd : public FullBox
+{
+public:
+  Box_mdhd()
+  {
+    set_short_type(fourcc("mdhd"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  uint32_t get_timescale() const { return m_timescale; }
+
+  uint64_t get_duration() const { return m_duration; }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  uint32_t m_timescale = 0;
+  uint64_t m_duration = 0;
+};
+
+
+class Box_minf : public Box
+{
+public:
+  Box_minf()
+  {
+    set_short_type(fourcc("minf"));
+  }
+
+  std::string dump(Indent&) const override;
+
+protected:
+  Error parse(BitstreamRange& range) override;
+};
+
+
+class Box_stbl : public Box
+{
+public:
+  Box_stbl()
+  {
+    set_short_type(fourcc("stbl"));
+  }
+
+  std::string dump(Indent&) const override;
+
+protected:
+  Error parse(BitstreamRange& range) override;
+};
+
+
+class Box_stsd : public FullBox
+{
+public:
+  Box_stsd()
+  {
+    set_short_type(fourcc("stsd"));
+  }
+
+  std::string dump(Indent&) const override;
+
+protected:
+  Error parse(BitstreamRange& range) override;
+};
+
+
+// A sample entry of a visual track ('hvc1', 'hev1', 'av01'). The codec configuration ('hvcC', 'av1C')
+// and the color profile ('colr') are its child boxes.
+class Box_VisualSampleEntry : public Box
+{
+public:
+  std::string dump(Indent&) const override;
+
+  uint16_t get_width() const { return m_width; }
+
+  uint16_t get_height() const { return m_height; }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  uint16_t m_data_reference_index = 0;
+  uint16_t m_width = 0;
+  uint16_t m_height = 0;
+  std::string m_compressor_name;
+  uint16_t m_depth = 0;
+};
+
+
+// A table of big-endian integers at the end of a sample table box.
+// When the input file is held in memory (e.g. when it is memory-mapped), the entries are read directly
+// from the file data. Otherwise, the table is copied as it is stored in the file. In both cases,
+// the table is not expanded into native integers, which would be larger for most tables.
+class PackedTable
+{
+public:
+  // The table has to be the remaining content of the box that is parsed from 'range'.
+  Error read(BitstreamRange& range, uint32_t num_entries, uint32_t entry_size);
+
+  uint32_t get_num_entries() const { return m_num_entries; }
+
+  uint32_t get32(uint32_t entry, uint32_t field_offset = 0) const;
+
+  uint64_t get64(uint32_t entry, uint32_t field_offset = 0) const;
+
+private:
+  const uint8_t* m_data = nullptr;
+  std::vector<uint8_t> m_copy;
+  uint32_t m_num_entries = 0;
+  uint32_t m_entry_size = 0;
+
+  // keeps the memory that 'm_data' points to alive
+  std::shared_ptr<StreamReader> m_stream;
+};
+
+
+// decoding time to sample
+class Box_stts : public FullBox
+{
+public:
+  Box_stts()
+  {
+    set_short_type(fourcc("stts"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  uint32_t get_num_entries() const { return m_entries.get_num_entries(); }
+
+  uint32_t get_sample_count(uint32_t entry) const { return m_entries.get32(entry, 0); }
+
+  uint32_t get_sample_delta(uint32_t entry) const { return m_entries.get32(entry, 4); }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  PackedTable m_entries;
+};
+
+
+// composition time to sample
+class Box_ctts : public FullBox
+{
+public:
+  Box_ctts()
+  {
+    set_short_type(fourcc("ctts"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  uint32_t get_num_entries() const { return m_entries.get_num_entries(); }
+
+  uint32_t get_sample_count(uint32_t entry) const { return m_entries.get32(entry, 0); }
+
+  int64_t get_sample_offset(uint32_t entry) const;
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  PackedTable m_entries;
+};
+
+
+// sample to chunk
+class Box_stsc : public FullBox
+{
+public:
+  Box_stsc()
+  {
+    set_short_type(fourcc("stsc"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  uint32_t get_num_entries() const { return m_entries.get_num_entries(); }
+
+  // 1-based chunk index
+  uint32_t get_first_chunk(uint32_t entry) const { return m_entries.get32(entry, 0); }
+
+  uint32_t get_samples_per_chunk(uint32_t entry) const { return m_entries.get32(entry, 4); }
+
+  uint32_t get_sample_description_index(uint32_t entry) const { return m_entries.get32(entry, 8); }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  PackedTable m_entries;
+};
+
+
+// sample sizes
+class Box_stsz : public FullBox
+{
+public:
+  Box_stsz()
+  {
+    set_short_type(fourcc("stsz"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  uint32_t get_sample_count() const { return m_sample_count; }
+
+  uint32_t get_sample_size(uint32_t sample) const
+  {
+    return m_fixed_sample_size ? m_fixed_sample_size : m_sizes.get32(sample);
+  }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  uint32_t m_fixed_sample_size = 0;
+  uint32_t m_sample_count = 0;
+  PackedTable m_sizes; // only when the samples have different sizes
+};
+
+
+// chunk offsets, 'stco' with 32 bit offsets or 'co64' with 64 bit offsets
+class Box_stco : public FullBox
+{
+public:
+  std::string dump(Indent&) const override;
+
+  uint32_t get_num_chunks() const { return m_offsets.get_num_entries(); }
+
+  uint64_t get_chunk_offset(uint32_t chunk) const
+  {
+    return get_short_type() == fourcc("co64") ? m_offsets.get64(chunk) : m_offsets.get32(chunk);
+  }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  PackedTable m_offsets;
+};
+
+
+// sync samples
+class Box_stss : public FullBox
+{
+public:
+  Box_stss()
+  {
+    set_short_type(fourcc("stss"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  uint32_t get_num_entries() const { return m_sample_numbers.get_num_entries(); }
+
+  // 1-based sample number, in increasing order
+  uint32_t get_sample_number(uint32_t entry) const { return m_sample_numbers.get32(entry); }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+private:
+  PackedTable m_sample_numbers;
+};
+
+
+// --- track access
+
+// A visual track of an image sequence ('pict' handler) or a video ('vide' handler).
+// The position, size and timing of the samples are looked up in the sample table boxes
+// while the samples are iterated. The sample table is not expanded into a per-sample index.
+class Track
+{
+public:
+  // Returns an error if the track is no visual track or its sample table is invalid.
+  static Error create(const std::shared_ptr<Box_trak>& trak, std::shared_ptr<Track>& out_track);
+
+  uint32_t get_id() const { return m_id; }
+
+  uint32_t get_handler_type() const { return m_handler_type; }
+
+  uint32_t get_width() const { return m_width; }
+
+  uint32_t get_height() const { return m_height; }
+
+  // ticks per second of the sample times
+  uint32_t get_timescale() const { return m_timescale; }
+
+  // in timescale units
+  uint64_t get_duration() const { return m_duration; }
+
+  uint32_t get_num_samples() const { return m_stsz->get_sample_count(); }
+
+  heif_compression_format get_compression_format() const { return m_compression; }
+
+  std::shared_ptr<const Box_VisualSampleEntry> get_sample_entry() const { return m_sample_entry; }
+
+  // The codec configuration headers in front of the first sample, in the same format as for images.
+  Error get_codec_headers(std::vector<uint8_t>* data) const;
+
+  // Number of bytes of the NAL unit sizes in the HEVC samples (4 for AV1, which has no NAL units).
+  int get_nal_length_size() const { return m_nal_length_size; }
+
+  bool has_only_sync_samples() const { return !m_stss || m_stss->get_num_entries() == get_num_samples(); }
+
+  struct Sample
+  {
+    uint32_t index; // in decoding order
+    uint64_t offset; // in the file
+    uint32_t size;
+    uint64_t decoding_time;
+    int64_t presentation_time;
+    uint32_t duration;
+    bool is_sync;
+  };
+
+  // Iterates over the samples in decoding order. Advancing to the next sample takes constant time.
+  class SampleCursor
+  {
+  public:
+    explicit SampleCursor(const Track& track) : m_track(&track) {}
+
+    bool at_end() const { return m_sample >= m_track->get_num_samples(); }
+
+    // Fails on inconsistent sample tables, e.g. when a chunk does not exist.
+    Error get_sample(Sample& sample) const;
+
+    void advance();
+
+  private:
+    const Track* m_track;
+
+    uint32_t m_sample = 0;
+
+    uint32_t m_chunk = 0; // 0-based
+    uint32_t m_sample_in_chunk = 0;
+    uint64_t m_offset_in_chunk = 0;
+    uint32_t m_stsc_entry = 0;
+
+    uint32_t m_stts_entry = 0;
+    uint32_t m_stts_sample = 0; // within the stts entry
+    uint64_t m_decoding_time = 0;
+
+    uint32_t m_ctts_entry = 0;
+    uint32_t m_ctts_sample = 0;
+
+    uint32_t m_stss_entry = 0;
+  };
+
+  SampleCursor get_samples() const { return SampleCursor(*this); }
+
+private:
+  uint32_t m_id = 0;
+  uint32_t m_handler_type = 0;
+  uint32_t m_width = 0;
+  uint32_t m_height = 0;
+  uint32_t m_timescale = 0;
+  uint64_t m_duration = 0;
+  heif_compression_format m_compression = heif_compression_undefined;
+  int m_nal_length_size = 4;
+
+  std::shared_ptr<Box_VisualSampleEntry> m_sample_entry;
+
+  std::shared_ptr<Box_stts> m_stts;
+  std::shared_ptr<Box_ctts> m_ctts; // nullptr: presentation time is the decoding time
+  std::shared_ptr<Box_stsc> m_stsc;
+  std::shared_ptr<Box_stsz> m_stsz;
+  std::shared_ptr<Box_stco> m_stco;
+  std::shared_ptr<Box_stss> m_stss; // nullptr: all samples are sync samples
+};
+
+#endif
@@ -24,8 +24,21 @@
 #include <algorithm>
 #include <map>
 #include <iostream>
+#include <cassert>
 
 #include "uncompressed_image.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+#include "metadata_compression.h"
+#include "libheif/plugins/encoder_uncompressed.h"
+
+#if HEIF_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if HEIF_HAVE_NEON
+#include <arm_neon.h>
+#endif
 
 
 enum heif_component_type
@@ -205,42 +218,297 @@ Error Box_uncC::write(StreamWriter& writer) const
   size_t box_start = reserve_box_header_space(writer);
 
   writer.write32(m_profile);
-  // TODO: this is not complete
+
+  writer.write16((uint16_t) m_components.size());
+  for (const auto& component : m_components) {
+    writer.write16(component.component_index);
+    writer.write8(component.component_bit_depth_minus_one);
+    writer.write8(component.component_format);
+    writer.write8(component.component_align_size);
+  }
+
+  writer.write8(m_sampling_type);
+  writer.write8(m_interleave_type);
+  writer.write8(m_block_size);
+
+  uint8_t flags = 0;
+  flags |= (m_components_little_endian ? 0x80 : 0);
+  flags |= (m_block_pad_lsb ? 0x40 : 0);
+  flags |= (m_block_little_endian ? 0x20 : 0);
+  flags |= (m_block_reversed ? 0x10 : 0);
+  flags |= (m_pad_unknown ? 0x08 : 0);
+  writer.write8(flags);
+
+  writer.write8(m_pixel_size);
+  writer.write32(m_row_align_size);
+  writer.write32(m_tile_align_size);
+  writer.write32(m_num_tile_cols_minus_one);
+  writer.write32(m_num_tile_rows_minus_one);
+
+  prepend_header(writer, box_start);
+
+  return Error::Ok;
+}
+
+
+Error Box_cmpC::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  if (get_version() != 0) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_data_version,
+                 "Unsupported 'cmpC' box version");
+  }
+
+  m_compression_type = range.read32();
+  m_compressed_unit_type = range.read8();
+
+  return range.get_error();
+}
+
+
+std::string Box_cmpC::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << FullBox::dump(indent);
+
+  sstr << indent << "compression_type: " << to_fourcc(m_compression_type) << "\n";
+  sstr << indent << "compressed_unit_type: " << (int) m_compressed_unit_type << "\n";
+
+  return sstr.str();
+}
+
+
+Error Box_cmpC::write(StreamWriter& writer) const
+{
+  size_t box_start = reserve_box_header_space(writer);
+
+  writer.write32(m_compression_type);
+  writer.write8(m_compressed_unit_type);
+
+  prepend_header(writer, box_start);
+
+  return Error::Ok;
+}
+
+
+// number of bits of the unit offsets and sizes, indexed by unit_offset_code / unit_size_code
+static const int icef_unit_offset_bits[] = {0, 16, 24, 32, 64};
+static const int icef_unit_size_bits[] = {8, 16, 24, 32, 64};
+
+
+static uint64_t read_icef_value(BitstreamRange& range, int bits)
+{
+  switch (bits) {
+    case 8:
+      return range.read8();
+    case 16:
+      return range.read16();
+    case 24:
+      return ((uint64_t) range.read16() << 8) | range.read8();
+    case 32:
+      return range.read32();
+    default: {
+      assert(bits == 64);
+      uint64_t high = range.read32();
+      return (high << 32) | range.read32();
+    }
+  }
+}
+
+
+static void write_icef_value(StreamWriter& writer, int bits, uint64_t value)
+{
+  switch (bits) {
+    case 8:
+      writer.write8((uint8_t) value);
+      break;
+    case 16:
+      writer.write16((uint16_t) value);
+      break;
+    case 24:
+      writer.write16((uint16_t) (value >> 8));
+      writer.write8((uint8_t) (value & 0xFF));
+      break;
+    case 32:
+      writer.write32((uint32_t) value);
+      break;
+    default:
+      assert(bits == 64);
+      writer.write64(value);
+      break;
+  }
+}
+
+
+// Smallest code whose field can hold 'value'.
+static uint8_t get_icef_code(const int* bits_table, uint8_t first_code, uint64_t value)
+{
+  uint8_t code = first_code;
+  while (bits_table[code] < 64 && (value >> bits_table[code]) != 0) {
+    code++;
+  }
+
+  return code;
+}
+
+
+Error Box_icef::parse(BitstreamRange& range)
+{
+  parse_full_box_header(range);
+
+  if (get_version() != 0) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_data_version,
+                 "Unsupported 'icef' box version");
+  }
+
+  uint8_t codes = range.read8();
+  uint8_t unit_offset_code = (codes >> 5) & 0x07;
+  uint8_t unit_size_code = (codes >> 2) & 0x07;
+
+  if (unit_offset_code > 4 || unit_size_code > 4) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Unspecified,
+                 "Invalid unit offset or size code in 'icef' box");
+  }
+
+  uint32_t num_compressed_units = range.read32();
+  uint64_t implied_offset = 0;
+
+  for (uint32_t i = 0; i < num_compressed_units && !range.error() && !range.eof(); i++) {
+    CompressedUnit unit;
+
+    if (unit_offset_code == 0) {
+      unit.unit_offset = implied_offset;
+    }
+    else {
+      unit.unit_offset = read_icef_value(range, icef_unit_offset_bits[unit_offset_code]);
+    }
+
+    unit.unit_size = read_icef_value(range, icef_unit_size_bits[unit_size_code]);
+
+    implied_offset = unit.unit_offset + unit.unit_size;
+    m_units.push_back(unit);
+  }
+
+  return range.get_error();
+}
+
+
+std::string Box_icef::dump(Indent& indent) const
+{
+  std::ostringstream sstr;
+  sstr << FullBox::dump(indent);
+
+  sstr << indent << "num_compressed_units: " << m_units.size() << "\n";
+  for (const auto& unit : m_units) {
+    sstr << indent << "unit_offset: " << unit.unit_offset << ", unit_size: " << unit.unit_size << "\n";
+  }
+
+  return sstr.str();
+}
+
+
+Error Box_icef::write(StreamWriter& writer) const
+{
+  size_t box_start = reserve_box_header_space(writer);
+
+  // Offsets are only written when the units are not stored consecutively from the start of the item.
+  bool consecutive = true;
+  uint64_t max_offset = 0;
+  uint64_t max_size = 0;
+  uint64_t implied_offset = 0;
+
+  for (const auto& unit : m_units) {
+    consecutive = consecutive && (unit.unit_offset == implied_offset);
+    implied_offset = unit.unit_offset + unit.unit_size;
+
+    max_offset = std::max(max_offset, unit.unit_offset);
+    max_size = std::max(max_size, unit.unit_size);
+  }
+
+  uint8_t unit_offset_code = consecutive ? 0 : get_icef_code(icef_unit_offset_bits, 1, max_offset);
+  uint8_t unit_size_code = get_icef_code(icef_unit_size_bits, 0, max_size);
+
+  writer.write8((uint8_t) ((unit_offset_code << 5) | (unit_size_code << 2)));
+  writer.write32((uint32_t) m_units.size());
+
+  for (const auto& unit : m_units) {
+    if (unit_offset_code != 0) {
+      write_icef_value(writer, icef_unit_offset_bits[unit_offset_code], unit.unit_offset);
+    }
+
+    write_icef_value(writer, icef_unit_size_bits[unit_size_code], unit.unit_size);
+  }
+
   prepend_header(writer, box_start);
 
   return Error::Ok;
 }
 
 
+// Number of bytes in which each sample of the component is stored.
+// Returns 0 for samples that are not byte aligned. These are not supported yet.
+static int get_bytes_per_sample(const Box_uncC::Component& component)
+{
+  int bit_depth = component.component_bit_depth_minus_one + 1;
+
+  if (component.component_align_size != 0) {
+    return component.component_align_size;
+  }
+  else if (bit_depth % 8 == 0) {
+    return bit_depth / 8;
+  }
+  else {
+    return 0;
+  }
+}
+
+
 static Error uncompressed_image_type_is_supported(std::shared_ptr<Box_uncC>& uncC, std::shared_ptr<Box_cmpd>& cmpd)
 {
+  if (uncC->get_components().empty()) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Unspecified,
+                 "Uncompressed image without components");
+  }
+
   for (Box_uncC::Component component : uncC->get_components()) {
     uint16_t component_index = component.component_index;
+    if (component_index >= cmpd->get_components().size()) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Unspecified,
+                   "Uncompressed image component index out of range");
+    }
     uint16_t component_type = cmpd->get_components()[component_index].component_type;
-    if ((component_type == 0) || (component_type > 7)) {
+    if (component_type > 7) {
       std::stringstream sstr;
       sstr << "Uncompressed image with component_type " << ((int) component_type) << " is not implemented yet";
       return Error(heif_error_Unsupported_feature,
                    heif_suberror_Unsupported_data_version,
                    sstr.str());
     }
-    if (component.component_bit_depth_minus_one + 1 != 8) {
+    int bit_depth = component.component_bit_depth_minus_one + 1;
+    int bytes_per_sample = get_bytes_per_sample(component);
+    if (!((bytes_per_sample == 1 && bit_depth == 8) ||
+          (bytes_per_sample == 2 && bit_depth > 8 && bit_depth <= 16))) {
       std::stringstream sstr;
-      sstr << "Uncompressed image with component_bit_depth_minus_one " << ((int) component.component_bit_depth_minus_one) << " is not implemented yet";
+      sstr << "Uncompressed image with component_bit_depth_minus_one " << ((int) component.component_bit_depth_minus_one)
+           << " and component_align_size " << ((int) component.component_align_size) << " is not implemented yet";
       return Error(heif_error_Unsupported_feature,
                    heif_suberror_Unsupported_data_version,
                    sstr.str());
     }
-    if (component.component_format != 0) {
-      std::stringstream sstr;
-      sstr << "Uncompressed image with component_format " << ((int) component.component_format) << " is not implemented yet";
+    if (bytes_per_sample != get_bytes_per_sample(uncC->get_components()[0])) {
       return Error(heif_error_Unsupported_feature,
                    heif_suberror_Unsupported_data_version,
-                   sstr.str());
+                   "Uncompressed image with components of different sample sizes is not implemented yet");
     }
-    if (component.component_align_size != 0) {
+    if (component.component_format != 0) {
       std::stringstream sstr;
-      sstr << "Uncompressed image with component_align_size " << ((int) component.component_align_size) << " is not implemented yet";
+      sstr << "Uncompressed image with component_format " << ((int) component.component_format) << " is not implemented yet";
       return Error(heif_error_Unsupported_feature,
                    heif_suberror_Unsupported_data_version,
                    sstr.str());
@@ -270,11 +538,6 @@ static Error uncompressed_image_type_is_supported(std::shared_ptr<Box_uncC>& unc
                  heif_suberror_Unsupported_data_version,
                  sstr.str());
   }
-  if (uncC->is_components_little_endian()) {
-    return Error(heif_error_Unsupported_feature,
-                 heif_suberror_Unsupported_data_version,
-                 "Uncompressed components_little_endian == 1 is not implemented yet");
-  }
   if (uncC->is_block_pad_lsb()) {
     return Error(heif_error_Unsupported_feature,
                  heif_suberror_Unsupported_data_version,
@@ -323,18 +586,22 @@ static Error get_heif_chroma_uncompressed(std::shared_ptr<Box_uncC>& uncC, std::
     componentSet |= (1 << component_type);
   }
 
-  if (componentSet == ((1 << heif_component_type_red) | (1 << heif_component_type_green) | (1 << heif_component_type_blue)) ||
-      componentSet == ((1 << heif_component_type_red) | (1 << heif_component_type_green) | (1 << heif_component_type_blue) | (1 << heif_component_type_alpha))) {
+  // alpha is stored in an additional plane of any colourspace
+  componentSet &= ~(1 << heif_component_type_alpha);
+
+  if (componentSet == ((1 << heif_component_type_red) | (1 << heif_component_type_green) | (1 << heif_component_type_blue))) {
     *out_chroma = heif_chroma_444;
     *out_colourspace = heif_colorspace_RGB;
   }
 
   if (componentSet == ((1 << heif_component_type_Y) | (1 << heif_component_type_Cb) | (1 << heif_component_type_Cr))) {
-    if (uncC->get_interleave_type() == 0) {
-      // Planar YCbCr
-      *out_chroma = heif_chroma_444;
-      *out_colourspace = heif_colorspace_YCbCr;
-    }
+    *out_chroma = heif_chroma_444;
+    *out_colourspace = heif_colorspace_YCbCr;
+  }
+
+  if (componentSet == (1 << heif_component_type_monochrome)) {
+    *out_chroma = heif_chroma_monochrome;
+    *out_colourspace = heif_colorspace_monochrome;
   }
 
   // TODO: more combinations
@@ -398,307 +665,1205 @@ int UncompressedImageCodec::get_luma_bits_per_pixel_from_configuration_unci(cons
 }
 
 
-static long unsigned int get_tile_base_offset(uint32_t col, uint32_t row, const std::shared_ptr<Box_uncC>& uncC, const std::vector<heif_channel>& channels, uint32_t width, uint32_t height)
+// --- deinterleaving of pixel-interleaved data
+
+// The SIMD kernels deinterleave the first pixels of a row and return the number of pixels processed.
+// The remaining pixels have to be copied by the caller.
+typedef uint32_t (* deinterleave_kernel_8bit)(const uint8_t* src, uint8_t* const* dst, uint32_t width);
+
+struct Deinterleave_kernels
 {
-  uint32_t numTileColumns = uncC->get_number_of_tile_columns();
-  uint32_t numTileRows = uncC->get_number_of_tile_rows();
-  uint32_t tile_width = width / numTileColumns;
-  uint32_t tile_height = height / numTileRows;
-  // TODO: assumes 8 bits per channel
-  long unsigned int content_bytes_per_tile = tile_width * tile_height * channels.size();
-  uint32_t tile_align_size = uncC->get_tile_align_size();
-  long unsigned int tile_padding = 0;
-  if (tile_align_size > 0) {
-    tile_padding = tile_align_size - (content_bytes_per_tile % tile_align_size);
+  deinterleave_kernel_8bit deinterleave_3_components = nullptr;
+  deinterleave_kernel_8bit deinterleave_4_components = nullptr;
+};
+
+
+#if HEIF_HAVE_X86_SIMD
+
+HEIF_TARGET_SSE41
+static uint32_t deinterleave_3_components_8bit_sse41(const uint8_t* src, uint8_t* const* dst, uint32_t width)
+{
+  // Gather the samples of each component from the three input vectors of 16 pixels.
+  const __m128i r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+  const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+  const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+  const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+  const __m128i b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+  const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+  uint32_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i v0 = _mm_loadu_si128((const __m128i*) (src + 3 * x));
+    __m128i v1 = _mm_loadu_si128((const __m128i*) (src + 3 * x + 16));
+    __m128i v2 = _mm_loadu_si128((const __m128i*) (src + 3 * x + 32));
+
+    __m128i c0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, r0), _mm_shuffle_epi8(v1, r1)), _mm_shuffle_epi8(v2, r2));
+    __m128i c1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, g0), _mm_shuffle_epi8(v1, g1)), _mm_shuffle_epi8(v2, g2));
+    __m128i c2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, b0), _mm_shuffle_epi8(v1, b1)), _mm_shuffle_epi8(v2, b2));
+
+    _mm_storeu_si128((__m128i*) (dst[0] + x), c0);
+    _mm_storeu_si128((__m128i*) (dst[1] + x), c1);
+    _mm_storeu_si128((__m128i*) (dst[2] + x), c2);
   }
-  long unsigned int bytes_per_tile = content_bytes_per_tile + tile_padding;
-  uint32_t tile_idx_y = row / tile_height;
-  uint32_t tile_idx_x = col / tile_width;
-  uint32_t tile_idx = tile_idx_y * numTileColumns + tile_idx_x;
-  long unsigned int tile_base_offset = tile_idx * bytes_per_tile;
-  return tile_base_offset;
+
+  return x;
 }
 
 
-Error UncompressedImageCodec::decode_uncompressed_image(const std::shared_ptr<const HeifFile>& heif_file,
-                                                        heif_item_id ID,
-                                                        std::shared_ptr<HeifPixelImage>& img,
-                                                        uint32_t maximum_image_width_limit,
-                                                        uint32_t maximum_image_height_limit,
-                                                        const std::vector<uint8_t>& uncompressed_data)
+HEIF_TARGET_SSE41
+static uint32_t deinterleave_4_components_8bit_sse41(const uint8_t* src, uint8_t* const* dst, uint32_t width)
 {
-  // Get the properties for this item
-  // We need: ispe, cmpd, uncC
-  std::vector<std::shared_ptr<Box>> item_properties;
-  Error error = heif_file->get_properties(ID, item_properties);
-  if (error) {
-    return error;
+  // Sort each group of 4 pixels by component, then transpose the 32-bit groups.
+  const __m128i sort = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+  uint32_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i s0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + 4 * x)), sort);
+    __m128i s1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + 4 * x + 16)), sort);
+    __m128i s2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + 4 * x + 32)), sort);
+    __m128i s3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + 4 * x + 48)), sort);
+
+    __m128i t0 = _mm_unpacklo_epi32(s0, s1);
+    __m128i t1 = _mm_unpackhi_epi32(s0, s1);
+    __m128i t2 = _mm_unpacklo_epi32(s2, s3);
+    __m128i t3 = _mm_unpackhi_epi32(s2, s3);
+
+    _mm_storeu_si128((__m128i*) (dst[0] + x), _mm_unpacklo_epi64(t0, t2));
+    _mm_storeu_si128((__m128i*) (dst[1] + x), _mm_unpackhi_epi64(t0, t2));
+    _mm_storeu_si128((__m128i*) (dst[2] + x), _mm_unpacklo_epi64(t1, t3));
+    _mm_storeu_si128((__m128i*) (dst[3] + x), _mm_unpackhi_epi64(t1, t3));
   }
-  uint32_t width = 0;
-  uint32_t height = 0;
-  bool found_ispe = false;
-  std::shared_ptr<Box_cmpd> cmpd;
-  std::shared_ptr<Box_uncC> uncC;
-  for (const auto& prop : item_properties) {
-    auto ispe = std::dynamic_pointer_cast<Box_ispe>(prop);
-    if (ispe) {
-      width = ispe->get_width();
-      height = ispe->get_height();
 
-      if (width >= maximum_image_width_limit || height >= maximum_image_height_limit) {
-        std::stringstream sstr;
-        sstr << "Image size " << width << "x" << height << " exceeds the maximum image size "
-             << maximum_image_width_limit << "x" << maximum_image_height_limit << "\n";
+  return x;
+}
 
-        return Error(heif_error_Memory_allocation_error,
-                     heif_suberror_Security_limit_exceeded,
-                     sstr.str());
-      }
-      found_ispe = true;
-    }
+#endif
 
-    auto maybe_cmpd = std::dynamic_pointer_cast<Box_cmpd>(prop);
-    if (maybe_cmpd) {
-      cmpd = maybe_cmpd;
-    }
 
-    auto maybe_uncC = std::dynamic_pointer_cast<Box_uncC>(prop);
-    if (maybe_uncC) {
-      uncC = maybe_uncC;
-    }
+#if HEIF_HAVE_NEON
+
+static uint32_t deinterleave_3_components_8bit_neon(const uint8_t* src, uint8_t* const* dst, uint32_t width)
+{
+  uint32_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x3_t v = vld3q_u8(src + 3 * x);
+    vst1q_u8(dst[0] + x, v.val[0]);
+    vst1q_u8(dst[1] + x, v.val[1]);
+    vst1q_u8(dst[2] + x, v.val[2]);
   }
 
+  return x;
+}
 
-  // if we miss a required box, show error
 
-  if (!found_ispe || !cmpd || !uncC) {
-    return Error(heif_error_Unsupported_feature,
-                 heif_suberror_Unsupported_data_version,
-                 "Missing required box for uncompressed codec");
+static uint32_t deinterleave_4_components_8bit_neon(const uint8_t* src, uint8_t* const* dst, uint32_t width)
+{
+  uint32_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x4_t v = vld4q_u8(src + 4 * x);
+    vst1q_u8(dst[0] + x, v.val[0]);
+    vst1q_u8(dst[1] + x, v.val[1]);
+    vst1q_u8(dst[2] + x, v.val[2]);
+    vst1q_u8(dst[3] + x, v.val[3]);
   }
 
+  return x;
+}
 
-  // check if we support the type of image
+#endif
 
-  error = uncompressed_image_type_is_supported(uncC, cmpd);
-  if (error) {
-    return error;
+
+static Deinterleave_kernels select_deinterleave_kernels()
+{
+  const CPUFeatures& cpu = get_cpu_features();
+
+  Deinterleave_kernels kernels;
+
+#if HEIF_HAVE_X86_SIMD
+  if (cpu.sse41) {
+    kernels.deinterleave_3_components = deinterleave_3_components_8bit_sse41;
+    kernels.deinterleave_4_components = deinterleave_4_components_8bit_sse41;
   }
+#endif
 
-  img = std::make_shared<HeifPixelImage>();
-  heif_chroma chroma;
-  heif_colorspace colourspace;
-  error = get_heif_chroma_uncompressed(uncC, cmpd, &chroma, &colourspace);
-  if (error) {
-    return error;
+#if HEIF_HAVE_NEON
+  if (cpu.neon) {
+    kernels.deinterleave_3_components = deinterleave_3_components_8bit_neon;
+    kernels.deinterleave_4_components = deinterleave_4_components_8bit_neon;
   }
-  img->create(width, height,
-              colourspace,
-              chroma);
+#endif
 
-  std::vector<heif_channel> channels;
-  std::map<heif_channel, uint32_t> channel_to_pixelOffset;
+  (void) cpu;
 
-  uint32_t componentOffset = 0;
-  for (Box_uncC::Component component : uncC->get_components()) {
-    uint16_t component_index = component.component_index;
-    uint16_t component_type = cmpd->get_components()[component_index].component_type;
-    if (component_type == heif_component_type_Y) {
-      img->add_plane(heif_channel_Y, width, height, component.component_bit_depth_minus_one + 1);
-      channels.push_back(heif_channel_Y);
-      channel_to_pixelOffset.emplace(heif_channel_Y, componentOffset);
-    }
-    else if (component_type == heif_component_type_Cb) {
-      img->add_plane(heif_channel_Cb, width, height, component.component_bit_depth_minus_one + 1);
-      channels.push_back(heif_channel_Cb);
-      channel_to_pixelOffset.emplace(heif_channel_Cb, componentOffset);
-    }
-    else if (component_type == heif_component_type_Cr) {
-      img->add_plane(heif_channel_Cr, width, height, component.component_bit_depth_minus_one + 1);
-      channels.push_back(heif_channel_Cr);
-      channel_to_pixelOffset.emplace(heif_channel_Cr, componentOffset);
-    }
-    else if (component_type == heif_component_type_red) {
-      img->add_plane(heif_channel_R, width, height, component.component_bit_depth_minus_one + 1);
-      channels.push_back(heif_channel_R);
-      channel_to_pixelOffset.emplace(heif_channel_R, componentOffset);
-    }
-    else if (component_type == heif_component_type_green) {
-      img->add_plane(heif_channel_G, width, height, component.component_bit_depth_minus_one + 1);
-      channels.push_back(heif_channel_G);
-      channel_to_pixelOffset.emplace(heif_channel_G, componentOffset);
+  return kernels;
+}
+
+
+static const Deinterleave_kernels& get_deinterleave_kernels()
+{
+  static const Deinterleave_kernels kernels = select_deinterleave_kernels();
+  return kernels;
+}
+
+
+static inline uint16_t read_sample_16bit(const uint8_t* p, bool little_endian)
+{
+  if (little_endian) {
+    return (uint16_t) (p[0] | (p[1] << 8));
+  }
+  else {
+    return (uint16_t) ((p[0] << 8) | p[1]);
+  }
+}
+
+
+void deinterleave_row(const uint8_t* src, uint8_t* const* dst, uint32_t num_components, uint32_t width,
+                      int bytes_per_sample, bool little_endian)
+{
+  if (bytes_per_sample == 1) {
+    if (num_components == 1) {
+      memcpy(dst[0], src, width);
+      return;
     }
-    else if (component_type == heif_component_type_blue) {
-      img->add_plane(heif_channel_B, width, height, component.component_bit_depth_minus_one + 1);
-      channels.push_back(heif_channel_B);
-      channel_to_pixelOffset.emplace(heif_channel_B, componentOffset);
+
+    const Deinterleave_kernels& kernels = get_deinterleave_kernels();
+
+    uint32_t x = 0;
+    if (num_components == 3 && kernels.deinterleave_3_components) {
+      x = kernels.deinterleave_3_components(src, dst, width);
     }
-    else if (component_type == heif_component_type_alpha) {
-      img->add_plane(heif_channel_Alpha, width, height, component.component_bit_depth_minus_one + 1);
-      channels.push_back(heif_channel_Alpha);
-      channel_to_pixelOffset.emplace(heif_channel_Alpha, componentOffset);
+    else if (num_components == 4 && kernels.deinterleave_4_components) {
+      x = kernels.deinterleave_4_components(src, dst, width);
     }
 
-    // TODO: other component types
-    componentOffset++;
-  }
-
-  // TODO: properly interpret uncompressed_data per uncC config, subsampling etc.
-  uint32_t bytes_per_channel = width * height;
-  uint32_t numTileColumns = uncC->get_number_of_tile_columns();
-  uint32_t numTileRows = uncC->get_number_of_tile_rows();
-  uint32_t tile_width = width / numTileColumns;
-  uint32_t tile_height = height / numTileRows;
-  if (uncC->get_interleave_type() == heif_uncompressed_interleave_type_component) {
-    // Source is planar
-    // TODO: assumes 8 bits
-    long unsigned int content_bytes_per_tile = tile_width * tile_height * channels.size();
-    uint32_t tile_align_size = uncC->get_tile_align_size();
-    long unsigned int tile_padding = 0;
-    if (tile_align_size > 0) {
-      tile_padding = tile_align_size - (content_bytes_per_tile % tile_align_size);
-    };
-    long unsigned int bytes_per_tile = content_bytes_per_tile + tile_padding;
-    for (uint32_t c = 0; c < channels.size(); c++) {
-      int stride;
-      uint8_t* dst = img->get_plane(channels[c], &stride);
-      if ((numTileRows == 1) && (numTileColumns == 1) && (((uint32_t) stride) == width)) {
-        memcpy(dst, uncompressed_data.data() + c * bytes_per_channel, bytes_per_channel);
-      }
-      else {
-        int pixel_offset = channel_to_pixelOffset[channels[c]];
-        for (uint32_t row = 0; row < height; row++) {
-          for (uint32_t col = 0; col < width; col += tile_width) {
-            uint32_t tile_idx_y = row / tile_height;
-            uint32_t tile_idx_x = col / tile_width;
-            uint32_t tile_idx = tile_idx_y * numTileColumns + tile_idx_x;
-            long unsigned int tile_base_offset = tile_idx * bytes_per_tile;
-            long unsigned int src_offset = tile_base_offset + pixel_offset * tile_width * tile_height;
-            long unsigned int dst_offset = row * stride + col;
-            memcpy(dst + dst_offset, uncompressed_data.data() + src_offset, tile_width);
-          }
-        }
+    for (uint32_t c = 0; c < num_components; c++) {
+      uint8_t* out = dst[c];
+      for (uint32_t i = x; i < width; i++) {
+        out[i] = src[i * num_components + c];
       }
     }
   }
-  else if (uncC->get_interleave_type() == heif_uncompressed_interleave_type_pixel) {
-    // TODO: we need to be smarter about block size, etc
-
-    // TODO: we can only do this if we are 8 bits
-    long unsigned int pixel_stride = channel_to_pixelOffset.size();
-    const uint8_t* src = uncompressed_data.data();
-    for (uint32_t c = 0; c < channels.size(); c++) {
-      int pixel_offset = channel_to_pixelOffset[channels[c]];
-      int stride;
-      uint8_t* dst = img->get_plane(channels[c], &stride);
-      for (uint32_t row = 0; row < height; row++) {
-        long unsigned int tile_row_idx = row % tile_height;
-        long unsigned int tile_row_offset = tile_width * tile_row_idx * channels.size();
-        uint32_t col = 0;
-        for (col = 0; col < width; col++) {
-          long unsigned int tile_base_offset = get_tile_base_offset(col, row, uncC, channels, width, height);
-          long unsigned int tile_col = col % tile_width;
-          long unsigned int tile_offset = tile_row_offset + tile_col * pixel_stride + pixel_offset;
-          long unsigned int src_offset = tile_base_offset + tile_offset;
-          uint32_t dstPixelIndex = row * stride + col;
-          dst[dstPixelIndex] = src[src_offset];
-        }
-        for (; col < (uint32_t) stride; col++) {
-          uint32_t dstPixelIndex = row * stride + col;
-          dst[dstPixelIndex] = 0;
-        }
+  else {
+    for (uint32_t c = 0; c < num_components; c++) {
+      auto* out = (uint16_t*) dst[c];
+      const uint8_t* in = src + 2 * c;
+      for (uint32_t i = 0; i < width; i++) {
+        out[i] = read_sample_16bit(in + 2 * i * num_components, little_endian);
       }
     }
   }
-  else if (uncC->get_interleave_type() == heif_uncompressed_interleave_type_row) {
-    // TODO: we need to be smarter about block size, etc
-
-    // TODO: we can only do this if we are 8 bits
-    for (uint32_t c = 0; c < channels.size(); c++) {
-      int pixel_offset = channel_to_pixelOffset[channels[c]];
-      int stride;
-      uint8_t* dst = img->get_plane(channels[c], &stride);
-      for (uint32_t row = 0; row < height; row++) {
-        long unsigned int tile_row_idx = row % tile_height;
-        long unsigned int tile_row_offset = tile_width * (tile_row_idx * channels.size() + pixel_offset);
-        uint32_t col = 0;
-        for (col = 0; col < width; col += tile_width) {
-          long unsigned int tile_base_offset = get_tile_base_offset(col, row, uncC, channels, width, height);
-          long unsigned int tile_col = col % tile_width;
-          long unsigned int tile_offset = tile_row_offset + tile_col;
-          long unsigned int src_offset = tile_base_offset + tile_offset;
-          uint32_t dst_offset = row * stride + col;
-          memcpy(dst + dst_offset, uncompressed_data.data() + src_offset, tile_width);
+}
+
+
+static bool get_channel_for_component_type(uint16_t component_type, heif_channel* out_channel)
+{
+  switch (component_type) {
+    case heif_component_type_monochrome:
+    case heif_component_type_Y:
+      *out_channel = heif_channel_Y;
+      return true;
+    case heif_component_type_Cb:
+      *out_channel = heif_channel_Cb;
+      return true;
+    case heif_component_type_Cr:
+      *out_channel = heif_channel_Cr;
+      return true;
+    case heif_component_type_red:
+      *out_channel = heif_channel_R;
+      return true;
+    case heif_component_type_green:
+      *out_channel = heif_channel_G;
+      return true;
+    case heif_component_type_blue:
+      *out_channel = heif_channel_B;
+      return true;
+    case heif_component_type_alpha:
+      *out_channel = heif_channel_Alpha;
+      return true;
+    default:
+      // TODO: other component types
+      return false;
+  }
+}
+
+
+// Checks whether the pixel-interleaved data can be used as an image with the interleaved 'chroma'
+// without any conversion. This is the case when the components are stored in RGB(A) order with
+// equal bit depths and, for more than 8 bits, in the byte order of the chroma format.
+static bool is_stored_as_interleaved_chroma(const std::shared_ptr<Box_uncC>& uncC, const std::shared_ptr<Box_cmpd>& cmpd,
+                                            heif_chroma chroma)
+{
+  if (uncC->get_interleave_type() != heif_uncompressed_interleave_type_pixel) {
+    return false;
+  }
+
+  const auto& components = uncC->get_components();
+  int bytes_per_sample = get_bytes_per_sample(components[0]);
+  bool little_endian = uncC->is_components_little_endian();
+
+  bool has_alpha;
+  switch (chroma) {
+    case heif_chroma_interleaved_RGB:
+    case heif_chroma_interleaved_RGBA:
+      has_alpha = (chroma == heif_chroma_interleaved_RGBA);
+      if (bytes_per_sample != 1) {
+        return false;
+      }
+      break;
+    case heif_chroma_interleaved_RRGGBB_BE:
+    case heif_chroma_interleaved_RRGGBBAA_BE:
+      has_alpha = (chroma == heif_chroma_interleaved_RRGGBBAA_BE);
+      if (bytes_per_sample != 2 || little_endian) {
+        return false;
+      }
+      break;
+    case heif_chroma_interleaved_RRGGBB_LE:
+    case heif_chroma_interleaved_RRGGBBAA_LE:
+      has_alpha = (chroma == heif_chroma_interleaved_RRGGBBAA_LE);
+      if (bytes_per_sample != 2 || !little_endian) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+
+  static const uint16_t rgba_component_types[] = {heif_component_type_red, heif_component_type_green,
+                                                  heif_component_type_blue, heif_component_type_alpha};
+
+  if (components.size() != (has_alpha ? 4 : 3)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < components.size(); i++) {
+    if (cmpd->get_components()[components[i].component_index].component_type != rgba_component_types[i] ||
+        components[i].component_bit_depth_minus_one != components[0].component_bit_depth_minus_one) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+static Error decompress_unit(uint32_t compression_type, const uint8_t* data, size_t size, size_t max_output_size,
+                             std::vector<uint8_t>* output)
+{
+  switch (compression_type) {
+#if HAVE_ZLIB
+    case fourcc("defl"):
+      return decompress_deflate(data, size, max_output_size, output);
+    case fourcc("zlib"):
+      return decompress_zlib(data, size, max_output_size, output);
+#endif
+#if HAVE_BROTLI
+    case fourcc("brot"):
+      return decompress_brotli(data, size, max_output_size, output);
+#endif
+    default: {
+      std::stringstream sstr;
+      sstr << "Generic compression method '" << to_fourcc(compression_type) << "' is not supported";
+      return Error(heif_error_Unsupported_feature,
+                   heif_suberror_Unsupported_generic_compression_method,
+                   sstr.str());
+    }
+  }
+}
+
+
+// How the samples of the tiles are stored in the item data and where they are placed in the output image.
+struct UncompressedTileDecoding
+{
+  std::shared_ptr<const HeifFile> heif_file;
+  heif_item_id ID = 0;
+
+  uint8_t interleave_type = 0;
+  uint32_t num_components = 0;
+  int bytes_per_sample = 1;
+  bool little_endian = false;
+
+  uint32_t tile_width = 0;
+  uint32_t tile_height = 0;
+  uint32_t num_tile_columns = 0;
+  uint64_t bytes_per_tile = 0;
+  uint64_t content_bytes_per_tile = 0;
+
+  // Generic compression ('cmpC'). When the whole item is compressed, it is decompressed into
+  // 'decompressed_data' before the tiles are decoded. With one compressed unit per tile, each
+  // tile is decompressed by the task that decodes it.
+  uint32_t compression_type = 0;
+  const uint8_t* decompressed_data = nullptr;
+  std::vector<Box_icef::CompressedUnit> tile_units;
+
+  // Copy pixel-interleaved rows into the single interleaved plane without deinterleaving.
+  bool copy_interleaved = false;
+
+  // output planes, in the order of the components
+  std::vector<uint8_t*> planes;
+  std::vector<size_t> strides;
+
+  // decoded area of the image
+  uint32_t x0 = 0;
+  uint32_t y0 = 0;
+  uint32_t out_width = 0;
+};
+
+
+// Reads the image rows 'row_begin' to 'row_end' (exclusive) of one tile and copies the part inside
+// the decoded area into the output image.
+static Error decode_tile_rows(const UncompressedTileDecoding& tiles, uint32_t tile_x, uint32_t tile_y,
+                              uint32_t row_begin, uint32_t row_end)
+{
+  uint32_t num_components = tiles.num_components;
+  int bytes_per_sample = tiles.bytes_per_sample;
+
+  uint32_t tile_index = tile_y * tiles.num_tile_columns + tile_x;
+  uint64_t tile_offset = tile_index * tiles.bytes_per_tile;
+  uint32_t first_row_in_tile = row_begin - tile_y * tiles.tile_height;
+  uint32_t num_rows = row_end - row_begin;
+
+  uint64_t component_row_bytes = (uint64_t) tiles.tile_width * bytes_per_sample;
+  uint64_t tile_row_bytes = component_row_bytes * num_components;
+
+
+  // --- get the tile data, either from memory or from the file
+
+  // Tile data in memory. Without compression, only the required rows are read from the file.
+  const uint8_t* tile_data = nullptr;
+  std::vector<uint8_t> decompressed_tile;
+
+  if (tiles.decompressed_data) {
+    tile_data = tiles.decompressed_data + tile_offset;
+  }
+  else if (!tiles.tile_units.empty()) {
+    const auto& unit = tiles.tile_units[tile_index];
+
+    std::vector<uint8_t> compressed_tile;
+    Error err = tiles.heif_file->get_item_data_range(tiles.ID, unit.unit_offset, unit.unit_size, &compressed_tile);
+    if (err) {
+      return err;
+    }
+
+    err = decompress_unit(tiles.compression_type, compressed_tile.data(), compressed_tile.size(),
+                          tiles.bytes_per_tile, &decompressed_tile);
+    if (err) {
+      return err;
+    }
+
+    if (decompressed_tile.size() < tiles.content_bytes_per_tile) {
+      return Error(heif_error_Invalid_input,
+                   heif_suberror_Decompression_invalid_data,
+                   "Decompressed tile is smaller than the tile size");
+    }
+
+    tile_data = decompressed_tile.data();
+  }
+
+  std::vector<uint8_t> data;
+
+  // Gets 'size' bytes at 'offset' within the tile. Returns the start of the bytes relative to the data base pointer.
+  auto read_tile_range = [&](uint64_t offset, uint64_t size, uint64_t* out_start) -> Error {
+    if (tile_data) {
+      *out_start = offset;
+      return Error::Ok;
+    }
+
+    *out_start = data.size();
+    return tiles.heif_file->get_item_data_range(tiles.ID, tile_offset + offset, size, &data);
+  };
+
+  std::vector<uint64_t> component_start(num_components, 0);
+  uint64_t row_pitch;
+
+  if (tiles.interleave_type == heif_uncompressed_interleave_type_component) {
+    // Source is planar. Each component is stored as a separate plane of the tile.
+    row_pitch = component_row_bytes;
+
+    for (uint32_t c = 0; c < num_components; c++) {
+      uint64_t offset = (c * (uint64_t) tiles.tile_height + first_row_in_tile) * component_row_bytes;
+      Error err = read_tile_range(offset, num_rows * component_row_bytes, &component_start[c]);
+      if (err) {
+        return err;
+      }
+    }
+  }
+  else {
+    row_pitch = tile_row_bytes;
+
+    uint64_t rows_start;
+    Error err = read_tile_range(first_row_in_tile * tile_row_bytes, num_rows * tile_row_bytes, &rows_start);
+    if (err) {
+      return err;
+    }
+
+    for (uint32_t c = 0; c < num_components; c++) {
+      component_start[c] = rows_start;
+      if (tiles.interleave_type == heif_uncompressed_interleave_type_row) {
+        component_start[c] += c * component_row_bytes;
+      }
+    }
+  }
+
+  const uint8_t* base = tile_data ? tile_data : data.data();
+
+
+  // --- copy the columns of the tile that are inside the decoded area
+
+  uint32_t col_begin = std::max(tiles.x0, tile_x * tiles.tile_width);
+  uint32_t col_end = std::min(tiles.x0 + tiles.out_width, (tile_x + 1) * tiles.tile_width);
+  uint32_t skip = col_begin - tile_x * tiles.tile_width;
+  uint32_t num_columns = col_end - col_begin;
+  uint32_t out_x = col_begin - tiles.x0;
+
+  std::vector<uint8_t*> dst_rows(tiles.planes.size());
+
+  for (uint32_t r = 0; r < num_rows; r++) {
+    size_t out_y = row_begin + r - tiles.y0;
+    const uint8_t* src_row = base + component_start[0] + r * row_pitch;
+
+    if (tiles.copy_interleaved) {
+      size_t pixel_bytes = num_components * bytes_per_sample;
+      memcpy(tiles.planes[0] + out_y * tiles.strides[0] + out_x * pixel_bytes,
+             src_row + skip * pixel_bytes,
+             num_columns * pixel_bytes);
+    }
+    else if (tiles.interleave_type == heif_uncompressed_interleave_type_pixel) {
+      for (size_t c = 0; c < tiles.planes.size(); c++) {
+        dst_rows[c] = tiles.planes[c] + out_y * tiles.strides[c] + out_x * bytes_per_sample;
+      }
+
+      deinterleave_row(src_row + (size_t) skip * num_components * bytes_per_sample,
+                       dst_rows.data(), num_components, num_columns, bytes_per_sample, tiles.little_endian);
+    }
+    else {
+      for (uint32_t c = 0; c < num_components; c++) {
+        uint8_t* dst_row = tiles.planes[c] + out_y * tiles.strides[c] + out_x * bytes_per_sample;
+
+        deinterleave_row(base + component_start[c] + r * row_pitch + (size_t) skip * bytes_per_sample,
+                         &dst_row, 1, num_columns, bytes_per_sample, tiles.little_endian);
+      }
+    }
+  }
+
+  return Error::Ok;
+}
+
+
+Error UncompressedImageCodec::decode_uncompressed_image(const std::shared_ptr<const HeifFile>& heif_file,
+                                                        heif_item_id ID,
+                                                        std::shared_ptr<HeifPixelImage>& img,
+                                                        uint32_t maximum_image_width_limit,
+                                                        uint32_t maximum_image_height_limit,
+                                                        heif_chroma preferred_chroma,
+                                                        const HeifContext::ImageRegion* region,
+                                                        ThreadPool* thread_pool)
+{
+  // Get the properties for this item
+  // We need: ispe, cmpd, uncC
+  std::vector<std::shared_ptr<Box>> item_properties;
+  Error error = heif_file->get_properties(ID, item_properties);
+  if (error) {
+    return error;
+  }
+  uint32_t width = 0;
+  uint32_t height = 0;
+  bool found_ispe = false;
+  std::shared_ptr<Box_cmpd> cmpd;
+  std::shared_ptr<Box_uncC> uncC;
+  std::shared_ptr<Box_cmpC> cmpC;
+  std::shared_ptr<Box_icef> icef;
+  for (const auto& prop : item_properties) {
+    auto ispe = std::dynamic_pointer_cast<Box_ispe>(prop);
+    if (ispe) {
+      width = ispe->get_width();
+      height = ispe->get_height();
+
+      if (width >= maximum_image_width_limit || height >= maximum_image_height_limit) {
+        std::stringstream sstr;
+        sstr << "Image size " << width << "x" << height << " exceeds the maximum image size "
+             << maximum_image_width_limit << "x" << maximum_image_height_limit << "\n";
+
+        return Error(heif_error_Memory_allocation_error,
+                     heif_suberror_Security_limit_exceeded,
+                     sstr.str());
+      }
+      found_ispe = true;
+    }
+
+    auto maybe_cmpd = std::dynamic_pointer_cast<Box_cmpd>(prop);
+    if (maybe_cmpd) {
+      cmpd = maybe_cmpd;
+    }
+
+    auto maybe_uncC = std::dynamic_pointer_cast<Box_uncC>(prop);
+    if (maybe_uncC) {
+      uncC = maybe_uncC;
+    }
+
+    auto maybe_cmpC = std::dynamic_pointer_cast<Box_cmpC>(prop);
+    if (maybe_cmpC) {
+      cmpC = maybe_cmpC;
+    }
+
+    auto maybe_icef = std::dynamic_pointer_cast<Box_icef>(prop);
+    if (maybe_icef) {
+      icef = maybe_icef;
+    }
+  }
+
+
+  // if we miss a required box, show error
+
+  if (!found_ispe || !cmpd || !uncC) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_data_version,
+                 "Missing required box for uncompressed codec");
+  }
+
+
+  // check if we support the type of image
+
+  error = uncompressed_image_type_is_supported(uncC, cmpd);
+  if (error) {
+    return error;
+  }
+
+  // --- area of the image that is decoded
+
+  uint32_t x0 = 0;
+  uint32_t y0 = 0;
+  uint32_t out_width = width;
+  uint32_t out_height = height;
+
+  if (region) {
+    if (region->x < 0 || region->y < 0 || region->width <= 0 || region->height <= 0 ||
+        (uint32_t) region->x + region->width > width ||
+        (uint32_t) region->y + region->height > height) {
+      return Error(heif_error_Usage_error,
+                   heif_suberror_Invalid_parameter_value,
+                   "Decoded region is outside of the image");
+    }
+
+    x0 = region->x;
+    y0 = region->y;
+    out_width = region->width;
+    out_height = region->height;
+  }
+
+
+  // --- layout of the tiles in the item data
+
+  const auto& components = uncC->get_components();
+
+  UncompressedTileDecoding tiles;
+  tiles.heif_file = heif_file;
+  tiles.ID = ID;
+  tiles.interleave_type = uncC->get_interleave_type();
+  tiles.num_components = (uint32_t) components.size();
+  tiles.bytes_per_sample = get_bytes_per_sample(components[0]);
+  tiles.little_endian = uncC->is_components_little_endian();
+
+  uint32_t numTileColumns = uncC->get_number_of_tile_columns();
+  uint32_t numTileRows = uncC->get_number_of_tile_rows();
+  if (width % numTileColumns != 0 || height % numTileRows != 0) {
+    return Error(heif_error_Invalid_input,
+                 heif_suberror_Unspecified,
+                 "Uncompressed image size is not a multiple of the tile size");
+  }
+
+  tiles.num_tile_columns = numTileColumns;
+  tiles.tile_width = width / numTileColumns;
+  tiles.tile_height = height / numTileRows;
+
+  // TODO: properly interpret uncompressed_data per uncC config, subsampling etc.
+  uint64_t content_bytes_per_tile = (uint64_t) tiles.tile_width * tiles.tile_height * tiles.num_components * tiles.bytes_per_sample;
+  uint32_t tile_align_size = uncC->get_tile_align_size();
+  uint64_t tile_padding = 0;
+  if (tile_align_size > 0) {
+    tile_padding = (tile_align_size - (content_bytes_per_tile % tile_align_size)) % tile_align_size;
+  }
+  tiles.content_bytes_per_tile = content_bytes_per_tile;
+  tiles.bytes_per_tile = content_bytes_per_tile + tile_padding;
+
+
+  // --- generic compression
+
+  std::vector<uint8_t> decompressed_data;
+
+  if (cmpC) {
+    tiles.compression_type = cmpC->get_compression_type();
+    uint64_t num_tiles = (uint64_t) numTileColumns * numTileRows;
+
+    switch (cmpC->get_compressed_unit_type()) {
+      case Box_cmpC::unit_full_item:
+      case Box_cmpC::unit_image: {
+        // The whole image is decompressed at once. Several units are concatenated.
+        std::vector<uint8_t> item_data;
+        error = heif_file->get_compressed_image_data(ID, &item_data);
+        if (error) {
+          return error;
         }
-        for (; col < (uint32_t) stride; col++) {
-          uint32_t dstPixelIndex = row * stride + col;
-          dst[dstPixelIndex] = 0;
+
+        std::vector<Box_icef::CompressedUnit> units;
+        if (icef) {
+          units = icef->get_units();
+        }
+        else {
+          units.push_back({0, item_data.size()});
         }
+
+        uint64_t image_size = num_tiles * tiles.bytes_per_tile;
+
+        for (const auto& unit : units) {
+          if (unit.unit_offset > item_data.size() || unit.unit_size > item_data.size() - unit.unit_offset) {
+            return Error(heif_error_Invalid_input,
+                         heif_suberror_End_of_data,
+                         "Compressed unit exceeds the item data");
+          }
+
+          std::vector<uint8_t> unit_data;
+          error = decompress_unit(tiles.compression_type, item_data.data() + unit.unit_offset, unit.unit_size,
+                                  image_size - decompressed_data.size(), &unit_data);
+          if (error) {
+            return error;
+          }
+
+          decompressed_data.insert(decompressed_data.end(), unit_data.begin(), unit_data.end());
+        }
+
+        // The padding of the last tile may be missing.
+        if (decompressed_data.size() < image_size - tile_padding) {
+          return Error(heif_error_Invalid_input,
+                       heif_suberror_Decompression_invalid_data,
+                       "Decompressed image data is smaller than the image size");
+        }
+
+        tiles.decompressed_data = decompressed_data.data();
+        break;
+      }
+
+      case Box_cmpC::unit_image_tile:
+        if (!icef || icef->get_units().size() != num_tiles) {
+          return Error(heif_error_Invalid_input,
+                       heif_suberror_Unspecified,
+                       "Number of compressed units does not match the number of tiles");
+        }
+
+        tiles.tile_units = icef->get_units();
+        break;
+
+      default: {
+        std::stringstream sstr;
+        sstr << "Uncompressed image with compressed_unit_type " << ((int) cmpC->get_compressed_unit_type())
+             << " is not implemented yet";
+        return Error(heif_error_Unsupported_feature,
+                     heif_suberror_Unsupported_data_version,
+                     sstr.str());
       }
     }
   }
-  return Error::Ok;
+
+  tiles.x0 = x0;
+  tiles.y0 = y0;
+  tiles.out_width = out_width;
+
+
+  // --- create the output image
+
+  img = std::make_shared<HeifPixelImage>();
+
+  // When the samples are stored in the requested interleaved format, the rows are copied as a whole.
+  tiles.copy_interleaved = is_stored_as_interleaved_chroma(uncC, cmpd, preferred_chroma);
+
+  if (tiles.copy_interleaved) {
+    img->create(out_width, out_height, heif_colorspace_RGB, preferred_chroma);
+    if (!img->add_plane(heif_channel_interleaved, out_width, out_height, components[0].component_bit_depth_minus_one + 1)) {
+      return Error(heif_error_Memory_allocation_error,
+                   heif_suberror_Unspecified);
+    }
+
+    size_t stride;
+    tiles.planes.push_back(img->get_plane(heif_channel_interleaved, &stride));
+    tiles.strides.push_back(stride);
+  }
+  else {
+    heif_chroma chroma;
+    heif_colorspace colourspace;
+    error = get_heif_chroma_uncompressed(uncC, cmpd, &chroma, &colourspace);
+    if (error) {
+      return error;
+    }
+    img->create(out_width, out_height,
+                colourspace,
+                chroma);
+
+    for (Box_uncC::Component component : components) {
+      uint16_t component_type = cmpd->get_components()[component.component_index].component_type;
+
+      heif_channel channel;
+      if (!get_channel_for_component_type(component_type, &channel)) {
+        return Error(heif_error_Unsupported_feature,
+                     heif_suberror_Unsupported_data_version,
+                     "Uncompressed image component type is not implemented yet");
+      }
+
+      if (img->has_channel(channel)) {
+        return Error(heif_error_Invalid_input,
+                     heif_suberror_Unspecified,
+                     "Uncompressed image with duplicate components");
+      }
+
+      if (!img->add_plane(channel, out_width, out_height, component.component_bit_depth_minus_one + 1)) {
+        return Error(heif_error_Memory_allocation_error,
+                     heif_suberror_Unspecified);
+      }
+
+      size_t stride;
+      tiles.planes.push_back(img->get_plane(channel, &stride));
+      tiles.strides.push_back(stride);
+    }
+  }
+
+
+  // --- decode the tiles that intersect the region
+
+  uint32_t first_tile_column = x0 / tiles.tile_width;
+  uint32_t last_tile_column = (x0 + out_width - 1) / tiles.tile_width;
+  uint32_t first_tile_row = y0 / tiles.tile_height;
+  uint32_t last_tile_row = (y0 + out_height - 1) / tiles.tile_height;
+
+  // When there are fewer tiles than threads, the tiles are split into bands of rows.
+  // Compressed tiles are always decoded as a whole, as they have to be decompressed completely.
+  uint32_t num_tiles = (last_tile_column - first_tile_column + 1) * (last_tile_row - first_tile_row + 1);
+  uint32_t bands_per_tile = 1;
+  if (thread_pool && tiles.tile_units.empty()) {
+    uint32_t num_threads = thread_pool->get_num_threads() + 1;
+    bands_per_tile = (num_threads + num_tiles - 1) / num_tiles;
+  }
+
+  TaskGroup tile_tasks(thread_pool);
+
+  for (uint32_t tile_y = first_tile_row; tile_y <= last_tile_row; tile_y++) {
+    uint32_t row_begin = std::max(y0, tile_y * tiles.tile_height);
+    uint32_t row_end = std::min(y0 + out_height, (tile_y + 1) * tiles.tile_height);
+    uint32_t band_height = (row_end - row_begin + bands_per_tile - 1) / bands_per_tile;
+
+    for (uint32_t tile_x = first_tile_column; tile_x <= last_tile_column; tile_x++) {
+      for (uint32_t band_begin = row_begin; band_begin < row_end; band_begin += band_height) {
+        uint32_t band_end = std::min(band_begin + band_height, row_end);
+
+        tile_tasks.run([&tiles, tile_x, tile_y, band_begin, band_end]() {
+          return decode_tile_rows(tiles, tile_x, tile_y, band_begin, band_end);
+        });
+      }
+    }
+  }
+
+  return tile_tasks.wait();
+}
+
+// --- encoding
+
+// Where the samples of the components are taken from when writing the tiles.
+struct UncompressedTileEncoding
+{
+  uint8_t interleave_type = 0;
+  uint32_t num_components = 0;
+  int bytes_per_sample = 1;
+
+  uint32_t tile_width = 0;
+  uint32_t tile_height = 0;
+
+  // Input is a single interleaved plane. The samples are copied in the byte order of the input.
+  bool input_interleaved = false;
+
+  // first sample of each component and the distance between the samples of a component, in bytes
+  std::vector<const uint8_t*> planes;
+  std::vector<size_t> strides;
+  int sample_step = 1;
+};
+
+
+// Copies 'width' samples of one component into 'dst'. Samples from planar 16-bit input are
+// written in big-endian byte order.
+static void write_component_row(const UncompressedTileEncoding& tiles, const uint8_t* src, uint8_t* dst, uint32_t width)
+{
+  if (tiles.bytes_per_sample == 1) {
+    if (tiles.sample_step == 1) {
+      memcpy(dst, src, width);
+    }
+    else {
+      for (uint32_t x = 0; x < width; x++) {
+        dst[x] = src[x * tiles.sample_step];
+      }
+    }
+  }
+  else if (tiles.input_interleaved) {
+    for (uint32_t x = 0; x < width; x++) {
+      dst[2 * x] = src[x * tiles.sample_step];
+      dst[2 * x + 1] = src[x * tiles.sample_step + 1];
+    }
+  }
+  else {
+    const auto* in = (const uint16_t*) src;
+    for (uint32_t x = 0; x < width; x++) {
+      dst[2 * x] = (uint8_t) (in[x] >> 8);
+      dst[2 * x + 1] = (uint8_t) (in[x] & 0xFF);
+    }
+  }
 }
 
+
+// Writes the samples of one tile in the interleaving of the 'uncC' box.
+static void encode_tile(const UncompressedTileEncoding& tiles, uint32_t tile_x, uint32_t tile_y, std::vector<uint8_t>* out)
+{
+  uint32_t num_components = tiles.num_components;
+  int bytes_per_sample = tiles.bytes_per_sample;
+  uint32_t width = tiles.tile_width;
+  uint32_t x0 = tile_x * tiles.tile_width;
+  uint32_t y0 = tile_y * tiles.tile_height;
+
+  size_t component_row_bytes = (size_t) width * bytes_per_sample;
+
+  out->resize(component_row_bytes * num_components * tiles.tile_height);
+  uint8_t* dst = out->data();
+
+  auto src_row = [&](uint32_t c, uint32_t y) {
+    return tiles.planes[c] + (size_t) (y0 + y) * tiles.strides[c] + (size_t) x0 * tiles.sample_step;
+  };
+
+  switch (tiles.interleave_type) {
+    case heif_uncompressed_interleave_type_component:
+      for (uint32_t c = 0; c < num_components; c++) {
+        for (uint32_t y = 0; y < tiles.tile_height; y++) {
+          write_component_row(tiles, src_row(c, y), dst, width);
+          dst += component_row_bytes;
+        }
+      }
+      break;
+
+    case heif_uncompressed_interleave_type_row:
+      for (uint32_t y = 0; y < tiles.tile_height; y++) {
+        for (uint32_t c = 0; c < num_components; c++) {
+          write_component_row(tiles, src_row(c, y), dst, width);
+          dst += component_row_bytes;
+        }
+      }
+      break;
+
+    case heif_uncompressed_interleave_type_pixel: {
+      size_t pixel_bytes = (size_t) num_components * bytes_per_sample;
+
+      for (uint32_t y = 0; y < tiles.tile_height; y++) {
+        if (tiles.input_interleaved) {
+          memcpy(dst, src_row(0, y), width * pixel_bytes);
+        }
+        else {
+          for (uint32_t c = 0; c < num_components; c++) {
+            const uint8_t* src = src_row(c, y);
+
+            for (uint32_t x = 0; x < width; x++) {
+              uint8_t* p = dst + x * pixel_bytes + c * bytes_per_sample;
+              if (bytes_per_sample == 1) {
+                p[0] = src[x];
+              }
+              else {
+                uint16_t v = ((const uint16_t*) src)[x];
+                p[0] = (uint8_t) (v >> 8);
+                p[1] = (uint8_t) (v & 0xFF);
+              }
+            }
+          }
+        }
+
+        dst += width * pixel_bytes;
+      }
+      break;
+    }
+
+    default:
+      assert(false);
+  }
+}
+
+
+static std::vector<uint8_t> compress_unit(uint32_t compression_type, const std::vector<uint8_t>& data)
+{
+  switch (compression_type) {
+#if HAVE_ZLIB
+    case fourcc("defl"):
+      return compress_deflate(data.data(), data.size());
+    case fourcc("zlib"):
+      return compress_zlib(data.data(), data.size());
+#endif
+#if HAVE_BROTLI
+    case fourcc("brot"):
+      return compress_brotli(data.data(), data.size());
+#endif
+    default:
+      assert(false);
+      return {};
+  }
+}
+
+
+// Without explicit tiling, compressed images are split into bands of rows that can be compressed
+// and decompressed in parallel. The number of bands has to divide the image height.
+static uint32_t get_number_of_row_bands(uint32_t height)
+{
+  const uint32_t min_band_height = 64;
+  const uint32_t max_bands = 64;
+
+  uint32_t num_bands = 1;
+  for (uint32_t n = 2; n <= max_bands && height / n >= min_band_height; n++) {
+    if (height % n == 0) {
+      num_bands = n;
+    }
+  }
+
+  return num_bands;
+}
+
+
 Error UncompressedImageCodec::encode_uncompressed_image(const std::shared_ptr<HeifFile>& heif_file,
+                                                        heif_item_id ID,
                                                         const std::shared_ptr<HeifPixelImage>& src_image,
                                                         void* encoder_struct,
                                                         const struct heif_encoding_options& options,
-                                                        std::shared_ptr<HeifContext::Image> out_image)
+                                                        ThreadPool* thread_pool)
 {
-  //encoder_struct_uncompressed* encoder = (encoder_struct_uncompressed*)encoder_struct;
+  auto* encoder = (encoder_struct_uncompressed*) encoder_struct;
+
+  // Use the const accessors, so that the conversion cache of the image is kept.
+  const HeifPixelImage& image = *src_image;
+
+  uint32_t width = src_image->get_width();
+  uint32_t height = src_image->get_height();
+  heif_colorspace colorspace = src_image->get_colorspace();
+  heif_chroma chroma = src_image->get_chroma_format();
+
+
+  // --- components of the image
+
+  UncompressedTileEncoding tiles;
+  std::vector<uint16_t> component_types;
+  int bit_depth;
+  bool little_endian = false;
+
+  switch (chroma) {
+    case heif_chroma_interleaved_RGB:
+    case heif_chroma_interleaved_RGBA:
+    case heif_chroma_interleaved_RRGGBB_BE:
+    case heif_chroma_interleaved_RRGGBBAA_BE:
+    case heif_chroma_interleaved_RRGGBB_LE:
+    case heif_chroma_interleaved_RRGGBBAA_LE: {
+      component_types = {heif_component_type_red, heif_component_type_green, heif_component_type_blue};
+      if (chroma == heif_chroma_interleaved_RGBA ||
+          chroma == heif_chroma_interleaved_RRGGBBAA_BE ||
+          chroma == heif_chroma_interleaved_RRGGBBAA_LE) {
+        component_types.push_back(heif_component_type_alpha);
+      }
 
-  printf("UNCOMPRESSED\n");
+      little_endian = (chroma == heif_chroma_interleaved_RRGGBB_LE ||
+                       chroma == heif_chroma_interleaved_RRGGBBAA_LE);
 
-#if 0
-  Box_uncC::configuration config;
+      bit_depth = src_image->get_bits_per_pixel(heif_channel_interleaved);
+      tiles.bytes_per_sample = (bit_depth > 8 ? 2 : 1);
+      tiles.input_interleaved = true;
+      tiles.sample_step = (int) component_types.size() * tiles.bytes_per_sample;
 
-  // Fill preliminary av1C in case we cannot parse the sequence_header() correctly in the code below.
-  // TODO: maybe we can remove this later.
-  fill_av1C_configuration(&config, src_image);
+      size_t stride;
+      const uint8_t* plane = image.get_plane(heif_channel_interleaved, &stride);
+      for (size_t c = 0; c < component_types.size(); c++) {
+        tiles.planes.push_back(plane + c * tiles.bytes_per_sample);
+        tiles.strides.push_back(stride);
+      }
+      break;
+    }
 
-  heif_image c_api_image;
-  c_api_image.image = src_image;
+    default: {
+      std::vector<heif_channel> channels;
 
-  struct heif_error err = encoder->plugin->encode_image(encoder->encoder, &c_api_image, input_class);
-  if (err.code) {
-    return Error(err.code,
-                 err.subcode,
-                 err.message);
+      if (colorspace == heif_colorspace_RGB && chroma == heif_chroma_444) {
+        channels = {heif_channel_R, heif_channel_G, heif_channel_B};
+        component_types = {heif_component_type_red, heif_component_type_green, heif_component_type_blue};
+      }
+      else if (colorspace == heif_colorspace_YCbCr && chroma == heif_chroma_444) {
+        channels = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr};
+        component_types = {heif_component_type_Y, heif_component_type_Cb, heif_component_type_Cr};
+      }
+      else if (colorspace == heif_colorspace_monochrome) {
+        channels = {heif_channel_Y};
+        component_types = {heif_component_type_monochrome};
+      }
+      else {
+        return Error(heif_error_Unsupported_feature,
+                     heif_suberror_Unsupported_color_conversion,
+                     "Unsupported image format for uncompressed coding");
+      }
+
+      if (options.save_alpha_channel && src_image->has_channel(heif_channel_Alpha)) {
+        channels.push_back(heif_channel_Alpha);
+        component_types.push_back(heif_component_type_alpha);
+      }
+
+      bit_depth = src_image->get_bits_per_pixel(channels[0]);
+      tiles.bytes_per_sample = (bit_depth > 8 ? 2 : 1);
+      tiles.sample_step = tiles.bytes_per_sample;
+
+      for (heif_channel channel : channels) {
+        if (src_image->get_bits_per_pixel(channel) != bit_depth) {
+          return Error(heif_error_Unsupported_feature,
+                       heif_suberror_Unsupported_bit_depth,
+                       "Uncompressed coding of channels with different bit depths is not supported");
+        }
+
+        size_t stride;
+        tiles.planes.push_back(image.get_plane(channel, &stride));
+        tiles.strides.push_back(stride);
+      }
+      break;
+    }
+  }
+
+  if (bit_depth < 1 || bit_depth > 16) {
+    return Error(heif_error_Unsupported_feature,
+                 heif_suberror_Unsupported_bit_depth,
+                 "Uncompressed coding supports bit depths of up to 16 bits");
   }
 
-  for (;;) {
-    uint8_t* data;
-    int size;
+  tiles.num_components = (uint32_t) component_types.size();
+
+  switch (encoder->interleaveFormat) {
+    case encoder_struct_uncompressed::InterleaveFormat::Planar:
+      tiles.interleave_type = heif_uncompressed_interleave_type_component;
+      break;
+    case encoder_struct_uncompressed::InterleaveFormat::Row:
+      tiles.interleave_type = heif_uncompressed_interleave_type_row;
+      break;
+    case encoder_struct_uncompressed::InterleaveFormat::Pixel:
+      tiles.interleave_type = heif_uncompressed_interleave_type_pixel;
+      break;
+  }
 
-    encoder->plugin->get_compressed_data(encoder->encoder, &data, &size, nullptr);
 
-    bool found_config = fill_av1C_configuration_from_stream(&config, data, size);
-    (void) found_config;
+  // --- compression and tiling
 
-    if (data == nullptr) {
+  uint32_t compression_type = 0;
+  switch (encoder->compression) {
+    case encoder_struct_uncompressed::Compression::None:
+      break;
+    case encoder_struct_uncompressed::Compression::Deflate:
+      compression_type = fourcc("defl");
+      break;
+    case encoder_struct_uncompressed::Compression::Zlib:
+      compression_type = fourcc("zlib");
       break;
+    case encoder_struct_uncompressed::Compression::Brotli:
+      compression_type = fourcc("brot");
+      break;
+  }
+
+  uint32_t num_tile_columns = encoder->tile_columns;
+  uint32_t num_tile_rows = encoder->tile_rows;
+  if (num_tile_rows == 0) {
+    num_tile_rows = (compression_type != 0 && num_tile_columns == 1) ? get_number_of_row_bands(height) : 1;
+  }
+
+  if (num_tile_columns > width || num_tile_rows > height ||
+      width % num_tile_columns != 0 || height % num_tile_rows != 0) {
+    std::stringstream sstr;
+    sstr << "Image size " << width << "x" << height << " cannot be split into "
+         << num_tile_columns << "x" << num_tile_rows << " tiles of equal size";
+    return Error(heif_error_Usage_error,
+                 heif_suberror_Invalid_parameter_value,
+                 sstr.str());
+  }
+
+  tiles.tile_width = width / num_tile_columns;
+  tiles.tile_height = height / num_tile_rows;
+
+
+  // --- write the tiles, compressing them in parallel
+
+  uint32_t num_tiles = num_tile_columns * num_tile_rows;
+  std::vector<std::vector<uint8_t>> tile_data(num_tiles);
+
+  TaskGroup tile_tasks(compression_type != 0 ? thread_pool : nullptr);
+
+  for (uint32_t tile_y = 0; tile_y < num_tile_rows; tile_y++) {
+    for (uint32_t tile_x = 0; tile_x < num_tile_columns; tile_x++) {
+      std::vector<uint8_t>& data = tile_data[tile_y * num_tile_columns + tile_x];
+
+      tile_tasks.run([&tiles, &data, tile_x, tile_y, compression_type]() {
+        encode_tile(tiles, tile_x, tile_y, &data);
+
+        if (compression_type != 0) {
+          data = compress_unit(compression_type, data);
+          if (data.empty()) {
+            return Error(heif_error_Encoding_error,
+                         heif_suberror_Encoder_encoding,
+                         "Compression of uncompressed image tile failed");
+          }
+        }
+
+        return Error::Ok;
+      });
     }
+  }
+
+  Error err = tile_tasks.wait();
+  if (err) {
+    return err;
+  }
 
-    std::vector<uint8_t> vec;
-    vec.resize(size);
-    memcpy(vec.data(), data, size);
+  auto icef = std::make_shared<Box_icef>();
+  uint64_t unit_offset = 0;
 
-    m_heif_file->append_iloc_data(image_id, vec);
+  for (auto& data : tile_data) {
+    icef->add_unit({unit_offset, data.size()});
+    unit_offset += data.size();
+
+    heif_file->append_iloc_data(ID, std::move(data));
   }
 
-  m_heif_file->add_av1C_property(image_id);
-  m_heif_file->set_av1C_configuration(image_id, config);
 
-  //m_heif_file->add_orientation_properties(image_id, options->image_orientation);
+  // --- properties
 
-  uint32_t input_width, input_height;
-  input_width = src_image->get_width();
-  input_height = src_image->get_height();
-  m_heif_file->add_ispe_property(image_id,
-                                 get_rotated_width(options->image_orientation, input_width, input_height),
-                                 get_rotated_height(options->image_orientation, input_width, input_height));
-#endif
+  heif_file->add_ispe_property(ID, width, height);
+
+  auto cmpd = std::make_shared<Box_cmpd>();
+  auto uncC = std::make_shared<Box_uncC>();
+
+  for (size_t c = 0; c < component_types.size(); c++) {
+    cmpd->add_component({component_types[c], std::string()});
+
+    Box_uncC::Component component;
+    component.component_index = (uint16_t) c;
+    component.component_bit_depth_minus_one = (uint8_t) (bit_depth - 1);
+    component.component_format = 0;
+    component.component_align_size = (bit_depth % 8 == 0 ? 0 : (uint8_t) tiles.bytes_per_sample);
+    uncC->add_component(component);
+  }
+
+  uncC->set_interleave_type(tiles.interleave_type);
+  uncC->set_components_little_endian(little_endian);
+  uncC->set_number_of_tiles(num_tile_columns, num_tile_rows);
+
+  heif_file->add_property(ID, cmpd);
+  heif_file->add_property(ID, uncC);
+
+  if (compression_type != 0) {
+    auto cmpC = std::make_shared<Box_cmpC>();
+    cmpC->set_compression_type(compression_type);
+    cmpC->set_compressed_unit_type(Box_cmpC::unit_image_tile);
+
+    heif_file->add_property(ID, cmpC);
+    heif_file->add_property(ID, icef);
+  }
 
   return Error::Ok;
 }
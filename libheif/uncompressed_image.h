@@ -53,6 +53,8 @@ public:
 
   const std::vector<Component>& get_components() const { return m_components; }
 
+  void add_component(const Component& component) { m_components.push_back(component); }
+
 protected:
   Error parse(BitstreamRange& range) override;
 
@@ -109,25 +111,105 @@ public:
 
   uint32_t get_number_of_tile_rows() { return m_num_tile_rows_minus_one + 1; }
 
+  void add_component(const Component& component) { m_components.push_back(component); }
+
+  void set_interleave_type(uint8_t interleave_type) { m_interleave_type = interleave_type; }
+
+  void set_components_little_endian(bool little_endian) { m_components_little_endian = little_endian; }
+
+  void set_number_of_tiles(uint32_t columns, uint32_t rows)
+  {
+    m_num_tile_cols_minus_one = columns - 1;
+    m_num_tile_rows_minus_one = rows - 1;
+  }
+
 protected:
   Error parse(BitstreamRange& range) override;
 
-  uint32_t m_profile;
+  uint32_t m_profile = 0;
 
   std::vector<Component> m_components;
-  uint8_t m_sampling_type;
-  uint8_t m_interleave_type;
-  uint8_t m_block_size;
-  bool m_components_little_endian;
-  bool m_block_pad_lsb;
-  bool m_block_little_endian;
-  bool m_block_reversed;
-  bool m_pad_unknown;
-  uint8_t m_pixel_size;
-  uint32_t m_row_align_size;
-  uint32_t m_tile_align_size;
-  uint32_t m_num_tile_cols_minus_one;
-  uint32_t m_num_tile_rows_minus_one;
+  uint8_t m_sampling_type = 0;
+  uint8_t m_interleave_type = 0;
+  uint8_t m_block_size = 0;
+  bool m_components_little_endian = false;
+  bool m_block_pad_lsb = false;
+  bool m_block_little_endian = false;
+  bool m_block_reversed = false;
+  bool m_pad_unknown = false;
+  uint8_t m_pixel_size = 0;
+  uint32_t m_row_align_size = 0;
+  uint32_t m_tile_align_size = 0;
+  uint32_t m_num_tile_cols_minus_one = 0;
+  uint32_t m_num_tile_rows_minus_one = 0;
+};
+
+
+// Generic compression of the image data (ISO/IEC 23001-17 Amd 2)
+class Box_cmpC : public FullBox
+{
+public:
+  Box_cmpC()
+  {
+    set_short_type(fourcc("cmpC"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  Error write(StreamWriter& writer) const override;
+
+  enum compressed_unit_type
+  {
+    unit_full_item = 0,
+    unit_image = 1,
+    unit_image_tile = 2,
+    unit_image_row = 3,
+    unit_image_pixel = 4
+  };
+
+  uint32_t get_compression_type() const { return m_compression_type; }
+
+  uint8_t get_compressed_unit_type() const { return m_compressed_unit_type; }
+
+  void set_compression_type(uint32_t type) { m_compression_type = type; }
+
+  void set_compressed_unit_type(uint8_t type) { m_compressed_unit_type = type; }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+  uint32_t m_compression_type = 0;
+  uint8_t m_compressed_unit_type = unit_full_item;
+};
+
+
+// Positions of the compressed units in the item data
+class Box_icef : public FullBox
+{
+public:
+  Box_icef()
+  {
+    set_short_type(fourcc("icef"));
+  }
+
+  std::string dump(Indent&) const override;
+
+  Error write(StreamWriter& writer) const override;
+
+  struct CompressedUnit
+  {
+    uint64_t unit_offset;
+    uint64_t unit_size;
+  };
+
+  const std::vector<CompressedUnit>& get_units() const { return m_units; }
+
+  void add_unit(const CompressedUnit& unit) { m_units.push_back(unit); }
+
+protected:
+  Error parse(BitstreamRange& range) override;
+
+  std::vector<CompressedUnit> m_units;
 };
 
 
@@ -136,18 +218,34 @@ class UncompressedImageCodec
 public:
   static int get_luma_bits_per_pixel_from_configuration_unci(const HeifFile& heif_file, heif_item_id imageID);
 
+  // The image is returned with planar channels, unless 'preferred_chroma' is an interleaved
+  // RGB(A) format in which the samples are already stored. Then, the rows are copied as they are.
+  // When 'region' is given, only the data of the tiles intersecting it is read from the file and the
+  // returned image covers exactly this region. Tiles are decoded in parallel on 'thread_pool' (may be nullptr).
   static Error decode_uncompressed_image(const std::shared_ptr<const HeifFile>& heif_file,
                                          heif_item_id ID,
                                          std::shared_ptr<HeifPixelImage>& img,
                                          uint32_t maximum_image_width_limit,
                                          uint32_t maximum_image_height_limit,
-                                         const std::vector<uint8_t>& uncompressed_data);
+                                         heif_chroma preferred_chroma,
+                                         const HeifContext::ImageRegion* region,
+                                         ThreadPool* thread_pool);
 
+  // Writes the image data and the 'ispe', 'cmpd', 'uncC' (and 'cmpC', 'icef') properties of the item 'ID'.
+  // Compressed tiles are coded in parallel on 'thread_pool' (may be nullptr).
   static Error encode_uncompressed_image(const std::shared_ptr<HeifFile>& heif_file,
+                                         heif_item_id ID,
                                          const std::shared_ptr<HeifPixelImage>& src_image,
                                          void* encoder_struct,
                                          const struct heif_encoding_options& options,
-                                         std::shared_ptr<HeifContext::Image> out_image);
+                                         ThreadPool* thread_pool);
 };
 
+
+// Copies 'width' pixels with 'num_components' interleaved components from 'src' into the
+// component rows 'dst'. With a single component, this is a plain copy of the row.
+// 16-bit samples are converted from the byte order of the file to the native byte order.
+void deinterleave_row(const uint8_t* src, uint8_t* const* dst, uint32_t num_components, uint32_t width,
+                      int bytes_per_sample, bool little_endian);
+
 #endif //LIBHEIF_UNCOMPRESSED_IMAGE_H
@@ -1,18 +1,13 @@
-function StringToArrayBuffer(str) {
-    var buf = new ArrayBuffer(str.length);
-    var bufView = new Uint8Array(buf);
-    for (var i=0, strLen=str.length; i<strLen; i++) {
-        bufView[i] = str.charCodeAt(i);
-    }
-    return buf;
-}
-
 var HeifImage = function(handle) {
     this.handle = handle;
     this.img = null;
 };
 
 HeifImage.prototype.free = function() {
+    if (this.img) {
+        libheif.heif_image_release(this.img.image);
+        this.img = null;
+    }
     if (this.handle) {
         libheif.heif_image_handle_release(this.handle);
         this.handle = null;
@@ -24,15 +19,15 @@ HeifImage.prototype._ensureImage = function() {
         return;
     }
 
-    var img = libheif.heif_js_decode_image(this.handle,
-        libheif.heif_colorspace_YCbCr, libheif.heif_chroma_420);
+    // The color conversion is done by libheif, the result stays in the WASM heap.
+    var img = libheif.heif_js_decode_image_view(this.handle,
+        libheif.heif_colorspace_RGB, libheif.heif_chroma_interleaved_RGBA);
     if (!img || img.code) {
         console.log("Decoding image failed", this.handle, img);
         return;
     }
 
-    this.data = new Uint8Array(StringToArrayBuffer(img.data));
-    delete img.data;
+    delete img.planes;
     this.img = img;
 };
 
@@ -52,7 +47,7 @@ HeifImage.prototype.is_primary = function() {
 }
 
 HeifImage.prototype.display = function(image_data, callback) {
-    // Defer color conversion.
+    // Defer decoding.
     var w = this.get_width();
     var h = this.get_height();
 
@@ -64,54 +59,16 @@ HeifImage.prototype.display = function(image_data, callback) {
             return;
         }
 
-        var yval;
-        var uval;
-        var vval;
-        var xpos = 0;
-        var ypos = 0;
-        var yoffset = 0;
-        var uoffset = 0;
-        var voffset = 0;
-        var x2;
-        var i = 0;
-        var maxi = w*h;
-        var stridey = w;
-        var strideu = Math.ceil(w / 2);
-        var stridev = Math.ceil(w / 2);
-        var h2 = Math.ceil(h / 2);
-        var y = this.data;
-        var u = this.data.subarray(stridey * h, stridey * h + (strideu * h2));
-        var v = this.data.subarray(stridey * h + (strideu * h2), stridey * h + (strideu * h2) + (stridev * h2));
+        // The views have to be requested again, the heap may have grown since decoding.
+        var planes = libheif.heif_js_image_get_planes(this.img.image);
+        var rgba = planes[0];
         var dest = image_data.data;
-        while (i < maxi) {
-            x2 = (xpos >> 1);
-            yval = 1.164 * (y[yoffset + xpos] - 16);
-
-            uval = u[uoffset + x2] - 128;
-            vval = v[voffset + x2] - 128;
-            dest[(i<<2)+0] = yval + 1.596 * vval;
-            dest[(i<<2)+1] = yval - 0.813 * vval - 0.391 * uval;
-            dest[(i<<2)+2] = yval + 2.018 * uval;
-            dest[(i<<2)+3] = 0xff;
-            i++;
-            xpos++;
-
-            if (xpos < w) {
-                yval = 1.164 * (y[yoffset + xpos] - 16);
-                dest[(i<<2)+0] = yval + 1.596 * vval;
-                dest[(i<<2)+1] = yval - 0.813 * vval - 0.391 * uval;
-                dest[(i<<2)+2] = yval + 2.018 * uval;
-                dest[(i<<2)+3] = 0xff;
-                i++;
-                xpos++;
-            }
-
-            if (xpos === w) {
-                xpos = 0;
-                ypos++;
-                yoffset += stridey;
-                uoffset = ((ypos >> 1) * strideu);
-                voffset = ((ypos >> 1) * stridev);
+        var row_size = w * 4;
+        if (rgba.stride === row_size) {
+            dest.set(rgba.data.subarray(0, row_size * h));
+        } else {
+            for (var y = 0; y < h; y++) {
+                dest.set(rgba.data.subarray(y * rgba.stride, y * rgba.stride + row_size), y * row_size);
             }
         }
         callback(image_data);
@@ -19,7 +19,9 @@
  * along with libheif.  If not, see <http://www.gnu.org/licenses/>.
  */
 (function() {
-var Module = {
+// The worker threads of a multithreaded build (USE_WASM_THREADS) load this script after the
+// Emscripten worker has received the shared module and memory in its global "Module".
+var Module = (typeof importScripts === "function" && typeof self !== "undefined" && self.Module) ? self.Module : {
     print: function(text) {
         text = Array.prototype.slice.call(arguments).join(' ');
         console.log(text);
@@ -0,0 +1,293 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Decoding only the alpha channel of images. The uncompressed encoder stores alpha as a component of
+// the image, hence the files with an auxiliary alpha image (single or grid) are built box by box.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+static const int kWidth = 32;
+static const int kHeight = 16;
+
+
+static uint8_t alpha_value(int x, int y)
+{
+  return static_cast<uint8_t>(x * 7 + y);
+}
+
+
+struct Item
+{
+  uint16_t id;
+  const char* type;
+  Bytes data;
+  std::vector<uint8_t> properties; // 1-based indices into ipco, 0x80 marks essential properties
+};
+
+
+// Item 1 is a 32x16 monochrome 'unci' image. Its alpha is either one 'unci' image (item 2)
+// or a 'grid' (item 4) of two 16x16 tiles (items 2 and 3).
+static Bytes create_file(bool alpha_grid)
+{
+  Bytes ispe_full, ispe_tile;
+  put32(ispe_full, kWidth);
+  put32(ispe_full, kHeight);
+  put32(ispe_tile, kWidth / 2);
+  put32(ispe_tile, kHeight);
+
+  Bytes cmpd;
+  put16(cmpd, 1);
+  put16(cmpd, 0); // monochrome
+
+  Bytes uncC;
+  put32(uncC, 0); // profile
+  put16(uncC, 1); // component count
+  put16(uncC, 0); // component index
+  uncC.insert(uncC.end(), {7, 0, 0}); // 8 bit unsigned, no alignment
+  uncC.insert(uncC.end(), {0, 0, 0, 0, 0}); // sampling, interleave, block size, flags, pixel size
+  put32(uncC, 0); // row align
+  put32(uncC, 0); // tile align
+  put32(uncC, 0); // tile columns - 1
+  put32(uncC, 0); // tile rows - 1
+
+  const char aux_type[] = "urn:mpeg:mpegB:cicp:systems:auxiliary:alpha";
+  Bytes auxC(aux_type, aux_type + sizeof(aux_type));
+
+  Bytes ipco = concat({make_full_box("ispe", 0, ispe_full),
+                       make_full_box("ispe", 0, ispe_tile),
+                       make_box("cmpd", cmpd),
+                       make_full_box("uncC", 0, uncC),
+                       make_full_box("auxC", 0, auxC)});
+
+  std::vector<Item> items;
+
+  Bytes color(kWidth * kHeight, 128);
+  items.push_back({1, "unci", color, {1, 3, 4}});
+
+  Bytes iref_content;
+  if (alpha_grid) {
+    for (int tile = 0; tile < 2; tile++) {
+      Bytes data;
+      for (int y = 0; y < kHeight; y++) {
+        for (int x = 0; x < kWidth / 2; x++) {
+          data.push_back(alpha_value(tile * kWidth / 2 + x, y));
+        }
+      }
+      items.push_back({static_cast<uint16_t>(2 + tile), "unci", data, {2, 3, 4}});
+    }
+
+    Bytes grid = {0, 0, 0, 1}; // version, flags, rows - 1, columns - 1
+    put16(grid, kWidth);
+    put16(grid, kHeight);
+    items.push_back({4, "grid", grid, {1, 0x80 | 5}});
+
+    Bytes dimg = {0, 4, 0, 2, 0, 2, 0, 3};
+    iref_content = concat({make_box("auxl", {0, 4, 0, 1, 0, 1}), make_box("dimg", dimg)});
+  }
+  else {
+    Bytes data;
+    for (int y = 0; y < kHeight; y++) {
+      for (int x = 0; x < kWidth; x++) {
+        data.push_back(alpha_value(x, y));
+      }
+    }
+    items.push_back({2, "unci", data, {1, 3, 4, 0x80 | 5}});
+
+    iref_content = make_box("auxl", {0, 2, 0, 1, 0, 1});
+  }
+
+  Bytes hdlr = {0, 0, 0, 0};
+  put_fourcc(hdlr, "pict");
+  hdlr.resize(hdlr.size() + 13);
+
+  Bytes pitm;
+  put16(pitm, 1);
+
+  Bytes iinf;
+  put16(iinf, static_cast<uint32_t>(items.size()));
+
+  // the item data is stored in 'idat' (construction method 1)
+  Bytes iloc = {0x44, 0x00};
+  put16(iloc, static_cast<uint32_t>(items.size()));
+
+  Bytes ipma;
+  put32(ipma, static_cast<uint32_t>(items.size()));
+
+  Bytes idat;
+
+  for (const Item& item : items) {
+    Bytes infe;
+    put16(infe, item.id);
+    put16(infe, 0);
+    put_fourcc(infe, item.type);
+    infe.push_back(0);
+    Bytes infe_box = make_full_box("infe", 2, infe);
+    iinf.insert(iinf.end(), infe_box.begin(), infe_box.end());
+
+    put16(iloc, item.id);
+    put16(iloc, 1); // construction method
+    put16(iloc, 0); // data reference index
+    put16(iloc, 1); // extent count
+    put32(iloc, static_cast<uint32_t>(idat.size()));
+    put32(iloc, static_cast<uint32_t>(item.data.size()));
+    idat.insert(idat.end(), item.data.begin(), item.data.end());
+
+    put16(ipma, item.id);
+    ipma.push_back(static_cast<uint8_t>(item.properties.size()));
+    ipma.insert(ipma.end(), item.properties.begin(), item.properties.end());
+  }
+
+  Bytes meta = concat({make_full_box("hdlr", 0, hdlr),
+                       make_full_box("pitm", 0, pitm),
+                       make_full_box("iinf", 0, iinf),
+                       make_full_box("iloc", 1, iloc),
+                       make_box("idat", idat),
+                       make_box("iprp", concat({make_box("ipco", ipco), make_full_box("ipma", 0, ipma)})),
+                       make_full_box("iref", 0, iref_content)});
+
+  Bytes ftyp;
+  put_fourcc(ftyp, "mif1");
+  put32(ftyp, 0);
+  put_fourcc(ftyp, "mif1");
+
+  return concat({make_box("ftyp", ftyp), make_full_box("meta", 0, meta)});
+}
+
+
+static void check_alpha_decode(bool alpha_grid)
+{
+  Bytes file = create_file(alpha_grid);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_image_handle_has_alpha_channel(handle));
+
+  heif_image* alpha = nullptr;
+  err = heif_decode_alpha_image(handle, &alpha, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(heif_image_get_colorspace(alpha) == heif_colorspace_monochrome);
+  REQUIRE(heif_image_get_chroma_format(alpha) == heif_chroma_monochrome);
+  REQUIRE(heif_image_get_width(alpha, heif_channel_Y) == kWidth);
+  REQUIRE(heif_image_get_height(alpha, heif_channel_Y) == kHeight);
+  REQUIRE(!heif_image_has_channel(alpha, heif_channel_Alpha));
+
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(alpha, heif_channel_Y, &stride);
+  REQUIRE(p != nullptr);
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth; x++) {
+      REQUIRE(p[y * stride + x] == alpha_value(x, y));
+    }
+  }
+
+  // the same samples as in the alpha plane of the fully decoded image
+  heif_image* img = nullptr;
+  err = heif_decode_image(handle, &img, heif_colorspace_monochrome, heif_chroma_monochrome, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int alpha_stride;
+  const uint8_t* a = heif_image_get_plane_readonly(img, heif_channel_Alpha, &alpha_stride);
+  REQUIRE(a != nullptr);
+  for (int y = 0; y < kHeight; y++) {
+    REQUIRE(memcmp(a + y * alpha_stride, p + y * stride, kWidth) == 0);
+  }
+
+  heif_image_release(img);
+  heif_image_release(alpha);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("alpha only decoding")
+{
+  check_alpha_decode(false);
+}
+
+
+TEST_CASE("alpha only decoding of grid alpha images")
+{
+  check_alpha_decode(true);
+}
+
+
+
+TEST_CASE("alpha only decoding without alpha channel")
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = nullptr;
+  err = heif_image_create(16, 16, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_Y, 16, 16, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_release(img);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+
+  ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* alpha = nullptr;
+  err = heif_decode_alpha_image(handle, &alpha, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(err.subcode == heif_suberror_Nonexisting_image_channel_referenced);
+  REQUIRE(alpha == nullptr);
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
@@ -0,0 +1,1030 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Stress tests for decoding from many threads at the same time (the C++ counterpart of test-race.go).
+// They check the decoded pixels, but data races are only found reliably when libheif and the tests
+// are built with the thread sanitizer (see the 'develop-tsan' preset in CMakePresets.json).
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+static const int kNumThreads = 8;
+static const int kNumRounds = 4;
+
+
+struct TestImage
+{
+  int width;
+  int height;
+  bool grid;
+  bool alpha;
+};
+
+static const TestImage kTestImages[] = {
+    {64, 48, false, false},
+    {100, 70, true, false},
+    {33, 17, false, true},
+    {96, 64, true, true},
+    {128, 40, true, false},
+    {20, 20, false, false},
+};
+
+
+static uint8_t get_sample(int image_idx, int x, int y, int c)
+{
+  return static_cast<uint8_t>(image_idx * 37 + x * 3 + y * 5 + c * 61);
+}
+
+
+// Monochrome images (with alpha) are decoded to RGB with exactly the gray values.
+// (RGB input would be written with an invalid 'pixi' box by heif_context_encode_grid().)
+static heif_image* create_image(int image_idx, const TestImage& desc)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(desc.width, desc.height, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_channel channels[] = {heif_channel_Y, heif_channel_Alpha};
+  int num_channels = desc.alpha ? 2 : 1;
+
+  for (int c = 0; c < num_channels; c++) {
+    err = heif_image_add_plane(img, channels[c], desc.width, desc.height, 8);
+    REQUIRE(err.code == heif_error_Ok);
+
+    int stride;
+    uint8_t* data = heif_image_get_plane(img, channels[c], &stride);
+    for (int y = 0; y < desc.height; y++) {
+      for (int x = 0; x < desc.width; x++) {
+        data[y * stride + x] = get_sample(image_idx, x, y, c);
+      }
+    }
+  }
+
+  return img;
+}
+
+
+
+// A file with all kTestImages as top-level images, coded with the uncompressed codec.
+static std::vector<uint8_t> create_test_file()
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  for (size_t i = 0; i < sizeof(kTestImages) / sizeof(kTestImages[0]); i++) {
+    const TestImage& desc = kTestImages[i];
+    heif_image* img = create_image(static_cast<int>(i), desc);
+
+    if (desc.grid) {
+      err = heif_context_encode_grid(ctx, img, 32, 32, encoder, nullptr, nullptr);
+    }
+    else {
+      err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+    }
+    REQUIRE(err.code == heif_error_Ok);
+
+    heif_image_release(img);
+  }
+
+  heif_encoder_release(encoder);
+
+  std::vector<uint8_t> data;
+  heif_writer writer{};
+  writer.writer_api_version = 1;
+  writer.write = write_to_vector;
+
+  err = heif_context_write(ctx, &writer, &data);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_context_free(ctx);
+
+  return data;
+}
+
+
+// Compare the decoded image with the input of create_image(). Returns false on any difference.
+// Must not use the Catch assertions, because it runs on several threads.
+static bool check_image(const heif_image* img, int image_idx, heif_chroma chroma)
+{
+  const TestImage& desc = kTestImages[image_idx];
+
+  bool ok = (heif_image_get_primary_width(img) == desc.width &&
+             heif_image_get_primary_height(img) == desc.height);
+
+  if (ok && chroma == heif_chroma_444) {
+    // planar RGB(A): the gray value in all color planes
+    heif_channel channels[] = {heif_channel_R, heif_channel_G, heif_channel_B, heif_channel_Alpha};
+    int num_channels = desc.alpha ? 4 : 3;
+
+    for (int c = 0; c < num_channels && ok; c++) {
+      int stride;
+      const uint8_t* data = heif_image_get_plane_readonly(img, channels[c], &stride);
+      ok = (data != nullptr);
+
+      for (int y = 0; y < desc.height && ok; y++) {
+        for (int x = 0; x < desc.width; x++) {
+          if (data[y * stride + x] != get_sample(image_idx, x, y, c < 3 ? 0 : 1)) {
+            ok = false;
+            break;
+          }
+        }
+      }
+    }
+  }
+  else if (ok) {
+    // interleaved RGB(A): the gray value in all color components
+    int num_components = (chroma == heif_chroma_interleaved_RGBA ? 4 : 3);
+    int stride;
+    const uint8_t* data = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+    ok = (data != nullptr);
+
+    for (int y = 0; y < desc.height && ok; y++) {
+      for (int x = 0; x < desc.width && ok; x++) {
+        for (int c = 0; c < num_components; c++) {
+          uint8_t expected;
+          if (c < 3) {
+            expected = get_sample(image_idx, x, y, 0);
+          }
+          else {
+            expected = desc.alpha ? get_sample(image_idx, x, y, 1) : 0xFF;
+          }
+
+          if (data[y * stride + x * num_components + c] != expected) {
+            ok = false;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  return ok;
+}
+
+
+// Decode the image and compare it with the input of create_image(). Returns false on any difference.
+static bool decode_and_check(heif_context* ctx, heif_item_id id, int image_idx, heif_chroma chroma,
+                             const heif_decoding_options* options = nullptr)
+{
+  heif_image_handle* handle = nullptr;
+  heif_error err = heif_context_get_image_handle(ctx, id, &handle);
+  if (err.code != heif_error_Ok) {
+    return false;
+  }
+
+  heif_image* img = nullptr;
+  err = heif_decode_image(handle, &img, heif_colorspace_RGB, chroma, options);
+  heif_image_handle_release(handle);
+  if (err.code != heif_error_Ok) {
+    return false;
+  }
+
+  bool ok = check_image(img, image_idx, chroma);
+
+  heif_image_release(img);
+  return ok;
+}
+
+
+static std::vector<heif_item_id> get_image_ids(heif_context* ctx)
+{
+  int num_images = heif_context_get_number_of_top_level_images(ctx);
+  REQUIRE(num_images == static_cast<int>(sizeof(kTestImages) / sizeof(kTestImages[0])));
+
+  std::vector<heif_item_id> ids(num_images);
+  heif_context_get_list_of_top_level_image_IDs(ctx, ids.data(), num_images);
+
+  return ids;
+}
+
+
+TEST_CASE("concurrent decoding of different images of one context")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> ids = get_image_ids(ctx);
+
+  const heif_chroma chromas[] = {heif_chroma_interleaved_RGB, heif_chroma_interleaved_RGBA, heif_chroma_444};
+
+  std::atomic<int> num_failures{0};
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int round = 0; round < kNumRounds; round++) {
+        // Each thread starts with a different image, so that all images are decoded at the same time.
+        for (size_t i = 0; i < ids.size(); i++) {
+          int image_idx = static_cast<int>((i + t) % ids.size());
+          heif_chroma chroma = chromas[(t + round) % 3];
+
+          if (!decode_and_check(ctx, ids[image_idx], image_idx, chroma)) {
+            num_failures++;
+          }
+        }
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  REQUIRE(num_failures == 0);
+
+  heif_context_free(ctx);
+  heif_deinit();
+}
+
+
+TEST_CASE("concurrent decoding with contexts that share an engine")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  heif_engine* engine = heif_engine_alloc(nullptr);
+
+  std::atomic<int> num_failures{0};
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (int round = 0; round < kNumRounds; round++) {
+        heif_context* ctx = heif_context_alloc();
+        heif_context_attach_to_engine(ctx, engine);
+
+        heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+        if (err.code != heif_error_Ok) {
+          num_failures++;
+          heif_context_free(ctx);
+          continue;
+        }
+
+        int num_images = heif_context_get_number_of_top_level_images(ctx);
+        std::vector<heif_item_id> ids(num_images);
+        heif_context_get_list_of_top_level_image_IDs(ctx, ids.data(), num_images);
+
+        for (int i = 0; i < num_images; i++) {
+          int image_idx = (i + t) % num_images;
+          if (!decode_and_check(ctx, ids[image_idx], image_idx, heif_chroma_interleaved_RGB)) {
+            num_failures++;
+          }
+        }
+
+        heif_context_free(ctx);
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  REQUIRE(num_failures == 0);
+
+  heif_engine_free(engine);
+  heif_deinit();
+}
+
+
+TEST_CASE("decoding grid images into a file-backed canvas")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> ids = get_image_ids(ctx);
+
+  heif_decoding_options* options = heif_decoding_options_alloc();
+  options->canvas_file_directory = ".";
+
+  const heif_chroma chromas[] = {heif_chroma_interleaved_RGB, heif_chroma_interleaved_RGBA, heif_chroma_444};
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    if (!kTestImages[i].grid) {
+      continue;
+    }
+
+    for (heif_chroma chroma : chromas) {
+      REQUIRE(decode_and_check(ctx, ids[i], static_cast<int>(i), chroma, options));
+    }
+  }
+
+  // the canvas does not count as image memory
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_image_handle(ctx, ids[1], &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_decoding_memory_estimate estimate{};
+  err = heif_image_handle_estimate_decoding_memory(handle, heif_chroma_interleaved_RGB, options, &estimate);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(estimate.image_bytes == 0);
+  REQUIRE(estimate.output_bytes == 0);
+  REQUIRE(estimate.peak_bytes > 0);
+
+  err = heif_image_handle_estimate_decoding_memory(handle, heif_chroma_interleaved_RGB, nullptr, &estimate);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(estimate.image_bytes == 100 * 70 * 3);
+
+  heif_image_handle_release(handle);
+
+  // the canvas cannot be created
+  options->canvas_file_directory = "nonexistent-directory";
+  REQUIRE(!decode_and_check(ctx, ids[1], 1, heif_chroma_interleaved_RGB, options));
+
+  heif_decoding_options_free(options);
+  heif_context_free(ctx);
+  heif_deinit();
+}
+
+
+struct BandResult
+{
+  int image_idx;
+  int next_row = 0;
+  int num_bands = 0;
+  int num_failures = 0;
+};
+
+
+static heif_error check_band(const heif_image* band, int y, void* userdata)
+{
+  auto* result = static_cast<BandResult*>(userdata);
+  const TestImage& desc = kTestImages[result->image_idx];
+
+  result->num_bands++;
+
+  int height = heif_image_get_primary_height(band);
+  if (y != result->next_row || heif_image_get_primary_width(band) != desc.width || height <= 0) {
+    result->num_failures++;
+    return {heif_error_Usage_error, heif_suberror_Unspecified, "Unexpected band"};
+  }
+
+  int stride;
+  const uint8_t* data = heif_image_get_plane_readonly(band, heif_channel_interleaved, &stride);
+
+  for (int by = 0; by < height; by++) {
+    for (int x = 0; x < desc.width; x++) {
+      if (data[by * stride + x * 3] != get_sample(result->image_idx, x, y + by, 0)) {
+        result->num_failures++;
+        return {heif_error_Usage_error, heif_suberror_Unspecified, "Wrong band content"};
+      }
+    }
+  }
+
+  result->next_row = y + height;
+
+  return {heif_error_Ok, heif_suberror_Unspecified, "Success"};
+}
+
+
+static heif_error stop_decoding(const heif_image*, int, void*)
+{
+  return {heif_error_Usage_error, heif_suberror_Unspecified, "Stopped"};
+}
+
+
+TEST_CASE("decoding in bands")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> ids = get_image_ids(ctx);
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    const TestImage& desc = kTestImages[i];
+
+    heif_image_handle* handle = nullptr;
+    err = heif_context_get_image_handle(ctx, ids[i], &handle);
+    REQUIRE(err.code == heif_error_Ok);
+
+    BandResult result;
+    result.image_idx = static_cast<int>(i);
+
+    err = heif_decode_image_in_bands(handle, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr,
+                                     check_band, &result);
+    REQUIRE(err.code == heif_error_Ok);
+    REQUIRE(result.num_failures == 0);
+    REQUIRE(result.next_row == desc.height);
+
+    // grids are delivered in rows of 32x32 tiles
+    if (desc.grid) {
+      REQUIRE(result.num_bands == (desc.height + 31) / 32);
+    }
+
+    err = heif_decode_image_in_bands(handle, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr,
+                                     stop_decoding, nullptr);
+    REQUIRE(err.code == heif_error_Usage_error);
+
+    heif_image_handle_release(handle);
+  }
+
+  heif_context_free(ctx);
+  heif_deinit();
+}
+
+
+struct BandSource
+{
+  int image_idx;
+  int next_row = 0;
+  int num_failures = 0;
+};
+
+
+// Cuts the bands out of the image created by create_image().
+static heif_error get_band(int y, int height, heif_image** out_band, void* userdata)
+{
+  auto* source = static_cast<BandSource*>(userdata);
+  const TestImage& desc = kTestImages[source->image_idx];
+
+  if (y != source->next_row || height != std::min(32, desc.height - y)) {
+    source->num_failures++;
+  }
+  source->next_row = y + height;
+
+  heif_image* img = create_image(source->image_idx, desc);
+
+  int stride;
+  const uint8_t* src = heif_image_get_plane_readonly(img, heif_channel_Y, &stride);
+
+  heif_image* band = nullptr;
+  heif_image_create(desc.width, height, heif_colorspace_monochrome, heif_chroma_monochrome, &band);
+  heif_image_add_plane(band, heif_channel_Y, desc.width, height, 8);
+
+  int band_stride;
+  uint8_t* dst = heif_image_get_plane(band, heif_channel_Y, &band_stride);
+  for (int by = 0; by < height; by++) {
+    memcpy(dst + by * band_stride, src + (y + by) * stride, desc.width);
+  }
+
+  heif_image_release(img);
+
+  *out_band = band;
+  return {heif_error_Ok, heif_suberror_Unspecified, "Success"};
+}
+
+
+static heif_error fail_band(int, int, heif_image** out_band, void*)
+{
+  *out_band = nullptr;
+  return {heif_error_Usage_error, heif_suberror_Unspecified, "No data"};
+}
+
+
+TEST_CASE("encoding a grid from bands")
+{
+  heif_init(nullptr);
+
+  const int image_idx = 1;
+  const TestImage& desc = kTestImages[image_idx];
+  REQUIRE(!desc.alpha);
+
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  BandSource source;
+  source.image_idx = image_idx;
+
+  err = heif_context_encode_grid_from_bands(ctx, desc.width, desc.height, 32, 32, encoder, nullptr,
+                                            get_band, &source, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(source.num_failures == 0);
+  REQUIRE(source.next_row == desc.height);
+
+  err = heif_context_encode_grid_from_bands(ctx, desc.width, desc.height, 32, 32, encoder, nullptr,
+                                            fail_band, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+
+  heif_encoder_release(encoder);
+
+  std::vector<uint8_t> data;
+  heif_writer writer{};
+  writer.writer_api_version = 1;
+  writer.write = write_to_vector;
+
+  err = heif_context_write(ctx, &writer, &data);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_context_free(ctx);
+
+  ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(ctx, data.data(), data.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_context_get_number_of_top_level_images(ctx) == 1);
+
+  heif_item_id id;
+  heif_context_get_list_of_top_level_image_IDs(ctx, &id, 1);
+  REQUIRE(decode_and_check(ctx, id, image_idx, heif_chroma_interleaved_RGB));
+
+  heif_context_free(ctx);
+  heif_deinit();
+}
+
+
+// The callback calls are serialized by heif_decode_images().
+struct BatchResult
+{
+  std::vector<int> num_calls;
+  int num_failures = 0;
+};
+
+
+static void check_batch_image(int index, heif_image* img, heif_error err, void* userdata)
+{
+  auto* result = static_cast<BatchResult*>(userdata);
+  result->num_calls[index]++;
+
+  if (err.code != heif_error_Ok || img == nullptr) {
+    result->num_failures++;
+    return;
+  }
+
+  const TestImage& desc = kTestImages[index];
+  int stride;
+  const uint8_t* data = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+
+  for (int y = 0; y < desc.height; y++) {
+    for (int x = 0; x < desc.width; x++) {
+      if (data[y * stride + x * 3] != get_sample(index, x, y, 0)) {
+        result->num_failures++;
+        heif_image_release(img);
+        return;
+      }
+    }
+  }
+
+  heif_image_release(img);
+}
+
+
+TEST_CASE("batch decoding of all top-level images")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> ids = get_image_ids(ctx);
+
+  std::vector<heif_image_handle*> handles;
+  for (heif_item_id id : ids) {
+    heif_image_handle* handle = nullptr;
+    err = heif_context_get_image_handle(ctx, id, &handle);
+    REQUIRE(err.code == heif_error_Ok);
+    handles.push_back(handle);
+  }
+
+  BatchResult result;
+  result.num_calls.resize(ids.size());
+
+  err = heif_decode_images(handles.data(), static_cast<int>(handles.size()), heif_colorspace_RGB,
+                           heif_chroma_interleaved_RGB, nullptr, check_batch_image, &result);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(result.num_failures == 0);
+  for (int n : result.num_calls) {
+    REQUIRE(n == 1);
+  }
+
+  for (auto* handle : handles) {
+    heif_image_handle_release(handle);
+  }
+
+  heif_context_free(ctx);
+  heif_deinit();
+}
+
+
+TEST_CASE("concurrent decoding with different priorities")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> ids = get_image_ids(ctx);
+
+  std::atomic<int> num_failures{0};
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      heif_decoding_options* options = heif_decoding_options_alloc();
+      options->priority = static_cast<heif_decoding_priority>(t % 6);
+
+      for (int round = 0; round < kNumRounds; round++) {
+        for (size_t i = 0; i < ids.size(); i++) {
+          int image_idx = static_cast<int>((i + t) % ids.size());
+          if (!decode_and_check(ctx, ids[image_idx], image_idx, heif_chroma_interleaved_RGB, options)) {
+            num_failures++;
+          }
+        }
+      }
+
+      heif_decoding_options_free(options);
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  REQUIRE(num_failures == 0);
+
+  heif_context_free(ctx);
+  heif_deinit();
+}
+
+
+// A minimal executor of an application: a task queue that is processed by its own threads.
+class TestExecutor
+{
+public:
+  explicit TestExecutor(int num_threads)
+  {
+    for (int i = 0; i < num_threads; i++) {
+      m_threads.emplace_back([this]() {
+        std::function<void()> task;
+        while (next_task(true, task)) {
+          task();
+        }
+      });
+    }
+  }
+
+  ~TestExecutor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_shutdown = true;
+    }
+    m_cond.notify_all();
+
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  heif_executor get_executor(bool with_wait)
+  {
+    heif_executor executor{};
+    executor.version = 1;
+    executor.userdata = this;
+    executor.submit = submit;
+    executor.wait = with_wait ? wait : nullptr;
+    executor.concurrency = static_cast<int>(m_threads.size());
+    return executor;
+  }
+
+  std::atomic<int> num_tasks{0};
+  std::atomic<int> num_waits{0};
+
+private:
+  static void submit(void* userdata, void (* task)(void*), void* task_data)
+  {
+    auto* executor = static_cast<TestExecutor*>(userdata);
+    executor->num_tasks++;
+
+    {
+      std::lock_guard<std::mutex> lock(executor->m_mutex);
+      executor->m_tasks.push_back([task, task_data]() { task(task_data); });
+    }
+    executor->m_cond.notify_one();
+  }
+
+  // runs other tasks while waiting, like a work-stealing scheduler
+  static void wait(void* userdata, int (* is_finished)(void*), void* finished_data)
+  {
+    auto* executor = static_cast<TestExecutor*>(userdata);
+    executor->num_waits++;
+
+    while (!is_finished(finished_data)) {
+      std::function<void()> task;
+      if (executor->next_task(false, task)) {
+        task();
+      }
+      else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  bool next_task(bool block, std::function<void()>& task)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (block) {
+      m_cond.wait(lock, [this]() { return m_shutdown || !m_tasks.empty(); });
+    }
+
+    if (m_tasks.empty()) {
+      return false;
+    }
+
+    task = std::move(m_tasks.front());
+    m_tasks.pop_front();
+    return true;
+  }
+
+  std::vector<std::thread> m_threads;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  bool m_shutdown = false;
+};
+
+
+TEST_CASE("decoding on an executor of the application")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  for (bool with_wait : {false, true}) {
+    TestExecutor test_executor(3);
+    heif_executor executor = test_executor.get_executor(with_wait);
+
+    heif_context* ctx = heif_context_alloc();
+    heif_error err = heif_context_set_executor(ctx, &executor);
+    REQUIRE(err.code == heif_error_Ok);
+
+    err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+    REQUIRE(err.code == heif_error_Ok);
+
+    std::vector<heif_item_id> ids = get_image_ids(ctx);
+
+    std::atomic<int> num_failures{0};
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&, t]() {
+        for (size_t i = 0; i < ids.size(); i++) {
+          int image_idx = static_cast<int>((i + t) % ids.size());
+          if (!decode_and_check(ctx, ids[image_idx], image_idx, heif_chroma_interleaved_RGB)) {
+            num_failures++;
+          }
+        }
+      });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    REQUIRE(num_failures == 0);
+    REQUIRE(test_executor.num_tasks > 0);
+    if (with_wait) {
+      REQUIRE(test_executor.num_waits > 0);
+    }
+
+    heif_context_free(ctx);
+  }
+
+  heif_deinit();
+}
+
+
+// Collects the results of heif_decode_image_async() and lets the test wait for them.
+struct AsyncResults
+{
+  std::mutex mutex;
+  std::condition_variable cond;
+  int num_finished = 0;
+  int num_failures = 0;
+  int num_canceled = 0;
+
+  void wait_for(int num)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this, num]() { return num_finished >= num; });
+  }
+};
+
+
+struct AsyncDecoding
+{
+  AsyncResults* results;
+  int image_idx;
+};
+
+
+static void async_decoding_finished(heif_image* img, heif_error err, void* userdata)
+{
+  auto* decoding = static_cast<AsyncDecoding*>(userdata);
+  AsyncResults* results = decoding->results;
+
+  bool ok = (err.code == heif_error_Ok && check_image(img, decoding->image_idx, heif_chroma_interleaved_RGBA));
+  heif_image_release(img);
+
+  std::lock_guard<std::mutex> lock(results->mutex);
+  if (err.code == heif_error_Canceled) {
+    results->num_canceled++;
+  }
+  else if (!ok) {
+    results->num_failures++;
+  }
+
+  results->num_finished++;
+  results->cond.notify_all();
+}
+
+
+static void decode_async(heif_context* ctx, heif_item_id id, AsyncDecoding* decoding,
+                         heif_decoding_request** out_request = nullptr)
+{
+  heif_image_handle* handle = nullptr;
+  heif_error err = heif_context_get_image_handle(ctx, id, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_decode_image_async(handle, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, nullptr,
+                                async_decoding_finished, decoding, out_request);
+  REQUIRE(err.code == heif_error_Ok);
+
+  // the decoding keeps running without the handle
+  heif_image_handle_release(handle);
+}
+
+
+TEST_CASE("asynchronous decoding")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_context_set_max_decoding_threads(ctx, 3);
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> ids = get_image_ids(ctx);
+
+  AsyncResults results;
+  std::vector<AsyncDecoding> decodings(ids.size());
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    decodings[i] = AsyncDecoding{&results, static_cast<int>(i)};
+    decode_async(ctx, ids[i], &decodings[i]);
+  }
+
+  results.wait_for(static_cast<int>(ids.size()));
+  REQUIRE(results.num_failures == 0);
+  REQUIRE(results.num_canceled == 0);
+
+  // without threads, the image is decoded before the function returns
+  heif_context_set_max_decoding_threads(ctx, 0);
+
+  AsyncResults sync_results;
+  AsyncDecoding sync_decoding{&sync_results, 1};
+  decode_async(ctx, ids[1], &sync_decoding);
+  REQUIRE(sync_results.num_finished == 1);
+  REQUIRE(sync_results.num_failures == 0);
+
+  heif_context_free(ctx);
+  heif_deinit();
+}
+
+
+// An executor whose tasks only run when the test calls run_all(), such that the test controls
+// when the decoding happens.
+class ManualExecutor
+{
+public:
+  heif_executor get_executor()
+  {
+    heif_executor executor{};
+    executor.version = 1;
+    executor.userdata = this;
+    executor.submit = submit;
+    executor.concurrency = 1;
+    return executor;
+  }
+
+  void run_all()
+  {
+    while (!m_tasks.empty()) {
+      std::function<void()> task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+      task();
+    }
+  }
+
+private:
+  static void submit(void* userdata, void (* task)(void*), void* task_data)
+  {
+    auto* executor = static_cast<ManualExecutor*>(userdata);
+    executor->m_tasks.push_back([task, task_data]() { task(task_data); });
+  }
+
+  std::deque<std::function<void()>> m_tasks;
+};
+
+
+TEST_CASE("canceling an asynchronous decoding")
+{
+  heif_init(nullptr);
+
+  std::vector<uint8_t> file = create_test_file();
+
+  ManualExecutor manual_executor;
+  heif_executor executor = manual_executor.get_executor();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_set_executor(ctx, &executor);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> ids = get_image_ids(ctx);
+
+  // a grid image, decoded on the executor
+  AsyncResults results;
+  AsyncDecoding decoding{&results, 3};
+  heif_decoding_request* request = nullptr;
+  decode_async(ctx, ids[3], &decoding, &request);
+  REQUIRE(request != nullptr);
+  REQUIRE(results.num_finished == 0);
+
+  manual_executor.run_all();
+  REQUIRE(results.num_finished == 1);
+  REQUIRE(results.num_failures == 0);
+  REQUIRE(results.num_canceled == 0);
+
+  // canceling after the decoding has finished has no effect
+  heif_decoding_request_cancel(request);
+  heif_decoding_request_release(request);
+
+  // canceled before the decoding has started
+  AsyncResults canceled_results;
+  AsyncDecoding canceled_decoding{&canceled_results, 3};
+  decode_async(ctx, ids[3], &canceled_decoding, &request);
+  heif_decoding_request_cancel(request);
+  heif_decoding_request_release(request);
+
+  manual_executor.run_all();
+  REQUIRE(canceled_results.num_finished == 1);
+  REQUIRE(canceled_results.num_canceled == 1);
+
+  heif_context_free(ctx);
+  heif_deinit();
+}
@@ -24,10 +24,24 @@
   SOFTWARE.
 */
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iomanip>
+#include <random>
 #include "catch.hpp"
 #include "libheif/color-conversion/colorconversion.h"
+#include "libheif/color-conversion/rgb_float.h"
+#include "libheif/color-conversion/yuv2rgb_simd.h"
+#include "libheif/color-conversion/rgb2yuv_simd.h"
+#include "libheif/color-conversion/chroma_sampling_simd.h"
+#include "libheif/common_utils.h"
+#include "libheif/color-conversion/alpha.h"
 #include "libheif/pixelimage.h"
+#include "libheif/statistics.h"
+#include "libheif/image_blending.h"
+#include "libheif/image_rotation.h"
+#include "libheif/image_scaling.h"
 
 // Enable for more verbose test output.
 #define DEBUG_ME 0
@@ -74,7 +88,7 @@ std::string PrintChannel(const HeifPixelImage& image, heif_channel channel) {
   int max_rows = 10;
   int width = std::min(image.get_width(channel), max_cols);
   int height = std::min(image.get_height(channel), max_rows);
-  int stride;
+  size_t stride;
   const T* p = (T*)image.get_plane(channel, &stride);
   stride /= sizeof(T);
   int bpp = image.get_bits_per_pixel(channel);
@@ -122,8 +136,8 @@ double GetPsnr(const HeifPixelImage& original, const HeifPixelImage& compressed,
   int h = original.get_height(channel);
   heif_chroma chroma = original.get_chroma_format();
 
-  int orig_stride;
-  int compressed_stride;
+  size_t orig_stride;
+  size_t compressed_stride;
   const T* orig_p = (T*)original.get_plane(channel, &orig_stride);
   const T* compressed_p = (T*)compressed.get_plane(channel, &compressed_stride);
   orig_stride /= sizeof(T);
@@ -274,7 +288,7 @@ void TestConversion(const std::string& test_name, const ColorState& input_state,
   CHECK(out_image->has_alpha() == target_state.has_alpha);
   for (const Plane& plane : GetPlanes(target_state, width, height)) {
     INFO("Channel: " << plane.channel);
-    int stride;
+    size_t stride;
     CHECK(out_image->get_plane(plane.channel, &stride) != nullptr);
     CHECK(out_image->get_bits_per_pixel(plane.channel) ==
           target_state.bits_per_pixel);
@@ -502,7 +516,7 @@ static void fill_plane(std::shared_ptr<HeifPixelImage>& img, heif_channel channe
 {
   img->add_plane(channel, w, h, 8);
 
-  int stride;
+  size_t stride;
   uint8_t* p = img->get_plane(channel, &stride);
 
   for (int y = 0; y < h; y++) {
@@ -518,7 +532,7 @@ static void assert_plane(std::shared_ptr<HeifPixelImage>& img, heif_channel chan
   int w = img->get_width(channel);
   int h = img->get_height(channel);
 
-  int stride;
+  size_t stride;
   uint8_t* p = img->get_plane(channel, &stride);
 
   for (int y = 0; y < h; y++) {
@@ -565,3 +579,1343 @@ TEST_CASE("Bilinear upsampling", "[heif_image]")
                    50, 38, 13, 0
                });
 }
+
+
+TEST_CASE("Semi-planar output", "[heif_image]")
+{
+  heif_color_conversion_options options = {
+      .preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average,
+      .preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear,
+      .only_use_preferred_chroma_algorithm = false};
+
+  std::shared_ptr<HeifPixelImage> img = std::make_shared<HeifPixelImage>();
+  img->create(3, 3, heif_colorspace_YCbCr, heif_chroma_420);
+
+  fill_plane(img, heif_channel_Y, 3, 3,
+             {1, 2, 3,
+              4, 5, 6,
+              7, 8, 9});
+  fill_plane(img, heif_channel_Cb, 2, 2,
+             {10, 20,
+              30, 40});
+  fill_plane(img, heif_channel_Cr, 2, 2,
+             {50, 60,
+              70, 80});
+
+  std::shared_ptr<HeifPixelImage> nv12 = convert_colorspace(img, heif_colorspace_YCbCr, heif_chroma_420_NV12, nullptr, 8, options);
+  REQUIRE(nv12 != nullptr);
+  REQUIRE(nv12->get_chroma_format() == heif_chroma_420_NV12);
+  REQUIRE(!nv12->has_channel(heif_channel_Cb));
+  REQUIRE(nv12->get_width(heif_channel_interleaved) == 2);
+  REQUIRE(nv12->get_height(heif_channel_interleaved) == 2);
+  assert_plane(nv12, heif_channel_Y,
+               {1, 2, 3,
+                4, 5, 6,
+                7, 8, 9});
+
+  size_t stride;
+  const uint8_t* p = nv12->get_plane(heif_channel_interleaved, &stride);
+  REQUIRE(std::vector<uint8_t>(p, p + 4) == std::vector<uint8_t>{10, 50, 20, 60});
+  REQUIRE(std::vector<uint8_t>(p + stride, p + stride + 4) == std::vector<uint8_t>{30, 70, 40, 80});
+
+  std::shared_ptr<HeifPixelImage> nv21 = convert_colorspace(img, heif_colorspace_YCbCr, heif_chroma_420_NV21, nullptr, 8, options);
+  REQUIRE(nv21 != nullptr);
+  p = nv21->get_plane(heif_channel_interleaved, &stride);
+  REQUIRE(std::vector<uint8_t>(p, p + 4) == std::vector<uint8_t>{50, 10, 60, 20});
+
+  // P010 stores the samples in the upper bits
+  std::shared_ptr<HeifPixelImage> p010 = convert_colorspace(img, heif_colorspace_YCbCr, heif_chroma_420_P010, nullptr, 10, options);
+  REQUIRE(p010 != nullptr);
+  REQUIRE(p010->get_bits_per_pixel(heif_channel_Y) == 10);
+  const auto* y16 = (const uint16_t*) p010->get_plane(heif_channel_Y, &stride);
+  REQUIRE(y16[0] == (1 << 2) << 6);
+  const auto* uv16 = (const uint16_t*) p010->get_plane(heif_channel_interleaved, &stride);
+  REQUIRE(uv16[0] == (10 << 2) << 6);
+  REQUIRE(uv16[1] == (50 << 2) << 6);
+
+  // and back to planar 4:2:0
+  std::shared_ptr<HeifPixelImage> planar = convert_colorspace(nv21, heif_colorspace_YCbCr, heif_chroma_420, nullptr, 8, options);
+  REQUIRE(planar != nullptr);
+  assert_plane(planar, heif_channel_Cb, {10, 20, 30, 40});
+  assert_plane(planar, heif_channel_Cr, {50, 60, 70, 80});
+}
+
+
+TEST_CASE("Monochrome to interleaved RGB", "[heif_image]")
+{
+  heif_color_conversion_options options = {
+      .preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average,
+      .preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear,
+      .only_use_preferred_chroma_algorithm = false};
+
+  // wide enough for the SIMD kernels and a scalar remainder
+  const int width = 37;
+
+  std::vector<uint8_t> luma(width * 2), alpha(width * 2);
+  for (int i = 0; i < width * 2; i++) {
+    luma[i] = static_cast<uint8_t>(i * 7);
+    alpha[i] = static_cast<uint8_t>(255 - i);
+  }
+  luma[0] = 16;
+  luma[1] = 235;
+  luma[2] = 126;
+  luma[3] = 0;
+
+  std::shared_ptr<HeifPixelImage> img = std::make_shared<HeifPixelImage>();
+  img->create(width, 2, heif_colorspace_monochrome, heif_chroma_monochrome);
+  fill_plane(img, heif_channel_Y, width, 2, luma);
+
+  std::shared_ptr<HeifPixelImage> rgb = convert_colorspace(img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr, 8, options);
+  REQUIRE(rgb != nullptr);
+
+  size_t stride;
+  const uint8_t* p = rgb->get_plane(heif_channel_interleaved, &stride);
+  for (int y = 0; y < 2; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < 3; c++) {
+        REQUIRE(p[y * stride + 3 * x + c] == luma[y * width + x]);
+      }
+    }
+  }
+
+  // limited range is expanded, alpha is merged
+  auto nclx = std::make_shared<color_profile_nclx>();
+  nclx->set_full_range_flag(false);
+  img->set_color_profile_nclx(nclx);
+  fill_plane(img, heif_channel_Alpha, width, 2, alpha);
+
+  std::shared_ptr<HeifPixelImage> rgba = convert_colorspace(img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, nullptr, 8, options);
+  REQUIRE(rgba != nullptr);
+
+  p = rgba->get_plane(heif_channel_interleaved, &stride);
+  REQUIRE(std::vector<uint8_t>(p, p + 16) == std::vector<uint8_t>{0, 0, 0, 255, 255, 255, 255, 254,
+                                                                  128, 128, 128, 253, 0, 0, 0, 252});
+  for (int y = 0; y < 2; y++) {
+    for (int x = 0; x < width; x++) {
+      int e = std::min(std::max(luma[y * width + x] - 16, 0), 219);
+      int expected = std::min((e * 299 + 128) >> 8, 255);
+      REQUIRE(p[y * stride + 4 * x + 0] == expected);
+      REQUIRE(p[y * stride + 4 * x + 2] == expected);
+      REQUIRE(p[y * stride + 4 * x + 3] == alpha[y * width + x]);
+    }
+  }
+
+  // 10 bit, without an input alpha plane
+  std::shared_ptr<HeifPixelImage> hdr = std::make_shared<HeifPixelImage>();
+  hdr->create(width, 1, heif_colorspace_monochrome, heif_chroma_monochrome);
+  REQUIRE(hdr->add_plane(heif_channel_Y, width, 1, 10));
+  auto* y16 = (uint16_t*) hdr->get_plane(heif_channel_Y, &stride);
+  for (int x = 0; x < width; x++) {
+    y16[x] = static_cast<uint16_t>(x * 27);
+  }
+
+  std::shared_ptr<HeifPixelImage> rrggbbaa = convert_colorspace(hdr, heif_colorspace_RGB, heif_chroma_interleaved_RRGGBBAA_BE, nullptr, 10, options);
+  REQUIRE(rrggbbaa != nullptr);
+  REQUIRE(rrggbbaa->get_bits_per_pixel(heif_channel_interleaved) == 10);
+
+  p = rrggbbaa->get_plane(heif_channel_interleaved, &stride);
+  for (int x = 0; x < width; x++) {
+    for (int c = 0; c < 3; c++) {
+      REQUIRE(((p[8 * x + 2 * c] << 8) | p[8 * x + 2 * c + 1]) == x * 27);
+    }
+    REQUIRE(((p[8 * x + 6] << 8) | p[8 * x + 7]) == 1023);
+  }
+
+  hdr->set_color_profile_nclx(nclx);
+  std::shared_ptr<HeifPixelImage> rrggbb = convert_colorspace(hdr, heif_colorspace_RGB, heif_chroma_interleaved_RRGGBB_LE, nullptr, 10, options);
+  REQUIRE(rrggbb != nullptr);
+
+  p = rrggbb->get_plane(heif_channel_interleaved, &stride);
+  for (int x = 0; x < width; x++) {
+    int e = std::min(std::max(x * 27 - 64, 0), 876);
+    int expected = std::min((e * 299 + 128) >> 8, 1023);
+    REQUIRE((p[6 * x + 2] | (p[6 * x + 3] << 8)) == expected);
+  }
+}
+
+
+// Planar RGB output is converted with the same coefficients, but without interleaving.
+static void check_interleaved_against_planar(const std::shared_ptr<HeifPixelImage>& img, heif_chroma chroma,
+                                             const char* expected_operation, int tolerance)
+{
+  heif_color_conversion_options options = {
+      .preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average,
+      .preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_nearest_neighbor,
+      .only_use_preferred_chroma_algorithm = true};
+
+  int bpp = img->get_bits_per_pixel(heif_channel_Y);
+  bool has_alpha = img->has_channel(heif_channel_Alpha);
+  bool hdr = (bpp > 8);
+
+  ColorState input_state(heif_colorspace_YCbCr, img->get_chroma_format(), has_alpha, bpp);
+  input_state.nclx_profile = img->get_color_profile_nclx();
+  ColorState target_state(heif_colorspace_RGB, chroma, has_alpha || chroma == heif_chroma_interleaved_RGBA, bpp);
+  target_state.nclx_profile = img->get_color_profile_nclx();
+
+  ColorConversionPipeline pipeline;
+  REQUIRE(pipeline.construct_pipeline(input_state, target_state, options));
+  ColorConversionInfo info = pipeline.get_info();
+  REQUIRE(info.steps.size() == 1);
+  REQUIRE(get_operation_name(info.steps[0].operation) == expected_operation);
+
+  std::shared_ptr<HeifPixelImage> interleaved = pipeline.convert_image(img);
+  REQUIRE(interleaved != nullptr);
+
+  std::shared_ptr<HeifPixelImage> planar = convert_colorspace(img, heif_colorspace_RGB, heif_chroma_444, nullptr, bpp, options);
+  REQUIRE(planar != nullptr);
+
+  int width = img->get_width();
+  int height = img->get_height();
+  int num_components = (chroma == heif_chroma_interleaved_RGB || chroma == heif_chroma_interleaved_RRGGBB_LE) ? 3 : 4;
+  const heif_channel channels[4] = {heif_channel_R, heif_channel_G, heif_channel_B, heif_channel_Alpha};
+
+  size_t out_stride;
+  const uint8_t* out = interleaved->get_plane(heif_channel_interleaved, &out_stride);
+
+  for (int c = 0; c < num_components; c++) {
+    if (c == 3 && !has_alpha) {
+      for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+          REQUIRE(out[y * out_stride + 4 * x + 3] == 0xFF);
+        }
+      }
+      continue;
+    }
+
+    size_t stride;
+    const uint8_t* p = planar->get_plane(channels[c], &stride);
+
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        int expected, actual;
+        if (hdr) {
+          expected = ((const uint16_t*) (p + y * stride))[x];
+          const uint8_t* o = out + y * out_stride + 2 * (num_components * x + c);
+          actual = o[0] | (o[1] << 8);
+        }
+        else {
+          expected = p[y * stride + x];
+          actual = out[y * out_stride + num_components * x + c];
+        }
+
+        INFO("x=" << x << " y=" << y << " c=" << c);
+        REQUIRE(std::abs(actual - expected) <= tolerance);
+      }
+    }
+  }
+}
+
+
+TEST_CASE("4:2:2 and 4:4:4 to interleaved RGB", "[heif_image]")
+{
+  // AVX2 and SSE blocks and a scalar remainder
+  const int width = 85;
+  const int height = 3;
+
+  auto nclx = std::make_shared<color_profile_nclx>();
+  nclx->set_matrix_coefficients(6);
+  nclx->set_full_range_flag(true);
+
+  for (heif_chroma chroma : {heif_chroma_422, heif_chroma_444}) {
+    int chroma_width = (chroma == heif_chroma_422 ? (width + 1) / 2 : width);
+
+    std::vector<uint8_t> luma(width * height), cb(chroma_width * height), cr(chroma_width * height), alpha(width * height);
+    for (int i = 0; i < width * height; i++) {
+      luma[i] = static_cast<uint8_t>(i * 7);
+      alpha[i] = static_cast<uint8_t>(255 - i);
+    }
+    for (int i = 0; i < chroma_width * height; i++) {
+      cb[i] = static_cast<uint8_t>(i * 13 + 5);
+      cr[i] = static_cast<uint8_t>(255 - i * 11);
+    }
+
+    std::shared_ptr<HeifPixelImage> img = std::make_shared<HeifPixelImage>();
+    img->create(width, height, heif_colorspace_YCbCr, chroma);
+    img->set_color_profile_nclx(nclx);
+    fill_plane(img, heif_channel_Y, width, height, luma);
+    fill_plane(img, heif_channel_Cb, chroma_width, height, cb);
+    fill_plane(img, heif_channel_Cr, chroma_width, height, cr);
+
+    // The fused operations add 8-bit chroma offsets to the luma, which can differ by one from the planar conversion.
+    check_interleaved_against_planar(img, heif_chroma_interleaved_RGB, "Op_YCbCr422_444_to_RGB24", 1);
+    check_interleaved_against_planar(img, heif_chroma_interleaved_RGBA, "Op_YCbCr422_444_to_RGB32", 1);
+
+    fill_plane(img, heif_channel_Alpha, width, height, alpha);
+    check_interleaved_against_planar(img, heif_chroma_interleaved_RGBA, "Op_YCbCr422_444_to_RGB32", 1);
+
+
+    // 10 bit, limited range
+
+    std::shared_ptr<HeifPixelImage> hdr = std::make_shared<HeifPixelImage>();
+    hdr->create(width, height, heif_colorspace_YCbCr, chroma);
+
+    auto limited = std::make_shared<color_profile_nclx>();
+    limited->set_matrix_coefficients(9);
+    limited->set_full_range_flag(false);
+    hdr->set_color_profile_nclx(limited);
+
+    for (heif_channel channel : {heif_channel_Y, heif_channel_Cb, heif_channel_Cr}) {
+      int w = (channel == heif_channel_Y ? width : chroma_width);
+      REQUIRE(hdr->add_plane(channel, w, height, 10));
+
+      size_t stride;
+      auto* p = (uint16_t*) hdr->get_plane(channel, &stride);
+      for (int y = 0; y < height; y++) {
+        for (int x = 0; x < w; x++) {
+          p[y * stride / 2 + x] = static_cast<uint16_t>((x * 37 + y * 101 + channel * 200) % 1024);
+        }
+      }
+    }
+
+    check_interleaved_against_planar(hdr, heif_chroma_interleaved_RRGGBB_LE, "Op_YCbCr422_444_to_RRGGBBaa", 0);
+  }
+}
+
+
+static bool pipeline_uses_operation(const ColorConversionPipeline& pipeline, const char* name_part)
+{
+  for (const auto& step : pipeline.get_info().steps) {
+    if (get_operation_name(step.operation).find(name_part) != std::string::npos) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+TEST_CASE("Fast conversion", "[heif_image]")
+{
+  heif_color_conversion_options precise_options = {
+      .version = 2,
+      .preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_sharp_yuv,
+      .preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear,
+      .only_use_preferred_chroma_algorithm = false,
+      .conversion_accuracy = heif_color_conversion_accuracy_precise};
+
+  heif_color_conversion_options fast_options = precise_options;
+  fast_options.conversion_accuracy = heif_color_conversion_accuracy_fast;
+
+  // --- nearest-neighbor chroma and no sharp YUV
+
+  ColorState yuv420_state(heif_colorspace_YCbCr, heif_chroma_420, false, 8);
+  ColorState rgb24_state(heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8);
+
+  ColorConversionPipeline to_yuv;
+  REQUIRE(to_yuv.construct_pipeline(rgb24_state, yuv420_state, fast_options));
+  REQUIRE(!pipeline_uses_operation(to_yuv, "Sharp"));
+  REQUIRE(!pipeline_uses_operation(to_yuv, "average"));
+
+  ColorConversionPipeline to_rgb;
+  REQUIRE(to_rgb.construct_pipeline(yuv420_state, rgb24_state, fast_options));
+  REQUIRE(!pipeline_uses_operation(to_rgb, "bilinear"));
+
+  // the application can still insist on its preferred algorithm
+  heif_color_conversion_options strict_options = fast_options;
+  strict_options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear;
+  strict_options.only_use_preferred_chroma_algorithm = true;
+
+  REQUIRE(to_rgb.construct_pipeline(yuv420_state, rgb24_state, strict_options));
+  REQUIRE(pipeline_uses_operation(to_rgb, "bilinear"));
+
+
+  // --- HDR input is converted directly to 8-bit RGB(A), within a few levels of the precise conversion
+
+  const int width = 85;
+  const int height = 6;
+
+  auto nclx = std::make_shared<color_profile_nclx>();
+  nclx->set_matrix_coefficients(6);
+  nclx->set_full_range_flag(true);
+
+  for (heif_chroma chroma : {heif_chroma_420, heif_chroma_422, heif_chroma_444}) {
+    for (int bpp : {10, 12}) {
+      int chroma_width = (chroma == heif_chroma_444 ? width : (width + 1) / 2);
+      int chroma_height = (chroma == heif_chroma_420 ? (height + 1) / 2 : height);
+      int shift = bpp - 8;
+
+      std::shared_ptr<HeifPixelImage> img = std::make_shared<HeifPixelImage>();
+      img->create(width, height, heif_colorspace_YCbCr, chroma);
+      img->set_color_profile_nclx(nclx);
+
+      // Smooth content: the chroma changes by at most two 8-bit levels between neighboring chroma samples.
+      for (heif_channel channel : {heif_channel_Y, heif_channel_Cb, heif_channel_Cr}) {
+        int w = (channel == heif_channel_Y ? width : chroma_width);
+        int h = (channel == heif_channel_Y ? height : chroma_height);
+        REQUIRE(img->add_plane(channel, w, h, bpp));
+
+        size_t stride;
+        auto* p = (uint16_t*) img->get_plane(channel, &stride);
+        for (int y = 0; y < h; y++) {
+          for (int x = 0; x < w; x++) {
+            int value;
+            switch (channel) {
+              case heif_channel_Y:
+                value = ((x * 2 + y * 5) << shift) + x % (1 << shift);
+                break;
+              case heif_channel_Cb:
+                value = ((128 + x * 2 - w + y) << shift) + y % (1 << shift);
+                break;
+              default:
+                value = ((128 - x + w / 2 - y * 2) << shift) + x % (1 << shift);
+                break;
+            }
+            p[y * stride / 2 + x] = static_cast<uint16_t>(value);
+          }
+        }
+      }
+
+      for (heif_chroma output_chroma : {heif_chroma_interleaved_RGB, heif_chroma_interleaved_RGBA}) {
+        INFO("chroma " << chroma << ", " << bpp << " bit, output chroma " << output_chroma);
+
+        ColorState input_state(heif_colorspace_YCbCr, chroma, false, bpp);
+        input_state.nclx_profile = nclx;
+        ColorState target_state(heif_colorspace_RGB, output_chroma, output_chroma == heif_chroma_interleaved_RGBA, 8);
+        target_state.nclx_profile = nclx;
+
+        ColorConversionPipeline pipeline;
+        REQUIRE(pipeline.construct_pipeline(input_state, target_state, fast_options));
+        ColorConversionInfo info = pipeline.get_info();
+        REQUIRE(info.steps.size() == 1);
+        REQUIRE(get_operation_name(info.steps[0].operation) == "Op_YCbCr_HDR_to_RGB24_32_fast");
+
+        std::shared_ptr<HeifPixelImage> fast = pipeline.convert_image(img);
+        REQUIRE(fast != nullptr);
+
+        std::shared_ptr<HeifPixelImage> precise = convert_colorspace(img, heif_colorspace_RGB, output_chroma, nclx, 8,
+                                                                     precise_options);
+        REQUIRE(precise != nullptr);
+
+        size_t fast_stride, precise_stride;
+        const uint8_t* fast_p = fast->get_plane(heif_channel_interleaved, &fast_stride);
+        const uint8_t* precise_p = precise->get_plane(heif_channel_interleaved, &precise_stride);
+
+        int num_components = (output_chroma == heif_chroma_interleaved_RGB ? 3 : 4);
+        int max_diff = 0;
+        for (int y = 0; y < height; y++) {
+          for (int x = 0; x < width * num_components; x++) {
+            max_diff = std::max(max_diff, std::abs(fast_p[y * fast_stride + x] - precise_p[y * precise_stride + x]));
+          }
+        }
+
+        REQUIRE(max_diff <= 4);
+      }
+    }
+  }
+}
+
+
+// The operations of a pipeline, together with whether it could be constructed.
+static std::string describe_pipeline(const ColorState& input_state, const ColorState& target_state,
+                                     const heif_color_conversion_options& options)
+{
+  ColorConversionPipeline pipeline;
+  bool success = pipeline.construct_pipeline(input_state, target_state, options);
+
+  std::string description = success ? "ok" : "failed";
+  for (const auto& step : pipeline.get_info().steps) {
+    description += " " + get_operation_name(step.operation);
+  }
+
+  return description;
+}
+
+
+static std::string describe_uncached_pipeline(const ColorState& input_state, const ColorState& target_state,
+                                              const heif_color_conversion_options& options)
+{
+  ColorConversionPipeline::clear_pipeline_cache();
+  return describe_pipeline(input_state, target_state, options);
+}
+
+
+static std::shared_ptr<color_profile_nclx> make_nclx(uint16_t matrix_coefficients, bool full_range,
+                                                     uint16_t colour_primaries = 1)
+{
+  auto nclx = std::make_shared<color_profile_nclx>();
+  nclx->set_matrix_coefficients(matrix_coefficients);
+  nclx->set_full_range_flag(full_range);
+  nclx->set_colour_primaries(colour_primaries);
+  return nclx;
+}
+
+
+TEST_CASE("Pipeline cache", "[heif_image]")
+{
+  heif_color_conversion_options options = {
+      .version = 2,
+      .preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average,
+      .preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear,
+      .only_use_preferred_chroma_algorithm = true,
+      .conversion_accuracy = heif_color_conversion_accuracy_precise};
+
+  ColorState yuv420_state(heif_colorspace_YCbCr, heif_chroma_420, false, 8);
+  yuv420_state.nclx_profile = make_nclx(6, false);
+  ColorState rgba_state(heif_colorspace_RGB, heif_chroma_interleaved_RGBA, true, 8);
+  rgba_state.nclx_profile = yuv420_state.nclx_profile;
+
+  const std::string uncached = describe_uncached_pipeline(yuv420_state, rgba_state, options);
+  REQUIRE(uncached.compare(0, 2, "ok") == 0);
+
+  auto hits = []() { return statistics::get(statistics::conversion_pipeline_cache_hits); };
+  auto misses = []() { return statistics::get(statistics::conversion_pipeline_cache_misses); };
+
+  SECTION("the same conversion is found in the cache") {
+    statistics::reset();
+    REQUIRE(describe_pipeline(yuv420_state, rgba_state, options) == uncached);
+    REQUIRE(hits() == 1);
+    REQUIRE(misses() == 0);
+
+    // Each image has its own profile object. They are compared by content.
+    ColorState other_input = yuv420_state;
+    other_input.nclx_profile = make_nclx(6, false);
+    ColorState other_target = rgba_state;
+    other_target.nclx_profile = make_nclx(6, false);
+    REQUIRE(describe_pipeline(other_input, other_target, options) == uncached);
+    REQUIRE(hits() == 2);
+    REQUIRE(misses() == 0);
+  }
+
+  SECTION("different nclx profiles are cached separately") {
+    for (int matrix : {0, 1, 5, 9}) {
+      for (bool full_range : {false, true}) {
+        INFO("matrix " << matrix << ", full range " << full_range);
+
+        ColorState input = yuv420_state;
+        input.nclx_profile = make_nclx(static_cast<uint16_t>(matrix), full_range);
+        ColorState target = rgba_state;
+        target.nclx_profile = input.nclx_profile;
+
+        std::string expected = describe_uncached_pipeline(input, target, options);
+
+        // the original conversion is still cached, and does not replace this one
+        REQUIRE(describe_pipeline(yuv420_state, rgba_state, options) == uncached);
+
+        statistics::reset();
+        REQUIRE(describe_pipeline(input, target, options) == expected);
+        REQUIRE(misses() == 0);
+      }
+    }
+  }
+
+  SECTION("different options are cached separately") {
+    heif_color_conversion_options nearest_options = options;
+    nearest_options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_nearest_neighbor;
+
+    statistics::reset();
+    std::string nearest = describe_pipeline(yuv420_state, rgba_state, nearest_options);
+    REQUIRE(misses() == 1);
+    REQUIRE(nearest != uncached);
+    REQUIRE(nearest == describe_uncached_pipeline(yuv420_state, rgba_state, nearest_options));
+
+    describe_pipeline(yuv420_state, rgba_state, options);
+    statistics::reset();
+    REQUIRE(describe_pipeline(yuv420_state, rgba_state, nearest_options) == nearest);
+    REQUIRE(describe_pipeline(yuv420_state, rgba_state, options) == uncached);
+    REQUIRE(hits() == 2);
+  }
+
+  SECTION("failed searches are cached") {
+    // YCbCr with an interleaved RGB chroma format cannot be reached
+    ColorState invalid_target(heif_colorspace_YCbCr, heif_chroma_interleaved_RGB, false, 8);
+
+    statistics::reset();
+    REQUIRE(describe_pipeline(yuv420_state, invalid_target, options) == "failed");
+    REQUIRE(describe_pipeline(yuv420_state, invalid_target, options) == "failed");
+    REQUIRE(hits() == 1);
+    REQUIRE(misses() == 1);
+  }
+
+  SECTION("the least recently used pipeline is evicted") {
+    // 66 distinct conversions, more than the cache holds, that all differ from the first one
+    std::vector<ColorState> inputs;
+    for (uint16_t primaries = 2; primaries <= 12; primaries++) {
+      for (int matrix : {1, 5, 6}) {
+        for (bool full_range : {false, true}) {
+          ColorState input = yuv420_state;
+          input.nclx_profile = make_nclx(static_cast<uint16_t>(matrix), full_range, primaries);
+          inputs.push_back(input);
+        }
+      }
+    }
+
+    for (const ColorState& input : inputs) {
+      describe_pipeline(input, rgba_state, options);
+    }
+
+    statistics::reset();
+    REQUIRE(describe_pipeline(yuv420_state, rgba_state, options) == uncached);
+    REQUIRE(hits() == 0);
+    REQUIRE(misses() == 1);
+
+    // the last conversions are still cached
+    REQUIRE(describe_pipeline(inputs.back(), rgba_state, options).compare(0, 2, "ok") == 0);
+    REQUIRE(hits() == 1);
+  }
+}
+
+
+TEST_CASE("Float output", "[heif_image]")
+{
+  heif_color_conversion_options options = {
+      .preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average,
+      .preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear,
+      .only_use_preferred_chroma_algorithm = false};
+
+  REQUIRE(float_to_half(1.0f) == 0x3C00);
+  REQUIRE(float_to_half(65504.0f) == 0x7BFF);
+  REQUIRE(float_to_half(65520.0f) == 0x7C00);
+  REQUIRE(float_to_half(5.9604645e-8f) == 0x0001);
+  REQUIRE(half_to_float(0x3555) == Approx(0.33325f));
+
+  std::shared_ptr<HeifPixelImage> img = std::make_shared<HeifPixelImage>();
+  img->create(2, 2, heif_colorspace_YCbCr, heif_chroma_420);
+
+  fill_plane(img, heif_channel_Y, 2, 2,
+             {0, 128,
+              255, 128});
+  fill_plane(img, heif_channel_Cb, 1, 1, {128});
+  fill_plane(img, heif_channel_Cr, 1, 1, {128});
+
+  std::shared_ptr<HeifPixelImage> rgb = convert_colorspace(img, heif_colorspace_RGB, heif_chroma_interleaved_RGB_FLOAT, nullptr, 0, options);
+  REQUIRE(rgb != nullptr);
+  REQUIRE(rgb->get_bits_per_pixel(heif_channel_interleaved) == 32);
+  REQUIRE(rgb->get_storage_bits_per_pixel(heif_channel_interleaved) == 96);
+
+  size_t stride;
+  const auto* f = (const float*) rgb->get_plane(heif_channel_interleaved, &stride);
+  REQUIRE(f[0] == 0.0f);
+  REQUIRE(f[3] == Approx(128 / 255.0f));
+  REQUIRE(f[5] == Approx(128 / 255.0f));
+  f = (const float*) (rgb->get_plane(heif_channel_interleaved, &stride) + stride);
+  REQUIRE(f[0] == 1.0f);
+
+  // linear light: inverse sRGB transfer function, alpha is filled with 1.0
+  auto linear_profile = std::make_shared<color_profile_nclx>();
+  linear_profile->set_transfer_characteristics(heif_transfer_characteristic_linear);
+
+  std::shared_ptr<HeifPixelImage> rgba = convert_colorspace(img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA_HALF, linear_profile, 0, options);
+  REQUIRE(rgba != nullptr);
+  REQUIRE(rgba->get_color_profile_nclx()->get_transfer_characteristics() == heif_transfer_characteristic_linear);
+
+  const auto* h = (const uint16_t*) rgba->get_plane(heif_channel_interleaved, &stride);
+  REQUIRE(half_to_float(h[4]) == Approx(0.2158605f).epsilon(0.001));
+  REQUIRE(h[7] == 0x3C00);
+
+  // and back to integer samples
+  std::shared_ptr<HeifPixelImage> planar = convert_colorspace(rgb, heif_colorspace_RGB, heif_chroma_444, nullptr, 8, options);
+  REQUIRE(planar != nullptr);
+  assert_plane(planar, heif_channel_G, {0, 128, 255, 128});
+}
+
+
+TEST_CASE("Premultiplied alpha", "[heif_image]")
+{
+  heif_color_conversion_options options = {
+      .preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average,
+      .preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_nearest_neighbor,
+      .only_use_preferred_chroma_algorithm = false};
+
+  std::shared_ptr<HeifPixelImage> img = std::make_shared<HeifPixelImage>();
+  img->create(2, 2, heif_colorspace_YCbCr, heif_chroma_420);
+
+  fill_plane(img, heif_channel_Y, 2, 2, {100, 100, 100, 100});
+  fill_plane(img, heif_channel_Cb, 1, 1, {128});
+  fill_plane(img, heif_channel_Cr, 1, 1, {128});
+  fill_plane(img, heif_channel_Alpha, 2, 2, {255, 128, 0, 51});
+
+  std::shared_ptr<HeifPixelImage> rgba = convert_colorspace(img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, nullptr, 8, options,
+                                                            nullptr, nullptr, 0, heif_alpha_premultiplication_premultiplied);
+  REQUIRE(rgba != nullptr);
+  REQUIRE(rgba->is_premultiplied_alpha());
+
+  size_t stride;
+  const uint8_t* p = rgba->get_plane(heif_channel_interleaved, &stride);
+  REQUIRE(std::vector<uint8_t>(p, p + 8) == std::vector<uint8_t>{100, 100, 100, 255, 50, 50, 50, 128});
+  REQUIRE(std::vector<uint8_t>(p + stride, p + stride + 8) == std::vector<uint8_t>{0, 0, 0, 0, 20, 20, 20, 51});
+
+  // unpremultiply the planar RGB conversion of the premultiplied image
+  img->set_premultiplied_alpha(true);
+  std::shared_ptr<HeifPixelImage> planar = convert_colorspace(img, heif_colorspace_RGB, heif_chroma_444, nullptr, 8, options,
+                                                              nullptr, nullptr, 0, heif_alpha_premultiplication_straight);
+  REQUIRE(planar != nullptr);
+  REQUIRE(!planar->is_premultiplied_alpha());
+  assert_plane(planar, heif_channel_R, {100, 199, 0, 255});
+  assert_plane(planar, heif_channel_Alpha, {255, 128, 0, 51});
+
+  // images without alpha are never premultiplied
+  std::shared_ptr<HeifPixelImage> rgb = convert_colorspace(img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr, 8, options);
+  REQUIRE(rgb != nullptr);
+  REQUIRE(!rgb->is_premultiplied_alpha());
+}
+
+
+TEST_CASE("Very wide images", "[heif_image]")
+{
+  // The pixel positions times the width exceed the range of int.
+  const int width = 60000;
+
+  auto img = std::make_shared<HeifPixelImage>();
+  img->create(width, 2, heif_colorspace_monochrome, heif_chroma_monochrome);
+  REQUIRE(img->add_plane(heif_channel_Y, width, 2, 8));
+
+  size_t stride;
+  uint8_t* p = img->get_plane(heif_channel_Y, &stride);
+  for (int x = 0; x < width; x++) {
+    p[x] = static_cast<uint8_t>(x / 1000);
+    p[stride + x] = static_cast<uint8_t>(255 - x / 1000);
+  }
+
+  std::shared_ptr<HeifPixelImage> cropped;
+  Error err = img->crop(59000, width - 1, 1, 1, cropped);
+  REQUIRE(!err);
+  REQUIRE(cropped->get_width() == 1000);
+
+  const uint8_t* c = cropped->get_plane(heif_channel_Y, &stride);
+  REQUIRE(c[0] == 255 - 59);
+
+  std::shared_ptr<HeifPixelImage> scaled;
+  err = img->scale_nearest_neighbor(scaled, width / 2, 1);
+  REQUIRE(!err);
+
+  const uint8_t* s = scaled->get_plane(heif_channel_Y, &stride);
+  REQUIRE(s[width / 2 - 1] == 59);
+}
+
+
+TEST_CASE("Plane stride beyond int", "[heif_image]")
+{
+  // Only the first row is accessed, such that no large buffer is needed.
+  std::vector<uint8_t> row(16);
+  const size_t large_stride = size_t{3} << 30;
+
+  auto img = std::make_shared<HeifPixelImage>();
+  img->create(16, 1, heif_colorspace_monochrome, heif_chroma_monochrome);
+  REQUIRE(img->add_external_plane(heif_channel_Y, 16, 1, 8, row.data(), large_stride));
+
+  size_t stride = 0;
+  REQUIRE(img->get_plane(heif_channel_Y, &stride) == row.data());
+  REQUIRE(stride == large_stride);
+}
+
+
+// --- SIMD kernels
+//
+// The SIMD kernels process a prefix of each row and the caller converts the remaining samples with
+// its scalar code. These tests run the kernels that are selected for this CPU on odd widths and on
+// all rows of odd-height planes, complete the rows with a scalar reference and compare the result
+// with the scalar reference for the whole row. Without SIMD kernels, there is nothing to compare.
+
+static const int kOddWidths[] = {1, 3, 7, 9, 15, 17, 31, 33, 63, 65, 127, 129, 255};
+static const int kOddHeight = 7;
+
+template<class T>
+static std::vector<T> random_samples(std::mt19937& rng, size_t n, int min_value, int max_value)
+{
+  std::uniform_int_distribution<int> dist(min_value, max_value);
+
+  std::vector<T> samples(n);
+  for (T& s : samples) {
+    s = static_cast<T>(dist(rng));
+  }
+
+  return samples;
+}
+
+
+// Same as the scalar loop of the 8-bit YCbCr to RGB24/RGB32 operations in yuv2rgb.cc.
+static void YCbCr_row_to_RGB_reference(const uint8_t* y, const int16_t* dr, const int16_t* dg, const int16_t* db,
+                                       const uint8_t* alpha, uint8_t* out, int first, int width,
+                                       int shiftH, int bytes_per_pixel)
+{
+  for (int x = first; x < width; x++) {
+    uint8_t* p = out + bytes_per_pixel * x;
+
+    p[0] = clip_int_u8(y[x] + dr[x >> shiftH]);
+    p[1] = clip_int_u8(y[x] + dg[x >> shiftH]);
+    p[2] = clip_int_u8(y[x] + db[x >> shiftH]);
+    if (bytes_per_pixel == 4) {
+      p[3] = alpha ? alpha[x] : 0xFF;
+    }
+  }
+}
+
+
+TEST_CASE("YCbCr to RGB kernels match the scalar code", "[heif_image]")
+{
+  select_YCbCr_to_RGB_kernels();
+  const YCbCr_to_RGB_kernels& kernels = get_YCbCr_to_RGB_kernels();
+
+  struct Variant
+  {
+    YCbCr_row_to_RGB_kernel kernel;
+    int shiftH;
+    int bytes_per_pixel;
+  } variants[] = {
+      {kernels.to_RGB24, 1, 3},
+      {kernels.to_RGB32, 1, 4},
+      {kernels.to_RGB24_444, 0, 3},
+      {kernels.to_RGB32_444, 0, 4}
+  };
+
+  std::mt19937 rng(11);
+
+  for (const Variant& v : variants) {
+    if (!v.kernel) {
+      continue;
+    }
+
+    for (int width : kOddWidths) {
+      const int chroma_width = (width + v.shiftH) >> v.shiftH;
+
+      for (int row = 0; row < kOddHeight; row++) {
+        std::vector<uint8_t> y = random_samples<uint8_t>(rng, width, 0, 255);
+        std::vector<uint8_t> a = random_samples<uint8_t>(rng, width, 0, 255);
+        std::vector<int16_t> dr = random_samples<int16_t>(rng, chroma_width, -255, 255);
+        std::vector<int16_t> dg = random_samples<int16_t>(rng, chroma_width, -255, 255);
+        std::vector<int16_t> db = random_samples<int16_t>(rng, chroma_width, -255, 255);
+        const uint8_t* alpha = (row % 2) ? a.data() : nullptr;
+
+        std::vector<uint8_t> expected(width * v.bytes_per_pixel);
+        YCbCr_row_to_RGB_reference(y.data(), dr.data(), dg.data(), db.data(), alpha, expected.data(),
+                                   0, width, v.shiftH, v.bytes_per_pixel);
+
+        std::vector<uint8_t> out(width * v.bytes_per_pixel);
+        int x = v.kernel(y.data(), dr.data(), dg.data(), db.data(), alpha, out.data(), width);
+        REQUIRE(x >= 0);
+        REQUIRE(x <= width);
+        YCbCr_row_to_RGB_reference(y.data(), dr.data(), dg.data(), db.data(), alpha, out.data(),
+                                   x, width, v.shiftH, v.bytes_per_pixel);
+
+        INFO("width " << width << ", " << v.bytes_per_pixel << " bytes per pixel, shiftH " << v.shiftH);
+        REQUIRE(out == expected);
+      }
+    }
+  }
+}
+
+
+// Same as the scalar loops in Op_RGB24_32_to_YCbCr.
+static void RGB24_32_row_to_Y_reference(const uint8_t* in, int bytes_per_pixel, uint8_t* out_y, int first, int width,
+                                        const RGB_to_YCbCr_kernel_params& params)
+{
+  const RGB_to_YCbCr_coefficients& c = params.coeffs;
+
+  for (int x = first; x < width; x++) {
+    const uint8_t* p = in + x * bytes_per_pixel;
+    float yv = p[0] * c.c[0][0] + p[1] * c.c[0][1] + p[2] * c.c[0][2];
+
+    if (params.full_range) {
+      out_y[x] = clip_f_u8(yv);
+    }
+    else {
+      out_y[x] = (uint8_t) (clip_f_u16(yv * 0.85547f, 219) + 16);
+    }
+  }
+}
+
+static void RGB24_32_rows_to_CbCr420_reference(const uint8_t* in0, const uint8_t* in1, int bytes_per_pixel,
+                                               uint8_t* out_cb, uint8_t* out_cr, int first, int num_chroma,
+                                               const RGB_to_YCbCr_kernel_params& params)
+{
+  const RGB_to_YCbCr_coefficients& c = params.coeffs;
+  const int bpp = bytes_per_pixel;
+
+  for (int x = first; x < num_chroma; x++) {
+    const uint8_t* p = in0 + 2 * x * bpp;
+    const uint8_t* q = in1 + 2 * x * bpp;
+
+    uint8_t r = uint8_t((p[0] + p[bpp + 0] + q[0] + q[bpp + 0]) / 4);
+    uint8_t g = uint8_t((p[1] + p[bpp + 1] + q[1] + q[bpp + 1]) / 4);
+    uint8_t b = uint8_t((p[2] + p[bpp + 2] + q[2] + q[bpp + 2]) / 4);
+
+    float cb = r * c.c[1][0] + g * c.c[1][1] + b * c.c[1][2];
+    float cr = r * c.c[2][0] + g * c.c[2][1] + b * c.c[2][2];
+
+    if (params.full_range) {
+      out_cb[x] = clip_f_u8(cb + 128);
+      out_cr[x] = clip_f_u8(cr + 128);
+    }
+    else {
+      out_cb[x] = clip_f_u8(cb * 0.875f + 128.0f);
+      out_cr[x] = clip_f_u8(cr * 0.875f + 128.0f);
+    }
+  }
+}
+
+
+// Same as the scalar loops in Op_RGB_to_YCbCr<Pixel>.
+template<class Pixel>
+static void RGB_planar_row_to_Y_reference(const Pixel* r, const Pixel* g, const Pixel* b, Pixel* out_y,
+                                          int first, int width, const RGB_to_YCbCr_kernel_params& params)
+{
+  const RGB_to_YCbCr_coefficients& c = params.coeffs;
+
+  for (int x = first; x < width; x++) {
+    float v = float(r[x]) * c.c[0][0] + float(g[x]) * c.c[0][1] + float(b[x]) * c.c[0][2];
+    if (!params.full_range) {
+      v = (((v * 219) / 256) + params.limited_range_offset);
+    }
+
+    out_y[x] = (Pixel) clip_f_u16(v, params.max_value);
+  }
+}
+
+template<class Pixel>
+static void RGB_planar_rows_to_CbCr420_reference(const Pixel* r0, const Pixel* g0, const Pixel* b0,
+                                                 const Pixel* r1, const Pixel* g1, const Pixel* b1,
+                                                 Pixel* out_cb, Pixel* out_cr, int first, int num_chroma,
+                                                 const RGB_to_YCbCr_kernel_params& params)
+{
+  const RGB_to_YCbCr_coefficients& c = params.coeffs;
+
+  for (int x = first; x < num_chroma; x++) {
+    int px = 2 * x;
+
+    float r = r0[px];
+    float g = g0[px];
+    float b = b0[px];
+    r += r0[px + 1];
+    g += g0[px + 1];
+    b += b0[px + 1];
+    r += r1[px];
+    g += g1[px];
+    b += b1[px];
+    r += r1[px + 1];
+    g += g1[px + 1];
+    b += b1[px + 1];
+    r *= 0.25f;
+    g *= 0.25f;
+    b *= 0.25f;
+
+    float cb = r * c.c[1][0] + g * c.c[1][1] + b * c.c[1][2];
+    float cr = r * c.c[2][0] + g * c.c[2][1] + b * c.c[2][2];
+    if (!params.full_range) {
+      cb = (cb * 224) / 256;
+      cr = (cr * 224) / 256;
+    }
+
+    out_cb[x] = (Pixel) clip_f_u16(cb + params.half_range, params.max_value);
+    out_cr[x] = (Pixel) clip_f_u16(cr + params.half_range, params.max_value);
+  }
+}
+
+
+static RGB_to_YCbCr_kernel_params RGB_to_YCbCr_test_params(uint16_t matrix_coefficients, bool full_range, int bit_depth)
+{
+  RGB_to_YCbCr_kernel_params params;
+  params.coeffs = get_color_conversion_coefficients(matrix_coefficients, 1, full_range, bit_depth).rgb_to_ycbcr;
+  params.full_range = full_range;
+  params.max_value = (1 << bit_depth) - 1;
+  params.half_range = (float) (1 << (bit_depth - 1));
+  params.limited_range_offset = (float) (16 << (bit_depth - 8));
+  return params;
+}
+
+
+template<class Pixel>
+static void check_planar_RGB_to_YCbCr420_kernels(std::mt19937& rng, int bit_depth)
+{
+  typename RGB_planar_kernel_types<Pixel>::row_to_Y to_Y;
+  typename RGB_planar_kernel_types<Pixel>::rows_to_CbCr420 to_CbCr;
+  get_RGB_to_YCbCr420_kernels().get_planar(&to_Y, &to_CbCr);
+
+  const int max_value = (1 << bit_depth) - 1;
+
+  for (bool full_range : {true, false}) {
+    RGB_to_YCbCr_kernel_params params = RGB_to_YCbCr_test_params(1, full_range, bit_depth);
+
+    for (int width : kOddWidths) {
+      const int num_chroma = width / 2;
+
+      std::vector<Pixel> r = random_samples<Pixel>(rng, width * kOddHeight, 0, max_value);
+      std::vector<Pixel> g = random_samples<Pixel>(rng, width * kOddHeight, 0, max_value);
+      std::vector<Pixel> b = random_samples<Pixel>(rng, width * kOddHeight, 0, max_value);
+
+      INFO("width " << width << ", bit depth " << bit_depth << ", full range " << full_range);
+
+      for (int y = 0; y < kOddHeight && to_Y; y++) {
+        const Pixel* pr = &r[y * width], * pg = &g[y * width], * pb = &b[y * width];
+
+        std::vector<Pixel> expected(width);
+        RGB_planar_row_to_Y_reference(pr, pg, pb, expected.data(), 0, width, params);
+
+        std::vector<Pixel> out(width);
+        int x = to_Y(pr, pg, pb, out.data(), width, params);
+        REQUIRE(x >= 0);
+        REQUIRE(x <= width);
+        RGB_planar_row_to_Y_reference(pr, pg, pb, out.data(), x, width, params);
+        REQUIRE(out == expected);
+      }
+
+      // The caller converts the last row of odd-height images with its scalar code.
+      for (int y = 0; y + 1 < kOddHeight && to_CbCr; y += 2) {
+        const Pixel* r0 = &r[y * width], * g0 = &g[y * width], * b0 = &b[y * width];
+        const Pixel* r1 = r0 + width, * g1 = g0 + width, * b1 = b0 + width;
+
+        std::vector<Pixel> expected_cb(num_chroma), expected_cr(num_chroma);
+        RGB_planar_rows_to_CbCr420_reference(r0, g0, b0, r1, g1, b1, expected_cb.data(), expected_cr.data(),
+                                             0, num_chroma, params);
+
+        std::vector<Pixel> cb(num_chroma), cr(num_chroma);
+        int x = to_CbCr(r0, g0, b0, r1, g1, b1, cb.data(), cr.data(), num_chroma, params);
+        REQUIRE(x >= 0);
+        REQUIRE(x <= num_chroma);
+        RGB_planar_rows_to_CbCr420_reference(r0, g0, b0, r1, g1, b1, cb.data(), cr.data(), x, num_chroma, params);
+        REQUIRE(cb == expected_cb);
+        REQUIRE(cr == expected_cr);
+      }
+    }
+  }
+}
+
+
+TEST_CASE("RGB to YCbCr 4:2:0 kernels match the scalar code", "[heif_image]")
+{
+  select_RGB_to_YCbCr420_kernels();
+  const RGB_to_YCbCr420_kernels& kernels = get_RGB_to_YCbCr420_kernels();
+
+  std::mt19937 rng(12);
+
+  SECTION("interleaved RGB24 and RGB32") {
+    for (int bytes_per_pixel : {3, 4}) {
+      for (bool full_range : {true, false}) {
+        RGB_to_YCbCr_kernel_params params = RGB_to_YCbCr_test_params(6, full_range, 8);
+
+        for (int width : kOddWidths) {
+          const int stride = width * bytes_per_pixel;
+          const int num_chroma = width / 2;
+          std::vector<uint8_t> in = random_samples<uint8_t>(rng, stride * kOddHeight, 0, 255);
+
+          INFO("width " << width << ", " << bytes_per_pixel << " bytes per pixel, full range " << full_range);
+
+          for (int y = 0; y < kOddHeight && kernels.interleaved_to_Y; y++) {
+            const uint8_t* p = &in[y * stride];
+
+            std::vector<uint8_t> expected(width);
+            RGB24_32_row_to_Y_reference(p, bytes_per_pixel, expected.data(), 0, width, params);
+
+            std::vector<uint8_t> out(width);
+            int x = kernels.interleaved_to_Y(p, bytes_per_pixel, out.data(), width, params);
+            REQUIRE(x >= 0);
+            REQUIRE(x <= width);
+            RGB24_32_row_to_Y_reference(p, bytes_per_pixel, out.data(), x, width, params);
+            REQUIRE(out == expected);
+          }
+
+          for (int y = 0; y + 1 < kOddHeight && kernels.interleaved_to_CbCr420; y += 2) {
+            const uint8_t* p0 = &in[y * stride];
+            const uint8_t* p1 = p0 + stride;
+
+            std::vector<uint8_t> expected_cb(num_chroma), expected_cr(num_chroma);
+            RGB24_32_rows_to_CbCr420_reference(p0, p1, bytes_per_pixel, expected_cb.data(), expected_cr.data(),
+                                               0, num_chroma, params);
+
+            std::vector<uint8_t> cb(num_chroma), cr(num_chroma);
+            int x = kernels.interleaved_to_CbCr420(p0, p1, bytes_per_pixel, cb.data(), cr.data(), num_chroma, params);
+            REQUIRE(x >= 0);
+            REQUIRE(x <= num_chroma);
+            RGB24_32_rows_to_CbCr420_reference(p0, p1, bytes_per_pixel, cb.data(), cr.data(), x, num_chroma, params);
+            REQUIRE(cb == expected_cb);
+            REQUIRE(cr == expected_cr);
+          }
+        }
+      }
+    }
+  }
+
+  SECTION("planar 8 bit") {
+    check_planar_RGB_to_YCbCr420_kernels<uint8_t>(rng, 8);
+  }
+
+  SECTION("planar 10 bit") {
+    check_planar_RGB_to_YCbCr420_kernels<uint16_t>(rng, 10);
+  }
+}
+
+
+// Same as the pair loop of the scalar bilinear upsampling in chroma_sampling_simd.cc.
+template<class Pixel>
+static void upsample_chroma_pairs_reference(const Pixel* near_row, const Pixel* far_row, Pixel* out,
+                                            int first_pair, int num_pairs)
+{
+  for (int cx = first_pair; cx < num_pairs; cx++) {
+    int32_t v0 = 3 * near_row[cx] + far_row[cx];
+    int32_t v1 = 3 * near_row[cx + 1] + far_row[cx + 1];
+
+    out[2 * cx + 1] = (Pixel) ((3 * v0 + v1 + 8) >> 4);
+    out[2 * cx + 2] = (Pixel) ((v0 + 3 * v1 + 8) >> 4);
+  }
+}
+
+
+template<class Pixel, class Kernel>
+static void check_bilinear_chroma_kernel(std::mt19937& rng, Kernel kernel, int bit_depth)
+{
+  for (int width : kOddWidths) {
+    const int chroma_width = (width + 1) / 2;
+    const int num_pairs = (width - 1) / 2;
+    const int chroma_height = (kOddHeight + 1) / 2;
+
+    std::vector<Pixel> chroma = random_samples<Pixel>(rng, chroma_width * chroma_height, 0, (1 << bit_depth) - 1);
+
+    for (int y = 0; y < kOddHeight; y++) {
+      int near_y, far_y;
+      get_bilinear_chroma_rows(y, chroma_height, &near_y, &far_y);
+      const Pixel* near_row = &chroma[near_y * chroma_width];
+      const Pixel* far_row = &chroma[far_y * chroma_width];
+
+      std::vector<Pixel> expected(width);
+      upsample_chroma_pairs_reference(near_row, far_row, expected.data(), 0, num_pairs);
+
+      std::vector<Pixel> out(width);
+      int cx = kernel(near_row, far_row, out.data(), num_pairs);
+      REQUIRE(cx >= 0);
+      REQUIRE(cx <= num_pairs);
+      upsample_chroma_pairs_reference(near_row, far_row, out.data(), cx, num_pairs);
+
+      INFO("width " << width << ", row " << y << ", bit depth " << bit_depth);
+      REQUIRE(out == expected);
+    }
+  }
+}
+
+
+TEST_CASE("Bilinear chroma upsampling kernels match the scalar code", "[heif_image]")
+{
+  select_bilinear_chroma_upsampling_kernels();
+  const Bilinear_chroma_upsampling_kernels& kernels = get_bilinear_chroma_upsampling_kernels();
+
+  std::mt19937 rng(18);
+
+  if (kernels.upsample_8bit) {
+    check_bilinear_chroma_kernel<uint8_t>(rng, kernels.upsample_8bit, 8);
+  }
+
+  // The 16-bit kernel is only used up to 12 bits.
+  if (kernels.upsample_16bit) {
+    check_bilinear_chroma_kernel<uint16_t>(rng, kernels.upsample_16bit, 10);
+    check_bilinear_chroma_kernel<uint16_t>(rng, kernels.upsample_16bit, 12);
+  }
+}
+
+
+TEST_CASE("Rotation with transpose kernels matches a pixel-by-pixel copy", "[heif_image]")
+{
+  // The blocks that do not fit completely into the image and the tile borders (64 pixels) are
+  // copied by the scalar code.
+  const int sizes[] = {1, 7, 9, 33, 67, 131};
+
+  std::mt19937 rng(64);
+
+  for (int bytes_per_pixel : {1, 2, 4}) {
+    for (int in_width : sizes) {
+      for (int in_height : sizes) {
+        const ptrdiff_t in_stride = in_width * bytes_per_pixel + 3;
+        std::vector<uint8_t> in = random_samples<uint8_t>(rng, in_stride * in_height, 0, 255);
+
+        // The output is 'in_height' pixels wide. The output rows run along the input columns.
+        const int out_width = in_height;
+        const int out_height = in_width;
+        const ptrdiff_t out_stride = out_width * bytes_per_pixel + 5;
+
+        for (int flip_x : {0, 1}) {
+          for (int flip_y : {0, 1}) {
+            const ptrdiff_t in_step_x = flip_x ? -in_stride : in_stride;
+            const ptrdiff_t in_step_y = flip_y ? -bytes_per_pixel : bytes_per_pixel;
+            const uint8_t* start = in.data() + (flip_x ? (in_height - 1) * in_stride : 0) +
+                                   (flip_y ? (in_width - 1) * bytes_per_pixel : 0);
+
+            std::vector<uint8_t> expected(out_stride * out_height);
+            for (int y = 0; y < out_height; y++) {
+              for (int x = 0; x < out_width; x++) {
+                memcpy(&expected[y * out_stride + x * bytes_per_pixel],
+                       start + x * in_step_x + y * in_step_y, bytes_per_pixel);
+              }
+            }
+
+            std::vector<uint8_t> out(out_stride * out_height);
+            transform_plane(start, in_step_x, in_step_y, out.data(), out_stride,
+                            out_width, out_height, bytes_per_pixel, nullptr);
+
+            INFO(in_width << "x" << in_height << ", " << bytes_per_pixel << " bytes per pixel, flip " << flip_x << flip_y);
+            REQUIRE(out == expected);
+          }
+        }
+      }
+    }
+  }
+}
+
+
+TEST_CASE("Blending kernel matches the scalar code", "[heif_image]")
+{
+  const Blending_kernels& kernels = get_blending_kernels();
+  if (!kernels.blend_8bit) {
+    return;
+  }
+
+  std::mt19937 rng(66);
+
+  for (int width : kOddWidths) {
+    for (int row = 0; row < kOddHeight; row++) {
+      std::vector<uint8_t> in = random_samples<uint8_t>(rng, width, 0, 255);
+      std::vector<uint8_t> alpha = random_samples<uint8_t>(rng, width, 0, 255);
+      std::vector<uint8_t> background = random_samples<uint8_t>(rng, width, 0, 255);
+
+      // include the extreme alpha values
+      alpha[0] = (row % 2) ? 0 : 255;
+
+      std::vector<uint8_t> expected = background;
+      for (int x = 0; x < width; x++) {
+        expected[x] = (uint8_t) ((in[x] * alpha[x] + expected[x] * (255 - alpha[x])) / 255);
+      }
+
+      std::vector<uint8_t> out = background;
+      int x = kernels.blend_8bit(in.data(), alpha.data(), out.data(), width);
+      REQUIRE(x >= 0);
+      REQUIRE(x <= width);
+      for (; x < width; x++) {
+        out[x] = (uint8_t) ((in[x] * alpha[x] + out[x] * (255 - alpha[x])) / 255);
+      }
+
+      INFO("width " << width);
+      REQUIRE(out == expected);
+    }
+  }
+
+  // The kernels divide by 255 with shifts. Check all combinations of the input, alpha and background values.
+  std::vector<uint8_t> alpha(256);
+  for (int a = 0; a < 256; a++) {
+    alpha[a] = (uint8_t) a;
+  }
+
+  for (int in_value = 0; in_value < 256; in_value++) {
+    std::vector<uint8_t> in(256, (uint8_t) in_value);
+
+    for (int background = 0; background < 256; background++) {
+      std::vector<uint8_t> out(256, (uint8_t) background);
+      int x = kernels.blend_8bit(in.data(), alpha.data(), out.data(), 256);
+
+      for (int a = 0; a < x; a++) {
+        int expected = (in_value * a + background * (255 - a)) / 255;
+        if (out[a] != expected) {
+          INFO("in " << in_value << ", alpha " << a << ", background " << background);
+          REQUIRE((int) out[a] == expected);
+        }
+      }
+    }
+  }
+}
+
+
+// The scaling kernels sum in the same order as the scalar code, but the compiler may contract the
+// scalar multiply-adds into fused operations. Allow for the rounding differences of that.
+static void require_close(const std::vector<float>& out, const std::vector<float>& expected)
+{
+  REQUIRE(out.size() == expected.size());
+  for (size_t i = 0; i < out.size(); i++) {
+    INFO("sample " << i);
+    REQUIRE(std::fabs(out[i] - expected[i]) <= 1e-5f * (1.0f + std::fabs(expected[i])));
+  }
+}
+
+
+TEST_CASE("Scaling kernels match the scalar code", "[heif_image]")
+{
+  const Scaling_kernels& kernels = get_scaling_kernels();
+
+  std::mt19937 rng(61);
+  std::uniform_real_distribution<float> sample_dist(0.0f, 65535.0f);
+  std::uniform_real_distribution<float> weight_dist(-0.25f, 1.25f);
+
+  auto random_floats = [&rng](std::uniform_real_distribution<float>& dist, size_t n) {
+    std::vector<float> v(n);
+    for (float& f : v) {
+      f = dist(rng);
+    }
+    return v;
+  };
+
+  // An odd number of taps corresponds to an odd number of input rows per output row.
+  const int tap_counts[] = {1, 2, 3, 5, 7};
+
+  if (kernels.vertical) {
+    for (int num_taps : tap_counts) {
+      for (int width : kOddWidths) {
+        std::vector<std::vector<float>> row_data(num_taps);
+        std::vector<const float*> rows(num_taps);
+        for (int k = 0; k < num_taps; k++) {
+          row_data[k] = random_floats(sample_dist, width);
+          rows[k] = row_data[k].data();
+        }
+
+        std::vector<float> weights = random_floats(weight_dist, num_taps);
+
+        std::vector<float> expected(width);
+        for (int x = 0; x < width; x++) {
+          float sum = 0.0f;
+          for (int k = 0; k < num_taps; k++) {
+            sum += weights[k] * rows[k][x];
+          }
+          expected[x] = sum;
+        }
+
+        std::vector<float> out(width);
+        int x = kernels.vertical(rows.data(), weights.data(), num_taps, out.data(), width);
+        REQUIRE(x >= 0);
+        REQUIRE(x <= width);
+        for (; x < width; x++) {
+          float sum = 0.0f;
+          for (int k = 0; k < num_taps; k++) {
+            sum += weights[k] * rows[k][x];
+          }
+          out[x] = sum;
+        }
+
+        INFO("vertical, width " << width << ", " << num_taps << " taps");
+        require_close(out, expected);
+      }
+    }
+  }
+
+  if (kernels.horizontal_4) {
+    for (int num_taps : tap_counts) {
+      for (int out_width : kOddWidths) {
+        const int in_width = out_width + num_taps;
+        std::vector<float> in = random_floats(sample_dist, 4 * in_width);
+        std::vector<float> weights = random_floats(weight_dist, out_width * num_taps);
+
+        std::uniform_int_distribution<int> first_dist(0, in_width - num_taps);
+        std::vector<int> first(out_width);
+        for (int& f : first) {
+          f = first_dist(rng);
+        }
+
+        auto filter_pixels = [&](std::vector<float>& out, int x0) {
+          for (int x = x0; x < out_width; x++) {
+            for (int c = 0; c < 4; c++) {
+              float sum = 0.0f;
+              for (int k = 0; k < num_taps; k++) {
+                sum += weights[x * num_taps + k] * in[(first[x] + k) * 4 + c];
+              }
+              out[x * 4 + c] = sum;
+            }
+          }
+        };
+
+        std::vector<float> expected(4 * out_width);
+        filter_pixels(expected, 0);
+
+        std::vector<float> out(4 * out_width);
+        int x = kernels.horizontal_4(in.data(), first.data(), weights.data(), num_taps, out.data(), out_width);
+        REQUIRE(x >= 0);
+        REQUIRE(x <= out_width);
+        filter_pixels(out, x);
+
+        INFO("horizontal, width " << out_width << ", " << num_taps << " taps");
+        require_close(out, expected);
+      }
+    }
+  }
+}
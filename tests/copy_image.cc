@@ -0,0 +1,352 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Remuxing images into a new file with heif_context_copy_image(). The copies must decode to the
+// same pixels, keep their compressed data, transformations, grid tiles and thumbnails, and lose
+// their metadata.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+static const char kXMP[] = "<x:xmpmeta xmlns:x='adobe:ns:meta/'></x:xmpmeta>";
+
+
+static heif_image* create_rgb_image(int width, int height)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, width, height, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width * 3; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x * 7 + y * 3);
+    }
+  }
+
+  return img;
+}
+
+
+static heif_image* create_monochrome_image(int width, int height)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(width, height, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_Y, width, height, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_Y, &stride);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x * 5 + y * 11);
+    }
+  }
+
+  return img;
+}
+
+
+// Image 1: 40x30 RGB, rotated by 90 degrees, with a thumbnail and XMP metadata.
+// Image 2: 50x40 monochrome grid of 16x16 tiles.
+static Bytes create_source_file()
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* rgb = create_rgb_image(40, 30);
+
+  heif_encoding_options* options = heif_encoding_options_alloc();
+  options->image_orientation = heif_orientation_rotate_90_cw;
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_encode_image(ctx, rgb, encoder, options, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_encoding_options_free(options);
+
+  err = heif_context_encode_thumbnail(ctx, rgb, handle, encoder, nullptr, 20, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_add_XMP_metadata(ctx, handle, kXMP, static_cast<int>(strlen(kXMP)));
+  REQUIRE(err.code == heif_error_Ok);
+  heif_image_handle_release(handle);
+
+  heif_image* mono = create_monochrome_image(50, 40);
+  err = heif_context_encode_grid(ctx, mono, 16, 16, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_release(rgb);
+  heif_image_release(mono);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+static std::vector<heif_item_id> get_top_level_image_IDs(heif_context* ctx)
+{
+  std::vector<heif_item_id> ids(heif_context_get_number_of_top_level_images(ctx));
+  heif_context_get_list_of_top_level_image_IDs(ctx, ids.data(), (int) ids.size());
+  return ids;
+}
+
+
+static heif_image_handle* get_image_handle(heif_context* ctx, heif_item_id id)
+{
+  heif_image_handle* handle = nullptr;
+  heif_error err = heif_context_get_image_handle(ctx, id, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+  return handle;
+}
+
+
+// The decoded pixels as interleaved RGB, without the row padding.
+static Bytes decode(const heif_image_handle* handle)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int width = heif_image_get_width(img, heif_channel_interleaved);
+  int height = heif_image_get_height(img, heif_channel_interleaved);
+
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+
+  Bytes pixels;
+  for (int y = 0; y < height; y++) {
+    pixels.insert(pixels.end(), p + y * stride, p + y * stride + width * 3);
+  }
+
+  heif_image_release(img);
+  return pixels;
+}
+
+
+// The stored bytes of an item.
+static Bytes get_item_data(heif_context* ctx, const Bytes& file, heif_item_id id)
+{
+  heif_file_range* ranges = nullptr;
+  int num_ranges = 0;
+  heif_error err = heif_item_get_file_ranges(ctx, id, &ranges, &num_ranges);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes data;
+  for (int i = 0; i < num_ranges; i++) {
+    REQUIRE(ranges[i].offset + ranges[i].size <= file.size());
+    data.insert(data.end(), file.begin() + ranges[i].offset, file.begin() + ranges[i].offset + ranges[i].size);
+  }
+
+  heif_file_ranges_release(ranges);
+  return data;
+}
+
+
+static void require_same_image(heif_context* src_ctx, const Bytes& src_file, heif_item_id src_id,
+                               heif_context* dst_ctx, const Bytes& dst_file, heif_item_id dst_id)
+{
+  REQUIRE(heif_item_get_item_type(dst_ctx, dst_id) == heif_item_get_item_type(src_ctx, src_id));
+  REQUIRE(get_item_data(dst_ctx, dst_file, dst_id) == get_item_data(src_ctx, src_file, src_id));
+
+  heif_image_handle* src = get_image_handle(src_ctx, src_id);
+  heif_image_handle* dst = get_image_handle(dst_ctx, dst_id);
+
+  REQUIRE(heif_image_handle_get_width(dst) == heif_image_handle_get_width(src));
+  REQUIRE(heif_image_handle_get_height(dst) == heif_image_handle_get_height(src));
+  REQUIRE(heif_image_handle_get_ispe_width(dst) == heif_image_handle_get_ispe_width(src));
+  REQUIRE(heif_image_handle_get_ispe_height(dst) == heif_image_handle_get_ispe_height(src));
+  REQUIRE(heif_image_handle_get_number_of_thumbnails(dst) == heif_image_handle_get_number_of_thumbnails(src));
+
+  heif_property_id src_transforms[4], dst_transforms[4];
+  int num_transforms = heif_item_get_transformation_properties(src_ctx, src_id, src_transforms, 4);
+  REQUIRE(heif_item_get_transformation_properties(dst_ctx, dst_id, dst_transforms, 4) == num_transforms);
+  for (int i = 0; i < num_transforms; i++) {
+    REQUIRE(heif_item_get_property_type(dst_ctx, dst_id, dst_transforms[i]) ==
+            heif_item_get_property_type(src_ctx, src_id, src_transforms[i]));
+  }
+
+  REQUIRE(decode(dst) == decode(src));
+
+  heif_image_handle_release(src);
+  heif_image_handle_release(dst);
+}
+
+
+TEST_CASE("copy images into a new file")
+{
+  Bytes src_file = create_source_file();
+
+  heif_context* src_ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory(src_ctx, src_file.data(), src_file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> src_ids = get_top_level_image_IDs(src_ctx);
+  REQUIRE(src_ids.size() == 2);
+
+  // Copy the grid image first. It becomes the primary image of the new file.
+  heif_context* dst_ctx = heif_context_alloc();
+  for (heif_item_id id : {src_ids[1], src_ids[0]}) {
+    heif_image_handle* src_handle = get_image_handle(src_ctx, id);
+    heif_image_handle* dst_handle = nullptr;
+    err = heif_context_copy_image(dst_ctx, src_handle, &dst_handle);
+    REQUIRE(err.code == heif_error_Ok);
+    REQUIRE(dst_handle != nullptr);
+    heif_image_handle_release(dst_handle);
+    heif_image_handle_release(src_handle);
+  }
+
+  Bytes dst_file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(dst_ctx, &writer, &dst_file);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_context_free(dst_ctx);
+
+  heif_context* copy_ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(copy_ctx, dst_file.data(), dst_file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> copy_ids = get_top_level_image_IDs(copy_ctx);
+  REQUIRE(copy_ids.size() == 2);
+
+  heif_item_id primary_id;
+  err = heif_context_get_primary_image_ID(copy_ctx, &primary_id);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_item_get_item_type(copy_ctx, primary_id) == heif_fourcc('g', 'r', 'i', 'd'));
+
+  heif_item_id copy_grid_id = primary_id;
+  heif_item_id copy_rgb_id = copy_ids[0] == primary_id ? copy_ids[1] : copy_ids[0];
+
+  SECTION("grid image with its tiles") {
+    require_same_image(src_ctx, src_file, src_ids[1], copy_ctx, dst_file, copy_grid_id);
+
+    // 4x3 tiles and the grid
+    REQUIRE(heif_context_get_number_of_items(copy_ctx) >= 13);
+  }
+
+  SECTION("image with transformation and thumbnail") {
+    require_same_image(src_ctx, src_file, src_ids[0], copy_ctx, dst_file, copy_rgb_id);
+
+    heif_image_handle* src = get_image_handle(src_ctx, src_ids[0]);
+    heif_image_handle* copy = get_image_handle(copy_ctx, copy_rgb_id);
+
+    // rotated by 90 degrees
+    REQUIRE(heif_image_handle_get_width(copy) == 30);
+    REQUIRE(heif_image_handle_get_height(copy) == 40);
+
+    heif_item_id src_thumb_id, copy_thumb_id;
+    REQUIRE(heif_image_handle_get_list_of_thumbnail_IDs(src, &src_thumb_id, 1) == 1);
+    REQUIRE(heif_image_handle_get_list_of_thumbnail_IDs(copy, &copy_thumb_id, 1) == 1);
+
+    heif_image_handle* src_thumb = nullptr;
+    heif_image_handle* copy_thumb = nullptr;
+    REQUIRE(heif_image_handle_get_thumbnail(src, src_thumb_id, &src_thumb).code == heif_error_Ok);
+    REQUIRE(heif_image_handle_get_thumbnail(copy, copy_thumb_id, &copy_thumb).code == heif_error_Ok);
+    REQUIRE(get_item_data(copy_ctx, dst_file, copy_thumb_id) == get_item_data(src_ctx, src_file, src_thumb_id));
+    REQUIRE(decode(copy_thumb) == decode(src_thumb));
+    heif_image_handle_release(src_thumb);
+    heif_image_handle_release(copy_thumb);
+
+    // The metadata stays behind.
+    REQUIRE(heif_image_handle_get_number_of_metadata_blocks(src, nullptr) == 1);
+    REQUIRE(heif_image_handle_get_number_of_metadata_blocks(copy, nullptr) == 0);
+
+    heif_image_handle_release(src);
+    heif_image_handle_release(copy);
+  }
+
+  heif_context_free(copy_ctx);
+  heif_context_free(src_ctx);
+}
+
+
+TEST_CASE("copied data outlives the source context")
+{
+  Bytes src_file = create_source_file();
+
+  // heif_context_read_from_memory() keeps its own copy of the input, which the copied items reference.
+  heif_context* src_ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory(src_ctx, src_file.data(), src_file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* src_handle = nullptr;
+  err = heif_context_get_primary_image_handle(src_ctx, &src_handle);
+  REQUIRE(err.code == heif_error_Ok);
+  Bytes expected = decode(src_handle);
+
+  heif_context* dst_ctx = heif_context_alloc();
+  err = heif_context_copy_image(dst_ctx, src_handle, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle_release(src_handle);
+  heif_context_free(src_ctx);
+  src_file.assign(src_file.size(), 0);
+
+  Bytes dst_file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(dst_ctx, &writer, &dst_file);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_context_free(dst_ctx);
+
+  heif_context* copy_ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(copy_ctx, dst_file.data(), dst_file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* copy = nullptr;
+  err = heif_context_get_primary_image_handle(copy_ctx, &copy);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(decode(copy) == expected);
+
+  heif_image_handle_release(copy);
+  heif_context_free(copy_ctx);
+}
+
+
+TEST_CASE("copy image without source")
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_copy_image(ctx, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(err.subcode == heif_suberror_Null_pointer_argument);
+  heif_context_free(ctx);
+}
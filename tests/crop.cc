@@ -0,0 +1,266 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// HeifPixelImage::crop() shares the pixel memory with the input image and copies a plane only
+// when one of the images writes to it.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "libheif/pixelimage.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+static const int kWidth = 32;
+static const int kHeight = 24;
+
+// inclusive crop rectangle, aligned to the 4:2:0 chroma samples
+static const int kLeft = 6;
+static const int kRight = 21;
+static const int kTop = 4;
+static const int kBottom = 17;
+
+
+static std::shared_ptr<HeifPixelImage> create_image()
+{
+  auto img = std::make_shared<HeifPixelImage>();
+  img->create(kWidth, kHeight, heif_colorspace_YCbCr, heif_chroma_420);
+
+  for (heif_channel channel : {heif_channel_Y, heif_channel_Cb, heif_channel_Cr}) {
+    int width = channel == heif_channel_Y ? kWidth : kWidth / 2;
+    int height = channel == heif_channel_Y ? kHeight : kHeight / 2;
+    REQUIRE(img->add_plane(channel, width, height, 8));
+
+    size_t stride;
+    uint8_t* p = img->get_plane(channel, &stride);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        p[y * stride + x] = static_cast<uint8_t>(x * 3 + y * 11 + channel * 50);
+      }
+    }
+  }
+
+  return img;
+}
+
+
+static const uint8_t* read_plane(const std::shared_ptr<HeifPixelImage>& img, heif_channel channel, size_t* stride)
+{
+  return static_cast<const HeifPixelImage&>(*img).get_plane(channel, stride);
+}
+
+
+static std::shared_ptr<HeifPixelImage> crop(const std::shared_ptr<HeifPixelImage>& img,
+                                            int left, int right, int top, int bottom)
+{
+  std::shared_ptr<HeifPixelImage> cropped;
+  Error err = img->crop(left, right, top, bottom, cropped);
+  REQUIRE(!err);
+  REQUIRE(cropped);
+  return cropped;
+}
+
+
+// Checks that 'cropped' has the pixels of 'original' (a fresh create_image()) at the offset (left,top).
+static void require_cropped_pixels(const std::shared_ptr<HeifPixelImage>& cropped,
+                                   const std::shared_ptr<HeifPixelImage>& original, int left, int top)
+{
+  for (heif_channel channel : {heif_channel_Y, heif_channel_Cb, heif_channel_Cr}) {
+    int scale = channel == heif_channel_Y ? 1 : 2;
+
+    size_t cropped_stride, original_stride;
+    const uint8_t* p_cropped = read_plane(cropped, channel, &cropped_stride);
+    const uint8_t* p_original = read_plane(original, channel, &original_stride);
+
+    int width = cropped->get_width(channel);
+    int height = cropped->get_height(channel);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        REQUIRE(p_cropped[y * cropped_stride + x] ==
+                p_original[(y + top / scale) * original_stride + x + left / scale]);
+      }
+    }
+  }
+}
+
+
+TEST_CASE("crop shares the pixel memory")
+{
+  auto img = create_image();
+  auto cropped = crop(img, kLeft, kRight, kTop, kBottom);
+
+  REQUIRE(cropped->get_width() == kRight - kLeft + 1);
+  REQUIRE(cropped->get_height() == kBottom - kTop + 1);
+  REQUIRE(cropped->get_width(heif_channel_Cb) == (kRight - kLeft + 1) / 2);
+  REQUIRE(cropped->get_height(heif_channel_Cb) == (kBottom - kTop + 1) / 2);
+
+  for (heif_channel channel : {heif_channel_Y, heif_channel_Cb, heif_channel_Cr}) {
+    int scale = channel == heif_channel_Y ? 1 : 2;
+
+    size_t stride, cropped_stride;
+    const uint8_t* p = read_plane(img, channel, &stride);
+    const uint8_t* p_cropped = read_plane(cropped, channel, &cropped_stride);
+
+    REQUIRE(cropped_stride == stride);
+    REQUIRE(p_cropped == p + (kTop / scale) * stride + kLeft / scale);
+  }
+
+  require_cropped_pixels(cropped, create_image(), kLeft, kTop);
+
+  SECTION("crop of a cropped image") {
+    auto cropped2 = crop(cropped, 2, 9, 4, 7);
+
+    size_t stride, cropped_stride;
+    const uint8_t* p = read_plane(img, heif_channel_Y, &stride);
+    const uint8_t* p_cropped = read_plane(cropped2, heif_channel_Y, &cropped_stride);
+    REQUIRE(p_cropped == p + (kTop + 4) * stride + kLeft + 2);
+
+    require_cropped_pixels(cropped2, create_image(), kLeft + 2, kTop + 4);
+  }
+
+  SECTION("the cropped image outlives the input image") {
+    img.reset();
+    require_cropped_pixels(cropped, create_image(), kLeft, kTop);
+  }
+}
+
+
+TEST_CASE("writing to a cropped image copies the plane")
+{
+  auto img = create_image();
+  auto cropped = crop(img, kLeft, kRight, kTop, kBottom);
+
+  size_t stride;
+  const uint8_t* p = read_plane(img, heif_channel_Y, &stride);
+
+  size_t cropped_stride;
+  uint8_t* p_cropped = cropped->get_plane(heif_channel_Y, &cropped_stride);
+  REQUIRE(p_cropped != p + kTop * stride + kLeft);
+
+  // the copy has the cropped pixels
+  require_cropped_pixels(cropped, create_image(), kLeft, kTop);
+
+  p_cropped[0] = static_cast<uint8_t>(p_cropped[0] + 1);
+
+  // the input image is not modified and still uses the same memory
+  REQUIRE(read_plane(img, heif_channel_Y, &stride) == p);
+  REQUIRE(img->get_plane(heif_channel_Y, &stride) == p);
+  require_cropped_pixels(img, create_image(), 0, 0);
+
+  // the chroma planes are still shared
+  size_t chroma_stride, cropped_chroma_stride;
+  const uint8_t* p_chroma = read_plane(img, heif_channel_Cb, &chroma_stride);
+  REQUIRE(read_plane(cropped, heif_channel_Cb, &cropped_chroma_stride) ==
+          p_chroma + (kTop / 2) * chroma_stride + kLeft / 2);
+}
+
+
+TEST_CASE("writing to the input image of a crop copies the plane")
+{
+  auto img = create_image();
+  auto cropped = crop(img, kLeft, kRight, kTop, kBottom);
+
+  size_t cropped_stride;
+  const uint8_t* p_cropped = read_plane(cropped, heif_channel_Y, &cropped_stride);
+
+  size_t stride;
+  uint8_t* p = img->get_plane(heif_channel_Y, &stride);
+  REQUIRE(p != p_cropped - kTop * stride - kLeft);
+
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth; x++) {
+      p[y * stride + x] = 0;
+    }
+  }
+
+  // the cropped image keeps the original pixels
+  REQUIRE(read_plane(cropped, heif_channel_Y, &cropped_stride) == p_cropped);
+  require_cropped_pixels(cropped, create_image(), kLeft, kTop);
+}
+
+
+TEST_CASE("writing after the crop is released does not copy")
+{
+  auto img = create_image();
+
+  size_t stride;
+  const uint8_t* p = read_plane(img, heif_channel_Y, &stride);
+
+  auto cropped = crop(img, kLeft, kRight, kTop, kBottom);
+  cropped.reset();
+
+  REQUIRE(img->get_plane(heif_channel_Y, &stride) == p);
+}
+
+
+static void count_release(void* user_data)
+{
+  (*static_cast<int*>(user_data))++;
+}
+
+
+TEST_CASE("heif_image_crop() of read-only external planes")
+{
+  std::vector<uint8_t> buffer(kWidth * kHeight);
+  for (size_t i = 0; i < buffer.size(); i++) {
+    buffer[i] = static_cast<uint8_t>(i * 7);
+  }
+  const std::vector<uint8_t> original_buffer = buffer;
+
+  int num_released = 0;
+
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_external_read_only_plane(img, heif_channel_Y, kWidth, kHeight, 8, buffer.data(), kWidth,
+                                                count_release, &num_released);
+  REQUIRE(err.code == heif_error_Ok);
+
+  // crops 'kLeft' columns at the left, 'kTop' rows at the top, and so on
+  err = heif_image_crop(img, kLeft, kWidth - 1 - kRight, kTop, kHeight - 1 - kBottom);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_image_get_width(img, heif_channel_Y) == kRight - kLeft + 1);
+  REQUIRE(heif_image_get_height(img, heif_channel_Y) == kBottom - kTop + 1);
+
+  // The cropped image refers to the buffer and keeps it referenced.
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(img, heif_channel_Y, &stride);
+  REQUIRE(p == buffer.data() + kTop * kWidth + kLeft);
+  REQUIRE(stride == kWidth);
+  REQUIRE(num_released == 0);
+
+  // Writable access copies the plane, the buffer is never written.
+  uint8_t* p_writable = heif_image_get_plane(img, heif_channel_Y, &stride);
+  REQUIRE(p_writable != p);
+  REQUIRE(p_writable[0] == buffer[kTop * kWidth + kLeft]);
+  p_writable[0] = static_cast<uint8_t>(p_writable[0] + 1);
+  REQUIRE(buffer == original_buffer);
+  REQUIRE(num_released == 1);
+
+  heif_image_release(img);
+  REQUIRE(num_released == 1);
+}
@@ -0,0 +1,202 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Limiting the decoding work of grid images relative to the size of their coded data. The files are
+// built box by box since the encoder does not write grids that refer to the same tile several times.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <vector>
+
+
+static const int kTileSize = 16;
+static const int kGridSize = 8; // tiles per row and column
+static const uint16_t kGridID = 100;
+
+
+// A 128x128 'grid' of 8x8 monochrome 'unci' tiles. The tiles are either separate images
+// or all references point to the same tile image.
+static Bytes create_file(bool distinct_tiles)
+{
+  Bytes ispe_grid, ispe_tile;
+  put32(ispe_grid, kTileSize * kGridSize);
+  put32(ispe_grid, kTileSize * kGridSize);
+  put32(ispe_tile, kTileSize);
+  put32(ispe_tile, kTileSize);
+
+  Bytes cmpd;
+  put16(cmpd, 1);
+  put16(cmpd, 0); // monochrome
+
+  Bytes uncC;
+  put32(uncC, 0); // profile
+  put16(uncC, 1); // component count
+  put16(uncC, 0); // component index
+  uncC.insert(uncC.end(), {7, 0, 0}); // 8 bit unsigned, no alignment
+  uncC.insert(uncC.end(), {0, 0, 0, 0, 0}); // sampling, interleave, block size, flags, pixel size
+  put32(uncC, 0); // row align
+  put32(uncC, 0); // tile align
+  put32(uncC, 0); // tile columns - 1
+  put32(uncC, 0); // tile rows - 1
+
+  Bytes ipco = concat({make_full_box("ispe", 0, ispe_grid),
+                       make_full_box("ispe", 0, ispe_tile),
+                       make_box("cmpd", cmpd),
+                       make_full_box("uncC", 0, uncC)});
+
+  int num_tile_items = distinct_tiles ? kGridSize * kGridSize : 1;
+  int num_items = num_tile_items + 1;
+
+  Bytes hdlr = {0, 0, 0, 0};
+  put_fourcc(hdlr, "pict");
+  hdlr.resize(hdlr.size() + 13);
+
+  Bytes pitm;
+  put16(pitm, kGridID);
+
+  Bytes iinf;
+  put16(iinf, static_cast<uint32_t>(num_items));
+
+  // the item data is stored in 'idat' (construction method 1)
+  Bytes iloc = {0x44, 0x00};
+  put16(iloc, static_cast<uint32_t>(num_items));
+
+  Bytes ipma;
+  put32(ipma, static_cast<uint32_t>(num_items));
+
+  Bytes idat;
+
+  Bytes grid = {0, 0, kGridSize - 1, kGridSize - 1}; // version, flags, rows - 1, columns - 1
+  put16(grid, kTileSize * kGridSize);
+  put16(grid, kTileSize * kGridSize);
+
+  Bytes dimg;
+  put16(dimg, kGridID);
+  put16(dimg, kGridSize * kGridSize);
+
+  for (int i = 0; i < num_items; i++) {
+    bool is_grid = (i == num_tile_items);
+    uint16_t id = is_grid ? kGridID : static_cast<uint16_t>(i + 1);
+    Bytes data = is_grid ? grid : Bytes(kTileSize * kTileSize, static_cast<uint8_t>(i));
+
+    Bytes infe;
+    put16(infe, id);
+    put16(infe, 0);
+    put_fourcc(infe, is_grid ? "grid" : "unci");
+    infe.push_back(0);
+    Bytes infe_box = make_full_box("infe", 2, infe);
+    iinf.insert(iinf.end(), infe_box.begin(), infe_box.end());
+
+    put16(iloc, id);
+    put16(iloc, 1); // construction method
+    put16(iloc, 0); // data reference index
+    put16(iloc, 1); // extent count
+    put32(iloc, static_cast<uint32_t>(idat.size()));
+    put32(iloc, static_cast<uint32_t>(data.size()));
+    idat.insert(idat.end(), data.begin(), data.end());
+
+    put16(ipma, id);
+    if (is_grid) {
+      ipma.insert(ipma.end(), {1, 1});
+    }
+    else {
+      ipma.insert(ipma.end(), {3, 2, 3, 4});
+    }
+  }
+
+  for (int tile = 0; tile < kGridSize * kGridSize; tile++) {
+    put16(dimg, distinct_tiles ? tile + 1 : 1);
+  }
+
+  Bytes meta = concat({make_full_box("hdlr", 0, hdlr),
+                       make_full_box("pitm", 0, pitm),
+                       make_full_box("iinf", 0, iinf),
+                       make_full_box("iloc", 1, iloc),
+                       make_box("idat", idat),
+                       make_box("iprp", concat({make_box("ipco", ipco), make_full_box("ipma", 0, ipma)})),
+                       make_full_box("iref", 0, make_box("dimg", dimg))});
+
+  Bytes ftyp;
+  put_fourcc(ftyp, "mif1");
+  put32(ftyp, 0);
+  put_fourcc(ftyp, "mif1");
+
+  return concat({make_box("ftyp", ftyp), make_full_box("meta", 0, meta)});
+}
+
+
+static heif_error decode_grid(bool distinct_tiles, uint64_t base_work, uint32_t work_per_input_byte)
+{
+  Bytes file = create_file(distinct_tiles);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_context_set_decoding_work_limit(ctx, base_work, work_per_input_byte);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = nullptr;
+  err = heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  if (err.code == heif_error_Ok) {
+    REQUIRE(heif_image_get_primary_width(img) == kTileSize * kGridSize);
+  }
+  else {
+    REQUIRE(img == nullptr);
+  }
+
+  heif_image_release(img);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+
+  return err;
+}
+
+
+TEST_CASE("decoding work limit")
+{
+  // The grid decodes 64 tiles of 256 pixels and composes 16384 pixels. The work is the same for
+  // both files, but the file with a single tile image has only 264 bytes of coded data.
+  heif_error err = decode_grid(false, 100000, 100);
+  REQUIRE(err.code == heif_error_Memory_allocation_error);
+  REQUIRE(err.subcode == heif_suberror_Decoding_work_limit_exceeded);
+
+  err = decode_grid(true, 100000, 100);
+  REQUIRE(err.code == heif_error_Ok);
+
+  // default limit
+  err = decode_grid(false, 1 << 28, 16384);
+  REQUIRE(err.code == heif_error_Ok);
+
+  // no limit
+  err = decode_grid(false, 0, 0);
+  REQUIRE(err.code == heif_error_Ok);
+}
@@ -0,0 +1,255 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Tiled encoding with heif_context_encode_grid(). The uncompressed codec is lossless, so the grid
+// has to decode to exactly the input image, also across the padded border tiles.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <vector>
+
+
+static const int kWidth = 100;
+static const int kHeight = 70;
+static const int kTileSize = 32;
+
+// 4x3 tiles, the right column and the bottom row are padded
+static const int kNumTiles = 4 * 3;
+
+
+static heif_image* create_image(bool with_alpha, int width = kWidth, int height = kHeight)
+{
+  heif_chroma chroma = with_alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB;
+  int bytes_per_pixel = with_alpha ? 4 : 3;
+
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(width, height, heif_colorspace_RGB, chroma, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, width, height, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width * bytes_per_pixel; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x * 7 + y * 13);
+    }
+  }
+
+  return img;
+}
+
+
+static Bytes get_pixels(const heif_image* img, int bytes_per_pixel)
+{
+  int width = heif_image_get_width(img, heif_channel_interleaved);
+  int height = heif_image_get_height(img, heif_channel_interleaved);
+
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+
+  Bytes pixels;
+  for (int y = 0; y < height; y++) {
+    pixels.insert(pixels.end(), p + y * stride, p + y * stride + width * bytes_per_pixel);
+  }
+
+  return pixels;
+}
+
+
+static Bytes encode_grid(const heif_image* img, int num_threads, const heif_encoding_options* options = nullptr)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_context_set_max_decoding_threads(ctx, num_threads);
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_encode_grid(ctx, img, kTileSize, kTileSize, encoder, options, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(handle != nullptr);
+  heif_image_handle_release(handle);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+static std::vector<heif_item_id> get_tile_IDs(heif_context* ctx)
+{
+  std::vector<heif_item_id> ids(heif_context_get_number_of_items(ctx));
+  heif_context_get_list_of_item_IDs(ctx, ids.data(), (int) ids.size());
+
+  std::vector<heif_item_id> tiles;
+  for (heif_item_id id : ids) {
+    if (heif_item_get_item_type(ctx, id) != heif_fourcc('g', 'r', 'i', 'd')) {
+      tiles.push_back(id);
+    }
+  }
+
+  return tiles;
+}
+
+
+static heif_property_id get_property(heif_context* ctx, heif_item_id id, heif_item_property_type type)
+{
+  heif_property_id property = 0;
+  REQUIRE(heif_item_get_properties_of_type(ctx, id, type, &property, 1) == 1);
+  return property;
+}
+
+
+TEST_CASE("encode grid")
+{
+  bool with_alpha = GENERATE(false, true);
+  int bytes_per_pixel = with_alpha ? 4 : 3;
+  heif_chroma chroma = with_alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB;
+
+  heif_image* input = create_image(with_alpha);
+  Bytes file = encode_grid(input, 0);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(heif_context_get_number_of_top_level_images(ctx) == 1);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_item_id grid_id = heif_image_handle_get_item_id(handle);
+  REQUIRE(heif_item_get_item_type(ctx, grid_id) == heif_fourcc('g', 'r', 'i', 'd'));
+  REQUIRE(heif_image_handle_get_width(handle) == kWidth);
+  REQUIRE(heif_image_handle_get_height(handle) == kHeight);
+
+  // All tiles are hidden and share their properties, i.e. they all have the full tile size.
+  std::vector<heif_item_id> tiles = get_tile_IDs(ctx);
+  REQUIRE(tiles.size() == kNumTiles);
+
+  heif_property_id tile_ispe = get_property(ctx, tiles[0], heif_item_property_type_image_size);
+  for (heif_item_id tile : tiles) {
+    REQUIRE(heif_item_is_item_hidden(ctx, tile));
+    REQUIRE(get_property(ctx, tile, heif_item_property_type_image_size) == tile_ispe);
+  }
+
+  heif_image* decoded = nullptr;
+  err = heif_decode_image(handle, &decoded, heif_colorspace_RGB, chroma, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(get_pixels(decoded, bytes_per_pixel) == get_pixels(input, bytes_per_pixel));
+
+  heif_image_release(decoded);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+  heif_image_release(input);
+}
+
+
+TEST_CASE("encode grid on several threads")
+{
+  // The tiles are stored in grid order, independent of the order in which they were encoded.
+  heif_image* input = create_image(false);
+  Bytes single_threaded = encode_grid(input, 0);
+  Bytes multi_threaded = encode_grid(input, 4);
+  REQUIRE(multi_threaded == single_threaded);
+  heif_image_release(input);
+}
+
+
+TEST_CASE("encode grid with orientation")
+{
+  heif_image* input = create_image(false);
+
+  heif_encoding_options* options = heif_encoding_options_alloc();
+  options->image_orientation = heif_orientation_rotate_90_cw;
+  Bytes file = encode_grid(input, 0, options);
+  heif_encoding_options_free(options);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_image_handle_get_width(handle) == kHeight);
+  REQUIRE(heif_image_handle_get_height(handle) == kWidth);
+
+  // The rotation is stored at the grid image only.
+  heif_property_id transforms[4];
+  REQUIRE(heif_item_get_transformation_properties(ctx, heif_image_handle_get_item_id(handle), transforms, 4) == 1);
+  for (heif_item_id tile : get_tile_IDs(ctx)) {
+    REQUIRE(heif_item_get_transformation_properties(ctx, tile, transforms, 4) == 0);
+  }
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+  heif_image_release(input);
+}
+
+
+TEST_CASE("encode grid with invalid tile size")
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* input = create_image(false);
+
+  err = heif_context_encode_grid(ctx, input, 0, kTileSize, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(err.subcode == heif_suberror_Invalid_parameter_value);
+
+  err = heif_context_encode_grid(ctx, input, kTileSize, 0, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(err.subcode == heif_suberror_Invalid_parameter_value);
+
+  // more than 256 tile columns
+  heif_image* wide_input = create_image(false, 257, 1);
+  err = heif_context_encode_grid(ctx, wide_input, 1, 1, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(err.subcode == heif_suberror_Invalid_parameter_value);
+
+  REQUIRE(heif_context_get_number_of_top_level_images(ctx) == 0);
+
+  heif_image_release(wide_input);
+  heif_image_release(input);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+}
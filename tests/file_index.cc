@@ -0,0 +1,333 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Reopening a file with the index written by heif_context_write_file_index().
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+static const char kXMP[] = "<x:xmpmeta xmlns:x='adobe:ns:meta/'></x:xmpmeta>";
+
+
+static heif_image* create_image(int width, int height, uint8_t seed)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(width, height, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_Y, width, height, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_Y, &stride);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x + y * 3 + seed);
+    }
+  }
+
+  return img;
+}
+
+
+// Two images, the second one with XMP metadata.
+static Bytes create_file()
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img1 = create_image(32, 16, 0);
+  heif_image* img2 = create_image(24, 8, 100);
+
+  err = heif_context_encode_image(ctx, img1, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_encode_image(ctx, img2, encoder, nullptr, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_add_XMP_metadata(ctx, handle, kXMP, static_cast<int>(strlen(kXMP)));
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle_release(handle);
+  heif_image_release(img1);
+  heif_image_release(img2);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+static Bytes write_file_index(const Bytes& file)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes index;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write_file_index(ctx, &writer, &index);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(!index.empty());
+
+  heif_context_free(ctx);
+  return index;
+}
+
+
+// Offset of the item data in the 'mdat' box written by heif_context_write().
+static int64_t find_mdat_content(const Bytes& file)
+{
+  size_t pos = 0;
+  while (pos + 8 <= file.size()) {
+    uint32_t size = (uint32_t(file[pos]) << 24) | (uint32_t(file[pos + 1]) << 16) |
+                    (uint32_t(file[pos + 2]) << 8) | uint32_t(file[pos + 3]);
+    if (memcmp(&file[pos + 4], "mdat", 4) == 0) {
+      return (int64_t) pos + 8;
+    }
+
+    REQUIRE(size >= 8);
+    pos += size;
+  }
+
+  FAIL("no 'mdat' box");
+  return 0;
+}
+
+
+// --- a reader that counts the read() calls and remembers the lowest position read
+
+struct CountingReader
+{
+  explicit CountingReader(const Bytes* d) : data(d) {}
+
+  const Bytes* data;
+  int64_t position = 0;
+  int num_reads = 0;
+  int64_t first_read_position = -1;
+};
+
+static int64_t counting_get_position(void* userdata)
+{
+  return static_cast<CountingReader*>(userdata)->position;
+}
+
+static int counting_read(void* data, size_t size, void* userdata)
+{
+  auto* reader = static_cast<CountingReader*>(userdata);
+  if (reader->position + (int64_t) size > (int64_t) reader->data->size()) {
+    return 1;
+  }
+
+  if (reader->num_reads == 0 || reader->position < reader->first_read_position) {
+    reader->first_read_position = reader->position;
+  }
+
+  memcpy(data, reader->data->data() + reader->position, size);
+  reader->position += size;
+  reader->num_reads++;
+  return 0;
+}
+
+static int counting_seek(int64_t position, void* userdata)
+{
+  static_cast<CountingReader*>(userdata)->position = position;
+  return 0;
+}
+
+static heif_reader_grow_status counting_wait_for_file_size(int64_t target_size, void* userdata)
+{
+  auto* reader = static_cast<CountingReader*>(userdata);
+  return target_size > (int64_t) reader->data->size() ? heif_reader_grow_status_size_beyond_eof : heif_reader_grow_status_size_reached;
+}
+
+static const heif_reader kCountingReader{1, counting_get_position, counting_read, counting_seek, counting_wait_for_file_size, nullptr};
+
+
+static heif_error read_with_index(heif_context* ctx, CountingReader* reader, const Bytes& index)
+{
+  heif_reading_options* options = heif_reading_options_alloc();
+  REQUIRE(options->version >= 2);
+  options->file_index = index.data();
+  options->file_index_size = index.size();
+
+  heif_error err = heif_context_read_from_reader(ctx, &kCountingReader, reader, options);
+  heif_reading_options_free(options);
+  return err;
+}
+
+
+static void check_file_content(heif_context* ctx)
+{
+  REQUIRE(heif_context_get_number_of_top_level_images(ctx) == 2);
+
+  heif_item_id ids[2];
+  REQUIRE(heif_context_get_list_of_top_level_image_IDs(ctx, ids, 2) == 2);
+
+  const int widths[2] = {32, 24};
+  const int heights[2] = {16, 8};
+  const uint8_t seeds[2] = {0, 100};
+
+  for (int i = 0; i < 2; i++) {
+    heif_image_handle* handle = nullptr;
+    heif_error err = heif_context_get_image_handle(ctx, ids[i], &handle);
+    REQUIRE(err.code == heif_error_Ok);
+    REQUIRE(heif_image_handle_get_width(handle) == widths[i]);
+    REQUIRE(heif_image_handle_get_height(handle) == heights[i]);
+    REQUIRE(heif_image_handle_get_number_of_metadata_blocks(handle, nullptr) == i);
+
+    heif_image* img = nullptr;
+    err = heif_decode_image(handle, &img, heif_colorspace_monochrome, heif_chroma_monochrome, nullptr);
+    REQUIRE(err.code == heif_error_Ok);
+
+    int stride;
+    const uint8_t* p = heif_image_get_plane_readonly(img, heif_channel_Y, &stride);
+    for (int y = 0; y < heights[i]; y++) {
+      for (int x = 0; x < widths[i]; x++) {
+        REQUIRE(p[y * stride + x] == static_cast<uint8_t>(x + y * 3 + seeds[i]));
+      }
+    }
+
+    heif_image_release(img);
+    heif_image_handle_release(handle);
+  }
+}
+
+
+TEST_CASE("reading a file with its file index")
+{
+  Bytes file = create_file();
+
+  CountingReader parsed_reader{&file};
+  heif_context* parsed_ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_reader(parsed_ctx, &kCountingReader, &parsed_reader, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  int reads_without_index = parsed_reader.num_reads;
+  heif_context_free(parsed_ctx);
+
+  // The index data is only needed while the file is read.
+  auto* index = new Bytes(write_file_index(file));
+
+  CountingReader reader{&file};
+  heif_context* ctx = heif_context_alloc();
+  err = read_with_index(ctx, &reader, *index);
+  REQUIRE(err.code == heif_error_Ok);
+  delete index;
+
+  // The 'ftyp' and 'meta' boxes are not read from the input. Only the item data behind them is.
+  REQUIRE(parsed_reader.first_read_position == 0);
+  REQUIRE(reader.num_reads < reads_without_index);
+  if (reader.num_reads > 0) {
+    REQUIRE(reader.first_read_position >= find_mdat_content(file));
+  }
+
+  check_file_content(ctx);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("file index that does not match the input")
+{
+  Bytes file = create_file();
+  Bytes index = write_file_index(file);
+
+  SECTION("different file size") {
+    Bytes longer_file = file;
+    longer_file.push_back(0);
+
+    CountingReader reader{&longer_file};
+    heif_context* ctx = heif_context_alloc();
+    heif_error err = read_with_index(ctx, &reader, index);
+    REQUIRE(err.code == heif_error_Usage_error);
+    REQUIRE(err.subcode == heif_suberror_Invalid_parameter_value);
+    heif_context_free(ctx);
+  }
+
+  SECTION("damaged index") {
+    Bytes damaged = index;
+    damaged[damaged.size() / 2] ^= 1;
+
+    CountingReader reader{&file};
+    heif_context* ctx = heif_context_alloc();
+    heif_error err = read_with_index(ctx, &reader, damaged);
+    REQUIRE(err.code == heif_error_Usage_error);
+    REQUIRE(err.subcode == heif_suberror_Invalid_parameter_value);
+    heif_context_free(ctx);
+  }
+
+  SECTION("truncated index") {
+    Bytes truncated(index.begin(), index.begin() + 4);
+
+    CountingReader reader{&file};
+    heif_context* ctx = heif_context_alloc();
+    heif_error err = read_with_index(ctx, &reader, truncated);
+    REQUIRE(err.code == heif_error_Usage_error);
+    heif_context_free(ctx);
+  }
+
+  // The same file can still be read without the index.
+  CountingReader reader{&file};
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_reader(ctx, &kCountingReader, &reader, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  check_file_content(ctx);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("no file index for partially read files")
+{
+  Bytes file = create_file();
+
+  heif_reading_options* options = heif_reading_options_alloc();
+  options->metadata_only = true;
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), options);
+  heif_reading_options_free(options);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes index;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write_file_index(ctx, &writer, &index);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(index.empty());
+
+  heif_context_free(ctx);
+}
@@ -0,0 +1,298 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+// The file ranges that are needed to decode an image, from heif_image_handle_get_file_ranges_for_decoding().
+// They have to cover the 'iloc' extents of the image and the images it is derived from, but no other items.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+static const int kWidth = 100;
+static const int kHeight = 70;
+static const int kTileSize = 32;
+
+// 4x3 tiles
+static const int kColumns = 4;
+static const int kNumTiles = 4 * 3;
+
+static const char kXMP[] = "<x:xmpmeta xmlns:x='adobe:ns:meta/'></x:xmpmeta>";
+
+
+static heif_image* create_image(int width, int height, uint8_t seed)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, width, height, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width * 3; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x * 7 + y * 13 + seed);
+    }
+  }
+
+  return img;
+}
+
+
+// A grid as primary image and a second image with XMP metadata that are not needed to decode the grid.
+static Bytes create_file()
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* grid_img = create_image(kWidth, kHeight, 0);
+  heif_image* img = create_image(24, 16, 100);
+
+  err = heif_context_encode_grid(ctx, grid_img, kTileSize, kTileSize, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_add_XMP_metadata(ctx, handle, kXMP, static_cast<int>(strlen(kXMP)));
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle_release(handle);
+  heif_image_release(grid_img);
+  heif_image_release(img);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+struct FileItems
+{
+  heif_item_id grid = 0;
+  std::vector<heif_item_id> tiles; // in grid order
+  heif_item_id image = 0;
+  heif_item_id xmp = 0;
+};
+
+
+static FileItems get_items(heif_context* ctx)
+{
+  FileItems items;
+  heif_error err = heif_context_get_primary_image_ID(ctx, &items.grid);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_item_id top_level[2];
+  REQUIRE(heif_context_get_list_of_top_level_image_IDs(ctx, top_level, 2) == 2);
+  items.image = (top_level[0] == items.grid ? top_level[1] : top_level[0]);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_image_handle(ctx, items.image, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_image_handle_get_list_of_metadata_block_IDs(handle, nullptr, &items.xmp, 1) == 1);
+  heif_image_handle_release(handle);
+
+  std::vector<heif_item_id> ids(heif_context_get_number_of_items(ctx));
+  heif_context_get_list_of_item_IDs(ctx, ids.data(), (int) ids.size());
+
+  for (heif_item_id id : ids) {
+    if (id != items.grid && id != items.image && id != items.xmp) {
+      items.tiles.push_back(id);
+    }
+  }
+
+  REQUIRE(items.tiles.size() == kNumTiles);
+
+  return items;
+}
+
+
+static std::vector<heif_file_range> get_item_ranges(heif_context* ctx, heif_item_id id)
+{
+  heif_file_range* ranges = nullptr;
+  int num_ranges = 0;
+  heif_error err = heif_item_get_file_ranges(ctx, id, &ranges, &num_ranges);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(num_ranges > 0);
+
+  std::vector<heif_file_range> result(ranges, ranges + num_ranges);
+  heif_file_ranges_release(ranges);
+  return result;
+}
+
+
+static std::vector<heif_file_range> get_ranges_for_decoding(heif_context* ctx, heif_item_id id,
+                                                            int x, int y, int width, int height)
+{
+  heif_image_handle* handle = nullptr;
+  heif_error err = heif_context_get_image_handle(ctx, id, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_file_range* ranges = nullptr;
+  int num_ranges = 0;
+  err = heif_image_handle_get_file_ranges_for_decoding(handle, x, y, width, height, nullptr, &ranges, &num_ranges);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_file_range> result(ranges, ranges + num_ranges);
+  heif_file_ranges_release(ranges);
+  heif_image_handle_release(handle);
+
+  // sorted, with overlapping and adjacent ranges merged
+  for (size_t i = 0; i < result.size(); i++) {
+    REQUIRE(result[i].size > 0);
+    if (i > 0) {
+      REQUIRE(result[i - 1].offset + result[i - 1].size < result[i].offset);
+    }
+  }
+
+  return result;
+}
+
+
+static bool covers(const std::vector<heif_file_range>& ranges, const heif_file_range& extent)
+{
+  for (const auto& range : ranges) {
+    if (range.offset <= extent.offset && extent.offset + extent.size <= range.offset + range.size) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static bool overlaps(const std::vector<heif_file_range>& ranges, const heif_file_range& extent)
+{
+  for (const auto& range : ranges) {
+    if (range.offset < extent.offset + extent.size && extent.offset < range.offset + range.size) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static void require_items(heif_context* ctx, const std::vector<heif_file_range>& ranges,
+                          const std::vector<heif_item_id>& needed, const std::vector<heif_item_id>& unrelated)
+{
+  for (heif_item_id id : needed) {
+    for (const auto& extent : get_item_ranges(ctx, id)) {
+      REQUIRE(covers(ranges, extent));
+    }
+  }
+
+  for (heif_item_id id : unrelated) {
+    for (const auto& extent : get_item_ranges(ctx, id)) {
+      REQUIRE(!overlaps(ranges, extent));
+    }
+  }
+}
+
+
+TEST_CASE("file ranges for decoding an image")
+{
+  Bytes file = create_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  FileItems items = get_items(ctx);
+
+  std::vector<heif_file_range> ranges = get_ranges_for_decoding(ctx, items.image, 0, 0, 0, 0);
+  for (const auto& range : ranges) {
+    REQUIRE(range.offset + range.size <= file.size());
+  }
+
+  std::vector<heif_item_id> unrelated = items.tiles;
+  unrelated.push_back(items.grid);
+  unrelated.push_back(items.xmp);
+  require_items(ctx, ranges, {items.image}, unrelated);
+
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("file ranges for decoding a grid")
+{
+  Bytes file = create_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  FileItems items = get_items(ctx);
+
+  SECTION("whole image") {
+    std::vector<heif_file_range> ranges = get_ranges_for_decoding(ctx, items.grid, 0, 0, 0, 0);
+
+    std::vector<heif_item_id> needed = items.tiles;
+    needed.push_back(items.grid);
+    require_items(ctx, ranges, needed, {items.image, items.xmp});
+  }
+
+  SECTION("region within the first tile") {
+    std::vector<heif_file_range> ranges = get_ranges_for_decoding(ctx, items.grid, 3, 5, 10, 10);
+
+    std::vector<heif_item_id> unrelated(items.tiles.begin() + 1, items.tiles.end());
+    unrelated.push_back(items.image);
+    unrelated.push_back(items.xmp);
+    require_items(ctx, ranges, {items.grid, items.tiles[0]}, unrelated);
+  }
+
+  SECTION("region across the tiles of the bottom row") {
+    std::vector<heif_file_range> ranges = get_ranges_for_decoding(ctx, items.grid, 40, 66, 40, 4);
+
+    // columns 1 and 2 of the last row
+    std::vector<heif_item_id> needed{items.grid, items.tiles[2 * kColumns + 1], items.tiles[2 * kColumns + 2]};
+
+    std::vector<heif_item_id> unrelated{items.image, items.xmp};
+    for (size_t i = 0; i < items.tiles.size(); i++) {
+      if (i != 2 * kColumns + 1 && i != 2 * kColumns + 2) {
+        unrelated.push_back(items.tiles[i]);
+      }
+    }
+
+    require_items(ctx, ranges, needed, unrelated);
+  }
+
+  heif_context_free(ctx);
+}
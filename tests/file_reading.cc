@@ -0,0 +1,157 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Reading files by name, with and without mapping them into memory.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+static const char* kTestFile = "file_reading_test.heif";
+
+
+// An image that is larger than the buffer of the file stream, such that it is not read with the 'meta' box.
+static void write_test_file()
+{
+  const int width = 256;
+  const int height = 256;
+
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, width, height, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width * 3; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x * 7 + y);
+    }
+  }
+
+  heif_context* ctx = heif_context_alloc();
+  heif_encoder* encoder = nullptr;
+  err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_context_write_to_file(ctx, kTestFile);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_image_release(img);
+  heif_context_free(ctx);
+}
+
+
+static heif_context* open_test_file(bool memory_mapping)
+{
+  heif_reading_options* options = heif_reading_options_alloc();
+  REQUIRE(options->version >= 3);
+  REQUIRE(options->disable_memory_mapping == false);
+  options->metadata_only = true;
+  options->disable_memory_mapping = !memory_mapping;
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_file(ctx, kTestFile, options);
+  heif_reading_options_free(options);
+  REQUIRE(err.code == heif_error_Ok);
+
+  return ctx;
+}
+
+
+static std::vector<uint8_t> decode_primary_image(heif_context* ctx, heif_error* out_err)
+{
+  heif_image_handle* handle = nullptr;
+  heif_error err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<uint8_t> pixels;
+
+  heif_image* img = nullptr;
+  *out_err = heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  if (out_err->code == heif_error_Ok) {
+    int stride;
+    const uint8_t* p = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+    int width = heif_image_get_width(img, heif_channel_interleaved);
+    for (int y = 0; y < heif_image_get_height(img, heif_channel_interleaved); y++) {
+      pixels.insert(pixels.end(), p + y * stride, p + y * stride + width * 3);
+    }
+
+    heif_image_release(img);
+  }
+
+  heif_image_handle_release(handle);
+  return pixels;
+}
+
+
+TEST_CASE("reading with and without memory mapping")
+{
+  write_test_file();
+
+  heif_error err;
+
+  heif_context* mapped_ctx = open_test_file(true);
+  std::vector<uint8_t> mapped_pixels = decode_primary_image(mapped_ctx, &err);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_context_free(mapped_ctx);
+
+  heif_context* read_ctx = open_test_file(false);
+  std::vector<uint8_t> read_pixels = decode_primary_image(read_ctx, &err);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_context_free(read_ctx);
+
+  REQUIRE(!mapped_pixels.empty());
+  REQUIRE(mapped_pixels == read_pixels);
+
+  std::remove(kTestFile);
+}
+
+
+TEST_CASE("file truncated while it is read without memory mapping")
+{
+  write_test_file();
+
+  heif_context* ctx = open_test_file(false);
+
+  // another process truncates the file (a mapped file would raise SIGBUS when the image is decoded)
+  std::ofstream(kTestFile, std::ios::binary | std::ios::trunc).close();
+
+  heif_error err;
+  decode_primary_image(ctx, &err);
+  REQUIRE(err.code != heif_error_Ok);
+
+  heif_context_free(ctx);
+  std::remove(kTestFile);
+}
@@ -0,0 +1,279 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// The gdk-pixbuf loader module, fed with a grid image in chunks like GdkPixbufLoader does.
+// The module is loaded from PIXBUF_LOADER_MODULE, the path of the built module.
+
+#define GDK_PIXBUF_ENABLE_BACKEND
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <gdk-pixbuf/gdk-pixbuf-io.h>
+#include <dlfcn.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+static const int kWidth = 96;
+static const int kHeight = 64;
+static const int kTileSize = 32;
+
+
+static const GdkPixbufModule& get_module()
+{
+  static GdkPixbufModule module;
+  static bool loaded = false;
+
+  if (!loaded) {
+    void* handle = dlopen(PIXBUF_LOADER_MODULE, RTLD_NOW);
+    REQUIRE(handle != nullptr);
+
+    auto fill_vtable = reinterpret_cast<void (*)(GdkPixbufModule*)>(dlsym(handle, "fill_vtable"));
+    REQUIRE(fill_vtable != nullptr);
+
+    memset(&module, 0, sizeof(module));
+    fill_vtable(&module);
+    REQUIRE(module.begin_load != nullptr);
+    REQUIRE(module.load_increment != nullptr);
+    REQUIRE(module.stop_load != nullptr);
+
+    loaded = true;
+  }
+
+  return module;
+}
+
+
+static heif_image* create_image()
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, kWidth, kHeight, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth * 3; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x * 5 + y * 3);
+    }
+  }
+
+  return img;
+}
+
+
+// A grid with 3x2 uncompressed tiles, such that the tiles are decoded while the file is loading.
+static Bytes create_file(const heif_image* img)
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_encode_grid(ctx, img, kTileSize, kTileSize, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+  return file;
+}
+
+
+struct LoadResult
+{
+  // the size set by the size function, negative values keep the image size
+  int requested_width = -1;
+  int requested_height = -1;
+
+  int num_size_calls = 0;
+  int image_width = 0;
+  int image_height = 0;
+
+  GdkPixbuf* pixbuf = nullptr;
+  int num_updates = 0;
+
+  GError* error = nullptr;
+
+  ~LoadResult()
+  {
+    if (pixbuf) {
+      g_object_unref(pixbuf);
+    }
+
+    if (error) {
+      g_error_free(error);
+    }
+  }
+};
+
+
+static void size_func(gint* width, gint* height, gpointer user_data)
+{
+  auto* result = static_cast<LoadResult*>(user_data);
+  result->num_size_calls++;
+  result->image_width = *width;
+  result->image_height = *height;
+
+  if (result->requested_width >= 0) {
+    *width = result->requested_width;
+    *height = result->requested_height;
+  }
+}
+
+
+static void prepared_func(GdkPixbuf* pixbuf, GdkPixbufAnimation*, gpointer user_data)
+{
+  auto* result = static_cast<LoadResult*>(user_data);
+  REQUIRE(result->pixbuf == nullptr);
+  result->pixbuf = GDK_PIXBUF(g_object_ref(pixbuf));
+}
+
+
+static void updated_func(GdkPixbuf*, int, int, int, int, gpointer user_data)
+{
+  static_cast<LoadResult*>(user_data)->num_updates++;
+}
+
+
+// Returns the result of stop_load(). Like GdkPixbufLoader, stop_load() is also called when
+// load_increment() fails.
+static bool load(const Bytes& file, size_t chunk_size, LoadResult& result)
+{
+  const GdkPixbufModule& module = get_module();
+
+  gpointer context = module.begin_load(size_func, prepared_func, updated_func, &result, &result.error);
+  REQUIRE(context != nullptr);
+
+  bool increments_ok = true;
+  for (size_t offset = 0; offset < file.size() && increments_ok; offset += chunk_size) {
+    guint size = static_cast<guint>(std::min(chunk_size, file.size() - offset));
+    increments_ok = module.load_increment(context, file.data() + offset, size, &result.error);
+  }
+
+  bool ok = module.stop_load(context, increments_ok ? &result.error : nullptr);
+  REQUIRE((ok && increments_ok) == (result.error == nullptr));
+  return ok && increments_ok;
+}
+
+
+TEST_CASE("gdk-pixbuf loader")
+{
+  heif_image* input = create_image();
+  Bytes file = create_file(input);
+
+  size_t chunk_size = GENERATE(1, 7, 100, 4096, 1 << 30);
+  CAPTURE(chunk_size);
+
+  LoadResult result;
+  REQUIRE(load(file, chunk_size, result));
+
+  REQUIRE(result.num_size_calls == 1);
+  REQUIRE(result.image_width == kWidth);
+  REQUIRE(result.image_height == kHeight);
+  REQUIRE(result.num_updates == 1);
+
+  GdkPixbuf* pixbuf = result.pixbuf;
+  REQUIRE(pixbuf != nullptr);
+  REQUIRE(gdk_pixbuf_get_width(pixbuf) == kWidth);
+  REQUIRE(gdk_pixbuf_get_height(pixbuf) == kHeight);
+  REQUIRE(!gdk_pixbuf_get_has_alpha(pixbuf));
+  REQUIRE(gdk_pixbuf_get_n_channels(pixbuf) == 3);
+
+  // uncompressed tiles are lossless
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(input, heif_channel_interleaved, &stride);
+  const guchar* pixels = gdk_pixbuf_get_pixels(pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  for (int y = 0; y < kHeight; y++) {
+    REQUIRE(memcmp(pixels + y * rowstride, p + y * stride, kWidth * 3) == 0);
+  }
+
+  heif_image_release(input);
+}
+
+
+TEST_CASE("gdk-pixbuf loader with a requested size")
+{
+  heif_image* input = create_image();
+  Bytes file = create_file(input);
+  heif_image_release(input);
+
+  LoadResult result;
+  result.requested_width = kWidth / 2;
+  result.requested_height = kHeight / 4;
+  REQUIRE(load(file, 100, result));
+
+  REQUIRE(result.pixbuf != nullptr);
+  REQUIRE(gdk_pixbuf_get_width(result.pixbuf) == kWidth / 2);
+  REQUIRE(gdk_pixbuf_get_height(result.pixbuf) == kHeight / 4);
+}
+
+
+TEST_CASE("gdk-pixbuf loader stopped by the size function")
+{
+  heif_image* input = create_image();
+  Bytes file = create_file(input);
+  heif_image_release(input);
+
+  // A size of 0 is requested when only the image size is of interest.
+  LoadResult result;
+  result.requested_width = 0;
+  result.requested_height = 0;
+  REQUIRE(!load(file, 100, result));
+
+  REQUIRE(result.num_size_calls == 1);
+  REQUIRE(result.image_width == kWidth);
+  REQUIRE(result.image_height == kHeight);
+  REQUIRE(result.pixbuf == nullptr);
+  REQUIRE(g_error_matches(result.error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED));
+}
+
+
+TEST_CASE("gdk-pixbuf loader with a truncated file")
+{
+  heif_image* input = create_image();
+  Bytes file = create_file(input);
+  heif_image_release(input);
+
+  // The decoding thread waits for the missing tiles until stop_load() and must then fail.
+  file.resize(file.size() - kTileSize * kTileSize);
+
+  LoadResult result;
+  REQUIRE(!load(file, 100, result));
+  REQUIRE(result.pixbuf == nullptr);
+  REQUIRE(g_error_matches(result.error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE));
+}
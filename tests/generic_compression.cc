@@ -0,0 +1,310 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Generic compression ('cmpC' and 'icef' boxes) of uncompressed images. Compressions that are not
+// available in this build are rejected by the encoder parameter and skipped.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+// The tile sizes must divide the image size.
+static const int kWidth = 60;
+static const int kHeight = 45;
+
+
+struct Format
+{
+  const char* name;
+  heif_colorspace colorspace;
+  heif_chroma chroma;
+  heif_channel channel;
+  int bit_depth;
+  int bytes_per_pixel;
+};
+
+static const Format kFormats[] = {
+    {"monochrome", heif_colorspace_monochrome, heif_chroma_monochrome, heif_channel_Y, 8, 1},
+    {"RGB", heif_colorspace_RGB, heif_chroma_interleaved_RGB, heif_channel_interleaved, 8, 3},
+    {"RGBA", heif_colorspace_RGB, heif_chroma_interleaved_RGBA, heif_channel_interleaved, 8, 4},
+    {"RRGGBB 10 bit", heif_colorspace_RGB, heif_chroma_interleaved_RRGGBB_LE, heif_channel_interleaved, 10, 6},
+};
+
+
+// Smooth gradients with some noise, such that the compressed data is smaller but not trivial.
+static heif_image* create_image(const Format& format)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, format.colorspace, format.chroma, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, format.channel, kWidth, kHeight, format.bit_depth);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, format.channel, &stride);
+  uint32_t noise = 1;
+
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth * format.bytes_per_pixel; x++) {
+      noise = noise * 1103515245 + 12345;
+      uint8_t value = static_cast<uint8_t>(x + y + ((noise >> 16) & 3));
+
+      // keep the 16 bit samples within the bit depth
+      if (format.bit_depth > 8 && (x % 2) == 1) {
+        value = static_cast<uint8_t>(value & ((1 << (format.bit_depth - 8)) - 1));
+      }
+
+      p[y * stride + x] = value;
+    }
+  }
+
+  return img;
+}
+
+
+static Bytes get_pixels(const heif_image* img, const Format& format)
+{
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(img, format.channel, &stride);
+  int width = heif_image_get_width(img, format.channel);
+  int height = heif_image_get_height(img, format.channel);
+
+  Bytes pixels;
+  for (int y = 0; y < height; y++) {
+    pixels.insert(pixels.end(), p + y * stride, p + y * stride + width * format.bytes_per_pixel);
+  }
+
+  return pixels;
+}
+
+
+// Returns false if the compression is not available in this build.
+static bool encode(const heif_image* img, const char* compression, const char* interleave,
+                   int tile_columns, int tile_rows, Bytes& file)
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_encoder_set_parameter_string(encoder, "compression", compression);
+  if (err.code != heif_error_Ok) {
+    REQUIRE(strcmp(compression, "none") != 0);
+    heif_encoder_release(encoder);
+    heif_context_free(ctx);
+    return false;
+  }
+
+  err = heif_encoder_set_parameter_string(encoder, "interleave", interleave);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_encoder_set_parameter_integer(encoder, "tile-columns", tile_columns);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_encoder_set_parameter_integer(encoder, "tile-rows", tile_rows);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  file.clear();
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+  return true;
+}
+
+
+static bool contains_box(const Bytes& file, const char* type)
+{
+  return std::search(file.begin(), file.end(), type, type + 4) != file.end();
+}
+
+
+static heif_error decode(const Bytes& file, const Format& format, heif_image** out_img,
+                         int x = 0, int y = 0, int width = 0, int height = 0)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  if (width == 0) {
+    err = heif_decode_image(handle, out_img, format.colorspace, format.chroma, nullptr);
+  }
+  else {
+    err = heif_decode_image_region(handle, out_img, x, y, width, height, format.colorspace, format.chroma, nullptr);
+  }
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+  return err;
+}
+
+
+TEST_CASE("generic compression round trip")
+{
+  const char* compression = GENERATE("deflate", "zlib", "brotli");
+  const char* interleave = GENERATE("planar", "row", "pixel");
+  int tiles = GENERATE(1, 3);
+  const Format& format = GENERATE(from_range(std::begin(kFormats), std::end(kFormats)));
+
+  CAPTURE(compression, interleave, tiles, format.name);
+
+  heif_image* input = create_image(format);
+
+  Bytes uncompressed_file;
+  REQUIRE(encode(input, "none", interleave, tiles, tiles, uncompressed_file));
+  REQUIRE(!contains_box(uncompressed_file, "cmpC"));
+
+  Bytes file;
+  if (!encode(input, compression, interleave, tiles, tiles, file)) {
+    heif_image_release(input);
+    return;
+  }
+
+  REQUIRE(contains_box(file, "cmpC"));
+  REQUIRE(contains_box(file, "icef"));
+  REQUIRE(file.size() < uncompressed_file.size());
+
+  heif_image* decoded = nullptr;
+  heif_error err = decode(file, format, &decoded);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(get_pixels(decoded, format) == get_pixels(input, format));
+  heif_image_release(decoded);
+
+  heif_image_release(input);
+}
+
+
+TEST_CASE("generic compression with region decoding")
+{
+  const Format& format = kFormats[1];
+  heif_image* input = create_image(format);
+
+  // 4x3 tiles of 15x15 pixels, each compressed separately
+  Bytes file;
+  if (!encode(input, "zlib", "pixel", 4, 3, file)) {
+    heif_image_release(input);
+    return;
+  }
+
+  heif_image* full = nullptr;
+  heif_error err = decode(file, format, &full);
+  REQUIRE(err.code == heif_error_Ok);
+
+  const int x = 13, y = 20, width = 25, height = 17;
+  heif_image* region = nullptr;
+  err = decode(file, format, &region, x, y, width, height);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_image_get_width(region, format.channel) == width);
+  REQUIRE(heif_image_get_height(region, format.channel) == height);
+
+  int full_stride, region_stride;
+  const uint8_t* p_full = heif_image_get_plane_readonly(full, format.channel, &full_stride);
+  const uint8_t* p_region = heif_image_get_plane_readonly(region, format.channel, &region_stride);
+  for (int row = 0; row < height; row++) {
+    REQUIRE(memcmp(p_region + row * region_stride,
+                   p_full + (y + row) * full_stride + x * format.bytes_per_pixel,
+                   width * format.bytes_per_pixel) == 0);
+  }
+
+  heif_image_release(region);
+  heif_image_release(full);
+  heif_image_release(input);
+}
+
+
+TEST_CASE("generic compression with invalid data")
+{
+  const Format& format = kFormats[0];
+  heif_image* input = create_image(format);
+
+  Bytes file;
+  if (!encode(input, "zlib", "planar", 1, 1, file)) {
+    heif_image_release(input);
+    return;
+  }
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_item_id id;
+  err = heif_context_get_primary_image_ID(ctx, &id);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_file_range* ranges = nullptr;
+  int num_ranges = 0;
+  err = heif_item_get_file_ranges(ctx, id, &ranges, &num_ranges);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(num_ranges > 0);
+
+  // A zlib stream starting with two zero bytes has an invalid header.
+  Bytes damaged = file;
+  std::fill(damaged.begin() + ranges[0].offset, damaged.begin() + ranges[0].offset + ranges[0].size, 0);
+
+  heif_file_ranges_release(ranges);
+  heif_context_free(ctx);
+
+  heif_image* decoded = nullptr;
+  err = decode(damaged, format, &decoded);
+  REQUIRE(err.code == heif_error_Invalid_input);
+  REQUIRE(err.subcode == heif_suberror_Decompression_invalid_data);
+  REQUIRE(decoded == nullptr);
+
+  heif_image_release(input);
+}
+
+
+TEST_CASE("generic compression encoder parameters")
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_encoder_set_parameter_string(encoder, "compression", "lzma");
+  REQUIRE(err.code == heif_error_Usage_error);
+  err = heif_encoder_set_parameter_string(encoder, "interleave", "component");
+  REQUIRE(err.code == heif_error_Usage_error);
+  err = heif_encoder_set_parameter_integer(encoder, "tile-columns", 0);
+  REQUIRE(err.code == heif_error_Usage_error);
+
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+}
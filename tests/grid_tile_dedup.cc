@@ -0,0 +1,260 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Grid images that reference the same tile several times, or tiles with the same data, decode each
+// distinct tile only once. The files are built box by box since the encoder writes each tile separately.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+static const int kTileWidth = 16;
+static const int kTileHeight = 8;
+static const int kColumns = 3;
+static const int kRows = 2;
+
+// the right column of tiles extends over the border of the image
+static const int kWidth = 2 * kTileWidth + 12;
+static const int kHeight = kRows * kTileHeight;
+
+
+static uint8_t sample(int tile, int x, int y)
+{
+  return static_cast<uint8_t>(tile * 100 + x * 3 + y);
+}
+
+
+struct Item
+{
+  uint16_t id;
+  const char* type;
+  uint32_t data_offset; // into 'idat'
+  uint32_t data_size;
+  std::vector<uint8_t> properties; // 1-based indices into ipco, 0x80 marks essential properties
+};
+
+
+// Item 1 is a 3x2 grid of 16x8 monochrome 'unci' tiles. Items 2 and 3 are tiles with different
+// content, item 4 is stored at the same data extent as item 3.
+static const uint16_t kTileReferences[kRows * kColumns] = {2, 3, 2,
+                                                           4, 2, 3};
+
+
+// The content of the tiles in kTileReferences (0 for item 2, 1 for items 3 and 4).
+static int tile_content(uint16_t item_id)
+{
+  return item_id == 2 ? 0 : 1;
+}
+
+
+static Bytes create_file()
+{
+  Bytes ispe_grid, ispe_tile;
+  put32(ispe_grid, kWidth);
+  put32(ispe_grid, kHeight);
+  put32(ispe_tile, kTileWidth);
+  put32(ispe_tile, kTileHeight);
+
+  Bytes cmpd;
+  put16(cmpd, 1);
+  put16(cmpd, 0); // monochrome
+
+  Bytes uncC;
+  put32(uncC, 0); // profile
+  put16(uncC, 1); // component count
+  put16(uncC, 0); // component index
+  uncC.insert(uncC.end(), {7, 0, 0}); // 8 bit unsigned, no alignment
+  uncC.insert(uncC.end(), {0, 0, 0, 0, 0}); // sampling, interleave, block size, flags, pixel size
+  put32(uncC, 0); // row align
+  put32(uncC, 0); // tile align
+  put32(uncC, 0); // tile columns - 1
+  put32(uncC, 0); // tile rows - 1
+
+  Bytes ipco = concat({make_full_box("ispe", 0, ispe_grid),
+                       make_full_box("ispe", 0, ispe_tile),
+                       make_box("cmpd", cmpd),
+                       make_full_box("uncC", 0, uncC)});
+
+  Bytes idat;
+  for (int tile = 0; tile < 2; tile++) {
+    for (int y = 0; y < kTileHeight; y++) {
+      for (int x = 0; x < kTileWidth; x++) {
+        idat.push_back(sample(tile, x, y));
+      }
+    }
+  }
+
+  const uint32_t tile_size = kTileWidth * kTileHeight;
+
+  Bytes grid = {0, 0, kRows - 1, kColumns - 1}; // version, flags, rows - 1, columns - 1
+  put16(grid, kWidth);
+  put16(grid, kHeight);
+
+  std::vector<Item> items = {
+      {1, "grid", static_cast<uint32_t>(idat.size()), static_cast<uint32_t>(grid.size()), {1}},
+      {2, "unci", 0, tile_size, {2, 3, 4}},
+      {3, "unci", tile_size, tile_size, {2, 3, 4}},
+      {4, "unci", tile_size, tile_size, {2, 3, 4}},
+  };
+
+  idat.insert(idat.end(), grid.begin(), grid.end());
+
+  Bytes dimg;
+  put16(dimg, 1);
+  put16(dimg, kRows * kColumns);
+  for (uint16_t reference : kTileReferences) {
+    put16(dimg, reference);
+  }
+
+  Bytes hdlr = {0, 0, 0, 0};
+  put_fourcc(hdlr, "pict");
+  hdlr.resize(hdlr.size() + 13);
+
+  Bytes pitm;
+  put16(pitm, 1);
+
+  Bytes iinf;
+  put16(iinf, static_cast<uint32_t>(items.size()));
+
+  // the item data is stored in 'idat' (construction method 1)
+  Bytes iloc = {0x44, 0x00};
+  put16(iloc, static_cast<uint32_t>(items.size()));
+
+  Bytes ipma;
+  put32(ipma, static_cast<uint32_t>(items.size()));
+
+  for (const Item& item : items) {
+    Bytes infe;
+    put16(infe, item.id);
+    put16(infe, 0);
+    put_fourcc(infe, item.type);
+    infe.push_back(0);
+    Bytes infe_box = make_full_box("infe", 2, infe);
+    iinf.insert(iinf.end(), infe_box.begin(), infe_box.end());
+
+    put16(iloc, item.id);
+    put16(iloc, 1); // construction method
+    put16(iloc, 0); // data reference index
+    put16(iloc, 1); // extent count
+    put32(iloc, item.data_offset);
+    put32(iloc, item.data_size);
+
+    put16(ipma, item.id);
+    ipma.push_back(static_cast<uint8_t>(item.properties.size()));
+    ipma.insert(ipma.end(), item.properties.begin(), item.properties.end());
+  }
+
+  Bytes meta = concat({make_full_box("hdlr", 0, hdlr),
+                       make_full_box("pitm", 0, pitm),
+                       make_full_box("iinf", 0, iinf),
+                       make_full_box("iloc", 1, iloc),
+                       make_box("idat", idat),
+                       make_box("iprp", concat({make_box("ipco", ipco), make_full_box("ipma", 0, ipma)})),
+                       make_full_box("iref", 0, make_box("dimg", dimg))});
+
+  Bytes ftyp;
+  put_fourcc(ftyp, "mif1");
+  put32(ftyp, 0);
+  put_fourcc(ftyp, "mif1");
+
+  return concat({make_box("ftyp", ftyp), make_full_box("meta", 0, meta)});
+}
+
+
+static int s_num_decoded_tiles = 0;
+
+static void on_tile_decoded(const heif_image*, int, int, void*)
+{
+  s_num_decoded_tiles++;
+}
+
+
+static void check_grid_decode(heif_chroma chroma)
+{
+  Bytes file = create_file();
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_image_handle_get_width(handle) == kWidth);
+  REQUIRE(heif_image_handle_get_height(handle) == kHeight);
+
+  heif_decoding_options* options = heif_decoding_options_alloc();
+  options->on_tile_decoded = on_tile_decoded;
+  s_num_decoded_tiles = 0;
+
+  heif_reset_statistics();
+
+  heif_image* img = nullptr;
+  err = heif_decode_image(handle, &img, heif_colorspace_RGB, chroma, options);
+  REQUIRE(err.code == heif_error_Ok);
+
+  // one decode of each distinct tile, but all tiles are reported to the application
+  heif_statistics stats;
+  heif_get_statistics(&stats);
+  REQUIRE(stats.tiles_decoded == 2);
+  REQUIRE(s_num_decoded_tiles == kRows * kColumns);
+
+  heif_channel channel = (chroma == heif_chroma_444 ? heif_channel_R : heif_channel_interleaved);
+  int bytes_per_pixel = (chroma == heif_chroma_444 ? 1 : 3);
+
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(img, channel, &stride);
+  REQUIRE(p != nullptr);
+
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth; x++) {
+      uint16_t tile_id = kTileReferences[(y / kTileHeight) * kColumns + x / kTileWidth];
+      INFO("x=" << x << " y=" << y);
+      REQUIRE(p[y * stride + x * bytes_per_pixel] == sample(tile_content(tile_id), x % kTileWidth, y % kTileHeight));
+    }
+  }
+
+  heif_image_release(img);
+  heif_decoding_options_free(options);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("grid tiles with the same item or data are decoded once")
+{
+  check_grid_decode(heif_chroma_444);
+}
+
+
+TEST_CASE("grid tiles with the same item or data are decoded once into interleaved RGB")
+{
+  check_grid_decode(heif_chroma_interleaved_RGB);
+}
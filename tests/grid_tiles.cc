@@ -0,0 +1,219 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+// Access to the single tiles of a grid image with heif_image_handle_get_grid_layout() and
+// heif_decode_grid_tile(). The uncompressed codec is lossless, so each tile has to match the same
+// area of the full image.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <cstdint>
+
+
+static const int kWidth = 100;
+static const int kHeight = 70;
+static const int kTileSize = 32;
+
+// 4x3 tiles, the right column and the bottom row extend beyond the image border
+static const uint32_t kColumns = 4;
+static const uint32_t kRows = 3;
+
+
+static heif_image* create_image(int width, int height)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, width, height, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width * 3; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x * 7 + y * 13);
+    }
+  }
+
+  return img;
+}
+
+
+static Bytes encode(bool grid)
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = create_image(kWidth, kHeight);
+  if (grid) {
+    err = heif_context_encode_grid(ctx, img, kTileSize, kTileSize, encoder, nullptr, nullptr);
+  }
+  else {
+    err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  }
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_release(img);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+static heif_image_handle* get_primary_image(heif_context* ctx, const Bytes& file)
+{
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  return handle;
+}
+
+
+TEST_CASE("grid layout")
+{
+  Bytes file = encode(true);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_image_handle* handle = get_primary_image(ctx, file);
+
+  uint32_t columns = 0, rows = 0, tile_width = 0, tile_height = 0;
+  heif_error err = heif_image_handle_get_grid_layout(handle, &columns, &rows, &tile_width, &tile_height);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(columns == kColumns);
+  REQUIRE(rows == kRows);
+  REQUIRE(tile_width == kTileSize);
+  REQUIRE(tile_height == kTileSize);
+
+  // any of the output pointers may be NULL
+  columns = 0;
+  err = heif_image_handle_get_grid_layout(handle, &columns, nullptr, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(columns == kColumns);
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("grid layout of an image that is no grid")
+{
+  Bytes file = encode(false);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_image_handle* handle = get_primary_image(ctx, file);
+
+  uint32_t columns = 0, rows = 0, tile_width = 0, tile_height = 0;
+  heif_error err = heif_image_handle_get_grid_layout(handle, &columns, &rows, &tile_width, &tile_height);
+  REQUIRE(err.code == heif_error_Usage_error);
+
+  heif_image* tile = nullptr;
+  err = heif_decode_grid_tile(handle, &tile, 0, 0, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(tile == nullptr);
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("decode grid tile")
+{
+  Bytes file = encode(true);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_image_handle* handle = get_primary_image(ctx, file);
+
+  heif_image* full = nullptr;
+  heif_error err = heif_decode_image(handle, &full, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int full_stride;
+  const uint8_t* full_pixels = heif_image_get_plane_readonly(full, heif_channel_interleaved, &full_stride);
+
+  // an inner tile, the tiles at the right and bottom border, and the corner tile
+  uint32_t column = GENERATE(1u, 3u);
+  uint32_t row = GENERATE(0u, 2u);
+
+  int x0 = static_cast<int>(column) * kTileSize;
+  int y0 = static_cast<int>(row) * kTileSize;
+  int expected_width = std::min(kTileSize, kWidth - x0);
+  int expected_height = std::min(kTileSize, kHeight - y0);
+
+  heif_image* tile = nullptr;
+  err = heif_decode_grid_tile(handle, &tile, column, row, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_image_get_width(tile, heif_channel_interleaved) == expected_width);
+  REQUIRE(heif_image_get_height(tile, heif_channel_interleaved) == expected_height);
+
+  int tile_stride;
+  const uint8_t* tile_pixels = heif_image_get_plane_readonly(tile, heif_channel_interleaved, &tile_stride);
+  for (int y = 0; y < expected_height; y++) {
+    for (int x = 0; x < expected_width * 3; x++) {
+      REQUIRE(tile_pixels[y * tile_stride + x] == full_pixels[(y0 + y) * full_stride + x0 * 3 + x]);
+    }
+  }
+
+  heif_image_release(tile);
+  heif_image_release(full);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("decode grid tile out of range")
+{
+  Bytes file = encode(true);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_image_handle* handle = get_primary_image(ctx, file);
+
+  heif_image* tile = nullptr;
+  heif_error err = heif_decode_grid_tile(handle, &tile, kColumns, 0, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+
+  err = heif_decode_grid_tile(handle, &tile, 0, kRows, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(tile == nullptr);
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
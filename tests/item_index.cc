@@ -0,0 +1,265 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Lookup of the 'iloc', 'ipma' and 'iref' entries by item ID. The boxes are parsed from data
+// written box by box, such that duplicate and unsorted IDs can be tested.
+
+#include "catch.hpp"
+#include "libheif/box.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+template <typename T>
+static std::shared_ptr<T> parse_box(const Bytes& data)
+{
+  auto reader = std::make_shared<StreamReader_memory>(data.data(), (int64_t) data.size(), false);
+  BitstreamRange range(reader, data.size());
+
+  std::shared_ptr<Box> box;
+  Error err = Box::read(range, &box);
+  REQUIRE(!err);
+
+  auto typed_box = std::dynamic_pointer_cast<T>(box);
+  REQUIRE(typed_box);
+  return typed_box;
+}
+
+
+struct IlocEntry
+{
+  uint16_t item_ID;
+  uint32_t offset;
+  uint32_t length;
+};
+
+// 'iloc' version 0 with 32 bit offsets and lengths, one extent per item
+static Bytes make_iloc(const std::vector<IlocEntry>& entries)
+{
+  Bytes content{0x44, 0x00};
+  put16(content, static_cast<uint32_t>(entries.size()));
+  for (const IlocEntry& entry : entries) {
+    put16(content, entry.item_ID);
+    put16(content, 0); // data_reference_index
+    put16(content, 1); // extent_count
+    put32(content, entry.offset);
+    put32(content, entry.length);
+  }
+
+  return make_full_box("iloc", 0, content);
+}
+
+
+struct IpmaEntry
+{
+  uint16_t item_ID;
+  std::vector<uint8_t> associations; // essential bit and property index
+};
+
+// 'ipma' version 0 with 8 bit property indices
+static Bytes make_ipma(const std::vector<IpmaEntry>& entries)
+{
+  Bytes content;
+  put32(content, static_cast<uint32_t>(entries.size()));
+  for (const IpmaEntry& entry : entries) {
+    put16(content, entry.item_ID);
+    content.push_back(static_cast<uint8_t>(entry.associations.size()));
+    content.insert(content.end(), entry.associations.begin(), entry.associations.end());
+  }
+
+  return make_full_box("ipma", 0, content);
+}
+
+
+static Bytes make_reference(const char* type, uint16_t from_ID, const std::vector<uint16_t>& to_IDs)
+{
+  Bytes content;
+  put16(content, from_ID);
+  put16(content, static_cast<uint32_t>(to_IDs.size()));
+  for (uint16_t to_ID : to_IDs) {
+    put16(content, to_ID);
+  }
+
+  return make_box(type, content);
+}
+
+
+static std::vector<uint8_t> get_property_indices(const Box_ipma& ipma, heif_item_id item_ID)
+{
+  const auto* associations = ipma.get_properties_for_item_ID(item_ID);
+  REQUIRE(associations != nullptr);
+
+  std::vector<uint8_t> indices;
+  for (const auto& association : *associations) {
+    indices.push_back(static_cast<uint8_t>(association.property_index | (association.essential ? 0x80 : 0)));
+  }
+
+  return indices;
+}
+
+
+TEST_CASE("iloc item lookup")
+{
+  auto iloc = parse_box<Box_iloc>(make_iloc({{7, 100, 10},
+                                             {2, 200, 20},
+                                             {30, 300, 30},
+                                             {2, 400, 40}}));
+
+  REQUIRE(iloc->get_items().size() == 4);
+
+  const Box_iloc::Item* item = iloc->get_item(30);
+  REQUIRE(item != nullptr);
+  REQUIRE(item->item_ID == 30);
+  REQUIRE(item->extents.size() == 1);
+  REQUIRE(item->extents[0].offset == 300);
+  REQUIRE(item->extents[0].length == 30);
+
+  // duplicate IDs: the first entry is used
+  item = iloc->get_item(2);
+  REQUIRE(item != nullptr);
+  REQUIRE(item->extents[0].offset == 200);
+
+  REQUIRE(iloc->get_item(0) == nullptr);
+  REQUIRE(iloc->get_item(3) == nullptr);
+}
+
+
+TEST_CASE("iloc item lookup of appended items")
+{
+  Box_iloc iloc;
+
+  const std::vector<uint8_t> data{1, 2, 3};
+  for (heif_item_id id = 1000; id > 0; id -= 10) {
+    Error err = iloc.append_data(id, data);
+    REQUIRE(!err);
+  }
+
+  REQUIRE(iloc.get_items().size() == 100);
+  for (heif_item_id id = 1000; id > 0; id -= 10) {
+    const Box_iloc::Item* item = iloc.get_item(id);
+    REQUIRE(item != nullptr);
+    REQUIRE(item->item_ID == id);
+  }
+
+  REQUIRE(iloc.get_item(5) == nullptr);
+}
+
+
+TEST_CASE("ipma property lookup")
+{
+  auto ipma = parse_box<Box_ipma>(make_ipma({{5, {1, 0x82}},
+                                             {1, {3}},
+                                             {5, {4}},
+                                             {9, {}}}));
+
+  REQUIRE(get_property_indices(*ipma, 1) == std::vector<uint8_t>{3});
+  REQUIRE(get_property_indices(*ipma, 9).empty());
+  REQUIRE(ipma->get_properties_for_item_ID(2) == nullptr);
+
+  // duplicate IDs: the first entry is used
+  REQUIRE(get_property_indices(*ipma, 5) == std::vector<uint8_t>{1, 0x82});
+  REQUIRE(!ipma->is_property_essential_for_item(5, 1));
+  REQUIRE(ipma->is_property_essential_for_item(5, 2));
+
+  SECTION("adding properties") {
+    ipma->add_property_for_item_ID(1, Box_ipma::PropertyAssociation{true, 6});
+    ipma->add_property_for_item_ID(2, Box_ipma::PropertyAssociation{false, 7});
+
+    REQUIRE(get_property_indices(*ipma, 1) == std::vector<uint8_t>{3, 0x86});
+    REQUIRE(get_property_indices(*ipma, 2) == std::vector<uint8_t>{7});
+  }
+
+  SECTION("removing entries") {
+    ipma->remove_entries_for_item_ID(5);
+
+    REQUIRE(ipma->get_properties_for_item_ID(5) == nullptr);
+    REQUIRE(get_property_indices(*ipma, 1) == std::vector<uint8_t>{3});
+    REQUIRE(get_property_indices(*ipma, 9).empty());
+  }
+}
+
+
+TEST_CASE("ipma property lookup of merged boxes")
+{
+  // Files may split the associations into several 'ipma' boxes. HeifFile merges them into the first one.
+  auto ipma = parse_box<Box_ipma>(make_ipma({{1, {1}}, {2, {2}}}));
+  auto second_ipma = parse_box<Box_ipma>(make_ipma({{3, {3}}, {1, {4}}}));
+
+  ipma->insert_entries_from_other_ipma_box(*second_ipma);
+
+  REQUIRE(get_property_indices(*ipma, 1) == std::vector<uint8_t>{1});
+  REQUIRE(get_property_indices(*ipma, 2) == std::vector<uint8_t>{2});
+  REQUIRE(get_property_indices(*ipma, 3) == std::vector<uint8_t>{3});
+  REQUIRE(ipma->get_properties_for_item_ID(4) == nullptr);
+}
+
+
+TEST_CASE("iref reference lookup")
+{
+  Bytes references = concat({make_reference("dimg", 10, {2, 3, 4}),
+                             make_reference("thmb", 5, {10}),
+                             make_reference("cdsc", 10, {6}),
+                             make_reference("dimg", 10, {7})});
+
+  auto iref = parse_box<Box_iref>(make_full_box("iref", 0, references));
+
+  REQUIRE(iref->has_references(10));
+  REQUIRE(iref->has_references(5));
+  REQUIRE(!iref->has_references(2));
+
+  // the first reference of each type is returned
+  REQUIRE(iref->get_references(10, fourcc("dimg")) == std::vector<heif_item_id>{2, 3, 4});
+  REQUIRE(iref->get_references(10, fourcc("cdsc")) == std::vector<heif_item_id>{6});
+  REQUIRE(iref->get_references(10, fourcc("thmb")).empty());
+  REQUIRE(iref->get_references(5, fourcc("thmb")) == std::vector<heif_item_id>{10});
+
+  // all references of the item, in file order
+  auto from_10 = iref->get_references_from(10);
+  REQUIRE(from_10.size() == 3);
+  REQUIRE(from_10[0].header.get_short_type() == fourcc("dimg"));
+  REQUIRE(from_10[1].header.get_short_type() == fourcc("cdsc"));
+  REQUIRE(from_10[2].header.get_short_type() == fourcc("dimg"));
+  REQUIRE(from_10[2].to_item_ID == std::vector<heif_item_id>{7});
+
+  SECTION("adding references") {
+    iref->add_reference(2, fourcc("auxl"), {10});
+
+    REQUIRE(iref->has_references(2));
+    REQUIRE(iref->get_references(2, fourcc("auxl")) == std::vector<heif_item_id>{10});
+    REQUIRE(iref->get_references_from(10).size() == 3);
+  }
+
+  SECTION("removing references") {
+    // removes the references from item 10 and to item 10
+    iref->remove_references(10);
+
+    REQUIRE(!iref->has_references(10));
+    REQUIRE(!iref->has_references(5));
+    REQUIRE(iref->get_references_from(10).empty());
+  }
+}
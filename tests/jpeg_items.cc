@@ -0,0 +1,182 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Adding JPEG files as 'jpeg' image items without re-encoding them.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <vector>
+
+
+// A 16x8 grayscale baseline JPEG. The left half has the value 50, the right half 200.
+static const Bytes kGrayJpeg = {
+    0xff, 0xd8, 0xff, 0xdb, 0x00, 0x43, 0x00, 0x02, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x01, 0x01,
+    0x01, 0x02, 0x02, 0x02, 0x02, 0x02, 0x04, 0x03, 0x02, 0x02, 0x02, 0x02, 0x05, 0x04, 0x04, 0x03,
+    0x04, 0x06, 0x05, 0x06, 0x06, 0x06, 0x05, 0x06, 0x06, 0x06, 0x07, 0x09, 0x08, 0x06, 0x07, 0x09,
+    0x07, 0x06, 0x06, 0x08, 0x0b, 0x08, 0x09, 0x0a, 0x0a, 0x0a, 0x0a, 0x0a, 0x06, 0x08, 0x0b, 0x0c,
+    0x0b, 0x0a, 0x0c, 0x09, 0x0a, 0x0a, 0x0a, 0xff, 0xc0, 0x00, 0x0b, 0x08, 0x00, 0x08, 0x00, 0x10,
+    0x01, 0x01, 0x11, 0x00, 0xff, 0xc4, 0x00, 0x15, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09, 0x0a, 0xff, 0xc4, 0x00, 0x14, 0x10,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00, 0x31, 0xd4, 0xb0, 0xff, 0xd9,
+};
+
+
+// Inserts an Exif APP1 segment with the given orientation tag after the SOI marker.
+static Bytes add_exif_orientation(const Bytes& jpeg, uint16_t orientation)
+{
+  const Bytes exif = {
+      0xff, 0xe1, 0x00, 0x22,
+      'E', 'x', 'i', 'f', 0, 0,
+      'M', 'M', 0x00, 0x2a, 0x00, 0x00, 0x00, 0x08, // TIFF header, IFD0 at offset 8
+      0x00, 0x01, // one entry
+      0x01, 0x12, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01, // orientation, SHORT, count 1
+      static_cast<uint8_t>(orientation >> 8), static_cast<uint8_t>(orientation), 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00 // no next IFD
+  };
+
+  Bytes result(jpeg.begin(), jpeg.begin() + 2);
+  result.insert(result.end(), exif.begin(), exif.end());
+  result.insert(result.end(), jpeg.begin() + 2, jpeg.end());
+  return result;
+}
+
+
+static Bytes write_jpeg_file(const Bytes& jpeg)
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_image_handle* handle = nullptr;
+  heif_error err = heif_context_add_jpeg_image(ctx, jpeg.data(), jpeg.size(), &handle);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(handle != nullptr);
+  REQUIRE(heif_image_handle_is_primary_image(handle));
+  heif_image_handle_release(handle);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+TEST_CASE("add JPEG image")
+{
+  Bytes file = write_jpeg_file(kGrayJpeg);
+
+  REQUIRE(heif_read_main_brand(file.data(), (int) file.size()) == heif_brand2_jpeg);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(heif_image_handle_get_width(handle) == 16);
+  REQUIRE(heif_image_handle_get_height(handle) == 8);
+  REQUIRE(heif_image_handle_get_luma_bits_per_pixel(handle) == 8);
+
+  // the JPEG data is stored unchanged
+  heif_image_handle_release(handle);
+
+  if (heif_have_decoder_for_format(heif_compression_JPEG)) {
+    err = heif_context_get_primary_image_handle(ctx, &handle);
+    REQUIRE(err.code == heif_error_Ok);
+
+    heif_image* img = nullptr;
+    err = heif_decode_image(handle, &img, heif_colorspace_monochrome, heif_chroma_monochrome, nullptr);
+    REQUIRE(err.code == heif_error_Ok);
+
+    int stride;
+    const uint8_t* p = heif_image_get_plane_readonly(img, heif_channel_Y, &stride);
+    REQUIRE(p != nullptr);
+    REQUIRE(p[3 * stride + 2] >= 45);
+    REQUIRE(p[3 * stride + 2] <= 55);
+    REQUIRE(p[3 * stride + 13] >= 195);
+    REQUIRE(p[3 * stride + 13] <= 205);
+
+    heif_image_release(img);
+    heif_image_handle_release(handle);
+  }
+
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("JPEG Exif orientation")
+{
+  // orientation 6: rotate 90 degrees clockwise
+  Bytes file = write_jpeg_file(add_exif_orientation(kGrayJpeg, 6));
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(heif_image_handle_get_ispe_width(handle) == 16);
+  REQUIRE(heif_image_handle_get_ispe_height(handle) == 8);
+  REQUIRE(heif_image_handle_get_width(handle) == 8);
+  REQUIRE(heif_image_handle_get_height(handle) == 16);
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("reject invalid JPEG data")
+{
+  heif_context* ctx = heif_context_alloc();
+
+  Bytes no_jpeg = {0x00, 0x01, 0x02, 0x03};
+  heif_error err = heif_context_add_jpeg_image(ctx, no_jpeg.data(), no_jpeg.size(), nullptr);
+  REQUIRE(err.code != heif_error_Ok);
+
+  // lossless JPEG (SOF3) is not supported
+  Bytes lossless = kGrayJpeg;
+  lossless[72] = 0xc3;
+  err = heif_context_add_jpeg_image(ctx, lossless.data(), lossless.size(), nullptr);
+  REQUIRE(err.code != heif_error_Ok);
+
+  // a truncated file without a frame header
+  Bytes truncated(kGrayJpeg.begin(), kGrayJpeg.begin() + 60);
+  err = heif_context_add_jpeg_image(ctx, truncated.data(), truncated.size(), nullptr);
+  REQUIRE(err.code != heif_error_Ok);
+
+  REQUIRE(heif_context_get_number_of_top_level_images(ctx) == 0);
+
+  heif_context_free(ctx);
+}
@@ -0,0 +1,236 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// The field sizes of the 'iloc' box and the 'mdat' header for files around 4 GB.
+// The item data is added with Box_iloc::append_data_reference(). Only its size is used when
+// the boxes are written, such that no large buffers are needed.
+
+#include "catch.hpp"
+#include "libheif/box.h"
+#include "libheif/security_limits.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+static const uint64_t k4GB = uint64_t{1} << 32;
+
+
+struct WrittenIloc
+{
+  int version = 0;
+  int offset_size = 0;
+  int length_size = 0;
+  int base_offset_size = 0;
+
+  uint64_t iloc_size = 0;
+  std::vector<uint8_t> mdat_header;
+
+  std::shared_ptr<Box_iloc> parsed;
+};
+
+
+// Writes the 'iloc' box and the header of the 'mdat' box behind it, as HeifFile::write() does.
+// 'items' has the extent sizes of each item. Item IDs start at 'first_item_ID'.
+static WrittenIloc write_iloc(const std::vector<std::vector<uint64_t>>& items, heif_item_id first_item_ID = 1)
+{
+  // The data is never accessed.
+  static const uint8_t dummy = 0;
+
+  Box_iloc iloc;
+  for (size_t i = 0; i < items.size(); i++) {
+    for (uint64_t size : items[i]) {
+      Error err = iloc.append_data_reference(first_item_ID + (heif_item_id) i, &dummy, (size_t) size, nullptr);
+      REQUIRE(!err);
+    }
+  }
+
+  iloc.derive_box_version();
+
+  StreamWriter writer;
+  Error err = iloc.write(writer);
+  REQUIRE(!err);
+  const size_t iloc_size = writer.data_size();
+
+  err = iloc.write_mdat_header_after_iloc(writer);
+  REQUIRE(!err);
+
+  const std::vector<uint8_t>& data = writer.get_data();
+
+  WrittenIloc result;
+  result.version = data[8];
+  result.offset_size = data[12] >> 4;
+  result.length_size = data[12] & 0x0F;
+  result.base_offset_size = data[13] >> 4;
+  result.iloc_size = iloc_size;
+  result.mdat_header.assign(data.begin() + iloc_size, data.end());
+
+  auto reader = std::make_shared<StreamReader_memory>(data.data(), (int64_t) iloc_size, true);
+  BitstreamRange range(reader, iloc_size);
+  std::shared_ptr<Box> box;
+  err = Box::read(range, &box);
+  REQUIRE(!err);
+  result.parsed = std::dynamic_pointer_cast<Box_iloc>(box);
+  REQUIRE(result.parsed);
+
+  return result;
+}
+
+
+static std::vector<uint8_t> mdat_header_32(uint64_t content_size)
+{
+  uint32_t size = (uint32_t) (content_size + 8);
+  return {uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size), 'm', 'd', 'a', 't'};
+}
+
+static std::vector<uint8_t> mdat_header_64(uint64_t content_size)
+{
+  uint64_t size = content_size + 16;
+  std::vector<uint8_t> header{0, 0, 0, 1, 'm', 'd', 'a', 't'};
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    header.push_back(uint8_t(size >> shift));
+  }
+  return header;
+}
+
+
+TEST_CASE("iloc field sizes at the 4 GB boundary")
+{
+  if (sizeof(size_t) < 8) {
+    return;
+  }
+
+  SECTION("small file") {
+    WrittenIloc iloc = write_iloc({{1000}, {2000}});
+    REQUIRE(iloc.version == 0);
+    REQUIRE(iloc.offset_size == 4);
+    REQUIRE(iloc.length_size == 4);
+    REQUIRE(iloc.base_offset_size == 4);
+    REQUIRE(iloc.mdat_header == mdat_header_32(3000));
+  }
+
+  SECTION("item IDs beyond 16 bits need version 2") {
+    WrittenIloc iloc = write_iloc({{1000}}, 0x10000);
+    REQUIRE(iloc.version == 2);
+    REQUIRE(iloc.parsed->get_items()[0].item_ID == 0x10000);
+  }
+
+  // The boxes in front of the 'mdat' may take up to MAX_MEMORY_BLOCK_SIZE bytes.
+  const uint64_t max_mdat_size_for_32bit_base = 0xFFFFFFFF - (uint64_t) MAX_MEMORY_BLOCK_SIZE;
+
+  SECTION("base offsets") {
+    WrittenIloc iloc = write_iloc({{max_mdat_size_for_32bit_base - 100}, {100}});
+    REQUIRE(iloc.base_offset_size == 4);
+
+    iloc = write_iloc({{max_mdat_size_for_32bit_base - 100}, {101}});
+    REQUIRE(iloc.base_offset_size == 8);
+    REQUIRE(iloc.offset_size == 4);
+    REQUIRE(iloc.length_size == 4);
+
+    // The second item is stored behind the first one.
+    const auto& items = iloc.parsed->get_items();
+    REQUIRE(items.size() == 2);
+    REQUIRE(items[1].base_offset == items[0].base_offset + max_mdat_size_for_32bit_base - 100);
+  }
+
+  SECTION("mdat header") {
+    WrittenIloc iloc = write_iloc({{0xFFFFFFFF - 8}});
+    REQUIRE(iloc.mdat_header == mdat_header_32(0xFFFFFFFF - 8));
+
+    iloc = write_iloc({{0xFFFFFFFF - 7}});
+    REQUIRE(iloc.mdat_header == mdat_header_64(0xFFFFFFFF - 7));
+
+    // The item data starts behind the 64 bit header.
+    const auto& items = iloc.parsed->get_items();
+    REQUIRE(items[0].base_offset + items[0].extents[0].offset == iloc.iloc_size + 16);
+  }
+
+  SECTION("extent lengths") {
+    WrittenIloc iloc = write_iloc({{0xFFFFFFFF}});
+    REQUIRE(iloc.length_size == 4);
+    REQUIRE(iloc.parsed->get_items()[0].extents[0].length == 0xFFFFFFFF);
+
+    iloc = write_iloc({{k4GB}});
+    REQUIRE(iloc.length_size == 8);
+    REQUIRE(iloc.offset_size == 4);
+    REQUIRE(iloc.parsed->get_items()[0].extents[0].length == k4GB);
+    REQUIRE(iloc.mdat_header == mdat_header_64(k4GB));
+  }
+
+  SECTION("extent offsets within an item") {
+    WrittenIloc iloc = write_iloc({{0xFFFFFFFF, 10}});
+    REQUIRE(iloc.offset_size == 4);
+    REQUIRE(iloc.parsed->get_items()[0].extents[1].offset == 0xFFFFFFFF);
+
+    iloc = write_iloc({{k4GB, 10}});
+    REQUIRE(iloc.offset_size == 8);
+    REQUIRE(iloc.length_size == 8);
+    REQUIRE(iloc.parsed->get_items()[0].extents[1].offset == k4GB);
+    REQUIRE(iloc.parsed->get_items()[0].extents[1].length == 10);
+  }
+}
+
+
+TEST_CASE("iloc field sizes of data placed beyond 4 GB")
+{
+  if (sizeof(size_t) < 8) {
+    return;
+  }
+
+  // As in HeifFile::write_in_place(): the new data is appended to an existing file with absolute offsets.
+  static const uint8_t dummy = 0;
+
+  for (uint64_t position : {uint64_t{0xFFFFFFFF}, k4GB}) {
+    Box_iloc iloc;
+    Error err = iloc.append_data_reference(1, &dummy, 100, nullptr);
+    REQUIRE(!err);
+
+    uint64_t size = 0;
+    err = iloc.place_new_data(position, &size);
+    REQUIRE(!err);
+    REQUIRE(size == 100);
+
+    iloc.derive_box_version();
+
+    StreamWriter writer;
+    err = iloc.write(writer);
+    REQUIRE(!err);
+    iloc.patch_iloc_header(writer);
+
+    const std::vector<uint8_t>& data = writer.get_data();
+    REQUIRE((data[12] >> 4) == (position > 0xFFFFFFFF ? 8 : 4));
+
+    auto reader = std::make_shared<StreamReader_memory>(data.data(), (int64_t) data.size(), true);
+    BitstreamRange range(reader, data.size());
+    std::shared_ptr<Box> box;
+    err = Box::read(range, &box);
+    REQUIRE(!err);
+
+    auto parsed = std::dynamic_pointer_cast<Box_iloc>(box);
+    REQUIRE(parsed);
+    REQUIRE(parsed->get_items()[0].base_offset + parsed->get_items()[0].extents[0].offset == position);
+  }
+}
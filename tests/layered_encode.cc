@@ -0,0 +1,420 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Progressive (layered) AV1 images. A test encoder plugin returns one packet per layer and a test
+// decoder plugin records how much data it receives, such that the layer handling of libheif is
+// checked without a codec. The test with the aom encoder is skipped if it is not available.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "libheif/heif_plugin.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+
+static const int kWidth = 64;
+static const int kHeight = 48;
+
+
+// --- encoder plugin that returns the packets in 's_layers' and reports 's_num_layers' layers
+
+static std::vector<Bytes> s_layers;
+static int s_num_layers = 1;
+static size_t s_next_layer = 0;
+
+
+// An AV1 padding OBU with the given payload size, such that the packet is a valid OBU stream.
+static Bytes padding_obu(uint8_t payload_size, uint8_t value)
+{
+  Bytes obu(2 + payload_size, value);
+  obu[0] = (15 << 3) | 0x02;
+  obu[1] = payload_size;
+  return obu;
+}
+
+
+static heif_error encode_layers(void*, const heif_image*, heif_image_input_class)
+{
+  s_next_layer = 0;
+  return test_encoder::ok();
+}
+
+
+static heif_error get_layer_data(void*, uint8_t** data, int* size, heif_encoded_data_type*)
+{
+  if (s_next_layer == s_layers.size()) {
+    *data = nullptr;
+    *size = 0;
+  }
+  else {
+    *data = s_layers[s_next_layer].data();
+    *size = static_cast<int>(s_layers[s_next_layer].size());
+    s_next_layer++;
+  }
+
+  return test_encoder::ok();
+}
+
+
+static int get_number_of_layers(void*)
+{
+  return s_num_layers;
+}
+
+
+static heif_encoder_plugin create_layered_encoder_plugin()
+{
+  heif_encoder_plugin plugin = create_test_encoder_plugin(5, "test-layered-encoder", encode_layers);
+  plugin.get_compressed_data = get_layer_data;
+  plugin.get_number_of_layers = get_number_of_layers;
+  return plugin;
+}
+
+static const heif_encoder_plugin s_encoder_plugin = create_layered_encoder_plugin();
+
+
+// --- decoder plugin that only counts the bytes pushed into it
+
+static const char* const kTestDecoderID = "test-layer-decoder";
+
+static size_t s_pushed_bytes = 0;
+
+namespace test_decoder {
+  const char* plugin_name() { return "test layer decoder"; }
+
+  int does_support_format(heif_compression_format format) { return format == heif_compression_AV1 ? 1 : 0; }
+
+  heif_error new_decoder(void** decoder)
+  {
+    static int dummy;
+    *decoder = &dummy;
+    s_pushed_bytes = 0;
+    return test_encoder::ok();
+  }
+
+  void free_decoder(void*) {}
+
+  heif_error push_data(void*, const void*, size_t size)
+  {
+    s_pushed_bytes += size;
+    return test_encoder::ok();
+  }
+
+  heif_error decode_image(void*, heif_image** out_img)
+  {
+    heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_YCbCr, heif_chroma_420, out_img);
+    if (err.code != heif_error_Ok) {
+      return err;
+    }
+
+    heif_image_add_plane(*out_img, heif_channel_Y, kWidth, kHeight, 8);
+    heif_image_add_plane(*out_img, heif_channel_Cb, kWidth / 2, kHeight / 2, 8);
+    heif_image_add_plane(*out_img, heif_channel_Cr, kWidth / 2, kHeight / 2, 8);
+    return test_encoder::ok();
+  }
+
+  void set_strict_decoding(void*, int) {}
+}
+
+static const heif_decoder_plugin s_decoder_plugin{
+    3,
+    test_decoder::plugin_name,
+    nullptr,
+    nullptr,
+    test_decoder::does_support_format,
+    test_decoder::new_decoder,
+    test_decoder::free_decoder,
+    test_decoder::push_data,
+    test_decoder::decode_image,
+    test_decoder::set_strict_decoding,
+    kTestDecoderID
+};
+
+
+static void register_test_decoder()
+{
+  static bool registered = false;
+  if (!registered) {
+    REQUIRE(heif_register_decoder_plugin(&s_decoder_plugin).code == heif_error_Ok);
+    registered = true;
+  }
+}
+
+
+static heif_image* create_image()
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, kWidth, kHeight, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth * 3; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x + y * 2);
+    }
+  }
+
+  return img;
+}
+
+
+static heif_error encode(heif_encoder* encoder, Bytes& file)
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_image* input = create_image();
+  heif_error err = heif_context_encode_image(ctx, input, encoder, nullptr, nullptr);
+  heif_image_release(input);
+
+  if (err.code == heif_error_Ok) {
+    file.clear();
+    heif_writer writer{1, write_to_vector};
+    heif_error write_err = heif_context_write(ctx, &writer, &file);
+    REQUIRE(write_err.code == heif_error_Ok);
+  }
+
+  heif_context_free(ctx);
+  return err;
+}
+
+
+// Encodes with the test plugin. The packets are the layers.
+static heif_error encode_with_layers(const std::vector<Bytes>& layers, int num_layers, Bytes& file)
+{
+  s_layers = layers;
+  s_num_layers = num_layers;
+
+  heif_context* ctx = heif_context_alloc();
+  heif_encoder* encoder = get_test_encoder(ctx, s_encoder_plugin);
+  REQUIRE(encoder != nullptr);
+
+  heif_error err = encode(encoder, file);
+
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+  return err;
+}
+
+
+static Bytes get_item_data(heif_context* ctx, heif_item_id id, const Bytes& file)
+{
+  heif_file_range* ranges = nullptr;
+  int num_ranges = 0;
+  heif_error err = heif_item_get_file_ranges(ctx, id, &ranges, &num_ranges);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes data;
+  for (int i = 0; i < num_ranges; i++) {
+    data.insert(data.end(), file.begin() + ranges[i].offset, file.begin() + ranges[i].offset + ranges[i].size);
+  }
+
+  heif_file_ranges_release(ranges);
+  return data;
+}
+
+
+// Returns the number of bytes that the test decoder received.
+static size_t decode_layers(heif_image_handle* handle, int max_decoded_layer)
+{
+  heif_decoding_options* options = heif_decoding_options_alloc();
+  options->decoder_id = kTestDecoderID;
+  options->max_decoded_layer = max_decoded_layer;
+
+  heif_image* img = nullptr;
+  heif_error err = heif_decode_image(handle, &img, heif_colorspace_undefined, heif_chroma_undefined, options);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_image_get_primary_width(img) == kWidth);
+  REQUIRE(heif_image_get_primary_height(img) == kHeight);
+
+  heif_image_release(img);
+  heif_decoding_options_free(options);
+  return s_pushed_bytes;
+}
+
+
+TEST_CASE("layered encoding")
+{
+  register_test_decoder();
+
+  const std::vector<Bytes> layers{padding_obu(10, 1), padding_obu(20, 2), padding_obu(30, 3)};
+
+  Bytes file;
+  heif_error err = encode_with_layers(layers, 3, file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_context* ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(heif_image_handle_get_number_of_layers(handle) == 3);
+
+  // the layers are stored one after the other
+  REQUIRE(get_item_data(ctx, heif_image_handle_get_item_id(handle), file) == concat({layers[0], layers[1], layers[2]}));
+
+  // Decoding the first layers only reads their data. Beyond the last layer, all data is read.
+  size_t all_layers = decode_layers(handle, -1);
+  REQUIRE(decode_layers(handle, 0) == all_layers - layers[1].size() - layers[2].size());
+  REQUIRE(decode_layers(handle, 1) == all_layers - layers[2].size());
+  REQUIRE(decode_layers(handle, 2) == all_layers);
+  REQUIRE(decode_layers(handle, 5) == all_layers);
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("layered encoding with a single layer")
+{
+  register_test_decoder();
+
+  // Without layers, several packets are one coded image and no 'a1lx' is written.
+  Bytes file;
+  heif_error err = encode_with_layers({padding_obu(10, 1), padding_obu(20, 2)}, 1, file);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(std::search(file.begin(), file.end(), "a1lx", "a1lx" + 4) == file.end());
+
+  heif_context* ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(heif_image_handle_get_number_of_layers(handle) == 1);
+  REQUIRE(decode_layers(handle, 0) == decode_layers(handle, -1));
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("layered encoding with an invalid number of layers")
+{
+  Bytes file;
+
+  // not one packet per layer
+  heif_error err = encode_with_layers({padding_obu(10, 1), padding_obu(20, 2)}, 3, file);
+  REQUIRE(err.code == heif_error_Encoder_plugin_error);
+
+  // more layers than 'a1lx' can describe
+  std::vector<Bytes> layers(5, padding_obu(10, 1));
+  err = encode_with_layers(layers, 5, file);
+  REQUIRE(err.code == heif_error_Encoder_plugin_error);
+}
+
+
+// Returns the ID of an AV1 decoder that is not the test decoder, or nullptr.
+static const char* find_av1_decoder()
+{
+  const heif_decoder_descriptor* decoders[10];
+  int num_decoders = heif_get_decoder_descriptors(heif_compression_AV1, decoders, 10);
+  for (int i = 0; i < num_decoders; i++) {
+    const char* id = heif_decoder_descriptor_get_id_name(decoders[i]);
+    if (id && strcmp(id, kTestDecoderID) != 0) {
+      return id;
+    }
+  }
+
+  return nullptr;
+}
+
+
+TEST_CASE("layered encoding with aom")
+{
+  heif_init(nullptr);
+
+  const heif_encoder_descriptor* descriptor = nullptr;
+  const char* decoder_id = find_av1_decoder();
+  if (heif_get_encoder_descriptors(heif_compression_AV1, "aom", &descriptor, 1) != 1 || !decoder_id) {
+    WARN("skipped, no aom encoder or no AV1 decoder");
+    heif_deinit();
+    return;
+  }
+
+  heif_context* ctx = heif_context_alloc();
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder(ctx, descriptor, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_encoder_set_parameter_integer(encoder, "progressive-layers", 3);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  err = encode(encoder, file);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  // libaom versions without spatial layer support code a single layer
+  int num_layers = heif_image_handle_get_number_of_layers(handle);
+  if (num_layers == 1) {
+    WARN("aom coded a single layer");
+  }
+  else {
+    REQUIRE(num_layers == 3);
+  }
+
+  // Each layer decodes to an image of the full size.
+  for (int layer = 0; layer < num_layers; layer++) {
+    CAPTURE(layer);
+
+    heif_decoding_options* options = heif_decoding_options_alloc();
+    options->decoder_id = decoder_id;
+    options->max_decoded_layer = layer;
+
+    heif_image* img = nullptr;
+    err = heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, options);
+    REQUIRE(err.code == heif_error_Ok);
+    REQUIRE(heif_image_get_primary_width(img) == kWidth);
+    REQUIRE(heif_image_get_primary_height(img) == kHeight);
+
+    heif_image_release(img);
+    heif_decoding_options_free(options);
+  }
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+  heif_deinit();
+}
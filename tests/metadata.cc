@@ -0,0 +1,148 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Getting all metadata blocks of an image at once.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+static const uint8_t kExif[] = {'I', 'I', 42, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+static const char kXMP[] = "<x:xmpmeta xmlns:x='adobe:ns:meta/'></x:xmpmeta>";
+
+
+static std::vector<uint8_t> create_file_with_metadata()
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = nullptr;
+  err = heif_image_create(16, 16, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_Y, 16, 16, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_add_exif_metadata(ctx, handle, kExif, sizeof(kExif));
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_context_add_XMP_metadata(ctx, handle, kXMP, static_cast<int>(strlen(kXMP)));
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<uint8_t> file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle_release(handle);
+  heif_image_release(img);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+static void check_metadata_blocks(heif_context* ctx, const std::vector<uint8_t>& file, bool expect_view)
+{
+  heif_image_handle* handle = nullptr;
+  heif_error err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(heif_image_handle_get_number_of_metadata_blocks(handle, nullptr) == 2);
+
+  heif_metadata_block blocks[2];
+  int num_blocks = 0;
+  err = heif_image_handle_get_metadata_blocks(handle, nullptr, blocks, 2, &num_blocks);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(num_blocks == 2);
+
+  for (const heif_metadata_block& block : blocks) {
+    // same data as returned by the single block functions
+    REQUIRE(std::string(block.type) == heif_image_handle_get_metadata_type(handle, block.id));
+    REQUIRE(std::string(block.content_type) == heif_image_handle_get_metadata_content_type(handle, block.id));
+    REQUIRE(block.size == heif_image_handle_get_metadata_size(handle, block.id));
+
+    std::vector<uint8_t> data(block.size);
+    err = heif_image_handle_get_metadata(handle, block.id, data.data());
+    REQUIRE(err.code == heif_error_Ok);
+    REQUIRE(memcmp(data.data(), block.data, block.size) == 0);
+
+    bool is_view = (block.data >= file.data() && block.data + block.size <= file.data() + file.size());
+    REQUIRE(is_view == expect_view);
+  }
+
+  err = heif_image_handle_get_metadata_blocks(handle, "mime", blocks, 2, &num_blocks);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(num_blocks == 1);
+  REQUIRE(std::string(blocks[0].content_type) == "application/rdf+xml");
+  REQUIRE(std::string(reinterpret_cast<const char*>(blocks[0].data), blocks[0].size) == kXMP);
+
+  err = heif_image_handle_get_metadata_blocks(handle, nullptr, blocks, 1, &num_blocks);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(num_blocks == 1);
+
+  heif_image_handle_release(handle);
+}
+
+
+TEST_CASE("metadata blocks")
+{
+  std::vector<uint8_t> file = create_file_with_metadata();
+
+  // the data points into the input
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  check_metadata_blocks(ctx, file, true);
+  heif_context_free(ctx);
+
+  // the data is copied
+  std::string path = "metadata-blocks-test.heif";
+  FILE* fh = fopen(path.c_str(), "wb");
+  REQUIRE(fh != nullptr);
+  REQUIRE(fwrite(file.data(), 1, file.size(), fh) == file.size());
+  fclose(fh);
+
+  ctx = heif_context_alloc();
+  err = heif_context_read_from_file(ctx, path.c_str(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  check_metadata_blocks(ctx, file, false);
+  heif_context_free(ctx);
+
+  remove(path.c_str());
+}
@@ -0,0 +1,131 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Monochrome images and alpha planes are passed to encoder plugins without dummy chroma planes
+// when the plugin reports that it can code monochrome images. The test plugins only record
+// the chroma format of the images that they receive.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "libheif/heif_plugin.h"
+#include "test_helpers.h"
+#include <atomic>
+#include <cstdint>
+
+
+static std::atomic<int> s_color_chroma{heif_chroma_undefined};
+static std::atomic<int> s_alpha_chroma{heif_chroma_undefined};
+
+static heif_error test_encode_image(void*, const heif_image* image, heif_image_input_class image_class)
+{
+  if (image_class == heif_image_input_class_alpha) {
+    s_alpha_chroma = heif_image_get_chroma_format(image);
+  }
+  else {
+    s_color_chroma = heif_image_get_chroma_format(image);
+  }
+
+  return {heif_error_Ok, heif_suberror_Unspecified, "Success"};
+}
+
+static int test_supports_monochrome(void*)
+{
+  return 1;
+}
+
+
+static const heif_encoder_plugin s_plugin_v5 = create_test_encoder_plugin(5, "test-chroma-only", test_encode_image,
+                                                                          test_supports_monochrome);
+static const heif_encoder_plugin s_plugin_v6 = create_test_encoder_plugin(6, "test-monochrome", test_encode_image,
+                                                                          test_supports_monochrome);
+
+
+static heif_image* create_image(heif_chroma chroma, heif_channel channel)
+{
+  heif_colorspace colorspace = (chroma == heif_chroma_monochrome ? heif_colorspace_monochrome : heif_colorspace_RGB);
+
+  heif_image* img = nullptr;
+  REQUIRE(heif_image_create(16, 16, colorspace, chroma, &img).code == heif_error_Ok);
+  REQUIRE(heif_image_add_plane(img, channel, 16, 16, 8).code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, channel, &stride);
+  for (int y = 0; y < 16; y++) {
+    for (int x = 0; x < stride; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x + y);
+    }
+  }
+
+  return img;
+}
+
+
+static void encode(const heif_encoder_plugin& plugin, heif_image* img)
+{
+  s_color_chroma = heif_chroma_undefined;
+  s_alpha_chroma = heif_chroma_undefined;
+
+  heif_context* ctx = heif_context_alloc();
+  heif_encoder* encoder = get_test_encoder(ctx, plugin);
+  REQUIRE(encoder != nullptr);
+
+  heif_error err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("monochrome images are coded without chroma")
+{
+  heif_image* img = create_image(heif_chroma_monochrome, heif_channel_Y);
+
+  encode(s_plugin_v6, img);
+  REQUIRE(s_color_chroma == heif_chroma_monochrome);
+
+  // without the capability, the encoder gets the format it asks for
+  encode(s_plugin_v5, img);
+  REQUIRE(s_color_chroma == heif_chroma_420);
+
+  heif_image_release(img);
+}
+
+
+TEST_CASE("alpha planes are coded without chroma")
+{
+  heif_image* img = create_image(heif_chroma_interleaved_RGBA, heif_channel_interleaved);
+
+  encode(s_plugin_v6, img);
+  REQUIRE(s_color_chroma == heif_chroma_420);
+  REQUIRE(s_alpha_chroma == heif_chroma_monochrome);
+
+  encode(s_plugin_v5, img);
+  REQUIRE(s_color_chroma == heif_chroma_420);
+  REQUIRE(s_alpha_chroma == heif_chroma_420);
+
+  heif_image_release(img);
+}
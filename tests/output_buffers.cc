@@ -0,0 +1,306 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+// Decoding into application buffers with heif_decoding_options::get_output_plane_buffer.
+// The final color conversion has to write into the provided memory with the provided stride.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <vector>
+
+
+static const int kWidth = 40;
+static const int kHeight = 24;
+
+// added to the minimum stride to check that libheif uses the stride of the application
+static const int kStridePadding = 13;
+static const uint8_t kPaddingValue = 0xAB;
+
+
+static uint8_t pixel_value(int x, int y, int component)
+{
+  return static_cast<uint8_t>(x * 5 + y * 11 + component * 70);
+}
+
+
+static heif_image* create_image(heif_chroma chroma)
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_RGB, chroma, &img);
+  REQUIRE(err.code == heif_error_Ok);
+
+  if (chroma == heif_chroma_interleaved_RGB) {
+    err = heif_image_add_plane(img, heif_channel_interleaved, kWidth, kHeight, 8);
+    REQUIRE(err.code == heif_error_Ok);
+
+    int stride;
+    uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+    for (int y = 0; y < kHeight; y++) {
+      for (int x = 0; x < kWidth; x++) {
+        for (int c = 0; c < 3; c++) {
+          p[y * stride + x * 3 + c] = pixel_value(x, y, c);
+        }
+      }
+    }
+  }
+  else {
+    const heif_channel channels[3] = {heif_channel_R, heif_channel_G, heif_channel_B};
+    for (int c = 0; c < 3; c++) {
+      err = heif_image_add_plane(img, channels[c], kWidth, kHeight, 8);
+      REQUIRE(err.code == heif_error_Ok);
+
+      int stride;
+      uint8_t* p = heif_image_get_plane(img, channels[c], &stride);
+      for (int y = 0; y < kHeight; y++) {
+        for (int x = 0; x < kWidth; x++) {
+          p[y * stride + x] = pixel_value(x, y, c);
+        }
+      }
+    }
+  }
+
+  return img;
+}
+
+
+static Bytes encode(heif_chroma chroma)
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = create_image(chroma);
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_release(img);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+// --- application buffers
+
+struct OutputPlane
+{
+  heif_channel channel;
+  int width;
+  int height;
+  int bytes_per_pixel;
+  int stride;
+  Bytes memory;
+
+  // The plane starts behind the beginning of the allocation. libheif would crash when it freed it.
+  uint8_t* data() { return memory.data() + kStridePadding; }
+};
+
+
+struct OutputBuffers
+{
+  std::vector<OutputPlane> planes;
+  bool fail = false;
+
+  OutputPlane* find(heif_channel channel)
+  {
+    for (auto& plane : planes) {
+      if (plane.channel == channel) {
+        return &plane;
+      }
+    }
+
+    return nullptr;
+  }
+};
+
+
+static uint8_t* get_output_plane_buffer(heif_channel channel, int width, int height,
+                                        int bit_depth, int bytes_per_pixel, int* out_stride,
+                                        void* userdata)
+{
+  auto* buffers = static_cast<OutputBuffers*>(userdata);
+  if (buffers->fail) {
+    return nullptr;
+  }
+
+  REQUIRE(bit_depth == 8);
+
+  OutputPlane plane;
+  plane.channel = channel;
+  plane.width = width;
+  plane.height = height;
+  plane.bytes_per_pixel = bytes_per_pixel;
+  plane.stride = width * bytes_per_pixel + kStridePadding;
+  plane.memory.assign(static_cast<size_t>(kStridePadding + plane.stride * height), kPaddingValue);
+
+  // Reserve all planes in advance, such that the returned pointers stay valid.
+  buffers->planes.reserve(4);
+  REQUIRE(buffers->planes.size() < 4);
+  buffers->planes.push_back(std::move(plane));
+
+  *out_stride = buffers->planes.back().stride;
+  return buffers->planes.back().data();
+}
+
+
+static heif_error decode(const Bytes& file, heif_chroma chroma, OutputBuffers* buffers, heif_image** out_img)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_decoding_options* options = heif_decoding_options_alloc();
+  REQUIRE(options->version >= 6);
+  options->get_output_plane_buffer = get_output_plane_buffer;
+  options->output_buffer_user_data = buffers;
+
+  err = heif_decode_image(handle, out_img, heif_colorspace_RGB, chroma, options);
+
+  heif_decoding_options_free(options);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+
+  return err;
+}
+
+
+// Checks that the image plane is stored in the application buffer and that only the pixels were written.
+static void check_plane(const heif_image* img, OutputPlane* plane, heif_channel channel, int first_component)
+{
+  REQUIRE(plane != nullptr);
+  REQUIRE(plane->width == kWidth);
+  REQUIRE(plane->height == kHeight);
+
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(img, channel, &stride);
+  REQUIRE(p == plane->data());
+  REQUIRE(stride == plane->stride);
+
+  for (int i = 0; i < kStridePadding; i++) {
+    REQUIRE(plane->memory[i] == kPaddingValue);
+  }
+
+  for (int y = 0; y < kHeight; y++) {
+    const uint8_t* row = plane->data() + y * plane->stride;
+    for (int x = 0; x < kWidth; x++) {
+      for (int c = 0; c < plane->bytes_per_pixel; c++) {
+        REQUIRE(row[x * plane->bytes_per_pixel + c] == pixel_value(x, y, first_component + c));
+      }
+    }
+
+    for (int x = kWidth * plane->bytes_per_pixel; x < plane->stride; x++) {
+      REQUIRE(row[x] == kPaddingValue);
+    }
+  }
+}
+
+
+TEST_CASE("decode into application buffer, interleaved RGB")
+{
+  // planar input, such that the conversion to the output format writes into the buffer
+  Bytes file = encode(heif_chroma_444);
+
+  OutputBuffers buffers;
+  heif_image* img = nullptr;
+  heif_error err = decode(file, heif_chroma_interleaved_RGB, &buffers, &img);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(buffers.planes.size() == 1);
+  REQUIRE(buffers.planes[0].bytes_per_pixel == 3);
+  check_plane(img, buffers.find(heif_channel_interleaved), heif_channel_interleaved, 0);
+
+  // The buffers belong to the application and are still valid after the image is released.
+  heif_image_release(img);
+  REQUIRE(buffers.planes[0].memory[0] == kPaddingValue);
+}
+
+
+TEST_CASE("decode into application buffers, planar RGB")
+{
+  Bytes file = encode(heif_chroma_interleaved_RGB);
+
+  OutputBuffers buffers;
+  heif_image* img = nullptr;
+  heif_error err = decode(file, heif_chroma_444, &buffers, &img);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(buffers.planes.size() == 3);
+  const heif_channel channels[3] = {heif_channel_R, heif_channel_G, heif_channel_B};
+  for (int c = 0; c < 3; c++) {
+    OutputPlane* plane = buffers.find(channels[c]);
+    REQUIRE(plane != nullptr);
+    REQUIRE(plane->bytes_per_pixel == 1);
+    check_plane(img, plane, channels[c], c);
+  }
+
+  heif_image_release(img);
+}
+
+
+TEST_CASE("decode into application buffer without format conversion")
+{
+  Bytes file = encode(heif_chroma_interleaved_RGB);
+
+  OutputBuffers buffers;
+  heif_image* img = nullptr;
+  heif_error err = decode(file, heif_chroma_interleaved_RGB, &buffers, &img);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(buffers.planes.size() == 1);
+  check_plane(img, buffers.find(heif_channel_interleaved), heif_channel_interleaved, 0);
+
+  heif_image_release(img);
+}
+
+
+TEST_CASE("application does not provide an output buffer")
+{
+  Bytes file = encode(heif_chroma_444);
+
+  OutputBuffers buffers;
+  buffers.fail = true;
+
+  heif_image* img = nullptr;
+  heif_error err = decode(file, heif_chroma_interleaved_RGB, &buffers, &img);
+  REQUIRE(err.code == heif_error_Memory_allocation_error);
+  REQUIRE(img == nullptr);
+  REQUIRE(buffers.planes.empty());
+}
@@ -0,0 +1,366 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Performance smoke tests (built with WITH_PERFORMANCE_TESTS). They check budgets that catch lost
+// fast paths and unnecessary copies: the length of the conversion pipelines, the memory of their
+// intermediate images, the plane allocations and conversions per decode and encode (from the process-wide
+// statistics), and the conversion throughput relative to memcpy. All exceeded budgets of a test are
+// reported, not only the first one.
+//
+// The throughput budgets are only checked in optimized builds.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "libheif/color-conversion/colorconversion.h"
+#include "libheif/pixelimage.h"
+#include "test-config.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__OPTIMIZE__) || (defined(_MSC_VER) && defined(NDEBUG))
+static const bool kOptimizedBuild = true;
+#else
+static const bool kOptimizedBuild = false;
+#endif
+
+
+static heif_color_conversion_options default_options()
+{
+  heif_color_conversion_options options{};
+  options.version = 2;
+  options.preferred_chroma_downsampling_algorithm = heif_chroma_downsampling_average;
+  options.preferred_chroma_upsampling_algorithm = heif_chroma_upsampling_bilinear;
+  options.only_use_preferred_chroma_algorithm = false;
+  options.conversion_accuracy = heif_color_conversion_accuracy_precise;
+  return options;
+}
+
+
+static std::string describe(const ColorState& state)
+{
+  std::stringstream sstr;
+  sstr << state.colorspace << " " << state.chroma << (state.has_alpha ? " alpha " : " ") << state.bits_per_pixel << " bit";
+  return sstr.str();
+}
+
+
+static size_t image_size_in_bytes(const HeifPixelImage& img)
+{
+  size_t size = 0;
+  for (heif_channel channel : img.get_channel_set()) {
+    size_t stride;
+    img.get_plane(channel, &stride);
+    size += stride * img.get_height(channel);
+  }
+
+  return size;
+}
+
+
+// --- pipeline budgets
+
+struct PipelineBudget
+{
+  ColorState input;
+  ColorState target;
+  size_t max_steps;
+};
+
+static const PipelineBudget kPipelineBudgets[] = {
+    // direct conversions to the formats that applications display
+    {{heif_colorspace_YCbCr, heif_chroma_420, false, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, 1},
+    {{heif_colorspace_YCbCr, heif_chroma_420, true, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGBA, true, 8}, 1},
+    {{heif_colorspace_YCbCr, heif_chroma_422, false, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, 1},
+    {{heif_colorspace_YCbCr, heif_chroma_444, false, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, 1},
+    {{heif_colorspace_YCbCr, heif_chroma_420, false, 10}, {heif_colorspace_RGB, heif_chroma_interleaved_RRGGBB_LE, false, 10}, 1},
+    {{heif_colorspace_RGB, heif_chroma_444, false, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, 1},
+    {{heif_colorspace_monochrome, heif_chroma_monochrome, false, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, 2},
+
+    // encoder input
+    {{heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, {heif_colorspace_YCbCr, heif_chroma_420, false, 8}, 1},
+    {{heif_colorspace_RGB, heif_chroma_interleaved_RGBA, true, 8}, {heif_colorspace_YCbCr, heif_chroma_420, true, 8}, 1},
+};
+
+
+TEST_CASE("Pipeline length and intermediate images")
+{
+  const int width = 256;
+  const int height = 128;
+
+  for (const PipelineBudget& budget : kPipelineBudgets) {
+    INFO(describe(budget.input) << " -> " << describe(budget.target));
+
+    ColorConversionPipeline pipeline;
+    REQUIRE(pipeline.construct_pipeline(budget.input, budget.target, default_options()));
+
+    ColorConversionInfo info = pipeline.get_info();
+    INFO(pipeline.debug_dump_pipeline());
+    CHECK(info.steps.size() <= budget.max_steps);
+
+    auto input = ColorConversionPipeline::create_calibration_image(width, height, budget.input);
+    REQUIRE(input);
+
+    auto output = pipeline.convert_image(input);
+    REQUIRE(output);
+
+    // Every step writes one image of at most the size of the largest format in the chain. More memory
+    // means that a step allocated an additional intermediate image.
+    size_t output_size = image_size_in_bytes(*output);
+
+    size_t memory_bytes = 0;
+    for (const auto& step : pipeline.get_info().steps) {
+      memory_bytes += step.memory_bytes;
+    }
+
+    CHECK(memory_bytes <= 2 * output_size * info.steps.size());
+  }
+}
+
+
+// --- throughput relative to memcpy
+
+template <typename F>
+static double best_time_us(int repetitions, F func)
+{
+  double best = 0;
+  for (int i = 0; i < repetitions; i++) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    double time = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    if (i == 0 || time < best) {
+      best = time;
+    }
+  }
+
+  return std::max(best, 1.0);
+}
+
+
+struct ThroughputBudget
+{
+  ColorState input;
+  ColorState target;
+  double max_factor; // time of the conversion / time of copying the output with memcpy
+};
+
+static const ThroughputBudget kThroughputBudgets[] = {
+    {{heif_colorspace_YCbCr, heif_chroma_420, false, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, 20},
+    {{heif_colorspace_YCbCr, heif_chroma_444, false, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, 20},
+    {{heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, {heif_colorspace_YCbCr, heif_chroma_420, false, 8}, 20},
+    {{heif_colorspace_RGB, heif_chroma_444, false, 8}, {heif_colorspace_RGB, heif_chroma_interleaved_RGB, false, 8}, 20},
+};
+
+
+TEST_CASE("Conversion throughput")
+{
+  const int width = 1024;
+  const int height = 1024;
+  const int repetitions = 5;
+
+  for (const ThroughputBudget& budget : kThroughputBudgets) {
+    INFO(describe(budget.input) << " -> " << describe(budget.target));
+
+    ColorConversionPipeline pipeline;
+    REQUIRE(pipeline.construct_pipeline(budget.input, budget.target, default_options()));
+
+    auto input = ColorConversionPipeline::create_calibration_image(width, height, budget.input);
+    REQUIRE(input);
+
+    std::shared_ptr<HeifPixelImage> output;
+    double conversion_us = best_time_us(repetitions, [&]() { output = pipeline.convert_image(input); });
+    REQUIRE(output);
+
+    size_t output_size = image_size_in_bytes(*output);
+
+    std::vector<uint8_t> src(output_size, 1), dst(output_size);
+    double memcpy_us = best_time_us(repetitions, [&]() {
+      memcpy(dst.data(), src.data(), output_size);
+      src[dst[output_size / 2] % output_size]++; // keep the copy from being optimized away
+    });
+
+    double factor = conversion_us / memcpy_us;
+    INFO("conversion: " << conversion_us << " us, memcpy: " << memcpy_us << " us, factor: " << factor);
+
+    if (kOptimizedBuild) {
+      CHECK(factor <= budget.max_factor);
+    }
+    else {
+      WARN("throughput budget not checked in an unoptimized build");
+    }
+  }
+}
+
+
+// --- decoding and encoding budgets
+
+static const char* const kReferenceFiles[] = {
+    "uncompressed_rgb3.heif", "uncompressed_planar_tiled.heif", "uncompressed_row.heif",
+    "uncompressed_row_tiled.heif", "uncompressed_pix_tile_align.heif",
+    "uncompressed_comp_tile_align.heif", "uncompressed_row_tile_align.heif"};
+
+
+static const heif_channel kChannels[] = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr, heif_channel_R,
+                                         heif_channel_G, heif_channel_B, heif_channel_Alpha, heif_channel_interleaved};
+
+
+static int number_of_planes(const heif_image* img)
+{
+  int num_planes = 0;
+  for (heif_channel channel : kChannels) {
+    if (heif_image_has_channel(img, channel)) {
+      num_planes++;
+    }
+  }
+
+  return num_planes;
+}
+
+
+static size_t image_size_in_bytes(const heif_image* img)
+{
+  size_t size = 0;
+  for (heif_channel channel : kChannels) {
+    if (heif_image_has_channel(img, channel)) {
+      int stride;
+      heif_image_get_plane_readonly(img, channel, &stride);
+      size += static_cast<size_t>(stride) * heif_image_get_height(img, channel);
+    }
+  }
+
+  return size;
+}
+
+
+TEST_CASE("Decoding budgets")
+{
+  // The uncompressed decoder is built in and not listed as a decoder plugin. Its encoder is built with it.
+  if (!heif_have_encoder_for_format(heif_compression_uncompressed)) {
+    WARN("decoding budgets not checked without the uncompressed codec");
+    return;
+  }
+
+  const heif_chroma target_chromas[] = {heif_chroma_444, heif_chroma_interleaved_RGB};
+
+  for (const char* filename : kReferenceFiles) {
+    for (heif_chroma chroma : target_chromas) {
+      INFO(filename << ", chroma " << chroma);
+
+      heif_context* ctx = heif_context_alloc();
+      heif_error err = heif_context_read_from_file(ctx, (tests_data_directory + "/" + filename).c_str(), nullptr);
+      REQUIRE(err.code == heif_error_Ok);
+
+      heif_image_handle* handle = nullptr;
+      err = heif_context_get_primary_image_handle(ctx, &handle);
+      REQUIRE(err.code == heif_error_Ok);
+
+      heif_reset_statistics();
+
+      heif_image* img = nullptr;
+      err = heif_decode_image(handle, &img, heif_colorspace_RGB, chroma, nullptr);
+      REQUIRE(err.code == heif_error_Ok);
+
+      heif_statistics stats;
+      heif_get_statistics(&stats);
+
+      uint64_t num_pixels = static_cast<uint64_t>(heif_image_get_primary_width(img)) * heif_image_get_primary_height(img);
+      int num_output_planes = number_of_planes(img);
+      INFO("plane allocations: " << stats.plane_allocations << ", output planes: " << num_output_planes);
+
+      CHECK(stats.images_decoded == 1);
+      // The planes of the decoded RGB image (at most three) and at most one converted copy of it.
+      // (The plane sizes are not compared because the padding dominates for these small images.)
+      CHECK(stats.plane_allocations <= static_cast<uint64_t>(3 + num_output_planes));
+      CHECK(stats.pixels_converted <= num_pixels);
+
+      heif_image_release(img);
+      heif_image_handle_release(handle);
+      heif_context_free(ctx);
+    }
+  }
+}
+
+
+TEST_CASE("Encoding budgets")
+{
+  if (!heif_have_encoder_for_format(heif_compression_uncompressed)) {
+    WARN("encoding budgets not checked without the uncompressed codec");
+    return;
+  }
+
+  const int width = 256;
+  const int height = 128;
+
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(width, height, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, width, height, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* data = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width * 3; x++) {
+      data[y * stride + x] = static_cast<uint8_t>(x + y);
+    }
+  }
+
+  size_t input_size = image_size_in_bytes(img);
+
+  heif_context* ctx = heif_context_alloc();
+  heif_encoder* encoder = nullptr;
+  err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_reset_statistics();
+
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<uint8_t> file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_statistics stats;
+  heif_get_statistics(&stats);
+  INFO("plane allocations: " << stats.plane_allocations << ", allocated: " << stats.plane_bytes_allocated
+       << ", input: " << input_size);
+
+  // at most one conversion of the input image into the format of the encoder
+  CHECK(stats.pixels_converted <= static_cast<uint64_t>(width) * height);
+  CHECK(stats.plane_allocations <= 3);
+  CHECK(stats.plane_bytes_allocated <= 2 * input_size);
+
+  heif_encoder_release(encoder);
+  heif_image_release(img);
+  heif_context_free(ctx);
+}
@@ -0,0 +1,141 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Images with read-only external planes are passed to encoder plugins without copying the
+// planes. The test plugin only records where the luma plane of the image it receives is.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "libheif/heif_plugin.h"
+#include "test_helpers.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+
+static std::atomic<const uint8_t*> s_encoded_luma{nullptr};
+
+static heif_error test_encode_image(void*, const heif_image* image, heif_image_input_class)
+{
+  int stride;
+  s_encoded_luma = heif_image_get_plane_readonly(image, heif_channel_Y, &stride);
+  return {heif_error_Ok, heif_suberror_Unspecified, "Success"};
+}
+
+
+static const heif_encoder_plugin s_plugin = create_test_encoder_plugin(3, "test-read-only-planes", test_encode_image);
+
+
+static void count_release(void* user_data)
+{
+  (*static_cast<int*>(user_data))++;
+}
+
+
+// A 4:2:0 image whose planes are all in 'buffer'. Each release of a plane increments 'num_released'.
+static heif_image* create_image(const std::vector<uint8_t>& buffer, int* num_released)
+{
+  heif_image* img = nullptr;
+  REQUIRE(heif_image_create(16, 16, heif_colorspace_YCbCr, heif_chroma_420, &img).code == heif_error_Ok);
+
+  heif_error err = heif_image_add_external_read_only_plane(img, heif_channel_Y, 16, 16, 8, buffer.data(), 16,
+                                                           count_release, num_released);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_external_read_only_plane(img, heif_channel_Cb, 8, 8, 8, buffer.data() + 256, 8,
+                                                count_release, num_released);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_external_read_only_plane(img, heif_channel_Cr, 8, 8, 8, buffer.data() + 320, 8,
+                                                count_release, num_released);
+  REQUIRE(err.code == heif_error_Ok);
+
+  return img;
+}
+
+
+static std::vector<uint8_t> create_buffer()
+{
+  std::vector<uint8_t> buffer(16 * 16 + 2 * 8 * 8);
+  for (size_t i = 0; i < buffer.size(); i++) {
+    buffer[i] = static_cast<uint8_t>(i * 7);
+  }
+  return buffer;
+}
+
+
+TEST_CASE("encoders read from read-only planes")
+{
+  const std::vector<uint8_t> buffer = create_buffer();
+  int num_released = 0;
+  heif_image* img = create_image(buffer, &num_released);
+
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = get_test_encoder(ctx, s_plugin);
+  REQUIRE(encoder != nullptr);
+
+  heif_error err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(s_encoded_luma == buffer.data());
+
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  REQUIRE(buffer == create_buffer());
+  REQUIRE(num_released == 0);
+
+  heif_image_release(img);
+  REQUIRE(num_released == 3);
+}
+
+
+TEST_CASE("read-only planes are copied on write")
+{
+  const std::vector<uint8_t> buffer = create_buffer();
+  int num_released = 0;
+  heif_image* img = create_image(buffer, &num_released);
+
+  int stride;
+  REQUIRE(heif_image_get_plane_readonly(img, heif_channel_Y, &stride) == buffer.data());
+  REQUIRE(stride == 16);
+
+  uint8_t* p = heif_image_get_plane(img, heif_channel_Y, &stride);
+  REQUIRE(p != nullptr);
+  REQUIRE(p != buffer.data());
+  REQUIRE(p[stride + 1] == buffer[16 + 1]);
+
+  // the copy replaces the external memory
+  REQUIRE(num_released == 1);
+
+  p[0] = static_cast<uint8_t>(buffer[0] + 1);
+  REQUIRE(buffer == create_buffer());
+  REQUIRE(heif_image_get_plane_readonly(img, heif_channel_Y, &stride) == p);
+
+  // the other planes still refer to the buffer
+  REQUIRE(heif_image_get_plane_readonly(img, heif_channel_Cb, &stride) == buffer.data() + 256);
+
+  heif_image_release(img);
+  REQUIRE(num_released == 3);
+}
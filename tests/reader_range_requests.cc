@@ -0,0 +1,306 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+
+// Readers that fetch the file ranges announced by libheif with heif_reader::request_ranges() (reader API version 2).
+// The tile data of a grid may only be read after it has been requested.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+static const int kWidth = 100;
+static const int kHeight = 70;
+static const int kTileSize = 32;
+static const int kNumTiles = 4 * 3;
+
+
+static uint8_t pixel_value(int x, int y)
+{
+  return static_cast<uint8_t>(x * 7 + y * 13);
+}
+
+
+static Bytes create_grid_file()
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, kWidth, kHeight, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth * 3; x++) {
+      p[y * stride + x] = pixel_value(x, y);
+    }
+  }
+
+  heif_context* ctx = heif_context_alloc();
+  heif_encoder* encoder = nullptr;
+  err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_context_encode_grid(ctx, img, kTileSize, kTileSize, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_image_release(img);
+  heif_context_free(ctx);
+
+  return file;
+}
+
+
+// The 'iloc' extents of all grid tiles.
+static std::vector<heif_file_range> get_tile_extents(const Bytes& file)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<heif_item_id> ids(heif_context_get_number_of_items(ctx));
+  heif_context_get_list_of_item_IDs(ctx, ids.data(), (int) ids.size());
+
+  std::vector<heif_file_range> extents;
+  int num_tiles = 0;
+
+  for (heif_item_id id : ids) {
+    if (heif_item_get_item_type(ctx, id) == heif_fourcc('g', 'r', 'i', 'd')) {
+      continue;
+    }
+
+    heif_file_range* ranges = nullptr;
+    int num_ranges = 0;
+    err = heif_item_get_file_ranges(ctx, id, &ranges, &num_ranges);
+    REQUIRE(err.code == heif_error_Ok);
+    extents.insert(extents.end(), ranges, ranges + num_ranges);
+    heif_file_ranges_release(ranges);
+    num_tiles++;
+  }
+
+  REQUIRE(num_tiles == kNumTiles);
+
+  heif_context_free(ctx);
+  return extents;
+}
+
+
+static bool contains(const std::vector<heif_file_range>& ranges, uint64_t offset, uint64_t size)
+{
+  for (const auto& range : ranges) {
+    if (range.offset <= offset && offset + size <= range.offset + range.size) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static bool overlaps(const std::vector<heif_file_range>& ranges, uint64_t offset, uint64_t size)
+{
+  for (const auto& range : ranges) {
+    if (range.offset < offset + size && offset < range.offset + range.size) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+// --- a reader that serves the tile data only after it has been requested
+
+struct RangeReader
+{
+  RangeReader(const Bytes* d, std::vector<heif_file_range> tiles) : data(d), tile_extents(std::move(tiles)) {}
+
+  ~RangeReader()
+  {
+    for (auto& thread : completion_threads) {
+      thread.join();
+    }
+  }
+
+  const Bytes* data;
+  std::vector<heif_file_range> tile_extents;
+  int64_t position = 0;
+
+  std::mutex mutex;
+  std::vector<heif_file_range> requested;
+  std::vector<std::vector<heif_file_range>> request_calls;
+  std::vector<std::thread> completion_threads;
+  bool read_unrequested_data = false;
+};
+
+static int64_t range_get_position(void* userdata)
+{
+  return static_cast<RangeReader*>(userdata)->position;
+}
+
+static int range_read(void* data, size_t size, void* userdata)
+{
+  auto* reader = static_cast<RangeReader*>(userdata);
+  if (reader->position + (int64_t) size > (int64_t) reader->data->size()) {
+    return 1;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(reader->mutex);
+    auto offset = static_cast<uint64_t>(reader->position);
+    if (overlaps(reader->tile_extents, offset, size) && !contains(reader->requested, offset, size)) {
+      reader->read_unrequested_data = true;
+      return 1;
+    }
+  }
+
+  memcpy(data, reader->data->data() + reader->position, size);
+  reader->position += size;
+  return 0;
+}
+
+static int range_seek(int64_t position, void* userdata)
+{
+  static_cast<RangeReader*>(userdata)->position = position;
+  return 0;
+}
+
+static heif_reader_grow_status range_wait_for_file_size(int64_t target_size, void* userdata)
+{
+  auto* reader = static_cast<RangeReader*>(userdata);
+  return target_size > (int64_t) reader->data->size() ? heif_reader_grow_status_size_beyond_eof : heif_reader_grow_status_size_reached;
+}
+
+// The ranges are fetched in a separate thread, like a reader that downloads them would do.
+static void range_request_ranges(const heif_file_range* ranges, int num_ranges,
+                                 void (* range_completed)(int range_index, int success, void* completion_userdata),
+                                 void* completion_userdata,
+                                 void* userdata)
+{
+  auto* reader = static_cast<RangeReader*>(userdata);
+  std::vector<heif_file_range> request(ranges, ranges + num_ranges);
+
+  std::lock_guard<std::mutex> lock(reader->mutex);
+  reader->request_calls.push_back(request);
+
+  reader->completion_threads.emplace_back([reader, request, range_completed, completion_userdata]() {
+    for (size_t i = 0; i < request.size(); i++) {
+      {
+        std::lock_guard<std::mutex> lock(reader->mutex);
+        reader->requested.push_back(request[i]);
+      }
+
+      range_completed(static_cast<int>(i), 1, completion_userdata);
+    }
+  });
+}
+
+static const heif_reader kRangeReader{2, range_get_position, range_read, range_seek, range_wait_for_file_size,
+                                      range_request_ranges};
+
+// The same reader without request_ranges(). All data can be read at any time.
+static const heif_reader kPlainReader{1, range_get_position, range_read, range_seek, range_wait_for_file_size,
+                                      nullptr};
+
+
+static heif_error decode_grid(const heif_reader* reader_functions, RangeReader* reader)
+{
+  heif_reading_options* options = heif_reading_options_alloc();
+  options->metadata_only = true;
+
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_reader(ctx, reader_functions, reader, options);
+  heif_reading_options_free(options);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = nullptr;
+  err = heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  if (err.code == heif_error_Ok) {
+    int stride;
+    const uint8_t* p = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+    REQUIRE(heif_image_get_width(img, heif_channel_interleaved) == kWidth);
+    REQUIRE(heif_image_get_height(img, heif_channel_interleaved) == kHeight);
+    for (int y = 0; y < kHeight; y++) {
+      for (int x = 0; x < kWidth * 3; x++) {
+        REQUIRE(p[y * stride + x] == pixel_value(x, y));
+      }
+    }
+
+    heif_image_release(img);
+  }
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+
+  return err;
+}
+
+
+TEST_CASE("grid tiles are requested from the reader")
+{
+  Bytes file = create_grid_file();
+  std::vector<heif_file_range> tile_extents = get_tile_extents(file);
+
+  RangeReader reader(&file, tile_extents);
+  heif_error err = decode_grid(&kRangeReader, &reader);
+  REQUIRE(!reader.read_unrequested_data);
+  REQUIRE(err.code == heif_error_Ok);
+
+  // all tiles are requested at once, not one by one
+  REQUIRE(reader.request_calls.size() == 1);
+  REQUIRE(reader.request_calls[0].size() > 1);
+
+  for (const auto& extent : tile_extents) {
+    REQUIRE(contains(reader.request_calls[0], extent.offset, extent.size));
+  }
+}
+
+
+TEST_CASE("grid decoding with a reader without request_ranges")
+{
+  Bytes file = create_grid_file();
+
+  RangeReader reader(&file, {});
+  heif_error err = decode_grid(&kPlainReader, &reader);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(reader.request_calls.empty());
+}
@@ -0,0 +1,280 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2024 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Bulk access to the regions of a region item, hit-testing, and rasterization of the regions.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+static heif_image_handle* encode_image(heif_context* ctx)
+{
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = nullptr;
+  err = heif_image_create(16, 16, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_Y, 16, 16, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_release(img);
+  heif_encoder_release(encoder);
+
+  return handle;
+}
+
+
+static const int32_t kRectX[] = {2, 10};
+static const int32_t kRectY[] = {3, 0};
+static const uint32_t kRectW[] = {4, 5};
+static const uint32_t kRectH[] = {5, 2};
+
+static const int32_t kEllipseX[] = {20};
+static const int32_t kEllipseY[] = {20};
+static const uint32_t kEllipseRX[] = {6};
+static const uint32_t kEllipseRY[] = {3};
+
+// a triangle and a square
+static const int32_t kPolygonPoints[] = {0, 30, 10, 30, 0, 40,
+                                         30, 0, 38, 0, 38, 8, 30, 8};
+static const int kPolygonSizes[] = {3, 4};
+
+static const int32_t kPointX[] = {35};
+static const int32_t kPointY[] = {35};
+
+
+static void add_regions(heif_region_item* item)
+{
+  heif_error err = heif_region_item_add_region_rectangles(item, kRectX, kRectY, kRectW, kRectH, 2);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_region_item_add_region_ellipses(item, kEllipseX, kEllipseY, kEllipseRX, kEllipseRY, 1);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_region_item_add_region_polygons(item, kPolygonPoints, kPolygonSizes, 2);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_region_item_add_region_points(item, kPointX, kPointY, 1);
+  REQUIRE(err.code == heif_error_Ok);
+}
+
+
+static void check_regions(const heif_region_item* item)
+{
+  REQUIRE(heif_region_item_get_number_of_regions(item) == 6);
+
+  heif_region_type types[6];
+  REQUIRE(heif_region_item_get_region_types(item, types, 6) == 6);
+  REQUIRE(types[0] == heif_region_type_rectangle);
+  REQUIRE(types[1] == heif_region_type_rectangle);
+  REQUIRE(types[2] == heif_region_type_ellipse);
+  REQUIRE(types[3] == heif_region_type_polygon);
+  REQUIRE(types[4] == heif_region_type_polygon);
+  REQUIRE(types[5] == heif_region_type_point);
+
+  REQUIRE(heif_region_item_get_number_of_regions_of_type(item, heif_region_type_rectangle) == 2);
+  REQUIRE(heif_region_item_get_number_of_regions_of_type(item, heif_region_type_polyline) == 0);
+
+  int32_t x[2], y[2];
+  uint32_t w[2], h[2];
+  REQUIRE(heif_region_item_get_region_rectangles(item, x, y, w, h, 2) == 2);
+  for (int i = 0; i < 2; i++) {
+    REQUIRE(x[i] == kRectX[i]);
+    REQUIRE(y[i] == kRectY[i]);
+    REQUIRE(w[i] == kRectW[i]);
+    REQUIRE(h[i] == kRectH[i]);
+  }
+
+  REQUIRE(heif_region_item_get_region_ellipses(item, x, y, w, h, 2) == 1);
+  REQUIRE(x[0] == kEllipseX[0]);
+  REQUIRE(y[0] == kEllipseY[0]);
+  REQUIRE(w[0] == kEllipseRX[0]);
+  REQUIRE(h[0] == kEllipseRY[0]);
+
+  REQUIRE(heif_region_item_get_region_points(item, x, y, 2) == 1);
+  REQUIRE(x[0] == kPointX[0]);
+  REQUIRE(y[0] == kPointY[0]);
+
+  int sizes[2];
+  REQUIRE(heif_region_item_get_region_polygon_sizes(item, sizes, 2) == 2);
+  REQUIRE(sizes[0] == 3);
+  REQUIRE(sizes[1] == 4);
+
+  int32_t pts[14];
+  REQUIRE(heif_region_item_get_region_polygon_points(item, pts, 7) == 7);
+  REQUIRE(std::vector<int32_t>(pts, pts + 14) == std::vector<int32_t>(kPolygonPoints, kPolygonPoints + 14));
+
+  // only complete polygons are returned
+  REQUIRE(heif_region_item_get_region_polygon_points(item, pts, 5) == 3);
+}
+
+
+TEST_CASE("bulk region access")
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_image_handle* handle = encode_image(ctx);
+
+  heif_region_item* item = nullptr;
+  heif_error err = heif_image_handle_add_region_item(handle, 40, 40, &item);
+  REQUIRE(err.code == heif_error_Ok);
+
+  add_regions(item);
+  check_regions(item);
+
+  std::vector<uint8_t> file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_region_item_release(item);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+
+
+  // read back
+
+  ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_item_id region_item_id;
+  REQUIRE(heif_image_handle_get_list_of_region_item_ids(handle, &region_item_id, 1) == 1);
+  err = heif_context_get_region_item(ctx, region_item_id, &item);
+  REQUIRE(err.code == heif_error_Ok);
+
+  check_regions(item);
+
+  heif_region_item_release(item);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("too many regions")
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_image_handle* handle = encode_image(ctx);
+
+  heif_region_item* item = nullptr;
+  heif_error err = heif_image_handle_add_region_item(handle, 40, 40, &item);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<int32_t> coords(256);
+  err = heif_region_item_add_region_points(item, coords.data(), coords.data(), 256);
+  REQUIRE(err.code == heif_error_Usage_error);
+  REQUIRE(err.subcode == heif_suberror_Too_many_regions);
+  REQUIRE(heif_region_item_get_number_of_regions(item) == 0);
+
+  err = heif_region_item_add_region_points(item, coords.data(), coords.data(), 255);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(heif_region_item_get_number_of_regions(item) == 255);
+
+  heif_region_item_release(item);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("region hit-testing and rasterization")
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_image_handle* handle = encode_image(ctx);
+
+  heif_region_item* item = nullptr;
+  heif_error err = heif_image_handle_add_region_item(handle, 40, 40, &item);
+  REQUIRE(err.code == heif_error_Ok);
+
+  add_regions(item);
+
+  int indices[6];
+  REQUIRE(heif_region_item_find_regions_at(item, 3, 4, indices, 6) == 1);
+  REQUIRE(indices[0] == 0);
+  REQUIRE(heif_region_item_find_regions_at(item, 6, 4, indices, 6) == 0);
+  REQUIRE(heif_region_item_find_regions_at(item, 20, 20, indices, 6) == 1);
+  REQUIRE(indices[0] == 2);
+  REQUIRE(heif_region_item_find_regions_at(item, 35, 35, indices, 6) == 1);
+  REQUIRE(indices[0] == 5);
+
+  REQUIRE(heif_region_item_find_regions_in_rectangle(item, 0, 0, 40, 10, indices, 6) == 3);
+  REQUIRE(indices[0] == 0);
+  REQUIRE(indices[1] == 1);
+  REQUIRE(indices[2] == 4);
+
+  // Each region sets exactly the pixels that are reported by the hit-test.
+
+  const uint32_t width = 40, height = 40;
+  const size_t stride = 48;
+
+  heif_region* regions[6];
+  REQUIRE(heif_region_item_get_list_of_regions(item, regions, 6) == 6);
+
+  for (int r = 0; r < 6; r++) {
+    std::vector<uint8_t> bitmap(stride * height);
+    err = heif_region_rasterize(regions[r], bitmap.data(), width, height, stride, 1);
+    REQUIRE(err.code == heif_error_Ok);
+
+    int num_set = 0;
+    for (uint32_t y = 0; y < height; y++) {
+      for (uint32_t x = 0; x < width; x++) {
+        int n = heif_region_item_find_regions_at(item, (int32_t) x, (int32_t) y, indices, 6);
+        bool contained = std::find(indices, indices + n, r) != indices + n;
+        REQUIRE((bitmap[y * stride + x] == 1) == contained);
+        num_set += bitmap[y * stride + x];
+      }
+
+      for (size_t x = width; x < stride; x++) {
+        REQUIRE(bitmap[y * stride + x] == 0);
+      }
+    }
+
+    REQUIRE(num_set > 0);
+  }
+
+  heif_region_release_many(regions, 6);
+
+  // all regions into one bitmap
+
+  std::vector<uint8_t> bitmap(width * height);
+  err = heif_region_item_rasterize(item, bitmap.data(), width, height, width, 255);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(bitmap[4 * width + 3] == 255);
+  REQUIRE(bitmap[4 * width + 6] == 0);
+  REQUIRE(bitmap[35 * width + 35] == 255);
+
+  heif_region_item_release(item);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
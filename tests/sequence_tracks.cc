@@ -0,0 +1,233 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2023 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Parsing of image sequence tracks. The frames cannot be decoded without a codec, hence only
+// the sample table lookup and the track information are checked.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "libheif/track.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <sstream>
+#include <vector>
+
+
+static Bytes table(std::initializer_list<uint32_t> values)
+{
+  Bytes data;
+  for (uint32_t value : values) {
+    put32(data, value);
+  }
+  return data;
+}
+
+
+// An AV1 track with 5 samples in 2 chunks (2 + 3 samples), sync samples 1 and 4,
+// and a composition offset for the first two samples.
+static Bytes create_moov_box()
+{
+  Bytes mvhd = table({0, 0, 1000, 700});
+  mvhd.resize(mvhd.size() + 80);
+
+  Bytes tkhd = table({0, 0, 1, 0, 700, 0, 0, 0, 0});
+  tkhd.resize(tkhd.size() + 36);
+  put32(tkhd, 64 << 16);
+  put32(tkhd, 48 << 16);
+
+  Bytes mdhd = table({0, 0, 1000, 700});
+  put32(mdhd, 0);
+
+  Bytes hdlr = table({0, 0x70696374 /* 'pict' */, 0, 0, 0});
+  hdlr.push_back(0);
+
+  Bytes sample_entry(6);
+  put16(sample_entry, 1); // data_reference_index
+  sample_entry.resize(sample_entry.size() + 16);
+  put16(sample_entry, 64);
+  put16(sample_entry, 48);
+  put32(sample_entry, 0x00480000);
+  put32(sample_entry, 0x00480000);
+  put32(sample_entry, 0);
+  put16(sample_entry, 1);
+  sample_entry.resize(sample_entry.size() + 32);
+  put16(sample_entry, 0x18);
+  put16(sample_entry, 0xFFFF);
+  Bytes av1C = make_box("av1C", Bytes{0x81, 0x00, 0x0C, 0x00});
+  sample_entry.insert(sample_entry.end(), av1C.begin(), av1C.end());
+
+  Bytes stbl = concat({make_full_box("stsd", 0, concat({table({1}), make_box("av01", sample_entry)})),
+                       make_full_box("stts", 0, table({2, 3, 100, 2, 200})),
+                       make_full_box("ctts", 0, table({2, 2, 50, 3, 0})),
+                       make_full_box("stsc", 0, table({2, 1, 2, 1, 2, 3, 1})),
+                       make_full_box("stsz", 0, table({0, 5, 10, 20, 30, 40, 50})),
+                       make_full_box("stco", 0, table({2, 1000, 2000})),
+                       make_full_box("stss", 0, table({2, 1, 4}))});
+
+  Bytes mdia = concat({make_full_box("mdhd", 0, mdhd),
+                       make_full_box("hdlr", 0, hdlr),
+                       make_box("minf", make_box("stbl", stbl))});
+
+  Bytes trak = concat({make_full_box("tkhd", 0, tkhd),
+                       make_box("mdia", mdia)});
+
+  return make_box("moov", concat({make_full_box("mvhd", 0, mvhd),
+                                  make_box("trak", trak)}));
+}
+
+
+static void check_samples(const std::shared_ptr<StreamReader>& reader, uint64_t size)
+{
+  BitstreamRange range(reader, size);
+  std::shared_ptr<Box> box;
+  Error err = Box::read(range, &box);
+  REQUIRE(!err);
+
+  auto trak = std::dynamic_pointer_cast<Box_trak>(box->get_child_box(fourcc("trak")));
+  REQUIRE(trak);
+
+  std::shared_ptr<Track> track;
+  err = Track::create(trak, track);
+  REQUIRE(!err);
+
+  REQUIRE(track->get_id() == 1);
+  REQUIRE(track->get_width() == 64);
+  REQUIRE(track->get_height() == 48);
+  REQUIRE(track->get_timescale() == 1000);
+  REQUIRE(track->get_compression_format() == heif_compression_AV1);
+  REQUIRE(track->get_num_samples() == 5);
+  REQUIRE(!track->has_only_sync_samples());
+
+  struct Expected
+  {
+    uint64_t offset;
+    uint32_t size;
+    uint64_t decoding_time;
+    int64_t presentation_time;
+    uint32_t duration;
+    bool is_sync;
+  };
+
+  const Expected expected[] = {
+      {1000, 10, 0, 50, 100, true},
+      {1010, 20, 100, 150, 100, false},
+      {2000, 30, 200, 200, 100, false},
+      {2030, 40, 300, 300, 200, true},
+      {2070, 50, 500, 500, 200, false},
+  };
+
+  Track::SampleCursor cursor = track->get_samples();
+  for (uint32_t i = 0; i < 5; i++) {
+    REQUIRE(!cursor.at_end());
+
+    Track::Sample sample{};
+    err = cursor.get_sample(sample);
+    REQUIRE(!err);
+
+    REQUIRE(sample.index == i);
+    REQUIRE(sample.offset == expected[i].offset);
+    REQUIRE(sample.size == expected[i].size);
+    REQUIRE(sample.decoding_time == expected[i].decoding_time);
+    REQUIRE(sample.presentation_time == expected[i].presentation_time);
+    REQUIRE(sample.duration == expected[i].duration);
+    REQUIRE(sample.is_sync == expected[i].is_sync);
+
+    cursor.advance();
+  }
+
+  REQUIRE(cursor.at_end());
+}
+
+
+TEST_CASE("sample table lookup")
+{
+  Bytes moov = create_moov_box();
+
+  // the sample tables point into the file data
+  check_samples(std::make_shared<StreamReader_memory>(moov.data(), moov.size(), false), moov.size());
+
+  // the sample tables are copied
+  std::unique_ptr<std::istream> stream(new std::istringstream(std::string(moov.begin(), moov.end())));
+  check_samples(std::make_shared<StreamReader_istream>(std::move(stream)), moov.size());
+}
+
+
+TEST_CASE("sequence track info")
+{
+  // a file with a primary image and the track
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = nullptr;
+  err = heif_image_create(16, 16, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_Y, 16, 16, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  Bytes file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_release(img);
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+
+  Bytes moov = create_moov_box();
+  file.insert(file.end(), moov.begin(), moov.end());
+
+
+  ctx = heif_context_alloc();
+  err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  REQUIRE(heif_context_number_of_sequence_tracks(ctx) == 1);
+
+  uint32_t track_id = 0;
+  REQUIRE(heif_context_get_sequence_track_IDs(ctx, &track_id, 1) == 1);
+  REQUIRE(track_id == 1);
+
+  heif_sequence_track_info info{};
+  err = heif_context_get_sequence_track_info(ctx, track_id, &info);
+  REQUIRE(err.code == heif_error_Ok);
+  REQUIRE(info.width == 64);
+  REQUIRE(info.height == 48);
+  REQUIRE(info.timescale == 1000);
+  REQUIRE(info.duration == 700);
+  REQUIRE(info.number_of_frames == 5);
+  REQUIRE(info.compression == heif_compression_AV1);
+
+  err = heif_context_get_sequence_track_info(ctx, 2, &info);
+  REQUIRE(err.code == heif_error_Usage_error);
+
+  heif_context_free(ctx);
+}
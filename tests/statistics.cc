@@ -0,0 +1,177 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// The process-wide statistics. The counters are shared by all tests in this binary, hence the tests
+// reset them first and only check values that are caused by their own calls.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static const int kWidth = 64;
+static const int kHeight = 32;
+
+
+static std::vector<uint8_t> create_test_file()
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_monochrome, heif_chroma_monochrome, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_Y, kWidth, kHeight, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* data = heif_image_get_plane(img, heif_channel_Y, &stride);
+  for (int y = 0; y < kHeight; y++) {
+    memset(data + y * stride, y * 4, kWidth);
+  }
+
+  heif_context* ctx = heif_context_alloc();
+  heif_encoder* encoder = nullptr;
+  err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  std::vector<uint8_t> file;
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_image_release(img);
+  heif_context_free(ctx);
+  return file;
+}
+
+
+static void decode_to_rgb(const std::vector<uint8_t>& file)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = nullptr;
+  err = heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_release(img);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("Decoding updates the statistics")
+{
+  std::vector<uint8_t> file = create_test_file();
+
+  heif_reset_statistics();
+  decode_to_rgb(file);
+
+  heif_statistics stats;
+  heif_get_statistics(&stats);
+  REQUIRE(stats.images_decoded == 1);
+  REQUIRE(stats.decoder_instances_created == 0); // the uncompressed codec is not a decoder plugin
+  REQUIRE(stats.bytes_read > 0);
+  REQUIRE(stats.pixels_converted >= uint64_t(kWidth * kHeight));
+  REQUIRE(stats.plane_allocations >= 1);
+  REQUIRE(stats.plane_bytes_allocated >= uint64_t(kWidth * kHeight * 3));
+  REQUIRE(stats.conversion_pipeline_cache_hits + stats.conversion_pipeline_cache_misses >= 1);
+
+  int num_operations = heif_get_color_conversion_statistics(nullptr, 0);
+  REQUIRE(num_operations > 0);
+
+  std::vector<heif_color_conversion_statistics> op_stats(num_operations);
+  REQUIRE(heif_get_color_conversion_statistics(op_stats.data(), num_operations) == num_operations);
+
+  uint64_t num_conversions = 0;
+  uint64_t num_pixels = 0;
+  for (const auto& op : op_stats) {
+    REQUIRE(op.operation_name != nullptr);
+    REQUIRE(std::string(op.operation_name).empty() == false);
+    num_conversions += op.num_conversions;
+    num_pixels += op.num_pixels;
+  }
+  REQUIRE(num_conversions >= 1);
+  REQUIRE(num_pixels == stats.pixels_converted);
+
+  heif_reset_statistics();
+  heif_get_statistics(&stats);
+  REQUIRE(stats.images_decoded == 0);
+  REQUIRE(stats.bytes_read == 0);
+  REQUIRE(stats.pixels_converted == 0);
+
+  heif_get_color_conversion_statistics(op_stats.data(), num_operations);
+  for (const auto& op : op_stats) {
+    REQUIRE(op.num_conversions == 0);
+  }
+}
+
+
+TEST_CASE("Counts from several threads are summed up")
+{
+  std::vector<uint8_t> file = create_test_file();
+
+  const int kNumThreads = 4;
+  const int kDecodesPerThread = 5;
+
+  heif_reset_statistics();
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&file]() {
+      for (int i = 0; i < kDecodesPerThread; i++) {
+        heif_context* ctx = heif_context_alloc();
+        heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+        heif_image_handle* handle = nullptr;
+        heif_context_get_primary_image_handle(ctx, &handle);
+        heif_image* img = nullptr;
+        heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+        heif_image_release(img);
+        heif_image_handle_release(handle);
+        heif_context_free(ctx);
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  heif_statistics stats;
+  heif_get_statistics(&stats);
+  REQUIRE(stats.images_decoded == uint64_t(kNumThreads * kDecodesPerThread));
+}
@@ -0,0 +1,237 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Helpers shared by the unit tests.
+
+#ifndef LIBHEIF_TEST_HELPERS_H
+#define LIBHEIF_TEST_HELPERS_H
+
+#include "libheif/heif.h"
+#include "libheif/heif_plugin.h"
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+
+// --- building files box by box, for inputs that the encoder does not write
+
+typedef std::vector<uint8_t> Bytes;
+
+
+inline void put16(Bytes& data, uint32_t value)
+{
+  data.push_back(static_cast<uint8_t>(value >> 8));
+  data.push_back(static_cast<uint8_t>(value));
+}
+
+
+inline void put32(Bytes& data, uint32_t value)
+{
+  put16(data, value >> 16);
+  put16(data, value & 0xFFFF);
+}
+
+
+inline void put_fourcc(Bytes& data, const char* type)
+{
+  data.insert(data.end(), type, type + 4);
+}
+
+
+inline Bytes make_box(const char* type, const Bytes& content)
+{
+  Bytes box;
+  put32(box, static_cast<uint32_t>(content.size() + 8));
+  put_fourcc(box, type);
+  box.insert(box.end(), content.begin(), content.end());
+  return box;
+}
+
+
+inline Bytes make_full_box(const char* type, uint8_t version, const Bytes& content)
+{
+  Bytes full_content;
+  put32(full_content, static_cast<uint32_t>(version) << 24);
+  full_content.insert(full_content.end(), content.begin(), content.end());
+  return make_box(type, full_content);
+}
+
+
+inline Bytes concat(std::initializer_list<Bytes> parts)
+{
+  Bytes result;
+  for (const Bytes& part : parts) {
+    result.insert(result.end(), part.begin(), part.end());
+  }
+  return result;
+}
+
+
+
+// --- writing files into memory
+
+// A heif_writer function that appends the data to the std::vector<uint8_t> passed as 'userdata'.
+inline heif_error write_to_vector(struct heif_context*, const void* data, size_t size, void* userdata)
+{
+  auto* out = static_cast<std::vector<uint8_t>*>(userdata);
+  out->insert(out->end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+  return {heif_error_Ok, heif_suberror_Unspecified, "Success"};
+}
+
+
+// --- a fake AV1 encoder plugin, which only passes the images that it receives to the test
+
+namespace test_encoder {
+  inline heif_error ok() { return {heif_error_Ok, heif_suberror_Unspecified, "Success"}; }
+
+  inline const char* plugin_name() { return "test encoder"; }
+
+  inline heif_error new_encoder(void** encoder)
+  {
+    static int dummy;
+    *encoder = &dummy;
+    return ok();
+  }
+
+  inline void free_encoder(void*) {}
+
+  inline heif_error set_int(void*, int) { return ok(); }
+
+  inline heif_error get_int(void*, int* value)
+  {
+    *value = 0;
+    return ok();
+  }
+
+  inline const heif_encoder_parameter** list_parameters(void*)
+  {
+    static const heif_encoder_parameter* parameters[] = {nullptr};
+    return parameters;
+  }
+
+  inline heif_error set_named_int(void*, const char*, int) { return ok(); }
+
+  inline heif_error get_named_int(void*, const char*, int*) { return ok(); }
+
+  inline heif_error set_string(void*, const char*, const char*) { return ok(); }
+
+  inline heif_error get_string(void*, const char*, char*, int) { return ok(); }
+
+  inline void query_input_colorspace(heif_colorspace* colorspace, heif_chroma* chroma)
+  {
+    *colorspace = heif_colorspace_YCbCr;
+    *chroma = heif_chroma_420;
+  }
+
+  inline void query_input_colorspace2(void*, heif_colorspace* colorspace, heif_chroma* chroma)
+  {
+    query_input_colorspace(colorspace, chroma);
+  }
+
+  inline heif_error get_compressed_data(void*, uint8_t** data, int* size, heif_encoded_data_type*)
+  {
+    *data = nullptr;
+    *size = 0;
+    return ok();
+  }
+}
+
+
+// The plugin requests YCbCr 4:2:0 input and produces no data. 'encode_image' receives the images.
+// 'supports_monochrome' is only used by plugins of API version 6 and later.
+inline heif_encoder_plugin create_test_encoder_plugin(int plugin_api_version, const char* id_name,
+                                                      heif_error (* encode_image)(void* encoder, const heif_image* image,
+                                                                                  heif_image_input_class image_class),
+                                                      int (* supports_monochrome)(void* encoder) = nullptr)
+{
+  using namespace test_encoder;
+
+  return {
+      plugin_api_version,
+      heif_compression_AV1,
+      id_name,
+      0,
+      true,
+      false,
+      plugin_name,
+      nullptr,
+      nullptr,
+      new_encoder,
+      free_encoder,
+      set_int,
+      get_int,
+      set_int,
+      get_int,
+      set_int,
+      get_int,
+      list_parameters,
+      set_named_int,
+      get_named_int,
+      set_named_int,
+      get_named_int,
+      set_string,
+      get_string,
+      query_input_colorspace,
+      encode_image,
+      get_compressed_data,
+      query_input_colorspace2,
+      nullptr,
+      nullptr,
+      nullptr,
+      supports_monochrome
+  };
+}
+
+
+// Registers 'plugin' (which has to stay alive) on first use and returns an encoder instance of it.
+// Returns nullptr if this fails.
+inline heif_encoder* get_test_encoder(heif_context* ctx, const heif_encoder_plugin& plugin)
+{
+  static std::vector<const heif_encoder_plugin*> registered_plugins;
+
+  if (std::find(registered_plugins.begin(), registered_plugins.end(), &plugin) == registered_plugins.end()) {
+    if (heif_register_encoder_plugin(&plugin).code != heif_error_Ok) {
+      return nullptr;
+    }
+
+    registered_plugins.push_back(&plugin);
+  }
+
+  const heif_encoder_descriptor* descriptor = nullptr;
+  if (heif_get_encoder_descriptors(heif_compression_AV1, plugin.id_name, &descriptor, 1) != 1) {
+    return nullptr;
+  }
+
+  heif_encoder* encoder = nullptr;
+  if (heif_context_get_encoder(ctx, descriptor, &encoder).code != heif_error_Ok) {
+    return nullptr;
+  }
+
+  return encoder;
+}
+
+#endif
@@ -0,0 +1,194 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Grid tiles that share their codec configuration are passed to the decoder plugin as one image
+// sequence (decode_image_sequence()). The tests need an encoder and the decoder plugin of the
+// format. If they are not available in this build, the test is skipped.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+
+static const int kTileSize = 64;
+static const int kTileColumns = 3;
+static const int kTileRows = 2;
+static const int kWidth = kTileSize * kTileColumns;
+static const int kHeight = kTileSize * kTileRows;
+
+
+// Each tile has a different gray level, such that tiles pasted at the wrong position are detected.
+static uint8_t tile_value(int tile_x, int tile_y)
+{
+  return static_cast<uint8_t>(30 + 40 * (tile_y * kTileColumns + tile_x));
+}
+
+
+static heif_image* create_image()
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, kWidth, kHeight, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth * 3; x++) {
+      p[y * stride + x] = tile_value(x / 3 / kTileSize, y / kTileSize);
+    }
+  }
+
+  return img;
+}
+
+
+static bool have_decoder(heif_compression_format format, const char* decoder_id)
+{
+  const heif_decoder_descriptor* decoders[10];
+  int num_decoders = heif_get_decoder_descriptors(format, decoders, 10);
+  for (int i = 0; i < num_decoders; i++) {
+    const char* id = heif_decoder_descriptor_get_id_name(decoders[i]);
+    if (id && strcmp(id, decoder_id) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+// Returns false if there is no encoder for the format.
+static bool encode_grid(heif_compression_format format, Bytes& file)
+{
+  heif_context* ctx = heif_context_alloc();
+
+  heif_encoder* encoder = nullptr;
+  heif_error err = heif_context_get_encoder_for_format(ctx, format, &encoder);
+  if (err.code != heif_error_Ok) {
+    heif_context_free(ctx);
+    return false;
+  }
+
+  heif_encoder_set_lossy_quality(encoder, 90);
+
+  heif_image* input = create_image();
+  err = heif_context_encode_grid(ctx, input, kTileSize, kTileSize, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_image_release(input);
+
+  file.clear();
+  heif_writer writer{1, write_to_vector};
+  err = heif_context_write(ctx, &writer, &file);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_context_free(ctx);
+  return true;
+}
+
+
+static void decode_grid(const Bytes& file, const char* decoder_id, int num_threads)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_context_set_max_decoding_threads(ctx, num_threads);
+  heif_error err = heif_context_read_from_memory_without_copy(ctx, file.data(), file.size(), nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_decoding_options* options = heif_decoding_options_alloc();
+  options->decoder_id = decoder_id;
+
+  heif_image* decoded = nullptr;
+  err = heif_decode_image(handle, &decoded, heif_colorspace_RGB, heif_chroma_interleaved_RGB, options);
+  REQUIRE(err.code == heif_error_Ok);
+  heif_decoding_options_free(options);
+
+  REQUIRE(heif_image_get_width(decoded, heif_channel_interleaved) == kWidth);
+  REQUIRE(heif_image_get_height(decoded, heif_channel_interleaved) == kHeight);
+
+  // The tiles are lossy, but flat areas stay close to their gray level.
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(decoded, heif_channel_interleaved, &stride);
+  for (int tile_y = 0; tile_y < kTileRows; tile_y++) {
+    for (int tile_x = 0; tile_x < kTileColumns; tile_x++) {
+      CAPTURE(tile_x, tile_y);
+
+      long sum = 0;
+      for (int y = tile_y * kTileSize; y < (tile_y + 1) * kTileSize; y++) {
+        for (int x = tile_x * kTileSize * 3; x < (tile_x + 1) * kTileSize * 3; x++) {
+          sum += p[y * stride + x];
+        }
+      }
+
+      long mean = sum / (kTileSize * kTileSize * 3);
+      REQUIRE(std::labs(mean - tile_value(tile_x, tile_y)) <= 8);
+    }
+  }
+
+  heif_image_release(decoded);
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+static void test_tile_sequence(heif_compression_format format, const char* decoder_id)
+{
+  heif_init(nullptr);
+
+  Bytes file;
+  if (!have_decoder(format, decoder_id) || !encode_grid(format, file)) {
+    WARN("skipped, no encoder or no '" << decoder_id << "' decoder");
+    heif_deinit();
+    return;
+  }
+
+  int num_threads = GENERATE(0, 4);
+  CAPTURE(num_threads);
+  decode_grid(file, decoder_id, num_threads);
+
+  heif_deinit();
+}
+
+
+TEST_CASE("HEVC grid tiles decoded as a sequence by libde265")
+{
+  test_tile_sequence(heif_compression_HEVC, "libde265");
+}
+
+
+TEST_CASE("AV1 grid tiles decoded as a sequence by dav1d")
+{
+  test_tile_sequence(heif_compression_AV1, "dav1d");
+}
@@ -0,0 +1,284 @@
+/*
+  libheif unit tests
+
+  MIT License
+
+  Copyright (c) 2025 Dirk Farin <dirk.farin@gmail.com>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+// Adding metadata with heif_context_update_file_in_place(). The updated files are read again
+// and the boxes of the original image data must not have been touched.
+
+#include "catch.hpp"
+#include "libheif/heif.h"
+#include "test_helpers.h"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+
+static const char* kTestFile = "update_in_place_test.heif";
+
+static const int kWidth = 64;
+static const int kHeight = 64;
+
+
+static void write_test_file()
+{
+  heif_image* img = nullptr;
+  heif_error err = heif_image_create(kWidth, kHeight, heif_colorspace_RGB, heif_chroma_interleaved_RGB, &img);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_image_add_plane(img, heif_channel_interleaved, kWidth, kHeight, 8);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  uint8_t* p = heif_image_get_plane(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth * 3; x++) {
+      p[y * stride + x] = static_cast<uint8_t>(x * 5 + y * 3);
+    }
+  }
+
+  heif_context* ctx = heif_context_alloc();
+  heif_encoder* encoder = nullptr;
+  err = heif_context_get_encoder_for_format(ctx, heif_compression_uncompressed, &encoder);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_context_encode_image(ctx, img, encoder, nullptr, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+  err = heif_context_write_to_file(ctx, kTestFile);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_encoder_release(encoder);
+  heif_image_release(img);
+  heif_context_free(ctx);
+}
+
+
+static Bytes read_file(const char* filename)
+{
+  std::ifstream istr(filename, std::ios::binary);
+  REQUIRE(istr.good());
+  return Bytes(std::istreambuf_iterator<char>(istr), std::istreambuf_iterator<char>());
+}
+
+
+struct TopLevelBox
+{
+  std::string type;
+  uint64_t offset;
+  uint64_t size;
+};
+
+static std::vector<TopLevelBox> get_top_level_boxes(const Bytes& file)
+{
+  auto read32 = [&file](uint64_t pos) {
+    return (uint32_t(file[pos]) << 24) | (uint32_t(file[pos + 1]) << 16) |
+           (uint32_t(file[pos + 2]) << 8) | uint32_t(file[pos + 3]);
+  };
+
+  std::vector<TopLevelBox> boxes;
+
+  uint64_t pos = 0;
+  while (pos + 8 <= file.size()) {
+    TopLevelBox box;
+    box.offset = pos;
+    box.size = read32(pos);
+    box.type = std::string(file.begin() + pos + 4, file.begin() + pos + 8);
+
+    if (box.size == 1) {
+      REQUIRE(pos + 16 <= file.size());
+      box.size = (uint64_t(read32(pos + 8)) << 32) | read32(pos + 12);
+    }
+
+    REQUIRE(box.size >= 8);
+    REQUIRE(pos + box.size <= file.size());
+    boxes.push_back(box);
+    pos += box.size;
+  }
+
+  REQUIRE(pos == file.size());
+  return boxes;
+}
+
+static std::vector<std::string> box_types(const std::vector<TopLevelBox>& boxes)
+{
+  std::vector<std::string> types;
+  for (const auto& box : boxes) {
+    types.push_back(box.type);
+  }
+  return types;
+}
+
+static const TopLevelBox& find_box(const std::vector<TopLevelBox>& boxes, const char* type)
+{
+  auto it = std::find_if(boxes.begin(), boxes.end(), [type](const TopLevelBox& box) { return box.type == type; });
+  REQUIRE(it != boxes.end());
+  return *it;
+}
+
+
+// The 'mdat' boxes of 'before' must be at the same position and unchanged in 'after'.
+static void require_mdat_unchanged(const Bytes& before, const Bytes& after)
+{
+  for (const auto& box : get_top_level_boxes(before)) {
+    if (box.type == "mdat") {
+      REQUIRE(box.offset + box.size <= after.size());
+      REQUIRE(std::equal(before.begin() + box.offset, before.begin() + box.offset + box.size,
+                         after.begin() + box.offset));
+    }
+  }
+}
+
+
+static void add_metadata_in_place(const char* item_type, const Bytes& data)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_file(ctx, kTestFile, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_add_generic_metadata(ctx, handle, data.data(), (int) data.size(), item_type, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  err = heif_context_update_file_in_place(ctx, kTestFile);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+// Reads the test file again and checks the image and its metadata.
+static void check_updated_file(const std::vector<Bytes>& expected_metadata)
+{
+  heif_context* ctx = heif_context_alloc();
+  heif_error err = heif_context_read_from_file(ctx, kTestFile, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image_handle* handle = nullptr;
+  err = heif_context_get_primary_image_handle(ctx, &handle);
+  REQUIRE(err.code == heif_error_Ok);
+
+  heif_image* img = nullptr;
+  err = heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGB, nullptr);
+  REQUIRE(err.code == heif_error_Ok);
+
+  int stride;
+  const uint8_t* p = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth * 3; x++) {
+      REQUIRE(p[y * stride + x] == static_cast<uint8_t>(x * 5 + y * 3));
+    }
+  }
+  heif_image_release(img);
+
+  int num_metadata = heif_image_handle_get_number_of_metadata_blocks(handle, nullptr);
+  REQUIRE(num_metadata == (int) expected_metadata.size());
+
+  std::vector<heif_item_id> ids(num_metadata);
+  heif_image_handle_get_list_of_metadata_block_IDs(handle, nullptr, ids.data(), num_metadata);
+
+  std::vector<Bytes> metadata;
+  for (heif_item_id id : ids) {
+    Bytes data(heif_image_handle_get_metadata_size(handle, id));
+    err = heif_image_handle_get_metadata(handle, id, data.data());
+    REQUIRE(err.code == heif_error_Ok);
+    metadata.push_back(data);
+  }
+
+  for (const Bytes& expected : expected_metadata) {
+    REQUIRE(std::find(metadata.begin(), metadata.end(), expected) != metadata.end());
+  }
+
+  heif_image_handle_release(handle);
+  heif_context_free(ctx);
+}
+
+
+TEST_CASE("update in place: meta moved to the end of the file")
+{
+  write_test_file();
+
+  Bytes original = read_file(kTestFile);
+  std::vector<TopLevelBox> original_boxes = get_top_level_boxes(original);
+  REQUIRE(box_types(original_boxes) == std::vector<std::string>{"ftyp", "meta", "mdat"});
+  const TopLevelBox old_meta = find_box(original_boxes, "meta");
+
+  // The new item makes the 'meta' box larger and there is no 'free' box behind it.
+  Bytes xmp(300, 'x');
+  add_metadata_in_place("mime", xmp);
+
+  Bytes updated = read_file(kTestFile);
+  std::vector<TopLevelBox> boxes = get_top_level_boxes(updated);
+  REQUIRE(box_types(boxes) == std::vector<std::string>{"ftyp", "free", "mdat", "mdat", "meta", "free"});
+
+  // The old 'meta' box became a 'free' box of the same size.
+  REQUIRE(boxes[1].offset == old_meta.offset);
+  REQUIRE(boxes[1].size == old_meta.size);
+
+  // The new item data was appended behind the old end of the file.
+  REQUIRE(boxes[3].offset == original.size());
+  REQUIRE(boxes[3].size == 8 + xmp.size());
+
+  require_mdat_unchanged(original, updated);
+  check_updated_file({xmp});
+}
+
+
+TEST_CASE("update in place: meta fits, trailing free box")
+{
+  write_test_file();
+
+  // Moves the 'meta' box to the end of the file, followed by a 'free' box for later updates.
+  Bytes xmp(300, 'x');
+  add_metadata_in_place("mime", xmp);
+
+  Bytes before = read_file(kTestFile);
+  std::vector<TopLevelBox> boxes_before = get_top_level_boxes(before);
+  REQUIRE(box_types(boxes_before) == std::vector<std::string>{"ftyp", "free", "mdat", "mdat", "meta", "free"});
+  const TopLevelBox old_meta = boxes_before[4];
+  const TopLevelBox old_free = boxes_before[5];
+
+  Bytes iptc(200, 'i');
+  add_metadata_in_place("iptc", iptc);
+
+  Bytes updated = read_file(kTestFile);
+  std::vector<TopLevelBox> boxes = get_top_level_boxes(updated);
+  REQUIRE(box_types(boxes) == std::vector<std::string>{"ftyp", "free", "mdat", "mdat", "meta", "free", "mdat"});
+
+  // The 'meta' box grew into the 'free' box, which still fills the rest of the old space.
+  REQUIRE(boxes[4].offset == old_meta.offset);
+  REQUIRE(boxes[4].size > old_meta.size);
+  REQUIRE(boxes[5].offset == boxes[4].offset + boxes[4].size);
+  REQUIRE(boxes[4].size + boxes[5].size == old_meta.size + old_free.size);
+
+  REQUIRE(boxes[6].offset == before.size());
+  REQUIRE(boxes[6].size == 8 + iptc.size());
+
+  require_mdat_unchanged(before, updated);
+  check_updated_file({xmp, iptc});
+}